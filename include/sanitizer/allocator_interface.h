@@ -14,6 +14,26 @@
 
 #include <stddef.h>
 
+/* Statistics of one size class of the allocator, see
+   __sanitizer_get_allocator_histogram(). The per-thread caches publish their
+   allocation and deallocation counts in batches, so these may lag behind by
+   a few hundred per thread. */
+struct __sanitizer_allocator_class_stats {
+  size_t size;                    /* Chunk size of the class. */
+  size_t mapped_bytes;            /* Bytes mapped for the class. */
+  size_t free_chunks;             /* Free chunks held by the allocator, not
+                                     counting the per-thread caches. */
+  unsigned long long allocs;      /* Allocations of chunks of the class. */
+  unsigned long long frees;       /* Deallocations of chunks of the class. */
+  unsigned long long cache_refills;  /* Allocations which had to refill the
+                                        per-thread cache. */
+  unsigned long long cache_drains;   /* Transfers of chunks from the
+                                        per-thread caches back to the
+                                        allocator. */
+  unsigned long long refill_samples; /* Number of timed refills. */
+  unsigned long long refill_ns;      /* Total time of the timed refills. */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -60,6 +80,17 @@ extern "C" {
   void __sanitizer_malloc_hook(const volatile void *ptr, size_t size);
   void __sanitizer_free_hook(const volatile void *ptr);
 
+  /* Fills stats with the statistics of up to max_classes size classes of the
+     allocator, from the smallest one. Returns the number of entries filled,
+     0 if the allocator of the tool has no size classes. */
+  size_t __sanitizer_get_allocator_histogram(
+      struct __sanitizer_allocator_class_stats *stats, size_t max_classes);
+
+  /* Prints the size class statistics to stderr: for each class in use the
+     number of allocations, the hit ratio of the per-thread caches, the mean
+     refill latency and the fraction of the mapped memory not in use. */
+  void __sanitizer_print_allocator_histogram();
+
   /* Installs a pair of hooks for malloc/free.
      Several (currently, 5) hook pairs may be installed, they are executed
      in the order they were installed and after calling
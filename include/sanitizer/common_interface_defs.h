@@ -155,6 +155,11 @@ extern "C" {
                                     const void *s1, size_t len1,
                                     const void *s2, size_t len2, void *result);
 
+  // Prints the cycles that the runtime spent in its interceptors, stack
+  // unwinding, stack depot, quarantine and symbolizer so far. The counts are
+  // only collected with self_profile=1. Also printed at exit then.
+  void __sanitizer_print_self_profile();
+
   // Prints stack traces for all live heap allocations ordered by total
   // allocation size until `top_percent` of total live heap is shown.
   // `top_percent` should be between 1 and 100.
@@ -163,6 +168,17 @@ extern "C" {
   void __sanitizer_print_memory_profile(size_t top_percent,
                                         size_t max_number_of_contexts);
 
+  // Writes a binary profile of the live heap allocations to `fd` (same
+  // convention as in __sanitizer_set_report_fd): the total size and count of
+  // the allocations of every allocation stack, keyed by a stack id that is
+  // stable for the process lifetime, followed by the unsymbolized stacks.
+  // Only about one chunk in `sample_rate` is inspected and the totals are
+  // scaled accordingly; the allocator is locked while the chunks are
+  // iterated, but other threads are not stopped. The format is described in
+  // asan_memory_profile.cc. Returns non-zero on success.
+  // Experimental feature currently available only with asan.
+  int __sanitizer_write_memory_profile(void *fd, size_t sample_rate);
+
   // Fiber annotation interface.
   // Before switching to a different stack, one must call
   // __sanitizer_start_switch_fiber with a pointer to the bottom of the
@@ -46,6 +46,38 @@ extern "C" {
   // Some of the entries in *data will be zero.
   uintptr_t __sanitizer_get_coverage_guards(uintptr_t **data);
 
+  // Unless the program defines its own __sanitizer_cov_trace_cmp* and
+  // __sanitizer_cov_trace_switch hooks, the operands of the comparisons
+  // instrumented with -fsanitize-coverage=trace-cmp are kept in a table
+  // indexed by a hash of the comparison's PC. Each entry holds the latest
+  // operands of one comparison; for a switch, arg2 is the case value closest
+  // to the switch value. Entries with a zero pc are unused. Entries are
+  // updated without synchronization and may be torn under concurrency.
+  struct __sanitizer_cmp_feedback {
+    uintptr_t pc;
+    uint64_t arg1;
+    uint64_t arg2;
+    // Size of the operands in bytes.
+    uint64_t size;
+  };
+  // Set *entries to the table and return its number of entries.
+  uintptr_t __sanitizer_get_cmp_feedback(
+      const struct __sanitizer_cmp_feedback **entries);
+  // Clear the table.
+  void __sanitizer_reset_cmp_feedback();
+
+  // With the live_coverage_file sancov flag set, trace-pc-guard coverage is
+  // kept in that file as it is collected: a 64-byte header, whose second and
+  // third 64-bit words are the number of guards and the number of guards
+  // first hit since the last reset, then a byte per guard that is 1 once the
+  // guard was hit and 2 if it was first hit since the last reset.
+  // Set *map to the bytes and return the number of guards, or 0 if the flag
+  // is not set.
+  uintptr_t __sanitizer_get_live_coverage(const uint8_t **map);
+  // Mark the guards first hit since the last reset as hit before, and return
+  // their number.
+  uintptr_t __sanitizer_reset_live_coverage();
+
   // The coverage instrumentation may optionally provide imprecise counters.
   // Rather than exposing the counter values to the user we instead map
   // the counters to a bitset.
@@ -91,6 +91,26 @@ void dfsan_set_write_callback(dfsan_write_callback_t labeled_write_callback);
 /// <label> <parent label 1> <parent label 2> <label description if any>
 void dfsan_dump_labels(int fd);
 
+/// The record of a label in the output of dfsan_dump_new_labels. It is
+/// followed by the desc_size bytes of the label description, which is not
+/// NUL-terminated and is truncated to 65535 bytes. desc_size is 0 for union
+/// labels and for base labels without a description.
+struct dfsan_dumped_label {
+  dfsan_label label;
+  dfsan_label l1;
+  dfsan_label l2;
+  uint16_t desc_size;
+};
+
+/// Writes the labels created since the previous call (or since the program
+/// start) to the given file descriptor, as dfsan_dumped_label records in the
+/// order of the labels and in host byte order, and returns the number of
+/// labels written. Each label is dumped once, so the output of successive
+/// calls appended together forms the whole label table; the parents of a
+/// union label always come before it. Labels that other threads are creating
+/// during the call may be dumped before their parents are stored.
+size_t dfsan_dump_new_labels(int fd);
+
 /// Interceptor hooks.
 /// Whenever a dfsan's custom function is called the corresponding
 /// hook is called it non-zero. The hooks should be defined by the user.
@@ -104,6 +104,20 @@ extern "C" {
      copy. Source and destination regions can overlap. */
   void __msan_copy_shadow(const volatile void *dst, const volatile void *src,
                           size_t size);
+
+  /* Save the shadow and origins of all application memory, to be restored
+     with __msan_restore_shadow_snapshot, e.g. at the end of each iteration of
+     an in-process fuzzer. Only the pages written in between are restored; this
+     uses the soft-dirty bits of the process (Linux only). Returns 0 on
+     success. */
+  int __msan_take_shadow_snapshot(void);
+
+  /* Restore the shadow and origins saved by the last
+     __msan_take_shadow_snapshot. The program must be back to the state it was
+     in then: memory allocated or initialized since, and still in use, gets
+     the shadow of that time. Other threads must not run. Returns 0 on
+     success. */
+  int __msan_restore_shadow_snapshot(void);
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -0,0 +1,60 @@
+//===-- sanitizer/scudo_interface.h -----------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of the Scudo Hardened Allocator.
+//
+// Public interface header.
+//===----------------------------------------------------------------------===//
+#ifndef SANITIZER_SCUDO_INTERFACE_H
+#define SANITIZER_SCUDO_INTERFACE_H
+
+#include <sanitizer/common_interface_defs.h>
+
+/* Number of buckets of the latency histograms of __scudo_stats. */
+#define __SCUDO_LATENCY_BUCKETS 32
+
+/* Statistics of the allocator, filled by __scudo_get_stats(). The statistics
+   of each size class of the primary allocator are available separately,
+   through __sanitizer_get_allocator_histogram(). */
+struct __scudo_stats {
+  size_t allocated_bytes;         /* Bytes of the chunks allocated from the
+                                     backend, including quarantined ones. */
+  size_t mapped_bytes;            /* Bytes mapped by the backend. */
+  size_t quarantine_bytes;        /* Bytes held by the global quarantine, not
+                                     counting the per-thread caches. */
+  size_t quarantine_max_bytes;    /* Size of the global quarantine. */
+  size_t secondary_chunks;        /* Chunks served by the secondary
+                                     allocator. */
+  size_t secondary_cached_mappings;  /* Mappings of freed secondary chunks
+                                        kept for reuse. */
+  size_t secondary_cached_bytes;     /* Bytes of these mappings. */
+  unsigned long long invalid_headers;  /* Chunk headers which failed their
+                                          checksum. */
+  /* Latencies of the allocations and deallocations sampled with
+     LatencySamplePeriod, in CPU timestamp counter ticks: entry i counts the
+     samples of [2^i, 2^(i+1)) ticks, the last one also the longer ones. */
+  unsigned long long malloc_latency[__SCUDO_LATENCY_BUCKETS];
+  unsigned long long free_latency[__SCUDO_LATENCY_BUCKETS];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  /* Fills stats with the current statistics of the allocator. */
+  void __scudo_get_stats(struct __scudo_stats *stats);
+
+  /* Prints the statistics of the allocator, and of its size classes, to
+     stderr. This is also done every StatsDumpIntervalMs. */
+  void __scudo_print_stats(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // SANITIZER_SCUDO_INTERFACE_H
@@ -114,6 +114,42 @@ void __tsan_mutex_post_signal(void *addr, unsigned flags);
 void __tsan_mutex_pre_divert(void *addr, unsigned flags);
 void __tsan_mutex_post_divert(void *addr, unsigned flags);
 
+// Fibers.
+// A fiber is a user-space context (a coroutine or a task of a cooperative
+// scheduler) that runs on the stack and the OS thread it is switched to.
+// TSan attributes the memory accesses and the synchronization of the code to
+// the current fiber, as if each fiber was a thread:
+// void *fiber = __tsan_create_fiber(0);
+// __tsan_switch_to_fiber(fiber, 0);
+// swapcontext(...);  // or the scheduler's own context switch
+// ...
+// __tsan_destroy_fiber(fiber);  // once the fiber does not run anymore
+
+// Returns the current fiber, or the state of the thread itself if it does not
+// run a fiber. The result can be passed to __tsan_switch_to_fiber to switch
+// back to the thread.
+void *__tsan_get_current_fiber(void);
+
+// Creates a new fiber. The fiber happens-after the creation.
+// Supported flags: none.
+void *__tsan_create_fiber(unsigned flags);
+
+// Destroys a fiber that is not running.
+void __tsan_destroy_fiber(void *fiber);
+
+// Do not synchronize the fibers on the switch: the default switch makes
+// everything the current fiber did happen-before everything the fiber
+// switched to does from now on. Pass this flag if the scheduler synchronizes
+// its tasks by other means, to find the races between them.
+const unsigned __tsan_switch_to_fiber_no_sync = 1 << 0;
+
+// Switches the current thread to the fiber. This must be called right before
+// the actual context switch.
+void __tsan_switch_to_fiber(void *fiber, unsigned flags);
+
+// Sets the name of the fiber in the reports.
+void __tsan_set_fiber_name(void *fiber, const char *name);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
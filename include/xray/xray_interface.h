@@ -48,6 +48,16 @@ enum XRayEntryType {
 // Returns 1 on success, 0 on error.
 extern int __xray_set_handler(void (*entry)(int32_t, XRayEntryType));
 
+// Like __xray_set_handler(), for a handler which does not modify the vector
+// registers (XMM on x86_64, the SIMD&FP registers on AArch64), and neither do
+// its callees; e.g. because it is built with -mgeneral-regs-only and only
+// calls code built the same way. The entry and exit trampolines then skip
+// saving and restoring them around each call. On the other architectures, and
+// while sampling is enabled, this behaves exactly like __xray_set_handler().
+//
+// Returns 1 on success, 0 on error.
+extern int __xray_set_handler_gpr_only(void (*entry)(int32_t, XRayEntryType));
+
 // This removes whatever the currently provided handler is. Returns 1 on
 // success, 0 on error.
 extern int __xray_remove_handler();
@@ -67,6 +77,33 @@ extern XRayPatchingStatus __xray_patch();
 // result values.
 extern XRayPatchingStatus __xray_unpatch();
 
+// Like __xray_patch() and __xray_unpatch(), but return right away and do the
+// patching on a new thread, which calls |Done| (if not null) with the result
+// when it finishes. Returns SUCCESS if the patching was started; ONGOING if
+// some other patching is still in progress.
+extern XRayPatchingStatus
+__xray_patch_in_background(void (*Done)(XRayPatchingStatus));
+extern XRayPatchingStatus
+__xray_unpatch_in_background(void (*Done)(XRayPatchingStatus));
+
+// Returns 1 while a patching or unpatching operation is in progress, 0
+// otherwise.
+extern int __xray_patching_in_progress();
+
+// Like __xray_patch() and __xray_unpatch(), but only for the instrumentation
+// points of the function with the given id. Returns FAILED for an id which has
+// no instrumentation points.
+extern XRayPatchingStatus __xray_patch_function(int32_t FuncId);
+extern XRayPatchingStatus __xray_unpatch_function(int32_t FuncId);
+
+// Only calls the handlers for one in every |Rate| calls to each function,
+// counted separately on each thread, and for the exits of exactly those calls.
+// Exits of calls which were entered before sampling started are always passed
+// on. A |Rate| of 0 or 1 turns sampling off.
+//
+// Returns 1 on success, 0 on error.
+extern int __xray_set_sampling_rate(uint32_t Rate);
+
 // Use XRay to log the first argument of each (instrumented) function call.
 // When this function exits, all threads will have observed the effect and
 // start logging their subsequent affected function calls (if patched).
@@ -46,6 +46,23 @@ XRayLogInitStatus __xray_log_init(size_t BufferSize, size_t MaxBuffers,
 XRayLogInitStatus __xray_log_finalize();
 XRayLogFlushStatus __xray_log_flushLog();
 
+// Custom events are only supported by the FDR mode logging implementation. An
+// event is a payload of |Size| bytes tagged with a user-defined |Type|, which
+// is stored right in the calling thread's buffer along with the function
+// records.
+//
+// __xray_fdr_reserve_custom_event() returns where to write the payload in the
+// buffer, or nullptr if the event can't be logged (e.g. when logging isn't
+// initialized, or the event wouldn't fit in a buffer). The thread doesn't log
+// anything else until __xray_fdr_commit_custom_event() is called, which must
+// happen exactly when the reservation succeeded.
+void *__xray_fdr_reserve_custom_event(uint16_t Type, size_t Size);
+void __xray_fdr_commit_custom_event();
+
+// Copies the payload at |Event| into a custom event. Returns 1 if the event
+// was logged, 0 otherwise.
+int __xray_fdr_log_custom_event(uint16_t Type, const void *Event, size_t Size);
+
 } // extern "C"
 
 namespace __xray {
@@ -55,6 +72,11 @@ struct FDRLoggingOptions {
   int Fd = -1;
 };
 
+// Options used by the LLVM XRay profiling implementation.
+struct ProfilingOptions {
+  int Fd = -1;
+};
+
 } // namespace __xray
 
 #endif // XRAY_XRAY_LOG_INTERFACE_H
@@ -22,6 +22,7 @@ namespace __xray {
 enum FileTypes {
   NAIVE_LOG = 0,
   FDR_LOG = 1,
+  PROFILE = 2,
 };
 
 // FDR mode use of the union field in the XRayFileHeader.
@@ -35,6 +36,17 @@ static_assert(sizeof(FdrAdditionalHeaderData) == 16,
 // This data structure is used to describe the contents of the file. We use this
 // for versioning the supported XRay file formats.
 struct alignas(32) XRayFileHeader {
+  // The version of the format of the records that follow. For FDR_LOG files:
+  //
+  //   1: Fixed size 16 byte metadata and 8 byte function records.
+  //   2: As version 1, but function records may also be 4 byte compact records
+  //      (CompactFunctionRecord) and FunctionRepeat records stand in for
+  //      repeated calls to the same function. Readers must track the function
+  //      ID of the last function record in each buffer to decode them.
+  //
+  // Either version may have CallArgument metadata records after function
+  // entries, and CustomEventMarker metadata records followed by the number of
+  // payload bytes given in the record.
   uint16_t Version = 0;
 
   // The type of file we're writing out. See the FileTypes enum for more
@@ -63,6 +75,33 @@ struct alignas(32) XRayFileHeader {
 
 static_assert(sizeof(XRayFileHeader) == 32, "XRayFileHeader != 32 bytes");
 
+// A PROFILE file has one of these records for each distinct call path seen in
+// the process, after the header. Records are written in preorder, so a node's
+// parent always comes before it.
+struct alignas(8) XRayProfileNodeRecord {
+  static constexpr int kHistogramBuckets = 32;
+
+  // The function called at the end of this call path.
+  int32_t FuncId = 0;
+
+  // The index of the record of the calling path, or NoParent for calls made
+  // outside of any other instrumented call.
+  enum : uint32_t { NoParent = ~0u };
+  uint32_t Parent = NoParent;
+
+  // The number of calls which returned, and their total duration in TSC ticks.
+  uint64_t CallCount = 0;
+  uint64_t TotalTicks = 0;
+
+  // The number of those calls by duration: bucket I counts the calls which
+  // took [2^I, 2^(I+1)) ticks, except that bucket 0 also counts calls which
+  // took no time, and the last bucket all calls which took longer.
+  uint32_t Histogram[kHistogramBuckets] = {};
+} __attribute__((packed));
+
+static_assert(sizeof(XRayProfileNodeRecord) == 152,
+              "XRayProfileNodeRecord != 152 bytes");
+
 enum RecordTypes {
   NORMAL = 0,
 };
@@ -44,6 +44,10 @@
 #include <libkern/OSAtomic.h>
 #endif /* HAVE_LIBKERN_OSATOMIC_H */
 
+static __inline int OSAtomicAddInt(int amount, int volatile *dst) {
+    return OSAtomicAdd32Barrier(amount, (volatile int32_t *)dst);
+}
+
 #elif defined(__WIN32__) || defined(_WIN32)
 #define _CRT_SECURE_NO_WARNINGS 1
 #include <windows.h>
@@ -60,6 +64,10 @@ static __inline bool OSAtomicCompareAndSwapInt(int oldi, int newi, int volatile
     return (original == oldi);
 }
 
+static __inline int OSAtomicAddInt(int amount, int volatile *dst) {
+    return InterlockedExchangeAdd((long volatile *)dst, amount) + amount;
+}
+
 /*
  * Check to see if the GCC atomic built-ins are available.  If we're on
  * a 64-bit system, make sure we have an 8-byte atomic function
@@ -77,6 +85,10 @@ static __inline bool OSAtomicCompareAndSwapInt(int oldi, int newi, int volatile
   return __sync_bool_compare_and_swap(dst, oldi, newi);
 }
 
+static __inline int OSAtomicAddInt(int amount, int volatile *dst) {
+  return __sync_add_and_fetch(dst, amount);
+}
+
 #else
 #error unknown atomic compare-and-swap primitive
 #endif /* HAVE_OSATOMIC_COMPARE_AND_SWAP_INT && HAVE_OSATOMIC_COMPARE_AND_SWAP_LONG */
@@ -113,7 +125,19 @@ static unsigned long int latching_incr_long(unsigned long int *where) {
 }
 #endif /* if 0 */
 
+/*
+ * Refcounts below this are changed with a single atomic add or subtract.
+ * Threads racing past the check can only carry the count into the flag bits
+ * if there are more than this many of them.  Larger refcounts take the
+ * compare-and-swap loops, which latch them at BLOCK_REFCOUNT_MASK.
+ */
+static const int REFCOUNT_ATOMIC_ADD_LIMIT = BLOCK_REFCOUNT_MASK / 2;
+
 static int latching_incr_int(int *where) {
+    int value = *(volatile int *)where;
+    if ((value & BLOCK_REFCOUNT_MASK) < REFCOUNT_ATOMIC_ADD_LIMIT) {
+        return OSAtomicAddInt(1, (volatile int *)where);
+    }
     while (1) {
         int old_value = *(volatile int *)where;
         if ((old_value & BLOCK_REFCOUNT_MASK) == BLOCK_REFCOUNT_MASK) {
@@ -143,6 +167,11 @@ static int latching_decr_long(unsigned long int *where) {
 #endif /* if 0 */
 
 static int latching_decr_int(int *where) {
+    /* A count of 0 takes the loop, which leaves it alone. */
+    int value = *(volatile int *)where & BLOCK_REFCOUNT_MASK;
+    if (value > 0 && value < REFCOUNT_ATOMIC_ADD_LIMIT) {
+        return OSAtomicAddInt(-1, (volatile int *)where);
+    }
     while (1) {
         int old_value = *(volatile int *)where;
         if ((old_value & BLOCK_REFCOUNT_MASK) == BLOCK_REFCOUNT_MASK) {
@@ -158,6 +187,108 @@ static int latching_decr_int(int *where) {
 }
 
 
+
+/*
+ * Per-thread cache of small heap Blocks and byref structures:
+ */
+#if 0
+#pragma mark Block Cache
+#endif /* if 0 */
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#define BLOCK_CACHE 1
+#include <pthread.h>
+#endif
+
+#ifdef BLOCK_CACHE
+/*
+ * Sizes up to BLOCK_CACHE_MAX_SIZE are rounded up to a multiple of
+ * BLOCK_CACHE_GRANULE; each rounded size has a free list holding at most
+ * BLOCK_CACHE_DEPTH entries.  The freeing thread keeps the memory, so
+ * producer/consumer queues copying Blocks in one thread and releasing them
+ * in another spill to malloc and free once the lists are full.
+ */
+enum {
+    BLOCK_CACHE_GRANULE = 16,
+    BLOCK_CACHE_MAX_SIZE = 128,
+    BLOCK_CACHE_CLASSES = BLOCK_CACHE_MAX_SIZE / BLOCK_CACHE_GRANULE,
+    BLOCK_CACHE_DEPTH = 32
+};
+
+struct Block_cache {
+    bool registered;    // with _Block_cache_key, to be flushed on thread exit
+    int count[BLOCK_CACHE_CLASSES];
+    void *free_list[BLOCK_CACHE_CLASSES];   // linked through the first word
+};
+
+static __thread struct Block_cache _Block_thread_cache;
+static pthread_key_t _Block_cache_key;
+static pthread_once_t _Block_cache_once = PTHREAD_ONCE_INIT;
+
+static void _Block_cache_flush(void *arg) {
+    struct Block_cache *cache = (struct Block_cache *)arg;
+    int i;
+    for (i = 0; i < BLOCK_CACHE_CLASSES; ++i) {
+        while (cache->free_list[i]) {
+            void *next = *(void **)cache->free_list[i];
+            free(cache->free_list[i]);
+            cache->free_list[i] = next;
+        }
+        cache->count[i] = 0;
+    }
+    cache->registered = false;
+}
+
+static void _Block_cache_create_key(void) {
+    pthread_key_create(&_Block_cache_key, _Block_cache_flush);
+}
+
+static __inline int _Block_cache_class(unsigned long size) {
+    return (int)((size + BLOCK_CACHE_GRANULE - 1) / BLOCK_CACHE_GRANULE) - 1;
+}
+
+static void *_Block_cache_alloc(unsigned long size) {
+    struct Block_cache *cache = &_Block_thread_cache;
+    void *result;
+    int cls;
+    if (size == 0 || size > BLOCK_CACHE_MAX_SIZE) return malloc(size);
+    cls = _Block_cache_class(size);
+    result = cache->free_list[cls];
+    if (!result) {
+        // Allocate the rounded size, so that any size of the class can reuse it.
+        return malloc((cls + 1) * BLOCK_CACHE_GRANULE);
+    }
+    cache->free_list[cls] = *(void **)result;
+    cache->count[cls]--;
+    return result;
+}
+
+static void _Block_cache_free(void *ptr, unsigned long size) {
+    struct Block_cache *cache = &_Block_thread_cache;
+    int cls;
+    if (size == 0 || size > BLOCK_CACHE_MAX_SIZE) {
+        free(ptr);
+        return;
+    }
+    cls = _Block_cache_class(size);
+    if (cache->count[cls] == BLOCK_CACHE_DEPTH) {
+        free(ptr);
+        return;
+    }
+    if (!cache->registered) {
+        pthread_once(&_Block_cache_once, _Block_cache_create_key);
+        pthread_setspecific(_Block_cache_key, cache);
+        cache->registered = true;
+    }
+    *(void **)ptr = cache->free_list[cls];
+    cache->free_list[cls] = ptr;
+    cache->count[cls]++;
+}
+#else
+#define _Block_cache_alloc(size) malloc(size)
+#define _Block_cache_free(ptr, size) free(ptr)
+#endif /* BLOCK_CACHE */
+
 /*
  * GC support stub routines:
  */
@@ -219,6 +350,16 @@ static void (*_Block_release_object)(const void *ptr) = _Block_release_object_de
 static void (*_Block_assign_weak)(const void *dest, void *ptr) = _Block_assign_weak_default;
 static void (*_Block_memmove)(void *dest, void *src, unsigned long size) = _Block_memmove_default;
 
+/* Frees a heap Block or byref structure of the given size. */
+static void _Block_free(void *ptr, unsigned long size) {
+    if (isGC) {
+        _Block_deallocator(ptr);
+    }
+    else {
+        _Block_cache_free(ptr, size);
+    }
+}
+
 
 /*
  * GC support SPI functions - called from ObjC runtime and CoreFoundation:
@@ -311,7 +452,7 @@ static void *_Block_copy_internal(const void *arg, const int flags) {
 
     // Its a stack block.  Make a copy.
     if (!isGC) {
-        struct Block_layout *result = malloc(aBlock->descriptor->size);
+        struct Block_layout *result = _Block_cache_alloc(aBlock->descriptor->size);
         if (!result) return (void *)0;
         memmove(result, aBlock, aBlock->descriptor->size); // bitcopy first
         // reset refcount
@@ -379,7 +520,9 @@ static void _Block_byref_assign_copy(void *dest, const void *arg, const int flag
         // src points to stack
         bool isWeak = ((flags & (BLOCK_FIELD_IS_BYREF|BLOCK_FIELD_IS_WEAK)) == (BLOCK_FIELD_IS_BYREF|BLOCK_FIELD_IS_WEAK));
         // if its weak ask for an object (only matters under GC)
-        struct Block_byref *copy = (struct Block_byref *)_Block_allocator(src->size, false, isWeak);
+        struct Block_byref *copy = (struct Block_byref *)(isGC ?
+            _Block_allocator(src->size, false, isWeak) :
+            _Block_cache_alloc(src->size));
         copy->flags = src->flags | _Byref_flag_initial_value; // non-GC one for caller, one for stack
         copy->forwarding = copy; // patch heap copy to point to itself (skip write-barrier)
         src->forwarding = copy;  // patch stack to point to heap copy
@@ -430,11 +573,12 @@ static void _Block_byref_release(const void *arg) {
     }
     else if ((latching_decr_int(&shared_struct->flags) & BLOCK_REFCOUNT_MASK) == 0) {
         //printf("disposing of heap based byref block\n");
+        int size = shared_struct->size;
         if (shared_struct->flags & BLOCK_HAS_COPY_DISPOSE) {
             //printf("calling out to helper\n");
             (*shared_struct->byref_destroy)(shared_struct);
         }
-        _Block_deallocator((struct Block_layout *)shared_struct);
+        _Block_free(shared_struct, size);
     }
 }
 
@@ -471,7 +615,7 @@ void _Block_release(void *arg) {
     }
     else if (aBlock->flags & BLOCK_NEEDS_FREE) {
         if (aBlock->flags & BLOCK_HAS_COPY_DISPOSE)(*aBlock->descriptor->dispose)(aBlock);
-        _Block_deallocator(aBlock);
+        _Block_free(aBlock, aBlock->descriptor->size);
     }
     else if (aBlock->flags & BLOCK_IS_GLOBAL) {
         ;
@@ -28,6 +28,8 @@ static struct AsanDeactivatedFlags {
   bool poison_heap;
   bool coverage;
   const char *coverage_dir;
+  int verbosity;
+  bool help;
 
   void RegisterActivationFlags(FlagParser *parser, Flags *f, CommonFlags *cf) {
 #define ASAN_ACTIVATION_FLAG(Type, Name) \
@@ -41,7 +43,11 @@ static struct AsanDeactivatedFlags {
     RegisterIncludeFlags(parser, cf);
   }
 
-  void OverrideFromActivationFlags() {
+  // Computes the flags the runtime is activated with: the runtime state
+  // stashed at deactivation, overridden by ASAN_ACTIVATION_OPTIONS. This runs
+  // when the runtime is deactivated, so that activation only has to apply the
+  // prepared snapshot.
+  void PrepareActivationFlags() {
     Flags f;
     CommonFlags cf;
     FlagParser parser;
@@ -62,17 +68,29 @@ static struct AsanDeactivatedFlags {
       parser.ParseString(env);
     }
 
-    InitializeCommonFlags(&cf);
-
-    if (Verbosity()) ReportUnrecognizedFlags();
-
-    if (cf.help) parser.PrintFlagDescriptions();
-
     allocator_options.SetFrom(&f, &cf);
     malloc_context_size = cf.malloc_context_size;
     poison_heap = f.poison_heap;
-    coverage = cf.coverage;
+    coverage = cf.coverage || cf.html_cov_report;
     coverage_dir = cf.coverage_dir;
+    verbosity = cf.verbosity;
+    help = cf.help;
+  }
+
+  // Applies the parts of the activation flags that only take effect at
+  // activation: verbosity and the reports about the flags themselves.
+  void ApplyActivationFlags() {
+    SetVerbosity(verbosity);
+
+    if (Verbosity()) ReportUnrecognizedFlags();
+
+    if (help) {
+      Flags f;
+      CommonFlags cf;
+      FlagParser parser;
+      RegisterActivationFlags(&parser, &f, &cf);
+      parser.PrintFlagDescriptions();
+    }
   }
 
   void Print() {
@@ -102,6 +120,7 @@ void AsanDeactivate() {
   asan_deactivated_flags.poison_heap = CanPoisonMemory();
   asan_deactivated_flags.coverage = common_flags()->coverage;
   asan_deactivated_flags.coverage_dir = common_flags()->coverage_dir;
+  asan_deactivated_flags.PrepareActivationFlags();
 
   // Deactivate the runtime.
   SetCanPoisonMemory(false);
@@ -126,7 +145,7 @@ void AsanActivate() {
 
   UpdateProcessName();
 
-  asan_deactivated_flags.OverrideFromActivationFlags();
+  asan_deactivated_flags.ApplyActivationFlags();
 
   SetCanPoisonMemory(asan_deactivated_flags.poison_heap);
   SetMallocContextSize(asan_deactivated_flags.malloc_context_size);
@@ -47,6 +47,11 @@ static u32 RZSize2Log(u32 rz_size) {
   return res;
 }
 
+// The left redzone spans at least one shadow granule, so that with the coarser
+// mappings (SHADOW_SCALE > 4) the user memory right after the chunk header is
+// still granule-aligned.
+static const u32 kMinRZLog = SHADOW_SCALE > 4 ? SHADOW_SCALE - 4 : 0;
+
 static AsanAllocator &get_allocator();
 
 // The memory chunk allocated from the underlying allocator looks like this:
@@ -128,20 +133,47 @@ struct AsanChunk: ChunkBase {
   }
 };
 
+// Decisions of the adaptive quarantine controller (see the
+// adaptive_quarantine flag). Everything but the bypass counters is only
+// touched by the background thread.
+struct AdaptiveQuarantineState {
+  uptr memory_limit;
+  uptr samples;
+  uptr shrinks;
+  uptr grows;
+  uptr min_size_seen;
+  uptr max_rss_seen;
+  atomic_uintptr_t bypassed_chunks;
+  atomic_uintptr_t bypassed_bytes;
+};
+
+// The adaptive quarantine shrinks when RSS gets above 90% of the memory limit
+// and grows back while it is below 75%.
+static const uptr kAdaptiveQuarantineMinFraction = 16;
+static const uptr kAdaptiveQuarantineChunkFraction = 16;
+static const uptr kAdaptiveQuarantineGrowFraction = 8;
+// The memory limit is re-read every this many RSS samples (~10s).
+static const uptr kAdaptiveQuarantineLimitRefresh = 100;
+
 struct QuarantineCallback {
   explicit QuarantineCallback(AllocatorCache *cache)
       : cache_(cache) {
   }
 
-  void Recycle(AsanChunk *m) {
+  // Chunks that were not sampled (see heap_sample_rate) are recycled with
+  // poison == false, their shadow is left as the allocation made it.
+  void Recycle(AsanChunk *m, bool poison = true) {
     CHECK_EQ(m->chunk_state, CHUNK_QUARANTINE);
     atomic_store((atomic_uint8_t*)m, CHUNK_AVAILABLE, memory_order_relaxed);
     CHECK_NE(m->alloc_tid, kInvalidTid);
     CHECK_NE(m->free_tid, kInvalidTid);
-    PoisonShadow(m->Beg(),
-                 RoundUpTo(m->UsedSize(), SHADOW_GRANULARITY),
-                 kAsanHeapLeftRedzoneMagic);
     void *p = reinterpret_cast<void *>(m->AllocBeg());
+    // Secondary chunks get their whole shadow cleared and released by
+    // AsanMapUnmapCallback::OnUnmap, don't dirty it once more on the way.
+    if (poison && get_allocator().FromPrimary(p))
+      PoisonShadow(m->Beg(),
+                   RoundUpTo(m->UsedSize(), SHADOW_GRANULARITY),
+                   kAsanHeapLeftRedzoneMagic);
     if (p != m) {
       uptr *alloc_magic = reinterpret_cast<uptr *>(p);
       CHECK_EQ(alloc_magic[0], kAllocBegMagic);
@@ -155,10 +187,16 @@ struct QuarantineCallback {
     AsanStats &thread_stats = GetCurrentThreadStats();
     thread_stats.real_frees++;
     thread_stats.really_freed += m->UsedSize();
+    AddToGlobalCounter(kGlobalReallyFreed, m->UsedSize());
 
     get_allocator().Deallocate(cache_, p);
   }
 
+  void RecycleBatch(AsanChunk **chunks, uptr count) {
+    for (uptr i = 0; i < count; i++)
+      Recycle(chunks[i]);
+  }
+
   void *Allocate(uptr size) {
     return get_allocator().Allocate(cache_, size, 1, false);
   }
@@ -179,6 +217,7 @@ void AsanMapUnmapCallback::OnMap(uptr p, uptr size) const {
   AsanStats &thread_stats = GetCurrentThreadStats();
   thread_stats.mmaps++;
   thread_stats.mmaped += size;
+  AddToGlobalCounter(kGlobalMmaped, size);
 }
 void AsanMapUnmapCallback::OnUnmap(uptr p, uptr size) const {
   PoisonShadow(p, size, 0);
@@ -189,6 +228,7 @@ void AsanMapUnmapCallback::OnUnmap(uptr p, uptr size) const {
   AsanStats &thread_stats = GetCurrentThreadStats();
   thread_stats.munmaps++;
   thread_stats.munmaped += size;
+  AddToGlobalCounter(kGlobalMunmaped, size);
 }
 
 // We can not use THREADLOCAL because it is not supported on some of the
@@ -234,6 +274,15 @@ struct Allocator {
   StaticSpinMutex fallback_mutex;
   AllocatorCache fallback_allocator_cache;
   QuarantineCache fallback_quarantine_cache;
+  // Owned by the background quarantine recycler thread, if any.
+  AllocatorCache recycler_allocator_cache;
+  // The configured quarantine limits; the adaptive quarantine scales the
+  // actual ones below these.
+  uptr quarantine_max_size;
+  uptr quarantine_max_cache_size;
+  // Chunks larger than this skip the quarantine; 0 means no limit.
+  atomic_uintptr_t quarantine_max_chunk_size;
+  AdaptiveQuarantineState adaptive_quarantine;
 
   // ------------------- Options --------------------------
   atomic_uint16_t min_redzone;
@@ -255,8 +304,11 @@ struct Allocator {
 
   void SharedInitCode(const AllocatorOptions &options) {
     CheckOptions(options);
-    quarantine.Init((uptr)options.quarantine_size_mb << 20,
-                    (uptr)options.thread_local_quarantine_size_kb << 10);
+    quarantine_max_size = (uptr)options.quarantine_size_mb << 20;
+    quarantine_max_cache_size =
+        (uptr)options.thread_local_quarantine_size_kb << 10;
+    quarantine.Init(quarantine_max_size, quarantine_max_cache_size);
+    atomic_store(&quarantine_max_chunk_size, 0, memory_order_relaxed);
     atomic_store(&alloc_dealloc_mismatch, options.alloc_dealloc_mismatch,
                  memory_order_release);
     atomic_store(&min_redzone, options.min_redzone, memory_order_release);
@@ -265,9 +317,84 @@ struct Allocator {
 
   void Initialize(const AllocatorOptions &options) {
     allocator.Init(options.may_return_null, options.release_to_os_interval_ms);
+    allocator.SetSizeProfile(GetAllocatorSizeProfile());
+    allocator.SetSecondaryCacheParams(
+        static_cast<uptr>(common_flags()->allocator_secondary_cache_size_mb)
+            << 20,
+        common_flags()->allocator_secondary_cache_decay_ms);
     SharedInitCode(options);
   }
 
+  void NORETURN RecycleQuarantineInBackground() {
+    allocator.InitCache(&recycler_allocator_cache);
+    quarantine.RecycleInBackground(
+        QuarantineCallback(&recycler_allocator_cache));
+  }
+
+  uptr AdaptiveQuarantineMemoryLimit() {
+    // An explicitly given rss limit wins over the cgroup one.
+    if (uptr limit_mb = common_flags()->hard_rss_limit_mb)
+      return limit_mb << 20;
+    if (uptr limit_mb = common_flags()->soft_rss_limit_mb)
+      return limit_mb << 20;
+    return GetCgroupMemoryLimit();
+  }
+
+  // Called by the background thread with the current RSS.
+  void AdaptQuarantine(uptr rss) {
+    AdaptiveQuarantineState *s = &adaptive_quarantine;
+    if (!quarantine_max_size) return;
+    if (s->samples++ % kAdaptiveQuarantineLimitRefresh == 0)
+      s->memory_limit = AdaptiveQuarantineMemoryLimit();
+    s->max_rss_seen = Max(s->max_rss_seen, rss);
+    if (!s->memory_limit) return;
+    uptr size = quarantine.GetSize();
+    uptr min_size = quarantine_max_size / kAdaptiveQuarantineMinFraction;
+    uptr new_size = size;
+    if (rss > s->memory_limit / 10 * 9)
+      new_size = Max(size / 2, min_size);
+    else if (rss < s->memory_limit / 4 * 3)
+      new_size = Min(size + quarantine_max_size / kAdaptiveQuarantineGrowFraction,
+                     quarantine_max_size);
+    if (new_size == size) return;
+    if (new_size < size) {
+      s->shrinks++;
+      if (!s->min_size_seen || new_size < s->min_size_seen)
+        s->min_size_seen = new_size;
+    } else {
+      s->grows++;
+    }
+    // Keep the thread local caches in the same proportion; they can't be
+    // zero while the global quarantine is not.
+    uptr cache_size = Max<uptr>(
+        (u64)quarantine_max_cache_size * new_size / quarantine_max_size, 1);
+    quarantine.Init(new_size, cache_size);
+    // Large chunks are the first to lose the quarantine protection.
+    atomic_store(&quarantine_max_chunk_size,
+                 new_size < quarantine_max_size
+                     ? new_size / kAdaptiveQuarantineChunkFraction : 0,
+                 memory_order_relaxed);
+    if (new_size < size) {
+      // Don't wait for the next free() to bring the quarantine down.
+      SpinMutexLock l(&fallback_mutex);
+      quarantine.Drain(&fallback_quarantine_cache,
+                       QuarantineCallback(&fallback_allocator_cache));
+    }
+  }
+
+  void PrintAdaptiveQuarantineStats() {
+    AdaptiveQuarantineState *s = &adaptive_quarantine;
+    Printf("Adaptive quarantine: limit: %zdMb; max rss: %zdMb; size: %zdMb "
+           "(min %zdMb, max %zdMb); %zd shrinks, %zd grows; %zd chunks "
+           "(%zdMb) not quarantined\n",
+           s->memory_limit >> 20, s->max_rss_seen >> 20,
+           quarantine.GetSize() >> 20,
+           (s->min_size_seen ? s->min_size_seen : quarantine.GetSize()) >> 20,
+           quarantine_max_size >> 20, s->shrinks, s->grows,
+           atomic_load(&s->bypassed_chunks, memory_order_relaxed),
+           atomic_load(&s->bypassed_bytes, memory_order_relaxed) >> 20);
+  }
+
   void RePoisonChunk(uptr chunk) {
     // This could be a user-facing chunk (with redzones), or some internal
     // housekeeping chunk, like TransferBatch. Start by assuming the former.
@@ -309,8 +436,8 @@ struct Allocator {
   }
 
   void GetOptions(AllocatorOptions *options) const {
-    options->quarantine_size_mb = quarantine.GetSize() >> 20;
-    options->thread_local_quarantine_size_kb = quarantine.GetCacheSize() >> 10;
+    options->quarantine_size_mb = quarantine_max_size >> 20;
+    options->thread_local_quarantine_size_kb = quarantine_max_cache_size >> 10;
     options->min_redzone = atomic_load(&min_redzone, memory_order_acquire);
     options->max_redzone = atomic_load(&max_redzone, memory_order_acquire);
     options->may_return_null = allocator.MayReturnNull();
@@ -331,7 +458,8 @@ struct Allocator {
       user_requested_size <= (1 << 16) - 1024 ? 6 : 7;
     u32 min_rz = atomic_load(&min_redzone, memory_order_acquire);
     u32 max_rz = atomic_load(&max_redzone, memory_order_acquire);
-    return Min(Max(rz_log, RZSize2Log(min_rz)), RZSize2Log(max_rz));
+    return Max(Min(Max(rz_log, RZSize2Log(min_rz)), RZSize2Log(max_rz)),
+               kMinRZLog);
   }
 
   // We have an address between two chunks, and we want to report just one.
@@ -359,6 +487,20 @@ struct Allocator {
   }
 
   // -------------------- Allocation/Deallocation routines ---------------
+  void UnpoisonUserMemory(uptr user_beg, uptr size) {
+    uptr size_rounded_down_to_granularity =
+        RoundDownTo(size, SHADOW_GRANULARITY);
+    // Unpoison the bulk of the memory region.
+    if (size_rounded_down_to_granularity)
+      PoisonShadow(user_beg, size_rounded_down_to_granularity, 0);
+    // Deal with the end of the region if size is not aligned to granularity.
+    if (size != size_rounded_down_to_granularity && CanPoisonMemory()) {
+      u8 *shadow =
+          (u8 *)MemToShadow(user_beg + size_rounded_down_to_granularity);
+      *shadow = flags()->poison_partial ? (size & (SHADOW_GRANULARITY - 1)) : 0;
+    }
+  }
+
   void *Allocate(uptr size, uptr alignment, BufferedStackTrace *stack,
                  AllocType alloc_type, bool can_fill) {
     if (UNLIKELY(!asan_inited))
@@ -378,7 +520,11 @@ struct Allocator {
       size = 1;
     }
     CHECK(IsPowerOfTwo(alignment));
-    uptr rz_log = ComputeRZLog(size);
+    // With heap_sample_rate, only the allocations that got a malloc stack
+    // (see GetMallocContextSizeForAllocation) are sampled. The others get
+    // the smallest left redzone, which is the chunk header, and no right one.
+    bool sampled = fl.heap_sample_rate <= 1 || stack->size;
+    uptr rz_log = sampled ? ComputeRZLog(size) : kMinRZLog;
     uptr rz_size = RZLog2Size(rz_log);
     uptr rounded_size = RoundUpTo(Max(size, kChunkHeader2Size), alignment);
     uptr needed_size = rounded_size + rz_size;
@@ -388,7 +534,8 @@ struct Allocator {
     // If we are allocating from the secondary allocator, there will be no
     // automatic right redzone, so add the right redzone manually.
     if (!PrimaryAllocator::CanAllocate(needed_size, alignment)) {
-      needed_size += rz_size;
+      if (sampled)
+        needed_size += rz_size;
       using_primary_allocator = false;
     }
     CHECK(IsAligned(needed_size, min_alignment));
@@ -414,10 +561,13 @@ struct Allocator {
 
     if (!allocated) return allocator.ReturnNullOrDieOnOOM();
 
-    if (*(u8 *)MEM_TO_SHADOW((uptr)allocated) == 0 && CanPoisonMemory()) {
+    if (sampled && CanPoisonMemory() &&
+        (*(u8 *)MEM_TO_SHADOW((uptr)allocated) == 0 ||
+         fl.heap_sample_rate > 1)) {
       // Heap poisoning is enabled, but the allocator provides an unpoisoned
       // chunk. This is possible if CanPoisonMemory() was false for some
-      // time, for example, due to flags()->start_disabled.
+      // time, for example, due to flags()->start_disabled, or if the block
+      // was last used by a chunk that was not sampled.
       // Anyway, poison the block before using it for anything else.
       uptr allocated_size = allocator.GetActuallyAllocatedSize(allocated);
       PoisonShadow((uptr)allocated, allocated_size, kAsanHeapLeftRedzoneMagic);
@@ -457,24 +607,15 @@ struct Allocator {
       meta[1] = chunk_beg;
     }
 
-    m->alloc_context_id = StackDepotPut(*stack);
-
-    uptr size_rounded_down_to_granularity =
-        RoundDownTo(size, SHADOW_GRANULARITY);
-    // Unpoison the bulk of the memory region.
-    if (size_rounded_down_to_granularity)
-      PoisonShadow(user_beg, size_rounded_down_to_granularity, 0);
-    // Deal with the end of the region if size is not aligned to granularity.
-    if (size != size_rounded_down_to_granularity && CanPoisonMemory()) {
-      u8 *shadow =
-          (u8 *)MemToShadow(user_beg + size_rounded_down_to_granularity);
-      *shadow = fl.poison_partial ? (size & (SHADOW_GRANULARITY - 1)) : 0;
-    }
+    m->alloc_context_id = sampled ? StackDepotPut(*stack) : 0;
+    UnpoisonUserMemory(user_beg, size);
 
     AsanStats &thread_stats = GetCurrentThreadStats();
     thread_stats.mallocs++;
     thread_stats.malloced += size;
     thread_stats.malloced_redzones += needed_size - size;
+    AddToGlobalCounter(kGlobalMalloced, size);
+    AddToGlobalCounter(kGlobalMallocedRedzones, needed_size - size);
     if (needed_size > SizeClassMap::kMaxSize)
       thread_stats.malloc_large++;
     else
@@ -495,6 +636,22 @@ struct Allocator {
     return res;
   }
 
+  // With heap_sample_rate, the chunks that were not sampled are those
+  // without an alloc stack: a stack that is kept is never given id 0.
+  bool ChunkIsSampled(AsanChunk *m) {
+    return flags()->heap_sample_rate <= 1 || m->alloc_context_id;
+  }
+
+  u32 MallocContextSizeForFree(const void *ptr) {
+    if (LIKELY(flags()->heap_sample_rate <= 1) || !ptr ||
+        !allocator.PointerIsMine(const_cast<void *>(ptr)))
+      return GetMallocContextSize();
+    AsanChunk *m = reinterpret_cast<AsanChunk *>((uptr)ptr - kChunkHeaderSize);
+    if (m->chunk_state != CHUNK_ALLOCATED)  // Collect it for the report.
+      return GetMallocContextSize();
+    return ChunkIsSampled(m) ? GetMallocContextSize() : 0;
+  }
+
   // Set quarantine flag if chunk is allocated, issue ASan error report on
   // available and quarantined chunks. Return true on success, false otherwise.
   bool AtomicallySetQuarantineFlagIfAllocated(AsanChunk *m, void *ptr,
@@ -522,9 +679,10 @@ struct Allocator {
       CHECK_EQ(m->free_tid, kInvalidTid);
     AsanThread *t = GetCurrentThread();
     m->free_tid = t ? t->tid() : 0;
-    m->free_context_id = StackDepotPut(*stack);
-
     Flags &fl = *flags();
+    bool sampled = ChunkIsSampled(m);
+    m->free_context_id = sampled ? StackDepotPut(*stack) : 0;
+
     if (fl.max_free_fill_size > 0) {
       // We have to skip the chunk header, it contains free_context_id.
       uptr scribble_start = (uptr)m + kChunkHeaderSize + kChunkHeader2Size;
@@ -536,25 +694,56 @@ struct Allocator {
     }
 
     // Poison the region.
-    PoisonShadow(m->Beg(),
-                 RoundUpTo(m->UsedSize(), SHADOW_GRANULARITY),
-                 kAsanHeapFreeMagic);
+    uptr poison_size = RoundUpTo(m->UsedSize(), SHADOW_GRANULARITY);
+    uptr shadow_released = 0;
+    if (!sampled) {
+      // Not poisoned: the chunk skips the quarantine below.
+    } else if (fl.release_freed_shadow_threshold_kb > 0 &&
+        poison_size >= (uptr)fl.release_freed_shadow_threshold_kb << 10 &&
+        !allocator.FromPrimary(m)) {
+      // Keep one shadow page worth of poisoning at each end, where most
+      // use-after-free accesses land, and release the rest.
+      shadow_released = PoisonShadowEdgesAndRelease(
+          m->Beg(), poison_size, kAsanHeapFreeMagic,
+          GetPageSizeCached() * SHADOW_GRANULARITY);
+    } else {
+      PoisonShadow(m->Beg(), poison_size, kAsanHeapFreeMagic);
+    }
 
     AsanStats &thread_stats = GetCurrentThreadStats();
+    thread_stats.freed_shadow_released += shadow_released;
     thread_stats.frees++;
     thread_stats.freed += m->UsedSize();
-
-    // Push into quarantine.
+    AddToGlobalCounter(kGlobalFreed, m->UsedSize());
+
+    // Push into quarantine, unless the chunk was not sampled, or the adaptive
+    // quarantine is scaled down and the chunk is too large for it.
+    uptr max_chunk_size =
+        atomic_load(&quarantine_max_chunk_size, memory_order_relaxed);
+    bool bypass =
+        !sampled || (max_chunk_size && m->UsedSize() > max_chunk_size);
+    if (UNLIKELY(bypass && sampled)) {
+      atomic_fetch_add(&adaptive_quarantine.bypassed_chunks, 1,
+                       memory_order_relaxed);
+      atomic_fetch_add(&adaptive_quarantine.bypassed_bytes, m->UsedSize(),
+                       memory_order_relaxed);
+    }
     if (t) {
       AsanThreadLocalMallocStorage *ms = &t->malloc_storage();
       AllocatorCache *ac = GetAllocatorCache(ms);
-      quarantine.Put(GetQuarantineCache(ms), QuarantineCallback(ac), m,
-                           m->UsedSize());
+      if (bypass)
+        QuarantineCallback(ac).Recycle(m, sampled);
+      else
+        quarantine.Put(GetQuarantineCache(ms), QuarantineCallback(ac), m,
+                       m->UsedSize());
     } else {
       SpinMutexLock l(&fallback_mutex);
       AllocatorCache *ac = &fallback_allocator_cache;
-      quarantine.Put(&fallback_quarantine_cache, QuarantineCallback(ac), m,
-                           m->UsedSize());
+      if (bypass)
+        QuarantineCallback(ac).Recycle(m, sampled);
+      else
+        quarantine.Put(&fallback_quarantine_cache, QuarantineCallback(ac), m,
+                       m->UsedSize());
     }
   }
 
@@ -596,6 +785,41 @@ struct Allocator {
     QuarantineChunk(m, ptr, stack, alloc_type);
   }
 
+  // Resizes the chunk m without moving it if it has room for new_size bytes
+  // and the redzone that follows them: primary chunks have it in the next
+  // chunk, the secondary ones at the end of their mapping.
+  bool ReallocateInPlace(AsanChunk *m, uptr new_size,
+                         BufferedStackTrace *stack) {
+    // Invalid chunks are reported by the regular path.
+    if (m->chunk_state != CHUNK_ALLOCATED)
+      return false;
+    uptr user_beg = m->Beg();
+    uptr old_size = m->UsedSize();
+    void *alloc_beg = m->AllocBeg();
+    bool from_primary = allocator.FromPrimary(alloc_beg);
+    uptr needed_size = user_beg + new_size - (uptr)alloc_beg;
+    if (!from_primary)
+      needed_size += RZLog2Size(m->rz_log);
+    // Don't keep a large mapping for a small chunk.
+    if (new_size > kMaxAllowedMallocSize ||
+        (!from_primary && new_size <= SizeClassMap::kMaxSize) ||
+        !allocator.ResizeInPlace(alloc_beg, needed_size))
+      return false;
+    PoisonShadow(user_beg, RoundUpTo(old_size, SHADOW_GRANULARITY),
+                 kAsanHeapLeftRedzoneMagic);
+    UnpoisonUserMemory(user_beg, new_size);
+    if (from_primary)
+      m->user_requested_size = new_size;
+    else
+      reinterpret_cast<uptr *>(allocator.GetMetaData(alloc_beg))[0] = new_size;
+    AsanThread *t = GetCurrentThread();
+    m->alloc_tid = t ? t->tid() : 0;
+    if (m->alloc_context_id)
+      m->alloc_context_id = StackDepotPut(*stack);
+    GetCurrentThreadStats().reallocs_in_place++;
+    return true;
+  }
+
   void *Reallocate(void *old_ptr, uptr new_size, BufferedStackTrace *stack) {
     CHECK(old_ptr && new_size);
     uptr p = reinterpret_cast<uptr>(old_ptr);
@@ -606,6 +830,8 @@ struct Allocator {
     thread_stats.reallocs++;
     thread_stats.realloced += new_size;
 
+    if (flags()->realloc_in_place && ReallocateInPlace(m, new_size, stack))
+      return old_ptr;
     void *new_ptr = Allocate(new_size, 8, stack, FROM_MALLOC, true);
     if (new_ptr) {
       u8 chunk_state = m->chunk_state;
@@ -626,8 +852,10 @@ struct Allocator {
       return allocator.ReturnNullOrDieOnBadRequest();
     void *ptr = Allocate(nmemb * size, 8, stack, FROM_MALLOC, false);
     // If the memory comes from the secondary allocator no need to clear it
-    // as it comes directly from mmap.
-    if (ptr && allocator.FromPrimary(ptr))
+    // as it comes directly from mmap. Neither do the primary chunks known to
+    // be zero, the header is written to the redzone only.
+    if (ptr && allocator.FromPrimary(ptr) &&
+        !allocator.ChunkIsZero(allocator.GetBlockBegin(ptr)))
       REAL(memset)(ptr, 0, nmemb * size);
     return ptr;
   }
@@ -703,7 +931,10 @@ struct Allocator {
 
   void PrintStats() {
     allocator.PrintStats();
+    allocator.PrintHistogram();
     quarantine.PrintStats();
+    if (flags()->adaptive_quarantine)
+      PrintAdaptiveQuarantineStats();
   }
 
   void ForceLock() {
@@ -763,6 +994,73 @@ void InitializeAllocator(const AllocatorOptions &options) {
   instance.Initialize(options);
 }
 
+void GetHeapRange(uptr *beg, uptr *end) {
+  get_allocator().GetPrimarySpaceRange(beg, end);
+}
+
+static void QuarantineRecyclerThread(void *arg) {
+  instance.RecycleQuarantineInBackground();
+}
+
+void MaybeStartQuarantineRecycler() {
+  if (!flags()->quarantine_recycle_in_background ||
+      !instance.quarantine.GetSize())
+    return;
+  internal_start_thread(QuarantineRecyclerThread, nullptr);
+}
+
+static void AsanRssSampledCallback(uptr rss) {
+  instance.AdaptQuarantine(rss);
+}
+
+static void PrintAdaptiveQuarantineStatsAtExit() {
+  // Stay quiet if the quarantine never had to be scaled.
+  if (instance.adaptive_quarantine.shrinks || Verbosity())
+    instance.PrintAdaptiveQuarantineStats();
+}
+
+void MaybeEnableAdaptiveQuarantine() {
+  if (!flags()->adaptive_quarantine || !instance.quarantine.GetSize())
+    return;
+  SetRssSampledCallback(AsanRssSampledCallback);
+  Atexit(PrintAdaptiveQuarantineStatsAtExit);
+}
+
+// The intervals between sampled allocations are drawn uniformly from
+// [1, 2 * heap_sample_rate - 1], so that one in heap_sample_rate is sampled
+// on average, without locking into a period of the program's allocations.
+static u32 NextHeapSampleInterval(AsanThreadLocalMallocStorage *ms, u32 rate) {
+  u32 x = ms->heap_sample_rand;
+  if (!x)
+    x = (u32)(uptr)ms ^ (u32)NanoTime() ^ 0x9e3779b9;
+  // xorshift32.
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  ms->heap_sample_rand = x;
+  return 1 + x % (2 * rate - 1);
+}
+
+u32 GetMallocContextSizeForAllocation() {
+  int rate = flags()->heap_sample_rate;
+  if (LIKELY(rate <= 1))
+    return GetMallocContextSize();
+  AsanThread *t = GetCurrentThread();
+  if (!t)
+    return GetMallocContextSize();
+  AsanThreadLocalMallocStorage *ms = &t->malloc_storage();
+  if (ms->heap_sample_countdown > 1) {
+    ms->heap_sample_countdown--;
+    return 0;
+  }
+  ms->heap_sample_countdown = NextHeapSampleInterval(ms, rate);
+  return GetMallocContextSize();
+}
+
+u32 GetMallocContextSizeForFree(const void *ptr) {
+  return instance.MallocContextSizeForFree(ptr);
+}
+
 void ReInitializeAllocator(const AllocatorOptions &options) {
   instance.ReInitialize(options);
 }
@@ -866,10 +1164,42 @@ void asan_mz_force_unlock() {
   instance.ForceUnlock();
 }
 
+struct SampledChunkIterationArgs {
+  uptr sample_rate;
+  AllocatedChunkCallback callback;
+  void *arg;
+};
+
+static void SampledChunkCallback(uptr chunk, void *arg) {
+  SampledChunkIterationArgs *args =
+      reinterpret_cast<SampledChunkIterationArgs *>(arg);
+  // Sample by address, so that a chunk is either in every profile taken
+  // during its lifetime or in none of them.
+  if (args->sample_rate > 1 &&
+      ((u64)chunk * 0x9E3779B97F4A7C15ULL >> 32) % args->sample_rate)
+    return;
+  AsanChunk *m = instance.GetAsanChunk(reinterpret_cast<void *>(chunk));
+  if (!m || m->chunk_state != CHUNK_ALLOCATED) return;
+  args->callback(m->alloc_context_id, m->UsedSize(/*locked_version=*/true),
+                 args->arg);
+}
+
+void ForEachAllocatedChunkSampled(uptr sample_rate,
+                                  AllocatedChunkCallback callback, void *arg) {
+  SampledChunkIterationArgs args = {sample_rate, callback, arg};
+  instance.ForceLock();
+  get_allocator().ForEachChunk(SampledChunkCallback, &args);
+  instance.ForceUnlock();
+}
+
 void AsanSoftRssLimitExceededCallback(bool exceeded) {
   instance.allocator.SetRssLimitIsExceeded(exceeded);
 }
 
+void AsanAllocatorReleaseToOSCallback(bool force) {
+  instance.allocator.ReleaseToOSInBackground(force);
+}
+
 } // namespace __asan
 
 // --- Implementation of LSan-specific functions --- {{{1
@@ -908,6 +1238,11 @@ uptr GetUserBegin(uptr chunk) {
   return m->Beg();
 }
 
+uptr GetAllocationSampleRate() {
+  // ASan records the stack of every allocation.
+  return 1;
+}
+
 LsanMetadata::LsanMetadata(uptr chunk) {
   metadata_ = reinterpret_cast<void *>(chunk - __asan::kChunkHeaderSize);
 }
@@ -927,6 +1262,25 @@ void LsanMetadata::set_tag(ChunkTag value) {
   m->lsan_tag = value;
 }
 
+bool LsanMetadata::try_set_tag(ChunkTag old_tag, ChunkTag new_tag) {
+  // lsan_tag lives in the second 32-bit word of the header together with
+  // free_tid, alloc_type and rz_log, which are not modified while the world is
+  // stopped.
+  atomic_uint32_t *word = reinterpret_cast<atomic_uint32_t *>(
+      reinterpret_cast<uptr>(metadata_) + sizeof(u32));
+  u32 cmp = atomic_load(word, memory_order_relaxed);
+  for (;;) {
+    __asan::ChunkHeader h;
+    internal_memcpy(reinterpret_cast<u32 *>(&h) + 1, &cmp, sizeof(cmp));
+    if (h.lsan_tag != old_tag) return false;
+    h.lsan_tag = new_tag;
+    u32 xchg;
+    internal_memcpy(&xchg, reinterpret_cast<u32 *>(&h) + 1, sizeof(xchg));
+    if (atomic_compare_exchange_weak(word, &cmp, xchg, memory_order_relaxed))
+      return true;
+  }
+}
+
 uptr LsanMetadata::requested_size() const {
   __asan::AsanChunk *m = reinterpret_cast<__asan::AsanChunk *>(metadata_);
   return m->UsedSize(/*locked_version=*/true);
@@ -941,6 +1295,11 @@ void ForEachChunk(ForEachChunkCallback callback, void *arg) {
   __asan::get_allocator().ForEachChunk(callback, arg);
 }
 
+void ForEachChunkInPart(ForEachChunkCallback callback, void *arg, uptr part,
+                        uptr n_parts) {
+  __asan::get_allocator().ForEachChunkInPart(callback, arg, part, n_parts);
+}
+
 IgnoreObjectResult IgnoreObjectLocked(const void *p) {
   uptr addr = reinterpret_cast<uptr>(p);
   __asan::AsanChunk *m = __asan::instance.GetAsanChunkByAddr(addr);
@@ -982,6 +1341,15 @@ uptr __sanitizer_get_allocated_size(const void *p) {
   return allocated_size;
 }
 
+uptr __sanitizer_get_allocator_histogram(AllocatorClassStats *stats,
+                                         uptr max_classes) {
+  return instance.allocator.GetHistogram(stats, max_classes);
+}
+
+void __sanitizer_print_allocator_histogram() {
+  instance.allocator.PrintHistogram();
+}
+
 #if !SANITIZER_SUPPORTS_WEAK_HOOKS
 // Provide default (no-op) implementation of malloc hooks.
 SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_malloc_hook,
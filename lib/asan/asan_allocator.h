@@ -46,7 +46,16 @@ struct AllocatorOptions {
 
 void InitializeAllocator(const AllocatorOptions &options);
 void ReInitializeAllocator(const AllocatorOptions &options);
+// Starts the background quarantine recycler thread if the
+// quarantine_recycle_in_background flag is set.
+void MaybeStartQuarantineRecycler();
+// Lets the background thread scale the quarantine if the adaptive_quarantine
+// flag is set. Must be called before MaybeStartBackgroudThread().
+void MaybeEnableAdaptiveQuarantine();
 void GetAllocatorOptions(AllocatorOptions *options);
+// Returns the range of the address space the heap is allocated from, or an
+// empty one if the allocator doesn't use a fixed range.
+void GetHeapRange(uptr *beg, uptr *end);
 
 class AsanChunkView {
  public:
@@ -122,7 +131,7 @@ struct AsanMapUnmapCallback {
 # if defined(__powerpc64__)
 const uptr kAllocatorSpace =  0xa0000000000ULL;
 const uptr kAllocatorSize  =  0x20000000000ULL;  // 2T.
-typedef DefaultSizeClassMap SizeClassMap;
+typedef ToolSizeClassMap SizeClassMap;
 # elif defined(__aarch64__) && SANITIZER_ANDROID
 const uptr kAllocatorSpace =  0x3000000000ULL;
 const uptr kAllocatorSize  =  0x2000000000ULL;  // 128G.
@@ -132,15 +141,15 @@ typedef VeryCompactSizeClassMap SizeClassMap;
 // so no need to different values for different VMA.
 const uptr kAllocatorSpace =  0x10000000000ULL;
 const uptr kAllocatorSize  =  0x10000000000ULL;  // 3T.
-typedef DefaultSizeClassMap SizeClassMap;
+typedef ToolSizeClassMap SizeClassMap;
 # elif SANITIZER_WINDOWS
 const uptr kAllocatorSpace = ~(uptr)0;
 const uptr kAllocatorSize  =  0x8000000000ULL;  // 500G
-typedef DefaultSizeClassMap SizeClassMap;
+typedef ToolSizeClassMap SizeClassMap;
 # else
 const uptr kAllocatorSpace = 0x600000000000ULL;
 const uptr kAllocatorSize  =  0x40000000000ULL;  // 4T.
-typedef DefaultSizeClassMap SizeClassMap;
+typedef ToolSizeClassMap SizeClassMap;
 # endif
 struct AP64 {  // Allocator64 parameters. Deliberately using a short name.
   static const uptr kSpaceBeg = kAllocatorSpace;
@@ -148,7 +157,7 @@ struct AP64 {  // Allocator64 parameters. Deliberately using a short name.
   static const uptr kMetadataSize = 0;
   typedef __asan::SizeClassMap SizeClassMap;
   typedef AsanMapUnmapCallback MapUnmapCallback;
-  static const uptr kFlags = 0;
+  static const uptr kFlags = kToolAllocator64Flags;
 };
 
 typedef SizeClassAllocator64<AP64> PrimaryAllocator;
@@ -164,7 +173,8 @@ typedef CompactSizeClassMap SizeClassMap;
 typedef SizeClassAllocator32<0, SANITIZER_MMAP_RANGE_SIZE, 16,
   SizeClassMap, kRegionSizeLog,
   ByteMap,
-  AsanMapUnmapCallback> PrimaryAllocator;
+  AsanMapUnmapCallback,
+  SizeClassAllocator32FlagMasks::kLockFreeFreeLists> PrimaryAllocator;
 #endif  // SANITIZER_CAN_USE_ALLOCATOR64
 
 static const uptr kNumberOfSizeClasses = SizeClassMap::kNumClasses;
@@ -177,6 +187,10 @@ typedef CombinedAllocator<PrimaryAllocator, AllocatorCache,
 struct AsanThreadLocalMallocStorage {
   uptr quarantine_cache[16];
   AllocatorCache allocator_cache;
+  // heap_sample_rate state: allocations left until the next sampled one,
+  // and the random number generator picking the intervals.
+  u32 heap_sample_countdown;
+  u32 heap_sample_rand;
   void CommitBack();
  private:
   // These objects are allocated via mmap() and are zero-initialized.
@@ -204,7 +218,17 @@ void asan_mz_force_lock();
 void asan_mz_force_unlock();
 
 void PrintInternalAllocatorStats();
+
+// Calls CALLBACK for the allocated chunks with the id of their allocation
+// stack and their user size. With SAMPLE_RATE > 1 only about one chunk in
+// SAMPLE_RATE is visited. The allocator is locked (but the world is not
+// stopped) during the iteration, so CALLBACK must not allocate from it.
+typedef void (*AllocatedChunkCallback)(u32 alloc_stack_id, uptr size,
+                                       void *arg);
+void ForEachAllocatedChunkSampled(uptr sample_rate,
+                                  AllocatedChunkCallback callback, void *arg);
 void AsanSoftRssLimitExceededCallback(bool exceeded);
+void AsanAllocatorReleaseToOSCallback(bool force);
 
 }  // namespace __asan
 #endif  // ASAN_ALLOCATOR_H
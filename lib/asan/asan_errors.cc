@@ -330,8 +330,12 @@ ErrorGeneric::ErrorGeneric(u32 tid, uptr pc_, uptr bp_, uptr sp_, uptr addr,
     bug_descr = "unknown-crash";
     if (AddrIsInMem(addr)) {
       u8 *shadow_addr = (u8 *)MemToShadow(addr);
-      // If we are accessing 16 bytes, look at the second shadow byte.
-      if (*shadow_addr == 0 && access_size > SHADOW_GRANULARITY) shadow_addr++;
+      // If we are accessing more than one granule, look at the first shadow
+      // byte which is not zero.
+      if (access_size > SHADOW_GRANULARITY) {
+        u8 *shadow_last = (u8 *)MemToShadow(addr + access_size - 1);
+        while (*shadow_addr == 0 && shadow_addr < shadow_last) shadow_addr++;
+      }
       // If we are in the partial right redzone, look at the next shadow byte.
       if (*shadow_addr > 0 && *shadow_addr < 128) shadow_addr++;
       bool far_from_bounds = false;
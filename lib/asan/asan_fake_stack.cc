@@ -26,11 +26,16 @@ static const u64 kMagic8 = (kMagic4 << 32) | kMagic4;
 static const u64 kAllocaRedzoneSize = 32UL;
 static const u64 kAllocaRedzoneMask = 31UL;
 
+// The alloca redzones (and the 64-byte smallest fake frames) must cover whole
+// shadow granules, which limits SHADOW_SCALE to 5.
+COMPILER_CHECK(kAllocaRedzoneSize % SHADOW_GRANULARITY == 0);
+
 // For small size classes inline PoisonShadow for better performance.
 ALWAYS_INLINE void SetShadow(uptr ptr, uptr size, uptr class_id, u64 magic) {
-  CHECK_EQ(SHADOW_SCALE, 3);  // This code expects SHADOW_SCALE=3.
   u64 *shadow = reinterpret_cast<u64*>(MemToShadow(ptr));
-  if (class_id <= 6) {
+  // The inlined loop writes 8 << class_id shadow bytes, which is the shadow
+  // of the frame only with the default 1:8 mapping.
+  if (SHADOW_SCALE == 3 && class_id <= 6) {
     for (uptr i = 0; i < (((uptr)1) << class_id); i++) {
       shadow[i] = magic;
       // Make sure this does not become memset.
@@ -42,6 +47,56 @@ ALWAYS_INLINE void SetShadow(uptr ptr, uptr size, uptr class_id, u64 magic) {
   }
 }
 
+// Fake stacks of exited threads. Each slot holds a page aligned FakeStack
+// address with its stack_size_log in the low bits, so that a slot can be
+// checked without touching a FakeStack another thread may have unmapped.
+// Create() can run in a signal handler, hence no locks.
+static const uptr kFakeStackPoolSlots = 64;
+static const uptr kFakeStackPoolLogMask = 4095;
+static atomic_uintptr_t fake_stack_pool[kFakeStackPoolSlots];
+
+static uptr FakeStackPoolSize() {
+  return Min<uptr>(Max(flags()->fake_stack_pool_size, 0), kFakeStackPoolSlots);
+}
+
+FakeStack *FakeStack::TakeFromPool(uptr stack_size_log) {
+  for (uptr i = 0, n = FakeStackPoolSize(); i < n; i++) {
+    uptr v = atomic_load(&fake_stack_pool[i], memory_order_acquire);
+    if ((v & kFakeStackPoolLogMask) != stack_size_log) continue;
+    if (atomic_compare_exchange_strong(&fake_stack_pool[i], &v, 0,
+                                       memory_order_acquire))
+      return reinterpret_cast<FakeStack *>(v & ~kFakeStackPoolLogMask);
+  }
+  return nullptr;
+}
+
+// The cheap reset: drop the allocation flags and hints of the frames the
+// exited thread left behind. Only the flags below each hint can be set, so
+// size classes that were never used are not touched at all. The frames keep
+// their pages and their shadow.
+bool FakeStack::PutIntoPool() {
+  uptr n = FakeStackPoolSize();
+  if (!n) return false;
+  uptr v = reinterpret_cast<uptr>(this);
+  CHECK_EQ(v & kFakeStackPoolLogMask, 0);
+  CHECK_LE(stack_size_log_, kFakeStackPoolLogMask);
+  v |= stack_size_log_;
+  for (uptr class_id = 0; class_id < kNumberOfSizeClasses; class_id++) {
+    uptr used = Min(hint_position_[class_id],
+                    NumberOfFrames(stack_size_log_, class_id));
+    internal_memset(GetFlags(stack_size_log_, class_id), 0, used);
+    hint_position_[class_id] = 0;
+  }
+  needs_gc_ = false;
+  for (uptr i = 0; i < n; i++) {
+    uptr empty = 0;
+    if (atomic_compare_exchange_strong(&fake_stack_pool[i], &empty, v,
+                                       memory_order_release))
+      return true;
+  }
+  return false;
+}
+
 FakeStack *FakeStack::Create(uptr stack_size_log) {
   static uptr kMinStackSizeLog = 16;
   static uptr kMaxStackSizeLog = FIRST_32_SECOND_64(24, 28);
@@ -49,6 +104,11 @@ FakeStack *FakeStack::Create(uptr stack_size_log) {
     stack_size_log = kMinStackSizeLog;
   if (stack_size_log > kMaxStackSizeLog)
     stack_size_log = kMaxStackSizeLog;
+  if (FakeStack *res = TakeFromPool(stack_size_log)) {
+    VReport(1, "T%d: FakeStack reused: %p stack_size_log: %zd\n",
+            GetCurrentTidOrInvalid(), res, stack_size_log);
+    return res;
+  }
   uptr size = RequiredSize(stack_size_log);
   FakeStack *res = reinterpret_cast<FakeStack *>(
       flags()->uar_noreserve ? MmapNoReserveOrDie(size, "FakeStack")
@@ -64,7 +124,6 @@ FakeStack *FakeStack::Create(uptr stack_size_log) {
 }
 
 void FakeStack::Destroy(int tid) {
-  PoisonAll(0);
   if (Verbosity() >= 2) {
     InternalScopedString str(kNumberOfSizeClasses * 50);
     for (uptr class_id = 0; class_id < kNumberOfSizeClasses; class_id++)
@@ -72,6 +131,9 @@ void FakeStack::Destroy(int tid) {
                  NumberOfFrames(stack_size_log(), class_id));
     Report("T%d: FakeStack destroyed: %s\n", tid, str.data());
   }
+  if (PutIntoPool())
+    return;
+  PoisonAll(0);
   uptr size = RequiredSize(stack_size_log_);
   FlushUnneededASanShadowMemory(reinterpret_cast<uptr>(this), size);
   UnmapOrDie(this, size);
@@ -82,6 +144,31 @@ void FakeStack::PoisonAll(u8 magic) {
                magic);
 }
 
+// Returns the position of the first free frame in [pos, end), or end.
+// The flags are only ever 0 or 1, so a whole word of them is checked at once
+// by looking at the low bit of each byte. The instrumented code clears the
+// flags directly, so they are the only record of the free frames.
+static uptr FindFreeFrame(const u8 *flags, uptr pos, uptr end) {
+  const uptr kLowBits = ~(uptr)0 / 255;
+  for (; pos < end && (reinterpret_cast<uptr>(flags + pos) % sizeof(uptr));
+       pos++) {
+    if (!flags[pos]) return pos;
+  }
+  for (; pos + sizeof(uptr) <= end; pos += sizeof(uptr)) {
+    uptr free = ~*reinterpret_cast<const uptr *>(flags + pos) & kLowBits;
+    if (!free) continue;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return pos + sizeof(uptr) - 1 - MostSignificantSetBitIndex(free) / 8;
+#else
+    return pos + LeastSignificantSetBitIndex(free) / 8;
+#endif
+  }
+  for (; pos < end; pos++) {
+    if (!flags[pos]) return pos;
+  }
+  return end;
+}
+
 #if !defined(_MSC_VER) || defined(__clang__)
 ALWAYS_INLINE USED
 #endif
@@ -91,26 +178,30 @@ FakeFrame *FakeStack::Allocate(uptr stack_size_log, uptr class_id,
   if (needs_gc_)
     GC(real_stack);
   uptr &hint_position = hint_position_[class_id];
-  const int num_iter = NumberOfFrames(stack_size_log, class_id);
+  const uptr num_frames = NumberOfFrames(stack_size_log, class_id);
   u8 *flags = GetFlags(stack_size_log, class_id);
-  for (int i = 0; i < num_iter; i++) {
-    uptr pos = ModuloNumberOfFrames(stack_size_log, class_id, hint_position++);
-    // This part is tricky. On one hand, checking and setting flags[pos]
-    // should be atomic to ensure async-signal safety. But on the other hand,
-    // if the signal arrives between checking and setting flags[pos], the
-    // signal handler's fake stack will start from a different hint_position
-    // and so will not touch this particular byte. So, it is safe to do this
-    // with regular non-atomic load and store (at least I was not able to make
-    // this code crash).
-    if (flags[pos]) continue;
-    flags[pos] = 1;
-    FakeFrame *res = reinterpret_cast<FakeFrame *>(
-        GetFrame(stack_size_log, class_id, pos));
-    res->real_stack = real_stack;
-    *SavedFlagPtr(reinterpret_cast<uptr>(res), class_id) = &flags[pos];
-    return res;
+  // Look for a free frame from the hint to the end, then from the beginning
+  // to the hint, so that the frames are still used in round robin order.
+  uptr start = ModuloNumberOfFrames(stack_size_log, class_id, hint_position);
+  uptr pos = FindFreeFrame(flags, start, num_frames);
+  if (pos == num_frames) {
+    pos = FindFreeFrame(flags, 0, start);
+    if (pos == start) return nullptr;  // We are out of fake stack.
   }
-  return nullptr; // We are out of fake stack.
+  // This part is tricky. On one hand, checking and setting flags[pos]
+  // should be atomic to ensure async-signal safety. But on the other hand,
+  // if the signal arrives between checking and setting flags[pos], the
+  // signal handler may take the same frame, but it frees all of its frames
+  // before we get to run again. So, it is safe to do this with regular
+  // non-atomic load and store.
+  hint_position +=
+      ModuloNumberOfFrames(stack_size_log, class_id, pos - start) + 1;
+  flags[pos] = 1;
+  FakeFrame *res = reinterpret_cast<FakeFrame *>(
+      GetFrame(stack_size_log, class_id, pos));
+  res->real_stack = real_stack;
+  *SavedFlagPtr(reinterpret_cast<uptr>(res), class_id) = &flags[pos];
+  return res;
 }
 
 uptr FakeStack::AddrIsInFakeStack(uptr ptr, uptr *frame_beg, uptr *frame_end) {
@@ -62,9 +62,12 @@ class FakeStack {
   static const uptr kNumberOfSizeClasses =
        kMaxStackFrameSizeLog - kMinStackFrameSizeLog + 1;
 
-  // CTOR: create the FakeStack as a single mmap-ed object.
+  // CTOR: create the FakeStack as a single mmap-ed object, or take one of
+  // the same size retired by an exited thread.
   static FakeStack *Create(uptr stack_size_log);
 
+  // Retires the FakeStack into the pool (see fake_stack_pool_size), or
+  // unmaps it if the pool is full.
   void Destroy(int tid);
 
   // stack_size_log is at least 15 (stack_size >= 32K).
@@ -157,6 +160,8 @@ class FakeStack {
 
  private:
   FakeStack() { }
+  static FakeStack *TakeFromPool(uptr stack_size_log);
+  bool PutIntoPool();
   static const uptr kFlagsOffset = 4096;  // This is were the flags begin.
   // Must match the number of uses of DEFINE_STACK_MALLOC_FREE_WITH_CLASS_ID
   COMPILER_CHECK(kNumberOfSizeClasses == 11);
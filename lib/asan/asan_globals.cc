@@ -31,14 +31,34 @@ namespace __asan {
 
 typedef __asan_global Global;
 
-struct ListOfGlobals {
+// Registered globals are kept in an interval index rather than in a list, so
+// that looking up the globals near an address stays cheap in processes with
+// hundreds of thousands of globals. Every __asan_register_globals call adds a
+// batch: pointers to its globals sorted by address, each paired with the
+// running maximum of the end addresses up to it. A lookup binary searches the
+// batch and walks back only while a preceding global may still cover the
+// address.
+struct IndexedGlobal {
   const Global *g;
-  ListOfGlobals *next;
+  uptr max_end;
 };
+typedef InternalMmapVector<IndexedGlobal> IndexedGlobalVector;
+
+struct GlobalsBatch {
+  const Global *globals;  // The array passed to __asan_register_globals.
+  uptr n;
+  uptr first;  // Index of the first global of the batch in indexed_globals.
+  uptr count;  // Number of globals of the batch registered so far.
+  uptr beg, end;  // Address range covered by the registered globals.
+  bool live;
+};
+typedef InternalMmapVector<GlobalsBatch> GlobalsBatchVector;
 
 static BlockingMutex mu_for_globals(LINKER_INITIALIZED);
 static LowLevelAllocator allocator_for_globals;
-static ListOfGlobals *list_of_all_globals;
+static const int kIndexedGlobalsInitialCapacity = 1024;
+static IndexedGlobalVector *indexed_globals;
+static GlobalsBatchVector *globals_batches;
 
 static const int kDynamicInitGlobalsInitialCapacity = 512;
 struct DynInitGlobal {
@@ -104,21 +124,44 @@ static u32 FindRegistrationSite(const Global *g) {
   return 0;
 }
 
+static bool IndexedGlobalBegLess(const IndexedGlobal &e, uptr addr) {
+  return e.g->beg < addr;
+}
+
+// Returns the index of the first registered global of the batch that starts
+// at or above addr.
+static uptr BatchLowerBound(const GlobalsBatch &batch, uptr addr) {
+  return InternalLowerBound(*indexed_globals, batch.first,
+                            batch.first + batch.count, addr,
+                            IndexedGlobalBegLess);
+}
+
 int GetGlobalsForAddress(uptr addr, Global *globals, u32 *reg_sites,
                          int max_globals) {
   if (!flags()->report_globals) return 0;
   BlockingMutexLock lock(&mu_for_globals);
+  if (!globals_batches) return 0;
   int res = 0;
-  for (ListOfGlobals *l = list_of_all_globals; l; l = l->next) {
-    const Global &g = *l->g;
-    if (flags()->report_globals >= 2)
-      ReportGlobal(g, "Search");
-    if (IsAddressNearGlobal(addr, g)) {
-      globals[res] = g;
-      if (reg_sites)
-        reg_sites[res] = FindRegistrationSite(&g);
-      res++;
-      if (res == max_globals) break;
+  // Visit the most recently registered batches first.
+  for (uptr b = globals_batches->size(); b > 0 && res < max_globals; b--) {
+    const GlobalsBatch &batch = (*globals_batches)[b - 1];
+    if (!batch.live || !batch.count) continue;
+    if (addr >= batch.end ||
+        addr + kMinimalDistanceFromAnotherGlobal <= batch.beg)
+      continue;
+    uptr i = BatchLowerBound(batch, addr + kMinimalDistanceFromAnotherGlobal);
+    while (i > batch.first && res < max_globals) {
+      const IndexedGlobal &e = (*indexed_globals)[--i];
+      if (e.max_end <= addr) break;
+      const Global &g = *e.g;
+      if (flags()->report_globals >= 2)
+        ReportGlobal(g, "Search");
+      if (IsAddressNearGlobal(addr, g)) {
+        globals[res] = g;
+        if (reg_sites)
+          reg_sites[res] = FindRegistrationSite(&g);
+        res++;
+      }
     }
   }
   return res;
@@ -140,12 +183,17 @@ static void CheckODRViolationViaIndicator(const Global *g) {
   }
   // If *odr_indicator is DEFINED, some module have already registered
   // externally visible symbol with the same name. This is an ODR violation.
-  for (ListOfGlobals *l = list_of_all_globals; l; l = l->next) {
-    if (g->odr_indicator == l->g->odr_indicator &&
-        (flags()->detect_odr_violation >= 2 || g->size != l->g->size) &&
-        !IsODRViolationSuppressed(g->name))
-      ReportODRViolation(g, FindRegistrationSite(g),
-                         l->g, FindRegistrationSite(l->g));
+  for (uptr b = 0, nb = globals_batches->size(); b < nb; b++) {
+    const GlobalsBatch &batch = (*globals_batches)[b];
+    if (!batch.live) continue;
+    for (uptr i = batch.first; i < batch.first + batch.count; i++) {
+      const Global *other = (*indexed_globals)[i].g;
+      if (g->odr_indicator == other->odr_indicator &&
+          (flags()->detect_odr_violation >= 2 || g->size != other->size) &&
+          !IsODRViolationSuppressed(g->name))
+        ReportODRViolation(g, FindRegistrationSite(g),
+                           other, FindRegistrationSite(other));
+    }
   }
 }
 
@@ -156,12 +204,18 @@ static void CheckODRViolationViaPoisoning(const Global *g) {
   if (__asan_region_is_poisoned(g->beg, g->size_with_redzone)) {
     // This check may not be enough: if the first global is much larger
     // the entire redzone of the second global may be within the first global.
-    for (ListOfGlobals *l = list_of_all_globals; l; l = l->next) {
-      if (g->beg == l->g->beg &&
-          (flags()->detect_odr_violation >= 2 || g->size != l->g->size) &&
-          !IsODRViolationSuppressed(g->name))
-        ReportODRViolation(g, FindRegistrationSite(g),
-                           l->g, FindRegistrationSite(l->g));
+    for (uptr b = 0, nb = globals_batches->size(); b < nb; b++) {
+      const GlobalsBatch &batch = (*globals_batches)[b];
+      if (!batch.live || g->beg < batch.beg || g->beg >= batch.end) continue;
+      for (uptr i = BatchLowerBound(batch, g->beg);
+           i < batch.first + batch.count; i++) {
+        const Global *other = (*indexed_globals)[i].g;
+        if (other->beg != g->beg) break;
+        if ((flags()->detect_odr_violation >= 2 || g->size != other->size) &&
+            !IsODRViolationSuppressed(g->name))
+          ReportODRViolation(g, FindRegistrationSite(g),
+                             other, FindRegistrationSite(other));
+      }
     }
   }
 }
@@ -190,7 +244,7 @@ static inline bool UseODRIndicator(const Global *g) {
 
 // Register a global variable.
 // This function may be called more than once for every global
-// so we store the globals in a map.
+// so we store the globals in a map. The caller adds G to the index.
 static void RegisterGlobal(const Global *g) {
   CHECK(asan_inited);
   if (flags()->report_globals >= 2)
@@ -218,10 +272,6 @@ static void RegisterGlobal(const Global *g) {
   }
   if (CanPoisonMemory())
     PoisonRedZones(*g);
-  ListOfGlobals *l = new(allocator_for_globals) ListOfGlobals;
-  l->g = g;
-  l->next = list_of_all_globals;
-  list_of_all_globals = l;
   if (g->has_dynamic_init) {
     if (!dynamic_init_globals) {
       dynamic_init_globals = new(allocator_for_globals)
@@ -232,6 +282,30 @@ static void RegisterGlobal(const Global *g) {
   }
 }
 
+static bool IndexedGlobalLess(const IndexedGlobal &a, const IndexedGlobal &b) {
+  return a.g->beg < b.g->beg;
+}
+
+// Drops the batch registered for GLOBALS from the index, so that globals of
+// an unloaded module are never reported. Space taken by the batches at the
+// end of the index is reused by later registrations.
+static void RemoveGlobalsBatch(const Global *globals, uptr n) {
+  mu_for_globals.CheckLocked();
+  if (!globals_batches) return;
+  for (uptr b = globals_batches->size(); b > 0; b--) {
+    GlobalsBatch &batch = (*globals_batches)[b - 1];
+    if (batch.live && batch.globals == globals && batch.n == n) {
+      batch.live = false;
+      break;
+    }
+  }
+  while (globals_batches->size() && !globals_batches->back().live) {
+    while (indexed_globals->size() > globals_batches->back().first)
+      indexed_globals->pop_back();
+    globals_batches->pop_back();
+  }
+}
+
 static void UnregisterGlobal(const Global *g) {
   CHECK(asan_inited);
   if (flags()->report_globals >= 2)
@@ -242,9 +316,8 @@ static void UnregisterGlobal(const Global *g) {
   CHECK(AddrIsAlignedByGranularity(g->size_with_redzone));
   if (CanPoisonMemory())
     PoisonShadowForGlobal(g, 0);
-  // We unpoison the shadow memory for the global but we do not remove it from
-  // the list because that would require O(n^2) time with the current list
-  // implementation. It might not be worth doing anyway.
+  // The global is dropped from the index together with its whole batch by
+  // __asan_unregister_globals.
 
   // Release ODR indicator.
   if (UseODRIndicator(g)) {
@@ -347,6 +420,12 @@ void __asan_register_globals(__asan_global *globals, uptr n) {
     PRINT_CURRENT_STACK();
     Printf("=== ID %d; %p %p\n", stack_id, &globals[0], &globals[n - 1]);
   }
+  if (!globals_batches) {
+    indexed_globals = new(allocator_for_globals)
+        IndexedGlobalVector(kIndexedGlobalsInitialCapacity);
+    globals_batches = new(allocator_for_globals) GlobalsBatchVector(64);
+  }
+  uptr first = indexed_globals->size();
   for (uptr i = 0; i < n; i++) {
     if (SANITIZER_WINDOWS && globals[i].beg == 0) {
       // The MSVC incremental linker may pad globals out to 256 bytes. As long
@@ -362,7 +441,26 @@ void __asan_register_globals(__asan_global *globals, uptr n) {
             globals[i].odr_indicator == 0);
       continue;
     }
-    RegisterGlobal(&globals[i]);
+    IndexedGlobal e = {&globals[i], 0};
+    indexed_globals->push_back(e);
+  }
+  uptr count = indexed_globals->size() - first;
+  if (!count) return;
+  // Register the globals in address order: the redzones are then poisoned in
+  // a single forward sweep over the shadow, and the part of the batch that is
+  // already registered is a sorted prefix the ODR checks can search.
+  IndexedGlobal *batch_globals = &(*indexed_globals)[first];
+  InternalSort(&batch_globals, count, IndexedGlobalLess);
+  GlobalsBatch new_batch = {globals, n, first, 0, batch_globals[0].g->beg, 0,
+                            true};
+  globals_batches->push_back(new_batch);
+  GlobalsBatch &batch = globals_batches->back();
+  for (uptr i = 0; i < count; i++) {
+    const Global *g = batch_globals[i].g;
+    RegisterGlobal(g);
+    batch.end = Max(batch.end, g->beg + g->size_with_redzone);
+    batch_globals[i].max_end = batch.end;
+    batch.count++;
   }
 }
 
@@ -379,6 +477,7 @@ void __asan_unregister_globals(__asan_global *globals, uptr n) {
     }
     UnregisterGlobal(&globals[i]);
   }
+  RemoveGlobalsBatch(globals, n);
 }
 
 // This method runs immediately prior to dynamic initialization in each TU,
@@ -23,6 +23,7 @@
 #include "asan_suppressions.h"
 #include "lsan/lsan_common.h"
 #include "sanitizer_common/sanitizer_libc.h"
+#include "sanitizer_common/sanitizer_self_profile.h"
 
 #if SANITIZER_POSIX
 #include "sanitizer_common/sanitizer_posix.h"
@@ -43,6 +44,12 @@ static inline bool QuickCheckForUnpoisonedRegion(uptr beg, uptr size) {
     return !AddressIsPoisoned(beg) &&
            !AddressIsPoisoned(beg + size - 1) &&
            !AddressIsPoisoned(beg + size / 2);
+  if (size <= 64)
+    return !AddressIsPoisoned(beg) &&
+           !AddressIsPoisoned(beg + size / 4) &&
+           !AddressIsPoisoned(beg + size - 1) &&
+           !AddressIsPoisoned(beg + 3 * size / 4) &&
+           !AddressIsPoisoned(beg + size / 2);
   return false;
 }
 
@@ -54,7 +61,8 @@ struct AsanInterceptorContext {
 // and ASAN_WRITE_RANGE as macro instead of function so
 // that no extra frames are created, and stack trace contains
 // relevant information only.
-// We check all shadow bytes.
+// We check all shadow bytes; larger ranges go to __asan_region_is_poisoned,
+// which scans the shadow with mem_find_nonzero.
 #define ACCESS_MEMORY_RANGE(ctx, offset, size, isWrite) do {            \
     uptr __offset = (uptr)(offset);                                     \
     uptr __size = (uptr)(size);                                         \
@@ -184,6 +192,7 @@ DECLARE_REAL_AND_INTERCEPTOR(void *, malloc, uptr)
 DECLARE_REAL_AND_INTERCEPTOR(void, free, void *)
 
 #define ASAN_INTERCEPTOR_ENTER(ctx, func)                                      \
+  ScopedSelfProfile _self_profile(kSelfProfileInterceptor);                    \
   AsanInterceptorContext _ctx = {#func};                                       \
   ctx = (void *)&_ctx;                                                         \
   (void) ctx;                                                                  \
@@ -712,6 +721,10 @@ void InitializeAsanInterceptors() {
   static bool was_called_once;
   CHECK(!was_called_once);
   was_called_once = true;
+#if SANITIZER_WINDOWS
+  // Flip the protection of each patched page once for all the interceptors.
+  __interception::BeginOverrideBatch();
+#endif
   InitializeCommonInterceptors();
 
   // Intercept str* functions.
@@ -781,6 +794,12 @@ void InitializeAsanInterceptors() {
 
   InitializePlatformInterceptors();
 
+#if SANITIZER_WINDOWS
+  if (!__interception::EndOverrideBatch())
+    VReport(1, "AddressSanitizer: failed to restore the protection of "
+               "patched pages\n");
+#endif
+
   VReport(1, "AddressSanitizer: libc interceptors initialized\n");
 }
 
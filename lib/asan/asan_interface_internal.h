@@ -25,6 +25,7 @@
 using __sanitizer::uptr;
 using __sanitizer::u64;
 using __sanitizer::u32;
+using __sanitizer::u8;
 
 extern "C" {
   // This function should be called at the very beginning of the process,
@@ -95,6 +96,15 @@ extern "C" {
   SANITIZER_INTERFACE_ATTRIBUTE
   void __asan_set_shadow_f8(uptr addr, uptr size);
 
+  // Sets the shadow of a whole stack frame from its precomputed layout, and
+  // clears it again. The layout is a sequence of (length, value) byte pairs,
+  // each a run of |length| shadow bytes set to |value|, ended by a zero
+  // length.
+  SANITIZER_INTERFACE_ATTRIBUTE
+  void __asan_set_shadow_frame(uptr addr, const u8 *layout);
+  SANITIZER_INTERFACE_ATTRIBUTE
+  void __asan_clear_shadow_frame(uptr addr, const u8 *layout);
+
   // These two functions are used by instrumented code in the
   // use-after-scope mode. They mark memory for local variables as
   // unaddressable when they leave scope and addressable before the
@@ -187,11 +197,15 @@ extern "C" {
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_load4(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_load8(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_load16(uptr p);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_load32(uptr p);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_load64(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store1(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store2(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store4(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store8(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store16(uptr p);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_store32(uptr p);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_store64(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_loadN(uptr p, uptr size);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_storeN(uptr p, uptr size);
 
@@ -200,11 +214,15 @@ extern "C" {
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_load4_noabort(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_load8_noabort(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_load16_noabort(uptr p);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_load32_noabort(uptr p);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_load64_noabort(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store1_noabort(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store2_noabort(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store4_noabort(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store8_noabort(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_store16_noabort(uptr p);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_store32_noabort(uptr p);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_store64_noabort(uptr p);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_loadN_noabort(uptr p, uptr size);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_storeN_noabort(uptr p, uptr size);
 
@@ -213,11 +231,15 @@ extern "C" {
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_load4(uptr p, u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_load8(uptr p, u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_load16(uptr p, u32 exp);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_load32(uptr p, u32 exp);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_load64(uptr p, u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_store1(uptr p, u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_store2(uptr p, u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_store4(uptr p, u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_store8(uptr p, u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_store16(uptr p, u32 exp);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_store32(uptr p, u32 exp);
+  SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_store64(uptr p, u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_loadN(uptr p, uptr size,
                                                       u32 exp);
   SANITIZER_INTERFACE_ATTRIBUTE void __asan_exp_storeN(uptr p, uptr size,
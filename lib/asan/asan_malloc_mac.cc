@@ -42,7 +42,7 @@ using namespace __asan;
   GET_STACK_TRACE_MALLOC; \
   void *p = asan_memalign(GetPageSizeCached(), size, &stack, FROM_MALLOC);
 #define COMMON_MALLOC_FREE(ptr) \
-  GET_STACK_TRACE_FREE; \
+  GET_STACK_TRACE_FREE(ptr); \
   asan_free(ptr, &stack, FROM_MALLOC);
 #define COMMON_MALLOC_SIZE(ptr) \
   uptr size = asan_mz_size(ptr);
@@ -52,7 +52,7 @@ using namespace __asan;
   CHECK(sizeof(malloc_statistics_t) == sizeof(AsanMallocStats)); \
   internal_memcpy(stats, &malloc_stats, sizeof(malloc_statistics_t));
 #define COMMON_MALLOC_REPORT_UNKNOWN_REALLOC(ptr, zone_ptr, zone_name) \
-  GET_STACK_TRACE_FREE; \
+  GET_STACK_TRACE_FREE(ptr); \
   ReportMacMzReallocUnknown((uptr)ptr, (uptr)zone_ptr, zone_name, &stack);
 #define COMMON_MALLOC_NAMESPACE __asan
 
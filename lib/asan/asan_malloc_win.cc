@@ -41,7 +41,7 @@ using namespace __asan;  // NOLINT
 extern "C" {
 ALLOCATION_FUNCTION_ATTRIBUTE
 void free(void *ptr) {
-  GET_STACK_TRACE_FREE;
+  GET_STACK_TRACE_FREE(ptr);
   return asan_free(ptr, &stack, FROM_MALLOC);
 }
 
@@ -177,7 +177,7 @@ INTERCEPTOR_WINAPI(LPVOID, HeapAlloc, HANDLE hHeap, DWORD dwFlags,
 
 INTERCEPTOR_WINAPI(BOOL, HeapFree, HANDLE hHeap, DWORD dwFlags, LPVOID lpMem) {
   CHECK(dwFlags == 0 && "unsupported heap flags");
-  GET_STACK_TRACE_FREE;
+  GET_STACK_TRACE_FREE(lpMem);
   asan_free(lpMem, &stack, FROM_MALLOC);
   return true;
 }
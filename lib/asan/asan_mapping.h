@@ -124,7 +124,26 @@
 // || `[0x30000000, 0x35ffffff]` || LowShadow  ||
 // || `[0x00000000, 0x2fffffff]` || LowMem     ||
 
+// The shadow scale is fixed at build time and must match the one the code is
+// instrumented with (-mllvm -asan-mapping-scale). Runtimes for the coarser
+// 1:16 and 1:32 mappings are built with -DASAN_SHADOW_SCALE=4 or 5, see
+// COMPILER_RT_ASAN_SHADOW_SCALE in CMakeLists.txt. They take 1/2 or 1/4 of
+// the default shadow, and detect less:
+//   - Heap chunks are aligned to the granule and have a left redzone of at
+//     least one granule, so small allocations use more memory.
+//   - Manual poisoning (__asan_poison_memory_region) and container
+//     annotations only poison whole granules, so more bytes before a poisoned
+//     region may stay addressable.
+//   - The fake stack always poisons whole frames instead of writing their
+//     shadow inline, which makes use-after-return detection slower.
+#if defined(ASAN_SHADOW_SCALE)
+# if ASAN_SHADOW_SCALE < 3 || ASAN_SHADOW_SCALE > 5
+#  error "ASAN_SHADOW_SCALE must be 3, 4 or 5"
+# endif
+static const u64 kDefaultShadowScale = ASAN_SHADOW_SCALE;
+#else
 static const u64 kDefaultShadowScale = 3;
+#endif
 static const u64 kDefaultShadowSentinel = ~(uptr)0;
 static const u64 kDefaultShadowOffset32 = 1ULL << 29;  // 0x20000000
 static const u64 kDefaultShadowOffset64 = 1ULL << 44;
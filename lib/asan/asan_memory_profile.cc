@@ -9,10 +9,12 @@
 //
 // This file is a part of AddressSanitizer, an address sanity checker.
 //
-// This file implements __sanitizer_print_memory_profile.
+// This file implements __sanitizer_print_memory_profile and
+// __sanitizer_write_memory_profile.
 //===----------------------------------------------------------------------===//
 
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_allocator_interface.h"
 #include "sanitizer_common/sanitizer_stackdepot.h"
 #include "sanitizer_common/sanitizer_stacktrace.h"
 #include "sanitizer_common/sanitizer_stoptheworld.h"
@@ -113,6 +115,120 @@ static void MemoryProfileCB(const SuspendedThreadsList &suspended_threads_list,
 
 #endif  // CAN_SANITIZE_LEAKS
 
+namespace __asan {
+
+// Binary heap profile written by __sanitizer_write_memory_profile. All fields
+// are in the native byte order; every profile is self-contained, so a file
+// holding a stream of them can be cut at any profile boundary.
+//   BinaryHeapProfileHeader
+//   num_sites x BinaryHeapProfileSite, sorted by stack_id
+//   num_stacks x (u32 stack_id, u32 size, u64 pc[size])
+// Sites are keyed by StackDepot ids, which are stable for the whole process
+// lifetime: diffing two profiles is a merge of their site arrays, and a stack
+// needs to be symbolized once no matter how many profiles it appears in.
+static const char kBinaryHeapProfileMagic[8] = {'A', 'S', 'A', 'N',
+                                                 'H', 'P', 'F', '1'};
+
+struct BinaryHeapProfileHeader {
+  char magic[8];
+  u64 timestamp_ns;
+  u64 allocated_bytes;  // Estimated from the sampled chunks.
+  u64 allocated_count;
+  u32 sample_rate;
+  u32 num_sites;
+  u32 num_stacks;
+  u32 reserved;
+};
+
+struct BinaryHeapProfileSite {
+  u32 stack_id;
+  u32 reserved;
+  u64 bytes;  // Estimated from the sampled chunks.
+  u64 count;
+};
+
+struct SampledChunk {
+  u32 stack_id;
+  uptr size;
+};
+
+class BinaryHeapProfile {
+ public:
+  explicit BinaryHeapProfile(uptr sample_rate)
+      : sample_rate_(Max<uptr>(sample_rate, 1)), chunks_(1024), sites_(256) {}
+
+  void Collect() {
+    ForEachAllocatedChunkSampled(sample_rate_, ChunkCallback, this);
+    // Aggregate with the allocator unlocked.
+    InternalSort(&chunks_, chunks_.size(),
+                 [](const SampledChunk &a, const SampledChunk &b) {
+                   return a.stack_id < b.stack_id;
+                 });
+    for (uptr i = 0; i < chunks_.size(); i++) {
+      const SampledChunk &c = chunks_[i];
+      allocated_bytes_ += c.size * sample_rate_;
+      allocated_count_ += sample_rate_;
+      if (!c.stack_id) continue;
+      if (!sites_.size() || sites_.back().stack_id != c.stack_id)
+        sites_.push_back({c.stack_id, 0, 0, 0});
+      sites_.back().bytes += c.size * sample_rate_;
+      sites_.back().count += sample_rate_;
+    }
+  }
+
+  bool Write(fd_t fd) {
+    BinaryHeapProfileHeader header = {};
+    internal_memcpy(header.magic, kBinaryHeapProfileMagic,
+                    sizeof(header.magic));
+    header.timestamp_ns = NanoTime();
+    header.allocated_bytes = allocated_bytes_;
+    header.allocated_count = allocated_count_;
+    header.sample_rate = sample_rate_;
+    header.num_sites = sites_.size();
+    header.num_stacks = sites_.size();
+    if (!WriteAll(fd, &header, sizeof(header)) ||
+        !WriteAll(fd, sites_.data(),
+                  sites_.size() * sizeof(BinaryHeapProfileSite)))
+      return false;
+    for (uptr i = 0; i < sites_.size(); i++) {
+      StackTrace stack = StackDepotGet(sites_[i].stack_id);
+      u32 stack_header[2] = {sites_[i].stack_id, (u32)stack.size};
+      u64 pcs[kStackTraceMax];
+      for (uptr j = 0; j < stack.size; j++)
+        pcs[j] = stack.trace[j];
+      if (!WriteAll(fd, stack_header, sizeof(stack_header)) ||
+          !WriteAll(fd, pcs, stack.size * sizeof(pcs[0])))
+        return false;
+    }
+    return true;
+  }
+
+ private:
+  uptr sample_rate_;
+  uptr allocated_bytes_ = 0;
+  uptr allocated_count_ = 0;
+  InternalMmapVector<SampledChunk> chunks_;
+  InternalMmapVector<BinaryHeapProfileSite> sites_;
+
+  static void ChunkCallback(u32 stack_id, uptr size, void *arg) {
+    reinterpret_cast<BinaryHeapProfile *>(arg)->chunks_.push_back(
+        {stack_id, size});
+  }
+
+  static bool WriteAll(fd_t fd, const void *buff, uptr size) {
+    uptr written;
+    while (size) {
+      if (!WriteToFile(fd, buff, size, &written) || !written)
+        return false;
+      buff = reinterpret_cast<const char *>(buff) + written;
+      size -= written;
+    }
+    return true;
+  }
+};
+
+}  // namespace __asan
+
 extern "C" {
 SANITIZER_INTERFACE_ATTRIBUTE
 void __sanitizer_print_memory_profile(uptr top_percent,
@@ -124,4 +240,11 @@ void __sanitizer_print_memory_profile(uptr top_percent,
   __sanitizer::StopTheWorld(__asan::MemoryProfileCB, Arg);
 #endif  // CAN_SANITIZE_LEAKS
 }
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int __sanitizer_write_memory_profile(void *fd, uptr sample_rate) {
+  __asan::BinaryHeapProfile profile(sample_rate);
+  profile.Collect();
+  return profile.Write((__sanitizer::fd_t)reinterpret_cast<uptr>(fd));
+}
 }  // extern "C"
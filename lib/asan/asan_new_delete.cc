@@ -117,7 +117,7 @@ INTERCEPTOR(void *, _ZnamRKSt9nothrow_t, size_t size, std::nothrow_t const&) {
 #endif
 
 #define OPERATOR_DELETE_BODY(type) \
-  GET_STACK_TRACE_FREE;\
+  GET_STACK_TRACE_FREE(ptr);\
   asan_free(ptr, &stack, type);
 
 #if !SANITIZER_MAC
@@ -139,12 +139,12 @@ void operator delete[](void *ptr, std::nothrow_t const&) {
 }
 CXX_OPERATOR_ATTRIBUTE
 void operator delete(void *ptr, size_t size) NOEXCEPT {
-  GET_STACK_TRACE_FREE;
+  GET_STACK_TRACE_FREE(ptr);
   asan_sized_free(ptr, size, &stack, FROM_NEW);
 }
 CXX_OPERATOR_ATTRIBUTE
 void operator delete[](void *ptr, size_t size) NOEXCEPT {
-  GET_STACK_TRACE_FREE;
+  GET_STACK_TRACE_FREE(ptr);
   asan_sized_free(ptr, size, &stack, FROM_NEW_BR);
 }
 CXX_OPERATOR_ATTRIBUTE
@@ -165,12 +165,12 @@ void operator delete[](void *ptr, std::align_val_t, std::nothrow_t const&) {
 }
 CXX_OPERATOR_ATTRIBUTE
 void operator delete(void *ptr, size_t size, std::align_val_t) NOEXCEPT {
-  GET_STACK_TRACE_FREE;
+  GET_STACK_TRACE_FREE(ptr);
   asan_sized_free(ptr, size, &stack, FROM_NEW);
 }
 CXX_OPERATOR_ATTRIBUTE
 void operator delete[](void *ptr, size_t size, std::align_val_t) NOEXCEPT {
-  GET_STACK_TRACE_FREE;
+  GET_STACK_TRACE_FREE(ptr);
   asan_sized_free(ptr, size, &stack, FROM_NEW_BR);
 }
 
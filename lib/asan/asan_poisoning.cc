@@ -41,6 +41,36 @@ void PoisonShadow(uptr addr, uptr size, u8 value) {
   FastPoisonShadow(addr, size, value);
 }
 
+void UnpoisonShadowSparse(uptr addr, uptr size) {
+  if (!CanPoisonMemory()) return;
+  CHECK(AddrIsAlignedByGranularity(addr));
+  CHECK(AddrIsInMem(addr));
+  CHECK(AddrIsAlignedByGranularity(addr + size));
+  CHECK(AddrIsInMem(addr + size - SHADOW_GRANULARITY));
+  static const uptr kChunk = 64;
+  static const uptr kMaxScannedShadow = 1 << 20;
+  uptr shadow_beg = MEM_TO_SHADOW(addr);
+  uptr shadow_end = MEM_TO_SHADOW(addr + size - SHADOW_GRANULARITY) + 1;
+  uptr chunk_beg = RoundUpTo(shadow_beg, kChunk);
+  uptr chunk_end = RoundDownTo(shadow_end, kChunk);
+  if (SANITIZER_WINDOWS || shadow_end - shadow_beg > kMaxScannedShadow ||
+      chunk_beg >= chunk_end) {
+    FastPoisonShadow(addr, size, 0);
+    return;
+  }
+  REAL(memset)((void *)shadow_beg, 0, chunk_beg - shadow_beg);
+  REAL(memset)((void *)chunk_end, 0, shadow_end - chunk_end);
+  for (u64 *p = (u64 *)chunk_beg; p < (u64 *)chunk_end; p += kChunk / 8) {
+    u64 poisoned = 0;
+    for (uptr i = 0; i < kChunk / 8; i++)
+      poisoned |= p[i];
+    if (UNLIKELY(poisoned)) {
+      for (uptr i = 0; i < kChunk / 8; i++)
+        p[i] = 0;
+    }
+  }
+}
+
 void PoisonShadowPartialRightRedzone(uptr addr,
                                      uptr size,
                                      uptr redzone_size,
@@ -69,6 +99,31 @@ void FlushUnneededASanShadowMemory(uptr p, uptr size) {
   ReleaseMemoryPagesToOS(MemToShadow(p), MemToShadow(p + size));
 }
 
+uptr PoisonShadowEdgesAndRelease(uptr aligned_beg, uptr aligned_size,
+                                 u8 value, uptr guard_size) {
+  if (!CanPoisonMemory()) return 0;
+  CHECK(AddrIsAlignedByGranularity(aligned_beg));
+  CHECK(AddrIsAlignedByGranularity(aligned_size));
+  uptr page_size = GetPageSizeCached();
+  uptr shadow_beg = MemToShadow(aligned_beg);
+  uptr shadow_end = MemToShadow(aligned_beg + aligned_size);
+  uptr shadow_guard = guard_size / SHADOW_GRANULARITY;
+  if (SANITIZER_WINDOWS || shadow_end - shadow_beg <= 2 * shadow_guard) {
+    PoisonShadow(aligned_beg, aligned_size, value);
+    return 0;
+  }
+  uptr release_beg = RoundUpTo(shadow_beg + shadow_guard, page_size);
+  uptr release_end = RoundDownTo(shadow_end - shadow_guard, page_size);
+  if (release_beg >= release_end) {
+    PoisonShadow(aligned_beg, aligned_size, value);
+    return 0;
+  }
+  REAL(memset)((void *)shadow_beg, value, release_beg - shadow_beg);
+  REAL(memset)((void *)release_end, value, shadow_end - release_end);
+  ReleaseMemoryPagesToOS(release_beg, release_end);
+  return release_end - release_beg;
+}
+
 void AsanPoisonOrUnpoisonIntraObjectRedzone(uptr ptr, uptr size, bool poison) {
   uptr end = ptr + size;
   if (Verbosity()) {
@@ -199,8 +254,24 @@ uptr __asan_region_is_poisoned(uptr beg, uptr size) {
                                 shadow_end - shadow_beg)))
     return 0;
   // The fast check failed, so we have a poisoned byte somewhere.
-  // Find it slowly.
-  for (; beg < end; beg++)
+  // Check the unaligned head byte by byte, then let mem_find_nonzero locate
+  // the first non-zero shadow byte and only scan that granule exactly.
+  uptr head_end = Min(aligned_b, end);
+  for (; beg < head_end; beg++)
+    if (__asan::AddressIsPoisoned(beg))
+      return beg;
+  if (shadow_beg < shadow_end) {
+    uptr pos = __sanitizer::mem_find_nonzero((const char *)shadow_beg,
+                                             shadow_end - shadow_beg);
+    if (pos < shadow_end - shadow_beg) {
+      uptr granule = aligned_b + pos * SHADOW_GRANULARITY;
+      for (beg = granule; beg < granule + SHADOW_GRANULARITY; beg++)
+        if (__asan::AddressIsPoisoned(beg))
+          return beg;
+      UNREACHABLE("non-zero shadow byte, but poisoned byte was not found");
+    }
+  }
+  for (beg = Max(beg, aligned_e); beg < end; beg++)
     if (__asan::AddressIsPoisoned(beg))
       return beg;
   UNREACHABLE("mem_is_zero returned false, but poisoned byte was not found");
@@ -335,6 +406,35 @@ void __asan_set_shadow_f8(uptr addr, uptr size) {
   REAL(memset)((void *)addr, 0xf8, size);
 }
 
+// Sets |size| shadow bytes at |addr| to |value|. The runs of a frame layout
+// are mostly a few bytes long, too short to be worth a call to memset.
+static ALWAYS_INLINE void SetShadowRun(uptr addr, uptr size, u8 value) {
+  uptr end = addr + size;
+  if (size >= 2 * sizeof(uptr)) {
+    const uptr pattern = (~(uptr)0 / 255) * value;
+    for (; addr % sizeof(uptr); addr++)
+      *reinterpret_cast<u8 *>(addr) = value;
+    for (; addr + sizeof(uptr) <= end; addr += sizeof(uptr))
+      *reinterpret_cast<uptr *>(addr) = pattern;
+  }
+  for (; addr < end; addr++)
+    *reinterpret_cast<u8 *>(addr) = value;
+}
+
+void __asan_set_shadow_frame(uptr addr, const u8 *layout) {
+  for (; layout[0]; layout += 2) {
+    SetShadowRun(addr, layout[0], layout[1]);
+    addr += layout[0];
+  }
+}
+
+void __asan_clear_shadow_frame(uptr addr, const u8 *layout) {
+  uptr size = 0;
+  for (; layout[0]; layout += 2)
+    size += layout[0];
+  SetShadowRun(addr, size, 0);
+}
+
 void __asan_poison_stack_memory(uptr addr, uptr size) {
   VReport(1, "poisoning: %p %zx\n", (void *)addr, size);
   PoisonAlignedStackMemory(addr, size, true);
@@ -345,6 +445,10 @@ void __asan_unpoison_stack_memory(uptr addr, uptr size) {
   PoisonAlignedStackMemory(addr, size, false);
 }
 
+// Containers whose annotated boundary moves by at most this many granules
+// have their shadow updated in place.
+static const uptr kContainerDirectShadowBytes = 16;
+
 void __sanitizer_annotate_contiguous_container(const void *beg_p,
                                                const void *end_p,
                                                const void *old_mid_p,
@@ -388,8 +492,19 @@ void __sanitizer_annotate_contiguous_container(const void *beg_p,
   uptr b2 = RoundUpTo(new_mid, granularity);
   // New state:
   // [a, b1) is good, [b2, c) is bad, [b1, b2) is partially good.
-  PoisonShadow(a, b1 - a, 0);
-  PoisonShadow(b2, c - b2, kAsanContiguousContainerOOBMagic);
+  if (c - a <= kContainerDirectShadowBytes * granularity && CanPoisonMemory()) {
+    // push_back/pop_back move the boundary by a granule or two; write the
+    // few affected shadow bytes directly instead of calling PoisonShadow.
+    u8 *shadow = (u8 *)MemToShadow(a);
+    for (uptr p = a; p < b1; p += granularity)
+      *shadow++ = 0;
+    shadow = (u8 *)MemToShadow(b2);
+    for (uptr p = b2; p < c; p += granularity)
+      *shadow++ = kAsanContiguousContainerOOBMagic;
+  } else {
+    PoisonShadow(a, b1 - a, 0);
+    PoisonShadow(b2, c - b2, kAsanContiguousContainerOOBMagic);
+  }
   if (b1 != b2) {
     CHECK_EQ(b2 - b1, granularity);
     *(u8*)MemToShadow(b1) = static_cast<u8>(new_mid - b1);
@@ -26,6 +26,12 @@ bool CanPoisonMemory();
 // Poisons the shadow memory for "size" bytes starting from "addr".
 void PoisonShadow(uptr addr, uptr size, u8 value);
 
+// PoisonShadow(addr, size, 0), for ranges which are expected to be mostly
+// unpoisoned already, like the stack on __asan_handle_no_return: the shadow is
+// scanned 64 bytes at a time, and only the chunks which are not zero yet are
+// written. Large ranges are left to PoisonShadow, which releases them.
+void UnpoisonShadowSparse(uptr addr, uptr size);
+
 // Poisons the shadow memory for "redzone_size" bytes starting from
 // "addr + size".
 void PoisonShadowPartialRightRedzone(uptr addr,
@@ -74,18 +80,31 @@ ALWAYS_INLINE void FastPoisonShadowPartialRightRedzone(
   DCHECK(CanPoisonMemory());
   bool poison_partial = flags()->poison_partial;
   u8 *shadow = (u8*)MEM_TO_SHADOW(aligned_addr);
-  for (uptr i = 0; i < redzone_size; i += SHADOW_GRANULARITY, shadow++) {
-    if (i + SHADOW_GRANULARITY <= size) {
-      *shadow = 0;  // fully addressable
-    } else if (i >= size) {
-      *shadow = (SHADOW_GRANULARITY == 128) ? 0xff : value;  // unaddressable
-    } else {
-      // first size-i bytes are addressable
-      *shadow = poison_partial ? static_cast<u8>(size - i) : 0;
-    }
+  // The shadow is a run of zeroes, at most one partial byte and a run of
+  // poison bytes, so fill the runs instead of deciding per granule.
+  uptr granules = RoundUpTo(redzone_size, SHADOW_GRANULARITY) /
+                  SHADOW_GRANULARITY;
+  uptr full = Min<uptr>(size / SHADOW_GRANULARITY, granules);
+  REAL(memset)(shadow, 0, full);  // fully addressable
+  shadow += full;
+  if (full < granules && size % SHADOW_GRANULARITY) {
+    // first size % SHADOW_GRANULARITY bytes are addressable
+    *shadow++ = poison_partial ? static_cast<u8>(size % SHADOW_GRANULARITY)
+                               : 0;
+    full++;
   }
+  // unaddressable
+  REAL(memset)(shadow, (SHADOW_GRANULARITY == 128) ? 0xff : value,
+               granules - full);
 }
 
+// Poisons [aligned_beg, aligned_beg+aligned_size) with value like
+// PoisonShadow(), but only writes the shadow of the first and the last
+// guard_size bytes. The whole shadow pages in between are released to the
+// OS, so they read back as zero. Returns the number of shadow bytes released.
+uptr PoisonShadowEdgesAndRelease(uptr aligned_beg, uptr aligned_size,
+                                 u8 value, uptr guard_size);
+
 // Calls __sanitizer::ReleaseMemoryPagesToOS() on
 // [MemToShadow(p), MemToShadow(p+size)].
 void FlushUnneededASanShadowMemory(uptr p, uptr size);
@@ -188,6 +188,14 @@ class ScopedInErrorReport {
       PrintCmdline();
 
     if (common_flags()->print_module_map == 2) PrintModuleMap();
+    // A process that keeps running after the report still needs the module
+    // map to symbolize its reports offline.
+    static bool module_map_printed_at_exit;
+    if (common_flags()->print_module_map == 1 && !halt_on_error_ &&
+        !module_map_printed_at_exit) {
+      module_map_printed_at_exit = true;
+      Atexit(PrintModuleMap);
+    }
 
     // Copy the message buffer so that we could start logging without holding a
     // lock that gets aquired during printing.
@@ -209,6 +217,7 @@ class ScopedInErrorReport {
     if (!halt_on_error_)
       internal_memset(&current_error_, 0, sizeof(current_error_));
 
+    report_file.FinishBuffering();
     CommonSanitizerReportMutex.Unlock();
     reporting_thread_tid_ = kInvalidTid;
     lock_.Unlock();
@@ -236,6 +245,7 @@ class ScopedInErrorReport {
     // recursive reports.
     asanThreadRegistry().Lock();
     CommonSanitizerReportMutex.Lock();
+    report_file.StartBuffering();
     reporting_thread_tid_ = GetCurrentTidOrInvalid();
     Printf("===================================================="
            "=============\n");
@@ -27,6 +27,7 @@
 #include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_flags.h"
 #include "sanitizer_common/sanitizer_libc.h"
+#include "sanitizer_common/sanitizer_self_profile.h"
 #include "sanitizer_common/sanitizer_symbolizer.h"
 #include "lsan/lsan_common.h"
 #include "ubsan/ubsan_init.h"
@@ -104,6 +105,29 @@ void ReserveShadowMemoryRange(uptr beg, uptr end, const char *name) {
     DontDumpShadowMemory(beg, size);
 }
 
+static uptr MemToShadowForHugePages(uptr p) { return MEM_TO_SHADOW(p); }
+
+// Backs the shadow of the heap and of the modules with huge pages, see the
+// huge_pages_for_dense_shadow flag. Must be called after InitializeAllocator.
+static void UseHugePagesForDenseShadow() {
+  uptr heap_beg, heap_end;
+  GetHeapRange(&heap_beg, &heap_end);
+  if (heap_beg < heap_end)
+    UseHugePagesInRegion(MEM_TO_SHADOW(heap_beg),
+                         (heap_end - heap_beg) >> SHADOW_SCALE);
+  UseHugePagesForModulesShadow(MemToShadowForHugePages);
+}
+
+// Lets the forked children start with a clean shadow, see the fast_fork flag.
+// Must be called after InitializeAllocator, pthread_atfork may allocate.
+static void DontForkShadow() {
+  if (kLowShadowBeg)
+    DontForkShadowMemory(kLowShadowBeg, kLowShadowEnd - kLowShadowBeg + 1);
+  if (kMidMemBeg)
+    DontForkShadowMemory(kMidShadowBeg, kMidShadowEnd - kMidShadowBeg + 1);
+  DontForkShadowMemory(kHighShadowBeg, kHighShadowEnd - kHighShadowBeg + 1);
+}
+
 // --------------- LowLevelAllocateCallbac ---------- {{{1
 static void OnLowLevelAllocate(uptr ptr, uptr size) {
   PoisonShadow(ptr, size, kAsanInternalHeapMagic);
@@ -133,11 +157,15 @@ ASAN_REPORT_ERROR(load, false, 2)
 ASAN_REPORT_ERROR(load, false, 4)
 ASAN_REPORT_ERROR(load, false, 8)
 ASAN_REPORT_ERROR(load, false, 16)
+ASAN_REPORT_ERROR(load, false, 32)
+ASAN_REPORT_ERROR(load, false, 64)
 ASAN_REPORT_ERROR(store, true, 1)
 ASAN_REPORT_ERROR(store, true, 2)
 ASAN_REPORT_ERROR(store, true, 4)
 ASAN_REPORT_ERROR(store, true, 8)
 ASAN_REPORT_ERROR(store, true, 16)
+ASAN_REPORT_ERROR(store, true, 32)
+ASAN_REPORT_ERROR(store, true, 64)
 
 #define ASAN_REPORT_ERROR_N(type, is_write)                                 \
 extern "C" NOINLINE INTERFACE_ATTRIBUTE                                     \
@@ -202,6 +230,55 @@ ASAN_MEMORY_ACCESS_CALLBACK(store, true, 4)
 ASAN_MEMORY_ACCESS_CALLBACK(store, true, 8)
 ASAN_MEMORY_ACCESS_CALLBACK(store, true, 16)
 
+// Returns true if the size bytes at addr are known to be addressable from a
+// single load of their shadow. This covers the vector accesses, which are
+// usually aligned to the shadow granularity.
+static ALWAYS_INLINE bool WideAccessIsAddressable(uptr addr, uptr size) {
+  if (addr & (SHADOW_GRANULARITY - 1))
+    return false;
+  uptr sp = MEM_TO_SHADOW(addr);
+  switch (size / SHADOW_GRANULARITY) {
+    case 2: return *reinterpret_cast<u16 *>(sp) == 0;
+    case 4: return *reinterpret_cast<u32 *>(sp) == 0;
+    case 8: return *reinterpret_cast<u64 *>(sp) == 0;
+  }
+  return false;
+}
+
+// The 32 and 64-byte accesses can span a partially addressable granule when
+// they are not aligned, so whatever the fast check can't prove is checked
+// byte-precisely.
+#define ASAN_WIDE_MEMORY_ACCESS_CALLBACK_BODY(type, is_write, size, exp_arg,  \
+                                              fatal)                          \
+    if (UNLIKELY(!WideAccessIsAddressable(addr, size)) &&                     \
+        __asan_region_is_poisoned(addr, size)) {                              \
+      if (__asan_test_only_reported_buggy_pointer) {                          \
+        *__asan_test_only_reported_buggy_pointer = addr;                      \
+      } else {                                                                \
+        GET_CALLER_PC_BP_SP;                                                  \
+        ReportGenericError(pc, bp, sp, addr, is_write, size, exp_arg, fatal); \
+      }                                                                       \
+    }
+
+#define ASAN_WIDE_MEMORY_ACCESS_CALLBACK(type, is_write, size)                \
+  extern "C" NOINLINE INTERFACE_ATTRIBUTE                                     \
+  void __asan_##type##size(uptr addr) {                                       \
+    ASAN_WIDE_MEMORY_ACCESS_CALLBACK_BODY(type, is_write, size, 0, true)      \
+  }                                                                           \
+  extern "C" NOINLINE INTERFACE_ATTRIBUTE                                     \
+  void __asan_exp_##type##size(uptr addr, u32 exp) {                          \
+    ASAN_WIDE_MEMORY_ACCESS_CALLBACK_BODY(type, is_write, size, exp, true)    \
+  }                                                                           \
+  extern "C" NOINLINE INTERFACE_ATTRIBUTE                                     \
+  void __asan_##type##size ## _noabort(uptr addr) {                           \
+    ASAN_WIDE_MEMORY_ACCESS_CALLBACK_BODY(type, is_write, size, 0, false)     \
+  }                                                                           \
+
+ASAN_WIDE_MEMORY_ACCESS_CALLBACK(load, false, 32)
+ASAN_WIDE_MEMORY_ACCESS_CALLBACK(load, false, 64)
+ASAN_WIDE_MEMORY_ACCESS_CALLBACK(store, true, 32)
+ASAN_WIDE_MEMORY_ACCESS_CALLBACK(store, true, 64)
+
 extern "C"
 NOINLINE INTERFACE_ATTRIBUTE
 void __asan_loadN(uptr addr, uptr size) {
@@ -504,6 +581,7 @@ static void AsanInitInternal() {
   SanitizerToolName = "AddressSanitizer";
   CHECK(!asan_init_is_running && "ASan init calls itself!");
   asan_init_is_running = true;
+  InitPhaseTimer timer;
 
   CacheBinaryName();
 
@@ -511,6 +589,8 @@ static void AsanInitInternal() {
   // initialization steps look at flags().
   InitializeFlags();
 
+  timer.EndPhase("flags");
+
   AsanCheckIncompatibleRT();
   AsanCheckDynamicRTPrereqs();
   AvoidCVE_2016_2143();
@@ -542,6 +622,7 @@ static void AsanInitInternal() {
   SetLowLevelAllocateCallback(OnLowLevelAllocate);
 
   InitializeAsanInterceptors();
+  timer.EndPhase("interceptors");
 
   // Enable system log ("adb logcat") on Android.
   // Doing this before interceptors are initialized crashes in:
@@ -553,6 +634,7 @@ static void AsanInitInternal() {
   DisableCoreDumperIfNecessary();
 
   InitializeShadowMemory();
+  timer.EndPhase("shadow memory");
 
   AsanTSDInit(PlatformTSDDtor);
   InstallDeadlySignalHandlers(AsanOnDeadlySignal);
@@ -560,9 +642,17 @@ static void AsanInitInternal() {
   AllocatorOptions allocator_options;
   allocator_options.SetFrom(flags(), common_flags());
   InitializeAllocator(allocator_options);
+  if (common_flags()->huge_pages_for_dense_shadow)
+    UseHugePagesForDenseShadow();
+  if (common_flags()->fast_fork)
+    DontForkShadow();
 
+  MaybeEnableAdaptiveQuarantine();
   MaybeStartBackgroudThread();
+  MaybeStartQuarantineRecycler();
   SetSoftRssLimitExceededCallback(AsanSoftRssLimitExceededCallback);
+  SetAllocatorReleaseToOSCallback(AsanAllocatorReleaseToOSCallback);
+  timer.EndPhase("allocator");
 
   // On Linux AsanThread::ThreadStart() calls malloc() that's why asan_inited
   // should be set to 1 prior to initializing the threads.
@@ -571,6 +661,8 @@ static void AsanInitInternal() {
 
   if (flags()->atexit)
     Atexit(asan_atexit);
+  MaybeWriteAllocatorSizeProfileAtExit();
+  MaybePrintSelfProfileAtExit();
 
   InitializeCoverage(common_flags()->coverage, common_flags()->coverage_dir);
 
@@ -592,6 +684,7 @@ static void AsanInitInternal() {
                            /* signal_thread_is_registered */ nullptr);
   force_interface_symbols();  // no-op.
   SanitizerInitializeUnwinder();
+  timer.EndPhase("main thread");
 
   if (CAN_SANITIZE_LEAKS) {
     __lsan::InitCommonLsan();
@@ -603,8 +696,12 @@ static void AsanInitInternal() {
 #if CAN_SANITIZE_UB
   __ubsan::InitAsPlugin();
 #endif
+  timer.EndPhase("lsan and ubsan");
 
-  InitializeSuppressions();
+  // With lazy_init the suppressions are parsed by their first query.
+  if (!common_flags()->lazy_init)
+    InitializeSuppressions();
+  timer.EndPhase("suppressions");
 
   if (CAN_SANITIZE_LEAKS) {
     // LateInitialize() calls dlsym, which can allocate an error string buffer
@@ -614,6 +711,8 @@ static void AsanInitInternal() {
   } else {
     Symbolizer::LateInitialize();
   }
+  timer.EndPhase("symbolizer");
+  timer.Print();
 
   VReport(1, "AddressSanitizer Init done\n");
 }
@@ -675,7 +774,9 @@ void NOINLINE __asan_handle_no_return() {
            top, bottom, top - bottom, top - bottom);
     return;
   }
-  PoisonShadow(bottom, top - bottom, 0);
+  // Most of the live stack is normally unpoisoned already: don't write its
+  // shadow or release it to the OS, which the next calls would fault back in.
+  UnpoisonShadowSparse(bottom, top - bottom);
   if (curr_thread && curr_thread->has_fake_stack())
     curr_thread->fake_stack()->HandleNoReturn();
 }
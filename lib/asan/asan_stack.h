@@ -26,6 +26,12 @@ static const u32 kDefaultMallocContextSize = 30;
 
 void SetMallocContextSize(u32 size);
 u32 GetMallocContextSize();
+// Stack depth to collect for the next allocation of the current thread.
+// With heap_sample_rate this is 0 for the allocations that are not sampled,
+// which is also how the allocator tells them apart.
+u32 GetMallocContextSizeForAllocation();
+// Stack depth to collect for freeing ptr: 0 for chunks that were not sampled.
+u32 GetMallocContextSizeForFree(const void *ptr);
 
 // Get the stack trace with the given pc and bp.
 // The pc will be in the position 0 of the resulting stack trace.
@@ -103,9 +109,12 @@ void GetStackTraceWithPcBpAndContext(BufferedStackTrace *stack, uptr max_depth,
   GET_STACK_TRACE(kStackTraceMax, true)
 
 #define GET_STACK_TRACE_MALLOC                                                 \
-  GET_STACK_TRACE(GetMallocContextSize(), common_flags()->fast_unwind_on_malloc)
+  u32 malloc_context_size = GetMallocContextSizeForAllocation();              \
+  GET_STACK_TRACE(malloc_context_size, common_flags()->fast_unwind_on_malloc)
 
-#define GET_STACK_TRACE_FREE GET_STACK_TRACE_MALLOC
+#define GET_STACK_TRACE_FREE(ptr)                                              \
+  u32 free_context_size = GetMallocContextSizeForFree(ptr);                   \
+  GET_STACK_TRACE(free_context_size, common_flags()->fast_unwind_on_malloc)
 
 #define PRINT_CURRENT_STACK()   \
   {                             \
@@ -44,6 +44,8 @@ void AsanStats::Print() {
   Printf("Stats: %zuM malloced (%zuM for red zones) by %zu calls\n",
              malloced>>20, malloced_redzones>>20, mallocs);
   Printf("Stats: %zuM realloced by %zu calls\n", realloced>>20, reallocs);
+  if (reallocs_in_place)
+    Printf("Stats: %zu reallocs in place\n", reallocs_in_place);
   Printf("Stats: %zuM freed by %zu calls\n", freed>>20, frees);
   Printf("Stats: %zuM really freed by %zu calls\n",
              really_freed>>20, real_frees);
@@ -53,6 +55,9 @@ void AsanStats::Print() {
 
   PrintMallocStatsArray("  mallocs by size class: ", malloced_by_size);
   Printf("Stats: malloc large: %zu\n", malloc_large);
+  if (freed_shadow_released)
+    Printf("Stats: %zuM of freed chunk shadow released\n",
+           freed_shadow_released >> 20);
 }
 
 void AsanStats::MergeFrom(const AsanStats *stats) {
@@ -72,6 +77,31 @@ static BlockingMutex dead_threads_stats_lock(LINKER_INITIALIZED);
 // per-thread AsanStats.
 static uptr max_malloced_memory;
 
+// The global counters are sharded by tid, so that the threads do not all
+// contend for the same cache line.
+static const uptr kNumGlobalCounterShards = 64;
+struct GlobalCounterShard {
+  atomic_uintptr_t counters[kNumGlobalCounters];
+  char padding[kCacheLineSize - kNumGlobalCounters * sizeof(atomic_uintptr_t)];
+};
+COMPILER_CHECK(sizeof(GlobalCounterShard) == kCacheLineSize);
+static GlobalCounterShard global_counter_shards[kNumGlobalCounterShards]
+    ALIGNED(kCacheLineSize);
+
+void AddToGlobalCounter(AsanGlobalCounter counter, uptr value) {
+  GlobalCounterShard &shard =
+      global_counter_shards[GetCurrentTidOrInvalid() % kNumGlobalCounterShards];
+  atomic_fetch_add(&shard.counters[counter], value, memory_order_relaxed);
+}
+
+uptr GetGlobalCounter(AsanGlobalCounter counter) {
+  uptr res = 0;
+  for (uptr i = 0; i < kNumGlobalCounterShards; i++)
+    res += atomic_load(&global_counter_shards[i].counters[counter],
+                       memory_order_relaxed);
+  return res;
+}
+
 static void MergeThreadStats(ThreadContextBase *tctx_base, void *arg) {
   AsanStats *accumulated_stats = reinterpret_cast<AsanStats*>(arg);
   AsanThreadContext *tctx = static_cast<AsanThreadContext*>(tctx_base);
@@ -128,6 +158,9 @@ static void PrintAccumulatedStats() {
   StackDepotStats *stack_depot_stats = StackDepotGetStats();
   Printf("Stats: StackDepot: %zd ids; %zdM allocated\n",
          stack_depot_stats->n_uniq_ids, stack_depot_stats->allocated >> 20);
+  Printf("Stats: PersistentAllocator: %zdK mapped; %zdK wasted\n",
+         stack_depot_stats->persistent_mapped >> 10,
+         stack_depot_stats->persistent_wasted >> 10);
   PrintInternalAllocatorStats();
 }
 
@@ -137,29 +170,23 @@ static void PrintAccumulatedStats() {
 using namespace __asan;  // NOLINT
 
 uptr __sanitizer_get_current_allocated_bytes() {
-  AsanStats stats;
-  GetAccumulatedStats(&stats);
-  uptr malloced = stats.malloced;
-  uptr freed = stats.freed;
+  uptr malloced = GetGlobalCounter(kGlobalMalloced);
+  uptr freed = GetGlobalCounter(kGlobalFreed);
   // Return sane value if malloced < freed due to racy
   // way we update accumulated stats.
   return (malloced > freed) ? malloced - freed : 1;
 }
 
 uptr __sanitizer_get_heap_size() {
-  AsanStats stats;
-  GetAccumulatedStats(&stats);
-  return stats.mmaped - stats.munmaped;
+  return GetGlobalCounter(kGlobalMmaped) - GetGlobalCounter(kGlobalMunmaped);
 }
 
 uptr __sanitizer_get_free_bytes() {
-  AsanStats stats;
-  GetAccumulatedStats(&stats);
-  uptr total_free = stats.mmaped
-                  - stats.munmaped
-                  + stats.really_freed;
-  uptr total_used = stats.malloced
-                  + stats.malloced_redzones;
+  uptr total_free = GetGlobalCounter(kGlobalMmaped)
+                  - GetGlobalCounter(kGlobalMunmaped)
+                  + GetGlobalCounter(kGlobalReallyFreed);
+  uptr total_used = GetGlobalCounter(kGlobalMalloced)
+                  + GetGlobalCounter(kGlobalMallocedRedzones);
   // Return sane value if total_free < total_used due to racy
   // way we update accumulated stats.
   return (total_free > total_used) ? total_free - total_used : 1;
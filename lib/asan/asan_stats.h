@@ -34,11 +34,13 @@ struct AsanStats {
   uptr really_freed;
   uptr reallocs;
   uptr realloced;
+  uptr reallocs_in_place;
   uptr mmaps;
   uptr mmaped;
   uptr munmaps;
   uptr munmaped;
   uptr malloc_large;
+  uptr freed_shadow_released;
   uptr malloced_by_size[kNumberOfSizeClasses];
 
   // Ctor for global AsanStats (accumulated stats for dead threads).
@@ -51,6 +53,26 @@ struct AsanStats {
   void MergeFrom(const AsanStats *stats);
 };
 
+// The totals that the allocator interface (__sanitizer_get_heap_size etc.)
+// returns are kept in global counters as well, so that these queries do not
+// lock the thread registry to sum up the AsanStats of all threads.
+enum AsanGlobalCounter {
+  kGlobalMalloced,
+  kGlobalMallocedRedzones,
+  kGlobalFreed,
+  kGlobalReallyFreed,
+  kGlobalMmaped,
+  kGlobalMunmaped,
+  kNumGlobalCounters
+};
+
+// Adds to one of the global counters. Lock-free, but an atomic add, so
+// called only on the paths that update the per-thread stats anyway.
+void AddToGlobalCounter(AsanGlobalCounter counter, uptr value);
+// Lock-free. The counters are read one by one and may be slightly out of
+// sync with each other.
+uptr GetGlobalCounter(AsanGlobalCounter counter);
+
 // Returns stats for GetCurrentThread(), or stats for fake "unknown thread"
 // if GetCurrentThread() returns 0.
 AsanStats &GetCurrentThreadStats();
@@ -15,6 +15,8 @@
 #include "asan_suppressions.h"
 
 #include "asan_stack.h"
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_mutex.h"
 #include "sanitizer_common/sanitizer_placement_new.h"
 #include "sanitizer_common/sanitizer_suppressions.h"
 #include "sanitizer_common/sanitizer_symbolizer.h"
@@ -23,6 +25,8 @@ namespace __asan {
 
 ALIGNED(64) static char suppression_placeholder[sizeof(SuppressionContext)];
 static SuppressionContext *suppression_ctx = nullptr;
+static StaticSpinMutex suppression_init_mu;
+static atomic_uint8_t suppressions_parsed;
 static const char kInterceptorName[] = "interceptor_name";
 static const char kInterceptorViaFunction[] = "interceptor_via_fun";
 static const char kInterceptorViaLibrary[] = "interceptor_via_lib";
@@ -36,52 +40,64 @@ SANITIZER_INTERFACE_WEAK_DEF(const char *, __asan_default_suppressions, void) {
 }
 
 void InitializeSuppressions() {
+  SpinMutexLock l(&suppression_init_mu);
+  if (atomic_load(&suppressions_parsed, memory_order_relaxed))
+    return;
   CHECK_EQ(nullptr, suppression_ctx);
   suppression_ctx = new (suppression_placeholder)  // NOLINT
       SuppressionContext(kSuppressionTypes, ARRAY_SIZE(kSuppressionTypes));
   suppression_ctx->ParseFromFile(flags()->suppressions);
   if (&__asan_default_suppressions)
     suppression_ctx->Parse(__asan_default_suppressions());
+  atomic_store(&suppressions_parsed, 1, memory_order_release);
+}
+
+// With lazy_init the suppressions are parsed by the first query.
+static SuppressionContext *GetSuppressionContext() {
+  if (UNLIKELY(!atomic_load(&suppressions_parsed, memory_order_acquire)))
+    InitializeSuppressions();
+  return suppression_ctx;
 }
 
 bool IsInterceptorSuppressed(const char *interceptor_name) {
-  CHECK(suppression_ctx);
+  SuppressionContext *ctx = GetSuppressionContext();
   Suppression *s;
   // Match "interceptor_name" suppressions.
-  return suppression_ctx->Match(interceptor_name, kInterceptorName, &s);
+  return ctx->Match(interceptor_name, kInterceptorName, &s);
 }
 
 bool HaveStackTraceBasedSuppressions() {
-  CHECK(suppression_ctx);
-  return suppression_ctx->HasSuppressionType(kInterceptorViaFunction) ||
-         suppression_ctx->HasSuppressionType(kInterceptorViaLibrary);
+  SuppressionContext *ctx = GetSuppressionContext();
+  return ctx->HasSuppressionType(kInterceptorViaFunction) ||
+         ctx->HasSuppressionType(kInterceptorViaLibrary);
 }
 
 bool IsODRViolationSuppressed(const char *global_var_name) {
-  CHECK(suppression_ctx);
+  SuppressionContext *ctx = GetSuppressionContext();
   Suppression *s;
   // Match "odr_violation" suppressions.
-  return suppression_ctx->Match(global_var_name, kODRViolation, &s);
+  return ctx->Match(global_var_name, kODRViolation, &s);
 }
 
 bool IsStackTraceSuppressed(const StackTrace *stack) {
   if (!HaveStackTraceBasedSuppressions())
     return false;
 
-  CHECK(suppression_ctx);
+  SuppressionContext *ctx = GetSuppressionContext();
   Symbolizer *symbolizer = Symbolizer::GetOrInit();
   Suppression *s;
   for (uptr i = 0; i < stack->size && stack->trace[i]; i++) {
     uptr addr = stack->trace[i];
 
-    if (suppression_ctx->HasSuppressionType(kInterceptorViaLibrary)) {
+    if (ctx->HasSuppressionType(kInterceptorViaLibrary)) {
       // Match "interceptor_via_lib" suppressions.
       if (const char *module_name = symbolizer->GetModuleNameForPc(addr))
-        if (suppression_ctx->Match(module_name, kInterceptorViaLibrary, &s))
+        if (ctx->Match(module_name, kInterceptorViaLibrary, &s))
           return true;
     }
 
-    if (suppression_ctx->HasSuppressionType(kInterceptorViaFunction)) {
+    if (ctx->HasSuppressionType(kInterceptorViaFunction) &&
+        !ctx->IsUnmatchedPC(addr, kInterceptorViaFunction)) {
       SymbolizedStack *frames = symbolizer->SymbolizePC(addr);
       CHECK(frames);
       for (SymbolizedStack *cur = frames; cur; cur = cur->next) {
@@ -90,13 +106,13 @@ bool IsStackTraceSuppressed(const StackTrace *stack) {
           continue;
         }
         // Match "interceptor_via_fun" suppressions.
-        if (suppression_ctx->Match(function_name, kInterceptorViaFunction,
-                                   &s)) {
+        if (ctx->Match(function_name, kInterceptorViaFunction, &s)) {
           frames->ClearAll();
           return true;
         }
       }
       frames->ClearAll();
+      ctx->AddUnmatchedPC(addr, kInterceptorViaFunction);
     }
   }
   return false;
@@ -19,6 +19,8 @@
 
 namespace __asan {
 
+// Parses the suppressions unless they are already parsed. The queries below
+// call it themselves, so with lazy_init it can be left to them.
 void InitializeSuppressions();
 bool IsInterceptorSuppressed(const char *interceptor_name);
 bool HaveStackTraceBasedSuppressions();
@@ -17,8 +17,10 @@
 #include "asan_stack.h"
 #include "asan_thread.h"
 #include "asan_mapping.h"
+#include "sanitizer_common/sanitizer_allocator_internal.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_placement_new.h"
+#include "sanitizer_common/sanitizer_shadow_stack.h"
 #include "sanitizer_common/sanitizer_stackdepot.h"
 #include "sanitizer_common/sanitizer_tls_get_addr.h"
 #include "lsan/lsan_common.h"
@@ -115,6 +117,8 @@ void AsanThread::Destroy() {
   // and we don't want it to have any poisoned stack.
   ClearShadowForThreadStackAndTLS();
   DeleteFakeStack(tid);
+  ShadowStackThreadFinish();
+  InternalAllocatorThreadFinish();
   uptr size = RoundUpTo(sizeof(AsanThread), GetPageSizeCached());
   UnmapOrDie(this, size);
   DTLS_Destroy();
@@ -382,6 +386,12 @@ u32 GetCurrentTidOrInvalid() {
 
 AsanThread *FindThreadByStackAddress(uptr addr) {
   asanThreadRegistry().CheckLocked();
+  // Most stack addresses in reports belong to the reporting thread; check it
+  // before scanning every thread.
+  if (AsanThread *t = GetCurrentThread()) {
+    if (ThreadStackContainsAddress(t->context(), (void *)addr))
+      return t;
+  }
   AsanThreadContext *tctx = static_cast<AsanThreadContext *>(
       asanThreadRegistry().FindThreadContextLocked(ThreadStackContainsAddress,
                                                    (void *)addr));
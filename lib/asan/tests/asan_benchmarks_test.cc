@@ -79,6 +79,21 @@ TEST(AddressSanitizer, FakeStackBenchmark) {
     Ident(&FunctionWithLargeStack)();
 }
 
+__attribute__((noinline))
+static int DeepRecursionWithLargeStack(int depth) {
+  int stack[100];
+  stack[0] = depth;
+  Ident(stack);
+  return depth ? DeepRecursionWithLargeStack(depth - 1) + stack[0] : 0;
+}
+
+// The live frames of a deep recursion fill most of their size class of the
+// fake stack, so the next allocations have to skip over them.
+TEST(AddressSanitizer, FakeStackDeepRecursionBenchmark) {
+  for (int i = 0; i < 100000; i++)
+    Ident(&DeepRecursionWithLargeStack)(i % 2 ? 1000 : 10);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
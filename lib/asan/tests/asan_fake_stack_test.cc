@@ -14,6 +14,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "asan_fake_stack.h"
+#include "asan_flags.h"
 #include "asan_test_utils.h"
 #include "sanitizer_common/sanitizer_common.h"
 
@@ -22,6 +23,7 @@
 #include <stdio.h>
 
 #include <map>
+#include <vector>
 
 namespace __asan {
 
@@ -70,6 +72,27 @@ TEST(FakeStack, CreateDestroy) {
 }
 #endif
 
+TEST(FakeStack, ReuseFromPool) {
+  const uptr stack_size_log = 20;
+  FakeStack *fs = FakeStack::Create(stack_size_log);
+  // Leave frames of a few size classes allocated, as an exiting thread would.
+  for (uptr cid = 0; cid < 4; cid++)
+    for (int j = 0; j < 10; j++)
+      EXPECT_NE((FakeFrame *)0, fs->Allocate(stack_size_log, cid, 0));
+  fs->Destroy(0);
+  FakeStack *fs2 = FakeStack::Create(stack_size_log);
+  if (flags()->fake_stack_pool_size > 0)
+    EXPECT_EQ(fs, fs2);
+  // All the frames are available again.
+  for (uptr cid = 0; cid < FakeStack::kNumberOfSizeClasses; cid++) {
+    uptr n = FakeStack::NumberOfFrames(stack_size_log, cid);
+    for (uptr j = 0; j < n; j++)
+      EXPECT_NE((FakeFrame *)0, fs2->Allocate(stack_size_log, cid, 0));
+    EXPECT_EQ((FakeFrame *)0, fs2->Allocate(stack_size_log, cid, 0));
+  }
+  fs2->Destroy(0);
+}
+
 TEST(FakeStack, ModuloNumberOfFrames) {
   EXPECT_EQ(FakeStack::ModuloNumberOfFrames(15, 0, 0), 0U);
   EXPECT_EQ(FakeStack::ModuloNumberOfFrames(15, 0, (1<<15)), 0U);
@@ -132,6 +155,29 @@ TEST(FakeStack, Allocate) {
   fs->Destroy(0);
 }
 
+TEST(FakeStack, AllocateSkipsLiveFrames) {
+  const uptr stack_size_log = 16;
+  const uptr cid = 0;
+  FakeStack *fs = FakeStack::Create(stack_size_log);
+  uptr n = FakeStack::NumberOfFrames(stack_size_log, cid);
+  std::vector<FakeFrame *> frames(n);
+  for (uptr j = 0; j < n; j++)
+    frames[j] = fs->Allocate(stack_size_log, cid, 0);
+  // Free a few frames spread over the class, the allocations must find them
+  // in round robin order, starting after the last allocated frame.
+  const uptr kFreed[] = {3, 17, 64, 65, n - 1};
+  for (uptr j = 0; j < ARRAY_SIZE(kFreed); j++)
+    fs->Deallocate(reinterpret_cast<uptr>(frames[kFreed[j]]), cid);
+  for (uptr j = 0; j < ARRAY_SIZE(kFreed); j++)
+    EXPECT_EQ(frames[kFreed[j]], fs->Allocate(stack_size_log, cid, 0));
+  EXPECT_EQ(0UL, fs->Allocate(stack_size_log, cid, 0));
+  fs->Deallocate(reinterpret_cast<uptr>(frames[5]), cid);
+  EXPECT_EQ(frames[5], fs->Allocate(stack_size_log, cid, 0));
+  for (uptr j = 0; j < n; j++)
+    fs->Deallocate(reinterpret_cast<uptr>(frames[j]), cid);
+  fs->Destroy(0);
+}
+
 static void RecursiveFunction(FakeStack *fs, int depth) {
   uptr class_id = depth / 3;
   FakeFrame *ff = fs->Allocate(fs->stack_size_log(), class_id, 0);
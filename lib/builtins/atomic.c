@@ -22,6 +22,12 @@
  *  For operations that must be atomic on two locations, the lower lock is
  *  always acquired first, to avoid deadlock.
  *
+ *  Where the platform has no lock of its own, the locks are sequence locks,
+ *  one per cache line: loads only read the lock, and retry if a store ran
+ *  concurrently, so that readers don't contend with each other.  On x86-64,
+ *  16-byte operations on aligned objects use cmpxchg16b instead when the CPU
+ *  has it, chosen through ifuncs.
+ *
  *===----------------------------------------------------------------------===
  */
 
@@ -29,6 +35,7 @@
 #include <string.h>
 
 #include "assembly.h"
+#include "int_cpu_model.h"
 
 // Clang objects if you redefine a builtin.  This little hack allows us to
 // define a function with the same name as an intrinsic.
@@ -38,7 +45,8 @@
 #pragma redefine_extname __atomic_compare_exchange_c SYMBOL_NAME(__atomic_compare_exchange)
 
 /// Number of locks.  This allocates one page on 32-bit platforms, two on
-/// 64-bit.  This can be specified externally if a different trade between
+/// 64-bit, or 64KB with the sequence locks, which are each padded to a cache
+/// line.  This can be specified externally if a different trade between
 /// memory usage and contention probability is required for a given platform.
 #ifndef SPINLOCK_COUNT
 #define SPINLOCK_COUNT (1<<10)
@@ -87,23 +95,147 @@ __inline static void lock(Lock *l) {
 static Lock locks[SPINLOCK_COUNT]; // initialized to OS_SPINLOCK_INIT which is 0
 
 #else
-typedef _Atomic(uintptr_t) Lock;
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+#define HAVE_SEQUENCE_LOCK 1
+/// The sequence number of a lock is odd while it is held.
+typedef struct {
+  _Atomic(uintptr_t) seq;
+  char padding[CACHE_LINE_SIZE - sizeof(uintptr_t)];
+} __attribute__((aligned(CACHE_LINE_SIZE))) Lock;
+/// Upper bound of the exponential backoff, in pause instructions.
+#define MAX_BACKOFF 1024
+__inline static void backoff(unsigned *spins) {
+  for (unsigned i = 0; i != *spins; ++i) {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+  }
+  if (*spins < MAX_BACKOFF)
+    *spins *= 2;
+}
 /// Unlock a lock.  This is a release operation.
 __inline static void unlock(Lock *l) {
-  __c11_atomic_store(l, 0, __ATOMIC_RELEASE);
+  uintptr_t seq = __c11_atomic_load(&l->seq, __ATOMIC_RELAXED);
+  __c11_atomic_store(&l->seq, seq + 1, __ATOMIC_RELEASE);
 }
-/// Locks a lock.  In the current implementation, this is potentially
-/// unbounded in the contended case.
+/// Locks a lock, with exponential backoff in the contended case.
 __inline static void lock(Lock *l) {
-  uintptr_t old = 0;
-  while (!__c11_atomic_compare_exchange_weak(l, &old, 1, __ATOMIC_ACQUIRE,
-        __ATOMIC_RELAXED))
-    old = 0;
+  unsigned spins = 1;
+  for (;;) {
+    uintptr_t seq = __c11_atomic_load(&l->seq, __ATOMIC_RELAXED);
+    if (!(seq & 1) &&
+        __c11_atomic_compare_exchange_weak(&l->seq, &seq, seq + 1,
+                                           __ATOMIC_ACQUIRE,
+                                           __ATOMIC_RELAXED)) {
+      // Readers which see the stores made under the lock must also see it
+      // held.
+      __c11_atomic_thread_fence(__ATOMIC_RELEASE);
+      return;
+    }
+    backoff(&spins);
+  }
+}
+/// Starts a read under a lock, waiting while it is held.  Returns the
+/// sequence number to pass to read_retry().
+__inline static uintptr_t read_begin(Lock *l) {
+  unsigned spins = 1;
+  for (;;) {
+    uintptr_t seq = __c11_atomic_load(&l->seq, __ATOMIC_ACQUIRE);
+    if (!(seq & 1))
+      return seq;
+    backoff(&spins);
+  }
+}
+/// Returns whether the lock was taken since read_begin() returned seq, in
+/// which case what was read may be torn and must be read again.
+__inline static int read_retry(Lock *l, uintptr_t seq) {
+  __c11_atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __c11_atomic_load(&l->seq, __ATOMIC_RELAXED) != seq;
 }
 /// locks for atomic operations
 static Lock locks[SPINLOCK_COUNT];
 #endif
 
+/// Runs stmt, which only reads the memory protected by l, as if under l.
+#ifdef HAVE_SEQUENCE_LOCK
+#define READ_UNDER_LOCK(l, stmt) \
+  do {\
+    uintptr_t seq;\
+    do {\
+      seq = read_begin(l);\
+      stmt;\
+    } while (read_retry(l, seq));\
+  } while (0)
+#else
+#define READ_UNDER_LOCK(l, stmt) \
+  do {\
+    lock(l);\
+    stmt;\
+    unlock(l);\
+  } while (0)
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// 16-byte operations with cmpxchg16b, which not all x86-64 CPUs have.  The
+// compiler only emits it with -mcx16, so the 16-byte functions below are
+// ifuncs which pick these versions on CPUs that have it, and the generic ones
+// check for it.  Objects which are not 16-byte aligned, which cmpxchg16b
+// can not handle, always use the locks.
+////////////////////////////////////////////////////////////////////////////////
+#ifdef CRT_HAS_X86_IFUNC
+#define HAVE_CMPXCHG16B_IFUNC 1
+#endif
+
+#ifdef HAVE_CMPXCHG16B_IFUNC
+/// 0 before the CPU is checked, then 1 if it lacks cmpxchg16b and 2 if not.
+static _Atomic(int) cmpxchg16b_state;
+
+/// This runs from the ifunc resolvers, before the constructors.
+static int have_cmpxchg16b(void) {
+  int state = __c11_atomic_load(&cmpxchg16b_state, __ATOMIC_RELAXED);
+  if (!state) {
+    state = crt_cpu_has_features(1 << CPU_FEATURE_CMPXCHG16B) ? 2 : 1;
+    __c11_atomic_store(&cmpxchg16b_state, state, __ATOMIC_RELAXED);
+  }
+  return state == 2;
+}
+
+static __inline int use_cmpxchg16b(void *ptr) {
+  return !((uintptr_t)ptr & 15) && have_cmpxchg16b();
+}
+
+/// A sequentially consistent strong compare and exchange.
+static __inline int cmpxchg16b(__uint128_t *ptr, __uint128_t *expected,
+                               __uint128_t desired) {
+  uint64_t lo = (uint64_t)*expected, hi = (uint64_t)(*expected >> 64);
+  char ok;
+  __asm__ __volatile__("lock cmpxchg16b %1\n\tsete %0"
+                       : "=q"(ok), "+m"(*ptr), "+a"(lo), "+d"(hi)
+                       : "b"((uint64_t)desired),
+                         "c"((uint64_t)(desired >> 64))
+                       : "memory", "cc");
+  *expected = ((__uint128_t)hi << 64) | lo;
+  return ok;
+}
+
+/// This writes to the object like any other operation on it does, but with
+/// no locks.
+static __inline __uint128_t load_cmpxchg16b(__uint128_t *src) {
+  __uint128_t val = 0;
+  cmpxchg16b(src, &val, 0);
+  return val;
+}
+
+static __inline __uint128_t exchange_cmpxchg16b(__uint128_t *ptr,
+                                                __uint128_t val) {
+  __uint128_t old = *(volatile __uint128_t *)ptr;
+  while (!cmpxchg16b(ptr, &old, val))
+    ;
+  return old;
+}
+#endif
 
 /// Returns a lock to use for a given pointer.  
 static __inline Lock *lock_for_pointer(void *ptr) {
@@ -165,10 +297,15 @@ void __atomic_load_c(int size, void *src, void *dest, int model) {
     return;
   LOCK_FREE_CASES();
 #undef LOCK_FREE_ACTION
+#ifdef HAVE_CMPXCHG16B_IFUNC
+  if (size == 16 && use_cmpxchg16b(src)) {
+    __uint128_t val = load_cmpxchg16b((__uint128_t *)src);
+    memcpy(dest, &val, 16);
+    return;
+  }
+#endif
   Lock *l = lock_for_pointer(src);
-  lock(l);
-  memcpy(dest, src, size);
-  unlock(l);
+  READ_UNDER_LOCK(l, memcpy(dest, src, size));
 }
 
 /// An atomic store operation.  This is atomic with respect to the destination
@@ -179,6 +316,14 @@ void __atomic_store_c(int size, void *dest, void *src, int model) {
     return;
   LOCK_FREE_CASES();
 #undef LOCK_FREE_ACTION
+#ifdef HAVE_CMPXCHG16B_IFUNC
+  if (size == 16 && use_cmpxchg16b(dest)) {
+    __uint128_t val;
+    memcpy(&val, src, 16);
+    exchange_cmpxchg16b((__uint128_t *)dest, val);
+    return;
+  }
+#endif
   Lock *l = lock_for_pointer(dest);
   lock(l);
   memcpy(dest, src, size);
@@ -197,6 +342,16 @@ int __atomic_compare_exchange_c(int size, void *ptr, void *expected,
       *(type*)desired, success, failure)
   LOCK_FREE_CASES();
 #undef LOCK_FREE_ACTION
+#ifdef HAVE_CMPXCHG16B_IFUNC
+  if (size == 16 && use_cmpxchg16b(ptr)) {
+    __uint128_t exp, des;
+    memcpy(&exp, expected, 16);
+    memcpy(&des, desired, 16);
+    int ok = cmpxchg16b((__uint128_t *)ptr, &exp, des);
+    memcpy(expected, &exp, 16);
+    return ok;
+  }
+#endif
   Lock *l = lock_for_pointer(ptr);
   lock(l);
   if (memcmp(ptr, expected, size) == 0) {
@@ -218,6 +373,15 @@ void __atomic_exchange_c(int size, void *ptr, void *val, void *old, int model) {
     return;
   LOCK_FREE_CASES();
 #undef LOCK_FREE_ACTION
+#ifdef HAVE_CMPXCHG16B_IFUNC
+  if (size == 16 && use_cmpxchg16b(ptr)) {
+    __uint128_t val16, old16;
+    memcpy(&val16, val, 16);
+    old16 = exchange_cmpxchg16b((__uint128_t *)ptr, val16);
+    memcpy(old, &old16, 16);
+    return;
+  }
+#endif
   Lock *l = lock_for_pointer(ptr);
   lock(l);
   memcpy(old, ptr, size);
@@ -229,6 +393,20 @@ void __atomic_exchange_c(int size, void *ptr, void *val, void *old, int model) {
 // Where the size is known at compile time, the compiler may emit calls to
 // specialised versions of the above functions.
 ////////////////////////////////////////////////////////////////////////////////
+#ifdef HAVE_CMPXCHG16B_IFUNC
+// The 16-byte versions generated below are the fallbacks of the ifuncs at the
+// end of this file.
+#define __atomic_load_16 __atomic_load_16_locked
+#define __atomic_store_16 __atomic_store_16_locked
+#define __atomic_exchange_16 __atomic_exchange_16_locked
+#define __atomic_compare_exchange_16 __atomic_compare_exchange_16_locked
+#define __atomic_fetch_add_16 __atomic_fetch_add_16_locked
+#define __atomic_fetch_sub_16 __atomic_fetch_sub_16_locked
+#define __atomic_fetch_and_16 __atomic_fetch_and_16_locked
+#define __atomic_fetch_or_16 __atomic_fetch_or_16_locked
+#define __atomic_fetch_xor_16 __atomic_fetch_xor_16_locked
+#endif
+
 #ifdef __SIZEOF_INT128__
 #define OPTIMISED_CASES\
   OPTIMISED_CASE(1, IS_LOCK_FREE_1, uint8_t)\
@@ -249,9 +427,8 @@ type __atomic_load_##n(type *src, int model) {\
   if (lockfree)\
     return __c11_atomic_load((_Atomic(type)*)src, model);\
   Lock *l = lock_for_pointer(src);\
-  lock(l);\
-  type val = *src;\
-  unlock(l);\
+  type val;\
+  READ_UNDER_LOCK(l, val = *(volatile type *)src);\
   return val;\
 }
 OPTIMISED_CASES
@@ -336,3 +513,91 @@ OPTIMISED_CASES
 #define OPTIMISED_CASE(n, lockfree, type) ATOMIC_RMW(n, lockfree, type, xor, ^)
 OPTIMISED_CASES
 #undef OPTIMISED_CASE
+
+#ifdef HAVE_CMPXCHG16B_IFUNC
+#undef __atomic_load_16
+#undef __atomic_store_16
+#undef __atomic_exchange_16
+#undef __atomic_compare_exchange_16
+#undef __atomic_fetch_add_16
+#undef __atomic_fetch_sub_16
+#undef __atomic_fetch_and_16
+#undef __atomic_fetch_or_16
+#undef __atomic_fetch_xor_16
+
+static __uint128_t __atomic_load_16_cx16(__uint128_t *src, int model) {
+  if ((uintptr_t)src & 15)
+    return __atomic_load_16_locked(src, model);
+  return load_cmpxchg16b(src);
+}
+
+static void __atomic_store_16_cx16(__uint128_t *dest, __uint128_t val,
+                                   int model) {
+  if ((uintptr_t)dest & 15) {
+    __atomic_store_16_locked(dest, val, model);
+    return;
+  }
+  exchange_cmpxchg16b(dest, val);
+}
+
+static __uint128_t __atomic_exchange_16_cx16(__uint128_t *dest,
+                                             __uint128_t val, int model) {
+  if ((uintptr_t)dest & 15)
+    return __atomic_exchange_16_locked(dest, val, model);
+  return exchange_cmpxchg16b(dest, val);
+}
+
+static int __atomic_compare_exchange_16_cx16(__uint128_t *ptr,
+                                             __uint128_t *expected,
+                                             __uint128_t desired, int success,
+                                             int failure) {
+  if ((uintptr_t)ptr & 15)
+    return __atomic_compare_exchange_16_locked(ptr, expected, desired, success,
+                                               failure);
+  return cmpxchg16b(ptr, expected, desired);
+}
+
+#define CMPXCHG16B_RMW(opname, op) \
+static __uint128_t __atomic_fetch_##opname##_16_cx16(__uint128_t *ptr,\
+                                                     __uint128_t val,\
+                                                     int model) {\
+  if ((uintptr_t)ptr & 15)\
+    return __atomic_fetch_##opname##_16_locked(ptr, val, model);\
+  __uint128_t old = *(volatile __uint128_t *)ptr;\
+  while (!cmpxchg16b(ptr, &old, old op val))\
+    ;\
+  return old;\
+}
+CMPXCHG16B_RMW(add, +)
+CMPXCHG16B_RMW(sub, -)
+CMPXCHG16B_RMW(and, &)
+CMPXCHG16B_RMW(or, |)
+CMPXCHG16B_RMW(xor, ^)
+#undef CMPXCHG16B_RMW
+
+#define CMPXCHG16B_IFUNC(ret, name, params) \
+static void *resolve_##name(void) {\
+  return have_cmpxchg16b() ? (void *)name##_cx16 : (void *)name##_locked;\
+}\
+ret name params __attribute__((ifunc("resolve_" #name)));
+CMPXCHG16B_IFUNC(__uint128_t, __atomic_load_16,
+                 (__uint128_t *src, int model))
+CMPXCHG16B_IFUNC(void, __atomic_store_16,
+                 (__uint128_t *dest, __uint128_t val, int model))
+CMPXCHG16B_IFUNC(__uint128_t, __atomic_exchange_16,
+                 (__uint128_t *dest, __uint128_t val, int model))
+CMPXCHG16B_IFUNC(int, __atomic_compare_exchange_16,
+                 (__uint128_t *ptr, __uint128_t *expected,
+                  __uint128_t desired, int success, int failure))
+CMPXCHG16B_IFUNC(__uint128_t, __atomic_fetch_add_16,
+                 (__uint128_t *ptr, __uint128_t val, int model))
+CMPXCHG16B_IFUNC(__uint128_t, __atomic_fetch_sub_16,
+                 (__uint128_t *ptr, __uint128_t val, int model))
+CMPXCHG16B_IFUNC(__uint128_t, __atomic_fetch_and_16,
+                 (__uint128_t *ptr, __uint128_t val, int model))
+CMPXCHG16B_IFUNC(__uint128_t, __atomic_fetch_or_16,
+                 (__uint128_t *ptr, __uint128_t val, int model))
+CMPXCHG16B_IFUNC(__uint128_t, __atomic_fetch_xor_16,
+                 (__uint128_t *ptr, __uint128_t val, int model))
+#undef CMPXCHG16B_IFUNC
+#endif
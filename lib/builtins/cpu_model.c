@@ -124,7 +124,10 @@ enum ProcessorFeatures {
   FEATURE_AVX512SAVE,
   FEATURE_MOVBE,
   FEATURE_ADX,
-  FEATURE_EM64T
+  FEATURE_EM64T,
+  FEATURE_CMPXCHG16B,
+  FEATURE_BMI2,
+  FEATURE_LZCNT
 };
 
 // The check below for i386 was copied from clang's cpuid.h (__get_cpuid_max).
@@ -700,6 +703,7 @@ static unsigned getAvailableFeatures(unsigned int ECX, unsigned int EDX,
   Features |= (((ECX >> 19) & 1) << FEATURE_SSE4_1);
   Features |= (((ECX >> 20) & 1) << FEATURE_SSE4_2);
   Features |= (((ECX >> 22) & 1) << FEATURE_MOVBE);
+  Features |= (((ECX >> 13) & 1) << FEATURE_CMPXCHG16B);
 
   // If CPUID indicates support for XSAVE, XRESTORE and AVX, and XGETBV
   // indicates that the AVX registers will be saved and restored on context
@@ -713,14 +717,17 @@ static unsigned getAvailableFeatures(unsigned int ECX, unsigned int EDX,
   bool HasADX = HasLeaf7 && ((EBX >> 19) & 1);
   bool HasAVX2 = HasAVX && HasLeaf7 && (EBX & 0x20);
   bool HasAVX512 = HasLeaf7 && HasAVX512Save && ((EBX >> 16) & 1);
+  bool HasBMI2 = HasLeaf7 && ((EBX >> 8) & 1);
   Features |= (HasAVX << FEATURE_AVX);
   Features |= (HasAVX2 << FEATURE_AVX2);
   Features |= (HasAVX512 << FEATURE_AVX512);
   Features |= (HasAVX512Save << FEATURE_AVX512SAVE);
   Features |= (HasADX << FEATURE_ADX);
+  Features |= (HasBMI2 << FEATURE_BMI2);
 
   getX86CpuIDAndInfo(0x80000001, &EAX, &EBX, &ECX, &EDX);
   Features |= (((EDX >> 29) & 0x1) << FEATURE_EM64T);
+  Features |= (((ECX >> 5) & 0x1) << FEATURE_LZCNT);
   return Features;
 }
 
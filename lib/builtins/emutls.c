@@ -93,12 +93,20 @@ static __inline void *emutls_allocate_object(__emutls_control *control) {
     return base;
 }
 
-static pthread_mutex_t emutls_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uintptr_t emutls_num_object = 0;  /* number of allocated TLS objects */
 
-static size_t emutls_num_object = 0;  /* number of allocated TLS objects */
+/* Small objects are carved out of per-thread chunks of this many bytes,
+ * instead of being allocated one by one.
+ */
+#define EMUTLS_CHUNK_SIZE 1024
+#define EMUTLS_MAX_BATCHED_SIZE 64
+#define EMUTLS_MAX_BATCHED_ALIGN 16
 
 typedef struct emutls_address_array {
     uintptr_t size;  /* number of elements in the 'data' array */
+    char* chunk_next;  /* first free byte of the current chunk */
+    char* chunk_end;  /* end of the current chunk */
+    void* chunks;  /* list of chunks, linked through their first word */
     void* data[];
 } emutls_address_array;
 
@@ -107,10 +115,18 @@ static pthread_key_t emutls_pthread_key;
 static void emutls_key_destructor(void* ptr) {
     emutls_address_array* array = (emutls_address_array*)ptr;
     uintptr_t i;
+    void* chunk;
+    /* The objects in chunks have a NULL malloc'ed address (see
+     * emutls_chunk_alloc), so they are freed with their chunks.
+     */
     for (i = 0; i < array->size; ++i) {
         if (array->data[i])
             emutls_memalign_free(array->data[i]);
     }
+    while ((chunk = array->chunks) != NULL) {
+        array->chunks = *(void**)chunk;
+        free(chunk);
+    }
     free(ptr);
 }
 
@@ -119,19 +135,21 @@ static void emutls_init(void) {
         abort();
 }
 
-/* Returns control->object.index; set index if not allocated yet. */
-static __inline uintptr_t emutls_get_index(__emutls_control *control) {
+/* Returns control->object.index; set index if not allocated yet.
+ * The index is claimed with a compare and swap; the loser of a race
+ * leaves an unused index behind, which only costs a NULL slot.
+ */
+static uintptr_t emutls_get_index(__emutls_control *control) {
     uintptr_t index = __atomic_load_n(&control->object.index, __ATOMIC_ACQUIRE);
     if (!index) {
         static pthread_once_t once = PTHREAD_ONCE_INIT;
+        uintptr_t new_index;
         pthread_once(&once, emutls_init);
-        pthread_mutex_lock(&emutls_mutex);
-        index = control->object.index;
-        if (!index) {
-            index = ++emutls_num_object;
-            __atomic_store_n(&control->object.index, index, __ATOMIC_RELEASE);
-        }
-        pthread_mutex_unlock(&emutls_mutex);
+        new_index = __atomic_add_fetch(&emutls_num_object, 1, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&control->object.index, &index,
+                                        new_index, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            index = new_index;
     }
     return index;
 }
@@ -165,12 +183,21 @@ emutls_get_address_array(uintptr_t index) {
     if (array == NULL) {
         uintptr_t new_size = emutls_new_data_array_size(index);
         array = malloc(new_size * sizeof(void *) + sizeof(emutls_address_array));
-        if (array)
+        if (array) {
             memset(array->data, 0, new_size * sizeof(void*));
+            array->chunk_next = array->chunk_end = NULL;
+            array->chunks = NULL;
+        }
         emutls_check_array_set_size(array, new_size);
     } else if (index > array->size) {
         uintptr_t orig_size = array->size;
-        uintptr_t new_size = emutls_new_data_array_size(index);
+        uintptr_t new_size;
+        /* Grow geometrically, so that a thread touching n variables only
+         * reallocates its array O(log n) times.
+         */
+        if (index < 2 * orig_size)
+            index = 2 * orig_size;
+        new_size = emutls_new_data_array_size(index);
         array = realloc(array, new_size * sizeof(void *) + sizeof(emutls_address_array));
         if (array)
             memset(array->data + orig_size, 0,
@@ -180,10 +207,84 @@ emutls_get_address_array(uintptr_t index) {
     return array;
 }
 
-void* __emutls_get_address(__emutls_control* control) {
+#if !EMUTLS_USE_POSIX_MEMALIGN
+/* Returns the first address after next aligned to align, with room for the
+ * malloc'ed address in front of it.
+ */
+static __inline char *emutls_chunk_object(char *next, size_t align) {
+    return (char*)(((uintptr_t)next + sizeof(void*) + align - 1)
+                   & ~(uintptr_t)(align - 1));
+}
+#endif
+
+/* Allocates a small object from the chunks of the array, with a NULL
+ * malloc'ed address in front of it so that emutls_memalign_free ignores it.
+ * Returns NULL if the object is too large or too aligned to be batched.
+ */
+static void *emutls_chunk_alloc(emutls_address_array *array, size_t align,
+                                size_t size) {
+#if EMUTLS_USE_POSIX_MEMALIGN
+    /* Objects from posix_memalign are freed themselves. */
+    (void)array;
+    (void)align;
+    (void)size;
+    return NULL;
+#else
+    char* base;
+    if (size > EMUTLS_MAX_BATCHED_SIZE || align > EMUTLS_MAX_BATCHED_ALIGN)
+        return NULL;
+    base = emutls_chunk_object(array->chunk_next, align);
+    if (array->chunk_next == NULL || base + size > array->chunk_end) {
+        char* chunk = malloc(EMUTLS_CHUNK_SIZE);
+        if (chunk == NULL)
+            abort();
+        *(void**)chunk = array->chunks;
+        array->chunks = chunk;
+        array->chunk_next = chunk + sizeof(void*);
+        array->chunk_end = chunk + EMUTLS_CHUNK_SIZE;
+        base = emutls_chunk_object(array->chunk_next, align);
+    }
+    ((void**)base)[-1] = NULL;
+    array->chunk_next = base + size;
+    return base;
+#endif
+}
+
+/* Handles the first access to a variable by the thread. */
+static __attribute__((noinline)) void *
+emutls_get_address_slow(__emutls_control *control) {
     uintptr_t index = emutls_get_index(control);
     emutls_address_array* array = emutls_get_address_array(index);
-    if (array->data[index - 1] == NULL)
-        array->data[index - 1] = emutls_allocate_object(control);
+    if (array->data[index - 1] == NULL) {
+        size_t align = control->align;
+        void* base;
+        if (align < sizeof(void*))
+            align = sizeof(void*);
+        /* Make sure that align is power of 2. */
+        if ((align & (align - 1)) != 0)
+            abort();
+        base = emutls_chunk_alloc(array, align, control->size);
+        if (base == NULL)
+            base = emutls_allocate_object(control);
+        else if (control->value)
+            memcpy(base, control->value, control->size);
+        else
+            memset(base, 0, control->size);
+        array->data[index - 1] = base;
+    }
     return array->data[index - 1];
 }
+
+void* __emutls_get_address(__emutls_control* control) {
+    /* Once the variable has an index, the key has been created. */
+    uintptr_t index = __atomic_load_n(&control->object.index, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(index != 0, 1)) {
+        emutls_address_array* array = pthread_getspecific(emutls_pthread_key);
+        if (__builtin_expect(array != NULL && index <= array->size, 1)) {
+            void* object = array->data[index - 1];
+            if (__builtin_expect(object != NULL, 1))
+                return object;
+        }
+    }
+    return emutls_get_address_slow(control);
+}
@@ -145,6 +145,29 @@ static __inline int rep_clz(rep_t a) {
 #define Word_3(a) (uint64_t)((a >> 32) & Word_LoMask)
 #define Word_4(a) (uint64_t)(a & Word_LoMask)
 
+#if defined(__aarch64__) || defined(__x86_64__)
+// 128x128 -> 256 wide multiply from four 64x64 -> 128 multiplies, which these
+// targets have (mul and umulh on AArch64, mul or mulx on x86-64).
+static __inline void wideMultiply(rep_t a, rep_t b, rep_t *hi, rep_t *lo) {
+    const uint64_t aLo = (uint64_t)a, aHi = (uint64_t)(a >> 64);
+    const uint64_t bLo = (uint64_t)b, bHi = (uint64_t)(b >> 64);
+    const __uint128_t productLoLo = (__uint128_t)aLo * bLo;
+    const __uint128_t productLoHi = (__uint128_t)aLo * bHi;
+    const __uint128_t productHiLo = (__uint128_t)aHi * bLo;
+    const __uint128_t productHiHi = (__uint128_t)aHi * bHi;
+
+    // Less than 3 * 2^64, so this can not overflow.
+    const __uint128_t middle = (productLoLo >> 64) +
+                               (uint64_t)productLoHi +
+                               (uint64_t)productHiLo;
+
+    *lo = (middle << 64) | (uint64_t)productLoLo;
+    *hi = productHiHi +
+          (productLoHi >> 64) +
+          (productHiLo >> 64) +
+          (middle >> 64);
+}
+#else
 // 128x128 -> 256 wide multiply for platforms that don't have such an operation;
 // many 64-bit platforms have this operation, but they tend to have hardware
 // floating-point, so we don't bother with a special case for them here.
@@ -200,6 +223,7 @@ static __inline void wideMultiply(rep_t a, rep_t b, rep_t *hi, rep_t *lo) {
           (sum5 << 32) +
           (sum6 << 64);
 }
+#endif
 #undef Word_1
 #undef Word_2
 #undef Word_3
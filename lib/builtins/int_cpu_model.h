@@ -0,0 +1,54 @@
+/* ===-- int_cpu_model.h - __cpu_model for ifunc resolvers -----------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===-----------------------------------------------------------------------===
+ *
+ * This file is not part of the interface of this library.
+ *
+ * This file declares the __cpu_model defined in cpu_model.c, for the x86-64
+ * functions which pick a version for the CPU through an ifunc.
+ *
+ * ===-----------------------------------------------------------------------===
+ */
+
+#ifndef INT_CPU_MODEL_H
+#define INT_CPU_MODEL_H
+
+#if defined(__x86_64__) && defined(__ELF__) && !defined(__ANDROID__) && \
+    defined(__has_attribute)
+#if __has_attribute(ifunc)
+#define CRT_HAS_X86_IFUNC 1
+#endif
+#endif
+
+#ifdef CRT_HAS_X86_IFUNC
+
+/* The indices of the ProcessorFeatures in cpu_model.c. */
+#define CPU_FEATURE_CMPXCHG16B 17
+#define CPU_FEATURE_BMI2 18
+#define CPU_FEATURE_LZCNT 19
+
+extern struct {
+  unsigned int __cpu_vendor;
+  unsigned int __cpu_type;
+  unsigned int __cpu_subtype;
+  unsigned int __cpu_features[1];
+} __cpu_model;
+int __cpu_indicator_init(void);
+
+/* Returns whether the CPU has all of the features in the mask of
+ * (1 << CPU_FEATURE_*).  The ifunc resolvers run before the constructors, so
+ * this initializes __cpu_model itself.
+ */
+static __inline int crt_cpu_has_features(unsigned mask) {
+  __cpu_indicator_init();
+  return (__cpu_model.__cpu_features[0] & mask) == mask;
+}
+
+#endif /* CRT_HAS_X86_IFUNC */
+
+#endif /* INT_CPU_MODEL_H */
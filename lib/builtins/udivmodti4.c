@@ -13,226 +13,181 @@
  */ 
 
 #include "int_lib.h"
+#include "int_cpu_model.h"
 
 #ifdef CRT_HAS_128BIT
 
+/* Returns the 128 bit value u1:u0 divided by v, and stores the remainder in
+ * *r.  Requires u1 < v, so that the quotient fits in 64 bits.
+ */
+static __inline __attribute__((always_inline)) du_int
+udiv128by64to64(du_int u1, du_int u0, du_int v, du_int *r)
+{
+#if defined(__x86_64__)
+    du_int result;
+    __asm__("divq %[v]"
+            : "=a"(result), "=d"(*r)
+            : [v] "r"(v), "a"(u0), "d"(u1));
+    return result;
+#else
+    /* Translated from Figure 9-3 of Hacker's Delight, 2nd edition: the
+     * divisor is normalized, and each 32 bit digit of the quotient is
+     * estimated from the top digit of the divisor and then corrected.
+     */
+    const unsigned n_udword_bits = sizeof(du_int) * CHAR_BIT;
+    const du_int b = (du_int)1 << (n_udword_bits / 2);
+    du_int un1, un0, vn1, vn0, q1, q0, un64, un21, un10, rhat;
+    unsigned s = __builtin_clzll(v);
+    if (s > 0)
+    {
+        v = v << s;
+        un64 = (u1 << s) | (u0 >> (n_udword_bits - s));
+        un10 = u0 << s;
+    }
+    else
+    {
+        un64 = u1;
+        un10 = u0;
+    }
+    vn1 = v >> (n_udword_bits / 2);
+    vn0 = v & (b - 1);
+    un1 = un10 >> (n_udword_bits / 2);
+    un0 = un10 & (b - 1);
+
+    q1 = un64 / vn1;
+    rhat = un64 - q1 * vn1;
+    while (q1 >= b || q1 * vn0 > b * rhat + un1)
+    {
+        q1 -= 1;
+        rhat += vn1;
+        if (rhat >= b)
+            break;
+    }
+
+    un21 = un64 * b + un1 - q1 * v;
+    q0 = un21 / vn1;
+    rhat = un21 - q0 * vn1;
+    while (q0 >= b || q0 * vn0 > b * rhat + un0)
+    {
+        q0 -= 1;
+        rhat += vn1;
+        if (rhat >= b)
+            break;
+    }
+
+    *r = (un21 * b + un0 - q0 * v) >> s;
+    return q1 * b + q0;
+#endif
+}
+
 /* Effects: if rem != 0, *rem = a % b 
  * Returns: a / b 
  */
 
-/* Translated from Figure 3-40 of The PowerPC Compiler Writer's Guide */
-
-COMPILER_RT_ABI tu_int
-__udivmodti4(tu_int a, tu_int b, tu_int* rem)
+static __inline __attribute__((always_inline)) tu_int
+udivmodti4_impl(tu_int a, tu_int b, tu_int* rem)
 {
     const unsigned n_udword_bits = sizeof(du_int) * CHAR_BIT;
-    const unsigned n_utword_bits = sizeof(tu_int) * CHAR_BIT;
     utwords n;
     n.all = a;
     utwords d;
     d.all = b;
     utwords q;
     utwords r;
-    unsigned sr;
-    /* special cases, X is unknown, K != 0 */
-    if (n.s.high == 0)
+    if (d.all > n.all)
     {
-        if (d.s.high == 0)
-        {
-            /* 0 X
-             * ---
-             * 0 X
-             */
-            if (rem)
-                *rem = n.s.low % d.s.low;
-            return n.s.low / d.s.low;
-        }
-        /* 0 X
-         * ---
-         * K X
-         */
         if (rem)
-            *rem = n.s.low;
+            *rem = n.all;
         return 0;
     }
-    /* n.s.high != 0 */
-    if (d.s.low == 0)
+    if (d.s.high == 0)
     {
-        if (d.s.high == 0)
-        {
-            /* K X
-             * ---
-             * 0 0
-             */
-            if (rem)
-                *rem = n.s.high % d.s.low;
-            return n.s.high / d.s.low;
-        }
-        /* d.s.high != 0 */
-        if (n.s.low == 0)
-        {
-            /* K 0
-             * ---
-             * K 0
-             */
-            if (rem)
-            {
-                r.s.high = n.s.high % d.s.high;
-                r.s.low = 0;
-                *rem = r.all;
-            }
-            return n.s.high / d.s.high;
-        }
-        /* K K
+        /* X X
          * ---
-         * K 0
+         * 0 K
          */
-        if ((d.s.high & (d.s.high - 1)) == 0)     /* if d is a power of 2 */
+        r.s.high = 0;
+        if (n.s.high < d.s.low)
         {
-            if (rem)
-            {
-                r.s.low = n.s.low;
-                r.s.high = n.s.high & (d.s.high - 1);
-                *rem = r.all;
-            }
-            return n.s.high >> __builtin_ctzll(d.s.high);
-        }
-        /* K K
-         * ---
-         * K 0
-         */
-        sr = __builtin_clzll(d.s.high) - __builtin_clzll(n.s.high);
-        /* 0 <= sr <= n_udword_bits - 2 or sr large */
-        if (sr > n_udword_bits - 2)
-        {
-           if (rem)
-                *rem = n.all;
-            return 0;
-        }
-        ++sr;
-        /* 1 <= sr <= n_udword_bits - 1 */
-        /* q.all = n.all << (n_utword_bits - sr); */
-        q.s.low = 0;
-        q.s.high = n.s.low << (n_udword_bits - sr);
-        /* r.all = n.all >> sr; */
-        r.s.high = n.s.high >> sr;
-        r.s.low = (n.s.high << (n_udword_bits - sr)) | (n.s.low >> sr);
-    }
-    else  /* d.s.low != 0 */
-    {
-        if (d.s.high == 0)
-        {
-            /* K X
-             * ---
-             * 0 K
-             */
-            if ((d.s.low & (d.s.low - 1)) == 0)     /* if d is a power of 2 */
-            {
-                if (rem)
-                    *rem = n.s.low & (d.s.low - 1);
-                if (d.s.low == 1)
-                    return n.all;
-                sr = __builtin_ctzll(d.s.low);
-                q.s.high = n.s.high >> sr;
-                q.s.low = (n.s.high << (n_udword_bits - sr)) | (n.s.low >> sr);
-                return q.all;
-            }
-            /* K X
-             * ---
-             * 0 K
-             */
-            sr = 1 + n_udword_bits + __builtin_clzll(d.s.low)
-                                   - __builtin_clzll(n.s.high);
-            /* 2 <= sr <= n_utword_bits - 1
-             * q.all = n.all << (n_utword_bits - sr);
-             * r.all = n.all >> sr;
-             */
-            if (sr == n_udword_bits)
-            {
-                q.s.low = 0;
-                q.s.high = n.s.low;
-                r.s.high = 0;
-                r.s.low = n.s.high;
-            }
-            else if (sr < n_udword_bits)  // 2 <= sr <= n_udword_bits - 1
-            {
-                q.s.low = 0;
-                q.s.high = n.s.low << (n_udword_bits - sr);
-                r.s.high = n.s.high >> sr;
-                r.s.low = (n.s.high << (n_udword_bits - sr)) | (n.s.low >> sr);
-            }
-            else              // n_udword_bits + 1 <= sr <= n_utword_bits - 1
-            {
-                q.s.low = n.s.low << (n_utword_bits - sr);
-                q.s.high = (n.s.high << (n_utword_bits - sr)) |
-                           (n.s.low >> (sr - n_udword_bits));
-                r.s.high = 0;
-                r.s.low = n.s.high >> (sr - n_udword_bits);
-            }
+            q.s.high = 0;
         }
         else
         {
-            /* K X
-             * ---
-             * K K
-             */
-            sr = __builtin_clzll(d.s.high) - __builtin_clzll(n.s.high);
-            /*0 <= sr <= n_udword_bits - 1 or sr large */
-            if (sr > n_udword_bits - 1)
-            {
-               if (rem)
-                    *rem = n.all;
-                return 0;
-            }
-            ++sr;
-            /* 1 <= sr <= n_udword_bits
-             * q.all = n.all << (n_utword_bits - sr);
-             * r.all = n.all >> sr;
-             */
-            q.s.low = 0;
-            if (sr == n_udword_bits)
-            {
-                q.s.high = n.s.low;
-                r.s.high = 0;
-                r.s.low = n.s.high;
-            }
-            else
-            {
-                r.s.high = n.s.high >> sr;
-                r.s.low = (n.s.high << (n_udword_bits - sr)) | (n.s.low >> sr);
-                q.s.high = n.s.low << (n_udword_bits - sr);
-            }
+            /* Leaves n.s.high < d.s.low for the second division. */
+            q.s.high = n.s.high / d.s.low;
+            n.s.high = n.s.high % d.s.low;
         }
+        q.s.low = udiv128by64to64(n.s.high, n.s.low, d.s.low, &r.s.low);
+        if (rem)
+            *rem = r.all;
+        return q.all;
     }
-    /* Not a special case
-     * q and r are initialized with:
-     * q.all = n.all << (n_utword_bits - sr);
-     * r.all = n.all >> sr;
-     * 1 <= sr <= n_utword_bits - 1
+    /* K X
+     * ---
+     * K X
+     *
+     * Translated from Figure 9-5 of Hacker's Delight, 2nd edition: the
+     * quotient fits in 64 bits, and dividing the dividend, halved so that
+     * the division can not overflow, by the top 64 bits of the normalized
+     * divisor gives it or one more after undoing the shifts.
      */
-    su_int carry = 0;
-    for (; sr > 0; --sr)
+    unsigned s = __builtin_clzll(d.s.high);
+    utwords u1;
+    u1.all = n.all >> 1;
+    du_int v1 = s ? (d.s.high << s) | (d.s.low >> (n_udword_bits - s))
+                  : d.s.high;
+    du_int q1 = udiv128by64to64(u1.s.high, u1.s.low, v1, &r.s.low);
+    du_int q0 = q1 >> (n_udword_bits - 1 - s);
+    if (q0 != 0)
+        --q0;
+    r.all = n.all - (tu_int)q0 * d.all;
+    if (r.all >= d.all)
     {
-        /* r:q = ((r:q)  << 1) | carry */
-        r.s.high = (r.s.high << 1) | (r.s.low  >> (n_udword_bits - 1));
-        r.s.low  = (r.s.low  << 1) | (q.s.high >> (n_udword_bits - 1));
-        q.s.high = (q.s.high << 1) | (q.s.low  >> (n_udword_bits - 1));
-        q.s.low  = (q.s.low  << 1) | carry;
-        /* carry = 0;
-         * if (r.all >= d.all)
-         * {
-         *     r.all -= d.all;
-         *      carry = 1;
-         * }
-         */
-        const ti_int s = (ti_int)(d.all - r.all - 1) >> (n_utword_bits - 1);
-        carry = s & 1;
-        r.all -= d.all & s;
+        ++q0;
+        r.all -= d.all;
     }
-    q.all = (q.all << 1) | carry;
     if (rem)
         *rem = r.all;
-    return q.all;
+    return q0;
 }
 
+#ifdef CRT_HAS_X86_IFUNC
+
+/* The generic x86-64 version, and one with lzcnt and the bmi2 shifts, picked
+ * from __cpu_model when the program is loaded.
+ */
+static tu_int
+__udivmodti4_generic(tu_int a, tu_int b, tu_int* rem)
+{
+    return udivmodti4_impl(a, b, rem);
+}
+
+__attribute__((target("lzcnt,bmi2"))) static tu_int
+__udivmodti4_lzcnt_bmi2(tu_int a, tu_int b, tu_int* rem)
+{
+    return udivmodti4_impl(a, b, rem);
+}
+
+static void *resolve___udivmodti4(void)
+{
+    if (crt_cpu_has_features((1 << CPU_FEATURE_LZCNT) |
+                             (1 << CPU_FEATURE_BMI2)))
+        return (void *)__udivmodti4_lzcnt_bmi2;
+    return (void *)__udivmodti4_generic;
+}
+
+COMPILER_RT_ABI tu_int
+__udivmodti4(tu_int a, tu_int b, tu_int* rem)
+    __attribute__((ifunc("resolve___udivmodti4")));
+
+#else
+
+COMPILER_RT_ABI tu_int
+__udivmodti4(tu_int a, tu_int b, tu_int* rem)
+{
+    return udivmodti4_impl(a, b, rem);
+}
+
+#endif /* CRT_HAS_X86_IFUNC */
+
 #endif /* CRT_HAS_128BIT */
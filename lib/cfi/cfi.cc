@@ -21,6 +21,7 @@ typedef ElfW(Phdr) Elf_Phdr;
 typedef ElfW(Ehdr) Elf_Ehdr;
 
 #include "interception/interception.h"
+#include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_flag_parser.h"
 #include "ubsan/ubsan_init.h"
@@ -108,10 +109,16 @@ public:
 
 class ShadowBuilder {
   uptr shadow_;
+  // The part of the shadow being built, as an offset into it and a size.
+  uptr offset_;
+  uptr size_;
 
 public:
   // Allocate a new empty shadow (for the entire address space) on the side.
   void Start();
+  // Copy the part of the current shadow that covers the given address range
+  // on the side, to be changed.
+  void StartUpdate(uptr begin, uptr end);
   // Mark the given address range as unchecked.
   // This is used for uninstrumented libraries like libc.
   // Any CFI check with a target in that range will pass.
@@ -119,14 +126,31 @@ public:
   // Mark the given address range as belonging to a library with the given
   // cfi_check function.
   void Add(uptr begin, uptr end, uptr cfi_check);
+  // Mark the given address range as invalid, after a library is unloaded.
+  void Remove(uptr begin, uptr end);
   // Finish shadow construction. Atomically switch the current active shadow
-  // region with the newly constructed one and deallocate the former.
+  // region, or the updated part of it, with the newly constructed one and
+  // deallocate the former.
   void Install();
 };
 
 void ShadowBuilder::Start() {
-  shadow_ = (uptr)MmapNoReserveOrDie(GetShadowSize(), "CFI shadow");
-  VReport(1, "CFI: shadow at %zx .. %zx\n", shadow_, shadow_ + GetShadowSize());
+  offset_ = 0;
+  size_ = GetShadowSize();
+  shadow_ = (uptr)MmapNoReserveOrDie(size_, "CFI shadow");
+  VReport(1, "CFI: shadow at %zx .. %zx\n", shadow_, shadow_ + size_);
+}
+
+void ShadowBuilder::StartUpdate(uptr begin, uptr end) {
+  uptr page_size = GetPageSizeCached();
+  offset_ = RoundDownTo(MemToShadowOffset(begin), page_size);
+  uptr end_offset = Min(
+      RoundUpTo(MemToShadowOffset(end - 1) + sizeof(uint16_t), page_size),
+      RoundUpTo(GetShadowSize(), page_size));
+  size_ = end_offset - offset_;
+  uptr copy = (uptr)MmapOrDie(size_, "CFI shadow update");
+  internal_memcpy((void *)copy, (void *)(GetShadow() + offset_), size_);
+  shadow_ = copy - offset_;
 }
 
 void ShadowBuilder::AddUnchecked(uptr begin, uptr end) {
@@ -150,14 +174,23 @@ void ShadowBuilder::Add(uptr begin, uptr end, uptr cfi_check) {
     *s = sv;
 }
 
+void ShadowBuilder::Remove(uptr begin, uptr end) {
+  uint16_t *shadow_begin = MemToShadow(begin, shadow_);
+  uint16_t *shadow_end = MemToShadow(end - 1, shadow_) + 1;
+  memset(shadow_begin, kInvalidShadow,
+         (shadow_end - shadow_begin) * sizeof(*shadow_begin));
+}
+
 #if SANITIZER_LINUX
 void ShadowBuilder::Install() {
-  MprotectReadOnly(shadow_, GetShadowSize());
+  MprotectReadOnly(shadow_ + offset_, size_);
   uptr main_shadow = GetShadow();
   if (main_shadow) {
-    // Update.
-    void *res = mremap((void *)shadow_, GetShadowSize(), GetShadowSize(),
-                       MREMAP_MAYMOVE | MREMAP_FIXED, (void *)main_shadow);
+    // Update. The readers see each page of the shadow either before or after
+    // the update.
+    void *res = mremap((void *)(shadow_ + offset_), size_, size_,
+                       MREMAP_MAYMOVE | MREMAP_FIXED,
+                       (void *)(main_shadow + offset_));
     CHECK(res != MAP_FAILED);
   } else {
     // Initial setup.
@@ -240,12 +273,29 @@ uptr find_cfi_check_in_dso(dl_phdr_info *info) {
   return 0;
 }
 
+// A loaded segment of a library. cfi_check is 0 for the unchecked ones.
+struct ShadowRange {
+  uptr begin;
+  uptr end;
+  uptr cfi_check;
+};
+
+static bool CompareShadowRanges(const ShadowRange &a, const ShadowRange &b) {
+  if (a.begin != b.begin) return a.begin < b.begin;
+  if (a.end != b.end) return a.end < b.end;
+  return a.cfi_check < b.cfi_check;
+}
+
+// The ranges in the shadow, sorted.
+static InternalMmapVectorNoCtor<ShadowRange> shadow_ranges;
+
 int dl_iterate_phdr_cb(dl_phdr_info *info, size_t size, void *data) {
   uptr cfi_check = find_cfi_check_in_dso(info);
   if (cfi_check)
     VReport(1, "Module '%s' __cfi_check %zx\n", info->dlpi_name, cfi_check);
 
-  ShadowBuilder *b = reinterpret_cast<ShadowBuilder *>(data);
+  InternalMmapVector<ShadowRange> *ranges =
+      reinterpret_cast<InternalMmapVector<ShadowRange> *>(data);
 
   for (int i = 0; i < info->dlpi_phnum; i++) {
     const Elf_Phdr *phdr = &info->dlpi_phdr[i];
@@ -257,27 +307,81 @@ int dl_iterate_phdr_cb(dl_phdr_info *info, size_t size, void *data) {
       // PT_RELRO?
       uptr cur_beg = info->dlpi_addr + phdr->p_vaddr;
       uptr cur_end = cur_beg + phdr->p_memsz;
-      if (cfi_check) {
+      if (cfi_check)
         VReport(1, "   %zx .. %zx\n", cur_beg, cur_end);
-        b->Add(cur_beg, cur_end, cfi_check);
-      } else {
-        b->AddUnchecked(cur_beg, cur_end);
-      }
+      ShadowRange range = {cur_beg, cur_end, cfi_check};
+      ranges->push_back(range);
     }
   }
   return 0;
 }
 
-// Init or update shadow for the current set of loaded libraries.
+static void AddRange(ShadowBuilder *b, const ShadowRange &range) {
+  if (range.cfi_check)
+    b->Add(range.begin, range.end, range.cfi_check);
+  else
+    b->AddUnchecked(range.begin, range.end);
+}
+
+template <class Container>
+static bool HasRange(const Container &ranges, const ShadowRange &range) {
+  uptr i = InternalLowerBound(ranges, 0, ranges.size(), range,
+                              CompareShadowRanges);
+  return i < ranges.size() && !CompareShadowRanges(range, ranges[i]);
+}
+
+// Init or update shadow for the current set of loaded libraries. Once the
+// shadow is set up, only the parts of it for the libraries loaded or unloaded
+// since the last update are rebuilt.
 void UpdateShadow() {
-  ShadowBuilder b;
-  b.Start();
-  dl_iterate_phdr(dl_iterate_phdr_cb, &b);
-  b.Install();
+  InternalMmapVector<ShadowRange> ranges(64);
+  dl_iterate_phdr(dl_iterate_phdr_cb, &ranges);
+  InternalSort(&ranges, ranges.size(), CompareShadowRanges);
+
+  if (!GetShadow()) {
+    shadow_ranges.Initialize(ranges.size());
+    ShadowBuilder b;
+    b.Start();
+    for (uptr i = 0; i < ranges.size(); ++i)
+      AddRange(&b, ranges[i]);
+    b.Install();
+  } else {
+    // The unloaded libraries are removed first: the new ones may have been
+    // loaded at the same addresses.
+    uptr removed = 0, added = 0;
+    for (uptr i = 0; i < shadow_ranges.size(); ++i) {
+      if (HasRange(ranges, shadow_ranges[i])) continue;
+      ShadowBuilder b;
+      b.StartUpdate(shadow_ranges[i].begin, shadow_ranges[i].end);
+      b.Remove(shadow_ranges[i].begin, shadow_ranges[i].end);
+      b.Install();
+      ++removed;
+    }
+    for (uptr i = 0; i < ranges.size(); ++i) {
+      if (HasRange(shadow_ranges, ranges[i])) continue;
+      ShadowBuilder b;
+      b.StartUpdate(ranges[i].begin, ranges[i].end);
+      AddRange(&b, ranges[i]);
+      b.Install();
+      ++added;
+    }
+    VReport(1, "CFI: shadow updated, %zu ranges removed, %zu added\n",
+            removed, added);
+  }
+
+  shadow_ranges.clear();
+  for (uptr i = 0; i < ranges.size(); ++i)
+    shadow_ranges.push_back(ranges[i]);
 }
 
+// Bumped whenever the set of loaded libraries may change, which invalidates
+// the slow path caches.
+static atomic_uint64_t loader_generation;
+
 void InitShadow() {
   CHECK_EQ(0, GetShadow());
+  // The zeroed slow path caches are invalid from the start.
+  atomic_store(&loader_generation, 1, memory_order_relaxed);
   CHECK_EQ(0, GetShadowSize());
 
   uptr vma = GetMaxVirtualAddress();
@@ -296,21 +400,55 @@ void EnterLoader() {
     shadow_update_lock.Lock();
   }
   ++in_loader;
+  atomic_fetch_add(&loader_generation, 1, memory_order_release);
 }
 
 void ExitLoader() {
   CHECK(in_loader > 0);
   --in_loader;
   UpdateShadow();
+  atomic_fetch_add(&loader_generation, 1, memory_order_release);
   if (in_loader == 0) {
     shadow_update_lock.Unlock();
   }
 }
 
+// A per-thread cache of the (CallSiteTypeId, Ptr) pairs that passed the check
+// in __cfi_slowpath, direct-mapped. Checks which fail without diagnostics
+// trap, so only the passing ones get here. Unlike the shadow, the cache is
+// writable.
+static const uptr kSlowPathCacheSize = 64;
+struct SlowPathCache {
+  u64 generation;
+  u64 type_id[kSlowPathCacheSize];
+  uptr target[kSlowPathCacheSize];
+};
+static THREADLOCAL SlowPathCache slowpath_cache;
+
+ALWAYS_INLINE uptr SlowPathCacheIndex(u64 CallSiteTypeId, uptr Addr) {
+  return ((CallSiteTypeId ^ Addr) * 0x9e3779b97f4a7c15ULL) >> 58;
+}
+
 ALWAYS_INLINE void CfiSlowPathCommon(u64 CallSiteTypeId, void *Ptr,
                                      void *DiagData) {
   uptr Addr = (uptr)Ptr;
   VReport(3, "__cfi_slowpath: %llx, %p\n", CallSiteTypeId, Ptr);
+  SlowPathCache *cache = nullptr;
+  uptr cache_index = 0;
+  if (!DiagData && Addr) {
+    // Entries are stored with the generation read before the check, so any
+    // shadow update that could have raced with it invalidates them.
+    cache = &slowpath_cache;
+    u64 generation = atomic_load(&loader_generation, memory_order_acquire);
+    if (cache->generation != generation) {
+      internal_memset(cache->target, 0, sizeof(cache->target));
+      cache->generation = generation;
+    }
+    cache_index = SlowPathCacheIndex(CallSiteTypeId, Addr);
+    if (cache->target[cache_index] == Addr &&
+        cache->type_id[cache_index] == CallSiteTypeId)
+      return;
+  }
   ShadowValue sv = ShadowValue::load(Addr);
   if (sv.is_invalid()) {
     VReport(1, "CFI: invalid memory region for a check target: %p\n", Ptr);
@@ -330,6 +468,10 @@ ALWAYS_INLINE void CfiSlowPathCommon(u64 CallSiteTypeId, void *Ptr,
   CFICheckFn cfi_check = sv.get_cfi_check();
   VReport(2, "__cfi_check at %p\n", cfi_check);
   cfi_check(CallSiteTypeId, Ptr, DiagData);
+  if (cache) {
+    cache->type_id[cache_index] = CallSiteTypeId;
+    cache->target[cache_index] = Addr;
+  }
 }
 
 void InitializeFlags() {
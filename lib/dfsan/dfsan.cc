@@ -24,6 +24,7 @@
 #include "sanitizer_common/sanitizer_flags.h"
 #include "sanitizer_common/sanitizer_flag_parser.h"
 #include "sanitizer_common/sanitizer_libc.h"
+#include "sanitizer_common/sanitizer_mutex.h"
 
 #include "dfsan/dfsan.h"
 
@@ -34,7 +35,13 @@ static const dfsan_label kInitializingLabel = -1;
 
 static const uptr kNumLabels = 1 << (sizeof(dfsan_label) * 8);
 
+// Multiplying a label by this gives a word of four copies of it. The shadow is
+// read and written a word at a time where it can be.
+static const u64 kFourLabels = 0x0001000100010001ULL;
+
 static atomic_dfsan_label __dfsan_last_label;
+// The labels up to this one have been written by dfsan_dump_new_labels.
+static atomic_dfsan_label __dfsan_last_dumped_label;
 static dfsan_label_info __dfsan_label_info[kNumLabels];
 
 Flags __dfsan::flags_data;
@@ -134,7 +141,21 @@ SANITIZER_INTERFACE_ATTRIBUTE uptr __dfsan_shadow_ptr_mask;
 // | reserved by kernel |
 // +--------------------+ 0x0000000000
 
-typedef atomic_dfsan_label dfsan_union_table_t[kNumLabels][kNumLabels];
+// The union table is a hash table from a pair of labels to the label of their
+// union. Only pairs for which a new label was created are entered, so there
+// are fewer entries than labels, and a table of twice as many entries as
+// labels never gets more than half full. Each entry packs the pair and the
+// label into a single word, so that it can be claimed and published without
+// locks:
+//   0                                          empty
+//   (l1 << 16 | l2) << 32 | kInitializingLabel  being created
+//   (l1 << 16 | l2) << 32 | label               done
+static const uptr kUnionTableSize = 2 * kNumLabels;
+
+// The region reserved for the union table, which keeps the layout above. Only
+// the pages of the hash table at its start are ever touched.
+static const uptr kUnionTableRegionSize =
+    kNumLabels * kNumLabels * sizeof(dfsan_label);
 
 #ifdef DFSAN_RUNTIME_VMA
 // Runtime detected VMA size.
@@ -142,12 +163,11 @@ int __dfsan::vmaSize;
 #endif
 
 static uptr UnusedAddr() {
-  return MappingArchImpl<MAPPING_UNION_TABLE_ADDR>()
-         + sizeof(dfsan_union_table_t);
+  return MappingArchImpl<MAPPING_UNION_TABLE_ADDR>() + kUnionTableRegionSize;
 }
 
-static atomic_dfsan_label *union_table(dfsan_label l1, dfsan_label l2) {
-  return &(*(dfsan_union_table_t *) UnionTableAddr())[l1][l2];
+static atomic_uint64_t *union_table() {
+  return (atomic_uint64_t *)UnionTableAddr();
 }
 
 // Checks we do not run out of labels.
@@ -172,46 +192,65 @@ dfsan_label __dfsan_union(dfsan_label l1, dfsan_label l2) {
   if (l1 > l2)
     Swap(l1, l2);
 
-  atomic_dfsan_label *table_ent = union_table(l1, l2);
-  // We need to deal with the case where two threads concurrently request
-  // a union of the same pair of labels.  If the table entry is uninitialized,
-  // (i.e. 0) use a compare-exchange to set the entry to kInitializingLabel
-  // (i.e. -1) to mark that we are initializing it.
-  dfsan_label label = 0;
-  if (atomic_compare_exchange_strong(table_ent, &label, kInitializingLabel,
-                                     memory_order_acquire)) {
-    // Check whether l2 subsumes l1.  We don't need to check whether l1
-    // subsumes l2 because we are guaranteed here that l1 < l2, and (at least
-    // in the cases we are interested in) a label may only subsume labels
-    // created earlier (i.e. with a lower numerical value).
-    if (__dfsan_label_info[l2].l1 == l1 ||
-        __dfsan_label_info[l2].l2 == l1) {
-      label = l2;
-    } else {
-      label =
-        atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
-      dfsan_check_label(label);
-      __dfsan_label_info[label].l1 = l1;
-      __dfsan_label_info[label].l2 = l2;
+  // Check whether l2 subsumes l1.  We don't need to check whether l1 subsumes
+  // l2 because we are guaranteed here that l1 < l2, and (at least in the cases
+  // we are interested in) a label may only subsume labels created earlier
+  // (i.e. with a lower numerical value).
+  if (__dfsan_label_info[l2].l1 == l1 || __dfsan_label_info[l2].l2 == l1)
+    return l2;
+
+  u64 key = (u64)((u32)l1 << 16 | l2) << 32;
+  uptr h = (l1 * 0x9e3779b1U ^ l2) & (kUnionTableSize - 1);
+  for (;; h = (h + 1) & (kUnionTableSize - 1)) {
+    atomic_uint64_t *table_ent = &union_table()[h];
+    u64 ent = atomic_load(table_ent, memory_order_acquire);
+    // We need to deal with the case where two threads concurrently request
+    // a union of the same pair of labels.  The thread which claims the empty
+    // entry marks it with kInitializingLabel while it creates the label.
+    if (ent == 0) {
+      if (atomic_compare_exchange_strong(table_ent, &ent,
+                                         key | kInitializingLabel,
+                                         memory_order_acquire)) {
+        dfsan_label label =
+          atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
+        dfsan_check_label(label);
+        __dfsan_label_info[label].l1 = l1;
+        __dfsan_label_info[label].l2 = l2;
+        atomic_store(table_ent, key | label, memory_order_release);
+        return label;
+      }
+      // Lost the race; ent now holds the winner's pair.
+    }
+    if ((ent & ~(u64)0xffffffff) != key)
+      continue;
+    // Another thread is initializing the entry.  Wait until it is finished;
+    // that only takes a few stores.
+    for (int i = 0; (dfsan_label)ent == kInitializingLabel; ++i) {
+      if (i < 10)
+        proc_yield(10);
+      else
+        internal_sched_yield();
+      ent = atomic_load(table_ent, memory_order_acquire);
     }
-    atomic_store(table_ent, label, memory_order_release);
-  } else if (label == kInitializingLabel) {
-    // Another thread is initializing the entry.  Wait until it is finished.
-    do {
-      internal_sched_yield();
-      label = atomic_load(table_ent, memory_order_acquire);
-    } while (label == kInitializingLabel);
+    return (dfsan_label)ent;
   }
-  return label;
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 dfsan_label __dfsan_union_load(const dfsan_label *ls, uptr n) {
   dfsan_label label = ls[0];
-  for (uptr i = 1; i != n; ++i) {
-    dfsan_label next_label = ls[i];
-    if (label != next_label)
-      label = __dfsan_union(label, next_label);
+  uptr i = 1;
+  while (i < n) {
+    // Skip runs of the current label four at a time; most loads are of memory
+    // with a single label, or none.
+    u64 run = label * kFourLabels;
+    while (i + 4 <= n && *(const uu64 *)&ls[i] == run)
+      i += 4;
+    for (uptr end = Min(i + 4, n); i < end; ++i) {
+      dfsan_label next_label = ls[i];
+      if (label != next_label)
+        label = __dfsan_union(label, next_label);
+    }
   }
   return label;
 }
@@ -262,20 +301,37 @@ dfsan_label dfsan_create_label(const char *desc, void *userdata) {
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 void __dfsan_set_label(dfsan_label label, void *addr, uptr size) {
-  for (dfsan_label *labelp = shadow_for(addr); size != 0; --size, ++labelp) {
-    // Don't write the label if it is already the value we need it to be.
-    // In a program where most addresses are not labeled, it is common that
-    // a page of shadow memory is entirely zeroed.  The Linux copy-on-write
-    // implementation will share all of the zeroed pages, making a copy of a
-    // page when any value is written.  The un-sharing will happen even if
-    // the value written does not change the value in memory.  Avoiding the
-    // write when both |label| and |*labelp| are zero dramatically reduces
-    // the amount of real memory used by large programs.
-    if (label == *labelp)
-      continue;
+  dfsan_label *labelp = shadow_for(addr);
+  // Don't write the label if it is already the value we need it to be.
+  // In a program where most addresses are not labeled, it is common that
+  // a page of shadow memory is entirely zeroed.  The Linux copy-on-write
+  // implementation will share all of the zeroed pages, making a copy of a
+  // page when any value is written.  The un-sharing will happen even if
+  // the value written does not change the value in memory.  Avoiding the
+  // write when both |label| and |*labelp| are zero dramatically reduces
+  // the amount of real memory used by large programs.
+  u64 labels = label * kFourLabels;
+  uptr i = 0;
+  for (; i + 4 <= size; i += 4)
+    if (*(uu64 *)&labelp[i] != labels)
+      *(uu64 *)&labelp[i] = labels;
+  for (; i < size; ++i)
+    if (labelp[i] != label)
+      labelp[i] = label;
+}
 
-    *labelp = label;
+void __dfsan::CopyLabels(dfsan_label *dst, const dfsan_label *src, uptr n) {
+  // Like __dfsan_set_label, keep the zero pages of the shadow shared when
+  // copying unlabeled data.
+  uptr i = 0;
+  for (; i + 4 <= n; i += 4) {
+    u64 labels = *(const uu64 *)&src[i];
+    if (*(uu64 *)&dst[i] != labels)
+      *(uu64 *)&dst[i] = labels;
   }
+  for (; i < n; ++i)
+    if (dst[i] != src[i])
+      dst[i] = src[i];
 }
 
 SANITIZER_INTERFACE_ATTRIBUTE
@@ -312,27 +368,118 @@ const struct dfsan_label_info *dfsan_get_label_info(dfsan_label label) {
   return &__dfsan_label_info[label];
 }
 
+// The labels in the tree of a union label, as a bitset over [0, label]: the
+// labels of a union were all created before it. The sets are built on the
+// first query for a label and kept in an arena, which is emptied whenever it
+// outgrows label_set_cache_size_mb.
+static const uptr kLabelSetArenaChunkSize = 1 << 20;
+
+static StaticSpinMutex label_sets_mutex;
+static u64 **label_sets;
+static uptr label_sets_bytes;
+// Chunks of the arena, and the free part of the last one.
+static InternalMmapVectorNoCtor<void *> label_set_chunks;
+static uptr label_set_chunk_pos, label_set_chunk_end;
+// The labels still to be visited while building a set.
+static InternalMmapVectorNoCtor<dfsan_label> label_set_worklist;
+
+static uptr LabelSetWords(dfsan_label label) { return label / 64 + 1; }
+
+static bool LabelSetHas(const u64 *set, dfsan_label elem) {
+  return (set[elem / 64] >> (elem % 64)) & 1;
+}
+
+// Must be called with label_sets_mutex held.
+static void ClearLabelSets() {
+  for (uptr i = 0; i < label_set_chunks.size(); ++i)
+    UnmapOrDie(label_set_chunks[i], kLabelSetArenaChunkSize);
+  label_set_chunks.clear();
+  label_set_chunk_pos = label_set_chunk_end = 0;
+  internal_memset(label_sets, 0, kNumLabels * sizeof(*label_sets));
+  label_sets_bytes = 0;
+}
+
+// Must be called with label_sets_mutex held.
+static u64 *AllocateLabelSet(dfsan_label label) {
+  uptr size = LabelSetWords(label) * sizeof(u64);
+  if (label_set_chunk_pos + size > label_set_chunk_end) {
+    void *chunk = MmapOrDie(kLabelSetArenaChunkSize, "dfsan label sets");
+    label_set_chunks.push_back(chunk);
+    label_set_chunk_pos = (uptr)chunk;
+    label_set_chunk_end = label_set_chunk_pos + kLabelSetArenaChunkSize;
+  }
+  u64 *set = (u64 *)label_set_chunk_pos;
+  label_set_chunk_pos += size;
+  label_sets_bytes += size;
+  return set;
+}
+
+// Returns the set of a union label. Must be called with label_sets_mutex held.
+static const u64 *GetLabelSet(dfsan_label label) {
+  if (!label_sets) {
+    label_sets = (u64 **)MmapOrDie(kNumLabels * sizeof(*label_sets),
+                                   "dfsan label sets");
+    label_set_chunks.Initialize(0);
+    label_set_worklist.Initialize(0);
+  }
+  if (label_sets[label])
+    return label_sets[label];
+  if (label_sets_bytes >= (uptr)flags().label_set_cache_size_mb << 20)
+    ClearLabelSets();
+
+  // Chunks are zeroed when mapped, and each set is carved out only once.
+  u64 *set = AllocateLabelSet(label);
+  label_set_worklist.clear();
+  label_set_worklist.push_back(label);
+  while (label_set_worklist.size()) {
+    dfsan_label l = label_set_worklist.back();
+    label_set_worklist.pop_back();
+    if (LabelSetHas(set, l))
+      continue;
+    set[l / 64] |= 1ULL << (l % 64);
+    const dfsan_label_info *info = &__dfsan_label_info[l];
+    if (info->l1 == 0)
+      continue;
+    // Merge the sets of labels already built rather than walking them again.
+    if (l != label && label_sets[l]) {
+      const u64 *sub = label_sets[l];
+      for (uptr i = 0; i < LabelSetWords(l); ++i)
+        set[i] |= sub[i];
+      continue;
+    }
+    label_set_worklist.push_back(info->l1);
+    label_set_worklist.push_back(info->l2);
+  }
+  label_sets[label] = set;
+  return set;
+}
+
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE int
 dfsan_has_label(dfsan_label label, dfsan_label elem) {
   if (label == elem)
     return true;
-  const dfsan_label_info *info = dfsan_get_label_info(label);
-  if (info->l1 != 0) {
-    return dfsan_has_label(info->l1, elem) || dfsan_has_label(info->l2, elem);
-  } else {
+  if (elem > label || dfsan_get_label_info(label)->l1 == 0)
     return false;
-  }
+  SpinMutexLock l(&label_sets_mutex);
+  return LabelSetHas(GetLabelSet(label), elem);
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE dfsan_label
 dfsan_has_label_with_desc(dfsan_label label, const char *desc) {
   const dfsan_label_info *info = dfsan_get_label_info(label);
-  if (info->l1 != 0) {
-    return dfsan_has_label_with_desc(info->l1, desc) ||
-           dfsan_has_label_with_desc(info->l2, desc);
-  } else {
+  if (info->l1 == 0)
     return internal_strcmp(desc, info->desc) == 0;
+  SpinMutexLock l(&label_sets_mutex);
+  const u64 *set = GetLabelSet(label);
+  for (uptr i = 0; i < LabelSetWords(label); ++i) {
+    for (u64 bits = set[i]; bits; bits &= bits - 1) {
+      dfsan_label elem = i * 64 + LeastSignificantSetBitIndex(bits);
+      info = dfsan_get_label_info(elem);
+      if (info->l1 == 0 && internal_strcmp(desc, info->desc) == 0)
+        return true;
+    }
   }
+  return false;
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE uptr
@@ -361,6 +508,52 @@ dfsan_dump_labels(int fd) {
   }
 }
 
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE uptr
+dfsan_dump_new_labels(int fd) {
+  dfsan_label last_label =
+      atomic_load(&__dfsan_last_label, memory_order_relaxed);
+  // Claim the labels to dump, so that concurrent calls dump each label once.
+  dfsan_label first_label =
+      atomic_load(&__dfsan_last_dumped_label, memory_order_relaxed);
+  do {
+    if (first_label >= last_label)
+      return 0;
+  } while (!atomic_compare_exchange_weak(&__dfsan_last_dumped_label,
+                                         &first_label, last_label,
+                                         memory_order_relaxed));
+
+  // Buffer the records to write the table in large chunks.
+  char buf[4096];
+  uptr pos = 0;
+  for (uptr l = (uptr)first_label + 1; l <= last_label; ++l) {
+    const dfsan_label_info *info = &__dfsan_label_info[l];
+    const char *desc = info->l1 == 0 ? info->desc : nullptr;
+    uptr desc_size = desc ? Min(internal_strlen(desc), (uptr)0xffff) : 0;
+    dfsan_dumped_label record = {(dfsan_label)l, info->l1, info->l2,
+                                 (u16)desc_size};
+    if (pos + sizeof(record) > sizeof(buf)) {
+      WriteToFile(fd, buf, pos);
+      pos = 0;
+    }
+    internal_memcpy(buf + pos, &record, sizeof(record));
+    pos += sizeof(record);
+    while (desc_size) {
+      if (pos == sizeof(buf)) {
+        WriteToFile(fd, buf, pos);
+        pos = 0;
+      }
+      uptr n = Min(desc_size, sizeof(buf) - pos);
+      internal_memcpy(buf + pos, desc, n);
+      pos += n;
+      desc += n;
+      desc_size -= n;
+    }
+  }
+  if (pos)
+    WriteToFile(fd, buf, pos);
+  return last_label - first_label;
+}
+
 void Flags::SetDefaults() {
 #define DFSAN_FLAG(Type, Name, DefaultValue, Description) Name = DefaultValue;
 #include "dfsan_flags.inc"
@@ -414,7 +607,10 @@ static void dfsan_fini() {
 
     Report("INFO: DataFlowSanitizer: dumping labels to %s\n",
            flags().dump_labels_at_exit);
-    dfsan_dump_labels(fd);
+    if (flags().dump_labels_binary)
+      dfsan_dump_new_labels(fd);
+    else
+      dfsan_dump_labels(fd);
     CloseFile(fd);
   }
 }
@@ -31,6 +31,13 @@ struct dfsan_label_info {
   void *userdata;
 };
 
+struct dfsan_dumped_label {
+  dfsan_label label;
+  dfsan_label l1;
+  dfsan_label l2;
+  u16 desc_size;
+};
+
 extern "C" {
 void dfsan_add_label(dfsan_label label, void *addr, uptr size);
 void dfsan_set_label(dfsan_label label, void *addr, uptr size);
@@ -55,6 +62,9 @@ inline const dfsan_label *shadow_for(const void *ptr) {
   return shadow_for(const_cast<void *>(ptr));
 }
 
+// Copies n labels from src to dst. The ranges must not overlap.
+void CopyLabels(dfsan_label *dst, const dfsan_label *src, uptr n);
+
 struct Flags {
 #define DFSAN_FLAG(Type, Name, DefaultValue, Description) Type Name;
 #include "dfsan_flags.inc"
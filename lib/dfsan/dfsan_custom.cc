@@ -244,14 +244,12 @@ __dfsw_strlen(const char *s, dfsan_label s_label, dfsan_label *ret_label) {
 
 
 static void *dfsan_memcpy(void *dest, const void *src, size_t n) {
-  dfsan_label *sdest = shadow_for(dest);
-  const dfsan_label *ssrc = shadow_for(src);
-  internal_memcpy((void *)sdest, (const void *)ssrc, n * sizeof(dfsan_label));
-  return internal_memcpy(dest, src, n);
+  CopyLabels(shadow_for(dest), shadow_for(src), n);
+  return memcpy(dest, src, n);
 }
 
 static void dfsan_memset(void *s, int c, dfsan_label c_label, size_t n) {
-  internal_memset(s, c, n);
+  memset(s, c, n);
   dfsan_set_label(c_label, s, n);
 }
 
@@ -508,8 +506,7 @@ char *__dfsw_strcpy(char *dest, const char *src, dfsan_label dst_label,
                     dfsan_label src_label, dfsan_label *ret_label) {
   char *ret = strcpy(dest, src);
   if (ret) {
-    internal_memcpy(shadow_for(dest), shadow_for(src),
-                    sizeof(dfsan_label) * (strlen(src) + 1));
+    CopyLabels(shadow_for(dest), shadow_for(src), strlen(src) + 1);
   }
   *ret_label = dst_label;
   return ret;
@@ -14,8 +14,11 @@
 
 #include "esan.h"
 #include "esan_flags.h"
-#include "sanitizer_common/sanitizer_addrhashmap.h"
+#include "esan_hashtable.h"
+#include "esan_sideline.h"
+#include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_mutex.h"
 #include "sanitizer_common/sanitizer_placement_new.h"
 #include <string.h>
 
@@ -50,19 +53,27 @@ struct StructCounter {
   u64 Ratio; // Difference ratio for the struct layout access.
 };
 
-// We use StructHashMap to keep track of an unique copy of StructCounter.
-typedef AddrHashMap<StructCounter, 31051> StructHashMap;
+// The counters are 8-byte aligned.
+struct StructCounterHash {
+  size_t operator()(const uptr &Key) const { return Key >> 3; }
+};
+
+// We use StructHashMap to keep track of an unique copy of StructCounter,
+// keyed by the address of its field counters.  Modules may be loaded and
+// unloaded by several threads at once.
+typedef ShardedHashTable<uptr, StructCounter, 16, StructCounterHash>
+    StructHashMap;
 struct Context {
   StructHashMap StructMap;
-  u32 NumStructs;
-  u64 TotalCount; // The total access count of all structs.
+  atomic_uint32_t NumStructs;
+  atomic_uint64_t TotalCount; // The total access count of all structs.
 };
 static Context *Ctx;
 
 static void reportStructSummary() {
   // FIXME: provide a better struct field access summary report.
   Report("%s: total struct field access count = %llu\n", SanitizerToolName,
-         Ctx->TotalCount);
+         atomic_load(&Ctx->TotalCount, memory_order_relaxed));
 }
 
 // FIXME: we are still exploring proper ways to evaluate the difference between
@@ -77,26 +88,36 @@ static inline u64 computeDifferenceRatio(u64 Val1, u64 Val2) {
   return (Val1 / Val2);
 }
 
-static void reportStructCounter(StructHashMap::Handle &Handle) {
+static bool isUnion(StructInfo *Struct) {
+  return strncmp(Struct->StructName, "union.", 6) == 0;
+}
+
+// Splits the name of a class or struct for printing.
+static void getStructName(StructInfo *Struct, const char **Type,
+                          const char **Start, const char **End) {
+  // Remove the '.' after class/struct during print.
+  if (strncmp(Struct->StructName, "class.", 6) == 0) {
+    *Type = "class";
+    *Start = &Struct->StructName[6];
+  } else {
+    *Type = "struct";
+    *Start = &Struct->StructName[7];
+  }
+  // Remove the suffixes with '$' during print.
+  *End = strchr(*Start, '$');
+  CHECK(*End != nullptr);
+}
+
+static void reportStructCounter(StructCounter *Handle) {
   const u32 TypePrintLimit = 512;
   const char *type, *start, *end;
   StructInfo *Struct = Handle->Struct;
   // Union field address calculation is done via bitcast instead of GEP,
   // so the count for union is always 0.
   // We skip the union report to avoid confusion.
-  if (strncmp(Struct->StructName, "union.", 6) == 0)
+  if (isUnion(Struct))
     return;
-  // Remove the '.' after class/struct during print.
-  if (strncmp(Struct->StructName, "class.", 6) == 0) {
-    type = "class";
-    start = &Struct->StructName[6];
-  } else {
-    type = "struct";
-    start = &Struct->StructName[7];
-  }
-  // Remove the suffixes with '$' during print.
-  end = strchr(start, '$');
-  CHECK(end != nullptr);
+  getStructName(Struct, &type, &start, &end);
   Report("  %s %.*s\n", type, end - start, start);
   Report("   size = %u, count = %llu, ratio = %llu, array access = %llu\n",
          Struct->Size, Handle->Count, Handle->Ratio, *Struct->ArrayCounter);
@@ -114,7 +135,226 @@ static void reportStructCounter(StructHashMap::Handle &Handle) {
   }
 }
 
-static void computeStructRatio(StructHashMap::Handle &Handle) {
+//===-- Field co-access affinity ------------------------------------------===//
+
+// The affinities are only tracked for structs with at most this many fields.
+static const u32 MaxAffinityFields = 32;
+
+// The affinity of two fields is the sum over the samples of the smaller of
+// the increments of their counters, which approximates how often they are
+// accessed close together in time.
+struct FieldAffinity {
+  StructInfo *Struct;
+  u64 *LastCounts;
+  u64 *Matrix; // NumFields x NumFields; only the entries with i < j are used.
+};
+
+static SidelineThread AffinityThread;
+static bool AffinityThreadLaunched;
+static StaticSpinMutex AffinityMutex;
+static InternalMmapVectorNoCtor<FieldAffinity> Affinities;
+
+static void takeAffinitySample(void *Arg) {
+  SpinMutexLock L(&AffinityMutex);
+  u64 Delta[MaxAffinityFields];
+  for (uptr k = 0; k < Affinities.size(); ++k) {
+    FieldAffinity &Affinity = Affinities[k];
+    u32 NumFields = Affinity.Struct->NumFields;
+    for (u32 i = 0; i < NumFields; ++i) {
+      u64 Count = Affinity.Struct->FieldCounters[i];
+      Delta[i] = Count - Affinity.LastCounts[i];
+      Affinity.LastCounts[i] = Count;
+    }
+    for (u32 i = 0; i < NumFields; ++i) {
+      if (Delta[i] == 0)
+        continue;
+      for (u32 j = i + 1; j < NumFields; ++j)
+        Affinity.Matrix[i * NumFields + j] += Min(Delta[i], Delta[j]);
+    }
+  }
+}
+
+static void registerAffinity(StructInfo *Struct) {
+  if (!AffinityThreadLaunched || !Struct->hasAuxFieldInfo() ||
+      Struct->NumFields < 2 || Struct->NumFields > MaxAffinityFields)
+    return;
+  u32 NumFields = Struct->NumFields;
+  FieldAffinity Affinity;
+  Affinity.Struct = Struct;
+  Affinity.LastCounts = (u64 *)InternalAlloc(NumFields * sizeof(u64));
+  internal_memcpy(Affinity.LastCounts, Struct->FieldCounters,
+                  NumFields * sizeof(u64));
+  Affinity.Matrix = (u64 *)InternalAlloc(NumFields * NumFields * sizeof(u64));
+  internal_memset(Affinity.Matrix, 0, NumFields * NumFields * sizeof(u64));
+  SpinMutexLock L(&AffinityMutex);
+  Affinities.push_back(Affinity);
+}
+
+// Stops sampling the struct, whose module is going away, and returns its
+// affinity matrix for the caller to free, or null if it was not sampled.
+static u64 *unregisterAffinity(StructInfo *Struct) {
+  SpinMutexLock L(&AffinityMutex);
+  for (uptr k = 0; k < Affinities.size(); ++k) {
+    if (Affinities[k].Struct != Struct)
+      continue;
+    u64 *Matrix = Affinities[k].Matrix;
+    InternalFree(Affinities[k].LastCounts);
+    Affinities[k] = Affinities.back();
+    Affinities.pop_back();
+    return Matrix;
+  }
+  return nullptr;
+}
+
+//===-- Struct layout suggestions -----------------------------------------===//
+
+// We suggest putting the hot fields of a struct first, each next to the one
+// it has the highest affinity with, and moving the cold ones to a separate
+// struct.  The estimated saving is the number of cache lines spanned by the
+// hot fields now minus after, with the struct aligned to a cache line; the
+// suggestions are ranked by the saving times the struct's access count.
+struct LayoutSuggestion {
+  char Name[128];
+  u64 Count;
+  u64 Score;
+  u32 OldLines;
+  u32 NewLines;
+  u32 NumFields;
+  u32 NumHot;
+  u32 *Order; // Hot fields first, in the suggested order, then cold ones.
+};
+
+static InternalMmapVectorNoCtor<LayoutSuggestion> Suggestions;
+
+// Our shadow memory assumes that the line size is 64.
+static const u32 CacheLineSize = 64;
+
+static bool compareSuggestions(const LayoutSuggestion &A,
+                               const LayoutSuggestion &B) {
+  return A.Score > B.Score;
+}
+
+static u64 getAffinity(const u64 *Matrix, u32 NumFields, u32 i, u32 j) {
+  if (Matrix == nullptr || i == j)
+    return 0;
+  return i < j ? Matrix[i * NumFields + j] : Matrix[j * NumFields + i];
+}
+
+// The alignment of a field, assuming that its size is a multiple of it.
+static u32 getFieldAlignment(u32 Size) {
+  if (Size == 0)
+    return 1;
+  return Min(8u, 1u << LeastSignificantSetBitIndex(Size));
+}
+
+static void suggestStructLayout(StructCounter *Handle,
+                                const u64 *Matrix) {
+  StructInfo *Struct = Handle->Struct;
+  u32 NumFields = Struct->NumFields;
+  if (isUnion(Struct) || !Struct->hasAuxFieldInfo() || Handle->Count == 0)
+    return;
+  u64 MaxCount = 0;
+  for (u32 i = 0; i < NumFields; ++i)
+    MaxCount = Max(MaxCount, Struct->FieldCounters[i]);
+  u64 ColdRatio = Max(getFlags()->cold_field_ratio, 1);
+  InternalScopedBuffer<bool> Hot(NumFields);
+  u32 NumHot = 0;
+  // The lines spanned by the hot fields, which are in offset order.
+  u32 OldLines = 0;
+  uptr LastLine = 0;
+  for (u32 i = 0; i < NumFields; ++i) {
+    u64 Count = Struct->FieldCounters[i];
+    Hot[i] = Count > 0 && Count * ColdRatio >= MaxCount;
+    if (!Hot[i])
+      continue;
+    uptr First = Struct->FieldOffset[i] / CacheLineSize;
+    uptr Last = (Struct->FieldOffset[i] + Max(Struct->FieldSize[i], 1u) - 1) /
+                CacheLineSize;
+    // Do not count the line shared with the previous hot field twice.
+    if (NumHot > 0 && First == LastLine)
+      ++First;
+    OldLines += Last + 1 - First;
+    LastLine = Last;
+    ++NumHot;
+  }
+  // Greedily order the hot fields, starting with the hottest one.
+  u32 *Order = (u32 *)InternalAlloc(NumFields * sizeof(u32));
+  InternalScopedBuffer<bool> Placed(NumFields);
+  internal_memset(Placed.data(), 0, NumFields * sizeof(bool));
+  uptr Offset = 0;
+  for (u32 n = 0; n < NumHot; ++n) {
+    u32 Best = NumFields;
+    for (u32 i = 0; i < NumFields; ++i) {
+      if (!Hot[i] || Placed[i])
+        continue;
+      if (Best == NumFields) {
+        Best = i;
+        continue;
+      }
+      u64 Affinity = n ? getAffinity(Matrix, NumFields, Order[n - 1], i) : 0;
+      u64 BestAffinity =
+          n ? getAffinity(Matrix, NumFields, Order[n - 1], Best) : 0;
+      if (Affinity > BestAffinity ||
+          (Affinity == BestAffinity &&
+           Struct->FieldCounters[i] > Struct->FieldCounters[Best]))
+        Best = i;
+    }
+    Order[n] = Best;
+    Placed[Best] = true;
+    u32 Size = Struct->FieldSize[Best];
+    Offset = RoundUpTo(Offset, getFieldAlignment(Size)) + Size;
+  }
+  u32 NewLines = RoundUpTo(Offset, CacheLineSize) / CacheLineSize;
+  if (NewLines >= OldLines) {
+    InternalFree(Order);
+    return;
+  }
+  for (u32 i = 0, n = NumHot; i < NumFields; ++i) {
+    if (!Hot[i])
+      Order[n++] = i;
+  }
+  LayoutSuggestion Suggestion;
+  const char *Type, *Start, *End;
+  getStructName(Struct, &Type, &Start, &End);
+  internal_snprintf(Suggestion.Name, sizeof(Suggestion.Name), "%s %.*s", Type,
+                    (int)(End - Start), Start);
+  Suggestion.Count = Handle->Count;
+  Suggestion.Score = (OldLines - NewLines) * Handle->Count;
+  Suggestion.OldLines = OldLines;
+  Suggestion.NewLines = NewLines;
+  Suggestion.NumFields = NumFields;
+  Suggestion.NumHot = NumHot;
+  Suggestion.Order = Order;
+  Suggestions.push_back(Suggestion);
+}
+
+static void reportLayoutSuggestions() {
+  if (Suggestions.size() == 0)
+    return;
+  InternalSort(&Suggestions, Suggestions.size(), compareSuggestions);
+  Report("%s: struct layout suggestions, by estimated cache lines saved:\n",
+         SanitizerToolName);
+  for (uptr k = 0; k < Suggestions.size(); ++k) {
+    LayoutSuggestion &Suggestion = Suggestions[k];
+    Report("  %s: hot fields in %u instead of %u cache lines, count = %llu\n",
+           Suggestion.Name, Suggestion.NewLines, Suggestion.OldLines,
+           Suggestion.Count);
+    InternalScopedString Fields(Suggestion.NumFields * 12 + 1);
+    for (u32 n = 0; n < Suggestion.NumHot; ++n)
+      Fields.append(" #%u", Suggestion.Order[n]);
+    Report("   hot field order:%s\n", Fields.data());
+    if (Suggestion.NumHot < Suggestion.NumFields) {
+      Fields.clear();
+      for (u32 n = Suggestion.NumHot; n < Suggestion.NumFields; ++n)
+        Fields.append(" #%u", Suggestion.Order[n]);
+      Report("   cold fields to split out:%s\n", Fields.data());
+    }
+    InternalFree(Suggestion.Order);
+  }
+  Suggestions.clear();
+}
+
+static void computeStructRatio(StructCounter *Handle) {
   Handle->Ratio = 0;
   Handle->Count = Handle->Struct->FieldCounters[0];
   for (u32 i = 1; i < Handle->Struct->NumFields; ++i) {
@@ -122,21 +362,25 @@ static void computeStructRatio(StructHashMap::Handle &Handle) {
     Handle->Ratio += computeDifferenceRatio(
         Handle->Struct->FieldCounters[i - 1], Handle->Struct->FieldCounters[i]);
   }
-  Ctx->TotalCount += Handle->Count;
+  atomic_fetch_add(&Ctx->TotalCount, Handle->Count, memory_order_relaxed);
   if (Handle->Ratio >= (u64)getFlags()->report_threshold ||
       (Verbosity() >= 1 && Handle->Count > 0))
     reportStructCounter(Handle);
+  u64 *Matrix = unregisterAffinity(Handle->Struct);
+  suggestStructLayout(Handle, Matrix);
+  if (Matrix)
+    InternalFree(Matrix);
 }
 
 static void registerStructInfo(CacheFragInfo *CacheFrag) {
   for (u32 i = 0; i < CacheFrag->NumStructs; ++i) {
     StructInfo *Struct = &CacheFrag->Structs[i];
-    StructHashMap::Handle H(&Ctx->StructMap, (uptr)Struct->FieldCounters);
-    if (H.created()) {
+    StructCounter Counter = {Struct, 0, 0};
+    if (Ctx->StructMap.add((uptr)Struct->FieldCounters, Counter)) {
       VPrintf(2, " Register %s: %u fields\n", Struct->StructName,
               Struct->NumFields);
-      H->Struct = Struct;
-      ++Ctx->NumStructs;
+      atomic_fetch_add(&Ctx->NumStructs, 1, memory_order_relaxed);
+      registerAffinity(Struct);
     } else {
       VPrintf(2, " Duplicated %s: %u fields\n", Struct->StructName,
               Struct->NumFields);
@@ -147,25 +391,29 @@ static void registerStructInfo(CacheFragInfo *CacheFrag) {
 static void unregisterStructInfo(CacheFragInfo *CacheFrag) {
   // FIXME: if the library is unloaded before finalizeCacheFrag, we should
   // collect the result for later report.
+  bool Last = false;
   for (u32 i = 0; i < CacheFrag->NumStructs; ++i) {
     StructInfo *Struct = &CacheFrag->Structs[i];
-    StructHashMap::Handle H(&Ctx->StructMap, (uptr)Struct->FieldCounters, true);
-    if (H.exists()) {
+    StructCounter Counter;
+    // Whoever removes the counter reports it.
+    if (Ctx->StructMap.lookup((uptr)Struct->FieldCounters, Counter) &&
+        Ctx->StructMap.remove((uptr)Struct->FieldCounters)) {
       VPrintf(2, " Unregister %s: %u fields\n", Struct->StructName,
               Struct->NumFields);
       // FIXME: we should move this call to finalizeCacheFrag once we can
       // iterate over the hash map there.
-      computeStructRatio(H);
-      --Ctx->NumStructs;
+      computeStructRatio(&Counter);
+      Last = atomic_fetch_sub(&Ctx->NumStructs, 1, memory_order_relaxed) == 1;
     } else {
       VPrintf(2, " Duplicated %s: %u fields\n", Struct->StructName,
               Struct->NumFields);
     }
   }
   static bool Reported = false;
-  if (Ctx->NumStructs == 0 && !Reported) {
+  if (Last && !Reported) {
     Reported = true;
     reportStructSummary();
+    reportLayoutSuggestions();
   }
 }
 
@@ -188,14 +436,25 @@ void processCacheFragCompilationUnitExit(void *Ptr) {
 void initializeCacheFrag() {
   VPrintf(2, "in esan::%s\n", __FUNCTION__);
   // We use placement new to initialize Ctx before C++ static initializaion.
-  // We make CtxMem 8-byte aligned for atomic operations in AddrHashMap.
-  static u64 CtxMem[sizeof(Context) / sizeof(u64) + 1];
+  // We align CtxMem for the shards of the StructMap.
+  static ALIGNED(64) u64 CtxMem[sizeof(Context) / sizeof(u64) + 1];
   Ctx = new (CtxMem) Context();
-  Ctx->NumStructs = 0;
+  atomic_store(&Ctx->NumStructs, 0, memory_order_relaxed);
+  atomic_store(&Ctx->TotalCount, 0, memory_order_relaxed);
+  Suggestions.Initialize(16);
+  if (getFlags()->field_affinity_sample_freq > 0) {
+    Affinities.Initialize(16);
+    AffinityThreadLaunched = AffinityThread.launchThread(
+        takeAffinitySample, nullptr, getFlags()->field_affinity_sample_freq);
+  }
 }
 
 int finalizeCacheFrag() {
   VPrintf(2, "in esan::%s\n", __FUNCTION__);
+  // The structs of the modules still loaded are reported after this, when
+  // their modules go away.
+  if (AffinityThreadLaunched)
+    AffinityThread.joinThread();
   return 0;
 }
 
@@ -17,6 +17,7 @@
 #include "esan_interface_internal.h"
 #include "esan_shadow.h"
 #include "cache_frag.h"
+#include "reuse_distance.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_flag_parser.h"
 #include "sanitizer_common/sanitizer_flags.h"
@@ -40,6 +41,7 @@ static const uptr ShadowScale[] = {
   0, // ESAN_None.
   2, // ESAN_CacheFrag: 4B:1B, so 4 to 1 == >>2.
   6, // ESAN_WorkingSet: 64B:1B, so 64 to 1 == >>6.
+  6, // ESAN_ReuseDistance: unused, so as small as the working set's.
 };
 
 // We are combining multiple performance tuning tools under the umbrella of
@@ -70,6 +72,8 @@ void processRangeAccess(uptr PC, uptr Addr, int Size, bool IsWrite) {
     // We'll move this to cache_frag.cpp once we have something.
   } else if (__esan_which_tool == ESAN_WorkingSet) {
     processRangeAccessWorkingSet(PC, Addr, Size, IsWrite);
+  } else if (__esan_which_tool == ESAN_ReuseDistance) {
+    processRangeAccessReuseDistance(PC, Addr, Size, IsWrite);
   }
 }
 
@@ -220,6 +224,8 @@ void initializeLibrary(ToolType Tool) {
     initializeCacheFrag();
   } else if (__esan_which_tool == ESAN_WorkingSet) {
     initializeWorkingSet();
+  } else if (__esan_which_tool == ESAN_ReuseDistance) {
+    initializeReuseDistance();
   }
 
   EsanIsInitialized = true;
@@ -232,6 +238,8 @@ int finalizeLibrary() {
     return finalizeCacheFrag();
   } else if (__esan_which_tool == ESAN_WorkingSet) {
     return finalizeWorkingSet();
+  } else if (__esan_which_tool == ESAN_ReuseDistance) {
+    return finalizeReuseDistance();
   }
   return 0;
 }
@@ -242,6 +250,8 @@ void reportResults() {
     return reportCacheFrag();
   } else if (__esan_which_tool == ESAN_WorkingSet) {
     return reportWorkingSet();
+  } else if (__esan_which_tool == ESAN_ReuseDistance) {
+    return reportReuseDistance();
   }
 }
 
@@ -15,6 +15,7 @@
 #include "sanitizer_common/sanitizer_allocator_internal.h"
 #include "sanitizer_common/sanitizer_internal_defs.h"
 #include "sanitizer_common/sanitizer_mutex.h"
+#include "sanitizer_common/sanitizer_placement_new.h"
 #include <stddef.h>
 
 namespace __esan {
@@ -127,6 +128,44 @@ private:
   const EqualFuncTy EqualFunc;
 };
 
+//===----------------------------------------------------------------------===//
+// ShardedHashTable declaration
+//===----------------------------------------------------------------------===//
+
+// A HashTable split into NumShards tables picked by the hash of the key, each
+// with its own mutex and resized on its own, for tables used by many threads
+// at once.  Operations on keys in different shards do not wait for each
+// other, and a resize only holds up the keys of one shard.
+//
+// All operations are internally-synchronized; there is no iterator.
+template <typename KeyTy, typename DataTy, u32 NumShards = 16,
+          typename HashFuncTy = DefaultHash<KeyTy>,
+          typename EqualFuncTy = DefaultEqual<KeyTy> >
+class ShardedHashTable {
+public:
+  // InitialCapacity is per shard and must be a power of 2.
+  explicit ShardedHashTable(u32 InitialCapacity = 64, u32 ResizeFactor = 70);
+  ~ShardedHashTable();
+  bool lookup(const KeyTy &Key, DataTy &Payload);
+  bool add(const KeyTy &Key, const DataTy &Payload);
+  bool remove(const KeyTy &Key);
+  u32 size();
+
+private:
+  typedef HashTable<KeyTy, DataTy, false, HashFuncTy, EqualFuncTy> Shard;
+  // Each shard gets its own cache lines so that the mutexes do not share
+  // them.
+  struct ALIGNED(64) ShardStorage {
+    u64 Mem[sizeof(Shard) / sizeof(u64) + 1];
+  };
+
+  Shard *getShard(u32 Idx);
+  Shard *getShard(const KeyTy &Key);
+
+  ShardStorage Shards[NumShards];
+  const HashFuncTy HashFunc;
+};
+
 //===----------------------------------------------------------------------===//
 // Hashtable implementation
 //===----------------------------------------------------------------------===//
@@ -286,6 +325,80 @@ void HashTable<KeyTy, DataTy, ExternalLock, HashFuncTy, EqualFuncTy>::unlock() {
   Mutex.Unlock();
 }
 
+//===----------------------------------------------------------------------===//
+// ShardedHashTable implementation
+//===----------------------------------------------------------------------===//
+
+template <typename KeyTy, typename DataTy, u32 NumShards, typename HashFuncTy,
+          typename EqualFuncTy>
+ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy,
+                 EqualFuncTy>::ShardedHashTable(u32 InitialCapacity,
+                                                u32 ResizeFactor)
+    : HashFunc(HashFuncTy()) {
+  for (u32 i = 0; i < NumShards; ++i)
+    new (Shards[i].Mem) Shard(InitialCapacity, ResizeFactor);
+}
+
+template <typename KeyTy, typename DataTy, u32 NumShards, typename HashFuncTy,
+          typename EqualFuncTy>
+ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy,
+                 EqualFuncTy>::~ShardedHashTable() {
+  for (u32 i = 0; i < NumShards; ++i)
+    getShard(i)->~Shard();
+}
+
+template <typename KeyTy, typename DataTy, u32 NumShards, typename HashFuncTy,
+          typename EqualFuncTy>
+typename ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy,
+                          EqualFuncTy>::Shard *
+ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy, EqualFuncTy>::getShard(
+    u32 Idx) {
+  return reinterpret_cast<Shard *>(Shards[Idx].Mem);
+}
+
+template <typename KeyTy, typename DataTy, u32 NumShards, typename HashFuncTy,
+          typename EqualFuncTy>
+typename ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy,
+                          EqualFuncTy>::Shard *
+ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy, EqualFuncTy>::getShard(
+    const KeyTy &Key) {
+  // The shards pick their buckets with the low bits of the hash: pick the
+  // shard with the high bits of its product with a large odd constant.
+  u64 Hash = (u64)HashFunc(Key) * 0x9e3779b97f4a7c15ULL;
+  return getShard((u32)((Hash >> 32) % NumShards));
+}
+
+template <typename KeyTy, typename DataTy, u32 NumShards, typename HashFuncTy,
+          typename EqualFuncTy>
+bool ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy,
+                      EqualFuncTy>::lookup(const KeyTy &Key, DataTy &Payload) {
+  return getShard(Key)->lookup(Key, Payload);
+}
+
+template <typename KeyTy, typename DataTy, u32 NumShards, typename HashFuncTy,
+          typename EqualFuncTy>
+bool ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy, EqualFuncTy>::add(
+    const KeyTy &Key, const DataTy &Payload) {
+  return getShard(Key)->add(Key, Payload);
+}
+
+template <typename KeyTy, typename DataTy, u32 NumShards, typename HashFuncTy,
+          typename EqualFuncTy>
+bool ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy,
+                      EqualFuncTy>::remove(const KeyTy &Key) {
+  return getShard(Key)->remove(Key);
+}
+
+template <typename KeyTy, typename DataTy, u32 NumShards, typename HashFuncTy,
+          typename EqualFuncTy>
+u32 ShardedHashTable<KeyTy, DataTy, NumShards, HashFuncTy,
+                     EqualFuncTy>::size() {
+  u32 Res = 0;
+  for (u32 i = 0; i < NumShards; ++i)
+    Res += getShard(i)->size();
+  return Res;
+}
+
 //===----------------------------------------------------------------------===//
 // Iterator implementation
 //===----------------------------------------------------------------------===//
@@ -32,6 +32,7 @@ typedef enum Type : u32 {
   ESAN_None = 0,
   ESAN_CacheFrag,
   ESAN_WorkingSet,
+  ESAN_ReuseDistance,
   ESAN_Max,
 } ToolType;
 
@@ -0,0 +1,218 @@
+//===-- reuse_distance.cpp ------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of EfficiencySanitizer, a family of performance tuners.
+//
+// This file contains reuse-distance-specific code.
+//===----------------------------------------------------------------------===//
+
+#include "reuse_distance.h"
+#include "esan.h"
+#include "esan_flags.h"
+#include "esan_hashtable.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_placement_new.h"
+
+// The reuse distance of an access to a cache line is the number of distinct
+// cache lines accessed since the previous access to it.  A fully associative
+// LRU cache of N lines misses exactly on the accesses whose reuse distance is
+// at least N, so a histogram of the distances gives the miss ratio of every
+// cache size at once.
+//
+// We sample the cache lines by a hash of their address, as in SHARDS
+// (Waldspurger et al., FAST '15): the distances among the sampled lines,
+// scaled up by the sampling rate, estimate those among all of the lines.
+// Each sampled access gets the next logical time.  For each sampled line we
+// keep the time of its last access, and a Fenwick tree over the times counts
+// the lines last accessed since a given time, which is the distance.
+//
+// We live with the tool lock being taken on every sampled access.
+
+namespace __esan {
+
+static const u32 CacheLineSize = 64;
+// The times are renumbered once they reach this.
+static const u32 MaxTime = 1 << 20;
+// At most this many sampled lines are tracked; the least recently used ones
+// beyond that are forgotten when renumbering, and their next accesses count
+// as first accesses.
+static const u32 MaxTrackedLines = MaxTime / 2;
+// Bucket 0 holds the distances of 0, bucket B those in [2^(B-1), 2^B).
+static const u32 NumBuckets = 64;
+
+// The table is indexed modulo a power of two: mix all of the line's bits into
+// the low ones.
+struct LineHash {
+  size_t operator()(const uptr &Line) const {
+    return (Line * 0xff51afd7ed558ccdULL) >> 32;
+  }
+};
+
+typedef HashTable<uptr, u32, /*ExternalLock=*/true, LineHash> LastAccessTable;
+
+static LastAccessTable *LastAccess;
+// A Fenwick tree counting the lines whose last access was at each time.
+static u32 *TimeTree;
+// The line last accessed at each time, or 0.
+static uptr *TimeToLine;
+static u32 CurTime;
+static u32 SampleRateLog;
+
+static u64 Histogram[NumBuckets];
+static u64 NumSampledAccesses;
+static u64 NumFirstAccesses;
+static u64 NumForgottenLines;
+
+static bool isSampledLine(uptr Line) {
+  return SampleRateLog == 0 ||
+         (Line * 0x9e3779b97f4a7c15ULL) >> (64 - SampleRateLog) == 0;
+}
+
+static void addToTimeTree(u32 Time, u32 Value) {
+  for (; Time < MaxTime; Time += Time & -Time)
+    TimeTree[Time] += Value;
+}
+
+// The number of lines last accessed at or before Time.
+static u32 sumTimeTree(u32 Time) {
+  u32 Sum = 0;
+  for (; Time > 0; Time -= Time & -Time)
+    Sum += TimeTree[Time];
+  return Sum;
+}
+
+// Gives the tracked lines consecutive times from 1 on, in the same order.
+static void renumberTimes() {
+  u32 Live = sumTimeTree(MaxTime - 1);
+  u32 Forget = Live > MaxTrackedLines ? Live - MaxTrackedLines : 0;
+  u32 NewTime = 1;
+  for (u32 Time = 1; Time < CurTime; ++Time) {
+    uptr Line = TimeToLine[Time];
+    if (Line == 0)
+      continue;
+    TimeToLine[Time] = 0;
+    LastAccess->remove(Line);
+    if (Forget > 0) {
+      --Forget;
+      ++NumForgottenLines;
+      continue;
+    }
+    TimeToLine[NewTime] = Line;
+    LastAccess->add(Line, NewTime);
+    ++NewTime;
+  }
+  internal_memset(TimeTree, 0, MaxTime * sizeof(*TimeTree));
+  for (u32 Time = 1; Time < NewTime; ++Time)
+    addToTimeTree(Time, 1);
+  VPrintf(2, "%s: renumbered %u lines\n", __FUNCTION__, NewTime - 1);
+  CurTime = NewTime;
+}
+
+static void accessSampledLine(uptr Line) {
+  ++NumSampledAccesses;
+  u32 PrevTime;
+  if (LastAccess->lookup(Line, PrevTime)) {
+    u64 Distance = (u64)(sumTimeTree(CurTime - 1) - sumTimeTree(PrevTime))
+                   << SampleRateLog;
+    ++Histogram[Distance == 0 ? 0 : MostSignificantSetBitIndex(Distance) + 1];
+    addToTimeTree(PrevTime, (u32)-1);
+    TimeToLine[PrevTime] = 0;
+    LastAccess->remove(Line);
+  } else {
+    ++NumFirstAccesses;
+  }
+  if (CurTime == MaxTime)
+    renumberTimes();
+  addToTimeTree(CurTime, 1);
+  TimeToLine[CurTime] = Line;
+  LastAccess->add(Line, CurTime);
+  ++CurTime;
+}
+
+void processRangeAccessReuseDistance(uptr PC, uptr Addr, SIZE_T Size,
+                                     bool IsWrite) {
+  // Accesses from interceptors may come in before the tool is initialized.
+  if (Size == 0 || LastAccess == nullptr)
+    return;
+  uptr Line = Addr / CacheLineSize;
+  uptr LastLine = (Addr + Size - 1) / CacheLineSize;
+  for (; Line <= LastLine; ++Line) {
+    if (!isSampledLine(Line))
+      continue;
+    LastAccess->lock();
+    accessSampledLine(Line);
+    LastAccess->unlock();
+  }
+}
+
+void initializeReuseDistance() {
+  VPrintf(2, "in esan::%s\n", __FUNCTION__);
+  SampleRateLog = getFlags()->reuse_sample_rate_log;
+  if (SampleRateLog >= 32) {
+    Printf("ERROR: reuse_sample_rate_log must be less than 32\n");
+    Die();
+  }
+  TimeTree = (u32 *)MmapOrDie(MaxTime * sizeof(*TimeTree), "TimeTree");
+  TimeToLine = (uptr *)MmapOrDie(MaxTime * sizeof(*TimeToLine), "TimeToLine");
+  CurTime = 1;
+  // We use placement new to initialize the table before C++ static
+  // initialization.
+  static u64 TableMem[sizeof(LastAccessTable) / sizeof(u64) + 1];
+  LastAccess = new (TableMem) LastAccessTable(1 << 16);
+}
+
+static u32 getSizeForPrinting(u64 NumOfCachelines, const char *&Unit) {
+  u64 Bytes = NumOfCachelines * CacheLineSize;
+  if (Bytes >= (1ULL << 30)) {
+    Unit = "GB";
+    return Bytes >> 30;
+  } else if (Bytes >= (1ULL << 20)) {
+    Unit = "MB";
+    return Bytes >> 20;
+  } else {
+    Unit = "KB";
+    return Bytes >> 10;
+  }
+}
+
+void reportReuseDistance() {
+  VPrintf(2, "in esan::%s\n", __FUNCTION__);
+  LastAccess->lock();
+  Report(" Reuse distance: %llu sampled accesses (1 in %u cache lines), "
+         "%llu first accesses\n", NumSampledAccesses, 1U << SampleRateLog,
+         NumFirstAccesses);
+  VReport(1, " Forgotten lines: %llu\n", NumForgottenLines);
+  if (NumSampledAccesses > 0) {
+    // A cache of 2^Log lines misses on the first accesses and on those in
+    // the buckets after Log.
+    u64 Misses = NumSampledAccesses;
+    for (u32 Log = 0; Log < NumBuckets; ++Log) {
+      Misses -= Histogram[Log];
+      // Start at 1KB.
+      if (Log < 4)
+        continue;
+      const char *Unit;
+      u32 Size = getSizeForPrinting(1ULL << Log, Unit);
+      u64 PerTenThousand = Misses * 10000 / NumSampledAccesses;
+      Report(" Cache of %4u %s: miss ratio %3llu.%02llu%%\n", Size, Unit,
+             PerTenThousand / 100, PerTenThousand % 100);
+      if (Misses == NumFirstAccesses)
+        break;
+    }
+  }
+  LastAccess->unlock();
+}
+
+int finalizeReuseDistance() {
+  VPrintf(2, "in esan::%s\n", __FUNCTION__);
+  reportReuseDistance();
+  return 0;
+}
+
+} // namespace __esan
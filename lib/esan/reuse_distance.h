@@ -0,0 +1,31 @@
+//===-- reuse_distance.h ----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of EfficiencySanitizer, a family of performance tuners.
+//
+// Header for reuse-distance-specific code.
+//===----------------------------------------------------------------------===//
+
+#ifndef REUSE_DISTANCE_H
+#define REUSE_DISTANCE_H
+
+#include "interception/interception.h"
+#include "sanitizer_common/sanitizer_internal_defs.h"
+
+namespace __esan {
+
+void initializeReuseDistance();
+int finalizeReuseDistance();
+void reportReuseDistance();
+void processRangeAccessReuseDistance(uptr PC, uptr Addr, SIZE_T Size,
+                                     bool IsWrite);
+
+} // namespace __esan
+
+#endif // REUSE_DISTANCE_H
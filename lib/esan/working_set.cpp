@@ -57,6 +57,13 @@ static SidelineThread Thread;
 // scenario, but if we switch to some other unit (such as memory accesses) we
 // may want to consider a 64-bit int.
 static u32 SnapshotNum;
+// The cost of taking the samples, which compete with the app for the CPU.
+static u64 SamplingNanoSeconds;
+static u64 SampledShadowBytes;
+// With hw_sampling, the number of PMU samples recorded and lost.
+static bool HwSampling;
+static u64 HwSamples;
+static u64 HwSamplesLost;
 
 // We store the wset size for each of 8 different sampling frequencies.
 static const u32 NumFreq = 8; // One for each bit of our shadow bytes.
@@ -78,6 +85,48 @@ u32 CircularBufferSizes[NumFreq] = {
   4*1024,
 };
 
+// The kinds of app memory the working set is broken down into with
+// region_breakdown_path.  The stacks of threads other than the main thread
+// are anonymous mappings, as are large heap allocations.
+enum RegionKind {
+  RegionHeap,      // The brk heap.
+  RegionStack,     // The main thread's stack.
+  RegionFile,      // File mappings, including the globals of the modules.
+  RegionAnonymous, // Other anonymous mappings.
+  RegionUnmapped,  // Memory that has been unmapped since it was accessed.
+  NumRegionKinds
+};
+
+// The layout of the region_breakdown_path file, in host byte order: the
+// header, then NumSamples WorkingSetRegionSample records in sampling order.
+// The sizes are in cache lines.
+static const u32 RegionFileVersion = 1;
+struct WorkingSetRegionFileHeader {
+  char Magic[8]; // "ESANWSRG"
+  u32 Version;
+  u32 NumKinds;
+  u32 CacheLineSize;
+  u32 SampleFreqMilliSec;
+  u32 NumSamples;
+  // The working set of the entire execution.
+  u32 TotalNumLines[NumRegionKinds];
+};
+struct WorkingSetRegionSample {
+  u32 SnapshotNum;
+  u32 NumLines[NumRegionKinds];
+};
+
+static bool RecordRegions;
+static CircularBuffer<WorkingSetRegionSample> RegionSamples;
+static u32 RegionTotals[NumRegionKinds];
+
+// The shadow of an app mapping.
+struct KindRange {
+  uptr Start;
+  uptr End;
+  RegionKind Kind;
+};
+
 void processRangeAccessWorkingSet(uptr PC, uptr Addr, SIZE_T Size,
                                   bool IsWrite) {
   if (Size == 0)
@@ -117,37 +166,117 @@ void processRangeAccessWorkingSet(uptr PC, uptr Addr, SIZE_T Size,
   }
 }
 
+// Adds up the bytes of Word, none of which may exceed 0x1f.
+static inline u32 sumBytes(u64 Word) {
+  return (Word * 0x0101010101010101ULL) >> 56;
+}
+
 // This routine will word-align ShadowStart and ShadowEnd prior to scanning.
 // It does *not* clear for BitIdx==TotalWorkingSetBitIdx, as that top bit
 // measures the access during the entire execution and should never be cleared.
+// The shadow is scanned 32 bytes at a time: the BitIdx bits are masked off
+// whole words and, as each byte holds at most one of them, counted by adding
+// up the bytes of the shifted words.
 static u32 countAndClearShadowValues(u32 BitIdx, uptr ShadowStart,
                                      uptr ShadowEnd) {
   u32 WorkingSetSize = 0;
-  u32 ByteValue = 0x1 << BitIdx;
-  u32 WordValue = ByteValue | ByteValue << 8 | ByteValue << 16 |
-    ByteValue << 24;
+  u64 WordValue = 0x0101010101010101ULL << BitIdx;
   // Get word aligned start.
-  ShadowStart = RoundDownTo(ShadowStart, sizeof(u32));
+  ShadowStart = RoundDownTo(ShadowStart, sizeof(u64));
   bool Accum = getFlags()->record_snapshots && BitIdx < MaxAccumBitIdx;
   // Do not clear the bit that measures access during the entire execution.
-  bool Clear = BitIdx < TotalWorkingSetBitIdx;
-  for (u32 *Ptr = (u32 *)ShadowStart; Ptr < (u32 *)ShadowEnd; ++Ptr) {
-    if ((*Ptr & WordValue) != 0) {
-      byte *BytePtr = (byte *)Ptr;
-      for (u32 j = 0; j < sizeof(u32); ++j) {
-        if (BytePtr[j] & ByteValue) {
-          ++WorkingSetSize;
-          if (Accum) {
-            // Accumulate to the lower-frequency bit to the left.
-            BytePtr[j] |= (ByteValue << 1);
-          }
-        }
-      }
-      if (Clear) {
-        // Clear this bit from every shadow byte.
-        *Ptr &= ~WordValue;
-      }
+  u64 ClearMask = BitIdx < TotalWorkingSetBitIdx ? ~WordValue : ~0ULL;
+  static const uptr WordsPerStep = 4;
+  u64 *Ptr = (u64 *)ShadowStart;
+  u64 *End = (u64 *)RoundUpTo(ShadowEnd, sizeof(u64));
+  for (; Ptr + WordsPerStep <= End; Ptr += WordsPerStep) {
+    u64 Bits[WordsPerStep];
+    u64 Any = 0;
+    for (uptr j = 0; j < WordsPerStep; ++j) {
+      Bits[j] = Ptr[j] & WordValue;
+      Any |= Bits[j];
+    }
+    if (Any == 0)
+      continue;
+    u64 Sum = 0;
+    for (uptr j = 0; j < WordsPerStep; ++j) {
+      Sum += Bits[j] >> BitIdx;
+      if (Bits[j] == 0)
+        continue;
+      // Accumulate to the lower-frequency bit to the left, and clear this
+      // bit from every shadow byte.
+      Ptr[j] = (Ptr[j] | (Accum ? Bits[j] << 1 : 0)) & ClearMask;
     }
+    WorkingSetSize += sumBytes(Sum);
+  }
+  for (; Ptr < End; ++Ptr) {
+    u64 Bits = *Ptr & WordValue;
+    if (Bits == 0)
+      continue;
+    WorkingSetSize += sumBytes(Bits >> BitIdx);
+    *Ptr = (*Ptr | (Accum ? Bits << 1 : 0)) & ClearMask;
+  }
+  return WorkingSetSize;
+}
+
+static bool compareKindRangeEnds(const KindRange &A, const KindRange &B) {
+  return A.End < B.End;
+}
+
+static bool compareKindRangeStarts(const KindRange &A, const KindRange &B) {
+  return A.Start < B.Start;
+}
+
+static RegionKind getRegionKind(const char *Name) {
+  if (internal_strcmp(Name, "[heap]") == 0)
+    return RegionHeap;
+  if (internal_strncmp(Name, "[stack", 6) == 0)
+    return RegionStack;
+  if (Name[0] != '\0' && Name[0] != '[')
+    return RegionFile;
+  return RegionAnonymous;
+}
+
+// Collects the shadow of the app mappings, sorted by address.
+static void getKindRanges(InternalMmapVector<KindRange> *Ranges) {
+  InternalScopedBuffer<char> Name(kMaxPathLength);
+  MemoryMappingLayout MemIter(true/*cache*/);
+  uptr Start, End;
+  while (MemIter.Next(&Start, &End, nullptr/*offs*/, Name.data(),
+                      Name.size(), nullptr/*prot*/)) {
+    if (!isAppMem(Start) || !isAppMem(End - 1))
+      continue;
+    KindRange Range = {appToShadow(Start), appToShadow(End - 1) + 1,
+                       getRegionKind(Name.data())};
+    Ranges->push_back(Range);
+  }
+  InternalSort(Ranges, Ranges->size(), compareKindRangeStarts);
+}
+
+// Like countAndClearShadowValues, but also adds the sizes of the parts of
+// [ShadowStart, ShadowEnd) covered by each kind of app mapping to SizePerKind.
+static u32 countAndClearShadowValuesPerKind(
+    u32 BitIdx, uptr ShadowStart, uptr ShadowEnd,
+    const InternalMmapVector<KindRange> &Ranges, u32 *SizePerKind) {
+  u32 WorkingSetSize = 0;
+  KindRange Key = {0, ShadowStart + 1, RegionUnmapped};
+  // The first range ending after ShadowStart.
+  uptr I = InternalLowerBound(Ranges, 0, Ranges.size(), Key,
+                              compareKindRangeEnds);
+  while (ShadowStart < ShadowEnd) {
+    uptr PieceEnd = ShadowEnd;
+    RegionKind Kind = RegionUnmapped;
+    if (I < Ranges.size() && Ranges[I].Start <= ShadowStart) {
+      PieceEnd = Min(ShadowEnd, Ranges[I].End);
+      Kind = Ranges[I].Kind;
+      ++I;
+    } else if (I < Ranges.size()) {
+      PieceEnd = Min(ShadowEnd, Ranges[I].Start);
+    }
+    u32 Size = countAndClearShadowValues(BitIdx, ShadowStart, PieceEnd);
+    SizePerKind[Kind] += Size;
+    WorkingSetSize += Size;
+    ShadowStart = PieceEnd;
   }
   return WorkingSetSize;
 }
@@ -157,8 +286,15 @@ static u32 countAndClearShadowValues(u32 BitIdx, uptr ShadowStart,
 // We also clear the lowest bits (most recent working set snapshot).
 // We do *not* clear for BitIdx==TotalWorkingSetBitIdx, as that top bit
 // measures the access during the entire execution and should never be cleared.
-static u32 computeWorkingSizeAndReset(u32 BitIdx) {
+// If SizePerKind is not null, the size is also broken down by RegionKind.
+static u32 computeWorkingSizeAndReset(u32 BitIdx, u64 *ScannedBytes,
+                                      u32 *SizePerKind = nullptr) {
   u32 WorkingSetSize = 0;
+  InternalMmapVector<KindRange> Ranges(SizePerKind ? 64 : 1);
+  if (SizePerKind) {
+    internal_memset(SizePerKind, 0, NumRegionKinds * sizeof(*SizePerKind));
+    getKindRanges(&Ranges);
+  }
   MemoryMappingLayout MemIter(true/*cache*/);
   uptr Start, End, Prot;
   while (MemIter.Next(&Start, &End, nullptr/*offs*/, nullptr/*file*/,
@@ -168,7 +304,12 @@ static u32 computeWorkingSizeAndReset(u32 BitIdx) {
             isShadowMem(Start));
     if (isShadowMem(Start) && (Prot & MemoryMappingLayout::kProtectionWrite)) {
       VPrintf(3, "%s: walking %p-%p\n", __FUNCTION__, Start, End);
-      WorkingSetSize += countAndClearShadowValues(BitIdx, Start, End);
+      if (SizePerKind)
+        WorkingSetSize += countAndClearShadowValuesPerKind(
+            BitIdx, Start, End, Ranges, SizePerKind);
+      else
+        WorkingSetSize += countAndClearShadowValues(BitIdx, Start, End);
+      *ScannedBytes += End - Start;
     }
   }
   return WorkingSetSize;
@@ -179,15 +320,29 @@ static u32 computeWorkingSizeAndReset(u32 BitIdx) {
 static void takeSample(void *Arg) {
   u32 BitIdx = CurWorkingSetBitIdx;
   u32 Freq = 1;
+  u64 StartTime = NanoTime();
+  // The events are set up after the thread starts, drainHwSamples copes.
+  if (getFlags()->hw_sampling)
+    HwSamples += drainHwSamples(&HwSamplesLost);
   ++SnapshotNum; // Simpler to skip 0 whose mod matches everything.
   while (BitIdx <= MaxAccumBitIdx && (SnapshotNum % Freq) == 0) {
-    u32 NumLines = computeWorkingSizeAndReset(BitIdx);
+    u32 NumLines;
+    if (RecordRegions && BitIdx == CurWorkingSetBitIdx) {
+      WorkingSetRegionSample Sample;
+      Sample.SnapshotNum = SnapshotNum;
+      NumLines = computeWorkingSizeAndReset(BitIdx, &SampledShadowBytes,
+                                            Sample.NumLines);
+      RegionSamples.push_back(Sample);
+    } else {
+      NumLines = computeWorkingSizeAndReset(BitIdx, &SampledShadowBytes);
+    }
     VReport(1, "%s: snapshot #%5d bit %d freq %4d: %8u\n", SanitizerToolName,
             SnapshotNum, BitIdx, Freq, NumLines);
     SizePerFreq[BitIdx].push_back(NumLines);
     Freq = Freq << getFlags()->snapshot_step;
     BitIdx++;
   }
+  SamplingNanoSeconds += NanoTime() - StartTime;
 }
 
 unsigned int getSampleCountWorkingSet()
@@ -202,11 +357,22 @@ void initializeShadowWorkingSet() {
 }
 
 void initializeWorkingSet() {
+  RecordRegions = getFlags()->region_breakdown_path[0] != '\0';
+  if (RecordRegions)
+    RegionSamples.initialize(CircularBufferSizes[CurWorkingSetBitIdx]);
   if (getFlags()->record_snapshots) {
     for (u32 i = 0; i < NumFreq; ++i)
       SizePerFreq[i].initialize(CircularBufferSizes[i]);
     Thread.launchThread(takeSample, nullptr, getFlags()->sample_freq);
   }
+  // The sideline thread is started first so that it does not inherit the
+  // events and sample its own shadow scans.
+  if (getFlags()->hw_sampling) {
+    HwSampling = startHwSampling();
+    if (!HwSampling)
+      Report("%s: WARNING: hardware sampling of memory accesses is not "
+             "available\n", SanitizerToolName);
+  }
 }
 
 static u32 getPeriodForPrinting(u32 MilliSec, const char *&Unit) {
@@ -256,19 +422,64 @@ void reportWorkingSet() {
       }
       Freq = Freq << getFlags()->snapshot_step;
     }
+    u64 PerSample = SnapshotNum ? SamplingNanoSeconds / SnapshotNum : 0;
+    Report(" Sampling cost: %llu ms (%llu us per sample), %llu MB of shadow "
+           "scanned\n", SamplingNanoSeconds / 1000000, PerSample / 1000,
+           SampledShadowBytes >> 20);
   }
+  if (HwSampling)
+    Report(" Hardware samples: %llu (%llu lost)\n", HwSamples, HwSamplesLost);
 
   // Get the working set size for the entire execution.
-  u32 NumOfCachelines = computeWorkingSizeAndReset(TotalWorkingSetBitIdx);
+  u64 ScannedBytes = 0;
+  u32 NumOfCachelines = computeWorkingSizeAndReset(
+      TotalWorkingSetBitIdx, &ScannedBytes,
+      RecordRegions ? RegionTotals : nullptr);
   u32 Size = getSizeForPrinting(NumOfCachelines, Unit);
   Report(" %s: the total working set size: %u %s (%u cache lines)\n",
          SanitizerToolName, Size, Unit, NumOfCachelines);
 }
 
+static void writeRegionFile() {
+  InternalScopedString Path(kMaxPathLength);
+  Path.append("%s.%zd", getFlags()->region_breakdown_path, internal_getpid());
+  error_t Err;
+  fd_t Fd = OpenFile(Path.data(), WrOnly, &Err);
+  if (Fd == kInvalidFd) {
+    Report("%s: failed to open %s, errno %d\n", SanitizerToolName,
+           Path.data(), Err);
+    return;
+  }
+  WorkingSetRegionFileHeader Header;
+  internal_memcpy(Header.Magic, "ESANWSRG", sizeof(Header.Magic));
+  Header.Version = RegionFileVersion;
+  Header.NumKinds = NumRegionKinds;
+  Header.CacheLineSize = CacheLineSize;
+  Header.SampleFreqMilliSec = getFlags()->sample_freq;
+  Header.NumSamples = RegionSamples.size();
+  internal_memcpy(Header.TotalNumLines, RegionTotals, sizeof(RegionTotals));
+  bool Ok = WriteToFile(Fd, &Header, sizeof(Header));
+  for (uptr i = 0; Ok && i < RegionSamples.size(); ++i)
+    Ok = WriteToFile(Fd, &RegionSamples[i], sizeof(RegionSamples[i]));
+  if (!Ok)
+    Report("%s: failed to write %s\n", SanitizerToolName, Path.data());
+  CloseFile(Fd);
+  VReport(1, "%s: wrote %zu region samples to %s\n", SanitizerToolName,
+          RegionSamples.size(), Path.data());
+}
+
 int finalizeWorkingSet() {
   if (getFlags()->record_snapshots)
     Thread.joinThread();
+  if (HwSampling) {
+    HwSamples += drainHwSamples(&HwSamplesLost);
+    stopHwSampling();
+  }
   reportWorkingSet();
+  if (RecordRegions) {
+    writeRegionFile();
+    RegionSamples.free();
+  }
   if (getFlags()->record_snapshots) {
     for (u32 i = 0; i < NumFreq; ++i)
       SizePerFreq[i].free();
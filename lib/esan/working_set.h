@@ -35,6 +35,14 @@ bool processWorkingSetSignal(int SigNum, void (*Handler)(int),
 bool processWorkingSetSigaction(int SigNum, const void *Act, void *OldAct);
 bool processWorkingSetSigprocmask(int How, void *Set, void *OldSet);
 
+// Hardware sampling of memory accesses (hw_sampling), platform-dependent.
+bool startHwSampling();
+// Records the accesses sampled since the last call in the shadow. Returns the
+// number of samples and sets *NumLost to the total number of samples lost so
+// far.
+uptr drainHwSamples(u64 *NumLost);
+void stopHwSampling();
+
 } // namespace __esan
 
 #endif // WORKING_SET_H
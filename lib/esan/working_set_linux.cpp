@@ -0,0 +1,172 @@
+//===-- working_set_linux.cpp ---------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of EfficiencySanitizer, a family of performance tuners.
+//
+// Linux-specific working-set code: collection of the memory accesses sampled
+// by the PMU (PEBS) through perf_event_open.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_common/sanitizer_platform.h"
+#if SANITIZER_LINUX
+
+#include "working_set.h"
+#include "esan_flags.h"
+#include "esan_shadow.h"
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_posix.h"
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace __esan {
+
+// Each event has a ring buffer of this many data pages (a power of two),
+// which must hold the samples of one sample_freq period.
+static const uptr HwSampleBufferPages = 16;
+static const uptr MaxHwSampleEvents = 512;
+
+struct HwSampleEvent {
+  int Fd;
+  // The control page, followed by the data pages.
+  perf_event_mmap_page *Page;
+};
+
+// One event per CPU and sampled event kind. The events of the first
+// NumHwSampleEvents entries are set up; the sideline thread drains them.
+static HwSampleEvent HwSampleEvents[MaxHwSampleEvents];
+static atomic_uintptr_t NumHwSampleEvents;
+// Only accessed by whoever drains the events.
+static u64 HwSamplesLost;
+
+static uptr hwSampleMapSize() {
+  return (HwSampleBufferPages + 1) * GetPageSizeCached();
+}
+
+static bool openHwSampleEvent(u64 Config, int Cpu, HwSampleEvent *Event) {
+  perf_event_attr Attr;
+  internal_memset(&Attr, 0, sizeof(Attr));
+  Attr.size = sizeof(Attr);
+  Attr.type = PERF_TYPE_RAW;
+  Attr.config = Config;
+  Attr.sample_period = getFlags()->hw_sample_period;
+  Attr.sample_type = PERF_SAMPLE_ADDR;
+  // PEBS only reports the data address of precise events.
+  Attr.precise_ip = 2;
+  Attr.exclude_kernel = 1;
+  Attr.exclude_hv = 1;
+  // Follow the threads created by the app from now on. Per-CPU events are
+  // required for that: inherited per-task events cannot be mmap-ed.
+  Attr.inherit = 1;
+  int Fd = syscall(__NR_perf_event_open, &Attr, 0 /*this thread*/, Cpu,
+                   -1 /*group*/, PERF_FLAG_FD_CLOEXEC);
+  if (Fd < 0)
+    return false;
+  uptr Map = internal_mmap(nullptr, hwSampleMapSize(), PROT_READ | PROT_WRITE,
+                           MAP_SHARED, Fd, 0);
+  if (internal_iserror(Map)) {
+    internal_close(Fd);
+    return false;
+  }
+  Event->Fd = Fd;
+  Event->Page = (perf_event_mmap_page *)Map;
+  return true;
+}
+
+// Must be called from the main thread before the app creates other threads,
+// which would not be sampled otherwise.
+bool startHwSampling() {
+  int NumCpus = sysconf(_SC_NPROCESSORS_CONF);
+  u64 Configs[] = {(u64)getFlags()->hw_sample_load_event,
+                   (u64)getFlags()->hw_sample_store_event};
+  uptr N = 0;
+  for (uptr i = 0; i < ARRAY_SIZE(Configs); ++i) {
+    if (Configs[i] == 0)
+      continue;
+    for (int Cpu = 0; Cpu < NumCpus && N < MaxHwSampleEvents; ++Cpu) {
+      if (!openHwSampleEvent(Configs[i], Cpu, &HwSampleEvents[N])) {
+        VReport(1, "%s: failed to open PMU event 0x%llx on cpu %d\n",
+                SanitizerToolName, Configs[i], Cpu);
+        continue;
+      }
+      ++N;
+    }
+  }
+  atomic_store(&NumHwSampleEvents, N, memory_order_release);
+  VReport(1, "%s: sampling memory accesses with %zu PMU events\n",
+          SanitizerToolName, N);
+  return N > 0;
+}
+
+// Copies Size bytes at Offset of the ring buffer Data out, wrapping around.
+static void copyFromRing(void *To, const char *Data, u64 Offset, uptr Size) {
+  uptr BufferSize = HwSampleBufferPages * GetPageSizeCached();
+  for (uptr i = 0; i < Size; ++i)
+    ((char *)To)[i] = Data[(Offset + i) & (BufferSize - 1)];
+}
+
+static uptr drainHwSampleEvent(const HwSampleEvent &Event) {
+  uptr NumSamples = 0;
+  perf_event_mmap_page *Page = Event.Page;
+  const char *Data = (const char *)Page + GetPageSizeCached();
+  u64 Head = atomic_load((atomic_uint64_t *)&Page->data_head,
+                         memory_order_acquire);
+  u64 Tail = Page->data_tail;
+  while (Tail < Head) {
+    perf_event_header Header;
+    copyFromRing(&Header, Data, Tail, sizeof(Header));
+    if (Header.size < sizeof(Header))
+      break;
+    u64 Payload;
+    if (Header.size >= sizeof(Header) + sizeof(Payload))
+      copyFromRing(&Payload, Data, Tail + sizeof(Header), sizeof(Payload));
+    else
+      Payload = 0;
+    if (Header.type == PERF_RECORD_SAMPLE) {
+      // The address is 0 if the sampled instruction did not access memory.
+      if (isAppMem(Payload))
+        processRangeAccessWorkingSet(0, Payload, 1, false);
+      ++NumSamples;
+    } else if (Header.type == PERF_RECORD_LOST &&
+               Header.size >= sizeof(Header) + 2 * sizeof(u64)) {
+      u64 Lost;
+      copyFromRing(&Lost, Data, Tail + sizeof(Header) + sizeof(u64),
+                   sizeof(Lost));
+      HwSamplesLost += Lost;
+    }
+    Tail += Header.size;
+  }
+  atomic_store((atomic_uint64_t *)&Page->data_tail, Tail,
+               memory_order_release);
+  return NumSamples;
+}
+
+uptr drainHwSamples(u64 *NumLost) {
+  uptr N = atomic_load(&NumHwSampleEvents, memory_order_acquire);
+  uptr NumSamples = 0;
+  for (uptr i = 0; i < N; ++i)
+    NumSamples += drainHwSampleEvent(HwSampleEvents[i]);
+  *NumLost = HwSamplesLost;
+  return NumSamples;
+}
+
+void stopHwSampling() {
+  uptr N = atomic_load(&NumHwSampleEvents, memory_order_acquire);
+  atomic_store(&NumHwSampleEvents, 0, memory_order_release);
+  for (uptr i = 0; i < N; ++i) {
+    internal_munmap(HwSampleEvents[i].Page, hwSampleMapSize());
+    internal_close(HwSampleEvents[i].Fd);
+  }
+}
+
+} // namespace __esan
+
+#endif // SANITIZER_LINUX
@@ -17,9 +17,246 @@
 
 #include <dlfcn.h>   // for dlsym() and dlvsym()
 
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <elf.h>
+#include <link.h>
+#include <stddef.h>
+#include <sys/auxv.h>  // for getauxval()
+#endif
+
 namespace __interception {
+
+#if defined(__linux__) && !defined(__ANDROID__)
+// The runtimes resolve hundreds of functions with dlsym(RTLD_NEXT) at startup,
+// and each call looks the name up in every loaded object from scratch. We
+// instead collect the dynamic symbol tables of the objects loaded after the
+// one containing this code once, and look the names up in their GNU hash
+// tables ourselves, in the same order. Whenever we are not sure to find what
+// dlsym would (no DT_GNU_HASH, an IFUNC, too many objects, or another thread
+// using the tables), we defer to dlsym.
+namespace {
+
+const uptr kMaxSearchedObjects = 64;
+
+struct SearchedObject {
+  ElfW(Addr) base;
+  const ElfW(Sym) *symtab;
+  const char *strtab;
+  const u32 *gnu_hash;  // Null if the object has no DT_GNU_HASH.
+  const ElfW(Half) *versym;
+};
+
+struct SearchList {
+  SearchedObject objects[kMaxSearchedObjects];
+  uptr num_objects;
+  // Set if there are more objects than fit in the list.
+  bool truncated;
+  // dlpi_adds + dlpi_subs when the list was built.
+  uptr generation;
+  bool valid;
+};
+
+SearchList search_list;
+// Taken while search_list is used; threads which find it taken use dlsym.
+int search_list_busy;
+
+uptr ObjectGeneration(dl_phdr_info *info, size_t size) {
+  // dlpi_adds and dlpi_subs are there since glibc 2.4.
+  if (size < offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+    return 0;
+  return info->dlpi_adds + info->dlpi_subs;
+}
+
+int GenerationCallback(dl_phdr_info *info, size_t size, void *arg) {
+  *(uptr *)arg = ObjectGeneration(info, size);
+  // The counters are the same for all objects.
+  return 1;
+}
+
+bool ContainsAddress(dl_phdr_info *info, uptr addr) {
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    uptr beg = info->dlpi_addr + phdr->p_vaddr;
+    if (phdr->p_type == PT_LOAD && addr >= beg && addr - beg < phdr->p_memsz)
+      return true;
+  }
+  return false;
+}
+
+// The dynamic linker relocates the addresses in the dynamic section of most
+// objects, but not those of the vDSO or of objects with a read-only one.
+template <typename T>
+T *DynamicPointer(ElfW(Addr) base, ElfW(Addr) ptr) {
+  return (T *)(ptr < base ? ptr + base : ptr);
+}
+
+struct BuildState {
+  uptr self;
+  bool self_seen;
+};
+
+int BuildCallback(dl_phdr_info *info, size_t size, void *arg) {
+  BuildState *state = (BuildState *)arg;
+  search_list.generation = ObjectGeneration(info, size);
+  if (!state->self_seen) {
+    // RTLD_NEXT searches the objects after the one making the call.
+    state->self_seen = ContainsAddress(info, state->self);
+    return 0;
+  }
+  // The vDSO is not part of the global scope, even though it is listed.
+  uptr vdso = (uptr)getauxval(AT_SYSINFO_EHDR);
+  if (vdso && ContainsAddress(info, vdso))
+    return 0;
+  if (search_list.num_objects == kMaxSearchedObjects) {
+    search_list.truncated = true;
+    return 1;
+  }
+  SearchedObject obj = {info->dlpi_addr, nullptr, nullptr, nullptr, nullptr};
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    if (phdr->p_type != PT_DYNAMIC)
+      continue;
+    for (const ElfW(Dyn) *dyn = (const ElfW(Dyn) *)(obj.base + phdr->p_vaddr);
+         dyn->d_tag != DT_NULL; dyn++) {
+      switch (dyn->d_tag) {
+        case DT_SYMTAB:
+          obj.symtab = DynamicPointer<const ElfW(Sym)>(obj.base,
+                                                       dyn->d_un.d_ptr);
+          break;
+        case DT_STRTAB:
+          obj.strtab = DynamicPointer<const char>(obj.base, dyn->d_un.d_ptr);
+          break;
+        case DT_GNU_HASH:
+          obj.gnu_hash = DynamicPointer<const u32>(obj.base, dyn->d_un.d_ptr);
+          break;
+        case DT_VERSYM:
+          obj.versym = DynamicPointer<const ElfW(Half)>(obj.base,
+                                                        dyn->d_un.d_ptr);
+          break;
+      }
+    }
+  }
+  // Objects without a dynamic section export nothing.
+  if (obj.symtab && obj.strtab)
+    search_list.objects[search_list.num_objects++] = obj;
+  return 0;
+}
+
+void BuildSearchList() {
+  search_list.num_objects = 0;
+  search_list.truncated = false;
+  search_list.generation = 0;
+  BuildState state = {(uptr)&BuildSearchList, false};
+  dl_iterate_phdr(BuildCallback, &state);
+  // Without the calling object we cannot tell which objects follow it.
+  search_list.valid = state.self_seen;
+}
+
+u32 GnuHash(const char *name) {
+  u32 h = 5381;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++)
+    h = h * 33 + *p;
+  return h;
+}
+
+// The interceptors may not be set up yet: do not call strcmp.
+bool NamesEqual(const char *a, const char *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+enum LookupResult { kNotFound, kFound, kUseDlsym };
+
+LookupResult LookupInObject(const SearchedObject &obj, const char *name,
+                            u32 hash, uptr *addr) {
+  if (!obj.gnu_hash)
+    return kUseDlsym;
+  const u32 nbuckets = obj.gnu_hash[0];
+  const u32 symoffset = obj.gnu_hash[1];
+  const u32 bloom_size = obj.gnu_hash[2];
+  const u32 bloom_shift = obj.gnu_hash[3];
+  const ElfW(Addr) *bloom = (const ElfW(Addr) *)&obj.gnu_hash[4];
+  const u32 *buckets = (const u32 *)&bloom[bloom_size];
+  const u32 *chain = &buckets[nbuckets];
+  if (nbuckets == 0 || bloom_size == 0)
+    return kNotFound;
+
+  const u32 kBloomBits = sizeof(ElfW(Addr)) * 8;
+  ElfW(Addr) word = bloom[(hash / kBloomBits) % bloom_size];
+  ElfW(Addr) mask = ((ElfW(Addr))1 << (hash % kBloomBits)) |
+                    ((ElfW(Addr))1 << ((hash >> bloom_shift) % kBloomBits));
+  if ((word & mask) != mask)
+    return kNotFound;
+
+  u32 index = buckets[hash % nbuckets];
+  if (index < symoffset)
+    return kNotFound;
+  for (;; index++) {
+    const ElfW(Sym) *sym = &obj.symtab[index];
+    u32 chain_hash = chain[index - symoffset];
+    // An unversioned lookup does not see the hidden versions.
+    if ((chain_hash | 1) == (hash | 1) && sym->st_shndx != SHN_UNDEF &&
+        (!obj.versym || !(obj.versym[index] & 0x8000)) &&
+        NamesEqual(name, obj.strtab + sym->st_name)) {
+      unsigned type = ELF32_ST_TYPE(sym->st_info);
+      unsigned bind = ELF32_ST_BIND(sym->st_info);
+      // dlsym calls the resolvers of IFUNCs with platform-specific arguments,
+      // and finds the TLS variables of the calling thread.
+      if (type == STT_GNU_IFUNC || type == STT_TLS)
+        return kUseDlsym;
+      // Like the dynamic linker, skip the version definitions, which have no
+      // value.
+      if ((bind == STB_GLOBAL || bind == STB_WEAK) && sym->st_value != 0 &&
+          (type == STT_FUNC || type == STT_OBJECT || type == STT_NOTYPE ||
+           type == STT_COMMON)) {
+        *addr = obj.base + sym->st_value;
+        return kFound;
+      }
+    }
+    if (chain_hash & 1)
+      return kNotFound;
+  }
+}
+
+}  // namespace
+
+bool GetRealFunctionAddressFromSymbolTables(const char *func_name,
+                                            uptr *func_addr) {
+  if (__atomic_exchange_n(&search_list_busy, 1, __ATOMIC_ACQUIRE))
+    return false;
+  uptr generation = 0;
+  dl_iterate_phdr(GenerationCallback, &generation);
+  // Without the counters, we cannot tell whether objects were loaded since.
+  if (!search_list.valid || generation == 0 ||
+      generation != search_list.generation)
+    BuildSearchList();
+  bool found = false;
+  if (search_list.valid) {
+    u32 hash = GnuHash(func_name);
+    for (uptr i = 0; i < search_list.num_objects; i++) {
+      LookupResult res = LookupInObject(search_list.objects[i], func_name,
+                                        hash, func_addr);
+      if (res == kNotFound)
+        continue;
+      found = res == kFound;
+      break;
+    }
+  }
+  __atomic_store_n(&search_list_busy, 0, __ATOMIC_RELEASE);
+  return found;
+}
+
+#endif  // defined(__linux__) && !defined(__ANDROID__)
+
 bool GetRealFunctionAddress(const char *func_name, uptr *func_addr,
     uptr real, uptr wrapper) {
+#if defined(__linux__) && !defined(__ANDROID__)
+  if (GetRealFunctionAddressFromSymbolTables(func_name, func_addr))
+    return real == wrapper;
+#endif
   *func_addr = (uptr)dlsym(RTLD_NEXT, func_name);
   return real == wrapper;
 }
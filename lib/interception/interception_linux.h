@@ -26,6 +26,12 @@ namespace __interception {
 bool GetRealFunctionAddress(const char *func_name, uptr *func_addr,
     uptr real, uptr wrapper);
 void *GetFuncAddrVer(const char *func_name, const char *ver);
+#if defined(__linux__) && !defined(__ANDROID__)
+// Finds what dlsym(RTLD_NEXT, func_name) returns without calling it, using
+// the GNU hash tables of the loaded objects. Returns false if it cannot tell.
+bool GetRealFunctionAddressFromSymbolTables(const char *func_name,
+                                            uptr *func_addr);
+#endif
 }  // namespace __interception
 
 #define INTERCEPT_FUNCTION_LINUX_OR_FREEBSD(func)                          \
@@ -200,21 +200,107 @@ static void _memcpy(void *dst, void *src, size_t sz) {
     dst_c[i] = src_c[i];
 }
 
+// Between BeginOverrideBatch() and EndOverrideBatch(), the pages made writable
+// stay so until the end of the batch: the functions patched at startup are
+// packed in a few pages of each DLL, and each page is then flipped only once.
+struct BatchedPage {
+  uptr page;
+  DWORD old_protection;
+};
+
+static const int kMaxBatchedPages = 64;
+static BatchedPage BatchedPages[kMaxBatchedPages];
+static int NumBatchedPages;
+static int BatchDepth;
+
+static uptr GetPageSize() {
+  static uptr page_size;
+  if (!page_size) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    page_size = si.dwPageSize;
+  }
+  return page_size;
+}
+
+static bool IsBatchedPage(uptr page) {
+  for (int i = 0; i < NumBatchedPages; ++i) {
+    if (BatchedPages[i].page == page)
+      return true;
+  }
+  return false;
+}
+
+// Restores the protection of the batched pages, with one call per run of
+// contiguous pages which had the same protection.
+static bool RestoreBatchedPages() {
+  bool res = true;
+  uptr page_size = GetPageSize();
+  for (int i = 0; i < NumBatchedPages;) {
+    int j = i + 1;
+    while (j < NumBatchedPages &&
+           BatchedPages[j].page == BatchedPages[j - 1].page + page_size &&
+           BatchedPages[j].old_protection == BatchedPages[i].old_protection)
+      ++j;
+    DWORD unused;
+    if (!::VirtualProtect((void*)BatchedPages[i].page, (j - i) * page_size,
+                          BatchedPages[i].old_protection, &unused))
+      res = false;
+    i = j;
+  }
+  NumBatchedPages = 0;
+  return res;
+}
+
 static bool ChangeMemoryProtection(
     uptr address, uptr size, DWORD *old_protection) {
-  return ::VirtualProtect((void*)address, size,
-                          PAGE_EXECUTE_READWRITE,
-                          old_protection) != FALSE;
+  if (BatchDepth == 0) {
+    return ::VirtualProtect((void*)address, size,
+                            PAGE_EXECUTE_READWRITE,
+                            old_protection) != FALSE;
+  }
+  uptr page_size = GetPageSize();
+  uptr first_page = address & ~(page_size - 1);
+  uptr last_page = (address + size - 1) & ~(page_size - 1);
+  if (NumBatchedPages + (last_page - first_page) / page_size + 1 >
+      (uptr)kMaxBatchedPages)
+    RestoreBatchedPages();
+  for (uptr page = first_page; page <= last_page; page += page_size) {
+    if (IsBatchedPage(page))
+      continue;
+    DWORD protection;
+    if (!::VirtualProtect((void*)page, page_size, PAGE_EXECUTE_READWRITE,
+                          &protection))
+      return false;
+    BatchedPages[NumBatchedPages].page = page;
+    BatchedPages[NumBatchedPages].old_protection = protection;
+    ++NumBatchedPages;
+  }
+  // RestoreMemoryProtection() does not use it in a batch.
+  *old_protection = PAGE_EXECUTE_READWRITE;
+  return true;
 }
 
 static bool RestoreMemoryProtection(
     uptr address, uptr size, DWORD old_protection) {
+  if (BatchDepth != 0)
+    return true;
   DWORD unused;
   return ::VirtualProtect((void*)address, size,
                           old_protection,
                           &unused) != FALSE;
 }
 
+void BeginOverrideBatch() {
+  ++BatchDepth;
+}
+
+bool EndOverrideBatch() {
+  if (BatchDepth == 0 || --BatchDepth != 0)
+    return true;
+  return RestoreBatchedPages();
+}
+
 static bool IsMemoryPadding(uptr address, uptr size) {
   u8* function = (u8*)address;
   for (size_t i = 0; i < size; ++i)
@@ -355,12 +441,35 @@ void TestOnlyReleaseTrampolineRegions() {
     ::VirtualFree((void*)current->content, 0, MEM_RELEASE);
     current->content = 0;
   }
+  LastTrampolineRegion = nullptr;
+}
+
+// The region of the last allocation. The functions of a DLL are patched one
+// after the other, so it usually has room for the next trampoline.
+static TrampolineMemoryRegion *LastTrampolineRegion;
+
+static bool TrampolineRegionFits(TrampolineMemoryRegion *region,
+                                 uptr image_address, size_t size) {
+  if (region->max_size - region->allocated_size <= size)
+    return false;
+#if SANITIZER_WINDOWS64
+  // In 64-bits, the memory space must be allocated within 2G boundary.
+  uptr next_address = region->content + region->allocated_size;
+  if (next_address < image_address ||
+      next_address - image_address >= 0x7FFF0000)
+    return false;
+#endif
+  return true;
 }
 
 static uptr AllocateMemoryForTrampoline(uptr image_address, size_t size) {
   // Find a region within 2G with enough space to allocate |size| bytes.
   TrampolineMemoryRegion *region = nullptr;
-  for (size_t bucket = 0; bucket < kMaxTrampolineRegion; ++bucket) {
+  if (LastTrampolineRegion &&
+      TrampolineRegionFits(LastTrampolineRegion, image_address, size))
+    region = LastTrampolineRegion;
+  for (size_t bucket = 0; !region && bucket < kMaxTrampolineRegion;
+       ++bucket) {
     TrampolineMemoryRegion* current = &TrampolineRegions[bucket];
     if (current->content == 0) {
       // No valid region found, allocate a new region.
@@ -374,14 +483,7 @@ static uptr AllocateMemoryForTrampoline(uptr image_address, size_t size) {
       current->max_size = bucket_size;
       region = current;
       break;
-    } else if (current->max_size - current->allocated_size > size) {
-#if SANITIZER_WINDOWS64
-        // In 64-bits, the memory space must be allocated within 2G boundary.
-        uptr next_address = current->content + current->allocated_size;
-        if (next_address < image_address ||
-            next_address - image_address >= 0x7FFF0000)
-          continue;
-#endif
+    } else if (TrampolineRegionFits(current, image_address, size)) {
       // The space can be allocated in the current region.
       region = current;
       break;
@@ -391,6 +493,7 @@ static uptr AllocateMemoryForTrampoline(uptr image_address, size_t size) {
   // Failed to find a region.
   if (region == nullptr)
     return 0U;
+  LastTrampolineRegion = region;
 
   // Allocate the space in the current region.
   uptr allocated_space = region->content + region->allocated_size;
@@ -993,12 +1096,11 @@ bool OverrideImportedFunction(const char *module_to_patch,
   // read/write first.
   if (orig_old_func)
     *orig_old_func = iat->u1.AddressOfData;
-  DWORD old_prot, unused_prot;
-  if (!VirtualProtect(&iat->u1.AddressOfData, 4, PAGE_EXECUTE_READWRITE,
-                      &old_prot))
+  DWORD old_prot;
+  if (!ChangeMemoryProtection((uptr)&iat->u1.AddressOfData, 4, &old_prot))
     return false;
   iat->u1.AddressOfData = new_function;
-  if (!VirtualProtect(&iat->u1.AddressOfData, 4, old_prot, &unused_prot))
+  if (!RestoreMemoryProtection((uptr)&iat->u1.AddressOfData, 4, old_prot))
     return false;  // Not clear if this failure bothers us.
   return true;
 }
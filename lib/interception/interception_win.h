@@ -42,6 +42,13 @@ bool OverrideImportedFunction(const char *module_to_patch,
                               const char *function_name, uptr new_function,
                               uptr *orig_old_func);
 
+// Between these calls, the pages patched by the functions above are made
+// writable only once, and their protection is restored by the last
+// EndOverrideBatch(). Calls may nest. Until then, the patched pages stay
+// writable, so only use this while the runtime is initializing.
+void BeginOverrideBatch();
+bool EndOverrideBatch();
+
 #if !SANITIZER_WINDOWS64
 // Exposed for unittests
 bool OverrideFunctionWithDetour(
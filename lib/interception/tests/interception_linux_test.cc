@@ -19,6 +19,8 @@
 
 #include "gtest/gtest.h"
 
+#include <dlfcn.h>
+
 // Too slow for debug build
 #if !SANITIZER_DEBUG
 #if SANITIZER_LINUX
@@ -45,6 +47,23 @@ TEST(Interception, GetRealFunctionAddress) {
   EXPECT_EQ(0U, dummy_address);
 }
 
+TEST(Interception, GetRealFunctionAddressFromSymbolTables) {
+  const char *names[] = {"malloc", "free", "strlen", "memcpy", "printf",
+                         "pthread_create", "isdigit", "environ",
+                         "dummy_doesnt_exist__"};
+  uptr found = 0;
+  for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    uptr address = 0;
+    if (!GetRealFunctionAddressFromSymbolTables(names[i], &address))
+      continue;
+    // Whatever is found must be what dlsym finds.
+    EXPECT_EQ((uptr)dlsym(RTLD_NEXT, names[i]), address) << names[i];
+    ++found;
+  }
+  // Some of the functions may be IFUNCs, which are left to dlsym.
+  EXPECT_NE(0U, found);
+}
+
 TEST(Interception, Basic) {
   ASSERT_TRUE(INTERCEPT_FUNCTION(isdigit));
 
@@ -474,6 +474,47 @@ TEST(Interception, OverrideFunctionTwice) {
   TestOnlyReleaseTrampolineRegions();
 }
 
+TEST(Interception, OverrideFunctionBatch) {
+  uptr identity_address1;
+  LoadActiveCode(kIdentityTwice, &identity_address1);
+  uptr identity_address2 = identity_address1 + kIdentityTwiceOffset;
+  IdentityFunction identity1 = (IdentityFunction)identity_address1;
+  IdentityFunction identity2 = (IdentityFunction)identity_address2;
+
+  // Make the code read-only, as it is in a DLL.
+  DWORD old_protection;
+  ASSERT_TRUE(::VirtualProtect((void*)identity_address1, 1, PAGE_EXECUTE_READ,
+                               &old_protection));
+
+  // Patch the two functions in the same batch.
+  BeginOverrideBatch();
+  uptr real_identity_address = 0;
+  EXPECT_TRUE(OverrideFunction(identity_address1,
+                               (uptr)&InterceptorFunction,
+                               &real_identity_address));
+  EXPECT_TRUE(OverrideFunction(identity_address2,
+                               (uptr)&InterceptorFunction,
+                               &real_identity_address));
+  EXPECT_TRUE(EndOverrideBatch());
+  IdentityFunction real_identity = (IdentityFunction)real_identity_address;
+  InterceptedRealFunction = real_identity;
+
+  // The protection is restored at the end of the batch.
+  MEMORY_BASIC_INFORMATION info;
+  ASSERT_NE(0U, ::VirtualQuery((void*)identity_address1, &info, sizeof(info)));
+  EXPECT_EQ((DWORD)PAGE_EXECUTE_READ, info.Protect);
+
+  // Calling the redirected functions.
+  InterceptorFunctionCalled = 0;
+  EXPECT_EQ(42, identity1(42));
+  EXPECT_EQ(42, identity2(42));
+  EXPECT_EQ(2, InterceptorFunctionCalled);
+
+  ASSERT_TRUE(::VirtualProtect((void*)identity_address1, 1, old_protection,
+                               &old_protection));
+  TestOnlyReleaseTrampolineRegions();
+}
+
 template<class T>
 static bool TestFunctionPatching(
     const T &code,
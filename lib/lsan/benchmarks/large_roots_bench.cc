@@ -0,0 +1,85 @@
+// Mini-benchmark for lsan: recoverable leak checks over large root sets.
+// Build with -fsanitize=leak (or address) and run with
+// LSAN_OPTIONS=use_registers=0, optionally passing the sizes in megabytes of
+// the globals and of the thread stack to scan.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sanitizer/lsan_interface.h>
+
+const int kNumIter = 10;
+const int kMaxGlobalMb = 256;
+
+// Mostly non-pointer data with an occasional heap pointer, like a big .data
+// segment.
+void *globals[kMaxGlobalMb << 17];
+
+int stack_mb;
+pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cv = PTHREAD_COND_INITIALIZER;
+bool stack_ready, done;
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Fill(void **p, long n) {
+  for (long i = 0; i < n; i++)
+    p[i] = (i % 4096) ? (void *)(i * 0x9e3779b9UL) : malloc(16);
+}
+
+// Fills a large stack frame and parks until the leak checks are done.
+void *Thread(void *arg) {
+  long n = (long)stack_mb << 17;
+  void **stack = (void **)__builtin_alloca(n * sizeof(void *));
+  Fill(stack, n);
+  pthread_mutex_lock(&mu);
+  stack_ready = true;
+  pthread_cond_broadcast(&cv);
+  while (!done)
+    pthread_cond_wait(&cv, &mu);
+  pthread_mutex_unlock(&mu);
+  return stack[n - 1];
+}
+
+int main(int argc, char **argv) {
+  int global_mb = 64;
+  stack_mb = 64;
+  if (argc == 3) {
+    global_mb = atoi(argv[1]);
+    stack_mb = atoi(argv[2]);
+  }
+  if (global_mb > kMaxGlobalMb) global_mb = kMaxGlobalMb;
+  fprintf(stderr, "%s: globals=%dMb stack=%dMb iter=%d\n", __FILE__,
+          global_mb, stack_mb, kNumIter);
+  Fill(globals, (long)global_mb << 17);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, ((size_t)stack_mb + 16) << 20);
+  pthread_t t;
+  pthread_create(&t, &attr, Thread, 0);
+  pthread_mutex_lock(&mu);
+  while (!stack_ready)
+    pthread_cond_wait(&cv, &mu);
+  pthread_mutex_unlock(&mu);
+
+  double start = Now();
+  for (int i = 0; i < kNumIter; i++)
+    __lsan_do_recoverable_leak_check();
+  double elapsed = Now() - start;
+  fprintf(stderr, "%.3f ms per leak check\n", elapsed * 1e3 / kNumIter);
+  // In the format of the check-sanitizer-bench results.
+  printf("BENCH: {\"name\": \"lsan_leak_check_%dmb_%dmb\", \"threads\": 1, "
+         "\"ops\": %d, \"ns\": %.0f, \"ns_per_op\": %.3f}\n", global_mb,
+         stack_mb, kNumIter, elapsed * 1e9, elapsed * 1e9 / kNumIter);
+
+  pthread_mutex_lock(&mu);
+  done = true;
+  pthread_cond_broadcast(&cv);
+  pthread_mutex_unlock(&mu);
+  pthread_join(t, 0);
+  return 0;
+}
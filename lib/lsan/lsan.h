@@ -15,8 +15,7 @@
 #include "sanitizer_common/sanitizer_flags.h"
 #include "sanitizer_common/sanitizer_stacktrace.h"
 
-#define GET_STACK_TRACE(max_size, fast)                                        \
-  BufferedStackTrace stack;                                                    \
+#define UNWIND_STACK_TRACE(stack, max_size, fast)                              \
   {                                                                            \
     uptr stack_top = 0, stack_bottom = 0;                                      \
     ThreadContext *t;                                                          \
@@ -31,12 +30,23 @@
     }                                                                          \
   }
 
+#define GET_STACK_TRACE(max_size, fast)                                        \
+  BufferedStackTrace stack;                                                    \
+  UNWIND_STACK_TRACE(stack, max_size, fast)
+
 #define GET_STACK_TRACE_FATAL \
   GET_STACK_TRACE(kStackTraceMax, common_flags()->fast_unwind_on_fatal)
 
-#define GET_STACK_TRACE_MALLOC                                      \
-  GET_STACK_TRACE(__sanitizer::common_flags()->malloc_context_size, \
-                  common_flags()->fast_unwind_on_malloc)
+// The allocations which are not sampled get an empty stack, see
+// allocation_sample_rate.
+#define GET_STACK_TRACE_MALLOC                                        \
+  BufferedStackTrace stack;                                           \
+  if (__lsan::ShouldSampleAllocation())                               \
+    UNWIND_STACK_TRACE(stack,                                         \
+                       __sanitizer::common_flags()->malloc_context_size, \
+                       common_flags()->fast_unwind_on_malloc)         \
+  else                                                                \
+    stack.tag = __lsan::kStackTagUnsampled
 
 namespace __lsan {
 
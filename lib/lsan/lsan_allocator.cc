@@ -37,10 +37,21 @@ typedef CombinedAllocator<PrimaryAllocator, AllocatorCache,
 
 static Allocator allocator;
 
+static void ReleaseToOSCallback(bool force) {
+  allocator.ReleaseToOSInBackground(force);
+}
+
 void InitializeAllocator() {
   allocator.InitLinkerInitialized(
       common_flags()->allocator_may_return_null,
       common_flags()->allocator_release_to_os_interval_ms);
+  allocator.SetSizeProfile(GetAllocatorSizeProfile());
+  allocator.SetSecondaryCacheParams(
+      static_cast<uptr>(common_flags()->allocator_secondary_cache_size_mb)
+          << 20,
+      common_flags()->allocator_secondary_cache_decay_ms);
+  MaybeWriteAllocatorSizeProfileAtExit();
+  SetAllocatorReleaseToOSCallback(ReleaseToOSCallback);
 }
 
 void AllocatorThreadFinish() {
@@ -51,12 +62,42 @@ static ChunkMetadata *Metadata(const void *p) {
   return reinterpret_cast<ChunkMetadata *>(allocator.GetMetaData(p));
 }
 
+bool ShouldSampleAllocation() {
+  int rate = flags()->allocation_sample_rate;
+  if (rate <= 1)
+    return true;
+  AllocationSampler *sampler = GetAllocationSampler();
+  if (sampler->countdown > 0) {
+    sampler->countdown--;
+    return false;
+  }
+  if (sampler->rand_state == 0)
+    sampler->rand_state = (u32)NanoTime() | 1;
+  // ANSI C linear congruential PRNG. Skipping a random number of allocations
+  // in [0, 2 * rate - 2] samples one in rate on average, and does not line up
+  // with periodic allocation patterns.
+  sampler->rand_state = sampler->rand_state * 1103515245 + 12345;
+  sampler->countdown = (sampler->rand_state >> 8) % (2 * rate - 1);
+  return true;
+}
+
+uptr GetAllocationSampleRate() {
+  return Max(flags()->allocation_sample_rate, 1);
+}
+
 static void RegisterAllocation(const StackTrace &stack, void *p, uptr size) {
   if (!p) return;
   ChunkMetadata *m = Metadata(p);
   CHECK(m);
-  m->tag = DisabledInThisThread() ? kIgnored : kDirectlyLeaked;
-  m->stack_trace_id = StackDepotPut(stack);
+  // The allocations which are not sampled are never reported, but they are
+  // still scanned for pointers to the other chunks.
+  if (stack.tag == kStackTagUnsampled) {
+    m->tag = kIgnored;
+    m->stack_trace_id = 0;
+  } else {
+    m->tag = DisabledInThisThread() ? kIgnored : kDirectlyLeaked;
+    m->stack_trace_id = StackDepotPut(stack);
+  }
   m->requested_size = size;
   atomic_store(reinterpret_cast<atomic_uint8_t *>(m), 1, memory_order_relaxed);
 }
@@ -78,7 +119,7 @@ void *Allocate(const StackTrace &stack, uptr size, uptr alignment,
   }
   void *p = allocator.Allocate(GetAllocatorCache(), size, alignment, false);
   // Do not rely on the allocator to clear the memory (it's slow).
-  if (cleared && allocator.FromPrimary(p))
+  if (cleared && !allocator.ChunkIsZero(p))
     memset(p, 0, size);
   RegisterAllocation(stack, p, size);
   if (&__sanitizer_malloc_hook) __sanitizer_malloc_hook(p, size);
@@ -202,6 +243,23 @@ void LsanMetadata::set_tag(ChunkTag value) {
   reinterpret_cast<ChunkMetadata *>(metadata_)->tag = value;
 }
 
+bool LsanMetadata::try_set_tag(ChunkTag old_tag, ChunkTag new_tag) {
+  // The tag shares the first word with |allocated| and |requested_size|, both
+  // of which are stable while the world is stopped.
+  atomic_uint64_t *word = reinterpret_cast<atomic_uint64_t *>(metadata_);
+  u64 cmp = atomic_load(word, memory_order_relaxed);
+  for (;;) {
+    ChunkMetadata m;
+    internal_memcpy(&m, &cmp, sizeof(cmp));
+    if (m.tag != old_tag) return false;
+    m.tag = new_tag;
+    u64 xchg;
+    internal_memcpy(&xchg, &m, sizeof(xchg));
+    if (atomic_compare_exchange_weak(word, &cmp, xchg, memory_order_relaxed))
+      return true;
+  }
+}
+
 uptr LsanMetadata::requested_size() const {
   return reinterpret_cast<ChunkMetadata *>(metadata_)->requested_size;
 }
@@ -214,6 +272,11 @@ void ForEachChunk(ForEachChunkCallback callback, void *arg) {
   allocator.ForEachChunk(callback, arg);
 }
 
+void ForEachChunkInPart(ForEachChunkCallback callback, void *arg, uptr part,
+                        uptr n_parts) {
+  allocator.ForEachChunkInPart(callback, arg, part, n_parts);
+}
+
 IgnoreObjectResult IgnoreObjectLocked(const void *p) {
   void *chunk = allocator.GetBlockBegin(p);
   if (!chunk || p < chunk) return kIgnoreObjectInvalid;
@@ -264,6 +327,15 @@ uptr __sanitizer_get_allocated_size(const void *p) {
   return GetMallocUsableSize(p);
 }
 
+SANITIZER_INTERFACE_ATTRIBUTE
+uptr __sanitizer_get_allocator_histogram(AllocatorClassStats *stats,
+                                         uptr max_classes) {
+  return allocator.GetHistogram(stats, max_classes);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void __sanitizer_print_allocator_histogram() { allocator.PrintHistogram(); }
+
 #if !SANITIZER_SUPPORTS_WEAK_HOOKS
 // Provide default (no-op) implementation of malloc hooks.
 SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
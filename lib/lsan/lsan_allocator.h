@@ -18,6 +18,7 @@
 #include "sanitizer_common/sanitizer_allocator.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_internal_defs.h"
+#include "sanitizer_common/sanitizer_stacktrace.h"
 #include "lsan_common.h"
 
 namespace __lsan {
@@ -66,7 +67,7 @@ struct AP64 {  // Allocator64 parameters. Deliberately using a short name.
   static const uptr kMetadataSize = sizeof(ChunkMetadata);
   typedef DefaultSizeClassMap SizeClassMap;
   typedef NoOpMapUnmapCallback MapUnmapCallback;
-  static const uptr kFlags = 0;
+  static const uptr kFlags = kToolAllocator64Flags;
 };
 
 typedef SizeClassAllocator64<AP64> PrimaryAllocator;
@@ -75,6 +76,16 @@ typedef SizeClassAllocatorLocalCache<PrimaryAllocator> AllocatorCache;
 
 AllocatorCache *GetAllocatorCache();
 
+// The tag of the stacks of the allocations which are not sampled.
+const u32 kStackTagUnsampled = StackTrace::TAG_CUSTOM;
+// Per-thread state of the allocation sampling, see allocation_sample_rate.
+struct AllocationSampler {
+  u32 countdown;  // Allocations to skip before the next sampled one.
+  u32 rand_state;
+};
+AllocationSampler *GetAllocationSampler();
+bool ShouldSampleAllocation();
+
 void *lsan_memalign(uptr alignment, uptr size, const StackTrace &stack);
 void *lsan_malloc(uptr size, const StackTrace &stack);
 void lsan_free(void *p);
@@ -25,6 +25,17 @@
 #include "sanitizer_common/sanitizer_report_decorator.h"
 #include "sanitizer_common/sanitizer_tls_get_addr.h"
 
+#if defined(__x86_64__) && defined(__SSE2__)
+// <emmintrin.h> transitively includes <stdlib.h>,
+// and it's prohibited to include std headers into the runtime.
+// So we do the same dirty trick as tsan_rtl.cc.
+#define _MM_MALLOC_H_INCLUDED
+#define __MM_MALLOC_H
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #if CAN_SANITIZE_LEAKS
 namespace __lsan {
 
@@ -96,14 +107,23 @@ void InitializeRootRegions() {
   root_regions = new(placeholder) InternalMmapVector<RootRegion>(1);
 }
 
+// Initialization which can fail or print warnings should only be done if
+// LSan is actually enabled. With lazy_init it is done by the first leak check,
+// under global_mutex.
+static bool leak_checker_initialized;
+
+static void InitializeLeakChecker() {
+  if (leak_checker_initialized)
+    return;
+  leak_checker_initialized = true;
+  InitializeSuppressions();
+  InitializePlatformSpecificModules();
+}
+
 void InitCommonLsan() {
   InitializeRootRegions();
-  if (common_flags()->detect_leaks) {
-    // Initialization which can fail or print warnings should only be done if
-    // LSan is actually enabled.
-    InitializeSuppressions();
-    InitializePlatformSpecificModules();
-  }
+  if (common_flags()->detect_leaks && !common_flags()->lazy_init)
+    InitializeLeakChecker();
 }
 
 class Decorator: public __sanitizer::SanitizerCommonDecorator {
@@ -114,23 +134,249 @@ class Decorator: public __sanitizer::SanitizerCommonDecorator {
   const char *End() { return Default(); }
 };
 
-static inline bool CanBeAHeapPointer(uptr p) {
+// Returns the range [*begin, *begin + *size) of values which can be heap
+// pointers regardless of the current state of the heap.
+static inline void GetHeapPointerRange(uptr *begin, uptr *size) {
   // Since our heap is located in mmap-ed memory, we can assume a sensible lower
   // bound on heap addresses.
   const uptr kMinAddress = 4 * 4096;
-  if (p < kMinAddress) return false;
+  uptr end;
 #if defined(__x86_64__)
   // Accept only canonical form user-space addresses.
-  return ((p >> 47) == 0);
+  end = 1ULL << 47;
 #elif defined(__mips64)
-  return ((p >> 40) == 0);
+  end = 1ULL << 40;
 #elif defined(__aarch64__)
   unsigned runtimeVMA =
     (MostSignificantSetBitIndex(GET_CURRENT_FRAME()) + 1);
-  return ((p >> runtimeVMA) == 0);
+  end = 1ULL << runtimeVMA;
 #else
-  return true;
+  end = 0;  // Wraps around: any value above kMinAddress is accepted.
 #endif
+  *begin = kMinAddress;
+  *size = end - kMinAddress;
+}
+
+// Bounds of the user memory of all allocated chunks, including one byte past
+// the end of each chunk for IsSpecialCaseOfOperatorNew0. Computed at the start
+// of every leak check, while the allocator is locked. The runtime's own
+// globals are scanned as roots too, so the start of the range is kept inverted
+// lest it keeps the lowest chunk alive.
+static uptr heap_begin_inverted;
+static uptr heap_size;
+
+// Returns a bit mask of those of the 4 words at |pp| which lie in
+// [begin, begin + size). False positives are allowed, the callers recheck
+// every word.
+static inline u32 FindWordsInRange4(uptr pp, uptr begin, uptr size) {
+  const uptr *w = reinterpret_cast<const uptr *>(pp);
+#if defined(__x86_64__) && defined(__SSE2__)
+  // SSE2 has no 64-bit comparisons, so only compare the upper halves of the
+  // words with the upper halves of the bounds. This lets through words within
+  // 4Gb of the range, which are rare enough. The bias turns the unsigned
+  // comparison into a signed one.
+  const __m128i bias = _mm_set1_epi32((int)0x80000000);
+  const __m128i lo = _mm_xor_si128(_mm_set1_epi32(begin >> 32), bias);
+  const __m128i hi =
+      _mm_xor_si128(_mm_set1_epi32((begin + size - 1) >> 32), bias);
+  const __m128i w01 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w));
+  const __m128i w23 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w) + 1);
+  __m128i upper = _mm_castps_si128(_mm_shuffle_ps(
+      _mm_castsi128_ps(w01), _mm_castsi128_ps(w23), _MM_SHUFFLE(3, 1, 3, 1)));
+  upper = _mm_xor_si128(upper, bias);
+  const __m128i outside =
+      _mm_or_si128(_mm_cmpgt_epi32(lo, upper), _mm_cmpgt_epi32(upper, hi));
+  return ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xf;
+#elif defined(__aarch64__)
+  const uint64x2_t lo = vdupq_n_u64(begin);
+  const uint64x2_t n = vdupq_n_u64(size);
+  const uint64x2_t in01 = vcltq_u64(vsubq_u64(vld1q_u64(w), lo), n);
+  const uint64x2_t in23 = vcltq_u64(vsubq_u64(vld1q_u64(w + 2), lo), n);
+  return (vgetq_lane_u64(in01, 0) & 1) | (vgetq_lane_u64(in01, 1) & 2) |
+         (vgetq_lane_u64(in23, 0) & 4) | (vgetq_lane_u64(in23, 1) & 8);
+#else
+  u32 mask = 0;
+  for (uptr i = 0; i < 4; i++)
+    mask |= (u32)(w[i] - begin < size) << i;
+  return mask;
+#endif
+}
+
+// Set for the duration of a leak check which uses incremental_scan.
+static bool incremental_scan_active;
+
+// Looks at the word at |pp| on behalf of ScanWordsForPointers. Returns false
+// if the word is outside of [range_begin, range_begin + range_size).
+static inline bool ScanWordForPointer(uptr begin, uptr pp, uptr range_begin,
+                                      uptr range_size, Frontier *frontier,
+                                      ChunkTag tag) {
+  void *p = *reinterpret_cast<void **>(pp);
+  if (reinterpret_cast<uptr>(p) - range_begin >= range_size) return false;
+  if (reinterpret_cast<uptr>(p) - ~heap_begin_inverted >= heap_size)
+    return true;
+  uptr chunk = PointsIntoChunk(p);
+  if (!chunk) return true;
+  // Pointers to self don't count. This matters when tag == kIndirectlyLeaked.
+  if (chunk == begin) return true;
+  LsanMetadata m(chunk);
+  ChunkTag old_tag = m.tag();
+  if (old_tag == kReachable || old_tag == kIgnored) return true;
+
+  // Do this check relatively late so we can log only the interesting cases.
+  if (!flags()->use_poisoned && WordIsPoisoned(pp)) {
+    LOG_POINTERS(
+        "%p is poisoned: ignoring %p pointing into chunk %p-%p of size "
+        "%zu.\n",
+        pp, p, chunk, chunk + m.requested_size(), m.requested_size());
+    return true;
+  }
+
+  // With mark_threads > 1 another thread may be tagging the same chunk. Only
+  // the thread which wins the race adds it to its frontier.
+  if (!m.try_set_tag(old_tag, tag)) return true;
+  LOG_POINTERS("%p: found %p pointing into chunk %p-%p of size %zu.\n", pp, p,
+               chunk, chunk + m.requested_size(), m.requested_size());
+  if (frontier)
+    frontier->push_back(chunk);
+  return true;
+}
+
+// Scans [pp, end) on behalf of ScanRangeForPointers. For incremental_scan,
+// returns false if none of the words could be a heap pointer at all.
+static bool ScanWordsForPointers(uptr begin, uptr pp, uptr end,
+                                 Frontier *frontier, ChunkTag tag) {
+  const uptr alignment = flags()->pointer_alignment();
+  // Words outside of the heap bounds can be dropped right away. Incremental
+  // scanning however needs to know about any word which might ever be a heap
+  // pointer, so it prefilters with the wider static range instead.
+  uptr range_begin = ~heap_begin_inverted, range_size = heap_size;
+  if (incremental_scan_active)
+    GetHeapPointerRange(&range_begin, &range_size);
+  if (range_size == 0) return false;
+  bool found_candidates = false;
+  if (SANITIZER_WORDSIZE == 64 && alignment == sizeof(uptr)) {
+    // Most words of stacks and globals fail the range check, so look at 4
+    // words at once and only take the slow path for the survivors.
+    const uptr kStep = 4 * sizeof(uptr);
+    for (; pp + kStep <= end; pp += kStep) {
+      for (u32 mask = FindWordsInRange4(pp, range_begin, range_size); mask;
+           mask &= mask - 1) {
+        uptr wp = pp + LeastSignificantSetBitIndex(mask) * sizeof(uptr);
+        found_candidates |= ScanWordForPointer(begin, wp, range_begin,
+                                               range_size, frontier, tag);
+      }
+    }
+  }
+  for (; pp + sizeof(void *) <= end; pp += alignment) {  // NOLINT
+    found_candidates |=
+        ScanWordForPointer(begin, pp, range_begin, range_size, frontier, tag);
+  }
+  return found_candidates;
+}
+
+// Scans the whole pages in [pages_begin, pages_end) of the range starting at
+// |begin| one at a time, skipping the pages which are known not to contain heap
+// pointers.
+static void ScanPagesForPointers(uptr begin, uptr pages_begin, uptr pages_end,
+                                 Frontier *frontier, ChunkTag tag) {
+  const uptr page_size = GetPageSizeCached();
+  const uptr kBatch = 512;
+  bool skippable[kBatch];
+  for (uptr page = pages_begin; page < pages_end;) {
+    uptr n_pages = Min(kBatch, (pages_end - page) / page_size);
+    GetSkippablePages(page, n_pages, skippable);
+    for (uptr i = 0; i < n_pages; i++, page += page_size) {
+      bool pointer_free =
+          skippable[i] ||
+          !ScanWordsForPointers(begin, page, page + page_size, frontier, tag);
+      MarkPage(page, pointer_free);
+    }
+  }
+}
+
+// State of the concurrent_root_scan mode. The global and root ranges are first
+// scanned while the world is still running, and the addresses of the words
+// which may be heap pointers are kept for each page sized segment of the
+// ranges. After the world is stopped, only the segments of the pages which
+// have been written to since are scanned again.
+enum RootPrescanState {
+  kNoPrescan,
+  kPrescanning,    // Record the segments and their candidates.
+  kUsingPrescan,   // Look the clean segments up instead of scanning them.
+};
+static RootPrescanState root_prescan_state;
+
+struct PrescannedSegment {
+  uptr begin;
+  uptr end;
+  // Range of the addresses of the candidate words in prescan_candidates.
+  uptr first_candidate;
+  uptr n_candidates;
+};
+
+static InternalMmapVector<PrescannedSegment> *prescanned_segments;
+static InternalMmapVector<uptr> *prescan_candidates;
+
+static bool PrescannedSegmentLess(const PrescannedSegment &a,
+                                  const PrescannedSegment &b) {
+  return a.begin < b.begin;
+}
+
+// Records the page sized segments of [pp, end) and the words in them which
+// might be heap pointers.
+static void PrescanRange(uptr pp, uptr end) {
+  const uptr alignment = flags()->pointer_alignment();
+  const uptr page_size = GetPageSizeCached();
+  uptr range_begin, range_size;
+  GetHeapPointerRange(&range_begin, &range_size);
+  while (pp < end) {
+    uptr segment_end = Min(end, RoundDownTo(pp, page_size) + page_size);
+    PrescannedSegment segment = {pp, segment_end, prescan_candidates->size(),
+                                 0};
+    for (; pp + sizeof(uptr) <= segment_end; pp += alignment) {
+      if (*reinterpret_cast<uptr *>(pp) - range_begin < range_size)
+        prescan_candidates->push_back(pp);
+    }
+    segment.n_candidates = prescan_candidates->size() - segment.first_candidate;
+    prescanned_segments->push_back(segment);
+    pp = segment_end;
+  }
+}
+
+// Scans [pp, end) on behalf of ScanRangeForPointers, using the candidates
+// recorded by PrescanRange for the pages which have not been written to since.
+static void ScanRangeWithPrescan(uptr begin, uptr pp, uptr end,
+                                 Frontier *frontier, ChunkTag tag) {
+  const uptr page_size = GetPageSizeCached();
+  const uptr kBatch = 512;
+  bool clean[kBatch];
+  while (pp < end) {
+    uptr first_page = RoundDownTo(pp, page_size);
+    uptr n_pages = Min(kBatch, (RoundUpTo(end, page_size) - first_page) /
+                                   page_size);
+    GetCleanPages(first_page, n_pages, clean);
+    for (uptr i = 0; i < n_pages; i++) {
+      uptr segment_end = Min(end, first_page + (i + 1) * page_size);
+      PrescannedSegment key = {pp, 0, 0, 0};
+      uptr idx = InternalLowerBound(*prescanned_segments, 0,
+                                    prescanned_segments->size(), key,
+                                    PrescannedSegmentLess);
+      if (clean[i] && idx < prescanned_segments->size() &&
+          (*prescanned_segments)[idx].begin == pp &&
+          (*prescanned_segments)[idx].end == segment_end) {
+        const PrescannedSegment &segment = (*prescanned_segments)[idx];
+        for (uptr j = 0; j < segment.n_candidates; j++) {
+          ScanWordForPointer(
+              begin, (*prescan_candidates)[segment.first_candidate + j],
+              ~heap_begin_inverted, heap_size, frontier, tag);
+        }
+      } else {
+        // Written to, or not mapped when the ranges were prescanned.
+        ScanWordsForPointers(begin, pp, segment_end, frontier, tag);
+      }
+      pp = segment_end;
+    }
+  }
 }
 
 // Scans the memory range, looking for byte patterns that point into allocator
@@ -148,31 +394,28 @@ void ScanRangeForPointers(uptr begin, uptr end,
   uptr pp = begin;
   if (pp % alignment)
     pp = pp + alignment - pp % alignment;
-  for (; pp + sizeof(void *) <= end; pp += alignment) {  // NOLINT
-    void *p = *reinterpret_cast<void **>(pp);
-    if (!CanBeAHeapPointer(reinterpret_cast<uptr>(p))) continue;
-    uptr chunk = PointsIntoChunk(p);
-    if (!chunk) continue;
-    // Pointers to self don't count. This matters when tag == kIndirectlyLeaked.
-    if (chunk == begin) continue;
-    LsanMetadata m(chunk);
-    if (m.tag() == kReachable || m.tag() == kIgnored) continue;
-
-    // Do this check relatively late so we can log only the interesting cases.
-    if (!flags()->use_poisoned && WordIsPoisoned(pp)) {
-      LOG_POINTERS(
-          "%p is poisoned: ignoring %p pointing into chunk %p-%p of size "
-          "%zu.\n",
-          pp, p, chunk, chunk + m.requested_size(), m.requested_size());
-      continue;
+  if (root_prescan_state == kPrescanning) {
+    PrescanRange(pp, end);
+    return;
+  }
+  if (root_prescan_state == kUsingPrescan) {
+    ScanRangeWithPrescan(begin, pp, end, frontier, tag);
+    return;
+  }
+  if (incremental_scan_active) {
+    // Only whole pages can be skipped, the partial ones at both ends are
+    // always scanned.
+    const uptr page_size = GetPageSizeCached();
+    uptr pages_begin = RoundUpTo(pp, page_size);
+    uptr pages_end = RoundDownTo(end, page_size);
+    if (pages_begin < pages_end) {
+      ScanWordsForPointers(begin, pp, pages_begin, frontier, tag);
+      ScanPagesForPointers(begin, pages_begin, pages_end, frontier, tag);
+      ScanWordsForPointers(begin, pages_end, end, frontier, tag);
+      return;
     }
-
-    m.set_tag(tag);
-    LOG_POINTERS("%p: found %p pointing into chunk %p-%p of size %zu.\n", pp, p,
-                 chunk, chunk + m.requested_size(), m.requested_size());
-    if (frontier)
-      frontier->push_back(chunk);
   }
+  ScanWordsForPointers(begin, pp, end, frontier, tag);
 }
 
 // Scans a global range for pointers
@@ -197,6 +440,37 @@ void ForEachExtraStackRangeCb(uptr begin, uptr end, void* arg) {
   ScanRangeForPointers(begin, end, frontier, "FAKE STACK", kReachable);
 }
 
+// Registers of the suspended threads, read before forking for
+// fork_leak_check: the child can't read them with ptrace. For each thread, the
+// PtraceRegistersStatus, the SP and RegisterCount() registers.
+static InternalMmapVector<uptr> *registers_snapshot;
+
+static uptr RegistersSnapshotStride() {
+  return SuspendedThreadsList::RegisterCount() + 2;
+}
+
+static void SnapshotRegisters(SuspendedThreadsList const &suspended_threads,
+                              InternalMmapVector<uptr> *snapshot) {
+  uptr stride = RegistersSnapshotStride();
+  snapshot->resize(suspended_threads.thread_count() * stride);
+  for (uptr i = 0; i < suspended_threads.thread_count(); i++) {
+    uptr *entry = &(*snapshot)[i * stride];
+    entry[0] = suspended_threads.GetRegistersAndSP(i, entry + 2, &entry[1]);
+  }
+}
+
+static PtraceRegistersStatus GetThreadRegisters(
+    SuspendedThreadsList const &suspended_threads, uptr index, uptr *buffer,
+    uptr *sp) {
+  if (!registers_snapshot)
+    return suspended_threads.GetRegistersAndSP(index, buffer, sp);
+  uptr stride = RegistersSnapshotStride();
+  const uptr *entry = &(*registers_snapshot)[index * stride];
+  *sp = entry[1];
+  internal_memcpy(buffer, entry + 2, (stride - 2) * sizeof(uptr));
+  return static_cast<PtraceRegistersStatus>(entry[0]);
+}
+
 // Scans thread data (stacks and TLS) for heap pointers.
 static void ProcessThreads(SuspendedThreadsList const &suspended_threads,
                            Frontier *frontier) {
@@ -219,7 +493,7 @@ static void ProcessThreads(SuspendedThreadsList const &suspended_threads,
     }
     uptr sp;
     PtraceRegistersStatus have_registers =
-        suspended_threads.GetRegistersAndSP(i, registers.data(), &sp);
+        GetThreadRegisters(suspended_threads, i, registers.data(), &sp);
     if (have_registers != REGISTERS_AVAILABLE) {
       Report("Unable to get registers from thread %d.\n", os_id);
       // If unable to get SP, consider the entire stack to be reachable unless
@@ -322,7 +596,84 @@ static void ProcessRootRegions(Frontier *frontier) {
   }
 }
 
+// Number of chunks a flood fill worker takes from or leaves in the shared pool
+// at once.
+static const uptr kFloodFillBatch = 64;
+
+// State shared by the threads of a parallel flood fill.
+struct ParallelFloodFill {
+  ChunkTag tag;
+  SpinMutex mutex;
+  // Chunks which have been tagged but not scanned yet, available to any
+  // worker. Protected by mutex.
+  Frontier *pool;
+  // Number of workers holding chunks taken from the pool. Protected by mutex.
+  uptr busy_workers;
+  // Mirrors pool->size() for the unlocked check in FloodFillWorker.
+  atomic_uintptr_t pool_size;
+};
+
+// Moves up to kFloodFillBatch chunks from the shared pool to |local|. Returns
+// false once the pool is empty and no other worker can refill it, which means
+// that the flood fill is complete.
+static bool TakeFloodFillWork(ParallelFloodFill *ff, Frontier *local) {
+  for (;;) {
+    {
+      SpinMutexLock l(&ff->mutex);
+      uptr n = Min(ff->pool->size(), kFloodFillBatch);
+      if (n) {
+        for (uptr i = 0; i < n; i++) {
+          local->push_back(ff->pool->back());
+          ff->pool->pop_back();
+        }
+        atomic_store_relaxed(&ff->pool_size, ff->pool->size());
+        ff->busy_workers++;
+        return true;
+      }
+      if (ff->busy_workers == 0)
+        return false;
+    }
+    internal_sched_yield();
+  }
+}
+
+static void FloodFillWorker(void *arg) {
+  ParallelFloodFill *ff = reinterpret_cast<ParallelFloodFill *>(arg);
+  Frontier local(1);
+  while (TakeFloodFillWork(ff, &local)) {
+    while (local.size()) {
+      uptr next_chunk = local.back();
+      local.pop_back();
+      LsanMetadata m(next_chunk);
+      ScanRangeForPointers(next_chunk, next_chunk + m.requested_size(), &local,
+                           "HEAP", ff->tag);
+      // Give away half of our chunks if other workers have run out of work.
+      if (local.size() > 2 * kFloodFillBatch &&
+          atomic_load_relaxed(&ff->pool_size) == 0) {
+        SpinMutexLock l(&ff->mutex);
+        for (uptr n = local.size() / 2; n; n--) {
+          ff->pool->push_back(local.back());
+          local.pop_back();
+        }
+        atomic_store_relaxed(&ff->pool_size, ff->pool->size());
+      }
+    }
+    SpinMutexLock l(&ff->mutex);
+    ff->busy_workers--;
+  }
+}
+
 static void FloodFillTag(Frontier *frontier, ChunkTag tag) {
+  if (flags()->mark_threads > 1 && frontier->size() > kFloodFillBatch) {
+    ParallelFloodFill ff;
+    ff.tag = tag;
+    ff.pool = frontier;
+    ff.busy_workers = 0;
+    atomic_store_relaxed(&ff.pool_size, frontier->size());
+    RunOnHelperThreads(FloodFillWorker, &ff, flags()->mark_threads);
+    CHECK_EQ(0, frontier->size());
+    return;
+  }
   while (frontier->size()) {
     uptr next_chunk = frontier->back();
     frontier->pop_back();
@@ -332,6 +683,57 @@ static void FloodFillTag(Frontier *frontier, ChunkTag tag) {
   }
 }
 
+static const uptr kMaxChunkWalkWorkers = 16;
+
+struct ParallelChunkWalk {
+  ForEachChunkCallback callback;
+  // The workers each take the argument of their own index.
+  char *args;
+  uptr arg_size;
+  uptr n_parts;
+  atomic_uintptr_t next_part;
+  atomic_uintptr_t next_worker;
+  uptr n_workers;
+};
+
+static void ChunkWalkWorker(void *arg) {
+  ParallelChunkWalk *walk = reinterpret_cast<ParallelChunkWalk *>(arg);
+  uptr worker = atomic_fetch_add(&walk->next_worker, 1, memory_order_relaxed);
+  CHECK_LT(worker, walk->n_workers);
+  void *callback_arg = walk->args + worker * walk->arg_size;
+  for (;;) {
+    uptr part = atomic_fetch_add(&walk->next_part, 1, memory_order_relaxed);
+    if (part >= walk->n_parts)
+      break;
+    ForEachChunkInPart(walk->callback, callback_arg, part, walk->n_parts);
+  }
+}
+
+// Runs ForEachChunk on min(n_workers, mark_threads) threads. The worker
+// number i passes args + i * arg_size to the callback, so args must hold
+// n_workers arguments of arg_size bytes, or arg_size must be 0 for a shared
+// argument. Returns the number of arguments which were used.
+static uptr ForEachChunkParallel(ForEachChunkCallback callback, void *args,
+                                 uptr arg_size, uptr n_workers) {
+  uptr n_threads = Min(n_workers, (uptr)Max(flags()->mark_threads, 1));
+  if (n_threads <= 1) {
+    ForEachChunk(callback, args);
+    return 1;
+  }
+  ParallelChunkWalk walk;
+  walk.callback = callback;
+  walk.args = reinterpret_cast<char *>(args);
+  walk.arg_size = arg_size;
+  // More parts than threads, so that the threads can even out the sizes of
+  // the regions between them.
+  walk.n_parts = n_threads * 8;
+  atomic_store_relaxed(&walk.next_part, 0);
+  atomic_store_relaxed(&walk.next_worker, 0);
+  walk.n_workers = n_threads;
+  RunOnHelperThreads(ChunkWalkWorker, &walk, n_threads);
+  return atomic_load_relaxed(&walk.next_worker);
+}
+
 // ForEachChunk callback. If the chunk is marked as leaked, marks all chunks
 // which are reachable from it as indirectly leaked.
 static void MarkIndirectlyLeakedCb(uptr chunk, void *arg) {
@@ -343,28 +745,88 @@ static void MarkIndirectlyLeakedCb(uptr chunk, void *arg) {
   }
 }
 
+struct CollectIgnoredParam {
+  Frontier *frontier;
+  // Protects frontier, which is shared by the workers of ForEachChunkParallel.
+  SpinMutex *frontier_mutex;
+  uptr heap_begin;
+  uptr heap_end;
+};
+
 // ForEachChunk callback. If chunk is marked as ignored, adds its address to
-// frontier.
+// frontier. Also computes the bounds of all allocated chunks, which saves
+// another pass over the heap.
 static void CollectIgnoredCb(uptr chunk, void *arg) {
   CHECK(arg);
+  CollectIgnoredParam *param = reinterpret_cast<CollectIgnoredParam *>(arg);
   chunk = GetUserBegin(chunk);
   LsanMetadata m(chunk);
-  if (m.allocated() && m.tag() == kIgnored) {
+  if (!m.allocated()) return;
+  param->heap_begin = Min(param->heap_begin, chunk);
+  param->heap_end = Max(param->heap_end, chunk + m.requested_size() + 1);
+  if (m.tag() == kIgnored) {
     LOG_POINTERS("Ignored: chunk %p-%p of size %zu.\n",
                  chunk, chunk + m.requested_size(), m.requested_size());
-    reinterpret_cast<Frontier *>(arg)->push_back(chunk);
+    SpinMutexLock l(param->frontier_mutex);
+    param->frontier->push_back(chunk);
+  }
+}
+
+// Scans the global and root regions before the world is stopped, see
+// RootPrescanState. Returns false if concurrent_root_scan can't be used.
+static bool PrescanRootRanges() {
+  // Unaligned pointers may cross the segment boundaries.
+  if (!flags()->concurrent_root_scan || flags()->use_unaligned ||
+      !BeginPrescan())
+    return false;
+  if (!prescanned_segments) {
+    ALIGNED(64) static char segments_placeholder[sizeof(
+        InternalMmapVector<PrescannedSegment>)];
+    ALIGNED(64) static char candidates_placeholder[sizeof(
+        InternalMmapVector<uptr>)];
+    prescanned_segments = new(segments_placeholder)
+        InternalMmapVector<PrescannedSegment>(1);
+    prescan_candidates = new(candidates_placeholder) InternalMmapVector<uptr>(1);
   }
+  prescanned_segments->clear();
+  prescan_candidates->clear();
+  root_prescan_state = kPrescanning;
+  ProcessGlobalRegions(nullptr);
+  ProcessRootRegions(nullptr);
+  root_prescan_state = kNoPrescan;
+  InternalSort(prescanned_segments, prescanned_segments->size(),
+               PrescannedSegmentLess);
+  return true;
 }
 
 // Sets the appropriate tag on each chunk.
-static void ClassifyAllChunks(SuspendedThreadsList const &suspended_threads) {
+static void ClassifyAllChunks(SuspendedThreadsList const &suspended_threads,
+                              bool prescanned) {
   // Holds the flood fill frontier.
   Frontier frontier(1);
 
-  ForEachChunk(CollectIgnoredCb, &frontier);
+  // One parameter per worker, as the heap bounds are updated for every chunk.
+  CollectIgnoredParam params[kMaxChunkWalkWorkers];
+  SpinMutex frontier_mutex;
+  for (uptr i = 0; i < kMaxChunkWalkWorkers; i++) {
+    CollectIgnoredParam param = {&frontier, &frontier_mutex, ~(uptr)0, 0};
+    params[i] = param;
+  }
+  uptr n_params = ForEachChunkParallel(CollectIgnoredCb, params,
+                                       sizeof(params[0]), kMaxChunkWalkWorkers);
+  uptr begin = ~(uptr)0, end = 0;
+  for (uptr i = 0; i < n_params; i++) {
+    begin = Min(begin, params[i].heap_begin);
+    end = Max(end, params[i].heap_end);
+  }
+  heap_begin_inverted = ~begin;
+  heap_size = end > begin ? end - begin : 0;
+  if (prescanned)
+    root_prescan_state = kUsingPrescan;
   ProcessGlobalRegions(&frontier);
-  ProcessThreads(suspended_threads, &frontier);
   ProcessRootRegions(&frontier);
+  root_prescan_state = kNoPrescan;
+  ProcessThreads(suspended_threads, &frontier);
   FloodFillTag(&frontier, kReachable);
 
   // The check here is relatively expensive, so we do this in a separate flood
@@ -378,7 +840,8 @@ static void ClassifyAllChunks(SuspendedThreadsList const &suspended_threads) {
   // Iterate over leaked chunks and mark those that are reachable from other
   // leaked chunks.
   LOG_POINTERS("Scanning leaked chunks.\n");
-  ForEachChunk(MarkIndirectlyLeakedCb, nullptr);
+  ForEachChunkParallel(MarkIndirectlyLeakedCb, nullptr, 0,
+                       kMaxChunkWalkWorkers);
 }
 
 // ForEachChunk callback. Resets the tags to pre-leak-check state.
@@ -395,6 +858,17 @@ static void PrintStackTraceById(u32 stack_trace_id) {
   StackDepotGet(stack_trace_id).Print();
 }
 
+static void AddLeakedChunk(LeakReport *leak_report, uptr chunk,
+                           u32 stack_trace_id, uptr size, ChunkTag tag) {
+  u32 resolution = flags()->resolution;
+  if (resolution > 0) {
+    StackTrace stack = StackDepotGet(stack_trace_id);
+    stack.size = Min(stack.size, resolution);
+    stack_trace_id = StackDepotPut(stack);
+  }
+  leak_report->AddLeakedChunk(chunk, stack_trace_id, size, tag);
+}
+
 // ForEachChunk callback. Aggregates information about unreachable chunks into
 // a LeakReport.
 static void CollectLeaksCb(uptr chunk, void *arg) {
@@ -403,21 +877,114 @@ static void CollectLeaksCb(uptr chunk, void *arg) {
   chunk = GetUserBegin(chunk);
   LsanMetadata m(chunk);
   if (!m.allocated()) return;
+  if (m.tag() == kDirectlyLeaked || m.tag() == kIndirectlyLeaked)
+    AddLeakedChunk(leak_report, chunk, m.stack_trace_id(), m.requested_size(),
+                   m.tag());
+}
+
+// The unreachable chunks found by the child of fork_leak_check. The stack ids
+// are the ones of the parent's stack depot: the child does not add to it. A
+// record with a zero chunk ends the list.
+struct ForkedLeakRecord {
+  uptr chunk;
+  uptr size;
+  u32 stack_trace_id;
+  u32 tag;
+};
+
+static const uptr kForkedLeakRecordBatch = 256;
+
+struct ForkedLeakWriter {
+  fd_t fd;
+  ForkedLeakRecord records[kForkedLeakRecordBatch];
+  uptr n_records;
+  bool failed;
+};
+
+static void FlushForkedLeakRecords(ForkedLeakWriter *writer) {
+  const char *buf = reinterpret_cast<const char *>(writer->records);
+  uptr size = writer->n_records * sizeof(ForkedLeakRecord);
+  writer->n_records = 0;
+  while (size > 0 && !writer->failed) {
+    uptr bytes_written;
+    if (!WriteToFile(writer->fd, buf, size, &bytes_written) ||
+        bytes_written == 0) {
+      writer->failed = true;
+      break;
+    }
+    buf += bytes_written;
+    size -= bytes_written;
+  }
+}
+
+static void WriteForkedLeakRecord(ForkedLeakWriter *writer,
+                                  const ForkedLeakRecord &record) {
+  writer->records[writer->n_records++] = record;
+  if (writer->n_records == kForkedLeakRecordBatch)
+    FlushForkedLeakRecords(writer);
+}
+
+// ForEachChunk callback. Sends the unreachable chunks to the parent.
+static void WriteLeaksCb(uptr chunk, void *arg) {
+  ForkedLeakWriter *writer = reinterpret_cast<ForkedLeakWriter *>(arg);
+  chunk = GetUserBegin(chunk);
+  LsanMetadata m(chunk);
+  if (!m.allocated()) return;
   if (m.tag() == kDirectlyLeaked || m.tag() == kIndirectlyLeaked) {
-    u32 resolution = flags()->resolution;
-    u32 stack_trace_id = 0;
-    if (resolution > 0) {
-      StackTrace stack = StackDepotGet(m.stack_trace_id());
-      stack.size = Min(stack.size, resolution);
-      stack_trace_id = StackDepotPut(stack);
-    } else {
-      stack_trace_id = m.stack_trace_id();
+    ForkedLeakRecord record = {chunk, m.requested_size(), m.stack_trace_id(),
+                               m.tag()};
+    WriteForkedLeakRecord(writer, record);
+  }
+}
+
+// Reads the records sent by WriteLeaksCb up to the terminating one. Returns
+// false if the child died before sending it.
+static bool ReadForkedLeaks(fd_t fd, LeakReport *leak_report) {
+  InternalScopedBuffer<ForkedLeakRecord> records(kForkedLeakRecordBatch);
+  char *buf = reinterpret_cast<char *>(records.data());
+  uptr buf_len = 0;
+  for (;;) {
+    uptr bytes_read;
+    if (!ReadFromFile(fd, buf + buf_len, records.size() - buf_len, &bytes_read)
+        || bytes_read == 0)
+      return false;
+    buf_len += bytes_read;
+    uptr n_records = buf_len / sizeof(ForkedLeakRecord);
+    for (uptr i = 0; i < n_records; i++) {
+      const ForkedLeakRecord &record = records[i];
+      if (!record.chunk) return true;
+      AddLeakedChunk(leak_report, record.chunk, record.stack_trace_id,
+                     record.size, static_cast<ChunkTag>(record.tag));
     }
-    leak_report->AddLeakedChunk(chunk, stack_trace_id, m.requested_size(),
-                                m.tag());
+    buf_len -= n_records * sizeof(ForkedLeakRecord);
+    internal_memmove(buf, buf + n_records * sizeof(ForkedLeakRecord),
+                     buf_len);
   }
 }
 
+// Classifies the chunks in a copy-on-write child of the process, for
+// fork_leak_check, so that the other threads can be resumed right after the
+// fork. Returns true in the parent if the child has been started. Does not
+// return in the child.
+static bool ForkLeakCheck(SuspendedThreadsList const &suspended_threads,
+                          fd_t write_fd) {
+  InternalMmapVector<uptr> snapshot(1);
+  SnapshotRegisters(suspended_threads, &snapshot);
+  int pid = ForkLeakCheckChild();
+  if (pid != 0) return pid > 0;
+  registers_snapshot = &snapshot;
+  ClassifyAllChunks(suspended_threads, /* prescanned */ false);
+  ForkedLeakWriter writer;
+  writer.fd = write_fd;
+  writer.n_records = 0;
+  writer.failed = false;
+  ForEachChunk(WriteLeaksCb, &writer);
+  ForkedLeakRecord end = {0, 0, 0, 0};
+  WriteForkedLeakRecord(&writer, end);
+  FlushForkedLeakRecords(&writer);
+  internal__exit(writer.failed ? 1 : 0);
+}
+
 static void PrintMatchedSuppressions() {
   InternalMmapVector<Suppression *> matched(1);
   GetSuppressionContext()->GetMatched(&matched);
@@ -435,6 +1002,11 @@ static void PrintMatchedSuppressions() {
 
 struct CheckForLeaksParam {
   bool success;
+  bool prescanned;
+  // Write end of the pipe for fork_leak_check, or kInvalidFd.
+  fd_t leak_pipe_fd;
+  // Set if the chunks are classified by a child process.
+  bool forked;
   LeakReport leak_report;
 };
 
@@ -443,25 +1015,59 @@ static void CheckForLeaksCallback(const SuspendedThreadsList &suspended_threads,
   CheckForLeaksParam *param = reinterpret_cast<CheckForLeaksParam *>(arg);
   CHECK(param);
   CHECK(!param->success);
-  ClassifyAllChunks(suspended_threads);
+  // If the child can't be started, check for leaks right here.
+  if (param->leak_pipe_fd != kInvalidFd &&
+      ForkLeakCheck(suspended_threads, param->leak_pipe_fd)) {
+    param->forked = true;
+    param->success = true;
+    return;
+  }
+  // Unaligned pointers may cross page boundaries, which the per-page marks
+  // can't describe.
+  // The prescan has already reset the soft-dirty bits which incremental_scan
+  // relies on.
+  incremental_scan_active = flags()->incremental_scan && !param->prescanned &&
+                            !flags()->use_unaligned && BeginIncrementalScan();
+  ClassifyAllChunks(suspended_threads, param->prescanned);
+  if (incremental_scan_active) {
+    EndIncrementalScan();
+    incremental_scan_active = false;
+  }
   ForEachChunk(CollectLeaksCb, &param->leak_report);
   // Clean up for subsequent leak checks. This assumes we did not overwrite any
   // kIgnored tags.
-  ForEachChunk(ResetTagsCb, nullptr);
+  ForEachChunkParallel(ResetTagsCb, nullptr, 0, kMaxChunkWalkWorkers);
   param->success = true;
 }
 
 static bool CheckForLeaks() {
   if (&__lsan_is_turned_off && __lsan_is_turned_off())
       return false;
+  InitializeLeakChecker();
   EnsureMainThreadIDIsCorrect();
   CheckForLeaksParam param;
   param.success = false;
+  param.forked = false;
+  fd_t leak_pipe_read_fd = kInvalidFd;
+  param.leak_pipe_fd = kInvalidFd;
+  if (flags()->fork_leak_check)
+    OpenLeakCheckPipe(&leak_pipe_read_fd, &param.leak_pipe_fd);
+  // The child has its own soft-dirty bits.
+  param.prescanned =
+      param.leak_pipe_fd == kInvalidFd && PrescanRootRanges();
   LockThreadRegistry();
   LockAllocator();
   DoStopTheWorld(CheckForLeaksCallback, &param);
   UnlockAllocator();
   UnlockThreadRegistry();
+  if (param.prescanned)
+    EndPrescan();
+  if (param.leak_pipe_fd != kInvalidFd) {
+    CloseFile(param.leak_pipe_fd);
+    if (param.forked)
+      param.success = ReadForkedLeaks(leak_pipe_read_fd, &param.leak_report);
+    CloseFile(leak_pipe_read_fd);
+  }
 
   if (!param.success) {
     Report("LeakSanitizer has encountered a fatal error.\n");
@@ -516,8 +1122,11 @@ static int DoRecoverableLeakCheck() {
 static Suppression *GetSuppressionForAddr(uptr addr) {
   Suppression *s = nullptr;
 
-  // Suppress by module name.
   SuppressionContext *suppressions = GetSuppressionContext();
+  if (suppressions->IsUnmatchedPC(addr, kSuppressionLeak))
+    return nullptr;
+
+  // Suppress by module name.
   if (const char *module_name =
           Symbolizer::GetOrInit()->GetModuleNameForPc(addr))
     if (suppressions->Match(module_name, kSuppressionLeak, &s))
@@ -532,6 +1141,8 @@ static Suppression *GetSuppressionForAddr(uptr addr) {
     }
   }
   frames->ClearAll();
+  if (!s)
+    suppressions->AddUnmatchedPC(addr, kSuppressionLeak);
   return s;
 }
 
@@ -547,31 +1158,59 @@ static Suppression *GetSuppressionForStack(u32 stack_trace_id) {
 
 ///// LeakReport implementation. /////
 
-// A hard limit on the number of distinct leaks, to avoid quadratic complexity
-// in LeakReport::AddLeakedChunk(). We don't expect to ever see this many leaks
-// in real-world applications.
-// FIXME: Get rid of this limit by changing the implementation of LeakReport to
-// use a hash table.
-const uptr kMaxLeaksConsidered = 5000;
+// A hard limit on the number of distinct leaks, to bound the memory used by
+// the report. We don't expect to ever see this many leaks in real-world
+// applications.
+const uptr kMaxLeaksConsidered = 1 << 20;
+
+const uptr kInitialLeakIndexSize = 1 << 10;
+
+uptr LeakReport::FindLeakSlot(u32 stack_trace_id, bool is_directly_leaked) {
+  uptr mask = leak_index_.size() - 1;
+  u64 key = (u64)stack_trace_id * 2 + is_directly_leaked;
+  uptr slot = (uptr)((key * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+  for (;; slot = (slot + 1) & mask) {
+    u32 pos = leak_index_[slot];
+    if (pos == 0)
+      return slot;
+    const Leak &leak = leaks_[pos - 1];
+    if (leak.stack_trace_id == stack_trace_id &&
+        leak.is_directly_leaked == is_directly_leaked)
+      return slot;
+  }
+}
+
+void LeakReport::GrowLeakIndex() {
+  uptr size = Max(leak_index_.size() * 2, kInitialLeakIndexSize);
+  leak_index_.clear();
+  leak_index_.resize(size);
+  for (uptr i = 0; i < leaks_.size(); i++) {
+    uptr slot = FindLeakSlot(leaks_[i].stack_trace_id,
+                             leaks_[i].is_directly_leaked);
+    leak_index_[slot] = i + 1;
+  }
+}
 
 void LeakReport::AddLeakedChunk(uptr chunk, u32 stack_trace_id,
                                 uptr leaked_size, ChunkTag tag) {
   CHECK(tag == kDirectlyLeaked || tag == kIndirectlyLeaked);
   bool is_directly_leaked = (tag == kDirectlyLeaked);
+  // Keep the index at most half full.
+  if (2 * (leaks_.size() + 1) > leak_index_.size())
+    GrowLeakIndex();
+  uptr slot = FindLeakSlot(stack_trace_id, is_directly_leaked);
   uptr i;
-  for (i = 0; i < leaks_.size(); i++) {
-    if (leaks_[i].stack_trace_id == stack_trace_id &&
-        leaks_[i].is_directly_leaked == is_directly_leaked) {
-      leaks_[i].hit_count++;
-      leaks_[i].total_size += leaked_size;
-      break;
-    }
-  }
-  if (i == leaks_.size()) {
+  if (leak_index_[slot]) {
+    i = leak_index_[slot] - 1;
+    leaks_[i].hit_count++;
+    leaks_[i].total_size += leaked_size;
+  } else {
     if (leaks_.size() == kMaxLeaksConsidered) return;
     Leak leak = { next_id_++, /* hit_count */ 1, leaked_size, stack_trace_id,
                   is_directly_leaked, /* is_suppressed */ false };
+    i = leaks_.size();
     leaks_.push_back(leak);
+    leak_index_[slot] = i + 1;
   }
   if (flags()->report_objects) {
     LeakedObject obj = {leaks_[i].id, chunk, leaked_size};
@@ -586,6 +1225,13 @@ static bool LeakComparator(const Leak &leak1, const Leak &leak2) {
     return leak1.is_directly_leaked;
 }
 
+static bool LeakedObjectComparator(const LeakedObject &obj1,
+                                   const LeakedObject &obj2) {
+  if (obj1.leak_id != obj2.leak_id)
+    return obj1.leak_id < obj2.leak_id;
+  return obj1.addr < obj2.addr;
+}
+
 void LeakReport::ReportTopLeaks(uptr num_leaks_to_report) {
   CHECK(leaks_.size() <= kMaxLeaksConsidered);
   Printf("\n");
@@ -597,7 +1243,15 @@ void LeakReport::ReportTopLeaks(uptr num_leaks_to_report) {
   uptr unsuppressed_count = UnsuppressedLeakCount();
   if (num_leaks_to_report > 0 && num_leaks_to_report < unsuppressed_count)
     Printf("The %zu top leak(s):\n", num_leaks_to_report);
+  uptr sample_rate = GetAllocationSampleRate();
+  if (sample_rate > 1)
+    Printf("The leak sizes are estimated from 1 in %zu allocations.\n",
+           sample_rate);
   InternalSort(&leaks_, leaks_.size(), LeakComparator);
+  // Grouped by leak, for PrintLeakedObjectsForLeak.
+  if (flags()->report_objects)
+    InternalSort(&leaked_objects_, leaked_objects_.size(),
+                 LeakedObjectComparator);
   uptr leaks_reported = 0;
   for (uptr i = 0; i < leaks_.size(); i++) {
     if (leaks_[i].is_suppressed) continue;
@@ -614,9 +1268,11 @@ void LeakReport::ReportTopLeaks(uptr num_leaks_to_report) {
 void LeakReport::PrintReportForLeak(uptr index) {
   Decorator d;
   Printf("%s", d.Leak());
+  uptr sample_rate = GetAllocationSampleRate();
   Printf("%s leak of %zu byte(s) in %zu object(s) allocated from:\n",
          leaks_[index].is_directly_leaked ? "Direct" : "Indirect",
-         leaks_[index].total_size, leaks_[index].hit_count);
+         leaks_[index].total_size * sample_rate,
+         leaks_[index].hit_count * sample_rate);
   Printf("%s", d.End());
 
   PrintStackTraceById(leaks_[index].stack_trace_id);
@@ -629,11 +1285,13 @@ void LeakReport::PrintReportForLeak(uptr index) {
 }
 
 void LeakReport::PrintLeakedObjectsForLeak(uptr index) {
-  u32 leak_id = leaks_[index].id;
-  for (uptr j = 0; j < leaked_objects_.size(); j++) {
-    if (leaked_objects_[j].leak_id == leak_id)
-      Printf("%p (%zu bytes)\n", leaked_objects_[j].addr,
-             leaked_objects_[j].size);
+  LeakedObject first = {leaks_[index].id, 0, 0};
+  uptr j = InternalLowerBound(leaked_objects_, 0, leaked_objects_.size(),
+                              first, LeakedObjectComparator);
+  for (; j < leaked_objects_.size() &&
+         leaked_objects_[j].leak_id == first.leak_id; j++) {
+    Printf("%p (%zu bytes)\n", leaked_objects_[j].addr,
+           leaked_objects_[j].size);
   }
 }
 
@@ -645,6 +1303,8 @@ void LeakReport::PrintSummary() {
       bytes += leaks_[i].total_size;
       allocations += leaks_[i].hit_count;
   }
+  bytes *= GetAllocationSampleRate();
+  allocations *= GetAllocationSampleRate();
   InternalScopedString summary(kMaxSummaryLength);
   summary.append("%zu byte(s) leaked in %zu allocation(s).", bytes,
                  allocations);
@@ -652,6 +1312,9 @@ void LeakReport::PrintSummary() {
 }
 
 void LeakReport::ApplySuppressions() {
+  // Matching symbolizes every frame of every leak, don't do it for nothing.
+  if (!GetSuppressionContext()->HasSuppressionType(kSuppressionLeak))
+    return;
   for (uptr i = 0; i < leaks_.size(); i++) {
     Suppression *s = GetSuppressionForStack(leaks_[i].stack_trace_id);
     if (s) {
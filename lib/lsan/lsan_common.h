@@ -94,7 +94,8 @@ struct LeakedObject {
 // Aggregates leaks by stack trace prefix.
 class LeakReport {
  public:
-  LeakReport() : next_id_(0), leaks_(1), leaked_objects_(1) {}
+  LeakReport()
+      : next_id_(0), leaks_(1), leaked_objects_(1), leak_index_(1) {}
   void AddLeakedChunk(uptr chunk, u32 stack_trace_id, uptr leaked_size,
                       ChunkTag tag);
   void ReportTopLeaks(uptr max_leaks);
@@ -106,10 +107,16 @@ class LeakReport {
  private:
   void PrintReportForLeak(uptr index);
   void PrintLeakedObjectsForLeak(uptr index);
+  uptr FindLeakSlot(u32 stack_trace_id, bool is_directly_leaked);
+  void GrowLeakIndex();
 
   u32 next_id_;
   InternalMmapVector<Leak> leaks_;
   InternalMmapVector<LeakedObject> leaked_objects_;
+  // Open addressing hash table of the positions in leaks_ (plus one, 0 for
+  // the empty slots) keyed by stack trace id and directness. It is not kept up
+  // to date once ReportTopLeaks sorts the leaks.
+  InternalMmapVector<u32> leak_index_;
 };
 
 typedef InternalMmapVector<uptr> Frontier;
@@ -120,6 +127,40 @@ void ProcessGlobalRegions(Frontier *frontier);
 void ProcessPlatformSpecificAllocations(Frontier *frontier);
 // Run stoptheworld while holding any platform-specific locks.
 void DoStopTheWorld(StopTheWorldCallback callback, void* argument);
+// Runs |worker| on the current thread and on |n_threads| - 1 helper threads,
+// and waits for all of them to finish. Must only be called from within the
+// StopTheWorld callback. Fewer helpers may be started if spawning fails.
+void RunOnHelperThreads(void (*worker)(void *arg), void *arg, uptr n_threads);
+
+// Soft-dirty based page skipping for the incremental_scan flag. Page marks are
+// only consulted between BeginIncrementalScan and EndIncrementalScan, which
+// must be called from within the StopTheWorld callback.
+// Returns false if incremental scanning can't be used for this leak check.
+bool BeginIncrementalScan();
+void EndIncrementalScan();
+// For each of the |n_pages| pages starting at |page|, sets |skippable[i]| to
+// whether the page had no heap pointer candidates during the previous leak
+// check and has not been written to since.
+void GetSkippablePages(uptr page, uptr n_pages, bool *skippable);
+// Records whether the page at |page| holds heap pointer candidates.
+void MarkPage(uptr page, bool pointer_free);
+
+// Soft-dirty based prescanning for the concurrent_root_scan flag.
+// BeginPrescan resets the soft-dirty bits while the world is still running,
+// and returns false if they are not available. Until EndPrescan, GetCleanPages
+// sets |clean[i]|, for each of the |n_pages| pages starting at |page|, to
+// whether the page has not been written to since BeginPrescan.
+bool BeginPrescan();
+void EndPrescan();
+void GetCleanPages(uptr page, uptr n_pages, bool *clean);
+
+// Copy-on-write leak checking for the fork_leak_check flag. OpenLeakCheckPipe
+// creates the pipe the child sends its results over, and returns false if it
+// can't. ForkLeakCheckChild must be called from within the StopTheWorld
+// callback. It returns 0 in the child, the pid of the child in the parent, or
+// -1 if the child can't be started.
+bool OpenLeakCheckPipe(fd_t *read_fd, fd_t *write_fd);
+int ForkLeakCheckChild();
 
 void ScanRangeForPointers(uptr begin, uptr end,
                           Frontier *frontier,
@@ -183,6 +224,10 @@ inline bool IsSpecialCaseOfOperatorNew0(uptr chunk_beg, uptr chunk_size,
 // The following must be implemented in the parent tool.
 
 void ForEachChunk(ForEachChunkCallback callback, void *arg);
+// Same as ForEachChunk, for the part |part| of |n_parts| disjoint parts of the
+// chunks. The parts can be iterated over concurrently.
+void ForEachChunkInPart(ForEachChunkCallback callback, void *arg, uptr part,
+                        uptr n_parts);
 // Returns the address range occupied by the global allocator object.
 void GetAllocatorGlobalRange(uptr *begin, uptr *end);
 // Wrappers for allocator's ForceLock()/ForceUnlock().
@@ -210,6 +255,8 @@ void EnsureMainThreadIDIsCorrect();
 uptr PointsIntoChunk(void *p);
 // Returns address of user-visible chunk contained in this allocator chunk.
 uptr GetUserBegin(uptr chunk);
+// Returns N if only one in N allocations can be reported as leaked.
+uptr GetAllocationSampleRate();
 // Helper for __lsan_ignore_object().
 IgnoreObjectResult IgnoreObjectLocked(const void *p);
 // Wrapper for chunk metadata operations.
@@ -220,6 +267,9 @@ class LsanMetadata {
   bool allocated() const;
   ChunkTag tag() const;
   void set_tag(ChunkTag value);
+  // Atomically replaces |old_tag| with |new_tag|. Returns false if the chunk
+  // had a different tag, e.g. because a concurrent marker got there first.
+  bool try_set_tag(ChunkTag old_tag, ChunkTag new_tag);
   uptr requested_size() const;
   u32 stack_trace_id() const;
  private:
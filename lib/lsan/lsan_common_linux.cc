@@ -16,11 +16,17 @@
 #include "lsan_common.h"
 
 #if CAN_SANITIZE_LEAKS && SANITIZER_LINUX
+#include <errno.h>
+#include <fcntl.h>  // for O_CLOEXEC
 #include <link.h>
+#include <sched.h>  // for CLONE_* definitions
+#include <sys/wait.h>  // for __WALL
+#include <unistd.h>  // for pipe2
 
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_flags.h"
 #include "sanitizer_common/sanitizer_linux.h"
+#include "sanitizer_common/sanitizer_posix.h"
 #include "sanitizer_common/sanitizer_stackdepot.h"
 
 namespace __lsan {
@@ -179,6 +185,233 @@ void DoStopTheWorld(StopTheWorldCallback callback, void *argument) {
   dl_iterate_phdr(DoStopTheWorldCallback, &param);
 }
 
+// State of the incremental_scan mode. One byte per page of the address space
+// holds the number of the leak check during which the page was last found to
+// be free of heap pointer candidates, or 0. A page can be skipped if it was
+// pointer-free during the previous check and its soft-dirty bit shows that it
+// has not been written to since: soft-dirty bits are cleared at the end of
+// every check.
+static u8 *page_marks;
+static uptr page_marks_size;
+static u8 scan_generation;
+static bool soft_dirty_unsupported;
+static fd_t pagemap_fd = kInvalidFd;
+// Serializes the lseek/read pairs on pagemap_fd between mark_threads helpers.
+static StaticSpinMutex pagemap_mutex;
+
+static const u64 kPagemapSoftDirty = 1ULL << 55;
+
+static bool ReadPagemap(uptr page, uptr n_pages, u64 *entries) {
+  uptr page_size = GetPageSizeCached();
+  SpinMutexLock l(&pagemap_mutex);
+  OFF_T offset = page / page_size * sizeof(u64);
+  if (internal_lseek(pagemap_fd, offset, SEEK_SET) != (uptr)offset)
+    return false;
+  uptr bytes_read;
+  return ReadFromFile(pagemap_fd, entries, n_pages * sizeof(u64),
+                      &bytes_read) &&
+         bytes_read == n_pages * sizeof(u64);
+}
+
+bool BeginIncrementalScan() {
+  if (soft_dirty_unsupported) return false;
+  uptr page_size = GetPageSizeCached();
+  if (!page_marks) {
+    page_marks_size = RoundUpTo((GetMaxVirtualAddress() + 1) / page_size,
+                                page_size);
+    page_marks = (u8 *)MmapNoReserveOrDie(page_marks_size, "LSan page marks");
+  }
+  pagemap_fd = OpenFile("/proc/self/pagemap", RdOnly);
+  if (pagemap_fd == kInvalidFd) {
+    Report("LeakSanitizer: can't open /proc/self/pagemap, incremental_scan "
+           "is disabled.\n");
+    soft_dirty_unsupported = true;
+    return false;
+  }
+  if (++scan_generation == 0) {
+    // Marks from 255 checks ago would be mistaken for marks from the previous
+    // one. Forget all of them instead.
+    // Released pages of a private anonymous mapping read back as zeroes.
+    ReleaseMemoryPagesToOS((uptr)page_marks, (uptr)page_marks + page_marks_size);
+    scan_generation = 1;
+  }
+  return true;
+}
+
+// Resets the soft-dirty bits of the whole process. Returns false, and disables
+// the soft-dirty based modes, if the kernel does not track them.
+static bool ClearSoftDirtyBits() {
+  fd_t clear_refs_fd = OpenFile("/proc/self/clear_refs", WrOnly);
+  bool cleared = clear_refs_fd != kInvalidFd &&
+                 WriteToFile(clear_refs_fd, "4", 1);
+  if (clear_refs_fd != kInvalidFd) CloseFile(clear_refs_fd);
+  if (cleared) {
+    // Make sure the kernel actually tracks soft-dirty bits before relying on
+    // them: a freshly written page must be reported as soft-dirty.
+    static char *probe_page;
+    if (!probe_page)
+      probe_page = (char *)MmapOrDie(GetPageSizeCached(), "LSan probe page");
+    probe_page[0]++;
+    u64 probe_entry;
+    pagemap_fd = OpenFile("/proc/self/pagemap", RdOnly);
+    cleared = pagemap_fd != kInvalidFd &&
+              ReadPagemap((uptr)probe_page, 1, &probe_entry) &&
+              (probe_entry & kPagemapSoftDirty);
+    if (pagemap_fd != kInvalidFd) CloseFile(pagemap_fd);
+    pagemap_fd = kInvalidFd;
+  }
+  if (!cleared) {
+    Report("LeakSanitizer: soft-dirty page tracking is not available, "
+           "incremental_scan and concurrent_root_scan are disabled.\n");
+    soft_dirty_unsupported = true;
+  }
+  return cleared;
+}
+
+void EndIncrementalScan() {
+  CloseFile(pagemap_fd);
+  pagemap_fd = kInvalidFd;
+  // The world is still stopped, so no write can slip in between the scan and
+  // the reset.
+  ClearSoftDirtyBits();
+}
+
+void GetSkippablePages(uptr page, uptr n_pages, bool *skippable) {
+  const uptr kMaxPages = 512;
+  CHECK_LE(n_pages, kMaxPages);
+  uptr page_size = GetPageSizeCached();
+  u8 prev_generation = scan_generation - 1;
+  bool any_skippable = false;
+  for (uptr i = 0; i < n_pages; i++) {
+    u8 mark = atomic_load_relaxed(reinterpret_cast<atomic_uint8_t *>(
+        &page_marks[page / page_size + i]));
+    skippable[i] = prev_generation != 0 && mark == prev_generation;
+    any_skippable |= skippable[i];
+  }
+  if (!any_skippable) return;
+  u64 entries[kMaxPages];
+  if (!ReadPagemap(page, n_pages, entries)) {
+    internal_memset(skippable, 0, n_pages * sizeof(skippable[0]));
+    return;
+  }
+  for (uptr i = 0; i < n_pages; i++) {
+    if (entries[i] & kPagemapSoftDirty)
+      skippable[i] = false;
+  }
+}
+
+bool BeginPrescan() {
+  if (soft_dirty_unsupported || !ClearSoftDirtyBits()) return false;
+  pagemap_fd = OpenFile("/proc/self/pagemap", RdOnly);
+  if (pagemap_fd == kInvalidFd) {
+    Report("LeakSanitizer: can't open /proc/self/pagemap, "
+           "concurrent_root_scan is disabled.\n");
+    soft_dirty_unsupported = true;
+    return false;
+  }
+  return true;
+}
+
+void EndPrescan() {
+  CloseFile(pagemap_fd);
+  pagemap_fd = kInvalidFd;
+}
+
+void GetCleanPages(uptr page, uptr n_pages, bool *clean) {
+  const uptr kMaxPages = 512;
+  CHECK_LE(n_pages, kMaxPages);
+  u64 entries[kMaxPages];
+  bool have_entries = ReadPagemap(page, n_pages, entries);
+  for (uptr i = 0; i < n_pages; i++)
+    clean[i] = have_entries && !(entries[i] & kPagemapSoftDirty);
+}
+
+bool OpenLeakCheckPipe(fd_t *read_fd, fd_t *write_fd) {
+  // Close on exec, lest a child the program starts in the meantime keeps the
+  // pipe open.
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    Report("LeakSanitizer: can't create a pipe, fork_leak_check is "
+           "disabled for this check.\n");
+    return false;
+  }
+  *read_fd = fds[0];
+  *write_fd = fds[1];
+  return true;
+}
+
+int ForkLeakCheckChild() {
+  int pid = internal_fork();
+  int rverrno;
+  if (internal_iserror((uptr)pid, &rverrno)) {
+    Report("LeakSanitizer: fork failed (errno %d), fork_leak_check is "
+           "disabled for this check.\n", rverrno);
+    return -1;
+  }
+  return pid;
+}
+
+void MarkPage(uptr page, bool pointer_free) {
+  atomic_store_relaxed(
+      reinterpret_cast<atomic_uint8_t *>(
+          &page_marks[page / GetPageSizeCached()]),
+      pointer_free ? scan_generation : 0);
+}
+
+struct HelperThreadArgument {
+  void (*worker)(void *arg);
+  void *arg;
+};
+
+static int HelperThread(void *argument) {
+  HelperThreadArgument *helper_argument =
+      reinterpret_cast<HelperThreadArgument *>(argument);
+  helper_argument->worker(helper_argument->arg);
+  return 0;
+}
+
+// The helpers are spawned from the tracer task the same way the tracer itself
+// is spawned by StopTheWorld. They are not part of the parent's thread group,
+// so they are neither suspended nor scanned for pointers.
+void RunOnHelperThreads(void (*worker)(void *arg), void *arg, uptr n_threads) {
+  const uptr kMaxHelperThreads = 64;
+  const uptr kHelperStackSize = 256 * 1024;
+  HelperThreadArgument helper_argument = {worker, arg};
+  uptr helper_pids[kMaxHelperThreads];
+  uptr helper_stacks[kMaxHelperThreads];
+  uptr n_helpers = 0;
+  n_threads = Min(n_threads, kMaxHelperThreads + 1);
+  while (n_helpers + 1 < n_threads) {
+    uptr stack = (uptr)MmapOrDie(kHelperStackSize, "LSan helper stack");
+    uptr pid = internal_clone(
+        HelperThread, reinterpret_cast<void *>(stack + kHelperStackSize),
+        CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_UNTRACED, &helper_argument,
+        nullptr /* parent_tidptr */, nullptr /* newtls */,
+        nullptr /* child_tidptr */);
+    int local_errno = 0;
+    if (internal_iserror(pid, &local_errno)) {
+      VReport(1, "Failed spawning an LSan helper thread (errno %d).\n",
+              local_errno);
+      UnmapOrDie(reinterpret_cast<void *>(stack), kHelperStackSize);
+      break;
+    }
+    helper_pids[n_helpers] = pid;
+    helper_stacks[n_helpers] = stack;
+    n_helpers++;
+  }
+  worker(arg);
+  for (uptr i = 0; i < n_helpers; i++) {
+    uptr waitpid_status;
+    HANDLE_EINTR(waitpid_status,
+                 internal_waitpid(helper_pids[i], nullptr, __WALL));
+    int wperrno;
+    if (internal_iserror(waitpid_status, &wperrno))
+      Report("Waiting on an LSan helper thread failed (errno %d).\n",
+             wperrno);
+    UnmapOrDie(reinterpret_cast<void *>(helper_stacks[i]), kHelperStackSize);
+  }
+}
+
 } // namespace __lsan
 
 #endif // CAN_SANITIZE_LEAKS && SANITIZER_LINUX
@@ -28,6 +28,7 @@ typedef struct {
   int disable_counter;
   u32 current_thread_id;
   AllocatorCache cache;
+  AllocationSampler sampler;
 } thread_local_data_t;
 
 static pthread_key_t key;
@@ -54,6 +55,7 @@ static thread_local_data_t *get_tls_val(bool alloc) {
     ptr->disable_counter = 0;
     ptr->current_thread_id = kInvalidTid;
     ptr->cache = AllocatorCache();
+    ptr->sampler = AllocationSampler();
     pthread_setspecific(key, ptr);
   }
 
@@ -85,6 +87,10 @@ void SetCurrentThread(u32 tid) { get_tls_val(true)->current_thread_id = tid; }
 
 AllocatorCache *GetAllocatorCache() { return &get_tls_val(true)->cache; }
 
+AllocationSampler *GetAllocationSampler() {
+  return &get_tls_val(true)->sampler;
+}
+
 // Required on Linux for initialization of TLS behavior, but should not be
 // required on Darwin.
 void InitializePlatformSpecificModules() {
@@ -121,6 +127,28 @@ void DoStopTheWorld(StopTheWorldCallback callback, void *argument) {
   CHECK(0 && "unimplemented");
 }
 
+// Soft-dirty page tracking is not available on Darwin.
+bool BeginIncrementalScan() { return false; }
+void EndIncrementalScan() {}
+void GetSkippablePages(uptr page, uptr n_pages, bool *skippable) {
+  CHECK(0 && "unimplemented");
+}
+void MarkPage(uptr page, bool pointer_free) { CHECK(0 && "unimplemented"); }
+
+bool OpenLeakCheckPipe(fd_t *read_fd, fd_t *write_fd) { return false; }
+int ForkLeakCheckChild() { return -1; }
+
+bool BeginPrescan() { return false; }
+void EndPrescan() {}
+void GetCleanPages(uptr page, uptr n_pages, bool *clean) {
+  CHECK(0 && "unimplemented");
+}
+
+// Helper threads are not supported on Darwin, the worker does all of the work.
+void RunOnHelperThreads(void (*worker)(void *arg), void *arg, uptr n_threads) {
+  worker(arg);
+}
+
 } // namespace __lsan
 
 #endif // CAN_SANITIZE_LEAKS && SANITIZER_MAC
@@ -303,6 +303,8 @@ INTERCEPTOR(int, pthread_join, void *th, void **ret) {
   return res;
 }
 
+DEFINE_REAL_PTHREAD_FUNCTIONS
+
 namespace __lsan {
 
 void InitializeInterceptors() {
@@ -26,6 +26,9 @@ void SetCurrentThread(u32 tid) { current_thread_tid = tid; }
 static THREADLOCAL AllocatorCache allocator_cache;
 AllocatorCache *GetAllocatorCache() { return &allocator_cache; }
 
+static THREADLOCAL AllocationSampler allocation_sampler;
+AllocationSampler *GetAllocationSampler() { return &allocation_sampler; }
+
 void ReplaceSystemMalloc() {}
 
 } // namespace __lsan
@@ -14,8 +14,10 @@
 
 #include "lsan_thread.h"
 
+#include "sanitizer_common/sanitizer_allocator_internal.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_placement_new.h"
+#include "sanitizer_common/sanitizer_shadow_stack.h"
 #include "sanitizer_common/sanitizer_thread_registry.h"
 #include "sanitizer_common/sanitizer_tls_get_addr.h"
 #include "lsan_allocator.h"
@@ -69,6 +71,8 @@ void ThreadContext::OnStarted(void *arg) {
 
 void ThreadContext::OnFinished() {
   AllocatorThreadFinish();
+  ShadowStackThreadFinish();
+  InternalAllocatorThreadFinish();
   DTLS_Destroy();
 }
 
@@ -23,6 +23,7 @@
 #include "sanitizer_common/sanitizer_flag_parser.h"
 #include "sanitizer_common/sanitizer_libc.h"
 #include "sanitizer_common/sanitizer_procmaps.h"
+#include "sanitizer_common/sanitizer_self_profile.h"
 #include "sanitizer_common/sanitizer_stacktrace.h"
 #include "sanitizer_common/sanitizer_symbolizer.h"
 #include "sanitizer_common/sanitizer_stackdepot.h"
@@ -233,16 +234,20 @@ void PrintWarning(uptr pc, uptr bp) {
   PrintWarningWithOrigin(pc, bp, __msan_origin_tls);
 }
 
-void PrintWarningWithOrigin(uptr pc, uptr bp, u32 origin) {
+// Returns true if the warning is not to be printed.
+static bool SkipWarning(uptr pc, u32 origin) {
   if (msan_expect_umr) {
     // Printf("Expected UMR\n");
     __msan_origin_tls = origin;
     msan_expected_umr_found = 1;
-    return;
+    return true;
   }
 
   ++msan_report_count;
+  return IsDuplicateUMR(pc, origin);
+}
 
+static void ReportWarning(uptr pc, uptr bp, u32 origin) {
   GET_FATAL_STACK_TRACE_PC_BP(pc, bp);
 
   u32 report_origin =
@@ -257,8 +262,33 @@ void PrintWarningWithOrigin(uptr pc, uptr bp, u32 origin) {
   }
 }
 
+void PrintWarningWithOrigin(uptr pc, uptr bp, u32 origin) {
+  if (SkipWarning(pc, origin)) return;
+  ReportWarning(pc, bp, origin);
+}
+
+void PrintWarningInsideAddressRange(uptr pc, uptr bp, const char *what,
+                                    const void *start, uptr size, uptr offset) {
+  u32 origin = __msan_get_origin((const char *)start + offset);
+  if (SkipWarning(pc, origin)) return;
+  ReportUMRInsideAddressRange(what, start, size, offset);
+  ReportWarning(pc, bp, origin);
+}
+
+// Clears a whole number of words of the TLS shadow. Unlike internal_memset(),
+// which stores a byte at a time, this is cheap enough for every callback and
+// signal.
+static void ClearTlsShadow(void *p, uptr size) {
+  u64 *w = reinterpret_cast<u64 *>(p);
+  for (uptr i = 0; i < size / sizeof(u64); ++i) {
+    w[i] = 0;
+    // Make sure this does not become memset.
+    SanitizerBreakOptimization(nullptr);
+  }
+}
+
 void UnpoisonParam(uptr n) {
-  internal_memset(__msan_param_tls, 0, n * sizeof(*__msan_param_tls));
+  ClearTlsShadow(__msan_param_tls, n * sizeof(*__msan_param_tls));
 }
 
 // Backup MSan runtime TLS state.
@@ -273,15 +303,13 @@ void ScopedThreadLocalStateBackup::Restore() {
   // A lame implementation that only keeps essential state and resets the rest.
   __msan_va_arg_overflow_size_tls = va_arg_overflow_size_tls;
 
-  internal_memset(__msan_param_tls, 0, sizeof(__msan_param_tls));
-  internal_memset(__msan_retval_tls, 0, sizeof(__msan_retval_tls));
-  internal_memset(__msan_va_arg_tls, 0, sizeof(__msan_va_arg_tls));
+  ClearTlsShadow(__msan_param_tls, sizeof(__msan_param_tls));
+  ClearTlsShadow(__msan_retval_tls, sizeof(__msan_retval_tls));
+  ClearTlsShadow(__msan_va_arg_tls, sizeof(__msan_va_arg_tls));
 
   if (__msan_get_track_origins()) {
-    internal_memset(&__msan_retval_origin_tls, 0,
-                    sizeof(__msan_retval_origin_tls));
-    internal_memset(__msan_param_origin_tls, 0,
-                    sizeof(__msan_param_origin_tls));
+    __msan_retval_origin_tls = 0;
+    ClearTlsShadow(__msan_param_origin_tls, sizeof(__msan_param_origin_tls));
   }
 }
 
@@ -294,6 +322,8 @@ const char *GetStackOriginDescr(u32 id, uptr *pc) {
   return StackOriginDescr[id];
 }
 
+static u32 ChainOriginSlow(u32 id, uptr pc, uptr bp);
+
 u32 ChainOrigin(u32 id, StackTrace *stack) {
   MsanThread *t = GetCurrentThread();
   if (t && t->InSignalHandler())
@@ -305,6 +335,32 @@ u32 ChainOrigin(u32 id, StackTrace *stack) {
   return chained.raw_id();
 }
 
+static u32 ChainOriginSlow(u32 id, uptr pc, uptr bp) {
+  GET_STORE_STACK_TRACE_PC_BP(pc, bp);
+  return ChainOrigin(id, &stack);
+}
+
+// ChainOrigin for a store at pc in the frame bp. A store that repeats, e.g.
+// in a loop, chains the same origin with the same stack, so the chained id
+// is cached per thread and reused without unwinding the stack again.
+static u32 ChainStoreOrigin(u32 id, uptr pc, uptr bp) {
+  MsanThread *t = GetCurrentThread();
+  if (!t || !msan_inited)
+    return ChainOriginSlow(id, pc, bp);
+  if (t->InSignalHandler())
+    return id;
+  MsanThread::ChainedOriginCacheEntry *e =
+      t->chained_origin_cache_entry(id, pc, bp);
+  if (e->pc == pc && e->bp == bp && e->prev_id == id)
+    return e->chained_id;
+  u32 chained_id = ChainOriginSlow(id, pc, bp);
+  e->pc = pc;
+  e->bp = bp;
+  e->prev_id = id;
+  e->chained_id = chained_id;
+  return chained_id;
+}
+
 } // namespace __msan
 
 // Interface.
@@ -335,8 +391,7 @@ MSAN_MAYBE_WARNING(u64, 8)
       if (__msan_get_track_origins() > 1) {                       \
         GET_CALLER_PC_BP_SP;                                      \
         (void) sp;                                                \
-        GET_STORE_STACK_TRACE_PC_BP(pc, bp);                      \
-        o = ChainOrigin(o, &stack);                               \
+        o = ChainStoreOrigin(o, pc, bp);                          \
       }                                                           \
       *(u32 *)MEM_TO_ORIGIN((uptr)p & ~3UL) = o;                  \
     }                                                             \
@@ -374,17 +429,21 @@ void __msan_init() {
   if (msan_inited) return;
   msan_init_is_running = 1;
   SanitizerToolName = "MemorySanitizer";
+  InitPhaseTimer timer;
 
   AvoidCVE_2016_2143();
   InitTlsSize();
 
   CacheBinaryName();
   InitializeFlags();
+  ChainedOriginDepotInit();
+  timer.EndPhase("flags");
 
   __sanitizer_set_report_path(common_flags()->log_path);
 
   InitializeInterceptors();
   InstallAtExitHandler(); // Needs __cxa_atexit interceptor.
+  timer.EndPhase("interceptors");
 
   DisableCoreDumperIfNecessary();
   if (StackSizeIsUnlimited()) {
@@ -407,14 +466,23 @@ void __msan_init() {
     DumpProcessMap();
     Die();
   }
+  timer.EndPhase("shadow memory");
 
-  Symbolizer::GetOrInit()->AddHooks(EnterSymbolizer, ExitSymbolizer);
+  Symbolizer::AddHooks(EnterSymbolizer, ExitSymbolizer);
+  // With lazy_init the symbolizer is set up by its first user.
+  if (!common_flags()->lazy_init)
+    Symbolizer::GetOrInit();
+  timer.EndPhase("symbolizer");
 
   InitializeCoverage(common_flags()->coverage, common_flags()->coverage_dir);
+  MaybePrintSelfProfileAtExit();
 
   MsanTSDInit(MsanTSDDtor);
 
   MsanAllocatorInit();
+  if (common_flags()->huge_pages_for_dense_shadow)
+    UseHugePagesForDenseShadow(__msan_get_track_origins());
+  timer.EndPhase("allocator");
 
   MsanThread *main_thread = MsanThread::Create(nullptr, nullptr);
   SetCurrentThread(main_thread);
@@ -424,6 +492,9 @@ void __msan_init() {
   __ubsan::InitAsPlugin();
 #endif
 
+  timer.EndPhase("main thread");
+  timer.Print();
+
   VPrintf(1, "MemorySanitizer init done\n");
 
   msan_init_is_running = 0;
@@ -485,9 +556,7 @@ void __msan_check_mem_is_initialized(const void *x, uptr size) {
 
   GET_CALLER_PC_BP_SP;
   (void)sp;
-  ReportUMRInsideAddressRange(__func__, x, size, offset);
-  __msan::PrintWarningWithOrigin(pc, bp,
-                                 __msan_get_origin(((const char *)x) + offset));
+  __msan::PrintWarningInsideAddressRange(pc, bp, __func__, x, size, offset);
   if (__msan::flags()->halt_on_error) {
     Printf("Exiting\n");
     Die();
@@ -559,8 +628,7 @@ void __msan_set_alloca_origin4(void *a, uptr size, char *descr, uptr pc) {
 u32 __msan_chain_origin(u32 id) {
   GET_CALLER_PC_BP_SP;
   (void)sp;
-  GET_STORE_STACK_TRACE_PC_BP(pc, bp);
-  return ChainOrigin(id, &stack);
+  return ChainStoreOrigin(id, pc, bp);
 }
 
 u32 __msan_get_origin(const void *a) {
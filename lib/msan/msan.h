@@ -275,10 +275,20 @@ extern int msan_report_count;
 
 bool ProtectRange(uptr beg, uptr end);
 bool InitShadow(bool init_origins);
+// Backs the shadow (and origins) of the heap and of the modules with huge
+// pages, see the huge_pages_for_dense_shadow flag. Must be called after
+// MsanAllocatorInit.
+void UseHugePagesForDenseShadow(bool init_origins);
+// Maps poisoned shadow copy-on-write over [shadow_beg, shadow_beg + size).
+// Both must be page-aligned. Returns false if that is not supported.
+bool MapPoisonedShadow(uptr shadow_beg, uptr size);
 char *GetProcSelfMaps();
 void InitializeInterceptors();
 
 void MsanAllocatorInit();
+// Returns the range of the address space the heap is allocated from, or an
+// empty one if the allocator doesn't use a fixed range.
+void MsanGetHeapRange(uptr *beg, uptr *end);
 void MsanAllocatorThreadFinish();
 void *MsanCalloc(StackTrace *stack, uptr nmemb, uptr size);
 void *MsanReallocate(StackTrace *stack, void *oldp, uptr size,
@@ -300,6 +310,9 @@ struct SymbolizerScope {
 
 void PrintWarning(uptr pc, uptr bp);
 void PrintWarningWithOrigin(uptr pc, uptr bp, u32 origin);
+// Like PrintWarningWithOrigin, for the uninitialized byte at start + offset.
+void PrintWarningInsideAddressRange(uptr pc, uptr bp, const char *what,
+                                    const void *start, uptr size, uptr offset);
 
 void GetStackTrace(BufferedStackTrace *stack, uptr max_s, uptr pc, uptr bp,
                    bool request_fast_unwind);
@@ -311,6 +324,9 @@ void ReportAtExitStatistics();
 void DescribeMemoryRange(const void *x, uptr size);
 void ReportUMRInsideAddressRange(const char *what, const void *start, uptr size,
                                  uptr offset);
+// With suppress_equal_reports, counts the warnings at pc with the given origin
+// and returns true for all but the first one.
+bool IsDuplicateUMR(uptr pc, u32 origin);
 
 // Unpoison first n function arguments.
 void UnpoisonParam(uptr n);
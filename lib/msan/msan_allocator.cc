@@ -29,12 +29,19 @@ struct Metadata {
 struct MsanMapUnmapCallback {
   void OnMap(uptr p, uptr size) const {}
   void OnUnmap(uptr p, uptr size) const {
-    __msan_unpoison((void *)p, size);
-
-    // We are about to unmap a chunk of user memory.
-    // Mark the corresponding shadow memory as not needed.
     uptr shadow_p = MEM_TO_SHADOW(p);
-    ReleaseMemoryPagesToOS(shadow_p, shadow_p + size);
+    if (flags()->lazy_malloc_poison_limit_mb > 0 &&
+        IsAligned(shadow_p | size, GetPageSizeCached())) {
+      // The shadow may be mapped from the poisoned shadow file, which
+      // releasing the pages would bring back. Map fresh zero pages instead.
+      MmapFixedNoReserve(shadow_p, size);
+    } else {
+      __msan_unpoison((void *)p, size);
+
+      // We are about to unmap a chunk of user memory.
+      // Mark the corresponding shadow memory as not needed.
+      ReleaseMemoryPagesToOS(shadow_p, shadow_p + size);
+    }
     if (__msan_get_track_origins()) {
       uptr origin_p = MEM_TO_ORIGIN(p);
       ReleaseMemoryPagesToOS(origin_p, origin_p + size);
@@ -67,7 +74,7 @@ struct MsanMapUnmapCallback {
     static const uptr kMetadataSize = sizeof(Metadata);
     typedef DefaultSizeClassMap SizeClassMap;
     typedef MsanMapUnmapCallback MapUnmapCallback;
-    static const uptr kFlags = 0;
+    static const uptr kFlags = kToolAllocator64Flags;
   };
 
   typedef SizeClassAllocator64<AP64> PrimaryAllocator;
@@ -81,7 +88,7 @@ struct MsanMapUnmapCallback {
     static const uptr kMetadataSize = sizeof(Metadata);
     typedef DefaultSizeClassMap SizeClassMap;
     typedef MsanMapUnmapCallback MapUnmapCallback;
-    static const uptr kFlags = 0;
+    static const uptr kFlags = kToolAllocator64Flags;
   };
 
   typedef SizeClassAllocator64<AP64> PrimaryAllocator;
@@ -109,6 +116,16 @@ void MsanAllocatorInit() {
   allocator.Init(
       common_flags()->allocator_may_return_null,
       common_flags()->allocator_release_to_os_interval_ms);
+  allocator.SetSizeProfile(GetAllocatorSizeProfile());
+  allocator.SetSecondaryCacheParams(
+      static_cast<uptr>(common_flags()->allocator_secondary_cache_size_mb)
+          << 20,
+      common_flags()->allocator_secondary_cache_decay_ms);
+  MaybeWriteAllocatorSizeProfileAtExit();
+}
+
+void MsanGetHeapRange(uptr *beg, uptr *end) {
+  allocator.GetPrimarySpaceRange(beg, end);
 }
 
 AllocatorCache *GetAllocatorCache(MsanThreadLocalMallocStorage *ms) {
@@ -121,6 +138,18 @@ void MsanThreadLocalMallocStorage::CommitBack() {
   allocator.SwallowCache(GetAllocatorCache(this));
 }
 
+// Chunks of the secondary allocator are freshly mapped (or cleared as if they
+// were), and so is their shadow, which OnUnmap() resets. Large ones get their
+// poisoned shadow mapped rather than written.
+static bool PoisonSecondaryChunkLazily(void *p, uptr size) {
+  uptr limit = (uptr)flags()->lazy_malloc_poison_limit_mb << 20;
+  if (flags()->poison_heap_with_zeroes || size > limit ||
+      size < common_flags()->clear_shadow_mmap_threshold)
+    return false;
+  return MapPoisonedShadow(MEM_TO_SHADOW(p),
+                           RoundUpTo(size, GetPageSizeCached()));
+}
+
 static void *MsanAllocate(StackTrace *stack, uptr size, uptr alignment,
                           bool zeroise) {
   if (size > kMaxAllowedMallocSize) {
@@ -141,10 +170,15 @@ static void *MsanAllocate(StackTrace *stack, uptr size, uptr alignment,
   Metadata *meta =
       reinterpret_cast<Metadata *>(allocator.GetMetaData(allocated));
   meta->requested_size = size;
+  bool from_primary = allocator.FromPrimary(allocated);
   if (zeroise) {
-    __msan_clear_and_unpoison(allocated, size);
+    if (!allocator.ChunkIsZero(allocated))
+      __msan_clear_and_unpoison(allocated, size);
+    else
+      __msan_unpoison(allocated, size);
   } else if (flags()->poison_in_malloc) {
-    __msan_poison(allocated, size);
+    if (from_primary || !PoisonSecondaryChunkLazily(allocated, size))
+      __msan_poison(allocated, size);
     if (__msan_get_track_origins()) {
       stack->tag = StackTrace::TAG_ALLOC;
       Origin o = Origin::CreateHeapOrigin(stack);
@@ -162,8 +196,8 @@ void MsanDeallocate(StackTrace *stack, void *p) {
   uptr size = meta->requested_size;
   meta->requested_size = 0;
   // This memory will not be reused by anyone else, so we are free to keep it
-  // poisoned.
-  if (flags()->poison_in_free) {
+  // poisoned. The secondary allocator unmaps (or unpoisons) it right away.
+  if (flags()->poison_in_free && allocator.FromPrimary(p)) {
     __msan_poison(p, size);
     if (__msan_get_track_origins()) {
       stack->tag = StackTrace::TAG_DEALLOC;
@@ -256,3 +290,10 @@ uptr __sanitizer_get_estimated_allocated_size(uptr size) { return size; }
 int __sanitizer_get_ownership(const void *p) { return AllocationSize(p) != 0; }
 
 uptr __sanitizer_get_allocated_size(const void *p) { return AllocationSize(p); }
+
+uptr __sanitizer_get_allocator_histogram(AllocatorClassStats *stats,
+                                         uptr max_classes) {
+  return allocator.GetHistogram(stats, max_classes);
+}
+
+void __sanitizer_print_allocator_histogram() { allocator.PrintHistogram(); }
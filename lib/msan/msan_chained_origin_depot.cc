@@ -12,6 +12,7 @@
 
 #include "msan_chained_origin_depot.h"
 
+#include "msan_flags.h"
 #include "sanitizer_common/sanitizer_stackdepotbase.h"
 
 namespace __msan {
@@ -100,13 +101,129 @@ struct ChainedOriginDepotNode {
   typedef Handle handle_type;
 };
 
-static StackDepotBase<ChainedOriginDepotNode, 4, 20> chainedOriginDepot;
+// The top bits of chained origin ids hold the depth.
+static const int kChainedIdReservedBits = 4;
+static const u32 kChainedIdMask = ((u32)-1) >> kChainedIdReservedBits;
+
+static StackDepotBase<ChainedOriginDepotNode, kChainedIdReservedBits, 20>
+    chainedOriginDepot;
+
+// With origin_history_memory_limit_mb, histories are stored in a fixed table
+// instead, which new histories overwrite in a circle: the slot of an id is its
+// low bits, so a history is evicted once as many newer ones were added as the
+// table has slots. Readers don't take locks; the id of a slot is cleared while
+// it is rewritten, seqlock-style, and checked again after reading it. An
+// index of the last history added for each hash value keeps most duplicates
+// out of the table.
+struct BoundedDepotEntry {
+  atomic_uint32_t id;
+  atomic_uint32_t here_id;
+  atomic_uint32_t prev_id;
+};
+
+class BoundedChainedOriginDepot {
+ public:
+  bool enabled() const { return entries_ != nullptr; }
+
+  void Init(uptr memory_limit) {
+    uptr size_log = kMinSizeLog;
+    while (size_log < kMaxSizeLog &&
+           (2ULL << size_log) * kBytesPerEntry <= memory_limit)
+      size_log++;
+    size_ = 1ULL << size_log;
+    entries_ = (BoundedDepotEntry *)MmapNoReserveOrDie(
+        size_ * sizeof(entries_[0]), "ChainedOriginDepot entries");
+    index_ = (atomic_uint32_t *)MmapNoReserveOrDie(
+        size_ * sizeof(index_[0]), "ChainedOriginDepot index");
+  }
+
+  bool Get(u32 id, u32 *here_id, u32 *prev_id) {
+    BoundedDepotEntry *entry = &entries_[id & (size_ - 1)];
+    if (atomic_load(&entry->id, memory_order_acquire) != id)
+      return false;
+    *here_id = atomic_load(&entry->here_id, memory_order_relaxed);
+    *prev_id = atomic_load(&entry->prev_id, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load(&entry->id, memory_order_relaxed) == id;
+  }
+
+  bool Put(u32 here_id, u32 prev_id, u32 *new_id) {
+    ChainedOriginDepotDesc desc = {here_id, prev_id};
+    atomic_uint32_t *index =
+        &index_[ChainedOriginDepotNode::hash(desc) & (size_ - 1)];
+    u32 id = atomic_load(index, memory_order_relaxed);
+    u32 old_here_id, old_prev_id;
+    if (id && Get(id, &old_here_id, &old_prev_id) && old_here_id == here_id &&
+        old_prev_id == prev_id) {
+      *new_id = id;
+      return false;
+    }
+    do {
+      id = (atomic_fetch_add(&next_id_, 1, memory_order_relaxed) + 1) &
+           kChainedIdMask;
+    } while (!id);
+    BoundedDepotEntry *entry = &entries_[id & (size_ - 1)];
+    atomic_store(&entry->id, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store(&entry->here_id, here_id, memory_order_relaxed);
+    atomic_store(&entry->prev_id, prev_id, memory_order_relaxed);
+    atomic_store(&entry->id, id, memory_order_release);
+    atomic_store(index, id, memory_order_relaxed);
+    atomic_fetch_add(&n_added_, 1, memory_order_relaxed);
+    *new_id = id;
+    return true;
+  }
+
+  StackDepotStats *GetStats() {
+    stats_.n_uniq_ids = Min(n_added(), size_);
+    stats_.allocated = size_ * kBytesPerEntry;
+    thePersistentAllocator.getStats(&stats_.persistent_mapped,
+                                    &stats_.persistent_wasted);
+    return &stats_;
+  }
+
+  uptr evicted() { return n_added() > size_ ? n_added() - size_ : 0; }
+
+ private:
+  uptr n_added() { return atomic_load(&n_added_, memory_order_relaxed); }
+
+  static const uptr kBytesPerEntry =
+      sizeof(BoundedDepotEntry) + sizeof(atomic_uint32_t);
+  static const uptr kMinSizeLog = 12;
+  // Leave at least one bit of the ids to tell the generations apart.
+  static const uptr kMaxSizeLog = 32 - kChainedIdReservedBits - 1;
+
+  BoundedDepotEntry *entries_;
+  atomic_uint32_t *index_;
+  uptr size_;
+  atomic_uint32_t next_id_;
+  atomic_uintptr_t n_added_;
+  StackDepotStats stats_;
+};
+
+static BoundedChainedOriginDepot boundedChainedOriginDepot;
+
+void ChainedOriginDepotInit() {
+  if (flags()->origin_history_memory_limit_mb > 0)
+    boundedChainedOriginDepot.Init(
+        (uptr)flags()->origin_history_memory_limit_mb << 20);
+}
 
 StackDepotStats *ChainedOriginDepotGetStats() {
+  if (boundedChainedOriginDepot.enabled())
+    return boundedChainedOriginDepot.GetStats();
   return chainedOriginDepot.GetStats();
 }
 
+uptr ChainedOriginDepotGetEvictedCount() {
+  if (boundedChainedOriginDepot.enabled())
+    return boundedChainedOriginDepot.evicted();
+  return 0;
+}
+
 bool ChainedOriginDepotPut(u32 here_id, u32 prev_id, u32 *new_id) {
+  if (boundedChainedOriginDepot.enabled())
+    return boundedChainedOriginDepot.Put(here_id, prev_id, new_id);
   ChainedOriginDepotDesc desc = {here_id, prev_id};
   bool inserted;
   ChainedOriginDepotNode::Handle h = chainedOriginDepot.Put(desc, &inserted);
@@ -116,6 +233,14 @@ bool ChainedOriginDepotPut(u32 here_id, u32 prev_id, u32 *new_id) {
 
 // Retrieves a stored stack trace by the id.
 u32 ChainedOriginDepotGet(u32 id, u32 *other) {
+  if (boundedChainedOriginDepot.enabled()) {
+    u32 here_id;
+    if (!boundedChainedOriginDepot.Get(id, &here_id, other)) {
+      *other = 0;
+      return 0;
+    }
+    return here_id;
+  }
   ChainedOriginDepotDesc desc = chainedOriginDepot.Get(id);
   *other = desc.prev_id;
   return desc.here_id;
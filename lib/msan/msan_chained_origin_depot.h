@@ -16,9 +16,14 @@
 
 namespace __msan {
 
+// Sets up the bounded depot if origin_history_memory_limit_mb is set.
+void ChainedOriginDepotInit();
 StackDepotStats *ChainedOriginDepotGetStats();
+// Number of histories overwritten by newer ones in the bounded depot.
+uptr ChainedOriginDepotGetEvictedCount();
 bool ChainedOriginDepotPut(u32 here_id, u32 prev_id, u32 *new_id);
-// Retrieves a stored stack trace by the id.
+// Retrieves a stored stack trace by the id. Returns 0 if the history was
+// evicted.
 u32 ChainedOriginDepotGet(u32 id, u32 *other);
 
 void ChainedOriginDepotLockAll();
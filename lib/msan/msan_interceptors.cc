@@ -99,9 +99,7 @@ static void *AllocateFromLocalPool(uptr size_in_bytes) {
     if (offset >= 0 && __msan::flags()->report_umrs) {                         \
       GET_CALLER_PC_BP_SP;                                                     \
       (void) sp;                                                               \
-      ReportUMRInsideAddressRange(__func__, x, n, offset);                     \
-      __msan::PrintWarningWithOrigin(                                          \
-          pc, bp, __msan_get_origin((const char *)x + offset));                \
+      __msan::PrintWarningInsideAddressRange(pc, bp, __func__, x, n, offset);  \
       if (__msan::flags()->halt_on_error) {                                    \
         Printf("Exiting\n");                                                   \
         Die();                                                                 \
@@ -1312,6 +1310,11 @@ int OnExit() {
   CHECK_UNPOISONED_CTX(ctx, ptr, size)
 #define COMMON_INTERCEPTOR_INITIALIZE_RANGE(ptr, size) \
   __msan_unpoison(ptr, size)
+// errno is application memory, and interceptors are entered often enough for
+// the checks and the memset() of __msan_unpoison() to show.
+static inline void UnpoisonErrno() {
+  *(u32 *)MEM_TO_SHADOW((uptr)__errno_location()) = 0; /* NOLINT */
+}
 #define COMMON_INTERCEPTOR_ENTER(ctx, func, ...)                  \
   if (msan_init_is_running) return REAL(func)(__VA_ARGS__);       \
   ENSURE_MSAN_INITED();                                           \
@@ -1319,7 +1322,7 @@ int OnExit() {
   ctx = (void *)&msan_ctx;                                        \
   (void)ctx;                                                      \
   InterceptorScope interceptor_scope;                             \
-  __msan_unpoison(__errno_location(), sizeof(int)); /* NOLINT */
+  UnpoisonErrno();
 #define COMMON_INTERCEPTOR_DIR_ACQUIRE(ctx, path) \
   do {                                            \
   } while (false)
@@ -27,10 +27,14 @@
 #include <unistd.h>
 #include <unwind.h>
 #include <execinfo.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "sanitizer_common/sanitizer_posix.h"
 #include "sanitizer_common/sanitizer_procmaps.h"
 
 namespace __msan {
@@ -158,6 +162,22 @@ bool InitShadow(bool init_origins) {
   return true;
 }
 
+static uptr MemToShadowForHugePages(uptr p) { return MEM_TO_SHADOW(p); }
+static uptr MemToOriginForHugePages(uptr p) { return MEM_TO_ORIGIN(p); }
+
+void UseHugePagesForDenseShadow(bool init_origins) {
+  uptr heap_beg, heap_end;
+  MsanGetHeapRange(&heap_beg, &heap_end);
+  if (heap_beg < heap_end) {
+    UseHugePagesInRegion(MEM_TO_SHADOW(heap_beg), heap_end - heap_beg);
+    if (init_origins)
+      UseHugePagesInRegion(MEM_TO_ORIGIN(heap_beg), heap_end - heap_beg);
+  }
+  UseHugePagesForModulesShadow(MemToShadowForHugePages);
+  if (init_origins)
+    UseHugePagesForModulesShadow(MemToOriginForHugePages);
+}
+
 static void MsanAtExit(void) {
   if (flags()->print_stats && (flags()->atexit || msan_report_count > 0))
     ReportStats();
@@ -211,6 +231,54 @@ void MsanTSDDtor(void *tsd) {
   MsanThread::TSDDtor(tsd);
 }
 
+// A memfd filled with poisoned shadow. Mapped privately over the shadow of an
+// allocation, it poisons it with a single mmap(); only the pages later
+// written to are copied. It grows to the largest shadow mapped from it.
+static StaticSpinMutex poisoned_shadow_mutex;
+static fd_t poisoned_shadow_fd = kInvalidFd;
+static uptr poisoned_shadow_size;
+static bool poisoned_shadow_failed;
+
+// Must be called with poisoned_shadow_mutex held.
+static bool GrowPoisonedShadowFile(uptr size) {
+  if (size <= poisoned_shadow_size) return true;
+#if SANITIZER_LINUX && defined(SYS_memfd_create)
+  if (poisoned_shadow_fd == kInvalidFd) {
+    int fd = syscall(SYS_memfd_create, "msan poisoned shadow", 0);
+    if (fd < 0) return false;
+    poisoned_shadow_fd = fd;
+  }
+  if (internal_ftruncate(poisoned_shadow_fd, size)) return false;
+  uptr grown = size - poisoned_shadow_size;
+  uptr p = internal_mmap(nullptr, grown, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         poisoned_shadow_fd, poisoned_shadow_size);
+  if (internal_iserror(p)) return false;
+  internal_memset((void *)p, -1, grown);
+  internal_munmap((void *)p, grown);
+  poisoned_shadow_size = size;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool MapPoisonedShadow(uptr shadow_beg, uptr size) {
+  CHECK(IsAligned(shadow_beg, GetPageSizeCached()));
+  CHECK(IsAligned(size, GetPageSizeCached()));
+  SpinMutexLock l(&poisoned_shadow_mutex);
+  if (poisoned_shadow_failed) return false;
+  if (!GrowPoisonedShadowFile(size)) {
+    VReport(1, "MemorySanitizer: failed to create the poisoned shadow file; "
+               "poisoning large allocations with memset()\n");
+    poisoned_shadow_failed = true;
+    return false;
+  }
+  uptr p = internal_mmap((void *)shadow_beg, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE,
+                         poisoned_shadow_fd, 0);
+  return !internal_iserror(p);
+}
+
 } // namespace __msan
 
 #endif // SANITIZER_FREEBSD || SANITIZER_LINUX
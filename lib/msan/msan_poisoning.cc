@@ -40,6 +40,17 @@ void SetOriginIfPoisoned(uptr addr, uptr src_shadow, uptr size,
     if (*(u8 *)src_s) *(u32 *)SHADOW_TO_ORIGIN(dst_s & ~3UL) = src_origin;
 }
 
+// Origins are copied in chunks of this many 4-byte granules. Chunks of
+// initialized memory are skipped after a check that compiles to a few vector
+// loads and ORs; most of the memory copied by large memcpy()s is initialized.
+static const uptr kOriginChunkSize = 16;
+
+static bool IsChunkInitialized(const u32 *shadow) {
+  u32 acc = 0;
+  for (uptr i = 0; i < kOriginChunkSize; ++i) acc |= shadow[i];
+  return acc == 0;
+}
+
 void CopyOrigin(const void *dst, const void *src, uptr size,
                 StackTrace *stack) {
   if (!MEM_IS_APP(dst) || !MEM_IS_APP(src)) return;
@@ -80,13 +91,23 @@ void CopyOrigin(const void *dst, const void *src, uptr size,
       u32 *dst = (u32 *)MEM_TO_ORIGIN(beg);
       u32 src_o = 0;
       u32 dst_o = 0;
-      for (; src < src_end; ++src, ++src_s, ++dst) {
-        if (!*src_s) continue;
-        if (*src != src_o) {
-          src_o = *src;
-          dst_o = ChainOrigin(src_o, stack);
+      while (src < src_end) {
+        uptr n = Min((uptr)(src_end - src), kOriginChunkSize);
+        if (n == kOriginChunkSize && IsChunkInitialized(src_s)) {
+          src += n;
+          src_s += n;
+          dst += n;
+          continue;
+        }
+        u32 *chunk_end = src + n;
+        for (; src < chunk_end; ++src, ++src_s, ++dst) {
+          if (!*src_s) continue;
+          if (*src != src_o) {
+            src_o = *src;
+            dst_o = ChainOrigin(src_o, stack);
+          }
+          *dst = dst_o;
         }
-        *dst = dst_o;
       }
     } else {
       REAL(memcpy)((void *)MEM_TO_ORIGIN(beg), (void *)MEM_TO_ORIGIN(s),
@@ -140,6 +161,11 @@ void SetShadow(const void *ptr, uptr size, u8 value) {
         REAL(memset)((void *)page_end, 0, shadow_end - page_end);
       }
       MmapFixedNoReserve(page_beg, page_end - page_beg);
+      // Origins are only read for poisoned memory, and are written again when
+      // it gets poisoned, so those of initialized pages can go as well.
+      if (__msan_get_track_origins())
+        ReleaseMemoryPagesToOS(SHADOW_TO_ORIGIN(page_beg),
+                               SHADOW_TO_ORIGIN(page_end));
     }
   }
 }
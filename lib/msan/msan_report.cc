@@ -65,6 +65,11 @@ static void DescribeOrigin(u32 id) {
   while (o.isChainedOrigin()) {
     StackTrace stack;
     o = o.getNextChainedOrigin(&stack);
+    if (!o.raw_id() && !stack.size) {
+      Printf("  %sThe rest of the origin history was evicted%s\n", d.Origin(),
+             d.End());
+      return;
+    }
     Printf("  %sUninitialized value was stored to memory at%s\n", d.Origin(),
         d.End());
     stack.Print();
@@ -96,6 +101,63 @@ static void DescribeOrigin(u32 id) {
   }
 }
 
+// The sites of uninitialized value uses, for suppress_equal_reports: an open
+// addressing hash table, which stops taking new sites when 3/4 full.
+struct UMRSite {
+  uptr pc;
+  u32 origin;
+  u32 count;
+};
+
+static const uptr kUMRSitesSize = 1 << 12;
+static UMRSite umr_sites[kUMRSitesSize];
+static uptr num_umr_sites;
+static StaticSpinMutex umr_sites_mutex;
+
+bool IsDuplicateUMR(uptr pc, u32 origin) {
+  if (!flags()->suppress_equal_reports) return false;
+  SpinMutexLock l(&umr_sites_mutex);
+  uptr h = (pc ^ (pc >> 16) ^ (origin * 0x9e3779b1U)) & (kUMRSitesSize - 1);
+  for (;; h = (h + 1) & (kUMRSitesSize - 1)) {
+    UMRSite *site = &umr_sites[h];
+    if (!site->count) {
+      if (num_umr_sites >= kUMRSitesSize / 4 * 3) return false;
+      num_umr_sites++;
+      site->pc = pc;
+      site->origin = origin;
+      site->count = 1;
+      return false;
+    }
+    if (site->pc == pc && site->origin == origin) {
+      site->count++;
+      return true;
+    }
+  }
+}
+
+static bool CompareUMRSitesByCount(const UMRSite &a, const UMRSite &b) {
+  return a.count > b.count;
+}
+
+// Prints the sites reported more than once, most often reported first.
+static void PrintRepeatedUMRSites() {
+  InternalMmapVector<UMRSite> repeated(num_umr_sites);
+  {
+    SpinMutexLock l(&umr_sites_mutex);
+    for (uptr i = 0; i < kUMRSitesSize; ++i)
+      if (umr_sites[i].count > 1) repeated.push_back(umr_sites[i]);
+  }
+  if (!repeated.size()) return;
+  InternalSort(&repeated, repeated.size(), CompareUMRSitesByCount);
+  Printf("MemorySanitizer: %zu unique warning sites, %zu of them repeated:\n",
+         num_umr_sites, repeated.size());
+  for (uptr i = 0; i < repeated.size(); ++i) {
+    Printf("  %u warnings with origin %x at\n", repeated[i].count,
+           repeated[i].origin);
+    StackTrace(&repeated[i].pc, 1).Print();
+  }
+}
+
 void ReportUMR(StackTrace *stack, u32 origin) {
   if (!__msan::flags()->report_umrs) return;
 
@@ -127,13 +189,20 @@ void ReportStats() {
     // FIXME: we want this at normal exit, too!
     // FIXME: but only with verbosity=1 or something
     Printf("Unique heap origins: %zu\n", stack_depot_stats->n_uniq_ids);
-    Printf("Stack depot allocated bytes: %zu\n", stack_depot_stats->allocated);
+    Printf("Stack depot allocated bytes: %zu, uncompressed bytes: %zu\n",
+           stack_depot_stats->allocated, stack_depot_stats->uncompressed);
+    Printf("Persistent allocator mapped bytes: %zu, wasted bytes: %zu\n",
+           stack_depot_stats->persistent_mapped,
+           stack_depot_stats->persistent_wasted);
 
     StackDepotStats *chained_origin_depot_stats = ChainedOriginDepotGetStats();
     Printf("Unique origin histories: %zu\n",
            chained_origin_depot_stats->n_uniq_ids);
     Printf("History depot allocated bytes: %zu\n",
            chained_origin_depot_stats->allocated);
+    if (flags()->origin_history_memory_limit_mb > 0)
+      Printf("Evicted origin histories: %zu\n",
+             ChainedOriginDepotGetEvictedCount());
   }
 }
 
@@ -145,6 +214,8 @@ void ReportAtExitStatistics() {
     Printf("%s", d.Warning());
     Printf("MemorySanitizer: %d warnings reported.\n", msan_report_count);
     Printf("%s", d.End());
+    if (flags()->suppress_equal_reports)
+      PrintRepeatedUMRSites();
   }
 }
 
@@ -0,0 +1,255 @@
+//===-- msan_snapshot.cc --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of MemorySanitizer.
+//
+// Snapshots of the shadow and origins, for in-process persistent fuzzing.
+//
+// Taking a snapshot saves the shadow and origin pages of the mapped
+// application memory that are not zero, and clears the soft-dirty bits of the
+// process (see Documentation/vm/soft-dirty.txt in the Linux sources).
+// Restoring it copies the saved pages back over the ones written since, and
+// releases the other written pages, which were zero. Only the pagemap entries
+// for the shadow of mapped application memory are read.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_common/sanitizer_platform.h"
+#if SANITIZER_LINUX
+
+#include "interception/interception.h"
+#include "msan.h"
+#include "msan_interface_internal.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "sanitizer_common/sanitizer_posix.h"
+#include "sanitizer_common/sanitizer_procmaps.h"
+
+#include <unistd.h>
+
+DECLARE_REAL(void *, memcpy, void *dest, const void *src, uptr n)
+
+namespace __msan {
+
+static const u64 kPagemapSoftDirty = 1ULL << 55;
+static const u64 kPagemapSwapped = 1ULL << 62;
+static const u64 kPagemapPresent = 1ULL << 63;
+// Pagemap entries are read this many at a time.
+static const uptr kPagemapBatch = 512;
+
+struct ShadowRange {
+  uptr beg;
+  uptr end;
+};
+
+struct SavedPage {
+  uptr addr;
+  uptr index;
+};
+
+static BlockingMutex snapshot_mutex(LINKER_INITIALIZED);
+static bool snapshot_taken;
+// Sorted by address; index is the position of the copy in saved_data.
+static InternalMmapVectorNoCtor<SavedPage> saved_pages;
+static u8 *saved_data;
+static uptr saved_data_size;
+static u64 pagemap_batch[kPagemapBatch];
+
+static bool CompareSavedPages(const SavedPage &a, const SavedPage &b) {
+  return a.addr < b.addr;
+}
+
+// The shadow, and the origins if they are tracked, of the mapped application
+// memory.
+static void GetShadowRanges(InternalMmapVector<ShadowRange> *ranges) {
+  uptr page_size = GetPageSizeCached();
+  MemoryMappingLayout proc_maps(/*cache_enabled*/false);
+  uptr start, end;
+  while (proc_maps.Next(&start, &end, nullptr, nullptr, 0, nullptr)) {
+    for (uptr i = 0; i < kMemoryLayoutSize; ++i) {
+      if (kMemoryLayout[i].type != MappingDesc::APP) continue;
+      uptr beg = Max(start, kMemoryLayout[i].start);
+      uptr app_end = Min(end, kMemoryLayout[i].end);
+      if (beg >= app_end) continue;
+      ShadowRange shadow = {RoundDownTo(MEM_TO_SHADOW(beg), page_size),
+                            RoundUpTo(MEM_TO_SHADOW(app_end - 1) + 1,
+                                      page_size)};
+      ranges->push_back(shadow);
+      if (__msan_get_track_origins()) {
+        ShadowRange origin = {SHADOW_TO_ORIGIN(shadow.beg),
+                              SHADOW_TO_ORIGIN(shadow.end)};
+        ranges->push_back(origin);
+      }
+    }
+  }
+}
+
+// Reads the pagemap entries of n pages starting at addr into pagemap_batch.
+static bool ReadPagemap(fd_t fd, uptr addr, uptr n) {
+  uptr offset = addr / GetPageSizeCached() * sizeof(u64);
+  uptr size = n * sizeof(u64), read = 0;
+  if (internal_lseek(fd, offset, SEEK_SET) != offset ||
+      !ReadFromFile(fd, pagemap_batch, size, &read) || read != size) {
+    Report("WARNING: MemorySanitizer: failed to read /proc/self/pagemap\n");
+    return false;
+  }
+  return true;
+}
+
+static bool IsZeroPage(uptr addr) {
+  const u64 *p = (const u64 *)addr;
+  for (uptr i = 0; i < GetPageSizeCached() / sizeof(u64); ++i)
+    if (p[i]) return false;
+  return true;
+}
+
+static bool ClearSoftDirty() {
+  fd_t fd = OpenFile("/proc/self/clear_refs", WrOnly);
+  if (fd == kInvalidFd) return false;
+  bool res = WriteToFile(fd, "4", 1);
+  CloseFile(fd);
+  return res;
+}
+
+// Checks once that written pages get marked soft-dirty.
+static bool SoftDirtyWorks(fd_t pagemap_fd) {
+  static int works = -1;
+  if (works >= 0) return works;
+  uptr page_size = GetPageSizeCached();
+  volatile u8 *probe = (volatile u8 *)MmapOrDie(page_size, "msan snapshot");
+  *probe = 1;
+  works = ClearSoftDirty() && ReadPagemap(pagemap_fd, (uptr)probe, 1) &&
+          !(pagemap_batch[0] & kPagemapSoftDirty);
+  *probe = 2;
+  works = works && ReadPagemap(pagemap_fd, (uptr)probe, 1) &&
+          (pagemap_batch[0] & kPagemapSoftDirty);
+  UnmapOrDie((void *)probe, page_size);
+  if (!works)
+    Report("WARNING: MemorySanitizer: shadow snapshots need soft-dirty page "
+           "tracking (CONFIG_MEM_SOFT_DIRTY)\n");
+  return works;
+}
+
+static void DropSnapshot() {
+  if (saved_data) UnmapOrDie(saved_data, saved_data_size);
+  saved_data = nullptr;
+  saved_data_size = 0;
+  saved_pages.clear();
+  snapshot_taken = false;
+}
+
+static bool TakeSnapshot(fd_t fd) {
+  uptr page_size = GetPageSizeCached();
+  InternalMmapVector<ShadowRange> ranges(16);
+  GetShadowRanges(&ranges);
+  for (uptr r = 0; r < ranges.size(); ++r) {
+    for (uptr beg = ranges[r].beg; beg < ranges[r].end;
+         beg += kPagemapBatch * page_size) {
+      uptr n = Min(kPagemapBatch, (ranges[r].end - beg) / page_size);
+      if (!ReadPagemap(fd, beg, n)) return false;
+      for (uptr i = 0; i < n; ++i) {
+        uptr page = beg + i * page_size;
+        if ((pagemap_batch[i] & (kPagemapPresent | kPagemapSwapped)) &&
+            !IsZeroPage(page)) {
+          SavedPage saved = {page, 0};
+          saved_pages.push_back(saved);
+        }
+      }
+    }
+  }
+  InternalSort(&saved_pages, saved_pages.size(), CompareSavedPages);
+  if (saved_pages.size()) {
+    saved_data_size = saved_pages.size() * page_size;
+    saved_data = (u8 *)MmapOrDie(saved_data_size, "msan shadow snapshot");
+  }
+  for (uptr i = 0; i < saved_pages.size(); ++i) {
+    saved_pages[i].index = i;
+    REAL(memcpy)(saved_data + i * page_size, (void *)saved_pages[i].addr,
+                 page_size);
+  }
+  return ClearSoftDirty();
+}
+
+static const SavedPage *FindSavedPage(uptr addr) {
+  SavedPage key = {addr, 0};
+  uptr i = InternalLowerBound(saved_pages, 0, saved_pages.size(), key,
+                              CompareSavedPages);
+  if (i < saved_pages.size() && saved_pages[i].addr == addr)
+    return &saved_pages[i];
+  return nullptr;
+}
+
+static bool RestoreSnapshot(fd_t fd) {
+  uptr page_size = GetPageSizeCached();
+  InternalMmapVector<ShadowRange> ranges(16);
+  GetShadowRanges(&ranges);
+  for (uptr r = 0; r < ranges.size(); ++r) {
+    // Written pages which were zero are released in runs.
+    uptr release_beg = 0, release_end = 0;
+    for (uptr beg = ranges[r].beg; beg < ranges[r].end;
+         beg += kPagemapBatch * page_size) {
+      uptr n = Min(kPagemapBatch, (ranges[r].end - beg) / page_size);
+      if (!ReadPagemap(fd, beg, n)) return false;
+      for (uptr i = 0; i < n; ++i) {
+        if (!(pagemap_batch[i] & kPagemapSoftDirty)) continue;
+        uptr page = beg + i * page_size;
+        if (const SavedPage *saved = FindSavedPage(page)) {
+          REAL(memcpy)((void *)page, saved_data + saved->index * page_size,
+                       page_size);
+          continue;
+        }
+        if (page != release_end) {
+          ReleaseMemoryPagesToOS(release_beg, release_end);
+          release_beg = page;
+        }
+        release_end = page + page_size;
+      }
+    }
+    ReleaseMemoryPagesToOS(release_beg, release_end);
+  }
+  return ClearSoftDirty();
+}
+
+}  // namespace __msan
+
+using namespace __msan;
+
+int __msan_take_shadow_snapshot() {
+  BlockingMutexLock l(&snapshot_mutex);
+  DropSnapshot();
+  fd_t fd = OpenFile("/proc/self/pagemap", RdOnly);
+  if (fd == kInvalidFd) {
+    Report("WARNING: MemorySanitizer: failed to open /proc/self/pagemap\n");
+    return -1;
+  }
+  if (!saved_pages.capacity()) saved_pages.Initialize(0);
+  snapshot_taken = SoftDirtyWorks(fd) && TakeSnapshot(fd);
+  CloseFile(fd);
+  if (!snapshot_taken) {
+    DropSnapshot();
+    return -1;
+  }
+  return 0;
+}
+
+int __msan_restore_shadow_snapshot() {
+  BlockingMutexLock l(&snapshot_mutex);
+  if (!snapshot_taken) return -1;
+  fd_t fd = OpenFile("/proc/self/pagemap", RdOnly);
+  if (fd == kInvalidFd) return -1;
+  bool res = RestoreSnapshot(fd);
+  CloseFile(fd);
+  return res ? 0 : -1;
+}
+
+#else  // SANITIZER_LINUX
+
+int __msan_take_shadow_snapshot() { return -1; }
+int __msan_restore_shadow_snapshot() { return -1; }
+
+#endif  // SANITIZER_LINUX
@@ -3,6 +3,8 @@
 #include "msan_thread.h"
 #include "msan_interface_internal.h"
 
+#include "sanitizer_common/sanitizer_allocator_internal.h"
+#include "sanitizer_common/sanitizer_shadow_stack.h"
 #include "sanitizer_common/sanitizer_tls_get_addr.h"
 
 namespace __msan {
@@ -59,6 +61,8 @@ void MsanThread::Destroy() {
   // some code may still be executing in later TSD destructors
   // and we don't want it to have any poisoned stack.
   ClearShadowForThreadStackAndTLS();
+  ShadowStackThreadFinish();
+  InternalAllocatorThreadFinish();
   uptr size = RoundUpTo(sizeof(MsanThread), GetPageSizeCached());
   UnmapOrDie(this, size);
   DTLS_Destroy();
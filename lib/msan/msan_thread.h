@@ -44,6 +44,20 @@ class MsanThread {
 
   MsanThreadLocalMallocStorage &malloc_storage() { return malloc_storage_; }
 
+  // The origins chained by the stores of this thread, by the origin which was
+  // stored and the pc and frame of the store.
+  struct ChainedOriginCacheEntry {
+    uptr pc;
+    uptr bp;
+    u32 prev_id;
+    u32 chained_id;
+  };
+  ChainedOriginCacheEntry *chained_origin_cache_entry(u32 id, uptr pc,
+                                                      uptr bp) {
+    u64 h = ((u64)pc ^ ((u64)bp << 16) ^ id) * 0x9e3779b97f4a7c15ULL;
+    return &chained_origin_cache_[h >> (64 - kChainedOriginCacheSizeLog)];
+  }
+
   int destructor_iterations_;
 
  private:
@@ -61,6 +75,10 @@ class MsanThread {
   unsigned in_signal_handler_;
 
   MsanThreadLocalMallocStorage malloc_storage_;
+
+  static const uptr kChainedOriginCacheSizeLog = 6;
+  ChainedOriginCacheEntry
+      chained_origin_cache_[1 << kChainedOriginCacheSizeLog];
 };
 
 MsanThread *GetCurrentThread();
@@ -4138,6 +4138,24 @@ TEST(MemorySanitizerOrigins, SetGet) {
   EXPECT_ORIGIN(0U, __msan_get_origin(&x));
 }
 
+TEST(MemorySanitizerOrigins, LargeUnpoisonReleasesOrigins) {
+  if (!TrackingOrigins()) return;
+  const size_t kSize = 1 << 20;
+  char *p = (char *)mmap(0, kSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, p);
+  __msan_poison(p, kSize);
+  __msan_set_origin(p, kSize, 1234);
+  __msan_unpoison(p, kSize);
+  EXPECT_ORIGIN(0U, __msan_get_origin(p + kSize / 2));
+
+  // Poisoning stores a new origin.
+  __msan_poison(p + kSize / 2, 4);
+  __msan_set_origin(p + kSize / 2, 4, 5678);
+  EXPECT_ORIGIN(5678U, __msan_get_origin(p + kSize / 2));
+  munmap(p, kSize);
+}
+
 namespace {
 struct S {
   U4 dummy;
@@ -4430,6 +4448,43 @@ TEST(MemorySanitizerStress, DISABLED_MallocStackTrace) {
   RecursiveMalloc(22);
 }
 
+static double NowNanoseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void CountSignal(int signo) {
+  static volatile int count;
+  count++;
+}
+
+// Prints the cost of entering an interceptor and of delivering a signal,
+// both of which reset some of the thread-local shadow.
+TEST(MemorySanitizerStress, DISABLED_InterceptorCost) {
+  const int kCalls = 10000000;
+  const int kSignals = 100000;
+  char buf[16] = "interceptor";
+  size_t total = 0;
+  double start = NowNanoseconds();
+  for (int i = 0; i < kCalls; ++i) {
+    break_optimization(buf);
+    total += strlen(buf);
+  }
+  double end = NowNanoseconds();
+  EXPECT_EQ(kCalls * strlen("interceptor"), total);
+  printf("strlen(): %.1f ns per call\n", (end - start) / kCalls);
+
+  void (*old_handler)(int) = signal(SIGUSR1, CountSignal);
+  ASSERT_NE(SIG_ERR, old_handler);
+  start = NowNanoseconds();
+  for (int i = 0; i < kSignals; ++i)
+    raise(SIGUSR1);
+  end = NowNanoseconds();
+  signal(SIGUSR1, old_handler);
+  printf("raise(): %.1f ns per signal\n", (end - start) / kSignals);
+}
+
 TEST(MemorySanitizerAllocator, get_estimated_allocated_size) {
   size_t sizes[] = {0, 20, 5000, 1<<20};
   for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
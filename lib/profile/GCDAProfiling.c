@@ -119,6 +119,9 @@ static void resize_write_buffer(uint64_t size) {
   if (!new_file) return;
   size += cur_pos;
   if (size <= cur_buffer_size) return;
+  /* Grow geometrically so that large files don't realloc over and over. */
+  if (size < 2 * cur_buffer_size)
+    size = 2 * cur_buffer_size;
   size = (size - 1) / WRITE_BUFFER_SIZE + 1;
   size *= WRITE_BUFFER_SIZE;
   write_buffer = realloc(write_buffer, size);
@@ -127,7 +130,10 @@ static void resize_write_buffer(uint64_t size) {
 
 static void write_bytes(const char *s, size_t len) {
   resize_write_buffer(len);
-  memcpy(&write_buffer[cur_pos], s, len);
+  /* Leave pages of a mapped file clean when the data is unchanged, so
+   * that they don't need to be written back. */
+  if (new_file || memcmp(&write_buffer[cur_pos], s, len))
+    memcpy(&write_buffer[cur_pos], s, len);
   cur_pos += len;
 }
 
@@ -276,12 +282,15 @@ void llvm_gcda_start_file(const char *orig_filename, const char version[4],
     memset(write_buffer, 0, WRITE_BUFFER_SIZE);
   } else {
     if (map_file() == -1) {
-      /* mmap failed, try to recover by clobbering */
+      /* mmap failed, try to recover by clobbering. The new contents are
+       * likely about as large as the old ones. */
       new_file = 1;
       write_buffer = NULL;
       cur_buffer_size = 0;
-      resize_write_buffer(WRITE_BUFFER_SIZE);
-      memset(write_buffer, 0, WRITE_BUFFER_SIZE);
+      resize_write_buffer(file_size > WRITE_BUFFER_SIZE ? file_size
+                                                        : WRITE_BUFFER_SIZE);
+      memset(write_buffer, 0, cur_buffer_size);
+      file_size = 0;
     }
   }
 
@@ -348,7 +357,6 @@ void llvm_gcda_emit_function(uint32_t ident, const char *function_name,
 
 void llvm_gcda_emit_arcs(uint32_t num_counters, uint64_t *counters) {
   uint32_t i;
-  uint64_t *old_ctrs = NULL;
   uint32_t val = 0;
   uint64_t save_cur_pos = cur_pos;
 
@@ -373,9 +381,28 @@ void llvm_gcda_emit_arcs(uint32_t num_counters, uint64_t *counters) {
       return;
     }
 
-    old_ctrs = malloc(sizeof(uint64_t) * num_counters);
-    for (i = 0; i < num_counters; ++i)
-      old_ctrs[i] = read_64bit_value();
+    /* The counters of the mapped file are updated in place. A function
+     * that didn't run since the last flush is skipped without touching
+     * its part of the file. */
+    for (i = 0; i < num_counters && !counters[i]; ++i)
+      ;
+    if (i == num_counters) {
+      cur_pos += (uint64_t)num_counters * sizeof(uint64_t);
+      return;
+    }
+    for (i = 0; i < num_counters; ++i) {
+      uint64_t old_ctr = read_64bit_value();
+      if (counters[i]) {
+        counters[i] += old_ctr;
+        memcpy(&write_buffer[cur_pos - sizeof(uint64_t)], &counters[i],
+               sizeof(uint64_t));
+      } else
+        counters[i] = old_ctr;
+    }
+#ifdef DEBUG_GCDAPROFILING
+    fprintf(stderr, "llvmgcda:   %u arcs merged in place\n", num_counters);
+#endif
+    return;
   }
 
   cur_pos = save_cur_pos;
@@ -383,12 +410,8 @@ void llvm_gcda_emit_arcs(uint32_t num_counters, uint64_t *counters) {
   /* Counter #1 (arcs) tag */
   write_bytes("\0\0\xa1\1", 4);
   write_32bit_value(num_counters * 2);
-  for (i = 0; i < num_counters; ++i) {
-    counters[i] += (old_ctrs ? old_ctrs[i] : 0);
+  for (i = 0; i < num_counters; ++i)
     write_64bit_value(counters[i]);
-  }
-
-  free(old_ctrs);
 
 #ifdef DEBUG_GCDAPROFILING
   fprintf(stderr, "llvmgcda:   %u arcs\n", num_counters);
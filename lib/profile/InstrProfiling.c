@@ -26,6 +26,8 @@ COMPILER_RT_VISIBILITY uint64_t __llvm_profile_get_magic(void) {
                                             : (INSTR_PROF_RAW_MAGIC_32);
 }
 
+COMPILER_RT_VISIBILITY void (*lprofThreadCountersHook)(int) = 0;
+
 static unsigned ProfileDumped = 0;
 
 COMPILER_RT_VISIBILITY unsigned lprofProfileDumped() {
@@ -53,6 +55,8 @@ COMPILER_RT_VISIBILITY void __llvm_profile_reset_counters(void) {
   uint64_t *E = __llvm_profile_end_counters();
 
   memset(I, 0, sizeof(uint64_t) * (E - I));
+  if (lprofThreadCountersHook)
+    lprofThreadCountersHook(1);
 
   const __llvm_profile_data *DataBegin = __llvm_profile_begin_data();
   const __llvm_profile_data *DataEnd = __llvm_profile_end_data();
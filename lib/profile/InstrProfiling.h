@@ -79,7 +79,9 @@ void __llvm_profile_reset_counters(void);
  * in-process profile counters. The client is expected to
  * have checked or already knows the profile data in the
  * buffer matches the in-process counter structure before
- * calling it.
+ * calling it. Profiles of other builds of the module, whose functions are
+ * laid out differently, are merged function by function, matched by name
+ * and hash; functions without a match are dropped.
  */
 void __llvm_profile_merge_from_buffer(const char *Profile, uint64_t Size);
 
@@ -106,6 +108,18 @@ void INSTR_PROF_VALUE_PROF_FUNC(
 #include "InstrProfData.inc"
     );
 
+/*!
+ * \brief Return the calling thread's copy of the counters section.
+ *
+ * Instrumentation that addresses counters relative to this base, rather than
+ * at their address in the counters section, increments a private copy and
+ * avoids contention between threads. The copy is allocated on first use and
+ * folded into the counters section when the thread exits and whenever the
+ * profile is written. If it can't be allocated, the counters section itself
+ * is returned.
+ */
+uint64_t *__llvm_profile_thread_counters(void);
+
 /*!
  * \brief Write instrumentation data to the current file.
  *
@@ -139,6 +153,35 @@ int __llvm_profile_write_file(void);
  */
 int __llvm_profile_dump(void);
 
+/*!
+ * \brief Start a new profiling phase.
+ *
+ * The counts collected since the previous phase are taken out of the
+ * counters, which restart from zero, and written to \p Filename by a
+ * background thread. Where the kernel supports it, whole pages of counters
+ * are moved out with mremap() rather than copied, so the pause does not grow
+ * with the size of the binary. Unlike __llvm_profile_dump(), this does not
+ * stop the profile from being written at exit, and the use model is
+ *      ... startup
+ *      __llvm_profile_snapshot("startup.profraw");
+ *      ... request
+ *      __llvm_profile_snapshot("request.profraw");
+ *
+ * Snapshots hold no value profile data, which keeps accumulating for the
+ * profile written at exit. An increment racing with the snapshot may be
+ * counted in either phase. Returns 0 if the snapshot was taken; any error
+ * while writing it is reported by __llvm_profile_wait_for_snapshots().
+ */
+int __llvm_profile_snapshot(const char *Filename);
+
+/*!
+ * \brief Wait until all snapshots taken so far have been written.
+ *
+ * Returns non-zero if any of them could not be written. This is done
+ * implicitly at exit.
+ */
+int __llvm_profile_wait_for_snapshots(void);
+
 /*!
  * \brief Set the filename for writing instrumentation data.
  *
@@ -147,6 +190,10 @@ int __llvm_profile_dump(void);
  *
  * \c Name is not copied, so it must remain valid.  Passing NULL resets the
  * filename logic to the default behaviour.
+ *
+ * A \c %c in the name enables continuous mode: the counters are mapped onto
+ * the file so that it is up to date at all times, including when the
+ * process crashes. Once that mapping is set up the name can't be changed.
  */
 void __llvm_profile_set_filename(const char *Name);
 
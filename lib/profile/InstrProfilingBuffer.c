@@ -46,7 +46,9 @@ uint64_t __llvm_profile_get_size_for_buffer_internal(
 }
 
 COMPILER_RT_VISIBILITY int __llvm_profile_write_buffer(char *Buffer) {
-  return lprofWriteData(lprofBufferWriter, Buffer, 0);
+  if (lprofThreadCountersHook)
+    lprofThreadCountersHook(0);
+  return lprofWriteData(lprofBufferWriter, Buffer, 0, 0);
 }
 
 COMPILER_RT_VISIBILITY int __llvm_profile_write_buffer_internal(
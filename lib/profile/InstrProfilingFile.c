@@ -23,14 +23,25 @@
 /* For _chsize_s */
 #include <io.h>
 #else
+#include <fcntl.h>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #if defined(__linux__)
 #include <sys/types.h>
 #endif
 #endif
 
+/* Compatible counters can be added to a shared profile file in place,
+ * without taking the file lock. */
+#if !defined(_WIN32) && COMPILER_RT_HAS_ATOMICS == 1
+#define MERGE_IN_PLACE 1
+#else
+#define MERGE_IN_PLACE 0
+#endif
+
 /* From where is profile name specified.
  * The order the enumerators define their
  * precedence. Re-order them may lead to
@@ -76,30 +87,91 @@ typedef struct lprofFilename {
    * spawned from the same binary. By default the value is 1. If merging
    * is not enabled, its value should be 0. This parameter is specified
    * by the %[0-9]m specifier. For instance %2m enables merging using
-   * 2 profile data files. %1m is equivalent to %m. Also %m specifier
+   * 2 profile data files. %1m is equivalent to %m, and %0m uses one file
+   * per CPU. Also %m specifier
    * can only appear once at the end of the name pattern. */
   unsigned MergePoolSize;
+  /* Set by the %c specifier: counters are mapped onto the profile file at
+   * startup so that updates land in the file directly. */
+  unsigned ContinuousMode;
   ProfileNameSpecifier PNS;
 } lprofFilename;
 
 COMPILER_RT_WEAK lprofFilename lprofCurFilename = {0, 0, 0, {0}, {0},
-                                                   0, 0, 0, PNS_unknown};
+                                                   0, 0, 0, 0, PNS_unknown};
+
+/* State of the continuous mode mapping. It is kept out of lprofCurFilename,
+ * which is reset whenever the filename pattern changes, as the mapping
+ * stays in place for the lifetime of the process. */
+static unsigned ContinuousModeActive = 0;
+static char *ContinuousFilename;
+/* File offset of the first counter. */
+static uint64_t ContinuousCountersOffset;
+/* Counters in [ContinuousMappedBegin, ContinuousMappedEnd) live in the file.
+ * The ones before and after share their page with unrelated data and cannot
+ * be mapped; they hold the increments since the last sync. */
+static uint64_t *ContinuousMappedBegin;
+static uint64_t *ContinuousMappedEnd;
 
 int getpid(void);
 static int getCurFilenameLength();
 static const char *getCurFilename(char *FilenameBuf);
 static unsigned doMerging() { return lprofCurFilename.MergePoolSize; }
 
+#if !defined(_WIN32)
+/* Write all of \p IOV, retrying short writes. Returns -1 on failure. */
+static int writevAll(int Fd, struct iovec *IOV, int NumIOV) {
+  while (NumIOV > 0) {
+    ssize_t Written = writev(Fd, IOV, NumIOV);
+    if (Written < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    for (; NumIOV > 0 && (size_t)Written >= IOV->iov_len; ++IOV, --NumIOV)
+      Written -= IOV->iov_len;
+    if (NumIOV > 0) {
+      IOV->iov_base = (char *)IOV->iov_base + Written;
+      IOV->iov_len -= Written;
+    }
+  }
+  return 0;
+}
+#endif
+
 /* Return 1 if there is an error, otherwise return  0.  */
 static uint32_t fileWriter(ProfDataIOVec *IOVecs, uint32_t NumIOVecs,
                            void **WriterCtx) {
   uint32_t I;
   FILE *File = (FILE *)*WriterCtx;
+#if !defined(_WIN32)
+  /* Hand the sections to the kernel straight from memory, rather than
+   * copying them through the stdio buffer. */
+  struct iovec IOV[16];
+  int NumIOV = 0;
+  if (fflush(File))
+    return 1;
+  for (I = 0; I < NumIOVecs; I++) {
+    size_t Length = IOVecs[I].ElmSize * IOVecs[I].NumElm;
+    if (!Length)
+      continue;
+    IOV[NumIOV].iov_base = (void *)IOVecs[I].Data;
+    IOV[NumIOV].iov_len = Length;
+    if (++NumIOV == sizeof(IOV) / sizeof(*IOV)) {
+      if (writevAll(fileno(File), IOV, NumIOV))
+        return 1;
+      NumIOV = 0;
+    }
+  }
+  if (NumIOV && writevAll(fileno(File), IOV, NumIOV))
+    return 1;
+#else
   for (I = 0; I < NumIOVecs; I++) {
     if (fwrite(IOVecs[I].Data, IOVecs[I].ElmSize, IOVecs[I].NumElm, File) !=
         IOVecs[I].NumElm)
       return 1;
   }
+#endif
   return 0;
 }
 
@@ -120,11 +192,45 @@ static void setupIOBuffer() {
   }
 }
 
+/* Return 1 if LLVM_PROFILE_COMPACT asks for the counters to be encoded
+ * compactly. Such profiles are smaller but can't be merged into in place. */
+static unsigned useCompactCounters(void) {
+  const char *CompactStr = getenv("LLVM_PROFILE_COMPACT");
+  return CompactStr && CompactStr[0] && strcmp(CompactStr, "0");
+}
+
+/* Return 1 if any function has value profiling sites. Their data is only
+ * produced when the profile is written and can't be updated in place. */
+static int hasValueSites(void) {
+  const __llvm_profile_data *Data;
+  unsigned I;
+  for (Data = __llvm_profile_begin_data(); Data < __llvm_profile_end_data();
+       ++Data)
+    for (I = 0; I <= IPVK_Last; ++I)
+      if (Data->NumValueSites[I])
+        return 1;
+  return 0;
+}
+
+#if MERGE_IN_PLACE
+/* Return 1 if the \p ProfileSize bytes at \p ProfileData hold exactly a
+ * profile of this module, whose counters can then be added to directly. */
+static int canMergeInPlace(const char *ProfileData, uint64_t ProfileSize) {
+  const __llvm_profile_header *Header =
+      (const __llvm_profile_header *)ProfileData;
+  return ProfileSize == __llvm_profile_get_size_for_buffer() &&
+         !(Header->Version & VARIANT_MASK_COMPACT_COUNTERS) &&
+         !hasValueSites() &&
+         !__llvm_profile_check_compatibility(ProfileData, ProfileSize);
+}
+#endif
+
 /* Read profile data in \c ProfileFile and merge with in-memory
    profile counters. Returns -1 if there is fatal error, otheriwse
-   0 is returned.
+   0 is returned. \p MergeDone is set if the in-memory counters were added
+   to the file directly, which then needs no rewriting.
 */
-static int doProfileMerging(FILE *ProfileFile) {
+static int doProfileMerging(FILE *ProfileFile, int *MergeDone) {
   uint64_t ProfileFileSize;
   char *ProfileBuffer;
 
@@ -150,8 +256,9 @@ static int doProfileMerging(FILE *ProfileFile) {
     return 0;
   }
 
-  ProfileBuffer = mmap(NULL, ProfileFileSize, PROT_READ, MAP_SHARED | MAP_FILE,
-                       fileno(ProfileFile), 0);
+  ProfileBuffer =
+      mmap(NULL, ProfileFileSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FILE,
+           fileno(ProfileFile), 0);
   if (ProfileBuffer == MAP_FAILED) {
     PROF_ERR("Unable to merge profile data, mmap failed: %s\n",
              strerror(errno));
@@ -159,14 +266,27 @@ static int doProfileMerging(FILE *ProfileFile) {
   }
 
   if (__llvm_profile_check_compatibility(ProfileBuffer, ProfileFileSize)) {
+    /* Another build of the module: merge what matches by function. */
+    if (!lprofCheckCompatibilityByName(ProfileBuffer, ProfileFileSize)) {
+      PROF_NOTE("Merging profile data by function name: %s\n",
+                "source profile file has a different layout.");
+      __llvm_profile_merge_from_buffer(ProfileBuffer, ProfileFileSize);
+    } else {
+      PROF_WARN("Unable to merge profile data: %s\n",
+                "source profile file is not compatible.");
+    }
     (void)munmap(ProfileBuffer, ProfileFileSize);
-    PROF_WARN("Unable to merge profile data: %s\n",
-              "source profile file is not compatible.");
     return 0;
   }
 
   /* Now start merging */
-  __llvm_profile_merge_from_buffer(ProfileBuffer, ProfileFileSize);
+#if MERGE_IN_PLACE
+  if (canMergeInPlace(ProfileBuffer, ProfileFileSize)) {
+    lprofMergeCountersToBuffer(ProfileBuffer);
+    *MergeDone = 1;
+  } else
+#endif
+    __llvm_profile_merge_from_buffer(ProfileBuffer, ProfileFileSize);
   (void)munmap(ProfileBuffer, ProfileFileSize);
 
   return 0;
@@ -189,8 +309,10 @@ static void createProfileDir(const char *Filename) {
  * the original profile data is truncated and gets ready for the profile
  * dumper. With profile merging enabled, each executable as well as any of
  * its instrumented shared libraries dump profile data into their own data file.
+ * If the counters could be added to the file in place, \p MergeDone is set
+ * and the file is left as is.
 */
-static FILE *openFileForMerging(const char *ProfileFileName) {
+static FILE *openFileForMerging(const char *ProfileFileName, int *MergeDone) {
   FILE *ProfileFile;
   int rc;
 
@@ -199,7 +321,9 @@ static FILE *openFileForMerging(const char *ProfileFileName) {
   if (!ProfileFile)
     return NULL;
 
-  rc = doProfileMerging(ProfileFile);
+  rc = doProfileMerging(ProfileFile, MergeDone);
+  if (!rc && *MergeDone)
+    return ProfileFile;
   if (rc || COMPILER_RT_FTRUNCATE(ProfileFile, 0L) ||
       fseek(ProfileFile, 0L, SEEK_SET) == -1) {
     PROF_ERR("Profile Merging of file %s failed: %s\n", ProfileFileName,
@@ -211,22 +335,113 @@ static FILE *openFileForMerging(const char *ProfileFileName) {
   return ProfileFile;
 }
 
+#if MERGE_IN_PLACE
+/* Write the profile to a temporary file and link it into place, so that
+ * concurrent writers never see a partially written file. */
+static int publishProfileFile(const char *ProfileFileName) {
+  size_t Length = strlen(ProfileFileName) + MAX_PID_SIZE + 6;
+  char *TmpName = (char *)COMPILER_RT_ALLOCA(Length);
+  int RetVal, SavedErrno;
+  FILE *File;
+
+  snprintf(TmpName, Length, "%s.%d.tmp", ProfileFileName, getpid());
+  File = fopen(TmpName, "wb");
+  if (!File)
+    return -1;
+  RetVal = lprofWriteData(fileWriter, File, 0, 0);
+  if (fclose(File))
+    RetVal = -1;
+  if (!RetVal)
+    RetVal = link(TmpName, ProfileFileName);
+  SavedErrno = errno;
+  unlink(TmpName);
+  errno = SavedErrno;
+  return RetVal;
+}
+
+/* Merge the in-memory counters into \p ProfileFileName without taking the
+ * file lock: a compatible file has the counters atomically added to it
+ * through a shared mapping, and a missing one is created in one step.
+ * Returns 0 on success and -1 if the locked merge has to be used. */
+static int mergeInPlace(const char *ProfileFileName) {
+  const uint64_t ProfileSize = __llvm_profile_get_size_for_buffer();
+  struct stat Stat;
+  char *ProfileBuffer;
+  int Fd, Retried;
+
+  if (hasValueSites() || useCompactCounters())
+    return -1;
+
+  for (Retried = 0; Retried < 2; ++Retried) {
+    Fd = open(ProfileFileName, O_RDWR);
+    if (Fd < 0) {
+      if (errno != ENOENT)
+        return -1;
+      createProfileDir(ProfileFileName);
+      if (!publishProfileFile(ProfileFileName))
+        return 0;
+      /* Somebody else created it first, add to theirs. */
+      if (errno != EEXIST)
+        return -1;
+      continue;
+    }
+
+    if (fstat(Fd, &Stat) || (uint64_t)Stat.st_size != ProfileSize) {
+      close(Fd);
+      return -1;
+    }
+    ProfileBuffer = mmap(NULL, ProfileSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_FILE, Fd, 0);
+    close(Fd);
+    if (ProfileBuffer == MAP_FAILED)
+      return -1;
+    if (!canMergeInPlace(ProfileBuffer, ProfileSize)) {
+      (void)munmap(ProfileBuffer, ProfileSize);
+      return -1;
+    }
+    lprofMergeCountersToBuffer(ProfileBuffer);
+    (void)munmap(ProfileBuffer, ProfileSize);
+    return 0;
+  }
+  return -1;
+}
+#endif
+
 /* Write profile data to file \c OutputName.  */
 static int writeFile(const char *OutputName) {
-  int RetVal;
+  int RetVal, MergeDone = 0;
   FILE *OutputFile;
 
-  if (!doMerging())
+  if (!doMerging()) {
     OutputFile = fopen(OutputName, "ab");
-  else
-    OutputFile = openFileForMerging(OutputName);
+#if defined(__linux__)
+    /* Other modules may be appending to the same file at the same time.
+     * Unlike the fcntl lock, flock excludes threads of this process too. */
+    if (OutputFile && lprofParallelWriterRegistered())
+      flock(fileno(OutputFile), LOCK_EX);
+#endif
+  } else {
+#if MERGE_IN_PLACE
+    if (!mergeInPlace(OutputName))
+      return 0;
+#endif
+    OutputFile = openFileForMerging(OutputName, &MergeDone);
+  }
 
   if (!OutputFile)
     return -1;
+  if (MergeDone) {
+    fclose(OutputFile);
+    return 0;
+  }
 
   FreeHook = &free;
   setupIOBuffer();
-  RetVal = lprofWriteData(fileWriter, OutputFile, lprofGetVPDataReader());
+  RetVal = lprofWriteData(fileWriter, OutputFile, lprofGetVPDataReader(),
+                          useCompactCounters());
+  if (lprofGetNumDroppedValues())
+    PROF_WARN("%" PRIu64 " values were not tracked: %s\n",
+              lprofGetNumDroppedValues(), "out of value profile counters");
 
   fclose(OutputFile);
   return RetVal;
@@ -258,6 +473,224 @@ static void truncateCurrentFile(void) {
   fclose(File);
 }
 
+#if !defined(_WIN32)
+/* In continuous mode the file starts with an empty, header only profile
+ * followed by zero padding and then the real profile. The raw profile
+ * reader skips zero padding between concatenated profiles, and the padding
+ * is sized so that the counters land at a file offset congruent to their
+ * address modulo the page size, as mmap requires. Returns the offset of the
+ * real profile. */
+static uint64_t getContinuousProfileOffset(uint64_t PageSize) {
+  const uint64_t HeaderSize = sizeof(__llvm_profile_header);
+  const uint64_t DataBytes =
+      __llvm_profile_get_data_size(__llvm_profile_begin_data(),
+                                   __llvm_profile_end_data()) *
+      sizeof(__llvm_profile_data);
+  const uint64_t CountersAddr = (uintptr_t)__llvm_profile_begin_counters();
+  return HeaderSize +
+         ((CountersAddr - (2 * HeaderSize + DataBytes)) & (PageSize - 1));
+}
+
+/* Merge the counters of an earlier run using the same continuous layout
+ * into the in-memory counters. */
+static void mergeContinuousProfile(FILE *File, uint64_t ProfileOffset,
+                                   uint64_t FileSize) {
+  const __llvm_profile_header *Header;
+  uint64_t ExistingSize;
+  char *Buffer;
+
+  if (fseek(File, 0L, SEEK_END) == -1)
+    return;
+  ExistingSize = ftell(File);
+  if (!ExistingSize)
+    return;
+
+  Buffer = mmap(NULL, ExistingSize, PROT_READ, MAP_SHARED, fileno(File), 0);
+  if (Buffer == MAP_FAILED) {
+    PROF_ERR("Unable to merge profile data, mmap failed: %s\n",
+             strerror(errno));
+    return;
+  }
+  Header = (const __llvm_profile_header *)Buffer;
+  if (ExistingSize != FileSize || Header->Magic != __llvm_profile_get_magic() ||
+      Header->Version != __llvm_profile_get_version() || Header->DataSize ||
+      __llvm_profile_check_compatibility(Buffer + ProfileOffset,
+                                         FileSize - ProfileOffset)) {
+    PROF_WARN("Unable to merge profile data: %s\n",
+              "source profile file is not compatible.");
+  } else
+    __llvm_profile_merge_from_buffer(Buffer + ProfileOffset,
+                                     FileSize - ProfileOffset);
+  (void)munmap(Buffer, ExistingSize);
+}
+
+/* Write the empty leading profile, the padding and the profile itself. */
+static int writeContinuousProfile(FILE *File, uint64_t ProfileOffset) {
+  __llvm_profile_header Header;
+
+  memset(&Header, 0, sizeof(Header));
+  Header.Magic = __llvm_profile_get_magic();
+  Header.Version = __llvm_profile_get_version();
+  Header.ValueKindLast = IPVK_Last;
+
+  if (COMPILER_RT_FTRUNCATE(File, 0L) || fseek(File, 0L, SEEK_SET) == -1 ||
+      fwrite(&Header, sizeof(Header), 1, File) != 1 ||
+      fseek(File, ProfileOffset, SEEK_SET) == -1)
+    return -1;
+  if (lprofWriteDataImpl(fileWriter, File, __llvm_profile_begin_data(),
+                         __llvm_profile_end_data(),
+                         __llvm_profile_begin_counters(),
+                         __llvm_profile_end_counters(), 0,
+                         __llvm_profile_begin_names(),
+                         __llvm_profile_end_names()))
+    return -1;
+  return fflush(File);
+}
+
+/* Map the counters section onto the profile file so that counter updates
+ * go straight to the file. On failure the profile is written at exit as
+ * usual. */
+static void initializeContinuousMode(void) {
+  const __llvm_profile_data *DataBegin = __llvm_profile_begin_data();
+  const __llvm_profile_data *DataEnd = __llvm_profile_end_data();
+  uint64_t *CountersBegin = __llvm_profile_begin_counters();
+  uint64_t *CountersEnd = __llvm_profile_end_counters();
+  const uint64_t PageSize = getpagesize();
+  uint64_t ProfileOffset, FileSize, MappedOffset;
+  uint64_t *MappedBegin, *MappedEnd;
+  const char *Filename;
+  char *FilenameBuf;
+  FILE *File;
+  int Length;
+
+  if (ContinuousModeActive || DataBegin == DataEnd)
+    return;
+
+  if (hasValueSites()) {
+    PROF_WARN("Continuous mode is disabled: %s\n",
+              "value profiling is not supported.");
+    return;
+  }
+
+  Length = getCurFilenameLength();
+  FilenameBuf = (char *)COMPILER_RT_ALLOCA(Length + 1);
+  Filename = getCurFilename(FilenameBuf);
+  if (!Filename)
+    return;
+
+  createProfileDir(Filename);
+  File = lprofOpenFileEx(Filename);
+  if (!File) {
+    PROF_ERR("Failed to open file \"%s\" for continuous mode: %s\n", Filename,
+             strerror(errno));
+    return;
+  }
+
+  ProfileOffset = getContinuousProfileOffset(PageSize);
+  FileSize = ProfileOffset + __llvm_profile_get_size_for_buffer();
+  ContinuousCountersOffset =
+      ProfileOffset + sizeof(__llvm_profile_header) +
+      __llvm_profile_get_data_size(DataBegin, DataEnd) *
+          sizeof(__llvm_profile_data);
+
+  if (doMerging())
+    mergeContinuousProfile(File, ProfileOffset, FileSize);
+  if (writeContinuousProfile(File, ProfileOffset)) {
+    PROF_ERR("Failed to write file \"%s\": %s\n", Filename, strerror(errno));
+    (void)COMPILER_RT_FTRUNCATE(File, 0L);
+    fclose(File);
+    return;
+  }
+
+  MappedBegin = (uint64_t *)(((uintptr_t)CountersBegin + PageSize - 1) &
+                             ~(PageSize - 1));
+  MappedEnd = (uint64_t *)((uintptr_t)CountersEnd & ~(PageSize - 1));
+  if (MappedBegin >= MappedEnd)
+    MappedBegin = MappedEnd = CountersEnd;
+  MappedOffset =
+      ContinuousCountersOffset + (MappedBegin - CountersBegin) * sizeof(uint64_t);
+  if (MappedBegin != MappedEnd &&
+      mmap(MappedBegin, (MappedEnd - MappedBegin) * sizeof(uint64_t),
+           PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fileno(File),
+           MappedOffset) == MAP_FAILED) {
+    PROF_ERR("Continuous mode is disabled, mmap failed: %s\n",
+             strerror(errno));
+    /* Leave nothing behind that the writer at exit would append to. */
+    (void)COMPILER_RT_FTRUNCATE(File, 0L);
+    fclose(File);
+    return;
+  }
+  fclose(File);
+
+  /* The unmapped counters are in the file already, from now on they only
+   * accumulate what is added at the next sync. */
+  memset(CountersBegin, 0, (MappedBegin - CountersBegin) * sizeof(uint64_t));
+  memset(MappedEnd, 0, (CountersEnd - MappedEnd) * sizeof(uint64_t));
+
+  ContinuousFilename = strdup(Filename);
+  ContinuousMappedBegin = MappedBegin;
+  ContinuousMappedEnd = MappedEnd;
+  ContinuousModeActive = 1;
+}
+
+/* Add the increments of the counters in [Begin, End), which could not be
+ * mapped, to their copy in the file at \p Offset. */
+static int syncCounterRange(int Fd, uint64_t *Begin, uint64_t *End,
+                            uint64_t Offset) {
+  uint64_t Buffer[512];
+  while (Begin < End) {
+    size_t N = End - Begin, I;
+    if (N > sizeof(Buffer) / sizeof(*Buffer))
+      N = sizeof(Buffer) / sizeof(*Buffer);
+    if (pread(Fd, Buffer, N * sizeof(uint64_t), Offset) !=
+        (ssize_t)(N * sizeof(uint64_t)))
+      return -1;
+    for (I = 0; I < N; ++I) {
+      Buffer[I] += Begin[I];
+      Begin[I] = 0;
+    }
+    if (pwrite(Fd, Buffer, N * sizeof(uint64_t), Offset) !=
+        (ssize_t)(N * sizeof(uint64_t)))
+      return -1;
+    Begin += N;
+    Offset += N * sizeof(uint64_t);
+  }
+  return 0;
+}
+
+/* In continuous mode only the counters sharing a page with other data need
+ * to be written out. */
+static int syncContinuousCounters(void) {
+  uint64_t *CountersBegin = __llvm_profile_begin_counters();
+  uint64_t *CountersEnd = __llvm_profile_end_counters();
+  FILE *File;
+  int RetVal;
+
+  if (CountersBegin == ContinuousMappedBegin &&
+      CountersEnd == ContinuousMappedEnd)
+    return 0;
+
+  File = lprofOpenFileEx(ContinuousFilename);
+  if (!File)
+    return -1;
+  RetVal = syncCounterRange(fileno(File), CountersBegin, ContinuousMappedBegin,
+                            ContinuousCountersOffset);
+  if (!RetVal)
+    RetVal = syncCounterRange(
+        fileno(File), ContinuousMappedEnd, CountersEnd,
+        ContinuousCountersOffset +
+            (ContinuousMappedEnd - CountersBegin) * sizeof(uint64_t));
+  fclose(File);
+  return RetVal;
+}
+#else
+static void initializeContinuousMode(void) {
+  PROF_WARN("Continuous mode is not supported on %s.\n", "this platform");
+}
+
+static int syncContinuousCounters(void) { return 0; }
+#endif
+
 static const char *DefaultProfileName = "default.profraw";
 static void resetFilenameToDefault(void) {
   if (lprofCurFilename.FilenamePat && lprofCurFilename.OwnsFilenamePat) {
@@ -270,7 +703,7 @@ static void resetFilenameToDefault(void) {
 
 static int containsMergeSpecifier(const char *FilenamePat, int I) {
   return (FilenamePat[I] == 'm' ||
-          (FilenamePat[I] >= '1' && FilenamePat[I] <= '9' &&
+          (FilenamePat[I] >= '0' && FilenamePat[I] <= '9' &&
            /* If FilenamePat[I] is not '\0', the next byte is guaranteed
             * to be in-bound as the string is null terminated. */
            FilenamePat[I + 1] == 'm'));
@@ -320,6 +753,8 @@ static int parseFilenamePattern(const char *FilenamePat,
                       FilenamePat);
             return -1;
           }
+      } else if (FilenamePat[I] == 'c') {
+        lprofCurFilename.ContinuousMode = 1;
       } else if (containsMergeSpecifier(FilenamePat, I)) {
         if (MergingEnabled) {
           PROF_WARN("%%m specifier can only be specified once in %s.\n",
@@ -329,7 +764,11 @@ static int parseFilenamePattern(const char *FilenamePat,
         MergingEnabled = 1;
         if (FilenamePat[I] == 'm')
           lprofCurFilename.MergePoolSize = 1;
-        else {
+        else if (FilenamePat[I] == '0') {
+          /* %0m sizes the pool by the number of CPUs. */
+          lprofCurFilename.MergePoolSize = lprofGetNumberOfCPUs();
+          I++; /* advance to 'm' */
+        } else {
           lprofCurFilename.MergePoolSize = FilenamePat[I] - '0';
           I++; /* advance to 'm' */
         }
@@ -359,6 +798,14 @@ static void parseAndSetFilename(const char *FilenamePat,
     return;
   }
 
+  /* The counters are backed by the mapped file now, it can't be moved. */
+  if (ContinuousModeActive) {
+    PROF_WARN("Profile file \"%s\" is mapped in continuous mode, "
+              "ignoring new name %s.\n",
+              ContinuousFilename, FilenamePat);
+    return;
+  }
+
   /* When PNS >= OldPNS, the last one wins. */
   if (!FilenamePat || parseFilenamePattern(FilenamePat, CopyFilenamePat))
     resetFilenameToDefault();
@@ -380,15 +827,15 @@ static void parseAndSetFilename(const char *FilenamePat,
 
 /* Return buffer length that is required to store the current profile
  * filename with PID and hostname substitutions. */
-/* The length to hold uint64_t followed by 2 digit pool id including '_' */
-#define SIGLEN 24
+/* The length to hold uint64_t followed by the pool id including '_' */
+#define SIGLEN 32
 static int getCurFilenameLength() {
   int Len;
   if (!lprofCurFilename.FilenamePat || !lprofCurFilename.FilenamePat[0])
     return 0;
 
   if (!(lprofCurFilename.NumPids || lprofCurFilename.NumHosts ||
-        lprofCurFilename.MergePoolSize))
+        lprofCurFilename.MergePoolSize || lprofCurFilename.ContinuousMode))
     return strlen(lprofCurFilename.FilenamePat);
 
   Len = strlen(lprofCurFilename.FilenamePat) +
@@ -411,7 +858,7 @@ static const char *getCurFilename(char *FilenameBuf) {
     return 0;
 
   if (!(lprofCurFilename.NumPids || lprofCurFilename.NumHosts ||
-        lprofCurFilename.MergePoolSize))
+        lprofCurFilename.MergePoolSize || lprofCurFilename.ContinuousMode))
     return lprofCurFilename.FilenamePat;
 
   PidLength = strlen(lprofCurFilename.PidChars);
@@ -510,6 +957,8 @@ void __llvm_profile_initialize_file(void) {
   }
 
   parseAndSetFilename(SelectedPat, PNS, 0);
+  if (lprofCurFilename.ContinuousMode)
+    initializeContinuousMode();
 }
 
 /* This API is directly called by the user application code. It has the
@@ -519,6 +968,8 @@ void __llvm_profile_initialize_file(void) {
 COMPILER_RT_VISIBILITY
 void __llvm_profile_set_filename(const char *FilenamePat) {
   parseAndSetFilename(FilenamePat, PNS_runtime_api, 1);
+  if (lprofCurFilename.ContinuousMode)
+    initializeContinuousMode();
 }
 
 /* The public API for writing profile data into the file with name
@@ -538,6 +989,18 @@ int __llvm_profile_write_file(void) {
     return 0;
   }
 
+  if (lprofThreadCountersHook)
+    lprofThreadCountersHook(0);
+
+  /* The counters are in the file already. */
+  if (ContinuousModeActive) {
+    rc = syncContinuousCounters();
+    if (rc)
+      PROF_ERR("Failed to write file \"%s\": %s\n", ContinuousFilename,
+               strerror(errno));
+    return rc;
+  }
+
   Length = getCurFilenameLength();
   FilenameBuf = (char *)COMPILER_RT_ALLOCA(Length + 1);
   Filename = getCurFilename(FilenameBuf);
@@ -574,7 +1037,7 @@ int __llvm_profile_write_file(void) {
 
 COMPILER_RT_VISIBILITY
 int __llvm_profile_dump(void) {
-  if (!doMerging())
+  if (!doMerging() && !ContinuousModeActive)
     PROF_WARN("Later invocation of __llvm_profile_dump can lead to clobbering "
               " of previously dumped profile data : %s. Either use %%m "
               "in profile name or change profile name before dumping.\n",
@@ -584,7 +1047,36 @@ int __llvm_profile_dump(void) {
   return rc;
 }
 
-static void writeFileWithoutReturn(void) { __llvm_profile_write_file(); }
+COMPILER_RT_VISIBILITY unsigned lprofContinuousModeActive(void) {
+  return ContinuousModeActive;
+}
+
+COMPILER_RT_VISIBILITY int lprofWriteSnapshotFile(const char *Filename,
+                                                  const uint64_t *Counters) {
+  int RetVal;
+  FILE *File = fopen(Filename, "wb");
+  if (!File) {
+    PROF_ERR("Failed to open file \"%s\": %s\n", Filename, strerror(errno));
+    return -1;
+  }
+  RetVal =
+      lprofWriteSnapshotData(fileWriter, File, Counters, useCompactCounters());
+  if (fclose(File))
+    RetVal = -1;
+  if (RetVal)
+    PROF_ERR("Failed to write file \"%s\": %s\n", Filename, strerror(errno));
+  return RetVal;
+}
+
+static void writeFileWithoutReturn(void) {
+#if defined(__linux__)
+  if (lprofParallelWriterRegistered()) {
+    lprofWriteParallel();
+    return;
+  }
+#endif
+  __llvm_profile_write_file();
+}
 
 COMPILER_RT_VISIBILITY
 int __llvm_profile_register_write_file_atexit(void) {
@@ -594,6 +1086,9 @@ int __llvm_profile_register_write_file_atexit(void) {
     return 0;
 
   lprofSetupValueProfiler();
+#if defined(__linux__)
+  lprofRegisterParallelWriter();
+#endif
 
   HasBeenRegistered = 1;
   return atexit(writeFileWithoutReturn);
@@ -133,8 +133,10 @@ typedef struct VPDataReaderType {
                                         uint32_t N);
 } VPDataReaderType;
 
+/* Write the profile of this module. With \p Compact set the counters are
+ * encoded as described for VARIANT_MASK_COMPACT_COUNTERS. */
 int lprofWriteData(WriterCallback Writer, void *WriterCtx,
-                   VPDataReaderType *VPDataReader);
+                   VPDataReaderType *VPDataReader, unsigned Compact);
 int lprofWriteDataImpl(WriterCallback Writer, void *WriterCtx,
                        const __llvm_profile_data *DataBegin,
                        const __llvm_profile_data *DataEnd,
@@ -142,6 +144,17 @@ int lprofWriteDataImpl(WriterCallback Writer, void *WriterCtx,
                        const uint64_t *CountersEnd,
                        VPDataReaderType *VPDataReader, const char *NamesBegin,
                        const char *NamesEnd);
+/* Write the profile of this module with \p Counters, a copy of the counters
+ * section, in place of the live counters. Value profile data is left out. */
+int lprofWriteSnapshotData(WriterCallback Writer, void *WriterCtx,
+                           const uint64_t *Counters, unsigned Compact);
+
+/* Returns 1 if the profile in \p ProfileData can't be merged into this
+ * module's counters even by function. That needs only the same profile
+ * kind, and __llvm_profile_merge_from_buffer() then drops the functions
+ * this module doesn't have. */
+int lprofCheckCompatibilityByName(const char *ProfileData,
+                                  uint64_t ProfileSize);
 
 /* Merge value profile data pointed to by SrcValueProfData into
  * in-memory profile counters pointed by to DstData.  */
@@ -150,6 +163,23 @@ void lprofMergeValueProfData(struct ValueProfData *SrcValueProfData,
 
 VPDataReaderType *lprofGetVPDataReader();
 
+/* Record \p Count occurrences of \p TargetValue at value site
+ * \p CounterIndex, as that many __llvm_profile_instrument_target calls
+ * would. */
+void lprofInstrumentTarget(uint64_t TargetValue, __llvm_profile_data *Data,
+                           uint32_t CounterIndex, uint64_t Count);
+
+/* Return the number of values that could not be tracked because no value
+ * profile node was left. */
+uint64_t lprofGetNumDroppedValues();
+
+#if COMPILER_RT_HAS_ATOMICS == 1 && !defined(_MSC_VER)
+/* Atomically add the in-memory counters to those of the compatible raw
+ * profile \p ProfileData, typically a shared mapping of the profile file.
+ * Concurrent writers need no lock as long as the layout stays the same. */
+void lprofMergeCountersToBuffer(char *ProfileData);
+#endif
+
 /* Internal interface used by test to reset the max number of 
  * tracked values per value site to be \p MaxVals.
  */
@@ -170,6 +200,30 @@ uint64_t lprofGetLoadModuleSignature();
 unsigned lprofProfileDumped();
 void lprofSetProfileDumped();
 
+/* Set once a thread asks for its own copy of the counters. Folds the
+ * copies into the global counters, or with \p Discard set, drops what they
+ * have counted so far. */
+COMPILER_RT_VISIBILITY extern void (*lprofThreadCountersHook)(int Discard);
+
+#if defined(__linux__)
+/* With LLVM_PROFILE_PARALLEL_WRITE set, register this module's profile
+ * writer with the registry shared by all instrumented modules of the
+ * process. Registered modules are kept loaded until exit. Returns 0 on
+ * success. */
+int lprofRegisterParallelWriter(void);
+unsigned lprofParallelWriterRegistered(void);
+/* Write the profiles of all registered modules not written yet on several
+ * threads, or wait for them if another module is doing so. */
+void lprofWriteParallel(void);
+#endif
+
+/* Return non zero if the counters section is mapped onto the profile file,
+ * see the %c filename pattern. */
+unsigned lprofContinuousModeActive(void);
+/* Write a profile of this module to \p Filename with the values of
+ * \p Counters, a copy of the counters section. */
+int lprofWriteSnapshotFile(const char *Filename, const uint64_t *Counters);
+
 COMPILER_RT_VISIBILITY extern void (*FreeHook)(void *);
 COMPILER_RT_VISIBILITY extern uint8_t *DynamicBufferIOBuffer;
 COMPILER_RT_VISIBILITY extern uint32_t VPBufferSize;
@@ -13,6 +13,8 @@
 #include "InstrProfiling.h"
 #include "InstrProfilingInternal.h"
 #include "InstrProfilingUtil.h"
+#include <stdlib.h>
+#include <string.h>
 
 #define INSTR_PROF_VALUE_PROF_DATA
 #include "InstrProfData.inc"
@@ -36,6 +38,100 @@ uint64_t lprofGetLoadModuleSignature() {
          (NumVnodes << 10) + (DataSize > 0 ? FirstD->NameRef : 0);
 }
 
+/* Reads counters encoded as described for VARIANT_MASK_COMPACT_COUNTERS. */
+typedef struct CompactDecoder {
+  const uint8_t *Begin;
+  const uint8_t *Ptr;
+  const uint8_t *End;
+  /* Index of the counter returned by the next call to nextCounter(). */
+  uint64_t Index;
+  /* Zero counters left in the current run. */
+  uint64_t ZerosLeft;
+} CompactDecoder;
+
+static void initCompactDecoder(CompactDecoder *D, const char *Begin,
+                               const char *End) {
+  D->Begin = D->Ptr = (const uint8_t *)Begin;
+  D->End = (const uint8_t *)End;
+  D->Index = 0;
+  D->ZerosLeft = 0;
+}
+
+/* Returns 1 and leaves \p Value alone if the stream ends first. */
+static int readULEB128(CompactDecoder *D, uint64_t *Value) {
+  uint64_t Result = 0;
+  unsigned Shift = 0;
+  uint8_t B;
+  do {
+    if (D->Ptr == D->End || Shift >= 64)
+      return 1;
+    B = *D->Ptr++;
+    Result |= (uint64_t)(B & 0x7f) << Shift;
+    Shift += 7;
+  } while (B & 0x80);
+  *Value = Result;
+  return 0;
+}
+
+/* Returns 1 if the stream is truncated or malformed. */
+static int nextCounter(CompactDecoder *D, uint64_t *Value) {
+  if (!D->ZerosLeft) {
+    if (D->Ptr == D->End)
+      return 1;
+    if (*D->Ptr) {
+      D->Index++;
+      return readULEB128(D, Value);
+    }
+    D->Ptr++;
+    if (readULEB128(D, &D->ZerosLeft) || !D->ZerosLeft)
+      return 1;
+  }
+  D->ZerosLeft--;
+  D->Index++;
+  *Value = 0;
+  return 0;
+}
+
+/* Position the decoder at counter \p Index. */
+static int seekCounter(CompactDecoder *D, uint64_t Index) {
+  uint64_t Value;
+  if (Index < D->Index) {
+    D->Ptr = D->Begin;
+    D->Index = 0;
+    D->ZerosLeft = 0;
+  }
+  while (D->Index < Index) {
+    if (D->ZerosLeft) {
+      uint64_t Skip = Index - D->Index;
+      if (Skip > D->ZerosLeft)
+        Skip = D->ZerosLeft;
+      D->ZerosLeft -= Skip;
+      D->Index += Skip;
+    } else if (nextCounter(D, &Value))
+      return 1;
+  }
+  return 0;
+}
+
+/* Return the size in bytes of the counters at \p Counters of the profile
+ * with \p Header, including padding. Returns UINT64_MAX if they don't fit
+ * before \p End. */
+static uint64_t getCountersSize(const __llvm_profile_header *Header,
+                                const char *Counters, const char *End) {
+  CompactDecoder D;
+  uint64_t Size;
+  if (!(Header->Version & VARIANT_MASK_COMPACT_COUNTERS)) {
+    Size = Header->CountersSize * sizeof(uint64_t);
+    return (uint64_t)(End - Counters) < Size ? UINT64_MAX : Size;
+  }
+  initCompactDecoder(&D, Counters, End);
+  if (seekCounter(&D, Header->CountersSize))
+    return UINT64_MAX;
+  Size = (const char *)D.Ptr - Counters;
+  Size += __llvm_profile_get_num_padding_bytes(Size);
+  return (uint64_t)(End - Counters) < Size ? UINT64_MAX : Size;
+}
+
 /* Returns 1 if profile is not structurally compatible.  */
 COMPILER_RT_VISIBILITY
 int __llvm_profile_check_compatibility(const char *ProfileData,
@@ -52,7 +148,8 @@ int __llvm_profile_check_compatibility(const char *ProfileData,
 
   /* Check the header first.  */
   if (Header->Magic != __llvm_profile_get_magic() ||
-      Header->Version != __llvm_profile_get_version() ||
+      (Header->Version & ~VARIANT_MASK_COMPACT_COUNTERS) !=
+          __llvm_profile_get_version() ||
       Header->DataSize !=
           __llvm_profile_get_data_size(__llvm_profile_begin_data(),
                                        __llvm_profile_end_data()) ||
@@ -67,6 +164,10 @@ int __llvm_profile_check_compatibility(const char *ProfileData,
                         Header->DataSize * sizeof(__llvm_profile_data) +
                         Header->NamesSize + Header->CountersSize)
     return 1;
+  if ((Header->Version & VARIANT_MASK_COMPACT_COUNTERS) &&
+      getCountersSize(Header, (const char *)SrcDataEnd,
+                      ProfileData + ProfileSize) == UINT64_MAX)
+    return 1;
 
   for (SrcData = SrcDataStart,
        DstData = (__llvm_profile_data *)__llvm_profile_begin_data();
@@ -81,6 +182,96 @@ int __llvm_profile_check_compatibility(const char *ProfileData,
   return 0;
 }
 
+/* Returns 1 if the header of \p ProfileData doesn't describe a profile of
+ * the same kind as this module's, or its sections don't fit in
+ * \p ProfileSize. */
+static int checkHeader(const char *ProfileData, uint64_t ProfileSize) {
+  const __llvm_profile_header *Header =
+      (const __llvm_profile_header *)ProfileData;
+  const char *Counters;
+
+  if (ProfileSize < sizeof(__llvm_profile_header) ||
+      Header->Magic != __llvm_profile_get_magic() ||
+      (Header->Version & ~VARIANT_MASK_COMPACT_COUNTERS) !=
+          __llvm_profile_get_version() ||
+      Header->ValueKindLast != IPVK_Last)
+    return 1;
+  if ((ProfileSize - sizeof(__llvm_profile_header)) /
+          sizeof(__llvm_profile_data) <
+      Header->DataSize)
+    return 1;
+  Counters = ProfileData + sizeof(__llvm_profile_header) +
+             Header->DataSize * sizeof(__llvm_profile_data);
+  return getCountersSize(Header, Counters, ProfileData + ProfileSize) ==
+         UINT64_MAX;
+}
+
+COMPILER_RT_VISIBILITY
+int lprofCheckCompatibilityByName(const char *ProfileData,
+                                  uint64_t ProfileSize) {
+  return checkHeader(ProfileData, ProfileSize);
+}
+
+/* Open addressing index of this module's data records by NameRef and
+ * FuncHash, for merging profiles whose records are laid out differently.
+ * Built on first use; the data section never changes. */
+static __llvm_profile_data **DataIndex;
+static uint64_t DataIndexMask;
+
+static uint64_t hashData(uint64_t NameRef, uint64_t FuncHash) {
+  uint64_t Hash = NameRef ^ (FuncHash * 0x9E3779B97F4A7C15ULL);
+  return Hash ^ (Hash >> 29);
+}
+
+static void buildDataIndex(void) {
+  __llvm_profile_data *Data = (__llvm_profile_data *)__llvm_profile_begin_data();
+  __llvm_profile_data *DataEnd = (__llvm_profile_data *)__llvm_profile_end_data();
+  uint64_t NumSlots = 16;
+
+  while (NumSlots < 2 * (uint64_t)(DataEnd - Data))
+    NumSlots *= 2;
+  DataIndex =
+      (__llvm_profile_data **)calloc(NumSlots, sizeof(__llvm_profile_data *));
+  if (!DataIndex)
+    return;
+  DataIndexMask = NumSlots - 1;
+  for (; Data < DataEnd; ++Data) {
+    uint64_t Slot = hashData(Data->NameRef, Data->FuncHash) & DataIndexMask;
+    while (DataIndex[Slot])
+      Slot = (Slot + 1) & DataIndexMask;
+    DataIndex[Slot] = Data;
+  }
+}
+
+/* Return the data record of this module for the same function as
+ * \p SrcData, or null if there is none. \p Positional is the record at the
+ * same position, which is the one for identical builds. */
+static __llvm_profile_data *findDstData(const __llvm_profile_data *SrcData,
+                                        __llvm_profile_data *Positional) {
+  __llvm_profile_data *DstData = 0;
+  if (Positional < (__llvm_profile_data *)__llvm_profile_end_data() &&
+      Positional->NameRef == SrcData->NameRef &&
+      Positional->FuncHash == SrcData->FuncHash)
+    DstData = Positional;
+  else {
+    if (!DataIndex)
+      buildDataIndex();
+    if (DataIndex) {
+      uint64_t Slot =
+          hashData(SrcData->NameRef, SrcData->FuncHash) & DataIndexMask;
+      for (; DataIndex[Slot]; Slot = (Slot + 1) & DataIndexMask)
+        if (DataIndex[Slot]->NameRef == SrcData->NameRef &&
+            DataIndex[Slot]->FuncHash == SrcData->FuncHash) {
+          DstData = DataIndex[Slot];
+          break;
+        }
+    }
+  }
+  if (DstData && DstData->NumCounters != SrcData->NumCounters)
+    return 0;
+  return DstData;
+}
+
 COMPILER_RT_VISIBILITY
 void __llvm_profile_merge_from_buffer(const char *ProfileData,
                                       uint64_t ProfileSize) {
@@ -89,31 +280,63 @@ void __llvm_profile_merge_from_buffer(const char *ProfileData,
   uint64_t *SrcCountersStart;
   const char *SrcNameStart;
   ValueProfData *SrcValueProfDataStart, *SrcValueProfData;
+  unsigned Compact = (Header->Version & VARIANT_MASK_COMPACT_COUNTERS) != 0;
+  CompactDecoder Decoder;
 
   SrcDataStart =
       (__llvm_profile_data *)(ProfileData + sizeof(__llvm_profile_header));
   SrcDataEnd = SrcDataStart + Header->DataSize;
   SrcCountersStart = (uint64_t *)SrcDataEnd;
-  SrcNameStart = (const char *)(SrcCountersStart + Header->CountersSize);
+  if (Compact) {
+    uint64_t CountersSize = getCountersSize(
+        Header, (const char *)SrcCountersStart, ProfileData + ProfileSize);
+    if (CountersSize == UINT64_MAX)
+      return;
+    SrcNameStart = (const char *)SrcCountersStart + CountersSize;
+    initCompactDecoder(&Decoder, (const char *)SrcCountersStart, SrcNameStart);
+  } else
+    SrcNameStart = (const char *)(SrcCountersStart + Header->CountersSize);
   SrcValueProfDataStart =
       (ValueProfData *)(SrcNameStart + Header->NamesSize +
                         __llvm_profile_get_num_padding_bytes(
                             Header->NamesSize));
 
+  /* Records are matched by position when the layouts agree, and through
+   * the index otherwise. Those of functions this module doesn't have, or
+   * has with another hash, are dropped. */
   for (SrcData = SrcDataStart,
       DstData = (__llvm_profile_data *)__llvm_profile_begin_data(),
       SrcValueProfData = SrcValueProfDataStart;
        SrcData < SrcDataEnd; ++SrcData, ++DstData) {
-    uint64_t *SrcCounters;
-    uint64_t *DstCounters = (uint64_t *)DstData->CounterPtr;
+    __llvm_profile_data *MatchedData = findDstData(SrcData, DstData);
+    uint64_t SrcIndex =
+        ((size_t)SrcData->CounterPtr - Header->CountersDelta) /
+        sizeof(uint64_t);
     unsigned I, NC, NVK = 0;
+    int InBounds;
 
     NC = SrcData->NumCounters;
-    SrcCounters = SrcCountersStart +
-                  ((size_t)SrcData->CounterPtr - Header->CountersDelta) /
-                      sizeof(uint64_t);
-    for (I = 0; I < NC; I++)
-      DstCounters[I] += SrcCounters[I];
+    InBounds = (size_t)SrcData->CounterPtr >= Header->CountersDelta &&
+               SrcIndex <= Header->CountersSize &&
+               Header->CountersSize - SrcIndex >= NC;
+    if (!MatchedData || !InBounds)
+      MatchedData = 0;
+    else if (Compact) {
+      uint64_t *DstCounters = (uint64_t *)MatchedData->CounterPtr;
+      uint64_t Value;
+      if (seekCounter(&Decoder, SrcIndex))
+        return;
+      for (I = 0; I < NC; I++) {
+        if (nextCounter(&Decoder, &Value))
+          return;
+        DstCounters[I] += Value;
+      }
+    } else {
+      uint64_t *DstCounters = (uint64_t *)MatchedData->CounterPtr;
+      uint64_t *SrcCounters = SrcCountersStart + SrcIndex;
+      for (I = 0; I < NC; I++)
+        DstCounters[I] += SrcCounters[I];
+    }
 
     /* Now merge value profile data.  */
     if (!VPMergeHook)
@@ -125,8 +348,40 @@ void __llvm_profile_merge_from_buffer(const char *ProfileData,
     if (!NVK)
       continue;
 
-    VPMergeHook(SrcValueProfData, DstData);
+    if (MatchedData &&
+        !memcmp(MatchedData->NumValueSites, SrcData->NumValueSites,
+                sizeof(SrcData->NumValueSites)))
+      VPMergeHook(SrcValueProfData, MatchedData);
     SrcValueProfData = (ValueProfData *)((char *)SrcValueProfData +
                                          SrcValueProfData->TotalSize);
   }
 }
+
+#if COMPILER_RT_HAS_ATOMICS == 1 && !defined(_MSC_VER)
+COMPILER_RT_VISIBILITY
+void lprofMergeCountersToBuffer(char *ProfileData) {
+  __llvm_profile_header *Header = (__llvm_profile_header *)ProfileData;
+  __llvm_profile_data *DstDataStart, *DstDataEnd, *DstData, *SrcData;
+  uint64_t *DstCountersStart;
+
+  DstDataStart =
+      (__llvm_profile_data *)(ProfileData + sizeof(__llvm_profile_header));
+  DstDataEnd = DstDataStart + Header->DataSize;
+  DstCountersStart = (uint64_t *)DstDataEnd;
+
+  for (DstData = DstDataStart,
+      SrcData = (__llvm_profile_data *)__llvm_profile_begin_data();
+       DstData < DstDataEnd; ++DstData, ++SrcData) {
+    uint64_t *SrcCounters = (uint64_t *)SrcData->CounterPtr;
+    uint64_t *DstCounters =
+        DstCountersStart +
+        ((size_t)DstData->CounterPtr - Header->CountersDelta) /
+            sizeof(uint64_t);
+    unsigned I, NC = DstData->NumCounters;
+
+    for (I = 0; I < NC; I++)
+      if (SrcCounters[I])
+        __sync_fetch_and_add(&DstCounters[I], SrcCounters[I]);
+  }
+}
+#endif
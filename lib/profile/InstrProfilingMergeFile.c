@@ -24,17 +24,21 @@ void (*VPMergeHook)(ValueProfData *,
  * in-memory profile counters pointed by to DstData.  */
 void lprofMergeValueProfData(ValueProfData *SrcValueProfData,
                              __llvm_profile_data *DstData) {
-  unsigned I, S, V, C;
+  unsigned I, S, V, SiteBase;
   InstrProfValueData *VData;
   ValueProfRecord *VR = getFirstValueProfRecord(SrcValueProfData);
   for (I = 0; I < SrcValueProfData->NumValueKinds; I++) {
+    /* Sites of all kinds share one array, in value kind order. */
+    SiteBase = 0;
+    for (V = IPVK_First; V < VR->Kind; V++)
+      SiteBase += DstData->NumValueSites[V];
     VData = getValueProfRecordValueData(VR);
     for (S = 0; S < VR->NumValueSites; S++) {
       uint8_t NV = VR->SiteCountArray[S];
-      for (V = 0; V < NV; V++) {
-        for (C = 0; C < VData[V].Count; C++)
-          __llvm_profile_instrument_target(VData[V].Value, DstData, S);
-      }
+      for (V = 0; V < NV; V++)
+        lprofInstrumentTarget(VData[V].Value, DstData, SiteBase + S,
+                              VData[V].Count);
+      VData += NV;
     }
     VR = getValueProfRecordNext(VR);
   }
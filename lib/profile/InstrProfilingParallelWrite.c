@@ -0,0 +1,179 @@
+/*===- InstrProfilingParallelWrite.c - Write all modules' profiles at once ===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#if defined(__linux__)
+
+#ifndef _GNU_SOURCE
+/* For dladdr(). */
+#define _GNU_SOURCE
+#endif
+
+#include "InstrProfiling.h"
+#include "InstrProfilingInternal.h"
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The threads and the loader interfaces are referenced weakly so that
+ * programs need not link with libpthread or libdl. Without them, each
+ * module writes its own profile. */
+#pragma weak pthread_create
+#pragma weak pthread_join
+#pragma weak dladdr
+#pragma weak dlopen
+
+/* Every instrumented module has its own copy of the runtime. With
+ * LLVM_PROFILE_PARALLEL_WRITE set, each copy registers its writer with the
+ * one registry shared by the process, the first definition of the
+ * interposable symbol below. The exit handler of whichever module runs
+ * first then writes the profiles of all modules on several threads. */
+#define PARALLEL_WRITERS_VERSION 1
+
+typedef struct ParallelWriter {
+  /* All registered writers. */
+  struct ParallelWriter *Next;
+  /* Writers queued for the threads. */
+  struct ParallelWriter *NextPending;
+  int (*Write)(void);
+  /* Set once the writer has been queued. */
+  unsigned Claimed;
+} ParallelWriter;
+
+typedef struct ParallelWriters {
+  uint64_t Version;
+  pthread_mutex_t Lock;
+  /* Signalled whenever a write completes. */
+  pthread_cond_t Done;
+  ParallelWriter *Writers;
+  ParallelWriter *Pending;
+  unsigned NumWriting;
+} ParallelWriters;
+
+COMPILER_RT_WEAK ParallelWriters __llvm_profile_parallel_writers = {
+    PARALLEL_WRITERS_VERSION, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, 0, 0, 0};
+
+static ParallelWriter ThisWriter = {0, 0, __llvm_profile_write_file, 0};
+static unsigned ThisWriterRegistered = 0;
+
+typedef struct ModuleLookup {
+  uintptr_t Address;
+  int InMainProgram;
+} ModuleLookup;
+
+/* The main program is reported first; stop after it. */
+static int lookUpMainProgram(struct dl_phdr_info *Info, size_t Size,
+                             void *Arg) {
+  ModuleLookup *Lookup = (ModuleLookup *)Arg;
+  unsigned I;
+  (void)Size;
+  for (I = 0; I < Info->dlpi_phnum; ++I) {
+    const ElfW(Phdr) *Phdr = &Info->dlpi_phdr[I];
+    uintptr_t Begin = Info->dlpi_addr + Phdr->p_vaddr;
+    if (Phdr->p_type == PT_LOAD && Lookup->Address >= Begin &&
+        Lookup->Address - Begin < Phdr->p_memsz)
+      Lookup->InMainProgram = 1;
+  }
+  return 1;
+}
+
+/* Make sure this module stays loaded until exit, so that the registered
+ * writer stays valid. Returns 0 on success. */
+static int pinThisModule(void) {
+  ModuleLookup Lookup = {(uintptr_t)&ThisWriter, 0};
+  Dl_info Info;
+
+  dl_iterate_phdr(lookUpMainProgram, &Lookup);
+  if (Lookup.InMainProgram)
+    return 0;
+  if (!dladdr || !dlopen || !dladdr(&ThisWriter, &Info) || !Info.dli_fname)
+    return -1;
+  return dlopen(Info.dli_fname, RTLD_LAZY | RTLD_NOLOAD | RTLD_NODELETE)
+             ? 0
+             : -1;
+}
+
+COMPILER_RT_VISIBILITY int lprofRegisterParallelWriter(void) {
+  ParallelWriters *Registry = &__llvm_profile_parallel_writers;
+  const char *ParallelStr = getenv("LLVM_PROFILE_PARALLEL_WRITE");
+
+  if (!ParallelStr || !ParallelStr[0] || !strcmp(ParallelStr, "0") ||
+      !pthread_create || !pthread_join ||
+      Registry->Version != PARALLEL_WRITERS_VERSION || pinThisModule())
+    return -1;
+
+  pthread_mutex_lock(&Registry->Lock);
+  ThisWriter.Next = Registry->Writers;
+  Registry->Writers = &ThisWriter;
+  pthread_mutex_unlock(&Registry->Lock);
+  ThisWriterRegistered = 1;
+  return 0;
+}
+
+COMPILER_RT_VISIBILITY unsigned lprofParallelWriterRegistered(void) {
+  return ThisWriterRegistered;
+}
+
+/* Write queued profiles until there are none left. */
+static void *writeProfiles(void *Arg) {
+  ParallelWriters *Registry = (ParallelWriters *)Arg;
+  ParallelWriter *Writer;
+
+  pthread_mutex_lock(&Registry->Lock);
+  while ((Writer = Registry->Pending)) {
+    Registry->Pending = Writer->NextPending;
+    Registry->NumWriting++;
+    pthread_mutex_unlock(&Registry->Lock);
+    Writer->Write();
+    pthread_mutex_lock(&Registry->Lock);
+    Registry->NumWriting--;
+    pthread_cond_broadcast(&Registry->Done);
+  }
+  pthread_mutex_unlock(&Registry->Lock);
+  return 0;
+}
+
+COMPILER_RT_VISIBILITY void lprofWriteParallel(void) {
+  ParallelWriters *Registry = &__llvm_profile_parallel_writers;
+  ParallelWriter *Writer;
+  pthread_t Threads[7];
+  unsigned NumWriters = 0, NumThreads = 0, I;
+
+  pthread_mutex_lock(&Registry->Lock);
+  /* Another module's exit handler got here first and is writing all
+   * profiles, including this one. */
+  if (ThisWriter.Claimed) {
+    while (Registry->Pending || Registry->NumWriting)
+      pthread_cond_wait(&Registry->Done, &Registry->Lock);
+    pthread_mutex_unlock(&Registry->Lock);
+    return;
+  }
+  for (Writer = Registry->Writers; Writer; Writer = Writer->Next) {
+    if (Writer->Claimed)
+      continue;
+    Writer->Claimed = 1;
+    Writer->NextPending = Registry->Pending;
+    Registry->Pending = Writer;
+    ++NumWriters;
+  }
+  pthread_mutex_unlock(&Registry->Lock);
+
+  /* Writing is mostly waiting for the kernel, so the number of threads
+   * does not depend on the number of CPUs. This thread writes too. */
+  for (I = 1; I < NumWriters && I <= sizeof(Threads) / sizeof(*Threads); ++I)
+    if (!pthread_create(&Threads[NumThreads], 0, writeProfiles, Registry))
+      ++NumThreads;
+  writeProfiles(Registry);
+  for (I = 0; I < NumThreads; ++I)
+    pthread_join(Threads[I], 0);
+}
+
+#endif
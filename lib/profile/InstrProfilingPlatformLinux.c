@@ -33,11 +33,14 @@ extern char PROF_NAME_STOP COMPILER_RT_VISIBILITY;
 extern ValueProfNode PROF_VNODES_START COMPILER_RT_VISIBILITY;
 extern ValueProfNode PROF_VNODES_STOP COMPILER_RT_VISIBILITY;
 
-/* Add dummy data to ensure the section is always created. */
+/* Add dummy data to ensure the section is always created. The counters
+ * one is page aligned so that the counters section starts, and as the
+ * runtime normally comes last in the link ends, on a page boundary and can
+ * be mapped onto the profile file in continuous mode. */
 __llvm_profile_data
     __prof_data_sect_data[0] COMPILER_RT_SECTION(INSTR_PROF_DATA_SECT_NAME_STR);
-uint64_t
-    __prof_cnts_sect_data[0] COMPILER_RT_SECTION(INSTR_PROF_CNTS_SECT_NAME_STR);
+uint64_t __prof_cnts_sect_data[0] COMPILER_RT_ALIGNAS(4096)
+    COMPILER_RT_SECTION(INSTR_PROF_CNTS_SECT_NAME_STR);
 char __prof_nms_sect_data[0] COMPILER_RT_SECTION(INSTR_PROF_NAME_SECT_NAME_STR);
 ValueProfNode __prof_vnodes_sect_data[0] COMPILER_RT_SECTION(INSTR_PROF_VNODES_SECT_NAME_STR);
 
@@ -0,0 +1,204 @@
+/*===- InstrProfilingSnapshot.c - Per-phase snapshots of the counters -----===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#if !defined(_WIN32)
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* For mremap(). */
+#define _GNU_SOURCE
+#endif
+
+#include "InstrProfiling.h"
+#include "InstrProfilingInternal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#ifndef MREMAP_DONTUNMAP
+#define MREMAP_DONTUNMAP 4
+#endif
+#endif
+
+/* The counts of one phase, on their way to a file. */
+typedef struct ProfileSnapshot {
+  struct ProfileSnapshot *Next;
+  pthread_t Thread;
+  char *Filename;
+  /* Anonymous mapping holding Counters, laid out so that its pages line up
+   * with those of the counters section. */
+  void *Mapping;
+  size_t MappingSize;
+  uint64_t *Counters;
+  int Result;
+} ProfileSnapshot;
+
+/* Snapshots whose writer thread has not been joined yet. */
+static ProfileSnapshot *PendingSnapshots;
+/* Serializes snapshots against each other and against waiting. */
+static pthread_mutex_t SnapshotLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t SnapshotOnce = PTHREAD_ONCE_INIT;
+
+static uintptr_t alignDown(uintptr_t Value, uintptr_t PageSize) {
+  return Value & ~(PageSize - 1);
+}
+
+static uintptr_t alignUp(uintptr_t Value, uintptr_t PageSize) {
+  return alignDown(Value + PageSize - 1, PageSize);
+}
+
+/* Move the counters in [Begin, End) to \p Dst and clear them, one at a time
+ * so that concurrent atomic updates are not lost. */
+static void exchangeCounters(uint64_t *Dst, uint64_t *Begin, uint64_t *End) {
+  for (; Begin < End; ++Begin, ++Dst)
+    *Dst = __sync_lock_test_and_set(Begin, 0);
+}
+
+/* Move the pages in [Begin, End) to \p Dst, leaving behind fresh pages that
+ * read as they did when the module was loaded, that is with zero counters.
+ * Only the page tables are touched. Returns 0 on success. */
+static int moveCounterPages(uint64_t *Dst, uint64_t *Begin, uint64_t *End) {
+#if defined(__linux__)
+  size_t Size = (char *)End - (char *)Begin;
+  return mremap(Begin, Size, Size, MREMAP_MAYMOVE | MREMAP_FIXED |
+                                       MREMAP_DONTUNMAP,
+                Dst) == MAP_FAILED;
+#else
+  return -1;
+#endif
+}
+
+/* Take the counts out of the counters section. Must be called with
+ * SnapshotLock held. */
+static int takeSnapshot(ProfileSnapshot *Snapshot) {
+  uint64_t *Begin = __llvm_profile_begin_counters();
+  uint64_t *End = __llvm_profile_end_counters();
+  uintptr_t PageSize = getpagesize();
+  uintptr_t Offset = (uintptr_t)Begin & (PageSize - 1);
+  uint64_t *PagesBegin = (uint64_t *)alignUp((uintptr_t)Begin, PageSize);
+  uint64_t *PagesEnd = (uint64_t *)alignDown((uintptr_t)End, PageSize);
+
+  Snapshot->MappingSize =
+      alignUp(Offset + (End - Begin) * sizeof(uint64_t), PageSize);
+  Snapshot->Mapping = mmap(0, Snapshot->MappingSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Snapshot->Mapping == MAP_FAILED)
+    return -1;
+  Snapshot->Counters = (uint64_t *)((char *)Snapshot->Mapping + Offset);
+
+  /* Counters that share their pages with other data, and all of them if the
+   * pages can't be moved, are exchanged one by one. */
+  if (PagesBegin >= PagesEnd ||
+      moveCounterPages(Snapshot->Counters + (PagesBegin - Begin), PagesBegin,
+                       PagesEnd)) {
+    exchangeCounters(Snapshot->Counters, Begin, End);
+    return 0;
+  }
+  exchangeCounters(Snapshot->Counters, Begin, PagesBegin);
+  exchangeCounters(Snapshot->Counters + (PagesEnd - Begin), PagesEnd, End);
+  return 0;
+}
+
+static void freeSnapshot(ProfileSnapshot *Snapshot) {
+  munmap(Snapshot->Mapping, Snapshot->MappingSize);
+  free(Snapshot->Filename);
+  free(Snapshot);
+}
+
+static void *writeSnapshot(void *Arg) {
+  ProfileSnapshot *Snapshot = (ProfileSnapshot *)Arg;
+  Snapshot->Result =
+      lprofWriteSnapshotFile(Snapshot->Filename, Snapshot->Counters);
+  return 0;
+}
+
+static void waitForSnapshotsAtExit(void) {
+  __llvm_profile_wait_for_snapshots();
+}
+
+/* The writer threads don't survive fork; forget about their snapshots. */
+static void forgetSnapshotsInChild(void) {
+  pthread_mutex_init(&SnapshotLock, 0);
+  PendingSnapshots = 0;
+}
+
+static void initSnapshots(void) {
+  pthread_atfork(0, 0, forgetSnapshotsInChild);
+  atexit(waitForSnapshotsAtExit);
+}
+
+COMPILER_RT_VISIBILITY int __llvm_profile_snapshot(const char *Filename) {
+  ProfileSnapshot *Snapshot;
+  int RetVal;
+
+  if (__llvm_profile_begin_data() == __llvm_profile_end_data())
+    return 0;
+  /* The counters section is backed by the profile file and can't be moved. */
+  if (lprofContinuousModeActive()) {
+    PROF_ERR("Failed to take profile snapshot: %s\n",
+             "not supported in continuous mode");
+    return -1;
+  }
+
+  Snapshot = (ProfileSnapshot *)calloc(1, sizeof(ProfileSnapshot));
+  if (!Snapshot || !(Snapshot->Filename = strdup(Filename))) {
+    free(Snapshot);
+    PROF_ERR("Failed to take profile snapshot: %s\n", strerror(errno));
+    return -1;
+  }
+
+  pthread_once(&SnapshotOnce, initSnapshots);
+  pthread_mutex_lock(&SnapshotLock);
+  if (lprofThreadCountersHook)
+    lprofThreadCountersHook(0);
+  if (takeSnapshot(Snapshot)) {
+    pthread_mutex_unlock(&SnapshotLock);
+    PROF_ERR("Failed to take profile snapshot: %s\n", strerror(errno));
+    free(Snapshot->Filename);
+    free(Snapshot);
+    return -1;
+  }
+  /* Without a thread the snapshot is written right away. */
+  if (pthread_create(&Snapshot->Thread, 0, writeSnapshot, Snapshot)) {
+    pthread_mutex_unlock(&SnapshotLock);
+    writeSnapshot(Snapshot);
+    RetVal = Snapshot->Result;
+    freeSnapshot(Snapshot);
+    return RetVal;
+  }
+  Snapshot->Next = PendingSnapshots;
+  PendingSnapshots = Snapshot;
+  pthread_mutex_unlock(&SnapshotLock);
+  return 0;
+}
+
+COMPILER_RT_VISIBILITY int __llvm_profile_wait_for_snapshots(void) {
+  ProfileSnapshot *Snapshot;
+  int RetVal = 0;
+
+  pthread_mutex_lock(&SnapshotLock);
+  Snapshot = PendingSnapshots;
+  PendingSnapshots = 0;
+  pthread_mutex_unlock(&SnapshotLock);
+
+  while (Snapshot) {
+    ProfileSnapshot *Next = Snapshot->Next;
+    pthread_join(Snapshot->Thread, 0);
+    RetVal |= Snapshot->Result;
+    freeSnapshot(Snapshot);
+    Snapshot = Next;
+  }
+  return RetVal;
+}
+
+#endif
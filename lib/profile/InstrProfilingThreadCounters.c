@@ -0,0 +1,117 @@
+/*===- InstrProfilingThreadCounters.c - Per-thread copies of counters -----===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#if !defined(_WIN32)
+
+#include "InstrProfiling.h"
+#include "InstrProfilingInternal.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A thread's private copy of the counters section. The owner increments
+ * Counters without synchronization. Folding adds what was counted since the
+ * previous fold, as recorded in Folded, to the global counters, so the
+ * runtime never writes to a copy while its thread may be using it. */
+typedef struct ThreadCounters {
+  struct ThreadCounters *Next;
+  unsigned InUse;
+  uint64_t *Counters;
+  uint64_t *Folded;
+} ThreadCounters;
+
+/* All copies ever allocated. Those of exited threads are reused. */
+static ThreadCounters *AllThreadCounters;
+/* Serializes allocation and folding, both of which are rare. */
+static pthread_mutex_t ThreadCountersLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t ThreadCountersOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t ThreadCountersKey;
+static __thread ThreadCounters *CurrentThreadCounters;
+
+static uint64_t getNumCounters(void) {
+  return __llvm_profile_end_counters() - __llvm_profile_begin_counters();
+}
+
+/* Must be called with ThreadCountersLock held. */
+static void foldThreadCounters(ThreadCounters *TC, int Discard) {
+  uint64_t *Global = __llvm_profile_begin_counters();
+  uint64_t I, N = getNumCounters();
+  for (I = 0; I < N; ++I) {
+    uint64_t Value = TC->Counters[I];
+    uint64_t Delta = Value - TC->Folded[I];
+    if (!Delta)
+      continue;
+    if (!Discard)
+      __sync_fetch_and_add(&Global[I], Delta);
+    TC->Folded[I] = Value;
+  }
+}
+
+static void foldAllThreadCounters(int Discard) {
+  ThreadCounters *TC;
+  pthread_mutex_lock(&ThreadCountersLock);
+  for (TC = AllThreadCounters; TC; TC = TC->Next)
+    if (TC->InUse)
+      foldThreadCounters(TC, Discard);
+  pthread_mutex_unlock(&ThreadCountersLock);
+}
+
+/* Thread exit: fold the copy and make it available to new threads. */
+static void releaseThreadCounters(void *Arg) {
+  ThreadCounters *TC = (ThreadCounters *)Arg;
+  pthread_mutex_lock(&ThreadCountersLock);
+  foldThreadCounters(TC, 0);
+  memset(TC->Counters, 0, 2 * getNumCounters() * sizeof(uint64_t));
+  TC->InUse = 0;
+  pthread_mutex_unlock(&ThreadCountersLock);
+}
+
+static void initThreadCounters(void) {
+  pthread_key_create(&ThreadCountersKey, releaseThreadCounters);
+  lprofThreadCountersHook = foldAllThreadCounters;
+}
+
+COMPILER_RT_VISIBILITY uint64_t *__llvm_profile_thread_counters(void) {
+  ThreadCounters *TC = CurrentThreadCounters;
+  uint64_t N = getNumCounters();
+
+  if (TC)
+    return TC->Counters;
+  if (!N)
+    return __llvm_profile_begin_counters();
+
+  pthread_once(&ThreadCountersOnce, initThreadCounters);
+  pthread_mutex_lock(&ThreadCountersLock);
+  for (TC = AllThreadCounters; TC && TC->InUse; TC = TC->Next)
+    ;
+  if (!TC) {
+    TC = (ThreadCounters *)calloc(1, sizeof(ThreadCounters));
+    if (TC)
+      TC->Counters = (uint64_t *)calloc(2 * N, sizeof(uint64_t));
+    if (!TC || !TC->Counters) {
+      pthread_mutex_unlock(&ThreadCountersLock);
+      free(TC);
+      PROF_WARN("Unable to allocate %s, using the shared counters.\n",
+                "thread counters");
+      return __llvm_profile_begin_counters();
+    }
+    TC->Folded = TC->Counters + N;
+    TC->Next = AllThreadCounters;
+    AllThreadCounters = TC;
+  }
+  TC->InUse = 1;
+  pthread_mutex_unlock(&ThreadCountersLock);
+
+  pthread_setspecific(ThreadCountersKey, TC);
+  CurrentThreadCounters = TC;
+  return TC->Counters;
+}
+
+#endif
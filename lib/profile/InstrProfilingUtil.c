@@ -93,6 +93,17 @@ COMPILER_RT_VISIBILITY int lprofGetHostName(char *Name, int Len) {
 }
 #endif
 
+COMPILER_RT_VISIBILITY unsigned lprofGetNumberOfCPUs(void) {
+#ifdef _WIN32
+  SYSTEM_INFO Info;
+  GetSystemInfo(&Info);
+  return Info.dwNumberOfProcessors;
+#else
+  long N = sysconf(_SC_NPROCESSORS_ONLN);
+  return N > 0 ? (unsigned)N : 1;
+#endif
+}
+
 COMPILER_RT_VISIBILITY FILE *lprofOpenFileEx(const char *ProfileName) {
   FILE *f;
   int fd;
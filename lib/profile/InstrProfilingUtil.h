@@ -48,6 +48,9 @@ const char *lprofFindLastDirSeparator(const char *Path);
 
 int lprofGetHostName(char *Name, int Len);
 
+/* Returns the number of online CPUs, at least 1. */
+unsigned lprofGetNumberOfCPUs(void);
+
 unsigned lprofBoolCmpXchg(void **Ptr, void *OldV, void *NewV);
 void *lprofPtrFetchAdd(void **Mem, long ByteIncr);
 
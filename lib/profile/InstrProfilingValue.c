@@ -71,15 +71,52 @@ __llvm_get_function_addr(const __llvm_profile_data *Data) {
   return Data->FunctionPointer;
 }
 
+/* Number of values a dynamically allocated site tracks before it gets an
+ * index, below that walking the list is cheaper. */
+#define INSTR_PROF_VP_INDEX_THRESHOLD 8
+#define INSTR_PROF_VP_MIN_CHUNK_NODES 64
+
+/* Open-addressed index over the nodes of one value site, so looking up a
+ * value doesn't walk the list. Slots point to nodes of the site's list and
+ * are only a lookup aid: the list stays authoritative for the writer. */
+typedef struct ValueProfIndex {
+  uint32_t Mask;
+  /* Slots that are not empty, including tombstones. */
+  uint32_t NumUsed;
+  ValueProfNode *Slots[1];
+} ValueProfIndex;
+#define INSTR_PROF_VP_TOMBSTONE ((ValueProfNode *)1)
+
+/* Dynamically allocated nodes are carved out of chunks with a bump
+ * pointer. Nodes are never freed. */
+typedef struct ValueProfNodeChunk {
+  ValueProfNode *Next;
+  ValueProfNode *End;
+} ValueProfNodeChunk;
+static ValueProfNodeChunk *CurrentNodeChunk;
+
+/* Values that could not be tracked for lack of nodes. */
+static uint64_t NumDroppedValues = 0;
+
+COMPILER_RT_VISIBILITY uint64_t lprofGetNumDroppedValues() {
+  return NumDroppedValues;
+}
+
+static uint32_t getNumValueSites(const __llvm_profile_data *Data) {
+  uint32_t NumVSites = 0, VKI;
+  for (VKI = IPVK_First; VKI <= IPVK_Last; ++VKI)
+    NumVSites += Data->NumValueSites[VKI];
+  return NumVSites;
+}
+
 /* Allocate an array that holds the pointers to the linked lists of
  * value profile counter nodes. The number of element of the array
- * is the total number of value profile sites instrumented. Returns
- * 0 if allocation fails.
+ * is the total number of value profile sites instrumented. It is followed
+ * by as many pointers to the sites' indices. Returns 0 if allocation fails.
  */
 
 static int allocateValueProfileCounters(__llvm_profile_data *Data) {
-  uint64_t NumVSites = 0;
-  uint32_t VKI;
+  uint64_t NumVSites;
 
   /* This function will never be called when value site array is allocated
      statically at compile time.  */
@@ -89,11 +126,10 @@ static int allocateValueProfileCounters(__llvm_profile_data *Data) {
   if (!hasNonDefaultValsPerSite)
     VPMaxNumValsPerSite = INSTR_PROF_MAX_NUM_VAL_PER_SITE;
 
-  for (VKI = IPVK_First; VKI <= IPVK_Last; ++VKI)
-    NumVSites += Data->NumValueSites[VKI];
+  NumVSites = getNumValueSites(Data);
 
   ValueProfNode **Mem =
-      (ValueProfNode **)calloc(NumVSites, sizeof(ValueProfNode *));
+      (ValueProfNode **)calloc(2 * NumVSites, sizeof(ValueProfNode *));
   if (!Mem)
     return 0;
   if (!COMPILER_RT_BOOL_CMPXCHG(&Data->Values, 0, Mem)) {
@@ -103,12 +139,39 @@ static int allocateValueProfileCounters(__llvm_profile_data *Data) {
   return 1;
 }
 
+static ValueProfNode *allocateDynamicNode(void) {
+  ValueProfNodeChunk *Chunk, *NewChunk;
+  ValueProfNode *Node;
+  uint32_t NumNodes;
+
+  for (;;) {
+    Chunk = CurrentNodeChunk;
+    if (Chunk) {
+      Node = COMPILER_RT_PTR_FETCH_ADD(ValueProfNode, Chunk->Next, 1);
+      if (Node < Chunk->End)
+        return Node;
+    }
+    /* Size chunks so that a few sites can fill up from each. */
+    NumNodes = 4 * VPMaxNumValsPerSite;
+    if (NumNodes < INSTR_PROF_VP_MIN_CHUNK_NODES)
+      NumNodes = INSTR_PROF_VP_MIN_CHUNK_NODES;
+    NewChunk = (ValueProfNodeChunk *)calloc(
+        1, sizeof(ValueProfNodeChunk) + NumNodes * sizeof(ValueProfNode));
+    if (!NewChunk)
+      return 0;
+    NewChunk->Next = (ValueProfNode *)(NewChunk + 1);
+    NewChunk->End = NewChunk->Next + NumNodes;
+    if (!COMPILER_RT_BOOL_CMPXCHG(&CurrentNodeChunk, Chunk, NewChunk))
+      free(NewChunk);
+  }
+}
+
 static ValueProfNode *allocateOneNode(__llvm_profile_data *Data, uint32_t Index,
                                       uint64_t Value) {
   ValueProfNode *Node;
 
   if (!hasStaticCounters)
-    return (ValueProfNode *)calloc(1, sizeof(ValueProfNode));
+    return allocateDynamicNode();
 
   /* Early check to avoid value wrapping around.  */
   if (CurrentVNode + 1 > EndVNode) {
@@ -130,11 +193,82 @@ static ValueProfNode *allocateOneNode(__llvm_profile_data *Data, uint32_t Index,
   return Node;
 }
 
-COMPILER_RT_VISIBILITY void
-__llvm_profile_instrument_target(uint64_t TargetValue, void *Data,
-                                 uint32_t CounterIndex) {
-  __llvm_profile_data *PData = (__llvm_profile_data *)Data;
-  if (!PData)
+static uint32_t hashValue(uint64_t Value) {
+  return (uint32_t)((Value * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static ValueProfNode *lookupValue(ValueProfIndex *Index, uint64_t Value) {
+  uint32_t I = hashValue(Value) & Index->Mask, N;
+  for (N = 0; N <= Index->Mask; ++N, I = (I + 1) & Index->Mask) {
+    ValueProfNode *Node = Index->Slots[I];
+    if (!Node)
+      return 0;
+    if (Node != INSTR_PROF_VP_TOMBSTONE && Node->Value == Value)
+      return Node;
+  }
+  return 0;
+}
+
+static void removeValue(ValueProfIndex *Index, ValueProfNode *Node,
+                        uint64_t Value) {
+  uint32_t I = hashValue(Value) & Index->Mask, N;
+  for (N = 0; N <= Index->Mask; ++N, I = (I + 1) & Index->Mask) {
+    if (!Index->Slots[I])
+      return;
+    if (Index->Slots[I] == Node) {
+      Index->Slots[I] = INSTR_PROF_VP_TOMBSTONE;
+      return;
+    }
+  }
+}
+
+static void insertValue(ValueProfIndex *Index, ValueProfNode *Node,
+                        ValueProfNode *Head) {
+  uint32_t I = hashValue(Node->Value) & Index->Mask;
+
+  /* Too many tombstones make probes long, start over from the list. */
+  if (2 * (Index->NumUsed + 1) > Index->Mask + 1) {
+    memset(Index->Slots, 0, (Index->Mask + 1) * sizeof(ValueProfNode *));
+    Index->NumUsed = 0;
+    for (; Head; Head = Head->Next)
+      if (Head != Node)
+        insertValue(Index, Head, 0);
+  }
+  while (Index->Slots[I] && Index->Slots[I] != INSTR_PROF_VP_TOMBSTONE)
+    I = (I + 1) & Index->Mask;
+  if (!Index->Slots[I])
+    Index->NumUsed++;
+  Index->Slots[I] = Node;
+}
+
+/* Index the site once its list gets long. Returns the index, or 0. */
+static ValueProfIndex *createIndex(ValueProfIndex **IndexSlot,
+                                   ValueProfNode *Head) {
+  uint32_t Size = 32;
+  ValueProfIndex *Index;
+  while (Size < 4 * VPMaxNumValsPerSite)
+    Size *= 2;
+  Index = (ValueProfIndex *)calloc(
+      1, sizeof(ValueProfIndex) + (Size - 1) * sizeof(ValueProfNode *));
+  if (!Index)
+    return 0;
+  Index->Mask = Size - 1;
+  for (; Head; Head = Head->Next)
+    insertValue(Index, Head, 0);
+  if (!COMPILER_RT_BOOL_CMPXCHG(IndexSlot, 0, Index)) {
+    free(Index);
+    return *IndexSlot;
+  }
+  return Index;
+}
+
+/* Add \p Count occurrences of \p TargetValue to the site. This has the same
+ * result as that many calls to __llvm_profile_instrument_target. */
+COMPILER_RT_VISIBILITY void lprofInstrumentTarget(uint64_t TargetValue,
+                                                  __llvm_profile_data *PData,
+                                                  uint32_t CounterIndex,
+                                                  uint64_t Count) {
+  if (!PData || !Count)
     return;
 
   if (!PData->Values) {
@@ -143,17 +277,37 @@ __llvm_profile_instrument_target(uint64_t TargetValue, void *Data,
   }
 
   ValueProfNode **ValueCounters = (ValueProfNode **)PData->Values;
+  ValueProfIndex **IndexSlot = 0;
+  ValueProfIndex *Index = 0;
   ValueProfNode *PrevVNode = NULL;
   ValueProfNode *MinCountVNode = NULL;
   ValueProfNode *CurVNode = ValueCounters[CounterIndex];
   uint64_t MinCount = UINT64_MAX;
 
-  uint8_t VDataCount = 0;
-  while (CurVNode) {
-    if (TargetValue == CurVNode->Value) {
-      CurVNode->Count++;
+  if (!hasStaticCounters) {
+    IndexSlot = (ValueProfIndex **)(ValueCounters + getNumValueSites(PData)) +
+                CounterIndex;
+    Index = *IndexSlot;
+  }
+
+  if (Index) {
+    CurVNode = lookupValue(Index, TargetValue);
+    if (CurVNode) {
+      CurVNode->Count += Count;
       return;
     }
+    CurVNode = ValueCounters[CounterIndex];
+  } else {
+    for (; CurVNode; CurVNode = CurVNode->Next)
+      if (TargetValue == CurVNode->Value) {
+        CurVNode->Count += Count;
+        return;
+      }
+    CurVNode = ValueCounters[CounterIndex];
+  }
+
+  uint8_t VDataCount = 0;
+  while (CurVNode) {
     if (CurVNode->Count < MinCount) {
       MinCount = CurVNode->Count;
       MinCountVNode = CurVNode;
@@ -191,20 +345,31 @@ __llvm_profile_instrument_target(uint64_t TargetValue, void *Data,
      * When the total number of evictions reaches certain threshold,
      * the runtime can wipe out more than one lowest count entries
      * to give space for hot targets.
+     *
+     * Adding \c Count at once first uses it up on bumping down the
+     * min count, and puts whatever is left on the new value.
      */
-    if (!MinCountVNode->Count || !(--MinCountVNode->Count)) {
-      CurVNode = MinCountVNode;
-      CurVNode->Value = TargetValue;
-      CurVNode->Count++;
+    if (MinCountVNode->Count > Count) {
+      MinCountVNode->Count -= Count;
+      return;
     }
+    CurVNode = MinCountVNode;
+    if (Index)
+      removeValue(Index, CurVNode, CurVNode->Value);
+    CurVNode->Value = TargetValue;
+    CurVNode->Count = Count - CurVNode->Count + (CurVNode->Count != 0);
+    if (Index)
+      insertValue(Index, CurVNode, ValueCounters[CounterIndex]);
     return;
   }
 
   CurVNode = allocateOneNode(PData, CounterIndex, TargetValue);
-  if (!CurVNode)
+  if (!CurVNode) {
+    NumDroppedValues++;
     return;
+  }
   CurVNode->Value = TargetValue;
-  CurVNode->Count++;
+  CurVNode->Count += Count;
 
   uint32_t Success = 0;
   if (!ValueCounters[CounterIndex])
@@ -213,10 +378,21 @@ __llvm_profile_instrument_target(uint64_t TargetValue, void *Data,
   else if (PrevVNode && !PrevVNode->Next)
     Success = COMPILER_RT_BOOL_CMPXCHG(&(PrevVNode->Next), 0, CurVNode);
 
-  if (!Success && !hasStaticCounters) {
-    free(CurVNode);
+  /* A dynamic node that lost the race is not reused, it comes from a bump
+   * allocated chunk. */
+  if (!Success || !IndexSlot)
     return;
-  }
+  if (Index)
+    insertValue(Index, CurVNode, ValueCounters[CounterIndex]);
+  else if (VDataCount + 1 >= INSTR_PROF_VP_INDEX_THRESHOLD)
+    createIndex(IndexSlot, ValueCounters[CounterIndex]);
+}
+
+COMPILER_RT_VISIBILITY void
+__llvm_profile_instrument_target(uint64_t TargetValue, void *Data,
+                                 uint32_t CounterIndex) {
+  lprofInstrumentTarget(TargetValue, (__llvm_profile_data *)Data,
+                        CounterIndex, 1);
 }
 
 /*
@@ -225,28 +225,81 @@ static int writeValueProfData(WriterCallback Writer, void *WriterCtx,
   return 0;
 }
 
-COMPILER_RT_VISIBILITY int lprofWriteData(WriterCallback Writer,
-                                          void *WriterCtx,
-                                          VPDataReaderType *VPDataReader) {
-  /* Match logic in __llvm_profile_write_buffer(). */
-  const __llvm_profile_data *DataBegin = __llvm_profile_begin_data();
-  const __llvm_profile_data *DataEnd = __llvm_profile_end_data();
-  const uint64_t *CountersBegin = __llvm_profile_begin_counters();
-  const uint64_t *CountersEnd = __llvm_profile_end_counters();
-  const char *NamesBegin = __llvm_profile_begin_names();
-  const char *NamesEnd = __llvm_profile_end_names();
-  return lprofWriteDataImpl(Writer, WriterCtx, DataBegin, DataEnd,
-                            CountersBegin, CountersEnd, VPDataReader,
-                            NamesBegin, NamesEnd);
+
+/* Encodes counters as described for VARIANT_MASK_COMPACT_COUNTERS and hands
+ * them to the writer in chunks. */
+typedef struct CompactEncoder {
+  WriterCallback Writer;
+  void **WriterCtx;
+  uint8_t Buffer[1024];
+  uint32_t Size;
+  uint64_t Written;
+} CompactEncoder;
+
+static int flushCompactEncoder(CompactEncoder *E) {
+  ProfDataIOVec IO[] = {{E->Buffer, sizeof(uint8_t), E->Size}};
+  if (E->Size && E->Writer(IO, 1, E->WriterCtx))
+    return -1;
+  E->Written += E->Size;
+  E->Size = 0;
+  return 0;
 }
 
-COMPILER_RT_VISIBILITY int
-lprofWriteDataImpl(WriterCallback Writer, void *WriterCtx,
-                   const __llvm_profile_data *DataBegin,
-                   const __llvm_profile_data *DataEnd,
-                   const uint64_t *CountersBegin, const uint64_t *CountersEnd,
-                   VPDataReaderType *VPDataReader, const char *NamesBegin,
-                   const char *NamesEnd) {
+/* Append a byte and a ULEB128 value. \p WithByte selects whether the byte
+ * is written. */
+static int encodeValue(CompactEncoder *E, int WithByte, uint8_t Byte,
+                       uint64_t Value) {
+  /* A byte and up to 10 bytes of ULEB128. */
+  if (E->Size + 11 > sizeof(E->Buffer) && flushCompactEncoder(E))
+    return -1;
+  if (WithByte)
+    E->Buffer[E->Size++] = Byte;
+  do {
+    uint8_t B = Value & 0x7f;
+    Value >>= 7;
+    E->Buffer[E->Size++] = Value ? B | 0x80 : B;
+  } while (Value);
+  return 0;
+}
+
+static int writeCompactCounters(WriterCallback Writer, void **WriterCtx,
+                                const uint64_t *Counters, uint64_t N) {
+  CompactEncoder E;
+  uint64_t I = 0;
+
+  E.Writer = Writer;
+  E.WriterCtx = WriterCtx;
+  E.Size = 0;
+  E.Written = 0;
+  while (I < N) {
+    uint64_t Run = 0;
+    if (Counters[I]) {
+      if (encodeValue(&E, 0, 0, Counters[I++]))
+        return -1;
+      continue;
+    }
+    while (I + Run < N && !Counters[I + Run])
+      ++Run;
+    if (encodeValue(&E, 1, 0, Run))
+      return -1;
+    I += Run;
+  }
+  while ((E.Written + E.Size) % sizeof(uint64_t))
+    E.Buffer[E.Size++] = 0;
+  return flushCompactEncoder(&E);
+}
+
+/* Write the profile of the given sections, taking the counter values from
+ * \p CountersData rather than from the section itself. With \p Compact set
+ * the counters are encoded as described for VARIANT_MASK_COMPACT_COUNTERS. */
+static int writeDataImpl(WriterCallback Writer, void *WriterCtx,
+                         const __llvm_profile_data *DataBegin,
+                         const __llvm_profile_data *DataEnd,
+                         const uint64_t *CountersBegin,
+                         const uint64_t *CountersEnd,
+                         const uint64_t *CountersData, unsigned Compact,
+                         VPDataReaderType *VPDataReader,
+                         const char *NamesBegin, const char *NamesEnd) {
 
   /* Calculate size of sections. */
   const uint64_t DataSize = __llvm_profile_get_data_size(DataBegin, DataEnd);
@@ -267,15 +320,70 @@ lprofWriteDataImpl(WriterCallback Writer, void *WriterCtx,
 #define INSTR_PROF_RAW_HEADER(Type, Name, Init) Header.Name = Init;
 #include "InstrProfData.inc"
 
-  /* Write the data. */
-  ProfDataIOVec IOVec[] = {{&Header, sizeof(__llvm_profile_header), 1},
-                           {DataBegin, sizeof(__llvm_profile_data), DataSize},
-                           {CountersBegin, sizeof(uint64_t), CountersSize},
-                           {NamesBegin, sizeof(uint8_t), NamesSize},
-                           {Zeroes, sizeof(uint8_t), Padding}};
-  if (Writer(IOVec, sizeof(IOVec) / sizeof(*IOVec), &WriterCtx))
-    return -1;
+  if (Compact) {
+    ProfDataIOVec HeaderIOVec[] = {
+        {&Header, sizeof(__llvm_profile_header), 1},
+        {DataBegin, sizeof(__llvm_profile_data), DataSize}};
+    ProfDataIOVec NamesIOVec[] = {{NamesBegin, sizeof(uint8_t), NamesSize},
+                                  {Zeroes, sizeof(uint8_t), Padding}};
+    Header.Version |= VARIANT_MASK_COMPACT_COUNTERS;
+    if (Writer(HeaderIOVec, sizeof(HeaderIOVec) / sizeof(*HeaderIOVec),
+               &WriterCtx) ||
+        writeCompactCounters(Writer, &WriterCtx, CountersData, CountersSize) ||
+        Writer(NamesIOVec, sizeof(NamesIOVec) / sizeof(*NamesIOVec),
+               &WriterCtx))
+      return -1;
+  } else {
+    /* Write the data. */
+    ProfDataIOVec IOVec[] = {{&Header, sizeof(__llvm_profile_header), 1},
+                             {DataBegin, sizeof(__llvm_profile_data), DataSize},
+                             {CountersData, sizeof(uint64_t), CountersSize},
+                             {NamesBegin, sizeof(uint8_t), NamesSize},
+                             {Zeroes, sizeof(uint8_t), Padding}};
+    if (Writer(IOVec, sizeof(IOVec) / sizeof(*IOVec), &WriterCtx))
+      return -1;
+  }
 
   return writeValueProfData(Writer, WriterCtx, VPDataReader, DataBegin,
                             DataEnd);
 }
+
+COMPILER_RT_VISIBILITY int
+lprofWriteDataImpl(WriterCallback Writer, void *WriterCtx,
+                   const __llvm_profile_data *DataBegin,
+                   const __llvm_profile_data *DataEnd,
+                   const uint64_t *CountersBegin, const uint64_t *CountersEnd,
+                   VPDataReaderType *VPDataReader, const char *NamesBegin,
+                   const char *NamesEnd) {
+  return writeDataImpl(Writer, WriterCtx, DataBegin, DataEnd, CountersBegin,
+                       CountersEnd, CountersBegin, 0, VPDataReader,
+                       NamesBegin, NamesEnd);
+}
+
+COMPILER_RT_VISIBILITY int lprofWriteData(WriterCallback Writer,
+                                          void *WriterCtx,
+                                          VPDataReaderType *VPDataReader,
+                                          unsigned Compact) {
+  /* Match logic in __llvm_profile_write_buffer(). */
+  const __llvm_profile_data *DataBegin = __llvm_profile_begin_data();
+  const __llvm_profile_data *DataEnd = __llvm_profile_end_data();
+  const uint64_t *CountersBegin = __llvm_profile_begin_counters();
+  const uint64_t *CountersEnd = __llvm_profile_end_counters();
+  const char *NamesBegin = __llvm_profile_begin_names();
+  const char *NamesEnd = __llvm_profile_end_names();
+  return writeDataImpl(Writer, WriterCtx, DataBegin, DataEnd, CountersBegin,
+                       CountersEnd, CountersBegin, Compact, VPDataReader,
+                       NamesBegin, NamesEnd);
+}
+
+COMPILER_RT_VISIBILITY int lprofWriteSnapshotData(WriterCallback Writer,
+                                                  void *WriterCtx,
+                                                  const uint64_t *Counters,
+                                                  unsigned Compact) {
+  return writeDataImpl(Writer, WriterCtx, __llvm_profile_begin_data(),
+                       __llvm_profile_end_data(),
+                       __llvm_profile_begin_counters(),
+                       __llvm_profile_end_counters(), Counters, Compact, 0,
+                       __llvm_profile_begin_names(),
+                       __llvm_profile_end_names());
+}
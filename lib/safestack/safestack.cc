@@ -19,12 +19,14 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/user.h>
 
 #include "interception/interception.h"
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_mutex.h"
 
 // TODO: The runtime library does not currently protect the safe stack beyond
 // relying on the system-enforced ASLR. The protection of the (safe) stack can
@@ -94,13 +96,66 @@ static __thread size_t unsafe_stack_guard = 0;
 
 using namespace __sanitizer;
 
+/// The unsafe stacks of exited threads, kept for reuse by new threads with
+/// the same stack and guard sizes. Their pages are given back to the OS, and
+/// they are inaccessible until reused.
+struct pooled_stack {
+  void *start;
+  size_t size;
+  size_t guard;
+};
+const unsigned kMaxPooledStacks = 32;
+static StaticSpinMutex stack_pool_mutex;
+static pooled_stack stack_pool[kMaxPooledStacks];
+static unsigned stack_pool_count;
+
+static void *stack_pool_take(size_t size, size_t guard) {
+  SpinMutexLock l(&stack_pool_mutex);
+  for (unsigned i = stack_pool_count; i-- > 0;) {
+    if (stack_pool[i].size == size && stack_pool[i].guard == guard) {
+      void *start = stack_pool[i].start;
+      stack_pool[i] = stack_pool[--stack_pool_count];
+      return start;
+    }
+  }
+  return nullptr;
+}
+
+static bool stack_pool_put(void *start, size_t size, size_t guard) {
+  SpinMutexLock l(&stack_pool_mutex);
+  if (stack_pool_count == kMaxPooledStacks)
+    return false;
+  pooled_stack stack = {start, size, guard};
+  stack_pool[stack_pool_count++] = stack;
+  return true;
+}
+
 static inline void *unsafe_stack_alloc(size_t size, size_t guard) {
   CHECK_GE(size + guard, size);
+  if (void *start = stack_pool_take(size, guard)) {
+    CHECK_EQ(mprotect(start, size, PROT_READ | PROT_WRITE), 0);
+    return start;
+  }
   void *addr = MmapOrDie(size + guard, "unsafe_stack_alloc");
   MprotectNoAccess((uptr)addr, (uptr)guard);
   return (char *)addr + guard;
 }
 
+/// Gives the pages of a retired stack back to the OS. MADV_FREE lets the
+/// kernel reclaim them lazily, so a stack reused before that does not fault
+/// them in again.
+static void unsafe_stack_release(void *start, size_t size) {
+#ifdef MADV_FREE
+  static bool madv_free_unsupported;
+  if (!madv_free_unsupported) {
+    if (madvise(start, size, MADV_FREE) == 0)
+      return;
+    madv_free_unsupported = true;
+  }
+#endif
+  madvise(start, size, MADV_DONTNEED);
+}
+
 static inline void unsafe_stack_setup(void *start, size_t size, size_t guard) {
   CHECK_GE((char *)start + size, (char *)start);
   CHECK_GE((char *)start + guard, (char *)start);
@@ -115,8 +170,15 @@ static inline void unsafe_stack_setup(void *start, size_t size, size_t guard) {
 
 static void unsafe_stack_free() {
   if (unsafe_stack_start) {
-    UnmapOrDie((char *)unsafe_stack_start - unsafe_stack_guard,
-               unsafe_stack_size + unsafe_stack_guard);
+    // Pooled stacks are made inaccessible, as unmapped ones are, so that
+    // dangling pointers into them still fault.
+    unsafe_stack_release(unsafe_stack_start, unsafe_stack_size);
+    if (mprotect(unsafe_stack_start, unsafe_stack_size, PROT_NONE) != 0 ||
+        !stack_pool_put(unsafe_stack_start, unsafe_stack_size,
+                        unsafe_stack_guard)) {
+      UnmapOrDie((char *)unsafe_stack_start - unsafe_stack_guard,
+                 unsafe_stack_size + unsafe_stack_guard);
+    }
   }
   unsafe_stack_start = nullptr;
 }
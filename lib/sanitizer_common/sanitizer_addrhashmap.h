@@ -32,7 +32,8 @@ namespace __sanitizer {
 //   use h.operator->() to access the data
 //   if h.created() then the element was just created, and the current thread
 //     has exclusive access to it
-//   otherwise the current thread has only read access to the data
+//   otherwise the current thread has only read access to the data, and
+//     the lookup took no locks
 // }
 // {
 //   Map::Handle h(&m, addr, true);
@@ -48,9 +49,13 @@ class AddrHashMap {
     T                val;
   };
 
+  // The cells which do not fit in a bucket go to a list of add buckets, each
+  // twice as large as the previous one. Add buckets are never freed or moved,
+  // so that they can be read without locks; removed cells are reused.
   struct AddBucket {
+    atomic_uintptr_t next;
+    atomic_uintptr_t size;  // The number of cells ever used.
     uptr cap;
-    uptr size;
     Cell cells[1];  // variable len
   };
 
@@ -84,7 +89,6 @@ class AddrHashMap {
     Bucket                *bucket_;
     Cell                  *cell_;
     uptr                   addr_;
-    uptr                   addidx_;
     bool                   created_;
     bool                   remove_;
     bool                   create_;
@@ -94,6 +98,8 @@ class AddrHashMap {
   friend class Handle;
   Bucket *table_;
 
+  Cell *find(Bucket *b, uptr addr, memory_order mo);
+  Cell *allocAddCell(Bucket *b);
   void acquire(Handle *h);
   void release(Handle *h);
   uptr calcHash(uptr addr);
@@ -163,6 +169,58 @@ AddrHashMap<T, kSize>::AddrHashMap() {
   table_ = (Bucket*)MmapOrDie(kSize * sizeof(table_[0]), "AddrHashMap");
 }
 
+template<typename T, uptr kSize>
+typename AddrHashMap<T, kSize>::Cell *AddrHashMap<T, kSize>::find(
+    Bucket *b, uptr addr, memory_order mo) {
+  for (uptr i = 0; i < kBucketSize; i++) {
+    Cell *c = &b->cells[i];
+    if (atomic_load(&c->addr, mo) == addr)
+      return c;
+  }
+  for (AddBucket *add = (AddBucket*)atomic_load(&b->add, memory_order_acquire);
+       add; add = (AddBucket*)atomic_load(&add->next, memory_order_acquire)) {
+    uptr size = atomic_load(&add->size, memory_order_acquire);
+    for (uptr i = 0; i < size; i++) {
+      Cell *c = &add->cells[i];
+      if (atomic_load(&c->addr, mo) == addr)
+        return c;
+    }
+  }
+  return nullptr;
+}
+
+// Returns a free add cell of the bucket, growing the list if needed.
+// Called with the bucket locked.
+template<typename T, uptr kSize>
+typename AddrHashMap<T, kSize>::Cell *AddrHashMap<T, kSize>::allocAddCell(
+    Bucket *b) {
+  atomic_uintptr_t *link = &b->add;
+  // The first add bucket has as many cells as the bucket.
+  uptr newsize = sizeof(AddBucket) + (kBucketSize - 1) * sizeof(Cell);
+  for (AddBucket *add = (AddBucket*)atomic_load(link, memory_order_relaxed);
+       add; add = (AddBucket*)atomic_load(link, memory_order_relaxed)) {
+    uptr size = atomic_load(&add->size, memory_order_relaxed);
+    for (uptr i = 0; i < size; i++) {
+      Cell *c = &add->cells[i];
+      if (atomic_load(&c->addr, memory_order_relaxed) == 0)
+        return c;
+    }
+    if (size < add->cap) {
+      // The new cell is visible to the readers only once its address is set.
+      atomic_store(&add->size, size + 1, memory_order_release);
+      return &add->cells[size];
+    }
+    link = &add->next;
+    newsize = (sizeof(*add) + (add->cap - 1) * sizeof(add->cells[0])) * 2;
+  }
+  AddBucket *add = (AddBucket*)InternalAlloc(newsize);
+  internal_memset(add, 0, newsize);
+  add->cap = (newsize - sizeof(*add)) / sizeof(add->cells[0]) + 1;
+  atomic_store(&add->size, 1, memory_order_relaxed);
+  atomic_store(link, (uptr)add, memory_order_release);
+  return &add->cells[0];
+}
+
 template<typename T, uptr kSize>
 void AddrHashMap<T, kSize>::acquire(Handle *h) {
   uptr addr = h->addr_;
@@ -170,77 +228,26 @@ void AddrHashMap<T, kSize>::acquire(Handle *h) {
   Bucket *b = &table_[hash];
 
   h->created_ = false;
-  h->addidx_ = -1U;
   h->bucket_ = b;
   h->cell_ = nullptr;
 
   // If we want to remove the element, we need exclusive access to the bucket,
   // so skip the lock-free phase.
-  if (h->remove_)
-    goto locked;
-
- retry:
-  // First try to find an existing element w/o read mutex.
-  CHECK(!h->remove_);
-  // Check the embed cells.
-  for (uptr i = 0; i < kBucketSize; i++) {
-    Cell *c = &b->cells[i];
-    uptr addr1 = atomic_load(&c->addr, memory_order_acquire);
-    if (addr1 == addr) {
-      h->cell_ = c;
+  if (!h->remove_) {
+    // The published cells are found without locks; a concurrent removal may
+    // make us miss one, which is checked again under the lock.
+    h->cell_ = find(b, addr, memory_order_acquire);
+    if (h->cell_)
       return;
-    }
-  }
-
-  // Check the add cells with read lock.
-  if (atomic_load(&b->add, memory_order_relaxed)) {
-    b->mtx.ReadLock();
-    AddBucket *add = (AddBucket*)atomic_load(&b->add, memory_order_relaxed);
-    for (uptr i = 0; i < add->size; i++) {
-      Cell *c = &add->cells[i];
-      uptr addr1 = atomic_load(&c->addr, memory_order_relaxed);
-      if (addr1 == addr) {
-        h->addidx_ = i;
-        h->cell_ = c;
-        return;
-      }
-    }
-    b->mtx.ReadUnlock();
   }
 
- locked:
-  // Re-check existence under write lock.
-  // Embed cells.
   b->mtx.Lock();
-  for (uptr i = 0; i < kBucketSize; i++) {
-    Cell *c = &b->cells[i];
-    uptr addr1 = atomic_load(&c->addr, memory_order_relaxed);
-    if (addr1 == addr) {
-      if (h->remove_) {
-        h->cell_ = c;
-        return;
-      }
+  Cell *c = find(b, addr, memory_order_relaxed);
+  if (c) {
+    h->cell_ = c;
+    if (!h->remove_)
       b->mtx.Unlock();
-      goto retry;
-    }
-  }
-
-  // Add cells.
-  AddBucket *add = (AddBucket*)atomic_load(&b->add, memory_order_relaxed);
-  if (add) {
-    for (uptr i = 0; i < add->size; i++) {
-      Cell *c = &add->cells[i];
-      uptr addr1 = atomic_load(&c->addr, memory_order_relaxed);
-      if (addr1 == addr) {
-        if (h->remove_) {
-          h->addidx_ = i;
-          h->cell_ = c;
-          return;
-        }
-        b->mtx.Unlock();
-        goto retry;
-      }
-    }
+    return;
   }
 
   // The element does not exist, no need to create it if we want to remove.
@@ -249,7 +256,8 @@ void AddrHashMap<T, kSize>::acquire(Handle *h) {
     return;
   }
 
-  // Now try to create it under the mutex.
+  // Now try to create it under the mutex; the bucket stays locked until the
+  // handle is released.
   h->created_ = true;
   // See if we have a free embed cell.
   for (uptr i = 0; i < kBucketSize; i++) {
@@ -260,36 +268,8 @@ void AddrHashMap<T, kSize>::acquire(Handle *h) {
       return;
     }
   }
-
-  // Store in the add cells.
-  if (!add) {
-    // Allocate a new add array.
-    const uptr kInitSize = 64;
-    add = (AddBucket*)InternalAlloc(kInitSize);
-    internal_memset(add, 0, kInitSize);
-    add->cap = (kInitSize - sizeof(*add)) / sizeof(add->cells[0]) + 1;
-    add->size = 0;
-    atomic_store(&b->add, (uptr)add, memory_order_relaxed);
-  }
-  if (add->size == add->cap) {
-    // Grow existing add array.
-    uptr oldsize = sizeof(*add) + (add->cap - 1) * sizeof(add->cells[0]);
-    uptr newsize = oldsize * 2;
-    AddBucket *add1 = (AddBucket*)InternalAlloc(newsize);
-    internal_memset(add1, 0, newsize);
-    add1->cap = (newsize - sizeof(*add)) / sizeof(add->cells[0]) + 1;
-    add1->size = add->size;
-    internal_memcpy(add1->cells, add->cells, add->size * sizeof(add->cells[0]));
-    InternalFree(add);
-    atomic_store(&b->add, (uptr)add1, memory_order_relaxed);
-    add = add1;
-  }
-  // Store.
-  uptr i = add->size++;
-  Cell *c = &add->cells[i];
-  CHECK_EQ(atomic_load(&c->addr, memory_order_relaxed), 0);
-  h->addidx_ = i;
-  h->cell_ = c;
+  h->cell_ = allocAddCell(b);
+  CHECK_EQ(atomic_load(&h->cell_->addr, memory_order_relaxed), 0);
 }
 
 template<typename T, uptr kSize>
@@ -307,38 +287,13 @@ void AddrHashMap<T, kSize>::release(Handle *h) {
     atomic_store(&c->addr, h->addr_, memory_order_release);
     b->mtx.Unlock();
   } else if (h->remove_) {
-    // Denote that the cell is empty now.
+    // Denote that the cell is empty now. The cell stays where it is: the
+    // lock-free readers may still be looking at it.
     CHECK_EQ(addr1, h->addr_);
     atomic_store(&c->addr, 0, memory_order_release);
-    // See if we need to compact the bucket.
-    AddBucket *add = (AddBucket*)atomic_load(&b->add, memory_order_relaxed);
-    if (h->addidx_ == -1U) {
-      // Removed from embed array, move an add element into the freed cell.
-      if (add && add->size != 0) {
-        uptr last = --add->size;
-        Cell *c1 = &add->cells[last];
-        c->val = c1->val;
-        uptr addr1 = atomic_load(&c1->addr, memory_order_relaxed);
-        atomic_store(&c->addr, addr1, memory_order_release);
-        atomic_store(&c1->addr, 0, memory_order_release);
-      }
-    } else {
-      // Removed from add array, compact it.
-      uptr last = --add->size;
-      Cell *c1 = &add->cells[last];
-      if (c != c1) {
-        *c = *c1;
-        atomic_store(&c1->addr, 0, memory_order_relaxed);
-      }
-    }
-    if (add && add->size == 0) {
-      // FIXME(dvyukov): free add?
-    }
     b->mtx.Unlock();
   } else {
     CHECK_EQ(addr1, h->addr_);
-    if (h->addidx_ != -1U)
-      b->mtx.ReadUnlock();
   }
 }
 
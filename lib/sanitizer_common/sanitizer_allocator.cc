@@ -78,6 +78,8 @@ InternalAllocator *internal_allocator() {
   return 0;
 }
 
+void InternalAllocatorThreadFinish() {}
+
 #else  // SANITIZER_GO || defined(SANITIZER_USE_MALLOC)
 
 static ALIGNED(64) char internal_alloc_placeholder[sizeof(InternalAllocator)];
@@ -102,10 +104,93 @@ InternalAllocator *internal_allocator() {
   return internal_allocator_instance;
 }
 
+// Calls without a cache use a cache of the current thread, created on first
+// use, where THREADLOCAL is available. They fall back to the shared cache when
+// the thread cache is busy: in a signal handler interrupting an allocation,
+// or on the tracer and helper threads of StopTheWorld, which share the TLS of
+// the thread which started them. They also do once the thread has finished.
+#if (SANITIZER_LINUX && !SANITIZER_ANDROID) || SANITIZER_FREEBSD
+# define SANITIZER_INTERNAL_THREAD_CACHES 1
+#else
+# define SANITIZER_INTERNAL_THREAD_CACHES 0
+#endif
+
+#if SANITIZER_INTERNAL_THREAD_CACHES
+struct InternalThreadCache {
+  InternalAllocatorCache cache;
+  InternalThreadCache *next;
+};
+
+enum {
+  kThreadCacheIdle = 0,
+  kThreadCacheBusy = 1,
+  kThreadCacheFinished = 2
+};
+
+static THREADLOCAL InternalThreadCache *internal_thread_cache;
+static THREADLOCAL atomic_uint8_t internal_thread_cache_state;
+
+// The drained caches of the finished threads, reused by the new ones.
+static InternalThreadCache *free_thread_caches;
+static StaticSpinMutex free_thread_caches_mu;
+
+// Returns the cache of the current thread, or null if it can't be used. A
+// non-null result must be released with ReleaseThreadCache.
+static InternalAllocatorCache *AcquireThreadCache() {
+  u8 cmp = kThreadCacheIdle;
+  if (!atomic_compare_exchange_strong(&internal_thread_cache_state, &cmp,
+                                      kThreadCacheBusy, memory_order_acquire))
+    return nullptr;
+  if (UNLIKELY(!internal_thread_cache)) {
+    {
+      SpinMutexLock l(&free_thread_caches_mu);
+      internal_thread_cache = free_thread_caches;
+      if (internal_thread_cache)
+        free_thread_caches = internal_thread_cache->next;
+    }
+    if (!internal_thread_cache)
+      internal_thread_cache = (InternalThreadCache *)MmapOrDie(
+          sizeof(InternalThreadCache), "InternalThreadCache");
+  }
+  return &internal_thread_cache->cache;
+}
+
+static void ReleaseThreadCache() {
+  atomic_store(&internal_thread_cache_state, kThreadCacheIdle,
+               memory_order_release);
+}
+
+void InternalAllocatorThreadFinish() {
+  u8 cmp = kThreadCacheIdle;
+  if (!atomic_compare_exchange_strong(&internal_thread_cache_state, &cmp,
+                                      kThreadCacheFinished,
+                                      memory_order_acquire))
+    return;
+  InternalThreadCache *c = internal_thread_cache;
+  if (!c)
+    return;
+  internal_thread_cache = nullptr;
+  internal_allocator()->SwallowCache(&c->cache);
+  SpinMutexLock l(&free_thread_caches_mu);
+  c->next = free_thread_caches;
+  free_thread_caches = c;
+}
+#else
+static InternalAllocatorCache *AcquireThreadCache() { return nullptr; }
+static void ReleaseThreadCache() {}
+void InternalAllocatorThreadFinish() {}
+#endif  // SANITIZER_INTERNAL_THREAD_CACHES
+
 static void *RawInternalAlloc(uptr size, InternalAllocatorCache *cache,
                               uptr alignment) {
   if (alignment == 0) alignment = 8;
   if (cache == 0) {
+    if (InternalAllocatorCache *thread_cache = AcquireThreadCache()) {
+      void *res =
+          internal_allocator()->Allocate(thread_cache, size, alignment, false);
+      ReleaseThreadCache();
+      return res;
+    }
     SpinMutexLock l(&internal_allocator_cache_mu);
     return internal_allocator()->Allocate(&internal_allocator_cache, size,
                                           alignment, false);
@@ -117,6 +202,12 @@ static void *RawInternalRealloc(void *ptr, uptr size,
                                 InternalAllocatorCache *cache) {
   uptr alignment = 8;
   if (cache == 0) {
+    if (InternalAllocatorCache *thread_cache = AcquireThreadCache()) {
+      void *res = internal_allocator()->Reallocate(thread_cache, ptr, size,
+                                                   alignment);
+      ReleaseThreadCache();
+      return res;
+    }
     SpinMutexLock l(&internal_allocator_cache_mu);
     return internal_allocator()->Reallocate(&internal_allocator_cache, ptr,
                                             size, alignment);
@@ -126,6 +217,11 @@ static void *RawInternalRealloc(void *ptr, uptr size,
 
 static void RawInternalFree(void *ptr, InternalAllocatorCache *cache) {
   if (!cache) {
+    if (InternalAllocatorCache *thread_cache = AcquireThreadCache()) {
+      internal_allocator()->Deallocate(thread_cache, ptr);
+      ReleaseThreadCache();
+      return;
+    }
     SpinMutexLock l(&internal_allocator_cache_mu);
     return internal_allocator()->Deallocate(&internal_allocator_cache, ptr);
   }
@@ -177,6 +273,52 @@ void InternalFree(void *addr, InternalAllocatorCache *cache) {
   RawInternalFree(addr, cache);
 }
 
+// InternalScopedArena
+InternalScopedArena::~InternalScopedArena() {
+  while (blocks_) {
+    Block *next = blocks_->next;
+    InternalFree(blocks_);
+    blocks_ = next;
+  }
+}
+
+void *InternalScopedArena::Allocate(uptr size, uptr alignment) {
+  CHECK(IsPowerOfTwo(alignment));
+  if (size > kBlockSize / 4) {
+    // Give large allocations a block of their own, behind the current one, so
+    // that the rest of the current block is not wasted.
+    Block *block = (Block *)InternalAlloc(sizeof(Block) + alignment + size);
+    CHECK(block);
+    if (blocks_) {
+      block->next = blocks_->next;
+      blocks_->next = block;
+    } else {
+      block->next = nullptr;
+      blocks_ = block;
+    }
+    return (void *)RoundUpTo((uptr)block + sizeof(Block), alignment);
+  }
+  uptr res = RoundUpTo(current_, alignment);
+  if (!current_ || res + size > end_) {
+    Block *block = (Block *)InternalAlloc(kBlockSize);
+    CHECK(block);
+    block->next = blocks_;
+    blocks_ = block;
+    current_ = (uptr)block + sizeof(Block);
+    end_ = (uptr)block + kBlockSize;
+    res = RoundUpTo(current_, alignment);
+  }
+  current_ = res + size;
+  return (void *)res;
+}
+
+char *InternalScopedArena::Strdup(const char *s) {
+  uptr len = internal_strlen(s);
+  char *res = (char *)Allocate(len + 1, 1);
+  internal_memcpy(res, s, len + 1);
+  return res;
+}
+
 // LowLevelAllocator
 static LowLevelAllocateCallback low_level_alloc_callback;
 
@@ -209,6 +351,50 @@ bool CallocShouldReturnNullDueToOverflow(uptr size, uptr n) {
   return (max / size) < n;
 }
 
+void PrintAllocatorHistogram(const AllocatorClassStats *stats, uptr n) {
+  Printf("Stats: allocator histogram (hit: allocations served by the thread "
+         "caches, frag: mapped bytes not in use):\n");
+  for (uptr i = 0; i < n; i++) {
+    const AllocatorClassStats &s = stats[i];
+    if (!s.mapped_bytes && !s.allocs)
+      continue;
+    u64 in_use = s.allocs > s.frees ? s.allocs - s.frees : 0;
+    u64 in_use_bytes = in_use * s.size;
+    uptr hit = s.allocs ? (s.allocs - Min(s.allocs, s.cache_refills)) * 100 /
+                              s.allocs
+                        : 0;
+    uptr frag = s.mapped_bytes > in_use_bytes
+                    ? (s.mapped_bytes - in_use_bytes) * 100 / s.mapped_bytes
+                    : 0;
+    uptr refill_ns = s.refill_samples ? s.refill_ns / s.refill_samples : 0;
+    Printf("  %7zd: mapped: %7zdK allocs: %9llu frees: %9llu inuse: %8llu "
+           "free: %7zd hit: %3zd%% refills: %7llu drains: %7llu "
+           "refill: %6zdns frag: %3zd%%\n",
+           s.size, s.mapped_bytes >> 10, s.allocs, s.frees, in_use,
+           s.free_chunks, hit, s.cache_refills, s.cache_drains, refill_ns,
+           frag);
+  }
+}
+
+void AllocatorSizeProfile::Write(fd_t fd) const {
+  const uptr kBufferSize = 1 << 16;
+  InternalScopedString buf(kBufferSize);
+  for (uptr bucket = 1; bucket < kNumBuckets; bucket++) {
+    u64 count = atomic_load(&counts_[bucket], memory_order_relaxed);
+    if (!count)
+      continue;
+    if (bucket == kNumBuckets - 1)
+      buf.append(">%zd %llu\n", kMaxSize, count);
+    else
+      buf.append("%zd %llu\n", bucket << kGranularityLog, count);
+    if (buf.length() > kBufferSize - 64) {
+      WriteToFile(fd, buf.data(), buf.length());
+      buf.clear();
+    }
+  }
+  WriteToFile(fd, buf.data(), buf.length());
+}
+
 static atomic_uint8_t reporting_out_of_memory = {0};
 
 bool IsReportingOOM() { return atomic_load_relaxed(&reporting_out_of_memory); }
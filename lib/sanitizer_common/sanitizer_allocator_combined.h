@@ -26,7 +26,9 @@ class CombinedAllocator {
  public:
   void InitCommon(bool may_return_null, s32 release_to_os_interval_ms) {
     primary_.Init(release_to_os_interval_ms);
+    secondary_.SetBindToNumaNode(PrimaryAllocator::kNumNodes > 1);
     atomic_store(&may_return_null_, may_return_null, memory_order_relaxed);
+    size_profile_ = nullptr;
   }
 
   void InitLinkerInitialized(
@@ -56,6 +58,8 @@ class CombinedAllocator {
     // alignment check.
     if (alignment > 8)
       size = RoundUpTo(size, alignment);
+    if (UNLIKELY(size_profile_))
+      size_profile_->Record(size);
     void *res;
     bool from_primary = primary_.CanAllocate(size, alignment);
     // The primary allocator should return a 2^x aligned allocation when
@@ -64,20 +68,33 @@ class CombinedAllocator {
     // using a non-fixed base address). The secondary takes care of the
     // alignment without such requirement, and allocating 'size' would use
     // extraneous memory, so we employ 'original_size'.
-    if (from_primary)
-      res = cache->Allocate(&primary_, primary_.ClassID(size));
-    else
+    uptr class_id = 0;
+    if (from_primary) {
+      class_id = primary_.ClassID(size);
+      res = cache->Allocate(&primary_, class_id);
+    } else
       res = secondary_.Allocate(&stats_, original_size, alignment);
     if (alignment > 8)
       CHECK_EQ(reinterpret_cast<uptr>(res) & (alignment - 1), 0);
     // When serviced by the secondary, the chunk comes from a mmap allocation
     // and will be zero'd out anyway. We only need to clear our the chunk if
     // it was serviced by the primary, hence using the rounded up 'size'.
-    if (cleared && res && from_primary)
+    if (cleared && res && from_primary && !primary_.ChunkIsZero(class_id, res))
       internal_bzero_aligned16(res, RoundUpTo(size, 16));
     return res;
   }
 
+  // Records the sizes of the following allocations in size_profile, if not
+  // null. Not thread-safe, to be called right after Init.
+  void SetSizeProfile(AllocatorSizeProfile *size_profile) {
+    size_profile_ = size_profile;
+  }
+
+  // See LargeMmapAllocator::SetCacheParams.
+  void SetSecondaryCacheParams(uptr max_cached_bytes, s32 decay_ms) {
+    secondary_.SetCacheParams(max_cached_bytes, decay_ms);
+  }
+
   bool MayReturnNull() const {
     return atomic_load(&may_return_null_, memory_order_acquire);
   }
@@ -106,6 +123,12 @@ class CombinedAllocator {
     primary_.SetReleaseToOSIntervalMs(release_to_os_interval_ms);
   }
 
+  // See SizeClassAllocator64::ReleaseToOSInBackground.
+  void ReleaseToOSInBackground(bool force) {
+    primary_.ReleaseToOSInBackground(force);
+    secondary_.ReleaseToOS(force);
+  }
+
   bool RssLimitIsExceeded() {
     return atomic_load(&rss_limit_is_exceeded_, memory_order_acquire);
   }
@@ -117,10 +140,13 @@ class CombinedAllocator {
 
   void Deallocate(AllocatorCache *cache, void *p) {
     if (!p) return;
-    if (primary_.PointerIsMine(p))
-      cache->Deallocate(&primary_, primary_.GetSizeClass(p), p);
-    else
+    if (primary_.PointerIsMine(p)) {
+      uptr class_id = primary_.GetSizeClass(p);
+      primary_.MarkChunkDirty(class_id, p);
+      cache->Deallocate(&primary_, class_id, p);
+    } else {
       secondary_.Deallocate(&stats_, p);
+    }
   }
 
   void *Reallocate(AllocatorCache *cache, void *p, uptr new_size,
@@ -141,6 +167,16 @@ class CombinedAllocator {
     return new_p;
   }
 
+  // Changes the size of the chunk p, as passed to Allocate with an alignment
+  // of at most 8, to new_size without moving it. Primary chunks can change
+  // within their size class, the secondary ones may have their mapping grown.
+  // Returns false if the chunk has to move.
+  bool ResizeInPlace(void *p, uptr new_size) {
+    if (primary_.PointerIsMine(p))
+      return new_size <= primary_.GetActuallyAllocatedSize(p);
+    return secondary_.ResizeInPlace(&stats_, p, new_size);
+  }
+
   bool PointerIsMine(void *p) {
     if (primary_.PointerIsMine(p))
       return true;
@@ -151,6 +187,15 @@ class CombinedAllocator {
     return primary_.PointerIsMine(p);
   }
 
+  // Returns true if the chunk p, which must have just been allocated, is
+  // known to hold only zeros, so that calloc() does not need to clear it. The
+  // chunks of the secondary always are, as if freshly mapped.
+  bool ChunkIsZero(void *p) {
+    if (!primary_.PointerIsMine(p))
+      return true;
+    return primary_.ChunkIsZero(primary_.GetSizeClass(p), p);
+  }
+
   void *GetMetaData(const void *p) {
     if (primary_.PointerIsMine(p))
       return primary_.GetMetaData(p);
@@ -204,6 +249,33 @@ class CombinedAllocator {
     secondary_.PrintStats();
   }
 
+  // For the statistics specific to the secondary allocator of a tool.
+  SecondaryAllocator *GetSecondary() { return &secondary_; }
+
+  // Fills stats with the statistics of up to max_classes size classes of the
+  // primary allocator, starting at class 1. Returns the number filled.
+  uptr GetHistogram(AllocatorClassStats *stats, uptr max_classes) {
+    uptr n = Min(max_classes, PrimaryAllocator::kNumClasses - 1);
+    for (uptr i = 0; i < n; i++)
+      primary_.GetClassStats(i + 1, &stats[i]);
+    return n;
+  }
+
+  // Fills stats with the statistics of up to max_nodes NUMA nodes of the
+  // primary allocator. Returns the number filled.
+  uptr GetNodeStats(AllocatorNodeStats *stats, uptr max_nodes) {
+    uptr n = Min(max_nodes, PrimaryAllocator::kNumNodes);
+    for (uptr i = 0; i < n; i++)
+      primary_.GetNodeStats(i, &stats[i]);
+    return n;
+  }
+
+  void PrintHistogram() {
+    AllocatorClassStats stats[PrimaryAllocator::kNumClasses];
+    uptr n = GetHistogram(stats, ARRAY_SIZE(stats));
+    PrintAllocatorHistogram(stats, n);
+  }
+
   // ForceLock() and ForceUnlock() are needed to implement Darwin malloc zone
   // introspection API.
   void ForceLock() {
@@ -223,11 +295,27 @@ class CombinedAllocator {
     secondary_.ForEachChunk(callback, arg);
   }
 
+  // Returns the range of the address space the primary allocator allocates
+  // from, or an empty one if it doesn't use a fixed range.
+  void GetPrimarySpaceRange(uptr *beg, uptr *end) {
+    primary_.GetSpaceRange(beg, end);
+  }
+
+  // Same as ForEachChunk, for the part |part| of |n_parts| disjoint parts of
+  // the chunks. The parts can be iterated over concurrently.
+  void ForEachChunkInPart(ForEachChunkCallback callback, void *arg, uptr part,
+                          uptr n_parts) {
+    primary_.ForEachChunkInPart(callback, arg, part, n_parts);
+    if (part == 0)
+      secondary_.ForEachChunk(callback, arg);
+  }
+
  private:
   PrimaryAllocator primary_;
   SecondaryAllocator secondary_;
   AllocatorGlobalStats stats_;
   atomic_uint8_t may_return_null_;
   atomic_uint8_t rss_limit_is_exceeded_;
+  AllocatorSizeProfile *size_profile_;
 };
 
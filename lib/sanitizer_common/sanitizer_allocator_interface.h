@@ -18,6 +18,10 @@
 
 using __sanitizer::uptr;
 
+namespace __sanitizer {
+struct AllocatorClassStats;
+}  // namespace __sanitizer
+
 extern "C" {
 SANITIZER_INTERFACE_ATTRIBUTE
 uptr __sanitizer_get_estimated_allocated_size(uptr size);
@@ -28,6 +32,9 @@ SANITIZER_INTERFACE_ATTRIBUTE uptr __sanitizer_get_current_allocated_bytes();
 SANITIZER_INTERFACE_ATTRIBUTE uptr __sanitizer_get_heap_size();
 SANITIZER_INTERFACE_ATTRIBUTE uptr __sanitizer_get_free_bytes();
 SANITIZER_INTERFACE_ATTRIBUTE uptr __sanitizer_get_unmapped_bytes();
+SANITIZER_INTERFACE_ATTRIBUTE uptr __sanitizer_get_allocator_histogram(
+    __sanitizer::AllocatorClassStats *stats, uptr max_classes);
+SANITIZER_INTERFACE_ATTRIBUTE void __sanitizer_print_allocator_histogram();
 
 SANITIZER_INTERFACE_ATTRIBUTE int __sanitizer_install_malloc_and_free_hooks(
     void (*malloc_hook)(const void *, uptr),
@@ -40,6 +47,8 @@ SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
 
 SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE void
 __sanitizer_print_memory_profile(uptr top_percent, uptr max_number_of_contexts);
+SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE int
+__sanitizer_write_memory_profile(void *fd, uptr sample_rate);
 }  // extern "C"
 
 #endif  // SANITIZER_ALLOCATOR_INTERFACE_H
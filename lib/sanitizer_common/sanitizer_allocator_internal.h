@@ -53,6 +53,34 @@ void *InternalCalloc(uptr countr, uptr size,
                      InternalAllocatorCache *cache = nullptr);
 void InternalFree(void *p, InternalAllocatorCache *cache = nullptr);
 InternalAllocator *internal_allocator();
+// Drains the cache the current thread uses for the calls above without a
+// cache, and makes these calls use the shared cache on this thread from now
+// on. The tools call it when a thread finishes.
+void InternalAllocatorThreadFinish();
+
+// Allocator for the short-lived allocations of a single task, e.g. generating
+// a report. Memory is carved out of large InternalAlloc blocks and is all
+// freed at once when the arena is destroyed. Not thread-safe.
+class InternalScopedArena {
+ public:
+  InternalScopedArena() : blocks_(nullptr), current_(0), end_(0) {}
+  ~InternalScopedArena();
+  void *Allocate(uptr size, uptr alignment = 8);
+  char *Strdup(const char *s);
+
+ private:
+  struct Block {
+    Block *next;
+  };
+  static const uptr kBlockSize = 1 << 16;
+
+  Block *blocks_;
+  uptr current_;
+  uptr end_;
+
+  InternalScopedArena(const InternalScopedArena &) = delete;
+  void operator=(const InternalScopedArena &) = delete;
+};
 
 enum InternalAllocEnum {
   INTERNAL_ALLOC
@@ -65,4 +93,9 @@ inline void *operator new(__sanitizer::operator_new_size_type size,
   return __sanitizer::InternalAlloc(size);
 }
 
+inline void *operator new(__sanitizer::operator_new_size_type size,
+                          __sanitizer::InternalScopedArena &arena) {
+  return arena.Allocate(size);
+}
+
 #endif // SANITIZER_ALLOCATOR_INTERNAL_H
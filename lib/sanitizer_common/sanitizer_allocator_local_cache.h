@@ -23,12 +23,25 @@ struct SizeClassAllocatorLocalCache
 };
 
 // Cache used by SizeClassAllocator64.
+// The capacity of each size class adapts to the allocation pattern of the
+// thread: it starts at 2 * SizeClassMap::MaxCachedHint(), grows when the class
+// keeps running out of chunks (or keeps overflowing), as happens when
+// the thread mostly allocates (or mostly frees) chunks of that class, and
+// shrinks back when the class has been idle for a while.
+// With a NUMA-aware allocator, the cache refills from the node the thread runs
+// on (checked again on every trim) and returns the chunks of other nodes to
+// the allocator as soon as they are freed, so that they are not reused here.
 template <class SizeClassAllocator>
 struct SizeClassAllocator64LocalCache {
   typedef SizeClassAllocator Allocator;
   static const uptr kNumClasses = SizeClassAllocator::kNumClasses;
   typedef typename Allocator::SizeClassMapT SizeClassMap;
   typedef typename Allocator::CompactPtrT CompactPtrT;
+  // Capacity of a size class can grow up to kMaxGrowth times the initial one.
+  static const uptr kMaxGrowth = 4;
+  // Size classes which did not run out of chunks or overflow during the last
+  // kTrimPeriod refills and drains of the cache are trimmed.
+  static const uptr kTrimPeriod = 1024;
 
   void Init(AllocatorGlobalStats *s) {
     stats_.Init();
@@ -49,6 +62,8 @@ struct SizeClassAllocator64LocalCache {
     if (UNLIKELY(c->count == 0))
       Refill(c, allocator, class_id);
     stats_.Add(AllocatorStatAllocated, c->class_size);
+    if (UNLIKELY(++c->allocs == AllocatorClassCounters::kMaxUnpublished))
+      PublishCounters(c, allocator, class_id);
     CHECK_GT(c->count, 0);
     CompactPtrT chunk = c->chunks[--c->count];
     void *res = reinterpret_cast<void *>(allocator->CompactPtrToPointer(
@@ -64,12 +79,18 @@ struct SizeClassAllocator64LocalCache {
     InitCache();
     PerClass *c = &per_class_[class_id];
     stats_.Sub(AllocatorStatAllocated, c->class_size);
+    if (UNLIKELY(++c->frees == AllocatorClassCounters::kMaxUnpublished))
+      PublishCounters(c, allocator, class_id);
     CHECK_NE(c->max_count, 0UL);
-    if (UNLIKELY(c->count == c->max_count))
-      Drain(c, allocator, class_id, c->max_count / 2);
     CompactPtrT chunk = allocator->PointerToCompactPtr(
         allocator->GetRegionBeginBySizeClass(class_id),
         reinterpret_cast<uptr>(p));
+    if (Allocator::kNumNodes > 1 && UNLIKELY(allocator->GetNode(p) != node_)) {
+      allocator->ReturnToAllocator(&stats_, class_id, &chunk, 1);
+      return;
+    }
+    if (UNLIKELY(c->count == c->max_count))
+      Overflow(c, allocator, class_id);
     c->chunks[c->count++] = chunk;
   }
 
@@ -78,36 +99,114 @@ struct SizeClassAllocator64LocalCache {
       PerClass *c = &per_class_[class_id];
       while (c->count > 0)
         Drain(c, allocator, class_id, c->count);
+      PublishCounters(c, allocator, class_id);
     }
   }
 
   // private:
+  static const uptr kMaxCount = 2 * SizeClassMap::kMaxNumCachedHint;
+  enum {
+    kEventNone,
+    kEventRefill,
+    kEventOverflow
+  };
   struct PerClass {
     u32 count;
     u32 max_count;
     uptr class_size;
-    CompactPtrT chunks[2 * SizeClassMap::kMaxNumCachedHint];
+    // Refills and overflows of this class during the current trim period.
+    u16 events;
+    // The last of them, kEventNone if there were none.
+    u8 last_event;
+    // Allocations and deallocations not yet published to the class counters.
+    uptr allocs;
+    uptr frees;
+    CompactPtrT chunks[kMaxCount];
   };
   PerClass per_class_[kNumClasses];
   AllocatorStats stats_;
+  // Refills and overflows of all classes since the last trim.
+  uptr events_;
+  // The node to refill from, updated on every trim.
+  uptr node_;
+
+  static uptr InitialMaxCount(uptr class_id) {
+    return 2 * SizeClassMap::MaxCachedHint(class_id);
+  }
 
   void InitCache() {
     if (per_class_[1].max_count)
       return;
+    node_ = Allocator::CurrentNode();
     for (uptr i = 0; i < kNumClasses; i++) {
       PerClass *c = &per_class_[i];
-      c->max_count = 2 * SizeClassMap::MaxCachedHint(i);
+      c->max_count = InitialMaxCount(i);
       c->class_size = Allocator::ClassIdToSize(i);
     }
   }
 
+  // Called when class c runs out of chunks or overflows.
+  void Adapt(PerClass *c, SizeClassAllocator *allocator, uptr class_id,
+             u8 event) {
+    // Running out of chunks (or overflowing) again before the opposite
+    // happens means that the chunks flow in one direction, transfer them
+    // in larger batches.
+    if (c->last_event == event) {
+      uptr max_count = Min(kMaxCount, kMaxGrowth * InitialMaxCount(class_id));
+      c->max_count = Min<uptr>(max_count, 2 * c->max_count);
+    }
+    c->last_event = event;
+    if (c->events < 0xffff)
+      c->events++;
+    if (++events_ >= kTrimPeriod)
+      Trim(allocator);
+  }
+
+  // Shrinks classes which were idle during the last trim period and returns
+  // their excess chunks to the allocator.
+  void Trim(SizeClassAllocator *allocator) {
+    events_ = 0;
+    node_ = Allocator::CurrentNode();
+    stats_.Add(AllocatorStatCacheTrims, 1);
+    for (uptr class_id = 1; class_id < kNumClasses; class_id++) {
+      PerClass *c = &per_class_[class_id];
+      if (c->events == 0) {
+        c->max_count = Max<uptr>(InitialMaxCount(class_id), c->max_count / 2);
+        c->last_event = kEventNone;
+        if (c->count > c->max_count / 2)
+          Drain(c, allocator, class_id, c->count - c->max_count / 2);
+      }
+      c->events = 0;
+    }
+  }
+
   NOINLINE void Refill(PerClass *c, SizeClassAllocator *allocator,
                        uptr class_id) {
     InitCache();
+    Adapt(c, allocator, class_id, kEventRefill);
+    AllocatorClassCounters *counters = allocator->GetClassCounters(class_id);
+    // NanoTime() might be a syscall, time only a sample of the refills.
+    bool timed = stats_.Get(AllocatorStatCacheRefills) %
+                     AllocatorClassCounters::kRefillSamplePeriod == 0;
+    u64 start = timed ? NanoTime() : 0;
     uptr num_requested_chunks = c->max_count / 2;
     allocator->GetFromAllocator(&stats_, class_id, c->chunks,
-                                num_requested_chunks);
+                                num_requested_chunks, node_);
     c->count = num_requested_chunks;
+    stats_.Add(AllocatorStatCacheRefills, 1);
+    if (timed) {
+      AllocatorClassCounters::Add(&counters->refill_samples, 1);
+      AllocatorClassCounters::Add(&counters->refill_ns, NanoTime() - start);
+    }
+    AllocatorClassCounters::Add(&counters->cache_refills, 1);
+  }
+
+  NOINLINE void Overflow(PerClass *c, SizeClassAllocator *allocator,
+                         uptr class_id) {
+    Adapt(c, allocator, class_id, kEventOverflow);
+    // The class might have just grown and have room for more chunks.
+    if (c->count == c->max_count)
+      Drain(c, allocator, class_id, c->max_count / 2);
   }
 
   NOINLINE void Drain(PerClass *c, SizeClassAllocator *allocator, uptr class_id,
@@ -118,6 +217,18 @@ struct SizeClassAllocator64LocalCache {
     c->count -= count;
     allocator->ReturnToAllocator(&stats_, class_id,
                                  &c->chunks[first_idx_to_drain], count);
+    stats_.Add(AllocatorStatCacheDrains, 1);
+    AllocatorClassCounters::Add(
+        &allocator->GetClassCounters(class_id)->cache_drains, 1);
+  }
+
+  NOINLINE void PublishCounters(PerClass *c, SizeClassAllocator *allocator,
+                                uptr class_id) {
+    AllocatorClassCounters *counters = allocator->GetClassCounters(class_id);
+    AllocatorClassCounters::Add(&counters->allocs, c->allocs);
+    AllocatorClassCounters::Add(&counters->frees, c->frees);
+    c->allocs = 0;
+    c->frees = 0;
   }
 };
 
@@ -147,6 +258,8 @@ struct SizeClassAllocator32LocalCache {
     if (UNLIKELY(c->count == 0))
       Refill(allocator, class_id);
     stats_.Add(AllocatorStatAllocated, c->class_size);
+    if (UNLIKELY(++c->allocs == AllocatorClassCounters::kMaxUnpublished))
+      PublishCounters(c, allocator, class_id);
     void *res = c->batch[--c->count];
     PREFETCH(c->batch[c->count - 1]);
     return res;
@@ -160,6 +273,8 @@ struct SizeClassAllocator32LocalCache {
     InitCache();
     PerClass *c = &per_class_[class_id];
     stats_.Sub(AllocatorStatAllocated, c->class_size);
+    if (UNLIKELY(++c->frees == AllocatorClassCounters::kMaxUnpublished))
+      PublishCounters(c, allocator, class_id);
     CHECK_NE(c->max_count, 0UL);
     if (UNLIKELY(c->count == c->max_count))
       Drain(allocator, class_id);
@@ -171,6 +286,7 @@ struct SizeClassAllocator32LocalCache {
       PerClass *c = &per_class_[class_id];
       while (c->count > 0)
         Drain(allocator, class_id);
+      PublishCounters(c, allocator, class_id);
     }
   }
 
@@ -180,6 +296,9 @@ struct SizeClassAllocator32LocalCache {
     uptr count;
     uptr max_count;
     uptr class_size;
+    // Allocations and deallocations not yet published to the class counters.
+    uptr allocs;
+    uptr frees;
     void *batch[2 * TransferBatch::kMaxNumCached];
   };
   PerClass per_class_[kNumClasses];
@@ -230,11 +349,22 @@ struct SizeClassAllocator32LocalCache {
   NOINLINE void Refill(SizeClassAllocator *allocator, uptr class_id) {
     InitCache();
     PerClass *c = &per_class_[class_id];
+    AllocatorClassCounters *counters = allocator->GetClassCounters(class_id);
+    // NanoTime() might be a syscall, time only a sample of the refills.
+    bool timed = stats_.Get(AllocatorStatCacheRefills) %
+                     AllocatorClassCounters::kRefillSamplePeriod == 0;
+    u64 start = timed ? NanoTime() : 0;
     TransferBatch *b = allocator->AllocateBatch(&stats_, this, class_id);
     CHECK_GT(b->Count(), 0);
     b->CopyToArray(c->batch);
     c->count = b->Count();
     DestroyBatch(class_id, allocator, b);
+    stats_.Add(AllocatorStatCacheRefills, 1);
+    if (timed) {
+      AllocatorClassCounters::Add(&counters->refill_samples, 1);
+      AllocatorClassCounters::Add(&counters->refill_ns, NanoTime() - start);
+    }
+    AllocatorClassCounters::Add(&counters->cache_refills, 1);
   }
 
   NOINLINE void Drain(SizeClassAllocator *allocator, uptr class_id) {
@@ -248,6 +378,18 @@ struct SizeClassAllocator32LocalCache {
                     &c->batch[first_idx_to_drain], cnt);
     c->count -= cnt;
     allocator->DeallocateBatch(&stats_, class_id, b);
+    stats_.Add(AllocatorStatCacheDrains, 1);
+    AllocatorClassCounters::Add(
+        &allocator->GetClassCounters(class_id)->cache_drains, 1);
+  }
+
+  NOINLINE void PublishCounters(PerClass *c, SizeClassAllocator *allocator,
+                                uptr class_id) {
+    AllocatorClassCounters *counters = allocator->GetClassCounters(class_id);
+    AllocatorClassCounters::Add(&counters->allocs, c->allocs);
+    AllocatorClassCounters::Add(&counters->frees, c->frees);
+    c->allocs = 0;
+    c->frees = 0;
   }
 };
 
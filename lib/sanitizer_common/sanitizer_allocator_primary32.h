@@ -36,11 +36,25 @@ template<class SizeClassAllocator> struct SizeClassAllocator32LocalCache;
 //
 // In order to avoid false sharing the objects of this class should be
 // chache-line aligned.
+//
+// With kLockFreeFreeLists, the free list of TransferBatches of each size class
+// is an LFStack, whose counter protects it from ABA, and the per-class mutex is
+// only taken to map new regions, so ForceLock() does not stop the transfers.
+// The flag is ignored where the space does not fit in the pointer bits of
+// LFStack (on some 64-bit targets).
+
+struct SizeClassAllocator32FlagMasks {  //  Bit masks.
+  enum {
+    kLockFreeFreeLists = 1,
+  };
+};
+
 template <const uptr kSpaceBeg, const u64 kSpaceSize,
           const uptr kMetadataSize, class SizeClassMap,
           const uptr kRegionSizeLog,
           class ByteMap,
-          class MapUnmapCallback = NoOpMapUnmapCallback>
+          class MapUnmapCallback = NoOpMapUnmapCallback,
+          const uptr kFlags = 0>
 class SizeClassAllocator32 {
  public:
   struct TransferBatch {
@@ -82,17 +96,22 @@ class SizeClassAllocator32 {
   COMPILER_CHECK(sizeof(TransferBatch) ==
                  SizeClassMap::kMaxNumCachedHint * sizeof(uptr));
 
+  static const bool kUsingLockFreeFreeLists =
+      (kFlags & SizeClassAllocator32FlagMasks::kLockFreeFreeLists) &&
+      kSpaceBeg + (kSpaceSize - 1) <= LFStack<TransferBatch>::kPtrMask;
+
   static uptr ClassIdToSize(uptr class_id) {
     return SizeClassMap::Size(class_id);
   }
 
   typedef SizeClassAllocator32<kSpaceBeg, kSpaceSize, kMetadataSize,
-      SizeClassMap, kRegionSizeLog, ByteMap, MapUnmapCallback> ThisT;
+      SizeClassMap, kRegionSizeLog, ByteMap, MapUnmapCallback, kFlags> ThisT;
   typedef SizeClassAllocator32LocalCache<ThisT> AllocatorCache;
 
   void Init(s32 release_to_os_interval_ms) {
     possible_regions.TestOnlyInit();
     internal_memset(size_class_info_array, 0, sizeof(size_class_info_array));
+    internal_memset(class_stats_, 0, sizeof(class_stats_));
   }
 
   s32 ReleaseToOSIntervalMs() const {
@@ -103,6 +122,10 @@ class SizeClassAllocator32 {
     // This is empty here. Currently only implemented in 64-bit allocator.
   }
 
+  void ReleaseToOSInBackground(bool force) {
+    // This is empty here. Currently only implemented in 64-bit allocator.
+  }
+
   void *MapWithCallback(uptr size) {
     size = RoundUpTo(size, GetPageSizeCached());
     void *res = MmapOrDie(size, "SizeClassAllocator32");
@@ -135,6 +158,18 @@ class SizeClassAllocator32 {
                                         uptr class_id) {
     CHECK_LT(class_id, kNumClasses);
     SizeClassInfo *sci = GetSizeClassInfo(class_id);
+    if (kUsingLockFreeFreeLists) {
+      if (TransferBatch *b = PopBatch(class_id, sci))
+        return b;
+      SpinMutexLock l(&sci->mutex);
+      // Another thread may have populated the list in the meantime.
+      TransferBatch *b = PopBatch(class_id, sci);
+      while (!b) {
+        PopulateFreeList(stat, c, sci, class_id);
+        b = PopBatch(class_id, sci);
+      }
+      return b;
+    }
     SpinMutexLock l(&sci->mutex);
     if (sci->free_list.empty())
       PopulateFreeList(stat, c, sci, class_id);
@@ -148,8 +183,12 @@ class SizeClassAllocator32 {
                                 TransferBatch *b) {
     CHECK_LT(class_id, kNumClasses);
     SizeClassInfo *sci = GetSizeClassInfo(class_id);
-    SpinMutexLock l(&sci->mutex);
     CHECK_GT(b->Count(), 0);
+    if (kUsingLockFreeFreeLists) {
+      PushBatch(class_id, sci, b);
+      return;
+    }
+    SpinMutexLock l(&sci->mutex);
     sci->free_list.push_front(b);
   }
 
@@ -184,6 +223,11 @@ class SizeClassAllocator32 {
 
   uptr ClassID(uptr size) { return SizeClassMap::ClassID(size); }
 
+  // The free lists are kept in the chunks themselves, so a free chunk is
+  // never known to hold only zeros.
+  bool ChunkIsZero(uptr class_id, const void *p) { return false; }
+  void MarkChunkDirty(uptr class_id, const void *p) {}
+
   uptr TotalMemoryUsed() {
     // No need to lock here.
     uptr res = 0;
@@ -216,7 +260,15 @@ class SizeClassAllocator32 {
   // Iterate over all existing chunks.
   // The allocator must be locked when calling this function.
   void ForEachChunk(ForEachChunkCallback callback, void *arg) {
-    for (uptr region = 0; region < kNumPossibleRegions; region++)
+    ForEachChunkInPart(callback, arg, 0, 1);
+  }
+
+  // Same as ForEachChunk, for the regions in the part |part| of |n_parts|
+  // disjoint parts. The parts can be iterated over concurrently.
+  void ForEachChunkInPart(ForEachChunkCallback callback, void *arg, uptr part,
+                          uptr n_parts) {
+    CHECK_LT(part, n_parts);
+    for (uptr region = part; region < kNumPossibleRegions; region += n_parts)
       if (possible_regions[region]) {
         uptr chunk_size = ClassIdToSize(possible_regions[region]);
         uptr max_chunks_in_region = kRegionSize / (chunk_size + kMetadataSize);
@@ -233,12 +285,42 @@ class SizeClassAllocator32 {
   void PrintStats() {
   }
 
+  // The regions are spread over the whole address space, so there is no range
+  // the chunks are allocated from: returns an empty one.
+  void GetSpaceRange(uptr *beg, uptr *end) {
+    *beg = 0;
+    *end = 0;
+  }
+
+  AllocatorClassCounters *GetClassCounters(uptr class_id) {
+    CHECK_LT(class_id, kNumClasses);
+    return &class_stats_[class_id].counters;
+  }
+
+  void GetClassStats(uptr class_id, AllocatorClassStats *s) {
+    SizeClassInfo *sci = GetSizeClassInfo(class_id);
+    ClassStats *cs = &class_stats_[class_id];
+    s->size = ClassIdToSize(class_id);
+    s->free_chunks = 0;
+    {
+      SpinMutexLock l(&sci->mutex);
+      s->mapped_bytes = cs->mapped_user;
+      if (kUsingLockFreeFreeLists)
+        s->free_chunks = atomic_load(&cs->free_chunks, memory_order_relaxed);
+      for (TransferBatch *b = sci->free_list.front(); b; b = b->next)
+        s->free_chunks += b->Count();
+    }
+    cs->counters.Get(s);
+  }
+
   static uptr AdditionalSize() {
     return 0;
   }
 
   typedef SizeClassMap SizeClassMapT;
   static const uptr kNumClasses = SizeClassMap::kNumClasses;
+  // Not NUMA-aware.
+  static const uptr kNumNodes = 1;
 
  private:
   static const uptr kRegionSize = 1 << kRegionSizeLog;
@@ -247,11 +329,35 @@ class SizeClassAllocator32 {
   struct SizeClassInfo {
     SpinMutex mutex;
     IntrusiveList<TransferBatch> free_list;
+    LFStack<TransferBatch> lf_free_list;  // Used if kUsingLockFreeFreeLists.
     char padding[kCacheLineSize - sizeof(uptr) -
-                 sizeof(IntrusiveList<TransferBatch>)];
+                 sizeof(IntrusiveList<TransferBatch>) -
+                 sizeof(LFStack<TransferBatch>)];
   };
   COMPILER_CHECK(sizeof(SizeClassInfo) == kCacheLineSize);
 
+  // Kept apart from SizeClassInfo, which must fit in a cache line.
+  struct ClassStats {
+    uptr mapped_user;  // Protected by SizeClassInfo::mutex.
+    // Chunks in lf_free_list, which cannot be walked while in use.
+    atomic_uintptr_t free_chunks;
+    AllocatorClassCounters counters;
+  };
+
+  TransferBatch *PopBatch(uptr class_id, SizeClassInfo *sci) {
+    TransferBatch *b = sci->lf_free_list.Pop();
+    if (b)
+      atomic_fetch_sub(&class_stats_[class_id].free_chunks, b->Count(),
+                       memory_order_relaxed);
+    return b;
+  }
+
+  void PushBatch(uptr class_id, SizeClassInfo *sci, TransferBatch *b) {
+    atomic_fetch_add(&class_stats_[class_id].free_chunks, b->Count(),
+                     memory_order_relaxed);
+    sci->lf_free_list.Push(b);
+  }
+
   uptr ComputeRegionId(uptr mem) {
     uptr res = mem >> kRegionSizeLog;
     CHECK_LT(res, kNumPossibleRegions);
@@ -270,6 +376,7 @@ class SizeClassAllocator32 {
     stat->Add(AllocatorStatMapped, kRegionSize);
     CHECK_EQ(0U, (res & (kRegionSize - 1)));
     possible_regions.set(ComputeRegionId(res), static_cast<u8>(class_id));
+    class_stats_[class_id].mapped_user += kRegionSize;
     return res;
   }
 
@@ -292,19 +399,26 @@ class SizeClassAllocator32 {
       }
       b->Add((void*)i);
       if (b->Count() == max_count) {
-        CHECK_GT(b->Count(), 0);
-        sci->free_list.push_back(b);
+        AddToFreeList(class_id, sci, b);
         b = nullptr;
       }
     }
-    if (b) {
-      CHECK_GT(b->Count(), 0);
+    if (b)
+      AddToFreeList(class_id, sci, b);
+  }
+
+  // sci->mutex is held.
+  void AddToFreeList(uptr class_id, SizeClassInfo *sci, TransferBatch *b) {
+    CHECK_GT(b->Count(), 0);
+    if (kUsingLockFreeFreeLists)
+      PushBatch(class_id, sci, b);
+    else
       sci->free_list.push_back(b);
-    }
   }
 
   ByteMap possible_regions;
   SizeClassInfo size_class_info_array[kNumClasses];
+  ClassStats class_stats_[kNumClasses];
 };
 
 
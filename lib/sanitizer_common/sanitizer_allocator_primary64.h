@@ -36,13 +36,55 @@ template<class SizeClassAllocator> struct SizeClassAllocator64LocalCache;
 //
 // A Region looks like this:
 // UserChunk1 ... UserChunkN <gap> MetaChunkN ... MetaChunk1 FreeArray
+//
+// With kUseHugePages, the user memory of a region which has grown beyond
+// the first huge page is considered dense: from then on it is mapped in huge
+// page steps, backed by transparent huge pages and released to the OS only
+// in whole huge pages.
+//
+// The user chunks of at least kMinZeroTrackedSize bytes have a bit in a
+// bitmap kept after the FreeArray, set while the chunk is known to hold only
+// zeros: it was never handed out, or all of its pages were released to the OS
+// since it was last deallocated. calloc() uses it to skip clearing them.
+//
+// With kNumaAware, every Region is split into kNumNodes equal parts, one per
+// NUMA node, each laid out as above and bound to its node. The per-thread
+// caches refill from the part of the node they run on, and freed chunks always
+// go back to the part they were allocated from. Compact pointers remain
+// relative to the beginning of the Region.
 
 struct SizeClassAllocator64FlagMasks {  //  Bit masks.
   enum {
     kRandomShuffleChunks = 1,
+    kUseHugePages = 2,
+    kNumaAware = 4,
   };
 };
 
+// Flags the tools' 64-bit primary allocators are built with. Huge pages are
+// a build option (CMake: COMPILER_RT_ALLOCATOR_HUGE_PAGES) and assume 2M
+// transparent huge pages, as on x86_64. So are NUMA-aware regions (CMake:
+// COMPILER_RT_ALLOCATOR_NUMA), split between COMPILER_RT_ALLOCATOR_NUMA_NODES
+// nodes; the nodes past this number share the parts of the regions modulo it.
+#ifndef SANITIZER_ALLOCATOR_HUGE_PAGES
+# define SANITIZER_ALLOCATOR_HUGE_PAGES 0
+#endif
+#ifndef SANITIZER_ALLOCATOR_NUMA
+# define SANITIZER_ALLOCATOR_NUMA 0
+#endif
+#ifndef SANITIZER_ALLOCATOR_NUMA_NODES
+# define SANITIZER_ALLOCATOR_NUMA_NODES 2
+#endif
+static const uptr kAllocatorNumaNodes = SANITIZER_ALLOCATOR_NUMA_NODES;
+static const uptr kToolAllocator64Flags =
+#if SANITIZER_ALLOCATOR_HUGE_PAGES && defined(__x86_64__)
+    SizeClassAllocator64FlagMasks::kUseHugePages |
+#endif
+#if SANITIZER_ALLOCATOR_NUMA && SANITIZER_LINUX
+    SizeClassAllocator64FlagMasks::kNumaAware |
+#endif
+    0;
+
 template <class Params>
 class SizeClassAllocator64 {
  public:
@@ -54,6 +96,13 @@ class SizeClassAllocator64 {
 
   static const bool kRandomShuffleChunks =
       Params::kFlags & SizeClassAllocator64FlagMasks::kRandomShuffleChunks;
+  static const bool kUsingHugePages =
+      Params::kFlags & SizeClassAllocator64FlagMasks::kUseHugePages;
+  // Transparent huge page size with 4K pages.
+  static const uptr kHugePageSize = 1 << 21;
+  static const bool kNumaAware =
+      Params::kFlags & SizeClassAllocator64FlagMasks::kNumaAware;
+  static const uptr kNumNodes = kNumaAware ? kAllocatorNumaNodes : 1;
 
   typedef SizeClassAllocator64<Params> ThisT;
   typedef SizeClassAllocator64LocalCache<ThisT> AllocatorCache;
@@ -69,17 +118,44 @@ class SizeClassAllocator64 {
     return base + (static_cast<uptr>(ptr32) << kCompactPtrScale);
   }
 
+  // Returns the node whose part of the regions the calling thread allocates
+  // from.
+  static uptr CurrentNode() {
+    return kNumNodes == 1 ? 0 : GetNumaNode() % kNumNodes;
+  }
+
+  // Returns the node whose part of its region p belongs to.
+  uptr GetNode(const void *p) {
+    if (kNumNodes == 1)
+      return 0;
+    return ((reinterpret_cast<uptr>(p) - SpaceBeg()) % kRegionSize) /
+           kNodeRegionSize;
+  }
+
   void Init(s32 release_to_os_interval_ms) {
     uptr TotalSpaceSize = kSpaceSize + AdditionalSize();
     if (kUsingConstantSpaceBeg) {
       CHECK_EQ(kSpaceBeg, reinterpret_cast<uptr>(
                               MmapFixedNoAccess(kSpaceBeg, TotalSpaceSize)));
+    } else if (kUsingHugePages) {
+      // Regions have to start at huge page boundaries.
+      uptr map_size = TotalSpaceSize + kHugePageSize;
+      uptr map_beg = reinterpret_cast<uptr>(MmapNoAccess(map_size));
+      CHECK_NE(map_beg, ~(uptr)0);
+      NonConstSpaceBeg = RoundUpTo(map_beg, kHugePageSize);
+      uptr map_end = map_beg + map_size;
+      if (NonConstSpaceBeg != map_beg)
+        UnmapOrDie((void *)map_beg, NonConstSpaceBeg - map_beg);
+      if (NonConstSpaceBeg + TotalSpaceSize != map_end)
+        UnmapOrDie((void *)(NonConstSpaceBeg + TotalSpaceSize),
+                   map_end - (NonConstSpaceBeg + TotalSpaceSize));
     } else {
       NonConstSpaceBeg =
           reinterpret_cast<uptr>(MmapNoAccess(TotalSpaceSize));
       CHECK_NE(NonConstSpaceBeg, ~(uptr)0);
     }
     SetReleaseToOSIntervalMs(release_to_os_interval_ms);
+    atomic_store(&release_in_background_, 0, memory_order_relaxed);
     MapWithCallback(SpaceEnd(), AdditionalSize());
   }
 
@@ -92,6 +168,22 @@ class SizeClassAllocator64 {
                  memory_order_relaxed);
   }
 
+  // Releases free memory of all size classes to the OS. Meant to be called
+  // periodically from a background thread: the first call switches the
+  // allocator to background mode, after which ReturnToAllocator no longer
+  // releases memory inline. If force is true, the release interval is
+  // ignored (used when the process is close to its RSS limit).
+  void ReleaseToOSInBackground(bool force) {
+    atomic_store(&release_in_background_, 1, memory_order_relaxed);
+    for (uptr class_id = 1; class_id < kNumClasses; class_id++) {
+      for (uptr node = 0; node < kNumNodes; node++) {
+        RegionInfo *region = GetRegionInfo(class_id, node);
+        BlockingMutexLock l(&region->mutex);
+        MaybeReleaseToOS(class_id, node, force);
+      }
+    }
+  }
+
   void MapWithCallback(uptr beg, uptr size) {
     CHECK_EQ(beg, reinterpret_cast<uptr>(MmapFixedOrDie(beg, size)));
     MapUnmapCallback().OnMap(beg, size);
@@ -107,33 +199,24 @@ class SizeClassAllocator64 {
       alignment <= SizeClassMap::kMaxSize;
   }
 
+  // The chunks may come from any node, each of them goes back to its own.
   NOINLINE void ReturnToAllocator(AllocatorStats *stat, uptr class_id,
                                   const CompactPtrT *chunks, uptr n_chunks) {
-    RegionInfo *region = GetRegionInfo(class_id);
-    uptr region_beg = GetRegionBeginBySizeClass(class_id);
-    CompactPtrT *free_array = GetFreeArray(region_beg);
-
-    BlockingMutexLock l(&region->mutex);
-    uptr old_num_chunks = region->num_freed_chunks;
-    uptr new_num_freed_chunks = old_num_chunks + n_chunks;
-    EnsureFreeArraySpace(region, region_beg, new_num_freed_chunks);
-    for (uptr i = 0; i < n_chunks; i++)
-      free_array[old_num_chunks + i] = chunks[i];
-    region->num_freed_chunks = new_num_freed_chunks;
-    region->n_freed += n_chunks;
-
-    MaybeReleaseToOS(class_id);
+    for (uptr node = 0; node < kNumNodes; node++)
+      ReturnToNode(class_id, node, chunks, n_chunks);
   }
 
+  // Takes the chunks from the given node's part of the region.
   NOINLINE void GetFromAllocator(AllocatorStats *stat, uptr class_id,
-                                 CompactPtrT *chunks, uptr n_chunks) {
-    RegionInfo *region = GetRegionInfo(class_id);
+                                 CompactPtrT *chunks, uptr n_chunks,
+                                 uptr node = 0) {
+    RegionInfo *region = GetRegionInfo(class_id, node);
     uptr region_beg = GetRegionBeginBySizeClass(class_id);
-    CompactPtrT *free_array = GetFreeArray(region_beg);
+    CompactPtrT *free_array = GetFreeArray(region_beg, node);
 
     BlockingMutexLock l(&region->mutex);
     if (UNLIKELY(region->num_freed_chunks < n_chunks)) {
-      PopulateFreeArray(stat, class_id, region,
+      PopulateFreeArray(stat, class_id, node, region,
                         n_chunks - region->num_freed_chunks);
       CHECK_GE(region->num_freed_chunks, n_chunks);
     }
@@ -176,11 +259,12 @@ class SizeClassAllocator64 {
     uptr size = ClassIdToSize(class_id);
     if (!size) return nullptr;
     uptr chunk_idx = GetChunkIdx((uptr)p, size);
-    uptr reg_beg = GetRegionBegin(p);
+    uptr node = GetNode(p);
+    uptr reg_beg = GetRegionBegin(p) + node * kNodeRegionSize;
     uptr beg = chunk_idx * size;
     uptr next_beg = beg + size;
     if (class_id >= kNumClasses) return nullptr;
-    RegionInfo *region = GetRegionInfo(class_id);
+    RegionInfo *region = GetRegionInfo(class_id, node);
     if (region->mapped_user >= next_beg)
       return reinterpret_cast<void*>(reg_beg + beg);
     return nullptr;
@@ -193,19 +277,42 @@ class SizeClassAllocator64 {
 
   uptr ClassID(uptr size) { return SizeClassMap::ClassID(size); }
 
+  // Returns true if the chunk p of class_id, which must have just been
+  // allocated, holds only zeros.
+  bool ChunkIsZero(uptr class_id, const void *p) {
+    uptr size = ClassIdToSize(class_id);
+    if (size < kMinZeroTrackedSize)
+      return false;
+    uptr word, mask;
+    atomic_uintptr_t *bitmap = GetZeroBitmap(class_id, p, size, &word, &mask);
+    return atomic_load(&bitmap[word], memory_order_relaxed) & mask;
+  }
+
+  // Must be called when the chunk p of class_id is deallocated.
+  void MarkChunkDirty(uptr class_id, const void *p) {
+    uptr size = ClassIdToSize(class_id);
+    if (size < kMinZeroTrackedSize)
+      return;
+    uptr word, mask;
+    atomic_uintptr_t *bitmap = GetZeroBitmap(class_id, p, size, &word, &mask);
+    if (atomic_load(&bitmap[word], memory_order_relaxed) & mask)
+      UpdateZeroBitmapWord(&bitmap[word], mask, false);
+  }
+
   void *GetMetaData(const void *p) {
     uptr class_id = GetSizeClass(p);
     uptr size = ClassIdToSize(class_id);
     uptr chunk_idx = GetChunkIdx(reinterpret_cast<uptr>(p), size);
     uptr region_beg = GetRegionBeginBySizeClass(class_id);
-    return reinterpret_cast<void *>(GetMetadataEnd(region_beg) -
+    return reinterpret_cast<void *>(GetMetadataEnd(region_beg, GetNode(p)) -
                                     (1 + chunk_idx) * kMetadataSize);
   }
 
   uptr TotalMemoryUsed() {
     uptr res = 0;
     for (uptr i = 0; i < kNumClasses; i++)
-      res += GetRegionInfo(i)->allocated_user;
+      for (uptr node = 0; node < kNumNodes; node++)
+        res += GetRegionInfo(i, node)->allocated_user;
     return res;
   }
 
@@ -221,11 +328,13 @@ class SizeClassAllocator64 {
         stats[class_id] = rss;
   }
 
-  void PrintStats(uptr class_id, uptr rss) {
-    RegionInfo *region = GetRegionInfo(class_id);
+  void PrintStats(uptr class_id, uptr node, uptr rss) {
+    RegionInfo *region = GetRegionInfo(class_id, node);
     if (region->mapped_user == 0) return;
     uptr in_use = region->n_allocated - region->n_freed;
     uptr avail_chunks = region->allocated_user / ClassIdToSize(class_id);
+    if (kNumNodes > 1)
+      Printf("  node %zd", node);
     Printf(
         "  %02zd (%6zd): mapped: %6zdK allocs: %7zd frees: %7zd inuse: %6zd "
         "num_freed_chunks %7zd avail: %6zd rss: %6zdK releases: %6zd\n",
@@ -235,53 +344,99 @@ class SizeClassAllocator64 {
         region->rtoi.num_releases);
   }
 
+  // The class counters are shared by all the nodes and kept with node 0.
+  AllocatorClassCounters *GetClassCounters(uptr class_id) {
+    return &GetRegionInfo(class_id, 0)->counters;
+  }
+
+  void GetClassStats(uptr class_id, AllocatorClassStats *s) {
+    s->size = ClassIdToSize(class_id);
+    s->mapped_bytes = 0;
+    s->free_chunks = 0;
+    for (uptr node = 0; node < kNumNodes; node++) {
+      RegionInfo *region = GetRegionInfo(class_id, node);
+      s->mapped_bytes += region->mapped_user;
+      s->free_chunks += region->num_freed_chunks;
+    }
+    GetClassCounters(class_id)->Get(s);
+  }
+
+  void GetNodeStats(uptr node, AllocatorNodeStats *s) {
+    internal_memset(s, 0, sizeof(*s));
+    for (uptr class_id = 1; class_id < kNumClasses; class_id++) {
+      RegionInfo *region = GetRegionInfo(class_id, node);
+      s->mapped_bytes += region->mapped_user;
+      s->free_chunks += region->num_freed_chunks;
+      s->allocs += region->n_allocated;
+      s->frees += region->n_freed;
+    }
+  }
+
   void PrintStats() {
     uptr total_mapped = 0;
     uptr n_allocated = 0;
     uptr n_freed = 0;
-    for (uptr class_id = 1; class_id < kNumClasses; class_id++) {
-      RegionInfo *region = GetRegionInfo(class_id);
-      total_mapped += region->mapped_user;
-      n_allocated += region->n_allocated;
-      n_freed += region->n_freed;
+    AllocatorNodeStats node_stats[kNumNodes];
+    for (uptr node = 0; node < kNumNodes; node++) {
+      GetNodeStats(node, &node_stats[node]);
+      total_mapped += node_stats[node].mapped_bytes;
+      n_allocated += node_stats[node].allocs;
+      n_freed += node_stats[node].frees;
     }
     Printf("Stats: SizeClassAllocator64: %zdM mapped in %zd allocations; "
            "remains %zd\n",
            total_mapped >> 20, n_allocated, n_allocated - n_freed);
-    uptr rss_stats[kNumClasses];
+    for (uptr node = 0; node < kNumNodes && kNumNodes > 1; node++) {
+      AllocatorNodeStats *s = &node_stats[node];
+      Printf("  node %zd: %zdM mapped in %zd allocations; remains %zd\n", node,
+             s->mapped_bytes >> 20, s->allocs, s->allocs - s->frees);
+    }
+    const uptr kNumParts = kNumClasses * kNumNodes;
+    uptr rss_stats[kNumParts];
     for (uptr class_id = 0; class_id < kNumClasses; class_id++)
-      rss_stats[class_id] = SpaceBeg() + kRegionSize * class_id;
-    GetMemoryProfile(FillMemoryProfile, rss_stats, kNumClasses);
+      for (uptr node = 0; node < kNumNodes; node++)
+        rss_stats[class_id * kNumNodes + node] =
+            GetNodeRegionBegin(class_id, node);
+    GetMemoryProfile(FillMemoryProfile, rss_stats, kNumParts);
     for (uptr class_id = 1; class_id < kNumClasses; class_id++)
-      PrintStats(class_id, rss_stats[class_id]);
+      for (uptr node = 0; node < kNumNodes; node++)
+        PrintStats(class_id, node, rss_stats[class_id * kNumNodes + node]);
   }
 
   // ForceLock() and ForceUnlock() are needed to implement Darwin malloc zone
   // introspection API.
   void ForceLock() {
     for (uptr i = 0; i < kNumClasses; i++) {
-      GetRegionInfo(i)->mutex.Lock();
+      for (uptr node = 0; node < kNumNodes; node++)
+        GetRegionInfo(i, node)->mutex.Lock();
     }
   }
 
   void ForceUnlock() {
     for (int i = (int)kNumClasses - 1; i >= 0; i--) {
-      GetRegionInfo(i)->mutex.Unlock();
+      for (int node = (int)kNumNodes - 1; node >= 0; node--)
+        GetRegionInfo(i, node)->mutex.Unlock();
     }
   }
 
-  // Iterate over all existing chunks.
+  // Iterate over all existing chunks, in the order of their addresses within
+  // each region. The chunks in the free arrays are skipped, the ones held by
+  // the caches are not.
   // The allocator must be locked when calling this function.
   void ForEachChunk(ForEachChunkCallback callback, void *arg) {
+    ForEachChunkInPart(callback, arg, 0, 1);
+  }
+
+  // Same as ForEachChunk, for the regions in the part |part| of |n_parts|
+  // disjoint parts. The parts can be iterated over concurrently.
+  void ForEachChunkInPart(ForEachChunkCallback callback, void *arg, uptr part,
+                          uptr n_parts) {
+    CHECK_LT(part, n_parts);
+    uptr i = 0;
     for (uptr class_id = 1; class_id < kNumClasses; class_id++) {
-      RegionInfo *region = GetRegionInfo(class_id);
-      uptr chunk_size = ClassIdToSize(class_id);
-      uptr region_beg = SpaceBeg() + class_id * kRegionSize;
-      for (uptr chunk = region_beg;
-           chunk < region_beg + region->allocated_user;
-           chunk += chunk_size) {
-        // Too slow: CHECK_EQ((void *)chunk, GetBlockBegin((void *)chunk));
-        callback(chunk, arg);
+      for (uptr node = 0; node < kNumNodes; node++) {
+        if (i++ % n_parts == part)
+          ForEachChunkInRegion(class_id, node, callback, arg);
       }
     }
   }
@@ -290,8 +445,14 @@ class SizeClassAllocator64 {
     return SizeClassMap::Size(class_id);
   }
 
+  // Returns the range of the address space the chunks are allocated from.
+  void GetSpaceRange(uptr *beg, uptr *end) {
+    *beg = SpaceBeg();
+    *end = SpaceEnd();
+  }
+
   static uptr AdditionalSize() {
-    return RoundUpTo(sizeof(RegionInfo) * kNumClassesRounded,
+    return RoundUpTo(sizeof(RegionInfo) * kNumClassesRounded * kNumNodes,
                      GetPageSizeCached());
   }
 
@@ -301,11 +462,13 @@ class SizeClassAllocator64 {
 
  private:
   static const uptr kRegionSize = kSpaceSize / kNumClassesRounded;
+  // The part of a region dedicated to one node.
+  static const uptr kNodeRegionSize = kRegionSize / kNumNodes;
   // FreeArray is the array of free-d chunks (stored as 4-byte offsets).
-  // In the worst case it may reguire kRegionSize/SizeClassMap::kMinSize
+  // In the worst case it may reguire kNodeRegionSize/SizeClassMap::kMinSize
   // elements, but in reality this will not happen. For simplicity we
-  // dedicate 1/8 of the region's virtual space to FreeArray.
-  static const uptr kFreeArraySize = kRegionSize / 8;
+  // dedicate 1/8 of the node part's virtual space to FreeArray.
+  static const uptr kFreeArraySize = kNodeRegionSize / 8;
 
   static const bool kUsingConstantSpaceBeg = kSpaceBeg != ~(uptr)0;
   uptr NonConstSpaceBeg;
@@ -317,14 +480,26 @@ class SizeClassAllocator64 {
   COMPILER_CHECK((kRegionSize) >= (1ULL << (SANITIZER_WORDSIZE / 2)));
   // kRegionSize must be <= 2^36, see CompactPtrT.
   COMPILER_CHECK((kRegionSize) <= (1ULL << (SANITIZER_WORDSIZE / 2 + 4)));
+  COMPILER_CHECK(!kUsingHugePages || !kUsingConstantSpaceBeg ||
+                 kSpaceBeg % kHugePageSize == 0);
+  COMPILER_CHECK((kNumNodes & (kNumNodes - 1)) == 0 && kNumNodes <= 64);
+  COMPILER_CHECK(kNodeRegionSize % kHugePageSize == 0);
   // Call mmap for user memory with at least this size.
   static const uptr kUserMapSize = 1 << 16;
   // Call mmap for metadata memory with at least this size.
   static const uptr kMetaMapSize = 1 << 16;
   // Call mmap for free array memory with at least this size.
   static const uptr kFreeArrayMapSize = 1 << 16;
+  // Smallest chunk size whose zero state is tracked, see ChunkIsZero. The
+  // free array of such a class takes at most 1/4096 of the node part, so the
+  // zero bitmap goes in the second half of the free array space.
+  static const uptr kMinZeroTrackedSize = 1 << 14;
+  static const uptr kZeroBitmapOffset = kFreeArraySize / 2;
+  COMPILER_CHECK(kNodeRegionSize / kMinZeroTrackedSize * sizeof(CompactPtrT) <=
+                 kZeroBitmapOffset);
 
   atomic_sint32_t release_to_os_interval_ms_;
+  atomic_uint8_t release_in_background_;
 
   struct ReleaseToOsInfo {
     uptr n_freed_at_last_release;
@@ -340,9 +515,11 @@ class SizeClassAllocator64 {
     uptr allocated_meta;  // Bytes allocated for metadata.
     uptr mapped_user;  // Bytes mapped for user memory.
     uptr mapped_meta;  // Bytes mapped for metadata.
+    uptr mapped_zero_bitmap;  // Bytes mapped for the zero bitmap.
     u32 rand_state; // Seed for random shuffle, used if kRandomShuffleChunks.
     uptr n_allocated, n_freed;  // Just stats.
     ReleaseToOsInfo rtoi;
+    AllocatorClassCounters counters;
   };
   COMPILER_CHECK(sizeof(RegionInfo) >= kCacheLineSize);
 
@@ -358,22 +535,32 @@ class SizeClassAllocator64 {
       Swap(a[i], a[RandN(rand_state, i + 1)]);
   }
 
-  RegionInfo *GetRegionInfo(uptr class_id) {
+  RegionInfo *GetRegionInfo(uptr class_id, uptr node) {
     CHECK_LT(class_id, kNumClasses);
     RegionInfo *regions =
         reinterpret_cast<RegionInfo *>(SpaceBeg() + kSpaceSize);
-    return &regions[class_id];
+    return &regions[class_id * kNumNodes + node];
+  }
+
+  uptr GetNodeRegionBegin(uptr class_id, uptr node) {
+    return GetRegionBeginBySizeClass(class_id) + node * kNodeRegionSize;
+  }
+
+  uptr CompactPtrToNode(CompactPtrT ptr) {
+    if (kNumNodes == 1)
+      return 0;
+    return (static_cast<uptr>(ptr) << kCompactPtrScale) / kNodeRegionSize;
   }
 
-  uptr GetMetadataEnd(uptr region_beg) {
-    return region_beg + kRegionSize - kFreeArraySize;
+  uptr GetMetadataEnd(uptr region_beg, uptr node) {
+    return region_beg + (node + 1) * kNodeRegionSize - kFreeArraySize;
   }
 
   uptr GetChunkIdx(uptr chunk, uptr size) {
     if (!kUsingConstantSpaceBeg)
       chunk -= SpaceBeg();
 
-    uptr offset = chunk % kRegionSize;
+    uptr offset = chunk % kNodeRegionSize;
     // Here we divide by a non-constant. This is costly.
     // size always fits into 32-bits. If the offset fits too, use 32-bit div.
     if (offset >> (SANITIZER_WORDSIZE / 2))
@@ -381,19 +568,69 @@ class SizeClassAllocator64 {
     return (u32)offset / (u32)size;
   }
 
-  CompactPtrT *GetFreeArray(uptr region_beg) {
-    return reinterpret_cast<CompactPtrT *>(region_beg + kRegionSize -
-                                           kFreeArraySize);
+  CompactPtrT *GetFreeArray(uptr region_beg, uptr node) {
+    return reinterpret_cast<CompactPtrT *>(GetMetadataEnd(region_beg, node));
+  }
+
+  atomic_uintptr_t *GetZeroBitmapBegin(uptr region_beg, uptr node) {
+    return reinterpret_cast<atomic_uintptr_t *>(
+        GetMetadataEnd(region_beg, node) + kZeroBitmapOffset);
+  }
+
+  atomic_uintptr_t *GetZeroBitmap(uptr class_id, const void *p, uptr size,
+                                  uptr *word, uptr *mask) {
+    const uptr kBitsPerWord = sizeof(uptr) * 8;
+    uptr chunk_idx = GetChunkIdx(reinterpret_cast<uptr>(p), size);
+    *word = chunk_idx / kBitsPerWord;
+    *mask = (uptr)1 << (chunk_idx % kBitsPerWord);
+    return GetZeroBitmapBegin(GetRegionBeginBySizeClass(class_id), GetNode(p));
+  }
+
+  // The chunks deallocated without holding the region mutex share the words
+  // with the ones being marked under it.
+  static void UpdateZeroBitmapWord(atomic_uintptr_t *word, uptr mask,
+                                   bool zero) {
+    uptr cmp = atomic_load(word, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak(word, &cmp,
+                                         zero ? cmp | mask : cmp & ~mask,
+                                         memory_order_relaxed)) {
+    }
+  }
+
+  // Sets the bits of the chunks [beg_idx, end_idx) of the node part. The
+  // region is expected to be locked.
+  void MarkZeroChunks(uptr region_beg, uptr node, uptr beg_idx,
+                      uptr end_idx) {
+    const uptr kBitsPerWord = sizeof(uptr) * 8;
+    atomic_uintptr_t *bitmap = GetZeroBitmapBegin(region_beg, node);
+    for (uptr i = beg_idx; i < end_idx; i++)
+      UpdateZeroBitmapWord(&bitmap[i / kBitsPerWord],
+                           (uptr)1 << (i % kBitsPerWord), true);
+  }
+
+  void EnsureZeroBitmapSpace(RegionInfo *region, uptr region_beg, uptr node,
+                             uptr num_chunks) {
+    uptr needed_space = RoundUpTo(num_chunks, 64) / 8;
+    if (region->mapped_zero_bitmap < needed_space) {
+      CHECK_LE(needed_space, kFreeArraySize - kZeroBitmapOffset);
+      uptr new_mapped = RoundUpTo(needed_space, kFreeArrayMapSize);
+      MapWithCallback(reinterpret_cast<uptr>(
+                          GetZeroBitmapBegin(region_beg, node)) +
+                          region->mapped_zero_bitmap,
+                      new_mapped - region->mapped_zero_bitmap);
+      region->mapped_zero_bitmap = new_mapped;
+    }
   }
 
-  void EnsureFreeArraySpace(RegionInfo *region, uptr region_beg,
+  void EnsureFreeArraySpace(RegionInfo *region, uptr region_beg, uptr node,
                             uptr num_freed_chunks) {
     uptr needed_space = num_freed_chunks * sizeof(CompactPtrT);
     if (region->mapped_free_array < needed_space) {
       CHECK_LE(needed_space, kFreeArraySize);
       uptr new_mapped_free_array = RoundUpTo(needed_space, kFreeArrayMapSize);
-      uptr current_map_end = reinterpret_cast<uptr>(GetFreeArray(region_beg)) +
-                             region->mapped_free_array;
+      uptr current_map_end =
+          reinterpret_cast<uptr>(GetFreeArray(region_beg, node)) +
+          region->mapped_free_array;
       uptr new_map_size = new_mapped_free_array - region->mapped_free_array;
       MapWithCallback(current_map_end, new_map_size);
       region->mapped_free_array = new_mapped_free_array;
@@ -401,37 +638,87 @@ class SizeClassAllocator64 {
   }
 
 
+  // Adds the chunks which belong to the given node to its free array, skips
+  // the others.
+  void ReturnToNode(uptr class_id, uptr node, const CompactPtrT *chunks,
+                    uptr n_chunks) {
+    uptr n_node_chunks = n_chunks;
+    if (kNumNodes > 1) {
+      n_node_chunks = 0;
+      for (uptr i = 0; i < n_chunks; i++)
+        n_node_chunks += CompactPtrToNode(chunks[i]) == node;
+      if (!n_node_chunks)
+        return;
+    }
+    RegionInfo *region = GetRegionInfo(class_id, node);
+    uptr region_beg = GetRegionBeginBySizeClass(class_id);
+    CompactPtrT *free_array = GetFreeArray(region_beg, node);
+
+    BlockingMutexLock l(&region->mutex);
+    uptr old_num_chunks = region->num_freed_chunks;
+    uptr new_num_freed_chunks = old_num_chunks + n_node_chunks;
+    EnsureFreeArraySpace(region, region_beg, node, new_num_freed_chunks);
+    for (uptr i = 0, j = old_num_chunks; i < n_chunks; i++) {
+      if (CompactPtrToNode(chunks[i]) == node)
+        free_array[j++] = chunks[i];
+    }
+    region->num_freed_chunks = new_num_freed_chunks;
+    region->n_freed += n_node_chunks;
+
+    if (!atomic_load(&release_in_background_, memory_order_relaxed))
+      MaybeReleaseToOS(class_id, node, false);
+  }
+
   NOINLINE void PopulateFreeArray(AllocatorStats *stat, uptr class_id,
-                                  RegionInfo *region, uptr requested_count) {
+                                  uptr node, RegionInfo *region,
+                                  uptr requested_count) {
     // region->mutex is held.
     uptr size = ClassIdToSize(class_id);
     uptr beg_idx = region->allocated_user;
     uptr end_idx = beg_idx + requested_count * size;
     uptr region_beg = GetRegionBeginBySizeClass(class_id);
+    uptr node_beg = GetNodeRegionBegin(class_id, node);
     if (end_idx > region->mapped_user) {
       if (!kUsingConstantSpaceBeg && region->mapped_user == 0)
-        region->rand_state = static_cast<u32>(region_beg >> 12);  // From ASLR.
+        region->rand_state = static_cast<u32>(node_beg >> 12);  // From ASLR.
       // Do the mmap for the user memory.
       uptr map_size = kUserMapSize;
-      while (end_idx > region->mapped_user + map_size)
-        map_size += kUserMapSize;
+      if (kUsingHugePages && end_idx > kHugePageSize) {
+        // Dense region: map up to the next huge page boundary.
+        map_size = RoundUpTo(end_idx, kHugePageSize) - region->mapped_user;
+      } else {
+        while (end_idx > region->mapped_user + map_size)
+          map_size += kUserMapSize;
+      }
       CHECK_GE(region->mapped_user + map_size, end_idx);
-      MapWithCallback(region_beg + region->mapped_user, map_size);
+      MapWithCallback(node_beg + region->mapped_user, map_size);
+      if (kNumNodes > 1)
+        BindMemoryToNumaNode(node_beg + region->mapped_user, map_size, node);
       stat->Add(AllocatorStatMapped, map_size);
       region->mapped_user += map_size;
+      if (IsDense(region))
+        UseHugePagesInRegion(node_beg, region->mapped_user);
     }
-    CompactPtrT *free_array = GetFreeArray(region_beg);
+    CompactPtrT *free_array = GetFreeArray(region_beg, node);
     uptr total_count = (region->mapped_user - beg_idx) / size;
     uptr num_freed_chunks = region->num_freed_chunks;
-    EnsureFreeArraySpace(region, region_beg, num_freed_chunks + total_count);
+    EnsureFreeArraySpace(region, region_beg, node,
+                         num_freed_chunks + total_count);
     for (uptr i = 0; i < total_count; i++) {
-      uptr chunk = beg_idx + i * size;
+      uptr chunk = node_beg - region_beg + beg_idx + i * size;
       free_array[num_freed_chunks + total_count - 1 - i] =
           PointerToCompactPtr(0, chunk);
     }
     if (kRandomShuffleChunks)
       RandomShuffle(&free_array[num_freed_chunks], total_count,
                     &region->rand_state);
+    if (size >= kMinZeroTrackedSize) {
+      // The chunks of the just mapped memory were never handed out.
+      EnsureZeroBitmapSpace(region, region_beg, node,
+                            region->allocated_user / size + total_count);
+      MarkZeroChunks(region_beg, node, beg_idx / size,
+                     beg_idx / size + total_count);
+    }
     region->num_freed_chunks += total_count;
     region->allocated_user += total_count * size;
     CHECK_LE(region->allocated_user, region->mapped_user);
@@ -443,25 +730,95 @@ class SizeClassAllocator64 {
         map_size += kMetaMapSize;
       // Do the mmap for the metadata.
       CHECK_GE(region->mapped_meta + map_size, region->allocated_meta);
-      MapWithCallback(GetMetadataEnd(region_beg) -
+      MapWithCallback(GetMetadataEnd(region_beg, node) -
                       region->mapped_meta - map_size, map_size);
       region->mapped_meta += map_size;
     }
     CHECK_LE(region->allocated_meta, region->mapped_meta);
     if (region->mapped_user + region->mapped_meta >
-        kRegionSize - kFreeArraySize) {
+        kNodeRegionSize - kFreeArraySize) {
       Printf("%s: Out of memory. Dying. ", SanitizerToolName);
       Printf("The process has exhausted %zuMB for size class %zu.\n",
-          kRegionSize / 1024 / 1024, size);
+          kNodeRegionSize / 1024 / 1024, size);
       Die();
     }
   }
 
-  void MaybeReleaseChunkRange(uptr region_beg, uptr chunk_size,
-                              CompactPtrT first, CompactPtrT last) {
+  bool IsDense(RegionInfo *region) {
+    return kUsingHugePages && region->mapped_user > kHugePageSize;
+  }
+
+  // Dense regions are backed by huge pages, don't split them to release a
+  // part of one.
+  uptr ReleaseGranularity(RegionInfo *region) {
+    return IsDense(region) ? kHugePageSize : GetPageSizeCached();
+  }
+
+  void MaybeReleaseChunkRange(uptr region_beg, uptr node, uptr chunk_size,
+                              CompactPtrT first, CompactPtrT last,
+                              uptr granularity) {
     uptr beg_ptr = CompactPtrToPointer(region_beg, first);
     uptr end_ptr = CompactPtrToPointer(region_beg, last) + chunk_size;
-    ReleaseMemoryPagesToOS(beg_ptr, end_ptr);
+    uptr release_beg = RoundUpTo(beg_ptr, granularity);
+    uptr release_end = RoundDownTo(end_ptr, granularity);
+    ReleaseMemoryPagesToOS(release_beg, release_end);
+#if SANITIZER_LINUX
+    // Released anonymous pages read back as zeros on Linux (MADV_DONTNEED).
+    if (chunk_size >= kMinZeroTrackedSize && release_beg < release_end) {
+      uptr node_beg = region_beg + node * kNodeRegionSize;
+      MarkZeroChunks(region_beg, node,
+                     (release_beg - node_beg + chunk_size - 1) / chunk_size,
+                     (release_end - node_beg) / chunk_size);
+    }
+#endif
+  }
+
+  void ForEachChunkInRegion(uptr class_id, uptr node,
+                            ForEachChunkCallback callback, void *arg) {
+    RegionInfo *region = GetRegionInfo(class_id, node);
+    const uptr chunk_size = ClassIdToSize(class_id);
+    const uptr n_chunks = region->allocated_user / chunk_size;
+    const uptr n_free = region->num_freed_chunks;
+    const uptr node_beg = GetNodeRegionBegin(class_id, node);
+    // Few free chunks aren't worth building the bitmap for.
+    const uptr kMinFreeChunksToSkip = 64;
+    const uptr kBitsPerWord = sizeof(uptr) * 8;
+    const uptr n_words = RoundUpTo(n_chunks, kBitsPerWord) / kBitsPerWord;
+    const uptr bitmap_size =
+        RoundUpTo(n_words * sizeof(uptr), GetPageSizeCached());
+    if (n_free < kMinFreeChunksToSkip) {
+      for (uptr chunk = node_beg; chunk < node_beg + region->allocated_user;
+           chunk += chunk_size) {
+        // Too slow: CHECK_EQ((void *)chunk, GetBlockBegin((void *)chunk));
+        callback(chunk, arg);
+      }
+      return;
+    }
+    // Mark the chunks of the free array, then only visit the unmarked ones,
+    // skipping a word of free chunks at a time.
+    uptr *free_bits =
+        reinterpret_cast<uptr *>(MmapOrDie(bitmap_size, "ForEachChunk"));
+    uptr region_beg = GetRegionBeginBySizeClass(class_id);
+    CompactPtrT *free_array = GetFreeArray(region_beg, node);
+    for (uptr i = 0; i < n_free; i++) {
+      uptr chunk_idx =
+          (CompactPtrToPointer(region_beg, free_array[i]) - node_beg) /
+          chunk_size;
+      DCHECK_LT(chunk_idx, n_chunks);
+      free_bits[chunk_idx / kBitsPerWord] |= (uptr)1
+                                             << (chunk_idx % kBitsPerWord);
+    }
+    for (uptr word = 0; word < n_words; word++) {
+      uptr used = ~free_bits[word];
+      if (word == n_words - 1 && n_chunks % kBitsPerWord)
+        used &= ((uptr)1 << (n_chunks % kBitsPerWord)) - 1;
+      for (; used; used &= used - 1) {
+        uptr chunk_idx =
+            word * kBitsPerWord + LeastSignificantSetBitIndex(used);
+        callback(node_beg + chunk_idx * chunk_size, arg);
+      }
+    }
+    UnmapOrDie(free_bits, bitmap_size);
   }
 
   // Attempts to release some RAM back to OS. The region is expected to be
@@ -470,10 +827,10 @@ class SizeClassAllocator64 {
   // * Sort the chunks.
   // * Find ranges fully covered by free-d chunks
   // * Release them to OS with madvise.
-  void MaybeReleaseToOS(uptr class_id) {
-    RegionInfo *region = GetRegionInfo(class_id);
+  void MaybeReleaseToOS(uptr class_id, uptr node, bool force) {
+    RegionInfo *region = GetRegionInfo(class_id, node);
     const uptr chunk_size = ClassIdToSize(class_id);
-    const uptr page_size = GetPageSizeCached();
+    const uptr page_size = ReleaseGranularity(region);
 
     uptr n = region->num_freed_chunks;
     if (n * chunk_size < page_size)
@@ -488,12 +845,13 @@ class SizeClassAllocator64 {
       return;
 
     u64 now_ns = NanoTime();
-    if (region->rtoi.last_release_at_ns + interval_ms * 1000000ULL > now_ns)
+    if (!force &&
+        region->rtoi.last_release_at_ns + interval_ms * 1000000ULL > now_ns)
       return;  // Memory was returned recently.
     region->rtoi.last_release_at_ns = now_ns;
 
     uptr region_beg = GetRegionBeginBySizeClass(class_id);
-    CompactPtrT *free_array = GetFreeArray(region_beg);
+    CompactPtrT *free_array = GetFreeArray(region_beg, node);
     SortArray(free_array, n);
 
     const uptr scaled_chunk_size = chunk_size >> kCompactPtrScale;
@@ -507,7 +865,8 @@ class SizeClassAllocator64 {
       if (chunk - prev != scaled_chunk_size) {
         CHECK_GT(chunk - prev, scaled_chunk_size);
         if (prev + scaled_chunk_size - range_beg >= kScaledGranularity) {
-          MaybeReleaseChunkRange(region_beg, chunk_size, range_beg, prev);
+          MaybeReleaseChunkRange(region_beg, node, chunk_size, range_beg,
+                                 prev, page_size);
           region->rtoi.n_freed_at_last_release = region->n_freed;
           region->rtoi.num_releases++;
         }
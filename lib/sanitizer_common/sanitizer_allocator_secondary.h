@@ -17,6 +17,13 @@
 // This class can (de)allocate only large chunks of memory using mmap/unmap.
 // The main purpose of this allocator is to cover large and rare allocation
 // sizes not covered by more efficient allocators (e.g. SizeClassAllocator64).
+// The list of the live chunks is split into kNumShards shards, picked by a hash
+// of the mapping address, so that threads working on different chunks seldom
+// contend for a lock. Freed mappings may be kept in a bounded cache (see
+// SetCacheParams) and handed out again to allocations of about the same size,
+// which saves the mmap/munmap calls, and the page faults on the new mapping.
+// With SetBindToNumaNode, the new mappings are bound to the NUMA node of the
+// allocating thread, and cached mappings are only reused on their own node.
 template <class MapUnmapCallback = NoOpMapUnmapCallback>
 class LargeMmapAllocator {
  public:
@@ -30,6 +37,19 @@ class LargeMmapAllocator {
     InitLinkerInitialized(may_return_null);
   }
 
+  // Keeps up to (approximately) max_cached_bytes of the freed mappings for
+  // reuse. A mapping not reused within decay_ms is unmapped by a later
+  // deallocation of about the same size, or by ReleaseToOS; negative decay_ms
+  // means never. The cache is disabled when max_cached_bytes is 0 (default).
+  void SetCacheParams(uptr max_cached_bytes, s32 decay_ms) {
+    atomic_store(&cache_decay_ms_, decay_ms, memory_order_relaxed);
+    atomic_store(&max_cached_bytes_, max_cached_bytes, memory_order_relaxed);
+  }
+
+  void SetBindToNumaNode(bool bind_to_numa_node) {
+    atomic_store(&bind_to_numa_node_, bind_to_numa_node, memory_order_relaxed);
+  }
+
   void *Allocate(AllocatorStats *stat, uptr size, uptr alignment) {
     CHECK(IsPowerOfTwo(alignment));
     uptr map_size = RoundUpMapSize(size);
@@ -37,8 +57,16 @@ class LargeMmapAllocator {
       map_size += alignment;
     // Overflow.
     if (map_size < size) return ReturnNullOrDieOnBadRequest();
-    uptr map_beg = reinterpret_cast<uptr>(
-        MmapOrDie(map_size, "LargeMmapAllocator"));
+    uptr dirty_end = 0;
+    bool bind = atomic_load(&bind_to_numa_node_, memory_order_relaxed);
+    uptr numa_node = bind ? GetNumaNode() : 0;
+    uptr map_beg = TakeFromCache(&map_size, &dirty_end, numa_node);
+    if (!map_beg) {
+      map_beg = reinterpret_cast<uptr>(
+          MmapOrDie(map_size, "LargeMmapAllocator"));
+      if (bind)
+        BindMemoryToNumaNode(map_beg, map_size, numa_node);
+    }
     CHECK(IsAligned(map_beg, page_size_));
     MapUnmapCallback().OnMap(map_beg, map_size);
     uptr map_end = map_beg + map_size;
@@ -49,29 +77,74 @@ class LargeMmapAllocator {
     CHECK(IsAligned(res, page_size_));
     CHECK_GE(res + size, map_beg);
     CHECK_LE(res + size, map_end);
+    uptr user_end = res + RoundUpTo(size, page_size_);
+    CHECK_LE(user_end, map_end);
+    // The callers rely on the memory being zeroed as if freshly mapped. Only
+    // the part of a cached mapping handed out before may hold stale data.
+    if (dirty_end)
+      internal_bzero_aligned16(reinterpret_cast<void *>(map_beg),
+                               Min(dirty_end, user_end) - map_beg);
     Header *h = GetHeader(res);
     h->size = size;
     h->map_beg = map_beg;
     h->map_size = map_size;
+    h->dirty_end = Max(dirty_end, user_end);
+    h->numa_node = numa_node;
     uptr size_log = MostSignificantSetBitIndex(map_size);
-    CHECK_LT(size_log, ARRAY_SIZE(stats.by_size_log));
+    Shard *s = GetShard(map_beg);
+    CHECK_LT(size_log, ARRAY_SIZE(s->stats.by_size_log));
     {
-      SpinMutexLock l(&mutex_);
-      uptr idx = n_chunks_++;
-      chunks_sorted_ = false;
-      CHECK_LT(idx, kMaxNumChunks);
+      SpinMutexLock l(&s->mutex);
+      uptr idx = s->n_chunks++;
+      s->chunks_sorted = false;
+      CHECK_LT(idx, kMaxNumChunksPerShard);
       h->chunk_idx = idx;
-      chunks_[idx] = h;
-      stats.n_allocs++;
-      stats.currently_allocated += map_size;
-      stats.max_allocated = Max(stats.max_allocated, stats.currently_allocated);
-      stats.by_size_log[size_log]++;
+      s->chunks[idx] = h;
+      s->stats.n_allocs++;
+      s->stats.by_size_log[size_log]++;
       stat->Add(AllocatorStatAllocated, map_size);
       stat->Add(AllocatorStatMapped, map_size);
     }
+    uptr allocated =
+        atomic_fetch_add(&currently_allocated_, map_size, memory_order_relaxed)
+        + map_size;
+    uptr max_allocated = atomic_load(&max_allocated_, memory_order_relaxed);
+    while (allocated > max_allocated &&
+           !atomic_compare_exchange_weak(&max_allocated_, &max_allocated,
+                                         allocated, memory_order_relaxed)) {
+    }
     return reinterpret_cast<void*>(res);
   }
 
+  // Changes the size of the chunk p to new_size without moving it, if its
+  // mapping has room for it or can be grown in place. The grown part is
+  // reported to MapUnmapCallback. Returns false otherwise.
+  bool ResizeInPlace(AllocatorStats *stat, void *p, uptr new_size) {
+    Header *h = GetHeader(p);
+    uptr res = reinterpret_cast<uptr>(p);
+    uptr user_end = res + RoundUpTo(new_size, page_size_);
+    if (user_end <= res)
+      return false;
+    uptr map_end = h->map_beg + h->map_size;
+    uptr grow_size = user_end > map_end ? user_end - map_end : 0;
+    if (grow_size) {
+      if (!GrowMappingInPlace(h->map_beg, h->map_size, h->map_size + grow_size))
+        return false;
+      if (atomic_load(&bind_to_numa_node_, memory_order_relaxed))
+        BindMemoryToNumaNode(map_end, grow_size, h->numa_node);
+      MapUnmapCallback().OnMap(map_end, grow_size);
+      atomic_fetch_add(&currently_allocated_, grow_size, memory_order_relaxed);
+    }
+    Shard *s = GetShard(h->map_beg);
+    SpinMutexLock l(&s->mutex);
+    h->size = new_size;
+    h->map_size += grow_size;
+    h->dirty_end = Max(h->dirty_end, user_end);
+    stat->Add(AllocatorStatAllocated, grow_size);
+    stat->Add(AllocatorStatMapped, grow_size);
+    return true;
+  }
+
   bool MayReturnNull() const {
     return atomic_load(&may_return_null_, memory_order_acquire);
   }
@@ -92,35 +165,73 @@ class LargeMmapAllocator {
 
   void Deallocate(AllocatorStats *stat, void *p) {
     Header *h = GetHeader(p);
+    uptr map_beg = h->map_beg;
+    uptr map_size = h->map_size;
+    uptr dirty_end = h->dirty_end;
+    uptr numa_node = h->numa_node;
+    Shard *s = GetShard(map_beg);
     {
-      SpinMutexLock l(&mutex_);
+      SpinMutexLock l(&s->mutex);
       uptr idx = h->chunk_idx;
-      CHECK_EQ(chunks_[idx], h);
-      CHECK_LT(idx, n_chunks_);
-      chunks_[idx] = chunks_[n_chunks_ - 1];
-      chunks_[idx]->chunk_idx = idx;
-      n_chunks_--;
-      chunks_sorted_ = false;
-      stats.n_frees++;
-      stats.currently_allocated -= h->map_size;
-      stat->Sub(AllocatorStatAllocated, h->map_size);
-      stat->Sub(AllocatorStatMapped, h->map_size);
+      CHECK_EQ(s->chunks[idx], h);
+      CHECK_LT(idx, s->n_chunks);
+      s->chunks[idx] = s->chunks[s->n_chunks - 1];
+      s->chunks[idx]->chunk_idx = idx;
+      s->n_chunks--;
+      s->chunks_sorted = false;
+      s->stats.n_frees++;
+      stat->Sub(AllocatorStatAllocated, map_size);
+      stat->Sub(AllocatorStatMapped, map_size);
+    }
+    atomic_fetch_sub(&currently_allocated_, map_size, memory_order_relaxed);
+    // As far as the tool is concerned, a cached mapping is unmapped.
+    MapUnmapCallback().OnUnmap(map_beg, map_size);
+    if (!PutIntoCache(map_beg, map_size, dirty_end, numa_node))
+      UnmapOrDie(reinterpret_cast<void*>(map_beg), map_size);
+  }
+
+  // Unmaps the cached mappings which outlived the decay interval, or all of
+  // them if force is true.
+  void ReleaseToOS(bool force) {
+    if (!atomic_load(&cached_bytes_, memory_order_relaxed))
+      return;
+    u64 now = NanoTime();
+    for (uptr i = 0; i < kNumShards; i++) {
+      CachedMapping evicted[kCacheEntriesPerShard];
+      uptr n_evicted = 0;
+      {
+        CacheShard *c = &cache_[i];
+        SpinMutexLock l(&c->mutex);
+        for (uptr j = 0; j < c->n_entries;) {
+          if (force || IsExpired(c->entries[j], now))
+            evicted[n_evicted++] = RemoveFromCacheLocked(c, j);
+          else
+            j++;
+        }
+      }
+      UnmapCachedMappings(evicted, n_evicted);
     }
-    MapUnmapCallback().OnUnmap(h->map_beg, h->map_size);
-    UnmapOrDie(reinterpret_cast<void*>(h->map_beg), h->map_size);
   }
 
   uptr TotalMemoryUsed() {
-    SpinMutexLock l(&mutex_);
     uptr res = 0;
-    for (uptr i = 0; i < n_chunks_; i++) {
-      Header *h = chunks_[i];
-      CHECK_EQ(h->chunk_idx, i);
-      res += RoundUpMapSize(h->size);
+    for (uptr i = 0; i < kNumShards; i++) {
+      Shard *s = &shards_[i];
+      SpinMutexLock l(&s->mutex);
+      for (uptr j = 0; j < s->n_chunks; j++) {
+        Header *h = s->chunks[j];
+        CHECK_EQ(h->chunk_idx, j);
+        res += RoundUpMapSize(h->size);
+      }
     }
     return res;
   }
 
+  // Total size of the freed mappings kept in the cache.
+  uptr CachedMemory() {
+    return atomic_load(&cached_bytes_, memory_order_relaxed);
+  }
+
   bool PointerIsMine(const void *p) {
     return GetBlockBegin(p) != nullptr;
   }
@@ -141,78 +252,65 @@ class LargeMmapAllocator {
 
   void *GetBlockBegin(const void *ptr) {
     uptr p = reinterpret_cast<uptr>(ptr);
-    SpinMutexLock l(&mutex_);
-    uptr nearest_chunk = 0;
-    // Cache-friendly linear search.
-    for (uptr i = 0; i < n_chunks_; i++) {
-      uptr ch = reinterpret_cast<uptr>(chunks_[i]);
-      if (p < ch) continue;  // p is at left to this chunk, skip it.
-      if (p - ch < p - nearest_chunk)
-        nearest_chunk = ch;
+    // The chunks do not overlap, so at most one shard has a chunk holding p.
+    for (uptr i = 0; i < kNumShards; i++) {
+      Shard *s = &shards_[i];
+      SpinMutexLock l(&s->mutex);
+      uptr nearest_chunk = 0;
+      // Cache-friendly linear search.
+      for (uptr j = 0; j < s->n_chunks; j++) {
+        uptr ch = reinterpret_cast<uptr>(s->chunks[j]);
+        if (p < ch) continue;  // p is at left to this chunk, skip it.
+        if (p - ch < p - nearest_chunk)
+          nearest_chunk = ch;
+      }
+      if (!nearest_chunk)
+        continue;
+      Header *h = reinterpret_cast<Header *>(nearest_chunk);
+      CHECK_GE(nearest_chunk, h->map_beg);
+      CHECK_LT(nearest_chunk, h->map_beg + h->map_size);
+      CHECK_LE(nearest_chunk, p);
+      if (h->map_beg + h->map_size <= p)
+        continue;
+      return GetUser(h);
     }
-    if (!nearest_chunk)
-      return nullptr;
-    Header *h = reinterpret_cast<Header *>(nearest_chunk);
-    CHECK_GE(nearest_chunk, h->map_beg);
-    CHECK_LT(nearest_chunk, h->map_beg + h->map_size);
-    CHECK_LE(nearest_chunk, p);
-    if (h->map_beg + h->map_size <= p)
-      return nullptr;
-    return GetUser(h);
+    return nullptr;
   }
 
   void EnsureSortedChunks() {
-    if (chunks_sorted_) return;
-    SortArray(reinterpret_cast<uptr*>(chunks_), n_chunks_);
-    for (uptr i = 0; i < n_chunks_; i++)
-      chunks_[i]->chunk_idx = i;
-    chunks_sorted_ = true;
+    for (uptr i = 0; i < kNumShards; i++)
+      EnsureSortedChunks(&shards_[i]);
   }
 
   // This function does the same as GetBlockBegin, but is much faster.
   // Must be called with the allocator locked.
   void *GetBlockBeginFastLocked(void *ptr) {
-    mutex_.CheckLocked();
     uptr p = reinterpret_cast<uptr>(ptr);
-    uptr n = n_chunks_;
-    if (!n) return nullptr;
-    EnsureSortedChunks();
-    auto min_mmap_ = reinterpret_cast<uptr>(chunks_[0]);
-    auto max_mmap_ =
-        reinterpret_cast<uptr>(chunks_[n - 1]) + chunks_[n - 1]->map_size;
-    if (p < min_mmap_ || p >= max_mmap_)
-      return nullptr;
-    uptr beg = 0, end = n - 1;
-    // This loop is a log(n) lower_bound. It does not check for the exact match
-    // to avoid expensive cache-thrashing loads.
-    while (end - beg >= 2) {
-      uptr mid = (beg + end) / 2;  // Invariant: mid >= beg + 1
-      if (p < reinterpret_cast<uptr>(chunks_[mid]))
-        end = mid - 1;  // We are not interested in chunks_[mid].
-      else
-        beg = mid;  // chunks_[mid] may still be what we want.
-    }
-
-    if (beg < end) {
-      CHECK_EQ(beg + 1, end);
-      // There are 2 chunks left, choose one.
-      if (p >= reinterpret_cast<uptr>(chunks_[end]))
-        beg = end;
+    for (uptr i = 0; i < kNumShards; i++) {
+      shards_[i].mutex.CheckLocked();
+      if (Header *h = FindChunkFastLocked(&shards_[i], p))
+        return GetUser(h);
     }
-
-    Header *h = chunks_[beg];
-    if (h->map_beg + h->map_size <= p || p < h->map_beg)
-      return nullptr;
-    return GetUser(h);
+    return nullptr;
   }
 
   void PrintStats() {
+    uptr n_allocs = 0, n_frees = 0, by_size_log[64] = {};
+    for (uptr i = 0; i < kNumShards; i++) {
+      Stats *stats = &shards_[i].stats;
+      n_allocs += stats->n_allocs;
+      n_frees += stats->n_frees;
+      for (uptr j = 0; j < ARRAY_SIZE(by_size_log); j++)
+        by_size_log[j] += stats->by_size_log[j];
+    }
     Printf("Stats: LargeMmapAllocator: allocated %zd times, "
-           "remains %zd (%zd K) max %zd M; by size logs: ",
-           stats.n_allocs, stats.n_allocs - stats.n_frees,
-           stats.currently_allocated >> 10, stats.max_allocated >> 20);
-    for (uptr i = 0; i < ARRAY_SIZE(stats.by_size_log); i++) {
-      uptr c = stats.by_size_log[i];
+           "remains %zd (%zd K) max %zd M, cached %zd K; by size logs: ",
+           n_allocs, n_allocs - n_frees,
+           atomic_load(&currently_allocated_, memory_order_relaxed) >> 10,
+           atomic_load(&max_allocated_, memory_order_relaxed) >> 20,
+           CachedMemory() >> 10);
+    for (uptr i = 0; i < ARRAY_SIZE(by_size_log); i++) {
+      uptr c = by_size_log[i];
       if (!c) continue;
       Printf("%zd:%zd; ", i, c);
     }
@@ -222,33 +320,81 @@ class LargeMmapAllocator {
   // ForceLock() and ForceUnlock() are needed to implement Darwin malloc zone
   // introspection API.
   void ForceLock() {
-    mutex_.Lock();
+    for (uptr i = 0; i < kNumShards; i++)
+      cache_[i].mutex.Lock();
+    for (uptr i = 0; i < kNumShards; i++)
+      shards_[i].mutex.Lock();
   }
 
   void ForceUnlock() {
-    mutex_.Unlock();
+    for (int i = kNumShards - 1; i >= 0; i--)
+      shards_[i].mutex.Unlock();
+    for (int i = kNumShards - 1; i >= 0; i--)
+      cache_[i].mutex.Unlock();
   }
 
   // Iterate over all existing chunks.
   // The allocator must be locked when calling this function.
   void ForEachChunk(ForEachChunkCallback callback, void *arg) {
     EnsureSortedChunks();  // Avoid doing the sort while iterating.
-    for (uptr i = 0; i < n_chunks_; i++) {
-      auto t = chunks_[i];
-      callback(reinterpret_cast<uptr>(GetUser(chunks_[i])), arg);
-      // Consistency check: verify that the array did not change.
-      CHECK_EQ(chunks_[i], t);
-      CHECK_EQ(chunks_[i]->chunk_idx, i);
+    for (uptr i = 0; i < kNumShards; i++) {
+      Shard *s = &shards_[i];
+      for (uptr j = 0; j < s->n_chunks; j++) {
+        auto t = s->chunks[j];
+        callback(reinterpret_cast<uptr>(GetUser(s->chunks[j])), arg);
+        // Consistency check: verify that the array did not change.
+        CHECK_EQ(s->chunks[j], t);
+        CHECK_EQ(s->chunks[j]->chunk_idx, j);
+      }
     }
   }
 
  private:
-  static const int kMaxNumChunks = 1 << FIRST_32_SECOND_64(15, 18);
+  static const uptr kNumShardsLog = 2;
+  static const uptr kNumShards = 1 << kNumShardsLog;
+  static const uptr kMaxNumChunks = 1 << FIRST_32_SECOND_64(15, 18);
+  static const uptr kMaxNumChunksPerShard = kMaxNumChunks / kNumShards;
+  // A mapping is reused for a request at most 1/kCacheMaxWaste smaller.
+  static const uptr kCacheMaxWaste = 4;
+  static const uptr kCacheEntriesPerShard = 8;
+
   struct Header {
     uptr map_beg;
     uptr map_size;
     uptr size;
     uptr chunk_idx;
+    // Everything past dirty_end has not been touched since the mapping was
+    // created.
+    uptr dirty_end;
+    uptr numa_node;
+  };
+
+  struct Stats {
+    uptr n_allocs, n_frees, by_size_log[64];
+  };
+
+  struct Shard {
+    SpinMutex mutex;
+    uptr n_chunks;
+    bool chunks_sorted;
+    Stats stats;
+    Header *chunks[kMaxNumChunksPerShard];
+  };
+
+  struct CachedMapping {
+    uptr map_beg;
+    uptr map_size;
+    uptr dirty_end;
+    uptr numa_node;
+    u64 free_time;
+  };
+
+  // The mappings are cached by size, so that a lookup only needs to search
+  // one shard.
+  struct CacheShard {
+    SpinMutex mutex;
+    uptr n_entries;
+    CachedMapping entries[kCacheEntriesPerShard];
   };
 
   Header *GetHeader(uptr p) {
@@ -268,15 +414,159 @@ class LargeMmapAllocator {
     return RoundUpTo(size, page_size_) + page_size_;
   }
 
+  Shard *GetShard(uptr map_beg) {
+    // Mappings are often of equal sizes, so take the high bits of the product
+    // rather than the low bits of the page number.
+    u64 h = static_cast<u64>(map_beg / page_size_) * 0x9E3779B97F4A7C15ULL;
+    return &shards_[h >> (64 - kNumShardsLog)];
+  }
+
+  CacheShard *GetCacheShard(uptr map_size) {
+    return &cache_[MostSignificantSetBitIndex(map_size) % kNumShards];
+  }
+
+  void EnsureSortedChunks(Shard *s) {
+    if (s->chunks_sorted) return;
+    SortArray(reinterpret_cast<uptr*>(s->chunks), s->n_chunks);
+    for (uptr i = 0; i < s->n_chunks; i++)
+      s->chunks[i]->chunk_idx = i;
+    s->chunks_sorted = true;
+  }
+
+  Header *FindChunkFastLocked(Shard *s, uptr p) {
+    uptr n = s->n_chunks;
+    if (!n) return nullptr;
+    EnsureSortedChunks(s);
+    Header **chunks = s->chunks;
+    auto min_mmap_ = reinterpret_cast<uptr>(chunks[0]);
+    auto max_mmap_ =
+        reinterpret_cast<uptr>(chunks[n - 1]) + chunks[n - 1]->map_size;
+    if (p < min_mmap_ || p >= max_mmap_)
+      return nullptr;
+    uptr beg = 0, end = n - 1;
+    // This loop is a log(n) lower_bound. It does not check for the exact match
+    // to avoid expensive cache-thrashing loads.
+    while (end - beg >= 2) {
+      uptr mid = (beg + end) / 2;  // Invariant: mid >= beg + 1
+      if (p < reinterpret_cast<uptr>(chunks[mid]))
+        end = mid - 1;  // We are not interested in chunks[mid].
+      else
+        beg = mid;  // chunks[mid] may still be what we want.
+    }
+
+    if (beg < end) {
+      CHECK_EQ(beg + 1, end);
+      // There are 2 chunks left, choose one.
+      if (p >= reinterpret_cast<uptr>(chunks[end]))
+        beg = end;
+    }
+
+    Header *h = chunks[beg];
+    if (h->map_beg + h->map_size <= p || p < h->map_beg)
+      return nullptr;
+    return h;
+  }
+
+  bool IsExpired(const CachedMapping &m, u64 now) {
+    s32 decay_ms = atomic_load(&cache_decay_ms_, memory_order_relaxed);
+    return decay_ms >= 0 && m.free_time + decay_ms * 1000000ULL <= now;
+  }
+
+  CachedMapping RemoveFromCacheLocked(CacheShard *c, uptr idx) {
+    CachedMapping m = c->entries[idx];
+    c->entries[idx] = c->entries[--c->n_entries];
+    atomic_fetch_sub(&cached_bytes_, m.map_size, memory_order_relaxed);
+    return m;
+  }
+
+  void UnmapCachedMappings(CachedMapping *mappings, uptr n) {
+    for (uptr i = 0; i < n; i++)
+      UnmapOrDie(reinterpret_cast<void *>(mappings[i].map_beg),
+                 mappings[i].map_size);
+  }
+
+  // Returns the beginning of a cached mapping large enough for *map_size
+  // bytes on numa_node, or 0. Updates *map_size to the actual size of the
+  // mapping.
+  uptr TakeFromCache(uptr *map_size, uptr *dirty_end, uptr numa_node) {
+    if (!atomic_load(&cached_bytes_, memory_order_relaxed))
+      return 0;
+    CacheShard *c = GetCacheShard(*map_size);
+    SpinMutexLock l(&c->mutex);
+    uptr best = c->n_entries;
+    for (uptr i = 0; i < c->n_entries; i++) {
+      uptr size = c->entries[i].map_size;
+      if (size < *map_size || size - *map_size > *map_size / kCacheMaxWaste)
+        continue;
+      if (c->entries[i].numa_node != numa_node)
+        continue;
+      if (best == c->n_entries || size < c->entries[best].map_size)
+        best = i;
+    }
+    if (best == c->n_entries)
+      return 0;
+    CachedMapping m = RemoveFromCacheLocked(c, best);
+    *map_size = m.map_size;
+    *dirty_end = m.dirty_end;
+    return m.map_beg;
+  }
+
+  // Returns false if the mapping should be unmapped instead.
+  bool PutIntoCache(uptr map_beg, uptr map_size, uptr dirty_end,
+                    uptr numa_node) {
+    uptr max_cached_bytes =
+        atomic_load(&max_cached_bytes_, memory_order_relaxed);
+    if (map_size > max_cached_bytes)
+      return false;
+    u64 now = NanoTime();
+    CachedMapping evicted[kCacheEntriesPerShard];
+    uptr n_evicted = 0;
+    bool cached = false;
+    {
+      CacheShard *c = GetCacheShard(map_size);
+      SpinMutexLock l(&c->mutex);
+      for (uptr i = 0; i < c->n_entries;) {
+        if (IsExpired(c->entries[i], now))
+          evicted[n_evicted++] = RemoveFromCacheLocked(c, i);
+        else
+          i++;
+      }
+      // Make room by evicting the least recently freed mappings.
+      while (c->n_entries &&
+             (c->n_entries == kCacheEntriesPerShard ||
+              CachedMemory() + map_size > max_cached_bytes)) {
+        uptr oldest = 0;
+        for (uptr i = 1; i < c->n_entries; i++)
+          if (c->entries[i].free_time < c->entries[oldest].free_time)
+            oldest = i;
+        evicted[n_evicted++] = RemoveFromCacheLocked(c, oldest);
+      }
+      // The rest of the budget may be held by the other shards.
+      if (CachedMemory() + map_size <= max_cached_bytes) {
+        CachedMapping *m = &c->entries[c->n_entries++];
+        m->map_beg = map_beg;
+        m->map_size = map_size;
+        m->dirty_end = dirty_end;
+        m->numa_node = numa_node;
+        m->free_time = now;
+        atomic_fetch_add(&cached_bytes_, map_size, memory_order_relaxed);
+        cached = true;
+      }
+    }
+    UnmapCachedMappings(evicted, n_evicted);
+    return cached;
+  }
+
   uptr page_size_;
-  Header *chunks_[kMaxNumChunks];
-  uptr n_chunks_;
-  bool chunks_sorted_;
-  struct Stats {
-    uptr n_allocs, n_frees, currently_allocated, max_allocated, by_size_log[64];
-  } stats;
+  atomic_uintptr_t currently_allocated_;
+  atomic_uintptr_t max_allocated_;
+  atomic_uintptr_t max_cached_bytes_;
+  atomic_sint32_t cache_decay_ms_;
+  atomic_uintptr_t cached_bytes_;
   atomic_uint8_t may_return_null_;
-  SpinMutex mutex_;
+  atomic_uint8_t bind_to_numa_node_;
+  CacheShard cache_[kNumShards];
+  Shard shards_[kNumShards];
 };
 
 
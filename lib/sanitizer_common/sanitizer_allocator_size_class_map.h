@@ -215,3 +215,100 @@ class SizeClassMap {
 typedef SizeClassMap<3, 4, 8, 17, 128, 16> DefaultSizeClassMap;
 typedef SizeClassMap<3, 4, 8, 17, 64, 14> CompactSizeClassMap;
 typedef SizeClassMap<2, 5, 9, 16, 64, 14> VeryCompactSizeClassMap;
+
+// TableSizeClassMap is a SizeClassMap with arbitrary class sizes, typically
+// generated by scripts/gen_size_class_map.py from the allocation size profile
+// of a workload (see AllocatorSizeProfile) to fit its most frequent sizes.
+// SizeTable provides kNumClasses (including class 0), kMaxSize and
+// Size(class_id). The sizes must grow, be multiples of 16 and include all the
+// powers of two up to kMaxSize, and the smallest class fitting any multiple of
+// a power of two must be a multiple of it, so that RoundUpTo(size, alignment)
+// gets aligned chunks (see Validate()).
+// ClassID() is a binary search over the sizes, so it is slower than in
+// SizeClassMap, which is the price for the better fit.
+template <class SizeTable, uptr kMaxNumCachedHintT, uptr kMaxBytesCachedLog>
+class TableSizeClassMap {
+ public:
+  static const uptr kMaxNumCachedHint = kMaxNumCachedHintT;
+  COMPILER_CHECK((kMaxNumCachedHint & (kMaxNumCachedHint - 1)) == 0);
+
+  static const uptr kMaxSize = SizeTable::kMaxSize;
+  static const uptr kNumClasses = SizeTable::kNumClasses;
+  static const uptr kLargestClassID = kNumClasses - 2;
+  COMPILER_CHECK(kNumClasses >= 16 && kNumClasses <= 256);
+  static const uptr kNumClassesRounded =
+      kNumClasses <= 32  ? 32 :
+      kNumClasses <= 64  ? 64 :
+      kNumClasses <= 128 ? 128 : 256;
+
+  static uptr Size(uptr class_id) { return SizeTable::Size(class_id); }
+
+  static uptr ClassID(uptr size) {
+    if (size == 0 || size > kMaxSize) return 0;
+    // Find the smallest class with Size(class_id) >= size.
+    uptr c = 0;
+    for (uptr step = kNumClassesRounded / 2; step; step >>= 1)
+      if (c + step < kNumClasses && Size(c + step) < size)
+        c += step;
+    return c + 1;
+  }
+
+  static uptr MaxCachedHint(uptr class_id) {
+    if (class_id == 0) return 0;
+    uptr n = (1UL << kMaxBytesCachedLog) / Size(class_id);
+    return Max<uptr>(1, Min(kMaxNumCachedHint, n));
+  }
+
+  static void Print() {
+    uptr prev_s = 0;
+    uptr total_cached = 0;
+    for (uptr i = 0; i < kNumClasses; i++) {
+      uptr s = Size(i);
+      uptr d = s - prev_s;
+      uptr p = prev_s ? (d * 100 / prev_s) : 0;
+      uptr cached = MaxCachedHint(i) * s;
+      Printf("c%02zd => s: %zd diff: +%zd %02zd%% cached: %zd %zd; id %zd\n",
+             i, s, d, p, MaxCachedHint(i), cached, ClassID(s));
+      total_cached += cached;
+      prev_s = s;
+    }
+    Printf("Total cached: %zd\n", total_cached);
+  }
+
+  static void Validate() {
+    CHECK_EQ(Size(0), 0);
+    CHECK_EQ(Size(kNumClasses - 1), kMaxSize);
+    for (uptr c = 1; c < kNumClasses; c++) {
+      uptr s = Size(c);
+      CHECK_GT(s, Size(c - 1));
+      CHECK_EQ(s % 16, 0);
+      CHECK_EQ(ClassID(s), c);
+      CHECK_EQ(ClassID(Size(c - 1) + 1), c);
+      if (c != kNumClasses - 1)
+        CHECK_EQ(ClassID(s + 1), c + 1);
+      // Any multiple of a power of two in (Size(c - 1), s] is served by
+      // class c, which must keep the alignment.
+      for (uptr a = 16; a <= kMaxSize; a <<= 1)
+        if (RoundUpTo(Size(c - 1) + 1, a) <= s)
+          CHECK_EQ(s % a, 0);
+    }
+    for (uptr s = 16; s <= kMaxSize; s <<= 1)
+      CHECK_EQ(Size(ClassID(s)), s);
+    CHECK_EQ(ClassID(kMaxSize + 1), 0);
+  }
+};
+
+// The size class map of the tool allocators which do not need a compact one.
+// A build can set SANITIZER_TRAINED_SIZE_CLASS_MAP and provide a
+// sanitizer_trained_size_class_map.h defining TrainedSizeClassMap, usually
+// generated by scripts/gen_size_class_map.py (see the
+// COMPILER_RT_TRAINED_SIZE_CLASS_MAP CMake option).
+#ifndef SANITIZER_TRAINED_SIZE_CLASS_MAP
+# define SANITIZER_TRAINED_SIZE_CLASS_MAP 0
+#endif
+#if SANITIZER_TRAINED_SIZE_CLASS_MAP
+# include "sanitizer_trained_size_class_map.h"
+typedef TrainedSizeClassMap ToolSizeClassMap;
+#else
+typedef DefaultSizeClassMap ToolSizeClassMap;
+#endif
@@ -0,0 +1,61 @@
+//===-- sanitizer_allocator_size_profile.h ----------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Part of the Sanitizer Allocator.
+//
+//===----------------------------------------------------------------------===//
+#ifndef SANITIZER_ALLOCATOR_H
+#error This file must be included inside sanitizer_allocator.h
+#endif
+
+// Histogram of the sizes requested from a CombinedAllocator (after the tool
+// added its redzones or headers), recorded to train a TableSizeClassMap for a
+// workload with scripts/gen_size_class_map.py. Sizes are counted at
+// kGranularity up to kMaxSize, larger ones in a single bucket.
+// All the threads update the same counters, so recording slows down
+// allocation-heavy multithreaded programs; it is meant for training runs.
+class AllocatorSizeProfile {
+ public:
+  static const uptr kGranularityLog = 4;
+  static const uptr kGranularity = 1 << kGranularityLog;
+  static const uptr kMaxSize = 1 << 20;
+  static const uptr kNumBuckets = (kMaxSize >> kGranularityLog) + 2;
+
+  void Init() {
+    counts_ = reinterpret_cast<atomic_uint64_t *>(MmapOrDie(
+        kNumBuckets * sizeof(counts_[0]), "AllocatorSizeProfile"));
+  }
+
+  void Record(uptr size) {
+    uptr bucket = size > kMaxSize ? kNumBuckets - 1
+                                  : RoundUpTo(size, kGranularity) >>
+                                        kGranularityLog;
+    atomic_fetch_add(&counts_[bucket], 1, memory_order_relaxed);
+  }
+
+  u64 Count(uptr size) const {
+    return atomic_load(&counts_[RoundUpTo(size, kGranularity) >>
+                                kGranularityLog],
+                       memory_order_relaxed);
+  }
+
+  // Writes a "<size> <count>" line for every size requested at least once,
+  // sizes larger than kMaxSize are reported as "><kMaxSize> <count>".
+  void Write(fd_t fd) const;
+
+ private:
+  atomic_uint64_t *counts_;
+};
+
+// Returns the profile to record if the allocator_size_profile flag is set, or
+// null.
+AllocatorSizeProfile *GetAllocatorSizeProfile();
+// Writes the profile to <allocator_size_profile>.<pid> at exit if it was
+// requested. Must be called once atexit() can be used by the tool.
+void MaybeWriteAllocatorSizeProfileAtExit();
@@ -18,6 +18,11 @@
 enum AllocatorStat {
   AllocatorStatAllocated,
   AllocatorStatMapped,
+  // Number of transfers between the per-thread caches and the allocator,
+  // and of trims of idle size classes in the per-thread caches.
+  AllocatorStatCacheRefills,
+  AllocatorStatCacheDrains,
+  AllocatorStatCacheTrims,
   AllocatorStatCount
 };
 
@@ -56,6 +61,63 @@ class AllocatorStats {
   atomic_uintptr_t stats_[AllocatorStatCount];
 };
 
+// Per size class statistics, as reported by
+// __sanitizer_get_allocator_histogram(). Must be kept in sync with
+// struct __sanitizer_allocator_class_stats in allocator_interface.h.
+struct AllocatorClassStats {
+  uptr size;
+  uptr mapped_bytes;
+  uptr free_chunks;
+  u64 allocs;
+  u64 frees;
+  u64 cache_refills;
+  u64 cache_drains;
+  u64 refill_samples;
+  u64 refill_ns;
+};
+
+// Per NUMA node statistics of a NUMA-aware primary allocator.
+struct AllocatorNodeStats {
+  uptr mapped_bytes;
+  uptr free_chunks;
+  uptr allocs;
+  uptr frees;
+};
+
+// Counters of a size class shared by all the per-thread caches. The caches
+// count allocations and deallocations locally and publish them here every
+// kMaxUnpublished operations and when drained, so the counters lag behind by
+// less than kMaxUnpublished per cache. Refills are timed one in
+// kRefillSamplePeriod.
+struct AllocatorClassCounters {
+  static const uptr kMaxUnpublished = 256;
+  static const uptr kRefillSamplePeriod = 64;
+
+  atomic_uint64_t allocs;
+  atomic_uint64_t frees;
+  atomic_uint64_t cache_refills;
+  atomic_uint64_t cache_drains;
+  atomic_uint64_t refill_samples;
+  atomic_uint64_t refill_ns;
+
+  static void Add(atomic_uint64_t *counter, u64 v) {
+    if (v)
+      atomic_fetch_add(counter, v, memory_order_relaxed);
+  }
+
+  void Get(AllocatorClassStats *s) const {
+    s->allocs = atomic_load(&allocs, memory_order_relaxed);
+    s->frees = atomic_load(&frees, memory_order_relaxed);
+    s->cache_refills = atomic_load(&cache_refills, memory_order_relaxed);
+    s->cache_drains = atomic_load(&cache_drains, memory_order_relaxed);
+    s->refill_samples = atomic_load(&refill_samples, memory_order_relaxed);
+    s->refill_ns = atomic_load(&refill_ns, memory_order_relaxed);
+  }
+};
+
+// Prints one line per size class of stats, skipping the unused ones.
+void PrintAllocatorHistogram(const AllocatorClassStats *stats, uptr n);
+
 // Global stats, used for aggregation and querying.
 class AllocatorGlobalStats : public AllocatorStats {
  public:
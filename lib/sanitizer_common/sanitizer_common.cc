@@ -67,6 +67,68 @@ void ReportFile::ReopenIfNecessary() {
     Die();
   }
   fd_pid = pid;
+  written = 0;
+}
+
+bool ReportFile::BufferIfNecessary(const char *data, uptr length) {
+  mu->CheckLocked();
+  if (!buffering_depth || buffering_tid != GetTid())
+    return false;
+  if (buffer_len + length > buffer_size) {
+    uptr new_size = RoundUpToPowerOfTwo(
+        Max(buffer_len + length, GetPageSizeCached()));
+    char *new_buffer = (char *)MmapOrDie(new_size, "ReportFile buffer");
+    internal_memcpy(new_buffer, buffer, buffer_len);
+    if (buffer)
+      UnmapOrDie(buffer, buffer_size);
+    buffer = new_buffer;
+    buffer_size = new_size;
+  }
+  internal_memcpy(buffer + buffer_len, data, length);
+  buffer_len += length;
+  return true;
+}
+
+void ReportFile::Write(const char *buffer, uptr length) {
+  SpinMutexLock l(mu);
+  if (!BufferIfNecessary(buffer, length))
+    WriteLocked(buffer, length);
+}
+
+void ReportFile::StartBuffering() {
+  if (!common_flags()->buffer_reports)
+    return;
+  SpinMutexLock l(mu);
+  uptr tid = GetTid();
+  if (buffering_depth && buffering_tid != tid)
+    return;
+  buffering_tid = tid;
+  buffering_depth++;
+}
+
+void ReportFile::FinishBuffering() {
+  SpinMutexLock l(mu);
+  if (!buffering_depth || buffering_tid != GetTid() || --buffering_depth)
+    return;
+  uptr len = buffer_len;
+  buffer_len = 0;
+  if (len)
+    WriteLocked(buffer, len);
+}
+
+void ReportFile::FlushBuffer() {
+  // We may be dying with the mutex held by this thread, if so, the buffer
+  // is lost.
+  if (!mu->TryLock())
+    return;
+  if (buffering_depth && buffering_tid == GetTid()) {
+    buffering_depth = 0;
+    uptr len = buffer_len;
+    buffer_len = 0;
+    if (len)
+      WriteLocked(buffer, len);
+  }
+  mu->Unlock();
 }
 
 void ReportFile::SetReportPath(const char *path) {
@@ -269,6 +331,11 @@ void LoadedModule::set(const char *module_name, uptr base_address,
   instrumented_ = instrumented;
 }
 
+void LoadedModule::setBuildId(const u8 *build_id, uptr size) {
+  build_id_size_ = Min(size, kMaxModuleBuildIdSize);
+  internal_memcpy(build_id_, build_id, build_id_size_);
+}
+
 void LoadedModule::clear() {
   InternalFree(full_name_);
   base_address_ = 0;
@@ -276,6 +343,7 @@ void LoadedModule::clear() {
   full_name_ = nullptr;
   arch_ = kModuleArchUnknown;
   internal_memset(uuid_, 0, kModuleUUIDSize);
+  build_id_size_ = 0;
   instrumented_ = false;
   while (!ranges_.empty()) {
     AddressRange *r = ranges_.front();
@@ -483,6 +551,7 @@ using namespace __sanitizer;  // NOLINT
 extern "C" {
 void __sanitizer_set_report_path(const char *path) {
   report_file.SetReportPath(path);
+  report_file.max_size = common_flags()->log_max_size;
 }
 
 void __sanitizer_set_report_fd(void *fd) {
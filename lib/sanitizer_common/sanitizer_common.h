@@ -91,6 +91,9 @@ void *MmapNoReserveOrDie(uptr size, const char *mem_type);
 void *MmapFixedOrDie(uptr fixed_addr, uptr size);
 void *MmapFixedNoAccess(uptr fixed_addr, uptr size, const char *name = nullptr);
 void *MmapNoAccess(uptr size);
+// Grows the mapping [addr, addr + old_size) to new_size bytes without moving
+// it. Returns false if it can't, e.g. when the next pages are taken.
+bool GrowMappingInPlace(uptr addr, uptr old_size, uptr new_size);
 // Map aligned chunk of address space; size and alignment are powers of two.
 void *MmapAlignedOrDie(uptr size, uptr alignment, const char *mem_type);
 // Disallow access to a memory range.  Use MmapFixedNoAccess to allocate an
@@ -109,8 +112,21 @@ void ReleaseMemoryPagesToOS(uptr beg, uptr end);
 void IncreaseTotalMmap(uptr size);
 void DecreaseTotalMmap(uptr size);
 uptr GetRSS();
+// Returns the memory limit of the cgroup the process runs in, or 0 if there
+// is no limit or it can not be determined.
+uptr GetCgroupMemoryLimit();
 void NoHugePagesInRegion(uptr addr, uptr length);
+// Asks the OS to back the range with transparent huge pages where possible.
+void UseHugePagesInRegion(uptr addr, uptr length);
+// Backs the shadow of the currently loaded modules with transparent huge
+// pages, for the huge_pages_for_dense_shadow flag. mem_to_shadow maps an
+// application address to its shadow, and must be linear within a module.
+void UseHugePagesForModulesShadow(uptr (*mem_to_shadow)(uptr));
 void DontDumpShadowMemory(uptr addr, uptr length);
+// For the fast_fork flag: the range is not copied to the children created
+// with fork(), which get it zeroed instead. Must be called by the tool init,
+// before the program registers its own pthread_atfork handlers.
+void DontForkShadowMemory(uptr addr, uptr length);
 // Check if the built VMA size matches the runtime one.
 void CheckVMASize();
 void RunMallocHooks(const void *ptr, uptr size);
@@ -198,6 +214,14 @@ struct ReportFile {
   void Write(const char *buffer, uptr length);
   bool SupportsColors();
   void SetReportPath(const char *path);
+  // If buffer_reports is set, the output of the calling thread is kept from
+  // StartBuffering() until the matching FinishBuffering(), and then written
+  // at once, so that other threads can't interleave their output with it.
+  void StartBuffering();
+  void FinishBuffering();
+  // Writes the output buffered by the calling thread, e.g. before dying in
+  // the middle of a report.
+  void FlushBuffer();
 
   // Don't use fields directly. They are only declared public to allow
   // aggregate initialization.
@@ -214,9 +238,24 @@ struct ReportFile {
   // PID of the process that opened fd. If a fork() occurs,
   // the PID of child will be different from fd_pid.
   uptr fd_pid;
+  // If non-zero, full_path is moved to <full_path>.1 before a write makes it
+  // larger than this.
+  uptr max_size;
+  // Bytes written to full_path since it was opened.
+  uptr written;
+  // The thread which is buffering its output, and its nesting.
+  uptr buffering_tid;
+  uptr buffering_depth;
+  char *buffer;
+  uptr buffer_size;
+  uptr buffer_len;
 
  private:
   void ReopenIfNecessary();
+  // Not supported on Windows.
+  void RotateIfNecessary(uptr length);
+  bool BufferIfNecessary(const char *buffer, uptr length);
+  void WriteLocked(const char *buffer, uptr length);
 };
 extern ReportFile report_file;
 
@@ -334,6 +373,11 @@ uptr GetTlsSize();
 void SleepForSeconds(int seconds);
 void SleepForMillis(int millis);
 u64 NanoTime();
+// Returns the NUMA node of the CPU the calling thread runs on, 0 if unknown.
+uptr GetNumaNode();
+// Asks the OS to place the pages of the range on the given NUMA node when it
+// has memory there. Best effort, errors are ignored.
+void BindMemoryToNumaNode(uptr addr, uptr size, uptr node);
 int Atexit(void (*function)(void));
 void SortArray(uptr *array, uptr size);
 void SortArray(u32 *array, uptr size);
@@ -378,6 +422,20 @@ void SetCheckFailedCallback(CheckFailedCallbackType callback);
 // The callback should be registered once at the tool init time.
 void SetSoftRssLimitExceededCallback(void (*Callback)(bool exceeded));
 
+// Callback will be called periodically by the background thread if
+// allocator_release_to_os_in_background is set. It should release unused
+// allocator memory to the OS; force==true means that RSS is close to one of
+// the rss limits and memory should be released regardless of the release
+// interval.
+// The callback should be registered once at the tool init time.
+void SetAllocatorReleaseToOSCallback(void (*Callback)(bool force));
+
+// Callback will be called by the background thread with the current RSS
+// every time it samples it. Registering it before MaybeStartBackgroudThread()
+// makes the background thread start even if none of the flags asks for it.
+// The callback should be registered once at the tool init time.
+void SetRssSampledCallback(void (*Callback)(uptr rss));
+
 // Functions related to signal handling.
 typedef void (*SignalHandlerType)(int, void *, void *);
 bool IsHandledDeadlySignal(int signum);
@@ -699,6 +757,7 @@ inline const char *ModuleArchToString(ModuleArch arch) {
 }
 
 const uptr kModuleUUIDSize = 16;
+const uptr kMaxModuleBuildIdSize = 32;
 
 // Represents a binary loaded into virtual memory (e.g. this can be an
 // executable or a shared object).
@@ -709,6 +768,7 @@ class LoadedModule {
         base_address_(0),
         max_executable_address_(0),
         arch_(kModuleArchUnknown),
+        build_id_size_(0),
         instrumented_(false) {
     internal_memset(uuid_, 0, kModuleUUIDSize);
     ranges_.clear();
@@ -716,6 +776,7 @@ class LoadedModule {
   void set(const char *module_name, uptr base_address);
   void set(const char *module_name, uptr base_address, ModuleArch arch,
            u8 uuid[kModuleUUIDSize], bool instrumented);
+  void setBuildId(const u8 *build_id, uptr size);
   void clear();
   void addAddressRange(uptr beg, uptr end, bool executable);
   bool containsAddress(uptr address) const;
@@ -725,6 +786,9 @@ class LoadedModule {
   uptr max_executable_address() const { return max_executable_address_; }
   ModuleArch arch() const { return arch_; }
   const u8 *uuid() const { return uuid_; }
+  // The GNU build id of an ELF module, or nothing if it has none.
+  const u8 *build_id() const { return build_id_; }
+  uptr build_id_size() const { return build_id_size_; }
   bool instrumented() const { return instrumented_; }
 
   struct AddressRange {
@@ -745,17 +809,28 @@ class LoadedModule {
   uptr max_executable_address_;
   ModuleArch arch_;
   u8 uuid_[kModuleUUIDSize];
+  u8 build_id_[kMaxModuleBuildIdSize];
+  uptr build_id_size_;
   bool instrumented_;
   IntrusiveList<AddressRange> ranges_;
 };
 
+// Returns a number that changes whenever a module is loaded or unloaded, or 0
+// if the loader doesn't count those events.
+uptr GetModulesGeneration();
+
 // List of LoadedModules. OS-dependent implementation is responsible for
 // filling this information.
 class ListOfModules {
  public:
-  ListOfModules() : modules_(kInitialCapacity) {}
+  ListOfModules() : modules_(kInitialCapacity), generation_(0) {}
   ~ListOfModules() { clear(); }
   void init();
+  // False if no module has been loaded or unloaded since init(), which is
+  // much cheaper to find out than calling init() again.
+  bool isStale() const {
+    return !generation_ || generation_ != GetModulesGeneration();
+  }
   const LoadedModule *begin() const { return modules_.begin(); }
   LoadedModule *begin() { return modules_.begin(); }
   const LoadedModule *end() const { return modules_.end(); }
@@ -770,9 +845,12 @@ class ListOfModules {
   void clear() {
     for (auto &module : modules_) module.clear();
     modules_.clear();
+    generation_ = 0;
   }
 
   InternalMmapVector<LoadedModule> modules_;
+  // GetModulesGeneration() at the time of init().
+  uptr generation_;
   // We rarely have more than 16K loaded modules.
   static const uptr kInitialCapacity = 1 << 14;
 };
@@ -909,6 +987,13 @@ INLINE void AvoidCVE_2016_2143() {}
 struct StackDepotStats {
   uptr n_uniq_ids;
   uptr allocated;
+  // What the stacks of allocated would take without compression, or 0 for the
+  // depots which don't compress.
+  uptr uncompressed;
+  // Of the persistent allocator shared by all the depots: the bytes mapped,
+  // and the part of them lost to fragmentation.
+  uptr persistent_mapped;
+  uptr persistent_wasted;
 };
 
 // The default value for allocator_release_to_os_interval_ms common flag to
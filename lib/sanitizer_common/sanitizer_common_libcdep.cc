@@ -13,8 +13,10 @@
 
 #include "sanitizer_common.h"
 
+#include "sanitizer_allocator.h"
 #include "sanitizer_allocator_interface.h"
 #include "sanitizer_flags.h"
+#include "sanitizer_self_profile.h"
 #include "sanitizer_stackdepot.h"
 #include "sanitizer_stacktrace.h"
 #include "sanitizer_symbolizer.h"
@@ -23,6 +25,10 @@
 #include "sanitizer_posix.h"
 #endif
 
+#if SANITIZER_LINUX
+#include "sanitizer_linux.h"
+#endif
+
 namespace __sanitizer {
 
 bool ReportFile::SupportsColors() {
@@ -71,18 +77,82 @@ void SetSoftRssLimitExceededCallback(void (*Callback)(bool exceeded)) {
   SoftRssLimitExceededCallback = Callback;
 }
 
+static void (*AllocatorReleaseToOSCallback)(bool force);
+void SetAllocatorReleaseToOSCallback(void (*Callback)(bool force)) {
+  CHECK_EQ(AllocatorReleaseToOSCallback, nullptr);
+  AllocatorReleaseToOSCallback = Callback;
+}
+
+static void (*RssSampledCallback)(uptr rss);
+void SetRssSampledCallback(void (*Callback)(uptr rss)) {
+  CHECK_EQ(RssSampledCallback, nullptr);
+  RssSampledCallback = Callback;
+}
+
 #if SANITIZER_LINUX && !SANITIZER_GO
+// Appends a binary heap profile to <heap_profile_path>.<pid>, which stays open
+// for the lifetime of the process.
+static void WriteHeapProfileToPath() {
+  static fd_t fd = kInvalidFd;
+  static bool open_failed;
+  if (open_failed) return;
+  if (fd == kInvalidFd) {
+    InternalScopedString path(kMaxPathLength);
+    path.append("%s.%zd", common_flags()->heap_profile_path,
+                internal_getpid());
+    error_t err;
+    fd = OpenFile(path.data(), WrOnly, &err);
+    if (fd == kInvalidFd) {
+      Report("%s: failed to open %s for writing (reason: %d)\n",
+             SanitizerToolName, path.data(), err);
+      open_failed = true;
+      return;
+    }
+  }
+  if (!__sanitizer_write_memory_profile(
+          reinterpret_cast<void *>(fd),
+          Max(common_flags()->heap_profile_sample_rate, 1)))
+    Report("%s: failed to write the heap profile\n", SanitizerToolName);
+}
+
 void BackgroundThread(void *arg) {
   uptr hard_rss_limit_mb = common_flags()->hard_rss_limit_mb;
   uptr soft_rss_limit_mb = common_flags()->soft_rss_limit_mb;
   bool heap_profile = common_flags()->heap_profile;
+  bool release_to_os = common_flags()->allocator_release_to_os_in_background;
   uptr prev_reported_rss = 0;
   uptr prev_reported_stack_depot_size = 0;
   bool reached_soft_rss_limit = false;
   uptr rss_during_last_reported_profile = 0;
+  bool write_heap_profile = common_flags()->heap_profile_path[0] &&
+                            &__sanitizer_write_memory_profile;
+  u64 heap_profile_interval_ns =
+      (u64)Max(common_flags()->heap_profile_interval_ms, 0) * 1000000;
+  u64 last_heap_profile_ns = NanoTime();
+  fd_t pressure_fd = common_flags()->rss_limit_on_memory_events
+                         ? OpenMemoryPressureEvents()
+                         : kInvalidFd;
+  if (common_flags()->rss_limit_on_memory_events && pressure_fd == kInvalidFd)
+    VReport(1, "%s: memory pressure notifications are not available, "
+               "polling RSS\n", SanitizerToolName);
+  // The timeout of the wait for a memory pressure event.
+  int idle_timeout_ms = 1000;
+  if (write_heap_profile && common_flags()->heap_profile_interval_ms > 0)
+    idle_timeout_ms = Min(idle_timeout_ms,
+                          common_flags()->heap_profile_interval_ms);
+  bool near_rss_limit = false;
   while (true) {
-    SleepForMillis(100);
-    uptr current_rss_mb = GetRSS() >> 20;
+    if (pressure_fd == kInvalidFd || near_rss_limit)
+      SleepForMillis(100);
+    else
+      WaitForMemoryPressureEvent(pressure_fd, idle_timeout_ms);
+    uptr current_rss = GetRSS();
+    uptr current_rss_mb = current_rss >> 20;
+    near_rss_limit =
+        (hard_rss_limit_mb && current_rss_mb > hard_rss_limit_mb / 10 * 9) ||
+        (soft_rss_limit_mb && current_rss_mb > soft_rss_limit_mb / 10 * 9);
+    if (RssSampledCallback)
+      RssSampledCallback(current_rss);
     if (Verbosity()) {
       // If RSS has grown 10% since last time, print some information.
       if (prev_reported_rss * 11 / 10 < current_rss_mb) {
@@ -93,10 +163,13 @@ void BackgroundThread(void *arg) {
       StackDepotStats *stack_depot_stats = StackDepotGetStats();
       if (prev_reported_stack_depot_size * 11 / 10 <
           stack_depot_stats->allocated) {
-        Printf("%s: StackDepot: %zd ids; %zdM allocated\n",
+        Printf("%s: StackDepot: %zd ids; %zdM allocated (%zdM uncompressed);"
+               " %zdK wasted\n",
                SanitizerToolName,
                stack_depot_stats->n_uniq_ids,
-               stack_depot_stats->allocated >> 20);
+               stack_depot_stats->allocated >> 20,
+               stack_depot_stats->uncompressed >> 20,
+               stack_depot_stats->persistent_wasted >> 10);
         prev_reported_stack_depot_size = stack_depot_stats->allocated;
       }
     }
@@ -121,12 +194,21 @@ void BackgroundThread(void *arg) {
           SoftRssLimitExceededCallback(false);
       }
     }
+    if (release_to_os && AllocatorReleaseToOSCallback) {
+      // Don't wait for the release interval if we are about to hit a limit.
+      AllocatorReleaseToOSCallback(near_rss_limit);
+    }
     if (heap_profile &&
         current_rss_mb > rss_during_last_reported_profile * 1.1) {
       Printf("\n\nHEAP PROFILE at RSS %zdMb\n", current_rss_mb);
       __sanitizer_print_memory_profile(90, 20);
       rss_during_last_reported_profile = current_rss_mb;
     }
+    if (write_heap_profile &&
+        NanoTime() - last_heap_profile_ns >= heap_profile_interval_ns) {
+      WriteHeapProfileToPath();
+      last_heap_profile_ns = NanoTime();
+    }
   }
 }
 #endif
@@ -149,13 +231,70 @@ void WriteToSyslog(const char *msg) {
   } while (q);
 }
 
+static AllocatorSizeProfile allocator_size_profile;
+static StaticSpinMutex allocator_size_profile_mu;
+static bool allocator_size_profile_inited;
+
+static void WriteAllocatorSizeProfile() {
+  InternalScopedString path(kMaxPathLength);
+  path.append("%s.%zd", common_flags()->allocator_size_profile,
+              internal_getpid());
+  error_t err;
+  fd_t fd = OpenFile(path.data(), WrOnly, &err);
+  if (fd == kInvalidFd) {
+    Report("%s: failed to open %s for writing (reason: %d)\n",
+           SanitizerToolName, path.data(), err);
+    return;
+  }
+  allocator_size_profile.Write(fd);
+  CloseFile(fd);
+}
+
+AllocatorSizeProfile *GetAllocatorSizeProfile() {
+  if (!common_flags()->allocator_size_profile[0])
+    return nullptr;
+  SpinMutexLock l(&allocator_size_profile_mu);
+  if (!allocator_size_profile_inited) {
+    allocator_size_profile.Init();
+    allocator_size_profile_inited = true;
+  }
+  return &allocator_size_profile;
+}
+
+void MaybeWriteAllocatorSizeProfileAtExit() {
+  if (allocator_size_profile_inited)
+    Atexit(WriteAllocatorSizeProfile);
+}
+
+void MaybePrintSelfProfileAtExit() {
+  if (common_flags()->self_profile)
+    Atexit(__sanitizer_print_self_profile);
+}
+
+void UseHugePagesForModulesShadow(uptr (*mem_to_shadow)(uptr)) {
+  ListOfModules modules;
+  modules.init();
+  uptr page_size = GetPageSizeCached();
+  for (const LoadedModule &module : modules) {
+    for (const auto &range : module.ranges()) {
+      uptr beg = RoundDownTo(mem_to_shadow(range.beg), page_size);
+      uptr end = RoundUpTo(mem_to_shadow(range.end), page_size);
+      if (beg < end)
+        UseHugePagesInRegion(beg, end - beg);
+    }
+  }
+}
+
 void MaybeStartBackgroudThread() {
 #if SANITIZER_LINUX && \
     !SANITIZER_GO  // Need to implement/test on other platforms.
   // Start the background thread if one of the rss limits is given.
   if (!common_flags()->hard_rss_limit_mb &&
       !common_flags()->soft_rss_limit_mb &&
-      !common_flags()->heap_profile) return;
+      !common_flags()->heap_profile &&
+      !common_flags()->heap_profile_path[0] &&
+      !common_flags()->allocator_release_to_os_in_background &&
+      !RssSampledCallback) return;
   if (!&real_pthread_create) return;  // Can't spawn the thread anyway.
   internal_start_thread(BackgroundThread, nullptr);
 #endif
@@ -30,6 +30,7 @@ void SleepForSeconds(int seconds) { internal_sleep(seconds); }
 #endif // !SANITIZER_WINDOWS
 
 #if !SANITIZER_WINDOWS && !SANITIZER_MAC
+uptr GetModulesGeneration() { return 0; }
 void ListOfModules::init() {}
 #endif
 
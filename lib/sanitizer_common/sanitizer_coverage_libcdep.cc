@@ -341,11 +341,31 @@ void CoverageData::Extend(uptr npcs) {
   atomic_store(&pc_array_size, size, memory_order_release);
 }
 
+// Maps a counter value to the bit it sets in the bitset.
+static u8 counter_to_bit[256];
+
+static void InitCounterToBit() {
+  if (counter_to_bit[1]) return;
+  for (uptr x = 1; x < 256; x++) {
+    u8 bit;
+    /**/ if (x >= 128) bit = 128;
+    else if (x >= 32) bit = 64;
+    else if (x >= 16) bit = 32;
+    else if (x >= 8) bit = 16;
+    else if (x >= 4) bit = 8;
+    else if (x >= 3) bit = 4;
+    else if (x >= 2) bit = 2;
+    else bit = 1;
+    counter_to_bit[x] = bit;
+  }
+}
+
 void CoverageData::InitializeCounters(u8 *counters, uptr n) {
   if (!counters) return;
   CHECK_EQ(reinterpret_cast<uptr>(counters) % 16, 0);
   n = RoundUpTo(n, 16); // The compiler must ensure that counters is 16-aligned.
   SpinMutexLock l(&mu);
+  InitCounterToBit();
   counters_vec.push_back({counters, n});
   num_8bit_counters += n;
 }
@@ -437,7 +457,10 @@ void CoverageData::IndirCall(uptr caller, uptr callee, uptr callee_cache[],
   atomic_uintptr_t *atomic_callee_cache =
       reinterpret_cast<atomic_uintptr_t *>(callee_cache);
   uptr zero = 0;
-  if (atomic_compare_exchange_strong(&atomic_callee_cache[0], &zero, caller,
+  // Only try to claim the cache while it is empty, so that calls from a
+  // known caller don't take its cache line exclusively.
+  if (!atomic_load(&atomic_callee_cache[0], memory_order_relaxed) &&
+      atomic_compare_exchange_strong(&atomic_callee_cache[0], &zero, caller,
                                      memory_order_seq_cst)) {
     uptr idx = atomic_fetch_add(&cc_array_index, 1, memory_order_relaxed);
     CHECK_LT(idx * sizeof(uptr),
@@ -447,8 +470,9 @@ void CoverageData::IndirCall(uptr caller, uptr callee, uptr callee_cache[],
   }
   CHECK_EQ(atomic_load(&atomic_callee_cache[0], memory_order_relaxed), caller);
   for (uptr i = 2; i < cache_size; i++) {
-    uptr was = 0;
-    if (atomic_compare_exchange_strong(&atomic_callee_cache[i], &was, callee,
+    uptr was = atomic_load(&atomic_callee_cache[i], memory_order_relaxed);
+    if (!was &&
+        atomic_compare_exchange_strong(&atomic_callee_cache[i], &was, callee,
                                        memory_order_seq_cst)) {
       atomic_fetch_add(&caller_callee_counter, 1, memory_order_relaxed);
       return;
@@ -462,53 +486,52 @@ uptr CoverageData::GetNumberOf8bitCounters() {
   return num_8bit_counters;
 }
 
+// Returns the number of non-zero bytes in x, where each byte has at most one
+// bit set.
+static uptr CountNonZeroBytes(u64 x) {
+  x |= x >> 4;
+  x |= x >> 2;
+  x |= x >> 1;
+  x &= 0x0101010101010101ULL;
+  return (x * 0x0101010101010101ULL) >> 56;
+}
+
 // Map every 8bit counter to a 8-bit bitset and clear the counter.
 uptr CoverageData::Update8bitCounterBitsetAndClearCounters(u8 *bitset) {
   uptr num_new_bits = 0;
   uptr cur = 0;
-  // For better speed we map 8 counters to 8 bytes of bitset at once.
-  static const uptr kBatchSize = 8;
-  CHECK_EQ(reinterpret_cast<uptr>(bitset) % kBatchSize, 0);
+  // For better speed we map 16 counters to 16 bytes of bitset at once,
+  // skipping them if they are all zero, and compute the 8 new bits of each
+  // word without branches.
+  static const uptr kBatchSize = 16;
+  CHECK_EQ(reinterpret_cast<uptr>(bitset) % 8, 0);
   for (uptr i = 0, len = counters_vec.size(); i < len; i++) {
     u8 *c = counters_vec[i].counters;
     uptr n = counters_vec[i].n;
-    CHECK_EQ(n % 16, 0);
-    CHECK_EQ(cur % kBatchSize, 0);
+    CHECK_EQ(n % kBatchSize, 0);
+    CHECK_EQ(cur % 8, 0);
     CHECK_EQ(reinterpret_cast<uptr>(c) % kBatchSize, 0);
     if (!bitset) {
       internal_bzero_aligned16(c, n);
       cur += n;
       continue;
     }
+    CHECK_LE(cur + n, num_8bit_counters);
     for (uptr j = 0; j < n; j += kBatchSize, cur += kBatchSize) {
-      CHECK_LT(cur, num_8bit_counters);
       u64 *pc64 = reinterpret_cast<u64*>(c + j);
+      if (!(pc64[0] | pc64[1])) continue;
       u64 *pb64 = reinterpret_cast<u64*>(bitset + cur);
-      u64 c64 = *pc64;
-      u64 old_bits_64 = *pb64;
-      u64 new_bits_64 = old_bits_64;
-      if (c64) {
-        *pc64 = 0;
-        for (uptr k = 0; k < kBatchSize; k++) {
-          u64 x = (c64 >> (8 * k)) & 0xff;
-          if (x) {
-            u64 bit = 0;
-            /**/ if (x >= 128) bit = 128;
-            else if (x >= 32) bit = 64;
-            else if (x >= 16) bit = 32;
-            else if (x >= 8) bit = 16;
-            else if (x >= 4) bit = 8;
-            else if (x >= 3) bit = 4;
-            else if (x >= 2) bit = 2;
-            else if (x >= 1) bit = 1;
-            u64 mask = bit << (8 * k);
-            if (!(new_bits_64 & mask)) {
-              num_new_bits++;
-              new_bits_64 |= mask;
-            }
-          }
-        }
-        *pb64 = new_bits_64;
+      for (uptr w = 0; w < 2; w++) {
+        u64 c64 = pc64[w];
+        if (!c64) continue;
+        pc64[w] = 0;
+        u64 bits_64 = 0;
+        for (uptr k = 0; k < 8; k++)
+          bits_64 |= static_cast<u64>(counter_to_bit[(c64 >> (8 * k)) & 0xff])
+                     << (8 * k);
+        u64 old_bits_64 = pb64[w];
+        num_new_bits += CountNonZeroBytes(bits_64 & ~old_bits_64);
+        pb64[w] = old_bits_64 | bits_64;
       }
     }
   }
@@ -932,6 +955,47 @@ void CoverageUpdateMapping() {
     CovUpdateMapping(coverage_dir);
 }
 
+// The most recent operands of the comparisons instrumented with
+// -fsanitize-coverage=trace-cmp, one entry per hash of the comparison's PC.
+// Entries are updated with plain stores, so a reader racing with the
+// instrumented code may see a torn entry; they are only hints.
+// Must match __sanitizer_cmp_feedback in coverage_interface.h.
+struct CmpFeedbackEntry {
+  uptr pc;
+  u64 arg1;
+  u64 arg2;
+  u64 size;
+};
+
+static const uptr kCmpFeedbackSize = 1 << 12;
+static CmpFeedbackEntry cmp_feedback[kCmpFeedbackSize];
+
+static ALWAYS_INLINE void RecordCmp(uptr pc, u64 arg1, u64 arg2, u64 size) {
+  CmpFeedbackEntry *e =
+      &cmp_feedback[(pc ^ (pc >> 12)) & (kCmpFeedbackSize - 1)];
+  e->pc = pc;
+  e->arg1 = arg1;
+  e->arg2 = arg2;
+  e->size = size;
+}
+
+// Records the switch value against the case value closest to it.
+static void RecordSwitch(uptr pc, u64 val, u64 *cases) {
+  u64 n = cases[0];
+  if (!n) return;
+  u64 closest = cases[2];
+  u64 closest_distance = val > closest ? val - closest : closest - val;
+  for (u64 i = 1; i < n; i++) {
+    u64 c = cases[2 + i];
+    u64 distance = val > c ? val - c : c - val;
+    if (distance < closest_distance) {
+      closest = c;
+      closest_distance = distance;
+    }
+  }
+  RecordCmp(pc, val, closest, cases[1] / 8);
+}
+
 } // namespace __sanitizer
 
 extern "C" {
@@ -1021,13 +1085,41 @@ uptr __sanitizer_update_counter_bitset_and_clear_counters(u8 *bitset) {
   return coverage_data.Update8bitCounterBitsetAndClearCounters(bitset);
 }
 
+SANITIZER_INTERFACE_ATTRIBUTE
+uptr __sanitizer_get_cmp_feedback(const __sanitizer_cmp_feedback **entries) {
+  *entries = reinterpret_cast<const __sanitizer_cmp_feedback *>(cmp_feedback);
+  return kCmpFeedbackSize;
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void __sanitizer_reset_cmp_feedback() {
+  internal_memset(cmp_feedback, 0, sizeof(cmp_feedback));
+}
+
 // Default empty implementations (weak). Users should redefine them.
 SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp1, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp2, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp4, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp8, void) {}
-SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_switch, void) {}
+// The default comparison hooks fill the table read by
+// __sanitizer_get_cmp_feedback.
+SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp1, u8 arg1,
+                             u8 arg2) {
+  RecordCmp(GET_CALLER_PC(), arg1, arg2, 1);
+}
+SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp2, u16 arg1,
+                             u16 arg2) {
+  RecordCmp(GET_CALLER_PC(), arg1, arg2, 2);
+}
+SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp4, u32 arg1,
+                             u32 arg2) {
+  RecordCmp(GET_CALLER_PC(), arg1, arg2, 4);
+}
+SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_cmp8, u64 arg1,
+                             u64 arg2) {
+  RecordCmp(GET_CALLER_PC(), arg1, arg2, 8);
+}
+SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_switch, u64 val,
+                             u64 *cases) {
+  RecordSwitch(GET_CALLER_PC(), val, cases);
+}
 SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_div4, void) {}
 SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_div8, void) {}
 SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_gep, void) {}
@@ -104,6 +104,124 @@ static void SanitizerDumpCoverage(const uptr* unsorted_pcs, uptr len) {
   }
 }
 
+// Buffers the offsets of one module's PCs on their way to its .sancov file.
+class ModuleCoverageWriter {
+ public:
+  ModuleCoverageWriter(char* file_path, uptr* buffer, uptr buffer_len)
+      : file_path_(file_path),
+        buffer_(buffer),
+        buffer_len_(buffer_len),
+        len_(0),
+        num_pcs_(0),
+        module_base_(0),
+        fd_(kInvalidFd) {}
+
+  ~ModuleCoverageWriter() { Close(); }
+
+  uptr module_base() const { return module_base_; }
+
+  void Open(const char* module_name, uptr module_base) {
+    Close();
+    GetCoverageFilename(file_path_, StripModuleName(module_name), "sancov");
+    fd_ = OpenFile(file_path_);
+    module_base_ = module_base;
+    WriteToFile(fd_, &Magic, sizeof(Magic));
+  }
+
+  void Add(uptr pc) {
+    if (len_ == buffer_len_) Flush();
+    buffer_[len_++] = pc - module_base_;
+    num_pcs_++;
+  }
+
+  void Close() {
+    if (fd_ == kInvalidFd) return;
+    Flush();
+    CloseFile(fd_);
+    fd_ = kInvalidFd;
+    Printf("SanitizerCoverage: %s %zd PCs written\n", file_path_, num_pcs_);
+    num_pcs_ = 0;
+  }
+
+ private:
+  void Flush() {
+    WriteToFile(fd_, buffer_, len_ * sizeof(*buffer_));
+    len_ = 0;
+  }
+
+  char* file_path_;
+  uptr* buffer_;
+  uptr buffer_len_;
+  uptr len_;
+  uptr num_pcs_;
+  uptr module_base_;
+  fd_t fd_;
+};
+
+// Dumps the PCs recorded for trace-pc guards. The guards of a module get
+// consecutive indices, starting at one of module_starts, so the PCs are
+// written module by module in guard order, without sorting or copying them.
+static void SanitizerDumpGuardCoverage(const uptr* pcs, uptr len,
+                                       const u32* module_starts,
+                                       uptr num_modules) {
+  static const uptr kBufferLen = 4096;
+  char* file_path = static_cast<char*>(InternalAlloc(kMaxPathLength));
+  char* module_name = static_cast<char*>(InternalAlloc(kMaxPathLength));
+  uptr* buffer = static_cast<uptr*>(InternalAlloc(kBufferLen * sizeof(uptr)));
+
+  {
+    ModuleCoverageWriter writer(file_path, buffer, kBufferLen);
+    bool module_found = false;
+    for (uptr m = 0; m < num_modules; ++m) {
+      uptr begin = module_starts[m];
+      uptr end = m + 1 < num_modules ? module_starts[m + 1] : len;
+      while (begin < end && !pcs[begin]) ++begin;
+      if (begin == end) continue;
+
+      uptr offset;
+      if (!__sanitizer_get_module_and_offset_for_pc(
+              pcs[begin], module_name, kMaxPathLength, &offset)) {
+        Printf("ERROR: bad pc %x\n", pcs[begin]);
+        continue;
+      }
+      // Guards registered separately by the same module share its file.
+      uptr module_base = pcs[begin] - offset;
+      if (module_base != writer.module_base() || !module_found) {
+        writer.Open(module_name, module_base);
+        module_found = true;
+      }
+      for (uptr i = begin; i < end; ++i)
+        if (pcs[i]) writer.Add(pcs[i]);
+    }
+  }
+
+  InternalFree(file_path);
+  InternalFree(module_name);
+  InternalFree(buffer);
+
+  if (sancov_flags()->symbolize) {
+    Printf("TODO(aizatsky): call sancov to symbolize\n");
+  }
+}
+
+// Header of the live coverage file. It is followed by a byte per guard:
+// kLiveNotCovered, kLiveCovered once the guard was hit, or kLiveNew if it
+// was first hit since the last reset. Another process may map the file, read
+// num_guards bytes and reset them itself.
+struct LiveCoverageHeader {
+  u64 magic;
+  // Number of guards, i.e. of valid bytes after the header.
+  atomic_uint64_t num_guards;
+  // Number of guards first hit since the last reset.
+  atomic_uint64_t num_new;
+  u64 reserved[5];
+};
+
+static const u64 kLiveCoverageMagic = 0xC0BFFFFFFFFF11FEULL;
+static const u8 kLiveNotCovered = 0;
+static const u8 kLiveCovered = 1;
+static const u8 kLiveNew = 2;
+
 // Collects trace-pc guard coverage.
 // This class relies on zero-initialization.
 class TracePcGuardController {
@@ -115,6 +233,8 @@ class TracePcGuardController {
     InitializeSancovFlags();
 
     pc_vector.Initialize(0);
+    module_starts.Initialize(0);
+    InitializeLiveCoverage();
   }
 
   void InitTracePcGuard(u32* start, u32* end) {
@@ -123,26 +243,119 @@ class TracePcGuardController {
     CHECK_NE(start, end);
 
     u32 i = pc_vector.size();
+    module_starts.push_back(i);
     for (u32* p = start; p < end; p++) *p = ++i;
     pc_vector.resize(i);
+    ExtendLiveCoverage(i);
   }
 
   void TracePcGuard(u32* guard, uptr pc) {
     atomic_uint32_t* guard_ptr = reinterpret_cast<atomic_uint32_t*>(guard);
+    // Hot guards are already zero; reading them keeps their cache line
+    // shared between the threads that hit them.
+    if (!atomic_load(guard_ptr, memory_order_relaxed)) return;
     u32 idx = atomic_exchange(guard_ptr, 0, memory_order_relaxed);
     if (!idx) return;
     // we start indices from 1.
     pc_vector[idx - 1] = pc;
+    if (live_header) {
+      live_map()[idx - 1] = kLiveNew;
+      atomic_fetch_add(&live_header->num_new, 1, memory_order_relaxed);
+    }
   }
 
   void Dump() {
     if (!initialized || !common_flags()->coverage) return;
-    __sanitizer_dump_coverage(pc_vector.data(), pc_vector.size());
+    SanitizerDumpGuardCoverage(pc_vector.data(), pc_vector.size(),
+                               module_starts.data(), module_starts.size());
+  }
+
+  uptr GetLiveCoverage(const u8** map) {
+    if (!live_header) {
+      *map = nullptr;
+      return 0;
+    }
+    *map = live_map();
+    return atomic_load(&live_header->num_guards, memory_order_acquire);
+  }
+
+  // Turns the guards first hit since the previous reset into covered ones
+  // and returns their number. Guards hit concurrently may be counted in
+  // either round.
+  uptr ResetLiveCoverage() {
+    if (!live_header) return 0;
+    uptr num_new = atomic_exchange(&live_header->num_new, 0,
+                                   memory_order_relaxed);
+    if (!num_new) return 0;
+    u8* map = live_map();
+    uptr n = atomic_load(&live_header->num_guards, memory_order_acquire);
+    for (uptr i = 0; i < n; i++)
+      if (map[i] == kLiveNew) map[i] = kLiveCovered;
+    return num_new;
   }
 
  private:
+  // The live coverage file is mapped into a range reserved up front, so that
+  // it never moves while guards are being hit.
+  static const uptr kLiveCoverageMaxSize = FIRST_32_SECOND_64(1 << 24, 1 << 27);
+  // The amount the file mapping is grown by.
+  static const uptr kLiveCoverageMmapSize = 64 * 1024;
+
+  u8* live_map() { return reinterpret_cast<u8*>(live_header + 1); }
+
+  void InitializeLiveCoverage() {
+    const char* path = sancov_flags()->live_coverage_file;
+    if (!path || !path[0]) return;
+    live_fd = OpenFile(path, RdWr);
+    if (live_fd == kInvalidFd) {
+      Report("SanitizerCoverage: failed to open %s for reading/writing\n",
+             path);
+      Die();
+    }
+    // Drop whatever a previous run left.
+    uptr res = internal_ftruncate(live_fd, 0);
+    int err;
+    if (internal_iserror(res, &err)) {
+      Report("SanitizerCoverage: failed to truncate %s: %d\n", path, err);
+      Die();
+    }
+    live_header = reinterpret_cast<LiveCoverageHeader*>(
+        MmapNoReserveOrDie(kLiveCoverageMaxSize, "LiveCoverage"));
+    ExtendLiveCoverage(0);
+    live_header->magic = kLiveCoverageMagic;
+  }
+
+  // Extend the live coverage file to hold num_guards bytes.
+  void ExtendLiveCoverage(uptr num_guards) {
+    if (!live_header) return;
+    uptr size = sizeof(LiveCoverageHeader) + num_guards;
+    if (size > live_mapped_size) {
+      uptr new_mapped_size = RoundUpTo(size, kLiveCoverageMmapSize);
+      CHECK_LE(new_mapped_size, kLiveCoverageMaxSize);
+      uptr res = internal_ftruncate(live_fd, new_mapped_size);
+      int err;
+      if (internal_iserror(res, &err)) {
+        Printf("failed to extend live coverage file: %d\n", err);
+        Die();
+      }
+      uptr next_map_base = reinterpret_cast<uptr>(live_header) +
+                           live_mapped_size;
+      void* p = MapWritableFileToMemory(reinterpret_cast<void*>(next_map_base),
+                                        new_mapped_size - live_mapped_size,
+                                        live_fd, live_mapped_size);
+      CHECK_EQ(reinterpret_cast<uptr>(p), next_map_base);
+      live_mapped_size = new_mapped_size;
+    }
+    atomic_store(&live_header->num_guards, num_guards, memory_order_release);
+  }
+
   bool initialized;
   InternalMmapVectorNoCtor<uptr> pc_vector;
+  // Index of the first guard of each InitTracePcGuard call.
+  InternalMmapVectorNoCtor<u32> module_starts;
+  LiveCoverageHeader* live_header;
+  uptr live_mapped_size;
+  fd_t live_fd;
 };
 
 static TracePcGuardController pc_guard_controller;
@@ -170,4 +383,13 @@ SANITIZER_INTERFACE_WEAK_DEF(void, __sanitizer_cov_trace_pc_guard_init,
 SANITIZER_INTERFACE_ATTRIBUTE void __sanitizer_dump_trace_pc_guard_coverage() {
   __sancov::pc_guard_controller.Dump();
 }
+
+SANITIZER_INTERFACE_ATTRIBUTE uptr
+__sanitizer_get_live_coverage(const u8** map) {
+  return __sancov::pc_guard_controller.GetLiveCoverage(map);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE uptr __sanitizer_reset_live_coverage() {
+  return __sancov::pc_guard_controller.ResetLiveCoverage();
+}
 }  // extern "C"
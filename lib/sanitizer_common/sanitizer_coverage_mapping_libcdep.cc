@@ -17,8 +17,15 @@
 // <pointer size in bits>  // 1 line, 32 or 64
 // <mapping start> <mapping end> <base address> <dso name> // repeated
 // ...
-// Mapping lines are NOT sorted. This file is updated every time memory layout
-// is changed (i.e. in dlopen() and dlclose() interceptors).
+// Mapping lines are NOT sorted. This file is written at exit from the changes
+// recorded in $pid.sancov.map.log.
+//
+// $pid.sancov.map.log is an append-only binary journal of the memory layout
+// changes (i.e. in dlopen() and dlclose() interceptors). It starts with the
+// pointer size in bits as a u64, then every record is a MappingRecord followed by name_size bytes of the dso name. Only the modules
+// loaded or unloaded since the previous update are appended, so processes
+// that load many modules don't rewrite the whole map on every dlopen(). If the
+// process doesn't reach exit, sancov.py rawunpack replays the journal instead.
 //
 // $pid.sancov.raw is a binary dump of PC values, sizeof(uptr) each. Again, not
 // sorted. This file is extended by 64Kb at a time and mapped into memory. It
@@ -32,6 +39,9 @@
 #include "sanitizer_allocator_internal.h"
 #include "sanitizer_libc.h"
 #include "sanitizer_procmaps.h"
+#if SANITIZER_POSIX
+#include "sanitizer_posix.h"
+#endif
 
 namespace __sanitizer {
 
@@ -61,41 +71,73 @@ struct CachedMapping {
 static CachedMapping cached_mapping;
 static StaticSpinMutex mapping_mu;
 
-void CovUpdateMapping(const char *coverage_dir, uptr caller_pc) {
-  if (!common_flags()->coverage_direct) return;
+enum MappingRecordKind {
+  kMappingLoaded = 1,
+  kMappingUnloaded = 2
+};
 
-  SpinMutexLock l(&mapping_mu);
+// Must match the journal parser in sancov.py.
+struct MappingRecord {
+  u64 start;
+  u64 end;
+  u64 base;
+  u32 kind;
+  u32 name_size;
+};
 
-  if (!cached_mapping.NeedsUpdate(caller_pc))
-    return;
+struct MappedRange {
+  uptr start, end, base;
+  const char *name;
+};
 
-  InternalScopedString text(kMaxTextSize);
+static bool CompareMappedRanges(const MappedRange &a, const MappedRange &b) {
+  return a.start < b.start;
+}
 
-  {
-    text.append("%d\n", sizeof(uptr) * 8);
-    ListOfModules modules;
-    modules.init();
-    for (const LoadedModule &module : modules) {
-      const char *module_name = StripModuleName(module.full_name());
-      uptr base = module.base_address();
-      for (const auto &range : module.ranges()) {
-        if (range.executable) {
-          uptr start = range.beg;
-          uptr end = range.end;
-          text.append("%zx %zx %zx %s\n", start, end, base, module_name);
-          if (caller_pc && caller_pc >= start && caller_pc < end)
-            cached_mapping.SetModuleRange(start, end);
-        }
-      }
-    }
+static bool SameMappedRange(const MappedRange &a, const MappedRange &b) {
+  return a.start == b.start && a.end == b.end && a.base == b.base &&
+         !internal_strcmp(a.name, b.name);
+}
+
+// The executable ranges recorded in the journal, sorted by start. Guarded by
+// mapping_mu, as are the variables below.
+static InternalMmapVectorNoCtor<MappedRange> mapped_ranges;
+static fd_t journal_fd = kInvalidFd;
+static int journal_pid;
+static const char *journal_dir;
+
+static void GetMappingPath(InternalScopedString *path, const char *dir,
+                           int pid, const char *suffix) {
+  uptr res = internal_snprintf((char *)path->data(), path->size(),
+                               "%s/%zd.sancov.map%s", dir, pid, suffix);
+  CHECK_LE(res, path->size());
+}
+
+static void AppendRecord(InternalMmapVector<char> *buf, u32 kind,
+                         const MappedRange &range) {
+  MappingRecord record;
+  record.start = range.start;
+  record.end = range.end;
+  record.base = range.base;
+  record.kind = kind;
+  record.name_size = internal_strlen(range.name);
+  const char *bytes = reinterpret_cast<const char *>(&record);
+  for (uptr i = 0; i < sizeof(record); i++) buf->push_back(bytes[i]);
+  for (uptr i = 0; i < record.name_size; i++) buf->push_back(range.name[i]);
+}
+
+static void WriteMap(const char *dir, int pid) {
+  InternalScopedString text(kMaxTextSize);
+  text.append("%d\n", sizeof(uptr) * 8);
+  for (uptr i = 0; i < mapped_ranges.size(); i++) {
+    const MappedRange &range = mapped_ranges[i];
+    text.append("%zx %zx %zx %s\n", range.start, range.end, range.base,
+                range.name);
   }
 
   error_t err;
-  InternalScopedString tmp_path(64 + internal_strlen(coverage_dir));
-  uptr res = internal_snprintf((char *)tmp_path.data(), tmp_path.size(),
-                               "%s/%zd.sancov.map.tmp", coverage_dir,
-                               internal_getpid());
-  CHECK_LE(res, tmp_path.size());
+  InternalScopedString tmp_path(64 + internal_strlen(dir));
+  GetMappingPath(&tmp_path, dir, pid, ".tmp");
   fd_t map_fd = OpenFile(tmp_path.data(), WrOnly, &err);
   if (map_fd == kInvalidFd) {
     Report("Coverage: failed to open %s for writing: %d\n", tmp_path.data(),
@@ -109,14 +151,130 @@ void CovUpdateMapping(const char *coverage_dir, uptr caller_pc) {
   }
   CloseFile(map_fd);
 
-  InternalScopedString path(64 + internal_strlen(coverage_dir));
-  res = internal_snprintf((char *)path.data(), path.size(), "%s/%zd.sancov.map",
-                          coverage_dir, internal_getpid());
-  CHECK_LE(res, path.size());
+  InternalScopedString path(64 + internal_strlen(dir));
+  GetMappingPath(&path, dir, pid, "");
   if (!RenameFile(tmp_path.data(), path.data(), &err)) {
     Printf("sancov.map rename failed: %d\n", err);
     Die();
   }
 }
 
+// Rewrites the journal of the current process as a plain .sancov.map.
+static void CompactMapping() {
+  SpinMutexLock l(&mapping_mu);
+  int pid = internal_getpid();
+  if (journal_fd == kInvalidFd || journal_pid != pid)
+    return;
+  CloseFile(journal_fd);
+  journal_fd = kInvalidFd;
+  WriteMap(journal_dir, journal_pid);
+#if SANITIZER_POSIX
+  InternalScopedString path(64 + internal_strlen(journal_dir));
+  GetMappingPath(&path, journal_dir, journal_pid, ".log");
+  internal_unlink(path.data());
+#endif
+}
+
+static void OpenJournal(const char *dir, int pid) {
+  static bool compaction_registered;
+  if (!compaction_registered) {
+    mapped_ranges.Initialize(64);
+    Atexit(CompactMapping);
+    compaction_registered = true;
+  }
+  // After fork() the journal and the recorded ranges are the parent's.
+  if (journal_fd != kInvalidFd)
+    CloseFile(journal_fd);
+  for (uptr i = 0; i < mapped_ranges.size(); i++)
+    InternalFree(const_cast<char *>(mapped_ranges[i].name));
+  mapped_ranges.clear();
+
+  error_t err;
+  InternalScopedString path(64 + internal_strlen(dir));
+  GetMappingPath(&path, dir, pid, ".log");
+  journal_fd = OpenFile(path.data(), WrOnly, &err);
+  if (journal_fd == kInvalidFd) {
+    Report("Coverage: failed to open %s for writing: %d\n", path.data(), err);
+    Die();
+  }
+  internal_ftruncate(journal_fd, 0);
+  u64 bits = sizeof(uptr) * 8;
+  if (!WriteToFile(journal_fd, &bits, sizeof(bits), nullptr, &err)) {
+    Printf("sancov.map.log write failed: %d\n", err);
+    Die();
+  }
+  journal_pid = pid;
+  journal_dir = dir;
+}
+
+void CovUpdateMapping(const char *coverage_dir, uptr caller_pc) {
+  if (!common_flags()->coverage_direct) return;
+
+  SpinMutexLock l(&mapping_mu);
+
+  if (!cached_mapping.NeedsUpdate(caller_pc))
+    return;
+
+  int pid = internal_getpid();
+  if (journal_fd == kInvalidFd || journal_pid != pid)
+    OpenJournal(coverage_dir, pid);
+
+  ListOfModules modules;
+  modules.init();
+  InternalMmapVector<MappedRange> current(64);
+  for (const LoadedModule &module : modules) {
+    const char *module_name = StripModuleName(module.full_name());
+    uptr base = module.base_address();
+    for (const auto &range : module.ranges()) {
+      if (range.executable) {
+        MappedRange mapped = {range.beg, range.end, base, module_name};
+        current.push_back(mapped);
+        if (caller_pc && caller_pc >= range.beg && caller_pc < range.end)
+          cached_mapping.SetModuleRange(range.beg, range.end);
+      }
+    }
+  }
+  if (current.size())
+    InternalSort(&current, current.size(), CompareMappedRanges);
+
+  // Both lists are sorted, so a single merge pass finds the ranges which
+  // appeared or went away since the previous update.
+  InternalMmapVector<MappedRange> updated(current.size() + 1);
+  InternalMmapVector<char> records(1);
+  uptr i = 0, j = 0;
+  while (i < mapped_ranges.size() || j < current.size()) {
+    if (i < mapped_ranges.size() && j < current.size() &&
+        SameMappedRange(mapped_ranges[i], current[j])) {
+      updated.push_back(mapped_ranges[i]);
+      i++;
+      j++;
+    } else if (j == current.size() ||
+               (i < mapped_ranges.size() &&
+                mapped_ranges[i].start <= current[j].start)) {
+      AppendRecord(&records, kMappingUnloaded, mapped_ranges[i]);
+      InternalFree(const_cast<char *>(mapped_ranges[i].name));
+      i++;
+    } else {
+      AppendRecord(&records, kMappingLoaded, current[j]);
+      MappedRange mapped = current[j];
+      mapped.name = internal_strdup(current[j].name);
+      updated.push_back(mapped);
+      j++;
+    }
+  }
+  if (!records.size())
+    return;
+
+  mapped_ranges.clear();
+  for (uptr k = 0; k < updated.size(); k++)
+    mapped_ranges.push_back(updated[k]);
+
+  error_t err;
+  if (!WriteToFile(journal_fd, records.data(), records.size(), nullptr,
+                   &err)) {
+    Printf("sancov.map.log write failed: %d\n", err);
+    Die();
+  }
+}
+
 } // namespace __sanitizer
@@ -0,0 +1,137 @@
+//===-- sanitizer_cpu_features.cc -----------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between the sanitizer run-time libraries.
+//
+// See sanitizer_cpu_features.h for details.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_cpu_features.h"
+#include "sanitizer_platform.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#ifndef __GLIBC_PREREQ
+#define __GLIBC_PREREQ(x, y) 0
+#endif
+
+#if defined(__aarch64__) && SANITIZER_LINUX && \
+    (__GLIBC_PREREQ(2, 16) || SANITIZER_ANDROID)
+#include <sys/auxv.h>
+#define SANITIZER_CPU_FEATURES_HWCAP 1
+#endif
+
+namespace __sanitizer {
+
+atomic_uint64_t cpu_features;
+
+static const char *const kCPUFeatureNames[kCPUFeatureCount] = {
+    "sse4_2",   "popcnt",   "pclmulqdq", "cx16",     "avx",
+    "avx2",     "bmi1",     "bmi2",      "abm",      "avx512f",
+    "avx512dq", "avx512cd", "avx512bw",  "avx512vl", "vpclmulqdq",
+    "asimd",    "aes",      "pmull",     "sha1",     "sha2",
+    "crc32",    "atomics",  "sve",
+};
+
+const char *CPUFeatureName(CPUFeature feature) {
+  CHECK_LT(feature, kCPUFeatureCount);
+  return kCPUFeatureNames[feature];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static u64 Bit(u32 reg, u32 bit, CPUFeature feature) {
+  return ((reg >> bit) & 1) ? 1ULL << feature : 0;
+}
+
+// The register state enabled in XCR0; requires OSXSAVE.
+static u32 GetXCR0() {
+  u32 eax, edx;
+  // xgetbv, spelled as bytes for the assemblers which lack it.
+  __asm__(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+  return eax;
+}
+
+static u64 DetectX86Features() {
+  u32 eax, ebx, ecx, edx;
+  u32 max_leaf = __get_cpuid_max(0, nullptr);
+  if (max_leaf < 1)
+    return 0;
+  __cpuid(1, eax, ebx, ecx, edx);
+  u64 features = Bit(ecx, 20, kCPUFeatureSSE4_2) |
+                 Bit(ecx, 23, kCPUFeaturePOPCNT) |
+                 Bit(ecx, 1, kCPUFeatureCLMUL) |
+                 Bit(ecx, 13, kCPUFeatureCMPXCHG16B);
+  // AVX needs the OS to save the YMM state, AVX-512 the opmask and ZMM state.
+  bool os_avx = false, os_avx512 = false;
+  if ((ecx >> 27) & 1) {
+    u32 xcr0 = GetXCR0();
+    os_avx = (xcr0 & 0x6) == 0x6;
+    os_avx512 = os_avx && (xcr0 & 0xe0) == 0xe0;
+  }
+  if (os_avx)
+    features |= Bit(ecx, 28, kCPUFeatureAVX);
+  if (max_leaf >= 7) {
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    features |= Bit(ebx, 3, kCPUFeatureBMI1) | Bit(ebx, 8, kCPUFeatureBMI2);
+    if (os_avx) {
+      features |= Bit(ebx, 5, kCPUFeatureAVX2) |
+                  Bit(ecx, 10, kCPUFeatureVPCLMULQDQ);
+    }
+    if (os_avx512) {
+      features |= Bit(ebx, 16, kCPUFeatureAVX512F) |
+                  Bit(ebx, 17, kCPUFeatureAVX512DQ) |
+                  Bit(ebx, 28, kCPUFeatureAVX512CD) |
+                  Bit(ebx, 30, kCPUFeatureAVX512BW) |
+                  Bit(ebx, 31, kCPUFeatureAVX512VL);
+    }
+  }
+  if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000001) {
+    __cpuid(0x80000001, eax, ebx, ecx, edx);
+    features |= Bit(ecx, 5, kCPUFeatureLZCNT);
+  }
+  return features;
+}
+#endif  // defined(__x86_64__) || defined(__i386__)
+
+#if SANITIZER_CPU_FEATURES_HWCAP
+static u64 DetectAArch64Features() {
+  // The bits of AT_HWCAP, from arch/arm64/include/uapi/asm/hwcap.h in Linux.
+  static const struct {
+    u32 bit;
+    CPUFeature feature;
+  } kHWCaps[] = {
+      {1, kCPUFeatureASIMD}, {3, kCPUFeatureAES},   {4, kCPUFeaturePMULL},
+      {5, kCPUFeatureSHA1},  {6, kCPUFeatureSHA2},  {7, kCPUFeatureCRC32},
+      {8, kCPUFeatureLSE},   {22, kCPUFeatureSVE},
+  };
+  uptr hwcap = getauxval(AT_HWCAP);
+  u64 features = 0;
+  for (uptr i = 0; i < ARRAY_SIZE(kHWCaps); ++i) {
+    if (hwcap & (1ULL << kHWCaps[i].bit))
+      features |= 1ULL << kHWCaps[i].feature;
+  }
+  return features;
+}
+#endif  // SANITIZER_CPU_FEATURES_HWCAP
+
+u64 DetectCPUFeatures() {
+  u64 features = kCPUFeaturesDetected;
+#if defined(__x86_64__) || defined(__i386__)
+  features |= DetectX86Features();
+#elif SANITIZER_CPU_FEATURES_HWCAP
+  features |= DetectAArch64Features();
+#endif
+  // Racing threads all store the same value.
+  atomic_store(&cpu_features, features, memory_order_relaxed);
+  return features;
+}
+
+}  // namespace __sanitizer
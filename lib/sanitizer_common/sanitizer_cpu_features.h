@@ -0,0 +1,82 @@
+//===-- sanitizer_cpu_features.h --------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between the sanitizer run-time libraries.
+//
+// Detection of the instruction set extensions the runtimes can pick faster
+// code with: CPUID (and XGETBV for the register state the OS saves) on x86,
+// the AT_HWCAP bits on AArch64 Linux. The features are detected once, and
+// each check after that is a load and a test.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANITIZER_CPU_FEATURES_H
+#define SANITIZER_CPU_FEATURES_H
+
+#include "sanitizer_atomic.h"
+#include "sanitizer_internal_defs.h"
+
+namespace __sanitizer {
+
+enum CPUFeature {
+  // x86 and x86-64.
+  kCPUFeatureSSE4_2,
+  kCPUFeaturePOPCNT,
+  kCPUFeatureCLMUL,
+  kCPUFeatureCMPXCHG16B,
+  kCPUFeatureAVX,
+  kCPUFeatureAVX2,
+  kCPUFeatureBMI1,
+  kCPUFeatureBMI2,
+  kCPUFeatureLZCNT,
+  kCPUFeatureAVX512F,
+  kCPUFeatureAVX512DQ,
+  kCPUFeatureAVX512CD,
+  kCPUFeatureAVX512BW,
+  kCPUFeatureAVX512VL,
+  kCPUFeatureVPCLMULQDQ,
+  // AArch64.
+  kCPUFeatureASIMD,
+  kCPUFeatureAES,
+  kCPUFeaturePMULL,
+  kCPUFeatureSHA1,
+  kCPUFeatureSHA2,
+  kCPUFeatureCRC32,
+  kCPUFeatureLSE,
+  kCPUFeatureSVE,
+  kCPUFeatureCount
+};
+
+// Set once the features have been detected.
+const u64 kCPUFeaturesDetected = 1ULL << 63;
+COMPILER_CHECK(kCPUFeatureCount < 63);
+
+extern atomic_uint64_t cpu_features;
+u64 DetectCPUFeatures();
+
+// Returns the mask of (1 << CPUFeature) the CPU has and the OS supports.
+// The AVX and AVX-512 features are only reported when the OS saves their
+// registers. It is fine to call this at any point, including from
+// preinit_array and from several threads at once.
+INLINE u64 GetCPUFeatures() {
+  u64 features = atomic_load(&cpu_features, memory_order_relaxed);
+  if (UNLIKELY(!features))
+    features = DetectCPUFeatures();
+  return features;
+}
+
+INLINE bool CPUHasFeature(CPUFeature feature) {
+  return GetCPUFeatures() & (1ULL << feature);
+}
+
+// Returns the name of the feature, as in /proc/cpuinfo.
+const char *CPUFeatureName(CPUFeature feature);
+
+}  // namespace __sanitizer
+
+#endif  // SANITIZER_CPU_FEATURES_H
@@ -19,6 +19,10 @@
 // epochs can not be used with any of the detector methods except for
 // nodeBelongsToCurrentEpoch().
 //
+// SparseDeadlockDetector does the same on top of SparseGraph, which has room
+// for many more locks and does not flush: a node id carries the generation of
+// its slot, so the ids of the removed nodes are recycled one at a time.
+//
 // FIXME: this is work in progress, nothing really works yet.
 //
 //===----------------------------------------------------------------------===//
@@ -28,6 +32,7 @@
 
 #include "sanitizer_common.h"
 #include "sanitizer_bvgraph.h"
+#include "sanitizer_sparse_graph.h"
 
 namespace __sanitizer {
 
@@ -411,6 +416,338 @@ class DeadlockDetector {
   uptr n_edges_;
 };
 
+// Thread-local state for SparseDeadlockDetector: the node ids of the locks
+// currently held by the owning thread. A node may be removed while it is
+// held, SparseDeadlockDetector ignores such stale ids.
+class SparseDeadlockDetectorTLS {
+ public:
+  // No CTOR.
+  void clear() {
+    n_recursive_locks = 0;
+    n_all_locks_ = 0;
+  }
+
+  bool empty() const { return n_all_locks_ == 0; }
+
+  // Returns true if this is the first (non-recursive) acquisition of this lock.
+  bool addLock(uptr node, u32 stk) {
+    if (isHeld(node)) {
+      // The lock is already held by this thread, it must be recursive.
+      CHECK_LT(n_recursive_locks, ARRAY_SIZE(recursive_locks));
+      recursive_locks[n_recursive_locks++] = node;
+      return false;
+    }
+    CHECK_LT(n_all_locks_, ARRAY_SIZE(all_locks_with_contexts_));
+    LockWithContext l = {node, stk};
+    all_locks_with_contexts_[n_all_locks_++] = l;
+    return true;
+  }
+
+  void removeLock(uptr node) {
+    for (sptr i = n_recursive_locks - 1; i >= 0; i--) {
+      if (recursive_locks[i] == node) {
+        n_recursive_locks--;
+        Swap(recursive_locks[i], recursive_locks[n_recursive_locks]);
+        return;
+      }
+    }
+    for (sptr i = n_all_locks_ - 1; i >= 0; i--) {
+      if (all_locks_with_contexts_[i].lock == node) {
+        Swap(all_locks_with_contexts_[i],
+             all_locks_with_contexts_[n_all_locks_ - 1]);
+        n_all_locks_--;
+        break;
+      }
+    }
+  }
+
+  bool isHeld(uptr node) const {
+    for (uptr i = 0; i < n_all_locks_; i++)
+      if (all_locks_with_contexts_[i].lock == node)
+        return true;
+    return false;
+  }
+
+  u32 findLockContext(uptr node) const {
+    for (uptr i = 0; i < n_all_locks_; i++)
+      if (all_locks_with_contexts_[i].lock == node)
+        return all_locks_with_contexts_[i].stk;
+    return 0;
+  }
+
+  uptr getNumLocks() const { return n_all_locks_; }
+  uptr getLock(uptr idx) const { return all_locks_with_contexts_[idx].lock; }
+
+ private:
+  uptr recursive_locks[64];
+  uptr n_recursive_locks;
+  struct LockWithContext {
+    uptr lock;
+    u32 stk;
+  };
+  LockWithContext all_locks_with_contexts_[64];
+  uptr n_all_locks_;
+};
+
+// DeadlockDetector on top of SparseGraph.
+// A node id is gen * kMaxNodes + idx, where idx is the slot of the node in
+// the graph and gen (never 0) is bumped every time the slot is reused, so the
+// id 0 is never a valid node and the ids of the removed nodes never match
+// again (modulo wrap around of gen on 32-bit platforms). Once all of the slots
+// are taken the slots are reclaimed one by one in a round robin manner, instead
+// of flushing the whole graph.
+// Most of the methods of this class are not thread-safe (i.e. should
+// be protected by an external lock) unless explicitly told otherwise.
+class SparseDeadlockDetector {
+ public:
+  static const uptr kMaxNodes = SparseGraph::kMaxNodes;
+
+  // No CTOR.
+  void Init() {
+    g_.Init();
+    nodes_ = (NodeInfo *)MmapNoReserveOrDie(kMaxNodes * sizeof(NodeInfo),
+                                            "deadlock detector node info");
+    n_nodes_ = 0;
+    free_nodes_ = kNoNode;
+    n_live_nodes_ = 0;
+    evict_pos_ = 0;
+  }
+
+  // Allocate new deadlock detector node.
+  // Associate 'data' (opaque user's object) with the new node.
+  uptr newNode(uptr data) {
+    uptr idx;
+    if (free_nodes_ != kNoNode) {
+      idx = free_nodes_;
+      free_nodes_ = nodes_[idx].next_free;
+    } else if (n_nodes_ < kMaxNodes) {
+      idx = n_nodes_++;
+      nodes_[idx].gen = 0;
+    } else {
+      // All of the nodes are live, take the next one in a round robin manner.
+      while (!nodes_[evict_pos_].live)
+        evict_pos_ = (evict_pos_ + 1) % kMaxNodes;
+      idx = evict_pos_;
+      evict_pos_ = (evict_pos_ + 1) % kMaxNodes;
+      releaseNode(idx);
+      CHECK_EQ(free_nodes_, idx);
+      free_nodes_ = nodes_[idx].next_free;
+    }
+    NodeInfo &n = nodes_[idx];
+    n.gen++;
+    if (n.gen > kMaxGen)
+      n.gen = 1;
+    n.data = data;
+    n.live = true;
+    n_live_nodes_++;
+    g_.addNode(idx);
+    return n.gen * kMaxNodes + idx;
+  }
+
+  // Get data associated with the node created by newNode().
+  uptr getData(uptr node) const { return nodes_[nodeToIndex(node)].data; }
+
+  // Returns true if node has been returned by newNode() and not removed
+  // since. This operation is thread-safe, but racy if the node is being
+  // added or removed concurrently.
+  bool isLiveNode(uptr node) const {
+    if (node < kMaxNodes)
+      return false;
+    uptr idx = node % kMaxNodes;
+    return idx < n_nodes_ && nodes_[idx].live &&
+           nodes_[idx].gen == node / kMaxNodes;
+  }
+
+  void removeNode(uptr node) { releaseNode(nodeToIndex(node)); }
+
+  uptr numLiveNodes() const { return n_live_nodes_; }
+
+  // Returns true if there is a cycle in the graph after this lock event.
+  // Ideally should be called before the lock is acquired so that we can
+  // report a deadlock before a real deadlock happens.
+  bool onLockBefore(SparseDeadlockDetectorTLS *dtls, uptr cur_node) {
+    uptr n = collectHeldLocks(dtls);
+    return g_.isReachable(nodeToIndex(cur_node), held_, n);
+  }
+
+  u32 findLockContext(SparseDeadlockDetectorTLS *dtls, uptr node) {
+    return dtls->findLockContext(node);
+  }
+
+  // Add cur_node to the set of locks held currently by dtls.
+  void onLockAfter(SparseDeadlockDetectorTLS *dtls, uptr cur_node,
+                   u32 stk = 0) {
+    check_node(cur_node);
+    dtls->addLock(cur_node, stk);
+  }
+
+  // Experimental *racy* fast path function.
+  // Returns true if all edges from the currently held locks to cur_node exist.
+  bool hasAllEdges(SparseDeadlockDetectorTLS *dtls, uptr cur_node) {
+    if (!isLiveNode(cur_node))
+      return false;
+    uptr cur_idx = cur_node % kMaxNodes;
+    for (uptr i = 0, n = dtls->getNumLocks(); i < n; i++) {
+      if (!g_.hasEdge(dtls->getLock(i) % kMaxNodes, cur_idx))
+        return false;
+    }
+    return true;
+  }
+
+  // Adds edges from currently held locks to cur_node,
+  // returns the number of added edges.
+  // Should be called before onLockAfter.
+  uptr addEdges(SparseDeadlockDetectorTLS *dtls, uptr cur_node, u32 stk,
+                int unique_tid) {
+    uptr cur_idx = nodeToIndex(cur_node);
+    uptr n_added_edges = 0;
+    for (uptr i = 0, n = dtls->getNumLocks(); i < n; i++) {
+      uptr node = dtls->getLock(i);
+      if (!isLiveNode(node) || node == cur_node)
+        continue;
+      SparseGraph::EdgeInfo info = {dtls->findLockContext(node), stk,
+                                    unique_tid};
+      if (g_.addEdge(node % kMaxNodes, cur_idx, info))
+        n_added_edges++;
+    }
+    return n_added_edges;
+  }
+
+  bool findEdge(uptr from_node, uptr to_node, u32 *stk_from, u32 *stk_to,
+                int *unique_tid) {
+    const SparseGraph::EdgeInfo *info =
+        g_.getEdgeInfo(nodeToIndex(from_node), nodeToIndex(to_node));
+    if (!info)
+      return false;
+    *stk_from = info->stk_from;
+    *stk_to = info->stk_to;
+    *unique_tid = info->unique_tid;
+    return true;
+  }
+
+  // Test-only function. Handles the before/after lock events,
+  // returns true if there is a cycle.
+  bool onLock(SparseDeadlockDetectorTLS *dtls, uptr cur_node, u32 stk = 0) {
+    bool is_reachable = !isHeld(dtls, cur_node) && onLockBefore(dtls, cur_node);
+    addEdges(dtls, cur_node, stk, 0);
+    onLockAfter(dtls, cur_node, stk);
+    return is_reachable;
+  }
+
+  // Handles the try_lock event, returns false.
+  // See DeadlockDetector::onTryLock.
+  bool onTryLock(SparseDeadlockDetectorTLS *dtls, uptr cur_node, u32 stk = 0) {
+    onLockAfter(dtls, cur_node, stk);
+    return false;
+  }
+
+  // Returns true iff dtls is empty (no locks are currently held) and we can
+  // add the node to the currently held locks w/o chanding the global state.
+  // This operation is thread-safe as it only touches the dtls
+  // (modulo racy nature of isLiveNode).
+  bool onFirstLock(SparseDeadlockDetectorTLS *dtls, uptr node, u32 stk = 0) {
+    if (!dtls->empty() || !isLiveNode(node))
+      return false;
+    dtls->addLock(node, stk);
+    return true;
+  }
+
+  // Finds a path between the lock 'cur_node' (currently not held in dtls)
+  // and some currently held lock, returns the length of the path
+  // or 0 on failure.
+  uptr findPathToLock(SparseDeadlockDetectorTLS *dtls, uptr cur_node,
+                      uptr *path, uptr path_size) {
+    CHECK(!dtls->isHeld(cur_node));
+    uptr n = collectHeldLocks(dtls);
+    uptr res = g_.findShortestPath(nodeToIndex(cur_node), held_, n, path,
+                                   path_size);
+    for (uptr i = 0; i < res; i++)
+      path[i] = indexToNode(path[i]);
+    if (res)
+      CHECK_EQ(path[0], cur_node);
+    return res;
+  }
+
+  // Handle the unlock event.
+  // This operation is thread-safe as it only touches the dtls.
+  void onUnlock(SparseDeadlockDetectorTLS *dtls, uptr node) {
+    dtls->removeLock(node);
+  }
+
+  // Tries to handle the lock event w/o writing to global state.
+  // Returns true on success.
+  // This operation is thread-safe as it only touches the dtls
+  // (modulo racy nature of hasAllEdges).
+  bool onLockFast(SparseDeadlockDetectorTLS *dtls, uptr node, u32 stk = 0) {
+    if (hasAllEdges(dtls, node)) {
+      dtls->addLock(node, stk);
+      return true;
+    }
+    return false;
+  }
+
+  bool isHeld(SparseDeadlockDetectorTLS *dtls, uptr node) const {
+    return dtls->isHeld(node);
+  }
+
+  bool testOnlyHasEdge(uptr l1, uptr l2) {
+    return g_.hasEdge(nodeToIndex(l1), nodeToIndex(l2));
+  }
+
+ private:
+  static const uptr kNoNode = kMaxNodes;
+  static const uptr kMaxGen = (uptr)-1 / kMaxNodes - 1;
+  static const uptr kMaxHeldLocks = 64;
+
+  struct NodeInfo {
+    uptr data;
+    uptr gen;
+    uptr next_free;
+    bool live;
+  };
+
+  void check_node(uptr node) const { CHECK(isLiveNode(node)); }
+
+  uptr nodeToIndex(uptr node) const {
+    check_node(node);
+    return node % kMaxNodes;
+  }
+
+  uptr indexToNode(uptr idx) const {
+    CHECK(nodes_[idx].live);
+    return nodes_[idx].gen * kMaxNodes + idx;
+  }
+
+  void releaseNode(uptr idx) {
+    NodeInfo &n = nodes_[idx];
+    CHECK(n.live);
+    g_.removeNode(idx);
+    n.live = false;
+    n.next_free = free_nodes_;
+    free_nodes_ = idx;
+    n_live_nodes_--;
+  }
+
+  // Puts the graph indices of the live locks held by dtls into held_.
+  uptr collectHeldLocks(SparseDeadlockDetectorTLS *dtls) {
+    uptr n = 0;
+    for (uptr i = 0; i < dtls->getNumLocks(); i++) {
+      uptr node = dtls->getLock(i);
+      if (isLiveNode(node))
+        held_[n++] = node % kMaxNodes;
+    }
+    return n;
+  }
+
+  SparseGraph g_;
+  NodeInfo *nodes_;
+  uptr n_nodes_;
+  uptr free_nodes_;
+  uptr n_live_nodes_;
+  uptr evict_pos_;
+  uptr held_[kMaxHeldLocks];
+};
+
 } // namespace __sanitizer
 
 #endif // SANITIZER_DEADLOCK_DETECTOR_H
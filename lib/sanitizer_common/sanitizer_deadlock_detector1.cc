@@ -7,7 +7,8 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// Deadlock detector implementation based on NxN adjacency bit matrix.
+// Deadlock detector implementation based on a sparse lock graph
+// (SparseDeadlockDetector).
 //
 //===----------------------------------------------------------------------===//
 
@@ -21,21 +22,19 @@
 
 namespace __sanitizer {
 
-typedef TwoLevelBitVector<> DDBV;  // DeadlockDetector's bit vector.
-
 struct DDPhysicalThread {
 };
 
 struct DDLogicalThread {
   u64 ctx;
-  DeadlockDetectorTLS<DDBV> dd;
+  SparseDeadlockDetectorTLS dd;
   DDReport rep;
   bool report_pending;
 };
 
 struct DD : public DDetector {
   SpinMutex mtx;
-  DeadlockDetector<DDBV> dd;
+  SparseDeadlockDetector dd;
   DDFlags flags;
 
   explicit DD(const DDFlags *flags);
@@ -67,7 +66,7 @@ DDetector *DDetector::Create(const DDFlags *flags) {
 
 DD::DD(const DDFlags *flags)
     : flags(*flags) {
-  dd.clear();
+  dd.Init();
 }
 
 DDPhysicalThread* DD::CreatePhysicalThread() {
@@ -96,9 +95,8 @@ void DD::MutexInit(DDCallback *cb, DDMutex *m) {
 }
 
 void DD::MutexEnsureID(DDLogicalThread *lt, DDMutex *m) {
-  if (!dd.nodeBelongsToCurrentEpoch(m->id))
+  if (!dd.isLiveNode(m->id))
     m->id = dd.newNode(reinterpret_cast<uptr>(m));
-  dd.ensureCurrentEpoch(&lt->dd);
 }
 
 void DD::MutexBeforeLock(DDCallback *cb,
@@ -179,7 +177,7 @@ void DD::MutexDestroy(DDCallback *cb,
     DDMutex *m) {
   if (!m->id) return;
   SpinMutexLock lk(&mtx);
-  if (dd.nodeBelongsToCurrentEpoch(m->id))
+  if (dd.isLiveNode(m->id))
     dd.removeNode(m->id);
   m->id = 0;
 }
@@ -9,6 +9,12 @@
 //
 // Deadlock detector implementation based on adjacency lists.
 //
+// If DDFlags::lock_graph_file is set, the links also count how many times
+// each of them has been taken and, for one in kHoldSampleRate acquisitions,
+// for how long the second mutex was held. The whole graph is appended to the
+// file every lock_graph_interval_ms, as one "from to count samples hold_ns"
+// line per link, where from and to are the DDMutex::ctx of the mutexes.
+//
 //===----------------------------------------------------------------------===//
 
 #include "sanitizer_deadlock_detector_interface.h"
@@ -28,6 +34,11 @@ const int kMaxLink = 8;
 const int kL1Size = 1024;
 const int kL2Size = 1024;
 const int kMaxMutex = kL1Size * kL2Size;
+// The hold times are measured for one in this many acquisitions.
+const u32 kHoldSampleRate = 64;
+// The threads check whether a lock graph snapshot is due every this many
+// acquisitions.
+const u32 kSnapshotCheckPeriod = 1024;
 
 struct Id {
   u32 id;
@@ -66,19 +77,33 @@ struct DDPhysicalThread {
 struct ThreadMutex {
   u32 id;
   u32 stk;
+  u32 order;    // acquisition order within the thread
+  bool sampled;  // whether the hold time is measured
+  u64 lock_ns;   // acquisition time if sampled
 };
 
 struct DDLogicalThread {
   u64         ctx;
   ThreadMutex locked[kMaxNesting];
   int         nlocked;
+  u32         lock_order;
+  u32         nlock_events;
+};
+
+// Lock graph statistics of a Link.
+struct LinkStats {
+  u32 count;
+  u32 hold_samples;
+  u64 hold_ns;
 };
 
 struct Mutex {
   StaticSpinMutex mtx;
   u32 seq;
   int nlink;
+  u64 ctx;
   Link link[kMaxLink];
+  LinkStats stats[kMaxLink];
 };
 
 struct DD : public DDetector {
@@ -101,7 +126,11 @@ struct DD : public DDetector {
 
   void CycleCheck(DDPhysicalThread *pt, DDLogicalThread *lt, DDMutex *mtx);
   void Report(DDPhysicalThread *pt, DDLogicalThread *lt, int npath);
-  u32 allocateId(DDCallback *cb);
+  void PushLocked(DDCallback *cb, DDMutex *m);
+  void AddHoldTime(DDLogicalThread *lt, const ThreadMutex &tm);
+  void MaybeWriteLockGraph();
+  void WriteLockGraph();
+  u32 allocateId(DDCallback *cb, DDMutex *m);
   Mutex *getMutex(u32 id);
   u32 getMutexId(Mutex *m);
 
@@ -112,6 +141,12 @@ struct DD : public DDetector {
   SpinMutex mtx;
   InternalMmapVector<u32> free_id;
   int id_gen;
+
+  bool lock_graph_enabled;
+  atomic_uint64_t next_lock_graph_ns;
+  SpinMutex lock_graph_mtx;
+  fd_t lock_graph_fd;
+  u32 lock_graph_seq;
 };
 
 DDetector *DDetector::Create(const DDFlags *flags) {
@@ -124,6 +159,10 @@ DD::DD(const DDFlags *flags)
     : flags(*flags)
     , free_id(1024) {
   id_gen = 0;
+  lock_graph_enabled = flags->lock_graph_file && flags->lock_graph_file[0];
+  atomic_store(&next_lock_graph_ns, 0, memory_order_relaxed);
+  lock_graph_fd = kInvalidFd;
+  lock_graph_seq = 0;
 }
 
 DDPhysicalThread* DD::CreatePhysicalThread() {
@@ -142,6 +181,8 @@ DDLogicalThread* DD::CreateLogicalThread(u64 ctx) {
       sizeof(DDLogicalThread));
   lt->ctx = ctx;
   lt->nlocked = 0;
+  lt->lock_order = 0;
+  lt->nlock_events = 0;
   return lt;
 }
 
@@ -172,7 +213,7 @@ u32 DD::getMutexId(Mutex *m) {
   return -1;
 }
 
-u32 DD::allocateId(DDCallback *cb) {
+u32 DD::allocateId(DDCallback *cb, DDMutex *m) {
   u32 id = -1;
   SpinMutexLock l(&mtx);
   if (free_id.size() > 0) {
@@ -187,6 +228,7 @@ u32 DD::allocateId(DDCallback *cb) {
     id = id_gen++;
   }
   CHECK_LE(id, kMaxMutex);
+  getMutex(id)->ctx = m->ctx;
   VPrintf(3, "#%llu: DD::allocateId assign id %d\n", cb->lt->ctx, id);
   return id;
 }
@@ -206,14 +248,14 @@ void DD::MutexBeforeLock(DDCallback *cb, DDMutex *m, bool wlock) {
 
   CHECK_LE(lt->nlocked, kMaxNesting);
 
+  if (lock_graph_enabled && ++lt->nlock_events % kSnapshotCheckPeriod == 0)
+    MaybeWriteLockGraph();
+
   // FIXME(dvyukov): don't allocate id if lt->nlocked == 0?
   if (m->id == kNoId)
-    m->id = allocateId(cb);
+    m->id = allocateId(cb, m);
 
-  ThreadMutex *tm = &lt->locked[lt->nlocked++];
-  tm->id = m->id;
-  if (flags.second_deadlock_stack)
-    tm->stk = cb->Unwind();
+  PushLocked(cb, m);
   if (lt->nlocked == 1) {
     VPrintf(3, "#%llu: DD::MutexBeforeLock first mutex\n",
         cb->lt->ctx);
@@ -240,10 +282,12 @@ void DD::MutexBeforeLock(DDCallback *cb, DDMutex *m, bool wlock) {
           link->tid = lt->ctx;
           link->stk0 = stk1;
           link->stk1 = cb->Unwind();
+          internal_memset(&mtx1->stats[li], 0, sizeof(mtx1->stats[li]));
           added = true;
           VPrintf(3, "#%llu: DD::MutexBeforeLock added %d->%d link\n",
               cb->lt->ctx, getMutexId(mtx1), m->id);
         }
+        mtx1->stats[li].count++;
         break;
       }
     }
@@ -255,6 +299,9 @@ void DD::MutexBeforeLock(DDCallback *cb, DDMutex *m, bool wlock) {
       link->tid = lt->ctx;
       link->stk0 = stk1;
       link->stk1 = cb->Unwind();
+      LinkStats *stats = &mtx1->stats[li];
+      internal_memset(stats, 0, sizeof(*stats));
+      stats->count = 1;
       added = true;
       VPrintf(3, "#%llu: DD::MutexBeforeLock added %d->%d link\n",
           cb->lt->ctx, getMutexId(mtx1), m->id);
@@ -291,16 +338,55 @@ void DD::MutexAfterLock(DDCallback *cb, DDMutex *m, bool wlock,
     atomic_store(&m->owner, (uptr)cb->lt, memory_order_relaxed);
   }
 
-  if (!trylock)
+  if (!trylock) {
+    // MutexBeforeLock has pushed the mutex, the hold time starts now.
+    if (lt->nlocked > 0) {
+      ThreadMutex *tm = &lt->locked[lt->nlocked - 1];
+      if (tm->id == m->id && tm->sampled)
+        tm->lock_ns = NanoTime();
+    }
     return;
+  }
 
   CHECK_LE(lt->nlocked, kMaxNesting);
   if (m->id == kNoId)
-    m->id = allocateId(cb);
+    m->id = allocateId(cb, m);
+  PushLocked(cb, m);
+  ThreadMutex *tm = &lt->locked[lt->nlocked - 1];
+  if (tm->sampled)
+    tm->lock_ns = NanoTime();
+}
+
+void DD::PushLocked(DDCallback *cb, DDMutex *m) {
+  DDLogicalThread *lt = cb->lt;
   ThreadMutex *tm = &lt->locked[lt->nlocked++];
   tm->id = m->id;
   if (flags.second_deadlock_stack)
     tm->stk = cb->Unwind();
+  tm->order = lt->lock_order++;
+  tm->sampled = lock_graph_enabled && tm->order % kHoldSampleRate == 0;
+  tm->lock_ns = 0;
+}
+
+// Adds the hold time of tm to the links to it from the mutexes which were
+// locked before it.
+void DD::AddHoldTime(DDLogicalThread *lt, const ThreadMutex &tm) {
+  u64 hold_ns = NanoTime() - tm.lock_ns;
+  u32 seq = getMutex(tm.id)->seq;
+  for (int i = 0; i < lt->nlocked; i++) {
+    const ThreadMutex &tm1 = lt->locked[i];
+    if ((s32)(tm1.order - tm.order) >= 0)
+      continue;
+    Mutex *mtx1 = getMutex(tm1.id);
+    SpinMutexLock l(&mtx1->mtx);
+    for (int li = 0; li < mtx1->nlink; li++) {
+      if (mtx1->link[li].id == tm.id && mtx1->link[li].seq == seq) {
+        mtx1->stats[li].hold_samples++;
+        mtx1->stats[li].hold_ns += hold_ns;
+        break;
+      }
+    }
+  }
 }
 
 void DD::MutexBeforeUnlock(DDCallback *cb, DDMutex *m, bool wlock) {
@@ -320,6 +406,8 @@ void DD::MutexBeforeUnlock(DDCallback *cb, DDMutex *m, bool wlock) {
   int last = lt->nlocked - 1;
   for (int i = last; i >= 0; i--) {
     if (cb->lt->locked[i].id == m->id) {
+      if (lt->locked[i].sampled && lt->locked[i].lock_ns)
+        AddHoldTime(lt, lt->locked[i]);
       lt->locked[i] = lt->locked[last];
       lt->nlocked--;
       break;
@@ -417,6 +505,70 @@ void DD::Report(DDPhysicalThread *pt, DDLogicalThread *lt, int npath) {
   pt->report_pending = true;
 }
 
+void DD::MaybeWriteLockGraph() {
+  u64 now = NanoTime();
+  u64 next = atomic_load(&next_lock_graph_ns, memory_order_relaxed);
+  if (now < next)
+    return;
+  u64 interval_ns = (u64)Max(flags.lock_graph_interval_ms, 1) * 1000 * 1000;
+  if (!atomic_compare_exchange_strong(&next_lock_graph_ns, &next,
+                                      now + interval_ns, memory_order_relaxed))
+    return;  // Another thread is writing it.
+  WriteLockGraph();
+}
+
+void DD::WriteLockGraph() {
+  SpinMutexLock lg(&lock_graph_mtx);
+  if (lock_graph_fd == kInvalidFd) {
+    InternalScopedString path(kMaxPathLength);
+    path.append("%s.%d", flags.lock_graph_file, (int)internal_getpid());
+    lock_graph_fd = OpenFile(path.data(), WrOnly);
+    if (lock_graph_fd == kInvalidFd) {
+      Printf("WARNING: failed to open lock graph file '%s'\n", path.data());
+      lock_graph_enabled = false;
+      return;
+    }
+  }
+  InternalScopedString buf(1 << 16);
+  buf.append("# lock graph %u at %llu ns\n", lock_graph_seq++, NanoTime());
+  int nmutex;
+  {
+    SpinMutexLock l(&mtx);
+    nmutex = id_gen;
+  }
+  for (int id = 0; id < nmutex; id++) {
+    Mutex *mtx1 = getMutex(id);
+    Link link[kMaxLink];
+    LinkStats stats[kMaxLink];
+    int nlink;
+    u64 ctx1;
+    {
+      SpinMutexLock l(&mtx1->mtx);
+      nlink = mtx1->nlink;
+      ctx1 = mtx1->ctx;
+      internal_memcpy(link, mtx1->link, nlink * sizeof(link[0]));
+      internal_memcpy(stats, mtx1->stats, nlink * sizeof(stats[0]));
+    }
+    for (int li = 0; li < nlink; li++) {
+      Mutex *mtx2 = getMutex(link[li].id);
+      u64 ctx2;
+      {
+        SpinMutexLock l(&mtx2->mtx);
+        if (mtx2->seq != link[li].seq)
+          continue;  // Stale link.
+        ctx2 = mtx2->ctx;
+      }
+      if (buf.length() + 128 > buf.size()) {
+        WriteToFile(lock_graph_fd, buf.data(), buf.length());
+        buf.clear();
+      }
+      buf.append("%llu %llu %u %u %llu\n", ctx1, ctx2, stats[li].count,
+                 stats[li].hold_samples, stats[li].hold_ns);
+    }
+  }
+  WriteToFile(lock_graph_fd, buf.data(), buf.length());
+}
+
 DDReport *DD::GetReport(DDCallback *cb) {
   if (!cb->pt->report_pending)
     return 0;
@@ -48,6 +48,10 @@ struct DDMutex {
 
 struct DDFlags {
   bool second_deadlock_stack;
+  // If set, the lock-order graph is periodically written to this path with
+  // the pid appended (deadlock detector version 2 only).
+  const char *lock_graph_file;
+  int lock_graph_interval_ms;
 };
 
 struct DDReport {
@@ -51,6 +51,14 @@ extern "C" {
   SANITIZER_INTERFACE_ATTRIBUTE void __sanitizer_dump_coverage(
       const __sanitizer::uptr *pcs, const __sanitizer::uptr len);
   SANITIZER_INTERFACE_ATTRIBUTE void __sanitizer_dump_trace_pc_guard_coverage();
+  struct __sanitizer_cmp_feedback;
+  SANITIZER_INTERFACE_ATTRIBUTE __sanitizer::uptr
+  __sanitizer_get_cmp_feedback(const __sanitizer_cmp_feedback **entries);
+  SANITIZER_INTERFACE_ATTRIBUTE void __sanitizer_reset_cmp_feedback();
+  SANITIZER_INTERFACE_ATTRIBUTE __sanitizer::uptr
+  __sanitizer_get_live_coverage(const __sanitizer::u8 **map);
+  SANITIZER_INTERFACE_ATTRIBUTE __sanitizer::uptr
+  __sanitizer_reset_live_coverage();
 
   SANITIZER_INTERFACE_ATTRIBUTE void __sanitizer_cov(__sanitizer::u32 *guard);
   SANITIZER_INTERFACE_ATTRIBUTE
@@ -73,15 +81,16 @@ extern "C" {
   SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
   void __sanitizer_cov_trace_cmp();
   SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
-  void __sanitizer_cov_trace_cmp1();
+  void __sanitizer_cov_trace_cmp1(__sanitizer::u8 arg1, __sanitizer::u8 arg2);
   SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
-  void __sanitizer_cov_trace_cmp2();
+  void __sanitizer_cov_trace_cmp2(__sanitizer::u16 arg1, __sanitizer::u16 arg2);
   SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
-  void __sanitizer_cov_trace_cmp4();
+  void __sanitizer_cov_trace_cmp4(__sanitizer::u32 arg1, __sanitizer::u32 arg2);
   SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
-  void __sanitizer_cov_trace_cmp8();
+  void __sanitizer_cov_trace_cmp8(__sanitizer::u64 arg1, __sanitizer::u64 arg2);
   SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
-  void __sanitizer_cov_trace_switch();
+  void __sanitizer_cov_trace_switch(__sanitizer::u64 val,
+                                    __sanitizer::u64 *cases);
   SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
   void __sanitizer_cov_trace_div4();
   SANITIZER_INTERFACE_ATTRIBUTE SANITIZER_WEAK_ATTRIBUTE
@@ -12,11 +12,55 @@
 //===----------------------------------------------------------------------===//
 
 #include "sanitizer_allocator_internal.h"
+#include "sanitizer_atomic.h"
 #include "sanitizer_common.h"
 #include "sanitizer_libc.h"
 
+#if defined(__x86_64__) && defined(__SSE2__)
+// <emmintrin.h> transitively includes <stdlib.h>,
+// and it's prohibited to include std headers into the runtime.
+// So we do the same dirty trick as tsan_rtl.cc.
+#define _MM_MALLOC_H_INCLUDED
+#define __MM_MALLOC_H
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace __sanitizer {
 
+// Vector and word loads past the terminating null of a string must not cross
+// into a page which may be unmapped.
+static const uptr kMinPageSizeForLoads = 4096;
+
+static inline bool LoadFitsInPage(const char *p, uptr size) {
+  return ((uptr)p & (kMinPageSizeForLoads - 1)) <= kMinPageSizeForLoads - size;
+}
+
+static inline uptr LoadWord(const char *p) {
+  uptr w;
+  __builtin_memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static inline void StoreWord(char *p, uptr w) {
+  __builtin_memcpy(p, &w, sizeof(w));
+}
+
+// Keeps the compiler from turning the loops below into calls to memcpy() or
+// memset(), which may be intercepted.
+static inline void NoLibcCallBarrier() {
+  atomic_signal_fence(memory_order_seq_cst);
+}
+
+static const uptr kWordOnes = ~(uptr)0 / 0xff;
+static const uptr kWordHighBits = kWordOnes << 7;
+
+// Non-zero if the word has a zero byte.
+static inline uptr WordHasZeroByte(uptr w) {
+  return (w - kWordOnes) & ~w & kWordHighBits;
+}
+
 s64 internal_atoll(const char *nptr) {
   return internal_simple_strtoll(nptr, nullptr, 10);
 }
@@ -41,17 +85,81 @@ void *internal_memrchr(const void *s, int c, uptr n) {
 int internal_memcmp(const void* s1, const void* s2, uptr n) {
   const char *t1 = (const char *)s1;
   const char *t2 = (const char *)s2;
-  for (uptr i = 0; i < n; ++i, ++t1, ++t2)
-    if (*t1 != *t2)
-      return *t1 < *t2 ? -1 : 1;
-  return 0;
+  uptr i = mem_find_mismatch(t1, t2, n);
+  if (i == n)
+    return 0;
+  // Like memcmp(), compare the bytes as unsigned char.
+  return (u8)t1[i] < (u8)t2[i] ? -1 : 1;
 }
 
 void *internal_memcpy(void *dest, const void *src, uptr n) {
   char *d = (char*)dest;
   const char *s = (const char *)src;
-  for (uptr i = 0; i < n; ++i)
+#if defined(__x86_64__) && defined(__SSE2__)
+  if (n >= 128 && !IsAligned((uptr)d, 64)) {
+    // Align dest to a cache line, so that each block fills one.
+    uptr head = 64 - ((uptr)d & 63);
+    const __m128i *v = (const __m128i *)s;
+    __m128i a = _mm_loadu_si128(v), b = _mm_loadu_si128(v + 1);
+    __m128i c = _mm_loadu_si128(v + 2), e = _mm_loadu_si128(v + 3);
+    _mm_storeu_si128((__m128i *)d, a);
+    _mm_storeu_si128((__m128i *)d + 1, b);
+    _mm_storeu_si128((__m128i *)d + 2, c);
+    _mm_storeu_si128((__m128i *)d + 3, e);
+    d += head;
+    s += head;
+    n -= head;
+  }
+  uptr blocks = n & ~(uptr)63;
+  // If dest is just above src modulo 4K, the loads of a forward copy falsely
+  // depend on the stores right before them (4K aliasing): copy the blocks
+  // backwards then.
+  bool backwards = n >= 256 && (((uptr)d - (uptr)s) & 4095) < 64;
+  for (uptr i = 0; i < blocks; i += 64) {
+    uptr offset = backwards ? blocks - 64 - i : i;
+    const __m128i *v = (const __m128i *)(s + offset);
+    __m128i a = _mm_loadu_si128(v), b = _mm_loadu_si128(v + 1);
+    __m128i c = _mm_loadu_si128(v + 2), e = _mm_loadu_si128(v + 3);
+    __m128i *w = (__m128i *)(d + offset);
+    _mm_storeu_si128(w, a);
+    _mm_storeu_si128(w + 1, b);
+    _mm_storeu_si128(w + 2, c);
+    _mm_storeu_si128(w + 3, e);
+    NoLibcCallBarrier();
+  }
+  d += blocks;
+  s += blocks;
+  n -= blocks;
+  for (; n >= 16; n -= 16, d += 16, s += 16) {
+    _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    NoLibcCallBarrier();
+  }
+#elif defined(__aarch64__)
+  for (; n >= 64; n -= 64, d += 64, s += 64) {
+    uint8x16_t a = vld1q_u8((const u8 *)s), b = vld1q_u8((const u8 *)s + 16);
+    uint8x16_t c = vld1q_u8((const u8 *)s + 32);
+    uint8x16_t e = vld1q_u8((const u8 *)s + 48);
+    vst1q_u8((u8 *)d, a);
+    vst1q_u8((u8 *)d + 16, b);
+    vst1q_u8((u8 *)d + 32, c);
+    vst1q_u8((u8 *)d + 48, e);
+    NoLibcCallBarrier();
+  }
+  for (; n >= 16; n -= 16, d += 16, s += 16) {
+    vst1q_u8((u8 *)d, vld1q_u8((const u8 *)s));
+    NoLibcCallBarrier();
+  }
+#endif
+  // Scalar tail, also the whole copy on targets without a vector path.
+  for (; n >= sizeof(uptr); n -= sizeof(uptr), d += sizeof(uptr),
+                            s += sizeof(uptr)) {
+    StoreWord(d, LoadWord(s));
+    NoLibcCallBarrier();
+  }
+  for (uptr i = 0; i < n; ++i) {
     d[i] = s[i];
+    NoLibcCallBarrier();
+  }
   return dest;
 }
 
@@ -84,11 +192,45 @@ void internal_bzero_aligned16(void *s, uptr n) {
 }
 
 void *internal_memset(void* s, int c, uptr n) {
-  // The next line prevents Clang from making a call to memset() instead of the
+  char *d = (char*)s;
+#if defined(__x86_64__) && defined(__SSE2__)
+  const __m128i v = _mm_set1_epi8((char)c);
+  for (; n >= 64; n -= 64, d += 64) {
+    _mm_storeu_si128((__m128i *)d, v);
+    _mm_storeu_si128((__m128i *)d + 1, v);
+    _mm_storeu_si128((__m128i *)d + 2, v);
+    _mm_storeu_si128((__m128i *)d + 3, v);
+    NoLibcCallBarrier();
+  }
+  for (; n >= 16; n -= 16, d += 16) {
+    _mm_storeu_si128((__m128i *)d, v);
+    NoLibcCallBarrier();
+  }
+#elif defined(__aarch64__)
+  const uint8x16_t v = vdupq_n_u8((u8)c);
+  for (; n >= 64; n -= 64, d += 64) {
+    vst1q_u8((u8 *)d, v);
+    vst1q_u8((u8 *)d + 16, v);
+    vst1q_u8((u8 *)d + 32, v);
+    vst1q_u8((u8 *)d + 48, v);
+    NoLibcCallBarrier();
+  }
+  for (; n >= 16; n -= 16, d += 16) {
+    vst1q_u8((u8 *)d, v);
+    NoLibcCallBarrier();
+  }
+#endif
+  // Scalar tail, also the whole fill on targets without a vector path.
+  const uptr w = kWordOnes * (u8)c;
+  for (; n >= sizeof(uptr); n -= sizeof(uptr), d += sizeof(uptr)) {
+    StoreWord(d, w);
+    NoLibcCallBarrier();
+  }
+  // The volatile keeps Clang from making a call to memset() instead of the
   // loop below.
   // FIXME: building the runtime with -ffreestanding is a better idea. However
   // there currently are linktime problems due to PR12396.
-  char volatile *t = (char*)s;
+  char volatile *t = d;
   for (uptr i = 0; i < n; ++i, ++t) {
     *t = c;
   }
@@ -170,9 +312,29 @@ char *internal_strrchr(const char *s, int c) {
 }
 
 uptr internal_strlen(const char *s) {
-  uptr i = 0;
-  while (s[i]) i++;
-  return i;
+  // Aligned loads never cross into another page.
+#if defined(__x86_64__) && defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  uptr misalign = (uptr)s & 15;
+  const __m128i *v = (const __m128i *)(s - misalign);
+  // Drop the bytes before s.
+  int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(v), zero)) >>
+             misalign;
+  if (mask)
+    return __builtin_ctz(mask);
+  for (v++;; v++) {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(v), zero));
+    if (mask)
+      return (const char *)v - s + __builtin_ctz(mask);
+  }
+#else
+  const char *p = s;
+  for (; !IsAligned((uptr)p, sizeof(uptr)); p++)
+    if (!*p) return p - s;
+  for (; !WordHasZeroByte(LoadWord(p)); p += sizeof(uptr)) {}
+  for (; *p; p++) {}
+  return p - s;
+#endif
 }
 
 uptr internal_strlcat(char *dst, const char *src, uptr maxlen) {
@@ -271,23 +433,127 @@ s64 internal_simple_strtoll(const char *nptr, char **endptr, int base) {
   }
 }
 
+uptr mem_find_nonzero(const char *beg, uptr size) {
+  const char *end = beg + size;
+  const char *mem = beg;
+#if defined(__x86_64__) && defined(__SSE2__)
+  for (; mem < end && !IsAligned((uptr)mem, 16); mem++)
+    if (*mem) return mem - beg;
+  const __m128i zero = _mm_setzero_si128();
+  // Test 64 bytes per branch; the 16-byte loop below pinpoints a hit.
+  for (; end - mem >= 64; mem += 64) {
+    const __m128i *v = (const __m128i *)mem;
+    __m128i all = _mm_or_si128(
+        _mm_or_si128(_mm_load_si128(v), _mm_load_si128(v + 1)),
+        _mm_or_si128(_mm_load_si128(v + 2), _mm_load_si128(v + 3)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(all, zero)) != 0xffff)
+      break;
+  }
+  for (; end - mem >= 16; mem += 16) {
+    int mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)mem), zero));
+    if (mask != 0xffff)
+      return mem - beg + __builtin_ctz(~mask);
+  }
+#elif defined(__aarch64__)
+  for (; mem < end && !IsAligned((uptr)mem, 16); mem++)
+    if (*mem) return mem - beg;
+  for (; end - mem >= 64; mem += 64) {
+    const u8 *v = (const u8 *)mem;
+    uint8x16_t all = vorrq_u8(vorrq_u8(vld1q_u8(v), vld1q_u8(v + 16)),
+                              vorrq_u8(vld1q_u8(v + 32), vld1q_u8(v + 48)));
+    if (vmaxvq_u8(all))
+      break;
+  }
+  for (; end - mem >= 16; mem += 16)
+    if (vmaxvq_u8(vld1q_u8((const u8 *)mem)))
+      break;
+#endif
+  // Scalar tail, also the whole search on targets without a vector path.
+  for (; mem < end && !IsAligned((uptr)mem, sizeof(uptr)); mem++)
+    if (*mem) return mem - beg;
+  for (; end - mem >= (sptr)sizeof(uptr); mem += sizeof(uptr))
+    if (*(const uptr *)mem) break;
+  for (; mem < end; mem++)
+    if (*mem) return mem - beg;
+  return size;
+}
+
+uptr mem_find_mismatch(const char *s1, const char *s2, uptr size) {
+  uptr i = 0;
+#if defined(__x86_64__) && defined(__SSE2__)
+  for (; size - i >= 16; i += 16) {
+    int mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s1 + i)),
+                       _mm_loadu_si128((const __m128i *)(s2 + i))));
+    if (mask != 0xffff)
+      return i + __builtin_ctz(~mask);
+  }
+#elif defined(__aarch64__)
+  for (; size - i >= 16; i += 16) {
+    uint8x16_t eq =
+        vceqq_u8(vld1q_u8((const u8 *)s1 + i), vld1q_u8((const u8 *)s2 + i));
+    if (vminvq_u8(eq) != 0xff)
+      break;
+  }
+#endif
+  // Scalar tail, also the whole search on targets without a vector path.
+  for (; size - i >= sizeof(uptr); i += sizeof(uptr))
+    if (LoadWord(s1 + i) != LoadWord(s2 + i))
+      break;
+  for (; i < size; i++)
+    if (s1[i] != s2[i])
+      break;
+  return i;
+}
+
+uptr str_find_mismatch(const char *s1, const char *s2, uptr size) {
+  uptr i = 0;
+  while (i < size) {
+#if defined(__x86_64__) && defined(__SSE2__)
+    if (size - i >= 16 && LoadFitsInPage(s1 + i, 16) &&
+        LoadFitsInPage(s2 + i, 16)) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(s1 + i));
+      __m128i b = _mm_loadu_si128((const __m128i *)(s2 + i));
+      int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+      int null = _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128()));
+      int more = equal & ~null;
+      if (more != 0xffff)
+        return i + __builtin_ctz(~more);
+      i += 16;
+      continue;
+    }
+#elif defined(__aarch64__)
+    if (size - i >= 16 && LoadFitsInPage(s1 + i, 16) &&
+        LoadFitsInPage(s2 + i, 16)) {
+      uint8x16_t a = vld1q_u8((const u8 *)s1 + i);
+      uint8x16_t b = vld1q_u8((const u8 *)s2 + i);
+      uint8x16_t more = vandq_u8(vceqq_u8(a, b), vtstq_u8(a, a));
+      if (vminvq_u8(more) == 0xff) {
+        i += 16;
+        continue;
+      }
+    }
+#endif
+    if (size - i >= sizeof(uptr) && LoadFitsInPage(s1 + i, sizeof(uptr)) &&
+        LoadFitsInPage(s2 + i, sizeof(uptr))) {
+      uptr a = LoadWord(s1 + i);
+      if (a == LoadWord(s2 + i) && !WordHasZeroByte(a)) {
+        i += sizeof(uptr);
+        continue;
+      }
+    }
+    // The mismatch or the null is close. Also steps over page boundaries.
+    if (s1[i] != s2[i] || s1[i] == '\0')
+      return i;
+    i++;
+  }
+  return size;
+}
+
 bool mem_is_zero(const char *beg, uptr size) {
   CHECK_LE(size, 1ULL << FIRST_32_SECOND_64(30, 40));  // Sanity check.
-  const char *end = beg + size;
-  uptr *aligned_beg = (uptr *)RoundUpTo((uptr)beg, sizeof(uptr));
-  uptr *aligned_end = (uptr *)RoundDownTo((uptr)end, sizeof(uptr));
-  uptr all = 0;
-  // Prologue.
-  for (const char *mem = beg; mem < (char*)aligned_beg && mem < end; mem++)
-    all |= *mem;
-  // Aligned loop.
-  for (; aligned_beg < aligned_end; aligned_beg++)
-    all |= *aligned_beg;
-  // Epilogue.
-  if ((char*)aligned_end >= beg)
-    for (const char *mem = (char*)aligned_end; mem < end; mem++)
-      all |= *mem;
-  return all == 0;
+  return mem_find_nonzero(beg, size) == size;
 }
 
 } // namespace __sanitizer
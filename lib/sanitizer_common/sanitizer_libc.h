@@ -61,6 +61,18 @@ int internal_snprintf(char *buffer, uptr length, const char *format, ...);
 // Optimized for the case when the result is true.
 bool mem_is_zero(const char *mem, uptr size);
 
+// Return the offset of the first non-zero byte in [mem, mem+size),
+// or size if there is none. Uses SSE2/NEON where available.
+uptr mem_find_nonzero(const char *mem, uptr size);
+
+// Return the offset of the first byte where [s1, s1+size) and [s2, s2+size)
+// differ, or size if they are equal. Uses SSE2/NEON where available.
+uptr mem_find_mismatch(const char *s1, const char *s2, uptr size);
+
+// Same as mem_find_mismatch(), but also stops at the first null in s1. May
+// read past the null, but never into another page.
+uptr str_find_mismatch(const char *s1, const char *s2, uptr size);
+
 // I/O
 // Define these as macros so we can use them in linker initialized global
 // structs without dynamic initialization.
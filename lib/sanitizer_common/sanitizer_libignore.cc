@@ -78,12 +78,7 @@ void LibIgnore::OnLibraryLoaded(const char *name) {
                 lib->templ, mod.full_name());
         lib->loaded = true;
         lib->name = internal_strdup(mod.full_name());
-        const uptr idx =
-            atomic_load(&ignored_ranges_count_, memory_order_relaxed);
-        CHECK_LT(idx, kMaxLibs);
-        ignored_code_ranges_[idx].begin = range.beg;
-        ignored_code_ranges_[idx].end = range.end;
-        atomic_store(&ignored_ranges_count_, idx + 1, memory_order_release);
+        AddRange(range.beg, range.end, false);
         break;
       }
     }
@@ -107,18 +102,46 @@ void LibIgnore::OnLibraryLoaded(const char *name) {
           continue;
         VReport(1, "Adding instrumented range %p-%p from library '%s'\n",
                 range.beg, range.end, mod.full_name());
-        const uptr idx =
-            atomic_load(&instrumented_ranges_count_, memory_order_relaxed);
-        CHECK_LT(idx, kMaxLibs);
-        instrumented_code_ranges_[idx].begin = range.beg;
-        instrumented_code_ranges_[idx].end = range.end;
-        atomic_store(&instrumented_ranges_count_, idx + 1,
-                     memory_order_release);
+        AddRange(range.beg, range.end, true);
       }
     }
   }
 }
 
+void LibIgnore::AddRange(uptr begin, uptr end, bool instrumented) {
+  CHECK_LT(begin, end);
+  CHECK_LE(end >> kRegionSizeLog, kNumRegions);
+  atomic_uintptr_t *regions = reinterpret_cast<atomic_uintptr_t *>(
+      atomic_load(&regions_, memory_order_relaxed));
+  if (!regions) {
+    // Only the top-level entries which cover code are ever touched.
+    regions = reinterpret_cast<atomic_uintptr_t *>(MmapOrDie(
+        kNumRegions * sizeof(regions[0]), "LibIgnore regions"));
+    atomic_store(&regions_, reinterpret_cast<uptr>(regions),
+                 memory_order_release);
+  }
+  for (uptr page = begin >> kPageSizeLog;
+       page < RoundUpTo(end, 1ULL << kPageSizeLog) >> kPageSizeLog; page++) {
+    const uptr idx = page >> (kRegionSizeLog - kPageSizeLog);
+    Region *region = reinterpret_cast<Region *>(
+        atomic_load(&regions[idx], memory_order_relaxed));
+    if (!region) {
+      region = reinterpret_cast<Region *>(
+          MmapOrDie(sizeof(Region), "LibIgnore region"));
+      atomic_store(&regions[idx], reinterpret_cast<uptr>(region),
+                   memory_order_release);
+    }
+    atomic_uintptr_t *bitmap =
+        instrumented ? region->instrumented : region->ignored;
+    const uptr bit = page & ((1ULL << (kRegionSizeLog - kPageSizeLog)) - 1);
+    atomic_uintptr_t *word = &bitmap[bit / kBitsPerWord];
+    atomic_store(word,
+                 atomic_load(word, memory_order_relaxed) |
+                     ((uptr)1 << (bit % kBitsPerWord)),
+                 memory_order_relaxed);
+  }
+}
+
 void LibIgnore::OnLibraryUnloaded() {
   OnLibraryLoaded(nullptr);
 }
@@ -57,23 +57,54 @@ class LibIgnore {
     bool loaded;
   };
 
-  struct LibCodeRange {
-    uptr begin;
-    uptr end;
+  // Code ranges are tracked in a two-level page map: the address space is
+  // split into regions of 1 << kRegionSizeLog bytes, and each region that
+  // holds code has a pair of page bitmaps, one for the ignored pages and one
+  // for the instrumented ones. Executable mappings are page aligned, so the
+  // lookups are exact. Pages are never removed from the map.
+  static const uptr kPageSizeLog = 12;
+  static const uptr kRegionSizeLog = 30;
+#if SANITIZER_WORDSIZE == 64
+  static const uptr kAddressSpaceLog = 48;
+#else
+  static const uptr kAddressSpaceLog = 32;
+#endif
+  static const uptr kNumRegions = 1ULL << (kAddressSpaceLog - kRegionSizeLog);
+  static const uptr kBitsPerWord = sizeof(uptr) * 8;
+  static const uptr kWordsPerRegion =
+      (1ULL << (kRegionSizeLog - kPageSizeLog)) / kBitsPerWord;
+
+  struct Region {
+    atomic_uintptr_t ignored[kWordsPerRegion];
+    atomic_uintptr_t instrumented[kWordsPerRegion];
   };
 
-  inline bool IsInRange(uptr pc, const LibCodeRange &range) const {
-    return (pc >= range.begin && pc < range.end);
+  // Returns the region holding |pc|, or null if nothing was added there.
+  inline const Region *GetRegion(uptr pc) const {
+    if ((pc >> kRegionSizeLog) >= kNumRegions)
+      return nullptr;
+    atomic_uintptr_t *regions = reinterpret_cast<atomic_uintptr_t *>(
+        atomic_load(&regions_, memory_order_acquire));
+    if (!regions)
+      return nullptr;
+    return reinterpret_cast<const Region *>(
+        atomic_load(&regions[pc >> kRegionSizeLog], memory_order_acquire));
   }
 
+  static inline bool TestPage(const atomic_uintptr_t *bitmap, uptr pc) {
+    const uptr page = (pc & ((1ULL << kRegionSizeLog) - 1)) >> kPageSizeLog;
+    const uptr word = atomic_load(&bitmap[page / kBitsPerWord],
+                                  memory_order_relaxed);
+    return word & ((uptr)1 << (page % kBitsPerWord));
+  }
+
+  // Marks the pages of [begin, end) in the ignored or instrumented bitmaps.
+  void AddRange(uptr begin, uptr end, bool instrumented);
+
   static const uptr kMaxLibs = 128;
 
   // Hot part:
-  atomic_uintptr_t ignored_ranges_count_;
-  LibCodeRange ignored_code_ranges_[kMaxLibs];
-
-  atomic_uintptr_t instrumented_ranges_count_;
-  LibCodeRange instrumented_code_ranges_[kMaxLibs];
+  atomic_uintptr_t regions_;  // atomic_uintptr_t[kNumRegions]
 
   // Cold part:
   BlockingMutex mutex_;
@@ -87,26 +118,21 @@ class LibIgnore {
 };
 
 inline bool LibIgnore::IsIgnored(uptr pc, bool *pc_in_ignored_lib) const {
-  const uptr n = atomic_load(&ignored_ranges_count_, memory_order_acquire);
-  for (uptr i = 0; i < n; i++) {
-    if (IsInRange(pc, ignored_code_ranges_[i])) {
-      *pc_in_ignored_lib = true;
-      return true;
-    }
+  const Region *region = GetRegion(pc);
+  if (region && TestPage(region->ignored, pc)) {
+    *pc_in_ignored_lib = true;
+    return true;
   }
   *pc_in_ignored_lib = false;
-  if (track_instrumented_libs_ && !IsPcInstrumented(pc))
+  if (track_instrumented_libs_ &&
+      !(region && TestPage(region->instrumented, pc)))
     return true;
   return false;
 }
 
 inline bool LibIgnore::IsPcInstrumented(uptr pc) const {
-  const uptr n = atomic_load(&instrumented_ranges_count_, memory_order_acquire);
-  for (uptr i = 0; i < n; i++) {
-    if (IsInRange(pc, instrumented_code_ranges_[i]))
-      return true;
-  }
-  return false;
+  const Region *region = GetRegion(pc);
+  return region && TestPage(region->instrumented, pc);
 }
 
 }  // namespace __sanitizer
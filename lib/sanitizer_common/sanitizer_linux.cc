@@ -47,6 +47,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <link.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sched.h>
 #include <sys/mman.h>
@@ -403,6 +404,43 @@ u64 NanoTime() {
   return (u64)tv.tv_sec * 1000*1000*1000 + tv.tv_usec * 1000;
 }
 
+uptr GetNumaNode() {
+#if SANITIZER_LINUX
+  unsigned cpu, node;
+  if (internal_iserror(
+          internal_syscall(SYSCALL(getcpu), (uptr)&cpu, (uptr)&node, 0)))
+    return 0;
+  return node;
+#else
+  return 0;
+#endif
+}
+
+void BindMemoryToNumaNode(uptr addr, uptr size, uptr node) {
+#if SANITIZER_LINUX
+  const int kMpolPreferred = 1;
+  if (node >= sizeof(uptr) * 8)
+    return;
+  uptr node_mask = (uptr)1 << node;
+  // The kernel ignores the last bit of the mask, hence the + 1.
+  internal_syscall(SYSCALL(mbind), addr, size, kMpolPreferred,
+                   (uptr)&node_mask, sizeof(node_mask) * 8 + 1, 0);
+#endif
+}
+
+bool GrowMappingInPlace(uptr addr, uptr old_size, uptr new_size) {
+#if SANITIZER_LINUX
+  // Without MREMAP_MAYMOVE, mremap fails rather than move the mapping.
+  if (internal_iserror(
+          internal_syscall(SYSCALL(mremap), addr, old_size, new_size, 0)))
+    return false;
+  IncreaseTotalMmap(new_size - old_size);
+  return true;
+#else
+  return false;
+#endif
+}
+
 // Like getenv, but reads env directly from /proc (on Linux) or parses the
 // 'environ' array (on FreeBSD) and does not use libc. This function should be
 // called first inside __asan_init.
@@ -533,31 +571,52 @@ BlockingMutex::BlockingMutex() {
   internal_memset(this, 0, sizeof(*this));
 }
 
+void FutexWait(atomic_uint32_t *p, u32 cmp) {
+#if SANITIZER_FREEBSD
+  _umtx_op(p, UMTX_OP_WAIT_UINT, cmp, 0, 0);
+#else
+  internal_syscall(SYSCALL(futex), (uptr)p, FUTEX_WAIT, cmp, 0, 0, 0);
+#endif
+}
+
+void FutexWake(atomic_uint32_t *p, u32 count) {
+#if SANITIZER_FREEBSD
+  _umtx_op(p, UMTX_OP_WAKE, count, 0, 0);
+#else
+  internal_syscall(SYSCALL(futex), (uptr)p, FUTEX_WAKE, count, 0, 0, 0);
+#endif
+}
+
 void BlockingMutex::Lock() {
   CHECK_EQ(owner_, 0);
   atomic_uint32_t *m = reinterpret_cast<atomic_uint32_t *>(&opaque_storage_);
-  if (atomic_exchange(m, MtxLocked, memory_order_acquire) == MtxUnlocked)
+  u32 cmp = MtxUnlocked;
+  if (atomic_compare_exchange_strong(m, &cmp, MtxLocked, memory_order_acquire))
     return;
-  while (atomic_exchange(m, MtxSleeping, memory_order_acquire) != MtxUnlocked) {
-#if SANITIZER_FREEBSD
-    _umtx_op(m, UMTX_OP_WAIT_UINT, MtxSleeping, 0, 0);
-#else
-    internal_syscall(SYSCALL(futex), (uptr)m, FUTEX_WAIT, MtxSleeping, 0, 0, 0);
-#endif
+  // The owner is likely to be running and about to unlock the mutex: spin
+  // before going to sleep. Only an unlocked mutex may be taken as MtxLocked,
+  // so that the sleepers are not forgotten.
+  for (int i = 0; i < kMutexSpinIterations; i++) {
+    proc_yield(4);
+    cmp = MtxUnlocked;
+    if (atomic_load(m, memory_order_relaxed) == MtxUnlocked &&
+        atomic_compare_exchange_weak(m, &cmp, MtxLocked,
+                                     memory_order_acquire)) {
+      contention_++;
+      return;
+    }
   }
+  while (atomic_exchange(m, MtxSleeping, memory_order_acquire) != MtxUnlocked)
+    FutexWait(m, MtxSleeping);
+  contention_++;
 }
 
 void BlockingMutex::Unlock() {
   atomic_uint32_t *m = reinterpret_cast<atomic_uint32_t *>(&opaque_storage_);
-  u32 v = atomic_exchange(m, MtxUnlocked, memory_order_relaxed);
+  u32 v = atomic_exchange(m, MtxUnlocked, memory_order_release);
   CHECK_NE(v, MtxUnlocked);
-  if (v == MtxSleeping) {
-#if SANITIZER_FREEBSD
-    _umtx_op(m, UMTX_OP_WAKE, 1, 0, 0);
-#else
-    internal_syscall(SYSCALL(futex), (uptr)m, FUTEX_WAKE, 1, 0, 0, 0);
-#endif
-  }
+  if (v == MtxSleeping)
+    FutexWake(m, 1);
 }
 
 void BlockingMutex::CheckLocked() {
@@ -743,6 +802,86 @@ bool internal_sigismember(__sanitizer_sigset_t *set, int signum) {
   const uptr bit = signum % (sizeof(k_set->sig[0]) * 8);
   return k_set->sig[idx] & (1 << bit);
 }
+
+// Returns the cgroup v2 directory of the process, e.g. "/sys/fs/cgroup/a/b".
+static bool GetCgroup2Directory(char *buf, uptr buf_size) {
+  char *cgroups;
+  uptr cgroups_size, cgroups_len;
+  if (!ReadFileToBuffer("/proc/self/cgroup", &cgroups, &cgroups_size,
+                        &cgroups_len, 1 << 16))
+    return false;
+  // The line of the unified hierarchy is "0::<path>".
+  bool found = false;
+  for (char *line = cgroups; line < cgroups + cgroups_len;) {
+    char *end = internal_strchr(line, '\n');
+    if (!end)
+      end = cgroups + cgroups_len;
+    *end = '\0';
+    if (!internal_strncmp(line, "0::", 3)) {
+      // The path of the root cgroup is "/".
+      const char *path = line[3] == '/' && line[4] == '\0' ? "" : line + 3;
+      found = (uptr)internal_snprintf(buf, buf_size, "/sys/fs/cgroup%s",
+                                      path) < buf_size;
+      break;
+    }
+    line = end + 1;
+  }
+  UnmapOrDie(cgroups, cgroups_size);
+  return found;
+}
+
+// Opens a PSI trigger at |path|, which fires when the tasks stall on memory
+// for 100ms within a 2s window. Unprivileged triggers must use a window which
+// is a multiple of 2s.
+static fd_t OpenPressureTrigger(const char *path) {
+  uptr fd = internal_open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (internal_iserror(fd))
+    return kInvalidFd;
+  static const char kTrigger[] = "some 100000 2000000";
+  if (internal_iserror(internal_write(fd, kTrigger, sizeof(kTrigger)))) {
+    internal_close(fd);
+    return kInvalidFd;
+  }
+  return fd;
+}
+
+fd_t OpenMemoryPressureEvents() {
+  char dir[kMaxPathLength];
+  bool have_cgroup = GetCgroup2Directory(dir, sizeof(dir));
+  char path[kMaxPathLength];
+  if (have_cgroup) {
+    internal_snprintf(path, sizeof(path), "%s/memory.pressure", dir);
+    fd_t fd = OpenPressureTrigger(path);
+    if (fd != kInvalidFd)
+      return fd;
+  }
+  fd_t fd = OpenPressureTrigger("/proc/pressure/memory");
+  if (fd != kInvalidFd || !have_cgroup)
+    return fd;
+  // Without PSI, fall back to the notifications of memory.events, which are
+  // sent when the cgroup goes over memory.high or memory.max.
+  internal_snprintf(path, sizeof(path), "%s/memory.events", dir);
+  uptr res = internal_open(path, O_RDONLY | O_CLOEXEC);
+  return internal_iserror(res) ? kInvalidFd : (fd_t)res;
+}
+
+bool WaitForMemoryPressureEvent(fd_t fd, int timeout_ms) {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLPRI;
+  pfd.revents = 0;
+  struct timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+  uptr res = internal_syscall(SYSCALL(ppoll), (uptr)&pfd, 1, (uptr)&ts, 0, 0);
+  if (internal_iserror(res) || !(pfd.revents & POLLPRI))
+    return false;
+  // memory.events only notifies again once it has been read.
+  char buf[256];
+  internal_lseek(fd, 0, SEEK_SET);
+  internal_read(fd, buf, sizeof(buf));
+  return true;
+}
 #endif  // SANITIZER_LINUX
 
 // ThreadLister implementation.
@@ -1569,8 +1708,6 @@ void MaybeReexec() {
   // No need to re-exec on Linux.
 }
 
-void PrintModuleMap() { }
-
 void CheckNoDeepBind(const char *filename, int flag) {
 #ifdef RTLD_DEEPBIND
   if (flag & RTLD_DEEPBIND) {
@@ -47,6 +47,14 @@ int internal_sigaction_norestorer(int signum, const void *act, void *oldact);
 int internal_sigaction_syscall(int signum, const void *act, void *oldact);
 #endif
 void internal_sigdelset(__sanitizer_sigset_t *set, int signum);
+
+// Returns a descriptor which is notified of the memory pressure on the
+// process: a PSI trigger of its cgroup or of the whole system, or the
+// memory.events file of its cgroup. Returns kInvalidFd if none is available.
+fd_t OpenMemoryPressureEvents();
+// Waits for up to |timeout_ms| for an event on a descriptor returned by
+// OpenMemoryPressureEvents. Returns false on timeout or error.
+bool WaitForMemoryPressureEvent(fd_t fd, int timeout_ms);
 #if defined(__x86_64__) || defined(__mips__) || defined(__aarch64__) \
   || defined(__powerpc64__) || defined(__s390__) || defined(__i386__) \
   || defined(__arm__)
@@ -28,6 +28,7 @@
 
 #include <dlfcn.h>  // for dlsym()
 #include <link.h>
+#include <stddef.h>  // for offsetof()
 #include <pthread.h>
 #include <signal.h>
 #include <sys/resource.h>
@@ -427,6 +428,33 @@ struct DlIteratePhdrData {
   bool first;
 };
 
+// Notes have the same layout in 32- and 64-bit ELF files.
+struct ElfNoteHeader {
+  u32 name_size;
+  u32 desc_size;
+  u32 type;
+};
+
+static const u32 kNoteGnuBuildId = 3;  // NT_GNU_BUILD_ID
+
+static void ReadBuildId(LoadedModule *module, uptr notes, uptr notes_size) {
+  uptr pos = 0;
+  while (pos + sizeof(ElfNoteHeader) <= notes_size) {
+    const ElfNoteHeader *note = (const ElfNoteHeader *)(notes + pos);
+    const char *name = (const char *)(note + 1);
+    uptr desc_pos = sizeof(*note) + RoundUpTo(note->name_size, 4);
+    uptr note_size = desc_pos + RoundUpTo(note->desc_size, 4);
+    if (note_size > notes_size - pos)
+      return;
+    if (note->type == kNoteGnuBuildId && note->name_size == 4 &&
+        internal_memcmp(name, "GNU", 4) == 0) {
+      module->setBuildId((const u8 *)note + desc_pos, note->desc_size);
+      return;
+    }
+    pos += note_size;
+  }
+}
+
 static int dl_iterate_phdr_cb(dl_phdr_info *info, size_t size, void *arg) {
   DlIteratePhdrData *data = (DlIteratePhdrData*)arg;
   InternalScopedString module_name(kMaxPathLength);
@@ -448,6 +476,9 @@ static int dl_iterate_phdr_cb(dl_phdr_info *info, size_t size, void *arg) {
       uptr cur_end = cur_beg + phdr->p_memsz;
       bool executable = phdr->p_flags & PF_X;
       cur_module.addAddressRange(cur_beg, cur_end, executable);
+    } else if (phdr->p_type == PT_NOTE && !cur_module.build_id_size()) {
+      ReadBuildId(&cur_module, info->dlpi_addr + phdr->p_vaddr,
+                  phdr->p_memsz);
     }
   }
   data->modules->push_back(cur_module);
@@ -459,8 +490,31 @@ extern "C" __attribute__((weak)) int dl_iterate_phdr(
     int (*)(struct dl_phdr_info *, size_t, void *), void *);
 #endif
 
+#if SANITIZER_LINUX && !SANITIZER_ANDROID
+static int modules_generation_cb(dl_phdr_info *info, size_t size, void *arg) {
+  // dlpi_adds and dlpi_subs are there since glibc 2.4.
+  if (size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+    *(uptr *)arg = info->dlpi_adds + info->dlpi_subs;
+  // The counters are the same for all modules.
+  return 1;
+}
+#endif
+
+uptr GetModulesGeneration() {
+#if SANITIZER_LINUX && !SANITIZER_ANDROID
+  uptr generation = 0;
+  dl_iterate_phdr(modules_generation_cb, &generation);
+  return generation;
+#else
+  return 0;
+#endif
+}
+
 void ListOfModules::init() {
   clear();
+  // Read the generation first, so that modules loaded while the list is
+  // being built make it stale.
+  generation_ = GetModulesGeneration();
 #if SANITIZER_ANDROID && __ANDROID_API__ <= 22
   u32 api_level = AndroidGetApiLevel();
   // Fall back to /proc/maps if dl_iterate_phdr is unavailable or broken.
@@ -476,6 +530,19 @@ void ListOfModules::init() {
   dl_iterate_phdr(dl_iterate_phdr_cb, &data);
 }
 
+// Prints the load addresses of the modules, so that reports printed with
+// symbolize=0 can be symbolized offline.
+void PrintModuleMap() {
+  Printf("Process module map:\n");
+  ListOfModules modules;
+  modules.init();
+  for (uptr i = 0; i < modules.size(); ++i) {
+    Printf("0x%zx-0x%zx %s\n", modules[i].base_address(),
+           modules[i].max_executable_address(), modules[i].full_name());
+  }
+  Printf("End of module map.\n");
+}
+
 // getrusage does not give us the current RSS, only the max RSS.
 // Still, this is better than nothing if /proc/self/statm is not available
 // for some reason, e.g. due to a sandbox.
@@ -515,6 +582,32 @@ uptr GetRSS() {
   return rss * GetPageSizeCached();
 }
 
+static uptr ReadMemoryLimitFile(const char *path) {
+  fd_t fd = OpenFile(path, RdOnly);
+  if (fd == kInvalidFd)
+    return 0;
+  char buf[64];
+  uptr len = internal_read(fd, buf, sizeof(buf) - 1);
+  internal_close(fd);
+  if ((sptr)len <= 0)
+    return 0;
+  buf[len] = 0;
+  // cgroup v2 says "max" when there is no limit, v1 a huge number.
+  u64 limit = 0;
+  for (char *pos = buf; *pos >= '0' && *pos <= '9'; pos++) {
+    limit = limit * 10 + *pos - '0';
+    if (limit >= (1ULL << 60))
+      return 0;
+  }
+  return (uptr)Min<u64>(limit, (uptr)-1);
+}
+
+uptr GetCgroupMemoryLimit() {
+  if (uptr limit = ReadMemoryLimitFile("/sys/fs/cgroup/memory.max"))
+    return limit;
+  return ReadMemoryLimitFile("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+}
+
 // 64-bit Android targets don't provide the deprecated __android_log_write.
 // Starting with the L release, syslog() works and is preferable to
 // __android_log_write.
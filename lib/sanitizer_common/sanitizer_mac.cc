@@ -349,7 +349,10 @@ void BlockingMutex::Lock() {
   CHECK(sizeof(OSSpinLock) <= sizeof(opaque_storage_));
   CHECK_EQ(OS_SPINLOCK_INIT, 0);
   CHECK_EQ(owner_, 0);
+  if (OSSpinLockTry((OSSpinLock*)&opaque_storage_))
+    return;
   OSSpinLockLock((OSSpinLock*)&opaque_storage_);
+  contention_++;
 }
 
 void BlockingMutex::Unlock() {
@@ -360,10 +363,28 @@ void BlockingMutex::CheckLocked() {
   CHECK_NE(*(OSSpinLock*)&opaque_storage_, 0);
 }
 
+// There is no public futex-like API: the waiters spin.
+void FutexWait(atomic_uint32_t *p, u32 cmp) {
+  internal_sched_yield();
+}
+
+void FutexWake(atomic_uint32_t *p, u32 count) {}
+
 u64 NanoTime() {
   return 0;
 }
 
+uptr GetNumaNode() {
+  return 0;
+}
+
+void BindMemoryToNumaNode(uptr addr, uptr size, uptr node) {
+}
+
+bool GrowMappingInPlace(uptr addr, uptr old_size, uptr new_size) {
+  return false;
+}
+
 uptr GetTlsSize() {
   return 0;
 }
@@ -388,6 +409,8 @@ void GetThreadStackAndTls(bool main, uptr *stk_addr, uptr *stk_size,
 #endif
 }
 
+uptr GetModulesGeneration() { return 0; }
+
 void ListOfModules::init() {
   clear();
   MemoryMappingLayout memory_mapping(false);
@@ -473,6 +496,10 @@ uptr GetRSS() {
   return info.resident_size;
 }
 
+uptr GetCgroupMemoryLimit() {
+  return 0;
+}
+
 void *internal_start_thread(void(*func)(void *arg), void *arg) {
   // Start the thread with signals blocked, otherwise it can steal user signals.
   __sanitizer_sigset_t set, old;
@@ -71,6 +71,16 @@ class SpinMutex : public StaticSpinMutex {
   void operator=(const SpinMutex&);
 };
 
+// Blocks while *p == cmp, until FutexWake(p); may also return spuriously.
+// Where there is no futex, it yields instead.
+void FutexWait(atomic_uint32_t *p, u32 cmp);
+// Wakes up to count threads blocked in FutexWait(p).
+void FutexWake(atomic_uint32_t *p, u32 count);
+
+// Waiters for the mutexes below spin this many times, for a few microseconds,
+// before they sleep.
+static const int kMutexSpinIterations = 32;
+
 class BlockingMutex {
  public:
 #if SANITIZER_WINDOWS
@@ -78,7 +88,7 @@ class BlockingMutex {
   explicit BlockingMutex(LinkerInitialized);
 #else
   explicit constexpr BlockingMutex(LinkerInitialized)
-      : opaque_storage_ {0, }, owner_(0) {}
+      : opaque_storage_ {0, }, owner_(0), contention_(0) {}
 #endif
   BlockingMutex();
   void Lock();
@@ -92,12 +102,20 @@ class BlockingMutex {
   // checks that the mutex is owned, and assumes callers to be generally
   // well-behaved.
   void CheckLocked();
+
+  // The number of times Lock() found the mutex locked.
+  uptr ContentionCount() const { return contention_; }
+
  private:
   uptr opaque_storage_[10];
   uptr owner_;  // for debugging
+  uptr contention_;  // Updated with the mutex held.
 };
 
-// Reader-writer spin mutex.
+// Reader-writer mutex. Writers are preferred: once a writer waits, new
+// readers wait too. Waiters spin for a while, and then sleep on a futex.
+// The mutex is a single word, to keep the buckets of AddrHashMap in a cache
+// line.
 class RWMutex {
  public:
   RWMutex() {
@@ -117,14 +135,17 @@ class RWMutex {
   }
 
   void Unlock() {
-    u32 prev = atomic_fetch_sub(&state_, kWriteLock, memory_order_release);
+    u32 prev = ClearBits(kWriteLock | kSleeping);
     DCHECK_NE(prev & kWriteLock, 0);
-    (void)prev;
+    if (prev & kSleeping)
+      FutexWake(&state_, kMaxWaiters);
   }
 
   void ReadLock() {
-    u32 prev = atomic_fetch_add(&state_, kReadLock, memory_order_acquire);
-    if ((prev & kWriteLock) == 0)
+    u32 cmp = atomic_load(&state_, memory_order_relaxed);
+    if ((cmp & kWriterMask) == 0 &&
+        atomic_compare_exchange_weak(&state_, &cmp, cmp + kReadLock,
+                                     memory_order_acquire))
       return;
     ReadLockSlow();
   }
@@ -132,8 +153,11 @@ class RWMutex {
   void ReadUnlock() {
     u32 prev = atomic_fetch_sub(&state_, kReadLock, memory_order_release);
     DCHECK_EQ(prev & kWriteLock, 0);
-    DCHECK_GT(prev & ~kWriteLock, 0);
-    (void)prev;
+    DCHECK_GE(prev, kReadLock);
+    // Only writers wait for the readers.
+    if ((prev & ~(kWaitingWriterMask | kSleeping)) == kReadLock &&
+        (prev & kSleeping) && (ClearBits(kSleeping) & kSleeping))
+      FutexWake(&state_, kMaxWaiters);
   }
 
   void CheckLocked() {
@@ -146,33 +170,77 @@ class RWMutex {
   enum {
     kUnlocked = 0,
     kWriteLock = 1,
-    kReadLock = 2
+    // Set by the threads sleeping in FutexWait(), cleared by the unlocking
+    // thread which wakes them all up.
+    kSleeping = 2,
+    kWaitingWriter = 4,
+    kWaitingWriterMask = 0xfffc,
+    kWriterMask = kWriteLock | kWaitingWriterMask,
+    kReadLock = 1 << 16,
+    kMaxWaiters = 1 << 30
   };
 
-  void NOINLINE LockSlow() {
-    for (int i = 0;; i++) {
-      if (i < 10)
-        proc_yield(10);
-      else
-        internal_sched_yield();
-      u32 cmp = atomic_load(&state_, memory_order_relaxed);
-      if (cmp == kUnlocked &&
-          atomic_compare_exchange_weak(&state_, &cmp, kWriteLock,
+  u32 ClearBits(u32 bits) {
+    u32 cmp = atomic_load(&state_, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak(&state_, &cmp, cmp & ~bits,
+                                         memory_order_release)) {
+    }
+    return cmp;
+  }
+
+  // Returns false if the thread has to wait.
+  bool TryLockSlow(bool waiting) {
+    u32 cmp = atomic_load(&state_, memory_order_relaxed);
+    while ((cmp & ~(kWaitingWriterMask | kSleeping)) == kUnlocked) {
+      u32 xch = (cmp - (waiting ? kWaitingWriter : 0)) | kWriteLock;
+      if (atomic_compare_exchange_weak(&state_, &cmp, xch,
                                        memory_order_acquire))
-          return;
+        return true;
     }
+    return false;
+  }
+
+  bool TryReadLockSlow() {
+    u32 cmp = atomic_load(&state_, memory_order_relaxed);
+    while ((cmp & kWriterMask) == 0) {
+      if (atomic_compare_exchange_weak(&state_, &cmp, cmp + kReadLock,
+                                       memory_order_acquire))
+        return true;
+    }
+    return false;
+  }
+
+  // Sleeps while one of the blocking bits is set, until the state changes.
+  void Wait(u32 blocking) {
+    u32 cmp = atomic_load(&state_, memory_order_relaxed);
+    if ((cmp & blocking) == 0)
+      return;
+    if ((cmp & kSleeping) == 0 &&
+        !atomic_compare_exchange_strong(&state_, &cmp, cmp | kSleeping,
+                                        memory_order_relaxed))
+      return;
+    FutexWait(&state_, cmp | kSleeping);
+  }
+
+  void NOINLINE LockSlow() {
+    for (int i = 0; i < kMutexSpinIterations; i++) {
+      proc_yield(4);
+      if (TryLockSlow(false))
+        return;
+    }
+    atomic_fetch_add(&state_, kWaitingWriter, memory_order_relaxed);
+    while (!TryLockSlow(true))
+      Wait(~(kWaitingWriterMask | kSleeping));
   }
 
   void NOINLINE ReadLockSlow() {
-    for (int i = 0;; i++) {
-      if (i < 10)
-        proc_yield(10);
-      else
-        internal_sched_yield();
-      u32 prev = atomic_load(&state_, memory_order_acquire);
-      if ((prev & kWriteLock) == 0)
+    for (int i = 0; i < kMutexSpinIterations; i++) {
+      proc_yield(4);
+      if (TryReadLockSlow())
         return;
     }
+    while (!TryReadLockSlow())
+      Wait(kWriterMask);
   }
 
   RWMutex(const RWMutex&);
@@ -16,4 +16,92 @@ namespace __sanitizer {
 
 PersistentAllocator thePersistentAllocator;
 
+#if SANITIZER_PERSISTENT_ALLOCATOR_SLABS
+// The bump pointer into the current slab of the thread, 0 if it has none.
+// Never points to the end of a slab, so it always identifies the slab.
+static THREADLOCAL atomic_uintptr_t persistent_slab_pos;
+#endif
+
+PersistentAllocator::Arena *PersistentAllocator::currentArena() {
+  if (kNumNodes == 1)
+    return &arenas[0];
+  return &arenas[GetNumaNode() % kNumNodes];
+}
+
+void *PersistentAllocator::tryAlloc(Arena *arena, uptr size, uptr align) {
+  // Optimisic lock-free allocation, essentially try to bump the region ptr.
+  for (;;) {
+    uptr cmp = atomic_load(&arena->region_pos, memory_order_acquire);
+    uptr end = atomic_load(&arena->region_end, memory_order_acquire);
+    if (cmp == 0) return nullptr;
+    uptr res = RoundUpTo(cmp, align);
+    if (res + size > end) return nullptr;
+    if (atomic_compare_exchange_weak(&arena->region_pos, &cmp, res + size,
+                                     memory_order_acquire)) {
+      if (res != cmp)
+        atomic_fetch_add(&wasted, res - cmp, memory_order_relaxed);
+      return (void *)res;
+    }
+  }
+}
+
+void *PersistentAllocator::arenaAlloc(Arena *arena, uptr size, uptr align) {
+  // First, try to allocate optimisitically.
+  void *s = tryAlloc(arena, size, align);
+  if (s) return s;
+  // If failed, lock, retry and alloc new superblock.
+  SpinMutexLock l(&arena->mtx);
+  for (;;) {
+    s = tryAlloc(arena, size, align);
+    if (s) return s;
+    uptr pos = atomic_load(&arena->region_pos, memory_order_relaxed);
+    uptr end = atomic_load(&arena->region_end, memory_order_relaxed);
+    atomic_store(&arena->region_pos, 0, memory_order_relaxed);
+    if (pos)
+      atomic_fetch_add(&wasted, end - pos, memory_order_relaxed);
+    uptr allocsz = kSuperblockSize;
+    if (allocsz < size) allocsz = size;
+    uptr mem = (uptr)MmapOrDie(allocsz, "stack depot");
+    if (kNumNodes > 1)
+      BindMemoryToNumaNode(mem, allocsz, arena - arenas);
+    atomic_fetch_add(&mapped, allocsz, memory_order_relaxed);
+    atomic_store(&arena->region_end, mem + allocsz, memory_order_release);
+    atomic_store(&arena->region_pos, mem, memory_order_release);
+  }
+}
+
+void *PersistentAllocator::slabAlloc(uptr size) {
+#if SANITIZER_PERSISTENT_ALLOCATOR_SLABS
+  atomic_uintptr_t *slab_pos = &persistent_slab_pos;
+  uptr cmp = atomic_load(slab_pos, memory_order_relaxed);
+  while (cmp && (cmp & (kSlabSize - 1)) + size < kSlabSize) {
+    if (atomic_compare_exchange_weak(slab_pos, &cmp, cmp + size,
+                                     memory_order_relaxed))
+      return (void *)cmp;
+  }
+  uptr slab = (uptr)arenaAlloc(currentArena(), kSlabSize, kSlabSize);
+  // A signal handler may have replaced the slab in the meantime, its tail is
+  // accounted either way.
+  uptr old = atomic_exchange(slab_pos, slab + size, memory_order_relaxed);
+  if (old)
+    atomic_fetch_add(&wasted, kSlabSize - (old & (kSlabSize - 1)),
+                     memory_order_relaxed);
+  return (void *)slab;
+#else
+  return nullptr;
+#endif
+}
+
+void *PersistentAllocator::alloc(uptr size) {
+  if (SANITIZER_PERSISTENT_ALLOCATOR_SLABS && size &&
+      size <= kMaxSlabAllocSize)
+    return slabAlloc(size);
+  return arenaAlloc(currentArena(), size, 1);
+}
+
+void PersistentAllocator::getStats(uptr *mapped_bytes, uptr *wasted_bytes) {
+  *mapped_bytes = atomic_load(&mapped, memory_order_relaxed);
+  *wasted_bytes = atomic_load(&wasted, memory_order_relaxed);
+}
+
 }  // namespace __sanitizer
@@ -18,49 +18,56 @@
 #include "sanitizer_mutex.h"
 #include "sanitizer_atomic.h"
 #include "sanitizer_common.h"
+#include "sanitizer_platform.h"
 
 namespace __sanitizer {
 
+// Superblocks are mmapped per NUMA node (CMake: COMPILER_RT_ALLOCATOR_NUMA,
+// as for the primary allocator) and carved into per-thread slabs, which their
+// thread bumps with uncontended atomic operations, as signal handlers may
+// allocate too. Larger allocations go to the superblock of the node directly.
+// Thread-local storage is not used in the Go runtime.
+#ifndef SANITIZER_ALLOCATOR_NUMA
+# define SANITIZER_ALLOCATOR_NUMA 0
+#endif
+#ifndef SANITIZER_ALLOCATOR_NUMA_NODES
+# define SANITIZER_ALLOCATOR_NUMA_NODES 2
+#endif
+#define SANITIZER_PERSISTENT_ALLOCATOR_SLABS !SANITIZER_GO
+
 class PersistentAllocator {
  public:
   void *alloc(uptr size);
+  // Bytes mapped for the allocations, and the part of them lost to the unused
+  // tails of retired slabs and superblocks, and to the alignment of slabs.
+  void getStats(uptr *mapped, uptr *wasted);
 
  private:
-  void *tryAlloc(uptr size);
-  StaticSpinMutex mtx;  // Protects alloc of new blocks for region allocator.
-  atomic_uintptr_t region_pos;  // Region allocator for Node's.
-  atomic_uintptr_t region_end;
-};
+  static const uptr kNumNodes =
+      SANITIZER_ALLOCATOR_NUMA && SANITIZER_LINUX
+          ? SANITIZER_ALLOCATOR_NUMA_NODES : 1;
+  static const uptr kSuperblockSize = 64 * 1024;
+  // Slabs are aligned to their size, so that the bump pointer of a thread
+  // also tells where its slab ends.
+  static const uptr kSlabSize = 4 * 1024;
+  static const uptr kMaxSlabAllocSize = kSlabSize / 4;
 
-inline void *PersistentAllocator::tryAlloc(uptr size) {
-  // Optimisic lock-free allocation, essentially try to bump the region ptr.
-  for (;;) {
-    uptr cmp = atomic_load(&region_pos, memory_order_acquire);
-    uptr end = atomic_load(&region_end, memory_order_acquire);
-    if (cmp == 0 || cmp + size > end) return nullptr;
-    if (atomic_compare_exchange_weak(&region_pos, &cmp, cmp + size,
-                                     memory_order_acquire))
-      return (void *)cmp;
-  }
-}
+  // The superblocks of a NUMA node.
+  struct Arena {
+    StaticSpinMutex mtx;  // Protects alloc of new blocks for region allocator.
+    atomic_uintptr_t region_pos;  // Region allocator for Node's.
+    atomic_uintptr_t region_end;
+  };
 
-inline void *PersistentAllocator::alloc(uptr size) {
-  // First, try to allocate optimisitically.
-  void *s = tryAlloc(size);
-  if (s) return s;
-  // If failed, lock, retry and alloc new superblock.
-  SpinMutexLock l(&mtx);
-  for (;;) {
-    s = tryAlloc(size);
-    if (s) return s;
-    atomic_store(&region_pos, 0, memory_order_relaxed);
-    uptr allocsz = 64 * 1024;
-    if (allocsz < size) allocsz = size;
-    uptr mem = (uptr)MmapOrDie(allocsz, "stack depot");
-    atomic_store(&region_end, mem + allocsz, memory_order_release);
-    atomic_store(&region_pos, mem, memory_order_release);
-  }
-}
+  Arena *currentArena();
+  void *tryAlloc(Arena *arena, uptr size, uptr align);
+  void *arenaAlloc(Arena *arena, uptr size, uptr align);
+  void *slabAlloc(uptr size);
+
+  Arena arenas[kNumNodes];
+  atomic_uintptr_t mapped;
+  atomic_uintptr_t wasted;
+};
 
 extern PersistentAllocator thePersistentAllocator;
 inline void *PersistentAlloc(uptr sz) {
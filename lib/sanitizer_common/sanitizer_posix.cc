@@ -322,15 +322,30 @@ bool IsAbsolutePath(const char *path) {
   return path != nullptr && IsPathSeparator(path[0]);
 }
 
-void ReportFile::Write(const char *buffer, uptr length) {
-  SpinMutexLock l(mu);
+void ReportFile::RotateIfNecessary(uptr length) {
+  mu->CheckLocked();
+  // A single write is never split, even if it is larger than max_size.
+  if (!max_size || fd == kStdoutFd || fd == kStderrFd || fd == kInvalidFd ||
+      !written || written + length <= max_size)
+    return;
+  char old_path[kMaxPathLength];
+  internal_snprintf(old_path, kMaxPathLength, "%s.1", full_path);
+  CloseFile(fd);
+  fd = kInvalidFd;
+  internal_rename(full_path, old_path);
+  ReopenIfNecessary();
+}
+
+void ReportFile::WriteLocked(const char *buffer, uptr length) {
   static const char *kWriteError =
       "ReportFile::Write() can't output requested buffer!\n";
   ReopenIfNecessary();
+  RotateIfNecessary(length);
   if (length != internal_write(fd, buffer, length)) {
     internal_write(fd, kWriteError, internal_strlen(kWriteError));
     Die();
   }
+  written += length;
 }
 
 bool GetCodeRangeForFile(const char *module, uptr *start, uptr *end) {
@@ -70,12 +70,72 @@ void NoHugePagesInRegion(uptr addr, uptr size) {
 #endif  // MADV_NOHUGEPAGE
 }
 
+void UseHugePagesInRegion(uptr addr, uptr size) {
+#ifdef MADV_HUGEPAGE  // May not be defined on old systems.
+  madvise((void *)addr, size, MADV_HUGEPAGE);
+#endif  // MADV_HUGEPAGE
+}
+
 void DontDumpShadowMemory(uptr addr, uptr length) {
 #ifdef MADV_DONTDUMP
   madvise((void *)addr, length, MADV_DONTDUMP);
 #endif
 }
 
+#ifdef MADV_DONTFORK
+// The ranges are only marked MADV_DONTFORK while fork() runs, so that a raw
+// fork syscall, which does not call the pthread_atfork handlers, still copies
+// them.
+static const uptr kMaxDontForkRanges = 4;
+static struct {
+  uptr addr;
+  uptr length;
+} dont_fork_ranges[kMaxDontForkRanges];
+static uptr num_dont_fork_ranges;
+
+static void AdviseDontForkRanges(int advice) {
+  for (uptr i = 0; i < num_dont_fork_ranges; i++)
+    madvise((void *)dont_fork_ranges[i].addr, dont_fork_ranges[i].length,
+            advice);
+}
+
+static void DontForkBeforeFork() { AdviseDontForkRanges(MADV_DONTFORK); }
+
+static void DontForkParentAfterFork() { AdviseDontForkRanges(MADV_DOFORK); }
+
+// Runs before the pthread_atfork handlers of the program, which may be
+// instrumented and access the shadow.
+static void DontForkChildAfterFork() {
+  for (uptr i = 0; i < num_dont_fork_ranges; i++) {
+    uptr addr = dont_fork_ranges[i].addr;
+    uptr length = dont_fork_ranges[i].length;
+    // The new pages are zeroed on first access.
+    if ((uptr)MmapFixedNoReserve(addr, length, nullptr) != addr) {
+      Report("ERROR: %s failed to map the shadow of the forked child\n",
+             SanitizerToolName);
+      Die();
+    }
+    DecreaseTotalMmap(length);  // Not counted against mmap_limit_mb.
+    if (common_flags()->no_huge_pages_for_shadow)
+      NoHugePagesInRegion(addr, length);
+    if (common_flags()->use_madv_dontdump)
+      DontDumpShadowMemory(addr, length);
+  }
+}
+#endif  // MADV_DONTFORK
+
+void DontForkShadowMemory(uptr addr, uptr length) {
+#ifdef MADV_DONTFORK
+  CHECK_LT(num_dont_fork_ranges, kMaxDontForkRanges);
+  if (num_dont_fork_ranges == 0)
+    pthread_atfork(DontForkBeforeFork, DontForkParentAfterFork,
+                   DontForkChildAfterFork);
+  dont_fork_ranges[num_dont_fork_ranges].addr = addr;
+  dont_fork_ranges[num_dont_fork_ranges].length = length;
+  num_dont_fork_ranges++;
+#endif  // MADV_DONTFORK
+}
+
 static rlim_t getlim(int res) {
   rlimit rlim;
   CHECK_EQ(0, getrlimit(res, &rlim));
@@ -17,9 +17,11 @@
 #ifndef SANITIZER_QUARANTINE_H
 #define SANITIZER_QUARANTINE_H
 
+#include "sanitizer_common.h"
 #include "sanitizer_internal_defs.h"
 #include "sanitizer_mutex.h"
 #include "sanitizer_list.h"
+#include "sanitizer_self_profile.h"
 
 namespace __sanitizer {
 
@@ -71,12 +73,15 @@ COMPILER_CHECK(sizeof(QuarantineBatch) <= (1 << 13));  // 8Kb.
 
 // The callback interface is:
 // void Callback::Recycle(Node *ptr);
+// void Callback::RecycleBatch(Node **ptrs, uptr count);
 // void *cb.Allocate(uptr size);
 // void cb.Deallocate(void *ptr);
 template<typename Callback, typename Node>
 class Quarantine {
  public:
   typedef QuarantineCache<Callback> Cache;
+  // How often the background recycler checks the quarantine size.
+  static const int kBackgroundRecycleIntervalMs = 1;
 
   explicit Quarantine(LinkerInitialized)
       : cache_(LINKER_INITIALIZED) {
@@ -94,6 +99,8 @@ class Quarantine {
   }
 
   uptr GetSize() const { return atomic_load(&max_size_, memory_order_relaxed); }
+  // Memory held by the global quarantine, not counting the per-thread caches.
+  uptr GetQuarantinedSize() const { return cache_.Size(); }
   uptr GetCacheSize() const {
     return atomic_load(&max_cache_size_, memory_order_relaxed);
   }
@@ -116,10 +123,30 @@ class Quarantine {
       SpinMutexLock l(&cache_mutex_);
       cache_.Transfer(c);
     }
-    if (cache_.Size() > GetSize() && recycle_mutex_.TryLock())
+    // With a background recycler, the producers only recycle the quarantine
+    // themselves once it gets to twice its maximum size, as a back-pressure.
+    uptr max_size = GetSize();
+    if (atomic_load(&recycle_in_background_, memory_order_relaxed))
+      max_size *= 2;
+    if (cache_.Size() > max_size && recycle_mutex_.TryLock())
       Recycle(cb);
   }
 
+  // Keeps the quarantine below its maximum size from the calling thread, which
+  // is meant to be dedicated to it: the chunks are then no longer recycled
+  // inline by the thread that happens to fill the quarantine up. Never
+  // returns. cb must be usable from the calling thread only (e.g. have an
+  // allocator cache of its own).
+  void NORETURN RecycleInBackground(Callback cb) {
+    atomic_store(&recycle_in_background_, 1, memory_order_relaxed);
+    while (true) {
+      if (cache_.Size() > GetSize() && recycle_mutex_.TryLock())
+        Recycle(cb);
+      else
+        SleepForMillis(kBackgroundRecycleIntervalMs);
+    }
+  }
+
   void PrintStats() const {
     // It assumes that the world is stopped, just as the allocator's PrintStats.
     Printf("Quarantine limits: global: %zdMb; thread local: %zdKb\n",
@@ -133,6 +160,7 @@ class Quarantine {
   atomic_uintptr_t max_size_;
   atomic_uintptr_t min_size_;
   atomic_uintptr_t max_cache_size_;
+  atomic_uint8_t recycle_in_background_;
   char pad1_[kCacheLineSize];
   SpinMutex cache_mutex_;
   SpinMutex recycle_mutex_;
@@ -172,15 +200,24 @@ class Quarantine {
   }
 
   void NOINLINE DoRecycle(Cache *c, Callback cb) {
+    ScopedSelfProfile self_profile(kSelfProfileQuarantineRecycle);
     while (QuarantineBatch *b = c->DequeueBatch()) {
       const uptr kPrefetch = 16;
       CHECK(kPrefetch <= ARRAY_SIZE(b->batch));
       for (uptr i = 0; i < kPrefetch; i++)
         PREFETCH(b->batch[i]);
-      for (uptr i = 0, count = b->count; i < count; i++) {
-        if (i + kPrefetch < count)
-          PREFETCH(b->batch[i + kPrefetch]);
-        cb.Recycle((Node*)b->batch[i]);
+      // The chunks are handed to the callback a few at a time, so that it can
+      // overlap the per chunk work (e.g. verifying a checksum) between them.
+      const uptr kRecycleBatch = 8;
+      Node *nodes[kRecycleBatch];
+      for (uptr i = 0, count = b->count; i < count; i += kRecycleBatch) {
+        uptr n = Min(kRecycleBatch, count - i);
+        for (uptr j = 0; j < n; j++) {
+          if (i + j + kPrefetch < count)
+            PREFETCH(b->batch[i + j + kPrefetch]);
+          nodes[j] = (Node*)b->batch[i + j];
+        }
+        cb.RecycleBatch(nodes, n);
       }
       cb.Deallocate(b);
     }
@@ -0,0 +1,59 @@
+//===-- sanitizer_report_bundle.h -------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between AddressSanitizer and ThreadSanitizer
+// run-time libraries.
+// Binary report bundles for offline symbolization (offline_report_path=).
+//===----------------------------------------------------------------------===//
+#ifndef SANITIZER_REPORT_BUNDLE_H
+#define SANITIZER_REPORT_BUNDLE_H
+
+#include "sanitizer_internal_defs.h"
+
+namespace __sanitizer {
+
+// A bundle is written to <offline_report_path>.<pid> and holds, in host byte
+// order, a ReportBundleHeader followed by records that each start with a
+// ReportBundleRecord. A module map (one kBundleModule record per module) is
+// written before the first stack or data record, and written again whenever
+// a PC is outside all of its modules; a module record that follows a stack or
+// data record starts a new map.
+const u64 kReportBundleMagic = 0x4c444e5542534e53ULL;  // "SNSBUNDL"
+const u32 kReportBundleVersion = 1;
+
+struct ReportBundleHeader {
+  u64 magic;
+  u32 version;
+  u32 pointer_size;
+};
+
+enum ReportBundleRecordKind {
+  // uptr begin, uptr end, u32 build id size, u32 name size, then the build id
+  // and the name, both without padding.
+  kBundleModule = 1,
+  // Frame PCs, innermost first, adjusted to point into the call instructions
+  // as they are printed.
+  kBundleStack = 2,
+  // One uptr, a data address described by the report.
+  kBundleData = 3,
+};
+
+struct ReportBundleRecord {
+  u32 kind;
+  // Size of the payload that follows.
+  u32 size;
+};
+
+bool ReportBundleEnabled();
+void WriteStackToReportBundle(const uptr *pcs, uptr count);
+void WriteDataToReportBundle(uptr addr);
+
+}  // namespace __sanitizer
+
+#endif  // SANITIZER_REPORT_BUNDLE_H
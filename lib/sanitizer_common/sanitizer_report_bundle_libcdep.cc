@@ -0,0 +1,124 @@
+//===-- sanitizer_report_bundle_libcdep.cc --------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between AddressSanitizer and ThreadSanitizer
+// run-time libraries.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_report_bundle.h"
+
+#include "sanitizer_common.h"
+#include "sanitizer_flags.h"
+#include "sanitizer_placement_new.h"
+
+namespace __sanitizer {
+
+static StaticSpinMutex bundle_file_mu;
+static ReportFile bundle_file = {&bundle_file_mu, kInvalidFd, "", "", 0};
+
+// Protects the fields below and keeps records from interleaving.
+static StaticSpinMutex bundle_mu;
+static bool bundle_initialized;
+// The process that wrote the header of the open bundle; a forked child
+// writes its own bundle.
+static uptr bundle_pid;
+static ListOfModules *bundle_modules;
+static bool bundle_modules_written;
+
+bool ReportBundleEnabled() {
+  const char *path = common_flags()->offline_report_path;
+  return path && path[0];
+}
+
+static void WriteRecord(u32 kind, const void *payload, uptr size) {
+  ReportBundleRecord record = {kind, (u32)size};
+  bundle_file.Write((const char *)&record, sizeof(record));
+  if (size)
+    bundle_file.Write((const char *)payload, size);
+}
+
+static void WriteModuleMap() {
+  bundle_modules->init();
+  for (const LoadedModule &module : *bundle_modules) {
+    uptr end = 0;
+    for (const LoadedModule::AddressRange &r : module.ranges())
+      end = Max(end, r.end);
+    u32 build_id_size = module.build_id_size();
+    u32 name_size = internal_strlen(module.full_name());
+    uptr fixed[2] = {module.base_address(), end};
+    u32 sizes[2] = {build_id_size, name_size};
+    ReportBundleRecord record = {
+        kBundleModule,
+        (u32)(sizeof(fixed) + sizeof(sizes) + build_id_size + name_size)};
+    bundle_file.Write((const char *)&record, sizeof(record));
+    bundle_file.Write((const char *)fixed, sizeof(fixed));
+    bundle_file.Write((const char *)sizes, sizeof(sizes));
+    if (build_id_size)
+      bundle_file.Write((const char *)module.build_id(), build_id_size);
+    bundle_file.Write(module.full_name(), name_size);
+  }
+  bundle_modules_written = true;
+}
+
+static bool IsInModuleMap(uptr addr) {
+  for (const LoadedModule &module : *bundle_modules)
+    if (module.containsAddress(addr))
+      return true;
+  return false;
+}
+
+// Opens the bundle if this process has not written to one yet, and makes sure
+// the module map covers the given PCs. Must be called with bundle_mu held.
+static void PrepareBundle(const uptr *pcs, uptr count) {
+  if (!bundle_initialized) {
+    static ALIGNED(64) char modules_placeholder[sizeof(ListOfModules)];
+    bundle_modules = new(modules_placeholder) ListOfModules();
+    bundle_file.SetReportPath(common_flags()->offline_report_path);
+    bundle_initialized = true;
+  }
+  uptr pid = internal_getpid();
+  // The tracer of StopTheWorld writes to its parent's bundle.
+  if (pid == stoptheworld_tracer_pid)
+    pid = stoptheworld_tracer_ppid;
+  if (bundle_pid != pid) {
+    ReportBundleHeader header = {kReportBundleMagic, kReportBundleVersion,
+                                 sizeof(uptr)};
+    bundle_file.Write((const char *)&header, sizeof(header));
+    bundle_pid = pid;
+    bundle_modules_written = false;
+  }
+  if (bundle_modules_written) {
+    for (uptr i = 0; i < count; i++) {
+      if (!IsInModuleMap(pcs[i])) {
+        bundle_modules_written = false;
+        break;
+      }
+    }
+  }
+  if (!bundle_modules_written) {
+    WriteModuleMap();
+    VReport(1, "Writing raw reports to %s\n", bundle_file.full_path);
+  }
+}
+
+void WriteStackToReportBundle(const uptr *pcs, uptr count) {
+  SpinMutexLock l(&bundle_mu);
+  PrepareBundle(pcs, count);
+  WriteRecord(kBundleStack, pcs, count * sizeof(pcs[0]));
+}
+
+void WriteDataToReportBundle(uptr addr) {
+  SpinMutexLock l(&bundle_mu);
+  // Data addresses are often on the heap or a stack; they don't make the
+  // module map stale.
+  PrepareBundle(nullptr, 0);
+  WriteRecord(kBundleData, &addr, sizeof(addr));
+}
+
+}  // namespace __sanitizer
@@ -0,0 +1,99 @@
+//===-- sanitizer_self_profile.cc -----------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between the sanitizer run-time libraries.
+// Cycle accounting for the hot paths of the runtimes and timing of their
+// initialization.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_self_profile.h"
+
+#include "sanitizer_atomic.h"
+#include "sanitizer_common.h"
+
+namespace __sanitizer {
+
+static const char *const kSelfProfileRegionNames[kSelfProfileRegionCount] = {
+    "interceptors", "stack unwinding", "stack depot put",
+    "quarantine recycling", "symbolization"};
+
+// A thread adds its counts to the global ones every this many calls.
+static const u32 kSelfProfileFlushPeriod = 64;
+
+struct SelfProfileCounters {
+  u64 calls[kSelfProfileRegionCount];
+  u64 cycles[kSelfProfileRegionCount];
+  u32 unflushed_calls;
+};
+
+static THREADLOCAL SelfProfileCounters thread_self_profile;
+static atomic_uint64_t self_profile_calls[kSelfProfileRegionCount];
+static atomic_uint64_t self_profile_cycles[kSelfProfileRegionCount];
+
+static void FlushSelfProfile(SelfProfileCounters *c) {
+  for (uptr i = 0; i < kSelfProfileRegionCount; i++) {
+    if (!c->calls[i])
+      continue;
+    atomic_fetch_add(&self_profile_calls[i], c->calls[i],
+                     memory_order_relaxed);
+    atomic_fetch_add(&self_profile_cycles[i], c->cycles[i],
+                     memory_order_relaxed);
+    c->calls[i] = 0;
+    c->cycles[i] = 0;
+  }
+  c->unflushed_calls = 0;
+}
+
+void SelfProfileAdd(SelfProfileRegion region, u64 cycles) {
+  SelfProfileCounters *c = &thread_self_profile;
+  c->calls[region]++;
+  c->cycles[region] += cycles;
+  if (++c->unflushed_calls >= kSelfProfileFlushPeriod)
+    FlushSelfProfile(c);
+}
+
+static void PrintSelfProfile() {
+  FlushSelfProfile(&thread_self_profile);
+  Printf("%s self-profile (cycles of a region include the nested ones):\n",
+         SanitizerToolName);
+  for (uptr i = 0; i < kSelfProfileRegionCount; i++) {
+    u64 calls = atomic_load(&self_profile_calls[i], memory_order_relaxed);
+    u64 cycles = atomic_load(&self_profile_cycles[i], memory_order_relaxed);
+    Printf("  %s: %llu calls, %llu cycles, %llu per call\n",
+           kSelfProfileRegionNames[i], calls, cycles,
+           calls ? cycles / calls : 0);
+  }
+}
+
+void InitPhaseTimer::EndPhase(const char *name) {
+  u64 now = NanoTime();
+  if (num_phases_ < kMaxPhases) {
+    names_[num_phases_] = name;
+    durations_[num_phases_] = now - last_;
+    num_phases_++;
+  }
+  last_ = now;
+}
+
+void InitPhaseTimer::Print() {
+  if (!common_flags()->print_init_timing)
+    return;
+  Printf("%s init timing:\n", SanitizerToolName);
+  for (uptr i = 0; i < num_phases_; i++)
+    Printf("  %s: %llu us\n", names_[i], durations_[i] / 1000);
+  Printf("  total: %llu us\n", (NanoTime() - start_) / 1000);
+}
+
+}  // namespace __sanitizer
+
+using namespace __sanitizer;  // NOLINT
+
+void __sanitizer_print_self_profile() {
+  PrintSelfProfile();
+}
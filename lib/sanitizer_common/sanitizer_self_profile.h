@@ -0,0 +1,105 @@
+//===-- sanitizer_self_profile.h --------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Cycle accounting for the hot paths of the sanitizer runtimes, enabled with
+// self_profile=1, to find out which part of the runtime slows a program down,
+// and timing of their initialization, enabled with print_init_timing=1.
+//===----------------------------------------------------------------------===//
+#ifndef SANITIZER_SELF_PROFILE_H
+#define SANITIZER_SELF_PROFILE_H
+
+#include "sanitizer_common.h"
+#include "sanitizer_flags.h"
+#include "sanitizer_internal_defs.h"
+
+extern "C" {
+// Prints the cycles spent in each region so far.
+SANITIZER_INTERFACE_ATTRIBUTE
+void __sanitizer_print_self_profile();
+}  // extern "C"
+
+namespace __sanitizer {
+
+// The regions are nested in each other (e.g. an interceptor that unwinds the
+// stack and puts it into the depot), and the cycles of a region include the
+// ones of the regions nested in it.
+enum SelfProfileRegion {
+  // The interceptors of the tool, including the intercepted function itself.
+  kSelfProfileInterceptor,
+  kSelfProfileUnwind,
+  kSelfProfileStackDepotPut,
+  kSelfProfileQuarantineRecycle,
+  kSelfProfileSymbolize,
+  kSelfProfileRegionCount
+};
+
+// Returns the CPU timestamp counter, or NanoTime() where there is none. Only
+// differences between two readings on the same thread are meaningful.
+INLINE u64 ReadCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+  u64 counter;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(counter));
+  return counter;
+#else
+  return NanoTime();
+#endif
+}
+
+// Accounts the cycles to the region. The counts are kept per thread and
+// added to the global ones every few calls, so that the threads do not
+// contend for them; a thread may have the last few of its calls unaccounted
+// when the profile is printed.
+void SelfProfileAdd(SelfProfileRegion region, u64 cycles);
+
+// Prints the profile at exit if self_profile is set. Must be called once
+// atexit() can be used by the tool.
+void MaybePrintSelfProfileAtExit();
+
+// Accounts the cycles spent in its scope to the region. Its cost is a load
+// and a branch when self_profile is off.
+class ScopedSelfProfile {
+ public:
+  explicit ScopedSelfProfile(SelfProfileRegion region)
+      : region_(region),
+        start_(LIKELY(!common_flags()->self_profile) ? 0
+                                                     : ReadCycleCounter()) {}
+  ~ScopedSelfProfile() {
+    if (UNLIKELY(start_))
+      SelfProfileAdd(region_, ReadCycleCounter() - start_);
+  }
+
+ private:
+  SelfProfileRegion region_;
+  u64 start_;
+};
+
+// Times the phases of the initialization of a tool. It may be created before
+// the flags are parsed; print_init_timing is only looked at by Print().
+class InitPhaseTimer {
+ public:
+  InitPhaseTimer() : last_(NanoTime()), start_(last_), num_phases_(0) {}
+  // Ends the current phase, which started when the previous one ended.
+  void EndPhase(const char *name);
+  // Prints the phases ended so far if print_init_timing is set.
+  void Print();
+
+ private:
+  static const uptr kMaxPhases = 32;
+  u64 last_;
+  u64 start_;
+  uptr num_phases_;
+  const char *names_[kMaxPhases];
+  u64 durations_[kMaxPhases];
+};
+
+}  // namespace __sanitizer
+
+#endif  // SANITIZER_SELF_PROFILE_H
@@ -0,0 +1,60 @@
+//===-- sanitizer_shadow_stack.cc -----------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between AddressSanitizer, MemorySanitizer and
+// LeakSanitizer run-time libraries.
+//
+// The shadow stack is mapped on the first entry of each thread. It only
+// follows calls and returns: frames left by longjmp or by exceptions without
+// instrumented cleanups stay on it, and uninstrumented frames never appear.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_shadow_stack.h"
+#include "sanitizer_common.h"
+
+namespace __sanitizer {
+
+// Deeper stacks are unwound as usual. Only the pages in use get touched.
+static const uptr kShadowStackSize = 1 << 14;
+// Keeps the depth past kShadowStackSize after the thread has finished.
+static const uptr kShadowStackFinished = ~(uptr)0 >> 1;
+
+static THREADLOCAL uptr *shadow_stack;
+static THREADLOCAL uptr shadow_stack_depth;
+
+uptr GetShadowStack(const uptr **pcs) {
+  uptr depth = shadow_stack_depth;
+  if (!shadow_stack || depth > kShadowStackSize) return 0;
+  *pcs = shadow_stack;
+  return depth;
+}
+
+void ShadowStackThreadFinish() {
+  if (shadow_stack)
+    UnmapOrDie(shadow_stack, kShadowStackSize * sizeof(uptr));
+  shadow_stack = nullptr;
+  shadow_stack_depth = kShadowStackFinished;
+}
+
+}  // namespace __sanitizer
+
+using namespace __sanitizer;
+
+void __sanitizer_shadow_stack_enter(uptr pc) {
+  uptr depth = shadow_stack_depth++;
+  if (UNLIKELY(depth >= kShadowStackSize)) return;
+  if (UNLIKELY(!shadow_stack))
+    shadow_stack = (uptr *)MmapNoReserveOrDie(kShadowStackSize * sizeof(uptr),
+                                              "shadow stack");
+  shadow_stack[depth] = pc;
+}
+
+void __sanitizer_shadow_stack_exit() {
+  if (LIKELY(shadow_stack_depth)) shadow_stack_depth--;
+}
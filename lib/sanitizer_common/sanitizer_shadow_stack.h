@@ -0,0 +1,42 @@
+//===-- sanitizer_shadow_stack.h --------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Per-thread shadow stack of return addresses, maintained by the
+// compiler-emitted __sanitizer_shadow_stack_enter/exit hooks, so that with
+// use_shadow_stack=1 capturing a stack is a copy of its top entries instead of
+// an unwind. Shared by AddressSanitizer, MemorySanitizer and LeakSanitizer.
+//===----------------------------------------------------------------------===//
+#ifndef SANITIZER_SHADOW_STACK_H
+#define SANITIZER_SHADOW_STACK_H
+
+#include "sanitizer_internal_defs.h"
+
+extern "C" {
+// Called on entry to each instrumented function with its return address, and
+// on each of its exits.
+SANITIZER_INTERFACE_ATTRIBUTE
+void __sanitizer_shadow_stack_enter(__sanitizer::uptr pc);
+SANITIZER_INTERFACE_ATTRIBUTE
+void __sanitizer_shadow_stack_exit();
+}  // extern "C"
+
+namespace __sanitizer {
+
+// The number of entries of the shadow stack of the current thread, or 0 if it
+// is empty or has overflowed, in which case stacks are unwound as usual.
+// Entry 0 is the return address of the outermost instrumented frame.
+uptr GetShadowStack(const uptr **pcs);
+
+// Releases the shadow stack of the current thread; any later entries and
+// exits on the thread are ignored.
+void ShadowStackThreadFinish();
+
+}  // namespace __sanitizer
+
+#endif  // SANITIZER_SHADOW_STACK_H
@@ -0,0 +1,421 @@
+//===-- sanitizer_sparse_graph.h --------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Sanitizer runtime.
+// SparseGraph -- a directed graph of lock acquisitions with adjacency lists.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SANITIZER_SPARSE_GRAPH_H
+#define SANITIZER_SPARSE_GRAPH_H
+
+#include "sanitizer_common.h"
+#include "sanitizer_atomic.h"
+
+namespace __sanitizer {
+
+// Directed graph over the node indices [0, kMaxNodes), with the edges kept in
+// intrusive lists of successors and predecessors and in a hash table.
+// Unlike BVGraph the cost of the operations depends on the edges, not on the
+// number of nodes.
+//
+// The graph also keeps a topological order of the nodes, which is maintained
+// incrementally when edges are added (Pearce, Kelly, "A dynamic topological
+// sort algorithm for directed acyclic graphs", JEA 2007). An edge which would
+// close a cycle is still added, but it is marked as a back edge and does not
+// take part in the order. While there are no back edges the order bounds the
+// reachability searches: a node can only reach the nodes after it.
+//
+// The edges and the nodes are never unmapped, and a removed edge is only
+// reused for another edge, so hasEdge may be called without the lock.
+// Not thread-safe otherwise, all accesses should be protected by an external
+// lock.
+class SparseGraph {
+ public:
+#if SANITIZER_WORDSIZE == 64
+  static const uptr kMaxNodes = 1 << 20;
+  static const uptr kMaxEdges = 1 << 22;
+  static const uptr kHashBits = 19;
+#else
+  static const uptr kMaxNodes = 1 << 16;
+  static const uptr kMaxEdges = 1 << 18;
+  static const uptr kHashBits = 16;
+#endif
+
+  // The contexts of the acquisitions which created an edge.
+  struct EdgeInfo {
+    u32 stk_from;
+    u32 stk_to;
+    int unique_tid;
+  };
+
+  // No CTOR.
+  void Init() {
+    nodes_ = (Node *)MmapNoReserveOrDie(kMaxNodes * sizeof(Node),
+                                        "deadlock detector nodes");
+    edges_ = (Edge *)MmapNoReserveOrDie(kMaxEdges * sizeof(Edge),
+                                        "deadlock detector edges");
+    hash_ = (atomic_uint32_t *)MmapOrDie(sizeof(*hash_) << kHashBits,
+                                         "deadlock detector edge hash");
+    n_nodes_ = 0;
+    next_ord_ = 0;
+    // Edge 0 is the list terminator.
+    n_edges_ = 1;
+    free_edges_ = 0;
+    n_back_edges_ = 0;
+    stamp_ = 0;
+    stack_.Initialize(64);
+    delta_f_.Initialize(64);
+    delta_b_.Initialize(64);
+    ords_.Initialize(64);
+  }
+
+  // Starts using idx as a new node without edges.
+  void addNode(uptr idx) {
+    CHECK_LT(idx, kMaxNodes);
+    for (; n_nodes_ <= idx; n_nodes_++)
+      internal_memset(&nodes_[n_nodes_], 0, sizeof(Node));
+    Node &n = nodes_[idx];
+    CHECK_EQ(n.first_out, 0);
+    CHECK_EQ(n.first_in, 0);
+    // A node without edges may go anywhere in the order.
+    n.ord = next_ord_++;
+  }
+
+  // Removes all of the edges from and to idx.
+  void removeNode(uptr idx) {
+    Node &n = nodes_[idx];
+    while (u32 e = n.first_out)
+      removeEdge(e);
+    while (u32 e = n.first_in)
+      removeEdge(e);
+  }
+
+  // Returns true if a new edge was added.
+  bool addEdge(uptr from, uptr to, const EdgeInfo &info) {
+    check(from, to);
+    if (findEdge(from, to))
+      return false;
+    u32 e = allocEdge();
+    if (!e)
+      return false;  // Out of edges, forget this one.
+    Edge &edge = edges_[e];
+    edge.info = info;
+    edge.from = from;
+    edge.to = to;
+    edge.back = from == to || !updateOrder(from, to);
+    if (edge.back)
+      n_back_edges_++;
+    // Successors and predecessors.
+    edge.prev_out = 0;
+    edge.next_out = nodes_[from].first_out;
+    if (edge.next_out) edges_[edge.next_out].prev_out = e;
+    nodes_[from].first_out = e;
+    edge.prev_in = 0;
+    edge.next_in = nodes_[to].first_in;
+    if (edge.next_in) edges_[edge.next_in].prev_in = e;
+    nodes_[to].first_in = e;
+    // The hash table, which may be read concurrently by hasEdge.
+    atomic_uint32_t *bucket = &hash_[hash(from, to)];
+    atomic_store_relaxed(&edge.key, makeKey(from, to));
+    atomic_store_relaxed(&edge.next_hash, atomic_load_relaxed(bucket));
+    atomic_store(bucket, e, memory_order_release);
+    return true;
+  }
+
+  // *EXPERIMENTAL*
+  // Returns true if an edge from=>to exist.
+  // This function can be called from different threads w/o locking: the
+  // edges are never unmapped, so a racing reader at worst misses an edge or
+  // sees one which has just been removed, as with BVGraph::hasEdge.
+  bool hasEdge(uptr from, uptr to) const {
+    u64 key = makeKey(from, to);
+    u32 e = atomic_load(&hash_[hash(from, to)], memory_order_acquire);
+    // A removed edge may be reused in another chain under our feet, so do not
+    // chase the links forever.
+    for (uptr i = 0; e && i < kMaxHashChain; i++) {
+      const Edge &edge = edges_[e];
+      if (atomic_load_relaxed(&edge.key) == key)
+        return true;
+      e = atomic_load_relaxed(&edge.next_hash);
+    }
+    return false;
+  }
+
+  // Returns the contexts of the edge from=>to, or null if there is none.
+  const EdgeInfo *getEdgeInfo(uptr from, uptr to) const {
+    u32 e = findEdge(from, to);
+    return e ? &edges_[e].info : nullptr;
+  }
+
+  // Returns true if there is a path from the node 'from' to any of the
+  // n nodes in 'targets'.
+  bool isReachable(uptr from, const uptr *targets, uptr n) {
+    u32 stamp = nextStamp();
+    u64 max_ord = markTargets(targets, n, stamp);
+    if (nodes_[from].target == stamp)
+      return true;
+    // Without back edges the paths only go forward in the order.
+    bool bounded = n_back_edges_ == 0;
+    if (bounded && max_ord < nodes_[from].ord)
+      return false;
+    stack_.clear();
+    stack_.push_back(from);
+    nodes_[from].visit = stamp;
+    while (stack_.size()) {
+      u32 idx = stack_.back();
+      stack_.pop_back();
+      for (u32 e = nodes_[idx].first_out; e; e = edges_[e].next_out) {
+        Node &to = nodes_[edges_[e].to];
+        if (to.target == stamp)
+          return true;
+        if (to.visit == stamp || (bounded && to.ord >= max_ord))
+          continue;
+        to.visit = stamp;
+        stack_.push_back(edges_[e].to);
+      }
+    }
+    return false;
+  }
+
+  // Finds a shortest path from 'from' to one of the n nodes in 'targets',
+  // stores it into 'path', and returns its length, or 0 if there is no path
+  // of at most 'path_size' nodes.
+  uptr findShortestPath(uptr from, const uptr *targets, uptr n, uptr *path,
+                        uptr path_size) {
+    if (path_size == 0)
+      return 0;
+    u32 stamp = nextStamp();
+    markTargets(targets, n, stamp);
+    // Breadth-first search, stack_ is the queue.
+    stack_.clear();
+    stack_.push_back(from);
+    nodes_[from].visit = stamp;
+    for (uptr head = 0; head < stack_.size(); head++) {
+      u32 idx = stack_[head];
+      if (nodes_[idx].target == stamp) {
+        uptr len = 1;
+        for (u32 i = idx; i != from; i = nodes_[i].parent)
+          len++;
+        if (len > path_size)
+          return 0;
+        for (uptr i = len, cur = idx; i > 0; cur = nodes_[cur].parent)
+          path[--i] = cur;
+        return len;
+      }
+      for (u32 e = nodes_[idx].first_out; e; e = edges_[e].next_out) {
+        Node &to = nodes_[edges_[e].to];
+        if (to.visit == stamp)
+          continue;
+        to.visit = stamp;
+        to.parent = idx;
+        stack_.push_back(edges_[e].to);
+      }
+    }
+    return 0;
+  }
+
+  uptr numBackEdges() const { return n_back_edges_; }
+  // Test-only: the position of idx in the topological order.
+  u64 testOnlyGetOrder(uptr idx) const { return nodes_[idx].ord; }
+
+ private:
+  static const uptr kMaxHashChain = 64;
+
+  struct Node {
+    // The position in the topological order, unique among the nodes.
+    u64 ord;
+    // Heads of the lists of the edges from and to this node.
+    u32 first_out;
+    u32 first_in;
+    // Scratch marks of the searches, compared with stamp_.
+    u32 visit;
+    u32 target;
+    u32 parent;
+  };
+
+  struct Edge {
+    // Read without the lock by hasEdge.
+    atomic_uint64_t key;
+    atomic_uint32_t next_hash;
+    u32 from;
+    u32 to;
+    u32 next_out;
+    u32 prev_out;
+    u32 next_in;
+    u32 prev_in;
+    // Closes a cycle, and is not accounted for in the order.
+    bool back;
+    EdgeInfo info;
+  };
+
+  struct CompareOrder {
+    const Node *nodes;
+    bool operator()(u32 a, u32 b) const { return nodes[a].ord < nodes[b].ord; }
+  };
+
+  static bool CompareOrd(u64 a, u64 b) { return a < b; }
+
+  void check(uptr idx1, uptr idx2) const {
+    CHECK_LT(idx1, n_nodes_);
+    CHECK_LT(idx2, n_nodes_);
+  }
+
+  static u64 makeKey(uptr from, uptr to) {
+    return (u64)(from + 1) << 32 | (u32)to;
+  }
+
+  static uptr hash(uptr from, uptr to) {
+    return (makeKey(from, to) * 0x9E3779B97F4A7C15ULL) >> (64 - kHashBits);
+  }
+
+  u32 findEdge(uptr from, uptr to) const {
+    u64 key = makeKey(from, to);
+    u32 e = atomic_load_relaxed(&hash_[hash(from, to)]);
+    for (; e; e = atomic_load_relaxed(&edges_[e].next_hash))
+      if (atomic_load_relaxed(&edges_[e].key) == key)
+        return e;
+    return 0;
+  }
+
+  u32 allocEdge() {
+    if (u32 e = free_edges_) {
+      free_edges_ = edges_[e].next_out;
+      return e;
+    }
+    if (n_edges_ == kMaxEdges)
+      return 0;
+    return n_edges_++;
+  }
+
+  void removeEdge(u32 e) {
+    Edge &edge = edges_[e];
+    if (edge.back)
+      n_back_edges_--;
+    if (edge.prev_out)
+      edges_[edge.prev_out].next_out = edge.next_out;
+    else
+      nodes_[edge.from].first_out = edge.next_out;
+    if (edge.next_out) edges_[edge.next_out].prev_out = edge.prev_out;
+    if (edge.prev_in)
+      edges_[edge.prev_in].next_in = edge.next_in;
+    else
+      nodes_[edge.to].first_in = edge.next_in;
+    if (edge.next_in) edges_[edge.next_in].prev_in = edge.prev_in;
+    // Unlink from the hash chain, but leave next_hash intact for the racing
+    // readers which are already on this edge.
+    atomic_uint32_t *link = &hash_[hash(edge.from, edge.to)];
+    while (atomic_load_relaxed(link) != e)
+      link = &edges_[atomic_load_relaxed(link)].next_hash;
+    atomic_store_relaxed(link, atomic_load_relaxed(&edge.next_hash));
+    atomic_store_relaxed(&edge.key, 0);
+    edge.next_out = free_edges_;
+    free_edges_ = e;
+  }
+
+  u32 nextStamp() {
+    if (++stamp_ == 0) {
+      for (uptr i = 0; i < n_nodes_; i++)
+        nodes_[i].visit = nodes_[i].target = 0;
+      stamp_ = 1;
+    }
+    return stamp_;
+  }
+
+  u64 markTargets(const uptr *targets, uptr n, u32 stamp) {
+    u64 max_ord = 0;
+    for (uptr i = 0; i < n; i++) {
+      nodes_[targets[i]].target = stamp;
+      max_ord = Max(max_ord, nodes_[targets[i]].ord);
+    }
+    return max_ord;
+  }
+
+  // Restores the order after the edge from=>to is added, or returns false if
+  // the edge closes a cycle. Only the nodes between 'to' and 'from' in the
+  // order are visited: those reachable from 'to' (delta_f_) and those
+  // reaching 'from' (delta_b_), which then swap their places.
+  bool updateOrder(uptr from, uptr to) {
+    u64 lb = nodes_[to].ord, ub = nodes_[from].ord;
+    if (lb > ub)
+      return true;
+    u32 stamp = nextStamp();
+    delta_f_.clear();
+    stack_.clear();
+    stack_.push_back(to);
+    nodes_[to].visit = stamp;
+    while (stack_.size()) {
+      u32 idx = stack_.back();
+      stack_.pop_back();
+      delta_f_.push_back(idx);
+      for (u32 e = nodes_[idx].first_out; e; e = edges_[e].next_out) {
+        if (edges_[e].back)
+          continue;
+        u32 w = edges_[e].to;
+        if (w == from)
+          return false;
+        if (nodes_[w].visit == stamp || nodes_[w].ord > ub)
+          continue;
+        nodes_[w].visit = stamp;
+        stack_.push_back(w);
+      }
+    }
+    delta_b_.clear();
+    stack_.push_back(from);
+    nodes_[from].visit = stamp;
+    while (stack_.size()) {
+      u32 idx = stack_.back();
+      stack_.pop_back();
+      delta_b_.push_back(idx);
+      for (u32 e = nodes_[idx].first_in; e; e = edges_[e].next_in) {
+        if (edges_[e].back)
+          continue;
+        u32 w = edges_[e].from;
+        if (nodes_[w].visit == stamp || nodes_[w].ord < lb)
+          continue;
+        nodes_[w].visit = stamp;
+        stack_.push_back(w);
+      }
+    }
+    CompareOrder comp = {nodes_};
+    InternalSort(&delta_f_, delta_f_.size(), comp);
+    InternalSort(&delta_b_, delta_b_.size(), comp);
+    ords_.clear();
+    for (uptr i = 0; i < delta_b_.size(); i++)
+      ords_.push_back(nodes_[delta_b_[i]].ord);
+    for (uptr i = 0; i < delta_f_.size(); i++)
+      ords_.push_back(nodes_[delta_f_[i]].ord);
+    InternalSort(&ords_, ords_.size(), CompareOrd);
+    uptr k = 0;
+    for (uptr i = 0; i < delta_b_.size(); i++)
+      nodes_[delta_b_[i]].ord = ords_[k++];
+    for (uptr i = 0; i < delta_f_.size(); i++)
+      nodes_[delta_f_[i]].ord = ords_[k++];
+    return true;
+  }
+
+  Node *nodes_;
+  Edge *edges_;
+  atomic_uint32_t *hash_;
+  uptr n_nodes_;
+  u64 next_ord_;
+  uptr n_edges_;
+  u32 free_edges_;
+  uptr n_back_edges_;
+  u32 stamp_;
+  // Scratch space of the searches.
+  InternalMmapVectorNoCtor<u32> stack_;
+  InternalMmapVectorNoCtor<u32> delta_f_;
+  InternalMmapVectorNoCtor<u32> delta_b_;
+  InternalMmapVectorNoCtor<u64> ords_;
+};
+
+} // namespace __sanitizer
+
+#endif // SANITIZER_SPARSE_GRAPH_H
@@ -14,17 +14,60 @@
 #include "sanitizer_stackdepot.h"
 
 #include "sanitizer_common.h"
+#include "sanitizer_self_profile.h"
 #include "sanitizer_stackdepotbase.h"
 
 namespace __sanitizer {
 
+// The bytes the stored stacks would take without compression, and the bytes
+// of their decompressed copies.
+static atomic_uintptr_t stack_depot_uncompressed;
+static atomic_uintptr_t stack_depot_decompressed;
+
+// The frames of a stack are stored as the differences between consecutive
+// pcs, zigzag and LEB128 encoded. The frames of one module are close to each
+// other, so most of them take 2 to 4 bytes instead of sizeof(uptr).
+static uptr ZigZag(uptr pc, uptr prev) {
+  sptr delta = (sptr)(pc - prev);
+  return ((uptr)delta << 1) ^ (uptr)(delta >> (SANITIZER_WORDSIZE - 1));
+}
+
+static uptr EncodedFrameSize(uptr pc, uptr prev) {
+  uptr v = ZigZag(pc, prev);
+  uptr n = 1;
+  for (; v >= 0x80; v >>= 7) n++;
+  return n;
+}
+
+static u8 *EncodeFrame(u8 *p, uptr pc, uptr prev) {
+  uptr v = ZigZag(pc, prev);
+  for (; v >= 0x80; v >>= 7) *p++ = (u8)(v | 0x80);
+  *p++ = (u8)v;
+  return p;
+}
+
+static const u8 *DecodeFrame(const u8 *p, uptr prev, uptr *pc) {
+  uptr v = 0;
+  for (uptr shift = 0;; shift += 7) {
+    u8 b = *p++;
+    v |= (uptr)(b & 0x7f) << shift;
+    if (!(b & 0x80)) break;
+  }
+  *pc = prev + ((v >> 1) ^ (0 - (v & 1)));
+  return p;
+}
+
 struct StackDepotNode {
   StackDepotNode *link;
   u32 id;
   atomic_uint32_t hash_and_use_count; // hash_bits : 12; use_count : 20;
   u32 size;
   u32 tag;
-  uptr stack[1];  // [size]
+  // The decompressed copy of the stack, made by the first load().
+  atomic_uintptr_t decompressed;
+  // Followed by the size frames of the stack, see EncodeFrame.
+  const u8 *encoded() const { return (const u8 *)(this + 1); }
+  u8 *encoded() { return (u8 *)(this + 1); }
 
   static const u32 kTabSizeLog = 20;
   // Lower kTabSizeLog bits are equal for all items in one bucket.
@@ -40,14 +83,23 @@ struct StackDepotNode {
         atomic_load(&hash_and_use_count, memory_order_relaxed) & kHashMask;
     if ((hash & kHashMask) != hash_bits || args.size != size || args.tag != tag)
       return false;
-    uptr i = 0;
-    for (; i < size; i++) {
-      if (stack[i] != args.trace[i]) return false;
+    const u8 *p = encoded();
+    uptr pc = 0;
+    for (uptr i = 0; i < size; i++) {
+      p = DecodeFrame(p, pc, &pc);
+      if (pc != args.trace[i]) return false;
     }
     return true;
   }
   static uptr storage_size(const args_type &args) {
-    return sizeof(StackDepotNode) + (args.size - 1) * sizeof(uptr);
+    uptr encoded_size = 0;
+    uptr prev = 0;
+    for (uptr i = 0; i < args.size; i++) {
+      encoded_size += EncodedFrameSize(args.trace[i], prev);
+      prev = args.trace[i];
+    }
+    // Keep the nodes aligned, the persistent allocator doesn't.
+    return RoundUpTo(sizeof(StackDepotNode) + encoded_size, sizeof(uptr));
   }
   static u32 hash(const args_type &args) {
     // murmur2
@@ -75,10 +127,40 @@ struct StackDepotNode {
     atomic_store(&hash_and_use_count, hash & kHashMask, memory_order_relaxed);
     size = args.size;
     tag = args.tag;
-    internal_memcpy(stack, args.trace, size * sizeof(uptr));
+    atomic_store(&decompressed, 0, memory_order_relaxed);
+    u8 *p = encoded();
+    uptr prev = 0;
+    for (uptr i = 0; i < size; i++) {
+      p = EncodeFrame(p, args.trace[i], prev);
+      prev = args.trace[i];
+    }
+    atomic_fetch_add(&stack_depot_uncompressed,
+                     sizeof(StackDepotNode) + size * sizeof(uptr),
+                     memory_order_relaxed);
   }
-  args_type load() const {
-    return args_type(&stack[0], size, tag);
+  // Most stored stacks are never retrieved, so they are only decompressed on
+  // demand. The copy is kept, as the callers expect the returned trace to stay
+  // valid.
+  args_type load() {
+    uptr v = atomic_load(&decompressed, memory_order_acquire);
+    if (v)
+      return args_type((uptr *)v, size, tag);
+    uptr *trace = (uptr *)PersistentAlloc(size * sizeof(uptr));
+    const u8 *p = encoded();
+    uptr pc = 0;
+    for (uptr i = 0; i < size; i++) {
+      p = DecodeFrame(p, pc, &pc);
+      trace[i] = pc;
+    }
+    if (atomic_compare_exchange_strong(&decompressed, &v, (uptr)trace,
+                                       memory_order_acq_rel)) {
+      atomic_fetch_add(&stack_depot_decompressed, size * sizeof(uptr),
+                       memory_order_relaxed);
+    } else {
+      // Another thread decompressed the stack first; our copy is leaked.
+      trace = (uptr *)v;
+    }
+    return args_type(trace, size, tag);
   }
   StackDepotHandle get_handle() { return StackDepotHandle(this); }
 
@@ -105,15 +187,22 @@ typedef StackDepotBase<StackDepotNode, 1, StackDepotNode::kTabSizeLog>
 static StackDepot theDepot;
 
 StackDepotStats *StackDepotGetStats() {
-  return theDepot.GetStats();
+  StackDepotStats *stats = theDepot.GetStats();
+  stats->allocated +=
+      atomic_load(&stack_depot_decompressed, memory_order_relaxed);
+  stats->uncompressed =
+      atomic_load(&stack_depot_uncompressed, memory_order_relaxed);
+  return stats;
 }
 
 u32 StackDepotPut(StackTrace stack) {
+  ScopedSelfProfile self_profile(kSelfProfileStackDepotPut);
   StackDepotHandle h = theDepot.Put(stack);
   return h.valid() ? h.id() : 0;
 }
 
 StackDepotHandle StackDepotPut_WithHandle(StackTrace stack) {
+  ScopedSelfProfile self_profile(kSelfProfileStackDepotPut);
   return theDepot.Put(stack);
 }
 
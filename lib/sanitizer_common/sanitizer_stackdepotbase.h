@@ -31,7 +31,13 @@ class StackDepotBase {
   // Retrieves a stored stack trace by the id.
   args_type Get(u32 id);
 
-  StackDepotStats *GetStats() { return &stats; }
+  StackDepotStats *GetStats() {
+    stats.n_uniq_ids = atomic_load(&n_uniq_ids, memory_order_relaxed);
+    stats.allocated = atomic_load(&allocated, memory_order_relaxed);
+    thePersistentAllocator.getStats(&stats.persistent_mapped,
+                                    &stats.persistent_wasted);
+    return &stats;
+  }
 
   void LockAll();
   void UnlockAll();
@@ -39,6 +45,7 @@ class StackDepotBase {
  private:
   static Node *find(Node *s, args_type args, u32 hash);
   static Node *lock(atomic_uintptr_t *p);
+  static Node *wait_unlocked(atomic_uintptr_t *p);
   static void unlock(atomic_uintptr_t *p, Node *s);
 
   static const int kTabSize = 1 << kTabSizeLog;  // Hash table size.
@@ -52,6 +59,9 @@ class StackDepotBase {
   atomic_uintptr_t tab[kTabSize];   // Hash table of Node's.
   atomic_uint32_t seq[kPartCount];  // Unique id generators.
 
+  // Updated with atomic RMWs from Put, copied into stats by GetStats.
+  atomic_uintptr_t n_uniq_ids;
+  atomic_uintptr_t allocated;
   StackDepotStats stats;
 
   friend class StackDepotReverseMap;
@@ -86,6 +96,22 @@ Node *StackDepotBase<Node, kReservedBits, kTabSizeLog>::lock(
   }
 }
 
+template <class Node, int kReservedBits, int kTabSizeLog>
+Node *StackDepotBase<Node, kReservedBits, kTabSizeLog>::wait_unlocked(
+    atomic_uintptr_t *p) {
+  // The lsb is only set by LockAll, so this spins for the duration of a
+  // fork or a StopTheWorld, never on a regular Put.
+  for (int i = 0;; i++) {
+    uptr v = atomic_load(p, memory_order_acquire);
+    if ((v & 1) == 0)
+      return (Node *)v;
+    if (i < 10)
+      proc_yield(10);
+    else
+      internal_sched_yield();
+  }
+}
+
 template <class Node, int kReservedBits, int kTabSizeLog>
 void StackDepotBase<Node, kReservedBits, kTabSizeLog>::unlock(
     atomic_uintptr_t *p, Node *s) {
@@ -106,31 +132,43 @@ StackDepotBase<Node, kReservedBits, kTabSizeLog>::Put(args_type args,
   // First, try to find the existing stack.
   Node *node = find(s, args, h);
   if (node) return node->get_handle();
-  // If failed, lock, retry and insert new.
-  Node *s2 = lock(p);
-  if (s2 != s) {
-    node = find(s2, args, h);
-    if (node) {
-      unlock(p, s2);
-      return node->get_handle();
-    }
-  }
+  // If failed, build a new node and publish it with a CAS on the bucket head.
+  // Nodes are never removed, so a failed CAS only requires rescanning the
+  // nodes that were pushed since the last observed head.
   uptr part = (h % kTabSize) / kPartSize;
   u32 id = atomic_fetch_add(&seq[part], 1, memory_order_relaxed) + 1;
-  stats.n_uniq_ids++;
   CHECK_LT(id, kMaxId);
   id |= part << kPartShift;
   CHECK_NE(id, 0);
   CHECK_EQ(id & (((u32)-1) >> kReservedBits), id);
   uptr memsz = Node::storage_size(args);
-  s = (Node *)PersistentAlloc(memsz);
-  stats.allocated += memsz;
-  s->id = id;
-  s->store(args, h);
-  s->link = s2;
-  unlock(p, s);
+  Node *n = (Node *)PersistentAlloc(memsz);
+  atomic_fetch_add(&allocated, memsz, memory_order_relaxed);
+  n->id = id;
+  n->store(args, h);
+  for (;;) {
+    Node *s2 = wait_unlocked(p);
+    if (s2 != s) {
+      // Somebody else has inserted into this bucket: only the new prefix of
+      // the list can contain our stack.
+      for (Node *t = s2; t != s; t = t->link) {
+        if (t->eq(h, args)) {
+          // We lost the race; the storage of n is leaked, which is fine for
+          // the persistent allocator given how rare this is.
+          return t->get_handle();
+        }
+      }
+      s = s2;
+    }
+    n->link = s;
+    uptr cmp = (uptr)s;
+    if (atomic_compare_exchange_strong(p, &cmp, (uptr)n,
+                                       memory_order_release))
+      break;
+  }
+  atomic_fetch_add(&n_uniq_ids, 1, memory_order_relaxed);
   if (inserted) *inserted = true;
-  return s->get_handle();
+  return n->get_handle();
 }
 
 template <class Node, int kReservedBits, int kTabSizeLog>
@@ -64,6 +64,76 @@ static inline uhwptr *GetCanonicFrame(uptr bp,
 #endif
 }
 
+#if SANITIZER_LINUX && !SANITIZER_ANDROID && !SANITIZER_GO
+#define SANITIZER_UNWIND_CACHE 1
+#else
+#define SANITIZER_UNWIND_CACHE 0
+#endif
+
+#if SANITIZER_UNWIND_CACHE
+// With fast_unwind_cache=1, FastUnwindStack() looks up the stack in a
+// per-thread cache once it has its first kUnwindCachePrefix frames. An entry
+// matches if those frames, the frame pointer below them and the return
+// address in that frame are the same; the rest of the stack is then copied
+// from it. Nothing checks the frames further out, which can differ if the same
+// code is reached from different callers with the same stack depth.
+static const u32 kUnwindCachePrefix = 6;
+static const u32 kUnwindCacheMaxFrames = 32;
+static const uptr kUnwindCacheSize = 8;
+
+struct UnwindCacheEntry {
+  uptr bp;
+  uptr frame;  // The frame after the prefix, or 0 if the entry is unused.
+  u32 max_depth;
+  u32 size;
+  uptr trace[kUnwindCacheMaxFrames];
+};
+
+struct UnwindCache {
+  // Set while the cache is used, so that a signal handler unwinding on the
+  // same thread does not see a half-written entry.
+  bool busy;
+  UnwindCacheEntry entries[kUnwindCacheSize];
+};
+
+static THREADLOCAL UnwindCache unwind_cache;
+
+static UnwindCacheEntry *GetUnwindCacheEntry(uptr frame, uptr pc) {
+  uptr h = (frame >> 4) ^ pc;
+  h ^= h >> 16;
+  return &unwind_cache.entries[h % kUnwindCacheSize];
+}
+
+// Returns true and completes the trace if the cache has the stack.
+static bool LookupUnwindCache(uptr *trace, u32 *size, uptr bp, uhwptr *frame,
+                              u32 max_depth) {
+  UnwindCacheEntry *e = GetUnwindCacheEntry((uptr)frame, trace[1]);
+  if (e->frame != (uptr)frame || e->bp != bp || e->max_depth != max_depth)
+    return false;
+  for (u32 i = 0; i < kUnwindCachePrefix; i++) {
+    if (e->trace[i] != trace[i])
+      return false;
+  }
+  if (e->size > kUnwindCachePrefix &&
+      e->trace[kUnwindCachePrefix] != (uptr)frame[1])
+    return false;
+  internal_memcpy(trace + kUnwindCachePrefix, e->trace + kUnwindCachePrefix,
+                  (e->size - kUnwindCachePrefix) * sizeof(trace[0]));
+  *size = e->size;
+  return true;
+}
+
+static void InsertIntoUnwindCache(const uptr *trace, u32 size, uptr bp,
+                                  uptr frame, u32 max_depth) {
+  UnwindCacheEntry *e = GetUnwindCacheEntry(frame, trace[1]);
+  e->bp = bp;
+  e->frame = frame;
+  e->max_depth = max_depth;
+  e->size = size;
+  internal_memcpy(e->trace, trace, size * sizeof(trace[0]));
+}
+#endif  // SANITIZER_UNWIND_CACHE
+
 void BufferedStackTrace::FastUnwindStack(uptr pc, uptr bp, uptr stack_top,
                                          uptr stack_bottom, u32 max_depth) {
   const uptr kPageSize = GetPageSizeCached();
@@ -72,6 +142,14 @@ void BufferedStackTrace::FastUnwindStack(uptr pc, uptr bp, uptr stack_top,
   size = 1;
   if (stack_top < 4096) return;  // Sanity check for stack top.
   uhwptr *frame = GetCanonicFrame(bp, stack_top, stack_bottom);
+#if SANITIZER_UNWIND_CACHE
+  // The frame after the prefix, once the cache is looked up.
+  uptr cache_frame = 0;
+  bool use_cache = common_flags()->fast_unwind_cache &&
+                   max_depth > kUnwindCachePrefix && !unwind_cache.busy;
+  if (use_cache)
+    unwind_cache.busy = true;
+#endif
   // Lowest possible address that makes sense as the next frame pointer.
   // Goes up as we walk the stack.
   uptr bottom = stack_bottom;
@@ -79,6 +157,15 @@ void BufferedStackTrace::FastUnwindStack(uptr pc, uptr bp, uptr stack_top,
   while (IsValidFrame((uptr)frame, stack_top, bottom) &&
          IsAligned((uptr)frame, sizeof(*frame)) &&
          size < max_depth) {
+#if SANITIZER_UNWIND_CACHE
+    if (use_cache && size == kUnwindCachePrefix && !cache_frame) {
+      if (LookupUnwindCache(trace_buffer, &size, bp, frame, max_depth)) {
+        unwind_cache.busy = false;
+        return;
+      }
+      cache_frame = (uptr)frame;
+    }
+#endif
 #ifdef __powerpc__
     // PowerPC ABIs specify that the return address is saved at offset
     // 16 of the *caller's* stack frame.  Thus we must dereference the
@@ -104,6 +191,13 @@ void BufferedStackTrace::FastUnwindStack(uptr pc, uptr bp, uptr stack_top,
     bottom = (uptr)frame;
     frame = GetCanonicFrame((uptr)frame[0], stack_top, bottom);
   }
+#if SANITIZER_UNWIND_CACHE
+  if (use_cache) {
+    if (cache_frame && size <= kUnwindCacheMaxFrames)
+      InsertIntoUnwindCache(trace_buffer, size, bp, cache_frame, max_depth);
+    unwind_cache.busy = false;
+  }
+#endif
 }
 
 void BufferedStackTrace::PopStackFrames(uptr count) {
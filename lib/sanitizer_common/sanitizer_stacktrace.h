@@ -100,6 +100,7 @@ struct BufferedStackTrace : public StackTrace {
  private:
   void FastUnwindStack(uptr pc, uptr bp, uptr stack_top, uptr stack_bottom,
                        u32 max_depth);
+  bool UnwindFromShadowStack(uptr pc, u32 max_depth);
   void SlowUnwindStack(uptr pc, u32 max_depth);
   void SlowUnwindStackWithContext(uptr pc, void *context,
                                   u32 max_depth);
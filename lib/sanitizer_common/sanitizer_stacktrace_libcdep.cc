@@ -13,6 +13,9 @@
 
 #include "sanitizer_common.h"
 #include "sanitizer_placement_new.h"
+#include "sanitizer_report_bundle.h"
+#include "sanitizer_self_profile.h"
+#include "sanitizer_shadow_stack.h"
 #include "sanitizer_stacktrace.h"
 #include "sanitizer_stacktrace_printer.h"
 #include "sanitizer_symbolizer.h"
@@ -28,11 +31,19 @@ void StackTrace::Print() const {
   InternalScopedString dedup_token(GetPageSizeCached());
   int dedup_frames = common_flags()->dedup_token_length;
   uptr frame_num = 0;
-  for (uptr i = 0; i < size && trace[i]; i++) {
-    // PCs in stack traces are actually the return addresses, that is,
-    // addresses of the next instructions after the call.
-    uptr pc = GetPreviousInstructionPc(trace[i]);
-    SymbolizedStack *frames = Symbolizer::GetOrInit()->SymbolizePC(pc);
+  uptr num_pcs = 0;
+  InternalScopedBuffer<uptr> pcs(size);
+  InternalScopedBuffer<SymbolizedStack *> symbolized(size);
+  // PCs in stack traces are actually the return addresses, that is,
+  // addresses of the next instructions after the call.
+  for (; num_pcs < size && trace[num_pcs]; num_pcs++)
+    pcs[num_pcs] = GetPreviousInstructionPc(trace[num_pcs]);
+  if (ReportBundleEnabled())
+    WriteStackToReportBundle(pcs.data(), num_pcs);
+  Symbolizer::GetOrInit()->SymbolizePCs(pcs.data(), num_pcs,
+                                        symbolized.data());
+  for (uptr i = 0; i < num_pcs; i++) {
+    SymbolizedStack *frames = symbolized[i];
     CHECK(frames);
     for (SymbolizedStack *cur = frames; cur; cur = cur->next) {
       frame_desc.clear();
@@ -54,9 +65,22 @@ void StackTrace::Print() const {
     Printf("DEDUP_TOKEN: %s\n", dedup_token.data());
 }
 
+bool BufferedStackTrace::UnwindFromShadowStack(uptr pc, u32 max_depth) {
+  const uptr *pcs;
+  uptr depth = GetShadowStack(&pcs);
+  if (depth == 0)
+    return false;
+  trace_buffer[0] = pc;
+  size = 1;
+  while (size < max_depth && depth > 0)
+    trace_buffer[size++] = pcs[--depth];
+  return true;
+}
+
 void BufferedStackTrace::Unwind(u32 max_depth, uptr pc, uptr bp, void *context,
                                 uptr stack_top, uptr stack_bottom,
                                 bool request_fast_unwind) {
+  ScopedSelfProfile self_profile(kSelfProfileUnwind);
   top_frame_bp = (max_depth > 0) ? bp : 0;
   // Avoid doing any work for small max_depth.
   if (max_depth == 0) {
@@ -68,6 +92,9 @@ void BufferedStackTrace::Unwind(u32 max_depth, uptr pc, uptr bp, void *context,
     trace_buffer[0] = pc;
     return;
   }
+  if (common_flags()->use_shadow_stack && !context &&
+      UnwindFromShadowStack(pc, max_depth))
+    return;
   if (!WillUseFastUnwind(request_fast_unwind)) {
 #if SANITIZER_CAN_SLOW_UNWIND
     if (context)
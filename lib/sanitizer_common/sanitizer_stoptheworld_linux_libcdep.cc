@@ -101,7 +101,9 @@ class ThreadSuspender {
  public:
   explicit ThreadSuspender(pid_t pid, TracerThreadArgument *arg)
     : arg(arg)
-    , pid_(pid) {
+    , pid_(pid)
+    , attached_threads_(1024)
+    , pending_threads_(1024) {
       CHECK_GE(pid, 0);
     }
   bool SuspendAllThreads();
@@ -114,15 +116,29 @@ class ThreadSuspender {
  private:
   SuspendedThreadsList suspended_threads_list_;
   pid_t pid_;
-  bool SuspendThread(SuspendedThreadID thread_id);
+  // IDs of the suspended threads, sorted after each pass over the thread
+  // list, so that threads listed again are found quickly.
+  InternalMmapVector<SuspendedThreadID> attached_threads_;
+  // Threads attached to in the current pass that haven't stopped yet.
+  InternalMmapVector<SuspendedThreadID> pending_threads_;
+  bool IsAttached(SuspendedThreadID tid) const;
+  bool AttachToThread(SuspendedThreadID tid);
+  bool WaitForThreadStop(SuspendedThreadID tid);
 };
 
-bool ThreadSuspender::SuspendThread(SuspendedThreadID tid) {
-  // Are we already attached to this thread?
-  // Currently this check takes linear time, however the number of threads is
-  // usually small.
-  if (suspended_threads_list_.Contains(tid))
-    return false;
+static bool CompareThreadIDs(const SuspendedThreadID &a,
+                             const SuspendedThreadID &b) {
+  return a < b;
+}
+
+bool ThreadSuspender::IsAttached(SuspendedThreadID tid) const {
+  uptr size = attached_threads_.size();
+  uptr pos = InternalLowerBound(attached_threads_, 0, size, tid,
+                                CompareThreadIDs);
+  return pos < size && attached_threads_[pos] == tid;
+}
+
+bool ThreadSuspender::AttachToThread(SuspendedThreadID tid) {
   int pterrno;
   if (internal_iserror(internal_ptrace(PTRACE_ATTACH, tid, nullptr, nullptr),
                        &pterrno)) {
@@ -130,38 +146,39 @@ bool ThreadSuspender::SuspendThread(SuspendedThreadID tid) {
     // Log this event and move on.
     VReport(1, "Could not attach to thread %d (errno %d).\n", tid, pterrno);
     return false;
-  } else {
-    VReport(2, "Attached to thread %d.\n", tid);
-    // The thread is not guaranteed to stop before ptrace returns, so we must
-    // wait on it. Note: if the thread receives a signal concurrently,
-    // we can get notification about the signal before notification about stop.
-    // In such case we need to forward the signal to the thread, otherwise
-    // the signal will be missed (as we do PTRACE_DETACH with arg=0) and
-    // any logic relying on signals will break. After forwarding we need to
-    // continue to wait for stopping, because the thread is not stopped yet.
-    // We do ignore delivery of SIGSTOP, because we want to make stop-the-world
-    // as invisible as possible.
-    for (;;) {
-      int status;
-      uptr waitpid_status;
-      HANDLE_EINTR(waitpid_status, internal_waitpid(tid, &status, __WALL));
-      int wperrno;
-      if (internal_iserror(waitpid_status, &wperrno)) {
-        // Got a ECHILD error. I don't think this situation is possible, but it
-        // doesn't hurt to report it.
-        VReport(1, "Waiting on thread %d failed, detaching (errno %d).\n",
-                tid, wperrno);
-        internal_ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
-        return false;
-      }
-      if (WIFSTOPPED(status) && WSTOPSIG(status) != SIGSTOP) {
-        internal_ptrace(PTRACE_CONT, tid, nullptr,
-                        (void*)(uptr)WSTOPSIG(status));
-        continue;
-      }
-      break;
+  }
+  VReport(2, "Attached to thread %d.\n", tid);
+  return true;
+}
+
+bool ThreadSuspender::WaitForThreadStop(SuspendedThreadID tid) {
+  // The thread is not guaranteed to stop before ptrace returns, so we must
+  // wait on it. Note: if the thread receives a signal concurrently,
+  // we can get notification about the signal before notification about stop.
+  // In such case we need to forward the signal to the thread, otherwise
+  // the signal will be missed (as we do PTRACE_DETACH with arg=0) and
+  // any logic relying on signals will break. After forwarding we need to
+  // continue to wait for stopping, because the thread is not stopped yet.
+  // We do ignore delivery of SIGSTOP, because we want to make stop-the-world
+  // as invisible as possible.
+  for (;;) {
+    int status;
+    uptr waitpid_status;
+    HANDLE_EINTR(waitpid_status, internal_waitpid(tid, &status, __WALL));
+    int wperrno;
+    if (internal_iserror(waitpid_status, &wperrno)) {
+      // Got a ECHILD error. I don't think this situation is possible, but it
+      // doesn't hurt to report it.
+      VReport(1, "Waiting on thread %d failed, detaching (errno %d).\n",
+              tid, wperrno);
+      internal_ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+      return false;
+    }
+    if (WIFSTOPPED(status) && WSTOPSIG(status) != SIGSTOP) {
+      internal_ptrace(PTRACE_CONT, tid, nullptr,
+                      (void*)(uptr)WSTOPSIG(status));
+      continue;
     }
-    suspended_threads_list_.Append(tid);
     return true;
   }
 }
@@ -193,19 +210,32 @@ bool ThreadSuspender::SuspendAllThreads() {
   bool added_threads;
   bool first_iteration = true;
   do {
-    // Run through the directory entries once.
+    // Run through the directory entries once, attaching to every new thread
+    // before waiting for any of them, so that they all stop at once rather
+    // than one after another.
     added_threads = false;
+    pending_threads_.clear();
     pid_t tid = thread_lister.GetNextTID();
     while (tid >= 0) {
-      if (SuspendThread(tid))
-        added_threads = true;
+      if (!IsAttached(tid) && AttachToThread(tid))
+        pending_threads_.push_back(tid);
       tid = thread_lister.GetNextTID();
     }
+    for (uptr i = 0; i < pending_threads_.size(); i++) {
+      if (WaitForThreadStop(pending_threads_[i])) {
+        suspended_threads_list_.Append(pending_threads_[i]);
+        attached_threads_.push_back(pending_threads_[i]);
+        added_threads = true;
+      }
+    }
     if (thread_lister.error() || (first_iteration && !added_threads)) {
       // Detach threads and fail.
       ResumeAllThreads();
       return false;
     }
+    if (added_threads)
+      InternalSort(&attached_threads_, attached_threads_.size(),
+                   CompareThreadIDs);
     thread_lister.Reset();
     first_iteration = false;
   } while (added_threads);
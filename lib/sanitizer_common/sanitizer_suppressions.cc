@@ -25,9 +25,11 @@ SuppressionContext::SuppressionContext(const char *suppression_types[],
                                        int suppression_types_num)
     : suppression_types_(suppression_types),
       suppression_types_num_(suppression_types_num), suppressions_(1),
-      can_parse_(true) {
+      by_type_(1), can_parse_(true) {
   CHECK_LE(suppression_types_num_, kMaxSuppressionTypes);
   internal_memset(has_suppression_type_, 0, suppression_types_num_);
+  internal_memset(by_type_begin_, 0, sizeof(by_type_begin_));
+  internal_memset(unmatched_pcs_, 0, sizeof(unmatched_pcs_));
 }
 
 static bool GetPathAssumingFileIsRelativeToExec(const char *file_path,
@@ -75,14 +77,65 @@ void SuppressionContext::ParseFromFile(const char *filename) {
   Parse(file_contents);
 }
 
+static uptr HashPair(char a, char b) {
+  return (((u32)(u8)a << 8 | (u8)b) * 0x9E3779B1U) >> 26;
+}
+
+// Every pair of adjacent characters in the literal parts of templ appears in
+// the strings it matches, so the matching strings contain all of its pairs.
+static u64 RequiredPairs(const char *templ) {
+  u64 pairs = 0;
+  if (templ[0] == '^')
+    templ++;
+  for (; templ[0] && templ[0] != '$'; templ++) {
+    if (templ[0] != '*' && templ[1] && templ[1] != '*' && templ[1] != '$')
+      pairs |= 1ULL << HashPair(templ[0], templ[1]);
+  }
+  return pairs;
+}
+
+static u64 ContainedPairs(const char *str) {
+  u64 pairs = 0;
+  for (; str[0] && str[1]; str++)
+    pairs |= 1ULL << HashPair(str[0], str[1]);
+  return pairs;
+}
+
+int SuppressionContext::TypeIndex(const char *type) const {
+  for (int i = 0; i < suppression_types_num_; i++) {
+    if (type == suppression_types_[i] ||
+        0 == internal_strcmp(type, suppression_types_[i]))
+      return i;
+  }
+  return -1;
+}
+
+// Groups the suppressions by type, keeping the order of parsing within each
+// type, so that Match only looks at those of the type it is asked for.
+void SuppressionContext::IndexSuppressions() {
+  u32 count[kMaxSuppressionTypes + 1] = {};
+  for (uptr i = 0; i < suppressions_.size(); i++)
+    count[TypeIndex(suppressions_[i].type) + 1]++;
+  for (int t = 0; t < suppression_types_num_; t++)
+    count[t + 1] += count[t];
+  internal_memcpy(by_type_begin_, count, sizeof(by_type_begin_));
+  by_type_.resize(suppressions_.size());
+  for (uptr i = 0; i < suppressions_.size(); i++)
+    by_type_[count[TypeIndex(suppressions_[i].type)]++] = i;
+}
+
 bool SuppressionContext::Match(const char *str, const char *type,
                                Suppression **s) {
   can_parse_ = false;
-  if (!HasSuppressionType(type))
+  int t = TypeIndex(type);
+  if (t < 0 || !has_suppression_type_[t])
+    return false;
+  if (!str || str[0] == 0)
     return false;
-  for (uptr i = 0; i < suppressions_.size(); i++) {
-    Suppression &cur = suppressions_[i];
-    if (0 == internal_strcmp(cur.type, type) && TemplateMatch(cur.templ, str)) {
+  u64 pairs = ContainedPairs(str);
+  for (uptr i = by_type_begin_[t]; i < by_type_begin_[t + 1]; i++) {
+    Suppression &cur = suppressions_[by_type_[i]];
+    if ((cur.required_pairs & ~pairs) == 0 && TemplateMatch(cur.templ, str)) {
       *s = &cur;
       return true;
     }
@@ -90,6 +143,24 @@ bool SuppressionContext::Match(const char *str, const char *type,
   return false;
 }
 
+bool SuppressionContext::IsUnmatchedPC(uptr pc, const char *type) const {
+  int t = TypeIndex(type);
+  if (t < 0 || (u64)pc >> 56)
+    return false;
+  u64 key = (u64)pc << 8 | (t + 1);
+  uptr idx = (pc ^ (pc >> 12)) % kUnmatchedPCCacheSize;
+  return atomic_load_relaxed(&unmatched_pcs_[idx]) == key;
+}
+
+void SuppressionContext::AddUnmatchedPC(uptr pc, const char *type) {
+  int t = TypeIndex(type);
+  if (t < 0 || (u64)pc >> 56)
+    return;
+  u64 key = (u64)pc << 8 | (t + 1);
+  uptr idx = (pc ^ (pc >> 12)) % kUnmatchedPCCacheSize;
+  atomic_store_relaxed(&unmatched_pcs_[idx], key);
+}
+
 static const char *StripPrefix(const char *str, const char *prefix) {
   while (str && *str == *prefix) {
     str++;
@@ -132,6 +203,7 @@ void SuppressionContext::Parse(const char *str) {
       s.templ = (char*)InternalAlloc(end2 - line + 1);
       internal_memcpy(s.templ, line, end2 - line);
       s.templ[end2 - line] = 0;
+      s.required_pairs = RequiredPairs(s.templ);
       suppressions_.push_back(s);
       has_suppression_type_[type] = true;
     }
@@ -139,6 +211,7 @@ void SuppressionContext::Parse(const char *str) {
       break;
     line = end + 1;
   }
+  IndexSuppressions();
 }
 
 uptr SuppressionContext::SuppressionCount() const {
@@ -146,11 +219,8 @@ uptr SuppressionContext::SuppressionCount() const {
 }
 
 bool SuppressionContext::HasSuppressionType(const char *type) const {
-  for (int i = 0; i < suppression_types_num_; i++) {
-    if (0 == internal_strcmp(type, suppression_types_[i]))
-      return has_suppression_type_[i];
-  }
-  return false;
+  int t = TypeIndex(type);
+  return t >= 0 && has_suppression_type_[t];
 }
 
 const Suppression *SuppressionContext::SuppressionAt(uptr i) const {
@@ -25,6 +25,8 @@ struct Suppression {
   char *templ;
   atomic_uint32_t hit_count;
   uptr weight;
+  // The hashed character pairs which a string must contain to match templ.
+  u64 required_pairs;
 };
 
 class SuppressionContext {
@@ -37,6 +39,12 @@ class SuppressionContext {
   void Parse(const char *str);
 
   bool Match(const char *str, const char *type, Suppression **s);
+  // A cache of the PCs whose frames are known not to match any suppression of
+  // the given type, so that the callers need not symbolize them again. The
+  // caller is responsible for adding a PC only once all of its frames (and
+  // whatever else it matches for the PC) failed to match.
+  bool IsUnmatchedPC(uptr pc, const char *type) const;
+  void AddUnmatchedPC(uptr pc, const char *type);
   uptr SuppressionCount() const;
   bool HasSuppressionType(const char *type) const;
   const Suppression *SuppressionAt(uptr i) const;
@@ -44,12 +52,23 @@ class SuppressionContext {
 
  private:
   static const int kMaxSuppressionTypes = 32;
+  static const uptr kUnmatchedPCCacheSize = 1024;
   const char **const suppression_types_;
   const int suppression_types_num_;
 
+  int TypeIndex(const char *type) const;
+  void IndexSuppressions();
+
   InternalMmapVector<Suppression> suppressions_;
+  // The indices in suppressions_ grouped by type, in the order of parsing;
+  // those of type t are in [by_type_begin_[t], by_type_begin_[t + 1]).
+  InternalMmapVector<u32> by_type_;
+  u32 by_type_begin_[kMaxSuppressionTypes + 1];
   bool has_suppression_type_[kMaxSuppressionTypes];
   bool can_parse_;
+  // Direct-mapped, each entry is the PC shifted left by 8 bits or'ed with the
+  // type index plus one.
+  atomic_uint64_t unmatched_pcs_[kUnmatchedPCCacheSize];
 };
 
 }  // namespace __sanitizer
@@ -40,6 +40,20 @@ void AddressInfo::FillModuleInfo(const char *mod_name, uptr mod_offset,
   module_arch = mod_arch;
 }
 
+void AddressInfo::CopyFrom(const AddressInfo &other) {
+  Clear();
+  address = other.address;
+  if (other.module)
+    FillModuleInfo(other.module, other.module_offset, other.module_arch);
+  if (other.function)
+    function = internal_strdup(other.function);
+  function_offset = other.function_offset;
+  if (other.file)
+    file = internal_strdup(other.file);
+  line = other.line;
+  column = other.column;
+}
+
 SymbolizedStack::SymbolizedStack() : next(nullptr), info() {}
 
 SymbolizedStack *SymbolizedStack::New(uptr addr) {
@@ -56,6 +70,20 @@ void SymbolizedStack::ClearAll() {
   InternalFree(this);
 }
 
+SymbolizedStack *SymbolizedStack::CopyAll() const {
+  SymbolizedStack *first = nullptr, *last = nullptr;
+  for (const SymbolizedStack *cur = this; cur; cur = cur->next) {
+    SymbolizedStack *copy = New(cur->info.address);
+    copy->info.CopyFrom(cur->info);
+    if (last)
+      last->next = copy;
+    else
+      first = copy;
+    last = copy;
+  }
+  return first;
+}
+
 DataInfo::DataInfo() {
   internal_memset(this, 0, sizeof(DataInfo));
 }
@@ -70,6 +98,8 @@ void DataInfo::Clear() {
 Symbolizer *Symbolizer::symbolizer_;
 StaticSpinMutex Symbolizer::init_mu_;
 LowLevelAllocator Symbolizer::symbolizer_allocator_;
+Symbolizer::StartSymbolizationHook Symbolizer::start_hook_;
+Symbolizer::EndSymbolizationHook Symbolizer::end_hook_;
 
 void Symbolizer::AddHooks(Symbolizer::StartSymbolizationHook start_hook,
                           Symbolizer::EndSymbolizationHook end_hook) {
@@ -99,8 +129,9 @@ const char *Symbolizer::ModuleNameOwner::GetOwnedCopy(const char *str) {
 }
 
 Symbolizer::Symbolizer(IntrusiveList<SymbolizerTool> tools)
-    : module_names_(&mu_), modules_(), modules_fresh_(false), tools_(tools),
-      start_hook_(0), end_hook_(0) {}
+    : module_names_(&mu_), modules_(), modules_fresh_(false),
+      last_module_(0), tools_(tools),
+      pc_cache_(nullptr), data_cache_(nullptr), cache_size_(0) {}
 
 Symbolizer::SymbolizerScope::SymbolizerScope(const Symbolizer *sym)
     : sym_(sym) {
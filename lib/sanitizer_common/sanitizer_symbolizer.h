@@ -45,6 +45,8 @@ struct AddressInfo {
   // Deletes all strings and resets all fields.
   void Clear();
   void FillModuleInfo(const char *mod_name, uptr mod_offset, ModuleArch arch);
+  // Replaces the contents with a deep copy of OTHER.
+  void CopyFrom(const AddressInfo &other);
 };
 
 // Linked list of symbolized frames (each frame is described by AddressInfo).
@@ -55,6 +57,8 @@ struct SymbolizedStack {
   // Deletes current, and all subsequent frames in the linked list.
   // The object cannot be accessed after the call to this function.
   void ClearAll();
+  // Returns a deep copy of current, and all subsequent frames.
+  SymbolizedStack *CopyAll() const;
 
  private:
   SymbolizedStack();
@@ -89,6 +93,10 @@ class Symbolizer final {
   // Returns a list of symbolized frames for a given address (containing
   // all inlined functions, if necessary).
   SymbolizedStack *SymbolizePC(uptr address);
+  // Fills results[i] with SymbolizePC(addresses[i]), sending the addresses to
+  // an external symbolizer in as few round trips as possible.
+  void SymbolizePCs(const uptr *addresses, uptr count,
+                    SymbolizedStack **results);
   bool SymbolizeData(uptr address, DataInfo *info);
 
   // The module names Symbolizer returns are stable and unique for every given
@@ -115,9 +123,10 @@ class Symbolizer final {
   // during in-process symbolization.
   typedef void (*StartSymbolizationHook)();
   typedef void (*EndSymbolizationHook)();
-  // May be called at most once.
-  void AddHooks(StartSymbolizationHook start_hook,
-                EndSymbolizationHook end_hook);
+  // May be called at most once, before or after the symbolizer is
+  // initialized.
+  static void AddHooks(StartSymbolizationHook start_hook,
+                       EndSymbolizationHook end_hook);
 
   const LoadedModule *FindModuleForAddress(uptr address);
 
@@ -151,6 +160,9 @@ class Symbolizer final {
   ListOfModules modules_;
   // If stale, need to reload the modules before looking up addresses.
   bool modules_fresh_;
+  // Index of the module of the last address found; the frames of a stack
+  // trace are mostly in the same module.
+  uptr last_module_;
 
   // Platform-specific default demangler, must not return nullptr.
   const char *PlatformDemangle(const char *name);
@@ -166,12 +178,44 @@ class Symbolizer final {
 
   IntrusiveList<SymbolizerTool> tools_;
 
+  // Direct-mapped caches of SymbolizePC and SymbolizeData results, indexed
+  // by module and offset and allocated on first use. The entries point into
+  // modules_, so both caches are flushed whenever it is reloaded.
+  struct PCCacheEntry {
+    const LoadedModule *module;
+    uptr module_offset;
+    SymbolizedStack *frames;
+  };
+  struct DataCacheEntry {
+    const LoadedModule *module;
+    uptr module_offset;
+    // Owned copy of the result, with start relative to the module base.
+    DataInfo info;
+  };
+  PCCacheEntry *pc_cache_;
+  DataCacheEntry *data_cache_;
+  uptr cache_size_;
+  bool InitCaches();
+  void FlushCaches();
+  uptr CacheIndex(const LoadedModule *module, uptr module_offset) const;
+  SymbolizedStack *LookupPCCache(const LoadedModule *module,
+                                 uptr module_offset);
+  void InsertIntoPCCache(const LoadedModule *module, uptr module_offset,
+                         const SymbolizedStack *frames);
+  bool LookupDataCache(const LoadedModule *module, uptr module_offset,
+                       DataInfo *info);
+  void InsertIntoDataCache(const LoadedModule *module, uptr module_offset,
+                           const DataInfo &info);
+  // Returns the cached or module-only frames for addr. Sets *module if the
+  // symbolizer tools must fill them in, and to null otherwise.
+  SymbolizedStack *PrepareSymbolizePC(uptr addr, const LoadedModule **module);
+
   explicit Symbolizer(IntrusiveList<SymbolizerTool> tools);
 
   static LowLevelAllocator symbolizer_allocator_;
 
-  StartSymbolizationHook start_hook_;
-  EndSymbolizationHook end_hook_;
+  static StartSymbolizationHook start_hook_;
+  static EndSymbolizationHook end_hook_;
   class SymbolizerScope {
    public:
     explicit SymbolizerScope(const Symbolizer *sym);
@@ -0,0 +1,645 @@
+//===-- sanitizer_symbolizer_elf.cc ---------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between AddressSanitizer and ThreadSanitizer
+// run-time libraries.
+// In-process symbolizer reading ELF symbol tables and DWARF line tables.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_symbolizer_elf.h"
+
+#if SANITIZER_ELF_SYMBOLIZER
+
+#include "sanitizer_allocator_internal.h"
+#include "sanitizer_libc.h"
+#include "sanitizer_placement_new.h"
+#include "sanitizer_posix.h"
+
+#include <link.h>
+#include <sys/mman.h>
+
+#ifndef SHF_COMPRESSED
+#define SHF_COMPRESSED (1 << 11)
+#endif
+#ifndef STT_GNU_IFUNC
+#define STT_GNU_IFUNC 10
+#endif
+
+namespace __sanitizer {
+
+typedef ElfW(Ehdr) Elf_Ehdr;
+typedef ElfW(Shdr) Elf_Shdr;
+typedef ElfW(Sym) Elf_Sym;
+
+#if SANITIZER_WORDSIZE == 64
+static const u8 kElfClass = ELFCLASS64;
+#else
+static const u8 kElfClass = ELFCLASS32;
+#endif
+
+// Bounds-checked reader of DWARF data. Reading past the end sets |failed| and
+// returns zeros.
+struct DwarfReader {
+  const u8 *pos;
+  const u8 *end;
+  bool failed;
+
+  DwarfReader(const u8 *begin, const u8 *end)
+      : pos(begin), end(end), failed(false) {}
+
+  bool Has(uptr n) {
+    if (failed || (uptr)(end - pos) < n) {
+      failed = true;
+      return false;
+    }
+    return true;
+  }
+  void Skip(uptr n) {
+    if (Has(n)) pos += n;
+  }
+  u64 Fixed(uptr n) {
+    if (!Has(n)) return 0;
+    u64 value = 0;
+    internal_memcpy(&value, pos, n);  // DWARF data is in the target's order.
+    pos += n;
+    return value;
+  }
+  u8 U8() { return Fixed(1); }
+  u16 U16() { return Fixed(2); }
+  u32 U32() { return Fixed(4); }
+  u64 U64() { return Fixed(8); }
+  u64 ULEB() {
+    u64 value = 0;
+    for (uptr shift = 0; Has(1); shift += 7) {
+      u8 byte = *pos++;
+      if (shift < 64) value |= (u64)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+    return 0;
+  }
+  s64 SLEB() {
+    u64 value = 0;
+    uptr shift = 0;
+    while (Has(1)) {
+      u8 byte = *pos++;
+      if (shift < 64) value |= (u64)(byte & 0x7f) << shift;
+      shift += 7;
+      if (!(byte & 0x80)) {
+        if (shift < 64 && (byte & 0x40)) value |= ~(u64)0 << shift;
+        return (s64)value;
+      }
+    }
+    return 0;
+  }
+  const char *CString() {
+    const u8 *begin = pos;
+    while (Has(1))
+      if (!*pos++) return (const char *)begin;
+    return nullptr;
+  }
+};
+
+// DWARF constants used by line tables.
+enum {
+  DW_LNS_copy = 1,
+  DW_LNS_advance_pc = 2,
+  DW_LNS_advance_line = 3,
+  DW_LNS_set_file = 4,
+  DW_LNS_set_column = 5,
+  DW_LNS_negate_stmt = 6,
+  DW_LNS_set_basic_block = 7,
+  DW_LNS_const_add_pc = 8,
+  DW_LNS_fixed_advance_pc = 9,
+  DW_LNE_end_sequence = 1,
+  DW_LNE_set_address = 2,
+  DW_LNCT_path = 1,
+  DW_LNCT_directory_index = 2,
+  DW_FORM_data2 = 0x05,
+  DW_FORM_data4 = 0x06,
+  DW_FORM_data8 = 0x07,
+  DW_FORM_string = 0x08,
+  DW_FORM_block = 0x09,
+  DW_FORM_data1 = 0x0b,
+  DW_FORM_strp = 0x0e,
+  DW_FORM_udata = 0x0f,
+  DW_FORM_data16 = 0x1e,
+  DW_FORM_line_strp = 0x1f,
+};
+
+// The header of a line table unit.
+struct LineProgram {
+  u16 version;
+  bool dwarf64;
+  u8 address_size;
+  u8 min_inst_length;
+  u8 line_range;
+  s8 line_base;
+  u8 opcode_base;
+  const u8 *standard_opcode_lengths;
+  // Directory and file tables, in the format of the version.
+  const u8 *tables;
+  const u8 *program;
+  const u8 *end;
+};
+
+struct LineRow {
+  uptr address;
+  u64 file;
+  u64 line;
+  u64 column;
+};
+
+// Parses the header of the unit at r->pos and moves r to the next unit.
+static bool ParseLineProgram(DwarfReader *r, LineProgram *lp) {
+  u64 length = r->U32();
+  lp->dwarf64 = length == 0xffffffff;
+  if (lp->dwarf64) length = r->U64();
+  if (!r->Has(length)) return false;
+  const u8 *unit_end = r->pos + length;
+  DwarfReader h(r->pos, unit_end);
+  r->pos = unit_end;
+
+  lp->version = h.U16();
+  if (lp->version < 2 || lp->version > 5) return false;
+  lp->address_size = sizeof(uptr);
+  if (lp->version >= 5) {
+    lp->address_size = h.U8();
+    h.U8();  // segment_selector_size
+  }
+  u64 header_length = lp->dwarf64 ? h.U64() : h.U32();
+  if (!h.Has(header_length)) return false;
+  lp->program = h.pos + header_length;
+  lp->end = unit_end;
+  lp->min_inst_length = h.U8();
+  if (lp->version >= 4) h.U8();  // maximum_operations_per_instruction
+  h.U8();  // default_is_stmt
+  lp->line_base = (s8)h.U8();
+  lp->line_range = h.U8();
+  lp->opcode_base = h.U8();
+  lp->standard_opcode_lengths = h.pos;
+  if (lp->opcode_base) h.Skip(lp->opcode_base - 1);
+  lp->tables = h.pos;
+  return !h.failed && lp->line_range && lp->opcode_base &&
+         lp->address_size <= sizeof(u64) && h.pos <= lp->program;
+}
+
+// Runs the line program of lp. Computes the range of addresses it describes
+// and, if |target| is one of them, the row that covers it. Sequences starting
+// at address 0 or -1 describe code that the linker discarded and are skipped.
+static bool RunLineProgram(const LineProgram &lp, uptr target, LineRow *match,
+                           uptr *begin, uptr *end) {
+  DwarfReader r(lp.program, lp.end);
+  LineRow row = {0, 1, 1, 0}, prev = row;
+  bool have_prev = false, discarded = false, found = false;
+  *begin = ~(uptr)0;
+  *end = 0;
+  while (r.pos < r.end && !r.failed) {
+    u8 opcode = r.U8();
+    bool emit = false, end_sequence = false;
+    if (opcode >= lp.opcode_base) {
+      uptr adjusted = opcode - lp.opcode_base;
+      row.address += (adjusted / lp.line_range) * lp.min_inst_length;
+      row.line += lp.line_base + (s64)(adjusted % lp.line_range);
+      emit = true;
+    } else if (opcode == 0) {
+      u64 length = r.ULEB();
+      if (!length || !r.Has(length)) break;
+      const u8 *next = r.pos + length;
+      u8 sub_opcode = r.U8();
+      if (sub_opcode == DW_LNE_end_sequence) {
+        emit = end_sequence = true;
+      } else if (sub_opcode == DW_LNE_set_address) {
+        row.address = r.Fixed(length - 1 <= 8 ? length - 1 : 8);
+      }
+      r.pos = next;
+    } else {
+      switch (opcode) {
+        case DW_LNS_copy:
+          emit = true;
+          break;
+        case DW_LNS_advance_pc:
+          row.address += r.ULEB() * lp.min_inst_length;
+          break;
+        case DW_LNS_advance_line:
+          row.line += r.SLEB();
+          break;
+        case DW_LNS_set_file:
+          row.file = r.ULEB();
+          break;
+        case DW_LNS_set_column:
+          row.column = r.ULEB();
+          break;
+        case DW_LNS_negate_stmt:
+        case DW_LNS_set_basic_block:
+          break;
+        case DW_LNS_const_add_pc:
+          row.address += ((255 - lp.opcode_base) / lp.line_range) *
+                         lp.min_inst_length;
+          break;
+        case DW_LNS_fixed_advance_pc:
+          row.address += r.U16();
+          break;
+        default:
+          // Unknown standard opcode: skip its operands.
+          for (u8 i = 0; i < lp.standard_opcode_lengths[opcode - 1]; i++)
+            r.ULEB();
+      }
+    }
+    if (!emit) continue;
+    if (!have_prev)
+      discarded = row.address == 0 || row.address == ~(uptr)0;
+    if (have_prev && !discarded) {
+      if (prev.address <= target && target < row.address && !found) {
+        *match = prev;
+        found = true;
+      }
+      if (prev.address < *begin) *begin = prev.address;
+      if (row.address > *end) *end = row.address;
+    }
+    prev = row;
+    have_prev = !end_sequence;
+    if (end_sequence) {
+      LineRow initial = {0, 1, 1, 0};
+      row = initial;
+    }
+  }
+  return found;
+}
+
+// Reads an attribute of a DWARF 5 directory or file entry. Sets *str for
+// string forms and *value for constant forms.
+static void ReadEntryForm(DwarfReader *r, u64 form, bool dwarf64,
+                          const ElfSymbolizer::Section &line_str,
+                          const ElfSymbolizer::Section &str,
+                          const char **str_value, u64 *value) {
+  u64 offset;
+  const ElfSymbolizer::Section *section = nullptr;
+  switch (form) {
+    case DW_FORM_string:
+      *str_value = r->CString();
+      return;
+    case DW_FORM_line_strp:
+    case DW_FORM_strp:
+      offset = dwarf64 ? r->U64() : r->U32();
+      section = form == DW_FORM_line_strp ? &line_str : &str;
+      if (section->data && offset < section->size &&
+          internal_memchr(section->data + offset, 0, section->size - offset))
+        *str_value = (const char *)section->data + offset;
+      return;
+    case DW_FORM_data1: *value = r->U8(); return;
+    case DW_FORM_data2: *value = r->U16(); return;
+    case DW_FORM_data4: *value = r->U32(); return;
+    case DW_FORM_data8: *value = r->U64(); return;
+    case DW_FORM_udata: *value = r->ULEB(); return;
+    case DW_FORM_data16: r->Skip(16); return;
+    case DW_FORM_block: r->Skip(r->ULEB()); return;
+    default:
+      // Forms that need the unit's string offsets table aren't supported.
+      r->failed = true;
+  }
+}
+
+// Finds the name and directory of a DWARF 5 table entry at r->pos.
+static void ReadEntry(DwarfReader *r, const u8 *formats, u8 format_count,
+                      bool dwarf64, const ElfSymbolizer::Section &line_str,
+                      const ElfSymbolizer::Section &str, const char **path,
+                      u64 *dir) {
+  DwarfReader f(formats, r->end);
+  for (u8 i = 0; i < format_count && !r->failed; i++) {
+    u64 content_type = f.ULEB();
+    u64 form = f.ULEB();
+    const char *str_value = nullptr;
+    u64 value = 0;
+    ReadEntryForm(r, form, dwarf64, line_str, str, &str_value, &value);
+    if (content_type == DW_LNCT_path) *path = str_value;
+    if (content_type == DW_LNCT_directory_index) *dir = value;
+  }
+}
+
+// Finds the name of file |index| of lp and the name of its directory, which
+// may be null if unknown.
+static bool FindFileName(const LineProgram &lp,
+                         const ElfSymbolizer::Section &line_str,
+                         const ElfSymbolizer::Section &str, u64 index,
+                         const char **file, const char **dir) {
+  DwarfReader r(lp.tables, lp.program);
+  *file = *dir = nullptr;
+  if (lp.version < 5) {
+    // Both tables are lists of entries ending with an empty string, and
+    // indices start at 1. Directory 0 is the compilation directory, which is
+    // only known from .debug_info.
+    const u8 *dirs = r.pos;
+    while (const char *d = r.CString())
+      if (!*d) break;
+    for (u64 i = 1; !r.failed; i++) {
+      const char *name = r.CString();
+      if (!name || !*name) return false;
+      u64 dir_index = r.ULEB();
+      r.ULEB();  // modification time
+      r.ULEB();  // length
+      if (i != index) continue;
+      *file = name;
+      DwarfReader d(dirs, lp.program);
+      for (u64 j = 1; j <= dir_index; j++) {
+        const char *dir_name = d.CString();
+        if (!dir_name || !*dir_name) break;
+        if (j == dir_index) *dir = dir_name;
+      }
+      return true;
+    }
+    return false;
+  }
+  // Both tables start with the format of their entries, and indices start at
+  // 0. Directory 0 is the compilation directory.
+  u8 dir_format_count = r.U8();
+  const u8 *dir_formats = r.pos;
+  for (u8 i = 0; i < dir_format_count; i++) {
+    r.ULEB();
+    r.ULEB();
+  }
+  u64 dir_count = r.ULEB();
+  const u8 *dirs = r.pos;
+  for (u64 i = 0; i < dir_count && !r.failed; i++) {
+    const char *unused_path = nullptr;
+    u64 unused_dir = 0;
+    ReadEntry(&r, dir_formats, dir_format_count, lp.dwarf64, line_str, str,
+              &unused_path, &unused_dir);
+  }
+  u8 file_format_count = r.U8();
+  const u8 *file_formats = r.pos;
+  for (u8 i = 0; i < file_format_count; i++) {
+    r.ULEB();
+    r.ULEB();
+  }
+  u64 file_count = r.ULEB();
+  for (u64 i = 0; i < file_count && !r.failed; i++) {
+    const char *name = nullptr;
+    u64 dir_index = 0;
+    ReadEntry(&r, file_formats, file_format_count, lp.dwarf64, line_str, str,
+              &name, &dir_index);
+    if (i != index) continue;
+    *file = name;
+    DwarfReader d(dirs, lp.program);
+    for (u64 j = 0; j < dir_count && j <= dir_index && !d.failed; j++) {
+      const char *dir_name = nullptr;
+      u64 unused_dir = 0;
+      ReadEntry(&d, dir_formats, dir_format_count, lp.dwarf64, line_str, str,
+                &dir_name, &unused_dir);
+      if (j == dir_index) *dir = dir_name;
+    }
+    return name != nullptr;
+  }
+  return false;
+}
+
+ElfSymbolizer::ElfSymbolizer() {
+  modules_.Initialize(0);
+}
+
+ElfSymbolizer *ElfSymbolizer::get(LowLevelAllocator *alloc) {
+  return new(*alloc) ElfSymbolizer();
+}
+
+ElfSymbolizer::Module *ElfSymbolizer::GetModule(const char *path) {
+  for (uptr i = 0; i < modules_.size(); i++)
+    if (!internal_strcmp(modules_[i].path, path))
+      return modules_[i].valid ? &modules_[i] : nullptr;
+  Module module;
+  internal_memset(&module, 0, sizeof(module));
+  module.path = internal_strdup(path);
+  LoadModule(&module);
+  modules_.push_back(module);
+  return module.valid ? &modules_[modules_.size() - 1] : nullptr;
+}
+
+static bool SymbolLess(const ElfSymbolizer::Symbol &a,
+                       const ElfSymbolizer::Symbol &b) {
+  return a.address < b.address;
+}
+
+static bool LineUnitLess(const ElfSymbolizer::LineUnit &a,
+                         const ElfSymbolizer::LineUnit &b) {
+  return a.begin < b.begin;
+}
+
+void ElfSymbolizer::LoadModule(Module *module) {
+  error_t err;
+  fd_t fd = OpenFile(module->path, RdOnly, &err);
+  if (fd == kInvalidFd) return;
+  uptr size = internal_filesize(fd);
+  uptr map = size == (uptr)-1 || size < sizeof(Elf_Ehdr)
+                 ? (uptr)-1
+                 : internal_mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  CloseFile(fd);
+  if (size == (uptr)-1 || size < sizeof(Elf_Ehdr) || internal_iserror(map))
+    return;
+  const u8 *image = (const u8 *)map;
+  module->image = image;
+  module->image_size = size;
+
+  const Elf_Ehdr *ehdr = (const Elf_Ehdr *)image;
+  if (internal_memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != kElfClass ||
+      ehdr->e_shentsize != sizeof(Elf_Shdr) || ehdr->e_shoff > size ||
+      ehdr->e_shnum > (size - ehdr->e_shoff) / sizeof(Elf_Shdr) ||
+      ehdr->e_shstrndx >= ehdr->e_shnum)
+    return;
+  const Elf_Shdr *sections = (const Elf_Shdr *)(image + ehdr->e_shoff);
+  uptr num_sections = ehdr->e_shnum;
+  auto in_image = [&](const Elf_Shdr &s) {
+    return s.sh_type != SHT_NOBITS && s.sh_offset <= size &&
+           s.sh_size <= size - s.sh_offset;
+  };
+  const Elf_Shdr &shstrtab = sections[ehdr->e_shstrndx];
+  if (!in_image(shstrtab)) return;
+
+  const Elf_Shdr *symtab = nullptr, *dynsym = nullptr;
+  for (uptr i = 0; i < num_sections; i++) {
+    const Elf_Shdr &s = sections[i];
+    if (!in_image(s)) continue;
+    if (s.sh_type == SHT_SYMTAB) symtab = &s;
+    if (s.sh_type == SHT_DYNSYM) dynsym = &s;
+    if (s.sh_name >= shstrtab.sh_size || (s.sh_flags & SHF_COMPRESSED))
+      continue;
+    const char *name = (const char *)image + shstrtab.sh_offset + s.sh_name;
+    uptr max_len = shstrtab.sh_size - s.sh_name;
+    Section section = {image + s.sh_offset, (uptr)s.sh_size};
+    if (!internal_strncmp(name, ".debug_line", max_len))
+      module->debug_line = section;
+    else if (!internal_strncmp(name, ".debug_line_str", max_len))
+      module->debug_line_str = section;
+    else if (!internal_strncmp(name, ".debug_str", max_len))
+      module->debug_str = section;
+  }
+  if (!symtab) symtab = dynsym;
+  if (!symtab || symtab->sh_link >= num_sections ||
+      !in_image(sections[symtab->sh_link]))
+    return;
+  const Elf_Shdr &strtab = sections[symtab->sh_link];
+  const char *strings = (const char *)image + strtab.sh_offset;
+  const Elf_Sym *syms = (const Elf_Sym *)(image + symtab->sh_offset);
+  uptr num_syms = symtab->sh_size / sizeof(Elf_Sym);
+
+  // Count, then fill the function and object indexes.
+  for (int pass = 0; pass < 2; pass++) {
+    uptr num_functions = 0, num_objects = 0;
+    for (uptr i = 0; i < num_syms; i++) {
+      const Elf_Sym &sym = syms[i];
+      u8 type = sym.st_info & 0xf;
+      bool is_function = type == STT_FUNC || type == STT_GNU_IFUNC;
+      if ((!is_function && type != STT_OBJECT) || sym.st_shndx == SHN_UNDEF ||
+          sym.st_shndx >= SHN_LORESERVE || !sym.st_value ||
+          sym.st_name >= strtab.sh_size || !strings[sym.st_name])
+        continue;
+      Symbol symbol = {(uptr)sym.st_value, (uptr)sym.st_size,
+                       strings + sym.st_name};
+      if (is_function) {
+        if (pass) module->functions[num_functions] = symbol;
+        num_functions++;
+      } else {
+        if (pass) module->objects[num_objects] = symbol;
+        num_objects++;
+      }
+    }
+    if (pass) break;
+    // The string table must end with a terminator for the names to be safe.
+    if (!strtab.sh_size || strings[strtab.sh_size - 1]) return;
+    module->num_functions = num_functions;
+    module->num_objects = num_objects;
+    if (num_functions)
+      module->functions = (Symbol *)MmapOrDie(
+          num_functions * sizeof(Symbol), "ElfSymbolizer functions");
+    if (num_objects)
+      module->objects = (Symbol *)MmapOrDie(num_objects * sizeof(Symbol),
+                                            "ElfSymbolizer objects");
+  }
+  InternalSort(&module->functions, module->num_functions, SymbolLess);
+  InternalSort(&module->objects, module->num_objects, SymbolLess);
+  module->valid = true;
+}
+
+// Returns the last symbol starting at or before |offset|, or null.
+static const ElfSymbolizer::Symbol *FindSymbol(
+    const ElfSymbolizer::Symbol *symbols, uptr num_symbols, uptr offset) {
+  uptr lo = 0, hi = num_symbols;
+  while (lo < hi) {
+    uptr mid = lo + (hi - lo) / 2;
+    if (symbols[mid].address <= offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo ? &symbols[lo - 1] : nullptr;
+}
+
+void ElfSymbolizer::IndexLineUnits(Module *module) {
+  module->units_indexed = true;
+  const Section &debug_line = module->debug_line;
+  if (!debug_line.data) return;
+  for (int pass = 0; pass < 2; pass++) {
+    DwarfReader r(debug_line.data, debug_line.data + debug_line.size);
+    uptr num_units = 0;
+    while (r.pos < r.end && !r.failed) {
+      uptr offset = r.pos - debug_line.data;
+      LineProgram lp;
+      if (!ParseLineProgram(&r, &lp)) continue;
+      LineRow unused_row;
+      uptr begin, end;
+      RunLineProgram(lp, 0, &unused_row, &begin, &end);
+      if (begin >= end) continue;
+      if (pass) {
+        LineUnit unit = {begin, end, offset};
+        module->units[num_units] = unit;
+      }
+      num_units++;
+    }
+    if (pass || !num_units) break;
+    module->num_units = num_units;
+    module->units = (LineUnit *)MmapOrDie(num_units * sizeof(LineUnit),
+                                          "ElfSymbolizer line units");
+  }
+  InternalSort(&module->units, module->num_units, LineUnitLess);
+}
+
+bool ElfSymbolizer::FindLine(Module *module, uptr offset, AddressInfo *info) {
+  if (!module->units_indexed) IndexLineUnits(module);
+  const Section &debug_line = module->debug_line;
+  // Units are sorted by their first address; the ones after the first that
+  // starts past offset can't cover it.
+  for (uptr i = 0; i < module->num_units; i++) {
+    const LineUnit &unit = module->units[i];
+    if (unit.begin > offset) break;
+    if (offset >= unit.end) continue;
+    DwarfReader r(debug_line.data + unit.offset,
+                  debug_line.data + debug_line.size);
+    LineProgram lp;
+    LineRow row;
+    uptr begin, end;
+    if (!ParseLineProgram(&r, &lp) ||
+        !RunLineProgram(lp, offset, &row, &begin, &end))
+      continue;
+    const char *file, *dir;
+    if (!FindFileName(lp, module->debug_line_str, module->debug_str, row.file,
+                      &file, &dir) ||
+        !file)
+      return false;
+    if (file[0] != '/' && dir && dir[0]) {
+      uptr len = internal_strlen(dir) + internal_strlen(file) + 2;
+      info->file = (char *)InternalAlloc(len);
+      internal_snprintf(info->file, len, "%s/%s", dir, file);
+    } else {
+      info->file = internal_strdup(file);
+    }
+    info->line = row.line;
+    info->column = row.column;
+    return true;
+  }
+  return false;
+}
+
+bool ElfSymbolizer::SymbolizePC(uptr addr, SymbolizedStack *stack) {
+  AddressInfo *info = &stack->info;
+  if (!info->module) return false;
+  Module *module = GetModule(info->module);
+  if (!module) return false;
+  uptr offset = info->module_offset;
+  const Symbol *symbol =
+      FindSymbol(module->functions, module->num_functions, offset);
+  // Assembly functions often have no size; they are assumed to extend up to
+  // the next function.
+  if (symbol && symbol->size && offset - symbol->address >= symbol->size)
+    symbol = nullptr;
+  bool has_line = FindLine(module, offset, info);
+  if (!symbol && !has_line) return false;
+  if (symbol) {
+    info->function = internal_strdup(DemangleSwiftAndCXX(symbol->name));
+    info->function_offset = offset - symbol->address;
+  }
+  return true;
+}
+
+bool ElfSymbolizer::SymbolizeData(uptr addr, DataInfo *info) {
+  if (!info->module) return false;
+  Module *module = GetModule(info->module);
+  if (!module) return false;
+  uptr offset = info->module_offset;
+  const Symbol *symbol =
+      FindSymbol(module->objects, module->num_objects, offset);
+  if (!symbol ||
+      (offset != symbol->address && offset - symbol->address >= symbol->size))
+    return false;
+  info->name = internal_strdup(symbol->name);
+  info->start = addr - offset + symbol->address;
+  info->size = symbol->size;
+  return true;
+}
+
+}  // namespace __sanitizer
+
+#endif  // SANITIZER_ELF_SYMBOLIZER
@@ -0,0 +1,92 @@
+//===-- sanitizer_symbolizer_elf.h ------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between AddressSanitizer and ThreadSanitizer
+// run-time libraries.
+// In-process symbolizer reading ELF symbol tables and DWARF line tables.
+//===----------------------------------------------------------------------===//
+#ifndef SANITIZER_SYMBOLIZER_ELF_H
+#define SANITIZER_SYMBOLIZER_ELF_H
+
+#include "sanitizer_platform.h"
+#include "sanitizer_common.h"
+#include "sanitizer_symbolizer_internal.h"
+
+#if SANITIZER_LINUX || SANITIZER_FREEBSD
+# define SANITIZER_ELF_SYMBOLIZER 1
+#else
+# define SANITIZER_ELF_SYMBOLIZER 0
+#endif
+
+namespace __sanitizer {
+
+// Symbolizes addresses with the .symtab (or .dynsym) and .debug_line sections
+// of the module files, which are mapped read-only. The symbols of a module are
+// sorted by address the first time one of its addresses is looked up, and so
+// are the address ranges of its line table units; only the unit covering an
+// address is run to find its line. It needs neither a helper process nor
+// libc, so it works in sandboxes and when no external symbolizer is found.
+class ElfSymbolizer : public SymbolizerTool {
+ public:
+  static ElfSymbolizer *get(LowLevelAllocator *alloc);
+
+  bool SymbolizePC(uptr addr, SymbolizedStack *stack) override;
+
+  bool SymbolizeData(uptr addr, DataInfo *info) override;
+
+  struct Symbol {
+    uptr address;
+    uptr size;
+    const char *name;
+  };
+
+  // The range of addresses described by a unit of .debug_line.
+  struct LineUnit {
+    uptr begin;
+    uptr end;
+    uptr offset;
+  };
+
+  struct Section {
+    const u8 *data;
+    uptr size;
+  };
+
+ private:
+  struct Module {
+    char *path;
+    // False if the file could not be read as ELF.
+    bool valid;
+    const u8 *image;
+    uptr image_size;
+    Symbol *functions;
+    uptr num_functions;
+    Symbol *objects;
+    uptr num_objects;
+    Section debug_line;
+    Section debug_line_str;
+    Section debug_str;
+    // Built on the first line lookup.
+    bool units_indexed;
+    LineUnit *units;
+    uptr num_units;
+  };
+
+  ElfSymbolizer();
+  Module *GetModule(const char *path);
+  void LoadModule(Module *module);
+  void IndexLineUnits(Module *module);
+  bool FindLine(Module *module, uptr offset, AddressInfo *info);
+
+  InternalMmapVectorNoCtor<Module> modules_;
+};
+
+}  // namespace __sanitizer
+
+#endif  // SANITIZER_SYMBOLIZER_ELF_H
@@ -52,6 +52,14 @@ class SymbolizerTool {
     UNIMPLEMENTED();
   }
 
+  // Symbolizes, like SymbolizePC, each stacks[i] for which done[i] is false,
+  // and sets done[i] for the ones that were symbolized.
+  virtual void SymbolizePCs(SymbolizedStack **stacks, bool *done, uptr count) {
+    for (uptr i = 0; i < count; i++)
+      if (!done[i])
+        done[i] = SymbolizePC(stacks[i]->info.address, stacks[i]);
+  }
+
   // The |info| parameter is inout. It is pre-filled with the module base
   // and module offset values.
   virtual bool SymbolizeData(uptr addr, DataInfo *info) {
@@ -73,6 +81,14 @@ class SymbolizerProcess {
  public:
   explicit SymbolizerProcess(const char *path, bool use_forkpty = false);
   const char *SendCommand(const char *command);
+  // Sends |count| newline-terminated commands in one write and calls
+  // |handler| with each response, in order. Only for tools whose responses
+  // are delimited by ReachedEndOfOutput and that read their input ahead of
+  // the output. Doesn't restart the tool; returns false if it fails, after
+  // which SendCommand may be used to restart it.
+  typedef void (*ResponseHandler)(const char *response, uptr index, void *arg);
+  bool SendCommands(const char *commands, uptr count, ResponseHandler handler,
+                    void *arg);
 
  protected:
   virtual bool ReachedEndOfOutput(const char *buffer, uptr length) const {
@@ -93,6 +109,8 @@ class SymbolizerProcess {
  private:
   bool Restart();
   const char *SendCommandImpl(const char *command);
+  bool SendCommandsImpl(const char *commands, uptr count,
+                        ResponseHandler handler, void *arg);
   bool WriteToSymbolizer(const char *buffer, uptr length);
   bool StartSymbolizerSubprocess();
 
@@ -121,9 +139,16 @@ class LLVMSymbolizer : public SymbolizerTool {
 
   bool SymbolizePC(uptr addr, SymbolizedStack *stack) override;
 
+  void SymbolizePCs(SymbolizedStack **stacks, bool *done, uptr count) override;
+
   bool SymbolizeData(uptr addr, DataInfo *info) override;
 
  private:
+  // Formats a command into buffer at offset pos. Returns its length, or 0 if
+  // it doesn't fit.
+  uptr FormatCommand(char *buffer, uptr pos, uptr size, bool is_data,
+                     const char *module_name, uptr module_offset,
+                     ModuleArch arch);
   const char *FormatAndSendCommand(bool is_data, const char *module_name,
                                    uptr module_offset, ModuleArch arch);
 
@@ -13,6 +13,8 @@
 
 #include "sanitizer_allocator_internal.h"
 #include "sanitizer_internal_defs.h"
+#include "sanitizer_report_bundle.h"
+#include "sanitizer_self_profile.h"
 #include "sanitizer_symbolizer_internal.h"
 
 namespace __sanitizer {
@@ -60,44 +62,184 @@ const char *ExtractTokenUpToDelimiter(const char *str, const char *delimiter,
   return prefix_end;
 }
 
-SymbolizedStack *Symbolizer::SymbolizePC(uptr addr) {
-  BlockingMutexLock l(&mu_);
-  const char *module_name;
-  uptr module_offset;
-  ModuleArch arch;
+// Processes that keep running after an error (halt_on_error=0) tend to report
+// the same frames and globals over and over, and each query to an external
+// symbolizer is much more expensive than the report itself. So the results
+// are cached by module and offset. The module list is only reloaded, which
+// flushes the caches, when an address is not found in it, e.g. after dlopen
+// or dlclose.
+bool Symbolizer::InitCaches() {
+  if (pc_cache_) return true;
+  if (common_flags()->symbolize_cache_size <= 0) return false;
+  cache_size_ = RoundUpToPowerOfTwo(common_flags()->symbolize_cache_size);
+  pc_cache_ = (PCCacheEntry *)MmapOrDie(cache_size_ * sizeof(pc_cache_[0]),
+                                        "SymbolizePC cache");
+  data_cache_ = (DataCacheEntry *)MmapOrDie(
+      cache_size_ * sizeof(data_cache_[0]), "SymbolizeData cache");
+  return true;
+}
+
+void Symbolizer::FlushCaches() {
+  if (!pc_cache_) return;
+  for (uptr i = 0; i < cache_size_; i++) {
+    if (pc_cache_[i].frames)
+      pc_cache_[i].frames->ClearAll();
+    pc_cache_[i].module = nullptr;
+    pc_cache_[i].frames = nullptr;
+    data_cache_[i].info.Clear();
+    data_cache_[i].module = nullptr;
+  }
+}
+
+uptr Symbolizer::CacheIndex(const LoadedModule *module,
+                            uptr module_offset) const {
+  uptr module_index = module - &modules_[0];
+  return ((module_offset >> 2) ^ (module_index * 0x9E3779B1U)) &
+         (cache_size_ - 1);
+}
+
+SymbolizedStack *Symbolizer::LookupPCCache(const LoadedModule *module,
+                                           uptr module_offset) {
+  if (!pc_cache_) return nullptr;
+  PCCacheEntry &entry = pc_cache_[CacheIndex(module, module_offset)];
+  if (entry.module != module || entry.module_offset != module_offset)
+    return nullptr;
+  return entry.frames;
+}
+
+void Symbolizer::InsertIntoPCCache(const LoadedModule *module,
+                                   uptr module_offset,
+                                   const SymbolizedStack *frames) {
+  if (!InitCaches()) return;
+  PCCacheEntry &entry = pc_cache_[CacheIndex(module, module_offset)];
+  if (entry.frames)
+    entry.frames->ClearAll();
+  entry.module = module;
+  entry.module_offset = module_offset;
+  entry.frames = frames->CopyAll();
+}
+
+static void CopyDataInfo(DataInfo *dst, const DataInfo &src, sptr delta) {
+  dst->Clear();
+  internal_memcpy(dst, &src, sizeof(*dst));
+  if (src.module) dst->module = internal_strdup(src.module);
+  if (src.file) dst->file = internal_strdup(src.file);
+  if (src.name) dst->name = internal_strdup(src.name);
+  dst->start += delta;
+}
+
+bool Symbolizer::LookupDataCache(const LoadedModule *module,
+                                 uptr module_offset, DataInfo *info) {
+  if (!data_cache_) return false;
+  DataCacheEntry &entry = data_cache_[CacheIndex(module, module_offset)];
+  if (entry.module != module || entry.module_offset != module_offset)
+    return false;
+  CopyDataInfo(info, entry.info, module->base_address());
+  return true;
+}
+
+void Symbolizer::InsertIntoDataCache(const LoadedModule *module,
+                                     uptr module_offset,
+                                     const DataInfo &info) {
+  if (!InitCaches()) return;
+  DataCacheEntry &entry = data_cache_[CacheIndex(module, module_offset)];
+  entry.module = module;
+  entry.module_offset = module_offset;
+  CopyDataInfo(&entry.info, info, -(sptr)module->base_address());
+}
+
+SymbolizedStack *Symbolizer::PrepareSymbolizePC(uptr addr,
+                                                const LoadedModule **module) {
   SymbolizedStack *res = SymbolizedStack::New(addr);
-  if (!FindModuleNameAndOffsetForAddress(addr, &module_name, &module_offset,
-                                         &arch))
+  *module = nullptr;
+  const LoadedModule *found = FindModuleForAddress(addr);
+  if (!found)
     return res;
+  uptr module_offset = addr - found->base_address();
   // Always fill data about module name and offset.
-  res->info.FillModuleInfo(module_name, module_offset, arch);
+  res->info.FillModuleInfo(found->full_name(), module_offset, found->arch());
+  // Without symbolizer tools there is nothing worth caching.
+  if (tools_.empty())
+    return res;
+  if (SymbolizedStack *cached = LookupPCCache(found, module_offset)) {
+    res->ClearAll();
+    return cached->CopyAll();
+  }
+  *module = found;
+  return res;
+}
+
+SymbolizedStack *Symbolizer::SymbolizePC(uptr addr) {
+  ScopedSelfProfile self_profile(kSelfProfileSymbolize);
+  BlockingMutexLock l(&mu_);
+  const LoadedModule *module;
+  SymbolizedStack *res = PrepareSymbolizePC(addr, &module);
+  if (!module)
+    return res;
   for (auto &tool : tools_) {
     SymbolizerScope sym_scope(this);
-    if (tool.SymbolizePC(addr, res)) {
-      return res;
-    }
+    if (tool.SymbolizePC(addr, res))
+      break;
   }
+  InsertIntoPCCache(module, res->info.module_offset, res);
   return res;
 }
 
+void Symbolizer::SymbolizePCs(const uptr *addresses, uptr count,
+                              SymbolizedStack **results) {
+  BlockingMutexLock l(&mu_);
+  InternalScopedBuffer<SymbolizedStack *> pending(count);
+  InternalScopedBuffer<const LoadedModule *> pending_modules(count);
+  InternalScopedBuffer<bool> done(count);
+  uptr num_pending = 0;
+  for (uptr i = 0; i < count; i++) {
+    const LoadedModule *module;
+    results[i] = PrepareSymbolizePC(addresses[i], &module);
+    if (module) {
+      pending[num_pending] = results[i];
+      pending_modules[num_pending] = module;
+      done[num_pending] = false;
+      num_pending++;
+    }
+  }
+  if (!num_pending)
+    return;
+  uptr num_done = 0;
+  for (auto &tool : tools_) {
+    SymbolizerScope sym_scope(this);
+    tool.SymbolizePCs(pending.data(), done.data(), num_pending);
+    num_done = 0;
+    for (uptr i = 0; i < num_pending; i++)
+      num_done += done[i];
+    if (num_done == num_pending)
+      break;
+  }
+  for (uptr i = 0; i < num_pending; i++)
+    InsertIntoPCCache(pending_modules[i], pending[i]->info.module_offset,
+                      pending[i]);
+}
+
 bool Symbolizer::SymbolizeData(uptr addr, DataInfo *info) {
+  if (ReportBundleEnabled())
+    WriteDataToReportBundle(addr);
   BlockingMutexLock l(&mu_);
-  const char *module_name;
-  uptr module_offset;
-  ModuleArch arch;
-  if (!FindModuleNameAndOffsetForAddress(addr, &module_name, &module_offset,
-                                         &arch))
+  const LoadedModule *module = FindModuleForAddress(addr);
+  if (!module)
     return false;
+  uptr module_offset = addr - module->base_address();
+  if (LookupDataCache(module, module_offset, info))
+    return true;
   info->Clear();
-  info->module = internal_strdup(module_name);
+  info->module = internal_strdup(module->full_name());
   info->module_offset = module_offset;
-  info->module_arch = arch;
+  info->module_arch = module->arch();
   for (auto &tool : tools_) {
     SymbolizerScope sym_scope(this);
-    if (tool.SymbolizeData(addr, info)) {
-      return true;
-    }
+    if (tool.SymbolizeData(addr, info))
+      break;
   }
+  if (!tools_.empty())
+    InsertIntoDataCache(module, module_offset, *info);
   return true;
 }
 
@@ -154,21 +296,26 @@ bool Symbolizer::FindModuleNameAndOffsetForAddress(uptr address,
 const LoadedModule *Symbolizer::FindModuleForAddress(uptr address) {
   bool modules_were_reloaded = false;
   if (!modules_fresh_) {
+    FlushCaches();
     modules_.init();
     RAW_CHECK(modules_.size() > 0);
     modules_fresh_ = true;
     modules_were_reloaded = true;
+    last_module_ = 0;
   }
+  if (modules_[last_module_].containsAddress(address))
+    return &modules_[last_module_];
   for (uptr i = 0; i < modules_.size(); i++) {
     if (modules_[i].containsAddress(address)) {
+      last_module_ = i;
       return &modules_[i];
     }
   }
-  // Reload the modules and look up again, if we haven't tried it yet.
-  if (!modules_were_reloaded) {
-    // FIXME: set modules_fresh_ from dlopen()/dlclose() interceptors.
-    // It's too aggressive to reload the list of modules each time we fail
-    // to find a module for a given address.
+  // Reload the modules and look up again, if we haven't tried it yet and the
+  // loader says that they may have changed. JIT code and addresses on the
+  // heap don't belong to any module, and reloading for each of them is slow
+  // in processes with many modules.
+  if (!modules_were_reloaded && modules_.isStale()) {
     modules_fresh_ = false;
     return FindModuleForAddress(address);
   }
@@ -338,6 +485,64 @@ bool LLVMSymbolizer::SymbolizePC(uptr addr, SymbolizedStack *stack) {
   return false;
 }
 
+struct PendingPCs {
+  SymbolizedStack **stacks;
+  bool *done;
+  // Index in stacks and done of each command of the batch.
+  uptr *indices;
+};
+
+static void ParseSymbolizePCResponse(const char *response, uptr index,
+                                     void *arg) {
+  PendingPCs *pending = reinterpret_cast<PendingPCs *>(arg);
+  uptr i = pending->indices[index];
+  ParseSymbolizePCOutput(response, pending->stacks[i]);
+  pending->done[i] = true;
+}
+
+// Sends a batch of addresses per round trip, so that llvm-symbolizer works
+// through them without waiting for us to read each answer.
+void LLVMSymbolizer::SymbolizePCs(SymbolizedStack **stacks, bool *done,
+                                  uptr count) {
+  // Keep the commands well below the capacity of the pipe, so that writing
+  // them never blocks while the symbolizer waits for us to read its output.
+  static const uptr kMaxBatchSize = 4096;
+  InternalScopedBuffer<uptr> indices(count);
+  PendingPCs pending = {stacks, done, indices.data()};
+  uptr i = 0;
+  while (i < count) {
+    uptr len = 0, batch_count = 0;
+    uptr batch_begin = i;
+    for (; i < count; i++) {
+      if (done[i])
+        continue;
+      AddressInfo *info = &stacks[i]->info;
+      uptr n = FormatCommand(buffer_, len, kMaxBatchSize, /*is_data*/ false,
+                             info->module, info->module_offset,
+                             info->module_arch);
+      if (!n)
+        break;
+      len += n;
+      indices[batch_count++] = i;
+    }
+    if (batch_count) {
+      if (symbolizer_process_->SendCommands(buffer_, batch_count,
+                                            ParseSymbolizePCResponse,
+                                            &pending))
+        continue;
+      // The symbolizer is not running yet or has to be restarted, which the
+      // single-address path takes care of. Give up if it fails too.
+      for (i = batch_begin; done[i]; i++) {}
+      if (!(done[i] = SymbolizePC(stacks[i]->info.address, stacks[i])))
+        return;
+    } else if (i < count) {
+      // The command is too long for a batch.
+      done[i] = SymbolizePC(stacks[i]->info.address, stacks[i]);
+    }
+    i++;
+  }
+}
+
 bool LLVMSymbolizer::SymbolizeData(uptr addr, DataInfo *info) {
   const char *buf = FormatAndSendCommand(
       /*is_data*/ true, info->module, info->module_offset, info->module_arch);
@@ -349,26 +554,36 @@ bool LLVMSymbolizer::SymbolizeData(uptr addr, DataInfo *info) {
   return false;
 }
 
-const char *LLVMSymbolizer::FormatAndSendCommand(bool is_data,
-                                                 const char *module_name,
-                                                 uptr module_offset,
-                                                 ModuleArch arch) {
+uptr LLVMSymbolizer::FormatCommand(char *buffer, uptr pos, uptr size,
+                                   bool is_data, const char *module_name,
+                                   uptr module_offset, ModuleArch arch) {
   CHECK(module_name);
+  CHECK_LE(pos, size);
   const char *is_data_str = is_data ? "DATA " : "";
+  int len;
   if (arch == kModuleArchUnknown) {
-    if (internal_snprintf(buffer_, kBufferSize, "%s\"%s\" 0x%zx\n", is_data_str,
-                          module_name,
-                          module_offset) >= static_cast<int>(kBufferSize)) {
-      Report("WARNING: Command buffer too small");
-      return nullptr;
-    }
+    len = internal_snprintf(buffer + pos, size - pos, "%s\"%s\" 0x%zx\n",
+                            is_data_str, module_name, module_offset);
   } else {
-    if (internal_snprintf(buffer_, kBufferSize, "%s\"%s:%s\" 0x%zx\n",
-                          is_data_str, module_name, ModuleArchToString(arch),
-                          module_offset) >= static_cast<int>(kBufferSize)) {
-      Report("WARNING: Command buffer too small");
-      return nullptr;
-    }
+    len = internal_snprintf(buffer + pos, size - pos, "%s\"%s:%s\" 0x%zx\n",
+                            is_data_str, module_name, ModuleArchToString(arch),
+                            module_offset);
+  }
+  if (len >= static_cast<int>(size - pos)) {
+    buffer[pos] = '\0';
+    return 0;
+  }
+  return len;
+}
+
+const char *LLVMSymbolizer::FormatAndSendCommand(bool is_data,
+                                                 const char *module_name,
+                                                 uptr module_offset,
+                                                 ModuleArch arch) {
+  if (!FormatCommand(buffer_, 0, kBufferSize, is_data, module_name,
+                     module_offset, arch)) {
+    Report("WARNING: Command buffer too small");
+    return nullptr;
   }
   return symbolizer_process_->SendCommand(buffer_);
 }
@@ -425,6 +640,63 @@ const char *SymbolizerProcess::SendCommandImpl(const char *command) {
   return buffer_;
 }
 
+bool SymbolizerProcess::SendCommands(const char *commands, uptr count,
+                                     ResponseHandler handler, void *arg) {
+  if (failed_to_start_ || input_fd_ == kInvalidFd ||
+      output_fd_ == kInvalidFd)
+    return false;
+  if (SendCommandsImpl(commands, count, handler, arg))
+    return true;
+  // Unread responses would be taken for the answers to later commands, so
+  // make SendCommand start a new symbolizer.
+  CloseFile(input_fd_);
+  CloseFile(output_fd_);
+  input_fd_ = output_fd_ = kInvalidFd;
+  return false;
+}
+
+bool SymbolizerProcess::SendCommandsImpl(const char *commands, uptr count,
+                                         ResponseHandler handler, void *arg) {
+  if (!WriteToSymbolizer(commands, internal_strlen(commands)))
+    return false;
+  // Several responses may arrive in one read; each one is handed over as
+  // soon as it is complete and the rest is moved to the front of the buffer.
+  uptr begin = 0, scanned = 0, end = 0;
+  for (uptr index = 0; index < count;) {
+    for (; scanned < end; scanned++) {
+      if (buffer_[scanned] == '\n' &&
+          ReachedEndOfOutput(buffer_ + begin, scanned + 1 - begin))
+        break;
+    }
+    if (scanned < end) {
+      uptr next = scanned + 1;
+      char saved = buffer_[next];
+      buffer_[next] = '\0';
+      handler(buffer_ + begin, index++, arg);
+      buffer_[next] = saved;
+      begin = scanned = next;
+      continue;
+    }
+    internal_memmove(buffer_, buffer_ + begin, end - begin);
+    end -= begin;
+    scanned -= begin;
+    begin = 0;
+    if (end + 1 == kBufferSize) {
+      Report("WARNING: Symbolizer buffer too small");
+      return false;
+    }
+    uptr just_read = 0;
+    bool success = ReadFromFile(input_fd_, buffer_ + end,
+                                kBufferSize - end - 1, &just_read);
+    if (!success || just_read == 0) {
+      Report("WARNING: Can't read from symbolizer at fd %d\n", input_fd_);
+      return false;
+    }
+    end += just_read;
+  }
+  return true;
+}
+
 bool SymbolizerProcess::Restart() {
   if (input_fd_ != kInvalidFd)
     CloseFile(input_fd_);
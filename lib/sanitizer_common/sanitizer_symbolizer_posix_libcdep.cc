@@ -22,6 +22,8 @@
 #include "sanitizer_placement_new.h"
 #include "sanitizer_posix.h"
 #include "sanitizer_procmaps.h"
+#include "sanitizer_report_bundle.h"
+#include "sanitizer_symbolizer_elf.h"
 #include "sanitizer_symbolizer_internal.h"
 #include "sanitizer_symbolizer_libbacktrace.h"
 #include "sanitizer_symbolizer_mac.h"
@@ -491,7 +493,7 @@ static SymbolizerTool *ChooseExternalSymbolizer(LowLevelAllocator *allocator) {
 
 static void ChooseSymbolizerTools(IntrusiveList<SymbolizerTool> *list,
                                   LowLevelAllocator *allocator) {
-  if (!common_flags()->symbolize) {
+  if (!common_flags()->symbolize || ReportBundleEnabled()) {
     VReport(2, "Symbolizer is disabled.\n");
     return;
   }
@@ -512,6 +514,13 @@ static void ChooseSymbolizerTools(IntrusiveList<SymbolizerTool> *list,
     list->push_back(tool);
   }
 
+#if SANITIZER_ELF_SYMBOLIZER
+  // Used if there is no external symbolizer or it can't be started, e.g. in
+  // a sandbox.
+  VReport(2, "Using ELF symbolizer as a fallback.\n");
+  list->push_back(ElfSymbolizer::get(allocator));
+#endif
+
 #if SANITIZER_MAC
   VReport(2, "Using dladdr symbolizer.\n");
   list->push_back(new(*allocator) DlAddrSymbolizer());
@@ -526,7 +535,10 @@ Symbolizer *Symbolizer::PlatformInit() {
 }
 
 void Symbolizer::LateInitialize() {
-  Symbolizer::GetOrInit();
+  // With lazy_init the symbolizer is set up by its first user. The Swift
+  // demangler cannot be, see above.
+  if (!common_flags()->lazy_init)
+    Symbolizer::GetOrInit();
   InitializeSwiftDemangler();
 }
 
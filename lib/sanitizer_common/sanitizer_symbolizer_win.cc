@@ -16,6 +16,8 @@
 #if SANITIZER_WINDOWS
 
 #include "sanitizer_dbghelp.h"
+#include "sanitizer_flags.h"
+#include "sanitizer_report_bundle.h"
 #include "sanitizer_symbolizer_internal.h"
 
 namespace __sanitizer {
@@ -278,7 +280,7 @@ bool SymbolizerProcess::StartSymbolizerSubprocess() {
 
 static void ChooseSymbolizerTools(IntrusiveList<SymbolizerTool> *list,
                                   LowLevelAllocator *allocator) {
-  if (!common_flags()->symbolize) {
+  if (!common_flags()->symbolize || ReportBundleEnabled()) {
     VReport(2, "Symbolizer is disabled.\n");
     return;
   }
@@ -312,7 +314,9 @@ Symbolizer *Symbolizer::PlatformInit() {
 }
 
 void Symbolizer::LateInitialize() {
-  Symbolizer::GetOrInit();
+  // With lazy_init the symbolizer is set up by its first user.
+  if (!common_flags()->lazy_init)
+    Symbolizer::GetOrInit();
 }
 
 }  // namespace __sanitizer
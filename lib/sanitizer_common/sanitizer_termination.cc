@@ -49,6 +49,7 @@ void SetUserDieCallback(DieCallbackType callback) {
 }
 
 void NORETURN Die() {
+  report_file.FlushBuffer();
   if (UserDieCallback)
     UserDieCallback();
   for (int i = kMaxNumOfInternalDieCallbacks - 1; i >= 0; i--) {
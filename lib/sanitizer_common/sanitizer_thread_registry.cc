@@ -102,6 +102,11 @@ ThreadRegistry::ThreadRegistry(ThreadContextFactory factory, u32 max_threads,
       running_threads_(0) {
   threads_ = (ThreadContextBase **)MmapOrDie(max_threads_ * sizeof(threads_[0]),
                                              "ThreadRegistry");
+  n_os_id_buckets_ = Min<uptr>(RoundUpToPowerOfTwo(max_threads_), 1 << 16);
+  os_id_buckets_ = (u32 *)MmapOrDie(
+      n_os_id_buckets_ * sizeof(os_id_buckets_[0]), "ThreadRegistry");
+  os_id_links_ = (OsIdIndexLink *)MmapOrDie(
+      max_threads_ * sizeof(os_id_links_[0]), "ThreadRegistry");
   dead_threads_.clear();
   invalid_threads_.clear();
 }
@@ -194,6 +199,20 @@ static bool FindThreadContextByOsIdCallback(ThreadContextBase *tctx,
 }
 
 ThreadContextBase *ThreadRegistry::FindThreadContextByOsIDLocked(uptr os_id) {
+  CheckLocked();
+  // If an exited joinable thread has the same os_id as a running one, return
+  // the lowest tid, like the scan over all the contexts would.
+  ThreadContextBase *res = nullptr;
+  for (u32 link = os_id_buckets_[OsIdBucket(os_id)]; link;
+       link = os_id_links_[link - 1].next) {
+    ThreadContextBase *tctx = threads_[link - 1];
+    if (FindThreadContextByOsIdCallback(tctx, (void *)os_id) &&
+        (!res || tctx->tid < res->tid))
+      res = tctx;
+  }
+  if (res)
+    return res;
+  // The tools may update os_id of a started thread; fall back to the scan.
   return FindThreadContextLocked(FindThreadContextByOsIdCallback,
                                  (void *)os_id);
 }
@@ -276,9 +295,40 @@ void ThreadRegistry::StartThread(u32 tid, uptr os_id, bool workerthread,
   CHECK_NE(tctx, 0);
   CHECK_EQ(ThreadStatusCreated, tctx->status);
   tctx->SetStarted(os_id, workerthread, arg);
+  AddToOsIdIndex(tctx);
+}
+
+u32 ThreadRegistry::OsIdBucket(uptr os_id) const {
+  return (u32)(((u64)os_id * 0x9E3779B97F4A7C15ULL >> 32) &
+               (n_os_id_buckets_ - 1));
+}
+
+void ThreadRegistry::AddToOsIdIndex(ThreadContextBase *tctx) {
+  OsIdIndexLink &link = os_id_links_[tctx->tid];
+  CHECK_EQ(link.bucket, 0);
+  u32 bucket = OsIdBucket(tctx->os_id);
+  link.next = os_id_buckets_[bucket];
+  link.bucket = bucket + 1;
+  os_id_buckets_[bucket] = tctx->tid + 1;
+}
+
+void ThreadRegistry::RemoveFromOsIdIndex(ThreadContextBase *tctx) {
+  OsIdIndexLink &link = os_id_links_[tctx->tid];
+  if (!link.bucket)
+    return;
+  u32 *prev = &os_id_buckets_[link.bucket - 1];
+  while (*prev != tctx->tid + 1) {
+    CHECK_NE(*prev, 0);
+    prev = &os_id_links_[*prev - 1].next;
+  }
+  *prev = link.next;
+  link.next = 0;
+  link.bucket = 0;
 }
 
 void ThreadRegistry::QuarantinePush(ThreadContextBase *tctx) {
+  // Every context that becomes dead ends up here.
+  RemoveFromOsIdIndex(tctx);
   if (tctx->tid == 0)
     return;  // Don't reuse the main thread.  It's a special snowflake.
   dead_threads_.push_back(tctx);
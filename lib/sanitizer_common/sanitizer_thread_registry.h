@@ -138,6 +138,21 @@ class ThreadRegistry {
   IntrusiveList<ThreadContextBase> dead_threads_;
   IntrusiveList<ThreadContextBase> invalid_threads_;
 
+  // Hash index of the started threads by os_id, so that
+  // FindThreadContextByOsIDLocked does not scan all the contexts. Chains hold
+  // tid + 1, with 0 terminating the chain.
+  struct OsIdIndexLink {
+    u32 next;
+    u32 bucket;  // Bucket index + 1, or 0 if the thread is not indexed.
+  };
+  u32 *os_id_buckets_;
+  uptr n_os_id_buckets_;  // Power of two.
+  OsIdIndexLink *os_id_links_;  // Indexed by tid.
+
+  u32 OsIdBucket(uptr os_id) const;
+  void AddToOsIdIndex(ThreadContextBase *tctx);
+  void RemoveFromOsIdIndex(ThreadContextBase *tctx);
+
   void QuarantinePush(ThreadContextBase *tctx);
   ThreadContextBase *QuarantinePop();
 };
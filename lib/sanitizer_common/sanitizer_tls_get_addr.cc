@@ -87,8 +87,18 @@ static const uptr kDtvOffset = 0x8000;
 static const uptr kDtvOffset = 0;
 #endif
 
+// This is the fast path of every __tls_get_addr call, keep it short: the dtv
+// is indexed by the module id, and the entry of a module is only set once.
+bool DTLS_IsKnownBlock(void *arg) {
+  uptr dso_id = reinterpret_cast<TlsGetAddrParam *>(arg)->dso_id;
+  uptr dtv_size = dtls.dtv_size;
+  return dtv_size != kDestroyedThread && dso_id < dtv_size &&
+         dtls.dtv[dso_id].beg;
+}
+
 DTLS::DTV *DTLS_on_tls_get_addr(void *arg_void, void *res,
                                 uptr static_tls_begin, uptr static_tls_end) {
+  if (DTLS_IsKnownBlock(arg_void)) return 0;
   if (!common_flags()->intercept_tls_get_addr) return 0;
   TlsGetAddrParam *arg = reinterpret_cast<TlsGetAddrParam *>(arg_void);
   uptr dso_id = arg->dso_id;
@@ -141,6 +151,7 @@ bool DTLSInDestruction(DTLS *dtls) {
 }
 
 #else
+bool DTLS_IsKnownBlock(void *arg) { return false; }
 void DTLS_on_libc_memalign(void *ptr, uptr size) {}
 DTLS::DTV *DTLS_on_tls_get_addr(void *arg, void *res) { return 0; }
 DTLS *DTLS_Get() { return 0; }
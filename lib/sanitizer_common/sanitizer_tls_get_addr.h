@@ -52,6 +52,9 @@ struct DTLS {
 // Each block is returned exactly once.
 DTLS::DTV *DTLS_on_tls_get_addr(void *arg, void *res, uptr static_tls_begin,
                                 uptr static_tls_end);
+// Returns true if the block of the __tls_get_addr argument has already been
+// returned by DTLS_on_tls_get_addr, so that nothing else needs to be done.
+bool DTLS_IsKnownBlock(void *arg);
 void DTLS_on_libc_memalign(void *ptr, uptr size);
 DTLS *DTLS_Get();
 void DTLS_Destroy();  // Make sure to call this before the thread is destroyed.
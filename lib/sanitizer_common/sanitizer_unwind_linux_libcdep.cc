@@ -14,6 +14,8 @@
 #include "sanitizer_platform.h"
 #if SANITIZER_FREEBSD || SANITIZER_LINUX
 #include "sanitizer_common.h"
+#include "sanitizer_flags.h"
+#include "sanitizer_mutex.h"
 #include "sanitizer_stacktrace.h"
 
 #if SANITIZER_ANDROID
@@ -25,6 +27,15 @@
 #endif
 #include <unwind.h>
 
+#if SANITIZER_LINUX && !SANITIZER_ANDROID && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define SANITIZER_EH_FRAME_UNWIND 1
+#include <link.h>
+#include <stddef.h>
+#else
+#define SANITIZER_EH_FRAME_UNWIND 0
+#endif
+
 namespace __sanitizer {
 
 //------------------------- SlowUnwindStack -----------------------------------
@@ -118,11 +129,653 @@ _Unwind_Reason_Code Unwind_Trace(struct _Unwind_Context *ctx, void *param) {
   return UNWIND_CONTINUE;
 }
 
+//------------------------- EhFrameUnwind -------------------------------------
+
+#if SANITIZER_EH_FRAME_UNWIND
+// With eh_frame_unwind=1, SlowUnwindStack() walks the stack with the
+// .eh_frame unwind tables itself. The binary search tables of the
+// .eh_frame_hdr sections of the loaded objects are listed once per change of
+// the loaded objects, and the rule to get from each pc to its caller's frame
+// is kept in a per-thread cache, so that the usual frames cost a cache lookup
+// and two loads. Only the rules the compilers emit for ordinary frames are
+// supported: a CFA at an offset from the stack or frame pointer, and the
+// frame pointer and return address saved below it. On anything else, like
+// signal frames, we go back to _Unwind_Backtrace() for the whole stack.
+
+#if defined(__x86_64__)
+static const uptr kDwarfRegFp = 6;
+static const uptr kDwarfRegSp = 7;
+static const uptr kDwarfRegRa = 16;
+#else
+static const uptr kDwarfRegFp = 29;
+static const uptr kDwarfRegRa = 30;
+static const uptr kDwarfRegSp = 31;
+#endif
+
+// Larger frames are assumed to come from bad unwind information.
+static const uptr kMaxEhFrameSize = 1 << 24;
+static const uptr kMaxEhFrameObjects = 256;
+static const uptr kEhFrameRuleCacheSize = 64;
+static const uptr kMaxRememberedStates = 4;
+
+enum EhFrameRegRule { kRuleSame, kRuleUndefined, kRuleOffset };
+enum EhFrameLookupResult { kRuleFound, kRuleNotFound, kRuleUnsupported };
+
+// How to get the registers of the caller of the frame at pc: its stack
+// pointer is the CFA, and a rule of kRuleOffset loads a register from the
+// given offset from the CFA.
+struct EhFrameRule {
+  uptr pc;
+  s32 cfa_offset;
+  s16 fp_offset;
+  s16 ra_offset;
+  bool cfa_is_fp;
+  u8 fp_rule;
+  u8 ra_rule;
+};
+
+struct EhFrameObject {
+  uptr beg;
+  uptr end;
+  const u8 *hdr;
+  const u8 *table;
+  uptr fde_count;
+};
+
+struct EhFrameObjectList {
+  uptr generation;
+  uptr num_objects;
+  EhFrameObject objects[kMaxEhFrameObjects];
+};
+
+struct EhFrameRuleCache {
+  uptr generation;
+  bool busy;
+  EhFrameRule rules[kEhFrameRuleCacheSize];
+};
+
+static StaticSpinMutex eh_frame_mu;
+static EhFrameObjectList eh_frame_objects;  // Guarded by eh_frame_mu.
+static THREADLOCAL EhFrameRuleCache eh_frame_rule_cache;
+
+static uptr ObjectGeneration(dl_phdr_info *info, size_t size) {
+  // dlpi_adds and dlpi_subs are there since glibc 2.4.
+  if (size < offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+    return 0;
+  return info->dlpi_adds + info->dlpi_subs;
+}
+
+static int GenerationCallback(dl_phdr_info *info, size_t size, void *arg) {
+  *(uptr *)arg = ObjectGeneration(info, size);
+  // The counters are the same for all objects.
+  return 1;
+}
+
+static int ListObjectsCallback(dl_phdr_info *info, size_t size, void *arg) {
+  EhFrameObjectList *list = (EhFrameObjectList *)arg;
+  list->generation = ObjectGeneration(info, size);
+  if (list->num_objects == kMaxEhFrameObjects)
+    return 1;
+  EhFrameObject obj = {~(uptr)0, 0, nullptr, nullptr, 0};
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    uptr beg = info->dlpi_addr + phdr->p_vaddr;
+    if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) {
+      obj.beg = Min(obj.beg, beg);
+      obj.end = Max(obj.end, beg + phdr->p_memsz);
+    } else if (phdr->p_type == PT_GNU_EH_FRAME) {
+      obj.hdr = (const u8 *)beg;
+    }
+  }
+  // Without .eh_frame_hdr, the pcs of the object have no rules.
+  if (obj.hdr && obj.beg < obj.end)
+    list->objects[list->num_objects++] = obj;
+  return 0;
+}
+
+static uptr ReadULEB128(const u8 **p) {
+  uptr res = 0;
+  for (uptr shift = 0;; shift += 7) {
+    u8 byte = *(*p)++;
+    if (shift < sizeof(uptr) * 8)
+      res |= (uptr)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return res;
+  }
+}
+
+static sptr ReadSLEB128(const u8 **p) {
+  uptr res = 0;
+  uptr shift = 0;
+  u8 byte;
+  do {
+    byte = *(*p)++;
+    if (shift < sizeof(uptr) * 8)
+      res |= (uptr)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  if (shift < sizeof(uptr) * 8 && (byte & 0x40))
+    res |= ~(uptr)0 << shift;
+  return (sptr)res;
+}
+
+// Reads a pointer encoded as described by a DW_EH_PE_* value. The indirect
+// bit is ignored: we never dereference the personality routines.
+static bool ReadEncodedPointer(const u8 **p, u8 encoding, uptr data_base,
+                               uptr *res) {
+  const u8 *start = *p;
+  uptr value;
+  switch (encoding & 0x0f) {
+    case 0x00:  // DW_EH_PE_absptr
+      value = *(const uptr *)start;
+      *p += sizeof(uptr);
+      break;
+    case 0x01:  // DW_EH_PE_uleb128
+      value = ReadULEB128(p);
+      break;
+    case 0x02:  // DW_EH_PE_udata2
+      value = *(const u16 *)start;
+      *p += 2;
+      break;
+    case 0x03:  // DW_EH_PE_udata4
+      value = *(const u32 *)start;
+      *p += 4;
+      break;
+    case 0x04:  // DW_EH_PE_udata8
+    case 0x0c:  // DW_EH_PE_sdata8
+      value = *(const u64 *)start;
+      *p += 8;
+      break;
+    case 0x09:  // DW_EH_PE_sleb128
+      value = ReadSLEB128(p);
+      break;
+    case 0x0a:  // DW_EH_PE_sdata2
+      value = *(const s16 *)start;
+      *p += 2;
+      break;
+    case 0x0b:  // DW_EH_PE_sdata4
+      value = *(const s32 *)start;
+      *p += 4;
+      break;
+    default:
+      return false;
+  }
+  switch (encoding & 0x70) {
+    case 0x00:
+      break;
+    case 0x10:  // DW_EH_PE_pcrel
+      value += (uptr)start;
+      break;
+    case 0x30:  // DW_EH_PE_datarel
+      value += data_base;
+      break;
+    default:
+      return false;
+  }
+  *res = value;
+  return true;
+}
+
+struct CieInfo {
+  const u8 *instructions;
+  const u8 *end;
+  uptr code_align;
+  sptr data_align;
+  u8 fde_encoding;
+  bool has_augmentation_data;
+};
+
+// Reads the length of a CIE or FDE and returns its end.
+static const u8 *ReadEntryLength(const u8 **p) {
+  u32 length = *(const u32 *)*p;
+  *p += 4;
+  // 64-bit DWARF is not used in .eh_frame.
+  if (length == 0 || length == 0xffffffff)
+    return nullptr;
+  return *p + length;
+}
+
+static bool ParseCie(const u8 *p, CieInfo *cie) {
+  cie->end = ReadEntryLength(&p);
+  if (!cie->end || *(const u32 *)p != 0)
+    return false;
+  p += 4;
+  u8 version = *p++;
+  if (version != 1 && version != 3)
+    return false;
+  const char *augmentation = (const char *)p;
+  p += internal_strlen(augmentation) + 1;
+  cie->code_align = ReadULEB128(&p);
+  cie->data_align = ReadSLEB128(&p);
+  uptr ra_reg = version == 1 ? *p++ : ReadULEB128(&p);
+  if (ra_reg != kDwarfRegRa)
+    return false;
+  cie->fde_encoding = 0;  // DW_EH_PE_absptr
+  cie->has_augmentation_data = augmentation[0] == 'z';
+  if (!cie->has_augmentation_data) {
+    if (augmentation[0])
+      return false;
+    cie->instructions = p;
+    return true;
+  }
+  uptr augmentation_size = ReadULEB128(&p);
+  cie->instructions = p + augmentation_size;
+  for (const char *a = augmentation + 1; *a; a++) {
+    uptr ignored;
+    switch (*a) {
+      case 'R':
+        cie->fde_encoding = *p++;
+        break;
+      case 'P': {
+        u8 encoding = *p++;
+        if (!ReadEncodedPointer(&p, encoding, 0, &ignored))
+          return false;
+        break;
+      }
+      case 'L':
+        p++;
+        break;
+      // Signal frames need all of the registers.
+      case 'S':
+        return false;
+      default:
+        // The rest of the augmentation data can be skipped as a whole.
+        return true;
+    }
+  }
+  return true;
+}
+
+struct CfaState {
+  uptr cfa_reg;
+  sptr cfa_offset;
+  u8 fp_rule;
+  sptr fp_offset;
+  u8 ra_rule;
+  sptr ra_offset;
+};
+
+static bool SetRegRule(CfaState *state, uptr reg, u8 rule, sptr offset) {
+  if (reg == kDwarfRegFp) {
+    state->fp_rule = rule;
+    state->fp_offset = offset;
+  } else if (reg == kDwarfRegRa) {
+    state->ra_rule = rule;
+    state->ra_offset = offset;
+  } else if (reg == kDwarfRegSp && rule != kRuleSame) {
+    return false;
+  }
+  return true;
+}
+
+static void RestoreRegRule(CfaState *state, const CfaState &initial,
+                           uptr reg) {
+  if (reg == kDwarfRegFp) {
+    state->fp_rule = initial.fp_rule;
+    state->fp_offset = initial.fp_offset;
+  } else if (reg == kDwarfRegRa) {
+    state->ra_rule = initial.ra_rule;
+    state->ra_offset = initial.ra_offset;
+  }
+}
+
+// Runs the call frame instructions in [p, end) for the code starting at loc,
+// up to the row of pc. initial is the state after the CIE instructions.
+static bool RunCfaProgram(const u8 *p, const u8 *end, const CieInfo &cie,
+                          uptr loc, uptr pc, const CfaState &initial,
+                          CfaState *state) {
+  CfaState remembered[kMaxRememberedStates];
+  uptr num_remembered = 0;
+  while (p < end) {
+    u8 op = *p++;
+    uptr reg, delta;
+    sptr offset;
+    switch (op >> 6) {
+      case 1:  // DW_CFA_advance_loc
+        delta = op & 0x3f;
+        goto advance;
+      case 2:  // DW_CFA_offset
+        offset = (sptr)ReadULEB128(&p) * cie.data_align;
+        if (!SetRegRule(state, op & 0x3f, kRuleOffset, offset))
+          return false;
+        continue;
+      case 3:  // DW_CFA_restore
+        RestoreRegRule(state, initial, op & 0x3f);
+        continue;
+    }
+    switch (op) {
+      case 0x00:  // DW_CFA_nop
+        break;
+      case 0x01:  // DW_CFA_set_loc
+        if (!ReadEncodedPointer(&p, cie.fde_encoding, 0, &loc))
+          return false;
+        if (loc > pc)
+          return true;
+        break;
+      case 0x02:  // DW_CFA_advance_loc1
+        delta = *p;
+        p += 1;
+        goto advance;
+      case 0x03:  // DW_CFA_advance_loc2
+        delta = *(const u16 *)p;
+        p += 2;
+        goto advance;
+      case 0x04:  // DW_CFA_advance_loc4
+        delta = *(const u32 *)p;
+        p += 4;
+        goto advance;
+      case 0x05:  // DW_CFA_offset_extended
+        reg = ReadULEB128(&p);
+        offset = (sptr)ReadULEB128(&p) * cie.data_align;
+        if (!SetRegRule(state, reg, kRuleOffset, offset))
+          return false;
+        break;
+      case 0x11:  // DW_CFA_offset_extended_sf
+        reg = ReadULEB128(&p);
+        offset = ReadSLEB128(&p) * cie.data_align;
+        if (!SetRegRule(state, reg, kRuleOffset, offset))
+          return false;
+        break;
+      case 0x06:  // DW_CFA_restore_extended
+        RestoreRegRule(state, initial, ReadULEB128(&p));
+        break;
+      case 0x07:  // DW_CFA_undefined
+        if (!SetRegRule(state, ReadULEB128(&p), kRuleUndefined, 0))
+          return false;
+        break;
+      case 0x08:  // DW_CFA_same_value
+        SetRegRule(state, ReadULEB128(&p), kRuleSame, 0);
+        break;
+      case 0x09:  // DW_CFA_register
+        reg = ReadULEB128(&p);
+        ReadULEB128(&p);
+        if (reg == kDwarfRegFp || reg == kDwarfRegRa || reg == kDwarfRegSp)
+          return false;
+        break;
+      case 0x0a:  // DW_CFA_remember_state
+        if (num_remembered == kMaxRememberedStates)
+          return false;
+        remembered[num_remembered++] = *state;
+        break;
+      case 0x0b:  // DW_CFA_restore_state
+        // As in libgcc, the CFA rule is restored too.
+        if (num_remembered == 0)
+          return false;
+        *state = remembered[--num_remembered];
+        break;
+      case 0x0c:  // DW_CFA_def_cfa
+        state->cfa_reg = ReadULEB128(&p);
+        state->cfa_offset = (sptr)ReadULEB128(&p);
+        break;
+      case 0x12:  // DW_CFA_def_cfa_sf
+        state->cfa_reg = ReadULEB128(&p);
+        state->cfa_offset = ReadSLEB128(&p) * cie.data_align;
+        break;
+      case 0x0d:  // DW_CFA_def_cfa_register
+        state->cfa_reg = ReadULEB128(&p);
+        break;
+      case 0x0e:  // DW_CFA_def_cfa_offset
+        state->cfa_offset = (sptr)ReadULEB128(&p);
+        break;
+      case 0x13:  // DW_CFA_def_cfa_offset_sf
+        state->cfa_offset = ReadSLEB128(&p) * cie.data_align;
+        break;
+      case 0x10:  // DW_CFA_expression
+      case 0x16:  // DW_CFA_val_expression
+        reg = ReadULEB128(&p);
+        delta = ReadULEB128(&p);
+        p += delta;
+        if (reg == kDwarfRegFp || reg == kDwarfRegRa || reg == kDwarfRegSp)
+          return false;
+        break;
+      case 0x14:  // DW_CFA_val_offset
+      case 0x15:  // DW_CFA_val_offset_sf
+        reg = ReadULEB128(&p);
+        if (op == 0x14)
+          ReadULEB128(&p);
+        else
+          ReadSLEB128(&p);
+        if (reg == kDwarfRegFp || reg == kDwarfRegRa || reg == kDwarfRegSp)
+          return false;
+        break;
+      case 0x2e:  // DW_CFA_GNU_args_size
+        ReadULEB128(&p);
+        break;
+      // DW_CFA_def_cfa_expression, DW_CFA_GNU_negative_offset_extended, and
+      // DW_CFA_AARCH64_negate_ra_state for the signed return addresses.
+      default:
+        return false;
+    }
+    continue;
+  advance:
+    loc += delta * cie.code_align;
+    if (loc > pc)
+      return true;
+  }
+  return true;
+}
+
+// Finds the FDE of pc in the binary search table of an .eh_frame_hdr.
+static const u8 *FindFde(const EhFrameObject &obj, uptr pc) {
+  // The table holds pairs of (initial location, FDE address), relative to
+  // the start of .eh_frame_hdr.
+  const s32 *table = (const s32 *)obj.table;
+  uptr lo = 0, hi = obj.fde_count;
+  while (lo < hi) {
+    uptr mid = (lo + hi) / 2;
+    if ((uptr)obj.hdr + table[2 * mid] <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return nullptr;
+  return obj.hdr + table[2 * (lo - 1) + 1];
+}
+
+static EhFrameLookupResult ComputeRule(const EhFrameObject &obj, uptr pc,
+                                       EhFrameRule *rule) {
+  if (!obj.table)
+    return kRuleUnsupported;
+  const u8 *fde = FindFde(obj, pc);
+  if (!fde)
+    return kRuleNotFound;
+  const u8 *p = fde;
+  const u8 *fde_end = ReadEntryLength(&p);
+  if (!fde_end)
+    return kRuleUnsupported;
+  CieInfo cie;
+  if (!ParseCie(p - *(const u32 *)p, &cie))
+    return kRuleUnsupported;
+  p += 4;
+  uptr pc_begin, pc_range;
+  if (!ReadEncodedPointer(&p, cie.fde_encoding, 0, &pc_begin) ||
+      !ReadEncodedPointer(&p, cie.fde_encoding & 0x0f, 0, &pc_range))
+    return kRuleUnsupported;
+  if (pc - pc_begin >= pc_range)
+    return kRuleNotFound;
+  if (cie.has_augmentation_data) {
+    uptr augmentation_size = ReadULEB128(&p);
+    p += augmentation_size;
+  }
+  CfaState initial = {kDwarfRegSp, 0, kRuleSame, 0, kRuleSame, 0};
+  if (!RunCfaProgram(cie.instructions, cie.end, cie, pc_begin, ~(uptr)0,
+                     initial, &initial))
+    return kRuleUnsupported;
+  CfaState state = initial;
+  if (!RunCfaProgram(p, fde_end, cie, pc_begin, pc, initial, &state))
+    return kRuleUnsupported;
+  if ((state.cfa_reg != kDwarfRegSp && state.cfa_reg != kDwarfRegFp) ||
+      state.cfa_offset != (s32)state.cfa_offset ||
+      state.fp_offset != (s16)state.fp_offset ||
+      state.ra_offset != (s16)state.ra_offset)
+    return kRuleUnsupported;
+  rule->pc = pc;
+  rule->cfa_is_fp = state.cfa_reg == kDwarfRegFp;
+  rule->cfa_offset = state.cfa_offset;
+  rule->fp_rule = state.fp_rule;
+  rule->fp_offset = state.fp_offset;
+  rule->ra_rule = state.ra_rule;
+  rule->ra_offset = state.ra_offset;
+  return kRuleFound;
+}
+
+// Sets up the binary search table of the .eh_frame_hdr of an object.
+static void InitEhFrameTable(EhFrameObject *obj) {
+  const u8 *p = obj->hdr;
+  u8 version = p[0], eh_frame_ptr_encoding = p[1], fde_count_encoding = p[2],
+     table_encoding = p[3];
+  p += 4;
+  uptr ignored, fde_count;
+  // Only the usual encoding of the table, DW_EH_PE_datarel | DW_EH_PE_sdata4,
+  // can be searched in place.
+  if (version != 1 || table_encoding != 0x3b ||
+      !ReadEncodedPointer(&p, eh_frame_ptr_encoding, (uptr)obj->hdr,
+                          &ignored) ||
+      !ReadEncodedPointer(&p, fde_count_encoding, (uptr)obj->hdr, &fde_count))
+    return;
+  obj->table = p;
+  obj->fde_count = fde_count;
+}
+
+static EhFrameLookupResult LookupRule(uptr pc, uptr generation,
+                                      EhFrameRule *rule) {
+  EhFrameRule *cached =
+      &eh_frame_rule_cache.rules[(pc ^ (pc >> 12)) % kEhFrameRuleCacheSize];
+  if (cached->pc == pc) {
+    *rule = *cached;
+    return kRuleFound;
+  }
+  EhFrameLookupResult res = kRuleNotFound;
+  {
+    SpinMutexLock l(&eh_frame_mu);
+    if (eh_frame_objects.generation != generation)
+      return kRuleUnsupported;
+    for (uptr i = 0; i < eh_frame_objects.num_objects; i++) {
+      const EhFrameObject &obj = eh_frame_objects.objects[i];
+      if (pc >= obj.beg && pc < obj.end) {
+        res = ComputeRule(obj, pc, rule);
+        break;
+      }
+    }
+  }
+  if (res == kRuleFound)
+    *cached = *rule;
+  return res;
+}
+
+// Makes sure that eh_frame_objects lists the loaded objects. The list is
+// built with eh_frame_mu unlocked: dl_iterate_phdr() takes the loader lock,
+// and the threads holding it may be unwinding too.
+static bool UpdateEhFrameObjects(uptr generation) {
+  {
+    SpinMutexLock l(&eh_frame_mu);
+    if (eh_frame_objects.generation == generation &&
+        eh_frame_objects.num_objects)
+      return true;
+  }
+  static StaticSpinMutex list_mu;
+  static EhFrameObjectList list;
+  if (!list_mu.TryLock())
+    return false;
+  list.num_objects = 0;
+  dl_iterate_phdr(ListObjectsCallback, &list);
+  bool res = list.generation == generation &&
+             list.num_objects < kMaxEhFrameObjects;
+  if (res) {
+    for (uptr i = 0; i < list.num_objects; i++)
+      InitEhFrameTable(&list.objects[i]);
+    SpinMutexLock l(&eh_frame_mu);
+    internal_memcpy(&eh_frame_objects, &list, sizeof(list));
+  }
+  list_mu.Unlock();
+  return res;
+}
+
+// Inlined, so that the registers are those of SlowUnwindStack().
+static ALWAYS_INLINE bool EhFrameUnwindImpl(BufferedStackTrace *stack,
+                                            u32 max_depth) {
+  uptr generation = 0;
+  dl_iterate_phdr(GenerationCallback, &generation);
+  if (!generation || !UpdateEhFrameObjects(generation))
+    return false;
+  if (eh_frame_rule_cache.generation != generation) {
+    internal_memset(eh_frame_rule_cache.rules, 0,
+                    sizeof(eh_frame_rule_cache.rules));
+    eh_frame_rule_cache.generation = generation;
+  }
+
+  uptr pc, sp, fp, ra = 0;
+#if defined(__x86_64__)
+  // The frame pointer is read first, in case it is one of the outputs.
+  __asm__ volatile("movq %%rbp, %2\n\t"
+                   "leaq 0(%%rip), %0\n\t"
+                   "movq %%rsp, %1"
+                   : "=&r"(pc), "=&r"(sp), "=&r"(fp));
+#else
+  __asm__ volatile("mov %2, x29\n\t"
+                   "mov %3, x30\n\t"
+                   "adr %0, .\n\t"
+                   "mov %1, sp"
+                   : "=&r"(pc), "=&r"(sp), "=&r"(fp), "=&r"(ra));
+#endif
+  const uptr kPageSize = GetPageSizeCached();
+  stack->size = 0;
+  // As with _Unwind_Backtrace(), the first frame is that of SlowUnwindStack().
+  for (bool first_frame = true;; first_frame = false) {
+    // As in Unwind_Trace.
+    if (pc < kPageSize)
+      break;
+    stack->trace_buffer[stack->size++] = pc;
+    if (stack->size == max_depth)
+      break;
+    EhFrameRule rule;
+    // A return address may be just past the end of the calling function.
+    EhFrameLookupResult res =
+        LookupRule(first_frame ? pc : pc - 1, generation, &rule);
+    if (res == kRuleNotFound)
+      break;
+    if (res == kRuleUnsupported)
+      return false;
+    if (rule.ra_rule == kRuleUndefined)
+      break;
+    uptr cfa = (rule.cfa_is_fp ? fp : sp) + rule.cfa_offset;
+    if (cfa < sp || cfa - sp > kMaxEhFrameSize || cfa % sizeof(uptr))
+      return false;
+    if (rule.ra_rule == kRuleOffset)
+      ra = *(const uptr *)(cfa + rule.ra_offset);
+    if (rule.fp_rule == kRuleOffset)
+      fp = *(const uptr *)(cfa + rule.fp_offset);
+    sp = cfa;
+    pc = ra;
+  }
+  return true;
+}
+
+// Returns false if the stack has to be unwound by _Unwind_Backtrace().
+static ALWAYS_INLINE bool EhFrameUnwind(BufferedStackTrace *stack,
+                                        u32 max_depth) {
+  // Signal handlers which unwind use _Unwind_Backtrace() meanwhile.
+  if (eh_frame_rule_cache.busy)
+    return false;
+  eh_frame_rule_cache.busy = true;
+  bool res = EhFrameUnwindImpl(stack, max_depth);
+  eh_frame_rule_cache.busy = false;
+  return res;
+}
+#endif  // SANITIZER_EH_FRAME_UNWIND
+
 void BufferedStackTrace::SlowUnwindStack(uptr pc, u32 max_depth) {
   CHECK_GE(max_depth, 2);
   size = 0;
   UnwindTraceArg arg = {this, Min(max_depth + 1, kStackTraceMax)};
-  _Unwind_Backtrace(Unwind_Trace, &arg);
+#if SANITIZER_EH_FRAME_UNWIND
+  if (!common_flags()->eh_frame_unwind || !EhFrameUnwind(this, arg.max_depth))
+#endif
+  {
+    size = 0;
+    _Unwind_Backtrace(Unwind_Trace, &arg);
+  }
   // We need to pop a few frames so that pc is on top.
   uptr to_pop = LocatePcInTrace(pc);
   // trace_buffer[0] belongs to the current function so we always pop it,
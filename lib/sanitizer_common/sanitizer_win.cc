@@ -259,11 +259,19 @@ void NoHugePagesInRegion(uptr addr, uptr size) {
   // FIXME: probably similar to ReleaseMemoryToOS.
 }
 
+void UseHugePagesInRegion(uptr addr, uptr size) {
+  // FIXME: probably similar to ReleaseMemoryToOS.
+}
+
 void DontDumpShadowMemory(uptr addr, uptr length) {
   // This is almost useless on 32-bits.
   // FIXME: add madvise-analog when we move to 64-bits.
 }
 
+void DontForkShadowMemory(uptr addr, uptr length) {
+  // There is no fork() on Windows.
+}
+
 uptr FindAvailableMemoryRange(uptr size, uptr alignment, uptr left_padding) {
   uptr address = 0;
   while (true) {
@@ -441,6 +449,19 @@ u64 NanoTime() {
   return 0;
 }
 
+uptr GetNumaNode() {
+  // FIXME: GetCurrentProcessorNumberEx + GetNumaProcessorNodeEx.
+  return 0;
+}
+
+void BindMemoryToNumaNode(uptr addr, uptr size, uptr node) {
+  // FIXME: VirtualAllocExNuma can only place new mappings.
+}
+
+bool GrowMappingInPlace(uptr addr, uptr old_size, uptr new_size) {
+  return false;
+}
+
 void Abort() {
   internal__exit(3);
 }
@@ -498,6 +519,8 @@ static uptr GetPreferredBase(const char *modname) {
   return (uptr)pe_header->ImageBase;
 }
 
+uptr GetModulesGeneration() { return 0; }
+
 void ListOfModules::init() {
   clear();
   HANDLE cur_process = GetCurrentProcess();
@@ -688,6 +711,10 @@ uptr GetRSS() {
   return 0;
 }
 
+uptr GetCgroupMemoryLimit() {
+  return 0;
+}
+
 void *internal_start_thread(void (*func)(void *arg), void *arg) { return 0; }
 void internal_join_thread(void *th) { }
 
@@ -702,12 +729,14 @@ BlockingMutex::BlockingMutex(LinkerInitialized li) {
   CHECK(sizeof(CRITICAL_SECTION) <= sizeof(opaque_storage_));
   InitializeCriticalSection((LPCRITICAL_SECTION)opaque_storage_);
   owner_ = LOCK_READY;
+  contention_ = 0;
 }
 
 BlockingMutex::BlockingMutex() {
   CHECK(sizeof(CRITICAL_SECTION) <= sizeof(opaque_storage_));
   InitializeCriticalSection((LPCRITICAL_SECTION)opaque_storage_);
   owner_ = LOCK_READY;
+  contention_ = 0;
 }
 
 void BlockingMutex::Lock() {
@@ -720,9 +749,13 @@ void BlockingMutex::Lock() {
     // constructors, we should probably manually Lock/Unlock all the global
     // locks while we're starting in one thread to avoid double-init races.
   }
-  EnterCriticalSection((LPCRITICAL_SECTION)opaque_storage_);
+  LPCRITICAL_SECTION cs = (LPCRITICAL_SECTION)opaque_storage_;
+  bool contended = !TryEnterCriticalSection(cs);
+  if (contended)
+    EnterCriticalSection(cs);
   CHECK_EQ(owner_, LOCK_READY);
   owner_ = GetThreadSelf();
+  contention_ += contended;
 }
 
 void BlockingMutex::Unlock() {
@@ -735,6 +768,13 @@ void BlockingMutex::CheckLocked() {
   CHECK_EQ(owner_, GetThreadSelf());
 }
 
+// WaitOnAddress() is not available before Windows 8: the waiters spin.
+void FutexWait(atomic_uint32_t *p, u32 cmp) {
+  internal_sched_yield();
+}
+
+void FutexWake(atomic_uint32_t *p, u32 count) {}
+
 uptr GetTlsSize() {
   return 0;
 }
@@ -807,8 +847,7 @@ void BufferedStackTrace::SlowUnwindStackWithContext(uptr pc, void *context,
 }
 #endif  // #if !SANITIZER_GO
 
-void ReportFile::Write(const char *buffer, uptr length) {
-  SpinMutexLock l(mu);
+void ReportFile::WriteLocked(const char *buffer, uptr length) {
   ReopenIfNecessary();
   if (!WriteToFile(fd, buffer, length)) {
     // stderr may be closed, but we may be able to print to the debugger
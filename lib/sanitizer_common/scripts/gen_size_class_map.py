@@ -0,0 +1,152 @@
+#!/usr/bin/env python
+#===- lib/sanitizer_common/scripts/gen_size_class_map.py -------------------===#
+#
+#                     The LLVM Compiler Infrastructure
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+#===------------------------------------------------------------------------===#
+#
+# Generates a TableSizeClassMap fitted to the allocation sizes of a workload.
+# The input files are written by the sanitizer runtimes when run with
+# allocator_size_profile=<path> (see AllocatorSizeProfile). The classes of
+# the base SizeClassMap are kept, and the most frequent sizes get classes of
+# their own. The output is to be passed to CMake as
+# -DCOMPILER_RT_TRAINED_SIZE_CLASS_MAP=<file>.
+# Usage:
+#   gen_size_class_map.py [-n 20] -o trained.h profile.1234 [profile ...]
+#
+#===------------------------------------------------------------------------===#
+import argparse
+import sys
+
+
+def base_classes(num_bits, min_size_log, mid_size_log, max_size_log):
+  # Mirrors SizeClassMap::Size().
+  min_size = 1 << min_size_log
+  mid_size = 1 << mid_size_log
+  mid_class = mid_size // min_size
+  s = num_bits - 1
+  m = (1 << s) - 1
+  num_classes = mid_class + ((max_size_log - mid_size_log) << s) + 1
+  sizes = []
+  for class_id in range(num_classes):
+    if class_id <= mid_class:
+      sizes.append(min_size * class_id)
+      continue
+    c = class_id - mid_class
+    t = mid_size << (c >> s)
+    sizes.append(t + (t >> s) * (c & m))
+  return sizes
+
+
+def read_profiles(paths):
+  counts = {}
+  large = 0
+  for path in paths:
+    with open(path) as f:
+      for line in f:
+        size, count = line.split()
+        if size.startswith('>'):
+          large += int(count)
+          continue
+        counts[int(size)] = counts.get(int(size), 0) + int(count)
+  return counts, large
+
+
+def class_size(sizes, size):
+  for s in sizes:
+    if s >= size:
+      return s
+  return None
+
+
+def keeps_alignment(prev, size):
+  # RoundUpTo(request, a) must get an a-aligned chunk for any power of two a,
+  # see TableSizeClassMap::Validate().
+  a = 16
+  while a <= size:
+    if (prev // a + 1) * a <= size and size % a:
+      return False
+    a *= 2
+  return True
+
+
+def fit(sizes, wanted):
+  sizes = sorted(set(sizes))
+  for size in sorted(wanted):
+    size = (size + 15) // 16 * 16
+    if size in sizes or size > sizes[-1]:
+      continue
+    prev = max(s for s in sizes if s < size)
+    while not keeps_alignment(prev, size):
+      a = 32
+      while size % a == 0:
+        a *= 2
+      size = (size + a - 1) // a * a
+    sizes = sorted(set(sizes + [size]))
+  return sizes
+
+
+def waste(sizes, counts):
+  total = 0
+  for size, count in counts.items():
+    c = class_size(sizes, size)
+    if c is not None:
+      total += (c - size) * count
+  return total
+
+
+def main(argv):
+  parser = argparse.ArgumentParser()
+  parser.add_argument('profiles', nargs='+',
+                      help='allocator_size_profile outputs')
+  parser.add_argument('-n', '--num-exact', type=int, default=20,
+                      help='number of sizes to fit exactly')
+  parser.add_argument('--base', default='3,4,8,17',
+                      help='kNumBits,kMinSizeLog,kMidSizeLog,kMaxSizeLog of '
+                           'the base SizeClassMap')
+  parser.add_argument('--max-cached-hint', type=int, default=128)
+  parser.add_argument('--max-bytes-cached-log', type=int, default=16)
+  parser.add_argument('-o', '--output', help='output file, default stdout')
+  args = parser.parse_args(argv)
+
+  base = base_classes(*[int(x) for x in args.base.split(',')])
+  counts, large = read_profiles(args.profiles)
+  in_range = dict((s, c) for s, c in counts.items() if s <= base[-1])
+  top = sorted(in_range, key=lambda s: -in_range[s])[:args.num_exact]
+  sizes = fit(base, top)
+  if len(sizes) > 256:
+    sys.exit('error: %d size classes, at most 256 are supported' % len(sizes))
+
+  allocs = sum(in_range.values())
+  if allocs:
+    sys.stderr.write(
+        'wasted bytes per allocation: %.1f (base) -> %.1f (trained); '
+        '%d allocations above %d bytes\n' %
+        (waste(base, in_range) / float(allocs),
+         waste(sizes, in_range) / float(allocs), large, base[-1]))
+
+  out = open(args.output, 'w') if args.output else sys.stdout
+  out.write('// Generated by gen_size_class_map.py, do not edit.\n')
+  out.write('// Added sizes: %s.\n' % ', '.join(
+      str(s) for s in sorted(set(sizes) - set(base))))
+  out.write('struct TrainedSizeClassTable {\n')
+  out.write('  static const uptr kNumClasses = %d;\n' % len(sizes))
+  out.write('  static const uptr kMaxSize = %d;\n' % sizes[-1])
+  out.write('  static uptr Size(uptr class_id) {\n')
+  out.write('    static const u32 kSizes[kNumClasses] = {\n')
+  for i in range(0, len(sizes), 8):
+    out.write('      %s,\n' % ', '.join(str(s) for s in sizes[i:i + 8]))
+  out.write('    };\n')
+  out.write('    return kSizes[class_id];\n')
+  out.write('  }\n')
+  out.write('};\n')
+  out.write('typedef TableSizeClassMap<TrainedSizeClassTable, %d, %d>\n'
+            '    TrainedSizeClassMap;\n' %
+            (args.max_cached_hint, args.max_bytes_cached_log))
+
+
+if __name__ == '__main__':
+  main(sys.argv[1:])
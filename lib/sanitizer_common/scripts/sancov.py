@@ -134,7 +134,7 @@ def Unpack(files):
   for f in files:
     UnpackOneFile(f)
 
-def UnpackOneRawFile(path, map_path):
+def ReadMap(map_path):
   mem_map = []
   with open(map_path, mode="rt") as f_map:
     sys.stderr.write("%s: reading map %s\n" % (prog_name, map_path))
@@ -147,6 +147,37 @@ def UnpackOneRawFile(path, map_path):
                   int(parts[1], 16),
                   int(parts[2], 16),
                   ' '.join(parts[3:])))
+  return bits, mem_map
+
+# Replays the journal left behind by a process which didn't reach exit.
+# Must match MappingRecord in sanitizer_coverage_mapping_libcdep.cc.
+def ReadMapJournal(log_path):
+  ranges = {}
+  with open(log_path, mode="rb") as f_log:
+    sys.stderr.write("%s: reading map journal %s\n" % (prog_name, log_path))
+    bits = struct.unpack('=Q', f_log.read(8))[0]
+    if bits != 32 and bits != 64:
+      raise Exception('Wrong bits size in the map journal')
+    while True:
+      record = f_log.read(32)
+      if len(record) < 32:
+        break
+      start, end, base, kind, name_size = struct.unpack('=QQQII', record)
+      name = f_log.read(name_size)
+      if len(name) < name_size:
+        break
+      name = name.decode('utf-8')
+      if kind == 1:
+        ranges[start] = (start, end, base, name)
+      elif kind == 2:
+        ranges.pop(start, None)
+  return bits, list(ranges.values())
+
+def UnpackOneRawFile(path, map_path):
+  if os.path.exists(map_path) or not os.path.exists(map_path + '.log'):
+    bits, mem_map = ReadMap(map_path)
+  else:
+    bits, mem_map = ReadMapJournal(map_path + '.log')
   mem_map.sort(key=lambda m : m[0])
   mem_map_keys = [m[0] for m in mem_map]
 
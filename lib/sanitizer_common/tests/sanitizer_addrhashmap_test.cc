@@ -0,0 +1,102 @@
+//===-- sanitizer_addrhashmap_test.cc -------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer/AddressSanitizer runtime.
+//
+//===----------------------------------------------------------------------===//
+#include "sanitizer_common/sanitizer_addrhashmap.h"
+
+#include "sanitizer_pthread_wrappers.h"
+
+#include "gtest/gtest.h"
+
+namespace __sanitizer {
+
+// A single bucket, so that most of the elements go to the add buckets.
+typedef AddrHashMap<uptr, 1> SingleBucketMap;
+
+static void Insert(SingleBucketMap *m, uptr addr) {
+  SingleBucketMap::Handle h(m, addr);
+  ASSERT_TRUE(h.created());
+  *h = addr * 2;
+}
+
+static bool Contains(SingleBucketMap *m, uptr addr) {
+  SingleBucketMap::Handle h(m, addr, false, false);
+  if (!h.exists())
+    return false;
+  EXPECT_FALSE(h.created());
+  EXPECT_EQ(addr * 2, *h);
+  return true;
+}
+
+static void Remove(SingleBucketMap *m, uptr addr) {
+  SingleBucketMap::Handle h(m, addr, true);
+  ASSERT_TRUE(h.exists());
+}
+
+TEST(SanitizerCommon, AddrHashMap) {
+  SingleBucketMap m;
+  const uptr kCount = 100;
+  for (uptr i = 1; i <= kCount; i++)
+    Insert(&m, i);
+  for (uptr i = 1; i <= kCount; i++)
+    EXPECT_TRUE(Contains(&m, i));
+  EXPECT_FALSE(Contains(&m, kCount + 1));
+
+  // The removed cells are reused.
+  for (uptr i = 1; i <= kCount; i += 2)
+    Remove(&m, i);
+  for (uptr i = 1; i <= kCount; i++)
+    EXPECT_EQ(i % 2 == 0, Contains(&m, i));
+  for (uptr i = kCount + 1; i <= kCount * 3 / 2; i++)
+    Insert(&m, i);
+  for (uptr i = 1; i <= kCount * 3 / 2; i++)
+    EXPECT_EQ(i % 2 == 0 || i > kCount, Contains(&m, i));
+}
+
+struct ReaderArg {
+  SingleBucketMap *m;
+  atomic_uint32_t *stop;
+};
+
+static void *ReaderThread(void *p) {
+  ReaderArg *arg = (ReaderArg *)p;
+  while (!atomic_load(arg->stop, memory_order_acquire)) {
+    // The elements 1..10 are always there.
+    for (uptr i = 1; i <= 10; i++)
+      CHECK(Contains(arg->m, i));
+  }
+  return 0;
+}
+
+TEST(SanitizerCommon, AddrHashMapConcurrentReads) {
+  SingleBucketMap m;
+  for (uptr i = 1; i <= 10; i++)
+    Insert(&m, i);
+  atomic_uint32_t stop;
+  atomic_store(&stop, 0, memory_order_relaxed);
+  ReaderArg arg = {&m, &stop};
+  const int kReaders = 4;
+  pthread_t threads[kReaders];
+  for (int i = 0; i < kReaders; i++)
+    PTHREAD_CREATE(&threads[i], 0, ReaderThread, &arg);
+  // Keep adding and removing other elements, growing the add buckets.
+  for (uptr iter = 0; iter < 1000; iter++) {
+    for (uptr i = 11; i <= 10 + iter % 64; i++)
+      Insert(&m, i);
+    for (uptr i = 11; i <= 10 + iter % 64; i++)
+      Remove(&m, i);
+  }
+  atomic_store(&stop, 1, memory_order_release);
+  for (int i = 0; i < kReaders; i++)
+    PTHREAD_JOIN(threads[i], 0);
+}
+
+}  // namespace __sanitizer
@@ -26,11 +26,36 @@
 #include <random>
 #include <set>
 
+#if SANITIZER_LINUX
+#include <sys/mman.h>
+#endif
+
 using namespace __sanitizer;
 
 // Too slow for debug build
 #if !SANITIZER_DEBUG
 
+// DefaultSizeClassMap with a few more sizes, as generated by
+// scripts/gen_size_class_map.py.
+struct TestSizeClassTable {
+  static const uptr kNumClasses = 57;
+  static const uptr kMaxSize = 131072;
+  static uptr Size(uptr class_id) {
+    static const u32 kSizes[kNumClasses] = {
+      0, 16, 32, 48, 64, 80, 96, 112,
+      128, 144, 160, 176, 192, 208, 224, 240,
+      256, 272, 320, 384, 448, 512, 640, 768,
+      896, 1024, 1040, 1088, 1280, 1536, 1792, 2048,
+      2560, 3072, 3584, 4096, 5120, 6144, 7168, 8192,
+      10240, 12288, 14336, 16384, 20480, 24576, 24592, 28672,
+      32768, 40960, 49152, 57344, 65536, 81920, 98304, 114688,
+      131072,
+    };
+    return kSizes[class_id];
+  }
+};
+typedef TableSizeClassMap<TestSizeClassTable, 128, 16> TestTableSizeClassMap;
+
 #if SANITIZER_CAN_USE_ALLOCATOR64
 #if SANITIZER_WINDOWS
 // On Windows 64-bit there is no easy way to find a large enough fixed address
@@ -89,10 +114,30 @@ struct AP64VeryCompact {
 };
 
 
+struct AP64Table {
+  static const uptr kSpaceBeg = ~(uptr)0;
+  static const uptr kSpaceSize = kAllocatorSize;
+  static const uptr kMetadataSize = 16;
+  typedef TestTableSizeClassMap SizeClassMap;
+  typedef NoOpMapUnmapCallback MapUnmapCallback;
+  static const uptr kFlags = 0;
+};
+
 typedef SizeClassAllocator64<AP64> Allocator64;
 typedef SizeClassAllocator64<AP64Dyn> Allocator64Dynamic;
 typedef SizeClassAllocator64<AP64Compact> Allocator64Compact;
 typedef SizeClassAllocator64<AP64VeryCompact> Allocator64VeryCompact;
+struct AP64Numa {
+  static const uptr kSpaceBeg = ~(uptr)0;
+  static const uptr kSpaceSize = kAllocatorSize;
+  static const uptr kMetadataSize = 16;
+  typedef ::SizeClassMap SizeClassMap;
+  typedef NoOpMapUnmapCallback MapUnmapCallback;
+  static const uptr kFlags = SizeClassAllocator64FlagMasks::kNumaAware;
+};
+
+typedef SizeClassAllocator64<AP64Table> Allocator64Table;
+typedef SizeClassAllocator64<AP64Numa> Allocator64Numa;
 #elif defined(__mips64)
 static const u64 kAddressSpaceSize = 1ULL << 40;
 #elif defined(__aarch64__)
@@ -116,6 +161,16 @@ typedef SizeClassAllocator32<
   FlatByteMap<kFlatByteMapSize> >
   Allocator32Compact;
 
+typedef SizeClassAllocator32<
+  0, kAddressSpaceSize,
+  /*kMetadataSize*/16,
+  CompactSizeClassMap,
+  kRegionSizeLog,
+  FlatByteMap<kFlatByteMapSize>,
+  NoOpMapUnmapCallback,
+  SizeClassAllocator32FlagMasks::kLockFreeFreeLists>
+  Allocator32LockFree;
+
 template <class SizeClassMap>
 void TestSizeClassMap() {
   typedef SizeClassMap SCMap;
@@ -139,6 +194,15 @@ TEST(SanitizerCommon, InternalSizeClassMap) {
   TestSizeClassMap<InternalSizeClassMap>();
 }
 
+TEST(SanitizerCommon, TableSizeClassMap) {
+  TestSizeClassMap<TestTableSizeClassMap>();
+  EXPECT_EQ(17U, TestTableSizeClassMap::ClassID(257));
+  EXPECT_EQ(272U, TestTableSizeClassMap::Size(17));
+  EXPECT_EQ(1088U, TestTableSizeClassMap::Size(
+      TestTableSizeClassMap::ClassID(1041)));
+  EXPECT_EQ(0U, TestTableSizeClassMap::ClassID(0));
+}
+
 template <class Allocator>
 void TestSizeClassAllocator() {
   Allocator *a = new Allocator;
@@ -193,6 +257,10 @@ void TestSizeClassAllocator() {
     }
     allocated.clear();
     uptr total_allocated = a->TotalMemoryUsed();
+    // The first round also grows the cache, the following ones must not need
+    // any more memory.
+    if (i == 0)
+      continue;
     if (last_total_allocated == 0)
       last_total_allocated = total_allocated;
     CHECK_EQ(last_total_allocated, total_allocated);
@@ -229,6 +297,10 @@ TEST(SanitizerCommon, SizeClassAllocator64Compact) {
 TEST(SanitizerCommon, SizeClassAllocator64VeryCompact) {
   TestSizeClassAllocator<Allocator64VeryCompact>();
 }
+
+TEST(SanitizerCommon, SizeClassAllocator64Numa) {
+  TestSizeClassAllocator<Allocator64Numa>();
+}
 #endif
 #endif
 
@@ -236,6 +308,11 @@ TEST(SanitizerCommon, SizeClassAllocator32Compact) {
   TestSizeClassAllocator<Allocator32Compact>();
 }
 
+TEST(SanitizerCommon, SizeClassAllocator32LockFree) {
+  EXPECT_TRUE(Allocator32LockFree::kUsingLockFreeFreeLists);
+  TestSizeClassAllocator<Allocator32LockFree>();
+}
+
 template <class Allocator>
 void SizeClassAllocatorMetadataStress() {
   Allocator *a = new Allocator;
@@ -278,6 +355,10 @@ TEST(SanitizerCommon, SizeClassAllocator64DynamicMetadataStress) {
   SizeClassAllocatorMetadataStress<Allocator64Dynamic>();
 }
 
+TEST(SanitizerCommon, SizeClassAllocator64NumaMetadataStress) {
+  SizeClassAllocatorMetadataStress<Allocator64Numa>();
+}
+
 #if !SANITIZER_ANDROID
 TEST(SanitizerCommon, SizeClassAllocator64CompactMetadataStress) {
   SizeClassAllocatorMetadataStress<Allocator64Compact>();
@@ -383,6 +464,115 @@ TEST(SanitizerCommon, SizeClassAllocator64MapUnmapCallback) {
   EXPECT_EQ(TestMapUnmapCallback::unmap_count, 1);  // The whole thing.
   delete a;
 }
+
+#if SANITIZER_LINUX
+struct AP64HugePages {
+  static const uptr kSpaceBeg = ~(uptr)0;
+  static const uptr kSpaceSize = kAllocatorSize;
+  static const uptr kMetadataSize = 16;
+  typedef ::SizeClassMap SizeClassMap;
+  typedef NoOpMapUnmapCallback MapUnmapCallback;
+  static const uptr kFlags = SizeClassAllocator64FlagMasks::kUseHugePages;
+};
+
+static bool IsResident(uptr p) {
+  unsigned char vec;
+  uptr page_size = GetPageSizeCached();
+  CHECK_EQ(0, mincore((void *)RoundDownTo(p, page_size), page_size, &vec));
+  return vec & 1;
+}
+
+// Allocates 3M worth of 16K chunks, then frees all of them but one at 2.3M.
+// Returns whether the memory at 2.1M, which is free but shares a huge page
+// with the live chunk, is still resident.
+template <class Allocator>
+bool TestReleaseAroundLiveChunk(uptr *mapped) {
+  Allocator *a = new Allocator;
+  a->Init(/* release_to_os_interval_ms */ 0);
+  AllocatorStats stats;
+  stats.Init();
+  const uptr kChunkSize = 1 << 14;
+  const uptr kNumChunks = 192;
+  const uptr kLiveChunk = 150;
+  uptr class_id = Allocator::SizeClassMapT::ClassID(kChunkSize);
+  CHECK_EQ(kChunkSize, Allocator::SizeClassMapT::Size(class_id));
+  uptr region_beg = a->GetRegionBeginBySizeClass(class_id);
+  u32 chunks[kNumChunks];
+  // The first batch stays below the first huge page, the second one makes
+  // the region dense.
+  a->GetFromAllocator(&stats, class_id, chunks, kNumChunks / 3);
+  a->GetFromAllocator(&stats, class_id, chunks + kNumChunks / 3,
+                      kNumChunks - kNumChunks / 3);
+  *mapped = stats.Get(AllocatorStatMapped);
+  u32 live = 0;
+  for (uptr i = 0; i < kNumChunks; i++) {
+    uptr p = a->CompactPtrToPointer(region_beg, chunks[i]);
+    memset((void *)p, 1, kChunkSize);
+    if (p - region_beg == kLiveChunk * kChunkSize)
+      live = chunks[i];
+  }
+  u32 *end = std::remove(chunks, chunks + kNumChunks, live);
+  a->ReturnToAllocator(&stats, class_id, chunks, end - chunks);
+  EXPECT_FALSE(IsResident(region_beg + kChunkSize));
+  EXPECT_TRUE(IsResident(region_beg + kLiveChunk * kChunkSize));
+  bool res = IsResident(region_beg + (2100 << 10));
+  a->TestOnlyUnmap();
+  delete a;
+  return res;
+}
+
+TEST(SanitizerCommon, SizeClassAllocator64HugePages) {
+  typedef SizeClassAllocator64<AP64Dyn> Allocator;
+  typedef SizeClassAllocator64<AP64HugePages> AllocatorHugePages;
+  uptr mapped;
+  EXPECT_FALSE(TestReleaseAroundLiveChunk<Allocator>(&mapped));
+  EXPECT_EQ(mapped, 3U << 20);
+  // Dense regions grow to whole huge pages and are released only in whole
+  // huge pages.
+  EXPECT_TRUE(TestReleaseAroundLiveChunk<AllocatorHugePages>(&mapped));
+  EXPECT_EQ(mapped, 4U << 20);
+}
+#endif  // SANITIZER_LINUX
+
+TEST(SanitizerCommon, SizeClassAllocator64NumaNodes) {
+  Allocator64Numa *a = new Allocator64Numa;
+  a->Init(kReleaseToOSIntervalNever);
+  AllocatorStats stats;
+  stats.Init();
+  const uptr kClassId = 10;
+  const uptr kNumChunks = 64;
+  uptr region_beg = a->GetRegionBeginBySizeClass(kClassId);
+  u32 chunks[2 * kNumChunks];
+  a->GetFromAllocator(&stats, kClassId, chunks, kNumChunks, 0);
+  a->GetFromAllocator(&stats, kClassId, chunks + kNumChunks, kNumChunks, 1);
+  for (uptr i = 0; i < 2 * kNumChunks; i++) {
+    void *p = (void *)a->CompactPtrToPointer(region_beg, chunks[i]);
+    EXPECT_EQ(i / kNumChunks, a->GetNode(p));
+    EXPECT_EQ(kClassId, a->GetSizeClass(p));
+    EXPECT_EQ(p, a->GetBlockBegin(p));
+    *(uptr *)a->GetMetaData(p) = i;
+  }
+  for (uptr i = 0; i < 2 * kNumChunks; i++) {
+    void *p = (void *)a->CompactPtrToPointer(region_beg, chunks[i]);
+    EXPECT_EQ(i, *(uptr *)a->GetMetaData(p));
+  }
+  // Every chunk goes back to its own node.
+  std::reverse(chunks, chunks + 2 * kNumChunks);
+  a->ReturnToAllocator(&stats, kClassId, chunks + kNumChunks / 2, kNumChunks);
+  AllocatorNodeStats node_stats[2];
+  for (uptr node = 0; node < 2; node++) {
+    a->GetNodeStats(node, &node_stats[node]);
+    EXPECT_EQ(kNumChunks / 2, node_stats[node].frees);
+    EXPECT_EQ(kNumChunks, node_stats[node].allocs);
+  }
+  u32 node_chunks[kNumChunks];
+  a->GetFromAllocator(&stats, kClassId, node_chunks, kNumChunks, 1);
+  for (uptr i = 0; i < kNumChunks; i++)
+    EXPECT_EQ(1U, a->GetNode(
+        (void *)a->CompactPtrToPointer(region_beg, node_chunks[i])));
+  a->TestOnlyUnmap();
+  delete a;
+}
 #endif
 #endif
 
@@ -428,6 +618,81 @@ TEST(SanitizerCommon, LargeMmapAllocatorMapUnmapCallback) {
   EXPECT_EQ(TestMapUnmapCallback::unmap_count, 1);
 }
 
+TEST(SanitizerCommon, LargeMmapAllocatorCache) {
+  TestMapUnmapCallback::map_count = 0;
+  TestMapUnmapCallback::unmap_count = 0;
+  LargeMmapAllocator<TestMapUnmapCallback> *a =
+      new LargeMmapAllocator<TestMapUnmapCallback>;
+  a->Init(/* may_return_null */ false);
+  a->SetCacheParams(4 << 20, /* decay_ms */ -1);
+  AllocatorStats stats;
+  stats.Init();
+  const uptr kSize = 1 << 20;
+  char *x = (char *)a->Allocate(&stats, kSize, 1);
+  memset(x, 0xab, kSize);
+  memset(a->GetMetaData(x), 0xab, 16);
+  a->Deallocate(&stats, x);
+  EXPECT_EQ(TestMapUnmapCallback::unmap_count, 1);
+  EXPECT_GT(a->CachedMemory(), kSize);
+  EXPECT_EQ(a->TotalMemoryUsed(), 0U);
+
+  // A slightly smaller chunk reuses the mapping, zeroed.
+  char *y = (char *)a->Allocate(&stats, kSize - 4096, 1);
+  EXPECT_EQ(x, y);
+  EXPECT_EQ(a->CachedMemory(), 0U);
+  EXPECT_EQ(TestMapUnmapCallback::map_count, 2);
+  for (uptr i = 0; i < kSize - 4096; i++)
+    ASSERT_EQ(y[i], 0);
+  EXPECT_EQ(*(uptr *)a->GetMetaData(y), 0U);
+  EXPECT_EQ(a->GetBlockBegin(y + 100), y);
+  a->Deallocate(&stats, y);
+
+  // Too large to reuse that mapping, and to be cached.
+  char *z = (char *)a->Allocate(&stats, 8 * kSize, 1);
+  EXPECT_NE(x, z);
+  a->Deallocate(&stats, z);
+  EXPECT_LT(a->CachedMemory(), 2 * kSize);
+
+  a->ReleaseToOS(/* force */ true);
+  EXPECT_EQ(a->CachedMemory(), 0U);
+  a->SetCacheParams(0, -1);
+  x = (char *)a->Allocate(&stats, kSize, 1);
+  a->Deallocate(&stats, x);
+  EXPECT_EQ(a->CachedMemory(), 0U);
+  delete a;
+}
+
+TEST(SanitizerCommon, LargeMmapAllocatorResizeInPlace) {
+  TestMapUnmapCallback::map_count = 0;
+  TestMapUnmapCallback::unmap_count = 0;
+  LargeMmapAllocator<TestMapUnmapCallback> *a =
+      new LargeMmapAllocator<TestMapUnmapCallback>;
+  a->Init(/* may_return_null */ false);
+  AllocatorStats stats;
+  stats.Init();
+  const uptr kPageSize = GetPageSizeCached();
+  const uptr kSize = 1 << 20;
+  char *x = (char *)a->Allocate(&stats, kSize + 1, 1);
+  // Within the mapping.
+  EXPECT_TRUE(a->ResizeInPlace(&stats, x, kSize + kPageSize));
+  EXPECT_EQ(a->GetActuallyAllocatedSize(x), kSize + kPageSize);
+  memset(x, 1, kSize + kPageSize);
+  EXPECT_TRUE(a->ResizeInPlace(&stats, x, 100));
+  EXPECT_EQ(a->GetActuallyAllocatedSize(x), kPageSize);
+  EXPECT_EQ(TestMapUnmapCallback::map_count, 1);
+  // Growing the mapping only works if the next pages are free.
+  if (a->ResizeInPlace(&stats, x, 4 * kSize)) {
+    EXPECT_EQ(TestMapUnmapCallback::map_count, 2);
+    EXPECT_EQ(a->GetActuallyAllocatedSize(x), 4 * kSize);
+    memset(x, 1, 4 * kSize);
+    EXPECT_EQ(a->GetBlockBegin(x + 4 * kSize - 1), x);
+  }
+  a->Deallocate(&stats, x);
+  EXPECT_EQ(TestMapUnmapCallback::unmap_count, 1);
+  EXPECT_EQ(a->TotalMemoryUsed(), 0U);
+  delete a;
+}
+
 template<class Allocator>
 void FailInAssertionOnOOM() {
   Allocator a;
@@ -615,6 +880,87 @@ TEST(SanitizerCommon, CombinedAllocator64VeryCompact) {
       LargeMmapAllocator<>,
       SizeClassAllocatorLocalCache<Allocator64VeryCompact> > ();
 }
+
+TEST(SanitizerCommon, CombinedAllocator64Table) {
+  TestCombinedAllocator<Allocator64Table,
+      LargeMmapAllocator<>,
+      SizeClassAllocatorLocalCache<Allocator64Table> > ();
+}
+
+TEST(SanitizerCommon, CombinedAllocator64Numa) {
+  TestCombinedAllocator<Allocator64Numa,
+      LargeMmapAllocator<>,
+      SizeClassAllocatorLocalCache<Allocator64Numa> > ();
+}
+
+#if SANITIZER_LINUX
+static bool IsAllZero(const char *p, uptr size) {
+  for (uptr i = 0; i < size; i++)
+    if (p[i])
+      return false;
+  return true;
+}
+
+TEST(SanitizerCommon, CombinedAllocator64ChunkIsZero) {
+  typedef CombinedAllocator<Allocator64,
+                            SizeClassAllocatorLocalCache<Allocator64>,
+                            LargeMmapAllocator<> > Allocator;
+  Allocator *a = new Allocator;
+  // Release the free memory on every deallocation.
+  a->Init(/* may_return_null */ false, 0);
+  SizeClassAllocatorLocalCache<Allocator64> cache;
+  memset(&cache, 0, sizeof(cache));
+  a->InitCache(&cache);
+
+  const uptr kSize = 1 << 16;
+  const uptr kNumChunks = 16;
+  std::vector<char *> chunks;
+  for (uptr i = 0; i < kNumChunks; i++) {
+    char *p = (char *)a->Allocate(&cache, kSize, 1);
+    // Freshly mapped.
+    EXPECT_TRUE(a->ChunkIsZero(p));
+    memset(p, 1, kSize);
+    chunks.push_back(p);
+  }
+  // Reused right away from the cache.
+  a->Deallocate(&cache, chunks[0]);
+  char *p = (char *)a->Allocate(&cache, kSize, 1);
+  EXPECT_EQ(chunks[0], p);
+  EXPECT_FALSE(a->ChunkIsZero(p));
+  p = (char *)a->Allocate(&cache, kSize, 1, /* cleared */ true);
+  EXPECT_TRUE(IsAllZero(p, kSize));
+  chunks.push_back(p);
+
+  // Keep one chunk to split the free ones into two ranges, the one below it
+  // gets released to the OS. The others were never handed out.
+  std::sort(chunks.begin(), chunks.end());
+  char *kept = chunks[kNumChunks - 1];
+  for (uptr i = 0; i < chunks.size(); i++)
+    if (chunks[i] != kept)
+      a->Deallocate(&cache, chunks[i]);
+  a->SwallowCache(&cache);
+  uptr n_zero = 0, n_released = 0;
+  for (uptr i = 0; i < kNumChunks; i++) {
+    char *q = (char *)a->Allocate(&cache, kSize, 1);
+    if (a->ChunkIsZero(q)) {
+      EXPECT_TRUE(IsAllZero(q, kSize));
+      n_zero++;
+      n_released += q < kept;
+    }
+  }
+  EXPECT_GE(n_zero, kNumChunks - 1);
+  EXPECT_GT(n_released, 0U);
+
+  // Chunks of the secondary are always zero.
+  p = (char *)a->Allocate(&cache, 1 << 20, 1);
+  EXPECT_TRUE(a->ChunkIsZero(p));
+  a->Deallocate(&cache, p);
+
+  a->DestroyCache(&cache);
+  a->TestOnlyUnmap();
+  delete a;
+}
+#endif  // SANITIZER_LINUX
 #endif
 
 TEST(SanitizerCommon, CombinedAllocator32Compact) {
@@ -623,6 +969,118 @@ TEST(SanitizerCommon, CombinedAllocator32Compact) {
       SizeClassAllocatorLocalCache<Allocator32Compact> > ();
 }
 
+TEST(SanitizerCommon, CombinedAllocator32LockFree) {
+  TestCombinedAllocator<Allocator32LockFree,
+      LargeMmapAllocator<>,
+      SizeClassAllocatorLocalCache<Allocator32LockFree> > ();
+}
+
+template <class PrimaryAllocator>
+void TestCombinedAllocatorHistogram() {
+  typedef SizeClassAllocatorLocalCache<PrimaryAllocator> AllocatorCache;
+  typedef CombinedAllocator<PrimaryAllocator, AllocatorCache,
+                            LargeMmapAllocator<> > Allocator;
+  typedef typename PrimaryAllocator::SizeClassMapT SizeClassMap;
+  Allocator *a = new Allocator;
+  a->Init(/* may_return_null */ false, kReleaseToOSIntervalNever);
+  AllocatorCache cache;
+  memset(&cache, 0, sizeof(cache));
+  a->InitCache(&cache);
+
+  const uptr kSize = 1000;
+  const uptr kNumAllocs = 10000;
+  std::vector<void *> allocated;
+  for (uptr i = 0; i < kNumAllocs; i++)
+    allocated.push_back(a->Allocate(&cache, kSize, 1));
+  for (uptr i = 0; i < kNumAllocs / 2; i++)
+    a->Deallocate(&cache, allocated[i]);
+  // Publishes the counts of the cache.
+  a->SwallowCache(&cache);
+
+  AllocatorClassStats stats[SizeClassMap::kNumClasses];
+  uptr n = a->GetHistogram(stats, ARRAY_SIZE(stats));
+  EXPECT_EQ(SizeClassMap::kNumClasses - 1, n);
+  EXPECT_EQ(1U, a->GetHistogram(stats, 1));
+  EXPECT_EQ(SizeClassMap::Size(1), stats[0].size);
+  n = a->GetHistogram(stats, ARRAY_SIZE(stats));
+  uptr class_id = SizeClassMap::ClassID(kSize);
+  const AllocatorClassStats &s = stats[class_id - 1];
+  EXPECT_EQ(SizeClassMap::Size(class_id), s.size);
+  EXPECT_EQ(kNumAllocs, s.allocs);
+  EXPECT_EQ(kNumAllocs / 2, s.frees);
+  EXPECT_GE(s.mapped_bytes, kNumAllocs * s.size);
+  // Most of the allocations must have been served by the cache.
+  EXPECT_GT(s.cache_refills, 0U);
+  EXPECT_LT(s.cache_refills, kNumAllocs / 4);
+  EXPECT_GT(s.cache_drains, 0U);
+  EXPECT_GE(s.refill_samples, 1U);
+  EXPECT_LE(s.refill_samples, s.cache_refills);
+  // The chunks swallowed from the cache are back in the allocator.
+  EXPECT_GE(s.free_chunks, kNumAllocs / 2);
+  for (uptr i = 0; i < n; i++) {
+    if (i + 1 == class_id)
+      continue;
+    EXPECT_EQ(SizeClassMap::Size(i + 1), stats[i].size);
+    EXPECT_EQ(stats[i].frees, stats[i].allocs);
+  }
+
+  for (uptr i = kNumAllocs / 2; i < kNumAllocs; i++)
+    a->Deallocate(&cache, allocated[i]);
+  a->DestroyCache(&cache);
+  a->GetHistogram(stats, ARRAY_SIZE(stats));
+  EXPECT_EQ(kNumAllocs, stats[class_id - 1].frees);
+  a->TestOnlyUnmap();
+  delete a;
+}
+
+#if SANITIZER_CAN_USE_ALLOCATOR64
+TEST(SanitizerCommon, CombinedAllocator64Histogram) {
+  TestCombinedAllocatorHistogram<Allocator64>();
+}
+
+TEST(SanitizerCommon, CombinedAllocator64DynamicHistogram) {
+  TestCombinedAllocatorHistogram<Allocator64Dynamic>();
+}
+#endif
+
+TEST(SanitizerCommon, CombinedAllocator32CompactHistogram) {
+  TestCombinedAllocatorHistogram<Allocator32Compact>();
+}
+
+TEST(SanitizerCommon, CombinedAllocator32LockFreeHistogram) {
+  TestCombinedAllocatorHistogram<Allocator32LockFree>();
+}
+
+TEST(SanitizerCommon, CombinedAllocatorSizeProfile) {
+  typedef CombinedAllocator<Allocator32Compact,
+                            SizeClassAllocatorLocalCache<Allocator32Compact>,
+                            LargeMmapAllocator<> > Allocator;
+  Allocator *a = new Allocator;
+  a->Init(/* may_return_null */ false, kReleaseToOSIntervalNever);
+  SizeClassAllocatorLocalCache<Allocator32Compact> cache;
+  memset(&cache, 0, sizeof(cache));
+  a->InitCache(&cache);
+  AllocatorSizeProfile profile;
+  profile.Init();
+  a->SetSizeProfile(&profile);
+
+  for (uptr i = 0; i < 10; i++)
+    a->Deallocate(&cache, a->Allocate(&cache, 100, 1));
+  for (uptr i = 0; i < 3; i++)
+    a->Deallocate(&cache, a->Allocate(&cache, 100, 64));
+  a->Deallocate(&cache, a->Allocate(&cache, 1 << 21, 1));
+  EXPECT_EQ(10U, profile.Count(100));
+  EXPECT_EQ(10U, profile.Count(112));
+  EXPECT_EQ(0U, profile.Count(96));
+  // Sizes are recorded rounded up to the alignment.
+  EXPECT_EQ(3U, profile.Count(128));
+  EXPECT_EQ(0U, profile.Count(1 << 20));
+
+  a->DestroyCache(&cache);
+  a->TestOnlyUnmap();
+  delete a;
+}
+
 template <class AllocatorCache>
 void TestSizeClassAllocatorLocalCache() {
   AllocatorCache cache;
@@ -689,6 +1147,105 @@ TEST(SanitizerCommon, SizeClassAllocator32CompactLocalCache) {
       SizeClassAllocatorLocalCache<Allocator32Compact> >();
 }
 
+TEST(SanitizerCommon, SizeClassAllocator32LockFreeLocalCache) {
+  TestSizeClassAllocatorLocalCache<
+      SizeClassAllocatorLocalCache<Allocator32LockFree> >();
+}
+
+static void *LockFreeFreeListWorker(void *arg) {
+  typedef SizeClassAllocatorLocalCache<Allocator32LockFree> Cache;
+  Allocator32LockFree *a = reinterpret_cast<Allocator32LockFree *>(arg);
+  Cache cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.Init(0);
+  const uptr kNumAllocs = 1000;
+  void *allocated[kNumAllocs];
+  for (uptr it = 0; it < 100; it++) {
+    for (uptr i = 0; i < kNumAllocs; i++) {
+      allocated[i] = cache.Allocate(a, 1 + i % 8);
+      *reinterpret_cast<uptr *>(allocated[i]) = i;
+    }
+    for (uptr i = 0; i < kNumAllocs; i++) {
+      EXPECT_EQ(i, *reinterpret_cast<uptr *>(allocated[i]));
+      cache.Deallocate(a, 1 + i % 8, allocated[i]);
+    }
+    cache.Drain(a);
+  }
+  cache.Destroy(a, 0);
+  return 0;
+}
+
+TEST(SanitizerCommon, SizeClassAllocator32LockFreeThreaded) {
+  Allocator32LockFree *a = new Allocator32LockFree;
+  a->Init(kReleaseToOSIntervalNever);
+  static const int kNumThreads = 4;
+  pthread_t t[kNumThreads];
+  for (int i = 0; i < kNumThreads; i++)
+    PTHREAD_CREATE(&t[i], 0, LockFreeFreeListWorker, a);
+  for (int i = 0; i < kNumThreads; i++)
+    PTHREAD_JOIN(t[i], 0);
+  // All the chunks are back in the free lists, each of them once.
+  for (uptr class_id = 1; class_id <= 8; class_id++) {
+    AllocatorClassStats s;
+    a->GetClassStats(class_id, &s);
+    uptr num_regions = s.mapped_bytes >> kRegionSizeLog;
+    EXPECT_GT(num_regions, 0U);
+    EXPECT_EQ(num_regions * ((1 << kRegionSizeLog) / (s.size + 16)),
+              s.free_chunks);
+  }
+  a->TestOnlyUnmap();
+  delete a;
+}
+
+#if SANITIZER_CAN_USE_ALLOCATOR64 && !SANITIZER_WINDOWS
+TEST(SanitizerCommon, SizeClassAllocator64LocalCacheAdaptive) {
+  typedef SizeClassAllocatorLocalCache<Allocator64> Cache;
+  Allocator64 *a = new Allocator64;
+  a->Init(kReleaseToOSIntervalNever);
+  AllocatorGlobalStats stats;
+  stats.Init();
+  Cache cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.Init(&stats);
+
+  const uptr class_id = Allocator64::SizeClassMapT::ClassID(16 << 10);
+  const uptr initial = Cache::InitialMaxCount(class_id);
+  const uptr grown = Min(Cache::kMaxCount, Cache::kMaxGrowth * initial);
+  ASSERT_LT(initial, grown);
+
+  // Allocating only: the class runs out of chunks again and again and grows.
+  const uptr kNumAllocs = 1000;
+  void *allocated[kNumAllocs];
+  for (uptr i = 0; i < kNumAllocs; i++)
+    allocated[i] = cache.Allocate(a, class_id);
+  EXPECT_EQ(grown, cache.per_class_[class_id].max_count);
+  AllocatorStatCounters counters;
+  stats.Get(counters);
+  EXPECT_LT(counters[AllocatorStatCacheRefills], kNumAllocs / (initial / 2));
+  for (uptr i = 0; i < kNumAllocs; i++)
+    cache.Deallocate(a, class_id, allocated[i]);
+  stats.Get(counters);
+  EXPECT_GT(counters[AllocatorStatCacheDrains], 0U);
+  EXPECT_EQ(0U, counters[AllocatorStatCacheTrims]);
+
+  // Keep another class busy, class_id is idle and is trimmed back.
+  for (int it = 0; cache.per_class_[class_id].max_count > initial; it++) {
+    ASSERT_LT(it, 10000);
+    for (uptr i = 0; i < 300; i++)
+      allocated[i] = cache.Allocate(a, 1);
+    for (uptr i = 0; i < 300; i++)
+      cache.Deallocate(a, 1, allocated[i]);
+  }
+  EXPECT_LE(cache.per_class_[class_id].count, initial / 2);
+  stats.Get(counters);
+  EXPECT_GE(counters[AllocatorStatCacheTrims], 2U);
+
+  cache.Destroy(a, &stats);
+  a->TestOnlyUnmap();
+  delete a;
+}
+#endif
+
 #if SANITIZER_CAN_USE_ALLOCATOR64
 typedef SizeClassAllocatorLocalCache<Allocator64> AllocatorCache;
 static AllocatorCache static_allocator_cache;
@@ -782,6 +1339,62 @@ TEST(Allocator, Stress) {
   }
 }
 
+static void *InternalAllocThreadWorker(void *arg) {
+  char **shared = reinterpret_cast<char **>(arg);
+  std::vector<char *> ptrs;
+  for (int i = 0; i < 1000; i++) {
+    char *p = (char *)InternalAlloc(i % 300);
+    EXPECT_NE(p, (char *)0);
+    ptrs.push_back(p);
+  }
+  // Free the blocks of the main thread, and leave ours to it.
+  for (int i = 0; i < 100; i++)
+    InternalFree(shared[i]);
+  for (int i = 0; i < 100; i++)
+    shared[i] = ptrs[i];
+  for (size_t i = 100; i < ptrs.size(); i++)
+    InternalFree(ptrs[i]);
+  InternalAllocatorThreadFinish();
+  // Allocations still work once the thread is finished.
+  InternalFree(InternalAlloc(10));
+  return 0;
+}
+
+TEST(Allocator, ThreadCaches) {
+  char *shared[100];
+  for (int t = 0; t < 4; t++) {
+    for (int i = 0; i < 100; i++)
+      shared[i] = (char *)InternalAlloc(i);
+    pthread_t thread;
+    PTHREAD_CREATE(&thread, 0, InternalAllocThreadWorker, shared);
+    PTHREAD_JOIN(thread, 0);
+    for (int i = 0; i < 100; i++)
+      InternalFree(shared[i]);
+  }
+}
+
+TEST(Allocator, ScopedArena) {
+  InternalScopedArena arena;
+  char *prev = nullptr;
+  for (uptr i = 0; i < 10000; i++) {
+    uptr alignment = 1 << (i % 7);
+    char *p = (char *)arena.Allocate(i % 100 + 1, alignment);
+    EXPECT_TRUE(IsAligned((uptr)p, alignment));
+    internal_memset(p, 'a', i % 100 + 1);
+    EXPECT_NE(prev, p);
+    prev = p;
+  }
+  char *large = (char *)arena.Allocate(1 << 20, 64);
+  EXPECT_TRUE(IsAligned((uptr)large, 64));
+  internal_memset(large, 'b', 1 << 20);
+  // The large allocation doesn't end the current block.
+  char *p = (char *)arena.Allocate(8);
+  EXPECT_LT((uptr)(p - prev), (uptr)(1 << 16));
+  EXPECT_STREQ("report", arena.Strdup("report"));
+  char **q = new(arena) char *;
+  *q = p;
+}
+
 TEST(Allocator, LargeAlloc) {
   void *p = InternalAlloc(10 << 20);
   InternalFree(p);
@@ -843,9 +1456,60 @@ void TestSizeClassAllocatorIteration() {
               reported_chunks.end());
   }
 
+  // The parts are disjoint and cover the same chunks.
+  const uptr kNumParts = 5;
+  std::set<uptr> part_chunks[kNumParts];
+  a->ForceLock();
+  for (uptr part = 0; part < kNumParts; part++)
+    a->ForEachChunkInPart(IterationTestCallback, &part_chunks[part], part,
+                          kNumParts);
+  a->ForceUnlock();
+  uptr n_part_chunks = 0;
+  for (uptr part = 0; part < kNumParts; part++) {
+    n_part_chunks += part_chunks[part].size();
+    for (uptr chunk : part_chunks[part])
+      ASSERT_NE(reported_chunks.find(chunk), reported_chunks.end());
+  }
+  ASSERT_EQ(reported_chunks.size(), n_part_chunks);
+
+  a->TestOnlyUnmap();
+  delete a;
+}
+
+#if SANITIZER_CAN_USE_ALLOCATOR64 && !SANITIZER_WINDOWS
+// The chunks returned to the free arrays are not iterated over.
+TEST(SanitizerCommon, SizeClassAllocator64IterationSkipsFree) {
+  Allocator64 *a = new Allocator64;
+  a->Init(kReleaseToOSIntervalNever);
+  SizeClassAllocatorLocalCache<Allocator64> cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.Init(0);
+
+  const uptr kNumChunks = 10000;
+  uptr class_id = Allocator64::SizeClassMapT::ClassID(48);
+  std::vector<void *> allocated;
+  for (uptr i = 0; i < kNumChunks; i++)
+    allocated.push_back(cache.Allocate(a, class_id));
+  for (uptr i = 0; i < kNumChunks; i += 2)
+    cache.Deallocate(a, class_id, allocated[i]);
+  cache.Drain(a);
+
+  std::set<uptr> reported_chunks;
+  a->ForceLock();
+  a->ForEachChunk(IterationTestCallback, &reported_chunks);
+  a->ForceUnlock();
+  for (uptr i = 0; i < kNumChunks; i++) {
+    bool reported = reported_chunks.find(reinterpret_cast<uptr>(
+                        allocated[i])) != reported_chunks.end();
+    ASSERT_EQ(i % 2 == 1, reported);
+  }
+  // Neither are the chunks which were mapped but never allocated.
+  ASSERT_EQ(kNumChunks / 2, reported_chunks.size());
+
   a->TestOnlyUnmap();
   delete a;
 }
+#endif
 
 #if SANITIZER_CAN_USE_ALLOCATOR64
 // These tests can fail on Windows if memory is somewhat full and lit happens
@@ -0,0 +1,190 @@
+//===-- sanitizer_benchmark_test.cc ---------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer/AddressSanitizer runtime.
+//
+// Benchmarks of the sanitizer_common building blocks shared by the tools.
+// They are disabled, check-sanitizer-bench runs them and prints one line of
+// JSON per result.
+//
+//===----------------------------------------------------------------------===//
+#include "sanitizer_common/sanitizer_allocator_internal.h"
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "sanitizer_common/sanitizer_stackdepot.h"
+#include "sanitizer_common/sanitizer_symbolizer.h"
+
+#include "sanitizer_pthread_wrappers.h"
+
+#include "gtest/gtest.h"
+
+namespace __sanitizer {
+
+static const int kMaxBenchThreads = 8;
+
+struct BenchThreadArg {
+  uptr iterations;
+  uptr seed;
+  void *shared;
+};
+
+// Runs the same body on 1, 2, 4 and 8 threads and reports the throughput of
+// each thread count.
+static void RunOnThreads(const char *name, void *(*body)(void *),
+                         uptr iterations, uptr ops_per_iteration,
+                         void *shared = nullptr) {
+  for (int n_threads = 1; n_threads <= kMaxBenchThreads; n_threads *= 2) {
+    pthread_t threads[kMaxBenchThreads];
+    BenchThreadArg args[kMaxBenchThreads];
+    BenchmarkTimer timer;
+    for (int t = 0; t < n_threads; t++) {
+      args[t].iterations = iterations;
+      args[t].seed = t;
+      args[t].shared = shared;
+      PTHREAD_CREATE(&threads[t], 0, body, &args[t]);
+    }
+    for (int t = 0; t < n_threads; t++)
+      PTHREAD_JOIN(threads[t], 0);
+    PrintBenchmarkResult(name, n_threads,
+                         n_threads * iterations * ops_per_iteration,
+                         timer.ElapsedNs());
+  }
+}
+
+static const uptr kAllocBatch = 64;
+
+// Allocates a batch of chunks of mixed sizes, then frees them.
+static void *InternalAllocThread(void *arg) {
+  BenchThreadArg *a = (BenchThreadArg *)arg;
+  void *chunks[kAllocBatch];
+  u32 rand_state = a->seed;
+  for (uptr i = 0; i < a->iterations; i++) {
+    for (uptr j = 0; j < kAllocBatch; j++)
+      chunks[j] = InternalAlloc(16 << (my_rand_r(&rand_state) % 7));
+    for (uptr j = 0; j < kAllocBatch; j++)
+      InternalFree(chunks[j]);
+  }
+  return nullptr;
+}
+
+TEST(DISABLED_BENCH, InternalAllocFree) {
+  RunOnThreads("internal_alloc_free", InternalAllocThread, 1 << 12,
+               2 * kAllocBatch);
+}
+
+// Every Put is an insertion of a new stack.
+TEST(DISABLED_BENCH, StackDepotInsert) {
+  const uptr kStacks = 1 << 17;
+  static uptr round;
+  round++;
+  uptr trace[8];
+  BenchmarkTimer timer;
+  for (uptr i = 0; i < kStacks; i++) {
+    for (uptr j = 0; j < ARRAY_SIZE(trace); j++)
+      trace[j] = (round << 24) | (i << 4) | j;
+    StackDepotPut(StackTrace(trace, ARRAY_SIZE(trace)));
+  }
+  PrintBenchmarkResult("stack_depot_insert", 1, kStacks, timer.ElapsedNs());
+}
+
+// Every Put finds a stack which is already in the depot.
+TEST(DISABLED_BENCH, StackDepotFind) {
+  const uptr kStacks = 1 << 10;
+  const uptr kRounds = 1 << 7;
+  uptr trace[8];
+  for (uptr pass = 0; pass < 2; pass++) {
+    BenchmarkTimer timer;
+    for (uptr r = 0; r < kRounds; r++) {
+      for (uptr i = 0; i < kStacks; i++) {
+        for (uptr j = 0; j < ARRAY_SIZE(trace); j++)
+          trace[j] = (i << 4) | j | (1 << 20);
+        StackDepotPut(StackTrace(trace, ARRAY_SIZE(trace)));
+      }
+    }
+    // The first pass fills the depot.
+    if (pass)
+      PrintBenchmarkResult("stack_depot_find", 1, kRounds * kStacks,
+                           timer.ElapsedNs());
+  }
+}
+
+static NOINLINE void SymbolizedFunction() { break_optimization(nullptr); }
+
+TEST(DISABLED_BENCH, SymbolizePC) {
+  const uptr kQueries = 1 << 10;
+  uptr pc = (uptr)&SymbolizedFunction;
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+  SymbolizedStack *frame = symbolizer->SymbolizePC(pc);
+  bool symbolized = frame->info.function != nullptr;
+  frame->ClearAll();
+  if (!symbolized) {
+    Printf("No symbolizer, skipping\n");
+    return;
+  }
+  BenchmarkTimer timer;
+  for (uptr i = 0; i < kQueries; i++)
+    symbolizer->SymbolizePC(pc)->ClearAll();
+  PrintBenchmarkResult("symbolize_pc", 1, kQueries, timer.ElapsedNs());
+}
+
+// Writes to a large range and gives it back to the OS, as the tools do with
+// the shadow of freed or unmapped memory. Each op is a page.
+TEST(DISABLED_BENCH, ClearAndReleaseRange) {
+  const uptr kSize = 64 << 20;
+  const uptr kRounds = 16;
+  uptr page_size = GetPageSizeCached();
+  uptr beg = (uptr)MmapNoReserveOrDie(kSize, "ClearAndReleaseRange");
+  BenchmarkTimer timer;
+  for (uptr r = 0; r < kRounds; r++) {
+    internal_memset((void *)beg, r + 1, kSize);
+    ReleaseMemoryPagesToOS(beg, beg + kSize);
+  }
+  PrintBenchmarkResult("clear_and_release_range", 1,
+                       kRounds * kSize / page_size, timer.ElapsedNs());
+  UnmapOrDie((void *)beg, kSize);
+}
+
+template <typename MutexType>
+static void *LockUnlockThread(void *arg) {
+  BenchThreadArg *a = (BenchThreadArg *)arg;
+  MutexType *mu = (MutexType *)a->shared;
+  for (uptr i = 0; i < a->iterations; i++) {
+    mu->Lock();
+    mu->Unlock();
+  }
+  return nullptr;
+}
+
+TEST(DISABLED_BENCH, SpinMutex) {
+  static StaticSpinMutex mu;
+  RunOnThreads("spin_mutex_lock_unlock", LockUnlockThread<StaticSpinMutex>,
+               1 << 20, 1, &mu);
+}
+
+TEST(DISABLED_BENCH, BlockingMutex) {
+  static BlockingMutex mu(LINKER_INITIALIZED);
+  RunOnThreads("blocking_mutex_lock_unlock", LockUnlockThread<BlockingMutex>,
+               1 << 20, 1, &mu);
+}
+
+static void *AtomicAddThread(void *arg) {
+  BenchThreadArg *a = (BenchThreadArg *)arg;
+  atomic_uint64_t *counter = (atomic_uint64_t *)a->shared;
+  for (uptr i = 0; i < a->iterations; i++)
+    atomic_fetch_add(counter, 1, memory_order_relaxed);
+  return nullptr;
+}
+
+TEST(DISABLED_BENCH, AtomicFetchAdd) {
+  static atomic_uint64_t counter;
+  RunOnThreads("atomic_fetch_add", AtomicAddThread, 1 << 22, 1, &counter);
+}
+
+}  // namespace __sanitizer
@@ -0,0 +1,59 @@
+//===-- sanitizer_cpu_features_test.cc ------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Tests for sanitizer_cpu_features.h.
+//
+//===----------------------------------------------------------------------===//
+#include "sanitizer_common/sanitizer_cpu_features.h"
+#include "sanitizer_common/sanitizer_libc.h"
+#include "gtest/gtest.h"
+
+namespace __sanitizer {
+
+TEST(SanitizerCommon, CPUFeaturesDetectedOnce) {
+  u64 features = GetCPUFeatures();
+  EXPECT_NE(0U, features & kCPUFeaturesDetected);
+  EXPECT_EQ(features, DetectCPUFeatures());
+  EXPECT_EQ(features, atomic_load(&cpu_features, memory_order_relaxed));
+}
+
+TEST(SanitizerCommon, CPUFeatureNames) {
+  for (int i = 0; i < kCPUFeatureCount; ++i) {
+    const char *name = CPUFeatureName(static_cast<CPUFeature>(i));
+    ASSERT_NE(nullptr, name);
+    for (int j = 0; j < i; ++j)
+      EXPECT_NE(0, internal_strcmp(name,
+                                   CPUFeatureName(static_cast<CPUFeature>(j))));
+  }
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+// The compiler's own detection, which also checks the OS support for AVX.
+TEST(SanitizerCommon, CPUFeaturesMatchBuiltinCPUSupports) {
+  __builtin_cpu_init();
+  EXPECT_EQ(!!__builtin_cpu_supports("sse4.2"),
+            CPUHasFeature(kCPUFeatureSSE4_2));
+  EXPECT_EQ(!!__builtin_cpu_supports("popcnt"),
+            CPUHasFeature(kCPUFeaturePOPCNT));
+  EXPECT_EQ(!!__builtin_cpu_supports("avx"), CPUHasFeature(kCPUFeatureAVX));
+  EXPECT_EQ(!!__builtin_cpu_supports("avx2"), CPUHasFeature(kCPUFeatureAVX2));
+  EXPECT_EQ(!!__builtin_cpu_supports("avx512f"),
+            CPUHasFeature(kCPUFeatureAVX512F));
+}
+#endif
+
+#if defined(__aarch64__)
+TEST(SanitizerCommon, CPUFeaturesAArch64) {
+  // Advanced SIMD is part of the AArch64 Linux ABI.
+  EXPECT_TRUE(CPUHasFeature(kCPUFeatureASIMD));
+  EXPECT_FALSE(CPUHasFeature(kCPUFeatureAVX2));
+}
+#endif
+
+}  // namespace __sanitizer
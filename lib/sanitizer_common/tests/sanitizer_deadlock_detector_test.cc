@@ -494,3 +494,135 @@ void RunRemoveEdgesTest() {
 TEST(DeadlockDetector, RemoveEdgesTest) {
   RunRemoveEdgesTest<BV1>();
 }
+
+struct ScopedSparseDD {
+  ScopedSparseDD() {
+    dp = new SparseDeadlockDetector;
+    dp->Init();
+    dtls.clear();
+  }
+  ~ScopedSparseDD() { delete dp; }
+  SparseDeadlockDetector *dp;
+  SparseDeadlockDetectorTLS dtls;
+};
+
+TEST(SparseDeadlockDetector, BasicTest) {
+  ScopedSparseDD sdd;
+  SparseDeadlockDetector &d = *sdd.dp;
+  SparseDeadlockDetectorTLS &dtls = sdd.dtls;
+  uptr n1 = d.newNode(1);
+  uptr n2 = d.newNode(2);
+  uptr n3 = d.newNode(3);
+  EXPECT_EQ(1U, d.getData(n1));
+  EXPECT_FALSE(d.isLiveNode(0));
+
+  // n1 => n2 => n3.
+  EXPECT_FALSE(d.onLock(&dtls, n1));
+  EXPECT_FALSE(d.onLock(&dtls, n2));
+  EXPECT_FALSE(d.onLock(&dtls, n3));
+  EXPECT_TRUE(d.testOnlyHasEdge(n1, n2));
+  EXPECT_TRUE(d.testOnlyHasEdge(n2, n3));
+  EXPECT_TRUE(d.testOnlyHasEdge(n1, n3));
+  d.onUnlock(&dtls, n1);
+  d.onUnlock(&dtls, n2);
+  d.onUnlock(&dtls, n3);
+  EXPECT_TRUE(dtls.empty());
+  EXPECT_TRUE(d.onFirstLock(&dtls, n1));
+  EXPECT_TRUE(d.onLockFast(&dtls, n2));
+  EXPECT_TRUE(d.hasAllEdges(&dtls, n3));
+  d.onUnlock(&dtls, n2);
+  d.onUnlock(&dtls, n1);
+
+  // n3 => n1 closes the cycle.
+  EXPECT_FALSE(d.onLock(&dtls, n3, 7));
+  EXPECT_FALSE(d.hasAllEdges(&dtls, n1));
+  EXPECT_TRUE(d.onLockBefore(&dtls, n1));
+  uptr path[10];
+  EXPECT_EQ(2U, d.findPathToLock(&dtls, n1, path, ARRAY_SIZE(path)));
+  EXPECT_EQ(n1, path[0]);
+  EXPECT_EQ(n3, path[1]);
+  EXPECT_EQ(1U, d.addEdges(&dtls, n1, 8, 5));
+  u32 stk_from, stk_to;
+  int unique_tid;
+  EXPECT_TRUE(d.findEdge(n3, n1, &stk_from, &stk_to, &unique_tid));
+  EXPECT_EQ(7U, stk_from);
+  EXPECT_EQ(8U, stk_to);
+  EXPECT_EQ(5, unique_tid);
+  d.onLockAfter(&dtls, n1);
+  d.onUnlock(&dtls, n1);
+  d.onUnlock(&dtls, n3);
+
+  // Removing n2 keeps the edges between n1 and n3.
+  d.removeNode(n2);
+  EXPECT_FALSE(d.isLiveNode(n2));
+  EXPECT_TRUE(d.testOnlyHasEdge(n1, n3));
+  EXPECT_TRUE(d.testOnlyHasEdge(n3, n1));
+}
+
+TEST(SparseDeadlockDetector, RecycleNodes) {
+  ScopedSparseDD sdd;
+  SparseDeadlockDetector &d = *sdd.dp;
+  SparseDeadlockDetectorTLS &dtls = sdd.dtls;
+  uptr l0 = d.newNode(0);
+  uptr l1 = d.newNode(0);
+  EXPECT_FALSE(d.onLock(&dtls, l0));
+  EXPECT_FALSE(d.onLock(&dtls, l1));
+  d.onUnlock(&dtls, l1);
+  d.onUnlock(&dtls, l0);
+  // Create and destroy many more locks than a bit vector graph can hold,
+  // which must not forget the edge l0 => l1.
+  set<uptr> ids;
+  for (int i = 0; i < 100000; i++) {
+    uptr node = d.newNode(0);
+    EXPECT_TRUE(ids.insert(node).second);
+    EXPECT_FALSE(d.onLock(&dtls, l0));
+    EXPECT_FALSE(d.onLock(&dtls, node));
+    d.onUnlock(&dtls, node);
+    d.onUnlock(&dtls, l0);
+    d.removeNode(node);
+    EXPECT_FALSE(d.isLiveNode(node));
+  }
+  EXPECT_EQ(2U, d.numLiveNodes());
+  EXPECT_TRUE(d.testOnlyHasEdge(l0, l1));
+  EXPECT_FALSE(d.onLock(&dtls, l1));
+  EXPECT_TRUE(d.onLock(&dtls, l0));
+}
+
+TEST(SparseDeadlockDetector, StaleHeldLock) {
+  ScopedSparseDD sdd;
+  SparseDeadlockDetector &d = *sdd.dp;
+  SparseDeadlockDetectorTLS &dtls = sdd.dtls;
+  uptr l0 = d.newNode(0);
+  EXPECT_TRUE(d.onFirstLock(&dtls, l0));
+  // The lock is destroyed while held, and its slot is reused.
+  d.removeNode(l0);
+  uptr l1 = d.newNode(0);
+  EXPECT_NE(l0, l1);
+  EXPECT_FALSE(d.isHeld(&dtls, l1));
+  EXPECT_FALSE(d.onLock(&dtls, l1));
+  // Only the edge from l1 is added.
+  EXPECT_EQ(1U, d.addEdges(&dtls, d.newNode(0), 0, 0));
+  d.onUnlock(&dtls, l0);
+  d.onUnlock(&dtls, l1);
+  EXPECT_TRUE(dtls.empty());
+}
+
+TEST(SparseDeadlockDetector, EvictNodes) {
+  ScopedSparseDD sdd;
+  SparseDeadlockDetector &d = *sdd.dp;
+  SparseDeadlockDetectorTLS &dtls = sdd.dtls;
+  const uptr kMaxNodes = SparseDeadlockDetector::kMaxNodes;
+  uptr l0 = d.newNode(0);
+  uptr l1 = d.newNode(0);
+  for (uptr i = 2; i < kMaxNodes; i++)
+    d.newNode(0);
+  EXPECT_EQ(kMaxNodes, d.numLiveNodes());
+  // Once all of the nodes are live, the oldest ones are reclaimed.
+  uptr l2 = d.newNode(0);
+  EXPECT_FALSE(d.isLiveNode(l0));
+  EXPECT_TRUE(d.isLiveNode(l1));
+  EXPECT_EQ(kMaxNodes, d.numLiveNodes());
+  EXPECT_FALSE(d.onLock(&dtls, l1));
+  EXPECT_FALSE(d.onLock(&dtls, l2));
+  EXPECT_TRUE(d.testOnlyHasEdge(l1, l2));
+}
@@ -261,3 +261,24 @@ TEST(SanitizerCommonInterceptors, Printf) {
   testPrintf("%m%s", 1, test_buf_size);
   testPrintf("%s%m%s", 2, test_buf_size, test_buf_size);
 }
+
+TEST(SanitizerCommonInterceptors, FormatPlanCache) {
+  // The second call with the same format string uses the cached arguments.
+  for (int i = 0; i < 2; i++) {
+    testPrintf("%d %s %*.*n %m%ls", 3, test_buf_size, I, 0);
+    testScanf("%d%*d%n%ms%5c", 4, I, I, P, 5 * C);
+    testScanfNoGnuMalloc("%as", 1, F);
+    testScanfPartial("%d%n%n%d %s %s", 3, 5, I, I, I, I, test_buf_size);
+  }
+  // The same format string is parsed differently by scanf and printf.
+  testScanf("%f", 1, F);
+  testPrintf("%f", 0);
+
+  // A format string modified in place is parsed again.
+  char format[] = "%d%s";
+  testPrintf(format, 1, test_buf_size);
+  format[1] = 's';
+  testPrintf(format, 2, test_buf_size, test_buf_size);
+  format[3] = 'd';
+  testPrintf(format, 1, test_buf_size);
+}
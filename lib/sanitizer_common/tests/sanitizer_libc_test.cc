@@ -9,8 +9,10 @@
 // Tests for sanitizer_libc.h.
 //===----------------------------------------------------------------------===//
 #include <algorithm>
+#include <string.h>
 
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_flags.h"
 #include "sanitizer_common/sanitizer_libc.h"
 #include "sanitizer_common/sanitizer_platform.h"
 #include "gtest/gtest.h"
@@ -56,6 +58,198 @@ TEST(SanitizerCommon, mem_is_zero) {
   delete [] x;
 }
 
+TEST(SanitizerCommon, mem_find_nonzero) {
+  size_t size = 300;
+  char *x = new char[size];
+  memset(x, 0, size);
+  for (size_t beg = 0; beg < 64; beg++)
+    EXPECT_EQ(size - beg, __sanitizer::mem_find_nonzero(x + beg, size - beg));
+  for (size_t pos = 0; pos < size; pos++) {
+    x[pos] = 1;
+    if (pos + 1 < size) x[pos + 1] = 1;
+    for (size_t beg = 0; beg <= pos; beg++)
+      EXPECT_EQ(pos - beg, __sanitizer::mem_find_nonzero(x + beg, size - beg));
+    EXPECT_EQ(pos, __sanitizer::mem_find_nonzero(x, pos));
+    x[pos] = 0;
+    if (pos + 1 < size) x[pos + 1] = 0;
+  }
+  delete [] x;
+}
+
+static size_t naive_mem_find_mismatch(const char *s1, const char *s2,
+                                      size_t size) {
+  size_t i = 0;
+  while (i < size && s1[i] == s2[i]) i++;
+  return i;
+}
+
+static size_t naive_str_find_mismatch(const char *s1, const char *s2,
+                                      size_t size) {
+  size_t i = 0;
+  while (i < size && s1[i] == s2[i] && s1[i]) i++;
+  return i;
+}
+
+TEST(SanitizerCommon, mem_find_mismatch) {
+  const size_t size = 100;
+  char x[size + 64], y[size + 64];
+  for (size_t i = 0; i < sizeof(x); i++)
+    x[i] = y[i] = 'a' + i % 26;
+  for (size_t pos = 0; pos <= size; pos++) {
+    if (pos < size) y[pos + 32] ^= 1;
+    for (size_t beg = 0; beg < 32; beg++) {
+      const char *s1 = x + 32, *s2 = y + 32;
+      // Also try all of the relative alignments.
+      EXPECT_EQ(naive_mem_find_mismatch(s1 + beg, s2 + beg, size - beg),
+                __sanitizer::mem_find_mismatch(s1 + beg, s2 + beg,
+                                               size - beg));
+      EXPECT_EQ(naive_mem_find_mismatch(x + beg, s2, size),
+                __sanitizer::mem_find_mismatch(x + beg, s2, size));
+    }
+    if (pos < size) y[pos + 32] ^= 1;
+  }
+}
+
+TEST(SanitizerCommon, str_find_mismatch) {
+  const size_t size = 100;
+  char x[size + 1], y[size + 1];
+  for (size_t i = 0; i < size; i++)
+    x[i] = y[i] = 'a' + i % 26;
+  x[size] = y[size] = 0;
+  for (size_t pos = 0; pos <= size; pos++) {
+    for (int kind = 0; kind < 3; kind++) {
+      char saved_x = x[pos], saved_y = y[pos];
+      if (kind == 0)
+        y[pos] = 'A';
+      else if (kind == 1)
+        x[pos] = y[pos] = 0;
+      else
+        x[pos] = 0;
+      for (size_t beg = 0; beg < 16 && beg <= pos; beg++) {
+        for (size_t n = pos - beg; n <= size + 1 - beg; n += 7) {
+          EXPECT_EQ(naive_str_find_mismatch(x + beg, y + beg, n),
+                    __sanitizer::str_find_mismatch(x + beg, y + beg, n));
+        }
+        EXPECT_EQ(naive_str_find_mismatch(x + beg, y + beg, ~(size_t)0),
+                  __sanitizer::str_find_mismatch(x + beg, y + beg, ~(uptr)0));
+      }
+      x[pos] = saved_x;
+      y[pos] = saved_y;
+    }
+  }
+}
+
+#if SANITIZER_POSIX
+TEST(SanitizerCommon, str_find_mismatch_PageBoundary) {
+  // Strings which end right before an unmapped page.
+  uptr page_size = GetPageSizeCached();
+  char *mem1 = (char *)MmapOrDie(2 * page_size, "str_find_mismatch");
+  char *mem2 = (char *)MmapOrDie(2 * page_size, "str_find_mismatch");
+  ASSERT_TRUE(MprotectNoAccess((uptr)mem1 + page_size, page_size));
+  ASSERT_TRUE(MprotectNoAccess((uptr)mem2 + page_size, page_size));
+  for (uptr len = 0; len < 40; len++) {
+    char *s = mem1 + page_size - len - 1;
+    internal_memset(s, 'x', len);
+    s[len] = 0;
+    for (uptr off = 0; off < 20; off++) {
+      char *t = mem2 + page_size - len - 1 - off;
+      internal_memset(t, 'x', len);
+      t[len] = 0;
+      EXPECT_EQ(len, str_find_mismatch(s, t, ~(uptr)0));
+      EXPECT_EQ(len, str_find_mismatch(t, s, ~(uptr)0));
+    }
+  }
+  UnmapOrDie(mem1, 2 * page_size);
+  UnmapOrDie(mem2, 2 * page_size);
+}
+#endif
+
+TEST(SanitizerCommon, InternalMemFunctions) {
+  const uptr kSize = 300;
+  char src[kSize + 64], dst[kSize + 64], expected[kSize + 64];
+  for (uptr i = 0; i < sizeof(src); i++)
+    src[i] = (char)(i * 7 + 1);
+  for (uptr beg = 0; beg < 32; beg++) {
+    for (uptr n = 0; n + beg <= kSize; n += (n < 40 ? 1 : 13)) {
+      memset(dst, 0x55, sizeof(dst));
+      memcpy(expected, dst, sizeof(dst));
+      memcpy(expected + beg, src + 3, n);
+      EXPECT_EQ(dst + beg, internal_memcpy(dst + beg, src + 3, n));
+      EXPECT_EQ(0, memcmp(expected, dst, sizeof(dst)));
+      EXPECT_EQ(0, internal_memcmp(dst + beg, src + 3, n));
+
+      memset(expected + beg, 0xab, n);
+      EXPECT_EQ(dst + beg, internal_memset(dst + beg, 0xab, n));
+      EXPECT_EQ(0, memcmp(expected, dst, sizeof(dst)));
+      if (n) {
+        dst[beg + n - 1] = 1;
+        EXPECT_EQ(1, internal_memcmp(expected + beg, dst + beg, n));
+        EXPECT_EQ(-1, internal_memcmp(dst + beg, expected + beg, n));
+      }
+    }
+  }
+}
+
+TEST(SanitizerCommon, InternalStrlen) {
+  const uptr kSize = 100;
+  char s[kSize + 32];
+  memset(s, 'x', sizeof(s));
+  for (uptr beg = 0; beg < 32; beg++) {
+    for (uptr len = 0; len < kSize; len++) {
+      s[beg + len] = 0;
+      EXPECT_EQ(len, internal_strlen(s + beg));
+      s[beg + len] = 'x';
+    }
+  }
+}
+
+// Reports the throughput of the memory functions at several sizes.
+TEST(DISABLED_BENCH, InternalMemFunctions) {
+  const uptr kTotal = 1 << 28;
+  const uptr kMaxSize = 1 << 16;
+  char *src = new char[kMaxSize + 1];
+  char *dst = new char[kMaxSize + 1];
+  memset(src, 'x', kMaxSize);
+  src[kMaxSize] = 0;
+  memcpy(dst, src, kMaxSize + 1);
+  for (uptr size = 16; size <= kMaxSize; size *= 4) {
+    uptr iterations = kTotal / size;
+    src[size] = 0;
+    u64 start = NanoTime();
+    for (uptr i = 0; i < iterations; i++) {
+      internal_memcpy(dst, src, size);
+      SanitizerBreakOptimization(dst);
+    }
+    u64 memcpy_time = NanoTime() - start;
+    start = NanoTime();
+    for (uptr i = 0; i < iterations; i++) {
+      internal_memset(dst, 'x', size);
+      SanitizerBreakOptimization(dst);
+    }
+    u64 memset_time = NanoTime() - start;
+    start = NanoTime();
+    for (uptr i = 0; i < iterations; i++) {
+      EXPECT_EQ(size, internal_strlen(src));
+      SanitizerBreakOptimization(src);
+    }
+    u64 strlen_time = NanoTime() - start;
+    start = NanoTime();
+    for (uptr i = 0; i < iterations; i++) {
+      EXPECT_EQ(0, internal_memcmp(dst, src, size));
+      SanitizerBreakOptimization(dst);
+    }
+    u64 memcmp_time = NanoTime() - start;
+    src[size] = 'x';
+    u64 bytes = (u64)iterations * size * 1000;
+    Printf("size: %6zd MB/s memcpy: %6llu memset: %6llu strlen: %6llu "
+           "memcmp: %6llu\n", size, bytes / (memcpy_time | 1),
+           bytes / (memset_time | 1), bytes / (strlen_time | 1),
+           bytes / (memcmp_time | 1));
+  }
+  delete[] src;
+  delete[] dst;
+}
+
 struct stat_and_more {
   struct stat st;
   unsigned char z;
@@ -240,4 +434,49 @@ TEST(SanitizerCommon, InternalMmapWithOffset) {
   UnmapOrDie(p, page_size);
   internal_unlink(tmpfile);
 }
+
+static void ExpectFileContents(const char *path, const char *expected) {
+  char *buff;
+  uptr buff_size, read_len;
+  ASSERT_TRUE(ReadFileToBuffer(path, &buff, &buff_size, &read_len));
+  EXPECT_EQ(internal_strlen(expected), read_len);
+  EXPECT_EQ(0, internal_memcmp(buff, expected, read_len));
+  UnmapOrDie(buff, buff_size);
+}
+
+TEST(SanitizerCommon, ReportFileRotateAndBuffer) {
+  CommonFlags saved_flags, cf;
+  saved_flags.CopyFrom(*common_flags());
+  cf.CopyFrom(saved_flags);
+  cf.buffer_reports = true;
+  OverrideCommonFlags(cf);
+
+  char prefix[128];
+  temp_file_name(prefix, sizeof(prefix), "sanitizer_common.reportfile.tmp.");
+  static StaticSpinMutex mu;
+  static ReportFile file = {&mu, kInvalidFd, "", "", 0};
+  file.SetReportPath(prefix);
+  file.max_size = 10;
+  file.Write("0123456", 7);
+  // Larger than max_size in total, the first file is moved out of the way.
+  file.Write("abcdef", 6);
+  char old_path[kMaxPathLength];
+  internal_snprintf(old_path, sizeof(old_path), "%s.1", file.full_path);
+  ExpectFileContents(old_path, "0123456");
+  ExpectFileContents(file.full_path, "abcdef");
+
+  file.StartBuffering();
+  file.StartBuffering();
+  file.Write("gh", 2);
+  file.FinishBuffering();
+  file.Write("ij", 2);
+  ExpectFileContents(file.full_path, "abcdef");
+  file.FinishBuffering();
+  ExpectFileContents(file.full_path, "abcdefghij");
+
+  CloseFile(file.fd);
+  internal_unlink(file.full_path);
+  internal_unlink(old_path);
+  OverrideCommonFlags(saved_flags);
+}
 #endif
@@ -50,6 +50,13 @@ class TestData {
     mtx_->Unlock();
   }
 
+  void Read() {
+    GenericScopedReadLock<MutexType> l(mtx_);
+    T v0 = data_[0];
+    for (int i = 0; i < kSize; i++)
+      CHECK_EQ(data_[i], v0);
+  }
+
   void Backoff() {
     volatile T data[kSize] = {};
     for (int i = 0; i < kSize; i++) {
@@ -94,6 +101,19 @@ static void *try_thread(void *param) {
   return 0;
 }
 
+template<typename MutexType>
+static void *read_write_thread(void *param) {
+  TestData<MutexType> *data = (TestData<MutexType>*)param;
+  for (int i = 0; i < kIters; i++) {
+    if (i % 8 == 0)
+      data->Write();
+    else
+      data->Read();
+    data->Backoff();
+  }
+  return 0;
+}
+
 template<typename MutexType>
 static void check_locked(MutexType *mtx) {
   GenericScopedLock<MutexType> l(mtx);
@@ -134,4 +154,48 @@ TEST(SanitizerCommon, BlockingMutex) {
   check_locked(mtx);
 }
 
+TEST(SanitizerCommon, BlockingMutexContention) {
+  u64 mtxmem[1024] = {};
+  BlockingMutex *mtx = new(mtxmem) BlockingMutex(LINKER_INITIALIZED);
+  mtx->Lock();
+  mtx->Unlock();
+  EXPECT_EQ(0U, mtx->ContentionCount());
+  // More threads than CPUs, so that the waiters go to sleep.
+  TestData<BlockingMutex> data(mtx);
+  const int kManyThreads = 4 * kThreads;
+  pthread_t threads[kManyThreads];
+  for (int i = 0; i < kManyThreads; i++)
+    PTHREAD_CREATE(&threads[i], 0, lock_thread<BlockingMutex>, &data);
+  for (int i = 0; i < kManyThreads; i++)
+    PTHREAD_JOIN(threads[i], 0);
+  EXPECT_LE(mtx->ContentionCount(), (uptr)kManyThreads * kIters);
+}
+
+TEST(SanitizerCommon, RWMutex) {
+  RWMutex mtx;
+  TestData<RWMutex> data(&mtx);
+  pthread_t threads[kThreads];
+  for (int i = 0; i < kThreads; i++)
+    PTHREAD_CREATE(&threads[i], 0, lock_thread<RWMutex>, &data);
+  for (int i = 0; i < kThreads; i++)
+    PTHREAD_JOIN(threads[i], 0);
+  check_locked(&mtx);
+}
+
+TEST(SanitizerCommon, RWMutexReadWrite) {
+  RWMutex mtx;
+  TestData<RWMutex> data(&mtx);
+  const int kManyThreads = 4 * kThreads;
+  pthread_t threads[kManyThreads];
+  for (int i = 0; i < kManyThreads; i++)
+    PTHREAD_CREATE(&threads[i], 0, read_write_thread<RWMutex>, &data);
+  for (int i = 0; i < kManyThreads; i++)
+    PTHREAD_JOIN(threads[i], 0);
+  mtx.ReadLock();
+  mtx.ReadLock();
+  mtx.CheckLocked();
+  mtx.ReadUnlock();
+  mtx.ReadUnlock();
+}
+
 }  // namespace __sanitizer
@@ -19,6 +19,8 @@
 
 #include <pthread.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace __sanitizer {
 
@@ -76,6 +78,33 @@ TEST(SanitizerCommon, IsAccessibleMemoryRange) {
   EXPECT_FALSE(IsAccessibleMemoryRange(0x0, 2));
 }
 
+#ifdef MADV_DONTFORK
+TEST(SanitizerCommon, DontForkShadowMemory) {
+  const uptr size = 4 * GetPageSize();
+  // Stays mapped: the pthread_atfork handlers are never unregistered.
+  char *mem = (char *)mmap(0, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANON, -1, 0);
+  ASSERT_NE(MAP_FAILED, mem);
+  DontForkShadowMemory((uptr)mem, size);
+  mem[0] = 1;
+  mem[size - 1] = 2;
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // The child gets the range back zeroed and writable.
+    bool ok = mem[0] == 0 && mem[size - 1] == 0;
+    mem[0] = 3;
+    _exit(ok ? 0 : 1);
+  }
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  EXPECT_EQ(1, mem[0]);
+  EXPECT_EQ(2, mem[size - 1]);
+}
+#endif  // MADV_DONTFORK
+
 }  // namespace __sanitizer
 
 #endif  // SANITIZER_POSIX
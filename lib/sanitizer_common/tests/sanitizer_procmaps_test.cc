@@ -73,5 +73,15 @@ TEST(MemoryMapping, LoadedModuleArchAndUUID) {
   }
 }
 
+#if SANITIZER_LINUX && !SANITIZER_ANDROID
+TEST(ListOfModules, IsStale) {
+  ListOfModules modules;
+  EXPECT_TRUE(modules.isStale());
+  modules.init();
+  EXPECT_GT(GetModulesGeneration(), 0U);
+  EXPECT_FALSE(modules.isStale());
+}
+#endif
+
 }  // namespace __sanitizer
 #endif  // !defined(_WIN32)
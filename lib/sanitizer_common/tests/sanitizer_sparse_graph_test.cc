@@ -0,0 +1,167 @@
+//===-- sanitizer_sparse_graph_test.cc ------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Sanitizer runtime.
+// Tests for sanitizer_sparse_graph.h.
+//
+//===----------------------------------------------------------------------===//
+#include "sanitizer_common/sanitizer_sparse_graph.h"
+
+#include "sanitizer_test_utils.h"
+
+#include "gtest/gtest.h"
+
+#include <set>
+#include <vector>
+
+using namespace __sanitizer;
+using namespace std;
+
+static const SparseGraph::EdgeInfo kNoInfo = {0, 0, 0};
+
+// Reference reachability by a depth-first search over a set of edges.
+static bool SimpleIsReachable(const set<pair<uptr, uptr> > &edges, uptr from,
+                              const set<uptr> &targets) {
+  set<uptr> visited;
+  vector<uptr> stack(1, from);
+  visited.insert(from);
+  while (!stack.empty()) {
+    uptr idx = stack.back();
+    stack.pop_back();
+    if (targets.count(idx))
+      return true;
+    for (set<pair<uptr, uptr> >::const_iterator it = edges.begin();
+         it != edges.end(); ++it) {
+      if (it->first == idx && visited.insert(it->second).second)
+        stack.push_back(it->second);
+    }
+  }
+  return false;
+}
+
+// The edges which are not back edges follow the topological order.
+static void CheckOrder(SparseGraph *g, const set<pair<uptr, uptr> > &edges) {
+  uptr n_unordered = 0;
+  for (set<pair<uptr, uptr> >::const_iterator it = edges.begin();
+       it != edges.end(); ++it) {
+    if (g->testOnlyGetOrder(it->first) > g->testOnlyGetOrder(it->second))
+      n_unordered++;
+  }
+  EXPECT_LE(n_unordered, g->numBackEdges());
+}
+
+static void RandomTest(uptr num_nodes, uptr num_edges) {
+  SparseGraph *g = new SparseGraph;
+  g->Init();
+  for (uptr i = 0; i < num_nodes; i++)
+    g->addNode(i);
+  set<pair<uptr, uptr> > edges;
+  int num_reachable = 0;
+  for (uptr it = 0; it < num_edges; it++) {
+    uptr from = my_rand() % num_nodes;
+    uptr to = my_rand() % num_nodes;
+    EXPECT_EQ(edges.insert(make_pair(from, to)).second,
+              g->addEdge(from, to, kNoInfo));
+    EXPECT_TRUE(g->hasEdge(from, to));
+    // Remove a node now and then.
+    if (my_rand() % 16 == 0) {
+      uptr idx = my_rand() % num_nodes;
+      g->removeNode(idx);
+      for (set<pair<uptr, uptr> >::iterator e = edges.begin();
+           e != edges.end();) {
+        if (e->first == idx || e->second == idx)
+          edges.erase(e++);
+        else
+          ++e;
+      }
+    }
+    CheckOrder(g, edges);
+    for (int i = 0; i < 4; i++) {
+      uptr targets[3];
+      set<uptr> s_targets;
+      for (int t = 0; t < 3; t++) {
+        targets[t] = my_rand() % num_nodes;
+        s_targets.insert(targets[t]);
+      }
+      from = my_rand() % num_nodes;
+      bool is_reachable = g->isReachable(from, targets, 3);
+      EXPECT_EQ(SimpleIsReachable(edges, from, s_targets), is_reachable);
+      uptr path[64];
+      uptr len = g->findShortestPath(from, targets, 3, path, 64);
+      EXPECT_EQ(is_reachable, len != 0);
+      if (!len)
+        continue;
+      num_reachable++;
+      EXPECT_EQ(from, path[0]);
+      EXPECT_TRUE(s_targets.count(path[len - 1]));
+      for (uptr j = 0; j + 1 < len; j++)
+        EXPECT_TRUE(edges.count(make_pair(path[j], path[j + 1])));
+    }
+  }
+  EXPECT_GT(num_reachable, 0);
+  delete g;
+}
+
+TEST(SparseGraph, RandomSparse) {
+  RandomTest(200, 300);
+}
+
+TEST(SparseGraph, RandomDense) {
+  RandomTest(20, 200);
+}
+
+TEST(SparseGraph, BackEdges) {
+  SparseGraph *g = new SparseGraph;
+  g->Init();
+  for (uptr i = 0; i < 4; i++)
+    g->addNode(i);
+  // 3 => 2 => 1 => 0 goes against the order in which the nodes were added.
+  EXPECT_TRUE(g->addEdge(3, 2, kNoInfo));
+  EXPECT_TRUE(g->addEdge(2, 1, kNoInfo));
+  EXPECT_TRUE(g->addEdge(1, 0, kNoInfo));
+  EXPECT_FALSE(g->addEdge(1, 0, kNoInfo));
+  EXPECT_EQ(0U, g->numBackEdges());
+  EXPECT_LT(g->testOnlyGetOrder(3), g->testOnlyGetOrder(2));
+  EXPECT_LT(g->testOnlyGetOrder(2), g->testOnlyGetOrder(1));
+  EXPECT_LT(g->testOnlyGetOrder(1), g->testOnlyGetOrder(0));
+  uptr target = 3;
+  EXPECT_FALSE(g->isReachable(0, &target, 1));
+  // Close the cycle.
+  SparseGraph::EdgeInfo info = {1, 2, 3};
+  EXPECT_TRUE(g->addEdge(0, 3, info));
+  EXPECT_EQ(1U, g->numBackEdges());
+  EXPECT_TRUE(g->isReachable(0, &target, 1));
+  EXPECT_TRUE(g->isReachable(2, &target, 1));
+  uptr path[4];
+  EXPECT_EQ(4U, g->findShortestPath(2, &target, 1, path, 4));
+  EXPECT_EQ(2U, path[0]);
+  EXPECT_EQ(1U, path[1]);
+  EXPECT_EQ(0U, path[2]);
+  EXPECT_EQ(3U, path[3]);
+  EXPECT_EQ(0U, g->findShortestPath(2, &target, 1, path, 3));
+  const SparseGraph::EdgeInfo *e = g->getEdgeInfo(0, 3);
+  ASSERT_NE(nullptr, e);
+  EXPECT_EQ(1U, e->stk_from);
+  EXPECT_EQ(2U, e->stk_to);
+  EXPECT_EQ(3, e->unique_tid);
+  EXPECT_EQ(nullptr, g->getEdgeInfo(3, 0));
+  // Removing a node of the back edge removes it.
+  g->removeNode(0);
+  EXPECT_EQ(0U, g->numBackEdges());
+  EXPECT_FALSE(g->hasEdge(1, 0));
+  EXPECT_FALSE(g->hasEdge(0, 3));
+  EXPECT_TRUE(g->hasEdge(3, 2));
+  EXPECT_FALSE(g->isReachable(1, &target, 1));
+  target = 1;
+  EXPECT_TRUE(g->isReachable(3, &target, 1));
+  g->addNode(0);
+  EXPECT_TRUE(g->addEdge(0, 3, kNoInfo));
+  EXPECT_EQ(0U, g->numBackEdges());
+  delete g;
+}
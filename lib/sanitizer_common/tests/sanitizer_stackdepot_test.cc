@@ -11,8 +11,12 @@
 //
 //===----------------------------------------------------------------------===//
 #include "sanitizer_common/sanitizer_stackdepot.h"
+#include "sanitizer_common/sanitizer_persistent_allocator.h"
 #include "sanitizer_common/sanitizer_internal_defs.h"
 #include "sanitizer_common/sanitizer_libc.h"
+
+#include "sanitizer_pthread_wrappers.h"
+
 #include "gtest/gtest.h"
 
 namespace __sanitizer {
@@ -65,6 +69,25 @@ TEST(SanitizerCommon, StackDepotSeveral) {
   EXPECT_NE(i1, i2);
 }
 
+TEST(SanitizerCommon, StackDepotCompression) {
+  // Both small and large differences between the frames, either way.
+  uptr array[] = {0x401000, 0x401234, 0x400010, 0x7fff12345678, 0,
+                  ~(uptr)0, 0x80, 0x7f, (uptr)1 << (SANITIZER_WORDSIZE - 1)};
+  StackTrace s1(array, ARRAY_SIZE(array));
+  uptr uncompressed0 = StackDepotGetStats()->uncompressed;
+  u32 i1 = StackDepotPut(s1);
+  EXPECT_GT(StackDepotGetStats()->uncompressed, uncompressed0);
+  EXPECT_EQ(i1, StackDepotPut(s1));
+  StackTrace stack = StackDepotGet(i1);
+  ASSERT_EQ(ARRAY_SIZE(array), stack.size);
+  EXPECT_EQ(0, internal_memcmp(stack.trace, array, sizeof(array)));
+  // The decompressed copy is kept.
+  EXPECT_EQ(stack.trace, StackDepotGet(i1).trace);
+  // Only the last frame differs.
+  array[ARRAY_SIZE(array) - 1]++;
+  EXPECT_NE(i1, StackDepotPut(s1));
+}
+
 TEST(SanitizerCommon, StackDepotReverseMap) {
   uptr array1[] = {1, 2, 3, 4, 5};
   uptr array2[] = {7, 1, 3, 0};
@@ -90,4 +113,98 @@ TEST(SanitizerCommon, StackDepotReverseMap) {
   }
 }
 
+struct StackDepotThreadArg {
+  uptr seed;
+  uptr n_stacks;
+  u32 *ids;
+};
+
+static void *StackDepotPutThread(void *param) {
+  StackDepotThreadArg *arg = (StackDepotThreadArg *)param;
+  for (uptr i = 0; i < arg->n_stacks; i++) {
+    // All threads with the same seed insert exactly the same stacks.
+    uptr array[] = {0x1000, arg->seed, i, i * 7 + 1};
+    StackTrace s(array, ARRAY_SIZE(array));
+    arg->ids[i] = StackDepotPut(s);
+  }
+  return nullptr;
+}
+
+TEST(SanitizerCommon, StackDepotMultiThreaded) {
+  const uptr kThreads = 8;
+  const uptr kStacks = 4096;
+  pthread_t threads[kThreads];
+  StackDepotThreadArg args[kThreads];
+  for (uptr t = 0; t < kThreads; t++) {
+    args[t].seed = t % 2;
+    args[t].n_stacks = kStacks;
+    args[t].ids = new u32[kStacks];
+    PTHREAD_CREATE(&threads[t], 0, StackDepotPutThread, &args[t]);
+  }
+  for (uptr t = 0; t < kThreads; t++)
+    PTHREAD_JOIN(threads[t], 0);
+  for (uptr t = 0; t < kThreads; t++) {
+    for (uptr i = 0; i < kStacks; i++) {
+      // Racing inserts of the same stack must agree on its id.
+      EXPECT_EQ(args[t % 2].ids[i], args[t].ids[i]);
+      StackTrace stack = StackDepotGet(args[t].ids[i]);
+      ASSERT_EQ(4U, stack.size);
+      EXPECT_EQ(args[t].seed, stack.trace[1]);
+      EXPECT_EQ(i, stack.trace[2]);
+    }
+  }
+  for (uptr t = 0; t < kThreads; t++)
+    delete[] args[t].ids;
+}
+
+TEST(SanitizerCommon, PersistentAllocator) {
+  const uptr kAllocs = 4096;
+  static uptr *blocks[kAllocs];
+  uptr mapped0 = StackDepotGetStats()->persistent_mapped;
+  // Mixes the sizes served from the thread's slabs with the larger ones.
+  for (uptr i = 0; i < kAllocs; i++) {
+    uptr n = i % 64 == 0 ? 1000 : i % 16 + 1;
+    blocks[i] = (uptr *)PersistentAlloc(n * sizeof(uptr));
+    for (uptr j = 0; j < n; j++)
+      blocks[i][j] = i;
+  }
+  for (uptr i = 0; i < kAllocs; i++) {
+    uptr n = i % 64 == 0 ? 1000 : i % 16 + 1;
+    for (uptr j = 0; j < n; j++)
+      ASSERT_EQ(i, blocks[i][j]);
+  }
+  StackDepotStats *stats = StackDepotGetStats();
+  EXPECT_GT(stats->persistent_mapped, mapped0);
+  EXPECT_LT(stats->persistent_wasted, stats->persistent_mapped);
+}
+
+// Reports StackDepotPut throughput for new stacks against the thread count.
+TEST(DISABLED_BENCH, StackDepotPutContention) {
+  const uptr kMaxThreads = 64;
+  const uptr kStacksPerThread = 1 << 14;
+  static uptr round = 0;
+  for (uptr n_threads = 1; n_threads <= kMaxThreads; n_threads *= 2) {
+    pthread_t threads[kMaxThreads];
+    StackDepotThreadArg args[kMaxThreads];
+    round++;
+    for (uptr t = 0; t < n_threads; t++) {
+      // Unique seed per thread and round, so that every Put is an insertion.
+      args[t].seed = (round << 8) | t;
+      args[t].n_stacks = kStacksPerThread;
+      args[t].ids = new u32[kStacksPerThread];
+    }
+    u64 start = NanoTime();
+    for (uptr t = 0; t < n_threads; t++)
+      PTHREAD_CREATE(&threads[t], 0, StackDepotPutThread, &args[t]);
+    for (uptr t = 0; t < n_threads; t++)
+      PTHREAD_JOIN(threads[t], 0);
+    u64 elapsed = NanoTime() - start;
+    u64 inserts = n_threads * kStacksPerThread;
+    Printf("threads: %2zd inserts/sec: %llu\n", n_threads,
+           inserts * 1000000000ULL / (elapsed ? elapsed : 1));
+    for (uptr t = 0; t < n_threads; t++)
+      delete[] args[t].ids;
+  }
+}
+
 }  // namespace __sanitizer
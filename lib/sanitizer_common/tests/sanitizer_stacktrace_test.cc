@@ -12,7 +12,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_flags.h"
+#include "sanitizer_common/sanitizer_shadow_stack.h"
 #include "sanitizer_common/sanitizer_stacktrace.h"
+#include "sanitizer_pthread_wrappers.h"
 #include "gtest/gtest.h"
 
 namespace __sanitizer {
@@ -149,6 +152,214 @@ TEST_F(FastUnwindTest, CloseToZeroFrame) {
   }
 }
 
+#if SANITIZER_LINUX && !SANITIZER_ANDROID
+TEST(FastUnwindCacheTest, Basic) {
+  if (!StackTrace::WillUseFastUnwind(true))
+    return;
+  CommonFlags saved_flags, cf;
+  saved_flags.CopyFrom(*common_flags());
+  cf.CopyFrom(saved_flags);
+  cf.fast_unwind_cache = true;
+  OverrideCommonFlags(cf);
+
+  // A fake stack of 20 frames, as in FastUnwindTest.
+  const uptr kSlots = 40;
+  uhwptr fake_stack[kSlots + 4];
+  for (uptr i = 0; i + 1 < kSlots; i += 2) {
+    fake_stack[i] = (uhwptr)&fake_stack[i + 2];
+    fake_stack[i + 1] = PC(i + 1);
+  }
+  fake_stack[kSlots - 2] = (uhwptr)&fake_stack[0];
+  uptr top = (uptr)&fake_stack[kSlots + 2];
+  uptr bottom = (uptr)&fake_stack[0] - sizeof(uhwptr);
+  const u32 kDepth = 30;
+
+  BufferedStackTrace expected;
+  expected.Unwind(kDepth, PC(0), (uptr)&fake_stack[0], 0, top, bottom, true);
+  EXPECT_EQ(21U, expected.size);
+
+  // The second unwind is served from the cache.
+  BufferedStackTrace trace;
+  trace.Unwind(kDepth, PC(0), (uptr)&fake_stack[0], 0, top, bottom, true);
+  ASSERT_EQ(expected.size, trace.size);
+  for (uptr i = 0; i < trace.size; i++)
+    EXPECT_EQ(expected.trace[i], trace.trace[i]);
+
+  // A different frame in the prefix, or right after it, is a miss.
+  for (uptr slot = 3; slot <= 13; slot += 10) {
+    fake_stack[slot] = PC(1000);
+    trace.Unwind(kDepth, PC(0), (uptr)&fake_stack[0], 0, top, bottom, true);
+    ASSERT_EQ(expected.size, trace.size);
+    EXPECT_EQ(PC(1000), trace.trace[slot / 2 + 1]);
+    fake_stack[slot] = PC(slot);
+  }
+
+  // So is a different maximum depth.
+  trace.Unwind(10, PC(0), (uptr)&fake_stack[0], 0, top, bottom, true);
+  EXPECT_EQ(10U, trace.size);
+
+  OverrideCommonFlags(saved_flags);
+}
+#endif
+
+class ShadowStackTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    saved_flags.CopyFrom(*common_flags());
+    CommonFlags cf;
+    cf.CopyFrom(saved_flags);
+    cf.use_shadow_stack = true;
+    OverrideCommonFlags(cf);
+  }
+  virtual void TearDown() { OverrideCommonFlags(saved_flags); }
+
+  CommonFlags saved_flags;
+};
+
+TEST_F(ShadowStackTest, Basic) {
+  const uptr *pcs;
+  uptr base = GetShadowStack(&pcs);
+  ASSERT_EQ(0U, base);
+  __sanitizer_shadow_stack_enter(PC(1));
+  __sanitizer_shadow_stack_enter(PC(2));
+  __sanitizer_shadow_stack_enter(PC(3));
+  ASSERT_EQ(3U, GetShadowStack(&pcs));
+  EXPECT_EQ(PC(1), pcs[0]);
+
+  BufferedStackTrace trace;
+  trace.Unwind(kStackTraceMax, PC(0), 0, 0, 0, 0, true);
+  ASSERT_EQ(4U, trace.size);
+  for (uptr i = 0; i < trace.size; i++)
+    EXPECT_EQ(PC(i ? 4 - i : 0), trace.trace[i]);
+
+  trace.Unwind(2, PC(0), 0, 0, 0, 0, false);
+  ASSERT_EQ(2U, trace.size);
+  EXPECT_EQ(PC(3), trace.trace[1]);
+
+  __sanitizer_shadow_stack_exit();
+  trace.Unwind(kStackTraceMax, PC(0), 0, 0, 0, 0, true);
+  ASSERT_EQ(3U, trace.size);
+  EXPECT_EQ(PC(2), trace.trace[1]);
+
+  __sanitizer_shadow_stack_exit();
+  __sanitizer_shadow_stack_exit();
+  EXPECT_EQ(0U, GetShadowStack(&pcs));
+  // Exits without entries are ignored.
+  __sanitizer_shadow_stack_exit();
+  __sanitizer_shadow_stack_enter(PC(1));
+  EXPECT_EQ(1U, GetShadowStack(&pcs));
+  __sanitizer_shadow_stack_exit();
+}
+
+static void *ShadowStackThread(void *arg) {
+  const uptr *pcs;
+  __sanitizer_shadow_stack_enter(PC(1));
+  EXPECT_EQ(1U, GetShadowStack(&pcs));
+  ShadowStackThreadFinish();
+  // Entries after the thread has finished are ignored.
+  __sanitizer_shadow_stack_enter(PC(2));
+  EXPECT_EQ(0U, GetShadowStack(&pcs));
+  __sanitizer_shadow_stack_exit();
+  __sanitizer_shadow_stack_exit();
+  EXPECT_EQ(0U, GetShadowStack(&pcs));
+  return nullptr;
+}
+
+TEST_F(ShadowStackTest, ThreadFinish) {
+  pthread_t t;
+  PTHREAD_CREATE(&t, 0, ShadowStackThread, 0);
+  PTHREAD_JOIN(t, 0);
+}
+
+// Compares the costs of capturing a stack with the shadow stack and with the
+// frame pointer unwinder, from the bottom of kBenchDepth frames.
+static const int kBenchDepth = 30;
+static const int kBenchIterations = 1 << 22;
+
+static NOINLINE void BenchCapture(int depth, uptr stack_top,
+                                  uptr stack_bottom) {
+  __sanitizer_shadow_stack_enter(GET_CALLER_PC());
+  if (depth > 0) {
+    BenchCapture(depth - 1, stack_top, stack_bottom);
+  } else {
+    BufferedStackTrace trace;
+    u64 start = NanoTime();
+    for (int i = 0; i < kBenchIterations; i++) {
+      GET_CURRENT_PC_BP_SP;
+      (void)sp;
+      trace.Unwind(kBenchDepth, pc, bp, 0, stack_top, stack_bottom, true);
+      EXPECT_GE(trace.size, (u32)kBenchDepth - 1);
+    }
+    Printf("%s: %d ns per stack\n",
+           common_flags()->use_shadow_stack ? "shadow stack" : "frame pointers",
+           (int)((NanoTime() - start) / kBenchIterations));
+  }
+  __sanitizer_shadow_stack_exit();
+}
+
+TEST_F(ShadowStackTest, DISABLED_BENCH) {
+  uptr stack_top, stack_bottom;
+  GetThreadStackTopAndBottom(false, &stack_top, &stack_bottom);
+  BenchCapture(kBenchDepth, stack_top, stack_bottom);
+  CommonFlags cf;
+  cf.CopyFrom(*common_flags());
+  cf.use_shadow_stack = false;
+  OverrideCommonFlags(cf);
+  BenchCapture(kBenchDepth, stack_top, stack_bottom);
+}
+
+#if SANITIZER_LINUX && !SANITIZER_ANDROID && \
+    (defined(__x86_64__) || defined(__aarch64__))
+static void SetEhFrameUnwind(bool value) {
+  CommonFlags cf;
+  cf.CopyFrom(*common_flags());
+  cf.eh_frame_unwind = value;
+  OverrideCommonFlags(cf);
+}
+
+static NOINLINE void EhFrameUnwindCompare(int depth, int iterations) {
+  if (depth > 0) {
+    EhFrameUnwindCompare(depth - 1, iterations);
+    // Keep the call from being a tail call.
+    asm volatile("" ::: "memory");
+    return;
+  }
+  BufferedStackTrace expected, trace;
+  uptr pc = StackTrace::GetCurrentPc();
+  SetEhFrameUnwind(false);
+  u64 start = NanoTime();
+  for (int i = 0; i < iterations; i++)
+    expected.Unwind(kStackTraceMax, pc, 0, 0, 0, 0, false);
+  u64 libgcc_time = NanoTime() - start;
+  SetEhFrameUnwind(true);
+  start = NanoTime();
+  for (int i = 0; i < iterations; i++)
+    trace.Unwind(kStackTraceMax, pc, 0, 0, 0, 0, false);
+  u64 eh_frame_time = NanoTime() - start;
+  SetEhFrameUnwind(false);
+  if (iterations > 2)
+    Printf("libgcc: %d ns, eh_frame_unwind: %d ns per stack of %d frames\n",
+           (int)(libgcc_time / iterations), (int)(eh_frame_time / iterations),
+           (int)trace.size);
+  ASSERT_EQ(expected.size, trace.size);
+  EXPECT_GT(trace.size, 12U);
+  for (uptr i = 0; i < trace.size; i++)
+    EXPECT_EQ(expected.trace[i], trace.trace[i]);
+}
+
+TEST(SlowUnwindTest, EhFrameUnwind) {
+  if (StackTrace::WillUseFastUnwind(false))
+    return;
+  EhFrameUnwindCompare(10, 1);
+  // The second unwind in the same thread hits the rule cache.
+  EhFrameUnwindCompare(10, 2);
+}
+
+TEST(DISABLED_BENCH, EhFrameUnwind) {
+  EhFrameUnwindCompare(30, 100000);
+}
+#endif
+
 TEST(SlowUnwindTest, ShortStackTrace) {
   if (StackTrace::WillUseFastUnwind(false))
     return;
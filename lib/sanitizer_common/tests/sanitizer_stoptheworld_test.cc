@@ -189,6 +189,94 @@ TEST(StopTheWorld, SuspendThreadsAdvanced) {
   pthread_mutex_destroy(&advanced_incrementer_thread_exit_mutex);
 }
 
+// Stops a world of many threads and measures how long it takes for all of
+// them to run again.
+static const uptr kManyThreadCount = 500;
+
+static pthread_mutex_t many_threads_exit_mutex;
+
+struct ManyThreadsArgument {
+  volatile int counters[kManyThreadCount];
+  volatile uptr threads_started;
+  uptr suspended_thread_count;
+  ManyThreadsArgument() : threads_started(0), suspended_thread_count(0) {
+    for (uptr i = 0; i < kManyThreadCount; i++) counters[i] = 0;
+  }
+};
+
+struct ManyThreadsThreadArgument {
+  ManyThreadsArgument *argument;
+  uptr index;
+};
+
+void *ManyThreadsIncrementerThread(void *arg) {
+  ManyThreadsThreadArgument *thread_argument = (ManyThreadsThreadArgument *)arg;
+  ManyThreadsArgument *argument = thread_argument->argument;
+  __sync_fetch_and_add(&argument->threads_started, 1);
+  while (true) {
+    __sync_fetch_and_add(&argument->counters[thread_argument->index], 1);
+    if (pthread_mutex_trylock(&many_threads_exit_mutex) == 0) {
+      pthread_mutex_unlock(&many_threads_exit_mutex);
+      return NULL;
+    }
+    sched_yield();
+  }
+}
+
+static void ManyThreadsCallback(
+    const SuspendedThreadsList &suspended_threads_list, void *argument) {
+  ManyThreadsArgument *many_threads_argument = (ManyThreadsArgument *)argument;
+  many_threads_argument->suspended_thread_count =
+      suspended_threads_list.thread_count();
+}
+
+TEST(StopTheWorld, SuspendManyThreads) {
+  pthread_mutex_init(&many_threads_exit_mutex, NULL);
+  ManyThreadsArgument argument;
+  ManyThreadsThreadArgument thread_arguments[kManyThreadCount];
+  pthread_t thread_ids[kManyThreadCount];
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64 * 1024);
+  pthread_mutex_lock(&many_threads_exit_mutex);
+  for (uptr i = 0; i < kManyThreadCount; i++) {
+    thread_arguments[i].argument = &argument;
+    thread_arguments[i].index = i;
+    ASSERT_EQ(0, pthread_create(&thread_ids[i], &attr,
+                                ManyThreadsIncrementerThread,
+                                &thread_arguments[i]));
+  }
+  pthread_attr_destroy(&attr);
+  while (__sync_fetch_and_add(&argument.threads_started, 0) < kManyThreadCount)
+    sched_yield();
+
+  u64 start_ns = NanoTime();
+  StopTheWorld(&ManyThreadsCallback, &argument);
+  u64 stopped_ns = NanoTime();
+  // The main thread is suspended too.
+  EXPECT_GT(argument.suspended_thread_count, kManyThreadCount);
+
+  // Wait for every thread to make progress after being resumed.
+  int counters_at_resume[kManyThreadCount];
+  for (uptr i = 0; i < kManyThreadCount; i++)
+    counters_at_resume[i] = __sync_fetch_and_add(&argument.counters[i], 0);
+  for (uptr i = 0; i < kManyThreadCount; i++) {
+    while (__sync_fetch_and_add(&argument.counters[i], 0) ==
+           counters_at_resume[i])
+      sched_yield();
+  }
+  u64 resumed_ns = NanoTime();
+  Printf("Stopped and resumed %zu threads in %zu us; all running after "
+         "%zu us.\n", argument.suspended_thread_count,
+         (uptr)(stopped_ns - start_ns) / 1000,
+         (uptr)(resumed_ns - start_ns) / 1000);
+
+  pthread_mutex_unlock(&many_threads_exit_mutex);
+  for (uptr i = 0; i < kManyThreadCount; i++)
+    ASSERT_EQ(0, pthread_join(thread_ids[i], NULL));
+  pthread_mutex_destroy(&many_threads_exit_mutex);
+}
+
 static void SegvCallback(const SuspendedThreadsList &suspended_threads_list,
                          void *argument) {
   *(volatile int*)0x1234 = 0;
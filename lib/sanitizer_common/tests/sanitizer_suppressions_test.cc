@@ -14,6 +14,7 @@
 #include "gtest/gtest.h"
 
 #include <string.h>
+#include <string>
 
 namespace __sanitizer {
 
@@ -132,4 +133,55 @@ TEST_F(SuppressionContextTest, HasSuppressionType) {
   EXPECT_FALSE(ctx_.HasSuppressionType("signal"));
 }
 
+TEST_F(SuppressionContextTest, MatchType) {
+  ctx_.Parse(
+    "race:foo*bar\n"
+    "thread:bar\n"
+    "race:^baz$\n"
+    "race:bar\n");
+  ctx_.Parse("mutex:foo\n"
+             "race:*\n");
+  Suppression *s;
+  EXPECT_TRUE(ctx_.Match("foo_bar", "race", &s));
+  EXPECT_STREQ("foo*bar", s->templ);
+  EXPECT_TRUE(ctx_.Match("prefix_bar", "race", &s));
+  EXPECT_STREQ("bar", s->templ);
+  EXPECT_TRUE(ctx_.Match("baz", "race", &s));
+  EXPECT_STREQ("^baz$", s->templ);
+  EXPECT_TRUE(ctx_.Match("bazz", "race", &s));
+  EXPECT_STREQ("*", s->templ);
+  EXPECT_TRUE(ctx_.Match("bar", "thread", &s));
+  EXPECT_STREQ("bar", s->templ);
+  EXPECT_FALSE(ctx_.Match("foo_baz", "thread", &s));
+  EXPECT_TRUE(ctx_.Match("foo", "mutex", &s));
+  EXPECT_STREQ("mutex", s->type);
+  EXPECT_FALSE(ctx_.Match("bar", "signal", &s));
+  EXPECT_FALSE(ctx_.Match("", "race", &s));
+}
+
+TEST_F(SuppressionContextTest, MatchMany) {
+  std::string supps;
+  for (int i = 0; i < 2000; i++)
+    supps += "race:function_" + std::to_string(i) + "$\n";
+  ctx_.Parse(supps.c_str());
+  Suppression *s;
+  for (int i = 0; i < 2000; i += 7) {
+    std::string name = "ns::function_" + std::to_string(i);
+    EXPECT_TRUE(ctx_.Match(name.c_str(), "race", &s));
+    EXPECT_EQ("function_" + std::to_string(i) + "$", std::string(s->templ));
+  }
+  EXPECT_FALSE(ctx_.Match("function_2000", "race", &s));
+  EXPECT_FALSE(ctx_.Match("function_1x", "race", &s));
+}
+
+TEST_F(SuppressionContextTest, UnmatchedPC) {
+  ctx_.Parse("race:foo\n");
+  EXPECT_FALSE(ctx_.IsUnmatchedPC(0x1234, "race"));
+  ctx_.AddUnmatchedPC(0x1234, "race");
+  EXPECT_TRUE(ctx_.IsUnmatchedPC(0x1234, "race"));
+  EXPECT_FALSE(ctx_.IsUnmatchedPC(0x1234, "thread"));
+  EXPECT_FALSE(ctx_.IsUnmatchedPC(0x1235, "race"));
+  EXPECT_FALSE(ctx_.IsUnmatchedPC(0x1234, "unknown"));
+}
+
 }  // namespace __sanitizer
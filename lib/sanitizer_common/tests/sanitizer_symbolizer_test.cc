@@ -12,6 +12,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "sanitizer_common/sanitizer_allocator_internal.h"
+#include "sanitizer_common/sanitizer_symbolizer_elf.h"
 #include "sanitizer_common/sanitizer_symbolizer_internal.h"
 #include "gtest/gtest.h"
 
@@ -55,6 +56,32 @@ TEST(Symbolizer, ExtractTokenUpToDelimiter) {
   InternalFree(token);
 }
 
+TEST(Symbolizer, SymbolizedStackCopyAll) {
+  SymbolizedStack *frames = SymbolizedStack::New(0x1000);
+  frames->info.FillModuleInfo("/lib/a.so", 0x100, kModuleArchUnknown);
+  frames->info.function = internal_strdup("inlined");
+  frames->info.file = internal_strdup("a.cc");
+  frames->info.line = 10;
+  frames->next = SymbolizedStack::New(0x1000);
+  frames->next->info.FillModuleInfo("/lib/a.so", 0x100, kModuleArchUnknown);
+  frames->next->info.function = internal_strdup("caller");
+
+  SymbolizedStack *copy = frames->CopyAll();
+  frames->ClearAll();
+  ASSERT_NE(nullptr, copy);
+  EXPECT_EQ(0x1000U, copy->info.address);
+  EXPECT_STREQ("/lib/a.so", copy->info.module);
+  EXPECT_EQ(0x100U, copy->info.module_offset);
+  EXPECT_STREQ("inlined", copy->info.function);
+  EXPECT_STREQ("a.cc", copy->info.file);
+  EXPECT_EQ(10, copy->info.line);
+  ASSERT_NE(nullptr, copy->next);
+  EXPECT_STREQ("caller", copy->next->info.function);
+  EXPECT_EQ(nullptr, copy->next->info.file);
+  EXPECT_EQ(nullptr, copy->next->next);
+  copy->ClearAll();
+}
+
 #if !SANITIZER_WINDOWS
 TEST(Symbolizer, DemangleSwiftAndCXX) {
   // Swift names are not demangled in default llvm build because Swift
@@ -69,4 +96,59 @@ TEST(Symbolizer, DemangleSwiftAndCXX) {
 }
 #endif
 
+#if SANITIZER_ELF_SYMBOLIZER
+static int elf_symbolizer_test_global = 42;
+
+static const uptr kElfSymbolizerTestFunctionLine = __LINE__ + 1;
+__attribute__((noinline)) static uptr ElfSymbolizerTestFunction() {
+  return reinterpret_cast<uptr>(__builtin_return_address(0));
+}
+
+TEST(Symbolizer, ElfSymbolizer) {
+  static LowLevelAllocator allocator;
+  ElfSymbolizer *tool = ElfSymbolizer::get(&allocator);
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+
+  uptr pc = reinterpret_cast<uptr>(&ElfSymbolizerTestFunction) + 1;
+  const char *module;
+  uptr offset;
+  ASSERT_TRUE(symbolizer->GetModuleNameAndOffsetForPC(pc, &module, &offset));
+  SymbolizedStack *stack = SymbolizedStack::New(pc);
+  stack->info.FillModuleInfo(module, offset, kModuleArchUnknown);
+  ASSERT_TRUE(tool->SymbolizePC(pc, stack));
+  ASSERT_NE(nullptr, stack->info.function);
+  EXPECT_NE(nullptr, internal_strstr(stack->info.function,
+                                     "ElfSymbolizerTestFunction"));
+  EXPECT_EQ(1U, stack->info.function_offset);
+  ASSERT_NE(nullptr, stack->info.file);
+  EXPECT_NE(nullptr,
+            internal_strstr(stack->info.file, "sanitizer_symbolizer_test.cc"));
+  EXPECT_GE(stack->info.line, kElfSymbolizerTestFunctionLine);
+  EXPECT_LE(stack->info.line, kElfSymbolizerTestFunctionLine + 2);
+  stack->ClearAll();
+
+  // A return address in this function is on a line of this test.
+  pc = ElfSymbolizerTestFunction() - 1;
+  uptr line = __LINE__ - 1;
+  ASSERT_TRUE(symbolizer->GetModuleNameAndOffsetForPC(pc, &module, &offset));
+  stack = SymbolizedStack::New(pc);
+  stack->info.FillModuleInfo(module, offset, kModuleArchUnknown);
+  ASSERT_TRUE(tool->SymbolizePC(pc, stack));
+  ASSERT_NE(nullptr, stack->info.file);
+  EXPECT_EQ(line, stack->info.line);
+  stack->ClearAll();
+
+  uptr addr = reinterpret_cast<uptr>(&elf_symbolizer_test_global) + 2;
+  ASSERT_TRUE(symbolizer->GetModuleNameAndOffsetForPC(addr, &module, &offset));
+  DataInfo info;
+  info.module = internal_strdup(module);
+  info.module_offset = offset;
+  ASSERT_TRUE(tool->SymbolizeData(addr, &info));
+  EXPECT_STREQ("_ZN11__sanitizerL26elf_symbolizer_test_globalE", info.name);
+  EXPECT_EQ(reinterpret_cast<uptr>(&elf_symbolizer_test_global), info.start);
+  EXPECT_EQ(sizeof(elf_symbolizer_test_global), info.size);
+  info.Clear();
+}
+#endif
+
 }  // namespace __sanitizer
@@ -30,6 +30,8 @@
 #endif
 
 #include <stdint.h>
+#include <stdio.h>
+#include <chrono>
 
 #if defined(_MSC_VER)
 # define NOINLINE __declspec(noinline)
@@ -93,6 +95,31 @@ static inline uint32_t my_rand() {
   return my_rand_r(&global_seed);
 }
 
+// Prints the result of a DISABLED_BENCH test as one line of JSON after a
+// "BENCH: " prefix, so that the runs of check-sanitizer-bench can be compared
+// across builds. ns is the wall time taken by ops operations.
+static inline void PrintBenchmarkResult(const char *name, int threads,
+                                        uint64_t ops, uint64_t ns) {
+  printf("BENCH: {\"name\": \"%s\", \"threads\": %d, \"ops\": %llu, "
+         "\"ns\": %llu, \"ns_per_op\": %.3f}\n", name, threads,
+         (unsigned long long)ops, (unsigned long long)ns,
+         ops ? (double)ns / ops : 0.0);
+  fflush(stdout);
+}
+
+// The wall time since construction, for PrintBenchmarkResult.
+class BenchmarkTimer {
+ public:
+  BenchmarkTimer() : start_(std::chrono::steady_clock::now()) {}
+  uint64_t ElapsedNs() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start_).count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
 // Set availability of platform-specific functions.
 
 #if !defined(__APPLE__) && !defined(__ANDROID__) && !defined(_WIN32)
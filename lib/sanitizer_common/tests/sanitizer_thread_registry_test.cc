@@ -149,6 +149,53 @@ TEST(SanitizerCommon, ThreadRegistryTest) {
   TestRegistry(&no_quarantine_registry, false);
 }
 
+TEST(SanitizerCommon, ThreadRegistryFindByOsId) {
+  ThreadRegistry registry(GetThreadContext<ThreadContextBase>,
+                          kMaxRegistryThreads, kRegistryQuarantine);
+  EXPECT_EQ(0U, registry.CreateThread(0, true, -1, 0));
+  registry.StartThread(0, 1000, false, 0);
+  const u32 kThreads = 300;
+  for (u32 i = 1; i <= kThreads; i++) {
+    EXPECT_EQ(i, registry.CreateThread(get_uid(i), false, 0, 0));
+    registry.StartThread(i, 1000 + i, false, 0);
+  }
+  {
+    ThreadRegistryLock l(&registry);
+    for (u32 i = 0; i <= kThreads; i++)
+      EXPECT_EQ(i, registry.FindThreadContextByOsIDLocked(1000 + i)->tid);
+    EXPECT_EQ(nullptr, registry.FindThreadContextByOsIDLocked(1));
+  }
+  // A finished joinable thread is still found; a joined one is not.
+  registry.FinishThread(5);
+  {
+    ThreadRegistryLock l(&registry);
+    EXPECT_EQ(5U, registry.FindThreadContextByOsIDLocked(1005)->tid);
+  }
+  registry.JoinThread(5, 0);
+  {
+    ThreadRegistryLock l(&registry);
+    EXPECT_EQ(nullptr, registry.FindThreadContextByOsIDLocked(1005));
+  }
+  // A new thread that gets the os_id of an exited, unjoined thread: the lower
+  // tid wins, as with a scan over all the threads.
+  registry.FinishThread(7);
+  u32 tid = registry.CreateThread(0, false, 0, 0);
+  registry.StartThread(tid, 1007, false, 0);
+  {
+    ThreadRegistryLock l(&registry);
+    EXPECT_EQ(7U, registry.FindThreadContextByOsIDLocked(1007)->tid);
+  }
+  registry.JoinThread(7, 0);
+  {
+    ThreadRegistryLock l(&registry);
+    EXPECT_EQ(tid, registry.FindThreadContextByOsIDLocked(1007)->tid);
+    // An os_id updated behind the registry's back is still found.
+    registry.GetThreadLocked(10)->os_id = 1;
+    EXPECT_EQ(10U, registry.FindThreadContextByOsIDLocked(1)->tid);
+    EXPECT_EQ(nullptr, registry.FindThreadContextByOsIDLocked(1010));
+  }
+}
+
 static const int kThreadsPerShard = 20;
 static const int kNumShards = 25;
 
@@ -15,6 +15,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "scudo_allocator.h"
+#include "scudo_interface_internal.h"
 #include "scudo_utils.h"
 
 #include "sanitizer_common/sanitizer_allocator_interface.h"
@@ -25,16 +26,43 @@
 
 #include <cstring>
 
+// With SCUDO_PER_CPU_CACHES, the threads share a pool of caches, one per CPU,
+// instead of each owning an allocator cache and a quarantine cache. This
+// bounds the memory used by the caches by the number of CPUs rather than by
+// the number of threads.
+#ifndef SCUDO_PER_CPU_CACHES
+# define SCUDO_PER_CPU_CACHES 0
+#endif
+
+// With SCUDO_OUT_OF_LINE_HEADERS, the headers of the chunks serviced by the
+// Primary are kept in the metadata region the Primary reserves for its blocks,
+// indexed by block position, rather than in front of the user data. Small
+// chunks don't pay for the header anymore, aligned chunks only need enough
+// room in the block to be aligned, and the user data of a chunk fills its
+// block, with no allocator data sharing its granules, as memory tagging would
+// require. Secondary backed chunks keep their header in front of them.
+#ifndef SCUDO_OUT_OF_LINE_HEADERS
+# define SCUDO_OUT_OF_LINE_HEADERS 0
+#endif
+
 namespace __scudo {
 
+// Size of the header stored in front of the user data of the Primary backed
+// chunks.
+const uptr PrimaryHeaderSize =
+    SCUDO_OUT_OF_LINE_HEADERS ? 0 : AlignedChunkHeaderSize;
+// Size of the per-block metadata of the Primary.
+const uptr PrimaryMetadataSize =
+    SCUDO_OUT_OF_LINE_HEADERS ? sizeof(PackedHeader) : 0;
+
 #if SANITIZER_CAN_USE_ALLOCATOR64
 const uptr AllocatorSpace = ~0ULL;
 const uptr AllocatorSize = 0x40000000000ULL;
-typedef DefaultSizeClassMap SizeClassMap;
+typedef ToolSizeClassMap SizeClassMap;
 struct AP {
   static const uptr kSpaceBeg = AllocatorSpace;
   static const uptr kSpaceSize = AllocatorSize;
-  static const uptr kMetadataSize = 0;
+  static const uptr kMetadataSize = PrimaryMetadataSize;
   typedef __scudo::SizeClassMap SizeClassMap;
   typedef NoOpMapUnmapCallback MapUnmapCallback;
   static const uptr kFlags =
@@ -52,9 +80,9 @@ typedef FlatByteMap<NumRegions> ByteMap;
 # elif SANITIZER_WORDSIZE == 64
 typedef TwoLevelByteMap<(NumRegions >> 12), 1 << 12> ByteMap;
 # endif  // SANITIZER_WORDSIZE
-typedef DefaultSizeClassMap SizeClassMap;
-typedef SizeClassAllocator32<0, SANITIZER_MMAP_RANGE_SIZE, 0, SizeClassMap,
-    RegionSizeLog, ByteMap> PrimaryAllocator;
+typedef ToolSizeClassMap SizeClassMap;
+typedef SizeClassAllocator32<0, SANITIZER_MMAP_RANGE_SIZE, PrimaryMetadataSize,
+    SizeClassMap, RegionSizeLog, ByteMap> PrimaryAllocator;
 #endif  // SANITIZER_CAN_USE_ALLOCATOR64
 
 typedef SizeClassAllocatorLocalCache<PrimaryAllocator> AllocatorCache;
@@ -68,11 +96,16 @@ static thread_local Xorshift128Plus Prng;
 // Global static cookie, initialized at start-up.
 static uptr Cookie;
 
+// Number of chunk headers which failed their checksum. Only ever more than 0
+// in the statistics printed at exit or from the background thread.
+static atomic_uint64_t InvalidHeaders;
+
 // We default to software CRC32 if the alternatives are not supported, either
 // at compilation or at runtime.
 static atomic_uint8_t HashAlgorithm = { CRC32Software };
 
 SANITIZER_WEAK_ATTRIBUTE u32 computeHardwareCRC32(u32 Crc, uptr Data);
+SANITIZER_WEAK_ATTRIBUTE u32 computeCarrylessCRC32(u32 Crc, uptr Data);
 
 INLINE u32 computeCRC32(u32 Crc, uptr Data, u8 HashType) {
   // If SSE4.2 is defined here, it was enabled everywhere, as opposed to only
@@ -84,11 +117,28 @@ INLINE u32 computeCRC32(u32 Crc, uptr Data, u8 HashType) {
 #else
   if (computeHardwareCRC32 && HashType == CRC32Hardware)
     return computeHardwareCRC32(Crc, Data);
+  // The carry-less multiplication version computes the same CRC32 as the
+  // software one, with a handful of multiplications instead of 8 dependent
+  // table lookups.
+  else if (computeCarrylessCRC32 && HashType == CRC32Carryless)
+    return computeCarrylessCRC32(Crc, Data);
   else
     return computeSoftwareCRC32(Crc, Data);
 #endif  // defined(__SSE4_2__)
 }
 
+// Returns the size of the header in front of the user data of the chunk Ptr
+// points into.
+INLINE uptr getInBandHeaderSize(const void *Ptr) {
+  if (PrimaryHeaderSize == AlignedChunkHeaderSize)
+    return AlignedChunkHeaderSize;
+  return getAllocator().FromPrimary(const_cast<void *>(Ptr)) ?
+      PrimaryHeaderSize : AlignedChunkHeaderSize;
+}
+
+// A chunk is designated by the beginning of its in-band header, which is also
+// the beginning of its user data if the header is out of line. Its offset is
+// relative to that address.
 struct ScudoChunk : UnpackedHeader {
   // We can't use the offset member of the chunk itself, as we would double
   // fetch it without any warranty that it wouldn't have been tampered. To
@@ -104,7 +154,20 @@ struct ScudoChunk : UnpackedHeader {
     uptr Size = getAllocator().GetActuallyAllocatedSize(getAllocBeg(Header));
     if (Size == 0)
       return Size;
-    return Size - AlignedChunkHeaderSize - (Header->Offset << MinAlignmentLog);
+    return Size - getInBandHeaderSize(this) -
+        (Header->Offset << MinAlignmentLog);
+  }
+
+  // Returns where the header is stored: right here, or in the metadata of the
+  // Primary block with SCUDO_OUT_OF_LINE_HEADERS.
+  AtomicPackedHeader *getAtomicHeader() {
+    if (SCUDO_OUT_OF_LINE_HEADERS && getAllocator().FromPrimary(this))
+      return reinterpret_cast<AtomicPackedHeader *>(
+          getAllocator().GetMetaData(this));
+    return reinterpret_cast<AtomicPackedHeader *>(this);
+  }
+  const AtomicPackedHeader *getAtomicHeader() const {
+    return const_cast<ScudoChunk *>(this)->getAtomicHeader();
   }
 
   // Compute the checksum of the Chunk pointer and its ChunkHeader.
@@ -123,8 +186,7 @@ struct ScudoChunk : UnpackedHeader {
   // Checks the validity of a chunk by verifying its checksum.
   bool isValid() {
     UnpackedHeader NewUnpackedHeader;
-    const AtomicPackedHeader *AtomicHeader =
-        reinterpret_cast<const AtomicPackedHeader *>(this);
+    const AtomicPackedHeader *AtomicHeader = getAtomicHeader();
     PackedHeader NewPackedHeader = atomic_load_relaxed(AtomicHeader);
     NewUnpackedHeader = bit_cast<UnpackedHeader>(NewPackedHeader);
     return (NewUnpackedHeader.Checksum == computeChecksum(&NewUnpackedHeader));
@@ -132,11 +194,11 @@ struct ScudoChunk : UnpackedHeader {
 
   // Loads and unpacks the header, verifying the checksum in the process.
   void loadHeader(UnpackedHeader *NewUnpackedHeader) const {
-    const AtomicPackedHeader *AtomicHeader =
-        reinterpret_cast<const AtomicPackedHeader *>(this);
+    const AtomicPackedHeader *AtomicHeader = getAtomicHeader();
     PackedHeader NewPackedHeader = atomic_load_relaxed(AtomicHeader);
     *NewUnpackedHeader = bit_cast<UnpackedHeader>(NewPackedHeader);
     if (NewUnpackedHeader->Checksum != computeChecksum(NewUnpackedHeader)) {
+      atomic_fetch_add(&InvalidHeaders, 1, memory_order_relaxed);
       dieWithMessage("ERROR: corrupted chunk header at address %p\n", this);
     }
   }
@@ -145,8 +207,7 @@ struct ScudoChunk : UnpackedHeader {
   void storeHeader(UnpackedHeader *NewUnpackedHeader) {
     NewUnpackedHeader->Checksum = computeChecksum(NewUnpackedHeader);
     PackedHeader NewPackedHeader = bit_cast<PackedHeader>(*NewUnpackedHeader);
-    AtomicPackedHeader *AtomicHeader =
-        reinterpret_cast<AtomicPackedHeader *>(this);
+    AtomicPackedHeader *AtomicHeader = getAtomicHeader();
     atomic_store_relaxed(AtomicHeader, NewPackedHeader);
   }
 
@@ -158,8 +219,7 @@ struct ScudoChunk : UnpackedHeader {
     NewUnpackedHeader->Checksum = computeChecksum(NewUnpackedHeader);
     PackedHeader NewPackedHeader = bit_cast<PackedHeader>(*NewUnpackedHeader);
     PackedHeader OldPackedHeader = bit_cast<PackedHeader>(*OldUnpackedHeader);
-    AtomicPackedHeader *AtomicHeader =
-        reinterpret_cast<AtomicPackedHeader *>(this);
+    AtomicPackedHeader *AtomicHeader = getAtomicHeader();
     if (!atomic_compare_exchange_strong(AtomicHeader,
                                         &OldPackedHeader,
                                         NewPackedHeader,
@@ -169,12 +229,23 @@ struct ScudoChunk : UnpackedHeader {
   }
 };
 
+// Returns the chunk of which the user data begins at UserBeg.
+INLINE ScudoChunk *getScudoChunk(uptr UserBeg) {
+  return reinterpret_cast<ScudoChunk *>(UserBeg -
+                                        getInBandHeaderSize(
+                                            reinterpret_cast<void *>(UserBeg)));
+}
+
 static bool ScudoInitIsRunning = false;
 
 static pthread_once_t GlobalInited = PTHREAD_ONCE_INIT;
-static pthread_key_t PThreadKey;
 
 static thread_local bool ThreadInited = false;
+#if SCUDO_PER_CPU_CACHES
+// Spreads the threads over the shared caches when their CPU is unknown.
+static thread_local uptr ThreadCachesHint;
+#else
+static pthread_key_t PThreadKey;
 static thread_local bool ThreadTornDown = false;
 static thread_local AllocatorCache Cache;
 
@@ -193,6 +264,7 @@ static void teardownThread(void *p) {
   getAllocator().DestroyCache(&Cache);
   ThreadTornDown = true;
 }
+#endif  // SCUDO_PER_CPU_CACHES
 
 static void initInternal() {
   SanitizerToolName = "Scudo";
@@ -200,8 +272,11 @@ static void initInternal() {
   ScudoInitIsRunning = true;
 
   // Check is SSE4.2 is supported, if so, opt for the CRC32 hardware version.
+  // Otherwise, fall back to carry-less multiplications if those are there.
   if (testCPUFeature(CRC32CPUFeature)) {
     atomic_store_relaxed(&HashAlgorithm, CRC32Hardware);
+  } else if (testCPUFeature(CLMULCPUFeature)) {
+    atomic_store_relaxed(&HashAlgorithm, CRC32Carryless);
   }
 
   initFlags();
@@ -210,23 +285,53 @@ static void initInternal() {
   Options.setFrom(getFlags(), common_flags());
   initAllocator(Options);
 
-  MaybeStartBackgroudThread();
+  if (getFlags()->PrintHistogramAtExit)
+    Atexit(__sanitizer_print_allocator_histogram);
+  if (getFlags()->StatsDumpIntervalMs > 0)
+    Atexit(printScudoStats);
 
   ScudoInitIsRunning = false;
 }
 
+static void startQuarantineRecycler();
+static void startStatsDumper();
+
+// pthread_create allocates memory, so the background threads can't be spawned
+// during the global initialization. They are started by the first thread to
+// be done with its own initialization instead.
+static pthread_once_t BackgroundThreadsStarted = PTHREAD_ONCE_INIT;
+
+static void startBackgroundThreads() {
+  MaybeStartBackgroudThread();
+  if (getFlags()->QuarantineRecycleInBackground)
+    startQuarantineRecycler();
+  if (getFlags()->StatsDumpIntervalMs > 0)
+    startStatsDumper();
+}
+
 static void initGlobal() {
+#if !SCUDO_PER_CPU_CACHES
   pthread_key_create(&PThreadKey, teardownThread);
+#endif
   initInternal();
 }
 
 static void NOINLINE initThread() {
   pthread_once(&GlobalInited, initGlobal);
+#if SCUDO_PER_CPU_CACHES
+  registerThreadRseq();
+  ThreadCachesHint = static_cast<uptr>(Prng.Next());
+#else
   pthread_setspecific(PThreadKey, reinterpret_cast<void *>(1));
   getAllocator().InitCache(&Cache);
+#endif
   ThreadInited = true;
+  pthread_once(&BackgroundThreadsStarted, startBackgroundThreads);
 }
 
+// Maximum number of chunks which headers are verified together when recycling.
+static const uptr RecycleBatchSize = 8;
+
 struct QuarantineCallback {
   explicit QuarantineCallback(AllocatorCache *Cache)
     : Cache_(Cache) {}
@@ -243,6 +348,27 @@ struct QuarantineCallback {
     getAllocator().Deallocate(Cache_, Ptr);
   }
 
+  // Verifies all the headers before returning any chunk to the backend, so
+  // that the checksum computations of the batch can overlap instead of being
+  // interleaved with the deallocations.
+  void RecycleBatch(ScudoChunk **Chunks, uptr Count) {
+    void *Ptrs[RecycleBatchSize];
+    for (uptr I = 0; I < Count; I += RecycleBatchSize) {
+      uptr N = Min(RecycleBatchSize, Count - I);
+      for (uptr J = 0; J < N; J++) {
+        UnpackedHeader Header;
+        Chunks[I + J]->loadHeader(&Header);
+        if (Header.State != ChunkQuarantine) {
+          dieWithMessage("ERROR: invalid chunk state when recycling address "
+                         "%p\n", Chunks[I + J]);
+        }
+        Ptrs[J] = Chunks[I + J]->getAllocBeg(&Header);
+      }
+      for (uptr J = 0; J < N; J++)
+        getAllocator().Deallocate(Cache_, Ptrs[J]);
+    }
+  }
+
   /// Internal quarantine allocation and deallocation functions.
   void *Allocate(uptr Size) {
     // The internal quarantine memory cannot be protected by us. But the only
@@ -266,7 +392,35 @@ struct QuarantineCallback {
 
 typedef Quarantine<QuarantineCallback, ScudoChunk> ScudoQuarantine;
 typedef ScudoQuarantine::Cache QuarantineCache;
+#if SCUDO_PER_CPU_CACHES
+// The caches shared by the threads running on a given CPU. The zero state
+// (once the allocator cache is initialized) is a valid one.
+struct ScudoSharedCaches {
+  StaticSpinMutex Mutex;
+  AllocatorCache Cache;
+  QuarantineCache Quarantine;
+};
+
+// Bounds the memory reserved for the shared caches on very large machines.
+static const uptr MaxSharedCaches = 256;
+// Number of other shared caches tried before blocking on a contended one.
+static const uptr SharedCachesProbes = 4;
+#else
 static thread_local QuarantineCache ThreadQuarantineCache;
+#endif
+
+// Allocations and deallocations left before the next timed one.
+static thread_local u32 LatencySampleCountdown;
+
+// Latency histograms, see struct __scudo_stats for the buckets.
+static atomic_uint64_t MallocLatency[NumLatencyBuckets];
+static atomic_uint64_t FreeLatency[NumLatencyBuckets];
+
+static void recordLatency(atomic_uint64_t *Histogram, u64 Ticks) {
+  uptr Bucket = Ticks ? 63 - __builtin_clzll(Ticks) : 0;
+  Bucket = Min(Bucket, NumLatencyBuckets - 1);
+  atomic_fetch_add(&Histogram[Bucket], 1, memory_order_relaxed);
+}
 
 void AllocatorOptions::setFrom(const Flags *f, const CommonFlags *cf) {
   MayReturnNull = cf->allocator_may_return_null;
@@ -276,6 +430,7 @@ void AllocatorOptions::setFrom(const Flags *f, const CommonFlags *cf) {
   DeallocationTypeMismatch = f->DeallocationTypeMismatch;
   DeleteSizeMismatch = f->DeleteSizeMismatch;
   ZeroContents = f->ZeroContents;
+  LatencySamplePeriod = Max(f->LatencySamplePeriod, 0);
 }
 
 void AllocatorOptions::copyTo(Flags *f, CommonFlags *cf) const {
@@ -286,6 +441,7 @@ void AllocatorOptions::copyTo(Flags *f, CommonFlags *cf) const {
   f->DeallocationTypeMismatch = DeallocationTypeMismatch;
   f->DeleteSizeMismatch = DeleteSizeMismatch;
   f->ZeroContents = ZeroContents;
+  f->LatencySamplePeriod = LatencySamplePeriod;
 }
 
 struct Allocator {
@@ -302,9 +458,17 @@ struct Allocator {
   AllocatorCache FallbackAllocatorCache;
   QuarantineCache FallbackQuarantineCache;
 
+#if SCUDO_PER_CPU_CACHES
+  ScudoSharedCaches *SharedCaches;
+  uptr NumSharedCaches;
+#endif
+  // Owned by the background quarantine recycler thread, if any.
+  AllocatorCache RecyclerAllocatorCache;
+
   bool DeallocationTypeMismatch;
   bool ZeroContents;
   bool DeleteSizeMismatch;
+  u32 LatencySamplePeriod;
 
   explicit Allocator(LinkerInitialized)
     : AllocatorQuarantine(LINKER_INITIALIZED),
@@ -319,11 +483,15 @@ struct Allocator {
     // to be the maximum alignment that would fit in that size class. As a
     // result, the maximum offset will be at most the maximum alignment for the
     // last size class minus the header size, in multiples of MinAlignment.
+    // Without an in-band header, the alignment can be up to the size of the
+    // last size class, and the offset up to that alignment minus MinAlignment.
     UnpackedHeader Header = {};
     uptr MaxPrimaryAlignment = 1 << MostSignificantSetBitIndex(
         SizeClassMap::kMaxSize - MinAlignment);
     uptr MaxOffset = (MaxPrimaryAlignment - AlignedChunkHeaderSize) >>
         MinAlignmentLog;
+    if (SCUDO_OUT_OF_LINE_HEADERS)
+      MaxOffset = (SizeClassMap::kMaxSize - MinAlignment) >> MinAlignmentLog;
     Header.Offset = MaxOffset;
     if (Header.Offset != MaxOffset) {
       dieWithMessage("ERROR: the maximum possible offset doesn't fit in the "
@@ -344,14 +512,90 @@ struct Allocator {
     DeallocationTypeMismatch = Options.DeallocationTypeMismatch;
     DeleteSizeMismatch = Options.DeleteSizeMismatch;
     ZeroContents = Options.ZeroContents;
+    LatencySamplePeriod = Options.LatencySamplePeriod;
     BackendAllocator.Init(Options.MayReturnNull, Options.ReleaseToOSIntervalMs);
+    BackendAllocator.SetSizeProfile(GetAllocatorSizeProfile());
+    BackendAllocator.SetSecondaryCacheParams(
+        static_cast<uptr>(common_flags()->allocator_secondary_cache_size_mb)
+            << 20,
+        common_flags()->allocator_secondary_cache_decay_ms);
+    MaybeWriteAllocatorSizeProfileAtExit();
     AllocatorQuarantine.Init(
         static_cast<uptr>(Options.QuarantineSizeMb) << 20,
         static_cast<uptr>(Options.ThreadLocalQuarantineSizeKb) << 10);
     BackendAllocator.InitCache(&FallbackAllocatorCache);
+#if SCUDO_PER_CPU_CACHES
+    initSharedCaches();
+#endif
     Cookie = Prng.Next();
   }
 
+#if SCUDO_PER_CPU_CACHES
+  void initSharedCaches() {
+    NumSharedCaches = Min(Max(getNumberOfCPUs(), static_cast<uptr>(1)),
+                          MaxSharedCaches);
+    SharedCaches = reinterpret_cast<ScudoSharedCaches *>(MmapOrDie(
+        sizeof(ScudoSharedCaches) * NumSharedCaches, "ScudoSharedCaches"));
+    for (uptr I = 0; I < NumSharedCaches; I++)
+      BackendAllocator.InitCache(&SharedCaches[I].Cache);
+  }
+
+  // Returns the locked caches of the CPU the calling thread runs on. As the
+  // thread can be preempted or migrated at any time, the caches still need a
+  // lock. If it is contended, the caches of a few other CPUs are tried before
+  // blocking.
+  ScudoSharedCaches *lockSharedCaches() {
+    s32 CPU = getCurrentCPU();
+    uptr Index = CPU >= 0 ? static_cast<uptr>(CPU) : ThreadCachesHint;
+    Index %= NumSharedCaches;
+    uptr Probes = Min(NumSharedCaches, SharedCachesProbes);
+    for (uptr I = 0; I < Probes; I++) {
+      ScudoSharedCaches *Caches = &SharedCaches[(Index + I) % NumSharedCaches];
+      if (Caches->Mutex.TryLock())
+        return Caches;
+    }
+    SharedCaches[Index].Mutex.Lock();
+    return &SharedCaches[Index];
+  }
+#endif  // SCUDO_PER_CPU_CACHES
+
+  // Puts a chunk in the quarantine, which will return the oldest chunks to the
+  // backend if needed.
+  void quarantineChunk(ScudoChunk *Chunk, uptr Size) {
+#if SCUDO_PER_CPU_CACHES
+    ScudoSharedCaches *Caches = lockSharedCaches();
+    AllocatorQuarantine.Put(&Caches->Quarantine,
+                            QuarantineCallback(&Caches->Cache), Chunk, Size);
+    Caches->Mutex.Unlock();
+#else
+    if (LIKELY(!ThreadTornDown)) {
+      AllocatorQuarantine.Put(&ThreadQuarantineCache,
+                              QuarantineCallback(&Cache), Chunk, Size);
+    } else {
+      SpinMutexLock l(&FallbackMutex);
+      AllocatorQuarantine.Put(&FallbackQuarantineCache,
+                              QuarantineCallback(&FallbackAllocatorCache),
+                              Chunk, Size);
+    }
+#endif
+  }
+
+  // Returns a chunk straight to the backend, bypassing the quarantine.
+  void recycleChunk(void *AllocBeg) {
+#if SCUDO_PER_CPU_CACHES
+    ScudoSharedCaches *Caches = lockSharedCaches();
+    BackendAllocator.Deallocate(&Caches->Cache, AllocBeg);
+    Caches->Mutex.Unlock();
+#else
+    if (LIKELY(!ThreadTornDown)) {
+      BackendAllocator.Deallocate(&Cache, AllocBeg);
+    } else {
+      SpinMutexLock l(&FallbackMutex);
+      BackendAllocator.Deallocate(&FallbackAllocatorCache, AllocBeg);
+    }
+#endif
+  }
+
   // Helper function that checks for a valid Scudo chunk.
   bool isValidPointer(const void *UserPtr) {
     if (UNLIKELY(!ThreadInited))
@@ -360,15 +604,43 @@ struct Allocator {
     if (!IsAligned(ChunkBeg, MinAlignment)) {
       return false;
     }
-    ScudoChunk *Chunk =
-        reinterpret_cast<ScudoChunk *>(ChunkBeg - AlignedChunkHeaderSize);
+    // The metadata of the blocks the Primary has never handed out might not
+    // be mapped.
+    if (SCUDO_OUT_OF_LINE_HEADERS && BackendAllocator.FromPrimary(
+            const_cast<void *>(UserPtr)) &&
+        !BackendAllocator.GetBlockBegin(UserPtr)) {
+      return false;
+    }
+    ScudoChunk *Chunk = getScudoChunk(ChunkBeg);
     return Chunk->isValid();
   }
 
-  // Allocates a chunk.
+  // Whether the calling allocation or deallocation is to be timed, which is
+  // the case of one in LatencySamplePeriod of them for each thread.
+  bool shouldSampleLatency() {
+    if (LIKELY(!LatencySamplePeriod))
+      return false;
+    if (LatencySampleCountdown > 1) {
+      LatencySampleCountdown--;
+      return false;
+    }
+    LatencySampleCountdown = LatencySamplePeriod;
+    return true;
+  }
+
   void *allocate(uptr Size, uptr Alignment, AllocType Type) {
     if (UNLIKELY(!ThreadInited))
       initThread();
+    if (LIKELY(!shouldSampleLatency()))
+      return allocateChunk(Size, Alignment, Type);
+    u64 Start = readCycleCounter();
+    void *Ptr = allocateChunk(Size, Alignment, Type);
+    recordLatency(MallocLatency, readCycleCounter() - Start);
+    return Ptr;
+  }
+
+  // Allocates a chunk.
+  void *allocateChunk(uptr Size, uptr Alignment, AllocType Type) {
     if (!IsPowerOfTwo(Alignment)) {
       dieWithMessage("ERROR: alignment is not a power of 2\n");
     }
@@ -381,7 +653,8 @@ struct Allocator {
     if (Size >= MaxAllowedMallocSize)
       return BackendAllocator.ReturnNullOrDieOnBadRequest();
 
-    uptr NeededSize = RoundUpTo(Size, MinAlignment) + AlignedChunkHeaderSize;
+    uptr RoundedSize = RoundUpTo(Size, MinAlignment);
+    uptr NeededSize = RoundedSize + AlignedChunkHeaderSize;
     if (Alignment > MinAlignment)
       NeededSize += Alignment;
     if (NeededSize >= MaxAllowedMallocSize)
@@ -392,9 +665,28 @@ struct Allocator {
     // allocations here, but the Secondary will take care of its own alignment
     // needs, which means we also have to work around some limitations of the
     // combined allocator to accommodate the situation.
-    bool FromPrimary = PrimaryAllocator::CanAllocate(NeededSize, MinAlignment);
+    bool FromPrimary;
+    if (SCUDO_OUT_OF_LINE_HEADERS) {
+      // Without a header in the block, which is already aligned on
+      // MinAlignment, only the room needed for a larger alignment is added.
+      uptr PrimaryNeededSize = RoundedSize;
+      if (Alignment > MinAlignment)
+        PrimaryNeededSize += Alignment - MinAlignment;
+      FromPrimary = PrimaryAllocator::CanAllocate(PrimaryNeededSize,
+                                                  MinAlignment);
+      if (FromPrimary)
+        NeededSize = PrimaryNeededSize;
+    } else {
+      FromPrimary = PrimaryAllocator::CanAllocate(NeededSize, MinAlignment);
+    }
 
     void *Ptr;
+#if SCUDO_PER_CPU_CACHES
+    ScudoSharedCaches *Caches = lockSharedCaches();
+    Ptr = BackendAllocator.Allocate(&Caches->Cache, NeededSize,
+                                    FromPrimary ? MinAlignment : Alignment);
+    Caches->Mutex.Unlock();
+#else
     if (LIKELY(!ThreadTornDown)) {
       Ptr = BackendAllocator.Allocate(&Cache, NeededSize,
                                       FromPrimary ? MinAlignment : Alignment);
@@ -403,6 +695,7 @@ struct Allocator {
       Ptr = BackendAllocator.Allocate(&FallbackAllocatorCache, NeededSize,
                                       FromPrimary ? MinAlignment : Alignment);
     }
+#endif
     if (!Ptr)
       return BackendAllocator.ReturnNullOrDieOnOOM();
 
@@ -419,22 +712,21 @@ struct Allocator {
     uptr ActuallyAllocatedSize = BackendAllocator.GetActuallyAllocatedSize(
         reinterpret_cast<void *>(AllocBeg));
     // If requested, we will zero out the entire contents of the returned chunk.
-    if (ZeroContents && FromPrimary)
+    if (ZeroContents && FromPrimary && !BackendAllocator.ChunkIsZero(Ptr))
        memset(Ptr, 0, ActuallyAllocatedSize);
 
-    uptr ChunkBeg = AllocBeg + AlignedChunkHeaderSize;
+    uptr HeaderSize = FromPrimary ? PrimaryHeaderSize : AlignedChunkHeaderSize;
+    uptr ChunkBeg = AllocBeg + HeaderSize;
     if (!IsAligned(ChunkBeg, Alignment))
       ChunkBeg = RoundUpTo(ChunkBeg, Alignment);
     CHECK_LE(ChunkBeg + Size, AllocBeg + NeededSize);
-    ScudoChunk *Chunk =
-        reinterpret_cast<ScudoChunk *>(ChunkBeg - AlignedChunkHeaderSize);
+    ScudoChunk *Chunk = reinterpret_cast<ScudoChunk *>(ChunkBeg - HeaderSize);
     UnpackedHeader Header = {};
     Header.State = ChunkAllocated;
-    uptr Offset = ChunkBeg - AlignedChunkHeaderSize - AllocBeg;
+    uptr Offset = ChunkBeg - HeaderSize - AllocBeg;
     Header.Offset = Offset >> MinAlignmentLog;
     Header.AllocType = Type;
-    Header.UnusedBytes = ActuallyAllocatedSize - Offset -
-        AlignedChunkHeaderSize - Size;
+    Header.UnusedBytes = ActuallyAllocatedSize - Offset - HeaderSize - Size;
     Header.Salt = static_cast<u8>(Prng.Next());
     Chunk->storeHeader(&Header);
     void *UserPtr = reinterpret_cast<void *>(ChunkBeg);
@@ -444,11 +736,21 @@ struct Allocator {
     return UserPtr;
   }
 
-  // Deallocates a Chunk, which means adding it to the delayed free list (or
-  // Quarantine).
   void deallocate(void *UserPtr, uptr DeleteSize, AllocType Type) {
     if (UNLIKELY(!ThreadInited))
       initThread();
+    if (LIKELY(!shouldSampleLatency())) {
+      deallocateChunk(UserPtr, DeleteSize, Type);
+      return;
+    }
+    u64 Start = readCycleCounter();
+    deallocateChunk(UserPtr, DeleteSize, Type);
+    recordLatency(FreeLatency, readCycleCounter() - Start);
+  }
+
+  // Deallocates a Chunk, which means adding it to the delayed free list (or
+  // Quarantine).
+  void deallocateChunk(void *UserPtr, uptr DeleteSize, AllocType Type) {
     // TODO(kostyak): see hook comment above
     // if (&__sanitizer_free_hook) __sanitizer_free_hook(UserPtr);
     if (!UserPtr)
@@ -458,45 +760,46 @@ struct Allocator {
       dieWithMessage("ERROR: attempted to deallocate a chunk not properly "
                      "aligned at address %p\n", UserPtr);
     }
-    ScudoChunk *Chunk =
-        reinterpret_cast<ScudoChunk *>(ChunkBeg - AlignedChunkHeaderSize);
+    ScudoChunk *Chunk = getScudoChunk(ChunkBeg);
     UnpackedHeader OldHeader;
     Chunk->loadHeader(&OldHeader);
     if (OldHeader.State != ChunkAllocated) {
       dieWithMessage("ERROR: invalid chunk state when deallocating address "
                      "%p\n", UserPtr);
     }
-    uptr UsableSize = Chunk->getUsableSize(&OldHeader);
-    UnpackedHeader NewHeader = OldHeader;
-    NewHeader.State = ChunkQuarantine;
-    Chunk->compareExchangeHeader(&NewHeader, &OldHeader);
     if (DeallocationTypeMismatch) {
       // The deallocation type has to match the allocation one.
-      if (NewHeader.AllocType != Type) {
+      if (OldHeader.AllocType != Type) {
         // With the exception of memalign'd Chunks, that can be still be free'd.
-        if (NewHeader.AllocType != FromMemalign || Type != FromMalloc) {
+        if (OldHeader.AllocType != FromMemalign || Type != FromMalloc) {
           dieWithMessage("ERROR: allocation type mismatch on address %p\n",
                          Chunk);
         }
       }
     }
-    uptr Size = UsableSize - OldHeader.UnusedBytes;
+    // The usable size, which takes a size class lookup, is only needed to
+    // check the size of a sized delete, and to account for the chunk in the
+    // quarantine. Without a quarantine, the chunk goes straight back to the
+    // backend, rather than through the quarantine callback which would verify
+    // its header a second time.
+    bool Quarantined = AllocatorQuarantine.GetCacheSize() != 0;
+    uptr UsableSize = 0;
+    if (Quarantined || (DeleteSizeMismatch && DeleteSize))
+      UsableSize = Chunk->getUsableSize(&OldHeader);
     if (DeleteSizeMismatch) {
-      if (DeleteSize && DeleteSize != Size) {
+      if (DeleteSize && DeleteSize != UsableSize - OldHeader.UnusedBytes) {
         dieWithMessage("ERROR: invalid sized delete on chunk at address %p\n",
                        Chunk);
       }
     }
+    UnpackedHeader NewHeader = OldHeader;
+    NewHeader.State = ChunkQuarantine;
+    Chunk->compareExchangeHeader(&NewHeader, &OldHeader);
 
-    if (LIKELY(!ThreadTornDown)) {
-      AllocatorQuarantine.Put(&ThreadQuarantineCache,
-                              QuarantineCallback(&Cache), Chunk, UsableSize);
-    } else {
-      SpinMutexLock l(&FallbackMutex);
-      AllocatorQuarantine.Put(&FallbackQuarantineCache,
-                              QuarantineCallback(&FallbackAllocatorCache),
-                              Chunk, UsableSize);
-    }
+    if (LIKELY(Quarantined))
+      quarantineChunk(Chunk, UsableSize);
+    else
+      recycleChunk(Chunk->getAllocBeg(&OldHeader));
   }
 
   // Reallocates a chunk. We can save on a new allocation if the new requested
@@ -505,8 +808,7 @@ struct Allocator {
     if (UNLIKELY(!ThreadInited))
       initThread();
     uptr ChunkBeg = reinterpret_cast<uptr>(OldPtr);
-    ScudoChunk *Chunk =
-        reinterpret_cast<ScudoChunk *>(ChunkBeg - AlignedChunkHeaderSize);
+    ScudoChunk *Chunk = getScudoChunk(ChunkBeg);
     UnpackedHeader OldHeader;
     Chunk->loadHeader(&OldHeader);
     if (OldHeader.State != ChunkAllocated) {
@@ -525,6 +827,16 @@ struct Allocator {
       Chunk->compareExchangeHeader(&NewHeader, &OldHeader);
       return OldPtr;
     }
+    // A Secondary backed chunk may have its mapping grown in place.
+    void *AllocBeg = Chunk->getAllocBeg(&OldHeader);
+    if (!BackendAllocator.FromPrimary(AllocBeg) &&
+        NewSize < MaxAllowedMallocSize &&
+        BackendAllocator.ResizeInPlace(
+            AllocBeg, ChunkBeg + NewSize - reinterpret_cast<uptr>(AllocBeg))) {
+      NewHeader.UnusedBytes = Chunk->getUsableSize(&OldHeader) - NewSize;
+      Chunk->compareExchangeHeader(&NewHeader, &OldHeader);
+      return OldPtr;
+    }
     // Otherwise, we have to allocate a new chunk and copy the contents of the
     // old one.
     void *NewPtr = allocate(NewSize, MinAlignment, FromMalloc);
@@ -533,15 +845,7 @@ struct Allocator {
       memcpy(NewPtr, OldPtr, Min(NewSize, OldSize));
       NewHeader.State = ChunkQuarantine;
       Chunk->compareExchangeHeader(&NewHeader, &OldHeader);
-      if (LIKELY(!ThreadTornDown)) {
-        AllocatorQuarantine.Put(&ThreadQuarantineCache,
-                                QuarantineCallback(&Cache), Chunk, Size);
-      } else {
-        SpinMutexLock l(&FallbackMutex);
-        AllocatorQuarantine.Put(&FallbackQuarantineCache,
-                                QuarantineCallback(&FallbackAllocatorCache),
-                                Chunk, Size);
-      }
+      quarantineChunk(Chunk, Size);
     }
     return NewPtr;
   }
@@ -553,8 +857,7 @@ struct Allocator {
     if (!Ptr)
       return 0;
     uptr ChunkBeg = reinterpret_cast<uptr>(Ptr);
-    ScudoChunk *Chunk =
-        reinterpret_cast<ScudoChunk *>(ChunkBeg - AlignedChunkHeaderSize);
+    ScudoChunk *Chunk = getScudoChunk(ChunkBeg);
     UnpackedHeader Header;
     Chunk->loadHeader(&Header);
     // Getting the usable size of a chunk only makes sense if it's allocated.
@@ -573,14 +876,28 @@ struct Allocator {
       return BackendAllocator.ReturnNullOrDieOnBadRequest();
     void *Ptr = allocate(Total, MinAlignment, FromMalloc);
     // If ZeroContents, the content of the chunk has already been zero'd out.
-    if (!ZeroContents && Ptr && BackendAllocator.FromPrimary(Ptr))
+    if (!ZeroContents && Ptr && BackendAllocator.FromPrimary(Ptr) &&
+        !BackendAllocator.ChunkIsZero(BackendAllocator.GetBlockBegin(Ptr)))
       memset(Ptr, 0, getUsableSize(Ptr));
     return Ptr;
   }
 
   void drainQuarantine() {
+#if SCUDO_PER_CPU_CACHES
+    ScudoSharedCaches *Caches = lockSharedCaches();
+    AllocatorQuarantine.Drain(&Caches->Quarantine,
+                              QuarantineCallback(&Caches->Cache));
+    Caches->Mutex.Unlock();
+#else
     AllocatorQuarantine.Drain(&ThreadQuarantineCache,
                               QuarantineCallback(&Cache));
+#endif
+  }
+
+  void NORETURN recycleQuarantineInBackground() {
+    BackendAllocator.InitCache(&RecyclerAllocatorCache);
+    AllocatorQuarantine.RecycleInBackground(
+        QuarantineCallback(&RecyclerAllocatorCache));
   }
 
   uptr getStats(AllocatorStat StatType) {
@@ -590,6 +907,38 @@ struct Allocator {
     BackendAllocator.GetStats(stats);
     return stats[StatType];
   }
+
+  uptr getHistogram(AllocatorClassStats *Stats, uptr MaxClasses) {
+    if (UNLIKELY(!ThreadInited))
+      initThread();
+    return BackendAllocator.GetHistogram(Stats, MaxClasses);
+  }
+
+  void printHistogram() {
+    if (UNLIKELY(!ThreadInited))
+      initThread();
+    BackendAllocator.PrintHistogram();
+  }
+
+  void getScudoStats(ScudoStats *Stats) {
+    if (UNLIKELY(!ThreadInited))
+      initThread();
+    internal_memset(Stats, 0, sizeof(*Stats));
+    uptr BackendStats[AllocatorStatCount];
+    BackendAllocator.GetStats(BackendStats);
+    Stats->AllocatedBytes = BackendStats[AllocatorStatAllocated];
+    Stats->MappedBytes = BackendStats[AllocatorStatMapped];
+    Stats->QuarantineBytes = AllocatorQuarantine.GetQuarantinedSize();
+    Stats->QuarantineMaxBytes = AllocatorQuarantine.GetSize();
+    BackendAllocator.GetSecondary()->getStats(&Stats->SecondaryChunks,
+                                              &Stats->SecondaryCachedMappings,
+                                              &Stats->SecondaryCachedBytes);
+    Stats->InvalidHeaders = atomic_load_relaxed(&InvalidHeaders);
+    for (uptr I = 0; I < NumLatencyBuckets; I++) {
+      Stats->MallocLatency[I] = atomic_load_relaxed(&MallocLatency[I]);
+      Stats->FreeLatency[I] = atomic_load_relaxed(&FreeLatency[I]);
+    }
+  }
 };
 
 static Allocator Instance(LINKER_INITIALIZED);
@@ -606,6 +955,58 @@ void drainQuarantine() {
   Instance.drainQuarantine();
 }
 
+static void quarantineRecyclerThread(void *Arg) {
+  Instance.recycleQuarantineInBackground();
+}
+
+static void startQuarantineRecycler() {
+  if (!Instance.AllocatorQuarantine.GetSize())
+    return;
+  internal_start_thread(quarantineRecyclerThread, nullptr);
+}
+
+void getScudoStats(ScudoStats *Stats) {
+  Instance.getScudoStats(Stats);
+}
+
+static void printLatencyHistogram(const char *Name, const u64 *Histogram) {
+  for (uptr I = 0; I < NumLatencyBuckets; I++) {
+    if (!Histogram[I])
+      continue;
+    const bool Last = I == NumLatencyBuckets - 1;
+    Printf("Scudo: %s latency %s%llu ticks: %llu\n", Name, Last ? ">= " : "< ",
+           1ULL << (Last ? I : I + 1), Histogram[I]);
+  }
+}
+
+void printScudoStats() {
+  ScudoStats Stats;
+  getScudoStats(&Stats);
+  Printf("Scudo: %zu bytes allocated, %zu bytes mapped\n",
+         Stats.AllocatedBytes, Stats.MappedBytes);
+  Printf("Scudo: quarantine holds %zu bytes out of %zu\n",
+         Stats.QuarantineBytes, Stats.QuarantineMaxBytes);
+  Printf("Scudo: %zu secondary chunks, %zu cached mappings of %zu bytes\n",
+         Stats.SecondaryChunks, Stats.SecondaryCachedMappings,
+         Stats.SecondaryCachedBytes);
+  Printf("Scudo: %llu invalid chunk headers\n", Stats.InvalidHeaders);
+  printLatencyHistogram("malloc", Stats.MallocLatency);
+  printLatencyHistogram("free", Stats.FreeLatency);
+  Instance.printHistogram();
+}
+
+static void statsDumperThread(void *Arg) {
+  const int IntervalMs = getFlags()->StatsDumpIntervalMs;
+  while (true) {
+    SleepForMillis(IntervalMs);
+    printScudoStats();
+  }
+}
+
+static void startStatsDumper() {
+  internal_start_thread(statsDumperThread, nullptr);
+}
+
 void *scudoMalloc(uptr Size, AllocType Type) {
   return Instance.allocate(Size, MinAlignment, Type);
 }
@@ -700,3 +1101,22 @@ int __sanitizer_get_ownership(const void *Ptr) {
 uptr __sanitizer_get_allocated_size(const void *Ptr) {
   return Instance.getUsableSize(Ptr);
 }
+
+uptr __sanitizer_get_allocator_histogram(AllocatorClassStats *Stats,
+                                         uptr MaxClasses) {
+  return Instance.getHistogram(Stats, MaxClasses);
+}
+
+void __sanitizer_print_allocator_histogram() {
+  Instance.printHistogram();
+}
+
+// Scudo specific interface functions
+
+void __scudo_get_stats(ScudoStats *Stats) {
+  getScudoStats(Stats);
+}
+
+void __scudo_print_stats() {
+  printScudoStats();
+}
@@ -77,6 +77,7 @@ struct AllocatorOptions {
   bool DeallocationTypeMismatch;
   bool DeleteSizeMismatch;
   bool ZeroContents;
+  u32 LatencySamplePeriod;
 
   void setFrom(const Flags *f, const CommonFlags *cf);
   void copyTo(Flags *f, CommonFlags *cf) const;
@@ -85,6 +86,25 @@ struct AllocatorOptions {
 void initAllocator(const AllocatorOptions &options);
 void drainQuarantine();
 
+const uptr NumLatencyBuckets = 32;
+
+// Must match struct __scudo_stats in include/sanitizer/scudo_interface.h.
+struct ScudoStats {
+  uptr AllocatedBytes;
+  uptr MappedBytes;
+  uptr QuarantineBytes;
+  uptr QuarantineMaxBytes;
+  uptr SecondaryChunks;
+  uptr SecondaryCachedMappings;
+  uptr SecondaryCachedBytes;
+  u64 InvalidHeaders;
+  u64 MallocLatency[NumLatencyBuckets];
+  u64 FreeLatency[NumLatencyBuckets];
+};
+
+void getScudoStats(ScudoStats *Stats);
+void printScudoStats();
+
 void *scudoMalloc(uptr Size, AllocType Type);
 void scudoFree(void *Ptr, AllocType Type);
 void scudoSizedFree(void *Ptr, uptr Size, AllocType Type);
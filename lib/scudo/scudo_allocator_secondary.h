@@ -10,7 +10,8 @@
 /// Scudo Secondary Allocator.
 /// This services allocation that are too large to be serviced by the Primary
 /// Allocator. It is directly backed by the memory mapping functions of the
-/// operating system.
+/// operating system. Freed mappings, guard pages included, can be cached for
+/// reuse by an allocation of the same size.
 ///
 //===----------------------------------------------------------------------===//
 
@@ -29,6 +30,17 @@ class ScudoLargeMmapAllocator {
     atomic_store(&MayReturnNull, AllocatorMayReturnNull, memory_order_relaxed);
   }
 
+  // See LargeMmapAllocator::SetCacheParams.
+  void SetCacheParams(uptr MaxCachedBytes, s32 DecayMs) {
+    atomic_store(&CacheDecayMs, DecayMs, memory_order_relaxed);
+    atomic_store(&MaxCachedSize, MaxCachedBytes, memory_order_relaxed);
+  }
+
+  // Scudo's Primary is not NUMA-aware, so the mappings are not bound either.
+  void SetBindToNumaNode(bool BindToNumaNode) {
+    CHECK(!BindToNumaNode);
+  }
+
   void *Allocate(AllocatorStats *Stats, uptr Size, uptr Alignment) {
     // The Scudo frontend prevents us from allocating more than
     // MaxAllowedMallocSize, so integer overflow checks would be superfluous.
@@ -40,6 +52,9 @@ class ScudoLargeMmapAllocator {
     // enough. Subtract it here to get the requested size, including header.
     if (Alignment > MinAlignment)
       Size -= Alignment;
+    else if (uptr MapBeg = takeFromCache(MapSize))
+      return initChunk(Stats, MapBeg, MapSize, MapBeg + PageSize + HeadersSize,
+                       Size);
 
     uptr MapBeg = reinterpret_cast<uptr>(MmapNoAccess(MapSize));
     if (MapBeg == ~static_cast<uptr>(0))
@@ -76,22 +91,30 @@ class ScudoLargeMmapAllocator {
       MapSize = NewMapEnd - NewMapBeg;
     }
 
-    uptr UserEnd = UserBeg + (Size - AlignedChunkHeaderSize);
-    CHECK_LE(UserEnd, MapEnd - PageSize);
     // Actually mmap the memory, preserving the guard pages on either side.
     CHECK_EQ(MapBeg + PageSize, reinterpret_cast<uptr>(
         MmapFixedOrDie(MapBeg + PageSize, MapSize - 2 * PageSize)));
-    uptr Ptr = UserBeg - AlignedChunkHeaderSize;
-    SecondaryHeader *Header = getHeader(Ptr);
-    Header->MapBeg = MapBeg;
-    Header->MapSize = MapSize;
-    // The primary adds the whole class size to the stats when allocating a
-    // chunk, so we will do something similar here. But we will not account for
-    // the guard pages.
-    Stats->Add(AllocatorStatAllocated, MapSize - 2 * PageSize);
-    Stats->Add(AllocatorStatMapped, MapSize - 2 * PageSize);
+    return initChunk(Stats, MapBeg, MapSize, UserBeg, Size);
+  }
 
-    return reinterpret_cast<void *>(UserBeg);
+  // Grows the chunk at Ptr to Size bytes, including the header, without
+  // moving it: the trailing guard page is grown in place and all but its last
+  // page are then backed. Returns false if the next pages are taken.
+  bool ResizeInPlace(AllocatorStats *Stats, void *Ptr, uptr Size) {
+    if (Size <= GetActuallyAllocatedSize(Ptr))
+      return true;
+    SecondaryHeader *Header = getHeader(Ptr);
+    uptr GuardBeg = Header->MapBeg + Header->MapSize - PageSize;
+    uptr UserEnd = RoundUpTo(reinterpret_cast<uptr>(Ptr) + Size, PageSize);
+    uptr GrowSize = UserEnd - GuardBeg;
+    if (!GrowMappingInPlace(GuardBeg, PageSize, PageSize + GrowSize))
+      return false;
+    CHECK_EQ(GuardBeg, reinterpret_cast<uptr>(
+        MmapFixedOrDie(GuardBeg, GrowSize)));
+    Header->MapSize += GrowSize;
+    Stats->Add(AllocatorStatAllocated, GrowSize);
+    Stats->Add(AllocatorStatMapped, GrowSize);
+    return true;
   }
 
   void *ReturnNullOrDieOnBadRequest() {
@@ -114,7 +137,44 @@ class ScudoLargeMmapAllocator {
     SecondaryHeader *Header = getHeader(Ptr);
     Stats->Sub(AllocatorStatAllocated, Header->MapSize - 2 * PageSize);
     Stats->Sub(AllocatorStatMapped, Header->MapSize - 2 * PageSize);
-    UnmapOrDie(reinterpret_cast<void *>(Header->MapBeg), Header->MapSize);
+    atomic_fetch_sub(&NumChunks, 1, memory_order_relaxed);
+    if (!putIntoCache(Header->MapBeg, Header->MapSize))
+      UnmapOrDie(reinterpret_cast<void *>(Header->MapBeg), Header->MapSize);
+  }
+
+  // Unmaps the cached mappings which outlived the decay interval, or all of
+  // them if Force is true.
+  void ReleaseToOS(bool Force) {
+    if (!atomic_load(&CachedSize, memory_order_relaxed))
+      return;
+    u64 Now = NanoTime();
+    for (uptr I = 0; I < NumCacheShards; I++) {
+      CachedMapping Evicted[CacheEntriesPerShard];
+      uptr NumEvicted = 0;
+      {
+        CacheShard *Shard = &Cache[I];
+        SpinMutexLock L(&Shard->Mutex);
+        for (uptr J = 0; J < Shard->NumEntries;) {
+          if (Force || isExpired(Shard->Entries[J], Now))
+            Evicted[NumEvicted++] = removeFromCacheLocked(Shard, J);
+          else
+            J++;
+        }
+      }
+      unmapCachedMappings(Evicted, NumEvicted);
+    }
+  }
+
+  // Returns the number of chunks in use, and the number and total size of the
+  // cached mappings.
+  void getStats(uptr *Chunks, uptr *CachedMappings, uptr *CachedBytes) {
+    *Chunks = atomic_load(&NumChunks, memory_order_relaxed);
+    *CachedBytes = atomic_load(&CachedSize, memory_order_relaxed);
+    *CachedMappings = 0;
+    for (uptr I = 0; I < NumCacheShards; I++) {
+      SpinMutexLock L(&Cache[I].Mutex);
+      *CachedMappings += Cache[I].NumEntries;
+    }
   }
 
   uptr TotalMemoryUsed() {
@@ -172,6 +232,132 @@ class ScudoLargeMmapAllocator {
   // Check that sizeof(SecondaryHeader) is a multiple of MinAlignment.
   COMPILER_CHECK((sizeof(SecondaryHeader) & (MinAlignment - 1)) == 0);
 
+  static const uptr NumCacheShards = 4;
+  static const uptr CacheEntriesPerShard = 8;
+
+  // A cached mapping keeps its guard pages, and is only reused for a chunk of
+  // the exact same mapping size so that the trailing guard page still directly
+  // follows the end of the chunk.
+  struct CachedMapping {
+    uptr MapBeg;
+    uptr MapSize;
+    u64 FreeTime;
+  };
+
+  struct CacheShard {
+    SpinMutex Mutex;
+    uptr NumEntries;
+    CachedMapping Entries[CacheEntriesPerShard];
+  };
+
+  // Writes the header of a chunk at UserBeg in the guarded mapping, which must
+  // be backed already.
+  void *initChunk(AllocatorStats *Stats, uptr MapBeg, uptr MapSize,
+                  uptr UserBeg, uptr Size) {
+    uptr UserEnd = UserBeg + (Size - AlignedChunkHeaderSize);
+    CHECK_LE(UserEnd, MapBeg + MapSize - PageSize);
+    uptr Ptr = UserBeg - AlignedChunkHeaderSize;
+    SecondaryHeader *Header = getHeader(Ptr);
+    Header->MapBeg = MapBeg;
+    Header->MapSize = MapSize;
+    // The primary adds the whole class size to the stats when allocating a
+    // chunk, so we will do something similar here. But we will not account for
+    // the guard pages.
+    Stats->Add(AllocatorStatAllocated, MapSize - 2 * PageSize);
+    Stats->Add(AllocatorStatMapped, MapSize - 2 * PageSize);
+    atomic_fetch_add(&NumChunks, 1, memory_order_relaxed);
+
+    return reinterpret_cast<void *>(UserBeg);
+  }
+
+  CacheShard *getCacheShard(uptr MapSize) {
+    return &Cache[MostSignificantSetBitIndex(MapSize) % NumCacheShards];
+  }
+
+  bool isExpired(const CachedMapping &Mapping, u64 Now) {
+    s32 DecayMs = atomic_load(&CacheDecayMs, memory_order_relaxed);
+    return DecayMs >= 0 && Mapping.FreeTime + DecayMs * 1000000ULL <= Now;
+  }
+
+  CachedMapping removeFromCacheLocked(CacheShard *Shard, uptr Index) {
+    CachedMapping Mapping = Shard->Entries[Index];
+    Shard->Entries[Index] = Shard->Entries[--Shard->NumEntries];
+    atomic_fetch_sub(&CachedSize, Mapping.MapSize, memory_order_relaxed);
+    return Mapping;
+  }
+
+  void unmapCachedMappings(CachedMapping *Mappings, uptr Count) {
+    for (uptr I = 0; I < Count; I++)
+      UnmapOrDie(reinterpret_cast<void *>(Mappings[I].MapBeg),
+                 Mappings[I].MapSize);
+  }
+
+  // Returns the beginning of a cached mapping of MapSize bytes, with its
+  // accessible part zeroed like a fresh mapping, or 0.
+  uptr takeFromCache(uptr MapSize) {
+    if (!atomic_load(&CachedSize, memory_order_relaxed))
+      return 0;
+    uptr MapBeg = 0;
+    {
+      CacheShard *Shard = getCacheShard(MapSize);
+      SpinMutexLock L(&Shard->Mutex);
+      for (uptr I = 0; I < Shard->NumEntries; I++) {
+        if (Shard->Entries[I].MapSize == MapSize) {
+          MapBeg = removeFromCacheLocked(Shard, I).MapBeg;
+          break;
+        }
+      }
+    }
+    if (MapBeg)
+      internal_bzero_aligned16(reinterpret_cast<void *>(MapBeg + PageSize),
+                               MapSize - 2 * PageSize);
+    return MapBeg;
+  }
+
+  // Returns false if the mapping should be unmapped instead.
+  bool putIntoCache(uptr MapBeg, uptr MapSize) {
+    uptr MaxCached = atomic_load(&MaxCachedSize, memory_order_relaxed);
+    if (MapSize > MaxCached)
+      return false;
+    u64 Now = NanoTime();
+    CachedMapping Evicted[CacheEntriesPerShard];
+    uptr NumEvicted = 0;
+    bool Cached = false;
+    {
+      CacheShard *Shard = getCacheShard(MapSize);
+      SpinMutexLock L(&Shard->Mutex);
+      for (uptr I = 0; I < Shard->NumEntries;) {
+        if (isExpired(Shard->Entries[I], Now))
+          Evicted[NumEvicted++] = removeFromCacheLocked(Shard, I);
+        else
+          I++;
+      }
+      // Make room by evicting the least recently freed mappings.
+      while (Shard->NumEntries &&
+             (Shard->NumEntries == CacheEntriesPerShard ||
+              atomic_load(&CachedSize, memory_order_relaxed) + MapSize >
+                  MaxCached)) {
+        uptr Oldest = 0;
+        for (uptr I = 1; I < Shard->NumEntries; I++)
+          if (Shard->Entries[I].FreeTime < Shard->Entries[Oldest].FreeTime)
+            Oldest = I;
+        Evicted[NumEvicted++] = removeFromCacheLocked(Shard, Oldest);
+      }
+      // The rest of the budget may be held by the other shards.
+      if (atomic_load(&CachedSize, memory_order_relaxed) + MapSize <=
+          MaxCached) {
+        CachedMapping *Mapping = &Shard->Entries[Shard->NumEntries++];
+        Mapping->MapBeg = MapBeg;
+        Mapping->MapSize = MapSize;
+        Mapping->FreeTime = Now;
+        atomic_fetch_add(&CachedSize, MapSize, memory_order_relaxed);
+        Cached = true;
+      }
+    }
+    unmapCachedMappings(Evicted, NumEvicted);
+    return Cached;
+  }
+
   SecondaryHeader *getHeader(uptr Ptr) {
     return reinterpret_cast<SecondaryHeader*>(Ptr - sizeof(SecondaryHeader));
   }
@@ -183,6 +369,11 @@ class ScudoLargeMmapAllocator {
   const uptr HeadersSize = SecondaryHeaderSize + AlignedChunkHeaderSize;
   uptr PageSize;
   atomic_uint8_t MayReturnNull;
+  atomic_uintptr_t MaxCachedSize;
+  atomic_sint32_t CacheDecayMs;
+  atomic_uintptr_t CachedSize;
+  atomic_uintptr_t NumChunks;
+  CacheShard Cache[NumCacheShards];
 };
 
 #endif  // SCUDO_ALLOCATOR_SECONDARY_H_
@@ -0,0 +1,75 @@
+//===-- scudo_crc32_clmul.cpp -----------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// CRC32 function leveraging carry-less multiplication instructions, for CPUs
+/// that lack the dedicated CRC32 ones. This has to be kept separated to
+/// restrict the use of compiler specific flags to this file.
+///
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_common/sanitizer_internal_defs.h"
+
+// Carry-less multiplication is supported at compilation via the following:
+// - for i386 & x86_64: -mpclmul
+// - for AArch64: -march=armv8-a+crypto
+// An additional check must be performed at runtime as well to make sure the
+// emitted instructions are valid on the target host.
+
+#if defined(__PCLMUL__)
+# include <wmmintrin.h>
+# define CLMUL_SUPPORTED 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+# include <arm_neon.h>
+# define CLMUL_SUPPORTED 1
+#endif
+
+namespace __scudo {
+
+#if defined(CLMUL_SUPPORTED)
+// The result is the same as the one of computeSoftwareCRC32, the reflected
+// polynomial being 0xedb88320. The 64-bit data is folded into 32 bits with a
+// multiplication by x^64 mod P, the remainder is then obtained with a Barrett
+// reduction, as described in "Fast CRC Computation for Generic Polynomials
+// Using PCLMULQDQ Instruction" (Intel, 2009).
+static const u64 CRC32Poly = 0x1db710641ULL;  // P, reflected.
+static const u64 CRC32Mu = 0x1f7011641ULL;    // x^64 / P, reflected.
+static const u64 CRC32X64 = 0x163cd6124ULL;   // x^64 mod P, reflected.
+
+// Both operands must fit in 33 bits, and the high one in 32, so that no bit
+// of the product is lost.
+static INLINE u64 carrylessMultiply(u64 A, u64 B) {
+#if defined(__PCLMUL__)
+  __m128i Product = _mm_clmulepi64_si128(_mm_set_epi64x(0, A),
+                                         _mm_set_epi64x(0, B), 0);
+  u64 Result;
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(&Result), Product);
+  return Result;
+#else
+  return vgetq_lane_u64(vreinterpretq_u64_p128(vmull_p64(A, B)), 0);
+#endif
+}
+
+static INLINE u32 reduceCRC32(u32 Value) {
+  u64 Quotient = carrylessMultiply(Value, CRC32Mu) & 0xffffffff;
+  return static_cast<u32>(carrylessMultiply(Quotient, CRC32Poly) >> 32);
+}
+
+u32 computeCarrylessCRC32(u32 Crc, uptr Data) {
+#if SANITIZER_WORDSIZE == 64
+  u64 Value = Crc ^ Data;
+  u64 Folded = carrylessMultiply(Value & 0xffffffff, CRC32X64);
+  return static_cast<u32>(Folded >> 32) ^
+      reduceCRC32(static_cast<u32>(Folded ^ (Value >> 32)));
+#else
+  return reduceCRC32(Crc ^ Data);
+#endif  // SANITIZER_WORDSIZE == 64
+}
+#endif  // defined(CLMUL_SUPPORTED)
+
+}  // namespace __scudo
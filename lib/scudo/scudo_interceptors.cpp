@@ -18,8 +18,27 @@
 
 #include "interception/interception.h"
 
+#include <pthread.h>
+
 using namespace __scudo;
 
+namespace __sanitizer {
+
+// Scudo doesn't intercept the pthread functions, the background threads can be
+// spawned with the libc ones directly.
+int real_pthread_create(void *Thread, void *Attr, void *(*Callback)(void *),
+                        void *Param) {
+  return pthread_create(reinterpret_cast<pthread_t *>(Thread),
+                        reinterpret_cast<pthread_attr_t *>(Attr), Callback,
+                        Param);
+}
+
+int real_pthread_join(void *Thread, void **Ret) {
+  return pthread_join(reinterpret_cast<pthread_t>(Thread), Ret);
+}
+
+}  // namespace __sanitizer
+
 INTERCEPTOR(void, free, void *ptr) {
   scudoFree(ptr, FromMalloc);
 }
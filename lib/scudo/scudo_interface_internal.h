@@ -0,0 +1,27 @@
+//===-- scudo_interface_internal.h ------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// Private Scudo interface header.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef SCUDO_INTERFACE_INTERNAL_H_
+#define SCUDO_INTERFACE_INTERNAL_H_
+
+#include "scudo_allocator.h"
+
+extern "C" {
+SANITIZER_INTERFACE_ATTRIBUTE
+void __scudo_get_stats(__scudo::ScudoStats *Stats);
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void __scudo_print_stats();
+}  // extern "C"
+
+#endif  // SCUDO_INTERFACE_INTERNAL_H_
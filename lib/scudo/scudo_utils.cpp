@@ -13,14 +13,15 @@
 
 #include "scudo_utils.h"
 
+#include "sanitizer_common/sanitizer_cpu_features.h"
+
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <sys/syscall.h>
 #include <unistd.h>
-#if defined(__x86_64__) || defined(__i386__)
-# include <cpuid.h>
-#endif
-#if defined(__arm__) || defined(__aarch64__)
+#if defined(__arm__)
 # include <sys/auxv.h>
 #endif
 
@@ -48,59 +49,9 @@ void NORETURN dieWithMessage(const char *Format, ...) {
   Die();
 }
 
-#if defined(__x86_64__) || defined(__i386__)
-// i386 and x86_64 specific code to detect CRC32 hardware support via CPUID.
-// CRC32 requires the SSE 4.2 instruction set.
-typedef struct {
-  u32 Eax;
-  u32 Ebx;
-  u32 Ecx;
-  u32 Edx;
-} CPUIDRegs;
-
-static void getCPUID(CPUIDRegs *Regs, u32 Level)
-{
-  __get_cpuid(Level, &Regs->Eax, &Regs->Ebx, &Regs->Ecx, &Regs->Edx);
-}
-
-CPUIDRegs getCPUFeatures() {
-  CPUIDRegs VendorRegs = {};
-  getCPUID(&VendorRegs, 0);
-  bool IsIntel =
-      (VendorRegs.Ebx == signature_INTEL_ebx) &&
-      (VendorRegs.Edx == signature_INTEL_edx) &&
-      (VendorRegs.Ecx == signature_INTEL_ecx);
-  bool IsAMD =
-      (VendorRegs.Ebx == signature_AMD_ebx) &&
-      (VendorRegs.Edx == signature_AMD_edx) &&
-      (VendorRegs.Ecx == signature_AMD_ecx);
-  // Default to an empty feature set if not on a supported CPU.
-  CPUIDRegs FeaturesRegs = {};
-  if (IsIntel || IsAMD) {
-    getCPUID(&FeaturesRegs, 1);
-  }
-  return FeaturesRegs;
-}
-
-#ifndef bit_SSE4_2
-# define bit_SSE4_2 bit_SSE42  // clang and gcc have different defines.
-#endif
-
-bool testCPUFeature(CPUFeature Feature)
-{
-  CPUIDRegs FeaturesRegs = getCPUFeatures();
-
-  switch (Feature) {
-    case CRC32CPUFeature:  // CRC32 is provided by SSE 4.2.
-      return !!(FeaturesRegs.Ecx & bit_SSE4_2);
-    default:
-      break;
-  }
-  return false;
-}
-#elif defined(__arm__) || defined(__aarch64__)
-// For ARM and AArch64, hardware CRC32 support is indicated in the
-// AT_HWVAL auxiliary vector.
+#if defined(__arm__)
+// For ARM, hardware CRC32 support is indicated in the AT_HWCAP auxiliary
+// vector.
 
 #ifndef HWCAP_CRC32
 # define HWCAP_CRC32 (1<<7)  // HWCAP_CRC32 is missing on older platforms.
@@ -118,10 +69,75 @@ bool testCPUFeature(CPUFeature Feature) {
   return false;
 }
 #else
+// The shared detection covers x86 (CRC32 is provided by SSE 4.2, carry-less
+// multiplication by PCLMULQDQ) and AArch64 (CRC32 and PMULL).
 bool testCPUFeature(CPUFeature Feature) {
+  switch (Feature) {
+    case CRC32CPUFeature:
+      return CPUHasFeature(kCPUFeatureSSE4_2) ||
+             CPUHasFeature(kCPUFeatureCRC32);
+    case CLMULCPUFeature:
+      return CPUHasFeature(kCPUFeatureCLMUL) ||
+             CPUHasFeature(kCPUFeaturePMULL);
+    default:
+      break;
+  }
   return false;
 }
-#endif  // defined(__x86_64__) || defined(__i386__)
+#endif  // defined(__arm__)
+
+#if defined(__NR_rseq) && (defined(__x86_64__) || defined(__i386__) || \
+    defined(__aarch64__))
+// The layout of struct rseq from linux/rseq.h, which might not be available.
+struct ALIGNED(32) RseqArea {
+  u32 CPUIdStart;
+  u32 CPUId;
+  u64 CriticalSection;
+  u32 Flags;
+};
+
+// The signature preceding the abort handlers of the critical sections. Scudo
+// does not define any, it only reads the CPU number, but registering requires
+// one.
+# if defined(__aarch64__)
+static const u32 RseqSignature = 0xd428bc00;
+# else
+static const u32 RseqSignature = 0x53053053;
+# endif
+
+static thread_local RseqArea ThreadRseq;
+static thread_local bool ThreadRseqRegistered = false;
+
+void registerThreadRseq() {
+  // If the C library registered its own area (glibc 2.35 and later), this
+  // fails with EBUSY, and sched_getcpu reads that area instead.
+  ThreadRseq.CPUId = static_cast<u32>(-1);
+  if (syscall(__NR_rseq, &ThreadRseq, sizeof(ThreadRseq), 0,
+              RseqSignature) == 0)
+    ThreadRseqRegistered = true;
+}
+
+s32 getCurrentCPU() {
+  if (LIKELY(ThreadRseqRegistered))
+    return static_cast<s32>(
+        *reinterpret_cast<volatile u32 *>(&ThreadRseq.CPUId));
+  return sched_getcpu();
+}
+#else
+void registerThreadRseq() {}
+
+s32 getCurrentCPU() {
+  return sched_getcpu();
+}
+#endif  // defined(__NR_rseq)
+
+uptr getNumberOfCPUs() {
+  // sysconf might allocate memory, which is not possible this early.
+  cpu_set_t CPUs;
+  if (sched_getaffinity(0, sizeof(CPUs), &CPUs) != 0)
+    return 1;
+  return CPU_COUNT(&CPUs);
+}
 
 // readRetry will attempt to read Count bytes from the Fd specified, and if
 // interrupted will retry to read additional bytes to reach Count.
@@ -32,10 +32,34 @@ void NORETURN dieWithMessage(const char *Format, ...);
 
 enum CPUFeature {
   CRC32CPUFeature = 0,
+  CLMULCPUFeature = 1,
   MaxCPUFeature,
 };
 bool testCPUFeature(CPUFeature feature);
 
+// Registers a restartable sequences (rseq) area for the calling thread, unless
+// the C library already did. The kernel then keeps the current CPU number in
+// it, which is cheaper to read than calling getcpu.
+void registerThreadRseq();
+// Returns the CPU the calling thread is running on, or -1 if unknown.
+s32 getCurrentCPU();
+// Returns the number of CPUs the process can run on.
+uptr getNumberOfCPUs();
+
+// Returns the CPU timestamp counter, or NanoTime() where there is none. Only
+// differences between two readings on the same thread are meaningful.
+INLINE u64 readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+  u64 Counter;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(Counter));
+  return Counter;
+#else
+  return NanoTime();
+#endif
+}
+
 // Tiny PRNG based on https://en.wikipedia.org/wiki/Xorshift#xorshift.2B
 // The state (128 bits) will be stored in thread local storage.
 struct Xorshift128Plus {
@@ -56,6 +80,7 @@ struct Xorshift128Plus {
 enum : u8 {
   CRC32Software = 0,
   CRC32Hardware = 1,
+  CRC32Carryless = 2,
 };
 
 u32 computeSoftwareCRC32(u32 Crc, uptr Data);
@@ -12,6 +12,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_internal_defs.h"
 #if SANITIZER_POSIX
@@ -22,6 +23,12 @@
 #if SANITIZER_POSIX
 #include <signal.h>
 #endif
+#if SANITIZER_POSIX
+#include <pthread.h>
+#endif
+#if SANITIZER_LINUX
+#include <sched.h>
+#endif
 
 using namespace __sanitizer;
 
@@ -32,6 +39,141 @@ StaticSpinMutex modules_mutex;
 
 fd_t stats_fd;
 
+// Configuration from the environment, read when the first module registers:
+//  * SANITIZER_STATS_SHARDED=1 counts the stats per CPU, in the shards below,
+//    rather than in the StatInfos that all the threads write to.
+//  * SANITIZER_STATS_EXPORT_INTERVAL=<ms> starts a thread which writes the
+//    counts accumulated since its previous export to the stats file at this
+//    interval. The file then holds several reports of each module, which
+//    are to be added up.
+StaticSpinMutex config_mutex;
+bool config_initialized;
+bool sharded;
+int export_interval_ms;
+
+// Each shard is an open-addressed table from StatInfos to counts. Entries are
+// only ever claimed, so the table needs no lock; the counts are taken out with
+// an atomic exchange when reporting. If a shard fills up, the remaining stats
+// are counted in their StatInfo as without sharding.
+const uptr kNumShards = 64;
+const uptr kShardSize = 4096;
+const uptr kMaxShardProbes = 16;
+
+struct ShardEntry {
+  atomic_uintptr_t info;
+  atomic_uintptr_t count;
+};
+
+struct Shard {
+  ShardEntry entries[kShardSize];
+};
+
+Shard *shards;
+
+void WriteFullReport(bool close_file);
+
+uptr ShardIndex(StatInfo *s) {
+  return ((uptr)s >> 3) * 0x9e3779b1U;
+}
+
+Shard *GetCurrentShard() {
+#if SANITIZER_LINUX
+  int cpu = sched_getcpu();
+  return &shards[cpu > 0 ? cpu % kNumShards : 0];
+#else
+  return &shards[0];
+#endif
+}
+
+void ShardedReport(StatInfo *s, uptr pc) {
+  if (!atomic_load_relaxed(reinterpret_cast<atomic_uintptr_t *>(&s->addr)))
+    atomic_store_relaxed(reinterpret_cast<atomic_uintptr_t *>(&s->addr), pc);
+  Shard *shard = GetCurrentShard();
+  uptr index = ShardIndex(s);
+  for (uptr i = 0; i != kMaxShardProbes; ++i) {
+    ShardEntry *e = &shard->entries[(index + i) % kShardSize];
+    uptr info = atomic_load_relaxed(&e->info);
+    if (!info &&
+        atomic_compare_exchange_strong(&e->info, &info, (uptr)s,
+                                       memory_order_relaxed))
+      info = (uptr)s;
+    if (info == (uptr)s) {
+      atomic_fetch_add(&e->count, 1, memory_order_relaxed);
+      return;
+    }
+  }
+  atomic_fetch_add(reinterpret_cast<atomic_uintptr_t *>(&s->data), 1,
+                   memory_order_relaxed);
+}
+
+// Takes the count of s out of its StatInfo and the shards. Returns the data
+// of s with that count.
+uptr TakeData(StatInfo *s) {
+  atomic_uintptr_t *data = reinterpret_cast<atomic_uintptr_t *>(&s->data);
+  uptr old_data = atomic_load_relaxed(data);
+  while (!atomic_compare_exchange_weak(data, &old_data,
+                                       old_data - CountFromData(old_data),
+                                       memory_order_relaxed)) {
+  }
+  uptr count = CountFromData(old_data);
+  uptr kind = old_data - count;
+  if (!shards)
+    return old_data;
+  uptr index = ShardIndex(s);
+  for (uptr shard = 0; shard != kNumShards; ++shard) {
+    for (uptr i = 0; i != kMaxShardProbes; ++i) {
+      ShardEntry *e = &shards[shard].entries[(index + i) % kShardSize];
+      uptr info = atomic_load_relaxed(&e->info);
+      if (!info)
+        break;
+      if (info == (uptr)s) {
+        count += atomic_exchange(&e->count, 0, memory_order_relaxed);
+        break;
+      }
+    }
+  }
+  return kind | CountFromData(count);
+}
+
+void *ExportThread(void *arg) {
+  for (;;) {
+    SleepForMillis(export_interval_ms);
+    WriteFullReport(/*close_file=*/false);
+  }
+  return nullptr;
+}
+
+// There is no sanitizer with real_pthread_create for internal_start_thread to
+// use here, and it is fine for the pthread_create interceptor of a sanitizer
+// to see this thread.
+void StartExportThread() {
+#if SANITIZER_POSIX
+  // Block the signals in the thread, so that it doesn't take SIGUSR2.
+  sigset_t set, old;
+  sigfillset(&set);
+  pthread_sigmask(SIG_SETMASK, &set, &old);
+  pthread_t th;
+  if (pthread_create(&th, nullptr, ExportThread, nullptr) == 0)
+    pthread_detach(th);
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+#endif
+}
+
+void InitConfig() {
+  SpinMutexLock l(&config_mutex);
+  if (config_initialized)
+    return;
+  config_initialized = true;
+  const char *sharded_env = GetEnv("SANITIZER_STATS_SHARDED");
+  sharded = sharded_env && internal_strcmp(sharded_env, "1") == 0;
+  if (sharded)
+    shards = (Shard *)MmapOrDie(kNumShards * sizeof(Shard), "stats shards");
+  const char *interval_env = GetEnv("SANITIZER_STATS_EXPORT_INTERVAL");
+  export_interval_ms = interval_env ? internal_atoll(interval_env) : 0;
+  if (export_interval_ms > 0 && GetEnv("SANITIZER_STATS_PATH"))
+    StartExportThread();
+}
+
 void WriteLE(fd_t fd, uptr val) {
   char chars[sizeof(uptr)];
   for (unsigned i = 0; i != sizeof(uptr); ++i) {
@@ -71,8 +213,12 @@ void WriteModuleReport(StatModule **smodp) {
       StatInfo *s = &smod->infos[i];
       if (!s->addr)
         continue;
+      uptr data = TakeData(s);
+      // The periodic reports only have the stats that changed.
+      if (!CountFromData(data) && export_interval_ms > 0)
+        continue;
       WriteLE(stats_fd, s->addr - mod->base_address());
-      WriteLE(stats_fd, s->data);
+      WriteLE(stats_fd, data);
     }
   }
   WriteLE(stats_fd, 0);
@@ -84,6 +230,7 @@ void WriteModuleReport(StatModule **smodp) {
 extern "C"
 SANITIZER_INTERFACE_ATTRIBUTE
 unsigned __sanitizer_stats_register(StatModule **mod) {
+  InitConfig();
   SpinMutexLock l(&modules_mutex);
   modules.push_back(mod);
   return modules.size() - 1;
@@ -97,16 +244,23 @@ void __sanitizer_stats_unregister(unsigned index) {
   modules[index] = 0;
 }
 
+extern "C"
+SANITIZER_INTERFACE_ATTRIBUTE
+StatReportFn __sanitizer_stats_get_sharded_report() {
+  InitConfig();
+  return sharded ? ShardedReport : nullptr;
+}
+
 namespace {
 
-void WriteFullReport() {
+void WriteFullReport(bool close_file) {
   SpinMutexLock l(&modules_mutex);
   for (StatModule **mod : modules) {
     if (!mod)
       continue;
     WriteModuleReport(mod);
   }
-  if (stats_fd != 0 && stats_fd != kInvalidFd) {
+  if (close_file && stats_fd != 0 && stats_fd != kInvalidFd) {
     CloseFile(stats_fd);
     stats_fd = kInvalidFd;
   }
@@ -114,7 +268,7 @@ void WriteFullReport() {
 
 #if SANITIZER_POSIX
 void USR2Handler(int sig) {
-  WriteFullReport();
+  WriteFullReport(/*close_file=*/true);
 }
 #endif
 
@@ -129,7 +283,7 @@ struct WriteReportOnExitOrSignal {
   }
 
   ~WriteReportOnExitOrSignal() {
-    WriteFullReport();
+    WriteFullReport(/*close_file=*/true);
   }
 } wr;
 
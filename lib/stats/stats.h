@@ -38,6 +38,11 @@ inline uptr CountFromData(uptr data) {
   return data & ((1ull << (sizeof(uptr) * 8 - kKindBits)) - 1);
 }
 
+// With SANITIZER_STATS_SHARDED=1, the clients report the stats through this
+// function of the runtime, which counts them per CPU instead of in the
+// StatInfo.
+typedef void (*StatReportFn)(StatInfo *s, uptr pc);
+
 }
 
 #endif
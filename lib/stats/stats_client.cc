@@ -40,6 +40,7 @@ void *LookupSymbolFromMain(const char *name) {
 }
 
 StatModule *list;
+StatReportFn sharded_report;
 
 struct RegisterSanStats {
   unsigned module_id;
@@ -50,6 +51,11 @@ struct RegisterSanStats {
         LookupSymbolFromMain("__sanitizer_stats_register"));
     if (reg_func)
       module_id = reg_func(&list);
+    typedef StatReportFn (*get_report_func_t)();
+    get_report_func_t get_report_func = reinterpret_cast<get_report_func_t>(
+        LookupSymbolFromMain("__sanitizer_stats_get_sharded_report"));
+    if (get_report_func)
+      sharded_report = get_report_func();
   }
 
   ~RegisterSanStats() {
@@ -69,6 +75,12 @@ extern "C" void __sanitizer_stat_init(StatModule *mod) {
 }
 
 extern "C" void __sanitizer_stat_report(StatInfo *s) {
+  if (sharded_report) {
+    // Don't write to the StatInfo once it has its address, so that it
+    // doesn't bounce between the CPUs.
+    sharded_report(s, GET_CALLER_PC());
+    return;
+  }
   s->addr = GET_CALLER_PC();
 #if defined(_WIN64) && !defined(__clang__)
   uptr old_data = InterlockedIncrement64(reinterpret_cast<LONG64 *>(&s->data));
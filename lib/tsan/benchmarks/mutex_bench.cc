@@ -0,0 +1,72 @@
+// Mini-benchmark for tsan: mutex lock/unlock throughput.
+// Every thread repeatedly locks and unlocks mutexes from its own small set
+// (think of per-connection locks in a server), so the application itself does
+// not contend and the numbers show the scalability of the runtime.
+// Runs with 1, 2, 4, ... threads up to the given maximum and prints the total
+// number of lock/unlock pairs per second for each thread count.
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+const int kMutexesPerThread = 16;
+const int kMaxThreads = 64;
+
+struct __attribute__((aligned(64))) PerThread {
+  pthread_mutex_t mutexes[kMutexesPerThread];
+};
+
+PerThread per_thread[kMaxThreads];
+int n_iterations;
+pthread_barrier_t start_barrier;
+
+double Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void *Thread(void *arg) {
+  PerThread *p = &per_thread[(long)arg];
+  pthread_barrier_wait(&start_barrier);
+  for (int i = 0; i < n_iterations; i++) {
+    pthread_mutex_t *m = &p->mutexes[i % kMutexesPerThread];
+    pthread_mutex_lock(m);
+    pthread_mutex_unlock(m);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int max_threads = 64;
+  n_iterations = 1000000;
+  if (argc == 3) {
+    max_threads = atoi(argv[1]);
+    assert(max_threads > 0 && max_threads <= kMaxThreads);
+    n_iterations = atoi(argv[2]);
+  } else if (argc != 1) {
+    printf("Usage: %s max_threads n_iterations\n", argv[0]);
+    return 1;
+  }
+  printf("%s: max_threads=%d n_iterations=%d\n", __FILE__, max_threads,
+         n_iterations);
+  for (int i = 0; i < kMaxThreads; i++)
+    for (int j = 0; j < kMutexesPerThread; j++)
+      pthread_mutex_init(&per_thread[i].mutexes[j], 0);
+  pthread_t t[kMaxThreads];
+  for (int n = 1; n <= max_threads; n *= 2) {
+    pthread_barrier_init(&start_barrier, 0, n + 1);
+    for (int i = 0; i < n; i++)
+      pthread_create(&t[i], 0, Thread, (void*)(long)i);
+    pthread_barrier_wait(&start_barrier);
+    double start = Now();
+    for (int i = 0; i < n; i++)
+      pthread_join(t[i], 0);
+    double elapsed = Now() - start;
+    pthread_barrier_destroy(&start_barrier);
+    printf("threads=%2d: %.2f M lock/unlock per second\n", n,
+           n * (double)n_iterations / elapsed * 1e-6);
+  }
+  return 0;
+}
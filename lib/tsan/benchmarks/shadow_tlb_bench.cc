@@ -0,0 +1,91 @@
+// Mini-benchmark for the sanitizer shadow: TLB pressure of the heap shadow.
+// Allocates a big linked list of small nodes through malloc and walks it in
+// random order with instrumented loads, reporting the time per node and the
+// dTLB load misses (from perf_event_open, if available). Compare runs with
+// and without huge_pages_for_dense_shadow=1 in the tool's options. Build it
+// with the sanitizer under test, e.g.:
+//   clang++ -O2 -fsanitize=thread shadow_tlb_bench.cc
+//   clang++ -O2 -fsanitize=address shadow_tlb_bench.cc
+//   clang++ -O2 -fsanitize=memory shadow_tlb_bench.cc
+// Optional arguments: heap size in megabytes and node size in bytes.
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct Node {
+  Node *next;
+};
+
+double Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int OpenDtlbMissCounter() {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  // The shadow checks and updates run in user space, inline or in the
+  // runtime.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int main(int argc, char **argv) {
+  long heap_mb = argc > 1 ? atol(argv[1]) : 512;
+  long node_size = argc > 2 ? atol(argv[2]) : 64;
+  long n = (heap_mb << 20) / node_size;
+  Node **nodes = (Node **)malloc(n * sizeof(Node *));
+  for (long i = 0; i < n; i++)
+    nodes[i] = (Node *)malloc(node_size);
+  // Link the nodes in a random order.
+  srand(1);
+  for (long i = n - 1; i > 0; i--) {
+    long j = ((long)rand() << 16 ^ rand()) % (i + 1);
+    Node *tmp = nodes[i];
+    nodes[i] = nodes[j];
+    nodes[j] = tmp;
+  }
+  for (long i = 0; i < n; i++)
+    nodes[i]->next = nodes[(i + 1) % n];
+
+  int fd = OpenDtlbMissCounter();
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  const int kIters = 4;
+  double t0 = Now();
+  Node *p = nodes[0];
+  for (long i = 0; i < n * kIters; i++)
+    p = p->next;
+  double t1 = Now();
+  long long misses = -1;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+      misses = -1;
+    close(fd);
+  }
+  printf("heap %ldMB, %ld nodes of %ldB: %.1f ns per node", heap_mb, n,
+         node_size, (t1 - t0) * 1e9 / (n * kIters));
+  if (misses >= 0)
+    printf(", %.3f dTLB misses per node", (double)misses / (n * kIters));
+  printf(" (%p)\n", (void *)p);
+  for (long i = 0; i < n; i++)
+    free(nodes[i]);
+  free(nodes);
+  return 0;
+}
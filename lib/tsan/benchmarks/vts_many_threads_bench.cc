@@ -27,6 +27,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 class __attribute__((aligned(64))) Mutex {
  public:
@@ -44,6 +45,12 @@ Mutex mutexes[kNumMutexes];
 
 int n_threads, n_iterations;
 
+double Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 pthread_barrier_t all_threads_ready, main_threads_ready;
 
 void* GarbageThread(void *unused) {
@@ -110,11 +117,14 @@ int main(int argc, char **argv) {
   }
   printf("Resuming the main threads.\n");
   pthread_barrier_wait(&main_threads_ready);
-
+  double start = Now();
 
   for (int i = 0; i < n_threads; i++) {
     pthread_join(t[i], 0);
   }
+  double elapsed = Now() - start;
+  printf("%.3fs, %.1fns per lock/unlock\n", elapsed,
+         elapsed * 1e9 / ((double)n_threads * n_iterations));
   delete [] t;
   return 0;
 }
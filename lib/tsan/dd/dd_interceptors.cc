@@ -62,6 +62,16 @@ INTERCEPTOR(int, pthread_mutex_trylock, pthread_mutex_t *m) {
   return res;
 }
 
+INTERCEPTOR(int, pthread_mutex_timedlock, pthread_mutex_t *m,
+    const timespec *abstime) {
+  InitThread();
+  MutexBeforeLock(thr, (uptr)m, true);
+  int res = REAL(pthread_mutex_timedlock)(m, abstime);
+  if (res == 0)
+    MutexAfterLock(thr, (uptr)m, true, false);
+  return res;
+}
+
 INTERCEPTOR(int, pthread_mutex_unlock, pthread_mutex_t *m) {
   InitThread();
   MutexBeforeUnlock(thr, (uptr)m, true);
@@ -296,6 +306,7 @@ void InitializeInterceptors() {
   INTERCEPT_FUNCTION(pthread_mutex_destroy);
   INTERCEPT_FUNCTION(pthread_mutex_lock);
   INTERCEPT_FUNCTION(pthread_mutex_trylock);
+  INTERCEPT_FUNCTION(pthread_mutex_timedlock);
   INTERCEPT_FUNCTION(pthread_mutex_unlock);
 
   INTERCEPT_FUNCTION(pthread_spin_destroy);
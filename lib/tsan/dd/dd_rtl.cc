@@ -19,6 +19,13 @@ namespace __dsan {
 
 static Context *ctx;
 
+// Sampling mode edge table parameters.
+static const uptr kMaxEdges = 1 << 16;
+static const uptr kMaxEdgeProbes = 64;
+static const uptr kEdgeMutexes = 1 << 16;
+// Replaces the target of the edges of a destroyed mutex.
+static const uptr kDestroyedMutex = 1;
+
 static u32 CurrentStackTrace(Thread *thr, uptr skip) {
   BufferedStackTrace stack;
   thr->ignore_interceptors = true;
@@ -70,6 +77,9 @@ static void InitializeFlags() {
 
   // Default values.
   f->second_deadlock_stack = false;
+  f->lock_graph_file = "";
+  f->lock_graph_interval_ms = 1000;
+  f->sample_period = 0;
 
   SetCommonFlagsDefaults();
   {
@@ -83,6 +93,10 @@ static void InitializeFlags() {
   // Override from command line.
   FlagParser parser;
   RegisterFlag(&parser, "second_deadlock_stack", "", &f->second_deadlock_stack);
+  RegisterFlag(&parser, "sample_period",
+               "If positive, only check one in this many lock acquisitions "
+               "of each thread, for two-lock inversions only.",
+               &f->sample_period);
   RegisterCommonFlags(&parser);
   parser.ParseString(GetEnv("DSAN_OPTIONS"));
   SetVerbosity(common_flags()->verbosity);
@@ -94,23 +108,159 @@ void Initialize() {
 
   InitializeInterceptors();
   InitializeFlags();
+  if (flags()->sample_period > 0) {
+    ctx->edges = (LockEdge *)MmapOrDie(kMaxEdges * sizeof(LockEdge),
+                                       "deadlock detector edges");
+    ctx->edge_mutexes = (atomic_uint8_t *)MmapOrDie(
+        kEdgeMutexes, "deadlock detector edge mutexes");
+    return;
+  }
   ctx->dd = DDetector::Create(flags());
 }
 
 void ThreadInit(Thread *thr) {
   static atomic_uintptr_t id_gen;
   uptr id = atomic_fetch_add(&id_gen, 1, memory_order_relaxed);
+  thr->id = id;
+  if (!ctx->dd)
+    return;
   thr->dd_pt = ctx->dd->CreatePhysicalThread();
   thr->dd_lt = ctx->dd->CreateLogicalThread(id);
 }
 
 void ThreadDestroy(Thread *thr) {
+  if (!ctx->dd)
+    return;
   ctx->dd->DestroyPhysicalThread(thr->dd_pt);
   ctx->dd->DestroyLogicalThread(thr->dd_lt);
 }
 
+// Sampling mode. The threads keep the stack of the locks they hold, and on
+// sampled acquisitions record the edges from these locks to the newly acquired
+// one into a global table. No lock is taken, and the stack is only unwound
+// when an edge is seen for the first time. Adding an edge whose reverse is
+// already in the table reports a lock-order inversion.
+
+static uptr EdgeHash(uptr from, uptr to) {
+  u64 h = (u64)from * 0x9e3779b97f4a7c15ULL ^ (u64)to * 0xc2b2ae3d27d4eb4fULL;
+  return (uptr)(h >> 32);
+}
+
+static atomic_uint8_t *EdgeMutexFlag(uptr m) {
+  uptr i = (uptr)(((u64)m * 0x9e3779b97f4a7c15ULL) >> 40);
+  return &ctx->edge_mutexes[i & (kEdgeMutexes - 1)];
+}
+
+static void MarkEdgeMutex(uptr m) {
+  atomic_uint8_t *flag = EdgeMutexFlag(m);
+  if (!atomic_load(flag, memory_order_relaxed))
+    atomic_store(flag, 1, memory_order_relaxed);
+}
+
+static LockEdge *FindEdge(uptr from, uptr to) {
+  uptr h = EdgeHash(from, to);
+  for (uptr i = 0; i < kMaxEdgeProbes; i++) {
+    LockEdge *e = &ctx->edges[(h + i) & (kMaxEdges - 1)];
+    uptr f = atomic_load(&e->from, memory_order_relaxed);
+    if (f == 0)
+      return 0;
+    if (f == from && atomic_load(&e->to, memory_order_acquire) == to)
+      return e;
+  }
+  return 0;
+}
+
+// Returns the edge if it was not in the table yet, 0 otherwise.
+static LockEdge *InsertEdge(Thread *thr, uptr from, uptr to) {
+  uptr h = EdgeHash(from, to);
+  for (uptr i = 0; i < kMaxEdgeProbes; i++) {
+    LockEdge *e = &ctx->edges[(h + i) & (kMaxEdges - 1)];
+    uptr f = atomic_load(&e->from, memory_order_relaxed);
+    if (f == 0 && atomic_compare_exchange_strong(&e->from, &f, from,
+                                                 memory_order_relaxed)) {
+      MarkEdgeMutex(from);
+      MarkEdgeMutex(to);
+      e->tid = thr->id;
+      e->stk = CurrentStackTrace(thr, 3);
+      atomic_store(&e->to, to, memory_order_release);
+      return e;
+    }
+    // An edge which is still being added is not seen, so that the same edge
+    // may rarely be added twice.
+    if (f == from && atomic_load(&e->to, memory_order_acquire) == to)
+      return 0;
+  }
+  atomic_fetch_add(&ctx->edges_dropped, 1, memory_order_relaxed);
+  return 0;
+}
+
+static void SampledAfterLock(Thread *thr, uptr m, bool trylock) {
+  // Try locks can't deadlock, and add no edge.
+  if (trylock || thr->nheld == 0) {
+  } else if (thr->sample_countdown > 1) {
+    thr->sample_countdown--;
+  } else {
+    thr->sample_countdown = flags()->sample_period;
+    for (uptr i = 0; i < thr->nheld; i++) {
+      uptr held = thr->held[i];
+      if (held == m)
+        continue;
+      LockEdge *e = InsertEdge(thr, held, m);
+      LockEdge *reverse = e ? FindEdge(m, held) : 0;
+      if (!reverse)
+        continue;
+      DDReport rep;
+      rep.n = 2;
+      rep.loop[0].thr_ctx = thr->id;
+      rep.loop[0].mtx_ctx0 = held;
+      rep.loop[0].mtx_ctx1 = m;
+      rep.loop[0].stk[0] = 0;
+      rep.loop[0].stk[1] = e->stk;
+      rep.loop[1].thr_ctx = reverse->tid;
+      rep.loop[1].mtx_ctx0 = m;
+      rep.loop[1].mtx_ctx1 = held;
+      rep.loop[1].stk[0] = 0;
+      rep.loop[1].stk[1] = reverse->stk;
+      ReportDeadlock(thr, &rep);
+    }
+  }
+  if (thr->nheld < kMaxHeldLocks)
+    thr->held[thr->nheld] = m;
+  thr->nheld++;
+}
+
+static void SampledBeforeUnlock(Thread *thr, uptr m) {
+  if (thr->nheld == 0)
+    return;
+  // Locks are mostly released in the reverse order of their acquisition.
+  uptr n = Min(thr->nheld, kMaxHeldLocks);
+  for (uptr i = n; i > 0; i--) {
+    if (thr->held[i - 1] == m) {
+      internal_memmove(&thr->held[i - 1], &thr->held[i],
+                       (n - i) * sizeof(thr->held[0]));
+      thr->nheld--;
+      return;
+    }
+  }
+  // The lock was acquired while more than kMaxHeldLocks were held.
+  if (thr->nheld > kMaxHeldLocks)
+    thr->nheld--;
+}
+
+// Forgets the edges of a destroyed mutex, whose address may be reused.
+static void SampledDestroy(uptr m) {
+  if (!atomic_load(EdgeMutexFlag(m), memory_order_relaxed))
+    return;
+  for (uptr i = 0; i < kMaxEdges; i++) {
+    LockEdge *e = &ctx->edges[i];
+    uptr to = atomic_load(&e->to, memory_order_acquire);
+    if (to == m || (to != 0 && atomic_load(&e->from, memory_order_relaxed) == m))
+      atomic_store(&e->to, kDestroyedMutex, memory_order_relaxed);
+  }
+}
+
 void MutexBeforeLock(Thread *thr, uptr m, bool writelock) {
-  if (thr->ignore_interceptors)
+  if (thr->ignore_interceptors || !ctx->dd)
     return;
   Callback cb(thr);
   {
@@ -125,6 +275,10 @@ void MutexBeforeLock(Thread *thr, uptr m, bool writelock) {
 void MutexAfterLock(Thread *thr, uptr m, bool writelock, bool trylock) {
   if (thr->ignore_interceptors)
     return;
+  if (!ctx->dd) {
+    SampledAfterLock(thr, m, trylock);
+    return;
+  }
   Callback cb(thr);
   {
     MutexHashMap::Handle h(&ctx->mutex_map, m);
@@ -138,6 +292,10 @@ void MutexAfterLock(Thread *thr, uptr m, bool writelock, bool trylock) {
 void MutexBeforeUnlock(Thread *thr, uptr m, bool writelock) {
   if (thr->ignore_interceptors)
     return;
+  if (!ctx->dd) {
+    SampledBeforeUnlock(thr, m);
+    return;
+  }
   Callback cb(thr);
   {
     MutexHashMap::Handle h(&ctx->mutex_map, m);
@@ -149,6 +307,10 @@ void MutexBeforeUnlock(Thread *thr, uptr m, bool writelock) {
 void MutexDestroy(Thread *thr, uptr m) {
   if (thr->ignore_interceptors)
     return;
+  if (!ctx->dd) {
+    SampledDestroy(m);
+    return;
+  }
   Callback cb(thr);
   MutexHashMap::Handle h(&ctx->mutex_map, m, true);
   if (!h.exists())
@@ -18,17 +18,32 @@
 
 namespace __dsan {
 
-typedef DDFlags Flags;
+struct Flags : DDFlags {
+  // If positive, the deadlock detector is replaced with a cheaper sampling
+  // one: only one in sample_period lock acquisitions of each thread records
+  // the lock-order edges from the locks the thread holds, and only inversions
+  // between two locks are reported.
+  int sample_period;
+};
 
 struct Mutex {
   DDMutex dd;
 };
 
+// Maximum number of locks held by a thread that the sampling mode tracks.
+const uptr kMaxHeldLocks = 16;
+
 struct Thread {
   DDPhysicalThread *dd_pt;
   DDLogicalThread *dd_lt;
 
   bool ignore_interceptors;
+
+  // Sampling mode state.
+  u32 id;
+  u32 sample_countdown;
+  uptr nheld;
+  uptr held[kMaxHeldLocks];
 };
 
 struct Callback : DDCallback {
@@ -40,11 +55,27 @@ struct Callback : DDCallback {
 
 typedef AddrHashMap<Mutex, 31051> MutexHashMap;
 
+// A lock-order edge recorded by the sampling mode: a thread (tid) acquired
+// mutex |to| at stack stk while holding mutex |from|. Slots are claimed by
+// setting |from|, and become visible once |to| is published.
+struct LockEdge {
+  atomic_uintptr_t from;
+  atomic_uintptr_t to;
+  u32 stk;
+  u32 tid;
+};
+
 struct Context {
   DDetector *dd;
 
   BlockingMutex report_mutex;
   MutexHashMap mutex_map;
+
+  // Sampling mode lock-order graph, a lock-free open addressing table of
+  // edges, and a filter of the mutexes which appear in an edge.
+  LockEdge *edges;
+  atomic_uint8_t *edge_mutexes;
+  atomic_uintptr_t edges_dropped;
 };
 
 inline Flags* flags() {
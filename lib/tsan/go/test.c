@@ -25,6 +25,8 @@ void __tsan_proc_wire(void *proc, void *thr);
 void __tsan_proc_unwire(void *proc, void *thr);
 void __tsan_read(void *thr, void *addr, void *pc);
 void __tsan_write(void *thr, void *addr, void *pc);
+void __tsan_read_range_batch(void *thr, void *accesses, unsigned long n);
+void __tsan_write_range_batch(void *thr, void *accesses, unsigned long n);
 void __tsan_func_enter(void *thr, void *pc);
 void __tsan_func_exit(void *thr);
 void __tsan_malloc(void *thr, void *pc, void *p, unsigned long sz);
@@ -46,6 +48,12 @@ void symbolize_cb(long cmd, void *ctx) {
 
 char buf0[100<<10];
 
+struct range_access {
+  void *addr;
+  unsigned long size;
+  void *pc;
+};
+
 void foobar() {}
 void barfoo() {}
 
@@ -79,9 +87,18 @@ int main(void) {
   current_proc = proc1;
   __tsan_func_enter(thr2, (char*)&foobar + 1);
   __tsan_read(thr2, buf, (char*)&barfoo + 1);
+  struct range_access accesses[2] = {
+    {buf + 16, 8, (char*)&barfoo + 1},
+    {buf + 32, 16, (char*)&barfoo + 1},
+  };
+  __tsan_read_range_batch(thr2, accesses, 2);
+  __tsan_write_range_batch(thr2, accesses, 2);
   __tsan_free(buf, 10);
   __tsan_func_exit(thr2);
   __tsan_go_end(thr2);
+  void *thr3 = 0;
+  __tsan_go_start(thr0, &thr3, (char*)&barfoo + 1);
+  __tsan_go_end(thr3);
   __tsan_proc_destroy(proc1);
   current_proc = proc0;
   __tsan_fini();
@@ -129,15 +129,52 @@ Processor *ThreadState::proc() {
   return get_cur_proc();
 }
 
-extern "C" {
+// ThreadState is large, and programs create and finish lots of goroutines,
+// so keep a bounded pool of finished goroutine states instead of returning
+// them to the internal allocator (which mmaps/munmaps blocks of this size).
+static const uptr kGoroutinePoolSize = 64;
+static StaticSpinMutex goroutine_pool_mtx;
+static void *goroutine_pool;  // Linked through the first word.
+static uptr goroutine_pool_size;
 
 static ThreadState *AllocGoroutine() {
-  ThreadState *thr = (ThreadState*)internal_alloc(MBlockThreadContex,
-      sizeof(ThreadState));
+  ThreadState *thr = 0;
+  {
+    SpinMutexLock l(&goroutine_pool_mtx);
+    if (goroutine_pool) {
+      thr = (ThreadState*)goroutine_pool;
+      goroutine_pool = *(void**)goroutine_pool;
+      goroutine_pool_size--;
+    }
+  }
+  if (thr == 0)
+    thr = (ThreadState*)internal_alloc(MBlockThreadContex, sizeof(ThreadState));
   internal_memset(thr, 0, sizeof(*thr));
   return thr;
 }
 
+static void FreeGoroutine(ThreadState *thr) {
+  {
+    SpinMutexLock l(&goroutine_pool_mtx);
+    if (goroutine_pool_size < kGoroutinePoolSize) {
+      *(void**)thr = goroutine_pool;
+      goroutine_pool = thr;
+      goroutine_pool_size++;
+      return;
+    }
+  }
+  internal_free(thr);
+}
+
+// A memory range access passed in batches, see __tsan_read_range_batch.
+struct GoRangeAccess {
+  uptr addr;
+  uptr size;
+  uptr pc;
+};
+
+extern "C" {
+
 void __tsan_init(ThreadState **thrp, Processor **procp,
                  void (*cb)(uptr cmd, void *cb)) {
   go_runtime_cb = cb;
@@ -191,6 +228,22 @@ void __tsan_write_range(ThreadState *thr, void *addr, uptr size, uptr pc) {
   MemoryAccessRange(thr, (uptr)pc, (uptr)addr, size, true);
 }
 
+// The batch versions let the Go runtime report all range accesses of an
+// operation (e.g. a slice copy or a channel op) in a single call.
+void __tsan_read_range_batch(ThreadState *thr, const GoRangeAccess *accesses,
+                             uptr n) {
+  for (uptr i = 0; i < n; i++)
+    MemoryAccessRange(thr, accesses[i].pc, accesses[i].addr, accesses[i].size,
+                      false);
+}
+
+void __tsan_write_range_batch(ThreadState *thr, const GoRangeAccess *accesses,
+                              uptr n) {
+  for (uptr i = 0; i < n; i++)
+    MemoryAccessRange(thr, accesses[i].pc, accesses[i].addr, accesses[i].size,
+                      true);
+}
+
 void __tsan_func_enter(ThreadState *thr, void *pc) {
   FuncEntry(thr, (uptr)pc);
 }
@@ -219,7 +272,7 @@ void __tsan_go_start(ThreadState *parent, ThreadState **pthr, void *pc) {
 
 void __tsan_go_end(ThreadState *thr) {
   ThreadFinish(thr);
-  internal_free(thr);
+  FreeGoroutine(thr);
 }
 
 void __tsan_proc_create(Processor **pproc) {
@@ -52,6 +52,9 @@
 // 3. Leaf mutex (unlock is O(1)).
 // 4. A mutex shared by 2 threads (both lock and unlock can be O(1)).
 // 5. An atomic with a single writer (writes can be O(1)).
+// 6. Lots of threads, but only few of them communicate recently (release and
+//    repeated acquire are proportional to the number of recently changed
+//    groups of elements rather than to the number of threads).
 // The implementation dynamically adopts to workload. So if an atomic is in
 // read-only phase, these reads will be O(1); if it later switches to read/write
 // phase, the implementation will correctly handle that by switching to O(N).
@@ -67,6 +70,11 @@
 // tid_ - index of the thread associated with he clock ("current thread").
 // last_acquire_ - current thread time when it acquired something from
 //   other threads.
+// block_acquire_ - the same per group of ClockBlock::kClockCount elements
+//   (plus 1, 0 means that the group has never been changed). A sync clock
+//   contains everything the thread had at the time recorded in the thread's
+//   element of the sync clock, so release needs to look only at the groups
+//   that have changed since then.
 //
 // Description of SyncClock state:
 // clk_ - variable size vector clock, low kClkBits hold timestamp,
@@ -76,9 +84,23 @@
 //   acquired this clock (except possibly dirty_tids_).
 // dirty_tids_ - holds up to two indeces in the vector clock that other threads
 //   need to acquire regardless of "acquired" flag value;
+// dirty_blocks_ - the same for up to four groups of ClockBlock::kClockCount
+//   elements; only when they overflow all "acquired" flags are reset;
 // release_store_tid_ - denotes that the clock state is a result of
 //   release-store operation by the thread with release_store_tid_ index.
 // release_store_reused_ - reuse count of release_store_tid_.
+//
+// Sharing of clock blocks:
+// Full release-store copies the whole thread clock into the sync clock, so
+// e.g. channel-heavy programs end up with lots of sync clocks that contain
+// the same groups of elements. To avoid that, a thread keeps a read-only copy
+// of every group of its clock (cached_block_) while the group does not change
+// and links it into second level tables of the sync clocks instead of copying
+// the elements. Shared blocks are marked with kSharedBlock in the first level
+// table and are reference counted in ctx->clock_refs. All modifications of
+// a shared block (done under the exclusive lock) first copy it; acquire does
+// not mark shared blocks as acquired (they are copied lazily by the next
+// release), thus the repeated acquire after a sharing release-store is O(N).
 
 // We don't have ThreadState in these methods, so this is an ugly hack that
 // works only in C++.
@@ -97,6 +119,9 @@ ThreadClock::ThreadClock(unsigned tid, unsigned reused)
   CHECK_EQ(reused_, ((u64)reused_ << kClkBits) >> kClkBits);
   nclk_ = tid_ + 1;
   last_acquire_ = 0;
+  internal_memset(block_acquire_, 0, sizeof(block_acquire_));
+  internal_memset(cached_block_, 0, sizeof(cached_block_));
+  internal_memset(cached_valid_, 0, sizeof(cached_valid_));
   internal_memset(clk_, 0, sizeof(clk_));
   clk_[tid_].reused = reused_;
 }
@@ -121,13 +146,17 @@ void ThreadClock::acquire(ClockCache *c, const SyncClock *src) {
       CPP_STAT_INC(StatClockAcquireRepeat);
       for (unsigned i = 0; i < kDirtyTids; i++) {
         unsigned tid = src->dirty_tids_[i];
-        if (tid != kInvalidTid) {
-          u64 epoch = src->elem(tid).epoch;
-          if (clk_[tid].epoch < epoch) {
-            clk_[tid].epoch = epoch;
-            acquired = true;
-          }
-        }
+        if (tid != kInvalidTid)
+          acquired |= AcquireElem(tid, src->elem(tid).epoch);
+      }
+      for (unsigned i = 0; i < kDirtyBlocks; i++) {
+        uptr block = src->dirty_blocks_[i];
+        if (block == SyncClock::kInvalidBlock)
+          continue;
+        CPP_STAT_INC(StatClockAcquireDirtyBlock);
+        const uptr end = min(nclk, (block + 1) * ClockBlock::kClockCount);
+        for (uptr tid = block * ClockBlock::kClockCount; tid < end; tid++)
+          acquired |= AcquireElem(tid, src->elem(tid).epoch);
       }
       if (acquired) {
         CPP_STAT_INC(StatClockAcquiredSomething);
@@ -140,16 +169,12 @@ void ThreadClock::acquire(ClockCache *c, const SyncClock *src) {
   // O(N) acquire.
   CPP_STAT_INC(StatClockAcquireFull);
   nclk_ = max(nclk_, nclk);
-  for (uptr i = 0; i < nclk; i++) {
-    u64 epoch = src->elem(i).epoch;
-    if (clk_[i].epoch < epoch) {
-      clk_[i].epoch = epoch;
-      acquired = true;
-    }
-  }
+  for (uptr i = 0; i < nclk; i++)
+    acquired |= AcquireElem(i, src->elem(i).epoch);
 
   // Remember that this thread has acquired this clock.
-  if (nclk > tid_)
+  // Shared blocks are read-only, so we can't do it for them.
+  if (nclk > tid_ && !src->IsShared(tid_ / ClockBlock::kClockCount))
     src->elem(tid_).reused = reused_;
 
   if (acquired) {
@@ -161,6 +186,7 @@ void ThreadClock::acquire(ClockCache *c, const SyncClock *src) {
 void ThreadClock::release(ClockCache *c, SyncClock *dst) const {
   DCHECK_LE(nclk_, kMaxTid);
   DCHECK_LE(dst->size_, kMaxTid);
+  dst->BumpVersion();
 
   if (dst->size_ == 0) {
     // ReleaseStore will correctly set release_store_tid_,
@@ -178,34 +204,25 @@ void ThreadClock::release(ClockCache *c, SyncClock *dst) const {
   // since the last release on dst. If so, we need to update
   // only dst->elem(tid_).
   if (dst->elem(tid_).epoch > last_acquire_) {
-    UpdateCurrentThread(dst);
+    UpdateCurrentThread(c, dst);
     if (dst->release_store_tid_ != tid_ ||
         dst->release_store_reused_ != reused_)
       dst->release_store_tid_ = kInvalidTid;
     return;
   }
 
-  // O(N) release.
   CPP_STAT_INC(StatClockReleaseFull);
   // First, remember whether we've acquired dst.
   bool acquired = IsAlreadyAcquired(dst);
   if (acquired)
     CPP_STAT_INC(StatClockReleaseAcquired);
-  // Update dst->clk_.
-  for (uptr i = 0; i < nclk_; i++) {
-    ClockElem &ce = dst->elem(i);
-    ce.epoch = max(ce.epoch, clk_[i].epoch);
-    ce.reused = 0;
-  }
-  // Clear 'acquired' flag in the remaining elements.
-  if (nclk_ < dst->size_)
-    CPP_STAT_INC(StatClockReleaseClearTail);
-  for (uptr i = nclk_; i < dst->size_; i++)
-    dst->elem(i).reused = 0;
-  for (unsigned i = 0; i < kDirtyTids; i++)
-    dst->dirty_tids_[i] = kInvalidTid;
-  dst->release_store_tid_ = kInvalidTid;
-  dst->release_store_reused_ = 0;
+  // Update dst->clk_. This keeps the 'acquired' flags of other threads and
+  // makes the changed elements dirty instead.
+  ReleaseChangedBlocks(c, dst);
+  UpdateCurrentThread(c, dst);
+  if (dst->release_store_tid_ != tid_ ||
+      dst->release_store_reused_ != reused_)
+    dst->release_store_tid_ = kInvalidTid;
   // If we've acquired dst, remember this fact,
   // so that we don't need to acquire it on next acquire.
   if (acquired)
@@ -216,6 +233,7 @@ void ThreadClock::ReleaseStore(ClockCache *c, SyncClock *dst) const {
   DCHECK_LE(nclk_, kMaxTid);
   DCHECK_LE(dst->size_, kMaxTid);
   CPP_STAT_INC(StatClockStore);
+  dst->BumpVersion();
 
   // Check if we need to resize dst.
   if (dst->size_ < nclk_)
@@ -225,20 +243,49 @@ void ThreadClock::ReleaseStore(ClockCache *c, SyncClock *dst) const {
       dst->release_store_reused_ == reused_ &&
       dst->elem(tid_).epoch > last_acquire_) {
     CPP_STAT_INC(StatClockStoreFast);
-    UpdateCurrentThread(dst);
+    UpdateCurrentThread(c, dst);
+    return;
+  }
+
+  // If we've acquired dst, it has nothing that we don't have, so release-store
+  // is the same as release. This is the common case for mutex unlock.
+  // Small clocks are cheaper to just overwrite.
+  if (dst->size_ > ClockBlock::kClockCount && IsAlreadyAcquired(dst)) {
+    CPP_STAT_INC(StatClockStoreAcquired);
+    ReleaseChangedBlocks(c, dst);
+    UpdateCurrentThread(c, dst);
+    dst->release_store_tid_ = tid_;
+    dst->release_store_reused_ = reused_;
+    dst->elem(tid_).reused = reused_;
     return;
   }
 
   // O(N) release-store.
   CPP_STAT_INC(StatClockStoreFull);
-  for (uptr i = 0; i < nclk_; i++) {
-    ClockElem &ce = dst->elem(i);
-    ce.epoch = clk_[i].epoch;
-    ce.reused = 0;
+  // Blocks of a two-level table that do not contain the current thread
+  // are shared with the cached copies instead of being overwritten.
+  const uptr own = tid_ / ClockBlock::kClockCount;
+  const bool share = dst->size_ > ClockBlock::kClockCount;
+  for (uptr block = 0; block * ClockBlock::kClockCount < nclk_; block++) {
+    if (share && block != own) {
+      dst->SetShared(c, block, CachedBlock(c, block));
+      continue;
+    }
+    dst->Unshare(c, block);
+    const uptr end = min(nclk_, (block + 1) * ClockBlock::kClockCount);
+    for (uptr i = block * ClockBlock::kClockCount; i < end; i++) {
+      ClockElem &ce = dst->elem(i);
+      ce.epoch = clk_[i].epoch;
+      ce.reused = 0;
+    }
   }
-  // Clear the tail of dst->clk_.
+  // Clear the tail of dst->clk_. The cached blocks are already zero there.
   if (nclk_ < dst->size_) {
     for (uptr i = nclk_; i < dst->size_; i++) {
+      const uptr block = i / ClockBlock::kClockCount;
+      if (block * ClockBlock::kClockCount < nclk_ && dst->IsShared(block))
+        continue;
+      dst->Unshare(c, block);
       ClockElem &ce = dst->elem(i);
       ce.epoch = 0;
       ce.reused = 0;
@@ -247,6 +294,8 @@ void ThreadClock::ReleaseStore(ClockCache *c, SyncClock *dst) const {
   }
   for (unsigned i = 0; i < kDirtyTids; i++)
     dst->dirty_tids_[i] = kInvalidTid;
+  for (unsigned i = 0; i < kDirtyBlocks; i++)
+    dst->dirty_blocks_[i] = SyncClock::kInvalidBlock;
   dst->release_store_tid_ = tid_;
   dst->release_store_reused_ = reused_;
   // Rememeber that we don't need to acquire it in future.
@@ -260,8 +309,9 @@ void ThreadClock::acq_rel(ClockCache *c, SyncClock *dst) {
 }
 
 // Updates only single element related to the current thread in dst->clk_.
-void ThreadClock::UpdateCurrentThread(SyncClock *dst) const {
+void ThreadClock::UpdateCurrentThread(ClockCache *c, SyncClock *dst) const {
   // Update the threads time, but preserve 'acquired' flag.
+  dst->Unshare(c, tid_ / ClockBlock::kClockCount);
   dst->elem(tid_).epoch = clk_[tid_].epoch;
 
   for (unsigned i = 0; i < kDirtyTids; i++) {
@@ -275,12 +325,107 @@ void ThreadClock::UpdateCurrentThread(SyncClock *dst) const {
       return;
     }
   }
-  // Reset all 'acquired' flags, O(N).
+  // All dirty tids are taken, so make the whole group dirty.
+  MarkBlockDirty(dst, tid_ / ClockBlock::kClockCount);
+}
+
+// Merges into dst->clk_ the groups of elements that has changed since dst has
+// last seen the current thread, and marks the actually updated groups dirty.
+void ThreadClock::ReleaseChangedBlocks(ClockCache *c, SyncClock *dst) const {
+  const u64 seen = dst->elem(tid_).epoch;
+  for (uptr block = 0; block * ClockBlock::kClockCount < nclk_; block++) {
+    if (block_acquire_[block] <= seen)
+      continue;
+    CPP_STAT_INC(StatClockReleaseBlock);
+    bool changed = false;
+    const uptr end = min(nclk_, (block + 1) * ClockBlock::kClockCount);
+    for (uptr i = block * ClockBlock::kClockCount; i < end; i++) {
+      // The current thread is updated separately by UpdateCurrentThread.
+      if (i == tid_)
+        continue;
+      if (dst->elem(i).epoch < clk_[i].epoch) {
+        if (!changed)
+          dst->Unshare(c, block);
+        dst->elem(i).epoch = clk_[i].epoch;
+        changed = true;
+      }
+    }
+    if (changed)
+      MarkBlockDirty(dst, block);
+  }
+}
+
+void ThreadClock::MarkBlockDirty(SyncClock *dst, uptr block) const {
+  for (unsigned i = 0; i < kDirtyBlocks; i++) {
+    if (dst->dirty_blocks_[i] == block)
+      return;
+    if (dst->dirty_blocks_[i] == SyncClock::kInvalidBlock) {
+      dst->dirty_blocks_[i] = block;
+      return;
+    }
+  }
+  ResetAcquired(dst);
+}
+
+// Resets all 'acquired' flags, O(N).
+void ThreadClock::ResetAcquired(SyncClock *dst) const {
   CPP_STAT_INC(StatClockReleaseSlow);
-  for (uptr i = 0; i < dst->size_; i++)
+  for (uptr i = 0; i < dst->size_; i++) {
+    // Shared blocks are never marked as acquired.
+    if (dst->IsShared(i / ClockBlock::kClockCount))
+      continue;
     dst->elem(i).reused = 0;
+  }
   for (unsigned i = 0; i < kDirtyTids; i++)
     dst->dirty_tids_[i] = kInvalidTid;
+  for (unsigned i = 0; i < kDirtyBlocks; i++)
+    dst->dirty_blocks_[i] = SyncClock::kInvalidBlock;
+}
+
+// Acquires a single element, returns whether it has changed.
+bool ThreadClock::AcquireElem(unsigned tid, u64 epoch) {
+  if (clk_[tid].epoch >= epoch)
+    return false;
+  clk_[tid].epoch = epoch;
+  block_acquire_[tid / ClockBlock::kClockCount] = clk_[tid_].epoch + 1;
+  cached_valid_[tid / ClockBlock::kClockCount] = false;
+  if (nclk_ <= tid)
+    nclk_ = tid + 1;
+  return true;
+}
+
+static void UnrefBlock(ClockCache *c, u32 idx) {
+  if (ctx->clock_refs.Unref(idx))
+    ctx->clock_alloc.Free(c, idx);
+}
+
+// Returns an up-to-date read-only copy of the block-th group of elements,
+// the caller must take its own reference to it.
+u32 ThreadClock::CachedBlock(ClockCache *c, uptr block) const {
+  if (cached_valid_[block])
+    return cached_block_[block];
+  CPP_STAT_INC(StatClockStoreCache);
+  if (cached_block_[block])
+    UnrefBlock(c, cached_block_[block]);
+  u32 idx = ctx->clock_alloc.Alloc(c);
+  ClockBlock *cb = ctx->clock_alloc.Map(idx);
+  for (uptr i = 0; i < ClockBlock::kClockCount; i++) {
+    cb->clock[i].epoch = clk_[block * ClockBlock::kClockCount + i].epoch;
+    cb->clock[i].reused = 0;
+  }
+  ctx->clock_refs.Init(idx);
+  cached_block_[block] = idx;
+  cached_valid_[block] = true;
+  return idx;
+}
+
+void ThreadClock::ResetCached(ClockCache *c) {
+  for (uptr i = 0; i < kBlocks; i++) {
+    if (cached_block_[i])
+      UnrefBlock(c, cached_block_[i]);
+    cached_block_[i] = 0;
+    cached_valid_[i] = false;
+  }
 }
 
 // Checks whether the current threads has already acquired src.
@@ -294,6 +439,17 @@ bool ThreadClock::IsAlreadyAcquired(const SyncClock *src) const {
         return false;
     }
   }
+  for (unsigned i = 0; i < kDirtyBlocks; i++) {
+    uptr block = src->dirty_blocks_[i];
+    if (block == SyncClock::kInvalidBlock)
+      continue;
+    const uptr end = min<uptr>(src->size_,
+                               (block + 1) * ClockBlock::kClockCount);
+    for (uptr tid = block * ClockBlock::kClockCount; tid < end; tid++) {
+      if (clk_[tid].epoch < src->elem(tid).epoch)
+        return false;
+    }
+  }
   return true;
 }
 
@@ -353,6 +509,8 @@ void ThreadClock::set(unsigned tid, u64 v) {
   if (nclk_ <= tid)
     nclk_ = tid + 1;
   last_acquire_ = clk_[tid_].epoch;
+  block_acquire_[tid / ClockBlock::kClockCount] = last_acquire_ + 1;
+  cached_valid_[tid / ClockBlock::kClockCount] = false;
 }
 
 void ThreadClock::DebugDump(int(*printf)(const char *s, ...)) {
@@ -374,6 +532,9 @@ SyncClock::SyncClock()
     , size_() {
   for (uptr i = 0; i < kDirtyTids; i++)
     dirty_tids_[i] = kInvalidTid;
+  for (uptr i = 0; i < kDirtyBlocks; i++)
+    dirty_blocks_[i] = kInvalidBlock;
+  atomic_store(&version_, 0, memory_order_relaxed);
 }
 
 SyncClock::~SyncClock() {
@@ -383,7 +544,14 @@ SyncClock::~SyncClock() {
   CHECK_EQ(tab_idx_, 0);
 }
 
+// Called under the exclusive lock, so a plain increment is enough.
+void SyncClock::BumpVersion() {
+  atomic_store(&version_, atomic_load(&version_, memory_order_relaxed) + 1,
+               memory_order_release);
+}
+
 void SyncClock::Reset(ClockCache *c) {
+  BumpVersion();
   if (size_ == 0) {
     // nothing
   } else if (size_ <= ClockBlock::kClockCount) {
@@ -391,8 +559,13 @@ void SyncClock::Reset(ClockCache *c) {
     ctx->clock_alloc.Free(c, tab_idx_);
   } else {
     // Two-level table.
-    for (uptr i = 0; i < size_; i += ClockBlock::kClockCount)
-      ctx->clock_alloc.Free(c, tab_->table[i / ClockBlock::kClockCount]);
+    for (uptr i = 0; i < size_; i += ClockBlock::kClockCount) {
+      u32 idx = tab_->table[i / ClockBlock::kClockCount];
+      if (idx & kSharedBlock)
+        UnrefBlock(c, idx & ~kSharedBlock);
+      else
+        ctx->clock_alloc.Free(c, idx);
+    }
     ctx->clock_alloc.Free(c, tab_idx_);
   }
   tab_ = 0;
@@ -402,17 +575,85 @@ void SyncClock::Reset(ClockCache *c) {
   release_store_reused_ = 0;
   for (uptr i = 0; i < kDirtyTids; i++)
     dirty_tids_[i] = kInvalidTid;
+  for (uptr i = 0; i < kDirtyBlocks; i++)
+    dirty_blocks_[i] = kInvalidBlock;
 }
 
 ClockElem &SyncClock::elem(unsigned tid) const {
   DCHECK_LT(tid, size_);
   if (size_ <= ClockBlock::kClockCount)
     return tab_->clock[tid];
-  u32 idx = tab_->table[tid / ClockBlock::kClockCount];
+  u32 idx = tab_->table[tid / ClockBlock::kClockCount] & ~kSharedBlock;
   ClockBlock *cb = ctx->clock_alloc.Map(idx);
   return cb->clock[tid % ClockBlock::kClockCount];
 }
 
+bool SyncClock::IsShared(uptr block) const {
+  return size_ > ClockBlock::kClockCount &&
+      (tab_->table[block] & kSharedBlock);
+}
+
+// Replaces a shared block with a private copy, so that it can be modified.
+void SyncClock::Unshare(ClockCache *c, uptr block) {
+  if (!IsShared(block))
+    return;
+  CPP_STAT_INC(StatClockUnshare);
+  u32 old = tab_->table[block] & ~kSharedBlock;
+  u32 idx = ctx->clock_alloc.Alloc(c);
+  internal_memcpy(ctx->clock_alloc.Map(idx), ctx->clock_alloc.Map(old),
+                  sizeof(ClockBlock));
+  tab_->table[block] = idx;
+  UnrefBlock(c, old);
+}
+
+// Replaces a block of a two-level table with the shared block idx.
+void SyncClock::SetShared(ClockCache *c, uptr block, u32 idx) {
+  u32 old = tab_->table[block];
+  if (old == (idx | kSharedBlock))
+    return;
+  CPP_STAT_INC(StatClockStoreShared);
+  ctx->clock_refs.Ref(idx);
+  tab_->table[block] = idx | kSharedBlock;
+  if (old & kSharedBlock)
+    UnrefBlock(c, old & ~kSharedBlock);
+  else
+    ctx->clock_alloc.Free(c, old);
+}
+
+ClockRefs::ClockRefs() {
+  internal_memset(map_, 0, sizeof(map_));
+}
+
+atomic_uint32_t *ClockRefs::Get(u32 idx) {
+  atomic_uint32_t *refs =
+      (atomic_uint32_t*)atomic_load(&map_[idx / kL2Size], memory_order_acquire);
+  if (refs == 0) {
+    SpinMutexLock lock(&mtx_);
+    refs = (atomic_uint32_t*)atomic_load(&map_[idx / kL2Size],
+                                         memory_order_relaxed);
+    if (refs == 0) {
+      refs = (atomic_uint32_t*)MmapOrDie(kL2Size * sizeof(refs[0]),
+                                         "ClockRefs");
+      atomic_store(&map_[idx / kL2Size], (uptr)refs, memory_order_release);
+    }
+  }
+  return &refs[idx % kL2Size];
+}
+
+void ClockRefs::Init(u32 idx) {
+  atomic_store(Get(idx), 1, memory_order_relaxed);
+}
+
+void ClockRefs::Ref(u32 idx) {
+  atomic_fetch_add(Get(idx), 1, memory_order_relaxed);
+}
+
+bool ClockRefs::Unref(u32 idx) {
+  u32 v = atomic_fetch_sub(Get(idx), 1, memory_order_acq_rel);
+  DCHECK_GT(v, 0);
+  return v == 1;
+}
+
 void SyncClock::DebugDump(int(*printf)(const char *s, ...)) {
   printf("clock=[");
   for (uptr i = 0; i < size_; i++)
@@ -420,8 +661,10 @@ void SyncClock::DebugDump(int(*printf)(const char *s, ...)) {
   printf("] reused=[");
   for (uptr i = 0; i < size_; i++)
     printf("%s%llu", i == 0 ? "" : ",", elem(i).reused);
-  printf("] release_store_tid=%d/%d dirty_tids=%d/%d",
+  printf("] release_store_tid=%d/%d dirty_tids=%d/%d dirty_blocks=",
       release_store_tid_, release_store_reused_,
       dirty_tids_[0], dirty_tids_[1]);
+  for (uptr i = 0; i < kDirtyBlocks; i++)
+    printf("%s%d", i == 0 ? "" : "/", (int)(s16)dirty_blocks_[i]);
 }
 }  // namespace __tsan
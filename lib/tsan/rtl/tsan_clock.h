@@ -40,6 +40,27 @@ struct ClockBlock {
 typedef DenseSlabAlloc<ClockBlock, 1<<16, 1<<10> ClockAlloc;
 typedef DenseSlabAllocCache ClockCache;
 
+// Reference counters for clock blocks that are shared between several clocks
+// (see ThreadClock::ReleaseStore). The counters are indexed by ClockAlloc
+// index and are mapped lazily, so blocks that are never shared cost nothing.
+class ClockRefs {
+ public:
+  ClockRefs();
+
+  void Init(u32 idx);
+  void Ref(u32 idx);
+  // Returns true if the last reference has been dropped.
+  bool Unref(u32 idx);
+
+ private:
+  static const uptr kL1Size = 1 << 16;
+  static const uptr kL2Size = 1 << 10;
+  atomic_uintptr_t map_[kL1Size];
+  SpinMutex mtx_;
+
+  atomic_uint32_t *Get(u32 idx);
+};
+
 // The clock that lives in sync variables (mutexes, atomics, etc).
 class SyncClock {
  public:
@@ -57,15 +78,30 @@ class SyncClock {
   void Resize(ClockCache *c, uptr nclk);
   void Reset(ClockCache *c);
 
+  // Changes on every operation that can modify the clock, so a thread that
+  // remembers the version it has acquired can skip a repeated acquire
+  // without looking at (and locking) the clock.
+  u32 version() const {
+    return atomic_load(&version_, memory_order_acquire);
+  }
+
   void DebugDump(int(*printf)(const char *s, ...));
 
  private:
   friend struct ThreadClock;
   static const uptr kDirtyTids = 2;
+  static const uptr kDirtyBlocks = 4;
+  static const u16 kInvalidBlock = (u16)-1;
+  // Set in the first level table for second level blocks that are shared
+  // with other clocks. Such blocks are read-only and are copied on write.
+  static const u32 kSharedBlock = 1u << 31;
 
   unsigned release_store_tid_;
   unsigned release_store_reused_;
   unsigned dirty_tids_[kDirtyTids];
+  // Indices of groups of ClockBlock::kClockCount elements that other threads
+  // need to acquire regardless of "acquired" flag value.
+  u16 dirty_blocks_[kDirtyBlocks];
   // tab_ contains indirect pointer to a 512b block using DenseSlabAlloc.
   // If size_ <= 64, then tab_ points to an array with 64 ClockElem's.
   // Otherwise, tab_ points to an array with 128 u32 elements,
@@ -73,7 +109,12 @@ class SyncClock {
   ClockBlock *tab_;
   u32 tab_idx_;
   u32 size_;
+  atomic_uint32_t version_;
 
+  void BumpVersion();
+  bool IsShared(uptr block) const;
+  void Unshare(ClockCache *c, uptr block);
+  void SetShared(ClockCache *c, uptr block, u32 idx);
   ClockElem &elem(unsigned tid) const;
 };
 
@@ -108,20 +149,38 @@ struct ThreadClock {
   void release(ClockCache *c, SyncClock *dst) const;
   void acq_rel(ClockCache *c, SyncClock *dst);
   void ReleaseStore(ClockCache *c, SyncClock *dst) const;
+  // Drops the blocks cached for sharing, must be called before the clock
+  // goes away.
+  void ResetCached(ClockCache *c);
 
   void DebugReset();
   void DebugDump(int(*printf)(const char *s, ...));
 
  private:
   static const uptr kDirtyTids = SyncClock::kDirtyTids;
+  static const uptr kDirtyBlocks = SyncClock::kDirtyBlocks;
+  static const uptr kBlocks = kMaxTidInClock / ClockBlock::kClockCount;
   const unsigned tid_;
   const unsigned reused_;
   u64 last_acquire_;
   uptr nclk_;
+  // For every group of ClockBlock::kClockCount elements: 1 + current thread
+  // time when an element of the group was last changed by acquire, or 0.
+  u64 block_acquire_[kBlocks];
+  // For every group of elements: a read-only copy of the group that
+  // release-store shares between sync clocks instead of copying the elements
+  // into each of them, and whether the copy is still up-to-date.
+  mutable u32 cached_block_[kBlocks];
+  mutable bool cached_valid_[kBlocks];
   ClockElem clk_[kMaxTidInClock];
 
+  bool AcquireElem(unsigned tid, u64 epoch);
   bool IsAlreadyAcquired(const SyncClock *src) const;
-  void UpdateCurrentThread(SyncClock *dst) const;
+  u32 CachedBlock(ClockCache *c, uptr block) const;
+  void UpdateCurrentThread(ClockCache *c, SyncClock *dst) const;
+  void ReleaseChangedBlocks(ClockCache *c, SyncClock *dst) const;
+  void MarkBlockDirty(SyncClock *dst, uptr block) const;
+  void ResetAcquired(SyncClock *dst) const;
 };
 
 }  // namespace __tsan
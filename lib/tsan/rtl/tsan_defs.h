@@ -28,6 +28,10 @@
 # define TSAN_COLLECT_STATS 0
 #endif
 
+#ifndef TSAN_SHADOW_COUNT
+# define TSAN_SHADOW_COUNT 4
+#endif
+
 #ifndef TSAN_CONTAINS_UBSAN
 # if CAN_SANITIZE_UB && !SANITIZER_GO
 #  define TSAN_CONTAINS_UBSAN 1
@@ -50,7 +54,13 @@ const unsigned kMaxTidReuse = (1 << (64 - kClkBits)) - 1;
 const uptr kShadowStackSize = 64 * 1024;
 
 // Count of shadow values in a shadow cell.
-const uptr kShadowCnt = 4;
+// Fewer values halve shadow memory consumption, but keep shorter history of
+// accesses to each cell, so more races can be missed. The shadow memory
+// layouts in tsan_platform.h have room for at most 4 values.
+#if TSAN_SHADOW_COUNT != 2 && TSAN_SHADOW_COUNT != 4
+# error "TSAN_SHADOW_COUNT must be 2 or 4"
+#endif
+const uptr kShadowCnt = TSAN_SHADOW_COUNT;
 
 // That many user bytes are mapped onto a single shadow cell.
 const uptr kShadowCell = 8;
@@ -91,6 +101,12 @@ void build_consistency_stats();
 void build_consistency_nostats();
 #endif
 
+#if TSAN_SHADOW_COUNT == 2
+void build_consistency_shadow2();
+#else
+void build_consistency_shadow4();
+#endif
+
 static inline void USED build_consistency() {
 #if SANITIZER_DEBUG
   build_consistency_debug();
@@ -102,6 +118,11 @@ static inline void USED build_consistency() {
 #else
   build_consistency_nostats();
 #endif
+#if TSAN_SHADOW_COUNT == 2
+  build_consistency_shadow2();
+#else
+  build_consistency_shadow4();
+#endif
 }
 
 template<typename T>
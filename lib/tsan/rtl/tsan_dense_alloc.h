@@ -77,6 +77,12 @@ class DenseSlabAlloc {
     return &map_[idx / kL2Size][idx % kL2Size];
   }
 
+  // The number of objects in the mapped slabs, allocated or not. May be read
+  // without the mutex, for statistics.
+  uptr Capacity() const {
+    return fillpos_ * kL2Size;
+  }
+
   void FlushCache(Cache *c) {
     SpinMutexLock lock(&mtx_);
     while (c->pos) {
@@ -23,6 +23,14 @@ const int kTableSize = kTableSizeL1 * kTableSizeL2;
 
 struct FdSync {
   atomic_uint64_t rc;
+  // Number of releases done on the sync. The upper half is a per-allocation
+  // generation, so that a sync reallocated at the same address does not
+  // match a stale value in acquired.
+  atomic_uint64_t seq;
+  // Last thread that acquired the sync and the seq it acquired at, see
+  // PackAcquired. If the same thread acquires again and seq is unchanged,
+  // the acquire would not bring anything new and is skipped.
+  atomic_uint64_t acquired;
 };
 
 struct FdDesc {
@@ -38,6 +46,7 @@ struct FdContext {
   FdSync filesync;
   FdSync socksync;
   u64 connectsync;
+  atomic_uint32_t syncgen;
 };
 
 static FdContext fdctx;
@@ -51,9 +60,23 @@ static FdSync *allocsync(ThreadState *thr, uptr pc) {
   FdSync *s = (FdSync*)user_alloc(thr, pc, sizeof(FdSync), kDefaultAlignment,
       false);
   atomic_store(&s->rc, 1, memory_order_relaxed);
+  u64 gen = atomic_fetch_add(&fdctx.syncgen, 1, memory_order_relaxed);
+  atomic_store(&s->seq, gen << 32, memory_order_relaxed);
+  atomic_store(&s->acquired, (u64)-1, memory_order_relaxed);
   return s;
 }
 
+// Uses unique_id rather than tid, because tids are reused by new threads.
+static u64 PackAcquired(ThreadState *thr, u64 seq) {
+  return (seq << 24) | ((u32)thr->unique_id & 0xffffff);
+}
+
+static FdSync *newsocksync(ThreadState *thr, uptr pc) {
+  if (flags()->io_sync_socket_per_fd)
+    return allocsync(thr, pc);
+  return &fdctx.socksync;
+}
+
 static FdSync *ref(FdSync *s) {
   if (s && atomic_load(&s->rc, memory_order_relaxed) != (u64)-1)
     atomic_fetch_add(&s->rc, 1, memory_order_relaxed);
@@ -123,6 +146,9 @@ void FdInit() {
   atomic_store(&fdctx.globsync.rc, (u64)-1, memory_order_relaxed);
   atomic_store(&fdctx.filesync.rc, (u64)-1, memory_order_relaxed);
   atomic_store(&fdctx.socksync.rc, (u64)-1, memory_order_relaxed);
+  atomic_store(&fdctx.globsync.acquired, (u64)-1, memory_order_relaxed);
+  atomic_store(&fdctx.filesync.acquired, (u64)-1, memory_order_relaxed);
+  atomic_store(&fdctx.socksync.acquired, (u64)-1, memory_order_relaxed);
 }
 
 void FdOnFork(ThreadState *thr, uptr pc) {
@@ -164,8 +190,15 @@ void FdAcquire(ThreadState *thr, uptr pc, int fd) {
   FdSync *s = d->sync;
   DPrintf("#%d: FdAcquire(%d) -> %p\n", thr->tid, fd, s);
   MemoryRead(thr, pc, (uptr)d, kSizeLog8);
-  if (s)
-    Acquire(thr, pc, (uptr)s);
+  if (s == 0)
+    return;
+  // Servers do several reads per write on the same connection, so avoid
+  // the sync object lookup when nobody released since our last acquire.
+  u64 acquired = PackAcquired(thr, atomic_load(&s->seq, memory_order_acquire));
+  if (atomic_load(&s->acquired, memory_order_relaxed) == acquired)
+    return;
+  Acquire(thr, pc, (uptr)s);
+  atomic_store(&s->acquired, acquired, memory_order_relaxed);
 }
 
 void FdRelease(ThreadState *thr, uptr pc, int fd) {
@@ -175,8 +208,15 @@ void FdRelease(ThreadState *thr, uptr pc, int fd) {
   FdSync *s = d->sync;
   DPrintf("#%d: FdRelease(%d) -> %p\n", thr->tid, fd, s);
   MemoryRead(thr, pc, (uptr)d, kSizeLog8);
-  if (s)
-    Release(thr, pc, (uptr)s);
+  if (s == 0)
+    return;
+  Release(thr, pc, (uptr)s);
+  u64 seq = atomic_fetch_add(&s->seq, 1, memory_order_release);
+  // If we were the last acquirer and nobody released in between, the sync
+  // clock is still covered by our clock after our own release.
+  u64 acquired = PackAcquired(thr, seq);
+  atomic_compare_exchange_strong(&s->acquired, &acquired,
+      PackAcquired(thr, seq + 1), memory_order_relaxed);
 }
 
 void FdAccess(ThreadState *thr, uptr pc, int fd) {
@@ -219,7 +259,7 @@ void FdFileCreate(ThreadState *thr, uptr pc, int fd) {
   DPrintf("#%d: FdFileCreate(%d)\n", thr->tid, fd);
   if (bogusfd(fd))
     return;
-  init(thr, pc, fd, &fdctx.filesync);
+  init(thr, pc, fd, flags()->io_sync_files ? &fdctx.filesync : 0);
 }
 
 void FdDup(ThreadState *thr, uptr pc, int oldfd, int newfd, bool write) {
@@ -274,7 +314,7 @@ void FdSocketCreate(ThreadState *thr, uptr pc, int fd) {
   if (bogusfd(fd))
     return;
   // It can be a UDP socket.
-  init(thr, pc, fd, &fdctx.socksync);
+  init(thr, pc, fd, newsocksync(thr, pc));
 }
 
 void FdSocketAccept(ThreadState *thr, uptr pc, int fd, int newfd) {
@@ -283,7 +323,7 @@ void FdSocketAccept(ThreadState *thr, uptr pc, int fd, int newfd) {
     return;
   // Synchronize connect->accept.
   Acquire(thr, pc, (uptr)&fdctx.connectsync);
-  init(thr, pc, newfd, &fdctx.socksync);
+  init(thr, pc, newfd, newsocksync(thr, pc));
 }
 
 void FdSocketConnecting(ThreadState *thr, uptr pc, int fd) {
@@ -298,7 +338,7 @@ void FdSocketConnect(ThreadState *thr, uptr pc, int fd) {
   DPrintf("#%d: FdSocketConnect(%d)\n", thr->tid, fd);
   if (bogusfd(fd))
     return;
-  init(thr, pc, fd, &fdctx.socksync);
+  init(thr, pc, fd, newsocksync(thr, pc));
 }
 
 uptr File2addr(const char *path) {
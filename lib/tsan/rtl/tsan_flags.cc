@@ -37,6 +37,8 @@ void Flags::SetDefaults() {
 #undef TSAN_FLAG
   // DDFlags
   second_deadlock_stack = false;
+  lock_graph_file = "";
+  lock_graph_interval_ms = 1000;
 }
 
 void RegisterTsanFlags(FlagParser *parser, Flags *f) {
@@ -48,6 +50,14 @@ void RegisterTsanFlags(FlagParser *parser, Flags *f) {
   RegisterFlag(parser, "second_deadlock_stack",
       "Report where each mutex is locked in deadlock reports",
       &f->second_deadlock_stack);
+  RegisterFlag(parser, "lock_graph_file",
+      "If set, the lock-order graph with the acquisition counts and hold "
+      "times of its edges is periodically appended to this file with the "
+      "pid appended (Go only)",
+      &f->lock_graph_file);
+  RegisterFlag(parser, "lock_graph_interval_ms",
+      "Interval between the lock-order graph snapshots in milliseconds",
+      &f->lock_graph_interval_ms);
 }
 
 void InitializeFlags(Flags *f, const char *env) {
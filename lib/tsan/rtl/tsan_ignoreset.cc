@@ -11,27 +11,91 @@
 //
 //===----------------------------------------------------------------------===//
 #include "tsan_ignoreset.h"
+#include "tsan_mman.h"
 
 namespace __tsan {
 
+const uptr IgnoreSet::kInlineSize;
 const uptr IgnoreSet::kMaxSize;
 
 IgnoreSet::IgnoreSet()
-    : size_() {
+    : size_()
+    , cap_()
+    , dropped_()
+    , heap_() {
+}
+
+IgnoreSet::~IgnoreSet() {
+  if (heap_)
+    internal_free(heap_);
+}
+
+uptr IgnoreSet::TableIndex(u32 stack_id) const {
+  // The table size is a power of two.
+  return (stack_id * 0x9E3779B1u) & (2 * cap_ - 1);
+}
+
+bool IgnoreSet::Contains(u32 stack_id) const {
+  if (!heap_) {
+    for (uptr i = 0; i < size_; i++) {
+      if (inline_[i] == stack_id)
+        return true;
+    }
+    return false;
+  }
+  const u32 *t = table();
+  for (uptr i = TableIndex(stack_id); t[i]; i = (i + 1) & (2 * cap_ - 1)) {
+    if (heap_[t[i] - 1] == stack_id)
+      return true;
+  }
+  return false;
+}
+
+void IgnoreSet::Insert(uptr pos) {
+  u32 *t = table();
+  uptr i = TableIndex(heap_[pos]);
+  while (t[i])
+    i = (i + 1) & (2 * cap_ - 1);
+  t[i] = pos + 1;
+}
+
+void IgnoreSet::Grow() {
+  uptr cap = cap_ ? cap_ * 2 : kInlineSize * 2;
+  u32 *heap = (u32*)internal_alloc(MBlockIgnoreSet, 3 * cap * sizeof(u32));
+  internal_memcpy(heap, stacks(), size_ * sizeof(u32));
+  internal_memset(heap + cap, 0, 2 * cap * sizeof(u32));
+  if (heap_)
+    internal_free(heap_);
+  heap_ = heap;
+  cap_ = cap;
+  for (uptr i = 0; i < size_; i++)
+    Insert(i);
 }
 
 void IgnoreSet::Add(u32 stack_id) {
-  if (size_ == kMaxSize)
+  if (Contains(stack_id))
     return;
-  for (uptr i = 0; i < size_; i++) {
-    if (stacks_[i] == stack_id)
+  if (size_ == (heap_ ? cap_ : kInlineSize)) {
+    if (size_ == kMaxSize) {
+      dropped_++;
       return;
+    }
+    Grow();
   }
-  stacks_[size_++] = stack_id;
+  if (heap_) {
+    heap_[size_] = stack_id;
+    Insert(size_);
+  } else {
+    inline_[size_] = stack_id;
+  }
+  size_++;
 }
 
 void IgnoreSet::Reset() {
+  if (heap_ && size_)
+    internal_memset(table(), 0, 2 * cap_ * sizeof(u32));
   size_ = 0;
+  dropped_ = 0;
 }
 
 uptr IgnoreSet::Size() const {
@@ -41,7 +105,11 @@ uptr IgnoreSet::Size() const {
 u32 IgnoreSet::At(uptr i) const {
   CHECK_LT(i, size_);
   CHECK_LE(size_, kMaxSize);
-  return stacks_[i];
+  return stacks()[i];
+}
+
+uptr IgnoreSet::Dropped() const {
+  return dropped_;
 }
 
 }  // namespace __tsan
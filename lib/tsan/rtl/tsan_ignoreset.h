@@ -20,17 +20,39 @@ namespace __tsan {
 
 class IgnoreSet {
  public:
-  static const uptr kMaxSize = 16;
+  // The first kInlineSize stacks are stored inline, the set grows
+  // dynamically to hold up to kMaxSize stacks.
+  // Further stacks are only counted.
+  static const uptr kInlineSize = 16;
+  static const uptr kMaxSize = 1024;
 
   IgnoreSet();
+  ~IgnoreSet();
   void Add(u32 stack_id);
   void Reset();
   uptr Size() const;
   u32 At(uptr i) const;
+  // The number of stacks that did not fit, repeated ones are counted again.
+  uptr Dropped() const;
 
  private:
   uptr size_;
-  u32 stacks_[kMaxSize];
+  uptr cap_;  // Capacity of heap_, inline_ is used while heap_ is null.
+  uptr dropped_;
+  // cap_ stacks followed by an open addressing hash table of 2 * cap_ slots
+  // holding 1-based positions in the stacks, 0 marks an empty slot.
+  u32 *heap_;
+  u32 inline_[kInlineSize];
+
+  const u32 *stacks() const { return heap_ ? heap_ : inline_; }
+  u32 *table() const { return heap_ + cap_; }
+  bool Contains(u32 stack_id) const;
+  void Insert(uptr pos);
+  void Grow();
+  uptr TableIndex(u32 stack_id) const;
+
+  IgnoreSet(const IgnoreSet&);
+  void operator=(const IgnoreSet&);
 };
 
 }  // namespace __tsan
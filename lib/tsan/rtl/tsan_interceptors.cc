@@ -2396,6 +2396,8 @@ static void syscall_post_fork(uptr pc, int pid) {
 // execute MOVDQA with stack addresses.
 TSAN_INTERCEPTOR(void *, __tls_get_addr, void *arg) {
   void *res = REAL(__tls_get_addr)(arg);
+  if (DTLS_IsKnownBlock(arg))
+    return res;
   ThreadState *thr = cur_thread();
   if (!thr)
     return res;
@@ -32,24 +32,57 @@ void __tsan_flush_memory() {
   FlushShadowMemory();
 }
 
+// The accesses wider than a shadow cell, e.g. vector loads and stores, are
+// checked as one batch: the cells that the thread has already accessed in
+// the current synch epoch only need the SIMD shadow comparison, and the
+// others share a single trace event.
+
 void __tsan_read16(void *addr) {
-  MemoryRead(cur_thread(), CALLERPC, (uptr)addr, kSizeLog8);
-  MemoryRead(cur_thread(), CALLERPC, (uptr)addr + 8, kSizeLog8);
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 16, 16, 1, false);
+}
+
+void __tsan_read32(void *addr) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 32, 32, 1, false);
+}
+
+void __tsan_read64(void *addr) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 64, 64, 1, false);
 }
 
 void __tsan_write16(void *addr) {
-  MemoryWrite(cur_thread(), CALLERPC, (uptr)addr, kSizeLog8);
-  MemoryWrite(cur_thread(), CALLERPC, (uptr)addr + 8, kSizeLog8);
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 16, 16, 1, true);
+}
+
+void __tsan_write32(void *addr) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 32, 32, 1, true);
+}
+
+void __tsan_write64(void *addr) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 64, 64, 1, true);
 }
 
 void __tsan_read16_pc(void *addr, void *pc) {
-  MemoryRead(cur_thread(), (uptr)pc, (uptr)addr, kSizeLog8);
-  MemoryRead(cur_thread(), (uptr)pc, (uptr)addr + 8, kSizeLog8);
+  MemoryAccessBatch(cur_thread(), (uptr)pc, (uptr)addr, 16, 16, 1, false);
+}
+
+void __tsan_read32_pc(void *addr, void *pc) {
+  MemoryAccessBatch(cur_thread(), (uptr)pc, (uptr)addr, 32, 32, 1, false);
+}
+
+void __tsan_read64_pc(void *addr, void *pc) {
+  MemoryAccessBatch(cur_thread(), (uptr)pc, (uptr)addr, 64, 64, 1, false);
 }
 
 void __tsan_write16_pc(void *addr, void *pc) {
-  MemoryWrite(cur_thread(), (uptr)pc, (uptr)addr, kSizeLog8);
-  MemoryWrite(cur_thread(), (uptr)pc, (uptr)addr + 8, kSizeLog8);
+  MemoryAccessBatch(cur_thread(), (uptr)pc, (uptr)addr, 16, 16, 1, true);
+}
+
+void __tsan_write32_pc(void *addr, void *pc) {
+  MemoryAccessBatch(cur_thread(), (uptr)pc, (uptr)addr, 32, 32, 1, true);
+}
+
+void __tsan_write64_pc(void *addr, void *pc) {
+  MemoryAccessBatch(cur_thread(), (uptr)pc, (uptr)addr, 64, 64, 1, true);
 }
 
 // __tsan_unaligned_read/write calls are emitted by compiler.
@@ -67,7 +100,15 @@ void __tsan_unaligned_read8(const void *addr) {
 }
 
 void __tsan_unaligned_read16(const void *addr) {
-  UnalignedMemoryAccess(cur_thread(), CALLERPC, (uptr)addr, 16, false, false);
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 16, 16, 1, false);
+}
+
+void __tsan_unaligned_read32(const void *addr) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 32, 32, 1, false);
+}
+
+void __tsan_unaligned_read64(const void *addr) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 64, 64, 1, false);
 }
 
 void __tsan_unaligned_write2(void *addr) {
@@ -83,7 +124,15 @@ void __tsan_unaligned_write8(void *addr) {
 }
 
 void __tsan_unaligned_write16(void *addr) {
-  UnalignedMemoryAccess(cur_thread(), CALLERPC, (uptr)addr, 16, true, false);
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 16, 16, 1, true);
+}
+
+void __tsan_unaligned_write32(void *addr) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 32, 32, 1, true);
+}
+
+void __tsan_unaligned_write64(void *addr) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, 64, 64, 1, true);
 }
 
 // __sanitizer_unaligned_load/store are for user instrumentation.
@@ -133,3 +182,26 @@ void __tsan_acquire(void *addr) {
 void __tsan_release(void *addr) {
   Release(cur_thread(), CALLERPC, (uptr)addr);
 }
+
+#if !SANITIZER_GO
+void *__tsan_get_current_fiber() {
+  return cur_thread();
+}
+
+void *__tsan_create_fiber(unsigned flags) {
+  return FiberCreate(cur_thread(), CALLERPC, flags);
+}
+
+void __tsan_destroy_fiber(void *fiber) {
+  FiberDestroy(cur_thread(), CALLERPC, static_cast<ThreadState *>(fiber));
+}
+
+void __tsan_switch_to_fiber(void *fiber, unsigned flags) {
+  FiberSwitch(cur_thread(), CALLERPC, static_cast<ThreadState *>(fiber),
+              flags);
+}
+
+void __tsan_set_fiber_name(void *fiber, const char *name) {
+  ThreadSetName(static_cast<ThreadState *>(fiber), name);
+}
+#endif
@@ -39,34 +39,46 @@ SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read2(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read4(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read8(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read16(void *addr);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read32(void *addr);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read64(void *addr);
 
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write1(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write2(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write4(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write8(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write16(void *addr);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write32(void *addr);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write64(void *addr);
 
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_read2(const void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_read4(const void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_read8(const void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_read16(const void *addr);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_read32(const void *addr);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_read64(const void *addr);
 
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_write2(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_write4(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_write8(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_write16(void *addr);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_write32(void *addr);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_unaligned_write64(void *addr);
 
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read1_pc(void *addr, void *pc);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read2_pc(void *addr, void *pc);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read4_pc(void *addr, void *pc);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read8_pc(void *addr, void *pc);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read16_pc(void *addr, void *pc);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read32_pc(void *addr, void *pc);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_read64_pc(void *addr, void *pc);
 
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write1_pc(void *addr, void *pc);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write2_pc(void *addr, void *pc);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write4_pc(void *addr, void *pc);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write8_pc(void *addr, void *pc);
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write16_pc(void *addr, void *pc);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write32_pc(void *addr, void *pc);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_write64_pc(void *addr, void *pc);
 
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_vptr_read(void **vptr_p);
 SANITIZER_INTERFACE_ATTRIBUTE
@@ -78,6 +90,15 @@ SANITIZER_INTERFACE_ATTRIBUTE void __tsan_func_exit();
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_ignore_thread_begin();
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_ignore_thread_end();
 
+// Fibers (see include/sanitizer/tsan_interface.h).
+SANITIZER_INTERFACE_ATTRIBUTE void *__tsan_get_current_fiber();
+SANITIZER_INTERFACE_ATTRIBUTE void *__tsan_create_fiber(unsigned flags);
+SANITIZER_INTERFACE_ATTRIBUTE void __tsan_destroy_fiber(void *fiber);
+SANITIZER_INTERFACE_ATTRIBUTE
+void __tsan_switch_to_fiber(void *fiber, unsigned flags);
+SANITIZER_INTERFACE_ATTRIBUTE
+void __tsan_set_fiber_name(void *fiber, const char *name);
+
 SANITIZER_INTERFACE_ATTRIBUTE
 void *__tsan_external_register_tag(const char *object_type);
 SANITIZER_INTERFACE_ATTRIBUTE
@@ -92,6 +113,25 @@ void __tsan_read_range(void *addr, unsigned long size);  // NOLINT
 SANITIZER_INTERFACE_ATTRIBUTE
 void __tsan_write_range(void *addr, unsigned long size);  // NOLINT
 
+// Check n accesses of size bytes each at addr, addr + stride, ...,
+// addr + (n - 1) * stride from the same PC in a single call, e.g. the
+// accesses of an unrolled loop. The accesses of __tsan_read/write_batch
+// must be naturally aligned and size must be 1, 2, 4, 8 or 16.
+SANITIZER_INTERFACE_ATTRIBUTE
+void __tsan_read_batch(void *addr, unsigned long size,  // NOLINT
+                       unsigned long stride, unsigned long n);  // NOLINT
+SANITIZER_INTERFACE_ATTRIBUTE
+void __tsan_write_batch(void *addr, unsigned long size,  // NOLINT
+                        unsigned long stride, unsigned long n);  // NOLINT
+SANITIZER_INTERFACE_ATTRIBUTE
+void __tsan_unaligned_read_batch(void *addr, unsigned long size,  // NOLINT
+                                 unsigned long stride,  // NOLINT
+                                 unsigned long n);  // NOLINT
+SANITIZER_INTERFACE_ATTRIBUTE
+void __tsan_unaligned_write_batch(void *addr, unsigned long size,  // NOLINT
+                                  unsigned long stride,  // NOLINT
+                                  unsigned long n);  // NOLINT
+
 // User may provide function that would be called right when TSan detects
 // an error. The argument 'report' is an opaque pointer that can be used to
 // gather additional information using other TSan report API functions.
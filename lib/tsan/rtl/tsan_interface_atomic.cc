@@ -219,6 +219,37 @@ static a128 NoTsanAtomicLoad(const volatile a128 *a, morder mo) {
 }
 #endif
 
+static ThreadState::AtomicAcquire *AtomicCacheEntry(ThreadState *thr,
+                                                    uptr addr) {
+  uptr idx = (addr >> 3) % ThreadState::kAtomicAcquireCacheSize;
+  return &thr->atomic_acquire_cache[idx];
+}
+
+// Must be called with s locked, after acquiring its clock.
+static void RememberAcquire(ThreadState *thr, uptr addr, SyncVar *s) {
+  ThreadState::AtomicAcquire *e = AtomicCacheEntry(thr, addr);
+  e->addr = addr;
+  e->sync = s;
+  e->uid = s->uid;
+  e->version = s->clock.version();
+}
+
+// Returns true if the thread has already acquired the current clock of the
+// sync object for addr, so acquiring it again would not change anything.
+// The value must be loaded before the call: releasers change the clock
+// version before storing their value, so observing a released value
+// guarantees that a stale version is noticed here.
+static bool AlreadyAcquired(ThreadState *thr, uptr addr) {
+  ThreadState::AtomicAcquire *e = AtomicCacheEntry(thr, addr);
+  if (e->addr != addr)
+    return false;
+  SyncVar *s = e->sync;
+  // Sync objects are never unmapped, but can be reused for another address
+  // or recreated for the same one; uid tells them apart.
+  return s->clock.version() == e->version && s->addr == addr &&
+         s->uid == e->uid;
+}
+
 template<typename T>
 static T AtomicLoad(ThreadState *thr, uptr pc, const volatile T *a,
     morder mo) {
@@ -229,9 +260,17 @@ static T AtomicLoad(ThreadState *thr, uptr pc, const volatile T *a,
     MemoryReadAtomic(thr, pc, (uptr)a, SizeLog<T>());
     return NoTsanAtomicLoad(a, mo);
   }
+  // Lock-free queues poll the same atomics over and over, avoid taking
+  // the sync object lock while nothing was released to it.
+  T v = NoTsanAtomicLoad(a, mo);
+  if (AlreadyAcquired(thr, (uptr)a)) {
+    MemoryReadAtomic(thr, pc, (uptr)a, SizeLog<T>());
+    return v;
+  }
   SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, (uptr)a, false);
   AcquireImpl(thr, pc, &s->clock);
-  T v = NoTsanAtomicLoad(a, mo);
+  RememberAcquire(thr, (uptr)a, s);
+  v = NoTsanAtomicLoad(a, mo);
   s->mtx.ReadUnlock();
   MemoryReadAtomic(thr, pc, (uptr)a, SizeLog<T>());
   return v;
@@ -268,6 +307,8 @@ static void AtomicStore(ThreadState *thr, uptr pc, volatile T *a, T v,
   // Can't increment epoch w/o writing to the trace as well.
   TraceAddEvent(thr, thr->fast_state, EventTypeMop, 0);
   ReleaseStoreImpl(thr, pc, &s->clock);
+  // The sync clock is now a copy of ours, nothing to acquire from it later.
+  RememberAcquire(thr, (uptr)a, s);
   NoTsanAtomicStore(a, v, mo);
   s->mtx.Unlock();
 }
@@ -287,6 +328,9 @@ static T AtomicRMW(ThreadState *thr, uptr pc, volatile T *a, T v, morder mo) {
       ReleaseImpl(thr, pc, &s->clock);
     else if (IsAcquireOrder(mo))
       AcquireImpl(thr, pc, &s->clock);
+    // Unlike a plain release, these leave the sync clock covered by ours.
+    if (IsAcqRelOrder(mo) || !IsReleaseOrder(mo))
+      RememberAcquire(thr, (uptr)a, s);
   }
   v = F(a, v);
   if (s)
@@ -403,6 +447,20 @@ static bool AtomicCAS(ThreadState *thr, uptr pc,
   bool write_lock = mo != mo_acquire && mo != mo_consume;
   if (mo != mo_relaxed) {
     s = ctx->metamap.GetOrCreateAndLock(thr, pc, (uptr)a, write_lock);
+    // CAS retry loops mostly fail because of a stale expected value.
+    // A failed CAS does not store, so check the value first and do only
+    // the acquire part then, instead of a release with a new epoch.
+    T cur = NoTsanAtomicLoad(a, mo_relaxed);
+    if (cur != *c) {
+      if (IsAcquireOrder(mo))
+        AcquireImpl(thr, pc, &s->clock);
+      if (write_lock)
+        s->mtx.Unlock();
+      else
+        s->mtx.ReadUnlock();
+      *c = cur;
+      return false;
+    }
     thr->fast_state.IncrementEpoch();
     // Can't increment epoch w/o writing to the trace as well.
     TraceAddEvent(thr, thr->fast_state, EventTypeMop, 0);
@@ -412,6 +470,9 @@ static bool AtomicCAS(ThreadState *thr, uptr pc,
       ReleaseImpl(thr, pc, &s->clock);
     else if (IsAcquireOrder(mo))
       AcquireImpl(thr, pc, &s->clock);
+    // Unlike a plain release, these leave the sync clock covered by ours.
+    if (IsAcqRelOrder(mo) || !IsReleaseOrder(mo))
+      RememberAcquire(thr, (uptr)a, s);
   }
   T cc = *c;
   T pr = func_cas(a, cc, v);
@@ -123,3 +123,29 @@ void __tsan_read_range(void *addr, uptr size) {
 void __tsan_write_range(void *addr, uptr size) {
   MemoryAccessRange(cur_thread(), CALLERPC, (uptr)addr, size, true);
 }
+
+void __tsan_read_batch(void *addr, uptr size, uptr stride, uptr n) {
+  DCHECK_EQ((uptr)addr % size, 0);
+  DCHECK_EQ(stride % size, 0);
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, size, stride, n,
+                    false);
+}
+
+void __tsan_write_batch(void *addr, uptr size, uptr stride, uptr n) {
+  DCHECK_EQ((uptr)addr % size, 0);
+  DCHECK_EQ(stride % size, 0);
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, size, stride, n,
+                    true);
+}
+
+void __tsan_unaligned_read_batch(void *addr, uptr size, uptr stride,
+                                 uptr n) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, size, stride, n,
+                    false);
+}
+
+void __tsan_unaligned_write_batch(void *addr, uptr size, uptr stride,
+                                  uptr n) {
+  MemoryAccessBatch(cur_thread(), CALLERPC, (uptr)addr, size, stride, n,
+                    true);
+}
@@ -114,10 +114,29 @@ void __tsan_java_free(jptr ptr, jptr size) {
   ctx->metamap.FreeRange(thr->proc(), ptr, size);
 }
 
-void __tsan_java_move(jptr src, jptr dst, jptr size) {
-  SCOPED_JAVA_FUNC(__tsan_java_move);
-  DPrintf("#%d: java_move(%p, %p, %p)\n", thr->tid, src, dst, size);
-  CHECK_NE(jctx, 0);
+// Moves shadow of [src, src + size) to dst and clears the part of the source
+// shadow that is not overwritten by the destination. The ranges can overlap.
+// The loops are kept trivial, so that the compiler vectorizes them.
+static void MoveShadow(jptr src, jptr dst, jptr size) {
+  u64 *s = (u64*)MemToShadow(src);
+  u64 *d = (u64*)MemToShadow(dst);
+  const uptr n = (u64*)MemToShadow(src + size) - s;
+  u64 *clear_beg = s;
+  u64 *clear_end = s + n;
+  if (d < s) {
+    for (uptr i = 0; i < n; i++)
+      d[i] = s[i];
+    clear_beg = max(s, d + n);
+  } else {
+    for (uptr i = n; i > 0; i--)
+      d[i - 1] = s[i - 1];
+    clear_end = min(s + n, d);
+  }
+  for (u64 *p = clear_beg; p < clear_end; p++)
+    *p = 0;
+}
+
+static void JavaMove(jptr src, jptr dst, jptr size) {
   CHECK_NE(size, 0);
   CHECK_EQ(src % kHeapAlignment, 0);
   CHECK_EQ(dst % kHeapAlignment, 0);
@@ -132,22 +151,22 @@ void __tsan_java_move(jptr src, jptr dst, jptr size) {
   // Assuming it's not running concurrently with threads that do
   // memory accesses and mutex operations (stop-the-world phase).
   ctx->metamap.MoveMemory(src, dst, size);
+  MoveShadow(src, dst, size);
+}
 
-  // Move shadow.
-  u64 *s = (u64*)MemToShadow(src);
-  u64 *d = (u64*)MemToShadow(dst);
-  u64 *send = (u64*)MemToShadow(src + size);
-  uptr inc = 1;
-  if (dst > src) {
-    s = (u64*)MemToShadow(src + size) - 1;
-    d = (u64*)MemToShadow(dst + size) - 1;
-    send = (u64*)MemToShadow(src) - 1;
-    inc = -1;
-  }
-  for (; s != send; s += inc, d += inc) {
-    *d = *s;
-    *s = 0;
-  }
+void __tsan_java_move(jptr src, jptr dst, jptr size) {
+  SCOPED_JAVA_FUNC(__tsan_java_move);
+  DPrintf("#%d: java_move(%p, %p, %p)\n", thr->tid, src, dst, size);
+  CHECK_NE(jctx, 0);
+  JavaMove(src, dst, size);
+}
+
+void __tsan_java_move_batch(const jptr *moves, jptr n) {
+  SCOPED_JAVA_FUNC(__tsan_java_move_batch);
+  DPrintf("#%d: java_move_batch(%p, %p)\n", thr->tid, moves, n);
+  CHECK_NE(jctx, 0);
+  for (jptr i = 0; i < n; i++)
+    JavaMove(moves[3 * i], moves[3 * i + 1], moves[3 * i + 2]);
 }
 
 jptr __tsan_java_find(jptr *from_ptr, jptr to) {
@@ -52,6 +52,12 @@ void __tsan_java_free(jptr ptr, jptr size) INTERFACE_ATTRIBUTE;
 // Can be aggregated for several objects (preferably).
 // The ranges can overlap.
 void __tsan_java_move(jptr src, jptr dst, jptr size) INTERFACE_ATTRIBUTE;
+// The same for n moves passed as (src, dst, size) triples in the moves array.
+// The moves are done in the array order, so a compacting GC should pass them
+// in the order it moves the objects.
+// Different GC worker threads can call it concurrently as long as all their
+// source and destination ranges are disjoint.
+void __tsan_java_move_batch(const jptr *moves, jptr n) INTERFACE_ATTRIBUTE;
 // This function must be called on the finalizer thread
 // before executing a batch of finalizers.
 // It ensures necessary synchronization between
@@ -115,6 +115,10 @@ void InitializeAllocator() {
   allocator()->Init(
       common_flags()->allocator_may_return_null,
       common_flags()->allocator_release_to_os_interval_ms);
+  allocator()->SetSecondaryCacheParams(
+      static_cast<uptr>(common_flags()->allocator_secondary_cache_size_mb)
+          << 20,
+      common_flags()->allocator_secondary_cache_decay_ms);
 }
 
 void InitializeAllocatorLate() {
@@ -127,6 +131,7 @@ void AllocatorProcStart(Processor *proc) {
 }
 
 void AllocatorProcFinish(Processor *proc) {
+  AllocatorFlushDeferredFrees(proc);
   allocator()->DestroyCache(&proc->alloc_cache);
   internal_allocator()->DestroyCache(&proc->internal_alloc_cache);
 }
@@ -166,20 +171,39 @@ void *user_calloc(ThreadState *thr, uptr pc, uptr size, uptr n) {
   if (CallocShouldReturnNullDueToOverflow(size, n))
     return allocator()->ReturnNullOrDieOnBadRequest();
   void *p = user_alloc(thr, pc, n * size);
-  if (p)
+  if (p && !allocator()->ChunkIsZero(p))
     internal_memset(p, 0, n * size);
   return p;
 }
 
+// The freed range is marked in the shadow right away, this is the access
+// that races with the accesses that do not happen before the free. The meta
+// block and the memory are released later in batches, which also keeps the
+// memory from being reused right away.
 void user_free(ThreadState *thr, uptr pc, void *p, bool signal) {
   ScopedGlobalProcessor sgp;
-  if (ctx && ctx->initialized)
+  if (ctx && ctx->initialized) {
     OnUserFree(thr, pc, (uptr)p, true);
-  allocator()->Deallocate(&thr->proc()->alloc_cache, p);
+    Processor *proc = thr->proc();
+    if (proc->n_deferred_free == kDeferredFreeBatch)
+      AllocatorFlushDeferredFrees(proc);
+    proc->deferred_free[proc->n_deferred_free++] = (uptr)p;
+  } else {
+    allocator()->Deallocate(&thr->proc()->alloc_cache, p);
+  }
   if (signal)
     SignalUnsafeCall(thr, pc);
 }
 
+void AllocatorFlushDeferredFrees(Processor *proc) {
+  for (uptr i = 0; i < proc->n_deferred_free; i++) {
+    uptr p = proc->deferred_free[i];
+    ctx->metamap.FreeBlock(proc, p);
+    allocator()->Deallocate(&proc->alloc_cache, (void*)p);
+  }
+  proc->n_deferred_free = 0;
+}
+
 void OnUserAlloc(ThreadState *thr, uptr pc, uptr p, uptr sz, bool write) {
   DPrintf("#%d: alloc(%zu) = %p\n", thr->tid, sz, p);
   ctx->metamap.AllocBlock(thr, pc, p, sz);
@@ -191,7 +215,9 @@ void OnUserAlloc(ThreadState *thr, uptr pc, uptr p, uptr sz, bool write) {
 
 void OnUserFree(ThreadState *thr, uptr pc, uptr p, bool write) {
   CHECK_NE(p, (void*)0);
-  uptr sz = ctx->metamap.FreeBlock(thr->proc(), p);
+  // The block itself is freed by AllocatorFlushDeferredFrees.
+  MBlock *b = ctx->metamap.GetBlock(p);
+  uptr sz = b ? RoundUpTo(b->siz, kMetaShadowCell) : 0;
   DPrintf("#%d: free(%p, %zu)\n", thr->tid, p, sz);
   if (write && thr->ignore_reads_and_writes == 0)
     MemoryRangeFreed(thr, pc, (uptr)p, sz);
@@ -293,6 +319,15 @@ uptr __sanitizer_get_allocated_size(const void *p) {
   return user_alloc_usable_size(p);
 }
 
+uptr __sanitizer_get_allocator_histogram(AllocatorClassStats *stats,
+                                         uptr max_classes) {
+  return allocator()->GetHistogram(stats, max_classes);
+}
+
+void __sanitizer_print_allocator_histogram() {
+  allocator()->PrintHistogram();
+}
+
 void __tsan_on_thread_idle() {
   ThreadState *thr = cur_thread();
   allocator()->SwallowCache(&thr->proc()->alloc_cache);
@@ -24,6 +24,7 @@ void InitializeAllocatorLate();
 void ReplaceSystemMalloc();
 void AllocatorProcStart(Processor *proc);
 void AllocatorProcFinish(Processor *proc);
+void AllocatorFlushDeferredFrees(Processor *proc);
 void AllocatorPrintStats();
 
 // For user allocations.
@@ -63,6 +64,9 @@ enum MBlockType {
   MBlockExpectRace,
   MBlockSignal,
   MBlockJmpBuf,
+  MBlockMutexSet,
+  MBlockIgnoreSet,
+  MBlockFiber,
 
   // This must be the last.
   MBlockTypeCount
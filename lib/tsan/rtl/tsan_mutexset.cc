@@ -15,29 +15,90 @@
 
 namespace __tsan {
 
+const uptr MutexSet::kInlineSize;
 const uptr MutexSet::kMaxSize;
+const uptr MutexSet::kNoPos;
 
 MutexSet::MutexSet() {
   size_ = 0;
-  internal_memset(&descs_, 0, sizeof(descs_));
+  cap_ = 0;
+  heap_ = 0;
+  internal_memset(&inline_, 0, sizeof(inline_));
+  internal_memset(&filter_, 0, sizeof(filter_));
 }
 
-void MutexSet::Add(u64 id, bool write, u64 epoch) {
+MutexSet::~MutexSet() {
+  if (heap_)
+    internal_free(heap_);
+}
+
+uptr MutexSet::FilterIndex(u64 id) {
+  return (id * 0x9E3779B97F4A7C15ull) >> 58;
+}
+
+void MutexSet::FilterAdd(u64 id) {
+  u8 *f = &filter_[FilterIndex(id)];
+  if (*f != (u8)-1)
+    (*f)++;
+}
+
+void MutexSet::FilterDel(u64 id) {
+  u8 *f = &filter_[FilterIndex(id)];
+  if (*f != (u8)-1)
+    (*f)--;
+}
+
+uptr MutexSet::Find(u64 id, uptr pos) const {
+  const Desc *d = descs();
+  if (pos < size_ && d[pos].id == id)
+    return pos;
+  if (filter_[FilterIndex(id)] == 0)
+    return kNoPos;
+  // Locks are mostly released in the reverse order, so look at the recently
+  // added mutexes first.
+  for (uptr i = size_; i > 0; i--) {
+    if (d[i - 1].id == id)
+      return i - 1;
+  }
+  return kNoPos;
+}
+
+void MutexSet::Grow(uptr n) {
+  uptr cap = Capacity();
+  if (n <= cap)
+    return;
+  while (cap < n)
+    cap *= 2;
+  cap = Min(cap, kMaxSize);
+  Desc *heap = (Desc*)internal_alloc(MBlockMutexSet, cap * sizeof(Desc));
+  internal_memcpy(heap, descs(), size_ * sizeof(Desc));
+  if (heap_)
+    internal_free(heap_);
+  heap_ = heap;
+  cap_ = cap;
+}
+
+void MutexSet::Reserve(uptr n) {
+  Grow(Min(n, kMaxSize));
+}
+
+uptr MutexSet::Add(u64 id, bool write, u64 epoch, uptr pos) {
   // Look up existing mutex with the same id.
-  for (uptr i = 0; i < size_; i++) {
-    if (descs_[i].id == id) {
-      descs_[i].count++;
-      descs_[i].epoch = epoch;
-      return;
-    }
+  uptr i = Find(id, pos);
+  if (i != kNoPos) {
+    descs()[i].count++;
+    descs()[i].epoch = epoch;
+    return i;
   }
+  if (size_ == Capacity() && size_ < kMaxSize)
+    Grow(size_ + 1);
   // On overflow, find the oldest mutex and drop it.
   if (size_ == kMaxSize) {
     u64 minepoch = (u64)-1;
     u64 mini = (u64)-1;
     for (uptr i = 0; i < size_; i++) {
-      if (descs_[i].epoch < minepoch) {
-        minepoch = descs_[i].epoch;
+      if (descs()[i].epoch < minepoch) {
+        minepoch = descs()[i].epoch;
         mini = i;
       }
     }
@@ -45,36 +106,34 @@ void MutexSet::Add(u64 id, bool write, u64 epoch) {
     CHECK_EQ(size_, kMaxSize - 1);
   }
   // Add new mutex descriptor.
-  descs_[size_].id = id;
-  descs_[size_].write = write;
-  descs_[size_].epoch = epoch;
-  descs_[size_].count = 1;
-  size_++;
+  Desc *d = &descs()[size_];
+  d->id = id;
+  d->write = write;
+  d->epoch = epoch;
+  d->count = 1;
+  FilterAdd(id);
+  return size_++;
 }
 
-void MutexSet::Del(u64 id, bool write) {
-  for (uptr i = 0; i < size_; i++) {
-    if (descs_[i].id == id) {
-      if (--descs_[i].count == 0)
-        RemovePos(i);
-      return;
-    }
-  }
+void MutexSet::Del(u64 id, bool write, uptr pos) {
+  uptr i = Find(id, pos);
+  if (i != kNoPos && --descs()[i].count == 0)
+    RemovePos(i);
 }
 
 void MutexSet::Remove(u64 id) {
-  for (uptr i = 0; i < size_; i++) {
-    if (descs_[i].id == id) {
-      RemovePos(i);
-      return;
-    }
-  }
+  uptr i = Find(id, kNoPos);
+  if (i != kNoPos)
+    RemovePos(i);
 }
 
 void MutexSet::RemovePos(uptr i) {
   CHECK_LT(i, size_);
-  descs_[i] = descs_[size_ - 1];
+  FilterDel(descs()[i].id);
+  descs()[i] = descs()[size_ - 1];
   size_--;
+  if (size_ == 0)
+    internal_memset(&filter_, 0, sizeof(filter_));
 }
 
 uptr MutexSet::Size() const {
@@ -83,7 +142,24 @@ uptr MutexSet::Size() const {
 
 MutexSet::Desc MutexSet::Get(uptr i) const {
   CHECK_LT(i, size_);
-  return descs_[i];
+  return descs()[i];
+}
+
+void MutexSet::operator=(const MutexSet &other) {
+  if (this == &other)
+    return;
+  // Mutexes are appended in the lock order, drop the oldest ones.
+  uptr n = Min(other.size_, Capacity());
+  uptr skip = other.size_ - n;
+  internal_memcpy(descs(), other.descs() + skip, n * sizeof(Desc));
+  size_ = n;
+  if (skip == 0) {
+    internal_memcpy(&filter_, &other.filter_, sizeof(filter_));
+  } else {
+    internal_memset(&filter_, 0, sizeof(filter_));
+    for (uptr i = 0; i < n; i++)
+      FilterAdd(descs()[i].id);
+  }
 }
 
 }  // namespace __tsan
@@ -20,9 +20,13 @@ namespace __tsan {
 
 class MutexSet {
  public:
-  // Holds limited number of mutexes.
+  // The first kInlineSize mutexes are stored inline, the set grows
+  // dynamically to hold up to kMaxSize mutexes.
   // The oldest mutexes are discarded on overflow.
-  static const uptr kMaxSize = 16;
+  static const uptr kInlineSize = 16;
+  static const uptr kMaxSize = 1024;
+  // Passed instead of a position hint when there is none.
+  static const uptr kNoPos = (uptr)-1;
   struct Desc {
     u64 id;
     u64 epoch;
@@ -31,38 +35,60 @@ class MutexSet {
   };
 
   MutexSet();
+  ~MutexSet();
   // The 'id' is obtained from SyncVar::GetId().
-  void Add(u64 id, bool write, u64 epoch);
-  void Del(u64 id, bool write);
+  // 'pos' is a position returned by an earlier Add of the same mutex, it is
+  // only a hint that saves the search if the mutex is still there.
+  uptr Add(u64 id, bool write, u64 epoch, uptr pos = kNoPos);
+  void Del(u64 id, bool write, uptr pos = kNoPos);
   void Remove(u64 id);  // Removes the mutex completely (if it's destroyed).
   uptr Size() const;
   Desc Get(uptr i) const;
+  // Makes room for n mutexes, so that a following copy of a set of that
+  // size does not need to allocate.
+  void Reserve(uptr n);
 
-  void operator=(const MutexSet &other) {
-    internal_memcpy(this, &other, sizeof(*this));
-  }
+  // Copies as many of the newest mutexes of other as fit into the already
+  // reserved capacity, does not allocate.
+  void operator=(const MutexSet &other);
 
  private:
 #if !SANITIZER_GO
+  // Counts of mutexes per hash bucket of id, so that adding a mutex
+  // that is not in the set does not need to search for it.
+  // Saturated counts are never decremented.
+  static const uptr kFilterSize = 64;
   uptr size_;
-  Desc descs_[kMaxSize];
+  uptr cap_;  // Capacity of heap_, inline_ is used while heap_ is null.
+  Desc *heap_;
+  Desc inline_[kInlineSize];
+  u8 filter_[kFilterSize];
+
+  Desc *descs() { return heap_ ? heap_ : inline_; }
+  const Desc *descs() const { return heap_ ? heap_ : inline_; }
+  uptr Capacity() const { return heap_ ? cap_ : kInlineSize; }
+  uptr Find(u64 id, uptr pos) const;
+  void Grow(uptr n);
+  void FilterAdd(u64 id);
+  void FilterDel(u64 id);
+  static uptr FilterIndex(u64 id);
 #endif
 
   void RemovePos(uptr i);
   MutexSet(const MutexSet&);
 };
 
-// Go does not have mutexes, so do not spend memory and time.
-// (Go sync.Mutex is actually a semaphore -- can be unlocked
-// in different goroutine).
 #if SANITIZER_GO
 MutexSet::MutexSet() {}
-void MutexSet::Add(u64 id, bool write, u64 epoch) {}
-void MutexSet::Del(u64 id, bool write) {}
+MutexSet::~MutexSet() {}
+uptr MutexSet::Add(u64 id, bool write, u64 epoch, uptr pos) { return 0; }
+void MutexSet::Del(u64 id, bool write, uptr pos) {}
 void MutexSet::Remove(u64 id) {}
 void MutexSet::RemovePos(uptr i) {}
 uptr MutexSet::Size() const { return 0; }
 MutexSet::Desc MutexSet::Get(uptr i) const { return Desc(); }
+void MutexSet::Reserve(uptr n) {}
+void MutexSet::operator=(const MutexSet &other) {}
 #endif
 
 }  // namespace __tsan
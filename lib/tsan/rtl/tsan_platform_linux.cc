@@ -144,6 +144,116 @@ void FlushShadowMemory() {
 #endif
 }
 
+#if SANITIZER_LINUX
+// Cold shadow is found with the kernel soft-dirty bits: writing "4" to
+// /proc/self/clear_refs resets them and /proc/self/pagemap reports the pages
+// written since then. Shadow is stored to on every memory access, so a shadow
+// page that is resident but not soft-dirty was not touched since the previous
+// flush and can be dropped without losing recent history.
+static const u64 kPagemapPresent = 1ULL << 63;
+static const u64 kPagemapSoftDirty = 1ULL << 55;
+
+static bool ReadPagemap(fd_t fd, uptr addr, u64 *entries, uptr count) {
+  uptr offset = addr / GetPageSizeCached() * sizeof(u64);
+  uptr res = internal_lseek(fd, offset, SEEK_SET);
+  if (internal_iserror(res) || res != offset)
+    return false;
+  uptr bytes_read;
+  uptr size = count * sizeof(u64);
+  return ReadFromFile(fd, entries, size, &bytes_read) && bytes_read == size;
+}
+
+static bool ClearSoftDirtyBits() {
+  fd_t fd = OpenFile("/proc/self/clear_refs", WrOnly);
+  if (fd == kInvalidFd)
+    return false;
+  bool res = WriteToFile(fd, "4", 1);
+  CloseFile(fd);
+  return res;
+}
+
+static void ReleaseColdShadow(fd_t pagemap, uptr beg, uptr end) {
+  const uptr kBatch = 512;
+  const uptr page = GetPageSizeCached();
+  u64 entries[kBatch];
+  uptr cold_beg = 0;
+  uptr p = beg;
+  while (p < end) {
+    uptr n = Min(kBatch, (end - p) / page);
+    if (!ReadPagemap(pagemap, p, entries, n))
+      break;
+    for (uptr i = 0; i < n; i++, p += page) {
+      u64 e = entries[i];
+      if ((e & kPagemapPresent) && !(e & kPagemapSoftDirty)) {
+        if (cold_beg == 0)
+          cold_beg = p;
+      } else if (cold_beg != 0) {
+        ReleaseMemoryPagesToOS(cold_beg, p);
+        cold_beg = 0;
+      }
+    }
+  }
+  if (cold_beg != 0)
+    ReleaseMemoryPagesToOS(cold_beg, p);
+}
+
+static void FlushColdShadowMemoryCallback(
+    const SuspendedThreadsList &suspended_threads_list,
+    void *argument) {
+  fd_t pagemap = *(fd_t *)argument;
+  const uptr page = GetPageSizeCached();
+  MemoryMappingLayout proc_maps(/*cache_enabled*/false);
+  uptr start, end, offset, prot;
+  while (proc_maps.Next(&start, &end, &offset, 0, 0, &prot)) {
+    if (!IsAppMem(start) || !IsAppMem(end - 1))
+      continue;
+    uptr shadow_beg = RoundDownTo(MemToShadow(start), page);
+    uptr shadow_end = RoundUpTo(MemToShadow(end - kShadowCell) +
+                                kShadowCnt * kShadowSize, page);
+    ReleaseColdShadow(pagemap, shadow_beg, shadow_end);
+  }
+}
+
+// Cleared right before the probe write, so its soft-dirty bit tells whether
+// the kernel tracks soft-dirty pages at all.
+ALIGNED(4096) static volatile char soft_dirty_probe[4096];
+
+static bool SoftDirtyTrackingWorks(fd_t pagemap) {
+  soft_dirty_probe[0] = 1;
+  u64 e;
+  return ReadPagemap(pagemap, (uptr)soft_dirty_probe, &e, 1) &&
+         (e & kPagemapSoftDirty);
+}
+#endif
+
+bool FlushColdShadowMemory() {
+#if SANITIZER_LINUX
+  static bool unsupported;
+  if (unsupported)
+    return false;
+  fd_t pagemap = OpenFile("/proc/self/pagemap", RdOnly);
+  if (pagemap == kInvalidFd) {
+    unsupported = true;
+    return false;
+  }
+  // The first call only starts tracking; shadow becomes eligible once it
+  // stays untouched for a whole flush interval.
+  static bool tracking;
+  if (tracking)
+    StopTheWorld(FlushColdShadowMemoryCallback, &pagemap);
+  tracking = ClearSoftDirtyBits() && SoftDirtyTrackingWorks(pagemap);
+  CloseFile(pagemap);
+  if (!tracking) {
+    VReport(1, "ThreadSanitizer: soft-dirty page tracking is not available, "
+               "flushing all shadow memory\n");
+    unsupported = true;
+  }
+  return tracking;
+#else
+  return false;
+#endif
+}
+
 #if !SANITIZER_GO
 // Mark shadow for .rodata sections with the special kShadowRodata marker.
 // Accesses to .rodata can't race, so this saves time, memory and trace space.
@@ -384,7 +494,13 @@ ThreadState *cur_thread() {
     }
     CHECK_EQ(0, internal_sigprocmask(SIG_SETMASK, &oldset, nullptr));
   }
-  return thr;
+  return thr->current_fiber ? thr->current_fiber : thr;
+}
+
+void set_cur_thread(ThreadState *thr) {
+  ThreadState *self = (ThreadState *)__get_tls()[TLS_SLOT_TSAN];
+  CHECK_NE(self, nullptr);
+  self->current_fiber = thr == self ? nullptr : thr;
 }
 
 void cur_thread_finalize() {
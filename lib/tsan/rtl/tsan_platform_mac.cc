@@ -75,7 +75,8 @@ static void *SignalSafeGetOrAllocate(uptr *dst, uptr size) {
 static uptr main_thread_identity = 0;
 ALIGNED(64) static char main_thread_state[sizeof(ThreadState)];
 
-ThreadState *cur_thread() {
+// Returns the state of the current thread itself, ignoring fibers.
+static ThreadState *cur_thread_self() {
   uptr thread_identity = (uptr)pthread_self();
   if (thread_identity == main_thread_identity || main_thread_identity == 0) {
     return (ThreadState *)&main_thread_state;
@@ -86,6 +87,16 @@ ThreadState *cur_thread() {
   return thr;
 }
 
+ThreadState *cur_thread() {
+  ThreadState *thr = cur_thread_self();
+  return thr->current_fiber ? thr->current_fiber : thr;
+}
+
+void set_cur_thread(ThreadState *thr) {
+  ThreadState *self = cur_thread_self();
+  self->current_fiber = thr == self ? nullptr : thr;
+}
+
 // TODO(kuba.brecka): This is not async-signal-safe. In particular, we call
 // munmap first and then clear `fake_tls`; if we receive a signal in between,
 // handler will try to access the unmapped ThreadState.
@@ -105,6 +116,10 @@ void cur_thread_finalize() {
 void FlushShadowMemory() {
 }
 
+bool FlushColdShadowMemory() {
+  return false;
+}
+
 static void RegionMemUsage(uptr start, uptr end, uptr *res, uptr *dirty) {
   vm_address_t address = start;
   vm_address_t end_address = end;
@@ -24,6 +24,10 @@ namespace __tsan {
 void FlushShadowMemory() {
 }
 
+bool FlushColdShadowMemory() {
+  return false;
+}
+
 void WriteMemoryProfile(char *buf, uptr buf_size, uptr nthread, uptr nlive) {
 }
 
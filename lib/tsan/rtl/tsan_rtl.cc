@@ -17,6 +17,7 @@
 #include "sanitizer_common/sanitizer_libc.h"
 #include "sanitizer_common/sanitizer_stackdepot.h"
 #include "sanitizer_common/sanitizer_placement_new.h"
+#include "sanitizer_common/sanitizer_self_profile.h"
 #include "sanitizer_common/sanitizer_symbolizer.h"
 #include "tsan_defs.h"
 #include "tsan_platform.h"
@@ -70,11 +71,12 @@ static ThreadContextBase *CreateThreadContext(u32 tid) {
   // Map thread trace when context is created.
   char name[50];
   internal_snprintf(name, sizeof(name), "trace %u", tid);
-  MapThreadTrace(GetThreadTrace(tid), TraceSize() * sizeof(Event), name);
+  MapThreadTrace(GetThreadTrace(tid), TraceSize(), name);
   const uptr hdr = GetThreadTraceHeader(tid);
   internal_snprintf(name, sizeof(name), "trace header %u", tid);
   MapThreadTrace(hdr, sizeof(Trace), name);
   new((void*)hdr) Trace();
+  ((Trace*)hdr)->nparts = flags()->adaptive_history ? 2 : TraceParts();
   // We are going to use only a small part of the trace with the default
   // value of history_size. However, the constructor writes to the whole trace.
   // Unmap the unused part.
@@ -98,6 +100,8 @@ Context::Context()
   , report_mtx(MutexTypeReport, StatMtxReport)
   , nreported()
   , nmissed_expected()
+  , trace_switches()
+  , finished_thread_events()
   , thread_registry(new(thread_registry_placeholder) ThreadRegistry(
       CreateThreadContext, kMaxTid, kThreadQuarantineSize, kMaxTidReuse))
   , racy_mtx(MutexTypeRacy, StatMtxRacy)
@@ -113,10 +117,15 @@ ThreadState::ThreadState(Context *ctx, int tid, int unique_id, u64 epoch,
                          uptr stk_addr, uptr stk_size,
                          uptr tls_addr, uptr tls_size)
   : fast_state(tid, epoch)
+  , trace_pos()
+  , trace_end()
+  , trace_prev_pc()
   // Do not touch these, rely on zero initialization,
   // they may be accessed before the ctor.
   // , ignore_reads_and_writes()
   // , ignore_interceptors()
+  // , is_fiber()
+  // , current_fiber()
   , clock(tid, reuse_count)
 #if !SANITIZER_GO
   , jmp_bufs(MBlockJmpBuf)
@@ -131,6 +140,8 @@ ThreadState::ThreadState(Context *ctx, int tid, int unique_id, u64 epoch,
   , last_sleep_clock(tid)
 #endif
 {
+  internal_memset(atomic_acquire_cache, 0, sizeof(atomic_acquire_cache));
+  internal_memset(mutex_cache, 0, sizeof(mutex_cache));
 }
 
 #if !SANITIZER_GO
@@ -143,6 +154,78 @@ static void MemoryProfiler(Context *ctx, fd_t fd, int i) {
   WriteToFile(fd, buf.data(), internal_strlen(buf.data()));
 }
 
+struct LiveThreadStats {
+  uptr running;
+  u64 events;
+  uptr max_clock_size;
+  u64 sum_clock_size;
+};
+
+// Reads the state of the running threads like UpdateClockCallback does,
+// without stopping them.
+static void CollectLiveThreadStats(ThreadContextBase *tctx_base, void *arg) {
+  ThreadContext *tctx = static_cast<ThreadContext*>(tctx_base);
+  LiveThreadStats *stats = static_cast<LiveThreadStats*>(arg);
+  if (tctx->status != ThreadStatusRunning || !tctx->thr)
+    return;
+  uptr clock_size = tctx->thr->clock.size();
+  stats->running++;
+  stats->events += tctx->thr->fast_state.epoch() - tctx->epoch0;
+  stats->max_clock_size = max(stats->max_clock_size, clock_size);
+  stats->sum_clock_size += clock_size;
+}
+
+// Writes a snapshot of the statistics which the runtime maintains anyway, so
+// that a slow run can be looked at while it runs. The snapshot is renamed
+// over the previous one, readers never see a partial file.
+static void WriteLiveStats(Context *ctx, u64 start_ns) {
+  LiveThreadStats threads = {};
+  uptr n_threads, n_running_threads;
+  u64 events;
+  {
+    ThreadRegistryLock l(ctx->thread_registry);
+    ctx->thread_registry->RunCallbackForEachThreadLocked(
+        CollectLiveThreadStats, &threads);
+    ctx->thread_registry->GetNumberOfThreads(&n_threads, &n_running_threads);
+    events = ctx->finished_thread_events + threads.events;
+  }
+  InternalScopedBuffer<char> buf(4096);
+  uptr len = internal_snprintf(buf.data(), buf.size(),
+      "uptime_ms %llu\n"
+      "threads %zu\n"
+      "running_threads %zu\n"
+      "events %llu\n"
+      "trace_switches %llu\n"
+      "races_reported %d\n"
+      "races_missed_expected %d\n"
+      "sync_uids %llu\n"
+      "sync_capacity %zu\n"
+      "max_thread_clock %zu\n"
+      "avg_thread_clock %llu\n"
+      "memory ",
+      (NanoTime() - start_ns) / 1000000, n_threads, threads.running,
+      events, atomic_load(&ctx->trace_switches, memory_order_relaxed),
+      ctx->nreported, ctx->nmissed_expected,
+      ctx->metamap.SyncUidsIssued(), ctx->metamap.SyncCapacity(),
+      threads.max_clock_size,
+      threads.running ? threads.sum_clock_size / threads.running : 0);
+  if (len < buf.size())
+    WriteMemoryProfile(buf.data() + len, buf.size() - len, n_threads,
+                       n_running_threads);
+  InternalScopedString path(kMaxPathLength);
+  path.append("%s.%d", flags()->live_stats_path, (int)internal_getpid());
+  InternalScopedString tmp_path(kMaxPathLength);
+  tmp_path.append("%s.tmp", path.data());
+  fd_t fd = OpenFile(tmp_path.data(), WrOnly);
+  if (fd == kInvalidFd)
+    return;
+  internal_ftruncate(fd, 0);
+  bool written = WriteToFile(fd, buf.data(), internal_strlen(buf.data()));
+  CloseFile(fd);
+  if (written)
+    RenameFile(tmp_path.data(), path.data());
+}
+
 static void BackgroundThread(void *arg) {
   // This is a non-initialized non-user thread, nothing to see here.
   // We don't use ScopedIgnoreInterceptors, because we want ignores to be
@@ -171,6 +254,8 @@ static void BackgroundThread(void *arg) {
   }
 
   u64 last_flush = NanoTime();
+  u64 start = last_flush;
+  u64 last_live_stats = 0;
   uptr last_rss = 0;
   for (int i = 0;
       atomic_load(&ctx->stop_background_thread, memory_order_relaxed) == 0;
@@ -182,7 +267,8 @@ static void BackgroundThread(void *arg) {
     if (flags()->flush_memory_ms > 0) {
       if (last_flush + flags()->flush_memory_ms * kMs2Ns < now) {
         VPrintf(1, "ThreadSanitizer: periodic memory flush\n");
-        FlushShadowMemory();
+        if (!flags()->flush_cold_shadow_only || !FlushColdShadowMemory())
+          FlushShadowMemory();
         last_flush = NanoTime();
       }
     }
@@ -195,17 +281,42 @@ static void BackgroundThread(void *arg) {
               (u64)rss >> 20, (u64)last_rss >> 20, (u64)limit >> 20);
       if (2 * rss > limit + last_rss) {
         VPrintf(1, "ThreadSanitizer: flushing memory due to RSS\n");
-        FlushShadowMemory();
+        // Try to keep hot shadow first and drop everything only if releasing
+        // the cold part is not enough to get under the limit.
+        bool flushed = false;
+        if (flags()->flush_cold_shadow_only && FlushColdShadowMemory()) {
+          rss = GetRSS();
+          flushed = rss <= limit;
+        }
+        if (!flushed)
+          FlushShadowMemory();
         rss = GetRSS();
         VPrintf(1, "ThreadSanitizer: memory flushed RSS=%llu\n", (u64)rss>>20);
       }
       last_rss = rss;
     }
 
+    // Return unused allocator memory to the OS if requested, regardless of
+    // the release interval if we are close to the memory limit.
+    if (common_flags()->allocator_release_to_os_in_background) {
+      uptr limit = uptr(flags()->memory_limit_mb) << 20;
+      allocator()->ReleaseToOSInBackground(limit && last_rss > limit / 10 * 9);
+    }
+
+    // Drop history of idle threads once a second.
+    if (flags()->adaptive_history && (i % 10) == 0)
+      ReleaseIdleTraces();
+
     // Write memory profile if requested.
     if (mprof_fd != kInvalidFd)
       MemoryProfiler(ctx, mprof_fd, i);
 
+    if (flags()->live_stats_path[0] &&
+        last_live_stats + flags()->live_stats_ms * kMs2Ns <= now) {
+      WriteLiveStats(ctx, start);
+      last_live_stats = now;
+    }
+
     // Flush symbolizer cache if requested.
     if (flags()->flush_symbolizer_ms > 0) {
       u64 last = atomic_load(&ctx->last_symbolize_time_ns,
@@ -237,6 +348,19 @@ void DontNeedShadowFor(uptr addr, uptr size) {
   ReleaseMemoryPagesToOS(MemToShadow(addr), MemToShadow(addr + size));
 }
 
+// Zeroes the page aligned range [beg, end) of shadow or meta shadow and gives
+// the memory back to the OS. The mapping is private, so on Linux the released
+// pages read as zeros. madvise is cheaper than mapping the range again, and
+// does not split the shadow into more VMAs.
+void ZeroShadowPages(uptr beg, uptr end) {
+#if SANITIZER_LINUX
+  ReleaseMemoryPagesToOS(beg, end);
+#else
+  UnmapOrDie((void*)beg, end - beg);
+  MmapFixedNoReserve(beg, end - beg);
+#endif
+}
+
 void MapShadow(uptr addr, uptr size) {
   // Global data is not 64K aligned, but there are no adjacent mappings,
   // so we can get away with unaligned mapping.
@@ -322,6 +446,30 @@ static void CheckShadowMapping() {
   }
 }
 
+// The accesses to an 8-byte cell are checked only if the hash of its address
+// is below access_sample_threshold, which is 0 if all the cells are checked.
+static u32 access_sample_threshold;
+static u64 access_sample_seed;
+
+static void InitializeAccessSampling() {
+  if (flags()->access_sample_period <= 1)
+    return;
+  access_sample_threshold =
+      (u32)((1ULL << 32) / (u64)flags()->access_sample_period);
+  access_sample_seed = flags()->access_sample_seed;
+  if (!access_sample_seed)
+    access_sample_seed = NanoTime() ^ ((u64)internal_getpid() << 32);
+  VPrintf(1, "ThreadSanitizer: checking 1/%d of the memory cells (seed %llu)"
+          "\n", flags()->access_sample_period, access_sample_seed);
+}
+
+ALWAYS_INLINE
+static bool IsSampledCell(uptr addr) {
+  u64 h = ((u64)(addr / kShadowCell) ^ access_sample_seed) *
+          0x9e3779b97f4a7c15ULL;
+  return (u32)(h >> 32) < access_sample_threshold;
+}
+
 void Initialize(ThreadState *thr) {
   // Thread safe because done before all threads exist.
   static bool is_initialized = false;
@@ -330,6 +478,7 @@ void Initialize(ThreadState *thr) {
   is_initialized = true;
   // We are not ready to handle interceptors yet.
   ScopedIgnoreInterceptors ignore;
+  InitPhaseTimer timer;
   SanitizerToolName = "ThreadSanitizer";
   // Install tool-specific callbacks in sanitizer_common.
   SetCheckFailedCallback(TsanCheckFailed);
@@ -338,6 +487,8 @@ void Initialize(ThreadState *thr) {
   const char *options = GetEnv(SANITIZER_GO ? "GORACE" : "TSAN_OPTIONS");
   CacheBinaryName();
   InitializeFlags(&ctx->flags, options);
+  timer.EndPhase("flags");
+  InitializeAccessSampling();
   AvoidCVE_2016_2143();
   InitializePlatformEarly();
 #if !SANITIZER_GO
@@ -347,11 +498,13 @@ void Initialize(ThreadState *thr) {
   InitializeAllocator();
   ReplaceSystemMalloc();
 #endif
+  timer.EndPhase("allocator");
   if (common_flags()->detect_deadlocks)
     ctx->dd = DDetector::Create(flags());
   Processor *proc = ProcCreate();
   ProcWire(proc, thr);
   InitializeInterceptors();
+  timer.EndPhase("interceptors");
   CheckShadowMapping();
   InitializePlatform();
   InitializeMutex();
@@ -360,12 +513,15 @@ void Initialize(ThreadState *thr) {
   InitializeShadowMemory();
   InitializeAllocatorLate();
 #endif
+  timer.EndPhase("shadow memory");
   // Setup correct file descriptor for error reports.
   __sanitizer_set_report_path(common_flags()->log_path);
+  // Not lazy even with lazy_init: libignore needs the called_from_lib ones.
   InitializeSuppressions();
 #if !SANITIZER_GO
   InitializeLibIgnore();
-  Symbolizer::GetOrInit()->AddHooks(EnterSymbolizer, ExitSymbolizer);
+  timer.EndPhase("suppressions");
+  Symbolizer::AddHooks(EnterSymbolizer, ExitSymbolizer);
   // On MIPS, TSan initialization is run before
   // __pthread_initialize_minimal_internal() is finished, so we can not spawn
   // new threads.
@@ -386,10 +542,13 @@ void Initialize(ThreadState *thr) {
   __ubsan::InitAsPlugin();
 #endif
   ctx->initialized = true;
+  timer.EndPhase("main thread");
 
 #if !SANITIZER_GO
   Symbolizer::LateInitialize();
+  timer.EndPhase("symbolizer");
 #endif
+  timer.Print();
 
   if (flags()->stop_on_start) {
     Printf("ThreadSanitizer is suspended at startup (pid %d)."
@@ -445,6 +604,9 @@ int Finalize(ThreadState *thr) {
 
   failed = OnFinalize(failed);
 
+  if (common_flags()->self_profile)
+    __sanitizer_print_self_profile();
+
 #if TSAN_COLLECT_STATS
   StatAggregate(ctx->stat, thr->stat);
   StatOutput(ctx->stat);
@@ -521,15 +683,46 @@ u32 CurrentStackId(ThreadState *thr, uptr pc) {
   return id;
 }
 
+// With adaptive_history a thread that fills the ring in less than that,
+// gets a twice larger one.
+static const u64 kTraceGrowNs = 1000 * 1000 * 1000;
+
 void TraceSwitch(ThreadState *thr) {
-  thr->nomalloc++;
   Trace *thr_trace = ThreadTrace(thr->tid);
   Lock l(&thr_trace->mtx);
-  unsigned trace = (thr->fast_state.epoch() / kTracePartSize) % TraceParts();
-  TraceHeader *hdr = &thr_trace->headers[trace];
+  const u64 now = NanoTime();
+  if (thr_trace->ring_start == 0)
+    thr_trace->ring_start = now;
+  uptr part = thr_trace->part + 1;
+  if (part >= thr_trace->nparts) {
+    if (thr_trace->nparts < TraceParts() &&
+        now - thr_trace->ring_start < kTraceGrowNs) {
+      // The thread is busy, continue with the new parts.
+      StatInc(thr, StatTraceGrow);
+      thr_trace->nparts = min(thr_trace->nparts * 2, TraceParts());
+    } else {
+      part = 0;
+    }
+    thr_trace->ring_start = now;
+  }
+  thr_trace->part = part;
+  thr_trace->last_switch = now;
+  atomic_fetch_add(&ctx->trace_switches, 1, memory_order_relaxed);
+  TraceHeader *hdr = &thr_trace->headers[part];
+  // Only threads holding many mutexes get here with a non-empty growth,
+  // nothing else in the switch may allocate.
+  hdr->mset0.Reserve(thr->mset.Size());
+  thr->nomalloc++;
   hdr->epoch0 = thr->fast_state.epoch();
   ObtainCurrentStack(thr, 0, &hdr->stack0);
   hdr->mset0 = thr->mset;
+  u8 *beg = (u8*)GetThreadTrace(thr->tid) + part * kTracePartSize;
+  // The terminator makes the stale events from the previous round invisible
+  // to RestoreStack.
+  beg[0] = 0;
+  thr->trace_pos = beg;
+  thr->trace_end = beg + kTracePartSize - kTraceMaxEventSize;
+  thr->trace_prev_pc = 0;
   thr->nomalloc--;
 }
 
@@ -538,17 +731,48 @@ Trace *ThreadTrace(int tid) {
 }
 
 uptr TraceTopPC(ThreadState *thr) {
-  Event *events = (Event*)GetThreadTrace(thr->tid);
-  uptr pc = events[thr->fast_state.GetTracePos()];
-  return pc;
+  return thr->trace_prev_pc;
+}
+
+static void ReleaseIdleTrace(ThreadContextBase *tctx_base, void *arg) {
+  ThreadContext *tctx = static_cast<ThreadContext*>(tctx_base);
+  if (tctx->status != ThreadStatusRunning)
+    return;
+  const u64 now = *(u64*)arg;
+  Trace *trace = ThreadTrace(tctx->tid);
+  Lock l(&trace->mtx);
+  if (trace->nparts <= 2 || trace->last_switch == 0 ||
+      trace->last_switch + flags()->history_idle_ms * 1000 * 1000ull > now)
+    return;
+  // The thread does not write to the parts except the current one, drop them
+  // and make RestoreStack ignore them.
+  const uptr trace_p = GetThreadTrace(tctx->tid);
+  for (uptr i = 0; i < trace->nparts; i++) {
+    if (i == trace->part)
+      continue;
+    trace->headers[i].epoch0 = (u64)-1;
+    ReleaseMemoryPagesToOS(trace_p + i * kTracePartSize,
+                           trace_p + (i + 1) * kTracePartSize);
+  }
+  // The next switch wraps to the beginning of the small ring.
+  trace->nparts = 2;
+  trace->ring_start = now;
+}
+
+// Drops history of threads that were idle for history_idle_ms,
+// called periodically by the background thread with adaptive_history.
+void ReleaseIdleTraces() {
+  u64 now = NanoTime();
+  ThreadRegistryLock l(ctx->thread_registry);
+  ctx->thread_registry->RunCallbackForEachThreadLocked(ReleaseIdleTrace, &now);
 }
 
 uptr TraceSize() {
-  return (uptr)(1ull << (kTracePartSizeBits + flags()->history_size + 1));
+  return TraceParts() * kTracePartSize;
 }
 
 uptr TraceParts() {
-  return TraceSize() / kTracePartSize;
+  return 2ull << flags()->history_size;
 }
 
 #if !SANITIZER_GO
@@ -625,7 +849,7 @@ void MemoryAccessImpl1(ThreadState *thr, uptr addr,
   // consumes almost 4K of stack. Gtest gives only 4K of stack to death test
   // threads, which is not enough for the unrolled loop.
 #if SANITIZER_DEBUG
-  for (int idx = 0; idx < 4; idx++) {
+  for (int idx = 0; idx < (int)kShadowCnt; idx++) {
 #include "tsan_update_shadow_word_inl.h"
   }
 #else
@@ -633,10 +857,12 @@ void MemoryAccessImpl1(ThreadState *thr, uptr addr,
 #include "tsan_update_shadow_word_inl.h"
   idx = 1;
 #include "tsan_update_shadow_word_inl.h"
+#if TSAN_SHADOW_COUNT > 2
   idx = 2;
 #include "tsan_update_shadow_word_inl.h"
   idx = 3;
 #include "tsan_update_shadow_word_inl.h"
+#endif
 #endif
 
   // we did not find any races and had already stored
@@ -652,24 +878,26 @@ void MemoryAccessImpl1(ThreadState *thr, uptr addr,
   return;
 }
 
+// Returns the size of the largest access at the beginning of [addr, addr+size)
+// that fits into a single shadow cell.
+ALWAYS_INLINE
+static int CellAccessSizeLog(uptr addr, uptr size) {
+  if (size >= 8 && (addr & ~7) == ((addr + 7) & ~7))
+    return kSizeLog8;
+  if (size >= 4 && (addr & ~7) == ((addr + 3) & ~7))
+    return kSizeLog4;
+  if (size >= 2 && (addr & ~7) == ((addr + 1) & ~7))
+    return kSizeLog2;
+  return kSizeLog1;
+}
+
 void UnalignedMemoryAccess(ThreadState *thr, uptr pc, uptr addr,
     int size, bool kAccessIsWrite, bool kIsAtomic) {
   while (size) {
-    int size1 = 1;
-    int kAccessSizeLog = kSizeLog1;
-    if (size >= 8 && (addr & ~7) == ((addr + 7) & ~7)) {
-      size1 = 8;
-      kAccessSizeLog = kSizeLog8;
-    } else if (size >= 4 && (addr & ~7) == ((addr + 3) & ~7)) {
-      size1 = 4;
-      kAccessSizeLog = kSizeLog4;
-    } else if (size >= 2 && (addr & ~7) == ((addr + 1) & ~7)) {
-      size1 = 2;
-      kAccessSizeLog = kSizeLog2;
-    }
+    int kAccessSizeLog = CellAccessSizeLog(addr, size);
     MemoryAccess(thr, pc, addr, kAccessSizeLog, kAccessIsWrite, kIsAtomic);
-    addr += size1;
-    size -= size1;
+    addr += 1 << kAccessSizeLog;
+    size -= 1 << kAccessSizeLog;
   }
 }
 
@@ -688,7 +916,8 @@ bool ContainsSameAccessSlow(u64 *s, u64 a, u64 sync_epoch, bool is_write) {
   return false;
 }
 
-#if defined(__SSE3__)
+// The SSE version processes exactly 4 shadow slots.
+#if defined(__SSE3__) && TSAN_SHADOW_COUNT == 4
 #define SHUF(v0, v1, i0, i1, i2, i3) _mm_castps_si128(_mm_shuffle_ps( \
     _mm_castsi128_ps(v0), _mm_castsi128_ps(v1), \
     (i0)*1 + (i1)*4 + (i2)*16 + (i3)*64))
@@ -748,7 +977,7 @@ bool ContainsSameAccessFast(u64 *s, u64 a, u64 sync_epoch, bool is_write) {
 
 ALWAYS_INLINE
 bool ContainsSameAccess(u64 *s, u64 a, u64 sync_epoch, bool is_write) {
-#if defined(__SSE3__)
+#if defined(__SSE3__) && TSAN_SHADOW_COUNT == 4
   bool res = ContainsSameAccessFast(s, a, sync_epoch, is_write);
   // NOTE: this check can fail if the shadow is concurrently mutated
   // by other threads. But it still can be useful if you modify
@@ -781,6 +1010,14 @@ void MemoryAccess(ThreadState *thr, uptr pc, uptr addr,
   }
 #endif
 
+  if (UNLIKELY(access_sample_threshold) && !IsSampledCell(addr)) {
+    StatInc(thr, StatMop);
+    StatInc(thr, kAccessIsWrite ? StatMopWrite : StatMopRead);
+    StatInc(thr, (StatType)(StatMop1 + kAccessSizeLog));
+    StatInc(thr, StatMopUnsampled);
+    return;
+  }
+
   if (!SANITIZER_GO && *shadow_mem == kShadowRodata) {
     // Access to .rodata section, no races here.
     // Measurements show that it can be 10-20% of all memory accesses.
@@ -830,6 +1067,13 @@ ALWAYS_INLINE USED
 void MemoryAccessImpl(ThreadState *thr, uptr addr,
     int kAccessSizeLog, bool kAccessIsWrite, bool kIsAtomic,
     u64 *shadow_mem, Shadow cur) {
+  if (UNLIKELY(access_sample_threshold) && !IsSampledCell(addr)) {
+    StatInc(thr, StatMop);
+    StatInc(thr, kAccessIsWrite ? StatMopWrite : StatMopRead);
+    StatInc(thr, (StatType)(StatMop1 + kAccessSizeLog));
+    StatInc(thr, StatMopUnsampled);
+    return;
+  }
   if (LIKELY(ContainsSameAccess(shadow_mem, cur.raw(),
       thr->fast_synch_epoch, kAccessIsWrite))) {
     StatInc(thr, StatMop);
@@ -843,6 +1087,91 @@ void MemoryAccessImpl(ThreadState *thr, uptr addr,
       shadow_mem, cur);
 }
 
+ALWAYS_INLINE
+static bool BatchAccessIsSame(ThreadState *thr, uptr addr, uptr size,
+                              Shadow cur, bool is_write) {
+  while (size) {
+    int size_log = CellAccessSizeLog(addr, size);
+    Shadow s = cur;
+    s.SetAddr0AndSizeLog(addr & 7, size_log);
+    if (!ContainsSameAccess((u64*)MemToShadow(addr), s.raw(),
+                            thr->fast_synch_epoch, is_write))
+      return false;
+    addr += 1 << size_log;
+    size -= 1 << size_log;
+  }
+  return true;
+}
+
+void MemoryAccessBatch(ThreadState *thr, uptr pc, uptr addr, uptr size,
+                       uptr stride, uptr n, bool is_write) {
+  if (size == 0 || n == 0)
+    return;
+  DPrintf2("#%d: MemoryAccessBatch: @%p %p size=%d stride=%d n=%d"
+      " is_write=%d\n", thr->tid, (void*)pc, (void*)addr, (int)size,
+      (int)stride, (int)n, is_write);
+  StatInc(thr, StatMopBatch);
+
+  u64 *shadow_mem = (u64*)MemToShadow(addr);
+  if (!SANITIZER_GO && *shadow_mem == kShadowRodata) {
+    StatInc(thr, StatMopRangeRodata);
+    return;
+  }
+
+  FastState fast_state = thr->fast_state;
+  if (fast_state.GetIgnoreBit())
+    return;
+
+  Shadow cur(fast_state);
+  cur.SetWrite(is_write);
+
+  // In loops the batch usually covers memory that the thread has already
+  // accessed in the current synch epoch. Such accesses only need the (SIMD)
+  // shadow comparison; the trace event and the full shadow update are done
+  // starting from the first access that is not like that.
+  uptr i = 0;
+  if (size <= 8 && IsPowerOfTwo(size) && ((addr | stride) & (size - 1)) == 0) {
+    // Naturally aligned accesses fit into a single cell each.
+    const int size_log = MostSignificantSetBitIndex(size);
+    for (; i < n; i++) {
+      uptr a = addr + i * stride;
+      Shadow s = cur;
+      s.SetAddr0AndSizeLog(a & 7, size_log);
+      if (!ContainsSameAccess((u64*)MemToShadow(a), s.raw(),
+                              thr->fast_synch_epoch, is_write))
+        break;
+    }
+  } else {
+    while (i < n && BatchAccessIsSame(thr, addr + i * stride, size, cur,
+                                      is_write))
+      i++;
+  }
+  if (i == n) {
+    StatInc(thr, StatMopBatchSame);
+    return;
+  }
+
+  if (kCollectHistory) {
+    fast_state.IncrementEpoch();
+    thr->fast_state = fast_state;
+    TraceAddEvent(thr, fast_state, EventTypeMop, pc);
+    cur.IncrementEpoch();
+  }
+
+  for (; i < n; i++) {
+    uptr a = addr + i * stride;
+    for (uptr sz = size; sz;) {
+      int size_log = CellAccessSizeLog(a, sz);
+      Shadow s = cur;
+      s.SetAddr0AndSizeLog(a & 7, size_log);
+      MemoryAccessImpl(thr, a, size_log, is_write, false,
+          (u64*)MemToShadow(a), s);
+      a += 1 << size_log;
+      sz -= 1 << size_log;
+    }
+  }
+}
+
 static void MemoryRangeSet(ThreadState *thr, uptr pc, uptr addr, uptr size,
                            u64 val) {
   (void)thr;
@@ -893,8 +1222,7 @@ static void MemoryRangeSet(ThreadState *thr, uptr pc, uptr addr, uptr size,
     // Reset middle part.
     u64 *p1 = p;
     p = RoundDown(end, kPageSize);
-    UnmapOrDie((void*)p1, (uptr)p - (uptr)p1);
-    MmapFixedNoReserve((uptr)p1, (uptr)p - (uptr)p1);
+    ZeroShadowPages((uptr)p1, (uptr)p);
     // Set the ending.
     while (p < end) {
       *p++ = val;
@@ -980,6 +1308,23 @@ void FuncExit(ThreadState *thr) {
   thr->shadow_stack_pos--;
 }
 
+#if !SANITIZER_GO
+// Every function entry and exit increments the epoch, so while the epoch stays
+// the same so does the shadow stack, and the depot id saved for the previous
+// ignore can be reused (e.g. for the sync ignore that follows a mop ignore).
+static u32 IgnoreStackId(ThreadState *thr, uptr pc) {
+  u64 epoch = thr->fast_state.epoch();
+  if (kCollectHistory && thr->ignore_stack_id &&
+      thr->ignore_stack_epoch == epoch && thr->ignore_stack_pc == pc)
+    return thr->ignore_stack_id;
+  u32 id = CurrentStackId(thr, pc);
+  thr->ignore_stack_id = id;
+  thr->ignore_stack_epoch = epoch;
+  thr->ignore_stack_pc = pc;
+  return id;
+}
+#endif
+
 void ThreadIgnoreBegin(ThreadState *thr, uptr pc, bool save_stack) {
   DPrintf("#%d: ThreadIgnoreBegin\n", thr->tid);
   thr->ignore_reads_and_writes++;
@@ -987,7 +1332,7 @@ void ThreadIgnoreBegin(ThreadState *thr, uptr pc, bool save_stack) {
   thr->fast_state.SetIgnoreBit();
 #if !SANITIZER_GO
   if (save_stack && !ctx->after_multithreaded_fork)
-    thr->mop_ignore_set.Add(CurrentStackId(thr, pc));
+    thr->mop_ignore_set.Add(IgnoreStackId(thr, pc));
 #endif
 }
 
@@ -1017,7 +1362,7 @@ void ThreadIgnoreSyncBegin(ThreadState *thr, uptr pc, bool save_stack) {
   CHECK_GT(thr->ignore_sync, 0);
 #if !SANITIZER_GO
   if (save_stack && !ctx->after_multithreaded_fork)
-    thr->sync_ignore_set.Add(CurrentStackId(thr, pc));
+    thr->sync_ignore_set.Add(IgnoreStackId(thr, pc));
 #endif
 }
 
@@ -1047,6 +1392,12 @@ void build_consistency_stats() {}
 void build_consistency_nostats() {}
 #endif
 
+#if TSAN_SHADOW_COUNT == 2
+void build_consistency_shadow2() {}
+#else
+void build_consistency_shadow4() {}
+#endif
+
 }  // namespace __tsan
 
 #if !SANITIZER_GO
@@ -72,7 +72,7 @@ struct AP64 {  // Allocator64 parameters. Deliberately using a short name.
   static const uptr kMetadataSize = 0;
   typedef DefaultSizeClassMap SizeClassMap;
   typedef __tsan::MapUnmapCallback MapUnmapCallback;
-  static const uptr kFlags = 0;
+  static const uptr kFlags = kToolAllocator64Flags;
 };
 typedef SizeClassAllocator64<AP64> PrimaryAllocator;
 #endif
@@ -153,14 +153,6 @@ class FastState {
     SetHistorySize(0);
   }
 
-  ALWAYS_INLINE
-  u64 GetTracePos() const {
-    const int hs = GetHistorySize();
-    // When hs == 0, the trace consists of 2 parts.
-    const u64 mask = (1ull << (kTracePartSizeBits + hs + 1)) - 1;
-    return epoch() & mask;
-  }
-
  private:
   friend class Shadow;
   static const int kTidShift = 64 - kTidBits - 1;
@@ -339,16 +331,27 @@ struct JmpBuf {
 // In Go it is tied to a P, so there are significantly fewer Processor's than
 // ThreadState's (which are tied to Gs).
 // A ThreadState must be wired with a Processor to handle events.
+#if !SANITIZER_GO
+const uptr kDeferredFreeBatch = 64;
+#endif
+
 struct Processor {
   ThreadState *thr; // currently wired thread, or nullptr
 #if !SANITIZER_GO
   AllocatorCache alloc_cache;
   InternalAllocatorCache internal_alloc_cache;
+  // Heap blocks freed on this processor which are not yet returned to the
+  // allocator, see user_free.
+  uptr deferred_free[kDeferredFreeBatch];
+  uptr n_deferred_free;
 #endif
   DenseSlabAllocCache block_cache;
   DenseSlabAllocCache sync_cache;
   DenseSlabAllocCache clock_cache;
   DDPhysicalThread *dd_pt;
+  // Range of sync object uids reserved for this processor, see MetaMap.
+  u64 sync_uid_pos;
+  u64 sync_uid_end;
 };
 
 #if !SANITIZER_GO
@@ -376,6 +379,12 @@ struct ThreadState {
   // taken by epoch between synchs.
   // This way we can save one load from tls.
   u64 fast_synch_epoch;
+  // Where the next event goes in the current trace part. When trace_pos
+  // reaches trace_end, TraceAddEvent switches to the next part.
+  u8 *trace_pos;
+  u8 *trace_end;
+  // The last non-zero PC written to the current trace part.
+  uptr trace_prev_pc;
   // This is a slow path flag. On fast path, fast_state.GetIgnoreBit() is read.
   // We do not distinguish beteween ignoring reads and writes
   // for better performance.
@@ -385,6 +394,11 @@ struct ThreadState {
 #if !SANITIZER_GO
   IgnoreSet mop_ignore_set;
   IgnoreSet sync_ignore_set;
+  // The stack id last saved for an ignore, and the epoch and pc it was
+  // saved at.
+  u32 ignore_stack_id;
+  u64 ignore_stack_epoch;
+  uptr ignore_stack_pc;
 #endif
   // C/C++ uses fixed size shadow stack embed into Trace.
   // Go uses malloc-allocated shadow stack with dynamic size.
@@ -395,6 +409,25 @@ struct ThreadState {
   u64 racy_state[2];
   MutexSet mset;
   ThreadClock clock;
+  // Sync objects of atomics recently acquired by the thread, together with
+  // the clock version they were acquired at. Indexed by AtomicCacheIndex.
+  struct AtomicAcquire {
+    uptr addr;
+    SyncVar *sync;
+    u64 uid;
+    u32 version;
+  };
+  static const uptr kAtomicAcquireCacheSize = 16;
+  AtomicAcquire atomic_acquire_cache[kAtomicAcquireCacheSize];
+  // Sync objects of mutexes recently locked or unlocked by the thread,
+  // so that repeated operations on the same mutex skip the meta map lookup.
+  struct MutexCacheEntry {
+    uptr addr;
+    SyncVar *sync;
+    u64 uid;
+  };
+  static const uptr kMutexCacheSize = 8;
+  MutexCacheEntry mutex_cache[kMutexCacheSize];
 #if !SANITIZER_GO
   Vector<JmpBuf> jmp_bufs;
   int ignore_interceptors;
@@ -410,6 +443,9 @@ struct ThreadState {
   bool is_dead;
   bool is_freeing;
   bool is_vptr_access;
+  // Set for the ThreadStates created by FiberCreate, which do not own an OS
+  // thread, its stack or its TLS.
+  bool is_fiber;
   uptr external_tag;
   const uptr stk_addr;
   const uptr stk_size;
@@ -444,6 +480,12 @@ struct ThreadState {
 
   const ReportDesc *current_report;
 
+#if !SANITIZER_GO
+  // Only used in the ThreadState of an OS thread: the fiber that currently
+  // runs on the thread, or nullptr if the thread runs on its own state.
+  ThreadState *current_fiber;
+#endif
+
   explicit ThreadState(Context *ctx, int tid, int unique_id, u64 epoch,
                        unsigned reuse_count,
                        uptr stk_addr, uptr stk_size,
@@ -451,14 +493,24 @@ struct ThreadState {
 };
 
 #if !SANITIZER_GO
+// cur_thread() returns the state of the fiber that runs on the current
+// thread, if any. set_cur_thread() makes thr, which is either a fiber or the
+// thread's own state, the current one.
 #if SANITIZER_MAC || SANITIZER_ANDROID
 ThreadState *cur_thread();
+void set_cur_thread(ThreadState *thr);
 void cur_thread_finalize();
 #else
 __attribute__((tls_model("initial-exec")))
 extern THREADLOCAL char cur_thread_placeholder[];
 INLINE ThreadState *cur_thread() {
-  return reinterpret_cast<ThreadState *>(&cur_thread_placeholder);
+  ThreadState *thr = reinterpret_cast<ThreadState *>(&cur_thread_placeholder);
+  ThreadState *fiber = thr->current_fiber;
+  return LIKELY(!fiber) ? thr : fiber;
+}
+INLINE void set_cur_thread(ThreadState *thr) {
+  ThreadState *self = reinterpret_cast<ThreadState *>(&cur_thread_placeholder);
+  self->current_fiber = thr == self ? nullptr : thr;
 }
 INLINE void cur_thread_finalize() { }
 #endif  // SANITIZER_MAC || SANITIZER_ANDROID
@@ -525,17 +577,27 @@ struct Context {
   void *background_thread;
   atomic_uint32_t stop_background_thread;
 
+  // Always collected statistics, for live_stats_path.
+  atomic_uint64_t trace_switches;
+  // Trace events of the finished threads, protected by thread_registry.
+  u64 finished_thread_events;
+
   ThreadRegistry *thread_registry;
 
   Mutex racy_mtx;
   Vector<RacyStacks> racy_stacks;
   Vector<RacyAddress> racy_addresses;
+  // Hashes of the instruction pairs of output race reports, a small
+  // open-addressing table accessed without locks (see suppress_equal_pcs).
+  static const uptr kRacyPcsSize = 1024;
+  atomic_uint64_t racy_pcs[kRacyPcsSize];
   // Number of fired suppressions may be large enough.
   Mutex fired_suppressions_mtx;
   InternalMmapVector<FiredSuppression> fired_suppressions;
   DDetector *dd;
 
   ClockAlloc clock_alloc;
+  ClockRefs clock_refs;
 
   Flags flags;
 
@@ -569,8 +631,9 @@ class ScopedReport {
   explicit ScopedReport(ReportType typ);
   ~ScopedReport();
 
-  void AddMemoryAccess(uptr addr, uptr external_tag, Shadow s, StackTrace stack,
-                       const MutexSet *mset);
+  // The stack must come from SymbolizeStack, the report takes ownership.
+  void AddMemoryAccess(uptr addr, uptr external_tag, Shadow s,
+                       ReportStack *stack, const MutexSet *mset);
   void AddStack(StackTrace stack, bool suppressable = false);
   void AddThread(const ThreadContext *tctx, bool suppressable = false);
   void AddThread(int unique_tid, bool suppressable = false);
@@ -630,6 +693,7 @@ void ALWAYS_INLINE StatSet(ThreadState *thr, StatType typ, u64 n) {
 void MapShadow(uptr addr, uptr size);
 void MapThreadTrace(uptr addr, uptr size, const char *name);
 void DontNeedShadowFor(uptr addr, uptr size);
+void ZeroShadowPages(uptr beg, uptr end);
 void InitializeShadowMemory();
 void InitializeInterceptors();
 void InitializeLibIgnore();
@@ -677,6 +741,11 @@ void MemoryAccessImpl(ThreadState *thr, uptr addr,
     u64 *shadow_mem, Shadow cur);
 void MemoryAccessRange(ThreadState *thr, uptr pc, uptr addr,
     uptr size, bool is_write);
+// Checks n accesses of size bytes each at addr, addr + stride, ...
+// as if they were done from pc, with at most one trace event.
+// The accesses do not need to be aligned.
+void MemoryAccessBatch(ThreadState *thr, uptr pc, uptr addr, uptr size,
+                       uptr stride, uptr n, bool is_write);
 void MemoryAccessRangeStep(ThreadState *thr, uptr pc, uptr addr,
     uptr size, uptr step, bool is_write);
 void UnalignedMemoryAccess(ThreadState *thr, uptr pc, uptr addr,
@@ -730,6 +799,19 @@ void ThreadSetName(ThreadState *thr, const char *name);
 int ThreadCount(ThreadState *thr);
 void ProcessPendingSignals(ThreadState *thr);
 
+#if !SANITIZER_GO
+enum FiberSwitchFlags {
+  // Do not synchronize the fibers on the switch, for the schedulers that
+  // synchronize their tasks themselves.
+  FiberSwitchFlagNoSync = 1 << 0,
+};
+
+ThreadState *FiberCreate(ThreadState *thr, uptr pc, unsigned flags);
+void FiberDestroy(ThreadState *thr, uptr pc, ThreadState *fiber);
+void FiberSwitch(ThreadState *thr, uptr pc, ThreadState *fiber,
+                 unsigned flags);
+#endif
+
 Processor *ProcCreate();
 void ProcDestroy(Processor *proc);
 void ProcWire(Processor *proc, ThreadState *thr);
@@ -792,6 +874,7 @@ uptr TraceTopPC(ThreadState *thr);
 uptr TraceSize();
 uptr TraceParts();
 Trace *ThreadTrace(int tid);
+void ReleaseIdleTraces();
 
 extern "C" void __tsan_trace_switch();
 void ALWAYS_INLINE TraceAddEvent(ThreadState *thr, FastState fs,
@@ -801,19 +884,22 @@ void ALWAYS_INLINE TraceAddEvent(ThreadState *thr, FastState fs,
   DCHECK_GE((int)typ, 0);
   DCHECK_LE((int)typ, 7);
   DCHECK_EQ(GetLsb(addr, 61), addr);
+  DCHECK_EQ(fs.tid(), thr->tid);
   StatInc(thr, StatEvents);
-  u64 pos = fs.GetTracePos();
-  if (UNLIKELY((pos % kTracePartSize) == 0)) {
+  if (UNLIKELY(thr->trace_pos >= thr->trace_end)) {
 #if !SANITIZER_GO
     HACKY_CALL(__tsan_trace_switch);
 #else
     TraceSwitch(thr);
 #endif
   }
-  Event *trace = (Event*)GetThreadTrace(fs.tid());
-  Event *evp = &trace[pos];
-  Event ev = (u64)addr | ((u64)typ << 61);
-  *evp = ev;
+  u64 v = addr;
+  if (typ == EventTypeMop || typ == EventTypeFuncEnter) {
+    v = TraceEncodePc(addr, thr->trace_prev_pc);
+    if (addr)
+      thr->trace_prev_pc = addr;
+  }
+  thr->trace_pos = TraceEncodeEvent(thr->trace_pos, typ, v);
 }
 
 #if !SANITIZER_GO
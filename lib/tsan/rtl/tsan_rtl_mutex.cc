@@ -46,6 +46,39 @@ void DDMutexInit(ThreadState *thr, uptr pc, SyncVar *s) {
   s->dd.ctx = s->GetId();
 }
 
+// Returns the locked sync object for the mutex at addr. The per-thread cache
+// is validated under the sync object lock the same way MetaMap::GetAndLock
+// validates its lock-free lookup: sync objects are never unmapped, and uid
+// changes whenever one is freed or reused.
+static SyncVar *GetMutexAndLock(ThreadState *thr, uptr pc, uptr addr,
+                                bool write_lock) {
+  ThreadState::MutexCacheEntry *e =
+      &thr->mutex_cache[(addr >> 3) % ThreadState::kMutexCacheSize];
+  if (e->addr == addr) {
+    SyncVar *s = e->sync;
+    if (write_lock)
+      s->mtx.Lock();
+    else
+      s->mtx.ReadLock();
+    if (s->addr == addr && s->uid == e->uid) {
+      StatInc(thr, StatMutexCacheHit);
+      return s;
+    }
+    if (write_lock)
+      s->mtx.Unlock();
+    else
+      s->mtx.ReadUnlock();
+  }
+  SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, addr, write_lock);
+  // A reset sync object has uid 0, don't let it match a freed one.
+  if (s->uid != 0) {
+    e->addr = addr;
+    e->sync = s;
+    e->uid = s->uid;
+  }
+  return s;
+}
+
 static void ReportMutexMisuse(ThreadState *thr, uptr pc, ReportType typ,
     uptr addr, u64 mid) {
   // In Go, these misuses are either impossible, or detected by std lib,
@@ -141,7 +174,7 @@ void MutexDestroy(ThreadState *thr, uptr pc, uptr addr) {
 void MutexPreLock(ThreadState *thr, uptr pc, uptr addr, u32 flagz) {
   DPrintf("#%d: MutexPreLock %zx flagz=0x%x\n", thr->tid, addr, flagz);
   if (!(flagz & MutexFlagTryLock) && common_flags()->detect_deadlocks) {
-    SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, addr, false);
+    SyncVar *s = GetMutexAndLock(thr, pc, addr, false);
     s->UpdateFlags(flagz);
     if (s->owner_tid != thr->tid) {
       Callback cb(thr, pc);
@@ -163,7 +196,7 @@ void MutexPostLock(ThreadState *thr, uptr pc, uptr addr, u32 flagz, int rec) {
     rec = 1;
   if (IsAppMem(addr))
     MemoryReadAtomic(thr, pc, addr, kSizeLog1);
-  SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, addr, true);
+  SyncVar *s = GetMutexAndLock(thr, pc, addr, true);
   s->UpdateFlags(flagz);
   thr->fast_state.IncrementEpoch();
   TraceAddEvent(thr, thr->fast_state, EventTypeLock, s->GetId());
@@ -187,7 +220,9 @@ void MutexPostLock(ThreadState *thr, uptr pc, uptr addr, u32 flagz, int rec) {
   } else if (!s->IsFlagSet(MutexFlagWriteReentrant)) {
     StatInc(thr, StatMutexRecLock);
   }
-  thr->mset.Add(s->GetId(), true, thr->fast_state.epoch());
+  s->owner_mset_pos = thr->mset.Add(s->GetId(), true,
+                                    thr->fast_state.epoch(),
+                                    s->owner_mset_pos);
   bool pre_lock = false;
   if (first && common_flags()->detect_deadlocks) {
     pre_lock = (flagz & MutexFlagDoPreLockOnPostLock) &&
@@ -213,7 +248,7 @@ int MutexUnlock(ThreadState *thr, uptr pc, uptr addr, u32 flagz) {
   DPrintf("#%d: MutexUnlock %zx flagz=0x%x\n", thr->tid, addr, flagz);
   if (IsAppMem(addr))
     MemoryReadAtomic(thr, pc, addr, kSizeLog1);
-  SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, addr, true);
+  SyncVar *s = GetMutexAndLock(thr, pc, addr, true);
   thr->fast_state.IncrementEpoch();
   TraceAddEvent(thr, thr->fast_state, EventTypeUnlock, s->GetId());
   int rec = 0;
@@ -234,7 +269,7 @@ int MutexUnlock(ThreadState *thr, uptr pc, uptr addr, u32 flagz) {
       StatInc(thr, StatMutexRecUnlock);
     }
   }
-  thr->mset.Del(s->GetId(), true);
+  thr->mset.Del(s->GetId(), true, s->owner_mset_pos);
   if (common_flags()->detect_deadlocks && s->recursion == 0 &&
       !report_bad_unlock) {
     Callback cb(thr, pc);
@@ -255,7 +290,7 @@ int MutexUnlock(ThreadState *thr, uptr pc, uptr addr, u32 flagz) {
 void MutexPreReadLock(ThreadState *thr, uptr pc, uptr addr, u32 flagz) {
   DPrintf("#%d: MutexPreReadLock %zx flagz=0x%x\n", thr->tid, addr, flagz);
   if (!(flagz & MutexFlagTryLock) && common_flags()->detect_deadlocks) {
-    SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, addr, false);
+    SyncVar *s = GetMutexAndLock(thr, pc, addr, false);
     s->UpdateFlags(flagz);
     Callback cb(thr, pc);
     ctx->dd->MutexBeforeLock(&cb, &s->dd, false);
@@ -269,7 +304,7 @@ void MutexPostReadLock(ThreadState *thr, uptr pc, uptr addr, u32 flagz) {
   StatInc(thr, StatMutexReadLock);
   if (IsAppMem(addr))
     MemoryReadAtomic(thr, pc, addr, kSizeLog1);
-  SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, addr, false);
+  SyncVar *s = GetMutexAndLock(thr, pc, addr, false);
   s->UpdateFlags(flagz);
   thr->fast_state.IncrementEpoch();
   TraceAddEvent(thr, thr->fast_state, EventTypeRLock, s->GetId());
@@ -309,7 +344,7 @@ void MutexReadUnlock(ThreadState *thr, uptr pc, uptr addr) {
   StatInc(thr, StatMutexReadUnlock);
   if (IsAppMem(addr))
     MemoryReadAtomic(thr, pc, addr, kSizeLog1);
-  SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, addr, true);
+  SyncVar *s = GetMutexAndLock(thr, pc, addr, true);
   thr->fast_state.IncrementEpoch();
   TraceAddEvent(thr, thr->fast_state, EventTypeRUnlock, s->GetId());
   bool report_bad_unlock = false;
@@ -340,7 +375,7 @@ void MutexReadOrWriteUnlock(ThreadState *thr, uptr pc, uptr addr) {
   DPrintf("#%d: MutexReadOrWriteUnlock %zx\n", thr->tid, addr);
   if (IsAppMem(addr))
     MemoryReadAtomic(thr, pc, addr, kSizeLog1);
-  SyncVar *s = ctx->metamap.GetOrCreateAndLock(thr, pc, addr, true);
+  SyncVar *s = GetMutexAndLock(thr, pc, addr, true);
   bool write = true;
   bool report_bad_unlock = false;
   if (s->owner_tid == SyncVar::kInvalidTid) {
@@ -367,7 +402,7 @@ void MutexReadOrWriteUnlock(ThreadState *thr, uptr pc, uptr addr) {
     s->SetFlags(MutexFlagBroken);
     report_bad_unlock = true;
   }
-  thr->mset.Del(s->GetId(), write);
+  thr->mset.Del(s->GetId(), write, s->owner_mset_pos);
   if (common_flags()->detect_deadlocks && s->recursion == 0) {
     Callback cb(thr, pc);
     ctx->dd->MutexBeforeUnlock(&cb, &s->dd, write);
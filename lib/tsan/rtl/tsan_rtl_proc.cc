@@ -18,7 +18,33 @@
 
 namespace __tsan {
 
+// Processors of the finished threads are kept with their caches for the next
+// threads, so that programs which start a thread per task do not fill and
+// drain the caches for every thread.
+static const uptr kMaxIdleProcs = 16;
+static StaticSpinMutex idle_procs_mtx;
+static Processor *idle_procs[kMaxIdleProcs];
+static uptr n_idle_procs;
+
+static Processor *ProcPopIdle() {
+  SpinMutexLock l(&idle_procs_mtx);
+  return n_idle_procs ? idle_procs[--n_idle_procs] : nullptr;
+}
+
+static bool ProcPushIdle(Processor *proc) {
+  SpinMutexLock l(&idle_procs_mtx);
+  if (n_idle_procs == kMaxIdleProcs)
+    return false;
+  idle_procs[n_idle_procs++] = proc;
+  return true;
+}
+
 Processor *ProcCreate() {
+  if (Processor *proc = ProcPopIdle()) {
+    if (common_flags()->detect_deadlocks)
+      proc->dd_pt = ctx->dd->CreatePhysicalThread();
+    return proc;
+  }
   void *mem = InternalAlloc(sizeof(Processor));
   internal_memset(mem, 0, sizeof(Processor));
   Processor *proc = new(mem) Processor;
@@ -33,13 +59,17 @@ Processor *ProcCreate() {
 
 void ProcDestroy(Processor *proc) {
   CHECK_EQ(proc->thr, nullptr);
+  // The deadlock detector state belongs to the thread, not to the caches.
+  if (common_flags()->detect_deadlocks)
+     ctx->dd->DestroyPhysicalThread(proc->dd_pt);
+  proc->dd_pt = nullptr;
+  if (ProcPushIdle(proc))
+    return;
 #if !SANITIZER_GO
   AllocatorProcFinish(proc);
 #endif
   ctx->clock_alloc.FlushCache(&proc->clock_cache);
   ctx->metamap.OnProcIdle(proc);
-  if (common_flags()->detect_deadlocks)
-     ctx->dd->DestroyPhysicalThread(proc->dd_pt);
   proc->~Processor();
   InternalFree(proc);
 }
@@ -150,9 +150,11 @@ ScopedReport::ScopedReport(ReportType typ) {
   rep_->typ = typ;
   ctx->report_mtx.Lock();
   CommonSanitizerReportMutex.Lock();
+  report_file.StartBuffering();
 }
 
 ScopedReport::~ScopedReport() {
+  report_file.FinishBuffering();
   CommonSanitizerReportMutex.Unlock();
   ctx->report_mtx.Unlock();
   DestroyAndFree(rep_);
@@ -165,7 +167,7 @@ void ScopedReport::AddStack(StackTrace stack, bool suppressable) {
 }
 
 void ScopedReport::AddMemoryAccess(uptr addr, uptr external_tag, Shadow s,
-                                   StackTrace stack, const MutexSet *mset) {
+                                   ReportStack *stack, const MutexSet *mset) {
   void *mem = internal_alloc(MBlockReportMop, sizeof(ReportMop));
   ReportMop *mop = new(mem) ReportMop;
   rep_->mops.PushBack(mop);
@@ -174,7 +176,7 @@ void ScopedReport::AddMemoryAccess(uptr addr, uptr external_tag, Shadow s,
   mop->size = s.size();
   mop->write = s.IsWrite();
   mop->atomic = s.IsAtomic();
-  mop->stack = SymbolizeStack(stack);
+  mop->stack = stack;
   mop->external_tag = external_tag;
   if (mop->stack)
     mop->stack->suppressable = true;
@@ -381,33 +383,54 @@ void RestoreStack(int tid, const u64 epoch, VarSizeStackTrace *stk,
   // This function restores stack trace and mutex set for the thread/epoch.
   // It does so by getting stack trace and mutex set at the beginning of
   // trace part, and then replaying the trace till the given epoch.
+  // Each event advances the epoch by one, so the part that contains
+  // the epoch is the one with the latest start epoch not after it.
   Trace* trace = ThreadTrace(tid);
   ReadLock l(&trace->mtx);
-  const int partidx = (epoch / kTracePartSize) % TraceParts();
-  TraceHeader* hdr = &trace->headers[partidx];
-  if (epoch < hdr->epoch0 || epoch >= hdr->epoch0 + kTracePartSize)
+  const uptr nparts = TraceParts();
+  TraceHeader* hdr = 0;
+  uptr partidx = 0;
+  for (uptr i = 0; i < nparts; i++) {
+    TraceHeader *h = &trace->headers[i];
+    if (h->epoch0 <= epoch && (hdr == 0 || h->epoch0 > hdr->epoch0)) {
+      hdr = h;
+      partidx = i;
+    }
+  }
+  if (hdr == 0)
     return;
-  CHECK_EQ(RoundDown(epoch, kTracePartSize), hdr->epoch0);
-  const u64 epoch0 = RoundDown(epoch, TraceSize());
-  const u64 eend = epoch % TraceSize();
-  const u64 ebegin = RoundDown(eend, kTracePartSize);
-  DPrintf("#%d: RestoreStack epoch=%zu ebegin=%zu eend=%zu partidx=%d\n",
-          tid, (uptr)epoch, (uptr)ebegin, (uptr)eend, partidx);
+  const u64 ebegin = hdr->epoch0;
+  DPrintf("#%d: RestoreStack epoch=%zu ebegin=%zu partidx=%zu\n",
+          tid, (uptr)epoch, (uptr)ebegin, partidx);
   Vector<uptr> stack(MBlockReportStack);
   stack.Resize(hdr->stack0.size + 64);
   for (uptr i = 0; i < hdr->stack0.size; i++) {
     stack[i] = hdr->stack0.trace[i];
     DPrintf2("  #%02zu: pc=%zx\n", i, stack[i]);
   }
-  if (mset)
+  if (mset) {
+    mset->Reserve(hdr->mset0.Size());
     *mset = hdr->mset0;
+  }
   uptr pos = hdr->stack0.size;
-  Event *events = (Event*)GetThreadTrace(tid);
-  for (uptr i = ebegin; i <= eend; i++) {
-    Event ev = events[i];
-    EventType typ = (EventType)(ev >> 61);
-    uptr pc = (uptr)(ev & ((1ull << 61) - 1));
-    DPrintf2("  %zu typ=%d pc=%zx\n", i, typ, pc);
+  const u8 *p = (const u8*)GetThreadTrace(tid) + partidx * kTracePartSize;
+  const u8 *end = p + kTracePartSize;
+  uptr prev_pc = 0;
+  // If the part ends before the epoch (the trace is being written
+  // concurrently), the stack at the last event is the best we have.
+  for (u64 i = ebegin; i <= epoch; i++) {
+    EventType typ;
+    u64 v;
+    p = TraceDecodeEvent(p, end, &typ, &v);
+    if (p == 0)
+      break;
+    uptr pc = (uptr)v;
+    if (typ == EventTypeMop || typ == EventTypeFuncEnter) {
+      pc = TraceDecodePc(v, prev_pc);
+      if (pc)
+        prev_pc = pc;
+    }
+    DPrintf2("  %zu typ=%d pc=%zx\n", (uptr)i, typ, pc);
     if (typ == EventTypeMop) {
       stack[pos] = pc;
     } else if (typ == EventTypeFuncEnter) {
@@ -420,11 +443,11 @@ void RestoreStack(int tid, const u64 epoch, VarSizeStackTrace *stk,
     }
     if (mset) {
       if (typ == EventTypeLock) {
-        mset->Add(pc, true, epoch0 + i);
+        mset->Add(pc, true, i);
       } else if (typ == EventTypeUnlock) {
         mset->Del(pc, true);
       } else if (typ == EventTypeRLock) {
-        mset->Add(pc, false, epoch0 + i);
+        mset->Add(pc, false, i);
       } else if (typ == EventTypeRUnlock) {
         mset->Del(pc, false);
       }
@@ -484,6 +507,45 @@ static bool HandleRacyStacks(ThreadState *thr, VarSizeStackTrace traces[2],
   return true;
 }
 
+static const uptr kRacyPcsProbes = 8;
+
+static u64 RacyPcsHash(VarSizeStackTrace traces[2]) {
+  if (traces[0].size == 0 || traces[1].size == 0)
+    return 0;
+  uptr pc0 = traces[0].trace[traces[0].size - 1];
+  uptr pc1 = traces[1].trace[traces[1].size - 1];
+  // Either access can be the current one.
+  if (pc0 > pc1)
+    Swap(pc0, pc1);
+  u64 h = (u64)pc0 * 0x9E3779B97F4A7C15ull;
+  h ^= ((u64)pc1 + (h << 6) + (h >> 2)) * 0xC2B2AE3D27D4EB4Full;
+  return h | 1;  // 0 marks an empty slot.
+}
+
+static bool IsRacyPcsReported(u64 h) {
+  const uptr n = Context::kRacyPcsSize;
+  for (uptr i = 0; i < kRacyPcsProbes; i++) {
+    u64 v = atomic_load_relaxed(&ctx->racy_pcs[(h + i) % n]);
+    if (v == h)
+      return true;
+    if (v == 0)
+      return false;
+  }
+  return false;
+}
+
+static void AddRacyPcs(u64 h) {
+  const uptr n = Context::kRacyPcsSize;
+  for (uptr i = 0; i < kRacyPcsProbes; i++) {
+    u64 v = 0;
+    atomic_uint64_t *slot = &ctx->racy_pcs[(h + i) % n];
+    if (atomic_compare_exchange_strong(slot, &v, h, memory_order_relaxed) ||
+        v == h)
+      return;
+  }
+  // The table is full around h, the pair is just not remembered.
+}
+
 static void AddRacyStacks(ThreadState *thr, VarSizeStackTrace traces[2],
                           uptr addr_min, uptr addr_max) {
   Lock lock(&ctx->racy_mtx);
@@ -638,25 +700,40 @@ void ReportRace(ThreadState *thr) {
   if (IsFiredSuppression(ctx, typ, traces[0]))
     return;
 
-  // MutexSet is too large to live on stack.
-  Vector<u64> mset_buffer(MBlockScopedBuf);
-  mset_buffer.Resize(sizeof(MutexSet) / sizeof(u64) + 1);
-  MutexSet *mset2 = new(&mset_buffer[0]) MutexSet();
-
+  MutexSet mset2;
   Shadow s2(thr->racy_state[1]);
-  RestoreStack(s2.tid(), s2.epoch(), &traces[1], mset2);
+  RestoreStack(s2.tid(), s2.epoch(), &traces[1], &mset2);
+  if (traces[1].size == 0)
+    StatInc(thr, StatTraceRestoreFailed);
   if (IsFiredSuppression(ctx, typ, traces[1]))
     return;
 
+  // Repeated races are usually between the same instructions, recognize
+  // them without taking any locks.
+  u64 racy_pcs = 0;
+  if (flags()->suppress_equal_pcs) {
+    racy_pcs = RacyPcsHash(traces);
+    if (racy_pcs != 0 && IsRacyPcsReported(racy_pcs)) {
+      VPrintf(2, "ThreadSanitizer: suppressing report as doubled (pcs)\n");
+      return;
+    }
+  }
+
   if (HandleRacyStacks(thr, traces, addr_min, addr_max))
     return;
 
+  // Symbolize before locking the thread registry, symbolization is by far
+  // the slowest part and does not need it.
+  ReportStack *stacks[kMop];
+  for (uptr i = 0; i < kMop; i++)
+    stacks[i] = SymbolizeStack(traces[i]);
+
   ThreadRegistryLock l0(ctx->thread_registry);
   ScopedReport rep(typ);
   for (uptr i = 0; i < kMop; i++) {
     Shadow s(thr->racy_state[i]);
-    rep.AddMemoryAccess(addr, thr->external_tag, s, traces[i],
-                        i == 0 ? &thr->mset : mset2);
+    rep.AddMemoryAccess(addr, thr->external_tag, s, stacks[i],
+                        i == 0 ? &thr->mset : &mset2);
   }
 
   for (uptr i = 0; i < kMop; i++) {
@@ -682,6 +759,8 @@ void ReportRace(ThreadState *thr) {
     return;
 
   AddRacyStacks(thr, traces, addr_min, addr_max);
+  if (racy_pcs != 0)
+    AddRacyPcs(racy_pcs);
 }
 
 void PrintCurrentStack(ThreadState *thr, uptr pc) {
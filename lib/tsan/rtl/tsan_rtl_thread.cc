@@ -11,6 +11,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "sanitizer_common/sanitizer_allocator_internal.h"
 #include "sanitizer_common/sanitizer_placement_new.h"
 #include "tsan_rtl.h"
 #include "tsan_mman.h"
@@ -68,8 +69,15 @@ void ThreadContext::OnCreated(void *arg) {
 
 void ThreadContext::OnReset() {
   CHECK_EQ(sync.size(), 0);
+  // The next thread with this tid starts in the part after the current one
+  // (see TraceSwitch). Keep that part, so that the new thread does not fault
+  // it in again right away, and release the rest.
+  Trace *trace = ThreadTrace(tid);
+  uptr next = trace->part + 1 < trace->nparts ? trace->part + 1 : 0;
   uptr trace_p = GetThreadTrace(tid);
-  ReleaseMemoryPagesToOS(trace_p, trace_p + TraceSize() * sizeof(Event));
+  ReleaseMemoryPagesToOS(trace_p, trace_p + next * kTracePartSize);
+  ReleaseMemoryPagesToOS(trace_p + (next + 1) * kTracePartSize,
+                         trace_p + TraceSize());
   //!!! ReleaseMemoryToOS(GetThreadTraceHeader(tid), sizeof(Trace));
 }
 
@@ -89,9 +97,9 @@ struct OnStartedArgs {
 void ThreadContext::OnStarted(void *arg) {
   OnStartedArgs *args = static_cast<OnStartedArgs*>(arg);
   thr = args->thr;
-  // RoundUp so that one trace part does not contain events
-  // from different threads.
-  epoch0 = RoundUp(epoch1 + 1, kTracePartSize);
+  // One trace part does not contain events from different threads,
+  // because the new ThreadState starts without a current trace part.
+  epoch0 = epoch1 + 1;
   epoch1 = (u64)-1;
   new(thr) ThreadState(ctx, tid, unique_id, epoch0, reuse_count,
       args->stk_addr, args->stk_size, args->tls_addr, args->tls_size);
@@ -139,9 +147,11 @@ void ThreadContext::OnFinished() {
     ReleaseImpl(thr, 0, &sync);
   }
   epoch1 = thr->fast_state.epoch();
+  ctx->finished_thread_events += epoch1 - epoch0;
 
   if (common_flags()->detect_deadlocks)
     ctx->dd->DestroyLogicalThread(thr->dd_lt);
+  thr->clock.ResetCached(&thr->proc()->clock_cache);
   thr->~ThreadState();
 #if TSAN_COLLECT_STATS
   StatAggregate(ctx->stat, thr->stat);
@@ -186,6 +196,9 @@ static void ReportIgnoresEnabled(ThreadContext *tctx, IgnoreSet *set) {
     Printf("  Ignore was enabled at:\n");
     PrintStack(SymbolizeStackId(set->At(i)));
   }
+  if (set->Dropped())
+    Printf("  The stacks of %zu more ignores were not recorded\n",
+           set->Dropped());
   Die();
 }
 
@@ -242,7 +255,9 @@ void ThreadStart(ThreadState *thr, int tid, uptr os_id, bool workerthread) {
   uptr tls_addr = 0;
   uptr tls_size = 0;
 #if !SANITIZER_GO
-  GetThreadStackAndTls(tid == 0, &stk_addr, &stk_size, &tls_addr, &tls_size);
+  // Fibers run on the stack and TLS of the thread that switches to them.
+  if (!thr->is_fiber)
+    GetThreadStackAndTls(tid == 0, &stk_addr, &stk_size, &tls_addr, &tls_size);
 
   if (tid) {
     if (stk_addr && stk_size)
@@ -290,6 +305,9 @@ void ThreadFinish(ThreadState *thr) {
     DontNeedShadowFor(thr->tls_addr, thr->tls_size);
   thr->is_dead = true;
   ctx->thread_registry->FinishThread(thr->tid);
+  // The OS thread of a fiber goes on and keeps using its allocator cache.
+  if (!thr->is_fiber)
+    InternalAllocatorThreadFinish();
 }
 
 static bool FindThreadByUid(ThreadContextBase *tctx, void *arg) {
@@ -301,6 +319,84 @@ static bool FindThreadByUid(ThreadContextBase *tctx, void *arg) {
   return false;
 }
 
+#if !SANITIZER_GO
+// The states of the destroyed fibers, reused by FiberCreate. A fiber tid is
+// recycled by the thread registry like the tid of any detached thread, and
+// keeps its trace mapping (and the part of the shadow stack in it that was
+// faulted in), so a pooled fiber is cheap to create.
+struct FiberPoolEntry {
+  FiberPoolEntry *next;
+};
+static StaticSpinMutex fiber_pool_mu;
+static FiberPoolEntry *fiber_pool;
+
+static ThreadState *FiberAlloc() {
+  void *mem = nullptr;
+  {
+    SpinMutexLock l(&fiber_pool_mu);
+    if (fiber_pool) {
+      mem = fiber_pool;
+      fiber_pool = fiber_pool->next;
+    }
+  }
+  if (!mem)
+    mem = internal_alloc(MBlockFiber, sizeof(ThreadState));
+  // The ThreadState ctor relies on zero-initialization, as in TLS.
+  internal_memset(mem, 0, sizeof(ThreadState));
+  return static_cast<ThreadState *>(mem);
+}
+
+static void FiberFree(ThreadState *fiber) {
+  FiberPoolEntry *entry = reinterpret_cast<FiberPoolEntry *>(fiber);
+  SpinMutexLock l(&fiber_pool_mu);
+  entry->next = fiber_pool;
+  fiber_pool = entry;
+}
+
+// Moves the processor and the signal context of the OS thread from the
+// current state to the other one and makes it the current state.
+static void FiberSwitchImpl(ThreadState *from, ThreadState *to) {
+  Processor *proc = from->proc();
+  ProcUnwire(proc, from);
+  ProcWire(proc, to);
+  to->signal_ctx = from->signal_ctx;
+  from->signal_ctx = nullptr;
+  set_cur_thread(to);
+}
+
+ThreadState *FiberCreate(ThreadState *thr, uptr pc, unsigned flags) {
+  ThreadState *fiber = FiberAlloc();
+  fiber->is_fiber = true;
+  int tid = ThreadCreate(thr, pc, 0, true);
+  FiberSwitchImpl(thr, fiber);
+  ThreadStart(fiber, tid, 0, /*workerthread*/ false);
+  FiberSwitchImpl(fiber, thr);
+  return fiber;
+}
+
+void FiberDestroy(ThreadState *thr, uptr pc, ThreadState *fiber) {
+  CHECK_NE(thr, fiber);
+  FiberSwitchImpl(thr, fiber);
+  ThreadFinish(fiber);
+  FiberSwitchImpl(fiber, thr);
+  // Drop the sync object of the switches to the fiber, so that the next
+  // fiber created at this address does not inherit its clock.
+  ctx->metamap.FreeRange(thr->proc(), (uptr)fiber, 1);
+  FiberFree(fiber);
+}
+
+void FiberSwitch(ThreadState *thr, uptr pc, ThreadState *fiber,
+                 unsigned flags) {
+  if (thr == fiber)
+    return;
+  if (!(flags & FiberSwitchFlagNoSync))
+    Release(thr, pc, (uptr)fiber);
+  FiberSwitchImpl(thr, fiber);
+  if (!(flags & FiberSwitchFlagNoSync))
+    Acquire(fiber, pc, (uptr)fiber);
+}
+#endif
+
 int ThreadTid(ThreadState *thr, uptr pc, uptr uid) {
   int res = ctx->thread_registry->FindThread(FindThreadByUid, (void*)uid);
   DPrintf("#%d: ThreadTid uid=%zu tid=%d\n", thr->tid, uid, res);
@@ -356,6 +452,14 @@ void MemoryAccessRange(ThreadState *thr, uptr pc, uptr addr,
 
   StatInc(thr, StatMopRange);
 
+  if (addr % kShadowCell == 0 && size % kShadowCell == 0) {
+    // Whole cells only, the batch path does not add a trace event
+    // if the range was already accessed in the current synch epoch.
+    MemoryAccessBatch(thr, pc, addr, kShadowCell, kShadowCell,
+                      size / kShadowCell, is_write);
+    return;
+  }
+
   if (*shadow_mem == kShadowRodata) {
     // Access to .rodata section, no races here.
     // Measurements show that it can be 10-20% of all memory accesses.
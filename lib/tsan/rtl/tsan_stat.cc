@@ -36,8 +36,11 @@ void StatOutput(u64 *stat) {
   name[StatMopSame]                      = "  Including same                  ";
   name[StatMopIgnored]                   = "  Including ignored               ";
   name[StatMopRange]                     = "  Including range                 ";
+  name[StatMopBatch]                     = "  Including batch                 ";
+  name[StatMopBatchSame]                 = "  Including same batch            ";
   name[StatMopRodata]                    = "  Including .rodata               ";
   name[StatMopRangeRodata]               = "  Including .rodata range         ";
+  name[StatMopUnsampled]                 = "  Including unsampled             ";
   name[StatShadowProcessed]              = "Shadow processed                  ";
   name[StatShadowZero]                   = "  Including empty                 ";
   name[StatShadowNonZero]                = "  Including non empty             ";
@@ -51,6 +54,8 @@ void StatOutput(u64 *stat) {
   name[StatFuncEnter]                    = "Function entries                  ";
   name[StatFuncExit]                     = "Function exits                    ";
   name[StatEvents]                       = "Events collected                  ";
+  name[StatTraceGrow]                    = "Trace grow                        ";
+  name[StatTraceRestoreFailed]           = "Stack restore failed              ";
 
   name[StatThreadCreate]                 = "Total threads created             ";
   name[StatThreadFinish]                 = "  threads finished                ";
@@ -66,6 +71,7 @@ void StatOutput(u64 *stat) {
   name[StatMutexRecUnlock]               = "  recursive unlock                ";
   name[StatMutexReadLock]                = "  read lock                       ";
   name[StatMutexReadUnlock]              = "  read unlock                     ";
+  name[StatMutexCacheHit]                = "  cached sync object              ";
 
   name[StatSyncCreated]                  = "Sync objects created              ";
   name[StatSyncDestroyed]                = "             destroyed            ";
@@ -79,6 +85,7 @@ void StatOutput(u64 *stat) {
   name[StatClockAcquireRepeat]           = "  repeated (fast)                 ";
   name[StatClockAcquireFull]             = "  full (slow)                     ";
   name[StatClockAcquiredSomething]       = "  acquired something              ";
+  name[StatClockAcquireDirtyBlock]       = "  dirty block                     ";
   name[StatClockRelease]                 = "Clock release                     ";
   name[StatClockReleaseResize]           = "  resize                          ";
   name[StatClockReleaseFast1]            = "  fast1                           ";
@@ -86,12 +93,16 @@ void StatOutput(u64 *stat) {
   name[StatClockReleaseSlow]             = "  dirty overflow (slow)           ";
   name[StatClockReleaseFull]             = "  full (slow)                     ";
   name[StatClockReleaseAcquired]         = "  was acquired                    ";
-  name[StatClockReleaseClearTail]        = "  clear tail                      ";
+  name[StatClockReleaseBlock]            = "  changed block                   ";
   name[StatClockStore]                   = "Clock release store               ";
   name[StatClockStoreResize]             = "  resize                          ";
   name[StatClockStoreFast]               = "  fast                            ";
   name[StatClockStoreFull]               = "  slow                            ";
   name[StatClockStoreTail]               = "  clear tail                      ";
+  name[StatClockStoreAcquired]           = "  acquired                        ";
+  name[StatClockStoreShared]             = "  shared block                    ";
+  name[StatClockStoreCache]              = "  new shared block                ";
+  name[StatClockUnshare]                 = "  copy shared block               ";
   name[StatClockAcquireRelease]          = "Clock acquire-release             ";
 
   name[StatAtomic]                       = "Atomic operations                 ";
@@ -28,8 +28,11 @@ enum StatType {
   StatMopSame,
   StatMopIgnored,
   StatMopRange,
+  StatMopBatch,
+  StatMopBatchSame,
   StatMopRodata,
   StatMopRangeRodata,
+  StatMopUnsampled,
   StatShadowProcessed,
   StatShadowZero,
   StatShadowNonZero,  // Derived.
@@ -46,6 +49,8 @@ enum StatType {
 
   // Trace processing.
   StatEvents,
+  StatTraceGrow,
+  StatTraceRestoreFailed,
 
   // Threads.
   StatThreadCreate,
@@ -63,6 +68,7 @@ enum StatType {
   StatMutexRecUnlock,
   StatMutexReadLock,
   StatMutexReadUnlock,
+  StatMutexCacheHit,
 
   // Synchronization.
   StatSyncCreated,
@@ -78,6 +84,7 @@ enum StatType {
   StatClockAcquireRepeat,
   StatClockAcquireFull,
   StatClockAcquiredSomething,
+  StatClockAcquireDirtyBlock,
   // Clocks - release.
   StatClockRelease,
   StatClockReleaseResize,
@@ -86,13 +93,17 @@ enum StatType {
   StatClockReleaseSlow,
   StatClockReleaseFull,
   StatClockReleaseAcquired,
-  StatClockReleaseClearTail,
+  StatClockReleaseBlock,
   // Clocks - release store.
   StatClockStore,
   StatClockStoreResize,
   StatClockStoreFast,
   StatClockStoreFull,
   StatClockStoreTail,
+  StatClockStoreAcquired,
+  StatClockStoreShared,
+  StatClockStoreCache,
+  StatClockUnshare,
   // Clocks - acquire-release.
   StatClockAcquireRelease,
 
@@ -40,6 +40,7 @@ void SyncVar::Reset(Processor *proc) {
   uid = 0;
   creation_stack_id = 0;
   owner_tid = kInvalidTid;
+  owner_mset_pos = 0;
   last_lock = 0;
   recursion = 0;
   atomic_store_relaxed(&flags, 0);
@@ -168,13 +169,12 @@ void MetaMap::ResetRange(Processor *proc, uptr p, uptr sz) {
       break;
   }
   // Finally, page out the whole range (including the parts that we've just
-  // freed). Note: we can't simply madvise, because we need to leave a zeroed
-  // range (otherwise __tsan_java_move can crash if it encounters a left-over
-  // meta objects in java heap).
+  // freed). Note: we need to leave a zeroed range (otherwise
+  // __tsan_java_move can crash if it encounters a left-over meta objects in
+  // java heap), see ZeroShadowPages.
   uptr metap = (uptr)MemToMeta(p0);
   uptr metasz = sz0 / kMetaRatio;
-  UnmapOrDie((void*)metap, metasz);
-  MmapFixedNoReserve(metap, metasz);
+  ZeroShadowPages(metap, metap + metasz);
 }
 
 MBlock* MetaMap::GetBlock(uptr p) {
@@ -200,56 +200,89 @@ SyncVar* MetaMap::GetIfExistsAndLock(uptr addr, bool write_lock) {
   return GetAndLock(0, 0, addr, write_lock, false);
 }
 
+static void LockSync(SyncVar *s, bool write_lock) {
+  if (write_lock)
+    s->mtx.Lock();
+  else
+    s->mtx.ReadLock();
+}
+
+static void UnlockSync(SyncVar *s, bool write_lock) {
+  if (write_lock)
+    s->mtx.Unlock();
+  else
+    s->mtx.ReadUnlock();
+}
+
+// Walks the meta objects list from idx up to, but not including, stop
+// and returns the sync object for addr, if any.
+SyncVar* MetaMap::FindSync(u32 idx, u32 stop, uptr addr) {
+  while (idx != stop) {
+    if (idx == 0 || (idx & kFlagBlock))
+      return 0;
+    DCHECK(idx & kFlagSync);
+    SyncVar *s = sync_alloc_.Map(idx & ~kFlagMask);
+    if (s->addr == addr)
+      return s;
+    idx = s->next;
+  }
+  return 0;
+}
+
+u64 MetaMap::NewUid(Processor *proc) {
+  if (proc->sync_uid_pos == proc->sync_uid_end) {
+    proc->sync_uid_pos =
+        atomic_fetch_add(&uid_gen_, kUidBatch, memory_order_relaxed);
+    proc->sync_uid_end = proc->sync_uid_pos + kUidBatch;
+  }
+  return proc->sync_uid_pos++;
+}
+
 SyncVar* MetaMap::GetAndLock(ThreadState *thr, uptr pc,
                              uptr addr, bool write_lock, bool create) {
-  u32 *meta = MemToMeta(addr);
-  u32 idx0 = *meta;
+  atomic_uint32_t *meta = (atomic_uint32_t*)MemToMeta(addr);
+  u32 idx0 = atomic_load(meta, memory_order_acquire);
+  // The tail of the list that is already known to not contain addr.
+  u32 stop = 0;
   u32 myidx = 0;
   SyncVar *mys = 0;
   for (;;) {
-    u32 idx = idx0;
-    for (;;) {
-      if (idx == 0)
-        break;
-      if (idx & kFlagBlock)
-        break;
-      DCHECK(idx & kFlagSync);
-      SyncVar * s = sync_alloc_.Map(idx & ~kFlagMask);
-      if (s->addr == addr) {
-        if (myidx != 0) {
-          mys->Reset(thr->proc());
-          sync_alloc_.Free(&thr->proc()->sync_cache, myidx);
-        }
-        if (write_lock)
-          s->mtx.Lock();
-        else
-          s->mtx.ReadLock();
-        return s;
+    // The lookup is optimistic: the list is walked without any locks, so the
+    // sync object can be freed and reused for another address before we lock
+    // it. Validate the address under the lock and start over if it changed.
+    SyncVar *s = FindSync(idx0, stop, addr);
+    if (s != 0) {
+      LockSync(s, write_lock);
+      if (s->addr != addr) {
+        UnlockSync(s, write_lock);
+        idx0 = atomic_load(meta, memory_order_acquire);
+        stop = 0;
+        continue;
       }
-      idx = s->next;
+      if (myidx != 0) {
+        mys->Reset(thr->proc());
+        sync_alloc_.Free(&thr->proc()->sync_cache, myidx);
+      }
+      return s;
     }
     if (!create)
       return 0;
-    if (*meta != idx0) {
-      idx0 = *meta;
-      continue;
-    }
 
     if (myidx == 0) {
-      const u64 uid = atomic_fetch_add(&uid_gen_, 1, memory_order_relaxed);
+      const u64 uid = NewUid(thr->proc());
       myidx = sync_alloc_.Alloc(&thr->proc()->sync_cache);
       mys = sync_alloc_.Map(myidx);
       mys->Init(thr, pc, addr, uid);
     }
     mys->next = idx0;
-    if (atomic_compare_exchange_strong((atomic_uint32_t*)meta, &idx0,
-        myidx | kFlagSync, memory_order_release)) {
-      if (write_lock)
-        mys->mtx.Lock();
-      else
-        mys->mtx.ReadLock();
+    if (atomic_compare_exchange_strong(meta, &idx0, myidx | kFlagSync,
+                                       memory_order_release)) {
+      LockSync(mys, write_lock);
       return mys;
     }
+    // Somebody else has pushed new objects in the meantime, idx0 is the new
+    // list head now. Only the new objects need to be checked for addr.
+    stop = mys->next;
   }
 }
 
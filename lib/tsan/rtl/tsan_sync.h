@@ -56,6 +56,7 @@ struct SyncVar {
   u64 uid;  // Globally unique id.
   u32 creation_stack_id;
   int owner_tid;  // Set only by exclusive owners.
+  u32 owner_mset_pos;  // Position in the owner's MutexSet, only a hint.
   u64 last_lock;
   int recursion;
   atomic_uint32_t flags;
@@ -125,18 +126,33 @@ class MetaMap {
 
   void OnProcIdle(Processor *proc);
 
+  // For statistics: the sync object uids handed out so far, which is an upper
+  // bound on the number of sync objects created, and the number of sync
+  // objects the allocator has room for.
+  u64 SyncUidsIssued() const {
+    return atomic_load(&uid_gen_, memory_order_relaxed);
+  }
+  uptr SyncCapacity() const {
+    return sync_alloc_.Capacity();
+  }
+
  private:
   static const u32 kFlagMask  = 3u << 30;
   static const u32 kFlagBlock = 1u << 30;
   static const u32 kFlagSync  = 2u << 30;
   typedef DenseSlabAlloc<MBlock, 1<<16, 1<<12> BlockAlloc;
   typedef DenseSlabAlloc<SyncVar, 1<<16, 1<<10> SyncAlloc;
+  // Sync object uids are handed out to processors in batches of that many,
+  // so that creation of sync objects does not hammer a single global counter.
+  static const u64 kUidBatch = 1 << 10;
   BlockAlloc block_alloc_;
   SyncAlloc sync_alloc_;
   atomic_uint64_t uid_gen_;
 
   SyncVar* GetAndLock(ThreadState *thr, uptr pc, uptr addr, bool write_lock,
                       bool create);
+  SyncVar* FindSync(u32 idx, u32 stop, uptr addr);
+  u64 NewUid(Processor *proc);
 };
 
 }  // namespace __tsan
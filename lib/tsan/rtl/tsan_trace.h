@@ -20,9 +20,13 @@
 
 namespace __tsan {
 
-const int kTracePartSizeBits = 13;
+// The trace is a ring of kTraceParts parts, each part is kTracePartSize bytes.
+// Events are variable-length (see TraceEncodeEvent), so the number of events
+// in a part depends on the encoded sizes; a new part is started when the
+// current part does not have room for the largest event.
+const int kTracePartSizeBits = 15;
 const int kTracePartSize = 1 << kTracePartSizeBits;
-const int kTraceParts = 2 * 1024 * 1024 / kTracePartSize;
+const int kTraceParts = 256;
 const int kTraceSize = kTracePartSize * kTraceParts;
 
 // Must fit into 3 bits.
@@ -36,10 +40,76 @@ enum EventType {
   EventTypeRUnlock
 };
 
-// Represents a thread event (from most significant bit):
-// u64 typ  : 3;   // EventType.
-// u64 addr : 61;  // Associated pc.
-typedef u64 Event;
+// Encoded event (from the first byte):
+// u8 typ  : 3;  // EventType + 1, so that a zero byte terminates the part.
+// u8 more : 1;  // The payload continues in the following bytes.
+// u8 val  : 4;  // Low 4 bits of the payload.
+// followed by the rest of the payload in LEB128 if more is set.
+// For EventTypeMop and EventTypeFuncEnter the payload is 0 for a zero PC and
+// 1 + zigzag(pc - prev_pc) otherwise, where prev_pc is the last non-zero PC
+// in the part (0 at the beginning of a part), so that nearby PCs take 1-2
+// bytes. For the other events the payload is the associated value as is.
+const int kTraceMaxEventSize = 10;
+
+ALWAYS_INLINE u64 TraceEncodePc(uptr pc, uptr prev_pc) {
+  if (pc == 0)
+    return 0;
+  s64 delta = (s64)(pc - prev_pc);
+  return (((u64)delta << 1) ^ (u64)(delta >> 63)) + 1;
+}
+
+ALWAYS_INLINE uptr TraceDecodePc(u64 v, uptr prev_pc) {
+  if (v == 0)
+    return 0;
+  v--;
+  return prev_pc + (uptr)((v >> 1) ^ (0 - (v & 1)));
+}
+
+// Writes the event at p followed by a zero terminator, there must be room
+// for kTraceMaxEventSize + 1 bytes. Returns the position of the terminator.
+ALWAYS_INLINE u8 *TraceEncodeEvent(u8 *p, EventType typ, u64 v) {
+  u8 tag = (u8)(typ + 1) | (u8)((v & 0xf) << 4);
+  if (LIKELY(v < (1 << 4))) {
+    p[0] = tag;
+    p[1] = 0;
+    return p + 1;
+  }
+  if (LIKELY(v < (1 << 11))) {
+    p[0] = tag | 8;
+    p[1] = (u8)(v >> 4);
+    p[2] = 0;
+    return p + 2;
+  }
+  *p++ = tag | 8;
+  for (v >>= 4; v >= 0x80; v >>= 7)
+    *p++ = (u8)(v | 0x80);
+  p[0] = (u8)v;
+  p[1] = 0;
+  return p + 1;
+}
+
+// Decodes an event at p. Returns the position of the next event, or 0 if p
+// points to the terminator or the event does not fit before end
+// (which can happen if the trace is being concurrently overwritten).
+inline const u8 *TraceDecodeEvent(const u8 *p, const u8 *end, EventType *typ,
+                                  u64 *v) {
+  if (p >= end || p[0] == 0)
+    return 0;
+  u8 tag = *p++;
+  *typ = (EventType)((tag & 7) - 1);
+  *v = tag >> 4;
+  if (tag & 8) {
+    for (int shift = 4;; shift += 7) {
+      if (p >= end || shift >= 64)
+        return 0;
+      u8 b = *p++;
+      *v |= (u64)(b & 0x7f) << shift;
+      if ((b & 0x80) == 0)
+        break;
+    }
+  }
+  return p;
+}
 
 struct TraceHeader {
 #if !SANITIZER_GO
@@ -47,7 +117,7 @@ struct TraceHeader {
 #else
   VarSizeStackTrace stack0;
 #endif
-  u64        epoch0;  // Start epoch for the trace.
+  u64        epoch0;  // Epoch of the first event in the part.
   MutexSet   mset0;
 
   TraceHeader() : stack0(), epoch0() {}
@@ -55,6 +125,12 @@ struct TraceHeader {
 
 struct Trace {
   Mutex mtx;
+  uptr part;  // Index of the part the thread currently writes to.
+  // Number of parts in the ring, less than TraceParts() only with
+  // adaptive_history (see TraceSwitch).
+  uptr nparts;
+  u64 ring_start;  // NanoTime when the ring was started or last wrapped.
+  u64 last_switch;  // NanoTime of the last switch to a new part.
 #if !SANITIZER_GO
   // Must be last to catch overflow as paging fault.
   // Go shadow stack is dynamically allocated.
@@ -65,7 +141,11 @@ struct Trace {
   TraceHeader headers[kTraceParts];
 
   Trace()
-    : mtx(MutexTypeTrace, StatMtxTrace) {
+    : mtx(MutexTypeTrace, StatMtxTrace)
+    , part()
+    , nparts()
+    , ring_start()
+    , last_switch() {
   }
 };
 
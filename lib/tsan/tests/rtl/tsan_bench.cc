@@ -13,6 +13,7 @@
 #include "tsan_test_util.h"
 #include "tsan_interface.h"
 #include "tsan_defs.h"
+#include "sanitizer_common/tests/sanitizer_test_utils.h"
 #include "gtest/gtest.h"
 #include <stdint.h>
 
@@ -22,71 +23,76 @@ const int kRepeat = 2*1024*1024;
 void noinstr(void *p) {}
 
 template<typename T, void(*__tsan_mop)(void *p)>
-static void Benchmark() {
+static void Benchmark(const char *name) {
   volatile T data[kSize];
+  BenchmarkTimer timer;
   for (int i = 0; i < kRepeat; i++) {
     for (int j = 0; j < kSize; j++) {
       __tsan_mop((void*)&data[j]);
       data[j]++;
     }
   }
+  PrintBenchmarkResult(name, 1, (uint64_t)kRepeat * kSize, timer.ElapsedNs());
 }
 
 TEST(DISABLED_BENCH, Mop1) {
-  Benchmark<uint8_t, noinstr>();
+  Benchmark<uint8_t, noinstr>("tsan_mop1");
 }
 
 TEST(DISABLED_BENCH, Mop1Read) {
-  Benchmark<uint8_t, __tsan_read1>();
+  Benchmark<uint8_t, __tsan_read1>("tsan_mop1_read");
 }
 
 TEST(DISABLED_BENCH, Mop1Write) {
-  Benchmark<uint8_t, __tsan_write1>();
+  Benchmark<uint8_t, __tsan_write1>("tsan_mop1_write");
 }
 
 TEST(DISABLED_BENCH, Mop2) {
-  Benchmark<uint16_t, noinstr>();
+  Benchmark<uint16_t, noinstr>("tsan_mop2");
 }
 
 TEST(DISABLED_BENCH, Mop2Read) {
-  Benchmark<uint16_t, __tsan_read2>();
+  Benchmark<uint16_t, __tsan_read2>("tsan_mop2_read");
 }
 
 TEST(DISABLED_BENCH, Mop2Write) {
-  Benchmark<uint16_t, __tsan_write2>();
+  Benchmark<uint16_t, __tsan_write2>("tsan_mop2_write");
 }
 
 TEST(DISABLED_BENCH, Mop4) {
-  Benchmark<uint32_t, noinstr>();
+  Benchmark<uint32_t, noinstr>("tsan_mop4");
 }
 
 TEST(DISABLED_BENCH, Mop4Read) {
-  Benchmark<uint32_t, __tsan_read4>();
+  Benchmark<uint32_t, __tsan_read4>("tsan_mop4_read");
 }
 
 TEST(DISABLED_BENCH, Mop4Write) {
-  Benchmark<uint32_t, __tsan_write4>();
+  Benchmark<uint32_t, __tsan_write4>("tsan_mop4_write");
 }
 
 TEST(DISABLED_BENCH, Mop8) {
-  Benchmark<uint8_t, noinstr>();
+  Benchmark<uint8_t, noinstr>("tsan_mop8");
 }
 
 TEST(DISABLED_BENCH, Mop8Read) {
-  Benchmark<uint64_t, __tsan_read8>();
+  Benchmark<uint64_t, __tsan_read8>("tsan_mop8_read");
 }
 
 TEST(DISABLED_BENCH, Mop8Write) {
-  Benchmark<uint64_t, __tsan_write8>();
+  Benchmark<uint64_t, __tsan_write8>("tsan_mop8_write");
 }
 
 TEST(DISABLED_BENCH, FuncCall) {
+  BenchmarkTimer timer;
   for (int i = 0; i < kRepeat; i++) {
     for (int j = 0; j < kSize; j++)
       __tsan_func_entry((void*)(uintptr_t)j);
     for (int j = 0; j < kSize; j++)
       __tsan_func_exit();
   }
+  PrintBenchmarkResult("tsan_func_call", 1, (uint64_t)kRepeat * kSize,
+                       timer.ElapsedNs());
 }
 
 TEST(DISABLED_BENCH, MutexLocal) {
@@ -97,9 +103,12 @@ TEST(DISABLED_BENCH, MutexLocal) {
     t.Lock(m);
     t.Unlock(m);
   }
-  for (int i = 0; i < 16*1024*1024; i++) {
+  const int kLocks = 16*1024*1024;
+  BenchmarkTimer timer;
+  for (int i = 0; i < kLocks; i++) {
     m.Lock();
     m.Unlock();
   }
+  PrintBenchmarkResult("tsan_mutex_local", 1, kLocks, timer.ElapsedNs());
   ScopedThread().Destroy(m);
 }
@@ -69,6 +69,27 @@ TEST(Clock, AcquireRelease) {
   chunked.Reset(&cache);
 }
 
+TEST(Clock, Version) {
+  ThreadClock thr1(1);
+  thr1.tick();
+  ThreadClock thr2(2);
+  SyncClock sync;
+  u32 v0 = sync.version();
+  thr1.ReleaseStore(&cache, &sync);
+  u32 v1 = sync.version();
+  ASSERT_NE(v0, v1);
+  thr2.acquire(&cache, &sync);
+  ASSERT_EQ(v1, sync.version());
+  thr2.release(&cache, &sync);
+  u32 v2 = sync.version();
+  ASSERT_NE(v1, v2);
+  thr1.acq_rel(&cache, &sync);
+  u32 v3 = sync.version();
+  ASSERT_NE(v2, v3);
+  sync.Reset(&cache);
+  ASSERT_NE(v3, sync.version());
+}
+
 TEST(Clock, RepeatedAcquire) {
   ThreadClock thr1(1);
   thr1.tick();
@@ -212,13 +233,57 @@ TEST(Clock, Growth) {
   }
 }
 
+TEST(Clock, SharedBlocks) {
+  // thr1 release-stores the same (unchanged) first group of elements
+  // into two sync clocks, which then must change independently.
+  ThreadClock thr1(100);
+  thr1.tick();
+  thr1.set(5, 42);
+  ThreadClock thr2(7);
+  thr2.tick();
+  thr2.tick();
+  SyncClock sync1;
+  SyncClock sync2;
+  thr1.ReleaseStore(&cache, &sync1);
+  thr1.ReleaseStore(&cache, &sync2);
+  thr1.ReleaseStore(&cache, &sync1);
+  thr1.ReleaseStore(&cache, &sync2);
+  ASSERT_EQ(sync1.get(5), 42ULL);
+  ASSERT_EQ(sync2.get(5), 42ULL);
+  thr2.acquire(&cache, &sync1);
+  ASSERT_EQ(thr2.get(5), 42ULL);
+  ASSERT_EQ(thr2.get(100), 1ULL);
+  thr2.release(&cache, &sync1);
+  ASSERT_EQ(sync1.get(7), 2ULL);
+  ASSERT_EQ(sync2.get(7), 0ULL);
+  ASSERT_EQ(sync2.get(5), 42ULL);
+  // Release-store after an acquire must not reuse the stale copy.
+  thr1.tick();
+  thr1.acquire(&cache, &sync1);
+  SyncClock sync3;
+  thr1.ReleaseStore(&cache, &sync3);
+  ASSERT_EQ(sync3.get(5), 42ULL);
+  ASSERT_EQ(sync3.get(7), 2ULL);
+  ASSERT_EQ(sync3.get(100), 2ULL);
+  sync1.Reset(&cache);
+  sync3.Reset(&cache);
+  ASSERT_EQ(sync2.get(5), 42ULL);
+  sync2.Reset(&cache);
+  thr1.ResetCached(&cache);
+  thr2.ResetCached(&cache);
+}
+
 const uptr kThreads = 4;
 const uptr kClocks = 4;
+// Threads can be spread over several groups of ClockBlock::kClockCount
+// elements, so the model clocks must be large enough for any tid.
+const uptr kMaxTidStride = 3 * ClockBlock::kClockCount + 1;
+const uptr kModelSize = kThreads * kMaxTidStride;
 
 // SimpleSyncClock and SimpleThreadClock implement the same thing as
 // SyncClock and ThreadClock, but in a very simple way.
 struct SimpleSyncClock {
-  u64 clock[kThreads];
+  u64 clock[kModelSize];
   uptr size;
 
   SimpleSyncClock() {
@@ -227,7 +292,7 @@ struct SimpleSyncClock {
 
   void Reset() {
     size = 0;
-    for (uptr i = 0; i < kThreads; i++)
+    for (uptr i = 0; i < kModelSize; i++)
       clock[i] = 0;
   }
 
@@ -247,14 +312,14 @@ struct SimpleSyncClock {
 };
 
 struct SimpleThreadClock {
-  u64 clock[kThreads];
+  u64 clock[kModelSize];
   uptr size;
   unsigned tid;
 
   explicit SimpleThreadClock(unsigned tid) {
     this->tid = tid;
     size = tid + 1;
-    for (uptr i = 0; i < kThreads; i++)
+    for (uptr i = 0; i < kModelSize; i++)
       clock[i] = 0;
   }
 
@@ -265,14 +330,14 @@ struct SimpleThreadClock {
   void acquire(const SimpleSyncClock *src) {
     if (size < src->size)
       size = src->size;
-    for (uptr i = 0; i < kThreads; i++)
+    for (uptr i = 0; i < kModelSize; i++)
       clock[i] = max(clock[i], src->clock[i]);
   }
 
   void release(SimpleSyncClock *dst) const {
     if (dst->size < size)
       dst->size = size;
-    for (uptr i = 0; i < kThreads; i++)
+    for (uptr i = 0; i < kModelSize; i++)
       dst->clock[i] = max(dst->clock[i], clock[i]);
   }
 
@@ -284,7 +349,7 @@ struct SimpleThreadClock {
   void ReleaseStore(SimpleSyncClock *dst) const {
     if (dst->size < size)
       dst->size = size;
-    for (uptr i = 0; i < kThreads; i++)
+    for (uptr i = 0; i < kModelSize; i++)
       dst->clock[i] = clock[i];
   }
 
@@ -303,15 +368,16 @@ struct SimpleThreadClock {
   }
 };
 
-static bool ClockFuzzer(bool printing) {
+static bool ClockFuzzer(bool printing, unsigned tid_stride) {
+  CHECK_LE(tid_stride, kMaxTidStride);
   // Create kThreads thread clocks.
   SimpleThreadClock *thr0[kThreads];
   ThreadClock *thr1[kThreads];
   unsigned reused[kThreads];
   for (unsigned i = 0; i < kThreads; i++) {
     reused[i] = 0;
-    thr0[i] = new SimpleThreadClock(i);
-    thr1[i] = new ThreadClock(i, reused[i]);
+    thr0[i] = new SimpleThreadClock(i * tid_stride);
+    thr1[i] = new ThreadClock(i * tid_stride, reused[i]);
   }
 
   // Create kClocks sync clocks.
@@ -364,13 +430,15 @@ static bool ClockFuzzer(bool printing) {
     case 5:
       if (printing)
         printf("reset thr%d\n", tid);
-      u64 epoch = thr0[tid]->clock[tid] + 1;
+      unsigned real_tid = tid * tid_stride;
+      u64 epoch = thr0[tid]->clock[real_tid] + 1;
       reused[tid]++;
       delete thr0[tid];
-      thr0[tid] = new SimpleThreadClock(tid);
-      thr0[tid]->clock[tid] = epoch;
+      thr0[tid] = new SimpleThreadClock(real_tid);
+      thr0[tid]->clock[real_tid] = epoch;
+      thr1[tid]->ResetCached(&cache);
       delete thr1[tid];
-      thr1[tid] = new ThreadClock(tid, reused[tid]);
+      thr1[tid] = new ThreadClock(real_tid, reused[tid]);
       thr1[tid]->set(epoch);
       break;
     }
@@ -413,21 +481,32 @@ static bool ClockFuzzer(bool printing) {
   for (unsigned i = 0; i < kClocks; i++) {
     sync1[i]->Reset(&cache);
   }
+  for (unsigned i = 0; i < kThreads; i++)
+    thr1[i]->ResetCached(&cache);
   return true;
 }
 
-TEST(Clock, Fuzzer) {
+static void RunClockFuzzer(unsigned tid_stride) {
   struct timeval tv;
   gettimeofday(&tv, NULL);
   int seed = tv.tv_sec + tv.tv_usec;
   printf("seed=%d\n", seed);
   srand(seed);
-  if (!ClockFuzzer(false)) {
+  if (!ClockFuzzer(false, tid_stride)) {
     // Redo the test with the same seed, but logging operations.
     srand(seed);
-    ClockFuzzer(true);
+    ClockFuzzer(true, tid_stride);
     ASSERT_TRUE(false);
   }
 }
 
+TEST(Clock, Fuzzer) {
+  RunClockFuzzer(1);
+}
+
+TEST(Clock, SparseFuzzer) {
+  // Every thread is in its own group of elements.
+  RunClockFuzzer(kMaxTidStride);
+}
+
 }  // namespace __tsan
@@ -0,0 +1,59 @@
+//===-- tsan_ignoreset_test.cc --------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_ignoreset.h"
+#include "gtest/gtest.h"
+
+namespace __tsan {
+
+TEST(IgnoreSet, Basic) {
+  IgnoreSet set;
+  EXPECT_EQ(set.Size(), (uptr)0);
+  set.Add(1);
+  set.Add(2);
+  set.Add(1);
+  EXPECT_EQ(set.Size(), (uptr)2);
+  EXPECT_EQ(set.At(0), (u32)1);
+  EXPECT_EQ(set.At(1), (u32)2);
+  set.Reset();
+  EXPECT_EQ(set.Size(), (uptr)0);
+}
+
+TEST(IgnoreSet, Grow) {
+  IgnoreSet set;
+  const uptr kStacks = IgnoreSet::kInlineSize * 5;
+  for (int round = 0; round < 2; round++) {
+    for (uptr i = 0; i < kStacks; i++) {
+      set.Add(i * 7);
+      set.Add(i * 7);
+    }
+    EXPECT_EQ(set.Size(), kStacks);
+    for (uptr i = 0; i < kStacks; i++)
+      EXPECT_EQ(set.At(i), (u32)(i * 7));
+    set.Reset();
+  }
+}
+
+TEST(IgnoreSet, Overflow) {
+  IgnoreSet set;
+  for (uptr i = 0; i < IgnoreSet::kMaxSize + 10; i++)
+    set.Add(i);
+  for (uptr i = 0; i < IgnoreSet::kMaxSize + 10; i++)
+    set.Add(i);
+  EXPECT_EQ(set.Size(), IgnoreSet::kMaxSize);
+  EXPECT_EQ(set.Dropped(), (uptr)20);
+  EXPECT_EQ(set.At(IgnoreSet::kMaxSize - 1), (u32)(IgnoreSet::kMaxSize - 1));
+  set.Reset();
+  EXPECT_EQ(set.Dropped(), (uptr)0);
+}
+
+}  // namespace __tsan
@@ -111,17 +111,59 @@ TEST(MutexSet, Overflow) {
     mset.Add(i, true, i + 1);
     mset.Add(i, true, i + 1);
   }
-  mset.Add(100, true, 200);
+  const u64 kNewId = MutexSet::kMaxSize + 100;
+  mset.Add(kNewId, true, 200);
   EXPECT_EQ(mset.Size(), MutexSet::kMaxSize);
   for (uptr i = 0; i < MutexSet::kMaxSize; i++) {
     if (i == 0)
       Expect(mset, i, MutexSet::kMaxSize - 1,
              true, MutexSet::kMaxSize, 2);
     else if (i == MutexSet::kMaxSize - 1)
-      Expect(mset, i, 100, true, 200, 1);
+      Expect(mset, i, kNewId, true, 200, 1);
     else
       Expect(mset, i, i, true, i + 1, 2);
   }
 }
 
+TEST(MutexSet, Hint) {
+  MutexSet mset;
+  uptr pos1 = mset.Add(1, true, 2);
+  uptr pos3 = mset.Add(3, true, 4);
+  EXPECT_EQ(pos1, mset.Add(1, true, 5, pos1));
+  Expect(mset, pos1, 1, true, 5, 2);
+  // A stale hint is ignored.
+  EXPECT_EQ(pos3, mset.Add(3, true, 6, pos1));
+  Expect(mset, pos3, 3, true, 6, 2);
+  mset.Del(1, true, pos3);
+  mset.Del(1, true, pos1);
+  EXPECT_EQ(mset.Size(), (uptr)1);
+  Expect(mset, 0, 3, true, 6, 2);
+}
+
+TEST(MutexSet, Copy) {
+  MutexSet mset;
+  const uptr kSize = MutexSet::kInlineSize * 3;
+  for (uptr i = 0; i < kSize; i++)
+    mset.Add(i, true, i + 1);
+  EXPECT_EQ(mset.Size(), kSize);
+
+  // Without reserved space only the newest mutexes are copied.
+  MutexSet small;
+  small = mset;
+  EXPECT_EQ(small.Size(), MutexSet::kInlineSize);
+  for (uptr i = 0; i < MutexSet::kInlineSize; i++)
+    Expect(small, i, kSize - MutexSet::kInlineSize + i, true,
+           kSize - MutexSet::kInlineSize + i + 1, 1);
+
+  MutexSet copy;
+  copy.Reserve(mset.Size());
+  copy = mset;
+  EXPECT_EQ(copy.Size(), kSize);
+  for (uptr i = 0; i < kSize; i++)
+    Expect(copy, i, i, true, i + 1, 1);
+  for (uptr i = 0; i < kSize; i++)
+    copy.Del(i, true);
+  EXPECT_EQ(copy.Size(), (uptr)0);
+}
+
 }  // namespace __tsan
@@ -120,4 +120,45 @@ TEST(MetaMap, ResetSync) {
   EXPECT_EQ(sz, 1 * sizeof(u64));
 }
 
+static const int kConcurrentThreads = 4;
+static const int kConcurrentSyncs = 8;
+static char concurrent_block[kConcurrentSyncs] ALIGNED(8);
+static SyncVar *concurrent_syncs[kConcurrentThreads][kConcurrentSyncs];
+
+static void *CreateSyncThread(void *arg) {
+  ThreadState *thr = cur_thread();
+  MetaMap *m = &ctx->metamap;
+  long t = (long)arg;
+  // All the sync objects share a single meta cell, and threads go over them
+  // in different orders, so the creations race with each other.
+  for (int i = 0; i < kConcurrentSyncs; i++) {
+    int j = (i + t) % kConcurrentSyncs;
+    SyncVar *s = m->GetOrCreateAndLock(thr, 0, (uptr)&concurrent_block[j],
+                                       true);
+    concurrent_syncs[t][j] = s;
+    s->mtx.Unlock();
+  }
+  return 0;
+}
+
+TEST(MetaMap, ConcurrentCreate) {
+  ThreadState *thr = cur_thread();
+  MetaMap *m = &ctx->metamap;
+  m->AllocBlock(thr, 0, (uptr)&concurrent_block[0], kConcurrentSyncs);
+  pthread_t threads[kConcurrentThreads];
+  for (long i = 0; i < kConcurrentThreads; i++)
+    pthread_create(&threads[i], 0, CreateSyncThread, (void*)i);
+  for (int i = 0; i < kConcurrentThreads; i++)
+    pthread_join(threads[i], 0);
+  for (int j = 0; j < kConcurrentSyncs; j++) {
+    SyncVar *s = m->GetIfExistsAndLock((uptr)&concurrent_block[j], false);
+    EXPECT_NE(s, (SyncVar*)0);
+    EXPECT_EQ(s->addr, (uptr)&concurrent_block[j]);
+    s->mtx.ReadUnlock();
+    for (int i = 0; i < kConcurrentThreads; i++)
+      EXPECT_EQ(concurrent_syncs[i][j], s);
+  }
+  m->FreeBlock(thr->proc(), (uptr)&concurrent_block[0]);
+}
+
 }  // namespace __tsan
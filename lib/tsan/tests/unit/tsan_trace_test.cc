@@ -0,0 +1,69 @@
+//===-- tsan_trace_test.cc ------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_trace.h"
+#include "gtest/gtest.h"
+
+namespace __tsan {
+
+TEST(Trace, Pc) {
+  const uptr pcs[] = {0, 1, 0x400000, 0x400010, 0x400008, 0x7fff12345678,
+                      0x1fffffffffffffffull};
+  for (uptr i = 0; i < ARRAY_SIZE(pcs); i++) {
+    for (uptr j = 0; j < ARRAY_SIZE(pcs); j++) {
+      u64 v = TraceEncodePc(pcs[i], pcs[j]);
+      EXPECT_EQ(pcs[i] == 0, v == 0);
+      EXPECT_EQ(pcs[i], TraceDecodePc(v, pcs[j]));
+    }
+  }
+  // Nearby PCs take a single byte.
+  EXPECT_LT(TraceEncodePc(0x400004, 0x400000), 16u);
+  EXPECT_LT(TraceEncodePc(0x400000, 0x400004), 16u);
+}
+
+TEST(Trace, Event) {
+  const u64 vals[] = {0, 1, 15, 16, 2047, 2048, 1ull << 32, (u64)-1};
+  u8 buf[ARRAY_SIZE(vals) * 7 * (kTraceMaxEventSize + 1)];
+  u8 *p = buf;
+  for (uptr i = 0; i < ARRAY_SIZE(vals); i++) {
+    for (int typ = EventTypeMop; typ <= EventTypeRUnlock; typ++) {
+      u8 *next = TraceEncodeEvent(p, (EventType)typ, vals[i]);
+      EXPECT_LE(next - p, kTraceMaxEventSize);
+      EXPECT_EQ(0, next[0]);
+      p = next;
+    }
+  }
+  const u8 *end = p;
+  const u8 *q = buf;
+  for (uptr i = 0; i < ARRAY_SIZE(vals); i++) {
+    for (int typ = EventTypeMop; typ <= EventTypeRUnlock; typ++) {
+      EventType typ1;
+      u64 v1;
+      q = TraceDecodeEvent(q, end + 1, &typ1, &v1);
+      ASSERT_NE((const u8*)0, q);
+      EXPECT_EQ(typ, typ1);
+      EXPECT_EQ(vals[i], v1);
+    }
+  }
+  EventType typ1;
+  u64 v1;
+  // Stops at the terminator.
+  EXPECT_EQ((const u8*)0, TraceDecodeEvent(q, end + 1, &typ1, &v1));
+  EXPECT_EQ(1, TraceEncodeEvent(buf, EventTypeFuncExit, 0) - buf);
+  EXPECT_EQ(2, TraceEncodeEvent(buf, EventTypeMop, 2047) - buf);
+  // Stops at a truncated event.
+  u8 *last = TraceEncodeEvent(buf, EventTypeLock, (u64)-1);
+  EXPECT_EQ((const u8*)0, TraceDecodeEvent(buf, last - 1, &typ1, &v1));
+  EXPECT_EQ(last, TraceDecodeEvent(buf, last, &typ1, &v1));
+}
+
+}  // namespace __tsan
@@ -16,6 +16,7 @@
 #include "ubsan_diag.h"
 #include "ubsan_init.h"
 #include "ubsan_flags.h"
+#include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_placement_new.h"
 #include "sanitizer_common/sanitizer_report_decorator.h"
 #include "sanitizer_common/sanitizer_stacktrace.h"
@@ -367,11 +368,13 @@ ScopedReport::ScopedReport(ReportOptions Opts, Location SummaryLoc,
     : Opts(Opts), SummaryLoc(SummaryLoc), Type(Type) {
   InitAsStandaloneIfNecessary();
   CommonSanitizerReportMutex.Lock();
+  report_file.StartBuffering();
 }
 
 ScopedReport::~ScopedReport() {
   MaybePrintStackTrace(Opts.pc, Opts.bp);
   MaybeReportErrorSummary(SummaryLoc, Type);
+  report_file.FinishBuffering();
   CommonSanitizerReportMutex.Unlock();
   if (flags()->halt_on_error)
     Die();
@@ -425,4 +428,67 @@ bool __ubsan::IsPCSuppressed(ErrorType ET, uptr PC, const char *Filename) {
          suppression_ctx->Match(AI.file, SuppType, &s);
 }
 
+// The minimal reports are kept in an open-addressing table of keys combining
+// the PC and the error type, which is never zero; zero marks a free slot.
+// Slots are only ever claimed, with a CAS, so the table needs no lock.
+static const uptr kMinimalReportTableSize = 4096;
+static atomic_uint64_t minimal_reports[kMinimalReportTableSize];
+static atomic_uint32_t num_dropped_minimal_reports;
+
+static void PrintMinimalReportsAtExit() {
+  __ubsan_print_minimal_reports();
+}
+
+void __ubsan::InitializeMinimalReporting() {
+  Atexit(PrintMinimalReportsAtExit);
+  // Unrecoverable errors end the program through Die().
+  AddDieCallback(PrintMinimalReportsAtExit);
+}
+
+void __ubsan::RecordMinimalReport(ErrorType ET, uptr PC) {
+  u64 Key = ((u64)PC << 8) | ((u64)ET + 1);
+  uptr Slot = (Key * 0x9e3779b97f4a7c15ULL) >> 32;
+  for (uptr I = 0; I < kMinimalReportTableSize; ++I) {
+    atomic_uint64_t *Entry =
+        &minimal_reports[(Slot + I) % kMinimalReportTableSize];
+    u64 Old = atomic_load(Entry, memory_order_relaxed);
+    if (Old == 0 &&
+        atomic_compare_exchange_strong(Entry, &Old, Key, memory_order_relaxed))
+      return;
+    // Another thread may have just claimed the slot for the same error.
+    if (Old == Key)
+      return;
+  }
+  atomic_fetch_add(&num_dropped_minimal_reports, 1, memory_order_relaxed);
+}
+
+void __ubsan_print_minimal_reports() {
+  uptr NumReports = 0;
+  for (uptr I = 0; I < kMinimalReportTableSize; ++I)
+    if (atomic_load(&minimal_reports[I], memory_order_relaxed))
+      ++NumReports;
+  u32 NumDropped =
+      atomic_load(&num_dropped_minimal_reports, memory_order_relaxed);
+  if (NumReports == 0 && NumDropped == 0)
+    return;
+  Report("%s: %zu distinct errors recorded\n", SanitizerToolName, NumReports);
+  for (uptr I = 0; I < kMinimalReportTableSize; ++I) {
+    u64 Key = atomic_load(&minimal_reports[I], memory_order_relaxed);
+    if (Key == 0)
+      continue;
+    ErrorType ET = (ErrorType)((Key & 0xff) - 1);
+    uptr PC = Key >> 8;
+    const char *Module;
+    uptr Offset;
+    if (Symbolizer::GetOrInit()->GetModuleNameAndOffsetForPC(PC, &Module,
+                                                              &Offset))
+      Printf("  %s at %p (%s+%p)\n", ConvertTypeToFlagName(ET), (void *)PC,
+             Module, (void *)Offset);
+    else
+      Printf("  %s at %p\n", ConvertTypeToFlagName(ET), (void *)PC);
+  }
+  if (NumDropped)
+    Printf("  %u more errors did not fit in the table\n", NumDropped);
+}
+
 #endif  // CAN_SANITIZE_UB
@@ -250,6 +250,20 @@ bool IsVptrCheckSuppressed(const char *TypeName);
 // debug info is missing.
 bool IsPCSuppressed(ErrorType ET, uptr PC, const char *Filename);
 
+/// \brief With minimal_reporting, the handlers record each error as its type
+/// and PC here instead of printing a report, and the distinct errors are
+/// printed at exit.
+void InitializeMinimalReporting();
+void RecordMinimalReport(ErrorType ET, uptr PC);
+
 } // namespace __ubsan
 
+extern "C" {
+/// \brief Prints the errors recorded so far with minimal_reporting. This does
+/// not symbolize, so it may be called from a signal handler that did not
+/// interrupt the runtime.
+SANITIZER_INTERFACE_ATTRIBUTE
+void __ubsan_print_minimal_reports();
+} // extern "C"
+
 #endif // UBSAN_DIAG_H
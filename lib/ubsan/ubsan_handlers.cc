@@ -15,6 +15,8 @@
 #if CAN_SANITIZE_UB
 #include "ubsan_handlers.h"
 #include "ubsan_diag.h"
+#include "ubsan_flags.h"
+#include "ubsan_init.h"
 
 #include "sanitizer_common/sanitizer_common.h"
 
@@ -22,7 +24,19 @@ using namespace __sanitizer;
 using namespace __ubsan;
 
 namespace __ubsan {
+static bool isMinimalReporting() {
+  InitAsStandaloneIfNecessary();
+  return flags()->minimal_reporting;
+}
+
 bool ignoreReport(SourceLocation SLoc, ReportOptions Opts, ErrorType ET) {
+  // With minimal reporting, nothing is printed here: the error is recorded,
+  // once, and the unrecoverable handlers go on to Die().
+  if (isMinimalReporting()) {
+    if (!SLoc.isDisabled())
+      RecordMinimalReport(ET, Opts.pc);
+    return true;
+  }
   // We are not allowed to skip error report: if we are in unrecoverable
   // handler, we have to terminate the program right now, and therefore
   // have to print some diagnostic.
@@ -296,6 +310,10 @@ void __ubsan::__ubsan_handle_out_of_bounds_abort(OutOfBoundsData *Data,
 
 static void handleBuiltinUnreachableImpl(UnreachableData *Data,
                                          ReportOptions Opts) {
+  if (isMinimalReporting()) {
+    RecordMinimalReport(ErrorType::UnreachableCall, Opts.pc);
+    return;
+  }
   ScopedReport R(Opts, Data->Loc, ErrorType::UnreachableCall);
   Diag(Data->Loc, DL_Error, "execution reached a __builtin_unreachable() call");
 }
@@ -307,6 +325,10 @@ void __ubsan::__ubsan_handle_builtin_unreachable(UnreachableData *Data) {
 }
 
 static void handleMissingReturnImpl(UnreachableData *Data, ReportOptions Opts) {
+  if (isMinimalReporting()) {
+    RecordMinimalReport(ErrorType::MissingReturn, Opts.pc);
+    return;
+  }
   ScopedReport R(Opts, Data->Loc, ErrorType::MissingReturn);
   Diag(Data->Loc, DL_Error,
        "execution reached the end of a value-returning function "
@@ -373,6 +395,12 @@ static void handleFloatCastOverflow(void *DataPtr, ValueHandle From,
 
   if (looksLikeFloatCastOverflowDataV1(DataPtr)) {
     auto Data = reinterpret_cast<FloatCastOverflowData *>(DataPtr);
+    // This data has no location to acquire, so check for minimal reporting
+    // before symbolizing.
+    if (isMinimalReporting()) {
+      RecordMinimalReport(ET, Opts.pc);
+      return;
+    }
     CallerLoc.reset(getCallerLocation(Opts.pc));
     Loc = CallerLoc;
     FromType = &Data->FromType;
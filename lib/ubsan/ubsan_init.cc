@@ -36,6 +36,8 @@ static StaticSpinMutex ubsan_init_mu;
 
 static void CommonInit() {
   InitializeSuppressions();
+  if (flags()->minimal_reporting)
+    InitializeMinimalReporting();
 }
 
 static void CommonStandaloneInit() {
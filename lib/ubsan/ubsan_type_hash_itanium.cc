@@ -15,8 +15,12 @@
 #include "ubsan_platform.h"
 #if CAN_SANITIZE_UB && !SANITIZER_WINDOWS
 #include "ubsan_type_hash.h"
+#include "ubsan_flags.h"
+#include "ubsan_init.h"
 
+#include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_mutex.h"
 
 // The following are intended to be binary compatible with the definitions
 // given in the Itanium ABI. We make no attempt to be ODR-compatible with
@@ -75,7 +79,7 @@ namespace abi = __cxxabiv1;
 
 using namespace __sanitizer;
 
-// We implement a simple two-level cache for type-checking results. For each
+// We implement a three-level cache for type-checking results. For each
 // (vptr,type) pair, a hash is computed. This hash is assumed to be globally
 // unique; if it collides, we will get false negatives, but:
 //  * such a collision would have to occur on the *first* bad access,
@@ -84,32 +88,148 @@ using namespace __sanitizer;
 //  * the vptr, and thus the hash, can be affected by ASLR, so multiple runs
 //    give better coverage.
 //
-// The first caching layer is a small hash table with no chaining; buckets are
-// reused as needed. The second caching layer is a large hash table with open
-// chaining. We can freely evict from either layer since this is just a cache.
+// The first caching layer is __ubsan_vptr_type_cache, a small hash table with
+// no chaining which the instrumentation checks inline; its size is part of the
+// ABI. The second layer is a small per-thread table of the same kind, so that
+// the threads don't keep writing to shared cache lines. The third layer is a
+// large open-addressed hash set, which is doubled when it is half full, up to
+// a limit. We can freely evict from any layer since this is just a cache.
 //
-// FIXME: Make these hash table accesses thread-safe. The races here are benign:
-//        assuming the unsequenced loads and stores don't misbehave too badly,
-//        the worst case is false negatives or poor cache behavior, not false
-//        positives or crashes.
-
-/// Find a bucket to store the given hash value in.
-static __ubsan::HashValue *getTypeCacheHashTableBucket(__ubsan::HashValue V) {
-  static const unsigned HashTableSize = 65537;
-  static __ubsan::HashValue __ubsan_vptr_hash_set[HashTableSize];
-
-  unsigned First = (V & 65535) ^ 1;
-  unsigned Probe = First;
-  for (int Tries = 5; Tries; --Tries) {
-    if (!__ubsan_vptr_hash_set[Probe] || __ubsan_vptr_hash_set[Probe] == V)
-      return &__ubsan_vptr_hash_set[Probe];
-    Probe += ((V >> 16) & 65535) + 1;
-    if (Probe >= HashTableSize)
-      Probe -= HashTableSize;
+// The slots of the hash set are only claimed with a CAS, and the set is grown
+// under a lock. Hashes added to the old set while it is being copied may be
+// lost, which is harmless. The old sets aren't unmapped, since other threads
+// may still be probing them; they take at most as much memory as the new one.
+
+namespace {
+
+struct TypeHashSet {
+  uptr Mask;
+  atomic_uintptr_t NumEntries;
+  atomic_uintptr_t Slots[1];
+};
+
+struct ThreadTypeCache {
+  __ubsan::HashValue Entries[64];
+  uptr NumHits;
+};
+
+}
+
+static const uptr InitialHashSetSize = 1 << 16;
+static const uptr MaxHashSetSize = 1 << 22;
+static const uptr MaxHashSetProbes = 16;
+// The thread cache hits are added to the global count in batches.
+static const uptr ThreadCacheHitsBatch = 256;
+
+static atomic_uintptr_t CurrentHashSet;
+static StaticSpinMutex HashSetMutex;
+static THREADLOCAL ThreadTypeCache ThreadCache;
+
+static atomic_uint64_t NumThreadCacheHits;
+static atomic_uint64_t NumHashSetHits;
+static atomic_uint64_t NumMisses;
+static atomic_uint64_t NumMismatches;
+static atomic_uint8_t StatsRegistered;
+
+static TypeHashSet *loadHashSet() {
+  return (TypeHashSet *)atomic_load(&CurrentHashSet, memory_order_acquire);
+}
+
+static void insertIntoHashSet(TypeHashSet *Set, __ubsan::HashValue V);
+
+/// Replace \p Old, the current hash set or null, by one twice as large.
+static TypeHashSet *growHashSet(TypeHashSet *Old) {
+  SpinMutexLock l(&HashSetMutex);
+  TypeHashSet *Current = loadHashSet();
+  if (Current != Old)
+    // Another thread got here first.
+    return Current;
+  uptr Size = Old ? 2 * (Old->Mask + 1) : InitialHashSetSize;
+  TypeHashSet *New = (TypeHashSet *)MmapOrDie(
+      sizeof(TypeHashSet) + (Size - 1) * sizeof(atomic_uintptr_t),
+      "ubsan vptr hash set");
+  New->Mask = Size - 1;
+  if (Old) {
+    for (uptr I = 0; I <= Old->Mask; ++I) {
+      if (uptr V = atomic_load(&Old->Slots[I], memory_order_relaxed))
+        insertIntoHashSet(New, V);
+    }
+  }
+  VReport(1, "vptr hash set grown to %zu slots\n", Size);
+  atomic_store(&CurrentHashSet, (uptr)New, memory_order_release);
+  return New;
+}
+
+static bool hashSetContains(__ubsan::HashValue V) {
+  TypeHashSet *Set = loadHashSet();
+  if (!Set)
+    return false;
+  for (uptr I = 0; I < MaxHashSetProbes; ++I) {
+    uptr Slot = atomic_load(&Set->Slots[(V + I) & Set->Mask],
+                            memory_order_relaxed);
+    if (Slot == V)
+      return true;
+    if (!Slot)
+      return false;
   }
-  // FIXME: Pick a random entry from the probe sequence to evict rather than
-  //        just taking the first.
-  return &__ubsan_vptr_hash_set[First];
+  return false;
+}
+
+/// Add \p V to \p Set, evicting the first entry of its probe sequence if
+/// they are all taken. Returns false if the set should be grown.
+static bool tryInsertIntoHashSet(TypeHashSet *Set, __ubsan::HashValue V,
+                                 bool Evict) {
+  for (uptr I = 0; I < MaxHashSetProbes; ++I) {
+    atomic_uintptr_t *Slot = &Set->Slots[(V + I) & Set->Mask];
+    uptr Old = atomic_load(Slot, memory_order_relaxed);
+    if (!Old &&
+        atomic_compare_exchange_strong(Slot, &Old, V, memory_order_relaxed)) {
+      uptr NumEntries =
+          atomic_fetch_add(&Set->NumEntries, 1, memory_order_relaxed) + 1;
+      return Evict || 2 * NumEntries <= Set->Mask + 1;
+    }
+    // Another thread may have just added the same hash.
+    if (Old == V)
+      return true;
+  }
+  if (!Evict)
+    return false;
+  atomic_store(&Set->Slots[V & Set->Mask], V, memory_order_relaxed);
+  return true;
+}
+
+static void insertIntoHashSet(TypeHashSet *Set, __ubsan::HashValue V) {
+  tryInsertIntoHashSet(Set, V, /*Evict=*/true);
+}
+
+static void addToHashSet(__ubsan::HashValue V) {
+  TypeHashSet *Set = loadHashSet();
+  if (!Set)
+    Set = growHashSet(nullptr);
+  while (!tryInsertIntoHashSet(Set, V, Set->Mask + 1 >= MaxHashSetSize))
+    Set = growHashSet(Set);
+}
+
+static void printTypeCacheStats() {
+  TypeHashSet *Set = loadHashSet();
+  Report("vptr type cache: %llu thread cache hits, %llu hash set hits, "
+         "%llu misses, %llu mismatches\n",
+         atomic_load(&NumThreadCacheHits, memory_order_relaxed),
+         atomic_load(&NumHashSetHits, memory_order_relaxed),
+         atomic_load(&NumMisses, memory_order_relaxed),
+         atomic_load(&NumMismatches, memory_order_relaxed));
+  Report("vptr hash set: %zu entries in %zu slots\n",
+         Set ? atomic_load(&Set->NumEntries, memory_order_relaxed) : 0,
+         Set ? Set->Mask + 1 : 0);
+}
+
+static void maybeRegisterTypeCacheStats() {
+  if (atomic_load(&StatsRegistered, memory_order_relaxed) ||
+      atomic_exchange(&StatsRegistered, 1, memory_order_relaxed))
+    return;
+  __ubsan::InitAsStandaloneIfNecessary();
+  if (__ubsan::flags()->print_type_cache_stats)
+    Atexit(printTypeCacheStats);
 }
 
 /// \brief Determine whether \p Derived has a \p Base base class subobject at
@@ -213,12 +333,26 @@ bool __ubsan::checkDynamicType(void *Object, void *Type, HashValue Hash) {
   // FIXME: Perform these checks more cautiously.
 
   // Check whether this is something we've evicted from the cache.
-  HashValue *Bucket = getTypeCacheHashTableBucket(Hash);
-  if (*Bucket == Hash) {
+  ThreadTypeCache *TC = &ThreadCache;
+  HashValue *Entry = &TC->Entries[Hash % ARRAY_SIZE(TC->Entries)];
+  if (*Entry == Hash) {
     __ubsan_vptr_type_cache[Hash % VptrTypeCacheSize] = Hash;
+    if (++TC->NumHits == ThreadCacheHitsBatch) {
+      atomic_fetch_add(&NumThreadCacheHits, ThreadCacheHitsBatch,
+                       memory_order_relaxed);
+      TC->NumHits = 0;
+    }
+    return true;
+  }
+  if (hashSetContains(Hash)) {
+    atomic_fetch_add(&NumHashSetHits, 1, memory_order_relaxed);
+    __ubsan_vptr_type_cache[Hash % VptrTypeCacheSize] = Hash;
+    *Entry = Hash;
     return true;
   }
 
+  maybeRegisterTypeCacheStats();
+  atomic_fetch_add(&NumMisses, 1, memory_order_relaxed);
   void *VtablePtr = *reinterpret_cast<void **>(Object);
   VtablePrefix *Vtable = getVtablePrefix(VtablePtr);
   if (!Vtable)
@@ -235,12 +369,16 @@ bool __ubsan::checkDynamicType(void *Object, void *Type, HashValue Hash) {
     return false;
 
   abi::__class_type_info *Base = (abi::__class_type_info*)Type;
-  if (!isDerivedFromAtOffset(Derived, Base, -Vtable->Offset))
+  if (!isDerivedFromAtOffset(Derived, Base, -Vtable->Offset)) {
+    atomic_fetch_add(&NumMismatches, 1, memory_order_relaxed);
     return false;
+  }
 
   // Success. Cache this result.
   __ubsan_vptr_type_cache[Hash % VptrTypeCacheSize] = Hash;
-  *Bucket = Hash;
+  *Entry = Hash;
+  if (Hash)
+    addToHashSet(Hash);
   return true;
 }
 
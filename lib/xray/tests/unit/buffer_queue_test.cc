@@ -13,7 +13,10 @@
 #include "xray_buffer_queue.h"
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <future>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 
 namespace __xray {
@@ -97,6 +100,89 @@ TEST(BufferQueueTest, MultiThreaded) {
   F();
 }
 
+TEST(BufferQueueTest, DoubleRelease) {
+  bool Success = false;
+  BufferQueue Buffers(kSize, 2, Success);
+  ASSERT_TRUE(Success);
+  BufferQueue::Buffer Buf;
+  ASSERT_EQ(Buffers.getBuffer(Buf), BufferQueue::ErrorCode::Ok);
+  BufferQueue::Buffer Copy = Buf;
+  ASSERT_EQ(Buffers.releaseBuffer(Buf), BufferQueue::ErrorCode::Ok);
+  EXPECT_EQ(BufferQueue::ErrorCode::UnrecognizedBuffer,
+            Buffers.releaseBuffer(Copy));
+}
+
+TEST(BufferQueueTest, PerCPUPools) {
+  bool Success = false;
+  BufferQueue Buffers(kSize, 4, Success, 2);
+  ASSERT_TRUE(Success);
+  // A CPU's pool is drained first, then buffers are taken from the others.
+  BufferQueue::Buffer Bufs[4];
+  for (auto &B : Bufs)
+    ASSERT_EQ(Buffers.getBuffer(B, 1), BufferQueue::ErrorCode::Ok);
+  BufferQueue::Buffer Extra;
+  EXPECT_EQ(BufferQueue::ErrorCode::NotEnoughMemory,
+            Buffers.getBuffer(Extra, 0));
+  for (auto &B : Bufs)
+    ASSERT_EQ(Buffers.releaseBuffer(B), BufferQueue::ErrorCode::Ok);
+  auto Count = 0;
+  Buffers.apply([&](const BufferQueue::Buffer &B) { ++Count; });
+  ASSERT_EQ(Count, 4);
+}
+
+TEST(BufferQueueTest, MultiThreadedThroughput) {
+  static constexpr size_t kThreads = 8;
+  static constexpr size_t kIterations = 100000;
+  bool Success = false;
+  BufferQueue Buffers(kSize, kThreads * 2, Success, kThreads / 2);
+  ASSERT_TRUE(Success);
+  std::atomic<size_t> Handoffs(0);
+  std::vector<std::thread> Threads;
+  for (size_t T = 0; T < kThreads; ++T)
+    Threads.emplace_back([&, T] {
+      BufferQueue::Buffer B;
+      for (size_t I = 0; I < kIterations; ++I) {
+        if (Buffers.getBuffer(B, T) != BufferQueue::ErrorCode::Ok)
+          continue;
+        // Every buffer must be handed to exactly one thread at a time.
+        *static_cast<size_t *>(B.Buffer) = T;
+        ASSERT_EQ(T, *static_cast<size_t *>(B.Buffer));
+        ASSERT_EQ(Buffers.releaseBuffer(B), BufferQueue::ErrorCode::Ok);
+        Handoffs.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+  for (auto &T : Threads)
+    T.join();
+  EXPECT_EQ(kThreads * kIterations, Handoffs.load());
+  auto Count = 0;
+  Buffers.apply([&](const BufferQueue::Buffer &B) { ++Count; });
+  EXPECT_EQ(Count, static_cast<int>(kThreads * 2));
+}
+
+TEST(BufferQueueTest, Streaming) {
+  bool Success = false;
+  BufferQueue Buffers(kSize, 2, Success, 1, true);
+  ASSERT_TRUE(Success);
+  BufferQueue::Buffer B0, B1, Full;
+  ASSERT_FALSE(Buffers.takeFullBuffer(Full));
+  ASSERT_EQ(Buffers.getBuffer(B0), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.getBuffer(B1), BufferQueue::ErrorCode::Ok);
+  void *First = B0.Buffer;
+  ASSERT_EQ(Buffers.releaseBuffer(B0), BufferQueue::ErrorCode::Ok);
+
+  // Released buffers are not handed out again until they are written out.
+  EXPECT_EQ(BufferQueue::ErrorCode::NotEnoughMemory, Buffers.getBuffer(B0));
+  EXPECT_EQ(1u, Buffers.exhaustedCount());
+  ASSERT_TRUE(Buffers.takeFullBuffer(Full));
+  EXPECT_EQ(First, Full.Buffer);
+  EXPECT_EQ(BufferQueue::ErrorCode::UnrecognizedBuffer,
+            Buffers.releaseBuffer(Full));
+  ASSERT_EQ(Buffers.recycleBuffer(Full), BufferQueue::ErrorCode::Ok);
+  EXPECT_EQ(Buffers.getBuffer(B0), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.releaseBuffer(B0), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.releaseBuffer(B1), BufferQueue::ErrorCode::Ok);
+}
+
 TEST(BufferQueueTest, Apply) {
   bool Success = false;
   BufferQueue Buffers(kSize, 10, Success);
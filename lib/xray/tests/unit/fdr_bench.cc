@@ -0,0 +1,74 @@
+//===-- fdr_bench.cc ------------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of XRay, a function call tracing system.
+//
+// Measures the cost of logging calls to empty functions in FDR mode. These
+// are disabled by default; run with --gtest_also_run_disabled_tests.
+//
+//===----------------------------------------------------------------------===//
+#include "xray_fdr_logging.h"
+#include "xray_flags.h"
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace __xray {
+namespace {
+
+constexpr auto kBufferSize = 1 << 16;
+constexpr auto kBufferMax = 16;
+constexpr int kCalls = 1 << 22;
+
+uint64_t nowNanos() {
+  timespec TS;
+  clock_gettime(CLOCK_MONOTONIC, &TS);
+  return TS.tv_sec * 1000000000ULL + TS.tv_nsec;
+}
+
+// Logs kCalls calls to an empty function, and reports the time per call.
+void benchmarkCalls(const char *Name) {
+  FDRLoggingOptions Options;
+  Options.Fd = open("/dev/null", O_WRONLY);
+  ASSERT_NE(Options.Fd, -1);
+  ASSERT_EQ(fdrLoggingInit(kBufferSize, kBufferMax, &Options,
+                            sizeof(FDRLoggingOptions)),
+            XRayLogInitStatus::XRAY_LOG_INITIALIZED);
+  uint64_t Start = nowNanos();
+  for (int I = 0; I < kCalls; ++I) {
+    fdrLoggingHandleArg0(1, XRayEntryType::ENTRY);
+    fdrLoggingHandleArg0(1, XRayEntryType::EXIT);
+  }
+  uint64_t Elapsed = nowNanos() - Start;
+  ASSERT_EQ(fdrLoggingFinalize(), XRayLogInitStatus::XRAY_LOG_FINALIZED);
+  fdrLoggingHandleArg0(1, XRayEntryType::ENTRY);
+  ASSERT_EQ(fdrLoggingFlush(), XRayLogFlushStatus::XRAY_LOG_FLUSHED);
+  ASSERT_EQ(fdrLoggingReset(), XRayLogInitStatus::XRAY_LOG_UNINITIALIZED);
+  close(Options.Fd);
+  printf("%s: %.2f ns per call\n", Name, double(Elapsed) / kCalls);
+}
+
+TEST(DISABLED_FDRBench, EmptyCallsRewound) {
+  // Short calls are erased again right away, which is the common case.
+  benchmarkCalls("rewound");
+}
+
+TEST(DISABLED_FDRBench, EmptyCallsLogged) {
+  auto OldThreshold = flags()->xray_fdr_log_func_duration_threshold_us;
+  flags()->xray_fdr_log_func_duration_threshold_us = 0;
+  // With this many calls we run out of buffers; the rest are dropped.
+  benchmarkCalls("logged");
+  flags()->xray_fdr_log_func_duration_threshold_us = OldThreshold;
+}
+
+} // namespace
+} // namespace __xray
@@ -11,16 +11,19 @@
 //
 //===----------------------------------------------------------------------===//
 #include "xray_fdr_logging.h"
+#include "xray_flags.h"
 #include "gtest/gtest.h"
 
 #include <fcntl.h>
 #include <iostream>
+#include <string>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <system_error>
 #include <unistd.h>
 
+#include "xray/xray_log_interface.h"
 #include "xray/xray_records.h"
 
 namespace __xray {
@@ -123,5 +126,230 @@ TEST(FDRLoggingTest, Multiple) {
   ASSERT_EQ(MDR0.RecordKind, uint8_t(MetadataRecord::RecordKinds::NewBuffer));
 }
 
+TEST(FDRLoggingTest, Streaming) {
+  // Use far fewer buffers than the trace needs: with streaming they keep being
+  // written out and recycled instead of running out.
+  constexpr auto kStreamBufferSize = 1024;
+  constexpr auto kStreamBufferMax = 4;
+  auto OldThreshold = flags()->xray_fdr_log_func_duration_threshold_us;
+  flags()->xray_fdr_log_stream = true;
+  flags()->xray_fdr_log_stream_interval_ms = 1;
+  flags()->xray_fdr_log_func_duration_threshold_us = 0;
+  FDRLoggingOptions Options;
+  char TmpFilename[] = "fdr-logging-test.XXXXXX";
+  Options.Fd = mkstemp(TmpFilename);
+  ASSERT_NE(Options.Fd, -1);
+  ASSERT_EQ(fdrLoggingInit(kStreamBufferSize, kStreamBufferMax, &Options,
+                            sizeof(FDRLoggingOptions)),
+            XRayLogInitStatus::XRAY_LOG_INITIALIZED);
+  for (uint64_t I = 0; I < 10000; ++I) {
+    fdrLoggingHandleArg0(1, XRayEntryType::ENTRY);
+    fdrLoggingHandleArg0(1, XRayEntryType::EXIT);
+    if (I % 100 == 0)
+      usleep(100);
+  }
+  ASSERT_EQ(fdrLoggingFinalize(), XRayLogInitStatus::XRAY_LOG_FINALIZED);
+  ASSERT_EQ(fdrLoggingFlush(), XRayLogFlushStatus::XRAY_LOG_FLUSHED);
+  ASSERT_EQ(fdrLoggingReset(), XRayLogInitStatus::XRAY_LOG_UNINITIALIZED);
+  flags()->xray_fdr_log_stream = false;
+  flags()->xray_fdr_log_func_duration_threshold_us = OldThreshold;
+
+  ASSERT_EQ(close(Options.Fd), 0);
+  int Fd = open(TmpFilename, O_RDONLY);
+  ASSERT_NE(-1, Fd);
+  ScopedFileCloserAndDeleter Guard(Fd, TmpFilename);
+  auto Size = lseek(Fd, 0, SEEK_END);
+  ASSERT_GT(Size, static_cast<off_t>(sizeof(XRayFileHeader) +
+                                     kStreamBufferSize * kStreamBufferMax));
+  ASSERT_EQ((Size - sizeof(XRayFileHeader)) % kStreamBufferSize, 0u);
+  const char *Contents = static_cast<const char *>(
+      mmap(NULL, Size, PROT_READ, MAP_PRIVATE, Fd, 0));
+  ASSERT_NE(Contents, nullptr);
+
+  XRayFileHeader H;
+  memcpy(&H, Contents, sizeof(XRayFileHeader));
+  ASSERT_EQ(H.Version, 1);
+  ASSERT_EQ(H.Type, FileTypes::FDR_LOG);
+
+  // Every buffer written out starts with its own metadata record.
+  for (auto Offset = sizeof(XRayFileHeader); Offset < size_t(Size);
+       Offset += kStreamBufferSize) {
+    MetadataRecord MDR;
+    memcpy(&MDR, Contents + Offset, sizeof(MetadataRecord));
+    ASSERT_EQ(MDR.RecordKind, uint8_t(MetadataRecord::RecordKinds::NewBuffer));
+  }
+}
+
+TEST(FDRLoggingTest, CompactRecords) {
+  auto OldThreshold = flags()->xray_fdr_log_func_duration_threshold_us;
+  flags()->xray_fdr_log_compact = true;
+  flags()->xray_fdr_log_func_duration_threshold_us = 0;
+  FDRLoggingOptions Options;
+  char TmpFilename[] = "fdr-logging-test.XXXXXX";
+  Options.Fd = mkstemp(TmpFilename);
+  ASSERT_NE(Options.Fd, -1);
+  ASSERT_EQ(fdrLoggingInit(kBufferSize, kBufferMax, &Options,
+                            sizeof(FDRLoggingOptions)),
+            XRayLogInitStatus::XRAY_LOG_INITIALIZED);
+  fdrLoggingHandleArg0(1, XRayEntryType::ENTRY);
+  for (uint64_t I = 0; I < 100; ++I) {
+    fdrLoggingHandleArg0(2, XRayEntryType::ENTRY);
+    fdrLoggingHandleArg0(2, XRayEntryType::EXIT);
+  }
+  fdrLoggingHandleArg0(1, XRayEntryType::EXIT);
+  ASSERT_EQ(fdrLoggingFinalize(), XRayLogInitStatus::XRAY_LOG_FINALIZED);
+  // Have this thread hand its buffer back to the queue.
+  fdrLoggingHandleArg0(1, XRayEntryType::ENTRY);
+  ASSERT_EQ(fdrLoggingFlush(), XRayLogFlushStatus::XRAY_LOG_FLUSHED);
+  ASSERT_EQ(fdrLoggingReset(), XRayLogInitStatus::XRAY_LOG_UNINITIALIZED);
+  flags()->xray_fdr_log_compact = false;
+  flags()->xray_fdr_log_func_duration_threshold_us = OldThreshold;
+
+  ASSERT_EQ(close(Options.Fd), 0);
+  int Fd = open(TmpFilename, O_RDONLY);
+  ASSERT_NE(-1, Fd);
+  ScopedFileCloserAndDeleter Guard(Fd, TmpFilename);
+  auto Size = lseek(Fd, 0, SEEK_END);
+  ASSERT_EQ(Size, static_cast<off_t>(sizeof(XRayFileHeader) + kBufferSize));
+  const char *Contents = static_cast<const char *>(
+      mmap(NULL, Size, PROT_READ, MAP_PRIVATE, Fd, 0));
+  ASSERT_NE(Contents, nullptr);
+
+  XRayFileHeader H;
+  memcpy(&H, Contents, sizeof(XRayFileHeader));
+  ASSERT_EQ(H.Version, 2);
+  ASSERT_EQ(H.Type, FileTypes::FDR_LOG);
+
+  // Walk the records up to the end of the buffer, counting the calls to the
+  // leaf function whether they have their own records or were folded.
+  int Entries = 0, Exits = 0, Repeats = 0, Compact = 0;
+  int32_t FuncId = 0;
+  bool SawEOB = false;
+  for (auto *P = Contents + sizeof(XRayFileHeader); P < Contents + Size;) {
+    uint8_t First = *P;
+    if (First & 1) {
+      MetadataRecord MDR;
+      memcpy(&MDR, P, sizeof(MetadataRecord));
+      if (MDR.RecordKind ==
+          uint8_t(MetadataRecord::RecordKinds::EndOfBuffer)) {
+        SawEOB = true;
+        break;
+      }
+      if (MDR.RecordKind == uint8_t(MetadataRecord::RecordKinds::NewBuffer))
+        FuncId = 0;
+      P += sizeof(MetadataRecord);
+      continue;
+    }
+    uint8_t Kind = (First >> 1) & 0x07;
+    if (Kind & CompactFunctionRecord::CompactKind) {
+      CompactFunctionRecord R;
+      memcpy(&R, P, sizeof(R));
+      FuncId += R.FuncIdDelta;
+      Kind &= ~CompactFunctionRecord::CompactKind;
+      ++Compact;
+      P += sizeof(CompactFunctionRecord);
+    } else {
+      FunctionRecord R;
+      memcpy(&R, P, sizeof(R));
+      P += sizeof(FunctionRecord);
+      if (Kind == uint8_t(FunctionRecord::RecordKinds::FunctionRepeat)) {
+        Repeats += R.FuncId;
+        continue;
+      }
+      FuncId = R.FuncId;
+    }
+    if (FuncId != 2)
+      continue;
+    if (Kind == uint8_t(FunctionRecord::RecordKinds::FunctionEnter))
+      ++Entries;
+    else if (Kind == uint8_t(FunctionRecord::RecordKinds::FunctionExit))
+      ++Exits;
+  }
+  ASSERT_TRUE(SawEOB);
+  EXPECT_EQ(Entries, Exits);
+  EXPECT_EQ(100, Exits + Repeats);
+  EXPECT_GT(Repeats, 0);
+  EXPECT_GT(Compact, 0);
+}
+
+TEST(FDRLoggingTest, CustomEventsAndArguments) {
+  FDRLoggingOptions Options;
+  char TmpFilename[] = "fdr-logging-test.XXXXXX";
+  Options.Fd = mkstemp(TmpFilename);
+  ASSERT_NE(Options.Fd, -1);
+  ASSERT_EQ(fdrLoggingInit(kBufferSize, kBufferMax, &Options,
+                            sizeof(FDRLoggingOptions)),
+            XRayLogInitStatus::XRAY_LOG_INITIALIZED);
+  fdrLoggingHandleArg1(3, XRayEntryType::LOG_ARGS_ENTRY, 42);
+  ASSERT_EQ(__xray_fdr_log_custom_event(7, "hello", 5), 1);
+  auto *Payload =
+      static_cast<uint64_t *>(__xray_fdr_reserve_custom_event(8, 8));
+  ASSERT_NE(Payload, nullptr);
+  // Nothing else is logged while the event is reserved.
+  fdrLoggingHandleArg0(4, XRayEntryType::ENTRY);
+  ASSERT_EQ(__xray_fdr_reserve_custom_event(9, 1), nullptr);
+  *Payload = 0x1234;
+  __xray_fdr_commit_custom_event();
+  // Events must fit in a buffer.
+  ASSERT_EQ(__xray_fdr_reserve_custom_event(9, kBufferSize), nullptr);
+  fdrLoggingHandleArg0(3, XRayEntryType::EXIT);
+  ASSERT_EQ(fdrLoggingFinalize(), XRayLogInitStatus::XRAY_LOG_FINALIZED);
+  // Have this thread hand its buffer back to the queue.
+  fdrLoggingHandleArg0(1, XRayEntryType::ENTRY);
+  ASSERT_EQ(fdrLoggingFlush(), XRayLogFlushStatus::XRAY_LOG_FLUSHED);
+  ASSERT_EQ(fdrLoggingReset(), XRayLogInitStatus::XRAY_LOG_UNINITIALIZED);
+
+  ASSERT_EQ(close(Options.Fd), 0);
+  int Fd = open(TmpFilename, O_RDONLY);
+  ASSERT_NE(-1, Fd);
+  ScopedFileCloserAndDeleter Guard(Fd, TmpFilename);
+  auto Size = lseek(Fd, 0, SEEK_END);
+  ASSERT_EQ(Size, static_cast<off_t>(sizeof(XRayFileHeader) + kBufferSize));
+  const char *Contents = static_cast<const char *>(
+      mmap(NULL, Size, PROT_READ, MAP_PRIVATE, Fd, 0));
+  ASSERT_NE(Contents, nullptr);
+
+  // Expect the entry to 3 with its argument, both events, and the exit from 3,
+  // in that order.
+  std::string Seen;
+  for (auto *P = Contents + sizeof(XRayFileHeader); P < Contents + Size;) {
+    if (*P & 1) {
+      MetadataRecord MDR;
+      memcpy(&MDR, P, sizeof(MetadataRecord));
+      P += sizeof(MetadataRecord);
+      if (MDR.RecordKind == uint8_t(MetadataRecord::RecordKinds::EndOfBuffer))
+        break;
+      if (MDR.RecordKind ==
+          uint8_t(MetadataRecord::RecordKinds::CallArgument)) {
+        uint64_t Arg;
+        memcpy(&Arg, MDR.Data, sizeof(Arg));
+        Seen += " arg:" + std::to_string(Arg);
+      } else if (MDR.RecordKind ==
+                 uint8_t(MetadataRecord::RecordKinds::CustomEventMarker)) {
+        int32_t EventSize;
+        uint16_t Type;
+        memcpy(&EventSize, MDR.Data, sizeof(EventSize));
+        memcpy(&Type, MDR.Data + 12, sizeof(Type));
+        Seen += " event:" + std::to_string(Type) + ":";
+        if (Type == 7)
+          Seen += std::string(P, EventSize);
+        else
+          Seen += std::to_string(*reinterpret_cast<const uint64_t *>(P));
+        P += EventSize;
+      }
+      continue;
+    }
+    FunctionRecord R;
+    memcpy(&R, P, sizeof(R));
+    P += sizeof(FunctionRecord);
+    Seen += (R.RecordKind ==
+                     uint8_t(FunctionRecord::RecordKinds::FunctionEnter)
+                 ? " enter:"
+                 : " exit:") +
+            std::to_string(R.FuncId);
+  }
+  EXPECT_EQ(Seen, " enter:3 arg:42 event:7:hello event:8:4660 exit:3");
+}
+
 } // namespace
 } // namespace __xray
@@ -0,0 +1,159 @@
+//===-- profiling_test.cc -------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of XRay, a function call tracing system.
+//
+//===----------------------------------------------------------------------===//
+#include "xray_profiling.h"
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+
+#include "xray/xray_records.h"
+
+namespace __xray {
+namespace {
+
+constexpr auto kBufferSize = 65536;
+constexpr auto kBufferMax = 0;
+
+struct ScopedFileCloserAndDeleter {
+  explicit ScopedFileCloserAndDeleter(int Fd, const char *Filename)
+      : Fd(Fd), Filename(Filename) {}
+
+  ~ScopedFileCloserAndDeleter() {
+    if (Fd) {
+      close(Fd);
+      unlink(Filename);
+    }
+  }
+
+  int Fd;
+  const char *Filename;
+};
+
+void callTree() {
+  profilingHandleArg0(1, XRayEntryType::ENTRY);
+  for (int I = 0; I < 10; ++I) {
+    profilingHandleArg0(2, XRayEntryType::ENTRY);
+    profilingHandleArg0(3, XRayEntryType::ENTRY);
+    profilingHandleArg0(3, XRayEntryType::EXIT);
+    profilingHandleArg0(2, XRayEntryType::EXIT);
+  }
+  profilingHandleArg0(3, XRayEntryType::ENTRY);
+  profilingHandleArg0(3, XRayEntryType::EXIT);
+  profilingHandleArg0(1, XRayEntryType::EXIT);
+}
+
+TEST(ProfilingTest, MergesCallPathsAcrossThreads) {
+  ProfilingOptions Options;
+  char TmpFilename[] = "profiling-test.XXXXXX";
+  Options.Fd = mkstemp(TmpFilename);
+  ASSERT_NE(Options.Fd, -1);
+  ASSERT_EQ(profilingInit(kBufferSize, kBufferMax, &Options,
+                          sizeof(ProfilingOptions)),
+            XRayLogInitStatus::XRAY_LOG_INITIALIZED);
+  // The exit of a call we haven't seen the entry of is ignored.
+  profilingHandleArg0(4, XRayEntryType::EXIT);
+  callTree();
+  std::thread T(callTree);
+  T.join();
+  ASSERT_EQ(profilingFinalize(), XRayLogInitStatus::XRAY_LOG_FINALIZED);
+  // Nothing is counted once finalized.
+  callTree();
+  ASSERT_EQ(profilingFlush(), XRayLogFlushStatus::XRAY_LOG_FLUSHED);
+  ASSERT_EQ(profilingReset(), XRayLogInitStatus::XRAY_LOG_UNINITIALIZED);
+
+  ASSERT_EQ(close(Options.Fd), 0);
+  int Fd = open(TmpFilename, O_RDONLY);
+  ASSERT_NE(-1, Fd);
+  ScopedFileCloserAndDeleter Guard(Fd, TmpFilename);
+  auto Size = lseek(Fd, 0, SEEK_END);
+  // There are four distinct call paths: 1, 1/2, 1/2/3 and 1/3.
+  ASSERT_EQ(Size, static_cast<off_t>(sizeof(XRayFileHeader) +
+                                     4 * sizeof(XRayProfileNodeRecord)));
+  const char *Contents = static_cast<const char *>(
+      mmap(NULL, Size, PROT_READ, MAP_PRIVATE, Fd, 0));
+  ASSERT_NE(Contents, nullptr);
+
+  XRayFileHeader H;
+  memcpy(&H, Contents, sizeof(XRayFileHeader));
+  ASSERT_EQ(H.Version, 1);
+  ASSERT_EQ(H.Type, FileTypes::PROFILE);
+
+  XRayProfileNodeRecord Records[4];
+  memcpy(Records, Contents + sizeof(XRayFileHeader), sizeof(Records));
+  ASSERT_EQ(Records[0].FuncId, 1);
+  ASSERT_EQ(Records[0].Parent, XRayProfileNodeRecord::NoParent);
+  EXPECT_EQ(Records[0].CallCount, 2u);
+  int Seen = 0;
+  for (int I = 1; I < 4; ++I) {
+    const auto &R = Records[I];
+    ASSERT_LT(R.Parent, static_cast<uint32_t>(I));
+    int32_t ParentFuncId = Records[R.Parent].FuncId;
+    uint64_t Histogrammed = 0;
+    for (auto Count : R.Histogram)
+      Histogrammed += Count;
+    EXPECT_EQ(Histogrammed, R.CallCount);
+    if (R.FuncId == 2 && ParentFuncId == 1) {
+      EXPECT_EQ(R.CallCount, 20u);
+      Seen |= 1;
+    } else if (R.FuncId == 3 && ParentFuncId == 2) {
+      EXPECT_EQ(R.CallCount, 20u);
+      Seen |= 2;
+    } else if (R.FuncId == 3 && ParentFuncId == 1) {
+      EXPECT_EQ(R.CallCount, 2u);
+      Seen |= 4;
+    }
+  }
+  EXPECT_EQ(Seen, 7);
+}
+
+TEST(ProfilingTest, ClosesCallsWithMissingExits) {
+  ProfilingOptions Options;
+  char TmpFilename[] = "profiling-test.XXXXXX";
+  Options.Fd = mkstemp(TmpFilename);
+  ASSERT_NE(Options.Fd, -1);
+  ASSERT_EQ(profilingInit(kBufferSize, kBufferMax, &Options,
+                          sizeof(ProfilingOptions)),
+            XRayLogInitStatus::XRAY_LOG_INITIALIZED);
+  // As if 2 were left through a longjmp into 1.
+  profilingHandleArg0(1, XRayEntryType::ENTRY);
+  profilingHandleArg0(2, XRayEntryType::ENTRY);
+  profilingHandleArg0(1, XRayEntryType::EXIT);
+  ASSERT_EQ(profilingFinalize(), XRayLogInitStatus::XRAY_LOG_FINALIZED);
+  ASSERT_EQ(profilingFlush(), XRayLogFlushStatus::XRAY_LOG_FLUSHED);
+  ASSERT_EQ(profilingReset(), XRayLogInitStatus::XRAY_LOG_UNINITIALIZED);
+
+  ASSERT_EQ(close(Options.Fd), 0);
+  int Fd = open(TmpFilename, O_RDONLY);
+  ASSERT_NE(-1, Fd);
+  ScopedFileCloserAndDeleter Guard(Fd, TmpFilename);
+  auto Size = lseek(Fd, 0, SEEK_END);
+  ASSERT_EQ(Size, static_cast<off_t>(sizeof(XRayFileHeader) +
+                                     2 * sizeof(XRayProfileNodeRecord)));
+  const char *Contents = static_cast<const char *>(
+      mmap(NULL, Size, PROT_READ, MAP_PRIVATE, Fd, 0));
+  ASSERT_NE(Contents, nullptr);
+  XRayProfileNodeRecord Records[2];
+  memcpy(Records, Contents + sizeof(XRayFileHeader), sizeof(Records));
+  EXPECT_EQ(Records[0].FuncId, 1);
+  EXPECT_EQ(Records[0].CallCount, 1u);
+  EXPECT_EQ(Records[1].FuncId, 2);
+  EXPECT_EQ(Records[1].Parent, 0u);
+  EXPECT_EQ(Records[1].CallCount, 1u);
+}
+
+} // namespace
+} // namespace __xray
@@ -17,50 +17,181 @@
 #include "sanitizer_common/sanitizer_libc.h"
 
 #include <cstdlib>
-#include <tuple>
 
 using namespace __xray;
 using namespace __sanitizer;
 
-BufferQueue::BufferQueue(std::size_t B, std::size_t N, bool &Success)
-    : BufferSize(B), Buffers(N), Mutex(), OwnedBuffers(), Finalizing{0} {
-  for (auto &T : Buffers) {
-    void *Tmp = malloc(BufferSize);
-    if (Tmp == nullptr) {
-      Success = false;
-      return;
+void BufferQueue::Ring::push(size_t Index) {
+  u64 Pos = atomic_load(&Tail, memory_order_relaxed);
+  Cell *C;
+  for (;;) {
+    C = &Cells[Pos & Mask];
+    u64 Seq = atomic_load(&C->Sequence, memory_order_acquire);
+    s64 Diff = static_cast<s64>(Seq - Pos);
+    if (Diff == 0) {
+      if (atomic_compare_exchange_weak(&Tail, &Pos, Pos + 1,
+                                       memory_order_relaxed))
+        break;
+    } else {
+      // The ring holds every buffer of its pool, so it is never really full:
+      // a cell that is not ready yet is being vacated by a concurrent pop.
+      if (Diff < 0)
+        proc_yield(1);
+      Pos = atomic_load(&Tail, memory_order_relaxed);
+    }
+  }
+  C->Index = Index;
+  atomic_store(&C->Sequence, Pos + 1, memory_order_release);
+}
+
+bool BufferQueue::Ring::pop(size_t &Index) {
+  u64 Pos = atomic_load(&Head, memory_order_relaxed);
+  Cell *C;
+  for (;;) {
+    C = &Cells[Pos & Mask];
+    u64 Seq = atomic_load(&C->Sequence, memory_order_acquire);
+    s64 Diff = static_cast<s64>(Seq - (Pos + 1));
+    if (Diff == 0) {
+      if (atomic_compare_exchange_weak(&Head, &Pos, Pos + 1,
+                                       memory_order_relaxed))
+        break;
+    } else if (Diff < 0) {
+      return false;
+    } else {
+      Pos = atomic_load(&Head, memory_order_relaxed);
     }
+  }
+  Index = C->Index;
+  atomic_store(&C->Sequence, Pos + Mask + 1, memory_order_release);
+  return true;
+}
+
+BufferQueue::BufferQueue(size_t B, size_t N, bool &Success, size_t P,
+                         bool Streaming)
+    : BufferSize(B), BufferStride(RoundUpTo(B, kCacheLineSize)),
+      BufferCount(N), PoolCount(P == 0 ? 1 : P), Data(nullptr),
+      Buffers(nullptr), Pools(nullptr), Pending(nullptr), Finalizing{0},
+      Exhausted{0} {
+  Success = false;
+  Data = static_cast<char *>(malloc(BufferStride * BufferCount));
+  Buffers =
+      static_cast<BufferRep *>(malloc(sizeof(BufferRep) * BufferCount));
+  Pools = static_cast<Ring *>(malloc(sizeof(Ring) * PoolCount));
+  if (Pools == nullptr ||
+      (BufferCount != 0 && (Data == nullptr || Buffers == nullptr)))
+    return;
+  internal_memset(Pools, 0, sizeof(Ring) * PoolCount);
+
+  // Buffer I lives in pool I % PoolCount, and is always returned there, so
+  // each ring only has to hold its own share of the buffers.
+  size_t PerPool = (BufferCount + PoolCount - 1) / PoolCount;
+  size_t Capacity = RoundUpToPowerOfTwo(PerPool == 0 ? 1 : PerPool);
+  for (size_t I = 0; I < PoolCount; ++I) {
+    auto &R = Pools[I];
+    R.Cells = static_cast<Cell *>(malloc(sizeof(Cell) * Capacity));
+    if (R.Cells == nullptr)
+      return;
+    R.Mask = Capacity - 1;
+    for (size_t J = 0; J < Capacity; ++J)
+      atomic_store(&R.Cells[J].Sequence, J, memory_order_relaxed);
+  }
+
+  // The pending ring has room for every buffer, like the pools have for
+  // theirs, so pushing to it never has to fail.
+  if (Streaming) {
+    Pending = static_cast<Ring *>(malloc(sizeof(Ring)));
+    if (Pending == nullptr)
+      return;
+    internal_memset(Pending, 0, sizeof(Ring));
+    size_t PendingCapacity =
+        RoundUpToPowerOfTwo(BufferCount == 0 ? 1 : BufferCount);
+    Pending->Cells =
+        static_cast<Cell *>(malloc(sizeof(Cell) * PendingCapacity));
+    if (Pending->Cells == nullptr)
+      return;
+    Pending->Mask = PendingCapacity - 1;
+    for (size_t J = 0; J < PendingCapacity; ++J)
+      atomic_store(&Pending->Cells[J].Sequence, J, memory_order_relaxed);
+  }
 
-    auto &Buf = std::get<0>(T);
-    Buf.Buffer = Tmp;
-    Buf.Size = B;
-    OwnedBuffers.emplace(Tmp);
+  for (size_t I = 0; I < BufferCount; ++I) {
+    auto &Rep = Buffers[I];
+    Rep.Buff.Buffer = Data + I * BufferStride;
+    Rep.Buff.Size = BufferSize;
+    atomic_store(&Rep.State, kFree, memory_order_relaxed);
+    Pools[I % PoolCount].push(I);
   }
   Success = true;
 }
 
-BufferQueue::ErrorCode BufferQueue::getBuffer(Buffer &Buf) {
+BufferQueue::ErrorCode BufferQueue::getBuffer(Buffer &Buf, size_t CPU) {
   if (__sanitizer::atomic_load(&Finalizing, __sanitizer::memory_order_acquire))
     return ErrorCode::QueueFinalizing;
-  __sanitizer::BlockingMutexLock Guard(&Mutex);
-  if (Buffers.empty())
-    return ErrorCode::NotEnoughMemory;
-  auto &T = Buffers.front();
-  auto &B = std::get<0>(T);
-  Buf = B;
-  B.Buffer = nullptr;
-  B.Size = 0;
-  Buffers.pop_front();
-  return ErrorCode::Ok;
+  size_t Index;
+  size_t Start = CPU % PoolCount;
+  for (size_t I = 0; I < PoolCount; ++I) {
+    size_t Pool = Start + I < PoolCount ? Start + I : Start + I - PoolCount;
+    if (Pools[Pool].pop(Index)) {
+      auto &Rep = Buffers[Index];
+      atomic_store(&Rep.State, kOwned, memory_order_relaxed);
+      Buf = Rep.Buff;
+      return ErrorCode::Ok;
+    }
+  }
+  atomic_fetch_add(&Exhausted, 1, memory_order_relaxed);
+  return ErrorCode::NotEnoughMemory;
+}
+
+bool BufferQueue::indexOf(const Buffer &Buf, size_t &Index) const {
+  // Ownership is tracked by the index of the buffer in our allocation, so
+  // anything outside of it, or not on a buffer boundary, is not ours.
+  uptr Offset = reinterpret_cast<uptr>(Buf.Buffer) -
+                reinterpret_cast<uptr>(Data);
+  if (Buf.Buffer == nullptr || Offset >= BufferStride * BufferCount ||
+      Offset % BufferStride != 0)
+    return false;
+  Index = Offset / BufferStride;
+  return true;
 }
 
 BufferQueue::ErrorCode BufferQueue::releaseBuffer(Buffer &Buf) {
-  if (OwnedBuffers.count(Buf.Buffer) == 0)
+  size_t Index;
+  if (!indexOf(Buf, Index))
     return ErrorCode::UnrecognizedBuffer;
-  __sanitizer::BlockingMutexLock Guard(&Mutex);
 
   // Now that the buffer has been released, we mark it as "used".
-  Buffers.emplace(Buffers.end(), Buf, true /* used */);
+  u8 Cmp = kOwned;
+  if (!atomic_compare_exchange_strong(&Buffers[Index].State, &Cmp, kUsed,
+                                      memory_order_acq_rel))
+    return ErrorCode::UnrecognizedBuffer;
+  if (Pending != nullptr)
+    Pending->push(Index);
+  else
+    Pools[Index % PoolCount].push(Index);
+  Buf.Buffer = nullptr;
+  Buf.Size = 0;
+  return ErrorCode::Ok;
+}
+
+bool BufferQueue::takeFullBuffer(Buffer &Buf) {
+  size_t Index;
+  if (Pending == nullptr || !Pending->pop(Index))
+    return false;
+  auto &Rep = Buffers[Index];
+  atomic_store(&Rep.State, kFlushing, memory_order_release);
+  Buf = Rep.Buff;
+  return true;
+}
+
+BufferQueue::ErrorCode BufferQueue::recycleBuffer(Buffer &Buf) {
+  size_t Index;
+  if (!indexOf(Buf, Index))
+    return ErrorCode::UnrecognizedBuffer;
+  u8 Cmp = kFlushing;
+  if (!atomic_compare_exchange_strong(&Buffers[Index].State, &Cmp, kFree,
+                                      memory_order_acq_rel))
+    return ErrorCode::UnrecognizedBuffer;
+  Pools[Index % PoolCount].push(Index);
   Buf.Buffer = nullptr;
   Buf.Size = 0;
   return ErrorCode::Ok;
@@ -74,8 +205,14 @@ BufferQueue::ErrorCode BufferQueue::finalize() {
 }
 
 BufferQueue::~BufferQueue() {
-  for (auto &T : Buffers) {
-    auto &Buf = std::get<0>(T);
-    free(Buf.Buffer);
+  if (Pools != nullptr) {
+    for (size_t I = 0; I < PoolCount; ++I)
+      free(Pools[I].Cells);
   }
+  free(Pools);
+  if (Pending != nullptr)
+    free(Pending->Cells);
+  free(Pending);
+  free(Buffers);
+  free(Data);
 }
@@ -16,10 +16,8 @@
 #define XRAY_BUFFER_QUEUE_H
 
 #include "sanitizer_common/sanitizer_atomic.h"
-#include "sanitizer_common/sanitizer_mutex.h"
-#include <deque>
-#include <unordered_set>
-#include <utility>
+#include "sanitizer_common/sanitizer_common.h"
+#include <cstddef>
 
 namespace __xray {
 
@@ -36,14 +34,52 @@ public:
   };
 
 private:
-  size_t BufferSize;
+  // Buffers are carved out of a single allocation and identified by their
+  // index into it. Each buffer is in one of these states; a buffer is only in
+  // a free ring while it is not Owned. In streaming mode released buffers wait
+  // in the pending ring until a writer takes them (Flushing) and recycles them.
+  enum : __sanitizer::u8 { kFree, kOwned, kUsed, kFlushing };
+
+  struct BufferRep {
+    Buffer Buff;
+    __sanitizer::atomic_uint8_t State;
+  };
+
+  // A bounded multi-producer/multi-consumer ring of free buffer indices. Every
+  // cell carries a sequence number which tells producers (releaseBuffer) and
+  // consumers (getBuffer) whether the cell is ready for them, so neither side
+  // ever takes a lock.
+  struct Cell {
+    __sanitizer::atomic_uint64_t Sequence;
+    size_t Index;
+  };
 
-  // We use a bool to indicate whether the Buffer has been used in this
-  // freelist implementation.
-  std::deque<std::tuple<Buffer, bool>> Buffers;
-  __sanitizer::BlockingMutex Mutex;
-  std::unordered_set<void *> OwnedBuffers;
+  struct Ring {
+    __sanitizer::atomic_uint64_t Head;
+    char Pad0[__sanitizer::kCacheLineSize - sizeof(__sanitizer::u64)];
+    __sanitizer::atomic_uint64_t Tail;
+    char Pad1[__sanitizer::kCacheLineSize - sizeof(__sanitizer::u64)];
+    Cell *Cells;
+    __sanitizer::u64 Mask;
+    char Pad2[__sanitizer::kCacheLineSize - sizeof(Cell *) -
+              sizeof(__sanitizer::u64)];
+
+    void push(size_t Index);
+    bool pop(size_t &Index);
+  };
+
+  size_t BufferSize;
+  size_t BufferStride;
+  size_t BufferCount;
+  size_t PoolCount;
+  char *Data;
+  BufferRep *Buffers;
+  Ring *Pools;
+  Ring *Pending;
   __sanitizer::atomic_uint8_t Finalizing;
+  __sanitizer::atomic_uint64_t Exhausted;
+
+  bool indexOf(const Buffer &Buf, size_t &Index) const;
 
 public:
   enum class ErrorCode : unsigned {
@@ -71,8 +107,17 @@ public:
   }
 
   /// Initialise a queue of size |N| with buffers of size |B|. We report success
-  /// through |Success|.
-  BufferQueue(size_t B, size_t N, bool &Success);
+  /// through |Success|. The free buffers are split across |P| pools which
+  /// callers can pick with a CPU hint to keep buffer handoff CPU-local.
+  ///
+  /// With |Streaming| set, released buffers are not reused until a writer has
+  /// taken them with takeFullBuffer(...) and handed them back with
+  /// recycleBuffer(...).
+  BufferQueue(size_t B, size_t N, bool &Success, size_t P = 1,
+              bool Streaming = false);
+
+  BufferQueue(const BufferQueue &) = delete;
+  BufferQueue &operator=(const BufferQueue &) = delete;
 
   /// Updates |Buf| to contain the pointer to an appropriate buffer. Returns an
   /// error in case there are no available buffers to return when we will run
@@ -85,14 +130,33 @@ public:
   ///   - std::errc::not_enough_memory on exceeding MaxSize.
   ///   - no error when we find a Buffer.
   ///   - std::errc::state_not_recoverable on finalising BufferQueue.
-  ErrorCode getBuffer(Buffer &Buf);
+  ///
+  /// The pool selected by |CPU| is tried first; the other pools are only
+  /// searched when it is empty.
+  ErrorCode getBuffer(Buffer &Buf, size_t CPU = 0);
 
   /// Updates |Buf| to point to nullptr, with size 0.
   ///
   /// Returns:
-  ///   - ...
+  ///   - UnrecognizedBuffer if |Buf| was not handed out by this queue, or has
+  ///     already been released.
+  ///   - no error when the buffer is back in its pool.
   ErrorCode releaseBuffer(Buffer &Buf);
 
+  /// Takes the oldest released buffer which has not been written out yet, in
+  /// streaming mode. Returns false if there is none.
+  bool takeFullBuffer(Buffer &Buf);
+
+  /// Returns a buffer obtained through takeFullBuffer(...) to the free pools.
+  ErrorCode recycleBuffer(Buffer &Buf);
+
+  /// Returns the number of getBuffer(...) calls which failed because all the
+  /// buffers were in use.
+  __sanitizer::u64 exhaustedCount() const {
+    return __sanitizer::atomic_load(&Exhausted,
+                                    __sanitizer::memory_order_relaxed);
+  }
+
   bool finalizing() const {
     return __sanitizer::atomic_load(&Finalizing,
                                     __sanitizer::memory_order_acquire);
@@ -113,11 +177,15 @@ public:
   /// Applies the provided function F to each Buffer in the queue, only if the
   /// Buffer is marked 'used' (i.e. has been the result of getBuffer(...) and a
   /// releaseBuffer(...) operation.
+  ///
+  /// This does not synchronise with concurrent getBuffer/releaseBuffer calls,
+  /// so the caller should make sure those have stopped (e.g. after finalize).
   template <class F> void apply(F Fn) {
-    __sanitizer::BlockingMutexLock G(&Mutex);
-    for (const auto &T : Buffers) {
-      if (std::get<1>(T))
-        Fn(std::get<0>(T));
+    for (size_t I = 0; I < BufferCount; ++I) {
+      auto &B = Buffers[I];
+      if (__sanitizer::atomic_load(&B.State,
+                                   __sanitizer::memory_order_acquire) == kUsed)
+        Fn(B.Buff);
     }
   }
 
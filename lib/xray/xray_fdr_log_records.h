@@ -29,6 +29,10 @@ struct alignas(16) MetadataRecord {
     NewCPUId,
     TSCWrap,
     WalltimeMarker,
+    // Followed by the number of bytes of event payload given in the record.
+    CustomEventMarker,
+    // The argument of the function entry record just before this one.
+    CallArgument,
   };
   // Use 7 bits to identify this record type.
   /* RecordKinds */ uint8_t RecordKind : 7;
@@ -44,6 +48,11 @@ struct alignas(8) FunctionRecord {
     FunctionEnter = 0x00,
     FunctionExit = 0x01,
     FunctionTailExit = 0x02,
+    // Only in the compact (version 2) format: the call just before this
+    // record, an entry immediately followed by an exit of the same function,
+    // was repeated FuncId more times back to back. TSCDelta is the time from
+    // the previous record until the last of those calls exited.
+    FunctionRepeat = 0x03,
   };
   /* RecordKinds */ uint8_t RecordKind : 3;
 
@@ -62,4 +71,29 @@ struct alignas(8) FunctionRecord {
 
 static_assert(sizeof(FunctionRecord) == 8, "Wrong size for FunctionRecord.");
 
+// In the compact (version 2) format, function records which are close to the
+// previous ones in both function ID and time are written in four bytes instead.
+// They can be told apart from a FunctionRecord by the CompactKind bit in their
+// RecordKind.
+struct alignas(4) CompactFunctionRecord {
+  // A CompactFunctionRecord must always have a type of 0.
+  /* RecordType */ uint32_t Type : 1;
+
+  // One of the FunctionEnter, FunctionExit or FunctionTailExit kinds of
+  // FunctionRecord, or'ed with CompactKind.
+  uint32_t RecordKind : 3;
+  static constexpr uint8_t CompactKind = 0x04;
+
+  // The function ID relative to the one of the last FunctionRecord or
+  // CompactFunctionRecord in the buffer (FunctionRepeat records do not count),
+  // or to 0 when there is none yet.
+  int32_t FuncIdDelta : 10;
+
+  // Like FunctionRecord::TSCDelta, but only 18 bits wide.
+  uint32_t TSCDelta : 18;
+} __attribute__((packed));
+
+static_assert(sizeof(CompactFunctionRecord) == 4,
+              "Wrong size for CompactFunctionRecord.");
+
 #endif // XRAY_XRAY_FDR_LOG_RECORDS_H
@@ -19,7 +19,9 @@
 #include <bitset>
 #include <cerrno>
 #include <cstring>
+#include <pthread.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
@@ -49,6 +51,79 @@ __sanitizer::atomic_sint32_t LogFlushStatus = {
 
 std::unique_ptr<FDRLoggingOptions> FDROptions;
 
+// Streaming mode state. While StreamFd is valid, a writer thread drains the
+// buffers released to the queue into it as the instrumented threads keep
+// recording. The thread is only started and stopped by init/flush/reset.
+int StreamFd = -1;
+pthread_t StreamThread;
+bool StreamThreadRunning = false;
+__sanitizer::atomic_uint8_t StreamStop = {0};
+__sanitizer::atomic_uint64_t StreamedBuffers = {0};
+
+static void writeFileHeader(int Fd,
+                            const BufferQueue &Q) XRAY_NEVER_INSTRUMENT {
+  XRayFileHeader Header;
+  Header.Version = flags()->xray_fdr_log_compact ? 2 : 1;
+  Header.Type = FileTypes::FDR_LOG;
+  Header.CycleFrequency = probeRequiredCPUFeatures()
+                          ? getTSCFrequency() : __xray::NanosecondsPerSecond;
+  // FIXME: Actually check whether we have 'constant_tsc' and 'nonstop_tsc'
+  // before setting the values in the header.
+  Header.ConstantTSC = 1;
+  Header.NonstopTSC = 1;
+  Header.FdrData = FdrAdditionalHeaderData{Q.ConfiguredBufferSize()};
+  retryingWriteAll(Fd, reinterpret_cast<char *>(&Header),
+                   reinterpret_cast<char *>(&Header) + sizeof(Header));
+}
+
+// Writes out all of the buffers waiting in |Q|, a batch per writev(2) call,
+// and hands them back to the queue. Returns the number of buffers written.
+static size_t streamBuffers(BufferQueue *Q, int Fd) XRAY_NEVER_INSTRUMENT {
+  static constexpr int kBatchSize = 16;
+  BufferQueue::Buffer Buffers[kBatchSize];
+  struct iovec Iov[kBatchSize];
+  size_t Total = 0;
+  for (;;) {
+    int N = 0;
+    while (N < kBatchSize && Q->takeFullBuffer(Buffers[N])) {
+      Iov[N].iov_base = Buffers[N].Buffer;
+      Iov[N].iov_len = Buffers[N].Size;
+      ++N;
+    }
+    if (N == 0)
+      break;
+    retryingWritevAll(Fd, Iov, N);
+    for (int I = 0; I < N; ++I) {
+      auto EC = Q->recycleBuffer(Buffers[I]);
+      if (EC != BufferQueue::ErrorCode::Ok)
+        Report("Failed to recycle buffer at %p; error=%s\n",
+               Buffers[I].Buffer, BufferQueue::getErrorString(EC));
+    }
+    Total += N;
+  }
+  __sanitizer::atomic_fetch_add(&StreamedBuffers, Total,
+                                __sanitizer::memory_order_relaxed);
+  return Total;
+}
+
+static void *streamingWriter(void *Arg) XRAY_NEVER_INSTRUMENT {
+  auto *Q = static_cast<BufferQueue *>(Arg);
+  while (!__sanitizer::atomic_load(&StreamStop,
+                                   __sanitizer::memory_order_acquire)) {
+    if (streamBuffers(Q, StreamFd) == 0)
+      SleepForMillis(flags()->xray_fdr_log_stream_interval_ms);
+  }
+  return nullptr;
+}
+
+static void stopStreaming() XRAY_NEVER_INSTRUMENT {
+  if (!StreamThreadRunning)
+    return;
+  __sanitizer::atomic_store(&StreamStop, 1, __sanitizer::memory_order_release);
+  pthread_join(StreamThread, nullptr);
+  StreamThreadRunning = false;
+}
+
 XRayLogInitStatus fdrLoggingInit(std::size_t BufferSize, std::size_t BufferMax,
                                  void *Options,
                                  size_t OptionsSize) XRAY_NEVER_INSTRUMENT {
@@ -64,19 +139,50 @@ XRayLogInitStatus fdrLoggingInit(std::size_t BufferSize, std::size_t BufferMax,
 
   FDROptions.reset(new FDRLoggingOptions());
   memcpy(FDROptions.get(), Options, OptionsSize);
+  bool Streaming = flags()->xray_fdr_log_stream;
+  if (Streaming) {
+    StreamFd = FDROptions->Fd;
+    if (StreamFd == -1)
+      StreamFd = getLogFD();
+    if (StreamFd == -1) {
+      Report("XRay FDR: no log file to stream to; buffers will only be "
+             "written out on flush.\n");
+      Streaming = false;
+    }
+  }
   bool Success = false;
-  BQ = std::make_shared<BufferQueue>(BufferSize, BufferMax, Success);
+  int Pools = flags()->xray_fdr_log_buffer_pools;
+  BQ = std::make_shared<BufferQueue>(BufferSize, BufferMax, Success,
+                                     Pools > 0 ? Pools : 1, Streaming);
   if (!Success) {
     Report("BufferQueue init failed.\n");
     return XRayLogInitStatus::XRAY_LOG_UNINITIALIZED;
   }
 
+  if (Streaming) {
+    writeFileHeader(StreamFd, *BQ);
+    __sanitizer::atomic_store(&StreamStop, 0,
+                              __sanitizer::memory_order_relaxed);
+    __sanitizer::atomic_store(&StreamedBuffers, 0,
+                              __sanitizer::memory_order_relaxed);
+    // Without the writer the buffers still get written out on flush, but
+    // tracing stops once they are all waiting.
+    if (pthread_create(&StreamThread, nullptr, streamingWriter, BQ.get()) != 0)
+      Report("XRay FDR: failed to start the streaming writer thread.\n");
+    else
+      StreamThreadRunning = true;
+  }
+
+  __xray_fdr_internal::updateThresholdTicks();
+
   // Install the actual handleArg0 handler after initialising the buffers.
   __xray_set_handler(fdrLoggingHandleArg0);
+  __xray_set_handler_arg1(fdrLoggingHandleArg1);
 
   __sanitizer::atomic_store(&LoggingStatus,
                             XRayLogInitStatus::XRAY_LOG_INITIALIZED,
                             __sanitizer::memory_order_release);
+  __xray_fdr_internal::invalidateThreadStates();
   Report("XRay FDR init successful.\n");
   return XRayLogInitStatus::XRAY_LOG_INITIALIZED;
 }
@@ -99,6 +205,23 @@ XRayLogFlushStatus fdrLoggingFlush() XRAY_NEVER_INSTRUMENT {
   // with it.
   auto LocalBQ = BQ;
 
+  // In streaming mode the header and most buffers are already out; stop the
+  // writer and write down whatever was released since.
+  if (StreamFd != -1) {
+    stopStreaming();
+    streamBuffers(LocalBQ.get(), StreamFd);
+    if (auto Exhausted = LocalBQ->exhaustedCount())
+      Report("XRay FDR: streamed %llu buffers; %llu buffer requests failed "
+             "because the writer fell behind.\n",
+             __sanitizer::atomic_load(&StreamedBuffers,
+                                      __sanitizer::memory_order_relaxed),
+             Exhausted);
+    __sanitizer::atomic_store(&LogFlushStatus,
+                              XRayLogFlushStatus::XRAY_LOG_FLUSHED,
+                              __sanitizer::memory_order_release);
+    return XRayLogFlushStatus::XRAY_LOG_FLUSHED;
+  }
+
   // We write out the file in the following format:
   //
   //   1) We write down the XRay file header with version 1, type FDR_LOG.
@@ -118,18 +241,7 @@ XRayLogFlushStatus fdrLoggingFlush() XRAY_NEVER_INSTRUMENT {
     return Result;
   }
 
-  XRayFileHeader Header;
-  Header.Version = 1;
-  Header.Type = FileTypes::FDR_LOG;
-  Header.CycleFrequency = probeRequiredCPUFeatures()
-                          ? getTSCFrequency() : __xray::NanosecondsPerSecond;
-  // FIXME: Actually check whether we have 'constant_tsc' and 'nonstop_tsc'
-  // before setting the values in the header.
-  Header.ConstantTSC = 1;
-  Header.NonstopTSC = 1;
-  Header.FdrData = FdrAdditionalHeaderData{LocalBQ->ConfiguredBufferSize()};
-  retryingWriteAll(Fd, reinterpret_cast<char *>(&Header),
-                   reinterpret_cast<char *>(&Header) + sizeof(Header));
+  writeFileHeader(Fd, *LocalBQ);
 
   LocalBQ->apply([&](const BufferQueue::Buffer &B) {
     uint64_t BufferSize = B.Size;
@@ -155,22 +267,28 @@ XRayLogInitStatus fdrLoggingFinalize() XRAY_NEVER_INSTRUMENT {
   // Do special things to make the log finalize itself, and not allow any more
   // operations to be performed until re-initialized.
   BQ->finalize();
+  __xray_fdr_internal::invalidateThreadStates();
 
   __sanitizer::atomic_store(&LoggingStatus,
                             XRayLogInitStatus::XRAY_LOG_FINALIZED,
                             __sanitizer::memory_order_release);
+  __xray_fdr_internal::invalidateThreadStates();
   return XRayLogInitStatus::XRAY_LOG_FINALIZED;
 }
 
 XRayLogInitStatus fdrLoggingReset() XRAY_NEVER_INSTRUMENT {
+  // Hold the status at FINALIZING while we tear down, so that a concurrent
+  // fdrLoggingInit cannot set up a queue which we then release.
   s32 CurrentStatus = XRayLogInitStatus::XRAY_LOG_FINALIZED;
-  if (__sanitizer::atomic_compare_exchange_strong(
+  if (!__sanitizer::atomic_compare_exchange_strong(
           &LoggingStatus, &CurrentStatus,
-          XRayLogInitStatus::XRAY_LOG_INITIALIZED,
+          XRayLogInitStatus::XRAY_LOG_FINALIZING,
           __sanitizer::memory_order_release))
     return static_cast<XRayLogInitStatus>(CurrentStatus);
 
-  // Release the in-memory buffer queue.
+  // Stop streaming, if we still are, and release the in-memory buffer queue.
+  stopStreaming();
+  StreamFd = -1;
   BQ.reset();
 
   // Spin until the flushing status is flushed.
@@ -185,37 +303,64 @@ XRayLogInitStatus fdrLoggingReset() XRAY_NEVER_INSTRUMENT {
   }
 
   // At this point, we know that the status is flushed, and that we can assume
+  __sanitizer::atomic_store(&LoggingStatus,
+                            XRayLogInitStatus::XRAY_LOG_UNINITIALIZED,
+                            __sanitizer::memory_order_release);
+  __xray_fdr_internal::invalidateThreadStates();
   return XRayLogInitStatus::XRAY_LOG_UNINITIALIZED;
 }
 
+static inline uint64_t readTimestamp(unsigned char &CPU) XRAY_NEVER_INSTRUMENT {
+  return probeRequiredCPUFeatures() ? __xray::readTSC(CPU)
+                                    : __xray::readEmulatedTSC(CPU);
+}
+
 void fdrLoggingHandleArg0(int32_t FuncId,
                           XRayEntryType Entry) XRAY_NEVER_INSTRUMENT {
   // We want to get the TSC as early as possible, so that we can check whether
   // we've seen this CPU before. We also do it before we load anything else, to
   // allow for forward progress with the scheduling.
   unsigned char CPU;
-  uint64_t TSC;
-
-  if(probeRequiredCPUFeatures()) {
-    TSC = __xray::readTSC(CPU);
-  } else {
-    // FIXME: This code needs refactoring as it appears in multiple locations
-    timespec TS;
-    int result = clock_gettime(CLOCK_REALTIME, &TS);
-    if (result != 0) {
-      Report("clock_gettime(2) return %d, errno=%d", result, int(errno));
-      TS = {0, 0};
-    }
-    CPU = 0;
-    TSC = TS.tv_sec * __xray::NanosecondsPerSecond + TS.tv_nsec;
-  }
-
+  uint64_t TSC = readTimestamp(CPU);
   __xray_fdr_internal::processFunctionHook(FuncId, Entry, TSC, CPU,
                                            clock_gettime, LoggingStatus, BQ);
 }
 
+void fdrLoggingHandleArg1(int32_t FuncId, XRayEntryType Entry,
+                          uint64_t Arg1) XRAY_NEVER_INSTRUMENT {
+  unsigned char CPU;
+  uint64_t TSC = readTimestamp(CPU);
+  __xray_fdr_internal::processFunctionHook(FuncId, Entry, TSC, CPU, Arg1,
+                                           clock_gettime, LoggingStatus, BQ);
+}
+
 } // namespace __xray
 
+using namespace __xray;
+
+void *__xray_fdr_reserve_custom_event(uint16_t Type,
+                                      size_t Size) XRAY_NEVER_INSTRUMENT {
+  unsigned char CPU;
+  uint64_t TSC = readTimestamp(CPU);
+  return __xray_fdr_internal::reserveCustomEvent(Type, Size, TSC, CPU,
+                                                 clock_gettime, LoggingStatus,
+                                                 BQ);
+}
+
+void __xray_fdr_commit_custom_event() XRAY_NEVER_INSTRUMENT {
+  __xray_fdr_internal::commitCustomEvent();
+}
+
+int __xray_fdr_log_custom_event(uint16_t Type, const void *Event,
+                                size_t Size) XRAY_NEVER_INSTRUMENT {
+  void *Payload = __xray_fdr_reserve_custom_event(Type, Size);
+  if (Payload == nullptr)
+    return 0;
+  memcpy(Payload, Event, Size);
+  __xray_fdr_commit_custom_event();
+  return 1;
+}
+
 static auto UNUSED Unused = [] {
   using namespace __xray;
   if (flags()->xray_fdr_log) {
@@ -101,6 +101,29 @@ static void processFunctionHook(int32_t FuncId, XRayEntryType Entry,
                                 __sanitizer::atomic_sint32_t &LoggingStatus,
                                 const std::shared_ptr<BufferQueue> &BQ);
 
+/// Like processFunctionHook, but also writes a CallArgument record with |Arg1|
+/// after the function record for |Entry|.
+static void processFunctionHook(int32_t FuncId, XRayEntryType Entry,
+                                uint64_t TSC, unsigned char CPU, uint64_t Arg1,
+                                int (*wall_clock_reader)(clockid_t,
+                                                         struct timespec *),
+                                __sanitizer::atomic_sint32_t &LoggingStatus,
+                                const std::shared_ptr<BufferQueue> &BQ);
+
+/// Writes a CustomEventMarker record for an event with |Size| bytes of payload
+/// and returns where the payload goes in the thread's buffer, or nullptr if the
+/// event can't be logged. The thread doesn't log anything else until
+/// commitCustomEvent() is called, which must happen iff this succeeded.
+static char *reserveCustomEvent(uint16_t EventType, size_t Size, uint64_t TSC,
+                                unsigned char CPU,
+                                int (*wall_clock_reader)(clockid_t,
+                                                         struct timespec *),
+                                __sanitizer::atomic_sint32_t &LoggingStatus,
+                                const std::shared_ptr<BufferQueue> &BQ);
+
+/// Finishes the custom event started by reserveCustomEvent().
+static void commitCustomEvent();
+
 //-----------------------------------------------------------------------------|
 // The rest of the file is implementation.                                     |
 //-----------------------------------------------------------------------------|
@@ -120,8 +143,48 @@ thread_local uint8_t NumConsecutiveFnEnters = 0;
 // records preceding RecordPtr.
 thread_local uint8_t NumTailCalls = 0;
 
+// State for the compact (version 2) format: whether the current buffer uses it,
+// and the function ID compact records are encoded relative to, which we lose
+// track of when rewinding over a full record.
+thread_local bool CompactRecords = false;
+thread_local int32_t BaseFuncId = 0;
+thread_local bool BaseFuncIdValid = false;
+
+// Function records are no longer all the same size in the compact format, so
+// for rewinding we keep one bit per recent function record, set for compact
+// ones, with the most recent in the lowest bit. We never rewind over more than
+// kMaxRewindRecords records.
+thread_local uint64_t CompactRecordBits = 0;
+constexpr uint8_t kMaxRewindRecords = 64;
+
+// The end of the last leaf call (an entry immediately followed by its exit)
+// written in the compact format, and the FunctionRepeat record after it, if
+// any, which a repeated call to the same function is folded into.
+thread_local char *LeafCallEnd = nullptr;
+thread_local int32_t LeafFuncId = 0;
+thread_local uint64_t LeafExitTSC = 0;
+thread_local char *RepeatRecord = nullptr;
+
+// The CPU the thread last logged on (we assume that we'll support only 65536
+// CPUs for x86_64), and the TSC of that and of the last function entry.
+thread_local uint16_t CurrentCPU = std::numeric_limits<uint16_t>::max();
+thread_local uint64_t LastTSC = 0;
+thread_local uint64_t LastFunctionEntryTSC = 0;
+
+// Set while the thread is writing to its buffer, or has a custom event
+// reserved in it.
+thread_local bool Running = false;
+
+// Bumped whenever the logging status or the buffer queue changes. Threads
+// which have a buffer and have seen the current epoch can skip checking the
+// status and the queue for every record, and write to CachedBQ's buffer.
+__sanitizer::atomic_uint32_t StateEpoch = {1};
+thread_local uint32_t SeenStateEpoch = 0;
+thread_local BufferQueue *CachedBQ = nullptr;
+
 constexpr auto MetadataRecSize = sizeof(MetadataRecord);
 constexpr auto FunctionRecSize = sizeof(FunctionRecord);
+constexpr auto CompactFunctionRecSize = sizeof(CompactFunctionRecord);
 
 class ThreadExitBufferCleanup {
   std::weak_ptr<BufferQueue> Buffers;
@@ -226,6 +289,12 @@ static inline void setupNewBuffer(int (*wall_clock_reader)(clockid_t,
                                                            struct timespec *))
     XRAY_NEVER_INSTRUMENT {
   RecordPtr = static_cast<char *>(Buffer.Buffer);
+  CompactRecords = flags()->xray_fdr_log_compact;
+  BaseFuncId = 0;
+  BaseFuncIdValid = true;
+  CompactRecordBits = 0;
+  LeafCallEnd = nullptr;
+  RepeatRecord = nullptr;
   pid_t Tid = syscall(SYS_gettid);
   timespec TS{0, 0};
   // This is typically clock_gettime, but callers have injection ability.
@@ -307,6 +376,12 @@ static inline void writeFunctionRecord(int FuncId, uint32_t TSCDelta,
 
   switch (EntryType) {
   case XRayEntryType::ENTRY:
+    // Don't let rewinding reach further back than we know record sizes for.
+    if (CompactRecords &&
+        NumConsecutiveFnEnters + 2 * NumTailCalls >= kMaxRewindRecords) {
+      NumConsecutiveFnEnters = 0;
+      NumTailCalls = 0;
+    }
     ++NumConsecutiveFnEnters;
     FuncRecord.RecordKind = uint8_t(FunctionRecord::RecordKinds::FunctionEnter);
     break;
@@ -341,33 +416,109 @@ static inline void writeFunctionRecord(int FuncId, uint32_t TSCDelta,
     break;
   }
 
+  if (CompactRecords && BaseFuncIdValid) {
+    int32_t Delta = FuncRecord.FuncId - BaseFuncId;
+    if (Delta >= -(1 << 9) && Delta < (1 << 9) && TSCDelta < (1u << 18)) {
+      CompactFunctionRecord Compact;
+      Compact.Type = uint8_t(RecordType::Function);
+      Compact.RecordKind =
+          FuncRecord.RecordKind | CompactFunctionRecord::CompactKind;
+      Compact.FuncIdDelta = Delta;
+      Compact.TSCDelta = TSCDelta;
+      std::memcpy(MemPtr, &Compact, sizeof(CompactFunctionRecord));
+      MemPtr += sizeof(CompactFunctionRecord);
+      BaseFuncId += Delta;
+      CompactRecordBits = (CompactRecordBits << 1) | 1;
+      return;
+    }
+  }
+  BaseFuncId = FuncRecord.FuncId;
+  BaseFuncIdValid = true;
+  CompactRecordBits <<= 1;
+
   std::memcpy(MemPtr, &AlignedFuncRecordBuffer, sizeof(FunctionRecord));
   MemPtr += sizeof(FunctionRecord);
 }
 
-static uint64_t thresholdTicks() {
+namespace {
+
+// A function record read back from the buffer, in either format. For compact
+// records FuncId holds the delta to the previous function ID.
+struct ReadFunctionRecord {
+  char *Start;
+  uint8_t RecordKind;
+  bool Compact;
+  int32_t FuncId;
+  uint32_t TSCDelta;
+};
+
+} // namespace
+
+// Reads the function record which ends at |End|, the |Depth|th most recent one
+// in the buffer.
+static inline ReadFunctionRecord
+readFunctionRecordBefore(char *End, unsigned Depth) XRAY_NEVER_INSTRUMENT {
+  ReadFunctionRecord R;
+  R.Compact = (CompactRecordBits >> Depth) & 1;
+  if (R.Compact) {
+    CompactFunctionRecord Compact;
+    R.Start = End - CompactFunctionRecSize;
+    std::memcpy(&Compact, R.Start, CompactFunctionRecSize);
+    R.RecordKind = Compact.RecordKind & ~CompactFunctionRecord::CompactKind;
+    R.FuncId = Compact.FuncIdDelta;
+    R.TSCDelta = Compact.TSCDelta;
+  } else {
+    std::aligned_storage<sizeof(FunctionRecord), alignof(FunctionRecord)>::type
+        AlignedFuncRecordBuffer;
+    R.Start = End - FunctionRecSize;
+    const auto &FuncRecord = *reinterpret_cast<FunctionRecord *>(
+        std::memcpy(&AlignedFuncRecordBuffer, R.Start, FunctionRecSize));
+    R.RecordKind = FuncRecord.RecordKind;
+    R.FuncId = FuncRecord.FuncId;
+    R.TSCDelta = FuncRecord.TSCDelta;
+  }
+  return R;
+}
+
+// Erases the most recent function record from the buffer.
+static inline ReadFunctionRecord popFunctionRecord() XRAY_NEVER_INSTRUMENT {
+  auto R = readFunctionRecordBefore(RecordPtr, 0);
+  RecordPtr = R.Start;
+  CompactRecordBits >>= 1;
+  if (R.Compact)
+    BaseFuncId -= R.FuncId;
+  else
+    BaseFuncIdValid = false;
+  return R;
+}
+
+namespace {
+
+// Calls shorter than this are erased from the log. Set by updateThresholdTicks()
+// before logging is initialized.
+uint64_t ThresholdTicks = 0;
+
+} // namespace
+
+static void updateThresholdTicks() {
   static uint64_t TicksPerSec = probeRequiredCPUFeatures() ? getTSCFrequency() :
                                 __xray::NanosecondsPerSecond;
-  static const uint64_t ThresholdTicks =
+  ThresholdTicks =
       TicksPerSec * flags()->xray_fdr_log_func_duration_threshold_us / 1000000;
-  return ThresholdTicks;
 }
 
+static uint64_t thresholdTicks() { return ThresholdTicks; }
+
 // Re-point the thread local pointer into this thread's Buffer before the recent
 // "Function Entry" record and any "Tail Call Exit" records after that.
 static void rewindRecentCall(uint64_t TSC, uint64_t &LastTSC,
                              uint64_t &LastFunctionEntryTSC, int32_t FuncId) {
-  using AlignedFuncStorage =
-      std::aligned_storage<sizeof(FunctionRecord),
-                           alignof(FunctionRecord)>::type;
-  RecordPtr -= FunctionRecSize;
-  AlignedFuncStorage AlignedFuncRecordBuffer;
-  const auto &FuncRecord = *reinterpret_cast<FunctionRecord *>(
-      std::memcpy(&AlignedFuncRecordBuffer, RecordPtr, FunctionRecSize));
+  const auto FuncRecord = popFunctionRecord();
   assert(FuncRecord.RecordKind ==
              uint8_t(FunctionRecord::RecordKinds::FunctionEnter) &&
          "Expected to find function entry recording when rewinding.");
-  assert(FuncRecord.FuncId == (FuncId & ~(0x0F << 28)) &&
+  assert((FuncRecord.Compact ||
+          FuncRecord.FuncId == (FuncId & ~(0x0F << 28))) &&
          "Expected matching function id when rewinding Exit");
   --NumConsecutiveFnEnters;
   LastTSC -= FuncRecord.TSCDelta;
@@ -383,27 +534,20 @@ static void rewindRecentCall(uint64_t TSC, uint64_t &LastTSC,
   // exited from via this exit.
   LastFunctionEntryTSC = 0;
   auto RewindingTSC = LastTSC;
-  auto RewindingRecordPtr = RecordPtr - FunctionRecSize;
   while (NumTailCalls > 0) {
-    AlignedFuncStorage TailExitRecordBuffer;
     // Rewind the TSC back over the TAIL EXIT record.
-    const auto &ExpectedTailExit =
-        *reinterpret_cast<FunctionRecord *>(std::memcpy(
-            &TailExitRecordBuffer, RewindingRecordPtr, FunctionRecSize));
-
+    const auto ExpectedTailExit = readFunctionRecordBefore(RecordPtr, 0);
     assert(ExpectedTailExit.RecordKind ==
                uint8_t(FunctionRecord::RecordKinds::FunctionTailExit) &&
            "Expected to find tail exit when rewinding.");
-    RewindingRecordPtr -= FunctionRecSize;
     RewindingTSC -= ExpectedTailExit.TSCDelta;
-    AlignedFuncStorage FunctionEntryBuffer;
-    const auto &ExpectedFunctionEntry =
-        *reinterpret_cast<FunctionRecord *>(std::memcpy(
-            &FunctionEntryBuffer, RewindingRecordPtr, FunctionRecSize));
+    const auto ExpectedFunctionEntry =
+        readFunctionRecordBefore(ExpectedTailExit.Start, 1);
     assert(ExpectedFunctionEntry.RecordKind ==
                uint8_t(FunctionRecord::RecordKinds::FunctionEnter) &&
            "Expected to find function entry when rewinding tail call.");
-    assert(ExpectedFunctionEntry.FuncId == ExpectedTailExit.FuncId &&
+    assert((ExpectedFunctionEntry.Compact || ExpectedTailExit.Compact ||
+            ExpectedFunctionEntry.FuncId == ExpectedTailExit.FuncId) &&
            "Expected funcids to match when rewinding tail call.");
 
     // This tail call exceeded the threshold duration. It will not be erased.
@@ -415,13 +559,54 @@ static void rewindRecentCall(uint64_t TSC, uint64_t &LastTSC,
     // We can erase a tail exit pair that we're exiting through since
     // its duration is under threshold.
     --NumTailCalls;
-    RewindingRecordPtr -= FunctionRecSize;
     RewindingTSC -= ExpectedFunctionEntry.TSCDelta;
-    RecordPtr -= 2 * FunctionRecSize;
+    popFunctionRecord();
+    popFunctionRecord();
     LastTSC = RewindingTSC;
   }
 }
 
+// In the compact format, a leaf call to the function that the last leaf call
+// was to is folded into a FunctionRepeat record after that call, instead of
+// keeping its own entry and exit records. Returns false if it can't be.
+static bool foldRepeatedCall(int32_t FuncId, uint64_t TSC) {
+  if (LeafCallEnd == nullptr || LeafFuncId != FuncId)
+    return false;
+  // The entry of this call must directly follow the previous call (or the
+  // FunctionRepeat record after it).
+  if (readFunctionRecordBefore(RecordPtr, 0).Start != LeafCallEnd)
+    return false;
+  uint64_t Delta = TSC - LeafExitTSC;
+  if (Delta > std::numeric_limits<uint32_t>::max())
+    return false;
+
+  std::aligned_storage<sizeof(FunctionRecord), alignof(FunctionRecord)>::type
+      AlignedFuncRecordBuffer;
+  auto &Repeat = *reinterpret_cast<FunctionRecord *>(&AlignedFuncRecordBuffer);
+  if (RepeatRecord != nullptr) {
+    std::memcpy(&AlignedFuncRecordBuffer, RepeatRecord, FunctionRecSize);
+    if (Repeat.FuncId == (1 << 27) - 1)
+      return false;
+  }
+
+  popFunctionRecord();
+  NumConsecutiveFnEnters = 0;
+  NumTailCalls = 0;
+  if (RepeatRecord == nullptr) {
+    Repeat.Type = uint8_t(RecordType::Function);
+    Repeat.RecordKind = uint8_t(FunctionRecord::RecordKinds::FunctionRepeat);
+    Repeat.FuncId = 0;
+    RepeatRecord = RecordPtr;
+    RecordPtr += FunctionRecSize;
+    CompactRecordBits <<= 1;
+  }
+  Repeat.FuncId = Repeat.FuncId + 1;
+  Repeat.TSCDelta = Delta;
+  std::memcpy(RepeatRecord, &AlignedFuncRecordBuffer, FunctionRecSize);
+  LeafCallEnd = RecordPtr;
+  return true;
+}
+
 static inline bool releaseThreadLocalBuffer(BufferQueue *BQ) {
   auto EC = BQ->releaseBuffer(Buffer);
   if (EC != BufferQueue::ErrorCode::Ok) {
@@ -432,8 +617,51 @@ static inline bool releaseThreadLocalBuffer(BufferQueue *BQ) {
   return true;
 }
 
-static inline void processFunctionHook(
-    int32_t FuncId, XRayEntryType Entry, uint64_t TSC, unsigned char CPU,
+static inline void reportGetBufferFailure(BufferQueue *BQ,
+                                          BufferQueue::ErrorCode EC) {
+  // Running out of buffers is back-pressure rather than an error, so we only
+  // report it once per queue; the flush reports how often it happened.
+  if (EC == BufferQueue::ErrorCode::NotEnoughMemory &&
+      BQ->exhaustedCount() > 1)
+    return;
+  Report("Failed to acquire a buffer; error=%s\n",
+         BufferQueue::getErrorString(EC));
+}
+
+static inline void writeCallArgumentMetadata(uint64_t A) XRAY_NEVER_INSTRUMENT {
+  MetadataRecord CallArg;
+  CallArg.Type = uint8_t(RecordType::Metadata);
+  CallArg.RecordKind = uint8_t(MetadataRecord::RecordKinds::CallArgument);
+
+  // The data for the CallArgument record contains the following bytes:
+  //   - Argument (uint64_t, 8 bytes)
+  // Total = 8 bytes.
+  std::memcpy(&CallArg.Data, &A, sizeof(A));
+  std::memcpy(RecordPtr, &CallArg, sizeof(MetadataRecord));
+  RecordPtr += sizeof(MetadataRecord);
+}
+
+// Nothing before a record which isn't a function record can be rewound or
+// folded into.
+static inline void resetRewindState() XRAY_NEVER_INSTRUMENT {
+  NumConsecutiveFnEnters = 0;
+  NumTailCalls = 0;
+  LeafCallEnd = nullptr;
+  RepeatRecord = nullptr;
+}
+
+/// Makes the threads re-check the logging status and the buffer queue. Called
+/// after changing either.
+static inline void invalidateThreadStates() XRAY_NEVER_INSTRUMENT {
+  __sanitizer::atomic_fetch_add(&StateEpoch, 1,
+                                __sanitizer::memory_order_acq_rel);
+}
+
+// Checks the logging status and which buffer queue the thread should use, and
+// makes sure the thread has a buffer from it. Returns the queue, or nullptr if
+// we shouldn't log anything.
+static inline BufferQueue *refreshThreadState(
+    unsigned char CPU, uint64_t TSC,
     int (*wall_clock_reader)(clockid_t, struct timespec *),
     __sanitizer::atomic_sint32_t &LoggingStatus,
     const std::shared_ptr<BufferQueue> &BQ) XRAY_NEVER_INSTRUMENT {
@@ -447,56 +675,45 @@ static inline void processFunctionHook(
          Status == XRayLogInitStatus::XRAY_LOG_FINALIZED)) {
       writeEOBMetadata();
       if (!releaseThreadLocalBuffer(BQ.get()))
-        return;
+        return nullptr;
       RecordPtr = nullptr;
     }
-    return;
+    return nullptr;
   }
 
-  // We use a thread_local variable to keep track of which CPUs we've already
-  // run, and the TSC times for these CPUs. This allows us to stop repeating the
-  // CPU field in the function records.
-  //
-  // We assume that we'll support only 65536 CPUs for x86_64.
-  thread_local uint16_t CurrentCPU = std::numeric_limits<uint16_t>::max();
-  thread_local uint64_t LastTSC = 0;
-  thread_local uint64_t LastFunctionEntryTSC = 0;
-
   // Make sure a thread that's ever called handleArg0 has a thread-local
   // live reference to the buffer queue for this particular instance of
   // FDRLogging, and that we're going to clean it up when the thread exits.
   thread_local auto LocalBQ = BQ;
   thread_local ThreadExitBufferCleanup Cleanup(LocalBQ, Buffer);
 
-  // Prevent signal handler recursion, so in case we're already in a log writing
-  // mode and the signal handler comes in (and is also instrumented) then we
-  // don't want to be clobbering potentially partial writes already happening in
-  // the thread. We use a simple thread_local latch to only allow one on-going
-  // handleArg0 to happen at any given time.
-  thread_local bool Running = false;
-  RecursionGuard Guard{Running};
-  if (!Guard) {
-    assert(Running == true && "RecursionGuard is buggy!");
-    return;
+  // If logging was reset and initialized again since this thread last ran,
+  // hand any buffer back to the old queue and start over with the new one.
+  if (LocalBQ != BQ) {
+    if (RecordPtr != nullptr)
+      releaseThreadLocalBuffer(LocalBQ.get());
+    Buffer = BufferQueue::Buffer();
+    RecordPtr = nullptr;
+    CurrentCPU = std::numeric_limits<uint16_t>::max();
+    LocalBQ = BQ;
   }
 
   if (!loggingInitialized(LoggingStatus) || LocalBQ->finalizing()) {
     writeEOBMetadata();
     if (!releaseThreadLocalBuffer(BQ.get()))
-      return;
+      return nullptr;
     RecordPtr = nullptr;
   }
 
   if (Buffer.Buffer == nullptr) {
-    auto EC = LocalBQ->getBuffer(Buffer);
+    auto EC = LocalBQ->getBuffer(Buffer, CPU);
     if (EC != BufferQueue::ErrorCode::Ok) {
       auto LS = __sanitizer::atomic_load(&LoggingStatus,
                                          __sanitizer::memory_order_acquire);
       if (LS != XRayLogInitStatus::XRAY_LOG_FINALIZING &&
           LS != XRayLogInitStatus::XRAY_LOG_FINALIZED)
-        Report("Failed to acquire a buffer; error=%s\n",
-               BufferQueue::getErrorString(EC));
-      return;
+        reportGetBufferFailure(LocalBQ.get(), EC);
+      return nullptr;
     }
 
     setupNewBuffer(wall_clock_reader);
@@ -508,13 +725,38 @@ static inline void processFunctionHook(
     CurrentCPU = CPU;
     writeNewCPUIdMetadata(CPU, TSC);
   }
+  return LocalBQ.get();
+}
+
+// Makes sure that the thread has a buffer from |BQ| with room for |Bytes| more
+// bytes and an EOB record after them, switching to a new buffer if needed.
+// Returns the queue the thread's buffer belongs to, or nullptr if we shouldn't
+// log anything. Requires the Running guard.
+static inline BufferQueue *prepareBuffer(
+    size_t Bytes, unsigned char CPU, uint64_t TSC,
+    int (*wall_clock_reader)(clockid_t, struct timespec *),
+    __sanitizer::atomic_sint32_t &LoggingStatus,
+    const std::shared_ptr<BufferQueue> &BQ) XRAY_NEVER_INSTRUMENT {
+  // The epoch is bumped after every status change, so reading it first means
+  // that if we still see the epoch we saw last, nothing we checked since has
+  // changed.
+  uint32_t Epoch =
+      __sanitizer::atomic_load(&StateEpoch, __sanitizer::memory_order_acquire);
+  BufferQueue *LocalBQ = CachedBQ;
+  if (UNLIKELY(Epoch != SeenStateEpoch || RecordPtr == nullptr)) {
+    LocalBQ = refreshThreadState(CPU, TSC, wall_clock_reader, LoggingStatus, BQ);
+    if (LocalBQ == nullptr)
+      return nullptr;
+    CachedBQ = LocalBQ;
+    SeenStateEpoch = Epoch;
+  }
 
-  // Before we go setting up writing new function entries, we need to be really
-  // careful about the pointer math we're doing. This means we need to ensure
-  // that the record we are about to write is going to fit into the buffer,
-  // without overflowing the buffer.
+  // Before we go setting up writing new records, we need to be really careful
+  // about the pointer math we're doing. This means we need to ensure that the
+  // records we are about to write are going to fit into the buffer, without
+  // overflowing the buffer.
   //
-  // To do this properly, we use the following assumptions:
+  // For function records, the callers use the following assumptions:
   //
   //   - The least number of bytes we will ever write is 8
   //     (sizeof(FunctionRecord)) only if the delta between the previous entry
@@ -537,33 +779,62 @@ static inline void processFunctionHook(
   //       3. When we learn about a new CPU ID, we need to write down a "new cpu
   //          id" MetadataRecord before writing out the actual FunctionRecord.
   //
+  //     A logged argument adds another MetadataRecord.
+  //
   //   - An End-of-Buffer (EOB) MetadataRecord is 16 bytes.
   //
-  // So the math we need to do is to determine whether writing 24 bytes past the
-  // current pointer leaves us with enough bytes to write the EOB
-  // MetadataRecord. If we don't have enough space after writing as much as 24
-  // bytes in the end of the buffer, we need to write out the EOB, get a new
-  // Buffer, set it up properly before doing any further writing.
+  // So the math we need to do is to determine whether writing |Bytes| bytes
+  // past the current pointer leaves us with enough bytes to write the EOB
+  // MetadataRecord. If we don't have enough space after writing as much as
+  // |Bytes| bytes in the end of the buffer, we need to write out the EOB, get a
+  // new Buffer, set it up properly before doing any further writing.
   //
   char *BufferStart = static_cast<char *>(Buffer.Buffer);
-  if ((RecordPtr + (MetadataRecSize + FunctionRecSize)) - BufferStart <
+  if ((BufferStart + Buffer.Size) - (RecordPtr + Bytes) <
       static_cast<ptrdiff_t>(MetadataRecSize)) {
     writeEOBMetadata();
-    if (!releaseThreadLocalBuffer(LocalBQ.get()))
-      return;
-    auto EC = LocalBQ->getBuffer(Buffer);
+    if (!releaseThreadLocalBuffer(LocalBQ))
+      return nullptr;
+    auto EC = LocalBQ->getBuffer(Buffer, CPU);
     if (EC != BufferQueue::ErrorCode::Ok) {
-      Report("Failed to acquire a buffer; error=%s\n",
-             BufferQueue::getErrorString(EC));
-      return;
+      RecordPtr = nullptr;
+      reportGetBufferFailure(LocalBQ, EC);
+      return nullptr;
     }
     setupNewBuffer(wall_clock_reader);
   }
+  return LocalBQ;
+}
+
+static inline void processFunctionHook(
+    int32_t FuncId, XRayEntryType Entry, uint64_t TSC, unsigned char CPU,
+    const uint64_t *Arg1,
+    int (*wall_clock_reader)(clockid_t, struct timespec *),
+    __sanitizer::atomic_sint32_t &LoggingStatus,
+    const std::shared_ptr<BufferQueue> &BQ) XRAY_NEVER_INSTRUMENT {
+  // Prevent signal handler recursion, so in case we're already in a log writing
+  // mode and the signal handler comes in (and is also instrumented) then we
+  // don't want to be clobbering potentially partial writes already happening in
+  // the thread. We use a simple thread_local latch to only allow one on-going
+  // handleArg0 to happen at any given time.
+  RecursionGuard Guard{Running};
+  if (!Guard) {
+    assert(Running == true && "RecursionGuard is buggy!");
+    return;
+  }
+
+  size_t MaxRecordsSize = MetadataRecSize + FunctionRecSize;
+  if (Arg1 != nullptr)
+    MaxRecordsSize += MetadataRecSize;
+  auto *LocalBQ = prepareBuffer(MaxRecordsSize, CPU, TSC, wall_clock_reader,
+                                LoggingStatus, BQ);
+  if (LocalBQ == nullptr)
+    return;
 
   // By this point, we are now ready to write at most 24 bytes (one metadata
-  // record and one function record).
-  BufferStart = static_cast<char *>(Buffer.Buffer);
-  assert((RecordPtr + (MetadataRecSize + FunctionRecSize)) - BufferStart >=
+  // record and one function record), and the argument.
+  char *BufferStart = static_cast<char *>(Buffer.Buffer);
+  assert((BufferStart + Buffer.Size) - (RecordPtr + MaxRecordsSize) >=
              static_cast<ptrdiff_t>(MetadataRecSize) &&
          "Misconfigured BufferQueue provided; Buffer size not large enough.");
 
@@ -614,25 +885,106 @@ static inline void processFunctionHook(
     break;
   case XRayEntryType::EXIT:
     // Break out and write the exit record if we can't erase any functions.
-    if (NumConsecutiveFnEnters == 0 ||
-        (TSC - LastFunctionEntryTSC) >= thresholdTicks())
+    if (NumConsecutiveFnEnters == 0 || Arg1 != nullptr)
+      break;
+    if ((TSC - LastFunctionEntryTSC) >= thresholdTicks()) {
+      if (CompactRecords && foldRepeatedCall(FuncId, TSC))
+        return;
       break;
+    }
     rewindRecentCall(TSC, LastTSC, LastFunctionEntryTSC, FuncId);
     return; // without writing log.
   }
 
+  bool ClosesLeafCall =
+      Entry == XRayEntryType::EXIT && NumConsecutiveFnEnters != 0;
   writeFunctionRecord(FuncId, RecordTSCDelta, Entry, RecordPtr);
+  if (Arg1 != nullptr) {
+    writeCallArgumentMetadata(*Arg1);
+    resetRewindState();
+  } else if (CompactRecords && ClosesLeafCall) {
+    LeafCallEnd = RecordPtr;
+    LeafFuncId = FuncId;
+    LeafExitTSC = TSC;
+    RepeatRecord = nullptr;
+  }
 
   // If we've exhausted the buffer by this time, we then release the buffer to
   // make sure that other threads may start using this buffer.
   if ((RecordPtr + MetadataRecSize) - BufferStart == MetadataRecSize) {
     writeEOBMetadata();
-    if (!releaseThreadLocalBuffer(LocalBQ.get()))
+    if (!releaseThreadLocalBuffer(LocalBQ))
       return;
     RecordPtr = nullptr;
   }
 }
 
+static inline void processFunctionHook(
+    int32_t FuncId, XRayEntryType Entry, uint64_t TSC, unsigned char CPU,
+    int (*wall_clock_reader)(clockid_t, struct timespec *),
+    __sanitizer::atomic_sint32_t &LoggingStatus,
+    const std::shared_ptr<BufferQueue> &BQ) XRAY_NEVER_INSTRUMENT {
+  processFunctionHook(FuncId, Entry, TSC, CPU, nullptr, wall_clock_reader,
+                      LoggingStatus, BQ);
+}
+
+static inline void processFunctionHook(
+    int32_t FuncId, XRayEntryType Entry, uint64_t TSC, unsigned char CPU,
+    uint64_t Arg1, int (*wall_clock_reader)(clockid_t, struct timespec *),
+    __sanitizer::atomic_sint32_t &LoggingStatus,
+    const std::shared_ptr<BufferQueue> &BQ) XRAY_NEVER_INSTRUMENT {
+  processFunctionHook(FuncId, Entry, TSC, CPU, &Arg1, wall_clock_reader,
+                      LoggingStatus, BQ);
+}
+
+static inline char *reserveCustomEvent(
+    uint16_t EventType, size_t Size, uint64_t TSC, unsigned char CPU,
+    int (*wall_clock_reader)(clockid_t, struct timespec *),
+    __sanitizer::atomic_sint32_t &LoggingStatus,
+    const std::shared_ptr<BufferQueue> &BQ) XRAY_NEVER_INSTRUMENT {
+  if (Running)
+    return nullptr;
+  Running = true;
+
+  // The event has to fit into an empty buffer, after the preamble and the
+  // NewCPUId record.
+  if (BQ == nullptr ||
+      Size + 5 * MetadataRecSize > BQ->ConfiguredBufferSize() ||
+      Size > static_cast<size_t>(std::numeric_limits<int32_t>::max()) ||
+      prepareBuffer(MetadataRecSize + Size, CPU, TSC, wall_clock_reader,
+                    LoggingStatus, BQ) == nullptr) {
+    Running = false;
+    return nullptr;
+  }
+
+  MetadataRecord Marker;
+  Marker.Type = uint8_t(RecordType::Metadata);
+  Marker.RecordKind = uint8_t(MetadataRecord::RecordKinds::CustomEventMarker);
+
+  // The data for the CustomEventMarker record contains the following bytes:
+  //   - Payload size (int32_t, 4 bytes)
+  //   - Full TSC (uint64_t, 8 bytes)
+  //   - Event type (uint16_t, 2 bytes)
+  // Total = 14 bytes. The payload follows the record.
+  int32_t PayloadSize = Size;
+  std::memcpy(&Marker.Data, &PayloadSize, sizeof(PayloadSize));
+  std::memcpy(&Marker.Data[sizeof(PayloadSize)], &TSC, sizeof(TSC));
+  std::memcpy(&Marker.Data[sizeof(PayloadSize) + sizeof(TSC)], &EventType,
+              sizeof(EventType));
+  std::memcpy(RecordPtr, &Marker, sizeof(MetadataRecord));
+  RecordPtr += sizeof(MetadataRecord);
+  resetRewindState();
+
+  char *Payload = RecordPtr;
+  RecordPtr += Size;
+  return Payload;
+}
+
+static inline void commitCustomEvent() XRAY_NEVER_INSTRUMENT {
+  assert(Running && "Committing a custom event which wasn't reserved.");
+  Running = false;
+}
+
 } // namespace __xray_fdr_internal
 
 } // namespace __xray
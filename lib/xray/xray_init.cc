@@ -59,8 +59,12 @@ void __xray_init() XRAY_NEVER_INSTRUMENT {
   __sanitizer::atomic_store(&XRayInitialized, true,
                             __sanitizer::memory_order_release);
 
-  if (flags()->patch_premain)
-    __xray_patch();
+  if (flags()->patch_premain) {
+    if (flags()->patch_premain_in_background)
+      __xray_patch_in_background(nullptr);
+    else
+      __xray_patch();
+  }
 }
 
 __attribute__((section(".preinit_array"),
@@ -15,9 +15,12 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <fcntl.h>
 #include <mutex>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
@@ -35,6 +38,10 @@
 // __xray_InMemoryRawLog will use a thread-local aligned buffer capped to a
 // certain size (32kb by default) and use it as if it were a circular buffer for
 // events. We store simple fixed-sized entries in the log for external analysis.
+//
+// With xray_naive_log_async, each thread has two such buffers instead: while it
+// logs into one, a writer thread writes the other out, so that the
+// instrumented threads don't block on I/O.
 
 extern "C" {
 void __xray_InMemoryRawLog(int32_t FuncId,
@@ -45,6 +52,139 @@ namespace __xray {
 
 std::mutex LogMutex;
 
+static constexpr size_t BuffLen = 1024;
+
+// With xray_naive_log_mmap, records are copied into a shared mapping of (a
+// window into) the log file instead of being written with write(2). The file
+// is extended as we go, so that it never has a tail of unwritten records.
+class MappedLogWriter {
+  static constexpr off_t kWindowSize = 1 << 20;
+  char *Window = nullptr;
+  off_t WindowOffset = 0;
+  off_t FileEnd = -1;
+  bool Failed = false;
+
+public:
+  // Appends [Begin, End) to the file. Returns false if the file couldn't be
+  // mapped, in which case the file position is left at the end of the data
+  // written so far so the caller can fall back to writing. Requires LogMutex.
+  bool write(int Fd, const char *Begin, const char *End) XRAY_NEVER_INSTRUMENT {
+    if (Failed)
+      return false;
+    if (FileEnd == -1)
+      FileEnd = lseek(Fd, 0, SEEK_END);
+    while (Begin != End) {
+      if (Window == nullptr || FileEnd >= WindowOffset + kWindowSize) {
+        if (Window != nullptr)
+          munmap(Window, kWindowSize);
+        WindowOffset = FileEnd & ~(kWindowSize - 1);
+        void *W = mmap(nullptr, kWindowSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       Fd, WindowOffset);
+        if (W == MAP_FAILED) {
+          Report("XRay: Failed mapping the log file (errno=%d); falling back "
+                 "to write(2).\n",
+                 errno);
+          Window = nullptr;
+          Failed = true;
+          lseek(Fd, FileEnd, SEEK_SET);
+          return false;
+        }
+        Window = static_cast<char *>(W);
+      }
+      off_t Len = Min<off_t>(End - Begin, WindowOffset + kWindowSize - FileEnd);
+      if (ftruncate(Fd, FileEnd + Len) == -1) {
+        Report("XRay: Failed extending the log file (errno=%d); falling back "
+               "to write(2).\n",
+               errno);
+        Failed = true;
+        lseek(Fd, FileEnd, SEEK_SET);
+        return false;
+      }
+      internal_memcpy(Window + (FileEnd - WindowOffset), Begin, Len);
+      FileEnd += Len;
+      Begin += Len;
+    }
+    return true;
+  }
+};
+
+MappedLogWriter MappedWriter;
+
+// Writes [Begin, End) to the log. Requires LogMutex.
+static void writeRecords(int Fd, XRayRecord *Begin,
+                         XRayRecord *End) XRAY_NEVER_INSTRUMENT {
+  auto *B = reinterpret_cast<char *>(Begin);
+  auto *E = reinterpret_cast<char *>(End);
+  if (flags()->xray_naive_log_mmap && MappedWriter.write(Fd, B, E))
+    return;
+  retryingWriteAll(Fd, B, E);
+}
+
+// A buffer of records which is either being filled by its thread or, while
+// Pending, waiting for or being written out by the writer thread.
+struct LogBuffer {
+  XRayRecord Records[BuffLen];
+  size_t Count = 0;
+  std::atomic<bool> Pending{false};
+  LogBuffer *Next = nullptr;
+};
+
+// The writer thread for xray_naive_log_async. Buffers are written in the order
+// they are submitted, which keeps each thread's records in order.
+class AsyncLogWriter {
+  std::mutex Mutex;
+  std::condition_variable Cond;
+  LogBuffer *Head = nullptr;
+  LogBuffer *Tail = nullptr;
+  int Fd;
+
+  void run() XRAY_NEVER_INSTRUMENT {
+    std::unique_lock<std::mutex> L(Mutex);
+    while (true) {
+      Cond.wait(L, [this]() XRAY_NEVER_INSTRUMENT { return Head != nullptr; });
+      LogBuffer *Batch = Head;
+      Head = Tail = nullptr;
+      L.unlock();
+      while (Batch != nullptr) {
+        // Once Pending is cleared the buffer may be reused or go away along
+        // with its thread, so read its successor first.
+        LogBuffer *Next = Batch->Next;
+        {
+          std::lock_guard<std::mutex> G(LogMutex);
+          writeRecords(Fd, Batch->Records, Batch->Records + Batch->Count);
+        }
+        Batch->Pending.store(false, std::memory_order_release);
+        Batch = Next;
+      }
+      L.lock();
+    }
+  }
+
+public:
+  explicit AsyncLogWriter(int Fd) XRAY_NEVER_INSTRUMENT : Fd(Fd) {
+    std::thread([this]() XRAY_NEVER_INSTRUMENT { run(); }).detach();
+  }
+
+  void submit(LogBuffer *B) XRAY_NEVER_INSTRUMENT {
+    B->Pending.store(true, std::memory_order_relaxed);
+    B->Next = nullptr;
+    {
+      std::lock_guard<std::mutex> L(Mutex);
+      if (Tail != nullptr)
+        Tail->Next = B;
+      else
+        Head = B;
+      Tail = B;
+    }
+    Cond.notify_one();
+  }
+};
+
+static void waitForWrite(LogBuffer &B) XRAY_NEVER_INSTRUMENT {
+  while (B.Pending.load(std::memory_order_acquire))
+    std::this_thread::yield();
+}
+
 class ThreadExitFlusher {
   int Fd;
   XRayRecord *Start;
@@ -60,8 +200,7 @@ public:
   ~ThreadExitFlusher() XRAY_NEVER_INSTRUMENT {
     std::lock_guard<std::mutex> L(LogMutex);
     if (Fd > 0 && Start != nullptr) {
-      retryingWriteAll(Fd, reinterpret_cast<char *>(Start),
-                       reinterpret_cast<char *>(Start + Offset));
+      writeRecords(Fd, Start, Start + Offset);
       // Because this thread's exit could be the last one trying to write to the
       // file and that we're not able to close out the file properly, we sync
       // instead and hope that the pending writes are flushed as the thread
@@ -71,6 +210,43 @@ public:
   }
 };
 
+// The per-thread state for xray_naive_log_async.
+class AsyncThreadLog {
+  LogBuffer Buffers[2];
+  LogBuffer *Current = &Buffers[0];
+  int Fd;
+  AsyncLogWriter &Writer;
+
+public:
+  AsyncThreadLog(int Fd, AsyncLogWriter &Writer) XRAY_NEVER_INSTRUMENT
+      : Fd(Fd),
+        Writer(Writer) {}
+
+  XRayRecord &next() XRAY_NEVER_INSTRUMENT {
+    return Current->Records[Current->Count];
+  }
+
+  void commit() XRAY_NEVER_INSTRUMENT {
+    if (++Current->Count != BuffLen)
+      return;
+    Writer.submit(Current);
+    Current = Current == &Buffers[0] ? &Buffers[1] : &Buffers[0];
+    // Only blocks if the writer has fallen a whole buffer behind.
+    waitForWrite(*Current);
+    Current->Count = 0;
+  }
+
+  ~AsyncThreadLog() XRAY_NEVER_INSTRUMENT {
+    // The writer may still be using the other buffer; it has to be done before
+    // this thread's storage goes away, and before we write the rest.
+    waitForWrite(Buffers[0]);
+    waitForWrite(Buffers[1]);
+    std::lock_guard<std::mutex> L(LogMutex);
+    writeRecords(Fd, Current->Records, Current->Records + Current->Count);
+    fsync(Fd);
+  }
+};
+
 } // namespace __xray
 
 using namespace __xray;
@@ -103,15 +279,30 @@ void __xray_InMemoryRawLog(int32_t FuncId, XRayEntryType Type,
                            RDTSC ReadTSC) XRAY_NEVER_INSTRUMENT {
   using Buffer =
       std::aligned_storage<sizeof(XRayRecord), alignof(XRayRecord)>::type;
-  static constexpr size_t BuffLen = 1024;
   thread_local static Buffer InMemoryBuffer[BuffLen] = {};
   thread_local static size_t Offset = 0;
   static int Fd = __xray_OpenLogFile();
   if (Fd == -1)
     return;
+  thread_local pid_t TId = syscall(SYS_gettid);
+
+  if (flags()->xray_naive_log_async) {
+    // The writer thread is leaked on purpose: it has to outlive the exits of
+    // all other threads, which flush their buffers through it.
+    static auto *Writer = new AsyncLogWriter(Fd);
+    thread_local AsyncThreadLog ThreadLog(Fd, *Writer);
+    auto &R = ThreadLog.next();
+    R.RecordType = RecordTypes::NORMAL;
+    R.TSC = ReadTSC(R.CPU);
+    R.TId = TId;
+    R.Type = Type;
+    R.FuncId = FuncId;
+    ThreadLog.commit();
+    return;
+  }
+
   thread_local __xray::ThreadExitFlusher Flusher(
       Fd, reinterpret_cast<__xray::XRayRecord *>(InMemoryBuffer), Offset);
-  thread_local pid_t TId = syscall(SYS_gettid);
 
   // First we get the useful data, and stuff it into the already aligned buffer
   // through a pointer offset.
@@ -125,8 +316,7 @@ void __xray_InMemoryRawLog(int32_t FuncId, XRayEntryType Type,
   if (Offset == BuffLen) {
     std::lock_guard<std::mutex> L(LogMutex);
     auto RecordBuffer = reinterpret_cast<__xray::XRayRecord *>(InMemoryBuffer);
-    retryingWriteAll(Fd, reinterpret_cast<char *>(RecordBuffer),
-                     reinterpret_cast<char *>(RecordBuffer + Offset));
+    writeRecords(Fd, RecordBuffer, RecordBuffer + Offset);
     Offset = 0;
   }
 }
@@ -138,21 +328,12 @@ void __xray_InMemoryRawLogRealTSC(int32_t FuncId,
 
 void __xray_InMemoryEmulateTSC(int32_t FuncId,
                                XRayEntryType Type) XRAY_NEVER_INSTRUMENT {
-  __xray_InMemoryRawLog(FuncId, Type, [](uint8_t &CPU) XRAY_NEVER_INSTRUMENT {
-    timespec TS;
-    int result = clock_gettime(CLOCK_REALTIME, &TS);
-    if (result != 0) {
-      Report("clock_gettimg(2) return %d, errno=%d.", result, int(errno));
-      TS = {0, 0};
-    }
-    CPU = 0;
-    return TS.tv_sec * __xray::NanosecondsPerSecond + TS.tv_nsec;
-  });
+  __xray_InMemoryRawLog(FuncId, Type, __xray::readEmulatedTSC);
 }
 
 static auto UNUSED Unused = [] {
   auto UseRealTSC = probeRequiredCPUFeatures();
-  if (!UseRealTSC)
+  if (!UseRealTSC && !flags()->xray_coarse_clock)
     Report("WARNING: Required CPU features missing for XRay instrumentation, "
            "using emulation instead.\n");
   if (flags()->xray_naive_log)
@@ -19,10 +19,13 @@
 #include <cstdio>
 #include <errno.h>
 #include <limits>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include "sanitizer_common/sanitizer_common.h"
 #include "xray_defs.h"
+#include "xray_flags.h"
 
 namespace __xray {
 
@@ -47,9 +50,148 @@ static const int16_t cSledLength = 8;
 // This is the function to call when we encounter the entry or exit sleds.
 __sanitizer::atomic_uintptr_t XRayPatchedFunction{0};
 
+// This is the function to call when we encounter the entry or exit sleds, if
+// it was installed with __xray_set_handler_gpr_only(). The trampolines check
+// it before XRayPatchedFunction, and skip saving the vector registers around
+// it. At most one of the two is set.
+__sanitizer::atomic_uintptr_t XRayGPROnlyFunction{0};
+
 // This is the function to call from the arg1-enabled sleds/trampolines.
 __sanitizer::atomic_uintptr_t XRayArgLogger{0};
 
+// With sampling enabled, XRayPatchedFunction and XRayArgLogger point at the
+// sampling wrappers below, which forward one in every XRaySamplingRate calls
+// of each function on each thread to these handlers.
+__sanitizer::atomic_uintptr_t XRaySampledFunction{0};
+__sanitizer::atomic_uintptr_t XRaySampledArgLogger{0};
+__sanitizer::atomic_uint32_t XRaySamplingRate{0};
+
+// Serializes handler and sampling rate changes.
+__sanitizer::StaticSpinMutex XRayHandlerMutex;
+
+// Whether the entry/exit handler was installed with
+// __xray_set_handler_gpr_only(). Requires XRayHandlerMutex.
+bool XRayHandlerIsGPROnly = false;
+
+namespace {
+
+// The per-thread sampling state: call counters for recently seen functions,
+// and whether each of the innermost kMaxDepth active calls was sampled so that
+// we forward exactly the exits whose entries we forwarded. Calls deeper than
+// that are always forwarded.
+struct SamplingState {
+  static constexpr int kCounters = 256;
+  static constexpr uint32_t kMaxDepth = 64;
+  int32_t FuncIds[kCounters];
+  uint32_t Counts[kCounters];
+  uint64_t Sampled;
+  uint32_t Depth;
+};
+
+thread_local SamplingState Sampling;
+
+bool sampleEntry(int32_t FuncId) XRAY_NEVER_INSTRUMENT {
+  auto &S = Sampling;
+  bool Sample = true;
+  if (S.Depth < SamplingState::kMaxDepth) {
+    uint32_t Rate = __sanitizer::atomic_load(&XRaySamplingRate,
+                                             __sanitizer::memory_order_relaxed);
+    auto Slot = static_cast<uint32_t>(FuncId) % SamplingState::kCounters;
+    if (S.FuncIds[Slot] != FuncId) {
+      S.FuncIds[Slot] = FuncId;
+      S.Counts[Slot] = 0;
+    }
+    Sample = Rate <= 1 || S.Counts[Slot]++ % Rate == 0;
+    S.Sampled = (S.Sampled << 1) | Sample;
+  }
+  ++S.Depth;
+  return Sample;
+}
+
+bool sampleExit() XRAY_NEVER_INSTRUMENT {
+  auto &S = Sampling;
+  // Exits of calls which started before sampling did are always forwarded.
+  if (S.Depth == 0)
+    return true;
+  if (--S.Depth >= SamplingState::kMaxDepth)
+    return true;
+  bool Sample = S.Sampled & 1;
+  S.Sampled >>= 1;
+  return Sample;
+}
+
+bool sampleEvent(int32_t FuncId, XRayEntryType Type) XRAY_NEVER_INSTRUMENT {
+  switch (Type) {
+  case XRayEntryType::ENTRY:
+  case XRayEntryType::LOG_ARGS_ENTRY:
+    return sampleEntry(FuncId);
+  case XRayEntryType::EXIT:
+  case XRayEntryType::TAIL:
+    return sampleExit();
+  }
+  return true;
+}
+
+void sampledHandler(int32_t FuncId, XRayEntryType Type) XRAY_NEVER_INSTRUMENT {
+  if (!sampleEvent(FuncId, Type))
+    return;
+  auto Handler = reinterpret_cast<void (*)(int32_t, XRayEntryType)>(
+      __sanitizer::atomic_load(&XRaySampledFunction,
+                               __sanitizer::memory_order_acquire));
+  if (Handler != nullptr)
+    Handler(FuncId, Type);
+}
+
+void sampledArgLogger(int32_t FuncId, XRayEntryType Type,
+                      uint64_t Arg1) XRAY_NEVER_INSTRUMENT {
+  if (!sampleEvent(FuncId, Type))
+    return;
+  auto Handler = reinterpret_cast<void (*)(int32_t, XRayEntryType, uint64_t)>(
+      __sanitizer::atomic_load(&XRaySampledArgLogger,
+                               __sanitizer::memory_order_acquire));
+  if (Handler != nullptr)
+    Handler(FuncId, Type, Arg1);
+}
+
+// Installs |Handler| for the trampolines to call through |Slot|, unless
+// sampling is enabled, in which case it goes into |SampledSlot| and the
+// trampolines call |Sampler| instead. Requires XRayHandlerMutex.
+void installHandler(__sanitizer::atomic_uintptr_t &Slot,
+                    __sanitizer::atomic_uintptr_t &SampledSlot, uptr Handler,
+                    uptr Sampler) XRAY_NEVER_INSTRUMENT {
+  bool Sampling = __sanitizer::atomic_load(&XRaySamplingRate,
+                                           __sanitizer::memory_order_relaxed) > 1;
+  __sanitizer::atomic_store(&SampledSlot, Sampling ? Handler : 0,
+                            __sanitizer::memory_order_release);
+  __sanitizer::atomic_store(&Slot, Sampling && Handler ? Sampler : Handler,
+                            __sanitizer::memory_order_release);
+}
+
+// Installs the entry/exit |Handler|. GPR-only handlers go into
+// XRayGPROnlyFunction on the architectures whose trampolines support it,
+// unless sampling is enabled: the sampling wrapper may use the vector
+// registers. Requires XRayHandlerMutex.
+void installEntryExitHandler(uptr Handler, bool GPROnly) XRAY_NEVER_INSTRUMENT {
+  XRayHandlerIsGPROnly = GPROnly;
+#if defined(__x86_64__) || defined(__aarch64__)
+  bool Sampling = __sanitizer::atomic_load(&XRaySamplingRate,
+                                           __sanitizer::memory_order_relaxed) > 1;
+  if (GPROnly && Handler && !Sampling) {
+    installHandler(XRayPatchedFunction, XRaySampledFunction, 0,
+                   reinterpret_cast<uptr>(sampledHandler));
+    __sanitizer::atomic_store(&XRayGPROnlyFunction, Handler,
+                              __sanitizer::memory_order_release);
+    return;
+  }
+#endif
+  __sanitizer::atomic_store(&XRayGPROnlyFunction, 0,
+                            __sanitizer::memory_order_release);
+  installHandler(XRayPatchedFunction, XRaySampledFunction, Handler,
+                 reinterpret_cast<uptr>(sampledHandler));
+}
+
+} // namespace
+
 // MProtectHelper is an RAII wrapper for calls to mprotect(...) that will undo
 // any successful mprotect(...) changes. This is used to make a page writeable
 // and executable, and upon destruction if it was successful in doing so returns
@@ -95,10 +237,21 @@ int __xray_set_handler(void (*entry)(int32_t,
                                      XRayEntryType)) XRAY_NEVER_INSTRUMENT {
   if (__sanitizer::atomic_load(&XRayInitialized,
                                __sanitizer::memory_order_acquire)) {
+    __sanitizer::SpinMutexLock Guard(&__xray::XRayHandlerMutex);
+    __xray::installEntryExitHandler(reinterpret_cast<__sanitizer::uptr>(entry),
+                                    false);
+    return 1;
+  }
+  return 0;
+}
 
-    __sanitizer::atomic_store(&__xray::XRayPatchedFunction,
-                              reinterpret_cast<uint64_t>(entry),
-                              __sanitizer::memory_order_release);
+int __xray_set_handler_gpr_only(void (*entry)(int32_t, XRayEntryType))
+    XRAY_NEVER_INSTRUMENT {
+  if (__sanitizer::atomic_load(&XRayInitialized,
+                               __sanitizer::memory_order_acquire)) {
+    __sanitizer::SpinMutexLock Guard(&__xray::XRayHandlerMutex);
+    __xray::installEntryExitHandler(reinterpret_cast<__sanitizer::uptr>(entry),
+                                    true);
     return 1;
   }
   return 0;
@@ -132,26 +285,159 @@ CleanupInvoker<Function> scopeCleanup(Function Fn) XRAY_NEVER_INSTRUMENT {
   return CleanupInvoker<Function>{Fn};
 }
 
-// controlPatching implements the common internals of the patching/unpatching
-// implementation. |Enable| defines whether we're enabling or disabling the
-// runtime XRay instrumentation.
-XRayPatchingStatus controlPatching(bool Enable) XRAY_NEVER_INSTRUMENT {
-  if (!__sanitizer::atomic_load(&XRayInitialized,
-                               __sanitizer::memory_order_acquire))
-    return XRayPatchingStatus::NOT_INITIALIZED; // Not initialized.
+// patchSleds patches (or unpatches, depending on |Enable|) the sleds in
+// [Begin, End), the first of which belongs to the function with id |FuncId|.
+// Runs of sleds on adjacent pages are made writeable with a single
+// mprotect(...) call, rather than one per sled.
+static bool patchSleds(bool Enable, const XRaySledEntry *Begin,
+                       const XRaySledEntry *End, uint32_t FuncId,
+                       uint64_t PageSize) XRAY_NEVER_INSTRUMENT {
+  uint64_t CurFun = Begin != End ? Begin->Function : 0;
+  for (auto *Batch = Begin; Batch != End;) {
+    uint64_t BatchStart = Batch->Address & ~(PageSize - 1);
+    uint64_t BatchEnd = Batch->Address + cSledLength;
+    auto *BatchLast = Batch + 1;
+    for (; BatchLast != End; ++BatchLast) {
+      uint64_t Page = BatchLast->Address & ~(PageSize - 1);
+      if (Page < BatchStart || Page > RoundUpTo(BatchEnd, PageSize))
+        break;
+      if (BatchLast->Address + cSledLength > BatchEnd)
+        BatchEnd = BatchLast->Address + cSledLength;
+    }
 
-  uint8_t NotPatching = false;
-  if (!__sanitizer::atomic_compare_exchange_strong(
-          &XRayPatching, &NotPatching, true, __sanitizer::memory_order_acq_rel))
-    return XRayPatchingStatus::ONGOING; // Already patching.
+    // While we're here, we should patch the nop sleds. To do that we mprotect
+    // the pages containing them to be writeable.
+    MProtectHelper Protector(reinterpret_cast<void *>(BatchStart),
+                             BatchEnd - BatchStart);
+    if (Protector.MakeWriteable() == -1) {
+      printf("Failed mprotect: %d\n", errno);
+      return false;
+    }
 
-  uint8_t PatchingSuccess = false;
-  auto XRayPatchingStatusResetter = scopeCleanup([&PatchingSuccess] {
-    if (!PatchingSuccess)
-      __sanitizer::atomic_store(&XRayPatching, false,
-                                __sanitizer::memory_order_release);
-  });
+    for (; Batch != BatchLast; ++Batch) {
+      const auto &Sled = *Batch;
+      if (Sled.Function != CurFun) {
+        ++FuncId;
+        CurFun = Sled.Function;
+      }
+
+      bool Success = false;
+      switch (Sled.Kind) {
+      case XRayEntryType::ENTRY:
+        Success =
+            patchFunctionEntry(Enable, FuncId, Sled, __xray_FunctionEntry);
+        break;
+      case XRayEntryType::EXIT:
+        Success = patchFunctionExit(Enable, FuncId, Sled);
+        break;
+      case XRayEntryType::TAIL:
+        Success = patchFunctionTailExit(Enable, FuncId, Sled);
+        break;
+      case XRayEntryType::LOG_ARGS_ENTRY:
+        Success =
+            patchFunctionEntry(Enable, FuncId, Sled, __xray_ArgLoggerEntry);
+        break;
+      default:
+        Report("Unsupported sled kind: %d\n", int(Sled.Kind));
+        continue;
+      }
+      (void)Success;
+    }
+  }
+  return true;
+}
+
+// Sled maps with fewer sleds than this are always patched on the calling
+// thread; starting workers would take longer than patching them.
+static constexpr size_t kMinSledsPerPatchWorker = 16384;
+static constexpr int kMaxPatchWorkers = 16;
+
+struct PatchChunk {
+  bool Enable;
+  const XRaySledEntry *Begin;
+  const XRaySledEntry *End;
+  uint32_t FuncId;
+  uint64_t PageSize;
+  bool Success;
+};
+
+static void *patchChunk(void *Arg) XRAY_NEVER_INSTRUMENT {
+  auto *Chunk = static_cast<PatchChunk *>(Arg);
+  Chunk->Success = patchSleds(Chunk->Enable, Chunk->Begin, Chunk->End,
+                              Chunk->FuncId, Chunk->PageSize);
+  return nullptr;
+}
+
+static int patchWorkerCount(const XRaySledEntry *Begin,
+                            const XRaySledEntry *End) XRAY_NEVER_INSTRUMENT {
+  int Workers = flags()->patch_threads;
+  if (Workers <= 0)
+    Workers = Min<int>(sysconf(_SC_NPROCESSORS_ONLN), 4);
+  Workers = Min<int>(Workers, kMaxPatchWorkers);
+  Workers = Min<int>(Workers, (End - Begin) / kMinSledsPerPatchWorker);
+  if (Workers <= 1)
+    return 1;
+  // Chunks are split at page boundaries so that no two workers change the
+  // protection of the same page, which only works if the sleds are sorted.
+  for (auto *I = Begin + 1; I < End; ++I)
+    if (I->Address < I[-1].Address)
+      return 1;
+  return Workers;
+}
+
+// parallelPatchSleds works like patchSleds, but splits the sleds into chunks
+// on disjoint sets of pages and patches them on a pool of worker threads.
+static bool parallelPatchSleds(bool Enable, const XRaySledEntry *Begin,
+                               const XRaySledEntry *End, uint32_t FuncId,
+                               uint64_t PageSize) XRAY_NEVER_INSTRUMENT {
+  int Workers = patchWorkerCount(Begin, End);
+  if (Workers == 1)
+    return patchSleds(Enable, Begin, End, FuncId, PageSize);
+
+  PatchChunk Chunks[kMaxPatchWorkers];
+  size_t PerChunk = (End - Begin + Workers - 1) / Workers;
+  int NumChunks = 0;
+  for (auto *I = Begin; I != End; ++NumChunks) {
+    auto &Chunk = Chunks[NumChunks];
+    Chunk = {Enable, I, End, FuncId, PageSize, false};
+    if (NumChunks == Workers - 1 || size_t(End - I) <= PerChunk) {
+      I = End;
+      continue;
+    }
+    // Move the split up past the sleds sharing a page with the chunk's last
+    // sled, counting functions along the way.
+    auto *Split = I + PerChunk;
+    uint64_t LastPage = (Split[-1].Address + cSledLength - 1) & ~(PageSize - 1);
+    while (Split != End && (Split->Address & ~(PageSize - 1)) <= LastPage)
+      ++Split;
+    for (; I != Split; ++I)
+      if (I + 1 != End && I[1].Function != I->Function)
+        ++FuncId;
+    Chunk.End = Split;
+  }
+
+  pthread_t Threads[kMaxPatchWorkers];
+  bool Started[kMaxPatchWorkers] = {};
+  for (int I = 1; I < NumChunks; ++I)
+    Started[I] =
+        pthread_create(&Threads[I], nullptr, patchChunk, &Chunks[I]) == 0;
+  // Patch the first chunk here, and anything we couldn't hand off.
+  for (int I = 0; I < NumChunks; ++I)
+    if (!Started[I])
+      patchChunk(&Chunks[I]);
+  bool Success = true;
+  for (int I = 0; I < NumChunks; ++I) {
+    if (Started[I])
+      pthread_join(Threads[I], nullptr);
+    Success &= Chunks[I].Success;
+  }
+  return Success;
+}
 
+// doPatching patches or unpatches the instrumentation points; see
+// controlPatching. Requires that the caller owns XRayPatching.
+static XRayPatchingStatus doPatching(bool Enable,
+                                     int32_t OnlyFuncId) XRAY_NEVER_INSTRUMENT {
   // Step 1: Compute the function id, as a unique identifier per function in the
   // instrumentation map.
   XRaySledMap InstrMap;
@@ -168,53 +454,96 @@ XRayPatchingStatus controlPatching(bool Enable) XRAY_NEVER_INSTRUMENT {
     return XRayPatchingStatus::FAILED;
   }
 
+  const XRaySledEntry *Begin = InstrMap.Sleds;
+  const XRaySledEntry *End = InstrMap.Sleds + InstrMap.Entries;
   uint32_t FuncId = 1;
-  uint64_t CurFun = 0;
-  for (std::size_t I = 0; I < InstrMap.Entries; I++) {
-    auto Sled = InstrMap.Sleds[I];
-    auto F = Sled.Function;
-    if (CurFun == 0)
-      CurFun = F;
-    if (F != CurFun) {
-      ++FuncId;
-      CurFun = F;
-    }
-
-    // While we're here, we should patch the nop sled. To do that we mprotect
-    // the page containing the function to be writeable.
-    void *PageAlignedAddr =
-        reinterpret_cast<void *>(Sled.Address & ~(PageSize - 1));
-    std::size_t MProtectLen = (Sled.Address + cSledLength) -
-                              reinterpret_cast<uint64_t>(PageAlignedAddr);
-    MProtectHelper Protector(PageAlignedAddr, MProtectLen);
-    if (Protector.MakeWriteable() == -1) {
-      printf("Failed mprotect: %d\n", errno);
+  if (OnlyFuncId != 0) {
+    // Function ids are assigned in the order functions appear in the map, so
+    // find the run of sleds which belongs to the requested one.
+    if (OnlyFuncId < 0)
       return XRayPatchingStatus::FAILED;
-    }
-
-    bool Success = false;
-    switch (Sled.Kind) {
-    case XRayEntryType::ENTRY:
-      Success = patchFunctionEntry(Enable, FuncId, Sled, __xray_FunctionEntry);
-      break;
-    case XRayEntryType::EXIT:
-      Success = patchFunctionExit(Enable, FuncId, Sled);
-      break;
-    case XRayEntryType::TAIL:
-      Success = patchFunctionTailExit(Enable, FuncId, Sled);
-      break;
-    case XRayEntryType::LOG_ARGS_ENTRY:
-      Success = patchFunctionEntry(Enable, FuncId, Sled, __xray_ArgLoggerEntry);
-      break;
-    default:
-      Report("Unsupported sled kind: %d\n", int(Sled.Kind));
-      continue;
-    }
-    (void)Success;
+    const XRaySledEntry *I = Begin;
+    for (; I != End && FuncId < uint32_t(OnlyFuncId); ++I)
+      if (I + 1 != End && I[1].Function != I->Function)
+        ++FuncId;
+    if (I == End)
+      return XRayPatchingStatus::FAILED;
+    Begin = I;
+    while (I != End && I->Function == Begin->Function)
+      ++I;
+    End = I;
   }
+
+  if (!parallelPatchSleds(Enable, Begin, End, FuncId, PageSize))
+    return XRayPatchingStatus::FAILED;
+  return XRayPatchingStatus::SUCCESS;
+}
+
+// acquirePatching makes the calling thread the only one patching, returning
+// SUCCESS if it did.
+static XRayPatchingStatus acquirePatching() XRAY_NEVER_INSTRUMENT {
+  if (!__sanitizer::atomic_load(&XRayInitialized,
+                               __sanitizer::memory_order_acquire))
+    return XRayPatchingStatus::NOT_INITIALIZED; // Not initialized.
+
+  uint8_t NotPatching = false;
+  if (!__sanitizer::atomic_compare_exchange_strong(
+          &XRayPatching, &NotPatching, true, __sanitizer::memory_order_acq_rel))
+    return XRayPatchingStatus::ONGOING; // Already patching.
+  return XRayPatchingStatus::SUCCESS;
+}
+
+// controlPatching implements the common internals of the patching/unpatching
+// implementation. |Enable| defines whether we're enabling or disabling the
+// runtime XRay instrumentation, and |OnlyFuncId| restricts it to the sleds of
+// a single function unless it is 0.
+XRayPatchingStatus controlPatching(bool Enable,
+                                   int32_t OnlyFuncId = 0) XRAY_NEVER_INSTRUMENT {
+  auto Status = acquirePatching();
+  if (Status != XRayPatchingStatus::SUCCESS)
+    return Status;
+  auto XRayPatchingStatusResetter = scopeCleanup([] {
+    __sanitizer::atomic_store(&XRayPatching, false,
+                              __sanitizer::memory_order_release);
+  });
+  return doPatching(Enable, OnlyFuncId);
+}
+
+struct BackgroundPatching {
+  bool Enable;
+  void (*Done)(XRayPatchingStatus);
+};
+BackgroundPatching BackgroundPatch;
+
+static void *backgroundPatching(void *) XRAY_NEVER_INSTRUMENT {
+  auto Status = doPatching(BackgroundPatch.Enable, 0);
+  auto Done = BackgroundPatch.Done;
   __sanitizer::atomic_store(&XRayPatching, false,
                             __sanitizer::memory_order_release);
-  PatchingSuccess = true;
+  if (Done != nullptr)
+    Done(Status);
+  return nullptr;
+}
+
+static XRayPatchingStatus
+controlPatchingInBackground(bool Enable, void (*Done)(XRayPatchingStatus))
+    XRAY_NEVER_INSTRUMENT {
+  auto Status = acquirePatching();
+  if (Status != XRayPatchingStatus::SUCCESS)
+    return Status;
+  // BackgroundPatch is only ever touched by whoever owns XRayPatching.
+  BackgroundPatch = {Enable, Done};
+  pthread_attr_t Attr;
+  pthread_attr_init(&Attr);
+  pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+  pthread_t Thread;
+  int Err = pthread_create(&Thread, &Attr, backgroundPatching, nullptr);
+  pthread_attr_destroy(&Attr);
+  if (Err != 0) {
+    __sanitizer::atomic_store(&XRayPatching, false,
+                              __sanitizer::memory_order_release);
+    return XRayPatchingStatus::FAILED;
+  }
   return XRayPatchingStatus::SUCCESS;
 }
 
@@ -226,6 +555,32 @@ XRayPatchingStatus __xray_unpatch() XRAY_NEVER_INSTRUMENT {
   return controlPatching(false);
 }
 
+XRayPatchingStatus __xray_patch_in_background(
+    void (*Done)(XRayPatchingStatus)) XRAY_NEVER_INSTRUMENT {
+  return controlPatchingInBackground(true, Done);
+}
+
+XRayPatchingStatus __xray_unpatch_in_background(
+    void (*Done)(XRayPatchingStatus)) XRAY_NEVER_INSTRUMENT {
+  return controlPatchingInBackground(false, Done);
+}
+
+int __xray_patching_in_progress() XRAY_NEVER_INSTRUMENT {
+  return __sanitizer::atomic_load(&XRayPatching,
+                                  __sanitizer::memory_order_acquire);
+}
+
+XRayPatchingStatus __xray_patch_function(int32_t FuncId) XRAY_NEVER_INSTRUMENT {
+  return FuncId == 0 ? XRayPatchingStatus::FAILED
+                     : controlPatching(true, FuncId);
+}
+
+XRayPatchingStatus
+__xray_unpatch_function(int32_t FuncId) XRAY_NEVER_INSTRUMENT {
+  return FuncId == 0 ? XRayPatchingStatus::FAILED
+                     : controlPatching(false, FuncId);
+}
+
 int __xray_set_handler_arg1(void (*Handler)(int32_t, XRayEntryType, uint64_t)) {
   if (!__sanitizer::atomic_load(&XRayInitialized,
                                 __sanitizer::memory_order_acquire))
@@ -234,8 +589,41 @@ int __xray_set_handler_arg1(void (*Handler)(int32_t, XRayEntryType, uint64_t)) {
   // A relaxed write might not be visible even if the current thread gets
   // scheduled on a different CPU/NUMA node.  We need to wait for everyone to
   // have this handler installed for consistency of collected data across CPUs.
-  __sanitizer::atomic_store(&XRayArgLogger, reinterpret_cast<uint64_t>(Handler),
-                            __sanitizer::memory_order_release);
+  __sanitizer::SpinMutexLock Guard(&XRayHandlerMutex);
+  installHandler(XRayArgLogger, XRaySampledArgLogger,
+                 reinterpret_cast<uptr>(Handler),
+                 reinterpret_cast<uptr>(sampledArgLogger));
   return 1;
 }
 int __xray_remove_handler_arg1() { return __xray_set_handler_arg1(nullptr); }
+
+int __xray_set_sampling_rate(uint32_t Rate) XRAY_NEVER_INSTRUMENT {
+  if (!__sanitizer::atomic_load(&XRayInitialized,
+                                __sanitizer::memory_order_acquire))
+    return 0;
+
+  __sanitizer::SpinMutexLock Guard(&XRayHandlerMutex);
+  // Take the handlers out of wherever they are installed now, and put them
+  // back according to the new rate.
+  auto CurrentHandler = [](__sanitizer::atomic_uintptr_t &Slot,
+                           __sanitizer::atomic_uintptr_t &SampledSlot,
+                           uptr Sampler) XRAY_NEVER_INSTRUMENT {
+    uptr H = __sanitizer::atomic_load(&Slot, __sanitizer::memory_order_relaxed);
+    return H == Sampler ? __sanitizer::atomic_load(
+                              &SampledSlot, __sanitizer::memory_order_relaxed)
+                        : H;
+  };
+  uptr Handler = __sanitizer::atomic_load(&XRayGPROnlyFunction,
+                                          __sanitizer::memory_order_relaxed);
+  if (!Handler)
+    Handler = CurrentHandler(XRayPatchedFunction, XRaySampledFunction,
+                             reinterpret_cast<uptr>(sampledHandler));
+  uptr ArgLogger = CurrentHandler(XRayArgLogger, XRaySampledArgLogger,
+                                  reinterpret_cast<uptr>(sampledArgLogger));
+  __sanitizer::atomic_store(&XRaySamplingRate, Rate,
+                            __sanitizer::memory_order_relaxed);
+  installEntryExitHandler(Handler, XRayHandlerIsGPROnly);
+  installHandler(XRayArgLogger, XRaySampledArgLogger, ArgLogger,
+                 reinterpret_cast<uptr>(sampledArgLogger));
+  return 1;
+}
@@ -0,0 +1,513 @@
+//===-- xray_profiling.cc ---------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of XRay, a dynamic runtime instrumentation system.
+//
+// Here we implement the profiling mode, which aggregates function call
+// durations per call path in memory.
+//
+//===----------------------------------------------------------------------===//
+#include "xray_profiling.h"
+
+#include <cstring>
+#include <memory>
+
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "xray/xray_interface.h"
+#include "xray/xray_records.h"
+#include "xray_defs.h"
+#include "xray_flags.h"
+#include "xray_tsc.h"
+#include "xray_utils.h"
+
+namespace __xray {
+
+namespace {
+
+constexpr int kBuckets = XRayProfileNodeRecord::kHistogramBuckets;
+
+// Calls nested deeper than this are not counted.
+constexpr uint32_t kMaxDepth = 256;
+
+// A node of a call trie, for the call path from the root to it.
+struct ProfileNode {
+  int32_t FuncId;
+  ProfileNode *Parent;
+  ProfileNode *FirstChild;
+  ProfileNode *NextSibling;
+  uint64_t CallCount;
+  uint64_t TotalTicks;
+  uint32_t Histogram[kBuckets];
+  // Only used while writing out the merged trie.
+  uint32_t Index;
+};
+
+// Memory is handed out from a list of blocks, which are only ever freed all at
+// once.
+struct ArenaBlock {
+  ArenaBlock *Next;
+};
+
+struct Arena {
+  ArenaBlock *Blocks = nullptr;
+  char *Cur = nullptr;
+  char *End = nullptr;
+  size_t BlockSize = 0;
+  size_t NumBlocks = 0;
+  size_t MaxBlocks = 0;
+
+  void *allocate(size_t Size) XRAY_NEVER_INSTRUMENT {
+    Size = RoundUpTo(Size, alignof(ProfileNode));
+    if (static_cast<size_t>(End - Cur) < Size) {
+      if (MaxBlocks != 0 && NumBlocks == MaxBlocks)
+        return nullptr;
+      if (sizeof(ArenaBlock) + Size > BlockSize)
+        return nullptr;
+      auto *B = static_cast<ArenaBlock *>(
+          MmapOrDieQuietly(BlockSize, "XRay profiling arena"));
+      B->Next = Blocks;
+      Blocks = B;
+      ++NumBlocks;
+      Cur = reinterpret_cast<char *>(B) +
+            RoundUpTo(sizeof(ArenaBlock), alignof(ProfileNode));
+      End = reinterpret_cast<char *>(B) + BlockSize;
+    }
+    void *Result = Cur;
+    Cur += Size;
+    return Result;
+  }
+
+  void release() XRAY_NEVER_INSTRUMENT {
+    while (Blocks != nullptr) {
+      auto *Next = Blocks->Next;
+      UnmapOrDie(Blocks, BlockSize);
+      Blocks = Next;
+    }
+    Cur = End = nullptr;
+    NumBlocks = 0;
+  }
+};
+
+// Returns the child of |Parent| for calls to |FuncId|, adding one if there is
+// none yet. Children are kept in most recently used order, since calls from
+// the same place tend to repeat.
+ProfileNode *getChild(Arena &A, ProfileNode *Parent,
+                      int32_t FuncId) XRAY_NEVER_INSTRUMENT {
+  ProfileNode *Prev = nullptr;
+  for (auto *C = Parent->FirstChild; C != nullptr;
+       Prev = C, C = C->NextSibling) {
+    if (C->FuncId != FuncId)
+      continue;
+    if (Prev != nullptr) {
+      Prev->NextSibling = C->NextSibling;
+      C->NextSibling = Parent->FirstChild;
+      Parent->FirstChild = C;
+    }
+    return C;
+  }
+  auto *C = static_cast<ProfileNode *>(A.allocate(sizeof(ProfileNode)));
+  if (C == nullptr)
+    return nullptr;
+  internal_memset(C, 0, sizeof(ProfileNode));
+  C->FuncId = FuncId;
+  C->Parent = Parent;
+  C->NextSibling = Parent->FirstChild;
+  Parent->FirstChild = C;
+  return C;
+}
+
+// Returns the next node after |N| in a preorder walk of the trie below |Root|.
+ProfileNode *nextPreorder(ProfileNode *N,
+                          ProfileNode *Root) XRAY_NEVER_INSTRUMENT {
+  if (N->FirstChild != nullptr)
+    return N->FirstChild;
+  while (N != Root && N->NextSibling == nullptr)
+    N = N->Parent;
+  return N == Root ? nullptr : N->NextSibling;
+}
+
+struct Frame {
+  ProfileNode *Node;
+  uint64_t EntryTSC;
+};
+
+// All of a thread's state lives in its arena, so that it outlives the thread
+// until the profile has been flushed.
+struct ThreadProfile {
+  ThreadProfile *Next;
+  __sanitizer::atomic_uint8_t Busy;
+  Arena Memory;
+  ProfileNode Root;
+  // The active calls on the thread. Depth can be larger than kMaxDepth, in
+  // which case the frames past it are not kept.
+  uint32_t Depth;
+  Frame Stack[kMaxDepth];
+};
+
+__sanitizer::atomic_sint32_t LoggingStatus = {
+    XRayLogInitStatus::XRAY_LOG_UNINITIALIZED};
+
+__sanitizer::atomic_sint32_t LogFlushStatus = {
+    XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING};
+
+ProfilingOptions Options;
+size_t BlockSize = 0;
+size_t MaxBlocks = 0;
+
+// Bumped on every reset, so that threads know to drop their profiles.
+__sanitizer::atomic_uint32_t Generation = {0};
+
+__sanitizer::SpinMutex ProfilesMutex;
+ThreadProfile *Profiles = nullptr;
+
+thread_local ThreadProfile *LocalProfile = nullptr;
+thread_local uint32_t LocalGeneration = 0;
+thread_local bool Running = false;
+
+ThreadProfile *getThreadProfile() XRAY_NEVER_INSTRUMENT {
+  uint32_t G =
+      __sanitizer::atomic_load(&Generation, __sanitizer::memory_order_acquire);
+  if (LocalProfile != nullptr && LocalGeneration == G)
+    return LocalProfile;
+  LocalProfile = nullptr;
+  Arena A;
+  A.BlockSize = BlockSize;
+  A.MaxBlocks = MaxBlocks;
+  auto *P = static_cast<ThreadProfile *>(A.allocate(sizeof(ThreadProfile)));
+  if (P == nullptr)
+    return nullptr;
+  internal_memset(P, 0, sizeof(ThreadProfile));
+  P->Memory = A;
+  P->Root.FuncId = 0;
+  {
+    __sanitizer::SpinMutexLock Guard(&ProfilesMutex);
+    P->Next = Profiles;
+    Profiles = P;
+  }
+  LocalProfile = P;
+  LocalGeneration = G;
+  return P;
+}
+
+unsigned bucketOf(uint64_t Ticks) XRAY_NEVER_INSTRUMENT {
+  if (Ticks == 0)
+    return 0;
+  unsigned B = MostSignificantSetBitIndex(Ticks);
+  return B < kBuckets ? B : kBuckets - 1;
+}
+
+void exitFrame(ThreadProfile &P, uint64_t TSC) XRAY_NEVER_INSTRUMENT {
+  auto &F = P.Stack[--P.Depth];
+  if (F.Node == nullptr)
+    return;
+  uint64_t Ticks = TSC - F.EntryTSC;
+  ++F.Node->CallCount;
+  F.Node->TotalTicks += Ticks;
+  ++F.Node->Histogram[bucketOf(Ticks)];
+}
+
+void recordEvent(ThreadProfile &P, int32_t FuncId, XRayEntryType Entry,
+                 uint64_t TSC) XRAY_NEVER_INSTRUMENT {
+  switch (Entry) {
+  case XRayEntryType::ENTRY:
+  case XRayEntryType::LOG_ARGS_ENTRY: {
+    if (P.Depth >= kMaxDepth) {
+      ++P.Depth;
+      return;
+    }
+    ProfileNode *Parent = P.Depth == 0 ? &P.Root : P.Stack[P.Depth - 1].Node;
+    ProfileNode *Node =
+        Parent == nullptr ? nullptr : getChild(P.Memory, Parent, FuncId);
+    P.Stack[P.Depth++] = {Node, TSC};
+    return;
+  }
+  case XRayEntryType::EXIT:
+  case XRayEntryType::TAIL: {
+    // Exits of calls which started before profiling did are ignored.
+    if (P.Depth == 0)
+      return;
+    if (P.Depth > kMaxDepth) {
+      --P.Depth;
+      return;
+    }
+    // If we missed exits (e.g. through longjmp or exceptions), close the calls
+    // down to the one exiting now, if there is one.
+    uint32_t I = P.Depth;
+    while (I > 0 && (P.Stack[I - 1].Node == nullptr ||
+                     P.Stack[I - 1].Node->FuncId != FuncId))
+      --I;
+    if (I == 0) {
+      // We couldn't tell which call this was; if we never built its node,
+      // assume it's the innermost one.
+      if (P.Stack[P.Depth - 1].Node == nullptr)
+        exitFrame(P, TSC);
+      return;
+    }
+    while (P.Depth >= I)
+      exitFrame(P, TSC);
+    return;
+  }
+  }
+}
+
+// Waits until no thread is recording into its profile. Requires that logging
+// is no longer initialized, so no thread starts recording again.
+void waitForRecorders() XRAY_NEVER_INSTRUMENT {
+  __sanitizer::SpinMutexLock Guard(&ProfilesMutex);
+  for (auto *P = Profiles; P != nullptr; P = P->Next)
+    while (__sanitizer::atomic_load(&P->Busy,
+                                    __sanitizer::memory_order_seq_cst))
+      internal_sched_yield();
+}
+
+void writeProfileHeader(int Fd) XRAY_NEVER_INSTRUMENT {
+  XRayFileHeader Header;
+  Header.Version = 1;
+  Header.Type = FileTypes::PROFILE;
+  Header.CycleFrequency = probeRequiredCPUFeatures()
+                              ? getTSCFrequency()
+                              : __xray::NanosecondsPerSecond;
+  // FIXME: Actually check whether we have 'constant_tsc' and 'nonstop_tsc'
+  // before setting the values in the header.
+  Header.ConstantTSC = 1;
+  Header.NonstopTSC = 1;
+  retryingWriteAll(Fd, reinterpret_cast<char *>(&Header),
+                   reinterpret_cast<char *>(&Header) + sizeof(Header));
+}
+
+// Writes out the merged trie below |Root| in preorder. Returns the number of
+// records written.
+uint32_t writeProfileRecords(int Fd, ProfileNode *Root) XRAY_NEVER_INSTRUMENT {
+  static constexpr size_t kBatch = 64;
+  XRayProfileNodeRecord Records[kBatch];
+  size_t Batched = 0;
+  uint32_t Index = 0;
+  for (auto *N = nextPreorder(Root, Root); N != nullptr;
+       N = nextPreorder(N, Root)) {
+    N->Index = Index++;
+    auto &R = Records[Batched++];
+    R.FuncId = N->FuncId;
+    R.Parent =
+        N->Parent == Root ? XRayProfileNodeRecord::NoParent : N->Parent->Index;
+    R.CallCount = N->CallCount;
+    R.TotalTicks = N->TotalTicks;
+    internal_memcpy(R.Histogram, N->Histogram, sizeof(R.Histogram));
+    if (Batched == kBatch) {
+      retryingWriteAll(Fd, reinterpret_cast<char *>(Records),
+                       reinterpret_cast<char *>(Records + Batched));
+      Batched = 0;
+    }
+  }
+  retryingWriteAll(Fd, reinterpret_cast<char *>(Records),
+                   reinterpret_cast<char *>(Records + Batched));
+  return Index;
+}
+
+} // namespace
+
+XRayLogInitStatus profilingInit(size_t BufferSize, size_t BufferMax,
+                                void *Opts,
+                                size_t OptionsSize) XRAY_NEVER_INSTRUMENT {
+  if (OptionsSize != sizeof(ProfilingOptions))
+    return static_cast<XRayLogInitStatus>(__sanitizer::atomic_load(
+        &LoggingStatus, __sanitizer::memory_order_acquire));
+  s32 CurrentStatus = XRayLogInitStatus::XRAY_LOG_UNINITIALIZED;
+  if (!__sanitizer::atomic_compare_exchange_strong(
+          &LoggingStatus, &CurrentStatus,
+          XRayLogInitStatus::XRAY_LOG_INITIALIZING,
+          __sanitizer::memory_order_release))
+    return static_cast<XRayLogInitStatus>(CurrentStatus);
+
+  memcpy(&Options, Opts, OptionsSize);
+  // Blocks have to hold at least the thread's state, and we don't want to map
+  // a lot of tiny ones.
+  BlockSize = RoundUpTo(
+      Max<size_t>(BufferSize, sizeof(ThreadProfile) + sizeof(ArenaBlock) +
+                                  alignof(ProfileNode)),
+      GetPageSizeCached());
+  MaxBlocks = BufferMax;
+
+  __xray_set_handler(profilingHandleArg0);
+
+  __sanitizer::atomic_store(&LoggingStatus,
+                            XRayLogInitStatus::XRAY_LOG_INITIALIZED,
+                            __sanitizer::memory_order_seq_cst);
+  Report("XRay profiling init successful.\n");
+  return XRayLogInitStatus::XRAY_LOG_INITIALIZED;
+}
+
+XRayLogInitStatus profilingFinalize() XRAY_NEVER_INSTRUMENT {
+  s32 CurrentStatus = XRayLogInitStatus::XRAY_LOG_INITIALIZED;
+  if (!__sanitizer::atomic_compare_exchange_strong(
+          &LoggingStatus, &CurrentStatus,
+          XRayLogInitStatus::XRAY_LOG_FINALIZING,
+          __sanitizer::memory_order_seq_cst))
+    return static_cast<XRayLogInitStatus>(CurrentStatus);
+
+  waitForRecorders();
+  __sanitizer::atomic_store(&LoggingStatus,
+                            XRayLogInitStatus::XRAY_LOG_FINALIZED,
+                            __sanitizer::memory_order_release);
+  return XRayLogInitStatus::XRAY_LOG_FINALIZED;
+}
+
+void profilingHandleArg0(int32_t FuncId,
+                         XRayEntryType Entry) XRAY_NEVER_INSTRUMENT {
+  unsigned char CPU;
+  uint64_t TSC = probeRequiredCPUFeatures() ? __xray::readTSC(CPU)
+                                            : __xray::readEmulatedTSC(CPU);
+  if (Running)
+    return;
+  Running = true;
+  if (__sanitizer::atomic_load(&LoggingStatus,
+                               __sanitizer::memory_order_acquire) ==
+      XRayLogInitStatus::XRAY_LOG_INITIALIZED) {
+    if (auto *P = getThreadProfile()) {
+      // Pairs with finalizing the profile: either it sees us busy and waits,
+      // or we see that logging has been finalized.
+      __sanitizer::atomic_store(&P->Busy, 1, __sanitizer::memory_order_seq_cst);
+      if (__sanitizer::atomic_load(&LoggingStatus,
+                                   __sanitizer::memory_order_seq_cst) ==
+          XRayLogInitStatus::XRAY_LOG_INITIALIZED)
+        recordEvent(*P, FuncId, Entry, TSC);
+      __sanitizer::atomic_store(&P->Busy, 0, __sanitizer::memory_order_release);
+    }
+  }
+  Running = false;
+}
+
+XRayLogFlushStatus profilingFlush() XRAY_NEVER_INSTRUMENT {
+  if (__sanitizer::atomic_load(&LoggingStatus,
+                               __sanitizer::memory_order_acquire) !=
+      XRayLogInitStatus::XRAY_LOG_FINALIZED)
+    return XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING;
+
+  s32 Result = XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING;
+  if (!__sanitizer::atomic_compare_exchange_strong(
+          &LogFlushStatus, &Result, XRayLogFlushStatus::XRAY_LOG_FLUSHING,
+          __sanitizer::memory_order_release))
+    return static_cast<XRayLogFlushStatus>(Result);
+
+  int Fd = Options.Fd;
+  if (Fd == -1)
+    Fd = getLogFD();
+  if (Fd == -1) {
+    auto Result = XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING;
+    __sanitizer::atomic_store(&LogFlushStatus, Result,
+                              __sanitizer::memory_order_release);
+    return Result;
+  }
+
+  // Merge the threads' tries into one, walking each of them in preorder while
+  // keeping track of the matching node in the merged trie.
+  Arena Merged;
+  Merged.BlockSize = BlockSize;
+  ProfileNode MergedRoot;
+  internal_memset(&MergedRoot, 0, sizeof(MergedRoot));
+  bool Complete = true;
+  {
+    __sanitizer::SpinMutexLock Guard(&ProfilesMutex);
+    for (auto *P = Profiles; P != nullptr && Complete; P = P->Next) {
+      ProfileNode *Dst = &MergedRoot;
+      ProfileNode *Src = &P->Root;
+      while (true) {
+        if (Src->FirstChild != nullptr) {
+          Src = Src->FirstChild;
+        } else {
+          while (Src != &P->Root && Src->NextSibling == nullptr) {
+            Src = Src->Parent;
+            Dst = Dst->Parent;
+          }
+          if (Src == &P->Root)
+            break;
+          Src = Src->NextSibling;
+          Dst = Dst->Parent;
+        }
+        Dst = getChild(Merged, Dst, Src->FuncId);
+        if (Dst == nullptr) {
+          Complete = false;
+          break;
+        }
+        Dst->CallCount += Src->CallCount;
+        Dst->TotalTicks += Src->TotalTicks;
+        for (int I = 0; I < kBuckets; ++I)
+          Dst->Histogram[I] += Src->Histogram[I];
+      }
+    }
+  }
+  if (!Complete)
+    Report("XRay profiling: failed to merge the profiles; the profile written "
+           "is incomplete.\n");
+
+  writeProfileHeader(Fd);
+  uint32_t Nodes = writeProfileRecords(Fd, &MergedRoot);
+  Merged.release();
+  if (Verbosity())
+    Report("XRay profiling: wrote %u call paths.\n", Nodes);
+
+  __sanitizer::atomic_store(&LogFlushStatus,
+                            XRayLogFlushStatus::XRAY_LOG_FLUSHED,
+                            __sanitizer::memory_order_release);
+  return XRayLogFlushStatus::XRAY_LOG_FLUSHED;
+}
+
+XRayLogInitStatus profilingReset() XRAY_NEVER_INSTRUMENT {
+  s32 CurrentStatus = XRayLogInitStatus::XRAY_LOG_FINALIZED;
+  if (!__sanitizer::atomic_compare_exchange_strong(
+          &LoggingStatus, &CurrentStatus,
+          XRayLogInitStatus::XRAY_LOG_FINALIZING,
+          __sanitizer::memory_order_release))
+    return static_cast<XRayLogInitStatus>(CurrentStatus);
+
+  // Spin until the flushing status is flushed.
+  s32 CurrentFlushingStatus = XRayLogFlushStatus::XRAY_LOG_FLUSHED;
+  while (__sanitizer::atomic_compare_exchange_weak(
+      &LogFlushStatus, &CurrentFlushingStatus,
+      XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING,
+      __sanitizer::memory_order_release)) {
+    if (CurrentFlushingStatus == XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING)
+      break;
+    CurrentFlushingStatus = XRayLogFlushStatus::XRAY_LOG_FLUSHED;
+  }
+
+  // Threads only touch their profiles while logging is initialized, and drop
+  // them once they see the new generation.
+  __sanitizer::atomic_fetch_add(&Generation, 1,
+                                __sanitizer::memory_order_acq_rel);
+  {
+    __sanitizer::SpinMutexLock Guard(&ProfilesMutex);
+    while (Profiles != nullptr) {
+      auto *Next = Profiles->Next;
+      // The profile itself lives in the arena.
+      Arena A = Profiles->Memory;
+      A.release();
+      Profiles = Next;
+    }
+  }
+
+  __sanitizer::atomic_store(&LoggingStatus,
+                            XRayLogInitStatus::XRAY_LOG_UNINITIALIZED,
+                            __sanitizer::memory_order_release);
+  return XRayLogInitStatus::XRAY_LOG_UNINITIALIZED;
+}
+
+} // namespace __xray
+
+static auto UNUSED Unused = [] {
+  using namespace __xray;
+  if (flags()->xray_profiling) {
+    XRayLogImpl Impl{
+        profilingInit, profilingFinalize, profilingHandleArg0, profilingFlush,
+    };
+    __xray_set_log_impl(Impl);
+  }
+  return true;
+}();
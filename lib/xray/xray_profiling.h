@@ -0,0 +1,41 @@
+//===-- xray_profiling.h ----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of XRay, a function call tracing system.
+//
+//===----------------------------------------------------------------------===//
+#ifndef XRAY_XRAY_PROFILING_H
+#define XRAY_XRAY_PROFILING_H
+
+#include "xray/xray_log_interface.h"
+
+// Profiling Mode
+// ==============
+//
+// Instead of logging every function entry and exit, each thread keeps a trie of
+// the call paths it has seen, with the number of calls and a histogram of their
+// durations in each node. At flush, the threads' tries are merged and written
+// out as one XRayProfileNodeRecord per distinct call path, so the size of the
+// profile does not grow with the number of calls.
+//
+// The tries live in arenas of |BufferSize| byte blocks, of which each thread
+// gets at most |BufferMax| (or as many as it needs, if that's 0). Calls which
+// don't fit are not counted.
+
+namespace __xray {
+XRayLogInitStatus profilingInit(size_t BufferSize, size_t BufferMax,
+                                void *Options, size_t OptionsSize);
+XRayLogInitStatus profilingFinalize();
+void profilingHandleArg0(int32_t FuncId, XRayEntryType Entry);
+XRayLogFlushStatus profilingFlush();
+XRayLogInitStatus profilingReset();
+
+} // namespace __xray
+
+#endif // XRAY_XRAY_PROFILING_H
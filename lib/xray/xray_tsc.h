@@ -13,8 +13,15 @@
 #ifndef XRAY_EMULATE_TSC_H
 #define XRAY_EMULATE_TSC_H
 
+#include <cstdint>
+
 namespace __xray {
 static constexpr uint64_t NanosecondsPerSecond = 1000ULL * 1000 * 1000;
+
+// Reads the clock we use in place of the TSC when it isn't usable, in
+// nanoseconds. This is CLOCK_MONOTONIC_COARSE with xray_coarse_clock, and
+// CLOCK_REALTIME otherwise. Sets |CPU| to 0.
+uint64_t readEmulatedTSC(uint8_t &CPU);
 }
 
 #if defined(__x86_64__)
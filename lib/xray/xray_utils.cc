@@ -15,18 +15,33 @@
 #include "sanitizer_common/sanitizer_common.h"
 #include "xray_defs.h"
 #include "xray_flags.h"
+#include "xray_tsc.h"
 #include <stdlib.h>
 #include <cstdio>
 #include <errno.h>
 #include <fcntl.h>
 #include <iterator>
 #include <sys/types.h>
+#include <time.h>
 #include <tuple>
 #include <unistd.h>
 #include <utility>
 
 namespace __xray {
 
+uint64_t readEmulatedTSC(uint8_t &CPU) XRAY_NEVER_INSTRUMENT {
+  timespec TS;
+  int result = clock_gettime(
+      flags()->xray_coarse_clock ? CLOCK_MONOTONIC_COARSE : CLOCK_REALTIME,
+      &TS);
+  if (result != 0) {
+    Report("clock_gettime(2) returned %d, errno=%d.", result, int(errno));
+    TS = {0, 0};
+  }
+  CPU = 0;
+  return TS.tv_sec * NanosecondsPerSecond + TS.tv_nsec;
+}
+
 void printToStdErr(const char *Buffer) XRAY_NEVER_INSTRUMENT {
   fprintf(stderr, "%s", Buffer);
 }
@@ -49,6 +64,31 @@ void retryingWriteAll(int Fd, char *Begin, char *End) XRAY_NEVER_INSTRUMENT {
   }
 }
 
+bool retryingWritevAll(int Fd, struct iovec *Iov,
+                       int Count) XRAY_NEVER_INSTRUMENT {
+  while (Count > 0) {
+    auto Written = writev(Fd, Iov, Count);
+    if (Written < 0) {
+      if (errno == EINTR)
+        continue; // Try again.
+      Report("Failed to write; errno = %d\n", errno);
+      return false;
+    }
+    // Skip over whatever made it out, and resume from the partially written
+    // entry, if any.
+    while (Count > 0 && static_cast<size_t>(Written) >= Iov->iov_len) {
+      Written -= Iov->iov_len;
+      ++Iov;
+      --Count;
+    }
+    if (Count > 0) {
+      Iov->iov_base = static_cast<char *>(Iov->iov_base) + Written;
+      Iov->iov_len -= Written;
+    }
+  }
+  return true;
+}
+
 std::pair<ssize_t, bool> retryingReadSome(int Fd, char *Begin,
                                           char *End) XRAY_NEVER_INSTRUMENT {
   auto BytesToRead = std::distance(Begin, End);
@@ -16,6 +16,7 @@
 #define XRAY_UTILS_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <utility>
 
 namespace __xray {
@@ -26,6 +27,10 @@ void printToStdErr(const char *Buffer);
 // EINTR-safe write routine, provided a file descriptor and a character range.
 void retryingWriteAll(int Fd, char *Begin, char *End);
 
+// EINTR-safe gathering write routine. Writes out all of the |Count| entries of
+// |Iov|, which may be updated in the process. Returns false on error.
+bool retryingWritevAll(int Fd, struct iovec *Iov, int Count);
+
 // Reads a long long value from a provided file.
 bool readValueFromFile(const char *Filename, long long *Value);
 
@@ -1,75 +1,124 @@
 #include "cpuid.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "xray_defs.h"
+#include "xray_flags.h"
 #include "xray_interface_internal.h"
+#include "xray_tsc.h"
+#include "xray_utils.h"
 
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <errno.h>
 #include <fcntl.h>
 #include <iterator>
 #include <limits>
+#include <sched.h>
+#include <time.h>
 #include <tuple>
 #include <unistd.h>
 
+// Exported by glibc 2.35 and later, which registers an rseq area for every
+// thread: the area is at the thread pointer plus __rseq_offset.
+extern "C" {
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+}
+
 namespace __xray {
 
-static std::pair<ssize_t, bool>
-retryingReadSome(int Fd, char *Begin, char *End) XRAY_NEVER_INSTRUMENT {
-  auto BytesToRead = std::distance(Begin, End);
-  ssize_t BytesRead;
-  ssize_t TotalBytesRead = 0;
-  while (BytesToRead && (BytesRead = read(Fd, Begin, BytesToRead))) {
-    if (BytesRead == -1) {
-      if (errno == EINTR)
-        continue;
-      Report("Read error; errno = %d\n", errno);
-      return std::make_pair(TotalBytesRead, false);
-    }
+bool HasRDTSCP = false;
 
-    TotalBytesRead += BytesRead;
-    BytesToRead -= BytesRead;
-    Begin += BytesRead;
+unsigned getCurrentCPU() XRAY_NEVER_INSTRUMENT {
+  // struct rseq starts with the 32-bit cpu_id_start and cpu_id fields; cpu_id
+  // is negative until the area is registered.
+  if (&__rseq_size != nullptr && __rseq_size != 0) {
+    char *ThreadPointer;
+    asm("mov %%fs:0, %0" : "=r"(ThreadPointer));
+    auto CPU = *reinterpret_cast<volatile int32_t *>(ThreadPointer +
+                                                     __rseq_offset + 4);
+    if (CPU >= 0)
+      return CPU;
   }
-  return std::make_pair(TotalBytesRead, true);
+  int CPU = sched_getcpu();
+  return CPU < 0 ? 0 : CPU;
 }
 
-static bool readValueFromFile(const char *Filename,
-                              long long *Value) XRAY_NEVER_INSTRUMENT {
-  int Fd = open(Filename, O_RDONLY | O_CLOEXEC);
-  if (Fd == -1)
-    return false;
-  static constexpr size_t BufSize = 256;
-  char Line[BufSize] = {};
-  ssize_t BytesRead;
-  bool Success;
-  std::tie(BytesRead, Success) = retryingReadSome(Fd, Line, Line + BufSize);
-  close(Fd);
-  if (!Success)
-    return false;
-  char *End = nullptr;
-  long long Tmp = internal_simple_strtoll(Line, &End, 10);
-  bool Result = false;
-  if (Line[0] != '\0' && (*End == '\n' || *End == '\0')) {
-    *Value = Tmp;
-    Result = true;
+// Returns the TSC frequency as enumerated in CPUID leaf 0x15, or 0 if the CPU
+// doesn't tell us.
+static uint64_t getTSCFrequencyFromCPUID() XRAY_NEVER_INSTRUMENT {
+  unsigned int EAX, EBX, ECX, EDX;
+  unsigned int MaxLeaf = __get_cpuid_max(0, nullptr);
+  if (MaxLeaf < 0x15)
+    return 0;
+  // EBX/EAX is the ratio of the TSC to the core crystal clock, and ECX the
+  // crystal clock frequency in Hz, if it's enumerated at all.
+  __cpuid(0x15, EAX, EBX, ECX, EDX);
+  if (EAX == 0 || EBX == 0)
+    return 0;
+  if (ECX != 0)
+    return static_cast<uint64_t>(ECX) * EBX / EAX;
+  // Without the crystal clock, leaf 0x16 has the base frequency in MHz, which
+  // is what the TSC runs at.
+  if (MaxLeaf < 0x16)
+    return 0;
+  __cpuid(0x16, EAX, EBX, ECX, EDX);
+  return static_cast<uint64_t>(EAX & 0xffff) * 1000 * 1000;
+}
+
+// Measures the TSC against CLOCK_MONOTONIC over a few milliseconds.
+static uint64_t calibrateTSCFrequency() XRAY_NEVER_INSTRUMENT {
+  timespec Begin, End;
+  timespec Sleep = {0, 10 * 1000 * 1000};
+  clock_gettime(CLOCK_MONOTONIC, &Begin);
+  uint64_t BeginTSC = __rdtsc();
+  while (nanosleep(&Sleep, &Sleep) == -1 && errno == EINTR) {
   }
-  return Result;
+  uint64_t EndTSC = __rdtsc();
+  clock_gettime(CLOCK_MONOTONIC, &End);
+  uint64_t Elapsed = (End.tv_sec - Begin.tv_sec) * NanosecondsPerSecond +
+                     End.tv_nsec - Begin.tv_nsec;
+  if (Elapsed == 0)
+    return 0;
+  return (EndTSC - BeginTSC) * NanosecondsPerSecond / Elapsed;
 }
 
-uint64_t getTSCFrequency() XRAY_NEVER_INSTRUMENT {
+static uint64_t computeTSCFrequency() XRAY_NEVER_INSTRUMENT {
   long long TSCFrequency = -1;
   if (readValueFromFile("/sys/devices/system/cpu/cpu0/tsc_freq_khz",
-                        &TSCFrequency)) {
-    TSCFrequency *= 1000;
-  } else if (readValueFromFile(
-                 "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq",
-                 &TSCFrequency)) {
-    TSCFrequency *= 1000;
-  } else {
+                        &TSCFrequency))
+    return static_cast<uint64_t>(TSCFrequency) * 1000;
+  if (uint64_t Frequency = getTSCFrequencyFromCPUID())
+    return Frequency;
+
+  // Calibrating takes a while, so we keep the result around in
+  // xray_tsc_frequency_cache for the next run.
+  const char *CacheFile = flags()->xray_tsc_frequency_cache;
+  bool UseCache = CacheFile != nullptr && CacheFile[0] != '\0';
+  if (UseCache && readValueFromFile(CacheFile, &TSCFrequency) &&
+      TSCFrequency > 0)
+    return static_cast<uint64_t>(TSCFrequency);
+  uint64_t Frequency = calibrateTSCFrequency();
+  if (Frequency == 0) {
     Report("Unable to determine CPU frequency for TSC accounting.\n");
+    return 0;
+  }
+  if (UseCache) {
+    int Fd = open(CacheFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (Fd != -1) {
+      char Line[32];
+      int Len = internal_snprintf(Line, sizeof(Line), "%llu\n",
+                                  static_cast<unsigned long long>(Frequency));
+      retryingWriteAll(Fd, Line, Line + Len);
+      close(Fd);
+    }
   }
-  return TSCFrequency == -1 ? 0 : static_cast<uint64_t>(TSCFrequency);
+  return Frequency;
+}
+
+uint64_t getTSCFrequency() XRAY_NEVER_INSTRUMENT {
+  static const uint64_t TSCFrequency = computeTSCFrequency();
+  return TSCFrequency;
 }
 
 static constexpr uint8_t CallOpCode = 0xe8;
@@ -203,18 +252,36 @@ bool patchFunctionTailExit(const bool Enable, const uint32_t FuncId,
 
 // We determine whether the CPU we're running on has the correct features we
 // need. In x86_64 this will be rdtscp support.
-bool probeRequiredCPUFeatures() XRAY_NEVER_INSTRUMENT {
+static bool computeRequiredCPUFeatures() XRAY_NEVER_INSTRUMENT {
+  // With xray_coarse_clock, we use the coarse clock instead of the TSC.
+  if (flags()->xray_coarse_clock)
+    return false;
+
   unsigned int EAX, EBX, ECX, EDX;
 
   // We check whether rdtscp support is enabled. According to the x86_64 manual,
   // level should be set at 0x80000001, and we should have a look at bit 27 in
   // EDX. That's 0x8000000 (or 1u << 26).
   __get_cpuid(0x80000001, &EAX, &EBX, &ECX, &EDX);
-  if (!(EDX & (1u << 26))) {
-    Report("Missing rdtscp support.\n");
-    return false;
+  if (EDX & (1u << 26)) {
+    HasRDTSCP = true;
+    return true;
   }
-  return true;
+
+  // Without rdtscp, we can still use rdtsc as long as the TSC is invariant,
+  // that is bit 8 of EDX in leaf 0x80000007.
+  __get_cpuid(0x80000007, &EAX, &EBX, &ECX, &EDX);
+  if (EDX & (1u << 8))
+    return true;
+  Report("Missing rdtscp support.\n");
+  return false;
+}
+
+bool probeRequiredCPUFeatures() XRAY_NEVER_INSTRUMENT {
+  // This is called for every event in some modes, and cpuid can be very
+  // expensive (especially under virtualization), so only ask once.
+  static const bool Supported = computeRequiredCPUFeatures();
+  return Supported;
 }
 
 } // namespace __xray
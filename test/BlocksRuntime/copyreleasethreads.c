@@ -0,0 +1,78 @@
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+//
+//  copyreleasethreads.c
+//
+//  Copy and release Blocks and __block variables from several threads at
+//  once, so that their refcounts and the per-thread cache of heap copies
+//  are exercised, and check that a refcount latches instead of overflowing.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <Block.h>
+#include <Block_private.h>
+
+// CONFIG
+
+enum { kThreads = 4, kIterations = 100000 };
+
+static void (^shared)(void);
+
+void *worker(void *arg) {
+    long id = (long)arg;
+    int i;
+    for (i = 0; i < kIterations; ++i) {
+        void (^copy)(void) = Block_copy(shared);
+        if (copy != shared) {
+            printf("*** heap copy of a heap Block was not the same Block\n");
+            exit(1);
+        }
+        Block_release(copy);
+
+        __block long counter = id;
+        long captured = id * i;
+        long (^inner)(void) = ^{ return ++counter + captured; };
+        long (^innercopy)(void) = Block_copy(inner);
+        if (innercopy() != id + 1 + id * i || counter != id + 1) {
+            printf("*** copied Block saw the wrong variables\n");
+            exit(1);
+        }
+        Block_release(innercopy);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t threads[kThreads];
+    __block int calls = 0;
+    long i;
+    shared = Block_copy(^{ ++calls; });
+    for (i = 0; i < kThreads; ++i)
+        pthread_create(&threads[i], NULL, worker, (void *)i);
+    for (i = 0; i < kThreads; ++i)
+        pthread_join(threads[i], NULL);
+
+    struct Block_layout *layout = (struct Block_layout *)(void *)shared;
+    if ((layout->flags & BLOCK_REFCOUNT_MASK) != 1) {
+        printf("*** %s: refcount is %d after balanced copies and releases\n",
+               argv[0], layout->flags & BLOCK_REFCOUNT_MASK);
+        return 1;
+    }
+    for (i = 0; i < BLOCK_REFCOUNT_MASK + 10; ++i)
+        Block_copy(shared);
+    if ((layout->flags & BLOCK_REFCOUNT_MASK) != BLOCK_REFCOUNT_MASK ||
+        !(layout->flags & BLOCK_NEEDS_FREE)) {
+        printf("*** %s: refcount did not latch, flags are %x\n", argv[0],
+               layout->flags);
+        return 1;
+    }
+    shared();
+    printf("%s: success\n", argv[0]);
+    return 0;
+}
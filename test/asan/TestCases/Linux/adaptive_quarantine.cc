@@ -0,0 +1,27 @@
+// Tests ASAN_OPTIONS=adaptive_quarantine=1: the quarantine is scaled down as
+// RSS approaches the memory limit, and the decisions are reported at exit.
+//
+// RUN: %clangxx_asan %s -o %t
+// RUN: %env_asan_opts=adaptive_quarantine=1:quarantine_size_mb=256:soft_rss_limit_mb=150:allocator_may_return_null=1 %run %t 2>&1 | FileCheck %s
+//
+// REQUIRES: x86_64-target-arch
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main() {
+  const size_t kAllocSize = 1 << 20;
+  // 512Mb worth of chunks, slow enough for the background thread to notice.
+  for (int i = 0; i < 512; i++) {
+    char *volatile p = (char *)malloc(kAllocSize);
+    if (p)
+      memset(p, 0, kAllocSize);
+    free(p);
+    usleep(5000);
+  }
+  fprintf(stderr, "done\n");
+  // CHECK: done
+  // CHECK: Adaptive quarantine: limit: 150Mb; {{.*}}; {{[1-9][0-9]*}} shrinks
+  return 0;
+}
@@ -0,0 +1,23 @@
+// Tests ASAN_OPTIONS=allocator_size_profile=<path>
+//
+// RUN: %clangxx_asan %s -o %t
+// RUN: rm -f %t.prof.*
+// RUN: %env_asan_opts=allocator_size_profile=%t.prof %run %t
+// RUN: cat %t.prof.* | FileCheck %s
+#include <stdlib.h>
+
+int main() {
+  // Sizes are recorded with the redzones, none of the other allocations of
+  // the program gets the same size this many times.
+  for (int i = 0; i < 1000; i++) {
+    void *volatile p = malloc(1000);
+    free(p);
+  }
+  for (int i = 0; i < 3; i++) {
+    void *volatile p = malloc(1 << 21);
+    free(p);
+  }
+}
+
+// CHECK: {{^[0-9]+ 1000$}}
+// CHECK: {{^>1048576 3$}}
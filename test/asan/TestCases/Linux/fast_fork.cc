@@ -0,0 +1,36 @@
+// Test that with fast_fork a forked child gets a clean shadow: the memory
+// allocated before the fork is usable, and the bugs on the memory allocated
+// after it are still detected.
+//
+// RUN: %clangxx_asan -O0 %s -o %t
+// RUN: %env_asan_opts=fast_fork=1 %run %t 2>&1 | FileCheck %s
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main() {
+  char *before = (char *)malloc(16);
+  memset(before, 'a', 16);
+  pid_t pid = fork();
+  if (pid == 0) {
+    memset(before, 'b', 16);
+    free(before);
+    // The overflow stays in the block of the chunk, which malloc poisons: the
+    // neighbouring blocks may still have the clean shadow.
+    char *after = (char *)malloc(10);
+    fprintf(stderr, "child\n");
+    after[10] = 0;  // BOOM
+    return 0;
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  fprintf(stderr, "parent %c exit=%d\n", before[0], WEXITSTATUS(status));
+  free(before);
+  return 0;
+}
+
+// CHECK: child
+// CHECK: ERROR: AddressSanitizer: heap-buffer-overflow
+// CHECK: parent a exit=1
@@ -0,0 +1,53 @@
+// Test that huge_pages_for_dense_shadow backs the shadow of the heap and of
+// the globals with huge pages, and leaves the rest of the shadow alone.
+//
+// RUN: %clangxx_asan %s -o %t
+// RUN: %env_asan_opts=huge_pages_for_dense_shadow=1 %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-HUGE
+// RUN: %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-DEFAULT
+//
+// REQUIRES: x86_64-target-arch
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char global[1 << 16];
+
+// Returns whether the mapping containing addr is marked with MADV_HUGEPAGE,
+// according to its VmFlags in /proc/self/smaps.
+bool IsHugePageMapping(unsigned long addr) {
+  FILE *f = fopen("/proc/self/smaps", "r");
+  if (!f) return false;
+  char line[512];
+  bool in_mapping = false, huge = false;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long beg, end;
+    if (sscanf(line, "%lx-%lx ", &beg, &end) == 2) {
+      in_mapping = beg <= addr && addr < end;
+    } else if (in_mapping && !strncmp(line, "VmFlags:", 8)) {
+      huge = strstr(line, " hg") != 0;
+      break;
+    }
+  }
+  fclose(f);
+  return huge;
+}
+
+unsigned long MemToShadow(void *p) {
+  return ((unsigned long)p >> 3) + 0x7fff8000;
+}
+
+int main() {
+  char *heap = (char *)malloc(100);
+  char stack[100];
+  fprintf(stderr, "heap: %d\n", IsHugePageMapping(MemToShadow(heap)));
+  fprintf(stderr, "global: %d\n", IsHugePageMapping(MemToShadow(global)));
+  fprintf(stderr, "stack: %d\n", IsHugePageMapping(MemToShadow(stack)));
+  free(heap);
+  return 0;
+}
+// CHECK-HUGE: heap: 1
+// CHECK-HUGE: global: 1
+// CHECK-HUGE: stack: 0
+// CHECK-DEFAULT: heap: 0
+// CHECK-DEFAULT: global: 0
+// CHECK-DEFAULT: stack: 0
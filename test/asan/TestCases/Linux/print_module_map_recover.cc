@@ -0,0 +1,25 @@
+// Check that with halt_on_error=0, symbolize=0 and print_module_map=1 the
+// reports contain raw module offsets and the module map is printed at exit,
+// so that the reports can be symbolized offline.
+//
+// RUN: %clangxx_asan -fsanitize-recover=address -O0 %s -o %t
+// RUN: %env_asan_opts=halt_on_error=0:symbolize=0:print_module_map=1 \
+// RUN:   %run %t 2>&1 | FileCheck %s
+
+#include <stdlib.h>
+
+int main() {
+  char *volatile p = (char *)malloc(10);
+  for (int i = 0; i < 3; i++)
+    p[10 + i] = 0;
+  free(p);
+  return 0;
+}
+
+// CHECK: ERROR: AddressSanitizer: heap-buffer-overflow
+// CHECK: #0 0x{{.*}} ({{.*}}print_module_map_recover.cc.tmp+0x
+// CHECK-NOT: Process module map:
+// CHECK: ERROR: AddressSanitizer: heap-buffer-overflow
+// CHECK: Process module map:
+// CHECK: 0x{{[0-9a-f]+}}-0x{{[0-9a-f]+}} {{.*}}print_module_map_recover.cc.tmp
+// CHECK: End of module map.
@@ -0,0 +1,27 @@
+// Tests ASAN_OPTIONS=quarantine_recycle_in_background=1: the quarantine stays
+// bounded and use-after-free is still detected.
+//
+// RUN: %clangxx_asan %s -o %t
+// RUN: %env_asan_opts=quarantine_size_mb=16:quarantine_recycle_in_background=1 not %run %t 2>&1 | FileCheck %s
+//
+// REQUIRES: x86_64-target-arch
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sanitizer/allocator_interface.h>
+
+int main() {
+  const size_t kAllocSize = 1024;
+  // 256Mb worth of chunks go through a 16Mb quarantine.
+  for (size_t i = 0; i < (256 << 20) / kAllocSize; i++) {
+    char *volatile p = (char *)malloc(kAllocSize);
+    free(p);
+  }
+  size_t heap_size = __sanitizer_get_heap_size();
+  fprintf(stderr, "heap bounded: %d\n", heap_size < (64 << 20));
+  // CHECK: heap bounded: 1
+  char *volatile p = (char *)malloc(kAllocSize);
+  free(p);
+  return p[0];
+  // CHECK: heap-use-after-free
+}
@@ -0,0 +1,27 @@
+// Tests ASAN_OPTIONS=release_freed_shadow_threshold_kb: the shadow of large
+// quarantined chunks is released, while use-after-free at either end of the
+// chunk is still reported.
+//
+// RUN: %clangxx_asan %s -o %t
+// RUN: %env_asan_opts=release_freed_shadow_threshold_kb=1024:print_stats=1 %run %t 2>&1 | FileCheck %s --check-prefix=STATS
+// RUN: %env_asan_opts=release_freed_shadow_threshold_kb=1024 not %run %t head 2>&1 | FileCheck %s
+// RUN: %env_asan_opts=release_freed_shadow_threshold_kb=1024 not %run %t tail 2>&1 | FileCheck %s
+//
+// REQUIRES: x86_64-target-arch
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv) {
+  const size_t kAllocSize = 64 << 20;
+  char *volatile p = (char *)malloc(kAllocSize);
+  memset(p, 0, kAllocSize);
+  free(p);
+  if (argc > 1 && !strcmp(argv[1], "head"))
+    return p[1];
+  if (argc > 1 && !strcmp(argv[1], "tail"))
+    return p[kAllocSize - 1];
+  return 0;
+}
+
+// STATS: Stats: {{[1-9][0-9]*}}M of freed chunk shadow released
+// CHECK: heap-use-after-free
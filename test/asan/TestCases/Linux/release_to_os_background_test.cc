@@ -0,0 +1,32 @@
+// Tests ASAN_OPTIONS=allocator_release_to_os_in_background=1
+//
+
+// RUN: %clangxx_asan -std=c++11 %s -o %t
+// RUN: %env_asan_opts=quarantine_size_mb=0:allocator_release_to_os_interval_ms=0:allocator_release_to_os_in_background=1 %run %t 2>&1 | FileCheck %s --check-prefix=RELEASE
+// RUN: %env_asan_opts=quarantine_size_mb=0:allocator_release_to_os_interval_ms=-1:allocator_release_to_os_in_background=1 %run %t 2>&1 | FileCheck %s --check-prefix=NO_RELEASE
+//
+// REQUIRES: x86_64-target-arch
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sanitizer/asan_interface.h>
+
+int main() {
+  const size_t kNumChunks = 10000;
+  const size_t kAllocSize = 100;
+  uintptr_t *chunks[kNumChunks];
+  for (size_t i = 0; i < kNumChunks; i++)
+    chunks[i] = new uintptr_t[kAllocSize];
+  // Keep a few chunks alive to split the free memory into ranges.
+  for (size_t i = 0; i < kNumChunks; i++)
+    if (i % 64)
+      delete[] chunks[i];
+  // The background thread wakes up every 100ms.
+  usleep(500000);
+  __asan_print_accumulated_stats();
+}
+
+// RELEASE: mapped:{{.*}}releases: {{[1-9]}}
+// NO_RELEASE: mapped:{{.*}}releases: 0
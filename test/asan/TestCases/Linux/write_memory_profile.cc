@@ -0,0 +1,94 @@
+// Tests __sanitizer_write_memory_profile and heap_profile_path.
+//
+// RUN: %clangxx_asan %s -o %t
+// RUN: %run %t %t.prof 1 2>&1 | FileCheck %s
+// RUN: %run %t %t.prof 16 2>&1 | FileCheck %s --check-prefix=SAMPLED
+// RUN: rm -f %t.hp.*
+// RUN: %env_asan_opts=heap_profile_path=%t.hp,heap_profile_interval_ms=100 \
+// RUN:   %run %t 2>&1
+// RUN: %run %t %t.hp.* 2>&1 | FileCheck %s --check-prefix=PERIODIC
+
+#include <sanitizer/common_interface_defs.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct Header {
+  char magic[8];
+  uint64_t timestamp_ns, allocated_bytes, allocated_count;
+  uint32_t sample_rate, num_sites, num_stacks, reserved;
+};
+
+struct Site {
+  uint32_t stack_id, reserved;
+  uint64_t bytes, count;
+};
+
+char *sink[1000];
+
+__attribute__((noinline)) void AllocateSmall() {
+  for (int i = 0; i < 1000; i++)
+    sink[i] = new char[1000];
+}
+
+// Reads a profile back and prints the biggest site.
+static void ReadProfile(const char *path) {
+  FILE *f = fopen(path, "rb");
+  assert(f);
+  Header h;
+  assert(fread(&h, sizeof(h), 1, f) == 1);
+  assert(!memcmp(h.magic, "ASANHPF1", 8));
+  Site biggest = {};
+  uint32_t prev_id = 0;
+  for (uint32_t i = 0; i < h.num_sites; i++) {
+    Site s;
+    assert(fread(&s, sizeof(s), 1, f) == 1);
+    assert(s.stack_id > prev_id);
+    prev_id = s.stack_id;
+    if (s.bytes > biggest.bytes)
+      biggest = s;
+  }
+  bool found_stack = false;
+  for (uint32_t i = 0; i < h.num_stacks; i++) {
+    uint32_t stack_header[2];
+    assert(fread(stack_header, sizeof(stack_header), 1, f) == 1);
+    uint64_t pcs[256];
+    assert(stack_header[1] <= 256);
+    assert(fread(pcs, sizeof(pcs[0]), stack_header[1], f) == stack_header[1]);
+    if (stack_header[0] == biggest.stack_id && stack_header[1])
+      found_stack = true;
+  }
+  fclose(f);
+  fprintf(stderr, "rate %u biggest site: %llu bytes in %llu chunks, stack %d\n",
+          h.sample_rate, (unsigned long long)biggest.bytes,
+          (unsigned long long)biggest.count, found_stack);
+}
+
+int main(int argc, char **argv) {
+  AllocateSmall();
+  if (argc == 1) {
+    // Let the background thread write a few profiles.
+    usleep(500000);
+    return 0;
+  }
+  if (argc == 2) {
+    ReadProfile(argv[1]);
+    return 0;
+  }
+  int fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  int res = __sanitizer_write_memory_profile((void *)(intptr_t)fd,
+                                             atoi(argv[2]));
+  assert(res);
+  close(fd);
+  ReadProfile(argv[1]);
+}
+
+// CHECK: rate 1 biggest site: 1000000 bytes in 1000 chunks, stack 1
+// SAMPLED: rate 16 biggest site: {{[0-9]+}}000 bytes in {{[0-9]+}} chunks, stack 1
+// PERIODIC: biggest site: 1000000 bytes in 1000 chunks, stack 1
@@ -0,0 +1,43 @@
+// Test that rawunpack replays the memory layout journal when the process
+// doesn't reach exit, including the modules loaded with dlopen().
+
+// RUN: %clangxx_asan -fsanitize-coverage=func -DSHARED %s -shared -o %dynamiclib -fPIC
+// RUN: %clangxx_asan -fsanitize-coverage=func %s %libdl -o %t
+
+// RUN: rm -rf %T/coverage-direct-journal
+// RUN: mkdir -p %T/coverage-direct-journal && cd %T/coverage-direct-journal
+// RUN: %env_asan_opts=coverage=1:coverage_direct=1:verbosity=1 %run %t %dynamiclib
+// RUN: not ls *.sancov.map.log
+// RUN: ls *.sancov.map
+// RUN: rm -f *
+// RUN: %env_asan_opts=coverage=1:coverage_direct=1:verbosity=1 not --crash %run %t %dynamiclib crash
+// RUN: ls *.sancov.map.log
+// RUN: %sancov rawunpack *.sancov.raw 2>&1 | FileCheck %s
+//
+// XFAIL: android
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SHARED
+extern "C" {
+void bar() {}
+}
+#else
+
+int main(int argc, char **argv) {
+  void *handle = dlopen(argv[1], RTLD_LAZY);
+  assert(handle);
+  void (*bar)() = (void (*)())dlsym(handle, "bar");
+  assert(bar);
+  bar();
+  if (argc > 2)
+    abort();
+  return 0;
+}
+#endif
+
+// CHECK: reading map journal
+// CHECK: writing {{[0-9]+}} PCs to {{.*}}.so.{{[0-9]+}}.sancov
@@ -0,0 +1,31 @@
+// Check that the global index finds the right variable among many globals
+// registered by the same module, both in the middle and at the edges.
+// RUN: %clangxx_asan -O0 %s -o %t
+// RUN: not %run %t 0 2>&1 | FileCheck %s --check-prefix=CHECK-FIRST
+// RUN: not %run %t 57 2>&1 | FileCheck %s --check-prefix=CHECK-MIDDLE
+// RUN: not %run %t 99 2>&1 | FileCheck %s --check-prefix=CHECK-LAST
+
+#include <stdlib.h>
+#include <string.h>
+
+#define G10(p)                                                                 \
+  char p##0[10], p##1[10], p##2[10], p##3[10], p##4[10], p##5[10], p##6[10],   \
+      p##7[10], p##8[10], p##9[10];
+G10(g_0) G10(g_1) G10(g_2) G10(g_3) G10(g_4)
+G10(g_5) G10(g_6) G10(g_7) G10(g_8) G10(g_9)
+
+#define P10(p)                                                                 \
+  p##0, p##1, p##2, p##3, p##4, p##5, p##6, p##7, p##8, p##9,
+char *globals[] = {
+  P10(g_0) P10(g_1) P10(g_2) P10(g_3) P10(g_4)
+  P10(g_5) P10(g_6) P10(g_7) P10(g_8) P10(g_9)
+};
+
+int main(int argc, char **argv) {
+  char *g = globals[atoi(argv[1])];
+  memset(g, 0, 10);
+  return g[10 + argc - 2];
+  // CHECK-FIRST: is located 0 bytes to the right of global variable 'g_00'
+  // CHECK-MIDDLE: is located 0 bytes to the right of global variable 'g_57'
+  // CHECK-LAST: is located 0 bytes to the right of global variable 'g_99'
+}
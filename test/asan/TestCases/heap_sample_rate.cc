@@ -0,0 +1,22 @@
+// Tests ASAN_OPTIONS=heap_sample_rate. Chunks that are not sampled are not
+// quarantined, so use-after-free on them is not reported, while a rate of 1
+// samples everything.
+//
+// RUN: %clangxx_asan -O0 %s -o %t
+// RUN: %env_asan_opts=heap_sample_rate=1 not %run %t 2>&1 | FileCheck %s --check-prefix=ALL
+// RUN: %env_asan_opts=heap_sample_rate=1000000 %run %t 2>&1 | FileCheck %s --check-prefix=SAMPLED
+#include <stdio.h>
+#include <stdlib.h>
+
+int main() {
+  // Skip the sampled allocation a thread starts with.
+  char *volatile warmup = (char *)malloc(10);
+  free(warmup);
+  char *volatile p = (char *)malloc(10);
+  free(p);
+  int res = p[5];
+  // ALL: heap-use-after-free
+  fprintf(stderr, "not reported\n");
+  // SAMPLED: not reported
+  return res & 0;
+}
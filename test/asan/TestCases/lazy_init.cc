@@ -0,0 +1,35 @@
+// Test that print_init_timing=1 prints the init phases, and that with
+// lazy_init=1 the suppressions and the symbolizer still work once used.
+//
+// RUN: %clangxx_asan -O0 %s -o %t
+// RUN: %env_asan_opts=print_init_timing=1 %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-TIMING
+// RUN: echo "interceptor_name:strlen" > %t.supp
+// RUN: %env_asan_opts=lazy_init=1:suppressions='"%t.supp"' %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-IGNORE
+// RUN: %env_asan_opts=lazy_init=1 not %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-CRASH
+
+// XFAIL: android
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main() {
+  char *a = (char *)malloc(6);
+  free(a);
+  size_t len = strlen(a); // BOOM
+  fprintf(stderr, "strlen ignored, len = %zu\n", len);
+}
+
+// CHECK-TIMING: AddressSanitizer init timing:
+// CHECK-TIMING:   flags: {{[0-9]+}} us
+// CHECK-TIMING:   suppressions: {{[0-9]+}} us
+// CHECK-TIMING:   symbolizer: {{[0-9]+}} us
+// CHECK-TIMING:   total: {{[0-9]+}} us
+
+// CHECK-IGNORE-NOT: AddressSanitizer: heap-use-after-free
+// CHECK-IGNORE: strlen ignored
+
+// CHECK-CRASH: AddressSanitizer: heap-use-after-free
+// CHECK-CRASH: #0 {{.*}} in {{.*}}strlen
+// CHECK-CRASH: #1 {{.*}} in main {{.*}}lazy_init.cc:[[@LINE-15]]
+// CHECK-CRASH-NOT: strlen ignored
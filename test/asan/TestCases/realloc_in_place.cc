@@ -0,0 +1,31 @@
+// Test that realloc_in_place resizes chunks without moving them, and that the
+// accesses past the new size are still reported.
+// RUN: %clangxx_asan -O0 %s -o %t
+// RUN: %env_asan_opts=realloc_in_place=1 not %run %t 2>&1 | FileCheck %s
+// RUN: %env_asan_opts=realloc_in_place=1 not %run %t large 2>&1 | FileCheck %s --check-prefix=LARGE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv) {
+  bool large = argc > 1 && !strcmp(argv[1], "large");
+  size_t size = large ? (1 << 20) + 100 : 100;
+  char *p = (char *)malloc(size);
+  memset(p, 1, size);
+  char *q = (char *)realloc(p, size + 1);
+  fprintf(stderr, "%s\n", p == q ? "In place." : "Moved.");
+  // CHECK: In place.
+  // LARGE: In place.
+  for (size_t i = 0; i < size; i++)
+    if (q[i] != 1)
+      return 1;
+  q[size] = 1;
+  q[size + 1] = 1;
+  // CHECK: heap-buffer-overflow
+  // CHECK: 0 bytes to the right of 101-byte region
+  // LARGE: heap-buffer-overflow
+  // LARGE: 0 bytes to the right of 1048677-byte region
+  free(q);
+  return 0;
+}
@@ -0,0 +1,27 @@
+// Test that self_profile=1 counts the cycles spent in the runtime and prints
+// them at exit.
+//
+// RUN: %clangxx_asan -O0 %s -o %t
+// RUN: %env_asan_opts=self_profile=1 %run %t 2>&1 | FileCheck %s
+// RUN: %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-OFF
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main() {
+  char buf[16];
+  for (int i = 0; i < 1000; i++) {
+    char *p = (char *)malloc(16);
+    memset(buf, i, sizeof(buf));
+    strncpy(p, buf, sizeof(buf));
+    free(p);
+  }
+  fprintf(stderr, "done\n");
+  return 0;
+}
+// CHECK: done
+// CHECK: AddressSanitizer self-profile
+// CHECK:   interceptors: {{[1-9][0-9]*}} calls
+// CHECK:   stack unwinding: {{[1-9][0-9]*}} calls
+// CHECK:   stack depot put: {{[1-9][0-9]*}} calls
+// CHECK-OFF-NOT: self-profile
@@ -0,0 +1,58 @@
+// RUN: %clang_asan -O0 %s -o %t
+// RUN: %run %t 0 2>&1 | FileCheck %s -check-prefix=CLEAR
+// RUN: %run %t 1 2>&1 | FileCheck %s -check-prefix=BEFORE
+// RUN: not %run %t 2 2>&1 | FileCheck %s -check-prefix=INSIDE
+// RUN: %run %t 3 2>&1 | FileCheck %s -check-prefix=AFTER
+
+// XFAIL: win32
+
+#include <assert.h>
+#include <sanitizer/asan_interface.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void __asan_set_shadow_frame(size_t addr, const unsigned char *layout);
+void __asan_clear_shadow_frame(size_t addr, const unsigned char *layout);
+
+// 32 shadow bytes: 2 addressable, 20 of redzone, then 10 addressable.
+static const unsigned char layout[] = {2, 0x00, 20, 0xf2, 10, 0x00, 0};
+
+char buf[256] __attribute__((aligned(64)));
+
+int main(int argc, char **argv) {
+  assert(argc > 1);
+  size_t shadow_offset;
+  size_t shadow_scale;
+  __asan_get_shadow_mapping(&shadow_scale, &shadow_offset);
+  size_t addr = (((size_t)buf) >> shadow_scale) + shadow_offset;
+  size_t granule = (size_t)1 << shadow_scale;
+
+  __asan_set_shadow_frame(addr, layout);
+  switch (atoi(argv[1])) {
+  // CLEAR-NOT: AddressSanitizer
+  // CLEAR: PASS
+  case 0:
+    __asan_clear_shadow_frame(addr, layout);
+    buf[granule * 10] = 1;
+    break;
+  // BEFORE-NOT: AddressSanitizer
+  // BEFORE: PASS
+  case 1:
+    buf[granule * 2 - 1] = 1;
+    break;
+  // INSIDE: AddressSanitizer: stack-buffer-overflow
+  // INSIDE: [f2]
+  case 2:
+    buf[granule * 15] = 1;
+    break;
+  // AFTER-NOT: AddressSanitizer
+  // AFTER: PASS
+  case 3:
+    buf[granule * 22] = 1;
+    break;
+  }
+  __asan_clear_shadow_frame(addr, layout);
+  printf("PASS\n");
+  return 0;
+}
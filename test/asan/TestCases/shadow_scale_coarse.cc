@@ -0,0 +1,48 @@
+// Checks the heap with the 1:32 shadow mapping: chunks are aligned to the
+// 32-byte granule and overflows inside the last granule are still detected.
+// RUN: %clangxx_asan -O0 %s -o %t
+// RUN: %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-OK
+// RUN: not %run %t 20 2>&1 | FileCheck %s --check-prefix=CHECK-OVERFLOW
+//
+// REQUIRES: shadow-scale-5
+
+#include <sanitizer/asan_interface.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+  size_t scale, offset;
+  __asan_get_shadow_mapping(&scale, &offset);
+  fprintf(stderr, "scale: %d\n", (int)scale);
+  // CHECK-OK: scale: 5
+
+  char *p[8];
+  for (int i = 0; i < 8; i++) {
+    p[i] = (char *)malloc(i + 1);
+    if ((size_t)p[i] % 32)
+      fprintf(stderr, "misaligned: %p\n", p[i]);
+  }
+  // CHECK-OK-NOT: misaligned
+  // The first i + 1 bytes of the granule are addressable, the rest of it and
+  // the left redzone are not.
+  for (int i = 0; i < 8; i++) {
+    if (__asan_address_is_poisoned(p[i] + i) ||
+        !__asan_address_is_poisoned(p[i] + i + 1) ||
+        !__asan_address_is_poisoned(p[i] + 31) ||
+        !__asan_address_is_poisoned(p[i] - 1))
+      fprintf(stderr, "wrong shadow: %d\n", i);
+    free(p[i]);
+  }
+  // CHECK-OK-NOT: wrong shadow
+  fprintf(stderr, "done\n");
+  // CHECK-OK: done
+
+  if (argc > 1) {
+    char *x = (char *)malloc(20);
+    volatile char c = x[atoi(argv[1])];
+    // CHECK-OVERFLOW: READ of size 1
+    // CHECK-OVERFLOW: 0 bytes to the right of 20-byte region
+    (void)c;
+  }
+  return 0;
+}
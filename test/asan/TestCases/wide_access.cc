@@ -0,0 +1,39 @@
+// Test the callbacks of the 32 and 64-byte (AVX and AVX-512) accesses.
+// RUN: %clangxx_asan -O0 %s -o %t
+// RUN: not %run %t load32 2>&1 | FileCheck %s --check-prefix=LOAD32
+// RUN: not %run %t store64 2>&1 | FileCheck %s --check-prefix=STORE64
+// RUN: not %run %t unaligned 2>&1 | FileCheck %s --check-prefix=UNALIGNED
+
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+void __asan_load32(void *p);
+void __asan_load64(void *p);
+void __asan_store32(void *p);
+void __asan_store64(void *p);
+}
+
+int main(int argc, char **argv) {
+  char *x;
+  if (posix_memalign((void **)&x, 64, 100))
+    return 1;
+  // In bounds.
+  __asan_load64(x);
+  __asan_store32(x + 64);
+  __asan_load32(x + 67);
+  if (!strcmp(argv[1], "load32"))
+    __asan_load32(x + 96);
+  // LOAD32: READ of size 32 at {{0x.*}} thread T0
+  // LOAD32: {{0x.* is located 96 bytes inside of 100-byte region}}
+  if (!strcmp(argv[1], "store64"))
+    __asan_store64(x + 64);
+  // STORE64: WRITE of size 64 at {{0x.*}} thread T0
+  // STORE64: heap-buffer-overflow
+  if (!strcmp(argv[1], "unaligned"))
+    __asan_load32(x + 69);
+  // UNALIGNED: READ of size 32 at {{0x.*}} thread T0
+  // UNALIGNED: {{0x.* is located 69 bytes inside of 100-byte region}}
+  free(x);
+  return 0;
+}
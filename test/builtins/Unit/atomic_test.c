@@ -0,0 +1,96 @@
+// REQUIRES: native-run
+// RUN: %clang_builtins %s %librt -lpthread -o %t && %run %t
+//===-- atomic_test.c - Test the lock-based atomic operations -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file tests that the atomic operations on objects which are not lock free
+// are atomic: concurrent loads must never see a partial store.
+//
+//===----------------------------------------------------------------------===//
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define NUM_STORES 200000
+
+struct S {
+  uint64_t v[4];
+};
+
+static struct S s32;
+#ifdef __SIZEOF_INT128__
+static __uint128_t c16 __attribute__((aligned(16)));
+#endif
+static int stop;
+static int torn;
+
+static void *writer(void *arg) {
+  for (uint64_t k = 1; k <= NUM_STORES; ++k) {
+    struct S n = {{k, k, k, k}};
+    __atomic_store(&s32, &n, __ATOMIC_SEQ_CST);
+#ifdef __SIZEOF_INT128__
+    __atomic_fetch_add(&c16, ((__uint128_t)1 << 64) | 1, __ATOMIC_SEQ_CST);
+#endif
+  }
+  return 0;
+}
+
+static void *reader(void *arg) {
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+    struct S r;
+    __atomic_load(&s32, &r, __ATOMIC_SEQ_CST);
+    if (r.v[0] != r.v[1] || r.v[0] != r.v[2] || r.v[0] != r.v[3])
+      __atomic_store_n(&torn, 1, __ATOMIC_RELAXED);
+#ifdef __SIZEOF_INT128__
+    __uint128_t x = __atomic_load_n(&c16, __ATOMIC_SEQ_CST);
+    if ((uint64_t)x != (uint64_t)(x >> 64))
+      __atomic_store_n(&torn, 1, __ATOMIC_RELAXED);
+#endif
+  }
+  return 0;
+}
+
+int main() {
+  pthread_t readers[2], writers[2];
+  for (int i = 0; i < 2; ++i)
+    pthread_create(&readers[i], 0, reader, 0);
+  for (int i = 0; i < 2; ++i)
+    pthread_create(&writers[i], 0, writer, 0);
+  for (int i = 0; i < 2; ++i)
+    pthread_join(writers[i], 0);
+  __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < 2; ++i)
+    pthread_join(readers[i], 0);
+  if (torn) {
+    printf("error: torn atomic load\n");
+    return 1;
+  }
+
+  struct S expected = s32, desired = {{7, 7, 7, 7}}, wrong = {{0, 0, 0, 0}};
+  if (__atomic_compare_exchange(&s32, &wrong, &desired, 0, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST) ||
+      wrong.v[0] != expected.v[0]) {
+    printf("error: compare exchange succeeded with the wrong value\n");
+    return 1;
+  }
+  if (!__atomic_compare_exchange(&s32, &expected, &desired, 0,
+                                 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ||
+      s32.v[3] != 7) {
+    printf("error: compare exchange failed\n");
+    return 1;
+  }
+#ifdef __SIZEOF_INT128__
+  if (c16 != ((((__uint128_t)2 * NUM_STORES) << 64) | 2 * NUM_STORES)) {
+    printf("error: lost 16-byte updates\n");
+    return 1;
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,83 @@
+// REQUIRES: native-run
+// RUN: %clang_builtins %s %librt -lpthread -o %t && %run %t
+//===-- emutls_test.c - Test __emutls_get_address -------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file tests that the emulated TLS objects are initialized, aligned and
+// private to each thread, for variables first accessed concurrently.
+//
+//===----------------------------------------------------------------------===//
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef unsigned int gcc_word __attribute__((mode(word)));
+typedef struct __emutls_control {
+  gcc_word size;
+  gcc_word align;
+  uintptr_t index;
+  void *value;
+} __emutls_control;
+
+void *__emutls_get_address(__emutls_control *control);
+
+#define NUM_VARS 300
+#define NUM_THREADS 8
+
+static __emutls_control vars[NUM_VARS];
+static char init[256];
+
+static void *test_thread(void *arg) {
+  int id = (int)(intptr_t)arg;
+  int round, i;
+  for (round = 0; round < 3; ++round) {
+    for (i = 0; i < NUM_VARS; ++i) {
+      char *p = (char *)__emutls_get_address(&vars[i]);
+      if ((uintptr_t)p % vars[i].align) {
+        printf("error: variable %d misaligned\n", i);
+        return (void *)1;
+      }
+      if (round == 0) {
+        char expected = vars[i].value ? init[vars[i].size - 1] : 0;
+        if (p[vars[i].size - 1] != expected) {
+          printf("error: variable %d not initialized\n", i);
+          return (void *)1;
+        }
+        memset(p, id + i, vars[i].size);
+      } else if (p[0] != (char)(id + i) || p[vars[i].size - 1] != p[0]) {
+        printf("error: variable %d shared between threads\n", i);
+        return (void *)1;
+      }
+    }
+  }
+  return NULL;
+}
+
+int main() {
+  pthread_t threads[NUM_THREADS];
+  int i, failed = 0;
+  for (i = 0; i < (int)sizeof(init); ++i)
+    init[i] = (char)(i + 1);
+  for (i = 0; i < NUM_VARS; ++i) {
+    // Mix small objects with ones too large or too aligned to be batched.
+    vars[i].size = 1 + (i % 5) * 50;
+    vars[i].align = 1 << (i % 8);
+    vars[i].value = i % 3 ? init : NULL;
+  }
+  for (i = 0; i < NUM_THREADS; ++i)
+    pthread_create(&threads[i], NULL, test_thread, (void *)(intptr_t)(i * 16));
+  for (i = 0; i < NUM_THREADS; ++i) {
+    void *res;
+    pthread_join(threads[i], &res);
+    failed |= res != NULL;
+  }
+  return failed;
+}
@@ -0,0 +1,59 @@
+#include "timing.h"
+#include <stdio.h>
+
+#define INPUT_SIZE 256
+#define FUNCTION_NAME __emutls_get_address
+
+#ifndef LIBNAME
+#define LIBNAME UNKNOWN
+#endif
+
+#define LIBSTRING		LIBSTRINGX(LIBNAME)
+#define LIBSTRINGX(a)	LIBSTRINGXX(a)
+#define LIBSTRINGXX(a)	#a
+
+typedef unsigned int gcc_word __attribute__((mode(word)));
+typedef struct __emutls_control {
+	gcc_word size;
+	gcc_word align;
+	uintptr_t index;
+	void *value;
+} __emutls_control;
+
+void *FUNCTION_NAME(__emutls_control *control);
+
+int main(int argc, char *argv[]) {
+	__emutls_control input[INPUT_SIZE];
+	int i, j;
+	
+	for (i=0; i<INPUT_SIZE; ++i) {
+		input[i].size = sizeof(int);
+		input[i].align = sizeof(int);
+		input[i].index = 0;
+		input[i].value = NULL;
+	}
+	
+	// Time the accesses to variables which the thread has already touched.
+	for (i=0; i<INPUT_SIZE; ++i)
+		FUNCTION_NAME(&input[i]);
+	
+	double bestTime = __builtin_inf();
+	void *dummyp;
+	for (j=0; j<1024; ++j) {
+		
+		uint64_t startTime = mach_absolute_time();
+		for (i=0; i<INPUT_SIZE; ++i)
+			FUNCTION_NAME(&input[i]);
+		uint64_t endTime = mach_absolute_time();
+		
+		double thisTime = intervalInCycles(startTime, endTime);
+		bestTime = __builtin_fmin(thisTime, bestTime);
+		
+		// Move the stack alignment between trials to eliminate (mostly) aliasing effects
+		dummyp = alloca(1);
+	}
+	
+	printf("%16s: %f cycles.\n", LIBSTRING, bestTime / (double) INPUT_SIZE);
+	
+	return 0;
+}
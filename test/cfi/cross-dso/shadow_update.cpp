@@ -0,0 +1,43 @@
+// RUN: %clangxx_cfi_dso -std=c++11 -g -DSHARED_LIB %s -fPIC -shared -o %t-cfi-so.so
+// RUN: %clangxx_cfi_dso -std=c++11 -g %s -o %t
+// RUN: CFI_OPTIONS=verbosity=1 %t %t-cfi-so.so 2>&1 | FileCheck %s
+
+// Tests that dlopen and dlclose only update the shadow of the library.
+// REQUIRES: cxxabi
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdio.h>
+
+struct A {
+  virtual void f();
+};
+
+#ifdef SHARED_LIB
+
+void A::f() {}
+
+extern "C" A *create_A() { return new A(); }
+
+#else
+
+void A::f() {}
+
+int main(int argc, char *argv[]) {
+  assert(argc > 1);
+  for (int i = 0; i < 2; ++i) {
+    // CHECK: CFI: shadow updated, 0 ranges removed, {{[1-9][0-9]*}} added
+    void *handle = dlopen(argv[1], RTLD_NOW);
+    assert(handle);
+    A *(*create_A)() = (A * (*)()) dlsym(handle, "create_A");
+    assert(create_A);
+    create_A()->f();
+    // CHECK: CFI: shadow updated, {{[1-9][0-9]*}} ranges removed, 0 added
+    int res = dlclose(handle);
+    assert(res == 0);
+  }
+  fprintf(stderr, "done\n");
+  // CHECK: done
+}
+
+#endif
@@ -1,6 +1,8 @@
 // RUN: %clangxx_cfi -g -fsanitize-stats -o %t %s
 // RUN: env SANITIZER_STATS_PATH=%t.stats %t
 // RUN: sanstats %t.stats | FileCheck %s
+// RUN: env SANITIZER_STATS_SHARDED=1 SANITIZER_STATS_PATH=%t.sharded.stats %t
+// RUN: sanstats %t.sharded.stats | FileCheck %s
 
 // FIXME: We currently emit the wrong debug info under devirtualization.
 // UNSUPPORTED: devirt
@@ -0,0 +1,69 @@
+// RUN: %clang_dfsan %s -o %t
+// RUN: %run %t %t.labels 2>&1 | FileCheck %s
+// RUN: DFSAN_OPTIONS=dump_labels_at_exit=%t.exit:dump_labels_binary=1 %run %t %t.labels
+// RUN: %run %t read %t.exit 2>&1 | FileCheck %s --check-prefix=CHECK-EXIT
+
+// Tests that dfsan_dump_new_labels dumps each label once, in the binary
+// format, and that dump_labels_binary dumps the rest at exit.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Prints the records in the file.
+static void PrintLabels(const char *path) {
+  int fd = open(path, O_RDONLY);
+  assert(fd >= 0);
+  struct dfsan_dumped_label record;
+  while (read(fd, &record, sizeof(record)) == sizeof(record)) {
+    char desc[256] = {};
+    assert(record.desc_size < sizeof(desc));
+    assert(read(fd, desc, record.desc_size) == record.desc_size);
+    fprintf(stderr, "%d %d %d %s\n", record.label, record.l1, record.l2, desc);
+  }
+  close(fd);
+}
+
+int main(int argc, char **argv) {
+  if (!strcmp(argv[1], "read")) {
+    PrintLabels(argv[2]);
+    return 0;
+  }
+
+  int fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  int i = 1;
+  dfsan_label i_label = dfsan_create_label("i", 0);
+  dfsan_set_label(i_label, &i, sizeof(i));
+  int j = 2;
+  dfsan_label j_label = dfsan_create_label("j", 0);
+  dfsan_set_label(j_label, &j, sizeof(j));
+  assert(dfsan_dump_new_labels(fd) == 2);
+  assert(dfsan_dump_new_labels(fd) == 0);
+
+  int k = 3;
+  dfsan_label k_label = dfsan_create_label("k", 0);
+  dfsan_set_label(k_label, &k, sizeof(k));
+  dfsan_label ij_label = dfsan_get_label(i + j);
+  assert(dfsan_dump_new_labels(fd) == 2);
+  close(fd);
+
+  dfsan_label ijk_label = dfsan_get_label(i + j + k);
+  fprintf(stderr, "ij %d ijk %d\n", ij_label, ijk_label);
+  PrintLabels(argv[1]);
+  return 0;
+}
+
+// CHECK: ij 4 ijk 5
+// CHECK-NEXT: 1 0 0 i
+// CHECK-NEXT: 2 0 0 j
+// CHECK-NEXT: 3 0 0 k
+// CHECK-NEXT: 4 1 2
+// CHECK-NOT: 5 3 4
+
+// CHECK-EXIT-NOT: 4 1 2
+// CHECK-EXIT: 5 3 4
+// CHECK-EXIT-NOT: {{[0-9]}}
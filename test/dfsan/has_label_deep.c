@@ -0,0 +1,24 @@
+// RUN: %clang_dfsan %s -o %t && %run %t
+
+// Tests that dfsan_has_label is fast on unions which share their operands, with
+// exponentially many paths to the labels they were made from.
+
+#include <sanitizer/dfsan_interface.h>
+#include <assert.h>
+
+int main(void) {
+  dfsan_label unrelated = dfsan_create_label("unrelated", 0);
+  dfsan_label first = dfsan_create_label("first", 0);
+  dfsan_label top = first;
+  for (int i = 0; i < 64; ++i) {
+    dfsan_label left = dfsan_union(top, dfsan_create_label("left", 0));
+    dfsan_label right = dfsan_union(top, dfsan_create_label("right", 0));
+    top = dfsan_union(left, right);
+  }
+
+  assert(dfsan_has_label(top, first));
+  assert(!dfsan_has_label(top, unrelated));
+  assert(dfsan_has_label_with_desc(top, "first"));
+  assert(!dfsan_has_label_with_desc(top, "unrelated"));
+  return 0;
+}
@@ -0,0 +1,25 @@
+// RUN: %clang_esan_frag -O0 %s -o %t 2>&1
+// RUN: %run %t 2>&1 | FileCheck %s
+// RUN: %env_esan_opts=field_affinity_sample_freq=1 %run %t 2>&1 | FileCheck %s
+
+// Test the suggestion to move the cold field out of the way of the hot ones.
+
+struct Node {
+  long key;
+  char pad[120];
+  long next;
+};
+
+int main(int argc, char **argv) {
+  struct Node n[2];
+  for (int i = 0; i < 1000; i++) {
+    n[i % 2].key = i;
+    n[i % 2].next = i;
+  }
+  n[0].pad[0] = 0;
+  return 0;
+  // CHECK:      EfficiencySanitizer: struct layout suggestions, by estimated cache lines saved:
+  // CHECK-NEXT:   struct Node: hot fields in 1 instead of 2 cache lines, count = 2001
+  // CHECK-NEXT:    hot field order: #0 #2
+  // CHECK-NEXT:    cold fields to split out: #1
+}
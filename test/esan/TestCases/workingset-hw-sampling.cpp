@@ -0,0 +1,30 @@
+// Without the load and store instrumentation, the working set only comes from
+// the PMU samples when hw_sampling is set. Where the PMU events cannot be
+// opened (e.g. in a VM), the tool warns and reports what it has.
+// RUN: %clang_esan_wset -O0 -mllvm -esan-instrument-loads-and-stores=0 -mllvm -esan-instrument-memintrinsics=0 %s -o %t 2>&1
+// RUN: %env_esan_opts=hw_sampling=1:hw_sample_period=1009 %run %t 2>&1 | FileCheck %s
+// RUN: %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-OFF
+
+#include <sanitizer/esan_interface.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+const int size = 0x1 << 25;
+const int line_size = 64;
+
+int main(int argc, char **argv) {
+  volatile char *buf = (char *)mmap(0, size, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  while (__esan_get_sample_count() < 4) {
+    for (int i = 0; i < size; i += line_size)
+      buf[i] = buf[i] + 1;
+    sched_yield();
+  }
+  munmap((void *)buf, size);
+  return 0;
+}
+// CHECK: {{Hardware samples: [0-9]+ \([0-9]+ lost\)|WARNING: hardware sampling of memory accesses is not available}}
+// CHECK: the total working set size:
+// CHECK-OFF-NOT: Hardware samples
+// CHECK-OFF: the total working set size:
@@ -0,0 +1,31 @@
+// RUN: %clang_esan_wset -O0 %s -o %t 2>&1
+// RUN: rm -f %t.regions.*
+// RUN: %env_esan_opts=region_breakdown_path=%t.regions:verbosity=1 %run %t 2>&1 | FileCheck %s
+// RUN: od -A n -t u4 -j 8 -N 16 %t.regions.* | FileCheck %s --check-prefix=CHECK-HEADER
+
+#include <sanitizer/esan_interface.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+const int size = 0x1 << 25; // 523288 cache lines
+
+int main(int argc, char **argv) {
+  char *buf = (char *)mmap(0, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  char *heap = (char *)malloc(64);
+  if (__esan_get_sample_count) {
+    while (__esan_get_sample_count() < 2) {
+      memset(buf, 1, size);
+      heap[0] = 1;
+      sched_yield();
+    }
+  }
+  free(heap);
+  // CHECK: EfficiencySanitizer: the total working set size: {{[0-9]+}} MB
+  // CHECK: EfficiencySanitizer: wrote {{[1-9][0-9]*}} region samples to {{.*}}.regions.{{[0-9]+}}
+  // Version, number of region kinds, cache line size and sample period.
+  // CHECK-HEADER: 1 5 64 20
+  return 0;
+}
@@ -38,6 +38,7 @@ int main(int argc, char **argv) {
   // CHECK:      =={{[0-9]+}}== Samples array #5 at period 20 sec
   // CHECK:      =={{[0-9]+}}== Samples array #6 at period 81 sec
   // CHECK:      =={{[0-9]+}}== Samples array #7 at period 327 sec
+  // CHECK:      =={{[0-9]+}}== Sampling cost: {{[0-9]+}} ms ({{[0-9]+}} us per sample), {{[0-9]+}} MB of shadow scanned
   // CHECK: {{.*}} EfficiencySanitizer: the total working set size: 32 MB (5242{{[0-9][0-9]}} cache lines)
   return 0;
 }
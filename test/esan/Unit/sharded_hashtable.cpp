@@ -0,0 +1,97 @@
+// RUN: %clangxx_unit -esan-instrument-loads-and-stores=0 -O2 %s -o %t -lpthread 2>&1
+// RUN: %env_esan_opts="record_snapshots=0" %run %t 2>&1 | FileCheck %s
+
+// Tests ShardedHashTable, and compares its throughput with that of HashTable
+// when several threads add, look up and remove keys at once.
+
+#include "esan/esan_hashtable.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+static const int NumThreads = 8;
+static const int KeysPerThread = 1 << 14;
+static const int Rounds = 8;
+
+template <typename TableTy> struct Bench {
+  TableTy *Table;
+  int Thread;
+};
+
+template <typename TableTy> static void *run(void *Arg) {
+  Bench<TableTy> *B = (Bench<TableTy> *)Arg;
+  for (int r = 0; r < Rounds; ++r) {
+    for (int i = 0; i < KeysPerThread; ++i) {
+      int Key = B->Thread * KeysPerThread + i;
+      bool Added = B->Table->add(Key, Key + 1);
+      assert(Added);
+    }
+    for (int i = 0; i < KeysPerThread; ++i) {
+      int Key = B->Thread * KeysPerThread + i, Value;
+      bool Found = B->Table->lookup(Key, Value);
+      assert(Found && Value == Key + 1);
+    }
+    for (int i = 0; i < KeysPerThread; ++i) {
+      bool Removed = B->Table->remove(B->Thread * KeysPerThread + i);
+      assert(Removed);
+    }
+  }
+  return nullptr;
+}
+
+template <typename TableTy> static double measure(TableTy *Table) {
+  pthread_t Threads[NumThreads];
+  Bench<TableTy> Benches[NumThreads];
+  timespec Start, End;
+  clock_gettime(CLOCK_MONOTONIC, &Start);
+  for (int t = 0; t < NumThreads; ++t) {
+    Benches[t].Table = Table;
+    Benches[t].Thread = t;
+    pthread_create(&Threads[t], nullptr, run<TableTy>, &Benches[t]);
+  }
+  for (int t = 0; t < NumThreads; ++t)
+    pthread_join(Threads[t], nullptr);
+  clock_gettime(CLOCK_MONOTONIC, &End);
+  assert(Table->size() == 0);
+  return (End.tv_sec - Start.tv_sec) * 1e3 +
+         (End.tv_nsec - Start.tv_nsec) / 1e6;
+}
+
+int main() {
+  __esan::ShardedHashTable<int, int> IntTable(4);
+  assert(IntTable.size() == 0);
+  bool Added = IntTable.add(4, 42);
+  assert(Added);
+  assert(!IntTable.add(4, 43));
+  assert(IntTable.size() == 1);
+  int Value;
+  bool Found = IntTable.lookup(4, Value);
+  assert(Found && Value == 42);
+  assert(!IntTable.lookup(5, Value));
+  assert(!IntTable.remove(5));
+  bool Removed = IntTable.remove(4);
+  assert(Removed);
+  assert(IntTable.size() == 0);
+  // Test the resizing of the shards.
+  for (int i = 0; i < 1000; ++i) {
+    Added = IntTable.add(i, i * 2);
+    assert(Added);
+  }
+  assert(IntTable.size() == 1000);
+  for (int i = 0; i < 1000; ++i) {
+    Found = IntTable.lookup(i, Value);
+    assert(Found && Value == i * 2);
+  }
+
+  __esan::HashTable<int, int> Single;
+  __esan::ShardedHashTable<int, int> Sharded;
+  double SingleMs = measure(&Single);
+  double ShardedMs = measure(&Sharded);
+  fprintf(stderr, "HashTable: %.1f ms, ShardedHashTable: %.1f ms\n", SingleMs,
+          ShardedMs);
+  fprintf(stderr, "All checks passed.\n");
+  return 0;
+}
+// CHECK: HashTable: {{.*}} ms, ShardedHashTable: {{.*}} ms
+// CHECK: All checks passed.
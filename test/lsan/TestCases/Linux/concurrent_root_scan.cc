@@ -0,0 +1,49 @@
+// Test that concurrent_root_scan finds the pointers in globals, both in the
+// pages scanned before the world is stopped and in the ones written to since.
+// RUN: LSAN_BASE="detect_leaks=1:use_stacks=0:use_registers=0:concurrent_root_scan=1"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: LSAN_OPTIONS=$LSAN_BASE not %run %t 2>&1 | FileCheck %s
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sanitizer/lsan_interface.h>
+
+// Large enough to span many pages which hold no pointers.
+void *volatile slots[1 << 16];
+volatile bool done;
+
+// Keeps moving a pointer between two pages while the leak checks run.
+void *Mover(void *arg) {
+  void *p = malloc(42);
+  slots[0] = p;
+  while (!done) {
+    slots[1 << 15] = p;
+    slots[0] = 0;
+    slots[0] = p;
+    slots[1 << 15] = 0;
+  }
+  return 0;
+}
+
+int main() {
+  slots[1 << 14] = malloc(1337);
+  assert(__lsan_do_recoverable_leak_check() == 0);
+  pthread_t t;
+  pthread_create(&t, 0, Mover, 0);
+  for (int i = 0; i < 20; i++)
+    assert(__lsan_do_recoverable_leak_check() == 0);
+  done = true;
+  pthread_join(t, 0);
+  slots[1 << 14] = 0;
+  fprintf(stderr, "Cleared the slot.\n");
+  assert(__lsan_do_recoverable_leak_check() == 1);
+  fprintf(stderr, "Done.\n");
+  return 0;
+}
+// CHECK-NOT: LeakSanitizer: detected memory leaks
+// CHECK: Cleared the slot.
+// CHECK: LeakSanitizer: detected memory leaks
+// CHECK: SUMMARY: {{(Leak|Address)}}Sanitizer: 1337 byte(s) leaked in 1 allocation(s)
+// CHECK: Done.
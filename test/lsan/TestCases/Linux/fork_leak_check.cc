@@ -0,0 +1,45 @@
+// Test that fork_leak_check finds the same leaks as the in-process check,
+// including the pointers held on the stacks of the other threads.
+// RUN: LSAN_BASE="detect_leaks=1:use_registers=0"
+// RUN: %clangxx_lsan -pthread %s -o %t
+// RUN: LSAN_OPTIONS=$LSAN_BASE:fork_leak_check=1 not %run %t 2>&1 | FileCheck %s
+// RUN: LSAN_OPTIONS=$LSAN_BASE:fork_leak_check=1:resolution=1 not %run %t 2>&1 | FileCheck %s
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sanitizer/lsan_interface.h>
+
+pthread_barrier_t barrier;
+
+void *Holder(void *arg) {
+  void *volatile p = malloc(42);
+  pthread_barrier_wait(&barrier);
+  pthread_barrier_wait(&barrier);
+  free(p);
+  return 0;
+}
+
+int main() {
+  pthread_barrier_init(&barrier, 0, 2);
+  pthread_t t;
+  pthread_create(&t, 0, Holder, 0);
+  pthread_barrier_wait(&barrier);
+  assert(__lsan_do_recoverable_leak_check() == 0);
+  void *volatile q = malloc(1337);
+  q = 0;
+  fprintf(stderr, "Leaked.\n");
+  assert(__lsan_do_recoverable_leak_check() == 1);
+  pthread_barrier_wait(&barrier);
+  pthread_join(t, 0);
+  fprintf(stderr, "Done.\n");
+  return 0;
+}
+// CHECK-NOT: LeakSanitizer: detected memory leaks
+// CHECK: Leaked.
+// CHECK: LeakSanitizer: detected memory leaks
+// CHECK: Direct leak of 1337 byte(s) in 1 object(s) allocated from:
+// CHECK-NOT: Direct leak of 42
+// CHECK: SUMMARY: {{(Leak|Address)}}Sanitizer: 1337 byte(s) leaked in 1 allocation(s)
+// CHECK: Done.
@@ -0,0 +1,31 @@
+// Test that incremental_scan notices writes to pages skipped in earlier checks.
+// RUN: LSAN_BASE="detect_leaks=1:use_stacks=0:use_registers=0:incremental_scan=1"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: LSAN_OPTIONS=$LSAN_BASE not %run %t 2>&1 | FileCheck %s
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sanitizer/lsan_interface.h>
+
+// Large enough to span many pages which hold no pointers.
+void *slots[1 << 16];
+
+int main() {
+  assert(__lsan_do_recoverable_leak_check() == 0);
+  assert(__lsan_do_recoverable_leak_check() == 0);
+  // Store a pointer into a page which was pointer-free during the last check.
+  slots[1 << 15] = malloc(1337);
+  assert(__lsan_do_recoverable_leak_check() == 0);
+  assert(__lsan_do_recoverable_leak_check() == 0);
+  slots[1 << 15] = 0;
+  fprintf(stderr, "Cleared the slot.\n");
+  assert(__lsan_do_recoverable_leak_check() == 1);
+  fprintf(stderr, "Done.\n");
+  return 0;
+}
+// CHECK-NOT: LeakSanitizer: detected memory leaks
+// CHECK: Cleared the slot.
+// CHECK: LeakSanitizer: detected memory leaks
+// CHECK: SUMMARY: {{(Leak|Address)}}Sanitizer: 1337 byte(s) leaked in 1 allocation(s)
+// CHECK: Done.
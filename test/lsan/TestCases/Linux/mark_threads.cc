@@ -0,0 +1,32 @@
+// Test that the reachable set is the same with a parallel flood fill.
+// RUN: LSAN_BASE="detect_leaks=1:use_stacks=0:use_registers=0"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: LSAN_OPTIONS=$LSAN_BASE:"mark_threads=1" not %run %t 2>&1 | FileCheck %s
+// RUN: LSAN_OPTIONS=$LSAN_BASE:"mark_threads=4" not %run %t 2>&1 | FileCheck %s
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Node {
+  Node *left, *right;
+};
+
+// A wide tree gives the flood fill enough work to share between threads.
+static Node *MakeTree(int depth) {
+  Node *n = (Node *)malloc(sizeof(Node));
+  n->left = depth ? MakeTree(depth - 1) : 0;
+  n->right = depth ? MakeTree(depth - 1) : 0;
+  return n;
+}
+
+Node *root;
+
+int main() {
+  root = MakeTree(15);
+  fprintf(stderr, "Test alloc: %p.\n", malloc(1337));
+  return 0;
+}
+// CHECK: Test alloc: [[ADDR:.*]].
+// CHECK: LeakSanitizer: detected memory leaks
+// CHECK-NOT: Direct leak of {{[0-9]+}} byte(s) in {{[0-9]+}} object(s) allocated from:{{.*}}MakeTree
+// CHECK: SUMMARY: {{(Leak|Address)}}Sanitizer: 1337 byte(s) leaked in 1 allocation(s)
@@ -0,0 +1,24 @@
+// Test that only the sampled allocations are reported, with scaled up sizes.
+// RUN: LSAN_BASE="detect_leaks=1:use_registers=0:use_stacks=0"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: LSAN_OPTIONS=$LSAN_BASE:allocation_sample_rate=100 not %run %t 2>&1 | FileCheck %s
+// RUN: LSAN_OPTIONS=$LSAN_BASE not %run %t 2>&1 | FileCheck %s --check-prefix=CHECK-ALL
+// UNSUPPORTED: asan
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void *volatile sink;
+
+int main() {
+  for (int i = 0; i < 10000; i++)
+    sink = malloc(64);
+  sink = 0;
+  fprintf(stderr, "Done.\n");
+  return 0;
+}
+// CHECK: The leak sizes are estimated from 1 in 100 allocations.
+// CHECK: Direct leak of {{[0-9]+}}00 byte(s) in {{[0-9]+}}00 object(s)
+// CHECK: SUMMARY: {{(Leak|Address)}}Sanitizer: {{[0-9]+}}00 byte(s) leaked in {{[0-9]+}}00 allocation(s)
+// CHECK-ALL-NOT: estimated
+// CHECK-ALL: Direct leak of 640000 byte(s) in 10000 object(s)
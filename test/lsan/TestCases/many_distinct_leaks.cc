@@ -0,0 +1,47 @@
+// Test that leaks from many distinct stacks are all accounted for.
+// RUN: LSAN_BASE="detect_leaks=1:use_stacks=0:use_registers=0:max_leaks=1"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: LSAN_OPTIONS=$LSAN_BASE not %run %t 2>&1 | FileCheck %s
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const int kDepth = 13;
+
+// Each value of bits leads to malloc through a distinct stack.
+__attribute__((noinline)) void Leak(unsigned bits, int depth);
+
+__attribute__((noinline)) void Left(unsigned bits, int depth) {
+  Leak(bits, depth);
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) void Right(unsigned bits, int depth) {
+  Leak(bits, depth);
+  asm volatile("" ::: "memory");
+}
+
+void Leak(unsigned bits, int depth) {
+  if (depth == kDepth) {
+    void *volatile p = malloc(1);
+    p = 0;
+    return;
+  }
+  if (bits & (1 << depth))
+    Right(bits, depth + 1);
+  else
+    Left(bits, depth + 1);
+  asm volatile("" ::: "memory");
+}
+
+int main() {
+  for (unsigned bits = 0; bits < (1 << kDepth); bits++)
+    Leak(bits, 0);
+  fprintf(stderr, "Leaked.\n");
+  return 0;
+}
+// CHECK: Leaked.
+// CHECK: LeakSanitizer: detected memory leaks
+// CHECK: The 1 top leak(s):
+// CHECK: Omitting 8191 more leak(s).
+// CHECK: SUMMARY: {{(Leak|Address)}}Sanitizer: 8192 byte(s) leaked in 8192 allocation(s)
@@ -0,0 +1,37 @@
+// RUN: %clangxx_msan -O0 %s -o %t && %run %t
+// RUN: %clangxx_msan -fsanitize-memory-track-origins -O0 %s -o %t && %run %t
+
+// Test that __msan_restore_shadow_snapshot brings back the shadow of the
+// snapshot after each iteration of a persistent fuzzing loop.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sanitizer/msan_interface.h>
+
+static char global[1 << 16];
+
+int main(int argc, char **argv) {
+  const size_t kSize = 1 << 20;
+  char *initialized = (char *)malloc(kSize);
+  memset(initialized, 0, kSize);
+  char *uninitialized = (char *)malloc(100);
+
+  // Soft-dirty page tracking is a kernel configuration option.
+  if (__msan_take_shadow_snapshot()) {
+    fprintf(stderr, "snapshots not supported\n");
+    return 0;
+  }
+  for (int i = 0; i < 3; ++i) {
+    __msan_poison(global, sizeof(global));
+    __msan_poison(initialized + 4096, kSize - 8192);
+    memset(uninitialized, 1, 100);
+    assert(__msan_restore_shadow_snapshot() == 0);
+
+    assert(__msan_test_shadow(global, sizeof(global)) == -1);
+    assert(__msan_test_shadow(initialized, kSize) == -1);
+    assert(__msan_test_shadow(uninitialized, 100) == 0);
+  }
+  return 0;
+}
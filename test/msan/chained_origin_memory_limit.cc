@@ -0,0 +1,39 @@
+// Test that origin_history_memory_limit_mb bounds the number of origin
+// histories, and that reports stop at evicted ones.
+
+// RUN: %clangxx_msan -fsanitize-memory-track-origins=2 -O0 %s -o %t
+// RUN: MSAN_OPTIONS=origin_history_size=0,origin_history_per_stack_limit=0,origin_history_memory_limit_mb=1,print_stats=1 not %run %t >%t.out 2>&1
+// RUN: FileCheck %s < %t.out
+
+// Without the limit the whole history is kept.
+// RUN: MSAN_OPTIONS=origin_history_size=2 not %run %t >%t.out 2>&1
+// RUN: FileCheck %s --check-prefix=CHECK-UNBOUNDED < %t.out
+
+#include <stdlib.h>
+
+volatile int a, b;
+
+int main(int argc, char *argv[]) {
+  int *first = new int;
+  volatile int evicted = *first;
+  // Each store chains a new history onto the last one, so the table of 1 Mb
+  // wraps around.
+  a = *first;
+  for (int i = 0; i < 200000; ++i) {
+    b = a;
+    a = b;
+  }
+  if (evicted)
+    exit(0);
+  return 0;
+}
+
+// CHECK: WARNING: MemorySanitizer: use-of-uninitialized-value
+// CHECK: {{#0 .* in main .*chained_origin_memory_limit.cc:}}[[@LINE-6]]
+// CHECK: The rest of the origin history was evicted
+// CHECK-NOT: Uninitialized value was created
+// CHECK: Evicted origin histories: {{[1-9][0-9]*}}
+
+// CHECK-UNBOUNDED: WARNING: MemorySanitizer: use-of-uninitialized-value
+// CHECK-UNBOUNDED: Uninitialized value was stored to memory at
+// CHECK-UNBOUNDED: Uninitialized value was created by a heap allocation
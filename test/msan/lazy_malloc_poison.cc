@@ -0,0 +1,38 @@
+// Test that large allocations poisoned through lazy_malloc_poison_limit_mb
+// behave like ones poisoned with memset().
+
+// RUN: %clangxx_msan -fsanitize-memory-track-origins -O0 %s -o %t
+// RUN: MSAN_OPTIONS=lazy_malloc_poison_limit_mb=64 not %run %t >%t.out 2>&1
+// RUN: FileCheck %s < %t.out
+// RUN: not %run %t >%t.out 2>&1
+// RUN: FileCheck %s < %t.out
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sanitizer/msan_interface.h>
+
+const size_t kSize = 16 << 20;
+
+int main(int argc, char **argv) {
+  for (int i = 0; i < 3; ++i) {
+    char *p = (char *)malloc(kSize);
+    assert(__msan_test_shadow(p, kSize) == 0);
+    memset(p + 4096, 0, 4096);
+    assert(__msan_test_shadow(p + 4096, kSize - 4096) == 4096);
+    free(p);
+
+    // The shadow is reset along with the mapping.
+    char *q = (char *)calloc(kSize, 1);
+    assert(__msan_test_shadow(q, kSize) == -1);
+    free(q);
+  }
+
+  char *p = (char *)malloc(kSize);
+  if (p[kSize / 2])
+    exit(0);
+  // CHECK: MemorySanitizer: use-of-uninitialized-value
+  // CHECK: Uninitialized value was created by a heap allocation
+  // CHECK: {{#1 .* in main .*lazy_malloc_poison.cc:}}[[@LINE-5]]
+  return 0;
+}
@@ -0,0 +1,47 @@
+// Test that suppress_equal_reports prints each use of uninitialized value once
+// per origin, and counts the repeats.
+
+// RUN: %clangxx_msan -fsanitize-memory-track-origins -fsanitize-recover=memory -O0 %s -o %t
+// RUN: MSAN_OPTIONS=suppress_equal_reports=1 not %run %t >%t.out 2>&1
+// RUN: FileCheck %s < %t.out
+// RUN: not %run %t >%t.out 2>&1
+// RUN: FileCheck %s --check-prefix=CHECK-ALL < %t.out
+
+#include <stdlib.h>
+#include <string.h>
+
+volatile int sink;
+
+__attribute__((noinline)) void Use(int *p) {
+  if (*p)
+    sink = 1;
+}
+
+int main(int argc, char **argv) {
+  int *a = (int *)malloc(sizeof(int));
+  int *b = (int *)malloc(sizeof(int));
+  for (int i = 0; i < 10; ++i)
+    Use(a);
+  Use(b);
+  for (int i = 0; i < 3; ++i)
+    memchr(a, 0, sizeof(*a));
+  free(a);
+  free(b);
+  return 0;
+}
+
+// CHECK: WARNING: MemorySanitizer: use-of-uninitialized-value
+// CHECK: #0 {{.*}} in Use
+// CHECK: WARNING: MemorySanitizer: use-of-uninitialized-value
+// CHECK: #0 {{.*}} in Use
+// CHECK: Uninitialized bytes in __interceptor_memchr
+// CHECK-NOT: WARNING: MemorySanitizer
+// CHECK: MemorySanitizer: 14 warnings reported.
+// CHECK: MemorySanitizer: 3 unique warning sites, 2 of them repeated:
+// CHECK: 10 warnings with origin {{.*}} at
+// CHECK: #0 {{.*}} in Use
+// CHECK: 3 warnings with origin {{.*}} at
+// CHECK: #0 {{.*}} in main
+
+// CHECK-ALL: MemorySanitizer: 14 warnings reported.
+// CHECK-ALL-NOT: unique warning sites
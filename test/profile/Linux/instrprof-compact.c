@@ -0,0 +1,30 @@
+// RUN: rm -fr %t.profdir
+// RUN: %clang_profgen -o %t -O2 %s
+//
+// Compact profiles are smaller than plain ones.
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/plain.profraw %run %t
+// RUN: env LLVM_PROFILE_COMPACT=1 LLVM_PROFILE_FILE=%t.profdir/compact.profraw %run %t
+// RUN: test `wc -c < %t.profdir/compact.profraw` -lt `wc -c < %t.profdir/plain.profraw`
+//
+// They are merged into by the runtime; the last run writes a plain profile.
+// RUN: env LLVM_PROFILE_COMPACT=1 LLVM_PROFILE_FILE=%t.profdir/merge_%m.profraw %run %t
+// RUN: env LLVM_PROFILE_COMPACT=1 LLVM_PROFILE_FILE=%t.profdir/merge_%m.profraw %run %t
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/merge_%m.profraw %run %t
+// RUN: llvm-profdata show --function=foo --counts %t.profdir/merge_*.profraw | FileCheck %s
+
+__attribute__((noinline)) int foo(int X) { return X * 2; }
+
+/* Never called; their counters stay zero. */
+#define UNUSED(N)                                                              \
+  __attribute__((noinline)) int unused##N(int X) { return X ? X + N : N; }
+UNUSED(0) UNUSED(1) UNUSED(2) UNUSED(3) UNUSED(4) UNUSED(5) UNUSED(6)
+UNUSED(7) UNUSED(8) UNUSED(9)
+
+int main(void) {
+  int I, Sum = 0;
+  for (I = 0; I < 10; ++I)
+    Sum += foo(I);
+  return Sum == 90 ? 0 : 1;
+}
+
+// CHECK: Function count: 30
@@ -0,0 +1,28 @@
+// RUN: rm -fr %t.profdir
+// RUN: %clang_profgen -o %t -O2 %s
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/crash_%c.profraw not --crash %run %t crash
+// RUN: llvm-profdata show --function=foo --counts %t.profdir/crash_.profraw | FileCheck %s --check-prefix=CRASH
+//
+// Counters of several runs accumulate in the mapped file with %m.
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/merge_%c%m.profraw %run %t
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/merge_%c%m.profraw %run %t
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/merge_%c%m.profraw not --crash %run %t crash
+// RUN: llvm-profdata merge -o %t.profdata %t.profdir/merge_*.profraw
+// RUN: llvm-profdata show --function=foo --counts %t.profdata | FileCheck %s --check-prefix=MERGE
+
+#include <stdlib.h>
+#include <string.h>
+
+__attribute__((noinline)) int foo(int X) { return X * 2; }
+
+int main(int argc, const char *argv[]) {
+  int I, Sum = 0;
+  for (I = 0; I < 10; ++I)
+    Sum += foo(I);
+  if (argc > 1 && !strcmp(argv[1], "crash"))
+    abort();
+  return Sum == 90 ? 0 : 1;
+}
+
+// CRASH: Function count: 10
+// MERGE: Function count: 30
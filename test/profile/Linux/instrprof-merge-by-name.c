@@ -0,0 +1,54 @@
+// RUN: rm -fr %t.profdir
+// RUN: %clang_profgen -o %t.v1 -O2 %s
+// RUN: %clang_profgen -o %t.v2 -O2 -DV2 %s
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/v1.profraw %run %t.v1
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/v2.profraw %run %t.v2 %t.profdir/v1.profraw
+// RUN: llvm-profdata show --function=foo --counts %t.profdir/v2.profraw | FileCheck %s --check-prefix=FOO
+// RUN: llvm-profdata show --function=bar --counts %t.profdir/v2.profraw | FileCheck %s --check-prefix=BAR
+
+// The second build has an extra function ahead of the others, so the
+// records of the first build's profile are matched by function.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int __llvm_profile_check_compatibility(const char *Profile, uint64_t Size);
+void __llvm_profile_merge_from_buffer(const char *Profile, uint64_t Size);
+
+#ifdef V2
+__attribute__((noinline)) int baz(int X) { return X + 1; }
+#endif
+__attribute__((noinline)) int foo(int X) { return X * 2; }
+__attribute__((noinline)) int bar(int X) { return X * 3; }
+
+static int mergeProfile(const char *Filename) {
+  static char Buffer[1 << 20];
+  size_t Size;
+  FILE *File = fopen(Filename, "rb");
+  if (!File)
+    return 1;
+  Size = fread(Buffer, 1, sizeof(Buffer), File);
+  fclose(File);
+  /* The layouts differ. */
+  if (!__llvm_profile_check_compatibility(Buffer, Size))
+    return 1;
+  __llvm_profile_merge_from_buffer(Buffer, Size);
+  return 0;
+}
+
+int main(int argc, const char *argv[]) {
+  int I, Sum = 0;
+  for (I = 0; I < 10; ++I)
+    Sum += foo(I);
+  for (I = 0; I < 5; ++I)
+    Sum += bar(I);
+#ifdef V2
+  Sum += baz(1);
+#endif
+  if (argc > 1 && mergeProfile(argv[1]))
+    return 1;
+  return Sum > 0 ? 0 : 1;
+}
+
+// FOO: Function count: 20
+// BAR: Function count: 10
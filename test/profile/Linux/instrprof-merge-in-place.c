@@ -0,0 +1,26 @@
+// Many processes finishing at once merge into the same pool files; with no
+// value profiling the counters are added in place without the file lock.
+// RUN: rm -fr %t.profdir
+// RUN: %clang_profgen -o %t -O2 %s
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/pool_%0m.profraw %run %t 1000
+// RUN: llvm-profdata merge -o %t.profdata %t.profdir
+// RUN: llvm-profdata show --function=foo --counts %t.profdata | FileCheck %s
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+__attribute__((noinline)) int foo(int X) { return X + 1; }
+
+int main(int argc, const char *argv[]) {
+  int I, N = atoi(argv[1]), Failed = 0, Status;
+  for (I = 0; I < N; ++I)
+    if (fork() == 0)
+      return foo(I) > 0 ? 0 : 1;
+  while (wait(&Status) > 0)
+    Failed |= !WIFEXITED(Status) || WEXITSTATUS(Status);
+  /* Keep the parent out of the profile. */
+  _exit(Failed);
+}
+
+// CHECK: Function count: 1000
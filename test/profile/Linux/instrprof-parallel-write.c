@@ -0,0 +1,34 @@
+// RUN: rm -fr %t.d
+// RUN: mkdir -p %t.d
+// RUN: %clang_profgen -o %t.d/liba.so -fPIC -shared -DLIB=a %s
+// RUN: %clang_profgen -o %t.d/libb.so -fPIC -shared -DLIB=b %s
+// RUN: %clang_profgen -o %t -Wl,-rpath,%t.d %s %t.d/liba.so %t.d/libb.so -lpthread -ldl
+//
+// All modules append to one file.
+// RUN: env LLVM_PROFILE_PARALLEL_WRITE=1 LLVM_PROFILE_FILE=%t.d/all.profraw %run %t
+// RUN: llvm-profdata merge -o %t.profdata %t.d/all.profraw
+// RUN: llvm-profdata show %t.profdata | FileCheck %s
+//
+// Each module writes its own file.
+// RUN: env LLVM_PROFILE_PARALLEL_WRITE=1 LLVM_PROFILE_FILE=%t.d/each_%m.profraw %run %t
+// RUN: llvm-profdata merge -o %t.each.profdata %t.d/each_*.profraw
+// RUN: llvm-profdata show %t.each.profdata | FileCheck %s
+
+// CHECK: Total functions: 3
+// CHECK: Maximum function count: 3
+
+#ifdef LIB
+#define NAME2(X) lib_##X
+#define NAME(X) NAME2(X)
+int NAME(LIB)(int X) { return X + 1; }
+#else
+int lib_a(int X);
+int lib_b(int X);
+
+int main(void) {
+  int I, Sum = 0;
+  for (I = 0; I < 3; ++I)
+    Sum += lib_a(I) + lib_b(I);
+  return Sum == 12 ? 0 : 1;
+}
+#endif
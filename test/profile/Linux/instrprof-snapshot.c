@@ -0,0 +1,43 @@
+// RUN: rm -fr %t.profdir
+// RUN: mkdir -p %t.profdir
+// RUN: %clang_profgen -o %t -O2 %s -lpthread
+// RUN: env LLVM_PROFILE_FILE=%t.profdir/exit.profraw %run %t %t.profdir
+// RUN: llvm-profdata show --function=foo --counts %t.profdir/startup.profraw | FileCheck %s --check-prefix=STARTUP
+// RUN: llvm-profdata show --function=foo --counts %t.profdir/request.profraw | FileCheck %s --check-prefix=REQUEST
+// RUN: llvm-profdata show --function=foo --counts %t.profdir/exit.profraw | FileCheck %s --check-prefix=EXIT
+
+#include <stdio.h>
+
+int __llvm_profile_snapshot(const char *Filename);
+int __llvm_profile_wait_for_snapshots(void);
+
+__attribute__((noinline)) int foo(int X) { return X * 2; }
+
+static int run(int N) {
+  int I, Sum = 0;
+  for (I = 0; I < N; ++I)
+    Sum += foo(I);
+  return Sum;
+}
+
+int main(int argc, const char *argv[]) {
+  char Filename[4096];
+
+  run(10);
+  snprintf(Filename, sizeof(Filename), "%s/startup.profraw", argv[1]);
+  if (__llvm_profile_snapshot(Filename))
+    return 1;
+
+  run(20);
+  snprintf(Filename, sizeof(Filename), "%s/request.profraw", argv[1]);
+  if (__llvm_profile_snapshot(Filename))
+    return 1;
+
+  /* What's left goes to the profile written at exit. */
+  run(5);
+  return __llvm_profile_wait_for_snapshots();
+}
+
+// STARTUP: Function count: 10
+// REQUEST: Function count: 20
+// EXIT: Function count: 5
@@ -0,0 +1,61 @@
+// RUN: %clang_profgen -o %t -O2 %s -lpthread
+// RUN: env LLVM_PROFILE_FILE=%t.profraw %run %t | FileCheck %s
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+uint64_t *__llvm_profile_begin_counters(void);
+uint64_t *__llvm_profile_thread_counters(void);
+void __llvm_profile_reset_counters(void);
+int __llvm_profile_write_file(void);
+
+#define NUM_THREADS 8
+#define NUM_INCREMENTS 100000
+
+/* Stand in for instrumentation addressing counters through the per-thread
+ * base: bump the copy of the first counter. */
+static void *counterThread(void *Arg) {
+  uint64_t *Counters = __llvm_profile_thread_counters();
+  int I;
+  for (I = 0; I < NUM_INCREMENTS; ++I)
+    Counters[0]++;
+  return 0;
+}
+
+static void run(void) {
+  pthread_t Threads[NUM_THREADS];
+  int I;
+  for (I = 0; I < NUM_THREADS; ++I)
+    pthread_create(&Threads[I], 0, counterThread, 0);
+  for (I = 0; I < NUM_THREADS; ++I)
+    pthread_join(Threads[I], 0);
+}
+
+int main(void) {
+  uint64_t Before = __llvm_profile_begin_counters()[0];
+
+  /* Copies are folded in when the threads exit. */
+  run();
+  // CHECK: after exit: 800000
+  printf("after exit: %llu\n",
+         (unsigned long long)(__llvm_profile_begin_counters()[0] - Before));
+
+  /* The main thread's copy is folded in when the profile is written, only
+   * what was counted since the last fold is added. */
+  __llvm_profile_thread_counters()[0] += 5;
+  __llvm_profile_write_file();
+  __llvm_profile_write_file();
+  // CHECK: after write: 800005
+  printf("after write: %llu\n",
+         (unsigned long long)(__llvm_profile_begin_counters()[0] - Before));
+
+  /* Reset drops what the copies have counted so far. */
+  __llvm_profile_thread_counters()[0] += 7;
+  __llvm_profile_reset_counters();
+  __llvm_profile_write_file();
+  // CHECK: after reset: 0
+  printf("after reset: %llu\n",
+         (unsigned long long)__llvm_profile_begin_counters()[0]);
+  return 0;
+}
@@ -0,0 +1,56 @@
+// RUN: %clang_safestack %s -pthread -o %t
+// RUN: %run %t
+// RUN: %run %t 200 16
+
+// XFAIL: darwin
+
+// Test that threads created and destroyed in batches, whose unsafe stacks are
+// reused from the ones of exited threads, never share a live unsafe stack.
+// With a larger count this doubles as a benchmark of thread churn.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+
+enum { kBufferSize = 8192, kMaxThreads = 64 };
+
+static pthread_barrier_t barrier;
+
+void *t_start(void *arg)
+{
+  int id = (int)(size_t)arg;
+
+  // unsafe stack
+  char buffer[kBufferSize];
+  memset(buffer, id, sizeof(buffer));
+  break_optimization(buffer);
+
+  // Every thread of the batch has written its buffer before any checks it.
+  pthread_barrier_wait(&barrier);
+  for (int i = 0; i < kBufferSize; ++i)
+    if (buffer[i] != (char)id)
+      abort();
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int batches = argc > 1 ? atoi(argv[1]) : 50;
+  int threads = argc > 2 ? atoi(argv[2]) : 8;
+  if (threads < 1 || threads > kMaxThreads)
+    abort();
+
+  pthread_t t[kMaxThreads];
+  pthread_barrier_init(&barrier, NULL, threads);
+  for (int b = 0; b < batches; ++b) {
+    for (int i = 0; i < threads; ++i)
+      if (pthread_create(&t[i], NULL, t_start, (void *)(size_t)(i + 1)))
+        abort();
+    for (int i = 0; i < threads; ++i)
+      if (pthread_join(t[i], NULL))
+        abort();
+  }
+  pthread_barrier_destroy(&barrier);
+  return 0;
+}
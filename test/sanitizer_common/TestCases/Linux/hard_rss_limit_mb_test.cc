@@ -5,6 +5,8 @@
 // RUN: %env_tool_opts=hard_rss_limit_mb=100                           not %run %t 2>&1 | FileCheck %s
 // This run uses getrusage:
 // RUN: %env_tool_opts=hard_rss_limit_mb=100:can_use_proc_maps_statm=0 not %run %t 2>&1 | FileCheck %s
+// This run waits for the memory pressure notifications, where available:
+// RUN: %env_tool_opts=hard_rss_limit_mb=100:rss_limit_on_memory_events=1 not %run %t 2>&1 | FileCheck %s
 //
 // Run w/o limit or with a large enough limit should pass:
 // RUN: %env_tool_opts=hard_rss_limit_mb=1000 %run %t
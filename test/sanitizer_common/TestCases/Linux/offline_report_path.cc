@@ -0,0 +1,24 @@
+// Test that offline_report_path prints unsymbolized frames and writes the raw
+// PCs and the module map to a bundle.
+// RUN: %clangxx -O0 -Wl,--build-id %s -o %t
+// RUN: rm -f %t.bundle.*
+// RUN: %env_tool_opts=offline_report_path=%t.bundle %run %t 2>&1 | FileCheck %s
+// RUN: head -c 8 %t.bundle.* | FileCheck %s --check-prefix=MAGIC
+// RUN: grep -a -c offline_report_path %t.bundle.*
+
+#include <sanitizer/common_interface_defs.h>
+
+static void __attribute__((noinline)) FooBarBaz() {
+  __sanitizer_print_stack_trace();
+}
+
+int main() {
+  FooBarBaz();
+  return 0;
+}
+// CHECK-NOT: FooBarBaz
+// CHECK: {{    #1 0x.* \(.*offline_report_path.cc.tmp\+0x[0-9a-f]+\)}}
+// CHECK-NOT: FooBarBaz
+// CHECK: {{    #2 0x.* \(.*offline_report_path.cc.tmp\+0x[0-9a-f]+\)}}
+
+// MAGIC: SNSBUNDL
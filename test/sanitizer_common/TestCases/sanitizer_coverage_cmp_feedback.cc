@@ -0,0 +1,55 @@
+// Tests the comparison feedback table filled by the default trace-cmp hooks.
+//
+// REQUIRES: stable-runtime
+// XFAIL: tsan,powerpc64,s390x,mips
+//
+// RUN: %clangxx -O0 -fsanitize-coverage=trace-pc-guard,trace-cmp %s -o %t
+// RUN: %run %t 2>&1 | FileCheck %s
+
+#include <sanitizer/coverage_interface.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void FindOperands(uint64_t arg1, uint64_t arg2, uint64_t size) {
+  const __sanitizer_cmp_feedback *entries;
+  uintptr_t n = __sanitizer_get_cmp_feedback(&entries);
+  for (uintptr_t i = 0; i < n; i++) {
+    if (entries[i].pc && entries[i].arg1 == arg1 && entries[i].arg2 == arg2 &&
+        entries[i].size == size) {
+      fprintf(stderr, "found %llx %llx %d\n", (unsigned long long)arg1,
+              (unsigned long long)arg2, (int)size);
+      return;
+    }
+  }
+  fprintf(stderr, "missing %llx %llx %d\n", (unsigned long long)arg1,
+          (unsigned long long)arg2, (int)size);
+}
+
+__attribute__((noinline)) int Check(uint32_t x, uint64_t y) {
+  if (x == 0x12345678)
+    return 1;
+  if (y == 0xdeadbeefcafeULL)
+    return 2;
+  switch (y) {
+  case 10: return 3;
+  case 1000: return 4;
+  case 100000: return 5;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  Check(argc + 41, argc + 998);
+  FindOperands(42, 0x12345678, 4);
+  FindOperands(999, 0xdeadbeefcafeULL, 8);
+  FindOperands(999, 1000, 8);
+  __sanitizer_reset_cmp_feedback();
+  FindOperands(42, 0x12345678, 4);
+  return 0;
+}
+
+// CHECK: found 2a 12345678 4
+// CHECK-NEXT: found 3e7 deadbeefcafe 8
+// CHECK-NEXT: found 3e7 3e8 8
+// CHECK-NEXT: missing 2a 12345678 4
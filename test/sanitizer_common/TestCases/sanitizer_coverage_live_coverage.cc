@@ -0,0 +1,61 @@
+// Tests the live trace-pc-guard coverage file.
+//
+// REQUIRES: stable-runtime,linux
+// XFAIL: tsan,powerpc64,s390x,mips
+//
+// RUN: %clangxx -O0 -fsanitize-coverage=trace-pc-guard %s -o %t
+// RUN: rm -f %t.live
+// RUN: SANCOV_OPTIONS=live_coverage_file=%t.live %t 2>&1 | FileCheck %s
+// RUN: %t 2>&1 | FileCheck --check-prefix=CHECK-NOLIVE %s
+
+#include <sanitizer/coverage_interface.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+__attribute__((noinline)) void foo() { fprintf(stderr, "foo\n"); }
+
+int main(int argc, char **argv) {
+  const uint8_t *map;
+  uintptr_t n = __sanitizer_get_live_coverage(&map);
+  if (!n) {
+    fprintf(stderr, "no live coverage\n");
+    return 0;
+  }
+  fprintf(stderr, "new before reset: %d\n", __sanitizer_reset_live_coverage() > 0);
+  fprintf(stderr, "new after reset: %d\n", (int)__sanitizer_reset_live_coverage());
+  foo();
+  fprintf(stderr, "new after foo: %d\n", (int)__sanitizer_reset_live_coverage());
+  foo();
+  fprintf(stderr, "new after foo again: %d\n", (int)__sanitizer_reset_live_coverage());
+
+  // Another process would see the same bytes through the file.
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.live", argv[0]);
+  int fd = open(path, O_RDONLY);
+  uint64_t *file = (uint64_t *)mmap(0, 64 + n, PROT_READ, MAP_SHARED, fd, 0);
+  fprintf(stderr, "guards match: %d\n", file[1] == n);
+  fprintf(stderr, "bytes match: %d\n",
+          !memcmp((const uint8_t *)file + 64, map, n));
+  uintptr_t num_new = 0;
+  for (uintptr_t i = 0; i < n; i++)
+    num_new += map[i] == 2;
+  fprintf(stderr, "none new: %d\n", num_new == 0);
+  return 0;
+}
+
+// CHECK: new before reset: 1
+// CHECK-NEXT: new after reset: 0
+// CHECK-NEXT: foo
+// CHECK-NEXT: new after foo: 1
+// CHECK-NEXT: foo
+// CHECK-NEXT: new after foo again: 0
+// CHECK-NEXT: guards match: 1
+// CHECK-NEXT: bytes match: 1
+// CHECK-NEXT: none new: 1
+
+// CHECK-NOLIVE: no live coverage
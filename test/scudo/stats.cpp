@@ -0,0 +1,46 @@
+// RUN: %clang_scudo %s -o %t
+// RUN: SCUDO_OPTIONS=LatencySamplePeriod=1 %run %t 2>&1 | FileCheck %s
+
+// Tests the statistics returned by __scudo_get_stats and printed by
+// __scudo_print_stats.
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <sanitizer/scudo_interface.h>
+
+static unsigned long long sum(const unsigned long long *Histogram) {
+  unsigned long long Sum = 0;
+  for (int I = 0; I < __SCUDO_LATENCY_BUCKETS; I++)
+    Sum += Histogram[I];
+  return Sum;
+}
+
+int main(int argc, char **argv)
+{
+  struct __scudo_stats Before, After;
+  __scudo_get_stats(&Before);
+
+  void *P = malloc(1 << 20);
+  assert(P);
+  __scudo_get_stats(&After);
+  assert(After.secondary_chunks == Before.secondary_chunks + 1);
+  assert(After.allocated_bytes >= Before.allocated_bytes + (1 << 20));
+  assert(sum(After.malloc_latency) > sum(Before.malloc_latency));
+  free(P);
+
+  __scudo_get_stats(&After);
+  assert(After.secondary_chunks == Before.secondary_chunks);
+  assert(sum(After.free_latency) > sum(Before.free_latency));
+  assert(After.invalid_headers == 0);
+
+  __scudo_print_stats();
+  return 0;
+}
+
+// CHECK: Scudo: {{[0-9]+}} bytes allocated, {{[0-9]+}} bytes mapped
+// CHECK: Scudo: quarantine holds {{[0-9]+}} bytes out of {{[0-9]+}}
+// CHECK: Scudo: {{[0-9]+}} secondary chunks
+// CHECK: Scudo: 0 invalid chunk headers
+// CHECK: Scudo: malloc latency
+// CHECK: Scudo: free latency
@@ -0,0 +1,39 @@
+// RUN: %clangxx_tsan -O1 %s -o %t
+// RUN: %env_tsan_opts=flush_memory_ms=100:flush_cold_shadow_only=1 %deflake %run %t 2>&1 | FileCheck %s
+#include "test.h"
+
+// Check that flush_cold_shadow_only keeps the history of memory that is
+// accessed between the flushes: the write in Thread is still known when main
+// races with it more than a second later.
+
+struct Data {
+  int racy;
+  int hot[64];
+};
+
+Data data;
+
+void *Thread(void *x) {
+  data.racy = 1;
+  barrier_wait(&barrier);
+  return NULL;
+}
+
+int main() {
+  barrier_init(&barrier, 2);
+  pthread_t t;
+  pthread_create(&t, NULL, Thread, NULL);
+  barrier_wait(&barrier);
+  unsigned long long tp0 = monotonic_clock_ns();
+  while (monotonic_clock_ns() - tp0 < 1500 * 1000000ull) {
+    for (int i = 0; i < 64; i++)
+      data.hot[i]++;
+  }
+  data.racy = 2;
+  pthread_join(t, NULL);
+  fprintf(stderr, "DONE\n");
+  return 0;
+}
+
+// CHECK: WARNING: ThreadSanitizer: data race
+// CHECK: DONE
@@ -0,0 +1,49 @@
+// Test that access_sample_period still finds races on enough distinct cells,
+// and that synchronization is tracked precisely for the cells it skips.
+// RUN: %clangxx_tsan -O1 %s -o %t
+// RUN: %env_tsan_opts=access_sample_period=64 %deflake %run %t 2>&1 | FileCheck %s
+// RUN: %env_tsan_opts=access_sample_period=64:access_sample_seed=42 %deflake %run %t 2>&1 | FileCheck %s
+#include "test.h"
+
+const int kCells = 4096;
+long racy[kCells];
+long guarded[kCells];
+pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+
+void *Thread1(void *x) {
+  barrier_wait(&barrier);
+  for (int i = 0; i < kCells; i++)
+    racy[i]++;
+  pthread_mutex_lock(&mu);
+  for (int i = 0; i < kCells; i++)
+    guarded[i]++;
+  pthread_mutex_unlock(&mu);
+  return NULL;
+}
+
+void *Thread2(void *x) {
+  for (int i = 0; i < kCells; i++)
+    racy[i]--;
+  pthread_mutex_lock(&mu);
+  for (int i = 0; i < kCells; i++)
+    guarded[i]--;
+  pthread_mutex_unlock(&mu);
+  barrier_wait(&barrier);
+  return NULL;
+}
+
+int main() {
+  barrier_init(&barrier, 2);
+  pthread_t t[2];
+  pthread_create(&t[0], NULL, Thread1, NULL);
+  pthread_create(&t[1], NULL, Thread2, NULL);
+  pthread_join(t[0], NULL);
+  pthread_join(t[1], NULL);
+  fprintf(stderr, "DONE\n");
+  return 0;
+}
+
+// CHECK: WARNING: ThreadSanitizer: data race
+// CHECK: Location is global 'racy'
+// CHECK-NOT: Location is global 'guarded'
+// CHECK: DONE
@@ -0,0 +1,39 @@
+// RUN: %clangxx_tsan -O1 %s -o %t
+// RUN: %env_tsan_opts=adaptive_history=1 %deflake %run %t 2>&1 | FileCheck %s
+#include "test.h"
+
+// The trace starts with two parts and has to grow while the thread below
+// produces a burst of events; the previous stack must still be restorable.
+
+int Global;
+
+__attribute__((noinline)) void Busy(int i) {
+  volatile int x = i;
+  (void)x;
+}
+
+__attribute__((noinline)) void WriteGlobal() {
+  Global = 1;
+}
+
+void *Thread1(void *x) {
+  WriteGlobal();
+  for (int i = 0; i < 20000; i++)
+    Busy(i);
+  barrier_wait(&barrier);
+  return NULL;
+}
+
+int main() {
+  barrier_init(&barrier, 2);
+  pthread_t t;
+  pthread_create(&t, NULL, Thread1, NULL);
+  barrier_wait(&barrier);
+  Global = 2;
+  pthread_join(t, NULL);
+  return 0;
+}
+
+// CHECK: WARNING: ThreadSanitizer: data race
+// CHECK:   Previous write of size 4
+// CHECK:     #0 WriteGlobal{{.*}}adaptive_history.cc
@@ -0,0 +1,51 @@
+// RUN: %clangxx_tsan -O1 %s -o %t && %deflake %run %t 2>&1 | FileCheck %s
+#include "test.h"
+
+extern "C" {
+void __tsan_read_batch(void *addr, unsigned long size, unsigned long stride,
+                       unsigned long n);
+void __tsan_write_batch(void *addr, unsigned long size, unsigned long stride,
+                        unsigned long n);
+void __tsan_unaligned_read_batch(void *addr, unsigned long size,
+                                 unsigned long stride, unsigned long n);
+}
+
+int data[16];
+
+void __attribute__((noinline)) Writer() {
+  // Even elements.
+  __tsan_write_batch(&data[0], sizeof(data[0]), 2 * sizeof(data[0]), 8);
+}
+
+void __attribute__((noinline)) Reader() {
+  // Odd elements, twice: does not race.
+  __tsan_read_batch(&data[1], sizeof(data[0]), 2 * sizeof(data[0]), 8);
+  __tsan_read_batch(&data[1], sizeof(data[0]), 2 * sizeof(data[0]), 8);
+  // Bytes 14..17 race with data[4].
+  __tsan_unaligned_read_batch((char*)data + 14, 4, 4, 1);
+}
+
+void *Thread(void *x) {
+  Writer();
+  barrier_wait(&barrier);
+  return NULL;
+}
+
+int main() {
+  barrier_init(&barrier, 2);
+  pthread_t t;
+  pthread_create(&t, NULL, Thread, NULL);
+  barrier_wait(&barrier);
+  Reader();
+  pthread_join(t, NULL);
+  fprintf(stderr, "DONE\n");
+  return 0;
+}
+
+// CHECK: WARNING: ThreadSanitizer: data race
+// CHECK:   Read of size 2 at [[ADDR:0x[0-9a-f]+]] by main thread:
+// CHECK:     #0 Reader
+// CHECK:   Previous write of size 4 at [[ADDR]] by thread T1:
+// CHECK:     #0 Writer
+// CHECK-NOT: WARNING: ThreadSanitizer
+// CHECK: DONE
@@ -0,0 +1,86 @@
+// RUN: %clangxx_tsan %s -o %t
+// RUN: %run %t 2>&1 | FileCheck %s
+
+// bench.h needs pthread barriers which are not available on OS X
+// UNSUPPORTED: darwin
+
+#include "bench.h"
+
+// Bounded multi-producer multi-consumer queue (Vyukov's design): every slot
+// has a sequence number that producers and consumers poll with acquire
+// loads and advance with release stores; positions are claimed with CAS.
+
+const int kQueueSize = 1024;
+
+struct Cell {
+  unsigned long seq;
+  int data;
+};
+
+Cell queue[kQueueSize];
+unsigned long enqueue_pos;
+unsigned long dequeue_pos;
+
+bool enqueue(int data) {
+  unsigned long pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    Cell *cell = &queue[pos % kQueueSize];
+    unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    long diff = (long)seq - (long)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, false,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        cell->data = data;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+bool dequeue(int *data) {
+  unsigned long pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    Cell *cell = &queue[pos % kQueueSize];
+    unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    long diff = (long)seq - (long)(pos + 1);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&dequeue_pos, &pos, pos + 1, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        *data = cell->data;
+        __atomic_store_n(&cell->seq, pos + kQueueSize, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void thread(int tid) {
+  if (tid % 2 == 0) {
+    for (int i = 0; i < bench_niter; i++)
+      while (!enqueue(i)) {
+      }
+  } else {
+    int data;
+    for (int i = 0; i < bench_niter; i++)
+      while (!dequeue(&data)) {
+      }
+  }
+}
+
+void bench() {
+  for (int i = 0; i < kQueueSize; i++)
+    queue[i].seq = i;
+  // Producers and consumers must match, otherwise someone spins forever.
+  start_thread_group(bench_nthread & ~1, thread);
+}
+
+// CHECK: DONE
@@ -0,0 +1,45 @@
+// RUN: %clangxx_tsan -O1 %s -o %t && %run %t 2>&1 | FileCheck %s
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Check that repeated reads from a pipe still synchronize with a write done
+// by another thread after the first read.
+
+int fds[2];
+int X;
+int Y;
+
+void *Thread1(void *x) {
+  X = 42;
+  write(fds[1], "ab", 2);
+  return NULL;
+}
+
+void *Thread2(void *x) {
+  Y = 42;
+  write(fds[1], "c", 1);
+  return NULL;
+}
+
+int main() {
+  pipe(fds);
+  char buf;
+  pthread_t t[2];
+  pthread_create(&t[0], NULL, Thread1, NULL);
+  while (read(fds[0], &buf, 1) != 1) {
+  }
+  while (read(fds[0], &buf, 1) != 1) {
+  }
+  X = 43;
+  pthread_create(&t[1], NULL, Thread2, NULL);
+  while (read(fds[0], &buf, 1) != 1) {
+  }
+  Y = 43;
+  pthread_join(t[0], NULL);
+  pthread_join(t[1], NULL);
+  fprintf(stderr, "OK\n");
+}
+
+// CHECK-NOT: WARNING: ThreadSanitizer: data race
+// CHECK: OK
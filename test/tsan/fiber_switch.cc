@@ -0,0 +1,57 @@
+// RUN: %clangxx_tsan -O1 %s -o %t
+// RUN: %run %t 2>&1 | FileCheck %s
+// RUN: %deflake %run %t no_sync 2>&1 | FileCheck %s --check-prefix=CHECK-NOSYNC
+#include "test.h"
+#include <sanitizer/tsan_interface.h>
+#include <string.h>
+#include <ucontext.h>
+
+char stack[64 * 1024] __attribute__((aligned(16)));
+ucontext_t main_uc, fiber_uc;
+void *main_fiber, *fiber;
+unsigned switch_flags;
+int Global;
+
+void FiberMain() {
+  while (true) {
+    Global++;
+    __tsan_switch_to_fiber(main_fiber, switch_flags);
+    swapcontext(&fiber_uc, &main_uc);
+  }
+}
+
+void RunFiber() {
+  __tsan_switch_to_fiber(fiber, switch_flags);
+  swapcontext(&main_uc, &fiber_uc);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "no_sync"))
+    switch_flags = __tsan_switch_to_fiber_no_sync;
+  main_fiber = __tsan_get_current_fiber();
+
+  // Create and destroy many fibers, which reuses their states.
+  for (int i = 0; i < 1000; i++)
+    __tsan_destroy_fiber(__tsan_create_fiber(0));
+
+  fiber = __tsan_create_fiber(0);
+  __tsan_set_fiber_name(fiber, "fiber");
+  getcontext(&fiber_uc);
+  fiber_uc.uc_stack.ss_sp = stack;
+  fiber_uc.uc_stack.ss_size = sizeof(stack);
+  makecontext(&fiber_uc, FiberMain, 0);
+  for (int i = 0; i < 10; i++) {
+    Global++;
+    RunFiber();
+  }
+  __tsan_destroy_fiber(fiber);
+  fprintf(stderr, "Global=%d\n", Global);
+  return 0;
+}
+
+// CHECK-NOT: WARNING: ThreadSanitizer: data race
+// CHECK: Global=20
+
+// CHECK-NOSYNC: WARNING: ThreadSanitizer: data race
+// CHECK-NOSYNC: Thread T{{[0-9]+}} 'fiber'
+// CHECK-NOSYNC: Global=20
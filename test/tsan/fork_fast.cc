@@ -0,0 +1,47 @@
+// RUN: %clangxx_tsan -O1 %s -o %t
+// RUN: %env_tsan_opts=fast_fork=1 %run %t 2>&1 | FileCheck %s
+// Test that with fast_fork the child starts with a clean shadow, and that the
+// shadow is back before the instrumented atfork handlers run.
+#include "test.h"
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+int Global;
+int AtforkCalls;
+
+static void AtforkChild() {
+  AtforkCalls++;
+}
+
+static void *Thread(void *p) {
+  Global = 42;
+  barrier_wait(&barrier);
+  return 0;
+}
+
+int main() {
+  barrier_init(&barrier, 2);
+  pthread_atfork(0, 0, AtforkChild);
+  pthread_t th;
+  pthread_create(&th, 0, Thread, 0);
+  barrier_wait(&barrier);
+  pthread_join(th, 0);
+  switch (fork()) {
+  default:  // parent
+    while (wait(0) < 0) {}
+    break;
+  case 0:  // child
+    Global++;
+    fprintf(stderr, "child Global=%d AtforkCalls=%d\n", Global, AtforkCalls);
+    exit(0);
+  case -1:  // error
+    fprintf(stderr, "failed to fork (%d)\n", errno);
+    exit(1);
+  }
+  fprintf(stderr, "parent Global=%d\n", Global);
+}
+
+// CHECK-NOT: WARNING: ThreadSanitizer
+// CHECK: child Global=43 AtforkCalls=1
+// CHECK: parent Global=42
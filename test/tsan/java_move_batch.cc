@@ -0,0 +1,54 @@
+// RUN: %clangxx_tsan -O1 %s -o %t && %deflake %run %t | FileCheck %s
+#include "java.h"
+
+jptr varaddr;
+jptr lockaddr;
+jptr varaddr2;
+jptr lockaddr2;
+
+void *Thread(void *p) {
+  barrier_wait(&barrier);
+  // The first object is still protected by the moved lock,
+  // the second one is not.
+  __tsan_java_mutex_lock(lockaddr2);
+  *(int*)varaddr2 = 43;
+  __tsan_java_mutex_unlock(lockaddr2);
+  *(int*)(varaddr2 + 64) = 43;
+  return 0;
+}
+
+int main() {
+  barrier_init(&barrier, 2);
+  int const kHeapSize = 1024 * 1024;
+  void *jheap = (char*)malloc(kHeapSize + 8) + 8;
+  __tsan_java_init((jptr)jheap, kHeapSize);
+  const int kBlockSize = 64;
+  // Two adjacent objects slide down by kMove bytes, overlapping themselves.
+  const int kMove = 32;
+  varaddr = (jptr)jheap + 256;
+  lockaddr = varaddr + 8;
+  __tsan_java_alloc(varaddr, kBlockSize);
+  __tsan_java_alloc(varaddr + kBlockSize, kBlockSize);
+  pthread_t th;
+  pthread_create(&th, 0, Thread, 0);
+  __tsan_java_mutex_lock(lockaddr);
+  *(int*)varaddr = 42;
+  __tsan_java_mutex_unlock(lockaddr);
+  *(int*)(varaddr + kBlockSize) = 42;
+  jptr moves[] = {
+    varaddr, varaddr - kMove, kBlockSize,
+    varaddr + kBlockSize, varaddr + kBlockSize - kMove, kBlockSize,
+  };
+  __tsan_java_move_batch(moves, 2);
+  varaddr2 = varaddr - kMove;
+  lockaddr2 = lockaddr - kMove;
+  barrier_wait(&barrier);
+  pthread_join(th, 0);
+  __tsan_java_free(varaddr2, 2 * kBlockSize);
+  fprintf(stderr, "DONE\n");
+  return __tsan_java_fini();
+}
+
+// CHECK: WARNING: ThreadSanitizer: data race
+// CHECK-NOT: WARNING: ThreadSanitizer: data race
+// CHECK: DONE
@@ -0,0 +1,50 @@
+// RUN: %clangxx_tsan -O1 %s -o %t
+// RUN: rm -f %t.stats.*
+// RUN: %env_tsan_opts=live_stats_path=%t.stats:live_stats_ms=100 %run %t %t.stats 2>&1 | FileCheck %s
+#include "test.h"
+#include <string.h>
+
+// The background thread keeps a snapshot of the statistics up to date while
+// the program runs.
+
+int Global;
+
+void *Thread(void *x) {
+  Global = 1;
+  barrier_wait(&barrier);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  barrier_init(&barrier, 2);
+  pthread_t t;
+  pthread_create(&t, NULL, Thread, NULL);
+  barrier_wait(&barrier);
+  Global = 2;
+  pthread_join(t, NULL);
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.%d", argv[1], (int)getpid());
+  char buf[4096] = {};
+  for (int i = 0; i < 100; i++) {
+    usleep(100 * 1000);
+    FILE *f = fopen(path, "r");
+    if (!f)
+      continue;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = 0;
+    fclose(f);
+    if (strstr(buf, "races_reported 1"))
+      break;
+  }
+  fprintf(stderr, "%s", buf);
+  fprintf(stderr, "DONE\n");
+}
+
+// CHECK: WARNING: ThreadSanitizer: data race
+// CHECK: uptime_ms
+// CHECK: threads {{[0-9]+}}
+// CHECK: events
+// CHECK: races_reported 1
+// CHECK: sync_uids
+// CHECK: memory RSS
+// CHECK: DONE
@@ -0,0 +1,40 @@
+// RUN: %clangxx_tsan -O1 %s -o %t && %run %t 2>&1 | FileCheck %s
+// Check that mutexes that are destroyed and recreated at the same address
+// (heap reuse or re-init of the same storage) still synchronize threads.
+#include "test.h"
+
+int Data;
+pthread_mutex_t *Mtx;
+
+void *Thread(void *x) {
+  pthread_mutex_lock(Mtx);
+  Data++;
+  pthread_mutex_unlock(Mtx);
+  return 0;
+}
+
+void Round() {
+  pthread_t t[2];
+  for (int i = 0; i < 2; i++)
+    pthread_create(&t[i], 0, Thread, 0);
+  for (int i = 0; i < 2; i++)
+    pthread_join(t[i], 0);
+}
+
+int main() {
+  for (int i = 0; i < 10; i++) {
+    Mtx = (pthread_mutex_t*)malloc(sizeof(*Mtx));
+    pthread_mutex_init(Mtx, 0);
+    Round();
+    pthread_mutex_destroy(Mtx);
+    pthread_mutex_init(Mtx, 0);
+    Round();
+    pthread_mutex_destroy(Mtx);
+    free(Mtx);
+  }
+  fprintf(stderr, "DONE %d\n", Data);
+  return 0;
+}
+
+// CHECK-NOT: WARNING: ThreadSanitizer
+// CHECK: DONE 40
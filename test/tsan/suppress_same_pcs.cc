@@ -0,0 +1,52 @@
+// RUN: %clangxx_tsan -O1 %s -o %t
+// RUN: %env_tsan_opts=suppress_equal_pcs=1 %deflake %run %t | FileCheck %s
+#include <pthread.h>
+
+// The races below are between the same instructions but reached through
+// different callers, so only suppress_equal_pcs deduplicates them.
+
+volatile int N;  // Prevent loop unrolling.
+int **data;
+
+__attribute__((noinline)) void Write(int *p) {
+  *p = 42;
+}
+
+__attribute__((noinline)) void WriteFromA(int *p) {
+  Write(p);
+}
+
+__attribute__((noinline)) void WriteFromB(int *p) {
+  Write(p);
+}
+
+__attribute__((noinline)) void WriteFromC(int *p) {
+  Write(p);
+}
+
+void *Thread1(void *x) {
+  for (int i = 0; i < N; i++)
+    WriteFromA(data[i]);
+  return 0;
+}
+
+int main() {
+  N = 4;
+  data = new int*[N];
+  for (int i = 0; i < N; i++)
+    data[i] = new int;
+  pthread_t t;
+  pthread_create(&t, 0, Thread1, 0);
+  for (int i = 0; i < N; i++) {
+    if (i % 2)
+      WriteFromB(data[i]);
+    else
+      WriteFromC(data[i]);
+  }
+  pthread_join(t, 0);
+  for (int i = 0; i < N; i++)
+    delete data[i];
+  delete[] data;
+}
+
+// CHECK: ThreadSanitizer: reported 1 warnings
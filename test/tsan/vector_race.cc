@@ -0,0 +1,48 @@
+// RUN: %clangxx_tsan -O1 %s -o %t && %deflake %run %t 2>&1 | FileCheck %s
+#include "test.h"
+
+extern "C" {
+void __tsan_write32(void *addr);
+void __tsan_read64(void *addr);
+void __tsan_unaligned_read32(const void *addr);
+}
+
+char data[128] __attribute__((aligned(64)));
+
+void __attribute__((noinline)) Writer() {
+  // Bytes 32..63.
+  __tsan_write32(&data[32]);
+}
+
+void __attribute__((noinline)) Reader() {
+  // Bytes 64..127 and 0..31 do not race.
+  __tsan_read64(&data[64]);
+  __tsan_unaligned_read32(&data[0]);
+  // Bytes 60..91 race with the writer.
+  __tsan_unaligned_read32(&data[60]);
+}
+
+void *Thread(void *x) {
+  Writer();
+  barrier_wait(&barrier);
+  return NULL;
+}
+
+int main() {
+  barrier_init(&barrier, 2);
+  pthread_t t;
+  pthread_create(&t, NULL, Thread, NULL);
+  barrier_wait(&barrier);
+  Reader();
+  pthread_join(t, NULL);
+  fprintf(stderr, "DONE\n");
+  return 0;
+}
+
+// CHECK: WARNING: ThreadSanitizer: data race
+// CHECK:   Read of size 4 at {{0x[0-9a-f]+}} by main thread:
+// CHECK:     #0 Reader
+// CHECK:   Previous write of size 8 at {{0x[0-9a-f]+}} by thread T1:
+// CHECK:     #0 Writer
+// CHECK-NOT: WARNING: ThreadSanitizer
+// CHECK: DONE
@@ -0,0 +1,31 @@
+// RUN: %clangxx -fsanitize=signed-integer-overflow,shift %s -O0 -o %t
+// RUN: %env_ubsan_opts=minimal_reporting=1 %run %t 2>&1 | FileCheck %s
+// RUN: %clangxx -fsanitize=signed-integer-overflow,shift -fno-sanitize-recover=all %s -O0 -o %t-abort
+// RUN: %env_ubsan_opts=minimal_reporting=1 not %run %t-abort 2>&1 | FileCheck %s --check-prefix=CHECK-ABORT
+
+#include <limits.h>
+#include <stdio.h>
+
+int overflow(int i) { return i + 1; }
+int shift(int i, int n) { return i << n; }
+
+int main() {
+  // CHECK-NOT: runtime error
+  // CHECK-ABORT-NOT: runtime error
+  volatile int sum = 0;
+  for (int i = 0; i < 10; ++i) {
+    sum += overflow(INT_MAX);
+    sum += shift(1, 32 + i);
+  }
+  // CHECK: End
+  fprintf(stderr, "End\n");
+  return 0;
+}
+
+// CHECK: 2 distinct errors recorded
+// CHECK-DAG: signed-integer-overflow at 0x{{.*}}minimal-reporting.cpp.tmp+0x
+// CHECK-DAG: shift-exponent at 0x{{.*}}minimal-reporting.cpp.tmp+0x
+
+// CHECK-ABORT-NOT: End
+// CHECK-ABORT: 1 distinct errors recorded
+// CHECK-ABORT-NEXT: signed-integer-overflow at 0x
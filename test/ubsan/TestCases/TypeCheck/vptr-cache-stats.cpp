@@ -0,0 +1,39 @@
+// RUN: %clangxx -frtti -fsanitize=vptr -g %s -O0 -o %t
+// RUN: %env_ubsan_opts=print_type_cache_stats=1 %run %t 2>&1 | FileCheck %s
+
+// REQUIRES: cxxabi
+
+// Checks more (vptr, type) pairs than fit in the inline cache; each one
+// should only miss all of the caches once.
+
+struct Base {
+  virtual ~Base() {}
+  int x;
+};
+
+template <int N> struct Derived : Base {};
+
+static Base *Objects[256];
+
+template <int N> struct Fill {
+  static void fill() {
+    Objects[N - 1] = new Derived<N>();
+    Fill<N - 1>::fill();
+  }
+};
+template <> struct Fill<0> {
+  static void fill() {}
+};
+
+int main() {
+  Fill<256>::fill();
+  int Sum = 0;
+  for (int Round = 0; Round < 100; ++Round)
+    for (int I = 0; I < 256; ++I)
+      Sum += Objects[I]->x;
+  return Sum & 0;
+}
+
+// CHECK-NOT: runtime error
+// CHECK: vptr type cache: {{[0-9]+}} thread cache hits, {{[0-9]+}} hash set hits, 256 misses, 0 mismatches
+// CHECK: vptr hash set: 256 entries in 65536 slots
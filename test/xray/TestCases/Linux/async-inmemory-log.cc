@@ -0,0 +1,28 @@
+// Check that the naive log writes out all the records when they are written
+// from the writer thread, with and without mapping the log file.
+
+// RUN: %clangxx_xray -std=c++11 %s -o %t
+// RUN: rm -f async-inmemory-log-*
+// RUN: XRAY_OPTIONS="patch_premain=true xray_naive_log=true xray_naive_log_async=true verbosity=1 xray_logfile_base=async-inmemory-log-" %run %t 2>&1 | FileCheck %s
+// RUN: cat async-inmemory-log-* | wc -c | FileCheck %s --check-prefix=SIZE
+// RUN: rm -f async-inmemory-log-*
+// RUN: XRAY_OPTIONS="patch_premain=true xray_naive_log=true xray_naive_log_async=true xray_naive_log_mmap=true verbosity=1 xray_logfile_base=async-inmemory-log-" %run %t 2>&1 | FileCheck %s
+// RUN: cat async-inmemory-log-* | wc -c | FileCheck %s --check-prefix=SIZE
+// RUN: rm -f async-inmemory-log-*
+
+#include <cstdio>
+
+int calls = 0;
+
+[[clang::xray_always_instrument]] void foo() { ++calls; }
+
+int main() {
+  // CHECK: XRay: Log file in 'async-inmemory-log-{{.*}}'
+  for (int i = 0; i < 1500; ++i)
+    foo();
+  printf("calls: %d\n", calls);
+  // CHECK: calls: 1500
+}
+
+// One 32-byte header, and an entry and exit record per call.
+// SIZE: 96032
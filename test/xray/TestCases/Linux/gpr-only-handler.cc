@@ -0,0 +1,56 @@
+// Check that a handler installed with __xray_set_handler_gpr_only() gets the
+// entry and exit events, that the floating point arguments and return values
+// of the instrumented function survive, and that __xray_set_handler() and
+// sampling still work after it.
+//
+// RUN: %clangxx_xray -fxray-instrument -std=c++11 %s -o %t
+// RUN: XRAY_OPTIONS="patch_premain=false" %run %t 2>&1 | FileCheck %s
+// REQUIRES: x86_64-target-arch
+
+#include "xray/xray_interface.h"
+
+#include <cstdio>
+
+int entries, exits;
+
+// Only touches general purpose registers.
+[[clang::xray_never_instrument]] void counting_handler(int32_t,
+                                                       XRayEntryType type) {
+  if (type == XRayEntryType::ENTRY)
+    ++entries;
+  else
+    ++exits;
+}
+
+[[clang::xray_always_instrument]] double
+scale(double a, double b, double c, double d, double e, double f, double g,
+      double h) {
+  return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h;
+}
+
+int main() {
+  __xray_patch();
+  __xray_set_handler_gpr_only(counting_handler);
+  double r = scale(1, 1, 1, 1, 1, 1, 1, 1);
+  printf("result: %g, entries: %d, exits: %d\n", r, entries, exits);
+  // CHECK: result: 36, entries: 1, exits: 1
+  __xray_set_handler(counting_handler);
+  r = scale(1, 2, 3, 4, 5, 6, 7, 8);
+  printf("result: %g, entries: %d, exits: %d\n", r, entries, exits);
+  // CHECK-NEXT: result: 204, entries: 2, exits: 2
+  __xray_set_handler_gpr_only(counting_handler);
+  __xray_set_sampling_rate(2);
+  for (int i = 0; i < 4; i++)
+    r = scale(1, 1, 1, 1, 1, 1, 1, 1);
+  printf("result: %g, entries: %d, exits: %d\n", r, entries, exits);
+  // CHECK-NEXT: result: 36, entries: 4, exits: 4
+  __xray_set_sampling_rate(1);
+  r = scale(1, 1, 1, 1, 1, 1, 1, 1);
+  printf("result: %g, entries: %d, exits: %d\n", r, entries, exits);
+  // CHECK-NEXT: result: 36, entries: 5, exits: 5
+  __xray_remove_handler();
+  r = scale(1, 1, 1, 1, 1, 1, 1, 1);
+  printf("result: %g, entries: %d, exits: %d\n", r, entries, exits);
+  // CHECK-NEXT: result: 36, entries: 5, exits: 5
+  __xray_unpatch();
+}
@@ -0,0 +1,66 @@
+// Check that we can patch a single function, and that sampling forwards the
+// entries and exits of the same calls.
+//
+// RUN: %clangxx_xray -fxray-instrument -std=c++11 %s -o %t
+// RUN: XRAY_OPTIONS="patch_premain=false" %run %t 2>&1 | FileCheck %s
+
+#include "xray/xray_interface.h"
+
+#include <cstdio>
+
+int32_t last_fid = 0;
+int calls = 0;
+
+void test_handler(int32_t fid, XRayEntryType type) {
+  last_fid = fid;
+  ++calls;
+  printf("called: type=%d\n", static_cast<int32_t>(type));
+}
+
+[[clang::xray_always_instrument]] void foo() { printf("foo called\n"); }
+
+[[clang::xray_always_instrument]] void bar() { printf("bar called\n"); }
+
+int main() {
+  __xray_set_handler(test_handler);
+  __xray_patch();
+  foo();
+  int32_t foo_id = last_fid;
+  bar();
+  int32_t bar_id = last_fid;
+  __xray_unpatch();
+  printf("distinct ids: %d\n", foo_id != bar_id);
+  // CHECK: distinct ids: 1
+
+  auto status = __xray_patch_function(bar_id);
+  printf("patching status: %d\n", static_cast<int32_t>(status));
+  // CHECK-NEXT: patching status: 1
+  foo();
+  // CHECK-NEXT: foo called
+  bar();
+  // CHECK-NEXT: called: type=0
+  // CHECK-NEXT: bar called
+  // CHECK-NEXT: called: type=1
+  status = __xray_unpatch_function(bar_id);
+  printf("patching status: %d\n", static_cast<int32_t>(status));
+  // CHECK-NEXT: patching status: 1
+  bar();
+  // CHECK-NEXT: bar called
+  status = __xray_patch_function(0);
+  printf("patching status: %d\n", static_cast<int32_t>(status));
+  // CHECK-NEXT: patching status: 3
+
+  __xray_set_sampling_rate(3);
+  __xray_patch_function(foo_id);
+  calls = 0;
+  for (int i = 0; i < 6; ++i)
+    foo();
+  printf("sampled calls: %d\n", calls);
+  // CHECK: sampled calls: 4
+  __xray_set_sampling_rate(0);
+  calls = 0;
+  foo();
+  printf("unsampled calls: %d\n", calls);
+  // CHECK: unsampled calls: 2
+  __xray_unpatch();
+}
@@ -0,0 +1,46 @@
+// Check that we can patch on a background thread, and that we're told when
+// it's done.
+//
+// RUN: %clangxx_xray -fxray-instrument -std=c++11 %s -o %t
+// RUN: XRAY_OPTIONS="patch_premain=false" %run %t 2>&1 | FileCheck %s
+
+#include "xray/xray_interface.h"
+
+#include <atomic>
+#include <cstdio>
+#include <sched.h>
+
+std::atomic<int> done_status{-1};
+
+void test_handler(int32_t fid, XRayEntryType type) {
+  printf("called: type=%d\n", static_cast<int32_t>(type));
+}
+
+void patching_done(XRayPatchingStatus status) {
+  done_status.store(static_cast<int32_t>(status));
+}
+
+[[clang::xray_always_instrument]] void always_instrument() {
+  printf("always instrumented called\n");
+}
+
+int main() {
+  __xray_set_handler(test_handler);
+  auto status = __xray_patch_in_background(patching_done);
+  printf("patching status: %d\n", static_cast<int32_t>(status));
+  // CHECK: patching status: 1
+  while (done_status.load() == -1)
+    sched_yield();
+  printf("done status: %d, in progress: %d\n", done_status.load(),
+         __xray_patching_in_progress());
+  // CHECK-NEXT: done status: 1, in progress: 0
+  always_instrument();
+  // CHECK-NEXT: called: type=0
+  // CHECK-NEXT: always instrumented called
+  // CHECK-NEXT: called: type=1
+  status = __xray_unpatch();
+  printf("patching status: %d\n", static_cast<int32_t>(status));
+  // CHECK-NEXT: patching status: 1
+  always_instrument();
+  // CHECK-NEXT: always instrumented called
+}